@@ -43,6 +43,22 @@ class Film : public TaggedPointer<RGBFilm, GBufferFilm> {
     PBRT_CPU_GPU inline Bounds2i PixelBounds() const;
     PBRT_CPU_GPU inline Float Diagonal() const;
 
+    // Until MergeTile() is called, samples that the calling thread adds to
+    // pixels inside _tileBounds_ are accumulated in a buffer of its own,
+    // which MergeTile() then adds to the film's pixels.
+    void StartTile(Bounds2i tileBounds);
+    void MergeTile();
+
+    // Streaming films only store the pixels of one band of scanlines at a time:
+    // all of a band's samples must be added between StartBand() and EndBand(),
+    // which writes the band's pixels to the image file and frees them. Bands
+    // are _StreamingBandHeight()_ scanlines high (the last may be shorter) and
+    // must be rendered in top-to-bottom order. Non-streaming films return 0
+    // from StreamingBandHeight().
+    int StreamingBandHeight() const;
+    void StartBand(Bounds2i bandBounds);
+    void EndBand(ImageMetadata metadata, Float splatScale = 1);
+
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
 
     PBRT_CPU_GPU inline RGB ToOutputRGB(const SampledSpectrum &L,
@@ -51,6 +67,9 @@ class Film : public TaggedPointer<RGBFilm, GBufferFilm> {
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
     PBRT_CPU_GPU
     RGB GetPixelRGB(const Point2i &p, Float splatScale = 1) const;
+    // Estimated relative standard error of the pixel's value
+    PBRT_CPU_GPU
+    Float GetPixelRelativeError(const Point2i &p) const;
 
     PBRT_CPU_GPU inline Filter GetFilter() const;
     PBRT_CPU_GPU inline const PixelSensor *GetPixelSensor() const;
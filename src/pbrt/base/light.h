@@ -28,10 +28,12 @@ class DistantLight;
 class ProjectionLight;
 class GoniometricLight;
 class DiffuseAreaLight;
+class TriangleAreaLight;
 class UniformInfiniteLight;
 class ImageInfiniteLight;
 class PortalImageInfiniteLight;
 class SpotLight;
+class VolumeEmitterLight;
 
 class LightSampleContext;
 class LightBounds;
@@ -42,8 +44,8 @@ struct LightLeSample;
 // Light Definition
 class Light : public TaggedPointer<  // Light Source Types
                   PointLight, DistantLight, ProjectionLight, GoniometricLight, SpotLight,
-                  DiffuseAreaLight, UniformInfiniteLight, ImageInfiniteLight,
-                  PortalImageInfiniteLight
+                  DiffuseAreaLight, TriangleAreaLight, UniformInfiniteLight,
+                  ImageInfiniteLight, PortalImageInfiniteLight, VolumeEmitterLight
 
                   > {
   public:
@@ -59,6 +61,15 @@ class Light : public TaggedPointer<  // Light Source Types
                             const Transform &renderFromLight,
                             const MediumInterface &mediumInterface, const Shape shape,
                             FloatTexture alpha, const FileLoc *loc, Allocator alloc);
+    // Creates the area lights for all of a shape's _Shape_s; the triangles of a
+    // mesh share a single set of emission parameters when possible
+    static pstd::vector<Light> CreateAreaLights(const std::string &name,
+                                                const ParameterDictionary &parameters,
+                                                const Transform &renderFromLight,
+                                                const MediumInterface &mediumInterface,
+                                                pstd::span<const Shape> shapes,
+                                                FloatTexture alpha, const FileLoc *loc,
+                                                Allocator alloc);
 
     SampledSpectrum Phi(SampledWavelengths lambda) const;
 
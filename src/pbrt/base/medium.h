@@ -59,6 +59,7 @@ using NanoVDBMedium = CuboidMedium<NanoVDBMediumProvider>;
 
 struct MediumProperties;
 struct MediumSample;
+struct MediumEmissionGrid;
 
 // MediumDensity Definition
 struct MediumDensity {
@@ -84,6 +85,8 @@ class Medium : public TaggedPointer<HomogeneousMedium, UniformGridMedium, CloudM
     std::string ToString() const;
 
     bool IsEmissive() const;
+    // Returns bounds on the medium's emission if it can be sampled by volume
+    pstd::optional<MediumEmissionGrid> GetEmissionGrid(Allocator alloc) const;
 
     PBRT_CPU_GPU
     MediumProperties Sample(Point3f p, const SampledWavelengths &lambda) const;
@@ -92,6 +95,12 @@ class Medium : public TaggedPointer<HomogeneousMedium, UniformGridMedium, CloudM
     PBRT_CPU_GPU SampledSpectrum SampleT_maj(Ray ray, Float tMax, Float u, RNG &rng,
                                              const SampledWavelengths &lambda,
                                              F callback) const;
+    // Sample the residual extinction with respect to a control extinction along
+    // the ray, returning the control's transmittance in _T_c_
+    template <typename F>
+    PBRT_CPU_GPU SampledSpectrum SampleT_res(Ray ray, Float tMax, Float u, RNG &rng,
+                                             const SampledWavelengths &lambda,
+                                             SampledSpectrum *T_c, F callback) const;
 };
 
 // MediumInterface Definition
@@ -25,6 +25,7 @@ struct CameraSample {
 };
 
 // Sampler Declarations
+class BlueNoiseSampler;
 class HaltonSampler;
 class PaddedSobolSampler;
 class PMJ02BNSampler;
@@ -38,7 +39,8 @@ class DebugMLTSampler;
 // Sampler Definition
 class Sampler : public TaggedPointer<IndependentSampler, StratifiedSampler, HaltonSampler,
                                      PaddedSobolSampler, SobolSampler, ZSobolSampler,
-                                     PMJ02BNSampler, MLTSampler, DebugMLTSampler> {
+                                     PMJ02BNSampler, BlueNoiseSampler, MLTSampler,
+                                     DebugMLTSampler> {
   public:
     // Sampler Interface
     using TaggedPointer::TaggedPointer;
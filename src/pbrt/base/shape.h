@@ -42,6 +42,8 @@ class Shape
     std::string ToString() const;
 
     PBRT_CPU_GPU inline Bounds3f Bounds() const;
+    // Returns bounds of the part of the shape inside _clip_
+    inline Bounds3f ClippedBounds(const Bounds3f &clip) const;
 
     PBRT_CPU_GPU inline DirectionCone NormalBounds() const;
 
@@ -792,3 +792,104 @@ TEST(Hair, SamplingConsistency) {
             EXPECT_LT(err, 0.05);
         }
 }
+
+// Returns a Monte Carlo estimate of the directional albedo of _bxdf_ for _wo_.
+template <typename BxDF>
+static SampledSpectrum DirectionalAlbedo(const BxDF& bxdf, Vector3f wo, int nSamples) {
+    RNG rng;
+    SampledSpectrum albedo(0.f);
+    for (int i = 0; i < nSamples; ++i) {
+        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+        pstd::optional<BSDFSample> bs =
+            bxdf.Sample_f(wo, rng.Uniform<Float>(), u, TransportMode::Radiance);
+        if (bs && bs->pdf > 0)
+            albedo += bs->f * AbsCosTheta(bs->wi) / bs->pdf;
+    }
+    return albedo / nSamples;
+}
+
+// LayeredBxDF Tests
+TEST(LayeredBxDF, FittedMatchesStochastic) {
+    for (Float alpha : {0.f, 0.1f, 0.5f})
+        for (Float r : {0.25f, 0.9f}) {
+            TrowbridgeReitzDistribution distrib(alpha, alpha);
+            SampledSpectrum R(r), albedo(0.f);
+            CoatedDiffuseBxDF stochastic(DielectricBxDF(1.5f, distrib), DiffuseBxDF(R),
+                                         0.01f, albedo, 0.f, 100, 1);
+            CoatedDiffuseBxDF fitted(DielectricBxDF(1.5f, distrib), DiffuseBxDF(R),
+                                     0.01f, albedo, 0.f, 10, 1, true);
+
+            for (Float cosTheta : {0.2f, 0.5f, 0.9f}) {
+                Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+                Float expected = DirectionalAlbedo(stochastic, wo, 100000)[0];
+                Float albedoFitted = DirectionalAlbedo(fitted, wo, 100000)[0];
+                EXPECT_LT(std::abs(expected - albedoFitted), 0.03f)
+                    << "alpha " << alpha << ", R " << r << ", cos " << cosTheta
+                    << ": stochastic " << expected << ", fitted " << albedoFitted;
+            }
+        }
+}
+
+TEST(LayeredBxDF, FittedConsistency) {
+    RNG rng;
+    for (Float alpha : {0.f, 0.3f}) {
+        TrowbridgeReitzDistribution distrib(alpha, alpha);
+        CoatedDiffuseBxDF bxdf(DielectricBxDF(1.5f, distrib),
+                               DiffuseBxDF(SampledSpectrum(1.f)), 1e-4f,
+                               SampledSpectrum(0.f), 0.f, 10, 1, true);
+        for (int i = 0; i < 1000; ++i) {
+            Vector3f wo =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            pstd::optional<BSDFSample> bs =
+                bxdf.Sample_f(wo, rng.Uniform<Float>(), u, TransportMode::Radiance);
+            if (!bs || bs->IsSpecular())
+                continue;
+            EXPECT_TRUE(SameHemisphere(wo, bs->wi));
+
+            // Sampled values should match the evaluated ones
+            SampledSpectrum f = bxdf.f(wo, bs->wi, TransportMode::Radiance);
+            Float pdf = bxdf.PDF(wo, bs->wi, TransportMode::Radiance);
+            EXPECT_LT(std::abs(f[0] - bs->f[0]), 1e-4f * f[0]);
+            EXPECT_LT(std::abs(pdf - bs->pdf), 1e-4f * pdf);
+
+            // The fitted model is reciprocal
+            SampledSpectrum fr = bxdf.f(bs->wi, wo, TransportMode::Radiance);
+            EXPECT_LT(std::abs(f[0] - fr[0]), 1e-3f * f[0]);
+        }
+
+        // A white base under a clear coating shouldn't gain energy; rough coatings
+        // lose some since the microfacet model only accounts for single scattering.
+        for (Float cosTheta : {0.1f, 0.5f, 1.f}) {
+            Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+            Float albedo = DirectionalAlbedo(bxdf, wo, 100000)[0];
+            EXPECT_LT(albedo, 1.01f) << alpha << " " << cosTheta;
+            EXPECT_GT(albedo, alpha == 0 ? 0.98f : 0.6f) << alpha << " " << cosTheta;
+        }
+    }
+}
+
+// ConductorBxDF Tests
+TEST(ConductorBxDF, EnergyCompensation) {
+    // A conductor with $k \gg 1$ reflects nearly all light at every angle, so with
+    // energy compensation a rough surface should have an albedo close to one.
+    SampledSpectrum eta(1.f), k(1e4f);
+    for (Float alpha : {0.2f, 0.5f, 1.f}) {
+        TrowbridgeReitzDistribution distrib(alpha, alpha);
+        ConductorBxDF single(distrib, eta, k), compensated(distrib, eta, k, true);
+        for (Float cosTheta : {0.1f, 0.5f, 1.f}) {
+            Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+            Float albedoSingle = DirectionalAlbedo(single, wo, 100000)[0];
+            Float albedo = DirectionalAlbedo(compensated, wo, 100000)[0];
+            EXPECT_LT(albedo, 1.02f) << alpha << " " << cosTheta;
+            EXPECT_GT(albedo, 0.97f) << alpha << " " << cosTheta;
+            EXPECT_GE(albedo, albedoSingle) << alpha << " " << cosTheta;
+
+            // The compensation lobe is reciprocal
+            Vector3f wi = Normalize(Vector3f(-0.3f, 0.2f, 0.6f));
+            EXPECT_LT(std::abs(compensated.f(wo, wi, TransportMode::Radiance)[0] -
+                               compensated.f(wi, wo, TransportMode::Radiance)[0]),
+                      1e-4f);
+        }
+    }
+}
@@ -5,17 +5,33 @@
 #include <pbrt/bssrdf.h>
 
 #include <pbrt/media.h>
+#include <pbrt/options.h>
 #include <pbrt/shapes.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/stats.h>
 
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 namespace pbrt {
 
+STAT_COUNTER("BSSRDF/Profile tables computed", bssrdfTablesComputed);
+STAT_PERCENT("BSSRDF/Profile table cache hits", bssrdfTableCacheHits,
+             bssrdfTableCacheLookups);
+
 std::string TabulatedBSSRDF::ToString() const {
     return StringPrintf(
         "[ TabulatedBSSRDF po: %s eta: %f ns: %s sigma_t: %s rho: %s table: %s ]", po,
@@ -108,17 +124,18 @@ void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
         t->rhoSamples[i] =
             (1 - FastExp(-8 * i / (Float)(t->rhoSamples.size() - 1))) / (1 - FastExp(-8));
 
-    ParallelFor(0, t->rhoSamples.size(), [&](int i) {
-        // Compute the diffusion profile for the _i_th albedo sample
-        // Compute scattering profile for chosen albedo $\rho$
-        size_t nSamples = t->radiusSamples.size();
-        for (int j = 0; j < nSamples; ++j) {
-            Float rho = t->rhoSamples[i], r = t->radiusSamples[j];
-            t->profile[i * nSamples + j] = 2 * Pi * r *
-                                           (BeamDiffusionSS(rho, 1 - rho, g, eta, r) +
-                                            BeamDiffusionMS(rho, 1 - rho, g, eta, r));
-        }
+    // Compute scattering profile for each pair of albedo and radius samples
+    size_t nSamples = t->radiusSamples.size();
+    ParallelFor(0, t->profile.size(), [&](int64_t index) {
+        int i = index / nSamples, j = index % nSamples;
+        Float rho = t->rhoSamples[i], r = t->radiusSamples[j];
+        t->profile[index] = 2 * Pi * r *
+                            (BeamDiffusionSS(rho, 1 - rho, g, eta, r) +
+                             BeamDiffusionMS(rho, 1 - rho, g, eta, r));
+    });
+    ++bssrdfTablesComputed;
 
+    ParallelFor(0, t->rhoSamples.size(), [&](int i) {
         // Compute effective albedo $\rho_{\roman{eff}}$ and CDF for importance sampling
         t->rhoEff[i] = IntegrateCatmullRom(
             t->radiusSamples,
@@ -127,6 +144,121 @@ void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
     });
 }
 
+// BSSRDF Profile Table Cache Definitions
+static constexpr char bssrdfCacheMagic[8] = "pbrtSSS";
+static constexpr int bssrdfCacheVersion = 1;
+
+struct BSSRDFCacheHeader {
+    char magic[8];
+    int32_t version, floatSize;
+    int32_t nRhoSamples, nRadiusSamples;
+    Float g, eta;
+};
+
+// Returns the number of _Float_ values stored after the header of a cache file
+static size_t BSSRDFCacheValues(int nRhoSamples, int nRadiusSamples) {
+    return 2 * size_t(nRhoSamples) * nRadiusSamples + 2 * nRhoSamples + nRadiusSamples;
+}
+
+static bool ReadBSSRDFCache(const std::string &filename, Float g, Float eta,
+                            BSSRDFTable *t) {
+    if (!FileExists(filename))
+        return false;
+    std::string contents = ReadFileContents(filename);
+
+    // Validate cache file header and size
+    BSSRDFCacheHeader header;
+    int nRho = t->rhoSamples.size(), nRadius = t->radiusSamples.size();
+    if (contents.size() < sizeof(header) ||
+        contents.size() !=
+            sizeof(header) + BSSRDFCacheValues(nRho, nRadius) * sizeof(Float)) {
+        Warning("%s: truncated BSSRDF cache file. Recomputing.", filename);
+        return false;
+    }
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (std::memcmp(header.magic, bssrdfCacheMagic, sizeof(bssrdfCacheMagic)) != 0 ||
+        header.version != bssrdfCacheVersion || header.floatSize != sizeof(Float) ||
+        header.nRhoSamples != nRho || header.nRadiusSamples != nRadius ||
+        header.g != g || header.eta != eta) {
+        Warning("%s: BSSRDF cache file doesn't match material. Recomputing.", filename);
+        return false;
+    }
+
+    // Copy tabulated values from cache file
+    const char *ptr = contents.data() + sizeof(header);
+    for (pstd::vector<Float> *v : {&t->rhoSamples, &t->radiusSamples, &t->profile,
+                                   &t->rhoEff, &t->profileCDF}) {
+        std::memcpy(v->data(), ptr, v->size() * sizeof(Float));
+        ptr += v->size() * sizeof(Float);
+    }
+    LOG_VERBOSE("Loaded BSSRDF profile table for g %f eta %f from %s", g, eta, filename);
+    return true;
+}
+
+static void WriteBSSRDFCache(const std::string &filename, Float g, Float eta,
+                             const BSSRDFTable &t) {
+    // Assemble cache file contents
+    BSSRDFCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, bssrdfCacheMagic, sizeof(bssrdfCacheMagic));
+    header.version = bssrdfCacheVersion;
+    header.floatSize = sizeof(Float);
+    header.nRhoSamples = t.rhoSamples.size();
+    header.nRadiusSamples = t.radiusSamples.size();
+    header.g = g;
+    header.eta = eta;
+    std::string contents((const char *)&header, sizeof(header));
+    for (const pstd::vector<Float> *v :
+         {&t.rhoSamples, &t.radiusSamples, &t.profile, &t.rhoEff, &t.profileCDF})
+        contents.append((const char *)v->data(), v->size() * sizeof(Float));
+
+    // Write to a temporary file and rename it so that concurrent renders never
+    // see a partially-written cache file
+    uint64_t tempSuffix = MixBits(uint64_t(time(nullptr)) ^ (uintptr_t)&t);
+    std::string tempFilename =
+        StringPrintf("%s.%016llx.tmp", filename, (unsigned long long)tempSuffix);
+    if (!WriteFileContents(tempFilename, contents))
+        return;
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        if (!FileExists(filename))
+            Warning("%s: %s", filename, ErrorString());
+        std::remove(tempFilename.c_str());
+    }
+}
+
+const BSSRDFTable *GetBeamDiffusionBSSRDFTable(Float g, Float eta, Allocator alloc) {
+    // Return previously computed table for _g_ and _eta_ if there is one
+    static std::mutex mutex;
+    static std::map<std::tuple<Float, Float, pstd::pmr::memory_resource *>,
+                    const BSSRDFTable *>
+        tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple(g, eta, alloc.resource());
+    if (auto iter = tables.find(key); iter != tables.end())
+        return iter->second;
+
+    BSSRDFTable *table = alloc.new_object<BSSRDFTable>(100, 64, alloc);
+    // Load the table from the cache directory or compute and store it there
+    std::string cacheFilename;
+    if (Options && !Options->bssrdfCacheDirectory.empty()) {
+        cacheFilename = StringPrintf(
+            "%s/bssrdf-%016llx.bin", Options->bssrdfCacheDirectory,
+            (unsigned long long)Hash(g, eta, table->rhoSamples.size(),
+                                     table->radiusSamples.size(), bssrdfCacheVersion));
+        ++bssrdfTableCacheLookups;
+    }
+    if (!cacheFilename.empty() && ReadBSSRDFCache(cacheFilename, g, eta, table))
+        ++bssrdfTableCacheHits;
+    else {
+        ComputeBeamDiffusionBSSRDF(g, eta, table);
+        if (!cacheFilename.empty())
+            WriteBSSRDFCache(cacheFilename, g, eta, *table);
+    }
+
+    tables[key] = table;
+    return table;
+}
+
 // BSSRDFTable Method Definitions
 BSSRDFTable::BSSRDFTable(int nRhoSamples, int nRadiusSamples, Allocator alloc)
     : rhoSamples(nRhoSamples, alloc),
@@ -69,6 +69,10 @@ Float BeamDiffusionSS(Float sigma_s, Float sigma_a, Float g, Float eta, Float r)
 Float BeamDiffusionMS(Float sigma_s, Float sigma_a, Float g, Float eta, Float r);
 
 void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t);
+// Returns a photon beam diffusion profile table for the given parameters. Tables
+// are shared by all callers that pass the same values and, if
+// _Options->bssrdfCacheDirectory_ is set, are loaded from and saved to that directory.
+const BSSRDFTable *GetBeamDiffusionBSSRDFTable(Float g, Float eta, Allocator alloc);
 
 // BSSRDFTable Definition
 struct BSSRDFTable {
@@ -0,0 +1,58 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/bssrdf.h>
+#include <pbrt/options.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/memory.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace pbrt;
+
+static void ExpectTablesEqual(const BSSRDFTable &a, const BSSRDFTable &b) {
+    ASSERT_EQ(a.profile.size(), b.profile.size());
+    for (size_t i = 0; i < a.rhoSamples.size(); ++i) {
+        EXPECT_EQ(a.rhoSamples[i], b.rhoSamples[i]);
+        EXPECT_EQ(a.rhoEff[i], b.rhoEff[i]);
+    }
+    for (size_t i = 0; i < a.radiusSamples.size(); ++i)
+        EXPECT_EQ(a.radiusSamples[i], b.radiusSamples[i]);
+    for (size_t i = 0; i < a.profile.size(); ++i) {
+        EXPECT_EQ(a.profile[i], b.profile[i]);
+        EXPECT_EQ(a.profileCDF[i], b.profileCDF[i]);
+    }
+}
+
+TEST(BSSRDFTable, Cache) {
+    std::string savedCacheDirectory = Options->bssrdfCacheDirectory;
+    Options->bssrdfCacheDirectory = ".";
+
+    BSSRDFTable expected(100, 64, {});
+    ComputeBeamDiffusionBSSRDF(0.25f, 1.4f, &expected);
+
+    // Materials with the same parameters share a table
+    static pstd::pmr::monotonic_buffer_resource resource0, resource1;
+    Allocator alloc0(&resource0), alloc1(&resource1);
+    const BSSRDFTable *computed = GetBeamDiffusionBSSRDFTable(0.25f, 1.4f, alloc0);
+    EXPECT_EQ(computed, GetBeamDiffusionBSSRDFTable(0.25f, 1.4f, alloc0));
+    ExpectTablesEqual(expected, *computed);
+
+    // The table for another allocator is loaded from the cache file
+    const BSSRDFTable *loaded = GetBeamDiffusionBSSRDFTable(0.25f, 1.4f, alloc1);
+    EXPECT_NE(computed, loaded);
+    ExpectTablesEqual(expected, *loaded);
+
+    std::vector<std::string> cacheFiles = MatchingFilenames("./bssrdf-");
+    EXPECT_EQ(1, cacheFiles.size());
+    for (const std::string &filename : cacheFiles)
+        EXPECT_EQ(0, remove(filename.c_str()));
+    Options->bssrdfCacheDirectory = savedCacheDirectory;
+}
@@ -4,6 +4,9 @@
 
 #include <pbrt/bxdfs.h>
 
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <pbrt/gpu/util.h>
+#endif
 #include <pbrt/bssrdf.h>
 #include <pbrt/interaction.h>
 #include <pbrt/media.h>
@@ -18,6 +21,7 @@
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/stats.h>
@@ -66,11 +70,144 @@ std::string RoughDiffuseBxDF::ToString() const {
     return StringPrintf("[ RoughDiffuseBxDF R: %s T: %s A: %f B: %f ]", R, T, A, B);
 }
 
+// MicrofacetAlbedoTable Method Definitions
+const MicrofacetAlbedoTable *MicrofacetAlbedoTable::table;
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+PBRT_CONST MicrofacetAlbedoTable *MicrofacetAlbedoTable_table;
+#endif
+
+// Returns a stratified estimate of the single-scattering albedo of a perfectly
+// reflecting microfacet surface with distribution _distrib_.
+static Float EstimateAlbedo(const TrowbridgeReitzDistribution &distrib, Vector3f wo,
+                            int sqrtSamples) {
+    Float sum = 0;
+    for (int i = 0; i < sqrtSamples; ++i)
+        for (int j = 0; j < sqrtSamples; ++j) {
+            Point2f u((i + 0.5f) / sqrtSamples, (j + 0.5f) / sqrtSamples);
+            // With visible normal sampling, each sample has weight $G / G_1(\wo)$
+            Vector3f wi = Reflect(wo, distrib.Sample_wm(wo, u));
+            if (SameHemisphere(wo, wi))
+                sum += distrib.G(wo, wi) / distrib.G1(wo);
+        }
+    return std::min<Float>(1, sum / Sqr(sqrtSamples));
+}
+
+void MicrofacetAlbedoTable::Init(Allocator alloc) {
+    MicrofacetAlbedoTable *t = alloc.new_object<MicrofacetAlbedoTable>();
+    ParallelFor(0, NAlpha, [&](int64_t iAlpha) {
+        Float alpha = Sqr(Float(iAlpha) / (NAlpha - 1));
+        TrowbridgeReitzDistribution distrib(alpha, alpha);
+        // Tabulate directional albedo
+        for (int iCos = 0; iCos < NCosTheta; ++iCos) {
+            Float cosTheta = std::max<Float>(Float(iCos) / (NCosTheta - 1), 1e-2f);
+            Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+            t->albedo[iAlpha * NCosTheta + iCos] =
+                (iAlpha == 0) ? 1 : EstimateAlbedo(distrib, wo, 32);
+        }
+
+        // Compute cosine-weighted average albedo
+        constexpr int nCosTheta = 64;
+        Float sum = 0;
+        for (int i = 0; i < nCosTheta; ++i) {
+            Float cosTheta = std::sqrt((i + 0.5f) / nCosTheta);
+            Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+            sum += (iAlpha == 0) ? 1 : EstimateAlbedo(distrib, wo, 16);
+        }
+        t->averageAlbedo[iAlpha] = sum / nCosTheta;
+    });
+    table = t;
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (Options->useGPU)
+        ForEachGPU([](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(MicrofacetAlbedoTable_table,
+                                          &MicrofacetAlbedoTable::table,
+                                          sizeof(MicrofacetAlbedoTable_table)));
+        });
+#endif
+}
+
+// DielectricAlbedoTable Method Definitions
+const DielectricAlbedoTable *DielectricAlbedoTable::table;
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+PBRT_CONST DielectricAlbedoTable *DielectricAlbedoTable_table;
+#endif
+
+// Returns a stratified estimate of the directional albedo of _bxdf_ for the
+// lobe selected by _flags_.
+static Float EstimateAlbedo(const DielectricBxDF &bxdf, Vector3f wo,
+                            BxDFReflTransFlags flags, int sqrtSamples) {
+    Float sum = 0;
+    for (int i = 0; i < sqrtSamples; ++i)
+        for (int j = 0; j < sqrtSamples; ++j) {
+            Point2f u((i + 0.5f) / sqrtSamples, (j + 0.5f) / sqrtSamples);
+            // Use importance transport so that transmission is not scaled by $\eta^2$
+            pstd::optional<BSDFSample> bs =
+                bxdf.Sample_f(wo, 0.5f, u, TransportMode::Importance, flags);
+            if (bs && bs->pdf > 0)
+                sum += bs->f[0] * AbsCosTheta(bs->wi) / bs->pdf;
+        }
+    return std::min<Float>(1, sum / Sqr(sqrtSamples));
+}
+
+void DielectricAlbedoTable::Init(Allocator alloc) {
+    DielectricAlbedoTable *t = alloc.new_object<DielectricAlbedoTable>();
+    ParallelFor(0, NEta, [&](int64_t iEta) {
+        Float eta = Lerp(Float(iEta) / (NEta - 1), MinEta, MaxEta);
+        for (int iAlpha = 0; iAlpha < NAlpha; ++iAlpha) {
+            Float alpha = Sqr(Float(iAlpha) / (NAlpha - 1));
+            DielectricBxDF bxdf(eta, TrowbridgeReitzDistribution(alpha, alpha));
+            int offset = (iEta * NAlpha + iAlpha) * NCosTheta;
+            // Tabulate reflectance and transmittance for light arriving from outside
+            for (int iCos = 0; iCos < NCosTheta; ++iCos) {
+                Float cosTheta = Float(iCos) / (NCosTheta - 1);
+                if (iAlpha == 0) {
+                    t->reflectance[offset + iCos] = FrDielectric(cosTheta, eta);
+                    t->transmittance[offset + iCos] = 1 - FrDielectric(cosTheta, eta);
+                    continue;
+                }
+                cosTheta = std::max<Float>(cosTheta, 1e-2f);
+                Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, cosTheta);
+                t->reflectance[offset + iCos] =
+                    EstimateAlbedo(bxdf, wo, BxDFReflTransFlags::Reflection, 16);
+                t->transmittance[offset + iCos] =
+                    EstimateAlbedo(bxdf, wo, BxDFReflTransFlags::Transmission, 16);
+            }
+
+            // Compute cosine-weighted average reflectance for light arriving from inside
+            constexpr int nCosTheta = 32;
+            Float sum = 0;
+            for (int i = 0; i < nCosTheta; ++i) {
+                Float cosTheta = std::sqrt((i + 0.5f) / nCosTheta);
+                if (iAlpha == 0)
+                    sum += FrDielectric(-cosTheta, eta);
+                else {
+                    Vector3f wo(SafeSqrt(1 - Sqr(cosTheta)), 0, -cosTheta);
+                    sum += EstimateAlbedo(bxdf, wo, BxDFReflTransFlags::Reflection, 8);
+                }
+            }
+            t->internalReflectance[iEta * NAlpha + iAlpha] = sum / nCosTheta;
+        }
+    });
+    table = t;
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (Options->useGPU)
+        ForEachGPU([](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(DielectricAlbedoTable_table,
+                                          &DielectricAlbedoTable::table,
+                                          sizeof(DielectricAlbedoTable_table)));
+        });
+#endif
+}
+
 template <typename TopBxDF, typename BottomBxDF, bool twoSided>
 std::string LayeredBxDF<TopBxDF, BottomBxDF, twoSided>::ToString() const {
     return StringPrintf(
-        "[ LayeredBxDF top: %s bottom: %s thickness: %f albedo: %s g: %f ]", top, bottom,
-        thickness, albedo, g);
+        "[ LayeredBxDF top: %s bottom: %s thickness: %f albedo: %s g: %f fitted: %s ]",
+        top, bottom, thickness, albedo, g, fitted);
 }
 
 // DielectricBxDF Method Definitions
@@ -282,8 +419,9 @@ std::string ThinDielectricBxDF::ToString() const {
 }
 
 std::string ConductorBxDF::ToString() const {
-    return StringPrintf("[ ConductorBxDF mfDistrib: %s eta: %s k: %s ]", mfDistrib, eta,
-                        k);
+    return StringPrintf(
+        "[ ConductorBxDF mfDistrib: %s eta: %s k: %s energyCompensation: %s ]", mfDistrib,
+        eta, k, energyCompensation);
 }
 
 // HairBxDF Method Definitions
@@ -230,6 +230,11 @@ class DielectricBxDF {
     PBRT_CPU_GPU
     void Regularize() { mfDistrib.Regularize(); }
 
+    PBRT_CPU_GPU
+    Float Eta() const { return eta; }
+    PBRT_CPU_GPU
+    const TrowbridgeReitzDistribution &Distribution() const { return mfDistrib; }
+
   private:
     // DielectricBxDF Private Members
     Float eta;
@@ -307,6 +312,60 @@ class ThinDielectricBxDF {
     Float eta;
 };
 
+#ifdef PBRT_BUILD_GPU_RENDERER
+class MicrofacetAlbedoTable;
+extern PBRT_CONST MicrofacetAlbedoTable *MicrofacetAlbedoTable_table;
+#endif
+
+// MicrofacetAlbedoTable Definition
+// Tabulates the directional albedo $E(\mu)$ of a perfectly reflecting
+// Trowbridge-Reitz microfacet surface, accounting only for single scattering, as
+// a function of the cosine of the incident angle and the roughness, along with its
+// cosine-weighted average $E_\roman{avg}$. These give the energy that is lost to
+// masking, which _ConductorBxDF_ adds back with a multiple-scattering lobe.
+class MicrofacetAlbedoTable {
+  public:
+    // MicrofacetAlbedoTable Public Constants
+    static constexpr int NCosTheta = 32, NAlpha = 32;
+
+    // MicrofacetAlbedoTable Public Methods
+    static void Init(Allocator alloc);
+
+    PBRT_CPU_GPU
+    static const MicrofacetAlbedoTable *Get() {
+#ifdef PBRT_IS_GPU_CODE
+        return MicrofacetAlbedoTable_table;
+#else
+        return table;
+#endif
+    }
+
+    PBRT_CPU_GPU
+    Float Albedo(Float cosTheta, Float alpha) const {
+        // Bilinearly interpolate albedo; roughness is indexed by $\sqrt{\alpha}$
+        Float x = Clamp(cosTheta, 0, 1) * (NCosTheta - 1);
+        Float y = SafeSqrt(std::min<Float>(alpha, 1)) * (NAlpha - 1);
+        int x0 = std::min<int>(x, NCosTheta - 2), y0 = std::min<int>(y, NAlpha - 2);
+        Float dx = x - x0, dy = y - y0;
+        const Float *row0 = &albedo[y0 * NCosTheta], *row1 = row0 + NCosTheta;
+        return Lerp(dy, Lerp(dx, row0[x0], row0[x0 + 1]),
+                    Lerp(dx, row1[x0], row1[x0 + 1]));
+    }
+
+    PBRT_CPU_GPU
+    Float AverageAlbedo(Float alpha) const {
+        Float y = SafeSqrt(std::min<Float>(alpha, 1)) * (NAlpha - 1);
+        int y0 = std::min<int>(y, NAlpha - 2);
+        return Lerp(y - y0, averageAlbedo[y0], averageAlbedo[y0 + 1]);
+    }
+
+  private:
+    // MicrofacetAlbedoTable Private Members
+    static const MicrofacetAlbedoTable *table;
+    pstd::array<Float, NAlpha * NCosTheta> albedo;
+    pstd::array<Float, NAlpha> averageAlbedo;
+};
+
 // ConductorBxDF Definition
 class ConductorBxDF {
   public:
@@ -314,8 +373,9 @@ class ConductorBxDF {
     ConductorBxDF() = default;
     PBRT_CPU_GPU
     ConductorBxDF(const TrowbridgeReitzDistribution &mfDistrib,
-                  const SampledSpectrum &eta, const SampledSpectrum &k)
-        : mfDistrib(mfDistrib), eta(eta), k(k) {}
+                  const SampledSpectrum &eta, const SampledSpectrum &k,
+                  bool energyCompensation = false)
+        : mfDistrib(mfDistrib), eta(eta), k(k), energyCompensation(energyCompensation) {}
 
     PBRT_CPU_GPU
     BxDFFlags Flags() const {
@@ -356,6 +416,8 @@ class ConductorBxDF {
 
         SampledSpectrum f =
             mfDistrib.D(wh) * mfDistrib.G(wo, wi) * F / (4 * cosTheta_i * cosTheta_o);
+        if (energyCompensation)
+            f += MultipleScattering(cosTheta_o, cosTheta_i);
         return BSDFSample(f, wi, pdf, BxDFFlags::GlossyReflection);
     }
 
@@ -379,7 +441,11 @@ class ConductorBxDF {
         Float frCosTheta_i = AbsDot(wi, wh);
         SampledSpectrum F = FrComplex(frCosTheta_i, eta, k);
 
-        return mfDistrib.D(wh) * mfDistrib.G(wo, wi) * F / (4 * cosTheta_i * cosTheta_o);
+        SampledSpectrum f =
+            mfDistrib.D(wh) * mfDistrib.G(wo, wi) * F / (4 * cosTheta_i * cosTheta_o);
+        if (energyCompensation)
+            f += MultipleScattering(cosTheta_o, cosTheta_i);
+        return f;
     }
 
     PBRT_CPU_GPU
@@ -408,9 +474,109 @@ class ConductorBxDF {
     void Regularize() { mfDistrib.Regularize(); }
 
   private:
+    // ConductorBxDF Private Methods
+    PBRT_CPU_GPU
+    SampledSpectrum MultipleScattering(Float cosTheta_o, Float cosTheta_i) const {
+        // Return energy-compensation lobe of Kulla and Conty for rough conductor
+        const MicrofacetAlbedoTable *table = MicrofacetAlbedoTable::Get();
+        if (!table)
+            return SampledSpectrum(0.f);
+        Float alpha = mfDistrib.EffectiveAlpha();
+        Float Eavg = table->AverageAlbedo(alpha);
+        if (Eavg >= 1)
+            return SampledSpectrum(0.f);
+        Float Eo = table->Albedo(cosTheta_o, alpha);
+        Float Ei = table->Albedo(cosTheta_i, alpha);
+
+        // Approximate average Fresnel reflectance using normal-incidence reflectance
+        SampledSpectrum one(1.f), k2 = k * k;
+        SampledSpectrum F0 = (Sqr(eta - one) + k2) / (Sqr(eta + one) + k2);
+        SampledSpectrum Favg = SampledSpectrum(1.f / 21) + (20.f / 21) * F0;
+        SampledSpectrum Fms = Favg * Favg * Eavg / (1 - Favg * (1 - Eavg));
+        return Fms * ((1 - Eo) * (1 - Ei) / (Pi * (1 - Eavg)));
+    }
+
     // ConductorBxDF Private Members
     TrowbridgeReitzDistribution mfDistrib;
     SampledSpectrum eta, k;
+    bool energyCompensation = false;
+};
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+class DielectricAlbedoTable;
+extern PBRT_CONST DielectricAlbedoTable *DielectricAlbedoTable_table;
+#endif
+
+// DielectricAlbedoTable Definition
+// Tabulates the directional reflectance and transmittance of a rough dielectric
+// interface for light arriving from outside as a function of the cosine of the
+// incident angle, the microfacet roughness, and the relative index of refraction,
+// along with the cosine-weighted average reflectance for light arriving from
+// inside. It is used by the fitted evaluation path of _LayeredBxDF_.
+class DielectricAlbedoTable {
+  public:
+    // DielectricAlbedoTable Public Constants
+    static constexpr int NCosTheta = 16, NAlpha = 16, NEta = 16;
+    static constexpr Float MinEta = 1, MaxEta = 3;
+
+    // DielectricAlbedoTable Public Methods
+    static void Init(Allocator alloc);
+
+    PBRT_CPU_GPU
+    static const DielectricAlbedoTable *Get() {
+#ifdef PBRT_IS_GPU_CODE
+        return DielectricAlbedoTable_table;
+#else
+        return table;
+#endif
+    }
+
+    PBRT_CPU_GPU
+    Float Reflectance(Float cosTheta, Float alpha, Float eta) const {
+        return Lookup(reflectance.data(), cosTheta, alpha, eta);
+    }
+    PBRT_CPU_GPU
+    Float Transmittance(Float cosTheta, Float alpha, Float eta) const {
+        return Lookup(transmittance.data(), cosTheta, alpha, eta);
+    }
+
+    PBRT_CPU_GPU
+    Float InternalReflectance(Float alpha, Float eta) const {
+        // Bilinearly interpolate tabulated internal reflectance
+        Float y = SafeSqrt(std::min<Float>(alpha, 1)) * (NAlpha - 1);
+        Float z = Clamp((eta - MinEta) / (MaxEta - MinEta), 0, 1) * (NEta - 1);
+        int y0 = std::min<int>(y, NAlpha - 2), z0 = std::min<int>(z, NEta - 2);
+        Float dy = y - y0, dz = z - z0;
+        auto r = [&](int iy, int iz) { return internalReflectance[iz * NAlpha + iy]; };
+        return Lerp(dz, Lerp(dy, r(y0, z0), r(y0 + 1, z0)),
+                    Lerp(dy, r(y0, z0 + 1), r(y0 + 1, z0 + 1)));
+    }
+
+  private:
+    // DielectricAlbedoTable Private Methods
+    PBRT_CPU_GPU
+    static Float Lookup(const Float *values, Float cosTheta, Float alpha, Float eta) {
+        // Compute continuous table coordinates; roughness is indexed by $\sqrt{\alpha}$
+        Float x = Clamp(cosTheta, 0, 1) * (NCosTheta - 1);
+        Float y = SafeSqrt(std::min<Float>(alpha, 1)) * (NAlpha - 1);
+        Float z = Clamp((eta - MinEta) / (MaxEta - MinEta), 0, 1) * (NEta - 1);
+
+        // Trilinearly interpolate tabulated _values_
+        int x0 = std::min<int>(x, NCosTheta - 2), y0 = std::min<int>(y, NAlpha - 2);
+        int z0 = std::min<int>(z, NEta - 2);
+        Float dx = x - x0, dy = y - y0, dz = z - z0;
+        auto v = [&](int iy, int iz) {
+            const Float *row = &values[(iz * NAlpha + iy) * NCosTheta];
+            return Lerp(dx, row[x0], row[x0 + 1]);
+        };
+        return Lerp(dz, Lerp(dy, v(y0, z0), v(y0 + 1, z0)),
+                    Lerp(dy, v(y0, z0 + 1), v(y0 + 1, z0 + 1)));
+    }
+
+    // DielectricAlbedoTable Private Members
+    static const DielectricAlbedoTable *table;
+    pstd::array<Float, NEta * NAlpha * NCosTheta> reflectance, transmittance;
+    pstd::array<Float, NEta * NAlpha> internalReflectance;
 };
 
 // TopOrBottomBxDF Definition
@@ -474,14 +640,16 @@ class LayeredBxDF {
     LayeredBxDF() = default;
     PBRT_CPU_GPU
     LayeredBxDF(TopBxDF top, BottomBxDF bottom, Float thickness,
-                const SampledSpectrum &albedo, Float g, int maxDepth, int nSamples)
+                const SampledSpectrum &albedo, Float g, int maxDepth, int nSamples,
+                bool fitted = false)
         : top(top),
           bottom(bottom),
           thickness(std::max(thickness, std::numeric_limits<Float>::min())),
           g(g),
           albedo(albedo),
           maxDepth(maxDepth),
-          nSamples(nSamples) {}
+          nSamples(nSamples),
+          fitted(fitted) {}
 
     std::string ToString() const;
 
@@ -521,6 +689,8 @@ class LayeredBxDF {
             wo = -wo;
             wi = -wi;
         }
+        if (UseFittedModel())
+            return FittedF(wo, wi, mode);
 
         // Determine entrance interface for layered BSDF
         TopOrBottomBxDF<TopBxDF, BottomBxDF> enterInterface;
@@ -702,6 +872,12 @@ class LayeredBxDF {
             wo = -wo;
             flipWi = true;
         }
+        if (UseFittedModel()) {
+            pstd::optional<BSDFSample> bs = FittedSample_f(wo, uc, u, mode);
+            if (bs && flipWi)
+                bs->wi = -bs->wi;
+            return bs;
+        }
 
         // Sample BSDF at entrance interface to get initial direction _w_
         bool enteredTop = twoSided || wo.z > 0;
@@ -814,6 +990,8 @@ class LayeredBxDF {
             wo = -wo;
             wi = -wi;
         }
+        if (UseFittedModel())
+            return FittedPDF(wo, wi, mode);
 
         // Declare _RNG_ for layered PDF evaluation
         RNG rng(Hash(GetOptions().seed, wi), Hash(wo));
@@ -922,12 +1100,138 @@ class LayeredBxDF {
         return FastExp(-std::abs(dz / w.z));
     }
 
+    // The fitted model replaces the random walk between the interfaces with a
+    // closed-form approximation: light refracts through the top interface,
+    // reflects from the bottom interface along the refracted directions, and
+    // refracts back out, with the interreflections between the two interfaces
+    // accounted for as a geometric series using hemispherical average reflectances.
+    // It is only used for a dielectric top interface over an opaque,
+    // non-specular bottom interface without a scattering medium in between.
+    PBRT_CPU_GPU
+    bool UseFittedModel() const {
+        if (!fitted || !twoSided || albedo || !DielectricAlbedoTable::Get())
+            return false;
+        Float eta = top.Eta();
+        BxDFFlags bottomFlags = bottom.Flags();
+        return eta > 1 && eta <= DielectricAlbedoTable::MaxEta &&
+               !IsSpecular(bottomFlags) && !IsTransmissive(bottomFlags);
+    }
+
+    PBRT_CPU_GPU
+    Float TopReflectance(Float cosTheta) const {
+        if (top.Distribution().EffectivelySmooth())
+            return FrDielectric(cosTheta, top.Eta());
+        return DielectricAlbedoTable::Get()->Reflectance(
+            cosTheta, top.Distribution().EffectiveAlpha(), top.Eta());
+    }
+
+    PBRT_CPU_GPU
+    Float TopTransmittance(Float cosTheta) const {
+        if (top.Distribution().EffectivelySmooth())
+            return 1 - FrDielectric(cosTheta, top.Eta());
+        return DielectricAlbedoTable::Get()->Transmittance(
+            cosTheta, top.Distribution().EffectiveAlpha(), top.Eta());
+    }
+
+    PBRT_CPU_GPU
+    SampledSpectrum FittedF(Vector3f wo, Vector3f wi, TransportMode mode) const {
+        if (!SameHemisphere(wo, wi))
+            return SampledSpectrum(0.f);
+        // Account for reflection at the top interface
+        SampledSpectrum f = top.f(wo, wi, mode);
+
+        // Find refracted directions of _wo_ and _wi_ inside the layers
+        Float eta = top.Eta(), etap;
+        Vector3f wot, wit;
+        if (!Refract(wo, Normal3f(0, 0, 1), eta, &etap, &wot) ||
+            !Refract(wi, Normal3f(0, 0, 1), eta, &etap, &wit))
+            return f;
+        SampledSpectrum fb = bottom.f(-wot, -wit, mode);
+        if (!fb)
+            return f;
+
+        // Estimate directional albedo of the bottom interface from a single sample
+        SampledSpectrum Rb(0.f);
+        pstd::optional<BSDFSample> bs = bottom.Sample_f(
+            -wit, 0.5f, Point2f(0.5f, 0.5f), mode, BxDFReflTransFlags::Reflection);
+        if (bs && bs->pdf > 0)
+            Rb = bs->f * AbsCosTheta(bs->wi) / bs->pdf;
+        // The mean of $1/\cos\theta$ for cosine-distributed directions is 2
+        Rb *= FastExp(-2 * thickness);
+
+        // Add bottom interface reflection with interreflection between interfaces
+        Float Ri = DielectricAlbedoTable::Get()->InternalReflectance(
+            top.Distribution().EffectiveAlpha(), eta);
+        Float T = TopTransmittance(AbsCosTheta(wo)) * TopTransmittance(AbsCosTheta(wi)) *
+                  Tr(thickness, wot) * Tr(thickness, wit) / Sqr(eta);
+        f += T * fb / (SampledSpectrum(1.f) - Ri * ClampZero(Rb));
+        return f;
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<BSDFSample> FittedSample_f(Vector3f wo, Float uc, Point2f u,
+                                              TransportMode mode) const {
+        // Sample top interface reflection with probability given by its reflectance
+        Float pr = TopReflectance(AbsCosTheta(wo));
+        if (uc < pr) {
+            pstd::optional<BSDFSample> bs = top.Sample_f(
+                wo, uc / pr, u, mode, BxDFReflTransFlags::Reflection);
+            if (!bs || !bs->f || bs->pdf == 0 || bs->wi.z == 0)
+                return {};
+            if (bs->IsSpecular()) {
+                bs->pdf *= pr;
+                return bs;
+            }
+            Float pdf = FittedPDF(wo, bs->wi, mode);
+            return BSDFSample(FittedF(wo, bs->wi, mode), bs->wi, pdf, bs->flags);
+        }
+
+        // Sample bottom interface reflection along refracted directions
+        Float eta = top.Eta(), etap;
+        Vector3f wot, wi;
+        if (!Refract(wo, Normal3f(0, 0, 1), eta, &etap, &wot))
+            return {};
+        pstd::optional<BSDFSample> bs =
+            bottom.Sample_f(-wot, (uc - pr) / (1 - pr), u, mode,
+                            BxDFReflTransFlags::Reflection);
+        if (!bs || !bs->f || bs->pdf == 0 || bs->wi.z <= 0)
+            return {};
+        if (!Refract(-bs->wi, Normal3f(0, 0, 1), eta, &etap, &wi))
+            return {};
+        Float pdf = FittedPDF(wo, wi, mode);
+        if (pdf == 0)
+            return {};
+        return BSDFSample(FittedF(wo, wi, mode), wi, pdf, bs->flags);
+    }
+
+    PBRT_CPU_GPU
+    Float FittedPDF(Vector3f wo, Vector3f wi, TransportMode mode) const {
+        if (!SameHemisphere(wo, wi))
+            return 0;
+        // Compute PDF of sampling top interface reflection
+        Float pr = TopReflectance(AbsCosTheta(wo));
+        Float pdf = pr * top.PDF(wo, wi, mode, BxDFReflTransFlags::Reflection);
+
+        // Add PDF of sampling bottom interface reflection
+        Float eta = top.Eta(), etap;
+        Vector3f wot, wit;
+        if (Refract(wo, Normal3f(0, 0, 1), eta, &etap, &wot) &&
+            Refract(wi, Normal3f(0, 0, 1), eta, &etap, &wit)) {
+            // Account for change of variables from refracted to external direction
+            Float bottomPDF =
+                bottom.PDF(-wot, -wit, mode, BxDFReflTransFlags::Reflection);
+            pdf += (1 - pr) * bottomPDF * AbsCosTheta(wi) / (Sqr(eta) * AbsCosTheta(wit));
+        }
+        return pdf;
+    }
+
     // LayeredBxDF Private Members
     TopBxDF top;
     BottomBxDF bottom;
     Float thickness, g;
     SampledSpectrum albedo;
     int maxDepth, nSamples;
+    bool fitted;
 };
 
 // CoatedDiffuseBxDF Definition
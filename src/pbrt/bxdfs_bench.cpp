@@ -0,0 +1,68 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/bxdfs.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// BxDF evaluation micro-benchmarks for pairs of random directions, which are
+// in the same hemisphere half of the time. The layered BxDFs are measured with
+// stochastic evaluation, where the benchmark's argument gives the number of
+// samples, and with the fitted approximation.
+
+static void BenchmarkEvaluate(benchmark::State &state, BxDF bxdf) {
+    constexpr int nPairs = 1024;
+    RNG rng;
+    std::vector<Vector3f> wo, wi;
+    for (int i = 0; i < nPairs; ++i) {
+        Point2f u0(rng.Uniform<Float>(), rng.Uniform<Float>());
+        Point2f u1(rng.Uniform<Float>(), rng.Uniform<Float>());
+        wo.push_back(SampleUniformHemisphere(u0));
+        wi.push_back(SampleUniformSphere(u1));
+    }
+
+    int index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bxdf.f(wo[index], wi[index], TransportMode::Radiance));
+        if (++index == nPairs)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_DiffuseBxDF(benchmark::State &state) {
+    DiffuseBxDF bxdf(SampledSpectrum(.5f));
+    BenchmarkEvaluate(state, &bxdf);
+}
+BENCHMARK(BM_DiffuseBxDF);
+
+static void BM_DielectricBxDF(benchmark::State &state) {
+    DielectricBxDF bxdf(1.5f, TrowbridgeReitzDistribution(.3f, .3f));
+    BenchmarkEvaluate(state, &bxdf);
+}
+BENCHMARK(BM_DielectricBxDF);
+
+static void BM_CoatedDiffuseBxDF(benchmark::State &state) {
+    CoatedDiffuseBxDF bxdf(DielectricBxDF(1.5f, TrowbridgeReitzDistribution(.3f, .3f)),
+                           DiffuseBxDF(SampledSpectrum(.5f)), .01f, SampledSpectrum(0.f),
+                           0.f, 10, state.range(0));
+    BenchmarkEvaluate(state, &bxdf);
+}
+BENCHMARK(BM_CoatedDiffuseBxDF)->Arg(1)->Arg(4)->Arg(16);
+
+static void BM_CoatedDiffuseBxDFFitted(benchmark::State &state) {
+    CoatedDiffuseBxDF bxdf(DielectricBxDF(1.5f, TrowbridgeReitzDistribution(.3f, .3f)),
+                           DiffuseBxDF(SampledSpectrum(.5f)), .01f, SampledSpectrum(0.f),
+                           0.f, 10, 1, true);
+    BenchmarkEvaluate(state, &bxdf);
+}
+BENCHMARK(BM_CoatedDiffuseBxDFFitted);
@@ -48,6 +48,12 @@ CameraTransform::CameraTransform(const AnimatedTransform &worldFromCamera) {
         LOG_FATAL("Unhandled rendering coordinate space");
     }
     LOG_VERBOSE("World-space position: %s", worldFromRender(Point3f(0, 0, 0)));
+    *this = CameraTransform(worldFromCamera, worldFromRender);
+}
+
+CameraTransform::CameraTransform(const AnimatedTransform &worldFromCamera,
+                                 const Transform &worldFromRender)
+    : worldFromRender(worldFromRender) {
     // Compute _renderFromCamera_ transformation
     Transform renderFromWorld = Inverse(worldFromRender);
     Transform rfc[2] = {renderFromWorld * worldFromCamera.startTransform,
@@ -680,11 +686,12 @@ std::string SphericalCamera::ToString() const {
 RealisticCamera::RealisticCamera(CameraBaseParameters baseParameters,
                                  std::vector<Float> &lensParameters, Float focusDistance,
                                  Float setApertureDiameter, Image apertureImage,
-                                 Allocator alloc)
+                                 bool polynomialOptics, Allocator alloc)
     : CameraBase(baseParameters),
       elementInterfaces(alloc),
       exitPupilBounds(alloc),
-      apertureImage(std::move(apertureImage)) {
+      apertureImage(std::move(apertureImage)),
+      polynomialCoefficients(alloc) {
     // Compute film's physical extent
     Float aspect = (Float)film.FullResolution().y / (Float)film.FullResolution().x;
     Float diagonal = film.Diagonal();
@@ -727,11 +734,16 @@ RealisticCamera::RealisticCamera(CameraBaseParameters baseParameters,
         exitPupilBounds[i] = BoundExitPupil(r0, r1);
     });
 
+    // Fit polynomials to the lens system if they're to be used instead of it
+    if (polynomialOptics && !FitPolynomialOptics())
+        polynomialCoefficients.clear();
+
     // Compute minimum differentials for _RealisticCamera_
     FindMinimumDifferentials(this);
 }
 
-Float RealisticCamera::TraceLensesFromFilm(const Ray &rCamera, Ray *rOut) const {
+Float RealisticCamera::TraceLensesFromFilm(const Ray &rCamera, Ray *rOut,
+                                           Point2f *pStop) const {
     Float elementZ = 0, weight = 1;
     // Transform _rCamera_ from camera to lens system space
     Ray rLens(Point3f(rCamera.o.x, rCamera.o.y, -rCamera.o.z),
@@ -762,6 +774,8 @@ Float RealisticCamera::TraceLensesFromFilm(const Ray &rCamera, Ray *rOut) const
 
         // Test intersection point against element aperture
         Point3f pHit = rLens(t);
+        if (isStop && pStop)
+            *pStop = Point2f(pHit.x, pHit.y);
         if (isStop && apertureImage) {
             // Check intersection point against _apertureImage_
             Point2f uv((pHit.x / element.apertureRadius + 1) / 2,
@@ -918,7 +932,8 @@ pstd::optional<CameraRay> RealisticCamera::GenerateRay(CameraSample sample,
         SampleExitPupil(Point2f(pFilm.x, pFilm.y), sample.pLens, &exitPupilBoundsArea);
     Ray rFilm(pFilm, pRear - pFilm);
     Ray ray;
-    Float weight = TraceLensesFromFilm(rFilm, &ray);
+    Float weight = polynomialCoefficients.empty() ? TraceLensesFromFilm(rFilm, &ray)
+                                                  : TraceLensesPolynomial(rFilm, &ray);
     if (weight == 0)
         return {};
 
@@ -937,6 +952,238 @@ pstd::optional<CameraRay> RealisticCamera::GenerateRay(CameraSample sample,
 
 STAT_PERCENT("Camera/Rays vignetted by lens system", vignettedRays, totalRays);
 
+void RealisticCamera::EvaluatePolynomialTerms(Float x0, Float x1, Float x2,
+                                              Float *terms) {
+    Float p0[PolynomialDegree + 1], p1[PolynomialDegree + 1], p2[PolynomialDegree + 1];
+    p0[0] = p1[0] = p2[0] = 1;
+    for (int i = 1; i <= PolynomialDegree; ++i) {
+        p0[i] = p0[i - 1] * x0;
+        p1[i] = p1[i - 1] * x1;
+        p2[i] = p2[i - 1] * x2;
+    }
+    int n = 0;
+    for (int i = 0; i <= PolynomialDegree; ++i)
+        for (int j = 0; i + j <= PolynomialDegree; ++j)
+            for (int k = 0; i + j + k <= PolynomialDegree; ++k)
+                terms[n++] = p0[i] * p1[j] * p2[k];
+    DCHECK_EQ(n, NPolynomialTerms);
+}
+
+Float RealisticCamera::TraceLensesPolynomial(const Ray &rCamera, Ray *rOut) const {
+    // Rotate the points on the film and the rear element so that the film point
+    // lies on the $+x$ axis
+    Point3f pRear = rCamera((LensRearZ() - rCamera.o.z) / rCamera.d.z);
+    Float rFilm = std::sqrt(Sqr(rCamera.o.x) + Sqr(rCamera.o.y));
+    Float sinTheta = (rFilm != 0) ? rCamera.o.y / rFilm : 0;
+    Float cosTheta = (rFilm != 0) ? rCamera.o.x / rFilm : 1;
+    Point2f pLens(cosTheta * pRear.x + sinTheta * pRear.y,
+                  -sinTheta * pRear.x + cosTheta * pRear.y);
+    if (Sqr(pLens.x) + Sqr(pLens.y) > Sqr(RearElementRadius()))
+        return 0;
+
+    // Evaluate the polynomials and rotate their results back
+    Float terms[NPolynomialTerms];
+    EvaluatePolynomialTerms(rFilm / (film.Diagonal() / 2),
+                            pLens.x / RearElementRadius(),
+                            pLens.y / RearElementRadius(), terms);
+    Float v[NPolynomialOutputs];
+    for (int o = 0; o < NPolynomialOutputs; ++o) {
+        const Float *c = &polynomialCoefficients[o * NPolynomialTerms];
+        v[o] = 0;
+        for (int i = 0; i < NPolynomialTerms; ++i)
+            v[o] += c[i] * terms[i];
+    }
+    auto rotate = [&](Float x, Float y) {
+        return Point2f(cosTheta * x - sinTheta * y, sinTheta * x + cosTheta * y);
+    };
+    Point2f pStop = rotate(v[0], v[1]), pExit = rotate(v[2], v[3]);
+    Point2f d = rotate(v[4], v[5]);
+
+    // Test the ray against the aperture stop and the front element
+    Float weight = 1;
+    if (apertureImage) {
+        Point2f uv((pStop.x / apertureStopRadius + 1) / 2,
+                   (pStop.y / apertureStopRadius + 1) / 2);
+        uv.y = 1 - uv.y;
+        weight = apertureImage.BilerpChannel(uv, 0, WrapMode::Black);
+        if (weight == 0)
+            return 0;
+    } else if (Sqr(pStop.x) + Sqr(pStop.y) > Sqr(apertureStopRadius))
+        return 0;
+    if (Sqr(pExit.x) + Sqr(pExit.y) > Sqr(elementInterfaces[0].apertureRadius))
+        return 0;
+    Float dz2 = 1 - Sqr(d.x) - Sqr(d.y);
+    if (dz2 <= 0)
+        return 0;
+
+    if (rOut != nullptr)
+        *rOut = Ray(Point3f(pExit.x, pExit.y, LensFrontZ()),
+                    Vector3f(d.x, d.y, SafeSqrt(dz2)), rCamera.time);
+    return weight;
+}
+
+bool RealisticCamera::FitPolynomialOptics() {
+    for (const LensElementInterface &element : elementInterfaces)
+        if (element.curvatureRadius == 0)
+            apertureStopRadius = element.apertureRadius;
+    if (apertureStopRadius == 0) {
+        Warning("Lens system has no aperture stop. Ignoring \"polynomialoptics\".");
+        return false;
+    }
+
+    // Traces the _i_th ray from the film's $+x$ axis through the exit pupil
+    // bounds of _bin_, returning its polynomials' inputs in _x_ and the
+    // results they should give in _y_, or false if it is blocked
+    constexpr int N = NPolynomialTerms, nOutputs = NPolynomialOutputs;
+    int nBins = exitPupilBounds.size();
+    Float filmRadius = film.Diagonal() / 2;
+    auto traceRay = [&](int bin, int i, Ray *rFilm, Float x[3], Float y[nOutputs]) {
+        Float r = (bin + RadicalInverse(0, i)) / nBins * filmRadius;
+        Point2f pLens = exitPupilBounds[bin].Lerp(
+            Point2f(RadicalInverse(1, i), RadicalInverse(2, i)));
+        Point3f pFilm(r, 0, 0), pRear(pLens.x, pLens.y, LensRearZ());
+        *rFilm = Ray(pFilm, pRear - pFilm);
+        Ray rOut;
+        Point2f pStop;
+        if (TraceLensesFromFilm(*rFilm, &rOut, &pStop) == 0)
+            return false;
+        Point3f pExit = rOut((LensFrontZ() - rOut.o.z) / rOut.d.z);
+        Vector3f d = Normalize(rOut.d);
+        x[0] = r / filmRadius;
+        x[1] = pLens.x / RearElementRadius();
+        x[2] = pLens.y / RearElementRadius();
+        Float values[nOutputs] = {pStop.x, pStop.y, pExit.x, pExit.y, d.x, d.y};
+        for (int o = 0; o < nOutputs; ++o)
+            y[o] = values[o];
+        return true;
+    };
+
+    // Accumulate the normal equations of the least-squares fit for each bin
+    struct NormalEquations {
+        double AtA[N][N] = {};
+        double AtB[N][nOutputs] = {};
+        int64_t nRays = 0;
+    };
+    constexpr int nBinRays = 4096;
+    std::vector<NormalEquations> binEquations(nBins);
+    ParallelFor(0, nBins, [&](int64_t bin) {
+        NormalEquations &eq = binEquations[bin];
+        for (int i = 0; i < nBinRays; ++i) {
+            Ray rFilm;
+            Float x[3], y[nOutputs], terms[N];
+            if (!traceRay(bin, i, &rFilm, x, y))
+                continue;
+            EvaluatePolynomialTerms(x[0], x[1], x[2], terms);
+            for (int j = 0; j < N; ++j) {
+                for (int k = j; k < N; ++k)
+                    eq.AtA[j][k] += double(terms[j]) * terms[k];
+                for (int o = 0; o < nOutputs; ++o)
+                    eq.AtB[j][o] += double(terms[j]) * y[o];
+            }
+            ++eq.nRays;
+        }
+    });
+    NormalEquations eq;
+    for (const NormalEquations &binEq : binEquations) {
+        for (int j = 0; j < N; ++j) {
+            for (int k = j; k < N; ++k)
+                eq.AtA[j][k] += binEq.AtA[j][k];
+            for (int o = 0; o < nOutputs; ++o)
+                eq.AtB[j][o] += binEq.AtB[j][o];
+        }
+        eq.nRays += binEq.nRays;
+    }
+    if (eq.nRays < 10 * N) {
+        Warning("Too few rays make it through the lens system to fit polynomials to "
+                "it. Ignoring \"polynomialoptics\".");
+        return false;
+    }
+
+    // Solve the normal equations using the Cholesky factorization $L L^T$ of
+    // $A^T A$, slightly regularized in case some terms are nearly degenerate
+    double trace = 0;
+    for (int j = 0; j < N; ++j)
+        trace += eq.AtA[j][j];
+    std::vector<double> L(N * N, 0.);
+    for (int j = 0; j < N; ++j) {
+        double sum = eq.AtA[j][j] + 1e-12 * trace / N;
+        for (int k = 0; k < j; ++k)
+            sum -= Sqr(L[j * N + k]);
+        if (sum <= 0) {
+            Warning("Unable to fit polynomials to the lens system. Ignoring "
+                    "\"polynomialoptics\".");
+            return false;
+        }
+        L[j * N + j] = std::sqrt(sum);
+        for (int i = j + 1; i < N; ++i) {
+            double s = eq.AtA[j][i];
+            for (int k = 0; k < j; ++k)
+                s -= L[i * N + k] * L[j * N + k];
+            L[i * N + j] = s / L[j * N + j];
+        }
+    }
+    polynomialCoefficients.resize(nOutputs * N);
+    for (int o = 0; o < nOutputs; ++o) {
+        double z[N], c[N];
+        for (int i = 0; i < N; ++i) {
+            double s = eq.AtB[i][o];
+            for (int k = 0; k < i; ++k)
+                s -= L[i * N + k] * z[k];
+            z[i] = s / L[i * N + i];
+        }
+        for (int i = N - 1; i >= 0; --i) {
+            double s = z[i];
+            for (int k = i + 1; k < N; ++k)
+                s -= L[k * N + i] * c[k];
+            c[i] = s / L[i * N + i];
+        }
+        for (int i = 0; i < N; ++i)
+            polynomialCoefficients[o * N + i] = c[i];
+    }
+
+    // Compare the polynomials to the lens system with rays that weren't used
+    // for the fit
+    std::vector<double> binDirectionError(nBins, 0.);
+    std::vector<int64_t> binRays(nBins, 0), binMismatches(nBins, 0);
+    ParallelFor(0, nBins, [&](int64_t bin) {
+        for (int i = nBinRays; i < 2 * nBinRays; ++i) {
+            Ray rFilm, rOut, rPolynomial;
+            Float x[3], y[nOutputs];
+            bool traced = traceRay(bin, i, &rFilm, x, y);
+            bool tracedPolynomial = TraceLensesPolynomial(rFilm, &rPolynomial) != 0;
+            if (traced != tracedPolynomial)
+                ++binMismatches[bin];
+            else if (traced) {
+                Float dz = SafeSqrt(1 - Sqr(y[4]) - Sqr(y[5]));
+                binDirectionError[bin] +=
+                    Sqr(Length(Normalize(rPolynomial.d) - Vector3f(y[4], y[5], dz)));
+                ++binRays[bin];
+            }
+        }
+    });
+    double directionError = 0;
+    int64_t nRays = 0, nMismatches = 0;
+    for (int bin = 0; bin < nBins; ++bin) {
+        directionError += binDirectionError[bin];
+        nRays += binRays[bin];
+        nMismatches += binMismatches[bin];
+    }
+    Float rmsDirectionError = nRays ? std::sqrt(directionError / nRays) : Infinity;
+    LOG_VERBOSE("Polynomial lens approximation: RMS direction error %f, rays blocked "
+                "differently %f%%",
+                rmsDirectionError, 100. * nMismatches / (nBins * nBinRays));
+
+    // Fall back to tracing rays through the lens system if the directions are
+    // off by more than about half a degree
+    if (!(rmsDirectionError < 0.01f)) {
+        Warning("Polynomial approximation of the lens system is too inaccurate (RMS "
+                "direction error %f). Ignoring \"polynomialoptics\".",
+                rmsDirectionError);
+        return false;
+    }
+    return true;
+}
+
 std::string RealisticCamera::LensElementInterface::ToString() const {
     return StringPrintf("[ LensElementInterface curvatureRadius: %f thickness: %f "
                         "eta: %f apertureRadius: %f ]",
@@ -1289,6 +1536,7 @@ RealisticCamera *RealisticCamera::Create(const ParameterDictionary &parameters,
     std::string lensFile = ResolveFilename(parameters.GetOneString("lensfile", ""));
     Float apertureDiameter = parameters.GetOneFloat("aperturediameter", 1.0);
     Float focusDistance = parameters.GetOneFloat("focusdistance", 10.0);
+    bool polynomialOptics = parameters.GetOneBool("polynomialoptics", false);
 
     if (lensFile.empty()) {
         Error(loc, "No lens description file supplied!");
@@ -1422,7 +1670,8 @@ RealisticCamera *RealisticCamera::Create(const ParameterDictionary &parameters,
 
     return alloc.new_object<RealisticCamera>(cameraBaseParameters, lensParameters,
                                              focusDistance, apertureDiameter,
-                                             std::move(apertureImage), alloc);
+                                             std::move(apertureImage), polynomialOptics,
+                                             alloc);
 }
 
 }  // namespace pbrt
@@ -28,6 +28,10 @@ class CameraTransform {
     // CameraTransform Public Methods
     CameraTransform() = default;
     explicit CameraTransform(const AnimatedTransform &worldFromCamera);
+    // Uses the given rendering space rather than one based on the camera's
+    // position, so that the camera can move without the scene being recreated
+    CameraTransform(const AnimatedTransform &worldFromCamera,
+                    const Transform &worldFromRender);
 
     PBRT_CPU_GPU
     Point3f RenderFromCamera(const Point3f &p, Float time) const {
@@ -463,7 +467,8 @@ class RealisticCamera : public CameraBase {
     // RealisticCamera Public Methods
     RealisticCamera(CameraBaseParameters baseParameters,
                     std::vector<Float> &lensParameters, Float focusDistance,
-                    Float apertureDiameter, Image apertureImage, Allocator alloc);
+                    Float apertureDiameter, Image apertureImage, bool polynomialOptics,
+                    Allocator alloc);
 
     static RealisticCamera *Create(const ParameterDictionary &parameters,
                                    const CameraTransform &cameraTransform, Film film,
@@ -526,8 +531,11 @@ class RealisticCamera : public CameraBase {
     PBRT_CPU_GPU
     Float RearElementRadius() const { return elementInterfaces.back().apertureRadius; }
 
+    // If _pStop_ is given, it is set to the point where the ray passes
+    // through the aperture stop.
     PBRT_CPU_GPU
-    Float TraceLensesFromFilm(const Ray &rCamera, Ray *rOut) const;
+    Float TraceLensesFromFilm(const Ray &rCamera, Ray *rOut,
+                              Point2f *pStop = nullptr) const;
 
     PBRT_CPU_GPU
     static bool IntersectSphericalElement(Float radius, Float zCenter, const Ray &ray,
@@ -573,11 +581,30 @@ class RealisticCamera : public CameraBase {
 
     void TestExitPupilBounds() const;
 
+    // The lens system can be approximated with polynomials in the film point's
+    // distance from the center of the film and the point on the rear element,
+    // both rotated so that the film point lies on the $+x$ axis. They give the
+    // point where the ray passes through the aperture stop, the point where it
+    // crosses the plane of the front element, and its direction there.
+    static constexpr int PolynomialDegree = 5;
+    static constexpr int NPolynomialTerms =
+        (PolynomialDegree + 1) * (PolynomialDegree + 2) * (PolynomialDegree + 3) / 6;
+    static constexpr int NPolynomialOutputs = 6;
+
+    PBRT_CPU_GPU
+    static void EvaluatePolynomialTerms(Float x0, Float x1, Float x2, Float *terms);
+    bool FitPolynomialOptics();
+    PBRT_CPU_GPU
+    Float TraceLensesPolynomial(const Ray &rCamera, Ray *rOut) const;
+
     // RealisticCamera Private Members
     Bounds2f physicalExtent;
     pstd::vector<LensElementInterface> elementInterfaces;
     Image apertureImage;
     pstd::vector<Bounds2f> exitPupilBounds;
+    // Empty unless the polynomial approximation of the lens system is used
+    pstd::vector<Float> polynomialCoefficients;
+    Float apertureStopRadius = 0;
 };
 
 inline pstd::optional<CameraRay> Camera::GenerateRay(CameraSample sample,
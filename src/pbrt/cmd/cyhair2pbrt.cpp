@@ -42,6 +42,8 @@ THE SOFTWARE.
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
+#include <thread>
 #include <vector>
 
 #include <iostream>
@@ -331,59 +333,66 @@ bool CyHair::ToCubicBezierCurves(std::vector<float> *vertices,
             << max_strands << " strands in the original hair data."
             << std::endl;
 
-  // Assume input points are CatmullRom spline.
+  // Count each strand's curves so that the strands can be converted in
+  // parallel, each into its own part of the output.
+  std::vector<size_t> curve_offsets(static_cast<size_t>(num_strands) + 1, 0);
   for (size_t i = 0; i < static_cast<size_t>(num_strands); i++) {
-    if ((i % 1000) == 0) {
-      std::cout << i << " / " << num_strands_ << std::endl;
-    }
-
     int num_segments = segments_.empty() ? default_segments_ : segments_[i];
-    if (num_segments < 2) {
-      continue;
-    }
+    curve_offsets[i + 1] =
+        curve_offsets[i] + static_cast<size_t>(std::max(num_segments - 2, 0));
+  }
+  vertices->resize(12 * curve_offsets.back());
+  radiuss->resize(4 * curve_offsets.back());
+
+  const float radius = (user_thickness > 0) ? user_thickness : default_thickness_;
+  const size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([&, t]() {
+      size_t begin = static_cast<size_t>(num_strands) * t / num_threads;
+      size_t end = static_cast<size_t>(num_strands) * (t + 1) / num_threads;
+      std::vector<real3> segment_points;
+
+      // Assume input points are CatmullRom spline.
+      for (size_t i = begin; i < end; i++) {
+        int num_segments = segments_.empty() ? default_segments_ : segments_[i];
+        if (num_segments < 2) {
+          continue;
+        }
 
-    std::vector<real3> segment_points;
-    for (size_t k = 0; k < static_cast<size_t>(num_segments); k++) {
-      // Zup -> Yup
-      real3 p(points_[3 * (strand_offsets_[i] + k) + 0],
-              points_[3 * (strand_offsets_[i] + k) + 2],
-              points_[3 * (strand_offsets_[i] + k) + 1]);
-      segment_points.push_back(p);
-    }
+        segment_points.clear();
+        for (size_t k = 0; k < static_cast<size_t>(num_segments); k++) {
+          // Zup -> Yup
+          real3 p(points_[3 * (strand_offsets_[i] + k) + 0],
+                  points_[3 * (strand_offsets_[i] + k) + 2],
+                  points_[3 * (strand_offsets_[i] + k) + 1]);
+          segment_points.push_back(p);
+        }
 
-    // Skip both endpoints
-    for (int s = 1; s < num_segments - 1; s++) {
-      int seg_idx = s - 1;
-      real3 q[4];
-      CamullRomToCubicBezier(q, segment_points.data(), num_segments, seg_idx);
-
-      vertices->push_back(vertex_scale[0] * q[0].x + vertex_translate[0]);
-      vertices->push_back(vertex_scale[1] * q[0].y + vertex_translate[1]);
-      vertices->push_back(vertex_scale[2] * q[0].z + vertex_translate[2]);
-      vertices->push_back(vertex_scale[0] * q[1].x + vertex_translate[0]);
-      vertices->push_back(vertex_scale[1] * q[1].y + vertex_translate[1]);
-      vertices->push_back(vertex_scale[2] * q[1].z + vertex_translate[2]);
-      vertices->push_back(vertex_scale[0] * q[2].x + vertex_translate[0]);
-      vertices->push_back(vertex_scale[1] * q[2].y + vertex_translate[1]);
-      vertices->push_back(vertex_scale[2] * q[2].z + vertex_translate[2]);
-      vertices->push_back(vertex_scale[0] * q[3].x + vertex_translate[0]);
-      vertices->push_back(vertex_scale[1] * q[3].y + vertex_translate[1]);
-      vertices->push_back(vertex_scale[2] * q[3].z + vertex_translate[2]);
-
-      if (user_thickness > 0) {
-        // Use user supplied thickness.
-        radiuss->push_back(user_thickness);
-        radiuss->push_back(user_thickness);
-        radiuss->push_back(user_thickness);
-        radiuss->push_back(user_thickness);
-      } else {
-        // TODO(syoyo) Support per point/segment thickness
-        radiuss->push_back(default_thickness_);
-        radiuss->push_back(default_thickness_);
-        radiuss->push_back(default_thickness_);
-        radiuss->push_back(default_thickness_);
+        // Skip both endpoints
+        float *v = vertices->data() + 12 * curve_offsets[i];
+        float *r = radiuss->data() + 4 * curve_offsets[i];
+        for (int s = 1; s < num_segments - 1; s++) {
+          int seg_idx = s - 1;
+          real3 q[4];
+          CamullRomToCubicBezier(q, segment_points.data(), num_segments, seg_idx);
+
+          for (int j = 0; j < 4; j++) {
+            *v++ = vertex_scale[0] * q[j].x + vertex_translate[0];
+            *v++ = vertex_scale[1] * q[j].y + vertex_translate[1];
+            *v++ = vertex_scale[2] * q[j].z + vertex_translate[2];
+          }
+
+          // TODO(syoyo) Support per point/segment thickness
+          for (int j = 0; j < 4; j++) {
+            *r++ = radius;
+          }
+        }
       }
-    }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
   }
 
   return true;
@@ -397,20 +406,56 @@ bool CyHair::ToCubicBezierCurves(std::vector<float> *vertices,
 // The above is cyhair_loader.{h,cc} basically directly; pbrt specific
 // code follows...
 
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <string>
+#include <thread>
 #include <vector>
 
+// Calls _format_ for each of the curves in [0, num_curves), in chunks that
+// are formatted in parallel, and writes the chunks to _f_ in order. Only one
+// chunk per core is held in memory at a time.
+template <typename F>
+static bool WriteCurves(FILE *f, size_t num_curves, F format) {
+    const size_t chunk_size = 16384;
+    std::vector<std::string> chunks(std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t start = 0; start < num_curves; start += chunks.size() * chunk_size) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < chunks.size(); ++t)
+            threads.emplace_back([&, t]() {
+                size_t begin = std::min(num_curves, start + t * chunk_size);
+                size_t end = std::min(num_curves, begin + chunk_size);
+                chunks[t].clear();
+                for (size_t i = begin; i < end; ++i)
+                    format(i, &chunks[t]);
+            });
+        for (std::thread &thread : threads)
+            thread.join();
+
+        for (const std::string &chunk : chunks)
+            if (fwrite(chunk.data(), 1, chunk.size(), f) != chunk.size())
+                return false;
+    }
+    return true;
+}
+
 int main(int argc, char *argv[]) {
     if (argc <= 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
-        fprintf(stderr, "usage: cyhair2pbrt [CyHair filename] [pbrt output filename] "
-                        "(max strands) (thickness)\n");
+        fprintf(stderr,
+                "usage: cyhair2pbrt [CyHair filename] [output filename] "
+                "(max strands) (thickness)\n"
+                "If the output filename ends in \".crv\", a binary curve file is "
+                "written instead,\nwhich can be used with 'Shape \"curve\" \"string "
+                "type\" \"cylinder\"\n\"string filename\" \"hair.crv\"'.\n");
         return EXIT_FAILURE;
     }
 
-    FILE *f = (strcmp(argv[2], "-") == 0) ? stdout : fopen(argv[2], "w");
+    const size_t len = strlen(argv[2]);
+    const bool binary = len > 4 && strcmp(argv[2] + len - 4, ".crv") == 0;
+    FILE *f = (strcmp(argv[2], "-") == 0) ? stdout : fopen(argv[2], binary ? "wb" : "w");
     if (!f) {
         perror(argv[2]);
         return EXIT_FAILURE;
@@ -454,27 +499,57 @@ int main(int argc, char *argv[]) {
                                     static_cast<double>(points[3 * i + c]) + thickness);
         }
     }
-    fprintf(f, "# Converted from \"%s\" by cyhair2pbrt\n", argv[1]);
-    fprintf(f, "# The number of strands = %d. user_thickness = %f\n",
-            static_cast<int>(radiuss.size() / 4), static_cast<double>(user_thickness));
-    fprintf(f, "# Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n\n\n", bounds[0][0],
-            bounds[0][1], bounds[0][2], bounds[1][0], bounds[1][1], bounds[1][2]);
 
     const size_t num_curves = radiuss.size() / 4;
-    for (size_t i = 0; i < num_curves; i++) {
-        fprintf(f, R"(Shape "curve" "string type" [ "cylinder" ] "point3 P" [ )");
-        for (size_t j = 0; j < 12; j++) {
-            fprintf(f, "%f ", static_cast<double>(points[12 * i + j]));
-        }
-        fprintf(f, " ] \"float width0\" [ %f ] \"float width1\" [ %f ]\n",
-                static_cast<double>(radiuss[4 * i + 0]),
-                static_cast<double>(radiuss[4 * i + 3]));
+    bool written;
+    if (binary) {
+        // Curve files start with a magic string and the number of curves,
+        // followed by each curve's 12 control point coordinates and its two
+        // widths; see ReadCurveFile() in src/pbrt/shapes.cpp.
+        uint64_t count = num_curves;
+        written = fwrite("pbrtcrv1", 1, 8, f) == 8 && fwrite(&count, 8, 1, f) == 1;
+        written = written && WriteCurves(f, num_curves, [&](size_t i, std::string *out) {
+                      float v[14];
+                      std::copy(&points[12 * i], &points[12 * i + 12], v);
+                      v[12] = radiuss[4 * i + 0];
+                      v[13] = radiuss[4 * i + 3];
+                      out->append(reinterpret_cast<const char *>(v), sizeof(v));
+                  });
+    } else {
+        fprintf(f, "# Converted from \"%s\" by cyhair2pbrt\n", argv[1]);
+        fprintf(f, "# The number of strands = %d. user_thickness = %f\n",
+                static_cast<int>(num_curves), static_cast<double>(user_thickness));
+        fprintf(f, "# Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n\n\n", bounds[0][0],
+                bounds[0][1], bounds[0][2], bounds[1][0], bounds[1][1], bounds[1][2]);
+
+        written = WriteCurves(f, num_curves, [&](size_t i, std::string *out) {
+            char buf[64];
+            out->append(R"(Shape "curve" "string type" [ "cylinder" ] "point3 P" [ )");
+            for (size_t j = 0; j < 12; j++) {
+                snprintf(buf, sizeof(buf), "%f ",
+                         static_cast<double>(points[12 * i + j]));
+                out->append(buf);
+            }
+            snprintf(buf, sizeof(buf), " ] \"float width0\" [ %f ] ",
+                     static_cast<double>(radiuss[4 * i + 0]));
+            out->append(buf);
+            snprintf(buf, sizeof(buf), "\"float width1\" [ %f ]\n",
+                     static_cast<double>(radiuss[4 * i + 3]));
+            out->append(buf);
+        });
+    }
+    if (!written) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
     }
 
     if (f != stdout)
         fclose(f);
 
-    fprintf(stderr, "Converted %d strands.\n", static_cast<int>(radiuss.size() / 4));
+    fprintf(stderr, "Converted %d strands.\n", static_cast<int>(num_curves));
+    if (binary)
+        fprintf(stderr, "Scene bounds: (%f, %f, %f) - (%f, %f, %f)\n", bounds[0][0],
+                bounds[0][1], bounds[0][2], bounds[1][0], bounds[1][1], bounds[1][2]);
 
     return EXIT_SUCCESS;
 }
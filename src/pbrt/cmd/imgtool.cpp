@@ -10,16 +10,20 @@
 #include <pbrt/util/check.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/mipmap.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/tilecache.h>
 #include <pbrt/util/vecmath.h>
 #include <pbrt/util/progressreporter.h>
 
@@ -29,10 +33,12 @@ extern "C" {
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <map>
 #include <string>
 
@@ -40,22 +46,12 @@ extern "C" {
 
 #ifdef PBRT_BUILD_GPU_RENDERER
 
+#include <pbrt/gpu/denoiser.h>
 #include <pbrt/gpu/memory.h>
 #include <pbrt/gpu/util.h>
 
 #include <cuda.h>
 #include <cuda_runtime.h>
-
-#include <optix.h>
-#include <optix_stubs.h>
-
-#define OPTIX_CHECK(EXPR)                                                           \
-    do {                                                                            \
-        OptixResult res = EXPR;                                                     \
-        if (res != OPTIX_SUCCESS)                                                   \
-            LOG_FATAL("OptiX call " #EXPR " failed with code %d: \"%s\"", int(res), \
-                      optixGetErrorString(res));                                    \
-    } while (false) /* eat semicolon */
 #endif
 
 // Stop that, Windows.
@@ -84,6 +80,15 @@ static std::map<std::string, CommandUsage> commandUsage = {
                  "    prefix.",
                  std::string(R"(
     --outfile          Output image filename.
+)")}},
+    {"batch", {"batch [options] <filename>",
+               "Run the imgtool commands in the given file, one per line, in a single\n"
+               "    process. Arguments are separated by whitespace and lines that are\n"
+               "    empty or start with '#' are ignored.",
+               std::string(R"(
+    --keep-going       Continue with the following commands after one fails.
+                       Errors that cause imgtool to exit, such as invalid
+                       arguments or unreadable images, still end the batch.
 )")}},
     {"cat", {"cat [options] <filename>",
              "Print the pixel values of the specified image to standard output.",
@@ -203,11 +208,26 @@ static std::map<std::string, CommandUsage> commandUsage = {
                       std::string(R"(
     --downsample <n>   Downsample the image by a factor of n in both dimensions
                        (using simple box filtering). Default: 1.
+)")}},
+    {"makemip", {"makemip [options] <filename>",
+                 "Write the MIP map pyramid used to filter an image texture to a\n"
+                 "    tiled file, which pbrt then uses in place of the image.",
+                 std::string(R"(
+    --encoding <name>  Color encoding of 8-bit image texels: "linear", "sRGB",
+                       or "gamma <value>". This must match the texture's
+                       "encoding" parameter. Default: "sRGB" for PNG images,
+                       "linear" otherwise.
+    --outfile <name>   Filename for the pyramid. Default: <filename>.mip
+    --wrap <mode>      Wrap mode used to filter the pyramid: "repeat", "clamp",
+                       "black", or "octahedralsphere". This must match the
+                       texture's "wrap" parameter. Default: "repeat".
 )")}},
     {"makesky", {"makesky [options] <filename>",
                  "Generate an environment map based on the Hosek-Wilkie sky model.",
                  std::string(R"(
     --albedo <a>       Albedo of ground-plane (range 0-1). Default: 0.5
+    --cache <dir>      Directory in which generated environment maps are cached and
+                       reused when the same sky parameters are requested again.
     --elevation <e>    Elevation of the sun in degrees (range 0-90). Default: 10
     --outfile <name>   Filename to store environment map in.
     --turbidity <t>    Atmospheric turbidity (range 1.7-10). Default: 3
@@ -284,8 +304,19 @@ int help(std::vector<std::string> args) {
     return 0;
 }
 
+// Calls _func_ with the coordinates of each pixel of an image with resolution
+// _res_, processing rows in parallel.
+template <typename F>
+static void ParallelForPixels(Point2i res, F func) {
+    ParallelFor(0, res.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = 0; x < res.x; ++x)
+                func(x, y);
+    });
+}
+
 int makesky(std::vector<std::string> args) {
-    std::string outfile;
+    std::string outfile, cacheDirectory;
     Float albedo = 0.5;
     Float turbidity = 3.;
     Float elevation = 10;
@@ -298,6 +329,7 @@ int makesky(std::vector<std::string> args) {
         };
         if (ParseArg(&iter, args.end(), "outfile", &outfile, onError) ||
             ParseArg(&iter, args.end(), "albedo", &albedo, onError) ||
+            ParseArg(&iter, args.end(), "cache", &cacheDirectory, onError) ||
             ParseArg(&iter, args.end(), "turbidity", &turbidity, onError) ||
             ParseArg(&iter, args.end(), "elevation", &elevation, onError) ||
             ParseArg(&iter, args.end(), "resolution", &resolution, onError)) {
@@ -318,6 +350,25 @@ int makesky(std::vector<std::string> args) {
     if (resolution < 1)
         usage("makesky", "--resolution must be >= 1");
 
+    // Reuse a previously generated environment map for these parameters, if cached
+    std::string cacheFilename;
+    if (!cacheDirectory.empty()) {
+        // Bump _skyCacheVersion_ whenever the generated images change
+        constexpr int skyCacheVersion = 1;
+        uint64_t key = Hash(skyCacheVersion, albedo, turbidity, elevation, resolution);
+        cacheFilename = StringPrintf("%s/sky-%016llx.exr", cacheDirectory,
+                                     (unsigned long long)key);
+        if (FileExists(cacheFilename)) {
+            ImageAndMetadata cached = Image::Read(cacheFilename);
+            if (cached.image.Resolution() == Point2i(resolution, resolution)) {
+                CHECK(cached.image.Write(outfile, cached.metadata));
+                return 0;
+            }
+            Warning("%s: cached sky image has unexpected resolution. Regenerating it.",
+                    cacheFilename);
+        }
+    }
+
     // Vector pointing at the sun. Note that elevation is measured from the
     // horizon--not the zenith, as it is elsewhere in pbrt.
     Vector3f sunDir(0., std::cos(elevation), std::sin(elevation));
@@ -374,6 +425,20 @@ int makesky(std::vector<std::string> args) {
     metadata.colorSpace = colorSpace;
     CHECK(img.Write(outfile, metadata));
 
+    if (!cacheFilename.empty()) {
+        // Write to a temporary file and rename it so that concurrent invocations
+        // never see a partially-written cache file
+        uint64_t tempSuffix = MixBits(uint64_t(time(nullptr)) ^ (uintptr_t)&img);
+        std::string tempFilename = StringPrintf("%s.%016llx.tmp.exr", cacheFilename,
+                                                (unsigned long long)tempSuffix);
+        if (img.Write(tempFilename, metadata) &&
+            std::rename(tempFilename.c_str(), cacheFilename.c_str()) != 0) {
+            if (!FileExists(cacheFilename))
+                Warning("%s: %s", cacheFilename, ErrorString());
+            std::remove(tempFilename.c_str());
+        }
+    }
+
     return 0;
 }
 
@@ -1086,25 +1151,25 @@ int diff(std::vector<std::string> args) {
                         "color spaces!");
 
     // Clamp Infs
-    int nClamped = 0, nRefClamped = 0;
-    for (int y = 0; y < image.Resolution().y; ++y)
-        for (int x = 0; x < image.Resolution().x; ++x)
-            for (int c = 0; c < image.NChannels(); ++c) {
-                if (std::isinf(image.GetChannel({x, y}, c))) {
-                    ++nClamped;
-                    image.SetChannel({x, y}, c, 0);
-                }
-                if (std::isinf(refImage.GetChannel({x, y}, c))) {
-                    ++nRefClamped;
-                    refImage.SetChannel({x, y}, c, 0);
-                }
+    std::atomic<int> nClamped{0}, nRefClamped{0};
+    ParallelForPixels(image.Resolution(), [&](int x, int y) {
+        for (int c = 0; c < image.NChannels(); ++c) {
+            if (std::isinf(image.GetChannel({x, y}, c))) {
+                ++nClamped;
+                image.SetChannel({x, y}, c, 0);
+            }
+            if (std::isinf(refImage.GetChannel({x, y}, c))) {
+                ++nRefClamped;
+                refImage.SetChannel({x, y}, c, 0);
             }
+        }
+    });
     if (nClamped > 0)
         fprintf(stderr, "%s: clamped %d infinite pixel values.\n", imageFile.c_str(),
-                nClamped);
+                nClamped.load());
     if (nRefClamped > 0)
         fprintf(stderr, "%s: clamped %d infinite pixel values.\n", referenceFile.c_str(),
-                nRefClamped);
+                nRefClamped.load());
 
     // Image averages. Compute before FLIP potentially goes and clamps things...
     Float refAverage = refImage.Average(refImage.AllChannelsDesc()).Average();
@@ -1132,12 +1197,13 @@ int diff(std::vector<std::string> args) {
         refImage = refImage.ConvertToFormat(PixelFormat::Float);
 
         // Clamp to [0,1]...
-        for (int y = 0; y < image.Resolution().y; ++y)
-            for (int x = 0; x < image.Resolution().x; ++x)
-                for (int c = 0; c < image.NChannels(); ++c) {
-                    image.SetChannel({x, y}, c, Clamp(image.GetChannel({x, y}, c), 0, 1));
-                    refImage.SetChannel({x, y}, c, Clamp(refImage.GetChannel({x, y}, c), 0, 1));
-                }
+        ParallelForPixels(image.Resolution(), [&](int x, int y) {
+            for (int c = 0; c < image.NChannels(); ++c) {
+                image.SetChannel({x, y}, c, Clamp(image.GetChannel({x, y}, c), 0, 1));
+                refImage.SetChannel({x, y}, c,
+                                    Clamp(refImage.GetChannel({x, y}, c), 0, 1));
+            }
+        });
 
         ComputeFLIPError((float *)image.RawPointer({0, 0}),
                          (float *)refImage.RawPointer({0, 0}),
@@ -1145,14 +1211,9 @@ int diff(std::vector<std::string> args) {
                          image.Resolution().x, image.Resolution().y,
                          opt);
 
+        Float averageError = errorImage.Average(errorImage.AllChannelsDesc())[0];
         for (int c = 0; c < image.NChannels(); ++c)
-            error[c] = 0;
-        for (int y = 0; y < image.Resolution().y; ++y)
-            for (int x = 0; x < image.Resolution().x; ++x)
-                for (int c = 0; c < image.NChannels(); ++c)
-                    error[c] += errorImage.GetChannel({x, y}, 0);
-        for (int c = 0; c < image.NChannels(); ++c)
-            error[c] /= image.Resolution().x * image.Resolution().y;
+            error[c] = averageError;
     }
 
     if (error.MaxValue() == 0)
@@ -1519,25 +1580,23 @@ int bloom(std::vector<std::string> args) {
     std::vector<Image> blurred;
 
     // First, threshold the source image
-    int nSurvivors = 0;
+    std::atomic<int> nSurvivors{0};
     Point2i res = image.Resolution();
     int nc = image.NChannels();
     Image thresholdedImage(PixelFormat::Float, image.Resolution(), image.ChannelNames());
-    for (int y = 0; y < res.y; ++y) {
-        for (int x = 0; x < res.x; ++x) {
-            bool overThreshold = false;
+    ParallelForPixels(res, [&](int x, int y) {
+        bool overThreshold = false;
+        for (int c = 0; c < nc; ++c)
+            if (image.GetChannel({x, y}, c) > level)
+                overThreshold = true;
+        if (overThreshold) {
+            ++nSurvivors;
             for (int c = 0; c < nc; ++c)
-                if (image.GetChannel({x, y}, c) > level)
-                    overThreshold = true;
-            if (overThreshold) {
-                ++nSurvivors;
-                for (int c = 0; c < nc; ++c)
-                    thresholdedImage.SetChannel({x, y}, c, image.GetChannel({x, y}, c));
-            } else
-                for (int c = 0; c < nc; ++c)
-                    thresholdedImage.SetChannel({x, y}, c, 0.f);
-        }
-    }
+                thresholdedImage.SetChannel({x, y}, c, image.GetChannel({x, y}, c));
+        } else
+            for (int c = 0; c < nc; ++c)
+                thresholdedImage.SetChannel({x, y}, c, 0.f);
+    });
     if (nSurvivors == 0) {
         fprintf(stderr, "imgtool: no pixels were above bloom threshold %f\n", level);
         return 1;
@@ -1561,21 +1620,19 @@ int bloom(std::vector<std::string> args) {
     }
 
     // Finally, add all of the blurred images, scaled, to the original.
-    for (int y = 0; y < res.y; ++y) {
-        for (int x = 0; x < res.x; ++x) {
-            for (int c = 0; c < nc; ++c) {
-                Float blurredSum = 0.f;
-                // Skip the thresholded image, since it's already
-                // present in the original; just add pixels from the
-                // blurred ones.
-                for (size_t j = 1; j < blurred.size(); ++j)
-                    blurredSum += blurred[j].GetChannel({x, y}, c);
-                image.SetChannel(
-                    {x, y}, c,
-                    image.GetChannel({x, y}, c) + (scale / iterations) * blurredSum);
-            }
+    ParallelForPixels(res, [&](int x, int y) {
+        for (int c = 0; c < nc; ++c) {
+            Float blurredSum = 0.f;
+            // Skip the thresholded image, since it's already
+            // present in the original; just add pixels from the
+            // blurred ones.
+            for (size_t j = 1; j < blurred.size(); ++j)
+                blurredSum += blurred[j].GetChannel({x, y}, c);
+            image.SetChannel(
+                {x, y}, c,
+                image.GetChannel({x, y}, c) + (scale / iterations) * blurredSum);
         }
-    }
+    });
 
     image.Write(outFile);
 
@@ -1705,141 +1762,124 @@ int convert(std::vector<std::string> args) {
                                                  ? *metadata.colorSpace
                                                  : RGBColorSpace::sRGB;
         SquareMatrix<3> m = ConvertRGBColorSpace(*srcColorSpace, *dest);
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x) {
-                ImageChannelValues channels = image.GetChannels({x, y}, rgbDesc);
-                RGB rgb = Mul<RGB>(m, channels);
-                image.SetChannels({x, y}, rgbDesc, {rgb.r, rgb.g, rgb.b});
-            }
+        ParallelForPixels(res, [&](int x, int y) {
+            ImageChannelValues channels = image.GetChannels({x, y}, rgbDesc);
+            RGB rgb = Mul<RGB>(m, channels);
+            image.SetChannels({x, y}, rgbDesc, {rgb.r, rgb.g, rgb.b});
+        });
         metadata.colorSpace = dest;
     }
 
     if (bw) {
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x) {
-                Float sum = 0;
-                for (int c = 0; c < nc; ++c)
-                    sum += image.GetChannel({x, y}, c);
-                sum /= nc;
-                for (int c = 0; c < nc; ++c)
-                    image.SetChannel({x, y}, c, sum);
-            }
+        ParallelForPixels(res, [&](int x, int y) {
+            Float sum = 0;
+            for (int c = 0; c < nc; ++c)
+                sum += image.GetChannel({x, y}, c);
+            sum /= nc;
+            for (int c = 0; c < nc; ++c)
+                image.SetChannel({x, y}, c, sum);
+        });
     }
 
     if (despikeLimit < Infinity) {
         Image filteredImg = image;
-        int despikeCount = 0;
-        std::vector<ImageChannelValues> neighbors;
-        for (int i = 0; i < 9; ++i)
-            neighbors.push_back(ImageChannelValues(image.NChannels()));
-
-        for (int y = 0; y < res.y; ++y) {
-            for (int x = 0; x < res.x; ++x) {
-                if (image.GetChannels({x, y}).Average() < despikeLimit)
-                    continue;
-
-                // Copy all of the valid neighbor pixels into neighbors[].
-                ++despikeCount;
-                int validNeighbors = 0;
-                for (int dy = -1; dy <= 1; ++dy) {
-                    if (y + dy < 0 || y + dy >= res.y)
+        std::atomic<int> despikeCount{0};
+        ParallelFor(0, res.y, [&](int64_t y0, int64_t y1) {
+            std::vector<ImageChannelValues> neighbors;
+            for (int i = 0; i < 9; ++i)
+                neighbors.push_back(ImageChannelValues(image.NChannels()));
+
+            for (int y = y0; y < y1; ++y) {
+                for (int x = 0; x < res.x; ++x) {
+                    if (image.GetChannels({x, y}).Average() < despikeLimit)
                         continue;
-                    for (int dx = -1; dx <= 1; ++dx) {
-                        if (x + dx < 0 || x + dx > res.x)
+
+                    // Copy all of the valid neighbor pixels into neighbors[].
+                    ++despikeCount;
+                    int validNeighbors = 0;
+                    for (int dy = -1; dy <= 1; ++dy) {
+                        if (y + dy < 0 || y + dy >= res.y)
                             continue;
-                        neighbors[validNeighbors++] = image.GetChannels({x + dx, y + dy});
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            if (x + dx < 0 || x + dx > res.x)
+                                continue;
+                            neighbors[validNeighbors++] =
+                                image.GetChannels({x + dx, y + dy});
+                        }
                     }
-                }
 
-                // Find the median of the neighbors, sorted by average value.
-                int mid = validNeighbors / 2;
-                std::nth_element(
-                    &neighbors[0], &neighbors[mid], &neighbors[validNeighbors],
-                    [](const ImageChannelValues &a, const ImageChannelValues &b) -> bool {
-                        return a.Average() < b.Average();
-                    });
-                filteredImg.SetChannels({x, y}, neighbors[mid]);
+                    // Find the median of the neighbors, sorted by average value.
+                    int mid = validNeighbors / 2;
+                    std::nth_element(&neighbors[0], &neighbors[mid],
+                                     &neighbors[validNeighbors],
+                                     [](const ImageChannelValues &a,
+                                        const ImageChannelValues &b) -> bool {
+                                         return a.Average() < b.Average();
+                                     });
+                    filteredImg.SetChannels({x, y}, neighbors[mid]);
+                }
             }
-        }
+        });
         pstd::swap(image, filteredImg);
-        fprintf(stderr, "%s: despiked %d pixels\n", inFile.c_str(), despikeCount);
-    }
+        fprintf(stderr, "%s: despiked %d pixels\n", inFile.c_str(),
+                despikeCount.load());
+    }
+
+    // Approximation via
+    // https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+    auto ACESFilm = [](Float x) -> Float {
+        if (x <= 0)
+            return 0;
+        Float a = 2.51f;
+        Float b = 0.03f;
+        Float c = 2.43f;
+        Float d = 0.59f;
+        Float e = 0.14f;
+        return Clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0, 1);
+    };
 
-    if (scale != 1) {
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x)
+    // Apply the remaining per-pixel operations in a single pass over the image
+    if (scale != 1 || gamma != 1 || tonemap || preserveColors || acesFilmic)
+        ParallelForPixels(res, [&](int x, int y) {
+            ImageChannelValues v = image.GetChannels({x, y});
+            if (scale != 1)
                 for (int c = 0; c < nc; ++c)
-                    image.SetChannel({x, y}, c, scale * image.GetChannel({x, y}, c));
-    }
+                    v[c] *= scale;
 
-    if (gamma != 1) {
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x)
+            if (gamma != 1)
                 for (int c = 0; c < nc; ++c)
-                    image.SetChannel(
-                        {x, y}, c,
-                        std::pow(std::max<Float>(0, image.GetChannel({x, y}, c)), gamma));
-    }
+                    v[c] = std::pow(std::max<Float>(0, v[c]), gamma);
 
-    if (tonemap) {
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x) {
-                Float lum = image.GetChannels({x, y}).Average();
+            if (tonemap) {
+                Float lum = v.Average();
                 // Reinhard et al. photographic tone mapping operator.
                 Float scale = (1 + lum / (maxY * maxY)) / (1 + lum);
                 for (int c = 0; c < nc; ++c)
-                    image.SetChannel({x, y}, c, scale * image.GetChannel({x, y}, c));
+                    v[c] *= scale;
             }
-    }
 
-    if (preserveColors) {
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x) {
-                Float m = image.GetChannel({x, y}, 0);
-                for (int c = 1; c < nc; ++c)
-                    m = std::max(m, image.GetChannel({x, y}, c));
-                if (m > 1) {
+            if (preserveColors) {
+                Float m = v.MaxValue();
+                if (m > 1)
                     for (int c = 0; c < nc; ++c)
-                        image.SetChannel({x, y}, c, image.GetChannel({x, y}, c) / m);
-                }
+                        v[c] /= m;
             }
-    }
 
-    if (acesFilmic) {
-        // Approximation via
-        // https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
-        auto ACESFilm = [](Float x) -> Float {
-            if (x <= 0)
-                return 0;
-            Float a = 2.51f;
-            Float b = 0.03f;
-            Float c = 2.43f;
-            Float d = 0.59f;
-            Float e = 0.14f;
-            return Clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0, 1);
-        };
+            if (acesFilmic)
+                for (int c = 0; c < nc; ++c)
+                    v[c] = ACESFilm(v[c]);
 
-        for (int y = 0; y < res.y; ++y)
-            for (int x = 0; x < res.x; ++x) {
-                for (int c = 0; c < nc; ++c) {
-                    Float v = image.GetChannel({x, y}, c);
-                    v = ACESFilm(v);
-                    image.SetChannel({x, y}, c, v);
-                }
-            }
-    }
+            image.SetChannels({x, y}, v);
+        });
 
     if (repeat > 1) {
         Image scaledImage(image.Format(), Point2i(res.x * repeat, res.y * repeat),
                           image.ChannelNames(), image.Encoding());
-        for (int y = 0; y < repeat * res.y; ++y) {
-            int yy = y / repeat;
-            for (int x = 0; x < repeat * res.x; ++x) {
-                int xx = x / repeat;
-                for (int c = 0; c < nc; ++c)
-                    scaledImage.SetChannel({x, y}, c, image.GetChannel({xx, yy}, c));
-            }
-        }
+        ParallelForPixels(scaledImage.Resolution(), [&](int x, int y) {
+            for (int c = 0; c < nc; ++c)
+                scaledImage.SetChannel({x, y}, c,
+                                       image.GetChannel({x / repeat, y / repeat}, c));
+        });
         image = std::move(scaledImage);
         res = image.Resolution();
     }
@@ -2002,6 +2042,47 @@ int makeemitters(std::vector<std::string> args) {
     return 0;
 }
 
+int makemip(std::vector<std::string> args) {
+    std::string inFilename, outFilename, encodingName, wrapName = "repeat";
+
+    auto onError = [](const std::string &err) {
+        usage("makemip", "%s", err.c_str());
+        exit(1);
+    };
+    for (auto iter = args.begin(); iter != args.end(); ++iter) {
+        if (ParseArg(&iter, args.end(), "encoding", &encodingName, onError) ||
+            ParseArg(&iter, args.end(), "outfile", &outFilename, onError) ||
+            ParseArg(&iter, args.end(), "wrap", &wrapName, onError)) {
+            // success
+        } else if ((*iter)[0] == '-')
+            usage("makemip", "%s: unknown command flag", iter->c_str());
+        else if (inFilename.empty()) {
+            inFilename = *iter;
+        } else
+            usage("makemip", "multiple input filenames provided.");
+    }
+    if (inFilename.empty())
+        usage("makemip", "input image filename must be provided.");
+    if (outFilename.empty())
+        outFilename = PyramidFilename(inFilename);
+    if (encodingName.empty())
+        encodingName = HasExtension(inFilename, "png") ? "sRGB" : "linear";
+
+    pstd::optional<WrapMode> wrapMode = ParseWrapMode(wrapName.c_str());
+    if (!wrapMode)
+        usage("makemip", "%s: wrap mode unknown", wrapName.c_str());
+    ColorEncoding encoding = ColorEncoding::Get(encodingName, {});
+
+    if (!MIPMap::WritePyramidFile(inFilename, *wrapMode, encoding, outFilename)) {
+        fprintf(stderr,
+                "%s: unable to write pyramid file. (8-bit images must be written "
+                "with their own color encoding.)\n",
+                outFilename.c_str());
+        return 1;
+    }
+    return 0;
+}
+
 int makeequiarea(std::vector<std::string> args) {
     std::string inFilename, outFilename;
     int resolution = 0;
@@ -2097,167 +2178,6 @@ int makeequiarea(std::vector<std::string> args) {
     return 0;
 }
 
-Image denoiseImage(const Image &in, const ImageChannelDesc &Ldesc,
-                   const Image &varianceImage, const ImageChannelDesc &albedoDesc,
-                   const ImageChannelDesc &zDesc, const ImageChannelDesc &deltaZDesc,
-                   const ImageChannelDesc &nDesc, int halfWidth, int nLevels) {
-    Image illum(PixelFormat::Float, in.Resolution(), {"R", "G", "B"});
-    for (int y = 0; y < in.Resolution().y; ++y)
-        for (int x = 0; x < in.Resolution().x; ++x) {
-            ImageChannelValues albedo = in.GetChannels({x, y}, albedoDesc);
-            ImageChannelValues L = in.GetChannels({x, y}, Ldesc);
-            for (int c = 0; c < 3; ++c)
-                if (albedo[c] > 0)
-                    illum.SetChannel({x, y}, c, L[c] / albedo[c]);
-                else
-                    illum.SetChannel({x, y}, c, L[c]);
-        }
-
-    std::vector<Float> f(halfWidth + 1, 0.);
-    for (int i = 0; i <= halfWidth; ++i)
-        f[i] = FastExp(-Float(i) / halfWidth * 3.f);
-
-    static int call = -1;
-    ++call;
-
-    Image currentImage = std::move(illum);
-    for (int i = 0; i < nLevels; ++i) {
-        int delta = 1 << i;  // A-Trous step between samples.
-
-        Image filtered(PixelFormat::Float, in.Resolution(), {"R", "G", "B"});
-        // Image wImage(PixelFormat::Float, in.Resolution(), 3, "Wp,Wn,Wc");
-        // Image dzImage(PixelFormat::Float, in.Resolution(), 1, "Y");
-
-        ParallelFor(0, currentImage.Resolution().y, [&](int64_t start, int64_t end) {
-            for (int y = start; y < end; ++y) {
-                for (int x = 0; x < currentImage.Resolution().x; ++x) {
-                    float wsum = 0;
-                    ImageChannelValues c = currentImage.GetChannels({x, y});
-
-                    Float z = in.GetChannels({x, y}, zDesc);
-                    // FIXME: hack multiply to cancel out scaled ray
-                    // differentials...
-                    Float dzdx = 8 * in.GetChannels({x, y}, deltaZDesc)[0];
-                    Float dzdy = 8 * in.GetChannels({x, y}, deltaZDesc)[1];
-
-                    ImageChannelValues nChan = in.GetChannels({x, y}, nDesc);
-                    Normal3f n = Normal3f(nChan[0], nChan[1], nChan[2]);
-                    if (n == Normal3f(0, 0, 0))
-                        // background pixel
-                        continue;
-
-                    Float pixelVariance = varianceImage.GetChannel({x, y}, 0);
-                    float result[3] = {0.f};
-                    float wpSum = 0, wnSum = 0, wcSum = 0;
-                    // if (pixelVariance > .001) {
-                    // pixelVariance = std::max<Float>(pixelVariance,
-                    // .000001); {
-                    {
-                        // Higher sigma -> more blur
-                        // Float sigma_y = .05;
-                        Float sigma_z = .005;
-
-                        // sigma_y = pixelVariance * 50;
-                        // sigma_y = std::sqrt(std::sqrt(pixelVariance)) *
-                        // 10 * sigmaYScale;
-
-                        for (int dy = -halfWidth * delta; dy <= halfWidth * delta;
-                             dy += delta) {
-                            if (y + dy < 0 || y + dy >= currentImage.Resolution().y)
-                                continue;
-                            for (int dx = -halfWidth * delta; dx <= halfWidth * delta;
-                                 dx += delta) {
-                                if (x + dx < 0 || x + dx >= currentImage.Resolution().x)
-                                    continue;
-                                ImageChannelValues co =
-                                    currentImage.GetChannels({x + dx, y + dy});
-                                Float dc2 = (Sqr(c[0] - co[0]) + Sqr(c[1] - co[1]) +
-                                             Sqr(c[2] - co[2]));  // squared color
-                                                                  // difference
-                                Float otherVariance =
-                                    varianceImage.GetChannel({x + dx, y + dy}, 0);
-                                Float d2 =
-                                    std::max<Float>(0, dc2 - (pixelVariance +
-                                                              std::min(pixelVariance,
-                                                                       otherVariance))) /
-                                    (1e-4 + 0.36f * (pixelVariance + otherVariance));
-
-                                Float zo = in.GetChannels({x + dx, y + dy}, zDesc);
-                                ImageChannelValues noChan =
-                                    in.GetChannels({x + dx, y + dy}, nDesc);
-                                Normal3f no = Normal3f(noChan[0], noChan[1], noChan[2]);
-                                if (no == Normal3f(0, 0, 0))
-                                    // background pixel;
-                                    continue;
-
-                                Float zp = z + dx * dzdx + dy * dzdy;
-                                Float dz = (z - zp) / ((z + zp) * 0.5f);
-
-                                // Assume camera space position...
-                                Float wp = Gaussian(dz, 0, sigma_z) *
-                                           f[std::abs(dy / delta)] *
-                                           f[std::abs(dx / delta)];
-                                Float wn = Pow<32>(std::max<float>(0, Dot(n, no)));
-                                Float wc =
-                                    FastExp(-d2 / 90);  // Gaussian(dc, 0, sigma_y);
-                                CHECK(!std::isnan(wc));
-                                wpSum += wp;
-                                wnSum += wn;
-                                wcSum += wc;
-                                Float w = wp * wn * wc;
-
-                                // CO fprintf(stderr, "(%d, %d) dc2 %f var
-                                // %f other var %f -> d2 %f\n", CO x, y,
-                                // dc2, pixelVariance, otherVariance, d2);
-
-                                CHECK(!std::isnan(w));
-                                if (w == 0)
-                                    continue;
-
-                                for (int c = 0; c < 3; ++c) {
-                                    result[c] +=
-                                        w * currentImage.GetChannel({x + dx, y + dy}, c);
-                                    CHECK(!std::isnan(result[c]));
-                                }
-                                wsum += w;
-                            }
-                        }
-                    }
-                    for (int c = 0; c < 3; ++c)
-                        if (wsum > 0) {
-                            filtered.SetChannel({x, y}, c, result[c] / wsum);
-                            // wImage.SetChannels({x, y}, {wpSum, wnSum,
-                            // wcSum});
-                        } else
-                            filtered.SetChannel({x, y}, c,
-                                                currentImage.GetChannel({x, y}, c));
-                }
-            }
-        });
-
-        // filtered.Write(StringPrintf("filtered-%d-%d.exr", call, i));
-        // wImage.Write(StringPrintf("weights%d.exr", i));
-        //        if (i == 0)
-        //  dzImage.Write("dz.exr");
-
-        pstd::swap(filtered, currentImage);
-    }
-
-    // static int i = 0;
-    // currentImage.Write(StringPrintf("filteredillum-%d.exr", i++));
-
-    // reincorporate albedo
-    for (int y = 0; y < currentImage.Resolution().y; ++y)
-        for (int x = 0; x < currentImage.Resolution().x; ++x) {
-            ImageChannelValues albedo = in.GetChannels({x, y}, albedoDesc);
-            for (int c = 0; c < 3; ++c)
-                currentImage.SetChannel({x, y}, c,
-                                        currentImage.GetChannel({x, y}, c) * albedo[c]);
-        }
-
-    return currentImage;
-}
-
 int denoise(std::vector<std::string> args) {
     std::string inFilename, outFilename;
 
@@ -2313,16 +2233,15 @@ int denoise(std::vector<std::string> args) {
 
     int halfWidth = 3;
     int nLevels = 3;
-    Image denoisedImage = denoiseImage(in, rgbDesc, filteredVariance, albedoDesc, zDesc,
+    Image denoisedImage = DenoiseImage(in, rgbDesc, filteredVariance, albedoDesc, zDesc,
                                        deltaZDesc, nsDesc, halfWidth, nLevels);
 
     Image result(PixelFormat::Float, in.Resolution(), {"R", "G", "B"});
-    for (int y = 0; y < in.Resolution().y; ++y)
-        for (int x = 0; x < in.Resolution().x; ++x) {
-            ImageChannelValues Ldenoised = denoisedImage.GetChannels({x, y});
-            for (int c = 0; c < 3; ++c)
-                result.SetChannel({x, y}, c, Ldenoised[c]);
-        }
+    ParallelForPixels(in.Resolution(), [&](int x, int y) {
+        ImageChannelValues Ldenoised = denoisedImage.GetChannels({x, y});
+        for (int c = 0; c < 3; ++c)
+            result.SetChannel({x, y}, c, Ldenoised[c]);
+    });
 
     if (!result.Write(outFilename)) {
         fprintf(stderr, "%s: couldn't write image.\n", outFilename.c_str());
@@ -2356,18 +2275,10 @@ int denoise_optix(std::vector<std::string> args) {
 
     CUDA_CHECK(cudaFree(nullptr));
 
-    CUcontext cudaContext;
-    CU_CHECK(cuCtxGetCurrent(&cudaContext));
-    CHECK(cudaContext != nullptr);
-
-    OPTIX_CHECK(optixInit());
-    OptixDeviceContext optixContext;
-    OPTIX_CHECK(optixDeviceContextCreate(cudaContext, 0, &optixContext));
-
     ImageAndMetadata im = Image::Read(inFilename);
     Image &image = im.image;
 
-    int nLayers = 3;
+    bool haveAlbedoAndNormal = true;
     ImageChannelDesc desc[3] = {
         image.GetChannelDesc({"R", "G", "B"}),
         image.GetChannelDesc({"Albedo.R", "Albedo.G", "Albedo.B"}),
@@ -2379,119 +2290,37 @@ int denoise_optix(std::vector<std::string> args) {
     if (!desc[1]) {
         fprintf(stderr, "Warning: %s: image doesn't have Albedo.{R,G,B} channels. "
                 "Denoising quality may suffer.\n", inFilename.c_str());
-        nLayers = 1;
+        haveAlbedoAndNormal = false;
     }
     if (!desc[2]) {
         fprintf(stderr, "Warning: %s: image doesn't have Nsx, Nsy, Nsz channels. "
                 "Denoising quality may suffer.\n", inFilename.c_str());
-        nLayers = 1;
+        haveAlbedoAndNormal = false;
     }
 
-    OptixDenoiserOptions options = {};
-#if (OPTIX_VERSION >= 70300)
-    if (nLayers == 3)
-        options.guideAlbedo = options.guideNormal = 1;
-
-    OptixDenoiser denoiserHandle;
-    OPTIX_CHECK(optixDenoiserCreate(optixContext, OPTIX_DENOISER_MODEL_KIND_HDR,
-                                    &options, &denoiserHandle));
-#else
-    options.inputKind = (nLayers == 3) ? OPTIX_DENOISER_INPUT_RGB_ALBEDO_NORMAL :
-        OPTIX_DENOISER_INPUT_RGB;
-
-    OptixDenoiser denoiserHandle;
-    OPTIX_CHECK(optixDenoiserCreate(optixContext, &options, &denoiserHandle));
-
-    OPTIX_CHECK(
-        optixDenoiserSetModel(denoiserHandle, OPTIX_DENOISER_MODEL_KIND_HDR, nullptr, 0));
-#endif
-
-    OptixDenoiserSizes memorySizes;
-    OPTIX_CHECK(optixDenoiserComputeMemoryResources(denoiserHandle, image.Resolution().x,
-                                                    image.Resolution().y, &memorySizes));
-
-    void *denoiserState;
-    CUDA_CHECK(cudaMalloc(&denoiserState, memorySizes.stateSizeInBytes));
-    void *scratchBuffer;
-    CUDA_CHECK(cudaMalloc(&scratchBuffer, memorySizes.withoutOverlapScratchSizeInBytes));
-
-    OPTIX_CHECK(optixDenoiserSetup(
-        denoiserHandle, 0 /* stream */, image.Resolution().x, image.Resolution().y,
-        CUdeviceptr(denoiserState), memorySizes.stateSizeInBytes,
-        CUdeviceptr(scratchBuffer), memorySizes.withoutOverlapScratchSizeInBytes));
-
     CUDAMemoryResource cudaMemoryResource;
     Allocator alloc(&cudaMemoryResource);
 
-    OptixImage2D *inputLayers = alloc.allocate_object<OptixImage2D>(nLayers);
-    for (int i = 0; i < nLayers; ++i) {
-        inputLayers[i].width = image.Resolution().x;
-        inputLayers[i].height = image.Resolution().y;
-        inputLayers[i].rowStrideInBytes = image.Resolution().x * 3 * sizeof(float);
-        inputLayers[i].pixelStrideInBytes = 0;
-        inputLayers[i].format = OPTIX_PIXEL_FORMAT_FLOAT3;
-
-        size_t sz = 3 * image.Resolution().x * image.Resolution().y;
-        float *buf = alloc.allocate_object<float>(sz);
-        int offset = 0;
-        for (int y = 0; y < image.Resolution().y; ++y)
-            for (int x = 0; x < image.Resolution().x; ++x) {
-                ImageChannelValues v = image.GetChannels({x, y}, desc[i]);
-                if (i == 2)
-                    v[2] *= -1;  // flip z--right handed...
-                for (int c = 0; c < 3; ++c)
-                    buf[offset++] = v[c];
-            }
-
-        inputLayers[i].data = CUdeviceptr(buf);
-    }
-
-    OptixImage2D *outputImage = alloc.allocate_object<OptixImage2D>();
-    outputImage->width = image.Resolution().x;
-    outputImage->height = image.Resolution().y;
-    outputImage->rowStrideInBytes = image.Resolution().x * 3 * sizeof(float);
-    outputImage->pixelStrideInBytes = 0;
-    outputImage->format = OPTIX_PIXEL_FORMAT_FLOAT3;
-
-    float *intensity = alloc.allocate_object<float>();
-    OPTIX_CHECK(optixDenoiserComputeIntensity(
-        denoiserHandle, 0 /* stream */, &inputLayers[0], CUdeviceptr(intensity),
-        CUdeviceptr(scratchBuffer), memorySizes.withoutOverlapScratchSizeInBytes));
-
-    size_t sz = 3 * image.Resolution().x * image.Resolution().y;
-    pstd::vector<float> buf(sz, alloc);
-    outputImage->data = CUdeviceptr(buf.data());
-
-    OptixDenoiserParams params = {};
-    params.denoiseAlpha = 0;
-    params.hdrIntensity = CUdeviceptr(intensity);
-    params.blendFactor = 0;  // TODO what should this be??
-
-#if (OPTIX_VERSION >= 70300)
-    OptixDenoiserGuideLayer guideLayer;
-    if (nLayers == 3) {
-        guideLayer.albedo = inputLayers[1];
-        guideLayer.normal = inputLayers[2];
-    }
-    OptixDenoiserLayer layers;
-    layers.input = inputLayers[0];
-    layers.output = *outputImage;
-
-    OPTIX_CHECK(optixDenoiserInvoke(
-        denoiserHandle, 0 /* stream */, &params, CUdeviceptr(denoiserState),
-        memorySizes.stateSizeInBytes, &guideLayer, &layers,
-        1 /* # layers to denoise */, 0 /* offset x */, 0 /* offset y */,
-        CUdeviceptr(scratchBuffer),
-        memorySizes.withoutOverlapScratchSizeInBytes));
-#else
-    OPTIX_CHECK(optixDenoiserInvoke(
-        denoiserHandle, 0 /* stream */, &params, CUdeviceptr(denoiserState),
-        memorySizes.stateSizeInBytes, inputLayers, nLayers, 0 /* offset x */, 0 /* offset y */,
-        outputImage, CUdeviceptr(scratchBuffer),
-        memorySizes.withoutOverlapScratchSizeInBytes));
-#endif
+    size_t nPixels = size_t(image.Resolution().x) * image.Resolution().y;
+    pstd::vector<RGB> rgb(nPixels, alloc), albedo(nPixels, alloc);
+    pstd::vector<Normal3f> n(nPixels, alloc);
+    ParallelForPixels(image.Resolution(), [&](int x, int y) {
+        size_t offset = size_t(y) * image.Resolution().x + x;
+        ImageChannelValues v = image.GetChannels({x, y}, desc[0]);
+        rgb[offset] = RGB(v[0], v[1], v[2]);
+        if (haveAlbedoAndNormal) {
+            v = image.GetChannels({x, y}, desc[1]);
+            albedo[offset] = RGB(v[0], v[1], v[2]);
+            v = image.GetChannels({x, y}, desc[2]);
+            // flip z--right handed...
+            n[offset] = Normal3f(v[0], v[1], -v[2]);
+        }
+    });
 
-    CUDA_CHECK(cudaDeviceSynchronize());
+    pstd::vector<float> buf(3 * nPixels, alloc);
+    Denoiser denoiser(Vector2i(image.Resolution()), haveAlbedoAndNormal);
+    denoiser.Denoise(rgb.data(), haveAlbedoAndNormal ? n.data() : nullptr,
+                     haveAlbedoAndNormal ? albedo.data() : nullptr, (RGB *)buf.data());
 
     Image result(buf, image.Resolution(), {"R", "G", "B"});
     CHECK(result.Write(outFilename));
@@ -2500,20 +2329,7 @@ int denoise_optix(std::vector<std::string> args) {
 }
 #endif  // PBRT_BUILD_GPU_RENDERER
 
-int main(int argc, char *argv[]) {
-    PBRTOptions opt;
-    opt.quiet = true;
-    InitPBRT(opt);
-
-    if (argc < 2) {
-        help();
-        return 0;
-    }
-
-    std::vector<std::string> args = GetCommandLineArguments(argv);
-    std::string cmd = args[0];
-    args.erase(args.begin());
-
+static int runCommand(const std::string &cmd, std::vector<std::string> args) {
     if (cmd == "average")
         return average(args);
     else if (cmd == "assemble")
@@ -2537,19 +2353,96 @@ int main(int argc, char *argv[]) {
     else if (cmd == "falsecolor")
         return falsecolor(args);
     else if (cmd == "help" || cmd == "-help" || cmd == "--help" || cmd == "-h")
-        help(args);
+        return help(args);
     else if (cmd == "info")
         return info(args);
     else if (cmd == "makeequiarea")
         return makeequiarea(args);
     else if (cmd == "makeemitters")
         return makeemitters(args);
+    else if (cmd == "makemip")
+        return makemip(args);
     else if (cmd == "makesky")
         return makesky(args);
     else if (cmd == "whitebalance")
         return whitebalance(args);
     else if (cmd == "splitn")
         return splitn(args);
+    else {
+        fprintf(stderr, "imgtool: unknown command \"%s\".\n", cmd.c_str());
+        help();
+        return 1;
+    }
+}
+
+int batch(std::vector<std::string> args) {
+    std::string filename;
+    bool keepGoing = false;
+
+    for (auto iter = args.begin(); iter != args.end(); ++iter) {
+        auto onError = [](const std::string &err) {
+            usage("batch", "%s", err.c_str());
+            exit(1);
+        };
+        if (ParseArg(&iter, args.end(), "keep-going", &keepGoing, onError)) {
+            // success
+        } else if ((*iter)[0] == '-')
+            usage("batch", "%s: unknown command flag", iter->c_str());
+        else if (filename.empty())
+            filename = *iter;
+        else
+            usage("batch", "multiple filenames provided.");
+    }
+    if (filename.empty())
+        usage("batch", "must specify file with commands.");
+
+    // Run the commands in order; each one parallelizes its own work over
+    // the image's pixels
+    int nFailed = 0;
+    for (const std::string &line : SplitString(ReadFileContents(filename), '\n')) {
+        std::vector<std::string> commandArgs = SplitStringsFromWhitespace(line);
+        if (commandArgs.empty() || commandArgs[0][0] == '#')
+            continue;
+        std::string cmd = commandArgs[0];
+        if (cmd == "batch") {
+            fprintf(stderr, "imgtool batch: %s: batch commands can't be nested.\n",
+                    filename.c_str());
+            return 1;
+        }
+        commandArgs.erase(commandArgs.begin());
+
+        if (runCommand(cmd, commandArgs) != 0) {
+            ++nFailed;
+            if (!keepGoing) {
+                fprintf(stderr, "imgtool batch: stopping after failed command \"%s\".\n",
+                        line.c_str());
+                return 1;
+            }
+        }
+    }
+    if (nFailed > 0) {
+        fprintf(stderr, "imgtool batch: %d commands failed.\n", nFailed);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    PBRTOptions opt;
+    opt.quiet = true;
+    InitPBRT(opt);
+
+    if (argc < 2) {
+        help();
+        return 0;
+    }
+
+    std::vector<std::string> args = GetCommandLineArguments(argv);
+    std::string cmd = args[0];
+    args.erase(args.begin());
+
+    if (cmd == "batch")
+        return batch(args);
     else if (cmd == "noisybit") {
         // hack for brute force comptuation of ideal filter weights.
 
@@ -2627,12 +2520,8 @@ int main(int argc, char *argv[]) {
           ArrayPlot[ArrayReshape[ %, {21, 21}], ColorFunction -> Function[a,
           GrayLevel[4 a]]]
         */
-    } else {
-        fprintf(stderr, "imgtool: unknown command \"%s\".\n", cmd.c_str());
-        help();
-        CleanupPBRT();
-        return 1;
-    }
+    } else
+        return runCommand(cmd, args);
 
     CleanupPBRT();
 
@@ -11,11 +11,14 @@
 #include <pbrt/util/args.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/image.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
 #include <pbrt/wavefront/wavefront.h>
 
@@ -32,44 +35,196 @@ static void usage(const std::string &msg = {}) {
             R"(usage: pbrt [<options>] <filename.pbrt...>
 
 Rendering options:
+  --adaptive-error <e>         Stop taking samples in pixels once their estimated
+                               relative error is below e. (CPU only)
+  --analyze                    Print the numbers of primitives, instances, lights,
+                               and images in the scene and estimates of the CPU and
+                               GPU memory needed to render it. Does not render an
+                               image.
+  --bench-traversal <filename>
+                               If the file doesn't exist, render the scene and write
+                               the rays traced to it. Otherwise, don't render but
+                               trace its rays against BVH and kd-tree accelerators
+                               for the scene and report their throughput. (CPU only)
+  --bench-traversal-rays <n>   Maximum number of rays recorded by --bench-traversal.
+                               Default: 16777216.
+  --bssrdf-cache <dir>         Load subsurface scattering profile tables from and
+                               save them to the given directory.
+  --bvh-cache <dir>            Load BVHs from and save BVHs to the given directory,
+                               skipping construction for unchanged geometry.
+  --checkpoint <filename>      Periodically write the image's pixel values and the
+                               number of samples taken to the given file, so that
+                               rendering can be resumed with --resume. (CPU only)
+  --checkpoint-interval <s>    Minimum number of seconds between checkpoints.
+                               Default: 300.
+  --compact-spectra            Store spectra in the wavefront integrator's queues
+                               with a shared exponent, halving their size at some
+                               loss of precision. (--gpu and --wavefront only)
+  --compress-meshes            Store triangle meshes' vertex positions quantized to
+                               16 bits, normals as octahedral vectors, and uvs as
+                               half floats, reducing their memory use. (CPU only)
+  --convergence-file <filename>
+                               After each pass over the image, write the relative
+                               MSE and the median and 95th percentile relative
+                               error estimated from the pixels' sample variances to
+                               the given file as one JSON object per line. No
+                               reference image is needed. (CPU only)
+  --coordinator <port>         Coordinate a distributed render: listen for --worker
+                               processes on the given port, hand out image tiles to
+                               them, and write the image once all tiles have been
+                               rendered. (CPU only)
   --cropwindow <x0,x1,y0,y1>   Specify an image crop window w.r.t. [0,1]^2
   --debugstart <values>        Inform the Integrator where to start rendering for
                                faster debugging. (<values> are Integrator-specific
                                and come from error message text.)
   --disable-pixel-jitter       Always sample pixels at their centers.
   --disable-wavelength-jitter  Always sample the same %d wavelengths of light.
+  --displacement-cache-memory <MB>
+                               Maximum amount of memory used for the tessellated
+                               geometry of displaced meshes. Default: 512.
   --display-server <addr:port> Connect to display server at given address and port
                                to display the image as it's being rendered.
+  --exr-compression <name>     Compression method for EXR images: "none", "rle",
+                               "zips", "zip", "piz", "pxr24", "b44", "b44a", "dwaa",
+                               or "dwab". Default: "zip".
+  --fast-phase-functions       Evaluate Henyey-Greenstein phase functions with an
+                               approximation that has less than 0.6%% relative error.
+  --float-normal-maps          Convert normal maps to 32-bit floats when they are
+                               loaded, which saves decoding texels at each lookup
+                               but uses up to 4x as much memory.
   --force-diffuse              Convert all materials to be diffuse.)"
 #ifdef PBRT_BUILD_GPU_RENDERER
             R"(
   --gpu                        Use the GPU for rendering. (Default: disabled)
-  --gpu-device <index>         Use specified GPU for rendering.)"
+  --gpu-build-memory <MB>      Memory budget for building each batch of GPU
+                               acceleration structures. (Default: half of free memory)
+  --gpu-compress-textures      Store 8-bit image textures block-compressed (BC1 for
+                               RGB, BC4 for one channel) in GPU memory.
+  --gpu-device <index>         Use specified GPU for rendering.
+  --gpu-graphs                 Launch the kernels for each ray depth as a CUDA graph
+                               to reduce kernel launch overhead.
+  --gpu-kernel-profile <filename>
+                               Write each GPU kernel's launches, time, throughput,
+                               and occupancy to the given .json or .csv file.
+  --gpu-texture-memory <MB>    Stream the finer MIP levels of image textures to the
+                               GPU in tiles as they are accessed, keeping at most
+                               this much memory of tiles resident.)"
 #endif
             R"(
   --help                       Print this help text.
+  --huge-pages <list>          Back allocations of 2MB and more with transparent
+                               huge pages for the given comma-separated scene
+                               subsystems: scene, textures, materials, lights,
+                               media, film, geometry, meshes, and bvh. (Linux, CPU
+                               rendering only.))"
+#ifdef PBRT_BUILD_GPU_RENDERER
+            R"(
+  --hybrid                     With --gpu, also render part of each pixel sample's
+                               rows using the CPU, balancing the rows between them
+                               by their measured speeds.)"
+#endif
+            R"(
+  --interactive <port>         Keep the scene loaded and render it progressively,
+                               restarting whenever a scene edit is received on the
+                               given port. Each connection sends one edit in the
+                               scene file format; its Camera, LightSource,
+                               MakeNamedMaterial, ObjectBegin/ObjectEnd, and
+                               ObjectInstance statements replace the scene's.
+                               (CPU only)
+  --lazy-instances             Build object instances' acceleration structures the
+                               first time a ray reaches them. (CPU only)
   --mse-reference-image        Filename for reference image to use for MSE computation.
-  --mse-reference-out          File to write MSE error vs spp results.
+  --mse-reference-out          File to write MSE error vs spp results.)"
+#ifdef PBRT_BUILD_GPU_RENDERER
+            R"(
+  --multi-gpu                  With --gpu, render using all of the visible GPUs,
+                               balancing each sample's rows between them.)"
+#endif
+            R"(
   --nthreads <num>             Use specified number of threads for rendering.
+  --numa                       Pin threads to NUMA nodes, have them take work from
+                               threads on the same node first, and spread scene
+                               data across the nodes' memory. (CPU only)
   --outfile <filename>         Write the final image to the given filename.
+  --perf-counters              Measure cycles, instructions, and cache, TLB, and
+                               branch misses on all threads for each phase of
+                               rendering and CPU wavefront kernel, and report them
+                               with --stats. (Linux only)
   --pixel <x,y>                Render just the specified pixel.
   --pixelbounds <x0,x1,y0,y1>  Specify an image crop window w.r.t. pixel coordinates.
+  --pixel-cost <filename>      Write an image of the milliseconds spent rendering each
+                               pixel, measured with the CPU's cycle counter, to the
+                               given file. (CPU only)
   --pixelmaterial <x,y>        Print information about the material visible in the
                                center of the pixel's extent.
+  --pin-threads                Pin each thread to a single CPU; implies --numa.
   --pixelstats                 Record per-pixel statistics and write additional images
                                with their values.
+  --progress-file <filename>   Write rendering progress, including samples and rays
+                               per second and the estimated time remaining, to the
+                               given file as one JSON object per line.
+  --ptex-cache-files <n>       Maximum number of Ptex files kept open. Default: 100.
+  --ptex-cache-memory <MB>     Memory budget of the Ptex texture cache. Default: 4096.
+  --ptex-thread-handles        Have each thread keep its own handle to every Ptex
+                               texture it uses rather than getting the texture
+                               from the Ptex cache for each lookup.
   --quick                      Automatically reduce a number of quality settings
                                to render more quickly.
   --quiet                      Suppress all text output other than error messages.
+  --raystats                   Count the rays of each type traced at each depth along
+                               with the BVH nodes they visit and primitives they test,
+                               and report them with --stats and --pixelstats.
+  --regenerate-paths           Start pixels' next samples as their paths terminate
+                               so that deep bounces trace full queues of rays.
+                               (--gpu and --wavefront only)
+  --resume                     Continue rendering from the --checkpoint file, if it
+                               exists, rather than starting over.
   --render-coord-sys <name>    Coordinate system to use for the scene when rendering,
                                where name is "camera", "cameraworld", or "world".
   --seed <n>                   Set random number generator seed. Default: 0.
+  --sequence <filename>        Render an animation: after the scene, render a frame
+                               for each scene file listed in the given file, one per
+                               line. Each frame's file edits the previous frame in
+                               the same way as the edits for --interactive. Frame
+                               numbers are appended to the film's filename.
+                               (CPU only)
+  --shared-buffers <dir>       Store large mesh vertex and index buffers in files in
+                               the given directory and map them into memory, so that
+                               pbrt processes rendering the same geometry share them.
+                               (CPU only)
+  --sort-materials             Evaluate materials in order of material instance and
+                               texture coordinates. (--gpu and --wavefront only)
+  --sort-rays                  Reorder indirect rays by origin and direction before
+                               tracing them. (--gpu and --wavefront only)
+  --split-planar-patches       Render bilinear patches that are parallelograms as
+                               pairs of triangles, which are faster to intersect.
+                               (CPU only)
   --stats                      Print various statistics after rendering completes.
   --spp <n>                    Override number of pixel samples specified in scene
                                description file.
+  --target-mse <mse>           Stop rendering once the image's MSE with respect to
+                               the --mse-reference-image is at most mse.
+  --target-rel-mse <e>         Stop rendering once the image's relative MSE
+                               estimated from the pixels' sample variances is at
+                               most e. (CPU only)
+  --texture-cache <dir>        Store image textures as tiles in files in the given
+                               directory and load tiles as they are accessed, rather
+                               than keeping entire textures in memory. (CPU only)
+  --texture-cache-memory <MB>  Maximum amount of memory used for texture tiles with
+                               --texture-cache. Default: 1024.
+  --time-limit <seconds>       Stop rendering, with fewer than the specified number
+                               of pixel samples if necessary, before the given time
+                               has passed.
+  --trace <filename>           Write a timeline of thread pool jobs, image tiles,
+                               rendering phases, GPU kernels, and image writes to
+                               the given file in the Chrome trace event format,
+                               which can be viewed with Perfetto.
   --wavefront                  Use wavefront volumetric path integrator.
   --write-partial-images       Periodically write the current image to disk, rather
                                than waiting for the end of rendering. Default: disabled.
+  --worker <host:port>         Render image tiles for the --coordinator at the given
+                               address rather than rendering an image. The worker
+                               must load the same scene. (CPU only)
 
 Logging options:
   --log-file <filename>        Filename to write logging messages to. Default: none;
@@ -84,6 +239,9 @@ Reformatting options:
   --toply                      Print a reformatted version of the input file(s) to
                                standard output and convert all triangle meshes to
                                PLY files. Does not render an image.
+  --tobinary                   Write the input file(s) to standard output in
+                               pbrt's binary scene format, which loads more quickly.
+                               Does not render an image.
   --upgrade                    Upgrade a pbrt-v3 file to pbrt-v4's format.
 )",
             NSpectrumSamples);
@@ -100,7 +258,7 @@ int main(int argc, char *argv[]) {
     std::vector<std::string> filenames;
     std::string logLevel = "error";
     std::string renderCoordSys = "cameraworld";
-    bool format = false, toPly = false;
+    bool format = false, toPly = false, toBinary = false, analyze = false;
 
     // Process command-line arguments
     for (auto iter = args.begin(); iter != args.end(); ++iter) {
@@ -148,18 +306,65 @@ int main(int argc, char *argv[]) {
         } else if (
 #ifdef PBRT_BUILD_GPU_RENDERER
             ParseArg(&iter, args.end(), "gpu", &options.useGPU, onError) ||
+            ParseArg(&iter, args.end(), "gpu-build-memory", &options.gpuBuildMemory,
+                     onError) ||
+            ParseArg(&iter, args.end(), "gpu-compress-textures",
+                     &options.compressGPUTextures, onError) ||
             ParseArg(&iter, args.end(), "gpu-device", &options.gpuDevice, onError) ||
+            ParseArg(&iter, args.end(), "gpu-graphs", &options.gpuGraphs, onError) ||
+            ParseArg(&iter, args.end(), "gpu-kernel-profile", &options.gpuKernelProfile,
+                     onError) ||
+            ParseArg(&iter, args.end(), "gpu-texture-memory", &options.gpuTextureMemory,
+                     onError) ||
+            ParseArg(&iter, args.end(), "hybrid", &options.hybrid, onError) ||
+            ParseArg(&iter, args.end(), "multi-gpu", &options.multiGPU, onError) ||
 #endif
+            ParseArg(&iter, args.end(), "bench-traversal", &options.benchTraversalFile,
+                     onError) ||
+            ParseArg(&iter, args.end(), "bench-traversal-rays",
+                     &options.benchTraversalRays, onError) ||
+            ParseArg(&iter, args.end(), "bssrdf-cache", &options.bssrdfCacheDirectory,
+                     onError) ||
+            ParseArg(&iter, args.end(), "bvh-cache", &options.bvhCacheDirectory,
+                     onError) ||
             ParseArg(&iter, args.end(), "debugstart", &options.debugStart, onError) ||
             ParseArg(&iter, args.end(), "disable-pixel-jitter",
                      &options.disablePixelJitter, onError) ||
             ParseArg(&iter, args.end(), "disable-wavelength-jitter",
                      &options.disableWavelengthJitter, onError) ||
+            ParseArg(&iter, args.end(), "adaptive-error", &options.adaptiveError,
+                     onError) ||
+            ParseArg(&iter, args.end(), "analyze", &analyze, onError) ||
+            ParseArg(&iter, args.end(), "checkpoint", &options.checkpointFile,
+                     onError) ||
+            ParseArg(&iter, args.end(), "checkpoint-interval",
+                     &options.checkpointInterval, onError) ||
+            ParseArg(&iter, args.end(), "compact-spectra", &options.compactSpectra,
+                     onError) ||
+            ParseArg(&iter, args.end(), "compress-meshes", &options.compressMeshes,
+                     onError) ||
+            ParseArg(&iter, args.end(), "convergence-file", &options.convergenceFile,
+                     onError) ||
+            ParseArg(&iter, args.end(), "coordinator", &options.coordinatorPort,
+                     onError) ||
+            ParseArg(&iter, args.end(), "displacement-cache-memory",
+                     &options.displacementCacheMemory, onError) ||
             ParseArg(&iter, args.end(), "display-server", &options.displayServer,
                      onError) ||
+            ParseArg(&iter, args.end(), "exr-compression", &options.exrCompression,
+                     onError) ||
+            ParseArg(&iter, args.end(), "fast-phase-functions",
+                     &options.fastPhaseFunctions, onError) ||
+            ParseArg(&iter, args.end(), "float-normal-maps", &options.floatNormalMaps,
+                     onError) ||
             ParseArg(&iter, args.end(), "force-diffuse", &options.forceDiffuse,
                      onError) ||
             ParseArg(&iter, args.end(), "format", &format, onError) ||
+            ParseArg(&iter, args.end(), "huge-pages", &options.hugePages, onError) ||
+            ParseArg(&iter, args.end(), "interactive", &options.interactivePort,
+                     onError) ||
+            ParseArg(&iter, args.end(), "lazy-instances", &options.lazyInstances,
+                     onError) ||
             ParseArg(&iter, args.end(), "log-level", &logLevel, onError) ||
             ParseArg(&iter, args.end(), "log-file", &options.logFile, onError) ||
             ParseArg(&iter, args.end(), "mse-reference-image", &options.mseReferenceImage,
@@ -167,17 +372,55 @@ int main(int argc, char *argv[]) {
             ParseArg(&iter, args.end(), "mse-reference-out", &options.mseReferenceOutput,
                      onError) ||
             ParseArg(&iter, args.end(), "nthreads", &options.nThreads, onError) ||
+            ParseArg(&iter, args.end(), "numa", &options.numa, onError) ||
             ParseArg(&iter, args.end(), "outfile", &options.imageFile, onError) ||
+            ParseArg(&iter, args.end(), "pin-threads", &options.pinThreads, onError) ||
+            ParseArg(&iter, args.end(), "perf-counters", &options.recordPerfCounters,
+                     onError) ||
+            ParseArg(&iter, args.end(), "pixel-cost", &options.pixelCostFile, onError) ||
             ParseArg(&iter, args.end(), "pixelstats", &options.recordPixelStatistics,
                      onError) ||
+            ParseArg(&iter, args.end(), "progress-file", &options.progressFile,
+                     onError) ||
+            ParseArg(&iter, args.end(), "ptex-cache-files", &options.ptexCacheFiles,
+                     onError) ||
+            ParseArg(&iter, args.end(), "ptex-cache-memory", &options.ptexCacheMemory,
+                     onError) ||
+            ParseArg(&iter, args.end(), "ptex-thread-handles",
+                     &options.ptexThreadHandles, onError) ||
             ParseArg(&iter, args.end(), "quick", &options.quickRender, onError) ||
             ParseArg(&iter, args.end(), "quiet", &options.quiet, onError) ||
+            ParseArg(&iter, args.end(), "raystats", &options.recordRayStatistics,
+                     onError) ||
+            ParseArg(&iter, args.end(), "regenerate-paths", &options.regeneratePaths,
+                     onError) ||
             ParseArg(&iter, args.end(), "render-coord-sys", &renderCoordSys, onError) ||
+            ParseArg(&iter, args.end(), "resume", &options.resume, onError) ||
             ParseArg(&iter, args.end(), "seed", &options.seed, onError) ||
+            ParseArg(&iter, args.end(), "sequence", &options.sequenceFile, onError) ||
+            ParseArg(&iter, args.end(), "shared-buffers", &options.sharedBufferDirectory,
+                     onError) ||
+            ParseArg(&iter, args.end(), "sort-materials", &options.sortMaterials,
+                     onError) ||
+            ParseArg(&iter, args.end(), "sort-rays", &options.sortRays, onError) ||
             ParseArg(&iter, args.end(), "spp", &options.pixelSamples, onError) ||
+            ParseArg(&iter, args.end(), "split-planar-patches",
+                     &options.splitPlanarPatches, onError) ||
             ParseArg(&iter, args.end(), "stats", &options.printStatistics, onError) ||
+            ParseArg(&iter, args.end(), "target-mse", &options.targetMSE, onError) ||
+            ParseArg(&iter, args.end(), "target-rel-mse", &options.targetRelMSE,
+                     onError) ||
+            ParseArg(&iter, args.end(), "texture-cache", &options.textureCacheDirectory,
+                     onError) ||
+            ParseArg(&iter, args.end(), "texture-cache-memory",
+                     &options.textureCacheMemory, onError) ||
+            ParseArg(&iter, args.end(), "time-limit", &options.timeLimit, onError) ||
             ParseArg(&iter, args.end(), "toply", &toPly, onError) ||
+            ParseArg(&iter, args.end(), "tobinary", &toBinary, onError) ||
+            ParseArg(&iter, args.end(), "trace", &options.traceFile, onError) ||
             ParseArg(&iter, args.end(), "wavefront", &options.wavefront, onError) ||
+            ParseArg(&iter, args.end(), "worker", &options.coordinatorAddress,
+                     onError) ||
             ParseArg(&iter, args.end(), "write-partial-images",
                      &options.writePartialImages, onError) ||
             ParseArg(&iter, args.end(), "upgrade", &options.upgrade, onError)) {
@@ -192,7 +435,8 @@ int main(int argc, char *argv[]) {
     }
 
     // Print welcome banner
-    if (!options.quiet && !format && !toPly && !options.upgrade) {
+    if (!options.quiet && !format && !toPly && !toBinary && !options.upgrade &&
+        !analyze) {
         printf("pbrt version 4 (built %s at %s)\n", __DATE__, __TIME__);
 #ifdef PBRT_DEBUG_BUILD
         LOG_VERBOSE("Running debug build");
@@ -229,6 +473,186 @@ int main(int argc, char *argv[]) {
     if (options.useGPU && options.wavefront)
         Warning("Both --gpu and --wavefront were specified; --gpu takes precedence.");
 
+    if (options.hybrid && !options.useGPU) {
+        Warning("Ignoring --hybrid since --gpu wasn't specified.");
+        options.hybrid = false;
+    }
+    if (options.sortMaterials && !options.useGPU && !options.wavefront) {
+        Warning("Ignoring --sort-materials, which only applies to --gpu and "
+                "--wavefront rendering.");
+        options.sortMaterials = false;
+    }
+    if (options.sortRays && !options.useGPU && !options.wavefront) {
+        Warning("Ignoring --sort-rays, which only applies to --gpu and --wavefront "
+                "rendering.");
+        options.sortRays = false;
+    }
+    if (options.regeneratePaths && !options.useGPU && !options.wavefront) {
+        Warning("Ignoring --regenerate-paths, which only applies to --gpu and "
+                "--wavefront rendering.");
+        options.regeneratePaths = false;
+    }
+    if (options.compactSpectra && !options.useGPU && !options.wavefront) {
+        Warning("Ignoring --compact-spectra, which only applies to --gpu and "
+                "--wavefront rendering.");
+        options.compactSpectra = false;
+    }
+    if (options.multiGPU && !options.useGPU) {
+        Warning("Ignoring --multi-gpu since --gpu wasn't specified.");
+        options.multiGPU = false;
+    }
+    if (options.gpuGraphs && !options.useGPU) {
+        Warning("Ignoring --gpu-graphs since --gpu wasn't specified.");
+        options.gpuGraphs = false;
+    }
+    if (!options.gpuKernelProfile.empty() && !options.useGPU) {
+        Warning("Ignoring --gpu-kernel-profile since --gpu wasn't specified.");
+        options.gpuKernelProfile.clear();
+    }
+    if (options.gpuTextureMemory && !options.useGPU) {
+        Warning("Ignoring --gpu-texture-memory since --gpu wasn't specified.");
+        options.gpuTextureMemory.reset();
+    }
+    if (options.gpuTextureMemory && options.multiGPU) {
+        // Each GPU would need its own tile pool and residency updates
+        Warning("Ignoring --gpu-texture-memory, which isn't supported with --multi-gpu.");
+        options.gpuTextureMemory.reset();
+    }
+    if (!options.gpuKernelProfile.empty() &&
+        !HasExtension(options.gpuKernelProfile, "json") &&
+        !HasExtension(options.gpuKernelProfile, "csv"))
+        ErrorExit("%s: --gpu-kernel-profile filename must have a \".json\" or "
+                  "\".csv\" extension.",
+                  options.gpuKernelProfile);
+
+    if (options.useGPU && !options.sharedBufferDirectory.empty()) {
+        // Mesh buffers must be allocated in GPU-accessible memory
+        Warning("Ignoring --shared-buffers since --gpu was specified.");
+        options.sharedBufferDirectory.clear();
+    }
+
+    if (options.useGPU && options.compressMeshes) {
+        // GPU acceleration structures are built from full-precision vertices
+        Warning("Ignoring --compress-meshes since --gpu was specified.");
+        options.compressMeshes = false;
+    }
+
+    if (options.useGPU && options.splitPlanarPatches) {
+        // The GPU aggregate creates its own meshes from the scene's shapes
+        Warning("Ignoring --split-planar-patches since --gpu was specified.");
+        options.splitPlanarPatches = false;
+    }
+
+    for (const std::string &name : SplitString(options.hugePages, ','))
+        if (name != "scene" && name != "textures" && name != "materials" &&
+            name != "lights" && name != "media" && name != "film" &&
+            name != "geometry" && name != "meshes" && name != "bvh")
+            usage(StringPrintf("%s: unknown subsystem for --huge-pages", name));
+    if (options.useGPU && !options.hugePages.empty()) {
+        // Scene data is allocated in CUDA managed memory
+        Warning("Ignoring --huge-pages since --gpu was specified.");
+        options.hugePages.clear();
+    }
+
+    if ((options.useGPU || options.wavefront) && !options.pixelCostFile.empty()) {
+        // Pixels' samples are spread across many kernel launches
+        Warning("Ignoring --pixel-cost since --gpu or --wavefront was specified.");
+        options.pixelCostFile.clear();
+    }
+
+    if ((options.useGPU || options.wavefront) && !options.benchTraversalFile.empty()) {
+        // Rays are only recorded by the CPU integrators
+        Warning("Ignoring --bench-traversal since --gpu or --wavefront was specified.");
+        options.benchTraversalFile.clear();
+    }
+
+    if ((options.useGPU || options.wavefront) &&
+        (!options.convergenceFile.empty() || options.targetRelMSE)) {
+        // The wavefront integrator's films don't estimate pixels' variance
+        Warning("Ignoring --convergence-file and --target-rel-mse since --gpu or "
+                "--wavefront was specified.");
+        options.convergenceFile.clear();
+        options.targetRelMSE.reset();
+    }
+
+    if ((options.useGPU || options.wavefront) && options.recordRayStatistics) {
+        // The wavefront integrator reports its own ray counts with --stats
+        Warning("Ignoring --raystats since --gpu or --wavefront was specified.");
+        options.recordRayStatistics = false;
+    }
+
+    if (options.useGPU && !options.textureCacheDirectory.empty()) {
+        // GPU textures are stored in CUDA arrays
+        Warning("Ignoring --texture-cache since --gpu was specified.");
+        options.textureCacheDirectory.clear();
+    }
+
+    if (options.pinThreads)
+        options.numa = true;
+    if (options.useGPU && options.numa) {
+        // Scene data lives in GPU memory and CPU threads do little work
+        Warning("Ignoring --numa and --pin-threads since --gpu was specified.");
+        options.numa = options.pinThreads = false;
+    }
+    if (options.textureCacheMemory <= 0)
+        ErrorExit("--texture-cache-memory must be positive.");
+    if (options.displacementCacheMemory <= 0)
+        ErrorExit("--displacement-cache-memory must be positive.");
+    if (!IsEXRCompression(options.exrCompression))
+        ErrorExit("%s: unknown EXR compression method.", options.exrCompression);
+    if (options.ptexCacheFiles <= 0)
+        ErrorExit("--ptex-cache-files must be positive.");
+    if (options.ptexCacheMemory <= 0)
+        ErrorExit("--ptex-cache-memory must be positive.");
+    if (options.adaptiveError && *options.adaptiveError <= 0)
+        ErrorExit("--adaptive-error must be positive.");
+    if (options.timeLimit && *options.timeLimit <= 0)
+        ErrorExit("--time-limit must be positive.");
+    if (options.targetRelMSE && *options.targetRelMSE <= 0)
+        ErrorExit("--target-rel-mse must be positive.");
+    if (options.targetMSE && options.mseReferenceImage.empty())
+        ErrorExit("Must provide MSE reference image via --mse-reference-image with "
+                  "--target-mse");
+    if (options.coordinatorPort &&
+        (*options.coordinatorPort <= 0 || *options.coordinatorPort > 65535))
+        ErrorExit("--coordinator port must be between 1 and 65535.");
+    if (options.coordinatorPort && !options.coordinatorAddress.empty())
+        ErrorExit("Only one of --coordinator and --worker can be specified.");
+    if ((options.coordinatorPort || !options.coordinatorAddress.empty()) &&
+        (options.useGPU || options.wavefront))
+        ErrorExit("--coordinator and --worker are only supported when rendering on "
+                  "the CPU.");
+    if (options.interactivePort &&
+        (*options.interactivePort <= 0 || *options.interactivePort > 65535))
+        ErrorExit("--interactive port must be between 1 and 65535.");
+    if (options.interactivePort &&
+        (options.coordinatorPort || !options.coordinatorAddress.empty()))
+        ErrorExit("--interactive can't be used with --coordinator or --worker.");
+    if (options.interactivePort && (options.useGPU || options.wavefront))
+        ErrorExit("--interactive is only supported when rendering on the CPU.");
+    if (!options.sequenceFile.empty() &&
+        (options.interactivePort || options.coordinatorPort ||
+         !options.coordinatorAddress.empty()))
+        ErrorExit("--sequence can't be used with --interactive, --coordinator, or "
+                  "--worker.");
+    if (!options.sequenceFile.empty() && (options.useGPU || options.wavefront))
+        ErrorExit("--sequence is only supported when rendering on the CPU.");
+    if (!options.sequenceFile.empty() &&
+        (!options.checkpointFile.empty() || !options.pixelCostFile.empty() ||
+         !options.mseReferenceImage.empty() || !options.convergenceFile.empty()))
+        ErrorExit("--sequence can't be used with --checkpoint, --pixel-cost, "
+                  "--mse-reference-image, or --convergence-file.");
+    if (options.checkpointInterval < 0)
+        ErrorExit("--checkpoint-interval must not be negative.");
+    if (options.resume && options.checkpointFile.empty())
+        ErrorExit("Must provide checkpoint file via --checkpoint with --resume");
+    if (!options.checkpointFile.empty() && (options.useGPU || options.wavefront)) {
+        Warning("Ignoring --checkpoint and --resume, which are only supported when "
+                "rendering on the CPU.");
+        options.checkpointFile.clear();
+        options.resume = false;
+    }
+
     if (options.pixelMaterial && options.wavefront) {
         Warning("Disabling --wavefront since --pixelmaterial was specified.");
         options.wavefront = false;
@@ -239,13 +663,23 @@ int main(int argc, char *argv[]) {
     // Initialize pbrt
     InitPBRT(options);
 
-    if (format || toPly || options.upgrade) {
+    if (toBinary) {
+        BinaryFormattingScene binaryScene(stdout);
+        ParseFiles(&binaryScene, filenames);
+    } else if (format || toPly || options.upgrade) {
         FormattingScene formattingScene(toPly, options.upgrade);
         ParseFiles(&formattingScene, filenames);
+    } else if (analyze) {
+        ParsedScene scene;
+        ParseFiles(&scene, filenames);
+        AnalyzeScene(scene).Print(stdout);
     } else {
         // Parse provided scene description files
         ParsedScene scene;
-        ParseFiles(&scene, filenames);
+        {
+            StatsPhase phase("ParseFiles");
+            ParseFiles(&scene, filenames);
+        }
 
         // Render the scene
         if (options.useGPU || options.wavefront)
@@ -0,0 +1,27 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/options.h>
+
+#include <benchmark/benchmark.h>
+
+using namespace pbrt;
+
+int main(int argc, char **argv) {
+    // Google Benchmark handles all of the command-line arguments
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    PBRTOptions opt;
+    opt.quiet = true;
+    InitPBRT(opt);
+
+    benchmark::RunSpecifiedBenchmarks();
+
+    CleanupPBRT();
+    return 0;
+}
@@ -0,0 +1,499 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+// pbrt_scene_bench.cpp
+
+// Renders a fixed set of small procedurally-generated scenes with the pbrt
+// executable and reports startup time, rendering rates, and peak memory use as
+// JSON, optionally comparing them to the results of a previous run.
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/options.h>
+#include <pbrt/util/args.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/string.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace pbrt;
+
+static void usage(const std::string &msg = {}) {
+    if (!msg.empty())
+        fprintf(stderr, "pbrt_scene_bench: %s\n\n", msg.c_str());
+
+    fprintf(stderr,
+            R"(usage: pbrt_scene_bench [<options>]
+
+Renders small generated scenes (instanced, textures, manylights, volume, hair)
+on the CPU and, if pbrt was built with GPU support, with --gpu, and prints the
+startup time, samples/s, Mrays/s, and peak memory use for each as JSON.
+
+Options:
+  --baseline <filename>  Compare the results to those in the given file, which
+                         was written by a previous run, and exit with an error
+                         if any got worse by more than the tolerance.
+  --cpu-only             Don't render the scenes with --gpu.
+  --help                 Print this help text.
+  --nthreads <num>       Use specified number of threads for rendering.
+  --outdir <dir>         Directory for the generated scenes and images.
+                         (Default: the current directory.)
+  --outfile <filename>   Write the JSON results to the given file rather than
+                         to standard output.
+  --pbrt <filename>      pbrt executable to run. (Default: the "pbrt" next to
+                         this program.)
+  --scenes <list>        Comma-separated list of the scenes to render.
+  --tolerance <percent>  Allowed change in each measurement when comparing to
+                         a baseline. (Default: 10)
+)");
+    exit(msg.empty() ? 0 : 1);
+}
+
+// Scene generation
+// All scenes are rendered at the same resolution with the volumetric path
+// tracer; each scene's description is returned as a string.
+static constexpr int xResolution = 400, yResolution = 300;
+
+static std::string SceneHeader(const std::string &imageFilename, int spp,
+                               const char *lookAt) {
+    return StringPrintf(
+        "LookAt %s 0 1 0\n"
+        "Camera \"perspective\" \"float fov\" 40\n"
+        "Sampler \"zsobol\" \"integer pixelsamples\" %d\n"
+        "Integrator \"volpath\" \"integer maxdepth\" 5\n"
+        "Film \"rgb\" \"integer xresolution\" %d \"integer yresolution\" %d\n"
+        "    \"string filename\" \"%s\"\n"
+        "WorldBegin\n"
+        "LightSource \"infinite\" \"rgb L\" [ .4 .45 .5 ]\n"
+        "LightSource \"distant\" \"point3 from\" [ 1 4 -2 ] \"point3 to\" [ 0 0 0 ]\n"
+        "    \"blackbody L\" 5500 \"float scale\" 3\n",
+        lookAt, spp, xResolution, yResolution, imageFilename);
+}
+
+// Returns a _Shape_ statement for a ground quad of the given size at $y=0$
+static std::string GroundQuad(Float size) {
+    return StringPrintf("Shape \"bilinearmesh\" \"point3 P\" [ %f 0 %f %f 0 %f %f 0 %f "
+                        "%f 0 %f ]\n    \"integer indices\" [ 0 1 2 3 ]\n",
+                        -size, -size, size, -size, -size, size, size, size);
+}
+
+// Returns a triangle mesh that approximates a sphere of the given radius
+static std::string SphereMesh(Float radius, int nTheta, int nPhi) {
+    std::string s = "Shape \"trianglemesh\" \"point3 P\" [";
+    for (int t = 0; t <= nTheta; ++t)
+        for (int p = 0; p < nPhi; ++p) {
+            Float theta = Pi * t / nTheta, phi = 2 * Pi * p / nPhi;
+            s += StringPrintf(" %f %f %f", radius * std::sin(theta) * std::cos(phi),
+                              radius * std::cos(theta),
+                              radius * std::sin(theta) * std::sin(phi));
+        }
+    s += " ]\n    \"integer indices\" [";
+    for (int t = 0; t < nTheta; ++t)
+        for (int p = 0; p < nPhi; ++p) {
+            int v00 = t * nPhi + p, v01 = t * nPhi + (p + 1) % nPhi;
+            int v10 = v00 + nPhi, v11 = v01 + nPhi;
+            s += StringPrintf(" %d %d %d %d %d %d", v00, v10, v11, v00, v11, v01);
+        }
+    return s + " ]\n";
+}
+
+static std::string InstancedScene(const std::string &dir, const std::string &image) {
+    // Many instances of a single object scattered over a ground plane
+    std::string s = SceneHeader(image, 16, "0 6 -14 0 0 0");
+    s += "ObjectBegin \"rock\"\n"
+         "Material \"coateddiffuse\" \"rgb reflectance\" [ .5 .4 .3 ]\n" +
+         SphereMesh(.25f, 24, 48) + "ObjectEnd\n";
+    s += "Material \"diffuse\"\n" + GroundQuad(20);
+    RNG rng;
+    for (int i = 0; i < 50000; ++i)
+        s += StringPrintf("AttributeBegin\nTranslate %f %f %f\nRotate %f 0 1 0\n"
+                          "Scale %f %f %f\nObjectInstance \"rock\"\nAttributeEnd\n",
+                          Lerp(rng.Uniform<Float>(), -15, 15), .1f,
+                          Lerp(rng.Uniform<Float>(), -15, 15),
+                          360 * rng.Uniform<Float>(), .5f + rng.Uniform<Float>(),
+                          .3f + .5f * rng.Uniform<Float>(), .5f + rng.Uniform<Float>());
+    return s;
+}
+
+static std::string TexturesScene(const std::string &dir, const std::string &image) {
+    // A grid of quads, each with its own image texture, some of them combined
+    // with procedural textures
+    std::string s = SceneHeader(image, 16, "0 9 -9 0 0 0");
+    constexpr int nImages = 16, imageRes = 512, gridRes = 8;
+    for (int i = 0; i < nImages; ++i) {
+        Image texture(PixelFormat::U256, {imageRes, imageRes}, {"R", "G", "B"});
+        for (int y = 0; y < imageRes; ++y)
+            for (int x = 0; x < imageRes; ++x)
+                for (int c = 0; c < 3; ++c)
+                    texture.SetChannel(
+                        {x, y}, c,
+                        .5f + .5f * std::sin((x * (c + 1) + y * (i + 1)) * .05f));
+        std::string filename = StringPrintf("%s/texture%02d.png", dir, i);
+        if (!texture.Write(filename))
+            ErrorExit("%s: unable to write texture", filename);
+        s += StringPrintf("Texture \"image%d\" \"spectrum\" \"imagemap\" "
+                          "\"string filename\" \"%s\"\n",
+                          i, filename);
+    }
+    const char *procedural[] = {"fbm", "wrinkled", "windy", "marble"};
+    for (int i = 0; i < gridRes * gridRes; ++i) {
+        int x = i % gridRes, z = i / gridRes;
+        std::string tex = StringPrintf("image%d", i % nImages);
+        if (i % 2 == 1) {
+            // Scale the image by a procedural texture
+            s += StringPrintf("Texture \"proc%d\" \"float\" \"%s\" \"float scale\" 4\n"
+                              "Texture \"scaled%d\" \"spectrum\" \"scale\" "
+                              "\"texture tex\" \"%s\" \"texture scale\" \"proc%d\"\n",
+                              i, procedural[(i / 2) % 4], i, tex, i);
+            tex = StringPrintf("scaled%d", i);
+        }
+        Float x0 = x - gridRes / 2.f, z0 = z - gridRes / 2.f;
+        s += StringPrintf("Material \"diffuse\" \"texture reflectance\" \"%s\"\n"
+                          "Shape \"bilinearmesh\" \"point3 P\" [ %f 0 %f %f 0 %f %f 0 %f "
+                          "%f 0 %f ]\n    \"integer indices\" [ 0 1 2 3 ]\n"
+                          "    \"point2 uv\" [ 0 0 1 0 0 1 1 1 ]\n",
+                          tex, x0, z0, x0 + 1, z0, x0, z0 + 1, x0 + 1, z0 + 1);
+    }
+    return s;
+}
+
+static std::string ManyLightsScene(const std::string &dir, const std::string &image) {
+    // A grid of small emitting spheres above a plane and a few glossy spheres
+    std::string s = SceneHeader(image, 16, "0 6 -12 0 0 0");
+    s += "Material \"diffuse\"\n" + GroundQuad(20);
+    s += "Material \"conductor\" \"float roughness\" .1\n";
+    for (int i = 0; i < 5; ++i)
+        s += StringPrintf("AttributeBegin\nTranslate %d 1 0\nShape \"sphere\"\n"
+                          "AttributeEnd\n",
+                          3 * i - 6);
+    RNG rng;
+    for (int z = 0; z < 32; ++z)
+        for (int x = 0; x < 32; ++x)
+            s += StringPrintf("AttributeBegin\nTranslate %f 3 %f\n"
+                              "AreaLightSource \"diffuse\" \"rgb L\" [ %f %f %f ]\n"
+                              "Shape \"sphere\" \"float radius\" .05\nAttributeEnd\n",
+                              (x - 15.5f) * .6f, (z - 15.5f) * .6f,
+                              4 * rng.Uniform<Float>(), 4 * rng.Uniform<Float>(),
+                              4 * rng.Uniform<Float>());
+    return s;
+}
+
+static std::string VolumeScene(const std::string &dir, const std::string &image) {
+    // A cube of heterogeneous smoke over a plane
+    std::string s = SceneHeader(image, 16, "0 3 -6 0 1 0");
+    constexpr int res = 64;
+    s += StringPrintf("MakeNamedMedium \"smoke\" \"string type\" \"uniformgrid\"\n"
+                      "    \"integer nx\" %d \"integer ny\" %d \"integer nz\" %d\n"
+                      "    \"point3 p0\" [ -1 0 -1 ] \"point3 p1\" [ 1 2 1 ]\n"
+                      "    \"float scale\" 4 \"float density\" [",
+                      res, res, res);
+    for (int z = 0; z < res; ++z)
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x) {
+                Float d = std::sin(x * .3f) * std::sin(y * .2f + z * .1f) *
+                          std::cos(z * .25f + x * .05f);
+                s += StringPrintf(" %f", std::max<Float>(0, d));
+            }
+    s += " ]\n";
+    s += "Material \"diffuse\"\n" + GroundQuad(10);
+    s += "AttributeBegin\nMaterial \"interface\"\nMediumInterface \"smoke\" \"\"\n"
+         "Shape \"trianglemesh\" \"point3 P\" [ -1 0 -1 1 0 -1 1 2 -1 -1 2 -1 "
+         "-1 0 1 1 0 1 1 2 1 -1 2 1 ]\n"
+         "    \"integer indices\" [ 0 2 1 0 3 2 4 5 6 4 6 7 0 1 5 0 5 4 "
+         "3 7 6 3 6 2 0 4 7 0 7 3 1 2 6 1 6 5 ]\nAttributeEnd\n";
+    return s;
+}
+
+static std::string HairScene(const std::string &dir, const std::string &image) {
+    // Curves growing from the upper half of a sphere
+    std::string s = SceneHeader(image, 16, "0 1.5 -4 0 .8 0");
+    s += "Material \"diffuse\"\n" + GroundQuad(10);
+    s += "AttributeBegin\nTranslate 0 .5 0\nMaterial \"diffuse\" "
+         "\"rgb reflectance\" [ .6 .5 .4 ]\nShape \"sphere\" \"float radius\" .5\n"
+         "AttributeEnd\n";
+    s += "Material \"hair\" \"float eumelanin\" 1.3\n";
+    RNG rng;
+    for (int i = 0; i < 30000; ++i) {
+        Float cosTheta = rng.Uniform<Float>(), phi = 2 * Pi * rng.Uniform<Float>();
+        Float sinTheta = SafeSqrt(1 - Sqr(cosTheta));
+        Float dx = sinTheta * std::cos(phi), dy = cosTheta, dz = sinTheta * std::sin(phi);
+        s += "Shape \"curve\" \"string type\" \"cylinder\" \"point3 P\" [";
+        for (int j = 0; j < 4; ++j) {
+            // Hairs bend downward as they grow outward
+            Float r = .5f + .15f * j;
+            s += StringPrintf(" %f %f %f", r * dx, .5f + r * dy - .03f * j * j, r * dz);
+        }
+        s += " ] \"float width0\" .004 \"float width1\" .001\n";
+    }
+    return s;
+}
+
+// BenchScene Definition
+struct BenchScene {
+    const char *name;
+    std::function<std::string(const std::string &, const std::string &)> generate;
+};
+
+// BenchResult Definition
+struct BenchResult {
+    std::string ToJSON() const {
+        return StringPrintf("{\"scene\": \"%s\", \"device\": \"%s\", "
+                            "\"startupSeconds\": %.3f, \"renderSeconds\": %.3f, "
+                            "\"samplesPerSecond\": %.1f, \"mraysPerSecond\": %s, "
+                            "\"peakMemoryBytes\": %d}",
+                            scene, device, startupSeconds, renderSeconds,
+                            samplesPerSecond,
+                            mraysPerSecond < 0 ? std::string("null")
+                                               : StringPrintf("%.3f", mraysPerSecond),
+                            peakMemoryBytes);
+    }
+
+    std::string scene, device;
+    double startupSeconds = 0, renderSeconds = 0, samplesPerSecond = 0;
+    // Negative if the number of rays traced isn't known
+    double mraysPerSecond = -1;
+    int64_t peakMemoryBytes = 0;
+};
+
+// Returns the number following _"key": _ in _s_ after _start_, or _fallback_
+static double JSONNumber(const std::string &s, const std::string &key, size_t start = 0,
+                         double fallback = 0) {
+    size_t offset = s.find("\"" + key + "\": ", start);
+    if (offset == std::string::npos)
+        return fallback;
+    const char *value = s.c_str() + offset + key.size() + 4;
+    if (strncmp(value, "null", 4) == 0)
+        return fallback;
+    return strtod(value, nullptr);
+}
+
+// Returns the string following _"key": _ in _s_ after _start_
+static std::string JSONString(const std::string &s, const std::string &key,
+                              size_t start = 0) {
+    size_t offset = s.find("\"" + key + "\": \"", start);
+    if (offset == std::string::npos)
+        return {};
+    offset += key.size() + 5;
+    return s.substr(offset, s.find('"', offset) - offset);
+}
+
+// Returns the lines of _s_
+static std::vector<std::string> Lines(const std::string &s) {
+    std::vector<std::string> lines = SplitString(s, '\n');
+    lines.erase(std::remove(lines.begin(), lines.end(), std::string()), lines.end());
+    return lines;
+}
+
+static BenchResult RunScene(const std::string &pbrt, const std::string &sceneFile,
+                            const std::string &logFile, const std::string &progressFile,
+                            int spp, bool gpu, int nThreads) {
+    std::string command = StringPrintf("\"%s\" --stats --quiet --progress-file \"%s\"",
+                                       pbrt, progressFile);
+    if (gpu)
+        command += " --gpu";
+    if (nThreads > 0)
+        command += StringPrintf(" --nthreads %d", nThreads);
+    command += StringPrintf(" \"%s\" > \"%s\"", sceneFile, logFile);
+    remove(progressFile.c_str());
+    if (system(command.c_str()) != 0)
+        ErrorExit("%s: rendering failed; see %s for pbrt's output.", sceneFile, logFile);
+
+    BenchResult result;
+    result.device = gpu ? "gpu" : "cpu";
+    std::string log = ReadFileContents(logFile);
+
+    // Find the startup and rendering times and peak memory use from the phases
+    // reported by --stats
+    size_t phases = log.find("{\"phases\": [");
+    if (phases == std::string::npos)
+        ErrorExit("%s: phase statistics not found.", logFile);
+    phases = log.find('[', phases);
+    size_t phasesEnd = log.find(']', phases);
+    for (size_t p = log.find('{', phases); p < phasesEnd; p = log.find('{', p + 1)) {
+        std::string name = JSONString(log, "name", p);
+        double seconds = JSONNumber(log, "wallSeconds", p);
+        if (name == "Render")
+            result.renderSeconds = seconds;
+        else if (JSONNumber(log, "depth", p) == 0)
+            result.startupSeconds += seconds;
+        result.peakMemoryBytes =
+            std::max<int64_t>(result.peakMemoryBytes, JSONNumber(log, "peakRSSBytes", p));
+    }
+    if (result.renderSeconds == 0)
+        ErrorExit("%s: rendering time not found.", logFile);
+    result.samplesPerSecond =
+        double(xResolution) * yResolution * spp / result.renderSeconds;
+
+    // Count the rays traced
+    double rays = 0;
+    if (gpu) {
+        // The wavefront integrator reports the number of rays of each type
+        for (const std::string &line : Lines(log))
+            if (line.find("Camera rays") != std::string::npos ||
+                line.find("Indirect rays") != std::string::npos ||
+                line.find("Shadow rays") != std::string::npos)
+                rays += strtod(line.c_str() + line.find_last_of(' '), nullptr);
+    } else {
+        // Integrate the rates in the progress file over their intervals
+        double lastElapsed = 0;
+        for (const std::string &line : Lines(ReadFileContents(progressFile))) {
+            if (JSONString(line, "title") != "Rendering")
+                continue;
+            double elapsed = JSONNumber(line, "elapsedSeconds");
+            rays += JSONNumber(line, "raysPerSecond") * (elapsed - lastElapsed);
+            lastElapsed = elapsed;
+        }
+    }
+    if (rays > 0)
+        result.mraysPerSecond = rays / result.renderSeconds / 1e6;
+    return result;
+}
+
+// Compares _result_ to the matching result in _baseline_, if there is one,
+// and returns false if it is worse by more than _tolerance_.
+static bool CompareToBaseline(const BenchResult &result,
+                              const std::vector<std::string> &baseline,
+                              double tolerance) {
+    for (const std::string &line : baseline) {
+        if (JSONString(line, "scene") != result.scene ||
+            JSONString(line, "device") != result.device)
+            continue;
+
+        bool ok = true;
+        auto check = [&](const char *name, double base, double current,
+                         bool higherIsBetter) {
+            double change = (current - base) / std::max(base, 1e-6);
+            if (higherIsBetter ? (change < -tolerance) : (change > tolerance)) {
+                fprintf(stderr, "%s (%s): %s regressed from %g to %g (%+.1f%%)\n",
+                        result.scene.c_str(), result.device.c_str(), name, base,
+                        current, 100 * change);
+                ok = false;
+            }
+        };
+        check("startupSeconds", JSONNumber(line, "startupSeconds"),
+              result.startupSeconds, false);
+        check("samplesPerSecond", JSONNumber(line, "samplesPerSecond"),
+              result.samplesPerSecond, true);
+        if (double mrays = JSONNumber(line, "mraysPerSecond", 0, -1);
+            mrays >= 0 && result.mraysPerSecond >= 0)
+            check("mraysPerSecond", mrays, result.mraysPerSecond, true);
+        check("peakMemoryBytes", JSONNumber(line, "peakMemoryBytes"),
+              result.peakMemoryBytes, false);
+        return ok;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> args = GetCommandLineArguments(argv);
+
+    std::string pbrt, outDir = ".", outFile, baselineFile, sceneList;
+    bool cpuOnly = false;
+    int nThreads = 0;
+    Float tolerance = 10;
+    for (auto iter = args.begin(); iter != args.end(); ++iter) {
+        auto onError = [](const std::string &err) { usage(err); };
+        if (ParseArg(&iter, args.end(), "baseline", &baselineFile, onError) ||
+            ParseArg(&iter, args.end(), "cpu-only", &cpuOnly, onError) ||
+            ParseArg(&iter, args.end(), "nthreads", &nThreads, onError) ||
+            ParseArg(&iter, args.end(), "outdir", &outDir, onError) ||
+            ParseArg(&iter, args.end(), "outfile", &outFile, onError) ||
+            ParseArg(&iter, args.end(), "pbrt", &pbrt, onError) ||
+            ParseArg(&iter, args.end(), "scenes", &sceneList, onError) ||
+            ParseArg(&iter, args.end(), "tolerance", &tolerance, onError))
+            ;
+        else if (*iter == "--help" || *iter == "-help" || *iter == "-h")
+            usage();
+        else
+            usage(StringPrintf("argument \"%s\" unknown", *iter));
+    }
+
+    if (pbrt.empty()) {
+        // Use the pbrt executable in the same directory as this one
+        std::string self = argv[0];
+        size_t slash = self.find_last_of("/\\");
+        pbrt = (slash == std::string::npos ? std::string() : self.substr(0, slash + 1)) +
+               "pbrt";
+#ifdef PBRT_IS_WINDOWS
+        pbrt += ".exe";
+#endif
+    }
+    if (!FileExists(pbrt))
+        usage(StringPrintf("%s: pbrt executable not found", pbrt));
+
+    PBRTOptions options;
+    options.quiet = true;
+    InitPBRT(options);
+
+    std::vector<BenchScene> scenes = {{"instanced", InstancedScene},
+                                      {"textures", TexturesScene},
+                                      {"manylights", ManyLightsScene},
+                                      {"volume", VolumeScene},
+                                      {"hair", HairScene}};
+    if (!sceneList.empty()) {
+        std::vector<std::string> names = SplitString(sceneList, ',');
+        for (const std::string &name : names)
+            if (std::none_of(scenes.begin(), scenes.end(),
+                             [&](const BenchScene &s) { return s.name == name; }))
+                usage(StringPrintf("%s: unknown scene", name));
+        scenes.erase(std::remove_if(scenes.begin(), scenes.end(),
+                                    [&](const BenchScene &s) {
+                                        return std::find(names.begin(), names.end(),
+                                                         s.name) == names.end();
+                                    }),
+                     scenes.end());
+    }
+
+    std::vector<bool> devices = {false};
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (!cpuOnly)
+        devices.push_back(true);
+#endif
+
+    std::vector<std::string> baseline;
+    if (!baselineFile.empty())
+        baseline = Lines(ReadFileContents(baselineFile));
+
+    std::vector<BenchResult> results;
+    bool regressed = false;
+    for (const BenchScene &scene : scenes) {
+        std::string base = StringPrintf("%s/bench-%s", outDir, scene.name);
+        std::string sceneFile = base + ".pbrt", imageFile = base + ".exr";
+        if (!WriteFileContents(sceneFile, scene.generate(outDir, imageFile)))
+            ErrorExit("%s: unable to write scene", sceneFile);
+        for (bool gpu : devices) {
+            fprintf(stderr, "Rendering %s (%s)...\n", scene.name, gpu ? "gpu" : "cpu");
+            BenchResult result =
+                RunScene(pbrt, sceneFile, base + ".log", base + "-progress.json", 16,
+                         gpu, nThreads);
+            result.scene = scene.name;
+            regressed |= !CompareToBaseline(result, baseline, tolerance / 100);
+            results.push_back(result);
+        }
+    }
+
+    // Write the results with one per line, which allows them to be read back
+    // as a baseline without a JSON parser
+    std::string json = "{\"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+        json += "  " + results[i].ToJSON() + (i + 1 < results.size() ? ",\n" : "\n");
+    json += "]}\n";
+    if (outFile.empty())
+        fputs(json.c_str(), stdout);
+    else if (!WriteFileContents(outFile, json))
+        ErrorExit("%s: unable to write results", outFile);
+
+    CleanupPBRT();
+    return regressed ? 1 : 0;
+}
@@ -14,14 +14,22 @@
 #include <algorithm>
 #include <cmath>
 #include <condition_variable>
+#include <cstdio>
 #include <cstring>
 #include <functional>
 #include <iostream>
 #include <mutex>
 #include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+// Identifies the version of this program whose tables are in the cache
+// directory; the build system sets it to a hash of this file.
+#ifndef PBRT_RGB2SPEC_OPT_HASH
+#define PBRT_RGB2SPEC_OPT_HASH ""
+#endif
+
 /**
  * This file contains:
  *
@@ -588,6 +596,24 @@ static Gamut parse_gamut(const char *str) {
     return NO_GAMUT;
 }
 
+// Copies the file _from_ to _to_, returning false if either can't be opened.
+static bool copy_file(const std::string &from, const std::string &to) {
+    FILE *in = fopen(from.c_str(), "rb");
+    if (in == nullptr)
+        return false;
+    FILE *out = fopen(to.c_str(), "wb");
+    if (out == nullptr) {
+        fclose(in);
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+    return fclose(out) == 0;
+}
+
 /* hack: below is a copy of enough of util/parallel.* to be able to run
    ParallelFor to generate the tables. Note that we don't want to #include
    <util/parallel.h>, since we'd end up spending lots of time regenerating
@@ -790,7 +816,7 @@ void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t
 
 int main(int argc, char **argv) {
     if (argc < 3) {
-        printf("Syntax: rgb2spec_opt <resolution> <output> [<gamut>]\n"
+        printf("Syntax: rgb2spec_opt <resolution> <output> [<gamut> [<cache dir>]]\n"
                "where <gamut> is one of "
                "sRGB,eRGB,XYZ,ProPhotoRGB,ACES2065_1,REC2020\n");
         exit(-1);
@@ -810,6 +836,18 @@ int main(int argc, char **argv) {
         exit(-1);
     }
 
+    // Use the table in the cache directory, if given, if this version of the
+    // program has already generated it there
+    std::string cacheFilename;
+    if (argc > 4 && strlen(PBRT_RGB2SPEC_OPT_HASH) > 0) {
+        cacheFilename = std::string(argv[4]) + "/rgbspectrum_" + argv[3] + "_" +
+                        std::to_string(res) + "_" + PBRT_RGB2SPEC_OPT_HASH + ".cpp";
+        if (copy_file(cacheFilename, argv[2])) {
+            printf("Using cached %s spectra.\n", argv[3]);
+            return 0;
+        }
+    }
+
     int nThreads = AvailableCores();
     threadPool = std::make_unique<ThreadPool>(nThreads);
 
@@ -823,62 +861,62 @@ int main(int argc, char **argv) {
     size_t bufsize = 3 * 3 * res * res * res;
     float *out = new float[bufsize];
 
-    for (int l = 0; l < 3; ++l) {
-        ParallelFor(0, res, [&](size_t j) {
-            const double y = j / double(res - 1);
-            fflush(stdout);
-            for (int i = 0; i < res; ++i) {
-                const double x = i / double(res - 1);
-                double coeffs[3], rgb[3];
-                memset(coeffs, 0, sizeof(double) * 3);
+    // Each of the three tables' rows is optimized independently
+    ParallelFor(0, 3 * res, [&](size_t lj) {
+        const int l = lj / res, j = lj % res;
+        const double y = j / double(res - 1);
+        fflush(stdout);
+        for (int i = 0; i < res; ++i) {
+            const double x = i / double(res - 1);
+            double coeffs[3], rgb[3];
+            memset(coeffs, 0, sizeof(double) * 3);
 
-                int start = res / 5;
+            int start = res / 5;
 
-                for (int k = start; k < res; ++k) {
-                    double b = (double)scale[k];
+            for (int k = start; k < res; ++k) {
+                double b = (double)scale[k];
 
-                    rgb[l] = b;
-                    rgb[(l + 1) % 3] = x * b;
-                    rgb[(l + 2) % 3] = y * b;
+                rgb[l] = b;
+                rgb[(l + 1) % 3] = x * b;
+                rgb[(l + 2) % 3] = y * b;
 
-                    double resid = gauss_newton(rgb, coeffs);
-                    (void)resid;
+                double resid = gauss_newton(rgb, coeffs);
+                (void)resid;
 
-                    double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
-                    double A = coeffs[0], B = coeffs[1], C = coeffs[2];
+                double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
+                double A = coeffs[0], B = coeffs[1], C = coeffs[2];
 
-                    int idx = ((l * res + k) * res + j) * res + i;
+                int idx = ((l * res + k) * res + j) * res + i;
 
-                    out[3 * idx + 0] = float(A * (sqr(c1)));
-                    out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
-                    out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
-                    // out[3*idx + 2] = resid;
-                }
+                out[3 * idx + 0] = float(A * (sqr(c1)));
+                out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
+                out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
+                // out[3*idx + 2] = resid;
+            }
 
-                memset(coeffs, 0, sizeof(double) * 3);
-                for (int k = start; k >= 0; --k) {
-                    double b = (double)scale[k];
+            memset(coeffs, 0, sizeof(double) * 3);
+            for (int k = start; k >= 0; --k) {
+                double b = (double)scale[k];
 
-                    rgb[l] = b;
-                    rgb[(l + 1) % 3] = x * b;
-                    rgb[(l + 2) % 3] = y * b;
+                rgb[l] = b;
+                rgb[(l + 1) % 3] = x * b;
+                rgb[(l + 2) % 3] = y * b;
 
-                    double resid = gauss_newton(rgb, coeffs);
-                    (void)resid;
+                double resid = gauss_newton(rgb, coeffs);
+                (void)resid;
 
-                    double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
-                    double A = coeffs[0], B = coeffs[1], C = coeffs[2];
+                double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
+                double A = coeffs[0], B = coeffs[1], C = coeffs[2];
 
-                    int idx = ((l * res + k) * res + j) * res + i;
+                int idx = ((l * res + k) * res + j) * res + i;
 
-                    out[3 * idx + 0] = float(A * (sqr(c1)));
-                    out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
-                    out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
-                    // out[3*idx + 2] = resid;
-                }
+                out[3 * idx + 0] = float(A * (sqr(c1)));
+                out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
+                out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
+                // out[3*idx + 2] = resid;
             }
-        });
-    }
+        }
+    });
 
     FILE *f = fopen(argv[2], "w");
     if (f == nullptr)
@@ -898,5 +936,14 @@ int main(int argc, char **argv) {
     fprintf(f, "} // namespace pbrt\n");
     fclose(f);
 
+    // Add the table to the cache, renaming it into place so that other builds
+    // never see a partially written file
+    if (!cacheFilename.empty()) {
+        std::string tempFilename = cacheFilename + ".tmp";
+        if (copy_file(argv[2], tempFilename) &&
+            std::rename(tempFilename.c_str(), cacheFilename.c_str()) != 0)
+            std::remove(tempFilename.c_str());
+    }
+
     threadPool.reset();
 }
@@ -18,6 +18,7 @@ TODO:
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fstream>
 #include <functional>
@@ -95,8 +96,22 @@ struct SOA {
 };
 
 int main(int argc, char *argv[]) {
-    if (argc != 2)
-        error("usage: soac <soac filename>\n");
+    // With --aosoa, fields are stored in blocks of _aosoaWidth_ items; see
+    // AOSOAArray in util/soa.h.
+    int aosoaWidth = 0;
+    if (argc == 4 && strcmp(argv[1], "--aosoa") == 0) {
+        aosoaWidth = atoi(argv[2]);
+        if (aosoaWidth < 1 || (aosoaWidth & (aosoaWidth - 1)) != 0) {
+            fprintf(stderr, "soac: %s: block width must be a power of two.\n", argv[2]);
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 2) {
+        fprintf(stderr, "usage: soac [--aosoa <block width>] <soac filename>\n");
+        return 1;
+    }
 
     // Read the file
     filename = argv[1];
@@ -317,34 +332,72 @@ int main(int argc, char *argv[]) {
             printf("template <> struct SOA<%s> {\n", soa.type.c_str());
 
         // Constructor
-        printf("    SOA() = default;\n");
-        printf("    SOA(int n, Allocator alloc) : nAlloc(n) {\n");
-        for (const auto &member : soa.members) {
-            for (int i = 0; i < member.names.size(); ++i) {
-                std::string name = member.names[i];
-                if (!member.arraySizes[i].empty()) {
-                    printf("        for (int i = 0; i < %s; ++i)\n",
-                           member.arraySizes[i].c_str());
-                    if (isFlatType(member.type) || member.numPointers > 0)
-                        printf(
-                            "            this->%s[i] = alloc.allocate_object<%s>(n);\n",
-                            name.c_str(), member.GetType().c_str());
-                    else {
-                        assert(member.isConst == false && member.numPointers == 0);
-                        printf("        this->%s[i] = SOA<%s>(n, alloc);\n", name.c_str(),
-                               member.type.c_str());
+        if (aosoaWidth > 0) {
+            printf("    static constexpr int aosoaWidth = %d;\n\n", aosoaWidth);
+            printf("    SOA() = default;\n");
+            printf("    SOA(int n, Allocator alloc) {\n");
+            printf("        size_t blockBytes =\n");
+            printf("            AOSOABlockBytes(Layout(nullptr, 0, 0, n, alloc));\n");
+            printf("        char *blocks = (char *)alloc.allocate_bytes(\n");
+            printf("            blockBytes * ((n + %d) / %d), 64);\n", aosoaWidth - 1,
+                   aosoaWidth);
+            printf("        Layout(blocks, blockBytes, 0, n, alloc);\n");
+            printf("    }\n");
+            // See AOSOALayout() in util/soa.h
+            printf("    size_t Layout(char *blocks, size_t blockBytes, size_t offset, "
+                   "int n,\n");
+            printf("                  Allocator alloc) {\n");
+            printf("        nAlloc = n;\n");
+            for (const auto &member : soa.members) {
+                for (int i = 0; i < member.names.size(); ++i) {
+                    std::string name = member.names[i];
+                    if (!member.arraySizes[i].empty()) {
+                        printf("        for (int i = 0; i < %s; ++i)\n",
+                               member.arraySizes[i].c_str());
+                        printf("            offset = AOSOALayout(&this->%s[i], blocks, "
+                               "blockBytes, offset, n,\n",
+                               name.c_str());
+                        printf("                                 alloc);\n");
+                    } else {
+                        printf("        offset = AOSOALayout(&this->%s, blocks, "
+                               "blockBytes, offset, n,\n",
+                               name.c_str());
+                        printf("                             alloc);\n");
+                    }
+                }
+            }
+            printf("        return offset;\n");
+            printf("    }\n");
+        } else {
+            printf("    SOA() = default;\n");
+            printf("    SOA(int n, Allocator alloc) : nAlloc(n) {\n");
+            for (const auto &member : soa.members) {
+                for (int i = 0; i < member.names.size(); ++i) {
+                    std::string name = member.names[i];
+                    if (!member.arraySizes[i].empty()) {
+                        printf("        for (int i = 0; i < %s; ++i)\n",
+                               member.arraySizes[i].c_str());
+                        if (isFlatType(member.type) || member.numPointers > 0)
+                            printf("            this->%s[i] = "
+                                   "alloc.allocate_object<%s>(n);\n",
+                                   name.c_str(), member.GetType().c_str());
+                        else {
+                            assert(member.isConst == false && member.numPointers == 0);
+                            printf("        this->%s[i] = SOA<%s>(n, alloc);\n",
+                                   name.c_str(), member.type.c_str());
+                        }
+                    } else {
+                        if (isFlatType(member.type) || member.numPointers > 0)
+                            printf("        this->%s = alloc.allocate_object<%s>(n);\n",
+                                   name.c_str(), member.GetType().c_str());
+                        else
+                            printf("        this->%s = SOA<%s>(n, alloc);\n",
+                                   name.c_str(), member.type.c_str());
                     }
-                } else {
-                    if (isFlatType(member.type) || member.numPointers > 0)
-                        printf("        this->%s = alloc.allocate_object<%s>(n);\n",
-                               name.c_str(), member.GetType().c_str());
-                    else
-                        printf("        this->%s = SOA<%s>(n, alloc);\n", name.c_str(),
-                               member.type.c_str());
                 }
             }
+            printf("    }\n");
         }
-        printf("    }\n");
         printf("    SOA &operator=(const SOA& s) {\n");
         printf("        nAlloc = s.nAlloc;\n");
         for (const auto &member : soa.members) {
@@ -449,7 +502,14 @@ int main(int argc, char *argv[]) {
         for (const auto &member : soa.members) {
             for (int i = 0; i < member.names.size(); ++i) {
                 std::string name = member.names[i];
-                if (!member.arraySizes[i].empty()) {
+                if (aosoaWidth > 0 &&
+                    (isFlatType(member.type) || member.numPointers > 0)) {
+                    printf("    AOSOAArray<%s, %d> %s%s;\n", member.GetType().c_str(),
+                           aosoaWidth, name.c_str(),
+                           member.arraySizes[i].empty()
+                               ? ""
+                               : ("[" + member.arraySizes[i] + "]").c_str());
+                } else if (!member.arraySizes[i].empty()) {
                     if (isFlatType(member.type) || member.numPointers > 0)
                         printf("    %s * /*PBRT_RESTRICT*/ %s[%s];\n",
                                member.GetType().c_str(), name.c_str(),
@@ -7,15 +7,23 @@
 #include <pbrt/interaction.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/shapes.h>
+#include <pbrt/options.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/stats.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
 #include <tuple>
 
 namespace pbrt {
@@ -25,6 +33,17 @@ STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
 STAT_PIXEL_COUNTER("BVH/Nodes visited", bvhNodesVisited);
+STAT_INT_DISTRIBUTION("BVH/Build time (ms)", bvhBuildTimeMS);
+STAT_RATIO("BVH/Primitives built per ms", bvhBuildPrimitives, bvhBuildMS);
+STAT_PERCENT("BVH/Cache hits", bvhCacheHits, bvhCacheLookups);
+STAT_COUNTER("BVH/Spatial splits", sbvhSpatialSplits);
+STAT_RATIO("BVH/SBVH references per primitive", sbvhReferences, sbvhPrimitives);
+STAT_COUNTER("BVH/Refits", bvhRefits);
+STAT_COUNTER("BVH/Rebuilds after refit", bvhRebuilds);
+STAT_INT_DISTRIBUTION("BVH/Update time (ms)", bvhUpdateMS);
+STAT_COUNTER("BVH/BVHs with triangle batches", bvhsWithTriangleBatches);
+STAT_COUNTER("BVH/BVHs with bilinear patch batches", bvhsWithPatchBatches);
+STAT_COUNTER("BVH/BVHs with precomputed triangles", bvhsWithPrecomputedTriangles);
 
 // MortonPrimitive Definition
 struct MortonPrimitive {
@@ -99,6 +118,26 @@ struct BVHPrimitive {
     Point3f centroid;
 };
 
+// SBVHBuildState Definition
+struct SBVHBuildState {
+    SBVHBuildState(Float minOverlapArea, int64_t maxReferences, int64_t nReferences)
+        : minOverlapArea(minOverlapArea),
+          maxReferences(maxReferences),
+          nReferences(nReferences) {}
+
+    // Spatial splits are only considered if the children of the best object
+    // split overlap by more than _minOverlapArea_
+    Float minOverlapArea;
+    int64_t maxReferences;
+    std::atomic<int64_t> nReferences;
+};
+
+// Parallel BVH Construction Helpers
+// Nodes with more primitives than this are binned and partitioned in parallel
+static constexpr int parallelBuildMinPrimitives = 64 * 1024;
+// Child subtrees with more primitives than this are built in parallel
+static constexpr int parallelBuildMinSubtreePrimitives = 4 * 1024;
+
 // BVHBuildNode Definition
 struct BVHBuildNode {
     // BVHBuildNode Public Methods
@@ -137,19 +176,355 @@ struct alignas(32) LinearBVHNode {
     uint8_t axis;          // interior node: xyz
 };
 
+// WideBVHNode Definition
+template <int N>
+struct alignas(64) WideBVHNode {
+    static constexpr int Width = N;
+    // WideBVHNode Public Methods
+    void InitChild(int i, const Bounds3f &b, int off, int nPrims) {
+        for (int axis = 0; axis < 3; ++axis) {
+            bounds[0][axis][i] = b.pMin[axis];
+            bounds[1][axis][i] = b.pMax[axis];
+        }
+        offset[i] = off;
+        nPrimitives[i] = nPrims;
+    }
+
+    void InitEmpty(int i) {
+        // Inverted bounds never pass the slab test
+        for (int axis = 0; axis < 3; ++axis) {
+            bounds[0][axis][i] = Infinity;
+            bounds[1][axis][i] = -Infinity;
+        }
+        offset[i] = -1;
+        nPrimitives[i] = 0;
+    }
+
+    bool IsEmpty(int i) const { return offset[i] < 0; }
+
+    Bounds3f ChildBounds(int i) const {
+        return Bounds3f(Point3f(bounds[0][0][i], bounds[0][1][i], bounds[0][2][i]),
+                        Point3f(bounds[1][0][i], bounds[1][1][i], bounds[1][2][i]));
+    }
+
+    int IntersectChildren(Point3f o, const Vector3f &invDir, const int dirIsNeg[3],
+                          Float raytMax, Float tEnter[N]) const {
+        // Test ray against all _N_ child boxes at once
+        // The loops below run across children with no branches so that the
+        // compiler can map each one to a single SIMD sweep.
+        Float tExit[N];
+        for (int i = 0; i < N; ++i) {
+            tEnter[i] = 0;
+            tExit[i] = raytMax;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            const Float *bNear = bounds[dirIsNeg[axis]][axis];
+            const Float *bFar = bounds[1 - dirIsNeg[axis]][axis];
+            for (int i = 0; i < N; ++i) {
+                Float tNear = (bNear[i] - o[axis]) * invDir[axis];
+                Float tFar = (bFar[i] - o[axis]) * invDir[axis];
+                // Update _tFar_ to ensure robust bounds intersection
+                tFar *= 1 + 2 * gamma(3);
+                // Written so that NaNs leave the running interval unchanged
+                tEnter[i] = tNear > tEnter[i] ? tNear : tEnter[i];
+                tExit[i] = tFar < tExit[i] ? tFar : tExit[i];
+            }
+        }
+
+        int hitMask = 0;
+        for (int i = 0; i < N; ++i)
+            hitMask |= int(tEnter[i] <= tExit[i]) << i;
+        return hitMask;
+    }
+
+    // Child bounds are stored as [min/max][axis][child]
+    Float bounds[2][3][N];
+    int offset[N];       // leaf: first primitive; interior: node index; empty: -1
+    int nPrimitives[N];  // 0 -> interior child
+};
+
+// QuantizedWideBVHNode Definition
+// Child bounds are stored as 8-bit offsets on a per-axis power-of-two grid
+// anchored at the minimum of the children's union. Quantization always rounds
+// outward, so decoded boxes conservatively contain the original ones.
+template <int N>
+struct alignas(16 * N) QuantizedWideBVHNode {
+    static constexpr int Width = N;
+    // QuantizedWideBVHNode Public Methods
+    void Init(const WideBVHNode<N> &node) {
+        // Compute union of child bounds to define the quantization grid
+        Bounds3f parentBounds;
+        for (int i = 0; i < N; ++i)
+            if (!node.IsEmpty(i))
+                parentBounds = Union(parentBounds, node.ChildBounds(i));
+
+        for (int axis = 0; axis < 3; ++axis) {
+            // Find smallest grid spacing that covers the extent in 255 steps
+            origin[axis] = parentBounds.pMin[axis];
+            Float extent = parentBounds.pMax[axis] - parentBounds.pMin[axis];
+            int e = (extent > 0) ? Clamp(Exponent(extent / 255), -126, 127) : -126;
+            exponent[axis] = e;
+            while (exponent[axis] < 127 && Decode(axis, 255) < parentBounds.pMax[axis])
+                ++exponent[axis];
+        }
+
+        for (int i = 0; i < N; ++i) {
+            offset[i] = node.offset[i];
+            CHECK_LE(node.nPrimitives[i], 65535);
+            nPrimitives[i] = node.nPrimitives[i];
+            if (node.IsEmpty(i)) {
+                // Inverted bounds never pass the slab test
+                for (int axis = 0; axis < 3; ++axis) {
+                    qBounds[0][axis][i] = 255;
+                    qBounds[1][axis][i] = 0;
+                }
+                continue;
+            }
+            // Round child bounds outward to the quantization grid
+            Bounds3f b = node.ChildBounds(i);
+            for (int axis = 0; axis < 3; ++axis) {
+                Float scale = Scale(axis);
+                int qMin = Clamp(int(std::floor((b.pMin[axis] - origin[axis]) / scale)),
+                                 0, 255);
+                while (qMin > 0 && Decode(axis, qMin) > b.pMin[axis])
+                    --qMin;
+                int qMax = Clamp(int(std::ceil((b.pMax[axis] - origin[axis]) / scale)),
+                                 0, 255);
+                while (qMax < 255 && Decode(axis, qMax) < b.pMax[axis])
+                    ++qMax;
+                qBounds[0][axis][i] = qMin;
+                qBounds[1][axis][i] = qMax;
+            }
+        }
+    }
+
+    bool IsEmpty(int i) const { return offset[i] < 0; }
+
+    Float Scale(int axis) const {
+        // Construct $2^e$ directly from the floating-point exponent bits
+#ifdef PBRT_FLOAT_AS_DOUBLE
+        return BitsToFloat(uint64_t(exponent[axis] + 1023) << 52);
+#else
+        return BitsToFloat(uint32_t(exponent[axis] + 127) << 23);
+#endif
+    }
+
+    // Traversal decodes with the same expression, so bounds remain conservative
+    Float Decode(int axis, int q) const { return origin[axis] + Float(q) * Scale(axis); }
+
+    Bounds3f ChildBounds(int i) const {
+        return Bounds3f(Point3f(Decode(0, qBounds[0][0][i]), Decode(1, qBounds[0][1][i]),
+                                Decode(2, qBounds[0][2][i])),
+                        Point3f(Decode(0, qBounds[1][0][i]), Decode(1, qBounds[1][1][i]),
+                                Decode(2, qBounds[1][2][i])));
+    }
+
+    int IntersectChildren(Point3f o, const Vector3f &invDir, const int dirIsNeg[3],
+                          Float raytMax, Float tEnter[N]) const {
+        // Decode child bounds and test ray against all _N_ children at once
+        Float tExit[N];
+        for (int i = 0; i < N; ++i) {
+            tEnter[i] = 0;
+            tExit[i] = raytMax;
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            const uint8_t *qNear = qBounds[dirIsNeg[axis]][axis];
+            const uint8_t *qFar = qBounds[1 - dirIsNeg[axis]][axis];
+            Float scale = Scale(axis);
+            for (int i = 0; i < N; ++i) {
+                Float bNear = origin[axis] + Float(qNear[i]) * scale;
+                Float bFar = origin[axis] + Float(qFar[i]) * scale;
+                Float tNear = (bNear - o[axis]) * invDir[axis];
+                Float tFar = (bFar - o[axis]) * invDir[axis];
+                // Update _tFar_ to ensure robust bounds intersection
+                tFar *= 1 + 2 * gamma(3);
+                tEnter[i] = tNear > tEnter[i] ? tNear : tEnter[i];
+                tExit[i] = tFar < tExit[i] ? tFar : tExit[i];
+            }
+        }
+
+        int hitMask = 0;
+        for (int i = 0; i < N; ++i)
+            hitMask |= int(tEnter[i] <= tExit[i]) << i;
+        return hitMask;
+    }
+
+    Float origin[3];
+    int8_t exponent[3];
+    // Quantized child bounds are stored as [min/max][axis][child]
+    uint8_t qBounds[2][3][N];
+    int offset[N];            // leaf: first primitive; interior: node index; empty: -1
+    uint16_t nPrimitives[N];  // 0 -> interior child
+};
+
+// WideBVHNodeToVisit Definition
+struct WideBVHNodeToVisit {
+    int offset, nPrimitives;
+    Float tMin;
+};
+
+template <int N>
+static int FlattenWideBVHTree(BVHBuildNode *node,
+                              std::vector<WideBVHNode<N>> *wideNodes) {
+    // Collect up to _N_ children for wide node by opening binary interior nodes
+    BVHBuildNode *children[N];
+    int nChildren = 0;
+    if (node->nPrimitives > 0)
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+    }
+    while (nChildren < N) {
+        // Replace the interior child with the largest surface area with its children
+        int expand = -1;
+        Float maxArea = -1;
+        for (int i = 0; i < nChildren; ++i)
+            if (children[i]->nPrimitives == 0 &&
+                children[i]->bounds.SurfaceArea() > maxArea) {
+                expand = i;
+                maxArea = children[i]->bounds.SurfaceArea();
+            }
+        if (expand == -1)
+            break;
+        BVHBuildNode *c = children[expand];
+        children[expand] = c->children[0];
+        children[nChildren++] = c->children[1];
+    }
+
+    // Initialize wide node and recursively flatten interior children
+    int nodeOffset = wideNodes->size();
+    wideNodes->push_back(WideBVHNode<N>());
+    for (int i = 0; i < N; ++i) {
+        if (i >= nChildren) {
+            (*wideNodes)[nodeOffset].InitEmpty(i);
+        } else if (children[i]->nPrimitives > 0) {
+            (*wideNodes)[nodeOffset].InitChild(i, children[i]->bounds,
+                                               children[i]->firstPrimOffset,
+                                               children[i]->nPrimitives);
+        } else {
+            int childOffset = FlattenWideBVHTree<N>(children[i], wideNodes);
+            (*wideNodes)[nodeOffset].InitChild(i, children[i]->bounds, childOffset, 0);
+        }
+    }
+    return nodeOffset;
+}
+
 // BVHAggregate Method Definitions
+// BVH Cache Definitions
+// A cache file holds a _BVHCacheHeader_, the index into the original
+// primitive array of each ordered primitive reference, and then the flattened
+// nodes.
+static constexpr char bvhCacheMagic[8] = "pbrtBVH";
+static constexpr int bvhCacheVersion = 2;
+
+struct BVHCacheHeader {
+    char magic[8];
+    uint64_t key;
+    int32_t version, width;
+    int64_t nPrimitives, nReferences, nNodes;
+    int64_t indicesOffset, nodesOffset;
+    Bounds3f bounds;
+};
+
+static int64_t BVHCacheAlignOffset(int64_t offset) {
+    return (offset + 127) & ~int64_t(127);
+}
+
+static size_t BVHCacheNodeSize(int width, bool quantized) {
+    if (width == 2)
+        return sizeof(LinearBVHNode);
+    else if (width == 4)
+        return quantized ? sizeof(QuantizedWideBVHNode<4>) : sizeof(WideBVHNode<4>);
+    else
+        return quantized ? sizeof(QuantizedWideBVHNode<8>) : sizeof(WideBVHNode<8>);
+}
+
+// The BVH depends only on the primitive bounds and the build parameters, so
+// hashing those gives a key that matches exactly when the build would.
+static uint64_t BVHCacheKey(const std::vector<BVHPrimitive> &bvhPrimitives,
+                            int maxPrimsInNode, BVHAggregate::SplitMethod splitMethod,
+                            int width, bool quantized, Float splitAlpha,
+                            Float maxDuplication) {
+    constexpr int64_t chunkSize = 16 * 1024;
+    int64_t nChunks = (bvhPrimitives.size() + chunkSize - 1) / chunkSize;
+    std::vector<uint64_t> chunkHashes(nChunks);
+    ParallelFor(0, nChunks, [&](int64_t chunk) {
+        uint64_t hash = 0;
+        size_t end = std::min<size_t>(bvhPrimitives.size(), (chunk + 1) * chunkSize);
+        for (size_t i = chunk * chunkSize; i < end; ++i)
+            hash = HashBuffer(&bvhPrimitives[i].bounds, sizeof(Bounds3f), hash);
+        chunkHashes[chunk] = hash;
+    });
+    uint64_t boundsHash =
+        HashBuffer(chunkHashes.data(), chunkHashes.size() * sizeof(uint64_t));
+    return Hash(boundsHash, bvhPrimitives.size(), maxPrimsInNode, splitMethod, width,
+                quantized, splitAlpha, maxDuplication, bvhCacheVersion,
+                BVHCacheNodeSize(width, quantized), sizeof(Float));
+}
+
+// BVH node arrays are allocated from the BVH subsystem's memory resource
+template <typename Node>
+static Node *allocateNodes(int n) {
+    Allocator alloc(SubsystemMemory(MemorySubsystem::BVH));
+    Node *nodes = alloc.allocate_object<Node>(n);
+    for (int i = 0; i < n; ++i)
+        alloc.construct(&nodes[i]);
+    return nodes;
+}
+
+template <typename Node>
+static void freeNodes(Node *nodes, int n) {
+    if (nodes)
+        Allocator(SubsystemMemory(MemorySubsystem::BVH)).deallocate_object(nodes, n);
+}
+
 BVHAggregate::BVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
-                           SplitMethod splitMethod)
+                           SplitMethod splitMethod, int width, bool quantized,
+                           Float splitAlpha, Float maxDuplication,
+                           bool precomputeTriangles)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       primitives(std::move(prims)),
-      splitMethod(splitMethod) {
+      splitMethod(splitMethod),
+      width(width),
+      quantized(quantized),
+      splitAlpha(splitAlpha),
+      maxDuplication(std::max<Float>(0, maxDuplication)),
+      precomputeTriangles(precomputeTriangles) {
     CHECK(!primitives.empty());
+    CHECK(width == 2 || width == 4 || width == 8);
+    CHECK(!quantized || width > 2);
+    build(true);
+}
+
+void BVHAggregate::build(bool useCache) {
     // Build BVH from _primitives_
     // Initialize _bvhPrimitives_ array for primitives
     std::vector<BVHPrimitive> bvhPrimitives(primitives.size());
     for (size_t i = 0; i < primitives.size(); ++i)
         bvhPrimitives[i] = BVHPrimitive(i, primitives[i].Bounds());
 
+    // Try to load the BVH from the cache directory, if there is one
+    std::string cacheFilename;
+    uint64_t cacheKey = 0;
+    if (useCache && Options && !Options->bvhCacheDirectory.empty()) {
+        cacheKey = BVHCacheKey(bvhPrimitives, maxPrimsInNode, splitMethod, width,
+                               quantized, splitAlpha, maxDuplication);
+        cacheFilename =
+            StringPrintf("%s/bvh-%016llx.bin", Options->bvhCacheDirectory,
+                         (unsigned long long)cacheKey);
+        ++bvhCacheLookups;
+        if (readCache(cacheFilename, cacheKey)) {
+            ++bvhCacheHits;
+            buildSAHCost = sahCost();
+            buildTriangleBatches();
+            buildPatchBatches();
+            buildPrecomputedTriangles();
+            interleaveNodes();
+            return;
+        }
+    }
+
     // Build BVH for primitives using _bvhPrimitives_
     // Declare _Allocator_s used for BVH construction
     pstd::pmr::monotonic_buffer_resource resource;
@@ -163,9 +538,27 @@ BVHAggregate::BVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
     std::vector<Primitive> orderedPrims(primitives.size());
     BVHBuildNode *root;
     // Build BVH according to selected _splitMethod_
+    Timer buildTimer;
     std::atomic<int> totalNodes{0};
     if (splitMethod == SplitMethod::HLBVH) {
         root = buildHLBVH(alloc, bvhPrimitives, &totalNodes, orderedPrims);
+    } else if (splitMethod == SplitMethod::SBVH) {
+        // Build SBVH, allowing for duplicated primitive references
+        Bounds3f rootBounds;
+        for (const BVHPrimitive &bp : bvhPrimitives)
+            rootBounds = Union(rootBounds, bp.bounds);
+        SBVHBuildState state(rootBounds.SurfaceArea() * splitAlpha,
+                             primitives.size() +
+                                 int64_t(maxDuplication * primitives.size()),
+                             primitives.size());
+        orderedPrims.resize(state.maxReferences);
+        std::atomic<int> orderedPrimsOffset{0};
+        root = buildSBVH(threadAllocators, bvhPrimitives, 0, &state, &totalNodes,
+                         &orderedPrimsOffset, orderedPrims);
+        CHECK_LE(orderedPrimsOffset.load(), orderedPrims.size());
+        orderedPrims.resize(orderedPrimsOffset.load());
+        sbvhReferences += orderedPrims.size();
+        sbvhPrimitives += primitives.size();
     } else {
         std::atomic<int> orderedPrimsOffset{0};
         size_t nPrimitives = primitives.size();
@@ -174,18 +567,238 @@ BVHAggregate::BVHAggregate(std::vector<Primitive> prims, int maxPrimsInNode,
         CHECK_EQ(orderedPrimsOffset.load(), orderedPrims.size());
     }
     primitives.swap(orderedPrims);
-
-    // Convert BVH into compact representation in _nodes_ array
+    int64_t buildMS = int64_t(1000 * buildTimer.ElapsedSeconds());
+    LOG_VERBOSE("BVH build for %d primitives took %d ms", (int)orderedPrims.size(),
+                buildMS);
+    bvhBuildTimeMS << buildMS;
+    bvhBuildPrimitives += orderedPrims.size();
+    bvhBuildMS += buildMS;
+
+    bounds = root->bounds;
     bvhPrimitives.resize(0);
-    LOG_VERBOSE("BVH created with %d nodes for %d primitives (%.2f MB)",
-                totalNodes.load(), (int)primitives.size(),
-                float(totalNodes.load() * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
-    nodes = new LinearBVHNode[totalNodes];
-    int offset = 0;
-    flattenBVHTree(root, &offset);
-    CHECK_EQ(totalNodes.load(), offset);
+    if (width == 2) {
+        // Convert BVH into compact representation in _nodes_ array
+        LOG_VERBOSE(
+            "BVH created with %d nodes for %d primitives (%.2f MB)", totalNodes.load(),
+            (int)primitives.size(),
+            float(totalNodes.load() * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
+        treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
+                     primitives.size() * sizeof(primitives[0]);
+        nodes = allocateNodes<LinearBVHNode>(totalNodes);
+        int offset = 0;
+        flattenBVHTree(root, &offset);
+        CHECK_EQ(totalNodes.load(), offset);
+        nNodes = offset;
+    } else {
+        // Collapse binary BVH into _width_-wide nodes
+        auto flattenWide = [&](auto **wideNodesOut, auto **quantizedNodesOut, auto tag) {
+            constexpr int N = decltype(tag)::value;
+            std::vector<WideBVHNode<N>> wideNodes;
+            wideNodes.reserve(totalNodes / (N - 1) + 1);
+            FlattenWideBVHTree<N>(root, &wideNodes);
+            nNodes = wideNodes.size();
+            size_t nodeBytes = nNodes * (quantized ? sizeof(QuantizedWideBVHNode<N>)
+                                                   : sizeof(WideBVHNode<N>));
+            LOG_VERBOSE("%d-wide %sBVH created with %d nodes for %d primitives (%.2f MB)",
+                        N, quantized ? "quantized " : "", nNodes, (int)primitives.size(),
+                        float(nodeBytes) / (1024.f * 1024.f));
+            treeBytes +=
+                nodeBytes + sizeof(*this) + primitives.size() * sizeof(primitives[0]);
+            if (quantized) {
+                // Quantize child bounds of each wide node
+                *quantizedNodesOut = allocateNodes<QuantizedWideBVHNode<N>>(nNodes);
+                ParallelFor(0, nNodes, [&](int64_t i) {
+                    (*quantizedNodesOut)[i].Init(wideNodes[i]);
+                });
+            } else {
+                *wideNodesOut = allocateNodes<WideBVHNode<N>>(nNodes);
+                std::copy(wideNodes.begin(), wideNodes.end(), *wideNodesOut);
+            }
+        };
+        if (width == 4)
+            flattenWide(&nodes4, &quantizedNodes4, std::integral_constant<int, 4>());
+        else
+            flattenWide(&nodes8, &quantizedNodes8, std::integral_constant<int, 8>());
+    }
+    // _orderedPrims_ now holds the primitives in their original order
+    if (!cacheFilename.empty())
+        writeCache(cacheFilename, cacheKey, orderedPrims);
+    buildSAHCost = sahCost();
+    buildTriangleBatches();
+    buildPatchBatches();
+    buildPrecomputedTriangles();
+    interleaveNodes();
+}
+
+void BVHAggregate::interleaveNodes() {
+    // Every thread traverses the BVH, so spread its nodes across the NUMA
+    // nodes' memory rather than leaving them where the build touched them
+    // first; nodes that are used in place from a mapped cache file are left
+    // to the page cache
+    if (!Options || !Options->numa || cacheFile)
+        return;
+    if (nodes)
+        InterleaveAcrossNUMANodes(nodes, nNodes * sizeof(LinearBVHNode));
+    else if (nodes4)
+        InterleaveAcrossNUMANodes(nodes4, nNodes * sizeof(WideBVHNode<4>));
+    else if (nodes8)
+        InterleaveAcrossNUMANodes(nodes8, nNodes * sizeof(WideBVHNode<8>));
+    else if (quantizedNodes4)
+        InterleaveAcrossNUMANodes(quantizedNodes4,
+                                  nNodes * sizeof(QuantizedWideBVHNode<4>));
+    else if (quantizedNodes8)
+        InterleaveAcrossNUMANodes(quantizedNodes8,
+                                  nNodes * sizeof(QuantizedWideBVHNode<8>));
+    InterleaveAcrossNUMANodes(primitives.data(), primitives.size() * sizeof(Primitive));
+}
+
+void BVHAggregate::Update(Float maxCostRatio) {
+    Timer updateTimer;
+    Refit();
+    Float cost = sahCost();
+    if (cost > maxCostRatio * buildSAHCost) {
+        // Rebuild BVH whose refit topology has degraded too much
+        LOG_VERBOSE("Refit BVH SAH cost %f exceeds %f times build cost %f; rebuilding",
+                    cost, maxCostRatio, buildSAHCost);
+        if (splitMethod == SplitMethod::SBVH) {
+            // Remove duplicate primitive references from spatial splits
+            std::sort(primitives.begin(), primitives.end());
+            primitives.erase(std::unique(primitives.begin(), primitives.end()),
+                             primitives.end());
+        }
+        releaseNodes();
+        build(false);
+        ++bvhRebuilds;
+    }
+    bvhUpdateMS << int64_t(1000 * updateTimer.ElapsedSeconds());
+}
+
+// Sets the children of a wide node after refitting their bounds
+template <int N>
+static void SetRefitNode(WideBVHNode<N> *node, const WideBVHNode<N> &refit) {
+    *node = refit;
+}
+
+template <int N>
+static void SetRefitNode(QuantizedWideBVHNode<N> *node, const WideBVHNode<N> &refit) {
+    node->Init(refit);
+}
+
+template <typename Node>
+static void RefitWideBVH(Node *wideNodes, int nNodes,
+                         const std::vector<Bounds3f> &primBounds) {
+    // Refit wide nodes bottom-up; children always follow their parent
+    constexpr int N = Node::Width;
+    std::vector<Bounds3f> nodeBounds(nNodes);
+    for (int n = nNodes - 1; n >= 0; --n) {
+        Node &node = wideNodes[n];
+        WideBVHNode<N> refit;
+        for (int i = 0; i < N; ++i) {
+            if (node.IsEmpty(i)) {
+                refit.InitEmpty(i);
+                continue;
+            }
+            Bounds3f b;
+            if (node.nPrimitives[i] > 0) {
+                for (int j = 0; j < node.nPrimitives[i]; ++j)
+                    b = Union(b, primBounds[node.offset[i] + j]);
+            } else {
+                DCHECK_GT(node.offset[i], n);
+                b = nodeBounds[node.offset[i]];
+            }
+            refit.InitChild(i, b, node.offset[i], node.nPrimitives[i]);
+            nodeBounds[n] = Union(nodeBounds[n], b);
+        }
+        SetRefitNode(&node, refit);
+    }
+}
+
+void BVHAggregate::Refit() {
+    // Compute current bounds of all primitives in parallel
+    std::vector<Bounds3f> primBounds(primitives.size());
+    ParallelFor(0, primitives.size(),
+                [&](int64_t i) { primBounds[i] = primitives[i].Bounds(); });
+
+    if (width == 2) {
+        // Refit binary nodes bottom-up; both children follow their parent
+        for (int n = nNodes - 1; n >= 0; --n) {
+            LinearBVHNode &node = nodes[n];
+            if (node.nPrimitives > 0) {
+                Bounds3f b;
+                for (int j = 0; j < node.nPrimitives; ++j)
+                    b = Union(b, primBounds[node.primitivesOffset + j]);
+                node.bounds = b;
+            } else
+                node.bounds =
+                    Union(nodes[n + 1].bounds, nodes[node.secondChildOffset].bounds);
+        }
+        bounds = nodes[0].bounds;
+    } else {
+        if (nodes4)
+            RefitWideBVH(nodes4, nNodes, primBounds);
+        else if (nodes8)
+            RefitWideBVH(nodes8, nNodes, primBounds);
+        else if (quantizedNodes4)
+            RefitWideBVH(quantizedNodes4, nNodes, primBounds);
+        else
+            RefitWideBVH(quantizedNodes8, nNodes, primBounds);
+        bounds = Bounds3f();
+        for (const Bounds3f &b : primBounds)
+            bounds = Union(bounds, b);
+    }
+    // Update the copies of the moved triangles' and patches' vertices
+    buildTriangleBatches();
+    buildPatchBatches();
+    buildPrecomputedTriangles();
+    ++bvhRefits;
+}
+
+Float BVHAggregate::sahCost() const {
+    // Sum surface areas of nodes weighted by their traversal or intersection cost
+    auto wideCost = [&](const auto *wideNodes) {
+        Float cost = 0;
+        for (int n = 0; n < nNodes; ++n)
+            for (int i = 0; i < std::remove_pointer_t<decltype(wideNodes)>::Width; ++i)
+                if (!wideNodes[n].IsEmpty(i))
+                    cost += wideNodes[n].ChildBounds(i).SurfaceArea() *
+                            std::max<int>(1, wideNodes[n].nPrimitives[i]);
+        return cost;
+    };
+    Float cost = 0;
+    if (width == 2) {
+        for (int n = 0; n < nNodes; ++n)
+            cost +=
+                nodes[n].bounds.SurfaceArea() * std::max<int>(1, nodes[n].nPrimitives);
+    } else if (nodes4)
+        cost = wideCost(nodes4);
+    else if (nodes8)
+        cost = wideCost(nodes8);
+    else if (quantizedNodes4)
+        cost = wideCost(quantizedNodes4);
+    else
+        cost = wideCost(quantizedNodes8);
+    Float rootArea = bounds.SurfaceArea();
+    return rootArea > 0 ? cost / rootArea : 0;
+}
+
+void BVHAggregate::releaseNodes() {
+    if (cacheFile) {
+        // Nodes live in the mapped cache file
+        delete cacheFile;
+        cacheFile = nullptr;
+    } else {
+        freeNodes(nodes, nNodes);
+        freeNodes(nodes4, nNodes);
+        freeNodes(nodes8, nNodes);
+        freeNodes(quantizedNodes4, nNodes);
+        freeNodes(quantizedNodes8, nNodes);
+    }
+    nodes = nullptr;
+    nodes4 = nullptr;
+    nodes8 = nullptr;
+    quantizedNodes4 = nullptr;
+    quantizedNodes8 = nullptr;
+    nNodes = 0;
 }
 
 BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocators,
@@ -199,12 +812,29 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
     BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
     // Initialize _BVHBuildNode_ for primitive range
     ++*totalNodes;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, bvhPrimitives[i].bounds);
-
+    // Compute bounds of all primitives and their centroids in BVH node
+    Bounds3f bounds, centroidBounds;
     int nPrimitives = end - start;
+    auto computeBounds = [&](int64_t s, int64_t e) {
+        Bounds3f b, cb;
+        for (int64_t i = s; i < e; ++i) {
+            b = Union(b, bvhPrimitives[i].bounds);
+            cb = Union(cb, bvhPrimitives[i].centroid);
+        }
+        return std::make_pair(b, cb);
+    };
+    if (nPrimitives < parallelBuildMinPrimitives)
+        std::tie(bounds, centroidBounds) = computeBounds(start, end);
+    else {
+        std::mutex boundsMutex;
+        ParallelFor(start, end, [&](int64_t s, int64_t e) {
+            std::pair<Bounds3f, Bounds3f> b = computeBounds(s, e);
+            std::lock_guard<std::mutex> lock(boundsMutex);
+            bounds = Union(bounds, b.first);
+            centroidBounds = Union(centroidBounds, b.second);
+        });
+    }
+
     if (bounds.SurfaceArea() == 0 || nPrimitives == 1) {
         // Create leaf _BVHBuildNode_
         int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
@@ -216,10 +846,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
         return node;
 
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, bvhPrimitives[i].centroid);
+        // Choose split dimension _dim_ using bound of primitive centroids
         int dim = centroidBounds.MaxDimension();
 
         // Partition primitives into two sets and build children
@@ -241,10 +868,11 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
                 // Partition primitives through node's midpoint
                 Float pmid = (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
                 BVHPrimitive *midPtr =
-                    std::partition(&bvhPrimitives[start], &bvhPrimitives[end - 1] + 1,
-                                   [dim, pmid](const BVHPrimitive &pi) {
-                                       return pi.centroid[dim] < pmid;
-                                   });
+                    ParallelPartition(&bvhPrimitives[start], &bvhPrimitives[end - 1] + 1,
+                                      [dim, pmid](const BVHPrimitive &pi) {
+                                          return pi.centroid[dim] < pmid;
+                                      },
+                                      parallelBuildMinPrimitives);
                 mid = midPtr - &bvhPrimitives[0];
                 // For lots of prims with large overlapping bounding boxes, this
                 // may fail to partition; in that case do not break and fall through
@@ -281,16 +909,35 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
                     BVHSplitBucket buckets[nBuckets];
 
                     // Initialize _BVHSplitBucket_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
-                        int b = nBuckets *
-                                centroidBounds.Offset(bvhPrimitives[i].centroid)[dim];
-                        if (b == nBuckets)
-                            b = nBuckets - 1;
-                        DCHECK_GE(b, 0);
-                        DCHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, bvhPrimitives[i].bounds);
+                    auto binPrimitives = [&](int64_t s, int64_t e,
+                                             BVHSplitBucket *buckets) {
+                        for (int64_t i = s; i < e; ++i) {
+                            int b = nBuckets *
+                                    centroidBounds.Offset(bvhPrimitives[i].centroid)[dim];
+                            if (b == nBuckets)
+                                b = nBuckets - 1;
+                            DCHECK_GE(b, 0);
+                            DCHECK_LT(b, nBuckets);
+                            buckets[b].count++;
+                            buckets[b].bounds =
+                                Union(buckets[b].bounds, bvhPrimitives[i].bounds);
+                        }
+                    };
+                    if (nPrimitives < parallelBuildMinPrimitives)
+                        binPrimitives(start, end, buckets);
+                    else {
+                        // Bin primitives in parallel and merge per-chunk buckets
+                        std::mutex bucketMutex;
+                        ParallelFor(start, end, [&](int64_t s, int64_t e) {
+                            BVHSplitBucket chunkBuckets[nBuckets];
+                            binPrimitives(s, e, chunkBuckets);
+                            std::lock_guard<std::mutex> lock(bucketMutex);
+                            for (int b = 0; b < nBuckets; ++b) {
+                                buckets[b].count += chunkBuckets[b].count;
+                                buckets[b].bounds =
+                                    Union(buckets[b].bounds, chunkBuckets[b].bounds);
+                            }
+                        });
                     }
 
                     // Compute costs for splitting after each bucket
@@ -336,7 +983,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
 
                     // Either create leaf or split primitives at selected SAH bucket
                     if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
-                        BVHPrimitive *pmid = std::partition(
+                        BVHPrimitive *pmid = ParallelPartition(
                             &bvhPrimitives[start], &bvhPrimitives[end - 1] + 1,
                             [=](const BVHPrimitive &bp) {
                                 int b =
@@ -344,7 +991,8 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
                                 if (b == nBuckets)
                                     b = nBuckets - 1;
                                 return b <= minCostSplitBucket;
-                            });
+                            },
+                            parallelBuildMinPrimitives);
                         mid = pmid - &bvhPrimitives[0];
                     } else {
                         // Create leaf _BVHBuildNode_
@@ -364,7 +1012,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
 
             BVHBuildNode *children[2];
             // Recursively build BVHs for _children_
-            if (end - start > 128 * 1024) {
+            if (end - start > parallelBuildMinSubtreePrimitives) {
                 // Recursively build child BVHs in parallel
                 ParallelFor(0, 2, [&](int i) {
                     if (i == 0)
@@ -394,6 +1042,287 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
     return node;
 }
 
+BVHBuildNode *BVHAggregate::buildSBVH(std::vector<Allocator> &threadAllocators,
+                                      std::vector<BVHPrimitive> &references, int depth,
+                                      SBVHBuildState *state,
+                                      std::atomic<int> *totalNodes,
+                                      std::atomic<int> *orderedPrimsOffset,
+                                      std::vector<Primitive> &orderedPrims) {
+    DCHECK(!references.empty());
+    Allocator alloc = threadAllocators[ThreadIndex];
+    BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
+    ++*totalNodes;
+    // Compute bounds of all primitive references and their centroids
+    Bounds3f bounds, centroidBounds;
+    for (const BVHPrimitive &ref : references) {
+        bounds = Union(bounds, ref.bounds);
+        centroidBounds = Union(centroidBounds, ref.centroid);
+    }
+    int nReferences = references.size();
+    auto createLeaf = [&]() {
+        int firstPrimOffset = orderedPrimsOffset->fetch_add(nReferences);
+        for (int i = 0; i < nReferences; ++i)
+            orderedPrims[firstPrimOffset + i] = primitives[references[i].primitiveIndex];
+        node->InitLeaf(firstPrimOffset, nReferences, bounds);
+        return node;
+    };
+    if (bounds.SurfaceArea() == 0 || nReferences == 1)
+        return createLeaf();
+
+    // Find lowest-cost object split over all three axes
+    constexpr int nBuckets = 12;
+    Float objectCost = Infinity;
+    int objectDim = -1, objectBucket = -1;
+    Bounds3f objectOverlap;
+    auto objectBucketIndex = [&](const BVHPrimitive &ref, int dim) {
+        int b = nBuckets * centroidBounds.Offset(ref.centroid)[dim];
+        return std::min(b, nBuckets - 1);
+    };
+    for (int dim = 0; dim < 3; ++dim) {
+        if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+            continue;
+        BVHSplitBucket buckets[nBuckets];
+        for (const BVHPrimitive &ref : references) {
+            int b = objectBucketIndex(ref, dim);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds, ref.bounds);
+        }
+        // Compute costs for splitting after each bucket
+        constexpr int nSplits = nBuckets - 1;
+        int countBelow[nSplits], countAbove[nSplits];
+        Bounds3f boundsBelow[nSplits], boundsAbove[nSplits];
+        countBelow[0] = buckets[0].count;
+        boundsBelow[0] = buckets[0].bounds;
+        for (int i = 1; i < nSplits; ++i) {
+            countBelow[i] = countBelow[i - 1] + buckets[i].count;
+            boundsBelow[i] = Union(boundsBelow[i - 1], buckets[i].bounds);
+        }
+        countAbove[nSplits - 1] = buckets[nBuckets - 1].count;
+        boundsAbove[nSplits - 1] = buckets[nBuckets - 1].bounds;
+        for (int i = nSplits - 2; i >= 0; --i) {
+            countAbove[i] = countAbove[i + 1] + buckets[i + 1].count;
+            boundsAbove[i] = Union(boundsAbove[i + 1], buckets[i + 1].bounds);
+        }
+        for (int i = 0; i < nSplits; ++i) {
+            if (countBelow[i] == 0 || countAbove[i] == 0)
+                continue;
+            Float cost = countBelow[i] * boundsBelow[i].SurfaceArea() +
+                         countAbove[i] * boundsAbove[i].SurfaceArea();
+            if (cost < objectCost) {
+                objectCost = cost;
+                objectDim = dim;
+                objectBucket = i;
+                objectOverlap = pbrt::Intersect(boundsBelow[i], boundsAbove[i]);
+            }
+        }
+    }
+
+    // Find lowest-cost spatial split if the object split's children overlap
+    constexpr int nSpatialBins = 16;
+    constexpr int maxSpatialSplitDepth = 64;
+    Float spatialCost = Infinity;
+    int spatialDim = -1;
+    Float spatialPlane = 0;
+    Bounds3f spatialBoundsBelow, spatialBoundsAbove;
+    int spatialCountBelow = 0, spatialCountAbove = 0;
+    bool trySpatialSplit =
+        depth < maxSpatialSplitDepth &&
+        state->nReferences.load(std::memory_order_relaxed) < state->maxReferences &&
+        (objectDim == -1 || (!objectOverlap.IsDegenerate() &&
+                             objectOverlap.SurfaceArea() > state->minOverlapArea));
+    if (trySpatialSplit) {
+        // Bin clipped primitive references along each axis
+        struct SpatialBin {
+            Bounds3f bounds;
+            int entries = 0, exits = 0;
+        };
+        SpatialBin bins[3][nSpatialBins];
+        auto binReferences = [&](int dim) {
+            Float binWidth = (bounds.pMax[dim] - bounds.pMin[dim]) / nSpatialBins;
+            if (binWidth == 0)
+                return;
+            auto binIndex = [&](Float v) {
+                int b = (v - bounds.pMin[dim]) / binWidth;
+                return Clamp(b, 0, nSpatialBins - 1);
+            };
+            for (const BVHPrimitive &ref : references) {
+                int first = binIndex(ref.bounds.pMin[dim]);
+                int last = binIndex(ref.bounds.pMax[dim]);
+                bins[dim][first].entries++;
+                bins[dim][last].exits++;
+                if (first == last) {
+                    bins[dim][first].bounds = Union(bins[dim][first].bounds, ref.bounds);
+                    continue;
+                }
+                // Add the part of the primitive in each bin to its bounds
+                const Primitive &prim = primitives[ref.primitiveIndex];
+                for (int b = first; b <= last; ++b) {
+                    Bounds3f clip = ref.bounds;
+                    clip.pMin[dim] =
+                        std::max(clip.pMin[dim], bounds.pMin[dim] + b * binWidth);
+                    if (b < nSpatialBins - 1)
+                        clip.pMax[dim] = std::min(clip.pMax[dim],
+                                                  bounds.pMin[dim] + (b + 1) * binWidth);
+                    bins[dim][b].bounds =
+                        Union(bins[dim][b].bounds, prim.ClippedBounds(clip));
+                }
+            }
+        };
+        if (nReferences < parallelBuildMinSubtreePrimitives)
+            for (int dim = 0; dim < 3; ++dim)
+                binReferences(dim);
+        else
+            ParallelFor(0, 3, binReferences);
+
+        // Choose spatial split plane that minimizes SAH cost
+        for (int dim = 0; dim < 3; ++dim) {
+            Float binWidth = (bounds.pMax[dim] - bounds.pMin[dim]) / nSpatialBins;
+            if (binWidth == 0)
+                continue;
+            constexpr int nSplits = nSpatialBins - 1;
+            int countBelow[nSplits], countAbove[nSplits];
+            Bounds3f boundsBelow[nSplits], boundsAbove[nSplits];
+            countBelow[0] = bins[dim][0].entries;
+            boundsBelow[0] = bins[dim][0].bounds;
+            for (int i = 1; i < nSplits; ++i) {
+                countBelow[i] = countBelow[i - 1] + bins[dim][i].entries;
+                boundsBelow[i] = Union(boundsBelow[i - 1], bins[dim][i].bounds);
+            }
+            countAbove[nSplits - 1] = bins[dim][nSpatialBins - 1].exits;
+            boundsAbove[nSplits - 1] = bins[dim][nSpatialBins - 1].bounds;
+            for (int i = nSplits - 2; i >= 0; --i) {
+                countAbove[i] = countAbove[i + 1] + bins[dim][i + 1].exits;
+                boundsAbove[i] = Union(boundsAbove[i + 1], bins[dim][i + 1].bounds);
+            }
+            for (int i = 0; i < nSplits; ++i) {
+                if (countBelow[i] == 0 || countAbove[i] == 0)
+                    continue;
+                Float cost = countBelow[i] * boundsBelow[i].SurfaceArea() +
+                             countAbove[i] * boundsAbove[i].SurfaceArea();
+                if (cost < spatialCost) {
+                    spatialCost = cost;
+                    spatialDim = dim;
+                    spatialPlane = bounds.pMin[dim] + (i + 1) * binWidth;
+                    spatialBoundsBelow = boundsBelow[i];
+                    spatialBoundsAbove = boundsAbove[i];
+                    spatialCountBelow = countBelow[i];
+                    spatialCountAbove = countAbove[i];
+                }
+            }
+        }
+    }
+
+    // Create leaf if splitting isn't worthwhile
+    Float minCost = 1.f / 2.f + std::min(objectCost, spatialCost) / bounds.SurfaceArea();
+    Float leafCost = nReferences;
+    if ((objectDim == -1 && spatialDim == -1) ||
+        (nReferences <= maxPrimsInNode && minCost >= leafCost))
+        return createLeaf();
+
+    std::vector<BVHPrimitive> below, above;
+    int dim = objectDim;
+    if (spatialCost < objectCost) {
+        // Reserve duplicated references for the spatial split
+        int nStraddling = 0;
+        for (const BVHPrimitive &ref : references)
+            if (ref.bounds.pMin[spatialDim] < spatialPlane &&
+                ref.bounds.pMax[spatialDim] > spatialPlane)
+                ++nStraddling;
+        if (state->nReferences.fetch_add(nStraddling) + nStraddling <=
+            state->maxReferences) {
+            // Partition references, splitting those that straddle the plane
+            int nDuplicated = 0;
+            Float areaBelow = spatialBoundsBelow.SurfaceArea();
+            Float areaAbove = spatialBoundsAbove.SurfaceArea();
+            for (const BVHPrimitive &ref : references) {
+                if (ref.bounds.pMax[spatialDim] <= spatialPlane) {
+                    below.push_back(ref);
+                    continue;
+                } else if (ref.bounds.pMin[spatialDim] >= spatialPlane) {
+                    above.push_back(ref);
+                    continue;
+                }
+                // Clip straddling reference to both sides of the plane
+                const Primitive &prim = primitives[ref.primitiveIndex];
+                Bounds3f clipBelow = ref.bounds, clipAbove = ref.bounds;
+                clipBelow.pMax[spatialDim] = clipAbove.pMin[spatialDim] = spatialPlane;
+                Bounds3f refBelow = prim.ClippedBounds(clipBelow);
+                Bounds3f refAbove = prim.ClippedBounds(clipAbove);
+                if (refBelow.IsDegenerate() || refAbove.IsDegenerate()) {
+                    (refAbove.IsDegenerate() ? below : above).push_back(ref);
+                    continue;
+                }
+
+                // Keep the reference unsplit if that is cheaper
+                Float splitCost =
+                    areaBelow * spatialCountBelow + areaAbove * spatialCountAbove;
+                Float unsplitBelowCost =
+                    Union(spatialBoundsBelow, ref.bounds).SurfaceArea() *
+                        spatialCountBelow +
+                    areaAbove * (spatialCountAbove - 1);
+                Float unsplitAboveCost =
+                    areaBelow * (spatialCountBelow - 1) +
+                    Union(spatialBoundsAbove, ref.bounds).SurfaceArea() *
+                        spatialCountAbove;
+                if (unsplitBelowCost < splitCost &&
+                    unsplitBelowCost <= unsplitAboveCost) {
+                    below.push_back(ref);
+                    spatialBoundsBelow = Union(spatialBoundsBelow, ref.bounds);
+                    areaBelow = spatialBoundsBelow.SurfaceArea();
+                    --spatialCountAbove;
+                } else if (unsplitAboveCost < splitCost) {
+                    above.push_back(ref);
+                    spatialBoundsAbove = Union(spatialBoundsAbove, ref.bounds);
+                    areaAbove = spatialBoundsAbove.SurfaceArea();
+                    --spatialCountBelow;
+                } else {
+                    below.push_back(BVHPrimitive(ref.primitiveIndex, refBelow));
+                    above.push_back(BVHPrimitive(ref.primitiveIndex, refAbove));
+                    ++nDuplicated;
+                }
+            }
+            // Return unused reservations to the duplication budget
+            state->nReferences -= nStraddling - nDuplicated;
+
+            if (below.empty() || above.empty()) {
+                // Fall back to the object split if the spatial split was degenerate
+                state->nReferences -= nDuplicated;
+                below.clear();
+                above.clear();
+            } else {
+                dim = spatialDim;
+                ++sbvhSpatialSplits;
+            }
+        } else
+            state->nReferences -= nStraddling;
+    }
+
+    if (below.empty()) {
+        if (objectDim == -1)
+            return createLeaf();
+        // Partition references at the selected object split bucket
+        for (const BVHPrimitive &ref : references)
+            (objectBucketIndex(ref, objectDim) <= objectBucket ? below : above)
+                .push_back(ref);
+    }
+    // Release this node's references before building the children
+    std::vector<BVHPrimitive>().swap(references);
+
+    BVHBuildNode *children[2];
+    auto buildChild = [&](int i) {
+        children[i] = buildSBVH(threadAllocators, i == 0 ? below : above, depth + 1,
+                                state, totalNodes, orderedPrimsOffset, orderedPrims);
+    };
+    if (below.size() + above.size() > parallelBuildMinSubtreePrimitives)
+        ParallelFor(0, 2, buildChild);
+    else {
+        buildChild(0);
+        buildChild(1);
+    }
+    node->InitInterior(dim, children[0], children[1]);
+    return node;
+}
+
 BVHBuildNode *BVHAggregate::buildHLBVH(Allocator alloc,
                                        const std::vector<BVHPrimitive> &bvhPrimitives,
                                        std::atomic<int> *totalNodes,
@@ -529,13 +1458,386 @@ int BVHAggregate::flattenBVHTree(BVHBuildNode *node, int *offset) {
     return nodeOffset;
 }
 
+bool BVHAggregate::readCache(const std::string &filename, uint64_t key) {
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file)
+        return false;
+
+    // Validate cache file header and sizes
+    BVHCacheHeader header;
+    if (file->size() < sizeof(header)) {
+        Warning("%s: truncated BVH cache file. Rebuilding.", filename);
+        return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    size_t nodeSize = BVHCacheNodeSize(width, quantized);
+    if (std::memcmp(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic)) != 0 ||
+        header.version != bvhCacheVersion || header.key != key ||
+        header.width != width || header.nPrimitives != (int64_t)primitives.size()) {
+        Warning("%s: BVH cache file doesn't match scene. Rebuilding.", filename);
+        return false;
+    }
+    if (header.indicesOffset < (int64_t)sizeof(header) ||
+        header.nReferences < header.nPrimitives ||
+        header.nodesOffset < header.indicesOffset + header.nReferences * 4 ||
+        header.nNodes <= 0 ||
+        header.nodesOffset + header.nNodes * nodeSize > file->size()) {
+        Warning("%s: truncated BVH cache file. Rebuilding.", filename);
+        return false;
+    }
+
+    // Reorder _primitives_ using the cached primitive indices
+    const int32_t *indices = (const int32_t *)(file->data() + header.indicesOffset);
+    std::vector<Primitive> orderedPrims(header.nReferences);
+    for (size_t i = 0; i < orderedPrims.size(); ++i) {
+        if (indices[i] < 0 || indices[i] >= (int64_t)primitives.size()) {
+            Warning("%s: corrupt BVH cache file. Rebuilding.", filename);
+            return false;
+        }
+        orderedPrims[i] = primitives[indices[i]];
+    }
+    primitives.swap(orderedPrims);
+
+    // Use the mapped nodes in place if they are suitably aligned
+    char *nodeData = file->data() + header.nodesOffset;
+    bool copyNodes = false;
+    auto setNodes = [&](auto **nodesOut) {
+        using Node = std::remove_pointer_t<std::remove_reference_t<decltype(*nodesOut)>>;
+        copyNodes = ((uintptr_t)nodeData % alignof(Node)) != 0;
+        if (copyNodes) {
+            *nodesOut = allocateNodes<Node>(header.nNodes);
+            std::memcpy((void *)*nodesOut, nodeData, header.nNodes * sizeof(Node));
+        } else
+            *nodesOut = (Node *)nodeData;
+    };
+    if (width == 2)
+        setNodes(&nodes);
+    else if (width == 4 && quantized)
+        setNodes(&quantizedNodes4);
+    else if (width == 4)
+        setNodes(&nodes4);
+    else if (quantized)
+        setNodes(&quantizedNodes8);
+    else
+        setNodes(&nodes8);
+    if (!copyNodes)
+        cacheFile = file.release();
+
+    bounds = header.bounds;
+    nNodes = header.nNodes;
+    treeBytes += (copyNodes ? nNodes * nodeSize : 0) + sizeof(*this) +
+                 primitives.size() * sizeof(primitives[0]);
+    LOG_VERBOSE("Loaded %d-wide BVH with %d nodes for %d primitives from %s", width,
+                nNodes, (int)primitives.size(), filename);
+    return true;
+}
+
+void BVHAggregate::writeCache(const std::string &filename, uint64_t key,
+                              const std::vector<Primitive> &originalPrims) const {
+    // Find original index of each ordered primitive
+    std::vector<std::pair<Primitive, int32_t>> sortedPrims(originalPrims.size());
+    for (size_t i = 0; i < originalPrims.size(); ++i)
+        sortedPrims[i] = std::make_pair(originalPrims[i], int32_t(i));
+    auto primLess = [](const std::pair<Primitive, int32_t> &a,
+                       const std::pair<Primitive, int32_t> &b) {
+        return a.first < b.first;
+    };
+    std::sort(sortedPrims.begin(), sortedPrims.end(), primLess);
+    std::vector<int32_t> indices(primitives.size());
+    ParallelFor(0, primitives.size(), [&](int64_t i) {
+        auto iter = std::lower_bound(sortedPrims.begin(), sortedPrims.end(),
+                                     std::make_pair(primitives[i], int32_t(0)), primLess);
+        CHECK(iter != sortedPrims.end() && iter->first == primitives[i]);
+        indices[i] = iter->second;
+    });
+
+    // Assemble cache file contents
+    BVHCacheHeader header;
+    std::memcpy(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic));
+    header.key = key;
+    header.version = bvhCacheVersion;
+    header.width = width;
+    header.nPrimitives = originalPrims.size();
+    header.nReferences = primitives.size();
+    header.nNodes = nNodes;
+    header.indicesOffset = BVHCacheAlignOffset(sizeof(header));
+    header.nodesOffset = BVHCacheAlignOffset(header.indicesOffset + indices.size() * 4);
+    header.bounds = bounds;
+    size_t nodeSize = BVHCacheNodeSize(width, quantized);
+    std::string contents(header.nodesOffset + nNodes * nodeSize, '\0');
+    std::memcpy(&contents[0], &header, sizeof(header));
+    std::memcpy(&contents[header.indicesOffset], indices.data(), indices.size() * 4);
+    const void *nodeData = nodes;
+    if (width == 4)
+        nodeData = quantized ? (const void *)quantizedNodes4 : (const void *)nodes4;
+    else if (width == 8)
+        nodeData = quantized ? (const void *)quantizedNodes8 : (const void *)nodes8;
+    std::memcpy(&contents[header.nodesOffset], nodeData, nNodes * nodeSize);
+
+    // Write to a temporary file and rename it so that concurrent renders never
+    // see a partially-written cache file
+    uint64_t tempSuffix = MixBits(uint64_t(time(nullptr)) ^ (uintptr_t)this);
+    std::string tempFilename =
+        StringPrintf("%s.%016llx.tmp", filename, (unsigned long long)tempSuffix);
+    if (!WriteFileContents(tempFilename, contents))
+        return;
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        if (!FileExists(filename))
+            Warning("%s: %s", filename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return;
+    }
+    LOG_VERBOSE("Wrote BVH cache file %s", filename);
+}
+
 Bounds3f BVHAggregate::Bounds() const {
-    CHECK(nodes != nullptr);
-    return nodes[0].bounds;
+    return bounds;
+}
+
+// Returns the shape of a simple or geometric primitive if it has one of type _T_
+template <typename T>
+static const T *PrimitiveShape(Primitive prim) {
+    Shape shape = nullptr;
+    if (const GeometricPrimitive *gp = prim.CastOrNullptr<GeometricPrimitive>(); gp)
+        shape = gp->GetShape();
+    else if (const SimplePrimitive *sp = prim.CastOrNullptr<SimplePrimitive>(); sp)
+        shape = sp->GetShape();
+    return shape ? shape.CastOrNullptr<T>() : nullptr;
+}
+
+// Returns the triangle of a simple or geometric primitive, if it has one
+static const Triangle *PrimitiveTriangle(Primitive prim) {
+    return PrimitiveShape<Triangle>(prim);
+}
+
+std::vector<std::pair<int, int>> BVHAggregate::leafRanges() const {
+    // Return the first primitive and primitive count of each BVH leaf
+    std::vector<std::pair<int, int>> leaves;
+    auto addWideLeaves = [&](const auto *wideNodes) {
+        for (int n = 0; n < nNodes; ++n)
+            for (int i = 0; i < std::remove_pointer_t<decltype(wideNodes)>::Width; ++i)
+                if (!wideNodes[n].IsEmpty(i) && wideNodes[n].nPrimitives[i] > 0)
+                    leaves.push_back(
+                        {wideNodes[n].offset[i], wideNodes[n].nPrimitives[i]});
+    };
+    if (nodes) {
+        for (int n = 0; n < nNodes; ++n)
+            if (nodes[n].nPrimitives > 0)
+                leaves.push_back({nodes[n].primitivesOffset, nodes[n].nPrimitives});
+    } else if (nodes4)
+        addWideLeaves(nodes4);
+    else if (nodes8)
+        addWideLeaves(nodes8);
+    else if (quantizedNodes4)
+        addWideLeaves(quantizedNodes4);
+    else
+        addWideLeaves(quantizedNodes8);
+    return leaves;
+}
+
+void BVHAggregate::buildTriangleBatches() {
+    delete[] triangleBatches;
+    triangleBatches = nullptr;
+    leafTriangleBatches.clear();
+    if (maxPrimsInNode == 1 || precomputeTriangles)
+        return;
+    // Gather vertices of leaves that only hold triangles into _TriangleBatch_es
+    leafTriangleBatches.assign(primitives.size(), -1);
+    std::vector<TriangleBatch> batches;
+    for (std::pair<int, int> leaf : leafRanges()) {
+        auto [offset, nPrimitives] = leaf;
+        if (nPrimitives == 1)
+            continue;
+        bool allTriangles = true;
+        for (int i = 0; i < nPrimitives && allTriangles; ++i)
+            allTriangles = PrimitiveTriangle(primitives[offset + i]) != nullptr;
+        if (!allTriangles)
+            continue;
+        leafTriangleBatches[offset] = batches.size();
+        for (int i = 0; i < nPrimitives; ++i) {
+            if (i % TriangleBatch::Width == 0)
+                batches.push_back(TriangleBatch());
+            pstd::array<Point3f, 3> p =
+                PrimitiveTriangle(primitives[offset + i])->Vertices();
+            batches.back().Set(i % TriangleBatch::Width, p[0], p[1], p[2]);
+        }
+    }
+    if (batches.empty()) {
+        leafTriangleBatches.clear();
+        return;
+    }
+    triangleBatches = new TriangleBatch[batches.size()];
+    std::copy(batches.begin(), batches.end(), triangleBatches);
+    ++bvhsWithTriangleBatches;
+    treeBytes += batches.size() * sizeof(TriangleBatch) +
+                 leafTriangleBatches.size() * sizeof(int);
+}
+
+void BVHAggregate::buildPatchBatches() {
+    delete[] patchBatches;
+    patchBatches = nullptr;
+    leafPatchBatches.clear();
+    if (maxPrimsInNode == 1)
+        return;
+    // Gather vertices of leaves that only hold bilinear patches into batches
+    leafPatchBatches.assign(primitives.size(), -1);
+    std::vector<BilinearPatchBatch> batches;
+    for (std::pair<int, int> leaf : leafRanges()) {
+        auto [offset, nPrimitives] = leaf;
+        if (nPrimitives == 1)
+            continue;
+        bool allPatches = true;
+        for (int i = 0; i < nPrimitives && allPatches; ++i)
+            allPatches = PrimitiveShape<BilinearPatch>(primitives[offset + i]) != nullptr;
+        if (!allPatches)
+            continue;
+        leafPatchBatches[offset] = batches.size();
+        for (int i = 0; i < nPrimitives; ++i) {
+            if (i % BilinearPatchBatch::Width == 0)
+                batches.push_back(BilinearPatchBatch());
+            pstd::array<Point3f, 4> p =
+                PrimitiveShape<BilinearPatch>(primitives[offset + i])->Vertices();
+            batches.back().Set(i % BilinearPatchBatch::Width, p[0], p[1], p[2], p[3]);
+        }
+    }
+    if (batches.empty()) {
+        leafPatchBatches.clear();
+        return;
+    }
+    patchBatches = new BilinearPatchBatch[batches.size()];
+    std::copy(batches.begin(), batches.end(), patchBatches);
+    ++bvhsWithPatchBatches;
+    treeBytes += batches.size() * sizeof(BilinearPatchBatch) +
+                 leafPatchBatches.size() * sizeof(int);
+}
+
+void BVHAggregate::buildPrecomputedTriangles() {
+    delete[] precomputedTriangles;
+    precomputedTriangles = nullptr;
+    precomputedLeaves.clear();
+    if (!precomputeTriangles)
+        return;
+    // Precompute the triangles of leaves that only hold triangles
+    precomputedTriangles = new PrecomputedTriangle[primitives.size()];
+    precomputedLeaves.assign(primitives.size(), false);
+    for (std::pair<int, int> leaf : leafRanges()) {
+        auto [offset, nPrimitives] = leaf;
+        bool allTriangles = true;
+        for (int i = 0; i < nPrimitives && allTriangles; ++i)
+            allTriangles = PrimitiveTriangle(primitives[offset + i]) != nullptr;
+        if (!allTriangles)
+            continue;
+        precomputedLeaves[offset] = true;
+        for (int i = 0; i < nPrimitives; ++i) {
+            pstd::array<Point3f, 3> p =
+                PrimitiveTriangle(primitives[offset + i])->Vertices();
+            precomputedTriangles[offset + i] = PrecomputedTriangle(p[0], p[1], p[2]);
+        }
+    }
+    ++bvhsWithPrecomputedTriangles;
+    treeBytes += primitives.size() * sizeof(PrecomputedTriangle);
+}
+
+void BVHAggregate::intersectLeaf(int offset, int nPrimitives, const Ray &ray,
+                                 Float *tMax,
+                                 pstd::optional<ShapeIntersection> *si) const {
+    if (precomputedTriangles && precomputedLeaves[offset]) {
+        // Only intersect primitives that their precomputed triangles may hit
+        for (int i = 0; i < nPrimitives; ++i) {
+            if (!precomputedTriangles[offset + i].MayIntersect(ray, *tMax))
+                continue;
+            pstd::optional<ShapeIntersection> primSi =
+                primitives[offset + i].Intersect(ray, *tMax);
+            if (primSi) {
+                *si = primSi;
+                *tMax = (*si)->tHit;
+            }
+        }
+        return;
+    }
+
+    auto intersect = [&](int i) {
+        pstd::optional<ShapeIntersection> primSi =
+            primitives[offset + i].Intersect(ray, *tMax);
+        if (primSi) {
+            *si = primSi;
+            *tMax = (*si)->tHit;
+        }
+    };
+    int batch = leafTriangleBatches.empty() ? -1 : leafTriangleBatches[offset];
+    int patchBatch = leafPatchBatches.empty() ? -1 : leafPatchBatches[offset];
+    if (batch >= 0) {
+        // Only intersect primitives whose triangles pass the batched edge tests
+        for (int start = 0; start < nPrimitives;
+             start += TriangleBatch::Width, ++batch) {
+            int candidates = triangleBatches[batch].Candidates(ray);
+            while (candidates) {
+                int i = start + Log2Int(candidates & -candidates);
+                candidates &= candidates - 1;
+                intersect(i);
+            }
+        }
+    } else if (patchBatch >= 0) {
+        // Only intersect primitives whose patches pass the batched tests
+        for (int start = 0; start < nPrimitives;
+             start += BilinearPatchBatch::Width, ++patchBatch) {
+            int candidates = patchBatches[patchBatch].Candidates(ray, *tMax);
+            while (candidates) {
+                int i = start + Log2Int(candidates & -candidates);
+                candidates &= candidates - 1;
+                intersect(i);
+            }
+        }
+    } else {
+        // Intersect ray with each primitive in leaf
+        for (int i = 0; i < nPrimitives; ++i)
+            intersect(i);
+    }
+}
+
+bool BVHAggregate::intersectPLeaf(int offset, int nPrimitives, const Ray &ray,
+                                  Float tMax) const {
+    if (precomputedTriangles && precomputedLeaves[offset]) {
+        for (int i = 0; i < nPrimitives; ++i)
+            if (precomputedTriangles[offset + i].MayIntersect(ray, tMax) &&
+                primitives[offset + i].IntersectP(ray, tMax))
+                return true;
+        return false;
+    }
+
+    int batch = leafTriangleBatches.empty() ? -1 : leafTriangleBatches[offset];
+    int patchBatch = leafPatchBatches.empty() ? -1 : leafPatchBatches[offset];
+    if (batch < 0 && patchBatch < 0) {
+        for (int i = 0; i < nPrimitives; ++i)
+            if (primitives[offset + i].IntersectP(ray, tMax))
+                return true;
+        return false;
+    }
+
+    int batchWidth = batch >= 0 ? TriangleBatch::Width : BilinearPatchBatch::Width;
+    for (int start = 0; start < nPrimitives; start += batchWidth) {
+        int candidates = batch >= 0 ? triangleBatches[batch++].Candidates(ray)
+                                    : patchBatches[patchBatch++].Candidates(ray, tMax);
+        while (candidates) {
+            int i = start + Log2Int(candidates & -candidates);
+            candidates &= candidates - 1;
+            if (primitives[offset + i].IntersectP(ray, tMax))
+                return true;
+        }
+    }
+    return false;
 }
 
 pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
                                                           Float tMax) const {
+    if (nodes4)
+        return intersectWide(nodes4, ray, tMax);
+    if (nodes8)
+        return intersectWide(nodes8, ray, tMax);
+    if (quantizedNodes4)
+        return intersectWide(quantizedNodes4, ray, tMax);
+    if (quantizedNodes8)
+        return intersectWide(quantizedNodes8, ray, tMax);
     if (nodes == nullptr)
         return {};
     pstd::optional<ShapeIntersection> si;
@@ -544,7 +1846,7 @@ pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
-    int nodesVisited = 0;
+    int nodesVisited = 0, primitivesTested = 0;
     while (true) {
         ++nodesVisited;
         const LinearBVHNode *node = &nodes[currentNodeIndex];
@@ -552,15 +1854,8 @@ pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
         if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    // Check for intersection with primitive in BVH node
-                    pstd::optional<ShapeIntersection> primSi =
-                        primitives[node->primitivesOffset + i].Intersect(ray, tMax);
-                    if (primSi) {
-                        si = primSi;
-                        tMax = si->tHit;
-                    }
-                }
+                primitivesTested += node->nPrimitives;
+                intersectLeaf(node->primitivesOffset, node->nPrimitives, ray, &tMax, &si);
                 if (toVisitOffset == 0)
                     break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
@@ -583,10 +1878,19 @@ pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
     }
 
     bvhNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
     return si;
 }
 
 bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    if (nodes4)
+        return intersectPWide(nodes4, ray, tMax);
+    if (nodes8)
+        return intersectPWide(nodes8, ray, tMax);
+    if (quantizedNodes4)
+        return intersectPWide(quantizedNodes4, ray, tMax);
+    if (quantizedNodes8)
+        return intersectPWide(quantizedNodes8, ray, tMax);
     if (nodes == nullptr)
         return false;
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
@@ -594,7 +1898,7 @@ bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
                        static_cast<int>(invDir.z < 0)};
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
-    int nodesVisited = 0;
+    int nodesVisited = 0, primitivesTested = 0;
 
     while (true) {
         ++nodesVisited;
@@ -602,11 +1906,12 @@ bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
         if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i].IntersectP(ray, tMax)) {
-                        bvhNodesVisited += nodesVisited;
-                        return true;
-                    }
+                primitivesTested += node->nPrimitives;
+                if (intersectPLeaf(node->primitivesOffset, node->nPrimitives, ray,
+                                   tMax)) {
+                    bvhNodesVisited += nodesVisited;
+                    StatsReportTraversal(nodesVisited, primitivesTested);
+                    return true;
                 }
                 if (toVisitOffset == 0)
                     break;
@@ -628,9 +1933,369 @@ bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
         }
     }
     bvhNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
+    return false;
+}
+
+template <typename Node>
+pstd::optional<ShapeIntersection> BVHAggregate::intersectWide(const Node *wideNodes,
+                                                              const Ray &ray,
+                                                              Float tMax) const {
+    constexpr int N = Node::Width;
+    pstd::optional<ShapeIntersection> si;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    // Follow ray through wide BVH nodes to find primitive intersections
+    WideBVHNodeToVisit nodesToVisit[64 * (N - 1)];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = WideBVHNodeToVisit{0, 0, Float(0)};
+    int nodesVisited = 0, primitivesTested = 0;
+    while (toVisitOffset > 0) {
+        WideBVHNodeToVisit toVisit = nodesToVisit[--toVisitOffset];
+        // Skip entries that are farther than the closest intersection found
+        if (toVisit.tMin > tMax)
+            continue;
+
+        if (toVisit.nPrimitives > 0) {
+            // Intersect ray with primitives in leaf
+            primitivesTested += toVisit.nPrimitives;
+            intersectLeaf(toVisit.offset, toVisit.nPrimitives, ray, &tMax, &si);
+            continue;
+        }
+
+        ++nodesVisited;
+        const Node &node = wideNodes[toVisit.offset];
+        Float tEnter[N];
+        int hitMask = node.IntersectChildren(ray.o, invDir, dirIsNeg, tMax, tEnter);
+
+        // Sort intersected children by entry distance
+        int hits[N], nHits = 0;
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i)) || node.IsEmpty(i))
+                continue;
+            int j = nHits++;
+            for (; j > 0 && tEnter[hits[j - 1]] > tEnter[i]; --j)
+                hits[j] = hits[j - 1];
+            hits[j] = i;
+        }
+
+        // Push children far-to-near so that the nearest is visited next
+        for (int j = nHits - 1; j >= 0; --j) {
+            int c = hits[j];
+            nodesToVisit[toVisitOffset++] =
+                WideBVHNodeToVisit{node.offset[c], node.nPrimitives[c], tEnter[c]};
+        }
+    }
+
+    bvhNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
+    return si;
+}
+
+template <typename Node>
+bool BVHAggregate::intersectPWide(const Node *wideNodes, const Ray &ray,
+                                  Float tMax) const {
+    constexpr int N = Node::Width;
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
+                       static_cast<int>(invDir.z < 0)};
+    int nodesToVisit[64 * (N - 1)];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
+    int nodesVisited = 0, primitivesTested = 0;
+
+    while (toVisitOffset > 0) {
+        ++nodesVisited;
+        const Node &node = wideNodes[nodesToVisit[--toVisitOffset]];
+        Float tEnter[N];
+        int hitMask = node.IntersectChildren(ray.o, invDir, dirIsNeg, tMax, tEnter);
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i)) || node.IsEmpty(i))
+                continue;
+            if (node.nPrimitives[i] > 0) {
+                // Test leaf primitives immediately for early termination
+                primitivesTested += node.nPrimitives[i];
+                if (intersectPLeaf(node.offset[i], node.nPrimitives[i], ray, tMax)) {
+                    bvhNodesVisited += nodesVisited;
+                    StatsReportTraversal(nodesVisited, primitivesTested);
+                    return true;
+                }
+            } else
+                nodesToVisit[toVisitOffset++] = node.offset[i];
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
     return false;
 }
 
+// BVHAggregate Ray Stream Utility Functions
+template <typename F>
+static void ForEachRayInMask(uint64_t mask, F func) {
+    while (mask) {
+        func(Log2Int(mask & (~mask + 1)));
+        mask &= mask - 1;
+    }
+}
+
+// BVHStreamRay Definition
+struct BVHStreamRay {
+    Vector3f invDir;
+    int dirIsNeg[3];
+};
+
+void BVHAggregate::IntersectStream(pstd::span<const Ray> rays,
+                                   pstd::span<const Float> tMax,
+                                   pstd::span<pstd::optional<ShapeIntersection>> si) const {
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), si.size());
+    for (size_t start = 0; start < rays.size(); start += MaxStreamRays) {
+        size_t n = std::min<size_t>(MaxStreamRays, rays.size() - start);
+        pstd::span<const Ray> batchRays = rays.subspan(start, n);
+        pstd::span<const Float> batchTMax = tMax.subspan(start, n);
+        pstd::span<pstd::optional<ShapeIntersection>> batchSi = si.subspan(start, n);
+        if (nodes4)
+            intersectStreamBatchWide<false>(nodes4, batchRays, batchTMax, batchSi);
+        else if (nodes8)
+            intersectStreamBatchWide<false>(nodes8, batchRays, batchTMax, batchSi);
+        else if (quantizedNodes4)
+            intersectStreamBatchWide<false>(quantizedNodes4, batchRays, batchTMax,
+                                            batchSi);
+        else if (quantizedNodes8)
+            intersectStreamBatchWide<false>(quantizedNodes8, batchRays, batchTMax,
+                                            batchSi);
+        else
+            intersectStreamBatch<false>(batchRays, batchTMax, batchSi);
+    }
+}
+
+void BVHAggregate::IntersectPStream(pstd::span<const Ray> rays,
+                                    pstd::span<const Float> tMax,
+                                    pstd::span<bool> hit) const {
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), hit.size());
+    for (size_t start = 0; start < rays.size(); start += MaxStreamRays) {
+        size_t n = std::min<size_t>(MaxStreamRays, rays.size() - start);
+        pstd::span<const Ray> batchRays = rays.subspan(start, n);
+        pstd::span<const Float> batchTMax = tMax.subspan(start, n);
+        pstd::span<bool> batchHit = hit.subspan(start, n);
+        if (nodes4)
+            intersectStreamBatchWide<true>(nodes4, batchRays, batchTMax, batchHit);
+        else if (nodes8)
+            intersectStreamBatchWide<true>(nodes8, batchRays, batchTMax, batchHit);
+        else if (quantizedNodes4)
+            intersectStreamBatchWide<true>(quantizedNodes4, batchRays, batchTMax,
+                                           batchHit);
+        else if (quantizedNodes8)
+            intersectStreamBatchWide<true>(quantizedNodes8, batchRays, batchTMax,
+                                           batchHit);
+        else
+            intersectStreamBatch<true>(batchRays, batchTMax, batchHit);
+    }
+}
+
+template <bool ShadowRays, typename Result>
+void BVHAggregate::intersectStreamBatch(pstd::span<const Ray> rays,
+                                        pstd::span<const Float> tMaxIn,
+                                        pstd::span<Result> result) const {
+    int nRays = rays.size();
+    DCHECK_LE(nRays, MaxStreamRays);
+    // Initialize per-ray traversal state for ray batch
+    BVHStreamRay streamRays[MaxStreamRays];
+    Float tMax[MaxStreamRays];
+    for (int i = 0; i < nRays; ++i) {
+        const Vector3f &d = rays[i].d;
+        streamRays[i].invDir = Vector3f(1 / d.x, 1 / d.y, 1 / d.z);
+        for (int c = 0; c < 3; ++c)
+            streamRays[i].dirIsNeg[c] = int(streamRays[i].invDir[c] < 0);
+        tMax[i] = tMaxIn[i];
+        result[i] = Result{};
+    }
+    if (nodes == nullptr)
+        return;
+
+    // Follow ray batch through BVH nodes, tracking active rays with a bit mask
+    struct NodeToVisit {
+        int nodeIndex;
+        uint64_t activeRays;
+    };
+    NodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] =
+        NodeToVisit{0, nRays == 64 ? ~uint64_t(0) : ((uint64_t(1) << nRays) - 1)};
+    int nodesVisited = 0;
+    int64_t primitivesTested = 0;
+    while (toVisitOffset > 0) {
+        NodeToVisit toVisit = nodesToVisit[--toVisitOffset];
+        ++nodesVisited;
+        const LinearBVHNode *node = &nodes[toVisit.nodeIndex];
+        // Find rays in the batch that intersect the node's bounds
+        uint64_t hitRays = 0;
+        ForEachRayInMask(toVisit.activeRays, [&](int i) {
+            if (node->bounds.IntersectP(rays[i].o, rays[i].d, tMax[i],
+                                        streamRays[i].invDir, streamRays[i].dirIsNeg))
+                hitRays |= uint64_t(1) << i;
+        });
+        if (!hitRays)
+            continue;
+
+        if (node->nPrimitives > 0) {
+            // Intersect active rays with primitives in leaf BVH node
+            primitivesTested += int64_t(node->nPrimitives) * PopCount(hitRays);
+            for (int p = 0; p < node->nPrimitives; ++p) {
+                const Primitive &prim = primitives[node->primitivesOffset + p];
+                ForEachRayInMask(hitRays, [&](int i) {
+                    if constexpr (ShadowRays) {
+                        if (prim.IntersectP(rays[i], tMax[i])) {
+                            result[i] = true;
+                            hitRays &= ~(uint64_t(1) << i);
+                        }
+                    } else {
+                        pstd::optional<ShapeIntersection> si =
+                            prim.Intersect(rays[i], tMax[i]);
+                        if (si) {
+                            tMax[i] = si->tHit;
+                            result[i] = si;
+                        }
+                    }
+                });
+            }
+            if constexpr (ShadowRays) {
+                // Retire occluded rays from all pending nodes
+                uint64_t occluded = 0;
+                for (int i = 0; i < nRays; ++i)
+                    if (result[i])
+                        occluded |= uint64_t(1) << i;
+                for (int j = 0; j < toVisitOffset; ++j)
+                    nodesToVisit[j].activeRays &= ~occluded;
+            }
+        } else {
+            // Order children using the direction of the first active ray
+            int leader = Log2Int(hitRays & (~hitRays + 1));
+            if (streamRays[leader].dirIsNeg[node->axis]) {
+                nodesToVisit[toVisitOffset++] = NodeToVisit{toVisit.nodeIndex + 1, hitRays};
+                nodesToVisit[toVisitOffset++] =
+                    NodeToVisit{node->secondChildOffset, hitRays};
+            } else {
+                nodesToVisit[toVisitOffset++] =
+                    NodeToVisit{node->secondChildOffset, hitRays};
+                nodesToVisit[toVisitOffset++] = NodeToVisit{toVisit.nodeIndex + 1, hitRays};
+            }
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
+}
+
+template <bool ShadowRays, typename Node, typename Result>
+void BVHAggregate::intersectStreamBatchWide(const Node *wideNodes,
+                                            pstd::span<const Ray> rays,
+                                            pstd::span<const Float> tMaxIn,
+                                            pstd::span<Result> result) const {
+    constexpr int N = Node::Width;
+    int nRays = rays.size();
+    DCHECK_LE(nRays, MaxStreamRays);
+    // Initialize per-ray traversal state for ray batch
+    BVHStreamRay streamRays[MaxStreamRays];
+    Float tMax[MaxStreamRays];
+    for (int i = 0; i < nRays; ++i) {
+        const Vector3f &d = rays[i].d;
+        streamRays[i].invDir = Vector3f(1 / d.x, 1 / d.y, 1 / d.z);
+        for (int c = 0; c < 3; ++c)
+            streamRays[i].dirIsNeg[c] = int(streamRays[i].invDir[c] < 0);
+        tMax[i] = tMaxIn[i];
+        result[i] = Result{};
+    }
+
+    // Follow ray batch through wide BVH nodes
+    struct NodeToVisit {
+        int nodeIndex;
+        uint64_t activeRays;
+    };
+    NodeToVisit nodesToVisit[64 * (N - 1)];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] =
+        NodeToVisit{0, nRays == 64 ? ~uint64_t(0) : ((uint64_t(1) << nRays) - 1)};
+    int nodesVisited = 0;
+    int64_t primitivesTested = 0;
+    while (toVisitOffset > 0) {
+        NodeToVisit toVisit = nodesToVisit[--toVisitOffset];
+        if (!toVisit.activeRays)
+            continue;
+        ++nodesVisited;
+        const Node &node = wideNodes[toVisit.nodeIndex];
+
+        // Test active rays against all children, accumulating per-child ray masks
+        uint64_t childRays[N] = {};
+        Float leaderTEnter[N];
+        int leader = -1;
+        ForEachRayInMask(toVisit.activeRays, [&](int i) {
+            Float tEnter[N];
+            int hitMask = node.IntersectChildren(rays[i].o, streamRays[i].invDir,
+                                                 streamRays[i].dirIsNeg, tMax[i], tEnter);
+            for (int c = 0; c < N; ++c)
+                if (hitMask & (1 << c))
+                    childRays[c] |= uint64_t(1) << i;
+            if (leader == -1 && hitMask) {
+                leader = i;
+                for (int c = 0; c < N; ++c)
+                    leaderTEnter[c] = (hitMask & (1 << c)) ? tEnter[c] : Infinity;
+            }
+        });
+        if (leader == -1)
+            continue;
+
+        // Sort children by entry distance of the first intersecting ray
+        int order[N], nOrder = 0;
+        for (int c = 0; c < N; ++c) {
+            if (!childRays[c] || node.IsEmpty(c))
+                continue;
+            int j = nOrder++;
+            for (; j > 0 && leaderTEnter[order[j - 1]] > leaderTEnter[c]; --j)
+                order[j] = order[j - 1];
+            order[j] = c;
+        }
+
+        // Intersect leaf children and push interior children far-to-near
+        for (int j = nOrder - 1; j >= 0; --j) {
+            int c = order[j];
+            if (node.nPrimitives[c] == 0) {
+                nodesToVisit[toVisitOffset++] = NodeToVisit{node.offset[c], childRays[c]};
+                continue;
+            }
+            uint64_t occluded = 0;
+            primitivesTested += int64_t(node.nPrimitives[c]) * PopCount(childRays[c]);
+            for (int p = 0; p < node.nPrimitives[c]; ++p) {
+                const Primitive &prim = primitives[node.offset[c] + p];
+                ForEachRayInMask(childRays[c] & ~occluded, [&](int i) {
+                    if constexpr (ShadowRays) {
+                        if (!result[i] && prim.IntersectP(rays[i], tMax[i])) {
+                            result[i] = true;
+                            occluded |= uint64_t(1) << i;
+                        }
+                    } else {
+                        pstd::optional<ShapeIntersection> si =
+                            prim.Intersect(rays[i], tMax[i]);
+                        if (si) {
+                            tMax[i] = si->tHit;
+                            result[i] = si;
+                        }
+                    }
+                });
+            }
+            if (occluded) {
+                // Retire occluded rays from all pending nodes
+                for (int k = 0; k < toVisitOffset; ++k)
+                    nodesToVisit[k].activeRays &= ~occluded;
+                for (int k = 0; k < N; ++k)
+                    childRays[k] &= ~occluded;
+            }
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
+}
+
 BVHBuildNode *BVHAggregate::buildUpperSAH(Allocator alloc,
                                           std::vector<BVHBuildNode *> &treeletRoots,
                                           int start, int end,
@@ -742,13 +2407,102 @@ BVHAggregate *BVHAggregate::Create(std::vector<Primitive> prims,
         splitMethod = BVHAggregate::SplitMethod::Middle;
     else if (splitMethodName == "equal")
         splitMethod = BVHAggregate::SplitMethod::EqualCounts;
+    else if (splitMethodName == "sbvh")
+        splitMethod = BVHAggregate::SplitMethod::SBVH;
     else {
         Warning(R"(BVH split method "%s" unknown.  Using "sah".)", splitMethodName);
         splitMethod = BVHAggregate::SplitMethod::SAH;
     }
 
     int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
-    return new BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod);
+    int width = parameters.GetOneInt("width", 2);
+    if (width != 2 && width != 4 && width != 8) {
+        Warning(R"(BVH width %d unsupported; must be 2, 4, or 8.  Using 2.)", width);
+        width = 2;
+    }
+    bool quantized = parameters.GetOneBool("quantized", false);
+    if (quantized && width == 2) {
+        Warning("Quantized BVH nodes require a wide BVH. Using \"width\" 4.");
+        width = 4;
+    }
+    Float splitAlpha = parameters.GetOneFloat("splitalpha", 1e-5f);
+    Float maxDuplication = parameters.GetOneFloat("maxduplication", 1.f);
+    bool precomputeTriangles = parameters.GetOneBool("precomputetriangles", false);
+    return new BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod, width,
+                            quantized, splitAlpha, maxDuplication, precomputeTriangles);
+}
+
+int64_t BVHAggregate::EstimateBytes(int64_t nPrimitives,
+                                    const ParameterDictionary &parameters) {
+    int maxPrimsInNode = std::min(255, parameters.GetOneInt("maxnodeprims", 4));
+    int width = parameters.GetOneInt("width", 2);
+    if (width != 2 && width != 4 && width != 8)
+        width = 2;
+    bool quantized = parameters.GetOneBool("quantized", false);
+    if (quantized && width == 2)
+        width = 4;
+    // Assume that spatial splits create as many references as they may
+    int64_t nReferences = nPrimitives;
+    if (parameters.GetOneString("splitmethod", "sah") == "sbvh")
+        nReferences += nPrimitives * parameters.GetOneFloat("maxduplication", 1.f);
+
+    // Assume that leaves are half full on average; a binary tree has one fewer
+    // interior node than leaves and wide nodes have up to _width_ children.
+    int64_t nLeaves = std::max<int64_t>(1, nReferences / std::max(1, maxPrimsInNode / 2));
+    int64_t nNodes = (width == 2) ? 2 * nLeaves - 1 : (nLeaves + width - 2) / (width - 1);
+    return nNodes * BVHCacheNodeSize(width, quantized) + nReferences * sizeof(Primitive);
+}
+
+STAT_PERCENT("BVH/Lazy instance BVHs built", lazyBVHBuilds, lazyBVHs);
+
+// LazyBVHAggregate Method Definitions
+LazyBVHAggregate::LazyBVHAggregate(std::vector<Primitive> prims)
+    : primitives(std::move(prims)) {
+    CHECK(!primitives.empty());
+    for (Primitive prim : primitives)
+        bounds = Union(bounds, prim.Bounds());
+    ++lazyBVHs;
+}
+
+const BVHAggregate *LazyBVHAggregate::getBVH() const {
+    if (BVHAggregate *b = bvh.load(std::memory_order_acquire); b)
+        return b;
+    // Build the BVH if no other thread has started to
+    if (buildClaimed.exchange(true, std::memory_order_relaxed))
+        return nullptr;
+    // Other threads may be reading _primitives_, so the BVH is given a copy
+    BVHAggregate *b = new BVHAggregate(primitives);
+    bvh.store(b, std::memory_order_release);
+    ++lazyBVHBuilds;
+    return b;
+}
+
+pstd::optional<ShapeIntersection> LazyBVHAggregate::Intersect(const Ray &ray,
+                                                              Float tMax) const {
+    if (!bounds.IntersectP(ray.o, ray.d, tMax))
+        return {};
+    if (const BVHAggregate *b = getBVH(); b)
+        return b->Intersect(ray, tMax);
+    // Test the primitives directly while the BVH is being built
+    pstd::optional<ShapeIntersection> si;
+    for (Primitive prim : primitives)
+        if (pstd::optional<ShapeIntersection> primSi = prim.Intersect(ray, tMax);
+            primSi) {
+            si = primSi;
+            tMax = si->tHit;
+        }
+    return si;
+}
+
+bool LazyBVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    if (!bounds.IntersectP(ray.o, ray.d, tMax))
+        return false;
+    if (const BVHAggregate *b = getBVH(); b)
+        return b->IntersectP(ray, tMax);
+    for (Primitive prim : primitives)
+        if (prim.IntersectP(ray, tMax))
+            return true;
+    return false;
 }
 
 // KdNodeToVisit Definition
@@ -758,9 +2512,21 @@ struct KdNodeToVisit {
 };
 
 // KdTreeNode Definition
+// Leaf nodes store their first primitive index in the node itself; any others
+// are packed two to a slot in the entries that immediately follow the leaf,
+// so that small leaves share a cache line with their primitive indices.
 struct alignas(8) KdTreeNode {
     // KdTreeNode Methods
-    void InitLeaf(int *primNums, int np, std::vector<int> *primitiveIndices);
+    void InitLeaf(int np, int firstPrimitive) {
+        flags = 3;
+        nPrims |= (np << 2);
+        onePrimitive = firstPrimitive;
+    }
+
+    void InitPrimitiveSlot(int p0, int p1) {
+        onePrimitive = p0;
+        secondPrimitive = p1;
+    }
 
     void InitInterior(int axis, int ac, Float s) {
         split = s;
@@ -773,21 +2539,58 @@ struct alignas(8) KdTreeNode {
     int SplitAxis() const { return flags & 3; }
     bool IsLeaf() const { return (flags & 3) == 3; }
     int AboveChild() const { return aboveChild >> 2; }
+    void OffsetAboveChild(int offset) { aboveChild += offset << 2; }
+
+    static int nPrimitiveSlots(int np) { return np / 2; }
+    int LeafPrimitive(int i) const {
+        if (i == 0)
+            return onePrimitive;
+        const KdTreeNode &slot = this[1 + (i - 1) / 2];
+        return (i & 1) ? slot.onePrimitive : slot.secondPrimitive;
+    }
 
     union {
-        Float split;                 // Interior
-        int onePrimitive;            // Leaf
-        int primitiveIndicesOffset;  // Leaf
+        Float split;       // Interior
+        int onePrimitive;  // Leaf and primitive slot
     };
 
   private:
     union {
-        int flags;       // Both
-        int nPrims;      // Leaf
-        int aboveChild;  // Interior
+        int flags;            // Both
+        int nPrims;           // Leaf
+        int aboveChild;       // Interior
+        int secondPrimitive;  // Primitive slot
     };
 };
 
+// Appends a leaf for the given primitives and its primitive slots to _nodes_
+static void AddKdTreeLeaf(std::vector<KdTreeNode> *nodes, const int *primNums, int np) {
+    KdTreeNode leaf;
+    leaf.InitLeaf(np, np > 0 ? primNums[0] : 0);
+    nodes->push_back(leaf);
+    for (int i = 1; i < np; i += 2) {
+        KdTreeNode slot;
+        slot.InitPrimitiveSlot(primNums[i], i + 1 < np ? primNums[i + 1] : -1);
+        nodes->push_back(slot);
+    }
+}
+
+// Appends a separately built subtree to _nodes_, relocating its child offsets
+static void AppendKdSubtree(std::vector<KdTreeNode> *nodes,
+                            const std::vector<KdTreeNode> &subtree) {
+    int offset = nodes->size();
+    nodes->insert(nodes->end(), subtree.begin(), subtree.end());
+    for (size_t i = offset; i < nodes->size();) {
+        KdTreeNode &node = (*nodes)[i];
+        if (node.IsLeaf())
+            i += 1 + KdTreeNode::nPrimitiveSlots(node.nPrimitives());
+        else {
+            node.OffsetAboveChild(offset);
+            ++i;
+        }
+    }
+}
+
 // EdgeType Definition
 enum class EdgeType { Start, End };
 
@@ -806,6 +2609,11 @@ struct BoundEdge {
 };
 
 STAT_PIXEL_COUNTER("Kd-Tree/Nodes visited", kdNodesVisited);
+STAT_MEMORY_COUNTER("Memory/Kd-tree", kdTreeBytes);
+STAT_INT_DISTRIBUTION("Kd-Tree/Build time (ms)", kdBuildTimeMS);
+
+// Subtrees with at least this many primitives have their children built in parallel
+static constexpr int kdParallelBuildMinPrimitives = 16384;
 
 // KdTreeAggregate Method Definitions
 KdTreeAggregate::KdTreeAggregate(std::vector<Primitive> p, int isectCost,
@@ -817,74 +2625,63 @@ KdTreeAggregate::KdTreeAggregate(std::vector<Primitive> p, int isectCost,
       emptyBonus(emptyBonus),
       primitives(std::move(p)) {
     // Build kd-tree for accelerator
-    nextFreeNode = nAllocedNodes = 0;
+    Timer buildTimer;
     if (maxDepth <= 0)
         maxDepth = std::round(8 + 1.3f * Log2Int(int64_t(primitives.size())));
     // Compute bounds for kd-tree construction
-    std::vector<Bounds3f> primBounds;
-    primBounds.reserve(primitives.size());
-    for (Primitive &prim : primitives) {
-        Bounds3f b = prim.Bounds();
+    std::vector<Bounds3f> primBounds(primitives.size());
+    ParallelFor(0, primitives.size(),
+                [&](int64_t i) { primBounds[i] = primitives[i].Bounds(); });
+    for (const Bounds3f &b : primBounds)
         bounds = Union(bounds, b);
-        primBounds.push_back(b);
-    }
-
-    // Allocate working memory for kd-tree construction
-    std::unique_ptr<BoundEdge[]> edges[3];
-    for (int i = 0; i < 3; ++i)
-        edges[i] = std::make_unique<BoundEdge[]>(2 * primitives.size());
-
-    std::unique_ptr<int[]> prims0 = std::make_unique<int[]>(primitives.size());
-    std::unique_ptr<int[]> prims1 =
-        std::make_unique<int[]>((maxDepth + 1) * primitives.size());
 
     // Initialize _primNums_ for kd-tree construction
-    std::unique_ptr<int[]> primNums = std::make_unique<int[]>(primitives.size());
+    std::vector<int> primNums(primitives.size());
     for (size_t i = 0; i < primitives.size(); ++i)
         primNums[i] = i;
 
     // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums.get(), primitives.size(), maxDepth, edges,
-              prims0.get(), prims1.get(), 0);
+    std::vector<KdTreeNode> buildNodes =
+        buildSubtree(bounds, primBounds, primNums, maxDepth, 0);
+    nNodes = buildNodes.size();
+    nodes = new KdTreeNode[nNodes];
+    std::copy(buildNodes.begin(), buildNodes.end(), nodes);
+
+    kdTreeBytes += nNodes * sizeof(KdTreeNode) + sizeof(*this) +
+                   primitives.size() * sizeof(primitives[0]);
+    int64_t buildMS = int64_t(1000 * buildTimer.ElapsedSeconds());
+    kdBuildTimeMS << buildMS;
+    LOG_VERBOSE("Kd-tree build for %d primitives took %d ms (%d nodes)",
+                (int)primitives.size(), buildMS, nNodes);
 }
 
-void KdTreeNode::InitLeaf(int *primNums, int np, std::vector<int> *primitiveIndices) {
-    flags = 3;
-    nPrims |= (np << 2);
-    // Store primitive ids for leaf node
-    if (np == 0)
-        onePrimitive = 0;
-    else if (np == 1)
-        onePrimitive = primNums[0];
-    else {
-        primitiveIndicesOffset = primitiveIndices->size();
-        for (int i = 0; i < np; ++i)
-            primitiveIndices->push_back(primNums[i]);
-    }
+std::vector<KdTreeNode> KdTreeAggregate::buildSubtree(
+    const Bounds3f &nodeBounds, const std::vector<Bounds3f> &allPrimBounds,
+    const std::vector<int> &primNums, int depth, int badRefines) const {
+    // Allocate working memory for kd-tree construction of subtree
+    size_t nPrimitives = primNums.size();
+    std::unique_ptr<BoundEdge[]> edges[3];
+    for (int i = 0; i < 3; ++i)
+        edges[i] = std::make_unique<BoundEdge[]>(2 * nPrimitives);
+    std::unique_ptr<int[]> prims0 = std::make_unique<int[]>(nPrimitives);
+    std::unique_ptr<int[]> prims1 = std::make_unique<int[]>((depth + 1) * nPrimitives);
+
+    std::vector<KdTreeNode> subtreeNodes;
+    subtreeNodes.reserve(2 * nPrimitives + 1);
+    buildTree(&subtreeNodes, nodeBounds, allPrimBounds, primNums.data(), nPrimitives,
+              depth, edges, prims0.get(), prims1.get(), badRefines);
+    return subtreeNodes;
 }
 
-void KdTreeAggregate::buildTree(int nodeNum, const Bounds3f &nodeBounds,
-                                const std::vector<Bounds3f> &allPrimBounds, int *primNums,
-                                int nPrimitives, int depth,
+void KdTreeAggregate::buildTree(std::vector<KdTreeNode> *buildNodes,
+                                const Bounds3f &nodeBounds,
+                                const std::vector<Bounds3f> &allPrimBounds,
+                                const int *primNums, int nPrimitives, int depth,
                                 const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
-                                int *prims1, int badRefines) {
-    CHECK_EQ(nodeNum, nextFreeNode);
-    // Get next free node from _nodes_ array
-    if (nextFreeNode == nAllocedNodes) {
-        int nNewAllocNodes = std::max(2 * nAllocedNodes, 512);
-        KdTreeNode *n = new KdTreeNode[nNewAllocNodes];
-        if (nAllocedNodes > 0) {
-            memcpy(n, nodes, nAllocedNodes * sizeof(KdTreeNode));
-            delete[] nodes;
-        }
-        nodes = n;
-        nAllocedNodes = nNewAllocNodes;
-    }
-    ++nextFreeNode;
-
+                                int *prims1, int badRefines) const {
     // Initialize leaf node if termination criteria met
     if (nPrimitives <= maxPrims || depth == 0) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
+        AddKdTreeLeaf(buildNodes, primNums, nPrimitives);
         return;
     }
 
@@ -958,7 +2755,7 @@ retrySplit:
         ++badRefines;
     if ((bestCost > 4 * leafCost && nPrimitives < 16) || bestAxis == -1 ||
         badRefines == 3) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
+        AddKdTreeLeaf(buildNodes, primNums, nPrimitives);
         return;
     }
 
@@ -975,12 +2772,30 @@ retrySplit:
     Float tSplit = edges[bestAxis][bestOffset].t;
     Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
     bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = tSplit;
-    buildTree(nodeNum + 1, bounds0, allPrimBounds, prims0, n0, depth - 1, edges, prims0,
-              prims1 + nPrimitives, badRefines);
-    int aboveChild = nextFreeNode;
-    nodes[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
-    buildTree(aboveChild, bounds1, allPrimBounds, prims1, n1, depth - 1, edges, prims0,
-              prims1 + nPrimitives, badRefines);
+    int nodeNum = buildNodes->size();
+    buildNodes->push_back(KdTreeNode());
+    if (nPrimitives < kdParallelBuildMinPrimitives) {
+        buildTree(buildNodes, bounds0, allPrimBounds, prims0, n0, depth - 1, edges,
+                  prims0, prims1 + nPrimitives, badRefines);
+        int aboveChild = buildNodes->size();
+        (*buildNodes)[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
+        buildTree(buildNodes, bounds1, allPrimBounds, prims1, n1, depth - 1, edges,
+                  prims0, prims1 + nPrimitives, badRefines);
+    } else {
+        // Build children in parallel, each with its own nodes and working memory
+        std::vector<int> childPrimNums[2] = {std::vector<int>(prims0, prims0 + n0),
+                                             std::vector<int>(prims1, prims1 + n1)};
+        std::vector<KdTreeNode> childNodes[2];
+        ParallelFor(0, 2, [&](int64_t child) {
+            childNodes[child] =
+                buildSubtree(child == 0 ? bounds0 : bounds1, allPrimBounds,
+                             childPrimNums[child], depth - 1, badRefines);
+        });
+        AppendKdSubtree(buildNodes, childNodes[0]);
+        int aboveChild = buildNodes->size();
+        (*buildNodes)[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
+        AppendKdSubtree(buildNodes, childNodes[1]);
+    }
 }
 
 pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
@@ -995,7 +2810,7 @@ pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
     constexpr int maxToVisit = 64;
     KdNodeToVisit toVisit[maxToVisit];
     int toVisitIndex = 0;
-    int nodesVisited = 0;
+    int nodesVisited = 0, primitivesTested = 0;
 
     // Traverse kd-tree nodes in order for ray
     pstd::optional<ShapeIntersection> si;
@@ -1043,26 +2858,15 @@ pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
         } else {
             // Check for intersections inside leaf node
             int nPrimitives = node->nPrimitives();
-            if (nPrimitives == 1) {
-                const Primitive &p = primitives[node->onePrimitive];
+            primitivesTested += nPrimitives;
+            for (int i = 0; i < nPrimitives; ++i) {
+                const Primitive &p = primitives[node->LeafPrimitive(i)];
                 // Check one primitive inside leaf node
                 pstd::optional<ShapeIntersection> primSi = p.Intersect(ray, rayTMax);
                 if (primSi) {
                     si = primSi;
                     rayTMax = si->tHit;
                 }
-
-            } else {
-                for (int i = 0; i < nPrimitives; ++i) {
-                    int index = primitiveIndices[node->primitiveIndicesOffset + i];
-                    const Primitive &p = primitives[index];
-                    // Check one primitive inside leaf node
-                    pstd::optional<ShapeIntersection> primSi = p.Intersect(ray, rayTMax);
-                    if (primSi) {
-                        si = primSi;
-                        rayTMax = si->tHit;
-                    }
-                }
             }
 
             // Grab next node to visit from todo list
@@ -1076,6 +2880,7 @@ pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
         }
     }
     kdNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
     return si;
 }
 
@@ -1090,29 +2895,21 @@ bool KdTreeAggregate::IntersectP(const Ray &ray, Float raytMax) const {
     constexpr int maxTodo = 64;
     KdNodeToVisit toVisit[maxTodo];
     int toVisitIndex = 0;
-    int nodesVisited = 0;
+    int nodesVisited = 0, primitivesTested = 0;
     const KdTreeNode *node = &nodes[0];
     while (node != nullptr) {
         ++nodesVisited;
         if (node->IsLeaf()) {
             // Check for shadow ray intersections inside leaf node
             int nPrimitives = node->nPrimitives();
-            if (nPrimitives == 1) {
-                const Primitive &p = primitives[node->onePrimitive];
-                if (p.IntersectP(ray, raytMax)) {
+            primitivesTested += nPrimitives;
+            for (int i = 0; i < nPrimitives; ++i) {
+                const Primitive &prim = primitives[node->LeafPrimitive(i)];
+                if (prim.IntersectP(ray, raytMax)) {
                     kdNodesVisited += nodesVisited;
+                    StatsReportTraversal(nodesVisited, primitivesTested);
                     return true;
                 }
-            } else {
-                for (int i = 0; i < nPrimitives; ++i) {
-                    int primitiveIndex =
-                        primitiveIndices[node->primitiveIndicesOffset + i];
-                    const Primitive &prim = primitives[primitiveIndex];
-                    if (prim.IntersectP(ray, raytMax)) {
-                        kdNodesVisited += nodesVisited;
-                        return true;
-                    }
-                }
             }
 
             // Grab next node to process from todo list
@@ -1159,6 +2956,7 @@ bool KdTreeAggregate::IntersectP(const Ray &ray, Float raytMax) const {
         }
     }
     kdNodesVisited += nodesVisited;
+    StatsReportTraversal(nodesVisited, primitivesTested);
     return false;
 }
 
@@ -11,6 +11,7 @@
 
 #include <atomic>
 #include <memory>
+#include <utility>
 #include <vector>
 
 namespace pbrt {
@@ -18,35 +19,72 @@ namespace pbrt {
 Primitive CreateAccelerator(const std::string &name, std::vector<Primitive> prims,
                             const ParameterDictionary &parameters);
 
+class MappedFile;
 struct BVHBuildNode;
 struct BVHPrimitive;
 struct LinearBVHNode;
 struct MortonPrimitive;
+struct SBVHBuildState;
+struct TriangleBatch;
+struct BilinearPatchBatch;
+struct PrecomputedTriangle;
+template <int N>
+struct WideBVHNode;
+template <int N>
+struct QuantizedWideBVHNode;
 
 // BVHAggregate Definition
 class BVHAggregate {
   public:
     // BVHAggregate Public Types
-    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts };
+    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH };
 
     // BVHAggregate Public Methods
     BVHAggregate(std::vector<Primitive> p, int maxPrimsInNode = 1,
-                 SplitMethod splitMethod = SplitMethod::SAH);
+                 SplitMethod splitMethod = SplitMethod::SAH, int width = 2,
+                 bool quantized = false, Float splitAlpha = 1e-5f,
+                 Float maxDuplication = 1, bool precomputeTriangles = false);
 
     static BVHAggregate *Create(std::vector<Primitive> prims,
                                 const ParameterDictionary &parameters);
+    // Returns a rough estimate of the memory used by the nodes and primitive
+    // references of a BVH built over _nPrimitives_ with the given parameters.
+    static int64_t EstimateBytes(int64_t nPrimitives,
+                                 const ParameterDictionary &parameters);
 
     Bounds3f Bounds() const;
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
     bool IntersectP(const Ray &ray, Float tMax) const;
 
+    // Ray streams are traversed together in batches of up to _MaxStreamRays_
+    static constexpr int MaxStreamRays = 64;
+    void IntersectStream(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                         pstd::span<pstd::optional<ShapeIntersection>> si) const;
+    void IntersectPStream(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                          pstd::span<bool> hit) const;
+
+    // Refit() recomputes node bounds bottom-up after primitives have moved,
+    // keeping the tree topology. Update() refits and then rebuilds the BVH
+    // if its SAH cost has grown by more than _maxCostRatio_ relative to the
+    // last build. Neither may run concurrently with traversal.
+    void Refit();
+    void Update(Float maxCostRatio = 2);
+
   private:
     // BVHAggregate Private Methods
+    void build(bool useCache);
+    void releaseNodes();
+    Float sahCost() const;
     BVHBuildNode *buildRecursive(std::vector<Allocator> &threadAllocators,
                                  std::vector<BVHPrimitive> &primitiveInfo, int start,
                                  int end, std::atomic<int> *totalNodes,
                                  std::atomic<int> *orderedPrimsOffset,
                                  std::vector<Primitive> &orderedPrims);
+    BVHBuildNode *buildSBVH(std::vector<Allocator> &threadAllocators,
+                            std::vector<BVHPrimitive> &references, int depth,
+                            SBVHBuildState *state, std::atomic<int> *totalNodes,
+                            std::atomic<int> *orderedPrimsOffset,
+                            std::vector<Primitive> &orderedPrims);
     BVHBuildNode *buildHLBVH(Allocator alloc,
                              const std::vector<BVHPrimitive> &primitiveInfo,
                              std::atomic<int> *totalNodes,
@@ -61,11 +99,95 @@ class BVHAggregate {
                                 int end, std::atomic<int> *totalNodes) const;
     int flattenBVHTree(BVHBuildNode *node, int *offset);
 
+    bool readCache(const std::string &filename, uint64_t key);
+    void writeCache(const std::string &filename, uint64_t key,
+                    const std::vector<Primitive> &originalPrims) const;
+
+    std::vector<std::pair<int, int>> leafRanges() const;
+    void buildTriangleBatches();
+    void buildPatchBatches();
+    void buildPrecomputedTriangles();
+    void interleaveNodes();
+    void intersectLeaf(int offset, int nPrimitives, const Ray &ray, Float *tMax,
+                       pstd::optional<ShapeIntersection> *si) const;
+    bool intersectPLeaf(int offset, int nPrimitives, const Ray &ray, Float tMax) const;
+
+    template <typename Node>
+    pstd::optional<ShapeIntersection> intersectWide(const Node *wideNodes,
+                                                    const Ray &ray, Float tMax) const;
+    template <typename Node>
+    bool intersectPWide(const Node *wideNodes, const Ray &ray, Float tMax) const;
+
+    template <bool ShadowRays, typename Result>
+    void intersectStreamBatch(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                              pstd::span<Result> result) const;
+    template <bool ShadowRays, typename Node, typename Result>
+    void intersectStreamBatchWide(const Node *wideNodes,
+                                  pstd::span<const Ray> rays,
+                                  pstd::span<const Float> tMax,
+                                  pstd::span<Result> result) const;
+
     // BVHAggregate Private Members
     int maxPrimsInNode;
     std::vector<Primitive> primitives;
     SplitMethod splitMethod;
+    int width;
+    // Wide nodes store child bounds quantized to 8 bits if _quantized_ is set
+    bool quantized;
+    // Spatial splits are only tried when the best object split's children
+    // overlap by more than _splitAlpha_ times the root's surface area.
+    // _maxDuplication_ caps the extra primitive references they may create,
+    // as a fraction of the number of primitives.
+    Float splitAlpha, maxDuplication;
+    Bounds3f bounds;
     LinearBVHNode *nodes = nullptr;
+    WideBVHNode<4> *nodes4 = nullptr;
+    WideBVHNode<8> *nodes8 = nullptr;
+    QuantizedWideBVHNode<4> *quantizedNodes4 = nullptr;
+    QuantizedWideBVHNode<8> *quantizedNodes8 = nullptr;
+    int nNodes = 0;
+    Float buildSAHCost = 0;
+    // Vertices of leaves that hold only triangles, gathered for batched tests;
+    // _leafTriangleBatches_ maps a leaf's first primitive to its first batch
+    TriangleBatch *triangleBatches = nullptr;
+    std::vector<int> leafTriangleBatches;
+    // Likewise for the vertices of leaves that hold only bilinear patches
+    BilinearPatchBatch *patchBatches = nullptr;
+    std::vector<int> leafPatchBatches;
+    // If _precomputeTriangles_ is set, leaves that hold only triangles are
+    // tested using _precomputedTriangles_, which parallels _primitives_, in
+    // place of triangle batches; _precomputedLeaves_ records which leaves, by
+    // their first primitive, those are
+    bool precomputeTriangles;
+    PrecomputedTriangle *precomputedTriangles = nullptr;
+    std::vector<bool> precomputedLeaves;
+    // Holds the nodes when they are used in place from a BVH cache file
+    MappedFile *cacheFile = nullptr;
+};
+
+// LazyBVHAggregate Definition
+// Holds the primitives of an object instance but only builds their BVH the
+// first time a ray reaches the instance's bounds. Rays that arrive while
+// another thread is building the BVH are tested against the primitives
+// directly rather than waiting for it.
+class LazyBVHAggregate {
+  public:
+    // LazyBVHAggregate Public Methods
+    LazyBVHAggregate(std::vector<Primitive> prims);
+
+    Bounds3f Bounds() const { return bounds; }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+  private:
+    // LazyBVHAggregate Private Methods
+    const BVHAggregate *getBVH() const;
+
+    // LazyBVHAggregate Private Members
+    std::vector<Primitive> primitives;
+    Bounds3f bounds;
+    mutable std::atomic<BVHAggregate *> bvh{nullptr};
+    mutable std::atomic<bool> buildClaimed{false};
 };
 
 struct KdTreeNode;
@@ -87,18 +209,22 @@ class KdTreeAggregate {
 
   private:
     // KdTreeAggregate Private Methods
-    void buildTree(int nodeNum, const Bounds3f &bounds,
-                   const std::vector<Bounds3f> &primBounds, int *primNums, int nprims,
-                   int depth, const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
-                   int *prims1, int badRefines);
+    std::vector<KdTreeNode> buildSubtree(const Bounds3f &bounds,
+                                         const std::vector<Bounds3f> &primBounds,
+                                         const std::vector<int> &primNums, int depth,
+                                         int badRefines) const;
+    void buildTree(std::vector<KdTreeNode> *buildNodes, const Bounds3f &bounds,
+                   const std::vector<Bounds3f> &primBounds, const int *primNums,
+                   int nprims, int depth, const std::unique_ptr<BoundEdge[]> edges[3],
+                   int *prims0, int *prims1, int badRefines) const;
 
     // KdTreeAggregate Private Members
     int isectCost, traversalCost, maxPrims;
     Float emptyBonus;
     std::vector<Primitive> primitives;
-    std::vector<int> primitiveIndices;
-    KdTreeNode *nodes;
-    int nAllocedNodes, nextFreeNode;
+    // Leaf primitive indices are stored in _nodes_ following each leaf
+    KdTreeNode *nodes = nullptr;
+    int nNodes = 0;
     Bounds3f bounds;
 };
 
@@ -0,0 +1,100 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/transform.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// BVH traversal micro-benchmarks: rays start outside of a unit sphere
+// tessellated into roughly the number of triangles given by the benchmark's
+// argument, with a bumpy surface so that the BVH's nodes overlap as they do
+// for scanned models, and are aimed at random points inside it. Half of them
+// miss. The "time/ray" counter reports the cost of a single traversal.
+
+static std::vector<Primitive> SphereMeshPrimitives(int nTriangles) {
+    int nPhi = std::max<int>(4, std::sqrt(nTriangles)), nTheta = std::max(2, nPhi / 2);
+    std::vector<Point3f> p;
+    RNG rng;
+    for (int t = 0; t <= nTheta; ++t)
+        for (int i = 0; i < nPhi; ++i) {
+            Float theta = Pi * t / nTheta, phi = 2 * Pi * i / nPhi;
+            Float r = 1 + .02f * rng.Uniform<Float>();
+            p.push_back(Point3f(r * std::sin(theta) * std::cos(phi),
+                                r * std::sin(theta) * std::sin(phi),
+                                r * std::cos(theta)));
+        }
+    std::vector<int> indices;
+    for (int t = 0; t < nTheta; ++t)
+        for (int i = 0; i < nPhi; ++i) {
+            int v00 = t * nPhi + i, v01 = t * nPhi + (i + 1) % nPhi;
+            int v10 = v00 + nPhi, v11 = v01 + nPhi;
+            indices.insert(indices.end(), {v00, v10, v11, v00, v11, v01});
+        }
+
+    static Transform identity;
+    // Leaks...
+    TriangleMesh *mesh = new TriangleMesh(identity, false, indices, p, {}, {}, {}, {});
+    std::vector<Primitive> prims;
+    for (Shape tri : Triangle::CreateTriangles(mesh, Allocator()))
+        prims.push_back(new SimplePrimitive(tri, nullptr));
+    return prims;
+}
+
+static std::vector<Ray> BenchmarkRays(int nRays) {
+    RNG rng;
+    std::vector<Ray> rays;
+    for (int i = 0; i < nRays; ++i) {
+        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+        Point3f o(2.f * SampleUniformSphere(u));
+        // Rays toward the inner half of the cube mostly hit; the rest mostly miss
+        Float extent = (i & 1) ? .5f : 2.f;
+        Point3f target(Lerp(rng.Uniform<Float>(), -extent, extent),
+                       Lerp(rng.Uniform<Float>(), -extent, extent),
+                       Lerp(rng.Uniform<Float>(), -extent, extent));
+        rays.push_back(Ray(o, target - o));
+    }
+    return rays;
+}
+
+template <typename F>
+static void BenchmarkTraversal(benchmark::State &state, int width, F traverse) {
+    BVHAggregate bvh(SphereMeshPrimitives(state.range(0)), 4,
+                     BVHAggregate::SplitMethod::SAH, width);
+    std::vector<Ray> rays = BenchmarkRays(4096);
+    size_t rayIndex = 0;
+    for (auto _ : state) {
+        traverse(bvh, rays[rayIndex]);
+        if (++rayIndex == rays.size())
+            rayIndex = 0;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["time/ray"] = benchmark::Counter(
+        state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+#define PBRT_BVH_BENCHMARK(name, width, call)                              \
+    static void BM_##name(benchmark::State &state) {                       \
+        BenchmarkTraversal(state, width,                                   \
+                           [](const BVHAggregate &bvh, const Ray &ray) {   \
+                               benchmark::DoNotOptimize(call);             \
+                           });                                             \
+    }                                                                      \
+    BENCHMARK(BM_##name)->RangeMultiplier(16)->Range(1 << 10, 1 << 18)
+
+PBRT_BVH_BENCHMARK(BVHIntersect, 2, bvh.Intersect(ray, Infinity));
+PBRT_BVH_BENCHMARK(BVHIntersectP, 2, bvh.IntersectP(ray, Infinity));
+PBRT_BVH_BENCHMARK(BVH4Intersect, 4, bvh.Intersect(ray, Infinity));
+PBRT_BVH_BENCHMARK(BVH4IntersectP, 4, bvh.IntersectP(ray, Infinity));
@@ -0,0 +1,353 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/cpu/traversalbench.h>
+#include <pbrt/interaction.h>
+#include <pbrt/options.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/transform.h>
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace pbrt;
+
+// Returns a soup of random triangles of roughly the given size centered in
+// the [-1,1]^3 cube.
+static std::vector<Primitive> RandomTrianglePrimitives(int nTriangles,
+                                                       Float size = .1f) {
+    RNG rng;
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f center(Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1));
+        for (int j = 0; j < 3; ++j) {
+            Vector3f offset(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                            rng.Uniform<Float>());
+            indices.push_back(p.size());
+            p.push_back(center + size * (offset - Vector3f(.5f, .5f, .5f)));
+        }
+    }
+
+    static Transform identity;
+    // Leaks...
+    TriangleMesh *mesh = new TriangleMesh(identity, false, indices, p, {}, {}, {}, {});
+    std::vector<Primitive> prims;
+    for (Shape tri : Triangle::CreateTriangles(mesh, Allocator()))
+        prims.push_back(new SimplePrimitive(tri, nullptr));
+    return prims;
+}
+
+// Returns random bilinear patches of roughly the given size centered in the
+// [-1,1]^3 cube.
+static std::vector<Primitive> RandomBilinearPatchPrimitives(int nPatches,
+                                                            Float size = .1f) {
+    RNG rng;
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nPatches * 4; ++i) {
+        if (i % 4 == 0)
+            p.push_back(Point3f(Lerp(rng.Uniform<Float>(), -1, 1),
+                                Lerp(rng.Uniform<Float>(), -1, 1),
+                                Lerp(rng.Uniform<Float>(), -1, 1)));
+        else
+            p.push_back(p[i - i % 4] + size * Vector3f(rng.Uniform<Float>(),
+                                                       rng.Uniform<Float>(),
+                                                       rng.Uniform<Float>()));
+        indices.push_back(i);
+    }
+
+    static Transform identity;
+    BilinearPatchMesh *mesh =
+        new BilinearPatchMesh(identity, false, indices, p, {}, {}, {}, nullptr);
+    std::vector<Primitive> prims;
+    for (Shape blp : BilinearPatch::CreatePatches(mesh, Allocator()))
+        prims.push_back(new SimplePrimitive(blp, nullptr));
+    return prims;
+}
+
+// Checks an aggregate against brute-force intersection of all primitives.
+template <typename Aggregate>
+static void CheckMatchesBruteForce(const Aggregate &aggregate,
+                                   const std::vector<Primitive> &prims, int nRays,
+                                   int seed) {
+    RNG rng(seed);
+    for (int i = 0; i < nRays; ++i) {
+        Point3f o = Point3f(0, 0, 0) +
+                    2 * SampleUniformSphere(Point2f(rng.Uniform<Float>(),
+                                                     rng.Uniform<Float>()));
+        Vector3f d = SampleUniformSphere(Point2f(rng.Uniform<Float>(),
+                                                 rng.Uniform<Float>()));
+        Ray ray(o, d);
+        Float tMax = rng.Uniform<Float>() < .5f ? Infinity : 2;
+
+        pstd::optional<Float> tClosest;
+        for (const Primitive &prim : prims) {
+            pstd::optional<ShapeIntersection> si = prim.Intersect(ray, tMax);
+            if (si && (!tClosest || si->tHit < *tClosest))
+                tClosest = si->tHit;
+        }
+
+        pstd::optional<ShapeIntersection> si = aggregate.Intersect(ray, tMax);
+        ASSERT_EQ(tClosest.has_value(), si.has_value()) << ray;
+        if (si)
+            EXPECT_EQ(*tClosest, si->tHit) << ray;
+        EXPECT_EQ(tClosest.has_value(), aggregate.IntersectP(ray, tMax)) << ray;
+    }
+}
+
+static void TestBVHMatchesBruteForce(BVHAggregate::SplitMethod splitMethod, int width,
+                                     int nTriangles = 2000, int nRays = 1000,
+                                     Float triangleSize = .1f, bool quantized = false) {
+    std::vector<Primitive> prims = RandomTrianglePrimitives(nTriangles, triangleSize);
+    BVHAggregate bvh(prims, 4, splitMethod, width, quantized);
+    CheckMatchesBruteForce(bvh, prims, nRays, width);
+}
+
+TEST(BVHAggregate, Binary) {
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 2);
+}
+
+TEST(BVHAggregate, Wide4) {
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 4);
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::HLBVH, 4);
+}
+
+TEST(BVHAggregate, Wide8) {
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 8);
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::Middle, 8);
+}
+
+TEST(BVHAggregate, ParallelBuild) {
+    // Enough primitives that binning and partitioning run in parallel
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 2, 100000, 100);
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::Middle, 4, 100000, 100);
+}
+
+TEST(BVHAggregate, SpatialSplits) {
+    // Long triangles overlap heavily, which leads to spatial splits
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SBVH, 2, 2000, 1000, 1.5f);
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SBVH, 4, 2000, 1000, 1.5f);
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SBVH, 8);
+}
+
+TEST(BVHAggregate, Quantized) {
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 4, 2000, 1000, .1f, true);
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 8, 2000, 1000, .1f, true);
+    // Tiny triangles stress quantization of nearly degenerate boxes
+    TestBVHMatchesBruteForce(BVHAggregate::SplitMethod::SAH, 4, 2000, 1000, 1e-4f, true);
+}
+
+TEST(BVHAggregate, PrecomputedTriangles) {
+    for (int width : {2, 4, 8}) {
+        std::vector<Primitive> prims = RandomTrianglePrimitives(2000);
+        BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, width, false, 1e-5f,
+                         1, true /* precomputeTriangles */);
+        CheckMatchesBruteForce(bvh, prims, 1000, width);
+    }
+    // Single-primitive leaves are precomputed as well
+    std::vector<Primitive> prims = RandomTrianglePrimitives(500);
+    BVHAggregate bvh(prims, 1, BVHAggregate::SplitMethod::SAH, 2, false, 1e-5f, 1, true);
+    CheckMatchesBruteForce(bvh, prims, 1000, 1);
+}
+
+TEST(BVHAggregate, BilinearPatchBatches) {
+    std::vector<Primitive> prims = RandomBilinearPatchPrimitives(2000);
+    for (int width : {2, 4, 8}) {
+        BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, width);
+        CheckMatchesBruteForce(bvh, prims, 1000, width);
+    }
+}
+
+TEST(BVHAggregate, RayStream) {
+    std::vector<Primitive> prims = RandomTrianglePrimitives(5000);
+    for (int width : {2, 4, 8}) {
+        BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, width);
+
+        // Mix a coherent batch from a common origin with incoherent rays
+        RNG rng(width);
+        std::vector<Ray> rays;
+        std::vector<Float> tMax;
+        for (int i = 0; i < 300; ++i) {
+            Point3f o = (i < 150) ? Point3f(0, 0, -3)
+                                  : Point3f(0, 0, 0) +
+                                        2 * SampleUniformSphere(Point2f(
+                                                rng.Uniform<Float>(), rng.Uniform<Float>()));
+            Point3f target(Lerp(rng.Uniform<Float>(), -1, 1),
+                           Lerp(rng.Uniform<Float>(), -1, 1), 0);
+            rays.push_back(Ray(o, target - o));
+            tMax.push_back(rng.Uniform<Float>() < .5f ? Infinity : 1);
+        }
+
+        std::vector<pstd::optional<ShapeIntersection>> si(rays.size());
+        std::unique_ptr<bool[]> hit(new bool[rays.size()]);
+        bvh.IntersectStream(rays, tMax, pstd::MakeSpan(si));
+        bvh.IntersectPStream(rays, tMax, pstd::MakeSpan(hit.get(), rays.size()));
+
+        for (size_t i = 0; i < rays.size(); ++i) {
+            pstd::optional<ShapeIntersection> expected = bvh.Intersect(rays[i], tMax[i]);
+            ASSERT_EQ(expected.has_value(), si[i].has_value()) << rays[i];
+            if (expected)
+                EXPECT_EQ(expected->tHit, si[i]->tHit) << rays[i];
+            EXPECT_EQ(expected.has_value(), hit[i]) << rays[i];
+        }
+    }
+}
+
+TEST(BVHAggregate, Cache) {
+    std::vector<Primitive> prims = RandomTrianglePrimitives(2000);
+    std::string savedCacheDirectory = Options->bvhCacheDirectory;
+    Options->bvhCacheDirectory = ".";
+
+    for (int width : {2, 4, 8}) {
+        // The first BVH is built and written to the cache; the second is
+        // loaded from it.
+        BVHAggregate built(prims, 4, BVHAggregate::SplitMethod::SAH, width);
+        BVHAggregate loaded(prims, 4, BVHAggregate::SplitMethod::SAH, width);
+        EXPECT_EQ(built.Bounds(), loaded.Bounds());
+
+        RNG rng(width);
+        for (int i = 0; i < 1000; ++i) {
+            Point3f o = Point3f(0, 0, 0) +
+                        2 * SampleUniformSphere(Point2f(rng.Uniform<Float>(),
+                                                         rng.Uniform<Float>()));
+            Vector3f d = SampleUniformSphere(Point2f(rng.Uniform<Float>(),
+                                                     rng.Uniform<Float>()));
+            Ray ray(o, d);
+            pstd::optional<ShapeIntersection> siBuilt = built.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> siLoaded = loaded.Intersect(ray, Infinity);
+            ASSERT_EQ(siBuilt.has_value(), siLoaded.has_value()) << ray;
+            if (siBuilt)
+                EXPECT_EQ(siBuilt->tHit, siLoaded->tHit) << ray;
+            EXPECT_EQ(built.IntersectP(ray, Infinity), loaded.IntersectP(ray, Infinity));
+        }
+    }
+
+    // One cache file should have been written for each width
+    std::vector<std::string> cacheFiles = MatchingFilenames("./bvh-");
+    EXPECT_EQ(3, cacheFiles.size());
+    for (const std::string &filename : cacheFiles)
+        EXPECT_EQ(0, remove(filename.c_str()));
+    Options->bvhCacheDirectory = savedCacheDirectory;
+}
+
+TEST(BVHAggregate, Refit) {
+    // Two-level hierarchy of translated instances of a BVH of triangles
+    Primitive instance = new BVHAggregate(RandomTrianglePrimitives(200, .05f));
+    RNG rng;
+    std::vector<AffineTransform> transforms[2];
+    for (int i = 0; i < 50; ++i)
+        for (int frame = 0; frame < 2; ++frame)
+            transforms[frame].push_back(
+                AffineTransform(Translate(Vector3f(Lerp(rng.Uniform<Float>(), -3, 3),
+                                                   Lerp(rng.Uniform<Float>(), -3, 3),
+                                                   Lerp(rng.Uniform<Float>(), -3, 3))) *
+                                Scale(.2f, .2f, .2f)));
+
+    for (int width : {2, 4, 8}) {
+        for (bool quantized : {false, true}) {
+            if (quantized && width == 2)
+                continue;
+            std::vector<Primitive> instances;
+            for (const AffineTransform &t : transforms[0])
+                instances.push_back(new TransformedPrimitive(instance, &t));
+            BVHAggregate bvh(instances, 1, BVHAggregate::SplitMethod::SAH, width,
+                             quantized);
+
+            // Move all instances and refit, then move them back and force a rebuild
+            for (int pass = 0; pass < 2; ++pass) {
+                for (size_t i = 0; i < instances.size(); ++i)
+                    instances[i].Cast<TransformedPrimitive>()->SetRenderFromPrimitive(
+                        &transforms[1 - pass][i]);
+                if (pass == 0)
+                    bvh.Refit();
+                else
+                    bvh.Update(0);
+
+                for (int i = 0; i < 500; ++i) {
+                    Point3f o = Point3f(0, 0, 0) +
+                                5 * SampleUniformSphere(Point2f(rng.Uniform<Float>(),
+                                                                 rng.Uniform<Float>()));
+                    Point3f target(Lerp(rng.Uniform<Float>(), -3, 3),
+                                   Lerp(rng.Uniform<Float>(), -3, 3),
+                                   Lerp(rng.Uniform<Float>(), -3, 3));
+                    Ray ray(o, target - o);
+
+                    pstd::optional<Float> tClosest;
+                    for (const Primitive &prim : instances) {
+                        pstd::optional<ShapeIntersection> si = prim.Intersect(ray, 2);
+                        if (si && (!tClosest || si->tHit < *tClosest))
+                            tClosest = si->tHit;
+                    }
+
+                    pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, 2);
+                    ASSERT_EQ(tClosest.has_value(), si.has_value()) << ray;
+                    if (si)
+                        EXPECT_EQ(*tClosest, si->tHit) << ray;
+                    EXPECT_EQ(tClosest.has_value(), bvh.IntersectP(ray, 2)) << ray;
+                }
+            }
+        }
+    }
+}
+
+TEST(LazyBVHAggregate, BruteForce) {
+    std::vector<Primitive> prims = RandomTrianglePrimitives(2000);
+    LazyBVHAggregate lazy(prims);
+    EXPECT_EQ(Union(prims[0].Bounds(), lazy.Bounds()), lazy.Bounds());
+    // Rays traced concurrently with the first one may find the BVH still
+    // being built and fall back to testing all of the primitives
+    ParallelFor(0, 8, [&](int64_t i) { CheckMatchesBruteForce(lazy, prims, 200, i); });
+}
+
+TEST(KdTreeAggregate, BruteForce) {
+    // Larger leaves store primitive indices in the slots following each leaf
+    for (int maxPrims : {1, 4, 16}) {
+        std::vector<Primitive> prims = RandomTrianglePrimitives(2000);
+        KdTreeAggregate kdTree(prims, 80, 1, .5f, maxPrims);
+        CheckMatchesBruteForce(kdTree, prims, 1000, maxPrims);
+    }
+}
+
+TEST(KdTreeAggregate, ParallelBuild) {
+    // Enough primitives that subtrees are built in parallel
+    std::vector<Primitive> prims = RandomTrianglePrimitives(100000);
+    KdTreeAggregate kdTree(prims);
+    CheckMatchesBruteForce(kdTree, prims, 100, 0);
+}
+
+TEST(TraversalBench, RecordAndTrace) {
+    std::string fn = "traversalbench_test.rays";
+    RayRecordingStart(1000);
+    RNG rng;
+    for (int i = 0; i < 100; ++i) {
+        Point3f o(2 * SampleUniformSphere(
+                          Point2f(rng.Uniform<Float>(), rng.Uniform<Float>())));
+        Ray ray(o, -Vector3f(o));
+        RecordRay(ray, Infinity, RayType::Camera, false);
+        RecordRay(ray, .5f, RayType::Shadow, true);
+    }
+    RayRecordingWrite(fn);
+    EXPECT_FALSE(rayRecordingEnabled);
+
+    // Each ray takes 36 bytes after the 16-byte header
+    std::string contents = ReadFileContents(fn);
+    EXPECT_EQ(16 + 200 * 36, contents.size());
+
+    BenchmarkTraversal(RandomTrianglePrimitives(1000), fn);
+    EXPECT_EQ(0, remove(fn.c_str()));
+}
@@ -0,0 +1,454 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/displacement.h>
+
+#include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/shapes.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace pbrt {
+
+STAT_COUNTER("Displacement/Triangles tessellated", nTrianglesTessellated);
+STAT_COUNTER("Displacement/Triangles evicted", nTrianglesEvicted);
+STAT_PERCENT("Displacement/Geometry cache hits", nGeometryCacheHits,
+             nGeometryCacheLookups);
+STAT_INT_DISTRIBUTION("Displacement/Tessellation level", tessellationLevel);
+
+// GridTriangle Definition
+// A triangle of the grid over a displaced triangle's barycentric domain, which has
+// $n=2^l$ segments along each edge. Grid vertex $(i,j)$ has barycentric
+// coordinates $(1-(i+j)/n, i/n, j/n)$. The grid triangle has a corner at $(i,j)$
+// and size _s_ and its other corners are at $(i+s,j)$ and $(i,j+s)$, or at
+// $(i-s,j)$ and $(i,j-s)$ if it is flipped; either way, its winding matches
+// the displaced triangle's.
+struct GridTriangle {
+    // Split the triangle at its edges' midpoints into three triangles at its
+    // corners and a flipped one in the middle
+    GridTriangle Child(int c) const {
+        int h = s / 2, d = flipped ? -h : h;
+        switch (c) {
+        case 0:
+            return {i, j, h, flipped};
+        case 1:
+            return {i + d, j, h, flipped};
+        case 2:
+            return {i, j + d, h, flipped};
+        default:
+            return {i + d, j + d, h, !flipped};
+        }
+    }
+
+    pstd::array<Point2i, 3> Corners() const {
+        int d = flipped ? -s : s;
+        return {Point2i(i, j), Point2i(i + d, j), Point2i(i, j + d)};
+    }
+
+    int i, j, s;
+    bool flipped;
+};
+
+// DisplacedPatchGeometry Definition
+// The displaced vertices of a tessellated triangle's grid and bounds for a
+// complete quadtree of its grid triangles, down to but excluding the
+// micro-triangles at its leaves. The children of node _k_ at each depth are nodes
+// $4k$ through $4k+3$ at the next one.
+struct DisplacedPatchGeometry {
+    int Resolution() const { return 1 << level; }
+    Point3f P(Point2i ij) const {
+        // Rows of constant $j$ have $n+1-j$ vertices
+        int n = Resolution();
+        return p[ij.y * (n + 1) - ij.y * (ij.y - 1) / 2 + ij.x];
+    }
+    static int NodeOffset(int depth) { return ((1 << (2 * depth)) - 1) / 3; }
+
+    size_t Bytes() const {
+        return sizeof(*this) + p.capacity() * sizeof(Point3f) +
+               nodeBounds.capacity() * sizeof(Bounds3f);
+    }
+
+    int level;
+    std::vector<Point3f> p;
+    std::vector<Bounds3f> nodeBounds;
+};
+
+// DisplacedTrianglePrimitive Utility Functions
+static Bounds3f InitNodeBounds(DisplacedPatchGeometry *geom, int depth, int k,
+                               const GridTriangle &t) {
+    if (t.s == 1) {
+        pstd::array<Point2i, 3> c = t.Corners();
+        return Union(Bounds3f(geom->P(c[0]), geom->P(c[1])), geom->P(c[2]));
+    }
+    Bounds3f bounds;
+    for (int c = 0; c < 4; ++c)
+        bounds = Union(bounds, InitNodeBounds(geom, depth + 1, 4 * k + c, t.Child(c)));
+    geom->nodeBounds[DisplacedPatchGeometry::NodeOffset(depth) + k] = bounds;
+    return bounds;
+}
+
+struct GridIntersection {
+    TriangleIntersection ti;
+    GridTriangle triangle;
+};
+
+static pstd::optional<GridIntersection> IntersectGrid(const DisplacedPatchGeometry &geom,
+                                                      const Ray &ray, Float tMax,
+                                                      bool anyHit) {
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    // Traverse the quadtree, testing micro-triangles as they are reached
+    struct Entry {
+        int depth, k;
+        GridTriangle triangle;
+    };
+    Entry toVisit[64];
+    int toVisitOffset = 0;
+    toVisit[toVisitOffset++] = {0, 0, GridTriangle{0, 0, geom.Resolution(), false}};
+    pstd::optional<GridIntersection> isect;
+    while (toVisitOffset > 0) {
+        Entry e = toVisit[--toVisitOffset];
+        if (e.triangle.s == 1) {
+            pstd::array<Point2i, 3> c = e.triangle.Corners();
+            pstd::optional<TriangleIntersection> ti = IntersectTriangle(
+                ray, tMax, geom.P(c[0]), geom.P(c[1]), geom.P(c[2]));
+            if (ti) {
+                tMax = ti->t;
+                isect = GridIntersection{*ti, e.triangle};
+                if (anyHit)
+                    return isect;
+            }
+            continue;
+        }
+
+        int node = DisplacedPatchGeometry::NodeOffset(e.depth) + e.k;
+        if (!geom.nodeBounds[node].IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg))
+            continue;
+        for (int c = 3; c >= 0; --c)
+            toVisit[toVisitOffset++] = {e.depth + 1, 4 * e.k + c, e.triangle.Child(c)};
+    }
+    return isect;
+}
+
+// DisplacementCache Definition
+// Tracks the triangles that have micro-geometry and evicts the least recently
+// used ones when it exceeds its memory budget. Triangles record the value of the
+// clock, which advances with each insertion, when they are used.
+class DisplacementCache {
+  public:
+    std::shared_ptr<const DisplacedPatchGeometry> Insert(
+        const DisplacedTrianglePrimitive *prim,
+        std::shared_ptr<const DisplacedPatchGeometry> geom);
+
+    void SetMaxBytes(size_t b) {
+        std::lock_guard<std::mutex> lock(mutex);
+        maxBytes = b;
+    }
+
+    std::atomic<uint32_t> clock{0};
+
+  private:
+    void Evict();
+
+    std::mutex mutex;
+    std::vector<const DisplacedTrianglePrimitive *> resident;
+    size_t bytes = 0, maxBytes = size_t(512) << 20;
+};
+
+static DisplacementCache displacementCache;
+
+// DisplacementCache Method Definitions
+std::shared_ptr<const DisplacedPatchGeometry> DisplacementCache::Insert(
+    const DisplacedTrianglePrimitive *prim,
+    std::shared_ptr<const DisplacedPatchGeometry> geom) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Use the triangle's geometry if another thread tessellated it first
+    if (std::shared_ptr<const DisplacedPatchGeometry> existing =
+            std::atomic_load(&prim->geometry))
+        return existing;
+
+    std::atomic_store(&prim->geometry, geom);
+    prim->lastUsed.store(clock.fetch_add(1) + 1, std::memory_order_relaxed);
+    resident.push_back(prim);
+    bytes += geom->Bytes();
+    if (bytes > maxBytes)
+        Evict();
+    return geom;
+}
+
+void DisplacementCache::Evict() {
+    // Sort resident triangles from least to most recently used; clock values are
+    // copied first since other threads may update them
+    uint32_t now = clock.load();
+    std::vector<std::pair<uint32_t, const DisplacedTrianglePrimitive *>> byAge;
+    byAge.reserve(resident.size());
+    for (const DisplacedTrianglePrimitive *prim : resident)
+        byAge.push_back({now - prim->lastUsed.load(std::memory_order_relaxed), prim});
+    std::sort(byAge.begin(), byAge.end(),
+              [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    // Evict until a quarter of the budget is free so that sorting is infrequent;
+    // threads that are using evicted geometry keep it alive until they are done
+    size_t nEvicted = 0;
+    while (bytes > maxBytes / 4 * 3 && nEvicted + 1 < byAge.size()) {
+        const DisplacedTrianglePrimitive *prim = byAge[nEvicted++].second;
+        bytes -= std::atomic_load(&prim->geometry)->Bytes();
+        std::atomic_store(&prim->geometry,
+                          std::shared_ptr<const DisplacedPatchGeometry>());
+        ++nTrianglesEvicted;
+    }
+    resident.clear();
+    for (size_t i = nEvicted; i < byAge.size(); ++i)
+        resident.push_back(byAge[i].second);
+}
+
+// DisplacedTrianglePrimitive Method Definitions
+DisplacedTrianglePrimitive::DisplacedTrianglePrimitive(const DisplacedMesh *mesh,
+                                                       int triIndex)
+    : mesh(mesh), triIndex(triIndex) {
+    primitiveMemory += sizeof(*this);
+}
+
+std::vector<Primitive> DisplacedTrianglePrimitive::Create(
+    pstd::span<const Shape> triangles, Material material,
+    const MediumInterface &mediumInterface, Float maxDisplacement, Float edgeLength,
+    int maxLevel, Allocator alloc) {
+    CHECK(!triangles.empty());
+    CHECK(material && material.GetDisplacement());
+    const TriangleMesh *m = triangles[0].Cast<Triangle>()->GetMesh();
+    DisplacedMesh *dmesh = alloc.new_object<DisplacedMesh>();
+    dmesh->mesh = m;
+    dmesh->displacement = material.GetDisplacement();
+    dmesh->maxDisplacement = maxDisplacement;
+    dmesh->material = material;
+    dmesh->mediumInterface = mediumInterface;
+
+    if (!m->HasNormals()) {
+        // Average area-weighted face normals, oriented like _Triangle_'s surface
+        // normals, at the mesh's vertices
+        dmesh->n.assign(m->nVertices, Normal3f(0, 0, 0));
+        bool flip = m->reverseOrientation ^ m->transformSwapsHandedness;
+        for (int t = 0; t < m->nTriangles; ++t) {
+            const int *v = &m->vertexIndices[3 * t];
+            Point3f p0 = m->P(v[0]), p1 = m->P(v[1]), p2 = m->P(v[2]);
+            Normal3f n(Cross(p0 - p2, p1 - p2));
+            for (int c = 0; c < 3; ++c)
+                dmesh->n[v[c]] += flip ? -n : n;
+        }
+        for (Normal3f &n : dmesh->n)
+            if (LengthSquared(n) > 0)
+                n = Normalize(n);
+    }
+
+    // Choose triangles' tessellation levels so that micro-triangle edges are at
+    // most _edgeLength_ long
+    maxLevel = Clamp(maxLevel, 0, 10);
+    dmesh->triangleLevels.resize(m->nTriangles);
+    for (int t = 0; t < m->nTriangles; ++t) {
+        const int *v = &m->vertexIndices[3 * t];
+        Float maxEdge = 0;
+        for (int c = 0; c < 3; ++c)
+            maxEdge = std::max(maxEdge, Distance(m->P(v[c]), m->P(v[(c + 1) % 3])));
+        int level = maxLevel;
+        if (edgeLength > 0)
+            level = maxEdge > edgeLength
+                        ? int(std::ceil(std::log2(maxEdge / edgeLength)))
+                        : 0;
+        dmesh->triangleLevels[t] = Clamp(level, 0, maxLevel);
+    }
+
+    // Give each edge the smaller of the levels of the triangles that share it
+    auto edgeKey = [&](int t, int e) {
+        int v0 = m->vertexIndices[3 * t + e], v1 = m->vertexIndices[3 * t + (e + 1) % 3];
+        return (uint64_t(std::min(v0, v1)) << 32) | uint64_t(std::max(v0, v1));
+    };
+    std::unordered_map<uint64_t, int> edgeLevels;
+    for (int t = 0; t < m->nTriangles; ++t)
+        for (int e = 0; e < 3; ++e) {
+            auto iter = edgeLevels.insert({edgeKey(t, e), dmesh->triangleLevels[t]});
+            iter.first->second = std::min<int>(iter.first->second,
+                                               dmesh->triangleLevels[t]);
+        }
+    dmesh->edgeLevels.resize(3 * m->nTriangles);
+    for (int t = 0; t < m->nTriangles; ++t)
+        for (int e = 0; e < 3; ++e)
+            dmesh->edgeLevels[3 * t + e] = edgeLevels[edgeKey(t, e)];
+
+    std::vector<Primitive> prims;
+    prims.reserve(triangles.size());
+    for (Shape shape : triangles) {
+        const Triangle *tri = shape.Cast<Triangle>();
+        CHECK(tri->GetMesh() == m);
+        prims.push_back(
+            alloc.new_object<DisplacedTrianglePrimitive>(dmesh, tri->GetTriangleIndex()));
+    }
+    return prims;
+}
+
+void DisplacedTrianglePrimitive::SetCacheMemory(size_t bytes) {
+    displacementCache.SetMaxBytes(bytes);
+}
+
+Bounds3f DisplacedTrianglePrimitive::Bounds() const {
+    const TriangleMesh *m = mesh->mesh;
+    const int *v = &m->vertexIndices[3 * triIndex];
+    return Expand(Union(Bounds3f(m->P(v[0]), m->P(v[1])), m->P(v[2])),
+                  mesh->maxDisplacement);
+}
+
+std::shared_ptr<const DisplacedPatchGeometry> DisplacedTrianglePrimitive::GetGeometry()
+    const {
+    ++nGeometryCacheLookups;
+    uint32_t now = displacementCache.clock.load(std::memory_order_relaxed);
+    if (lastUsed.load(std::memory_order_relaxed) != now)
+        lastUsed.store(now, std::memory_order_relaxed);
+    std::shared_ptr<const DisplacedPatchGeometry> geom = std::atomic_load(&geometry);
+    if (geom) {
+        ++nGeometryCacheHits;
+        return geom;
+    }
+    return displacementCache.Insert(this, Tessellate());
+}
+
+std::shared_ptr<const DisplacedPatchGeometry> DisplacedTrianglePrimitive::Tessellate()
+    const {
+    const TriangleMesh *m = mesh->mesh;
+    const int *v = &m->vertexIndices[3 * triIndex];
+    pstd::array<Point2f, 3> uv =
+        m->HasUVs() ? pstd::array<Point2f, 3>({m->UV(v[0]), m->UV(v[1]), m->UV(v[2])})
+                    : pstd::array<Point2f, 3>(
+                          {Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
+    int faceIndex = m->faceIndices ? m->faceIndices[triIndex] : 0;
+
+    // Return the displaced point with barycentric coordinates _b_ with respect to
+    // the triangle's corners _c_
+    auto displacedPoint = [&](pstd::array<int, 3> c, pstd::array<Float, 3> b) {
+        Point3f p = b[0] * m->P(v[c[0]]) + b[1] * m->P(v[c[1]]) + b[2] * m->P(v[c[2]]);
+        Normal3f n =
+            b[0] * mesh->N(v[c[0]]) + b[1] * mesh->N(v[c[1]]) + b[2] * mesh->N(v[c[2]]);
+        if (LengthSquared(n) == 0)
+            return p;
+        Point2f st = b[0] * uv[c[0]] + b[1] * uv[c[1]] + b[2] * uv[c[2]];
+        TextureEvalContext ctx(p, Vector3f(), Vector3f(), st, 0, 0, 0, 0, faceIndex);
+        Float d = Clamp(mesh->displacement.Evaluate(ctx), -mesh->maxDisplacement,
+                        mesh->maxDisplacement);
+        return p + d * Vector3f(Normalize(n));
+    };
+    // Points along edges are computed in the direction of increasing vertex
+    // index so that the triangles on both sides of the edge compute the same
+    // ones. (With meshes that don't have uvs, neighbors' uvs still differ.)
+    auto edgePoint = [&](int c0, int c1, int k, int nSegments) {
+        if (v[c0] > v[c1]) {
+            std::swap(c0, c1);
+            k = nSegments - k;
+        }
+        Float t = Float(k) / nSegments;
+        return displacedPoint({c0, c1, c0}, {1 - t, t, 0});
+    };
+
+    auto geom = std::make_shared<DisplacedPatchGeometry>();
+    geom->level = Level();
+    int n = geom->Resolution();
+    geom->p.resize((n + 1) * (n + 2) / 2);
+    for (int j = 0, offset = 0; j <= n; ++j)
+        for (int i = 0; i <= n - j; ++i, ++offset) {
+            // Find the edge that the vertex lies on, if any, and its position on it
+            int edge = -1, k = 0;
+            if (j == 0) {
+                edge = 0;
+                k = i;
+            } else if (i + j == n) {
+                edge = 1;
+                k = j;
+            } else if (i == 0) {
+                edge = 2;
+                k = n - j;
+            }
+            if (edge == -1) {
+                geom->p[offset] = displacedPoint(
+                    {0, 1, 2}, {1 - Float(i + j) / n, Float(i) / n, Float(j) / n});
+                continue;
+            }
+
+            // Place the vertex on the edge's coarser tessellation
+            int c0 = edge, c1 = (edge + 1) % 3;
+            int stride = 1 << (geom->level - mesh->edgeLevels[3 * triIndex + edge]);
+            Point3f p0 = edgePoint(c0, c1, k / stride, n / stride);
+            if (k % stride == 0)
+                geom->p[offset] = p0;
+            else
+                geom->p[offset] = Lerp(Float(k % stride) / stride, p0,
+                                       edgePoint(c0, c1, k / stride + 1, n / stride));
+        }
+
+    if (geom->level > 0) {
+        geom->nodeBounds.resize(DisplacedPatchGeometry::NodeOffset(geom->level));
+        InitNodeBounds(geom.get(), 0, 0, GridTriangle{0, 0, n, false});
+    }
+    ++nTrianglesTessellated;
+    tessellationLevel << geom->level;
+    return geom;
+}
+
+pstd::optional<ShapeIntersection> DisplacedTrianglePrimitive::Intersect(
+    const Ray &r, Float tMax) const {
+    if (!Bounds().IntersectP(r.o, r.d, tMax))
+        return {};
+    std::shared_ptr<const DisplacedPatchGeometry> geom = GetGeometry();
+    pstd::optional<GridIntersection> gi = IntersectGrid(*geom, r, tMax, false);
+    if (!gi)
+        return {};
+    const TriangleIntersection &ti = gi->ti;
+
+    // Find the barycentric coordinates of the hit in the undisplaced triangle
+    pstd::array<Point2i, 3> c = gi->triangle.Corners();
+    Point2f ij = ti.b0 * Point2f(c[0]) + ti.b1 * Point2f(c[1]) + ti.b2 * Point2f(c[2]);
+    int n = geom->Resolution();
+    Float b1 = ij.x / n, b2 = ij.y / n, b0 = std::max<Float>(0, 1 - b1 - b2);
+
+    // Initialize the interaction's shading geometry from the undisplaced triangle
+    const TriangleMesh *m = mesh->mesh;
+    SurfaceInteraction intr = Triangle::InteractionFromIntersection(
+        m, triIndex, TriangleIntersection{b0, b1, b2, ti.t}, r.time, -r.d);
+    if (!m->HasNormals()) {
+        const int *v = &m->vertexIndices[3 * triIndex];
+        Normal3f ns = b0 * mesh->N(v[0]) + b1 * mesh->N(v[1]) + b2 * mesh->N(v[2]);
+        ns = LengthSquared(ns) > 0 ? Normalize(ns) : intr.n;
+        Vector3f ss = intr.shading.dpdu;
+        Vector3f ts = Cross(ns, ss);
+        if (LengthSquared(ts) > 0)
+            ss = Cross(ts, ns);
+        else
+            CoordinateSystem(ns, &ss, &ts);
+        intr.SetShadingGeometry(ns, ss, ts, Normal3f(), Normal3f(), true);
+    }
+
+    // Set the interaction's position and surface normal from the micro-triangle
+    Point3f p0 = geom->P(c[0]), p1 = geom->P(c[1]), p2 = geom->P(c[2]);
+    Point3f pHit = ti.b0 * p0 + ti.b1 * p1 + ti.b2 * p2;
+    Vector3f pAbsSum(Abs(ti.b0 * p0) + Abs(ti.b1 * p1) + Abs(ti.b2 * p2));
+    intr.pi = Point3fi(pHit, gamma(7) * pAbsSum);
+    intr.n = FaceForward(Normal3f(Normalize(Cross(p0 - p2, p1 - p2))), intr.shading.n);
+
+    intr.SetIntersectionProperties(mesh->material, nullptr, &mesh->mediumInterface,
+                                   r.medium);
+    return ShapeIntersection{intr, ti.t};
+}
+
+bool DisplacedTrianglePrimitive::IntersectP(const Ray &r, Float tMax) const {
+    if (!Bounds().IntersectP(r.o, r.d, tMax))
+        return false;
+    return IntersectGrid(*GetGeometry(), r, tMax, true).has_value();
+}
+
+}  // namespace pbrt
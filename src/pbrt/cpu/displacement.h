@@ -0,0 +1,91 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_DISPLACEMENT_H
+#define PBRT_CPU_DISPLACEMENT_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/base/material.h>
+#include <pbrt/base/medium.h>
+#include <pbrt/base/shape.h>
+#include <pbrt/base/texture.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+struct DisplacedPatchGeometry;
+
+// DisplacedMesh Definition
+// Shared state of the displaced triangles of one _TriangleMesh_. Each triangle is
+// tessellated into $4^l$ micro-triangles for its level $l$; each edge's level is
+// the smaller of those of the triangles that share it and the vertices along
+// finer edges are placed on the coarser edge so that neighbors meet without cracks.
+struct DisplacedMesh {
+    // Surfaces are offset by _displacement_ along per-vertex normals, which are
+    // the mesh's normals if it has them and otherwise are averaged from the faces
+    Normal3f N(int v) const { return n.empty() ? mesh->N(v) : n[v]; }
+
+    const TriangleMesh *mesh;
+    FloatTexture displacement;
+    Float maxDisplacement;
+    std::vector<Normal3f> n;
+    std::vector<uint8_t> triangleLevels, edgeLevels;
+    Material material;
+    MediumInterface mediumInterface;
+};
+
+// DisplacedTrianglePrimitive Definition
+// A triangle of a mesh displaced by its material's displacement texture. The
+// triangle is tessellated the first time a ray reaches its bounds, which are
+// expanded by the maximum displacement, and the micro-geometry is kept in a
+// cache of bounded size that evicts the least recently used triangles. The
+// shading frame is that of the undisplaced surface, so that the material's bump
+// mapping of the same displacement texture gives shading normals that match the
+// micro-geometry.
+class DisplacedTrianglePrimitive {
+  public:
+    // DisplacedTrianglePrimitive Public Methods
+    DisplacedTrianglePrimitive(const DisplacedMesh *mesh, int triIndex);
+
+    static std::vector<Primitive> Create(pstd::span<const Shape> triangles,
+                                         Material material,
+                                         const MediumInterface &mediumInterface,
+                                         Float maxDisplacement, Float edgeLength,
+                                         int maxLevel, Allocator alloc);
+    // Sets the maximum number of bytes of micro-geometry kept in the cache
+    static void SetCacheMemory(size_t bytes);
+
+    Bounds3f Bounds() const;
+    pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
+    bool IntersectP(const Ray &r, Float tMax) const;
+
+    int Level() const { return mesh->triangleLevels[triIndex]; }
+
+  private:
+    friend class DisplacementCache;
+    // DisplacedTrianglePrimitive Private Methods
+    std::shared_ptr<const DisplacedPatchGeometry> GetGeometry() const;
+    std::shared_ptr<const DisplacedPatchGeometry> Tessellate() const;
+
+    // DisplacedTrianglePrimitive Private Members
+    const DisplacedMesh *mesh;
+    int triIndex;
+    mutable std::shared_ptr<const DisplacedPatchGeometry> geometry;
+    // Value of the cache's clock when the geometry was last used
+    mutable std::atomic<uint32_t> lastUsed{0};
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_DISPLACEMENT_H
@@ -0,0 +1,93 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/displacement.h>
+#include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/shapes.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/transform.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// Returns a material that displaces surfaces by _d_.
+static Material DisplacementMaterial(Float d) {
+    return new DiffuseMaterial(nullptr, nullptr, new FloatConstantTexture(d), nullptr);
+}
+
+TEST(Displacement, Plane) {
+    // A unit square in the $z=0$ plane, displaced upward by 0.5
+    Transform identity;
+    std::vector<int> indices = {0, 1, 2, 2, 1, 3};
+    std::vector<Point3f> p = {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0, 1, 0),
+                              Point3f(1, 1, 0)};
+    TriangleMesh *mesh = new TriangleMesh(identity, false, indices, p, {}, {}, {}, {});
+    pstd::vector<Shape> tris = Triangle::CreateTriangles(mesh, Allocator());
+    std::vector<Primitive> prims = DisplacedTrianglePrimitive::Create(
+        tris, DisplacementMaterial(0.5f), MediumInterface(), 1, 0.2f, 6, Allocator());
+    ASSERT_EQ(2, prims.size());
+    // Edges are about 1.4 long, so micro-triangles' edges are at most 0.2 long
+    // with 8 segments along each edge
+    EXPECT_EQ(3, prims[0].Cast<DisplacedTrianglePrimitive>()->Level());
+    EXPECT_EQ(Bounds3f(Point3f(-1, -1, -1), Point3f(2, 2, 1)), prims[0].Bounds());
+
+    for (Float x : {0.1f, 0.3f, 0.5f, 0.7f}) {
+        Ray ray(Point3f(x, x, 5), Vector3f(0, 0, -1));
+        pstd::optional<ShapeIntersection> si = prims[0].Intersect(ray, Infinity);
+        if (!si)
+            si = prims[1].Intersect(ray, Infinity);
+        ASSERT_TRUE(si.has_value()) << x;
+        EXPECT_NEAR(4.5f, si->tHit, 1e-5f);
+        EXPECT_NEAR(0.5f, si->intr.p().z, 1e-5f);
+        EXPECT_EQ(Normal3f(0, 0, 1), si->intr.n);
+        EXPECT_EQ(Normal3f(0, 0, 1), si->intr.shading.n);
+    }
+
+    // Rays that pass above the undisplaced surface hit the displaced one
+    Ray under(Point3f(-1, 0.25f, 0.25f), Vector3f(1, 0, 0));
+    EXPECT_FALSE(prims[0].IntersectP(under, Infinity));
+    Ray rising(Point3f(-1, 0.25f, 0.25f), Vector3f(1, 0, 0.2f));
+    EXPECT_TRUE(prims[0].IntersectP(rising, Infinity));
+}
+
+TEST(Displacement, Watertight) {
+    // Two triangles of different sizes with tilted normals, so that displaced
+    // edges are curved and are tessellated at different rates on their sides
+    Transform identity;
+    std::vector<int> indices = {0, 1, 2, 1, 3, 2};
+    std::vector<Point3f> p = {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0, 1, 0),
+                              Point3f(3, 3, 0)};
+    std::vector<Normal3f> n = {Normal3f(0, 0, 1), Normalize(Normal3f(0.5f, 0.5f, 1)),
+                               Normalize(Normal3f(-0.5f, -0.5f, 1)), Normal3f(0, 0, 1)};
+    TriangleMesh *mesh = new TriangleMesh(identity, false, indices, p, {}, n, {}, {});
+    pstd::vector<Shape> tris = Triangle::CreateTriangles(mesh, Allocator());
+    std::vector<Primitive> prims = DisplacedTrianglePrimitive::Create(
+        tris, DisplacementMaterial(0.3f), MediumInterface(), 0.5f, 0.1f, 6, Allocator());
+    ASSERT_EQ(2, prims.size());
+    EXPECT_LT(prims[0].Cast<DisplacedTrianglePrimitive>()->Level(),
+              prims[1].Cast<DisplacedTrianglePrimitive>()->Level());
+
+    // Keep little micro-geometry in the cache so that triangles are evicted and
+    // re-tessellated while rays are traced
+    DisplacedTrianglePrimitive::SetCacheMemory(1);
+
+    // Rays from above the edge shared by the triangles always hit one of them
+    for (int i = 0; i <= 1000; ++i) {
+        Float x = 0.25f + 0.5f * i / 1000;
+        for (Float dy : {-1e-3f, 0.f, 1e-3f}) {
+            Ray ray(Point3f(x, 1 - x + dy, 5), Vector3f(0, 0, -1));
+            EXPECT_TRUE(prims[0].IntersectP(ray, Infinity) ||
+                        prims[1].IntersectP(ray, Infinity))
+                << x << " " << dy;
+        }
+    }
+    DisplacedTrianglePrimitive::SetCacheMemory(size_t(512) << 20);
+}
@@ -0,0 +1,377 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/distributed.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/cpu/integrators.h>
+#include <pbrt/film.h>
+#include <pbrt/options.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef PBRT_IS_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Ws2tcpip.h>
+#include <winsock2.h>
+#undef NOMINMAX
+using socket_t = SOCKET;
+#else
+using socket_t = int;
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define SOCKET_ERROR (-1)
+#define INVALID_SOCKET (-1)
+#endif
+
+namespace pbrt {
+
+// Socket Function Definitions
+static void initSockets() {
+#ifdef PBRT_IS_WINDOWS
+    WSADATA wsaData;
+    int err = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (err != NO_ERROR)
+        ErrorExit("Unable to initialize WinSock: %s", ErrorString(err));
+#else
+    // Lost connections are detected from send()'s return value instead
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+static int closeSocket(socket_t socket) {
+#ifdef PBRT_IS_WINDOWS
+    return closesocket(socket);
+#else
+    return close(socket);
+#endif
+}
+
+// These return false if the connection is lost before all of the bytes have
+// been sent or received.
+static bool sendAll(socket_t socket, const char *data, size_t size) {
+    while (size > 0) {
+        int n = send(socket, data, int(std::min<size_t>(size, 1 << 30)), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool receiveAll(socket_t socket, char *data, size_t size) {
+    while (size > 0) {
+        int n = recv(socket, data, int(std::min<size_t>(size, 1 << 30)), 0);
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Distributed Rendering Message Definitions
+// Each message is a header followed by _size_ bytes of payload. Workers start
+// with a _Hello_ message; the coordinator then sends _Tile_ messages with the
+// bounds of a tile, to which workers reply with a _Result_ message holding the
+// bounds and the tile's pixel values, until it sends _Done_.
+enum class MessageType : uint32_t { Hello, Tile, Result, Done };
+
+struct MessageHeader {
+    MessageType type;
+    uint32_t pad = 0;
+    uint64_t size;
+};
+
+// The _Hello_ message lets the coordinator check that workers have loaded the
+// same scene with the same build of pbrt
+struct HelloMessage {
+    char magic[8] = {'p', 'b', 'r', 't', 'd', 's', 't', '1'};
+    int32_t pixelBounds[4];
+    int32_t samplesPerPixel;
+    int32_t pixelValueBytes;
+};
+
+static HelloMessage makeHello(Bounds2i pixelBounds, int samplesPerPixel) {
+    HelloMessage hello;
+    hello.pixelBounds[0] = pixelBounds.pMin.x;
+    hello.pixelBounds[1] = pixelBounds.pMin.y;
+    hello.pixelBounds[2] = pixelBounds.pMax.x;
+    hello.pixelBounds[3] = pixelBounds.pMax.y;
+    hello.samplesPerPixel = samplesPerPixel;
+    hello.pixelValueBytes = RGBFilm::PixelValueBytes();
+    return hello;
+}
+
+static bool sendMessage(socket_t socket, MessageType type, const char *payload,
+                        size_t size) {
+    MessageHeader header;
+    header.type = type;
+    header.size = size;
+    return sendAll(socket, (const char *)&header, sizeof(header)) &&
+           sendAll(socket, payload, size);
+}
+
+static bool receiveMessage(socket_t socket, MessageType *type, std::string *payload) {
+    MessageHeader header;
+    if (!receiveAll(socket, (char *)&header, sizeof(header)))
+        return false;
+    *type = header.type;
+    payload->resize(header.size);
+    return receiveAll(socket, &(*payload)[0], header.size);
+}
+
+// Returns the film as an _RGBFilm_, which is the only film whose pixel values
+// can be transferred between processes.
+static RGBFilm *distributedFilm(Film film) {
+    RGBFilm *rgbFilm = film.CastOrNullptr<RGBFilm>();
+    if (!rgbFilm || film.StreamingBandHeight() > 0)
+        ErrorExit("Distributed rendering is only supported with a non-streaming "
+                  "\"rgb\" film.");
+    return rgbFilm;
+}
+
+// Distributed Rendering Function Definitions
+void RunDistributedCoordinator(Camera camera, int samplesPerPixel, int port) {
+    Film film = camera.GetFilm();
+    RGBFilm *rgbFilm = distributedFilm(film);
+    Bounds2i pixelBounds = film.PixelBounds();
+    HelloMessage expectedHello = makeHello(pixelBounds, samplesPerPixel);
+
+    // Split the image into tiles that are handed out as workers ask for them
+    constexpr int tileSize = 64;
+    std::deque<Bounds2i> pendingTiles;
+    for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; y += tileSize)
+        for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; x += tileSize)
+            pendingTiles.push_back(Intersect(
+                Bounds2i(Point2i(x, y), Point2i(x + tileSize, y + tileSize)),
+                pixelBounds));
+    size_t nTiles = pendingTiles.size(), nTilesDone = 0;
+    std::mutex tilesMutex;
+    std::condition_variable tilesCondition;
+
+    // Start listening for workers
+    initSockets();
+    struct addrinfo hints = {}, *addrinfo;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    std::string portString = std::to_string(port);
+    if (int err = getaddrinfo(nullptr, portString.c_str(), &hints, &addrinfo); err)
+        ErrorExit("%s", gai_strerror(err));
+    socket_t listenSocket =
+        socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
+    int reuse = 1;
+    if (listenSocket == INVALID_SOCKET ||
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
+                   sizeof(reuse)) == SOCKET_ERROR ||
+        bind(listenSocket, addrinfo->ai_addr, addrinfo->ai_addrlen) == SOCKET_ERROR ||
+        listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+        ErrorExit("Unable to listen for workers on port %d: %s", port, ErrorString());
+    freeaddrinfo(addrinfo);
+    LOG_VERBOSE("Listening for workers on port %d", port);
+
+    ProgressReporter progress(int64_t(samplesPerPixel) * pixelBounds.Area(),
+                              "Rendering", Options->quiet);
+
+    // Hands out tiles to the worker connected to _socket_ and copies their pixel
+    // values into the film until all tiles are done
+    auto serveWorker = [&](socket_t socket) {
+        MessageType type;
+        std::string payload;
+        if (!receiveMessage(socket, &type, &payload) || type != MessageType::Hello ||
+            payload.size() != sizeof(HelloMessage) ||
+            std::memcmp(payload.data(), &expectedHello, sizeof(HelloMessage)) != 0) {
+            Warning("Ignoring a worker whose scene or build of pbrt doesn't match "
+                    "the coordinator's.");
+            closeSocket(socket);
+            return;
+        }
+        LOG_VERBOSE("Worker connected");
+
+        while (true) {
+            // Wait until there's a tile to hand out or all of them are done
+            Bounds2i tile;
+            {
+                std::unique_lock<std::mutex> lock(tilesMutex);
+                tilesCondition.wait(lock, [&]() {
+                    return !pendingTiles.empty() || nTilesDone == nTiles;
+                });
+                if (nTilesDone == nTiles)
+                    break;
+                tile = pendingTiles.front();
+                pendingTiles.pop_front();
+            }
+
+            int32_t bounds[4] = {tile.pMin.x, tile.pMin.y, tile.pMax.x, tile.pMax.y};
+            bool received =
+                sendMessage(socket, MessageType::Tile, (const char *)bounds,
+                            sizeof(bounds)) &&
+                receiveMessage(socket, &type, &payload) &&
+                type == MessageType::Result &&
+                payload.size() ==
+                    sizeof(bounds) + tile.Area() * RGBFilm::PixelValueBytes() &&
+                std::memcmp(payload.data(), bounds, sizeof(bounds)) == 0;
+            if (!received) {
+                // Give the tile to another worker
+                Warning("Lost connection to a worker; its tile will be rendered by "
+                        "another one.");
+                std::lock_guard<std::mutex> lock(tilesMutex);
+                pendingTiles.push_back(tile);
+                tilesCondition.notify_all();
+                closeSocket(socket);
+                return;
+            }
+
+            // Tiles don't overlap, so their pixels can be copied concurrently
+            rgbFilm->CopyPixelValuesIn(tile, payload.data() + sizeof(bounds));
+            progress.Update(int64_t(samplesPerPixel) * tile.Area());
+            std::lock_guard<std::mutex> lock(tilesMutex);
+            if (++nTilesDone == nTiles)
+                tilesCondition.notify_all();
+        }
+        sendMessage(socket, MessageType::Done, nullptr, 0);
+        closeSocket(socket);
+    };
+
+    // Accept workers until all tiles are done, serving each one in its own
+    // thread; the listening socket is polled so that the thread can notice
+    // when rendering has finished.
+    std::atomic<bool> finished{false};
+    std::vector<std::thread> workerThreads;
+    std::thread acceptThread([&]() {
+        while (!finished) {
+            fd_set readSet;
+            FD_ZERO(&readSet);
+            FD_SET(listenSocket, &readSet);
+            struct timeval timeout = {0, 250000};
+            if (select(int(listenSocket + 1), &readSet, nullptr, nullptr, &timeout) <= 0)
+                continue;
+            socket_t socket = accept(listenSocket, nullptr, nullptr);
+            if (socket != INVALID_SOCKET)
+                workerThreads.push_back(std::thread(serveWorker, socket));
+        }
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(tilesMutex);
+        tilesCondition.wait(lock, [&]() { return nTilesDone == nTiles; });
+    }
+    finished = true;
+    acceptThread.join();
+    for (std::thread &thread : workerThreads)
+        thread.join();
+    closeSocket(listenSocket);
+    progress.Done();
+
+    ImageMetadata metadata;
+    metadata.renderTimeSeconds = progress.ElapsedSeconds();
+    metadata.samplesPerPixel = samplesPerPixel;
+    camera.InitMetadata(&metadata);
+    film.WriteImage(metadata, 1.0f / samplesPerPixel);
+}
+
+void RunDistributedWorker(Integrator *integrator, Camera camera, int samplesPerPixel,
+                          const std::string &address) {
+    // Check that the integrator and film support rendering tiles independently
+    ImageTileIntegrator *tileIntegrator = dynamic_cast<ImageTileIntegrator *>(integrator);
+    if (!tileIntegrator || tileIntegrator->AddsSplats())
+        ErrorExit("Distributed rendering isn't supported by the integrator since it "
+                  "doesn't render image tiles independently.");
+    Film film = camera.GetFilm();
+    RGBFilm *rgbFilm = distributedFilm(film);
+
+    // Connect to the coordinator, which may not have started listening yet
+    size_t split = address.find_last_of(':');
+    if (split == std::string::npos)
+        ErrorExit("Expected \"host:port\" for coordinator address. Given \"%s\".",
+                  address);
+    std::string host = address.substr(0, split), port = address.substr(split + 1);
+    initSockets();
+    socket_t socket = INVALID_SOCKET;
+    for (int attempt = 0; attempt < 60 && socket == INVALID_SOCKET; ++attempt) {
+        if (attempt > 0)
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        struct addrinfo hints = {}, *addrinfo;
+        hints.ai_family = PF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrinfo); err)
+            ErrorExit("%s: %s", address, gai_strerror(err));
+        for (struct addrinfo *ptr = addrinfo; ptr; ptr = ptr->ai_next) {
+            socket = ::socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+            if (socket == INVALID_SOCKET)
+                continue;
+            if (connect(socket, ptr->ai_addr, ptr->ai_addrlen) != SOCKET_ERROR)
+                break;
+            closeSocket(socket);
+            socket = INVALID_SOCKET;
+        }
+        freeaddrinfo(addrinfo);
+    }
+    if (socket == INVALID_SOCKET)
+        ErrorExit("%s: unable to connect to coordinator.", address);
+    HelloMessage hello = makeHello(film.PixelBounds(), samplesPerPixel);
+    if (!sendMessage(socket, MessageType::Hello, (const char *)&hello, sizeof(hello)))
+        ErrorExit("%s: lost connection to coordinator.", address);
+    LOG_VERBOSE("Connected to coordinator %s", address);
+
+    // Render tiles until the coordinator is done, sending each one's pixel
+    // values before asking for the next
+    pstd::optional<Bounds2i> tile;
+    int nTilesRendered = 0;
+    tileIntegrator->RenderTiles([&]() -> pstd::optional<Bounds2i> {
+        if (tile) {
+            std::string result(sizeof(int32_t) * 4 +
+                                   tile->Area() * RGBFilm::PixelValueBytes(),
+                               '\0');
+            int32_t bounds[4] = {tile->pMin.x, tile->pMin.y, tile->pMax.x,
+                                 tile->pMax.y};
+            std::memcpy(&result[0], bounds, sizeof(bounds));
+            rgbFilm->CopyPixelValuesOut(*tile, &result[sizeof(bounds)]);
+            if (!sendMessage(socket, MessageType::Result, result.data(), result.size()))
+                ErrorExit("%s: lost connection to coordinator.", address);
+            ++nTilesRendered;
+        }
+
+        MessageType type;
+        std::string payload;
+        if (!receiveMessage(socket, &type, &payload))
+            ErrorExit("%s: lost connection to coordinator.", address);
+        if (type == MessageType::Done)
+            return {};
+        int32_t bounds[4];
+        if (type != MessageType::Tile || payload.size() != sizeof(bounds))
+            ErrorExit("%s: unexpected message from coordinator.", address);
+        std::memcpy(bounds, payload.data(), sizeof(bounds));
+        tile = Bounds2i(Point2i(bounds[0], bounds[1]), Point2i(bounds[2], bounds[3]));
+        if (Intersect(*tile, film.PixelBounds()) != *tile)
+            ErrorExit("%s: coordinator sent tile %s outside of the film.", address,
+                      *tile);
+        return tile;
+    });
+
+    closeSocket(socket);
+    LOG_VERBOSE("Rendered %d tiles for coordinator %s", nTilesRendered, address);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,37 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_DISTRIBUTED_H
+#define PBRT_CPU_DISTRIBUTED_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/base/camera.h>
+
+#include <string>
+
+namespace pbrt {
+
+class Integrator;
+
+// In a distributed render, a coordinator process hands out tiles of the image
+// over TCP to worker processes that have each loaded the scene once. Workers
+// send back the accumulated values of their tiles' pixels, which the
+// coordinator copies into its film, so that the final image is the same as
+// one rendered by a single process. Tiles are handed out as workers finish
+// their previous ones, and a tile is handed out again if its worker's
+// connection is lost. All processes must run the same build of pbrt.
+
+// Distributed Rendering Declarations
+// Listens for workers on _port_, hands out tiles until all of them have been
+// rendered, and writes the film's image.
+void RunDistributedCoordinator(Camera camera, int samplesPerPixel, int port);
+// Connects to the coordinator at _address_, given as "host:port", and renders
+// the tiles it hands out with _integrator_.
+void RunDistributedWorker(Integrator *integrator, Camera camera, int samplesPerPixel,
+                          const std::string &address);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_DISTRIBUTED_H
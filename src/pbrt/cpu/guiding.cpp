@@ -0,0 +1,260 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/guiding.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace pbrt {
+
+STAT_PERCENT("Integrator/Guided BSDF samples", nGuidedBSDFSamples, nBSDFSamples);
+STAT_COUNTER("Path guiding/Spatial regions", nGuidingRegions);
+STAT_INT_DISTRIBUTION("Path guiding/Quadtree nodes", quadtreeNodes);
+
+// GuidingQuadtree Method Definitions
+GuidingQuadtree::GuidingQuadtree() : nodes(1), recordTopology(1), recordSums(4) {}
+
+GuidingQuadtree::GuidingQuadtree(const GuidingQuadtree &tree)
+    : nodes(tree.nodes),
+      total(tree.total),
+      incidentRadiance(tree.incidentRadiance),
+      recordTopology(tree.recordTopology),
+      recordSums(tree.recordSums.size()),
+      nRecords(tree.RecordCount()) {
+    for (size_t i = 0; i < recordSums.size(); ++i)
+        recordSums[i] = float(tree.recordSums[i]);
+}
+
+Vector3f GuidingQuadtree::Sample(Point2f u, Float *pdf) const {
+    // Descend the quadtree, choosing quadrants in proportion to their radiance
+    Point2f pMin(0, 0);
+    Float extent = 1, density = 1;
+    int node = 0;
+    while (true) {
+        const Node &n = nodes[node];
+        // Choose column of quadrants using _u[0]_ and remap it
+        Float sum = n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+        Float pLeft = (n.sum[0] + n.sum[2]) / sum;
+        int qx = u[0] >= pLeft;
+        u[0] = qx ? (u[0] - pLeft) / (1 - pLeft) : u[0] / pLeft;
+        // Choose quadrant in the column using _u[1]_ and remap it
+        Float pBottom = n.sum[qx] / (n.sum[qx] + n.sum[qx + 2]);
+        int qy = u[1] >= pBottom;
+        u[1] = qy ? (u[1] - pBottom) / (1 - pBottom) : u[1] / pBottom;
+        u = Point2f(std::min<Float>(u[0], OneMinusEpsilon),
+                    std::min<Float>(u[1], OneMinusEpsilon));
+
+        // Account for quadrant in the sample's density and continue to its child
+        int q = qx + 2 * qy;
+        density *= 4 * n.sum[q] / sum;
+        extent /= 2;
+        pMin += Vector2f(qx * extent, qy * extent);
+        if (!n.child[q])
+            break;
+        node = n.child[q];
+    }
+    // The cylindrical mapping is area-preserving up to a factor of $4\pi$
+    *pdf = density * Inv4Pi;
+    return SquareToDirection(pMin + extent * Vector2f(u));
+}
+
+Float GuidingQuadtree::PDF(Vector3f w) const {
+    if (!HasDistribution())
+        return 0;
+    Point2f p = DirectionToSquare(w);
+    Float density = 1;
+    int node = 0;
+    while (true) {
+        const Node &n = nodes[node];
+        Float sum = n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+        int q = Quadrant(&p);
+        if (n.sum[q] == 0)
+            return 0;
+        density *= 4 * n.sum[q] / sum;
+        if (!n.child[q])
+            break;
+        node = n.child[q];
+    }
+    return density * Inv4Pi;
+}
+
+void GuidingQuadtree::Record(Vector3f w, Float radiance) {
+    if (!(radiance > 0) || IsInf(radiance))
+        return;
+    // Add _radiance_ to the quadrant containing _w_ at each level of the tree
+    Point2f p = DirectionToSquare(w);
+    int node = 0;
+    while (true) {
+        int q = Quadrant(&p);
+        recordSums[4 * node + q].Add(radiance);
+        if (!recordTopology[node][q])
+            break;
+        node = recordTopology[node][q];
+    }
+}
+
+void GuidingQuadtree::Update(Float subdivisionThreshold, int maxDepth) {
+    Float recordedTotal = recordSums[0] + recordSums[1] + recordSums[2] + recordSums[3];
+    if (recordedTotal > 0) {
+        // Make the recorded radiance the distribution that is sampled
+        nodes.resize(recordTopology.size());
+        for (size_t i = 0; i < nodes.size(); ++i)
+            for (int q = 0; q < 4; ++q) {
+                nodes[i].sum[q] = recordSums[4 * i + q];
+                nodes[i].child[q] = recordTopology[i][q];
+            }
+        total = recordedTotal;
+        incidentRadiance = total / std::max(RecordCount(), 1);
+
+        // Subdivide quadrants with more than _subdivisionThreshold_ of the radiance
+        recordTopology.assign(1, {0, 0, 0, 0});
+        Refine(0, 0, nodes[0].sum, 1, subdivisionThreshold * total, maxDepth);
+        recordSums = std::vector<AtomicFloat>(4 * recordTopology.size());
+    }
+    // Keep the previous distribution if nothing was recorded
+    nRecords = 0;
+    quadtreeNodes << recordTopology.size();
+}
+
+void GuidingQuadtree::Refine(int node, int samplingNode, const Float sums[4], int depth,
+                             Float threshold, int maxDepth) {
+    for (int q = 0; q < 4; ++q) {
+        if (sums[q] <= threshold || depth >= maxDepth)
+            continue;
+        // Add a child for quadrant _q_ and refine it in turn
+        int child = recordTopology.size();
+        recordTopology.push_back({0, 0, 0, 0});
+        recordTopology[node][q] = child;
+        // Use the quadrant's learned child if it has one and split its radiance
+        // evenly otherwise
+        int samplingChild = samplingNode >= 0 ? nodes[samplingNode].child[q] : 0;
+        Float childSums[4];
+        for (int c = 0; c < 4; ++c)
+            childSums[c] = samplingChild ? nodes[samplingChild].sum[c] : sums[q] / 4;
+        Refine(child, samplingChild ? samplingChild : -1, childSums, depth + 1,
+               threshold, maxDepth);
+    }
+}
+
+// GuidedBSDF Method Definitions
+pstd::optional<BSDFSample> GuidedBSDF::Sample_f(Vector3f wo, Float u, Point2f u2) const {
+    if (!quadtree)
+        return bsdf->Sample_f(wo, u, u2);
+    ++nBSDFSamples;
+    if (u < GuidedFraction) {
+        // Sample direction from the learned incident radiance
+        ++nGuidedBSDFSamples;
+        Float guidePDF;
+        Vector3f wi = quadtree->Sample(u2, &guidePDF);
+        SampledSpectrum f = bsdf->f(wo, wi);
+        if (!f)
+            return {};
+        Float pdf = GuidedFraction * guidePDF + (1 - GuidedFraction) * bsdf->PDF(wo, wi);
+        return BSDFSample(f, wi, pdf, bsdf->Flags());
+    }
+    // Sample the BSDF, remapping _u_, and use the PDF of the mixture
+    pstd::optional<BSDFSample> bs = bsdf->Sample_f(
+        wo, std::min<Float>((u - GuidedFraction) / (1 - GuidedFraction), OneMinusEpsilon),
+        u2);
+    if (!bs)
+        return {};
+    if (bs->pdfIsProportional) {
+        // Evaluate the BSDF and its PDF for the sampled direction
+        bs->f = bsdf->f(wo, bs->wi);
+        bs->pdf = bsdf->PDF(wo, bs->wi);
+        bs->pdfIsProportional = false;
+    }
+    bs->pdf = GuidedFraction * quadtree->PDF(bs->wi) + (1 - GuidedFraction) * bs->pdf;
+    return bs;
+}
+
+Float GuidedBSDF::PDF(Vector3f wo, Vector3f wi) const {
+    if (!quadtree)
+        return bsdf->PDF(wo, wi);
+    return GuidedFraction * quadtree->PDF(wi) + (1 - GuidedFraction) * bsdf->PDF(wo, wi);
+}
+
+Float GuidedBSDF::ReflectedRadiance(Vector3f wo) const {
+    if (!quadtree)
+        return 0;
+    // Average the BSDF over directions distributed like the incident radiance
+    const Point2f u[4] = {Point2f(0.25f, 0.25f), Point2f(0.75f, 0.25f),
+                          Point2f(0.25f, 0.75f), Point2f(0.75f, 0.75f)};
+    Float sum = 0;
+    for (Point2f ui : u) {
+        Float pdf;
+        Vector3f wi = quadtree->Sample(ui, &pdf);
+        sum += bsdf->f(wo, wi).Average() * AbsCosTheta(bsdf->RenderToLocal(wi));
+    }
+    return quadtree->IncidentRadiance() * sum / 4;
+}
+
+// GuidingSDTree Method Definitions
+GuidingSDTree::GuidingSDTree(const Bounds3f &sceneBounds) : nodes(1) {
+    // Make the tree's bounds a cube so that regions stay roughly cubical
+    Float extent = MaxComponentValue(sceneBounds.Diagonal());
+    bounds = Bounds3f(sceneBounds.pMin,
+                      sceneBounds.pMin + Vector3f(extent, extent, extent));
+    quadtrees.push_back(std::make_unique<GuidingQuadtree>());
+}
+
+void GuidingSDTree::StartIteration(int samplesPerPixel) {
+    if (iterationSamplesPerPixel > 0) {
+        // Split regions that received many records in the previous iteration
+        int maxRecords = int(12000 * std::sqrt(Float(iterationSamplesPerPixel)));
+        Subdivide(0, bounds, 0, maxRecords);
+
+        // Update the regions' directional distributions in parallel
+        ParallelFor(0, quadtrees.size(),
+                    [&](int64_t i) { quadtrees[i]->Update(0.01f, 20); });
+    }
+    iterationSamplesPerPixel = samplesPerPixel;
+}
+
+void GuidingSDTree::Subdivide(int node, const Bounds3f &nodeBounds, int depth,
+                              int maxRecords) {
+    if (!nodes[node].child[0]) {
+        GuidingQuadtree *quadtree = quadtrees[nodes[node].quadtree].get();
+        if (quadtree->RecordCount() <= maxRecords || depth >= MaxDepth)
+            return;
+        // Split the region in half, giving each half a copy of its quadtree
+        ++nGuidingRegions;
+        quadtree->HalveRecordCount();
+        int axis = depth % 3;
+        nodes[node].axis = axis;
+        nodes[node].split = (nodeBounds.pMin[axis] + nodeBounds.pMax[axis]) / 2;
+        for (int side = 0; side < 2; ++side) {
+            Node child;
+            child.quadtree = side == 0 ? nodes[node].quadtree : int(quadtrees.size());
+            if (side == 1)
+                quadtrees.push_back(std::make_unique<GuidingQuadtree>(*quadtree));
+            nodes[node].child[side] = nodes.size();
+            nodes.push_back(child);
+        }
+    }
+    // Subdivide the node's children in turn
+    for (int side = 0; side < 2; ++side) {
+        Bounds3f childBounds = nodeBounds;
+        int axis = nodes[node].axis;
+        if (side == 0)
+            childBounds.pMax[axis] = nodes[node].split;
+        else
+            childBounds.pMin[axis] = nodes[node].split;
+        Subdivide(nodes[node].child[side], childBounds, depth + 1, maxRecords);
+    }
+}
+
+std::string GuidingSDTree::ToString() const {
+    return StringPrintf("[ GuidingSDTree bounds: %s nodes: %d regions: %d "
+                        "iterationSamplesPerPixel: %d ]",
+                        bounds, nodes.size(), quadtrees.size(), iterationSamplesPerPixel);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,209 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_GUIDING_H
+#define PBRT_CPU_GUIDING_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/bsdf.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// GuidingQuadtree Definition
+// Approximates the distribution of radiance arriving at a region of space with a
+// quadtree over the cylindrical mapping of directions to $[0,1]^2$. Rendering
+// samples from the distribution that was learned in the previous iteration while
+// recording new estimates into a second tree, whose topology is refined from the
+// learned distribution between iterations.
+class GuidingQuadtree {
+  public:
+    // GuidingQuadtree Public Methods
+    GuidingQuadtree();
+    GuidingQuadtree(const GuidingQuadtree &tree);
+
+    bool HasDistribution() const { return total > 0; }
+    Vector3f Sample(Point2f u, Float *pdf) const;
+    Float PDF(Vector3f w) const;
+    // Returns the learned estimate of incident radiance integrated over the sphere
+    Float IncidentRadiance() const { return incidentRadiance; }
+
+    void Record(Vector3f w, Float radiance);
+    // Path vertices are counted separately from records since a vertex's
+    // estimate may be made of several records, e.g. with MIS
+    void CountVertex() { nRecords.fetch_add(1, std::memory_order_relaxed); }
+    int RecordCount() const { return nRecords.load(std::memory_order_relaxed); }
+    void HalveRecordCount() { nRecords = RecordCount() / 2; }
+    void Update(Float subdivisionThreshold, int maxDepth);
+
+    size_t NodeCount() const { return recordTopology.size(); }
+
+    static Point2f DirectionToSquare(Vector3f w) {
+        return Point2f(Clamp((w.z + 1) / 2, 0, OneMinusEpsilon),
+                       Clamp(SphericalPhi(w) * Inv2Pi, 0, OneMinusEpsilon));
+    }
+    static Vector3f SquareToDirection(Point2f p) {
+        Float cosTheta = 2 * p[0] - 1;
+        return SphericalDirection(SafeSqrt(1 - Sqr(cosTheta)), cosTheta, 2 * Pi * p[1]);
+    }
+
+  private:
+    // GuidingQuadtree Private Members
+    // Nodes' quadrants are ordered with $x$ varying fastest; a child index of 0
+    // marks a leaf quadrant since the root can't be a child
+    struct Node {
+        Float sum[4] = {0, 0, 0, 0};
+        int child[4] = {0, 0, 0, 0};
+    };
+    std::vector<Node> nodes;
+    Float total = 0, incidentRadiance = 0;
+    std::vector<std::array<int, 4>> recordTopology;
+    std::vector<AtomicFloat> recordSums;
+    std::atomic<int> nRecords{0};
+
+    // GuidingQuadtree Private Methods
+    static int Quadrant(Point2f *p) {
+        // Return quadrant of _p_ and remap _p_ to the quadrant's extent
+        int qx = (*p)[0] >= 0.5f, qy = (*p)[1] >= 0.5f;
+        *p = Point2f(std::min<Float>(2 * (*p)[0] - qx, OneMinusEpsilon),
+                     std::min<Float>(2 * (*p)[1] - qy, OneMinusEpsilon));
+        return qx + 2 * qy;
+    }
+
+    void Refine(int node, int samplingNode, const Float sums[4], int depth,
+                Float threshold, int maxDepth);
+};
+
+// GuidedBSDF Definition
+// Samples directions at a surface vertex from an equal mixture of its BSDF and the
+// incident radiance learned by a _GuidingQuadtree_; without a quadtree, it is
+// equivalent to the BSDF.
+class GuidedBSDF {
+  public:
+    // GuidedBSDF Public Methods
+    GuidedBSDF(const BSDF *bsdf, const GuidingQuadtree *quadtree = nullptr)
+        : bsdf(bsdf), quadtree(quadtree) {}
+
+    pstd::optional<BSDFSample> Sample_f(Vector3f wo, Float u, Point2f u2) const;
+    Float PDF(Vector3f wo, Vector3f wi) const;
+    Float ReflectedRadiance(Vector3f wo) const;
+
+    // GuidedBSDF Public Members
+    // Fraction of the probability of each direction that comes from the quadtree
+    static constexpr Float GuidedFraction = 0.5f;
+
+  private:
+    // GuidedBSDF Private Members
+    const BSDF *bsdf;
+    const GuidingQuadtree *quadtree;
+};
+
+// GuidingSDTree Definition
+// Spatial-directional tree for path guiding at surfaces, following "Practical Path
+// Guiding" by M\"uller et al.: a binary tree subdivides the scene's bounds into
+// regions that each hold a _GuidingQuadtree_. Training happens over iterations of
+// doubling sample counts; between iterations, regions that received many records
+// are split and the directional distributions are updated.
+class GuidingSDTree {
+  public:
+    // GuidingSDTree Public Methods
+    GuidingSDTree(const Bounds3f &bounds);
+
+    static bool CanGuide(BxDFFlags flags) {
+        // Directions sampled from the quadtree can't follow specular lobes, and
+        // _GuidedBSDF_ can't find the relative IOR of transmitted directions
+        return IsNonSpecular(flags) && !IsSpecular(flags) && !IsTransmissive(flags);
+    }
+
+    const GuidingQuadtree *Lookup(Point3f p, const BSDF &bsdf) const {
+        if (!CanGuide(bsdf.Flags()))
+            return nullptr;
+        const GuidingQuadtree *quadtree = quadtrees[Leaf(p)].get();
+        return quadtree->HasDistribution() ? quadtree : nullptr;
+    }
+
+    void Record(Point3f p, Vector3f wi, Float radiance) {
+        quadtrees[Leaf(p)]->Record(wi, radiance);
+    }
+    void RecordVertex(Point3f p, Vector3f wi, Float radiance) {
+        GuidingQuadtree *quadtree = quadtrees[Leaf(p)].get();
+        quadtree->CountVertex();
+        quadtree->Record(wi, radiance);
+    }
+
+    void StartIteration(int samplesPerPixel);
+
+    std::string ToString() const;
+
+  private:
+    // GuidingSDTree Private Members
+    struct Node {
+        int child[2] = {0, 0};
+        int quadtree = 0;
+        int axis = 0;
+        Float split = 0;
+    };
+    static constexpr int MaxDepth = 48;
+    Bounds3f bounds;
+    std::vector<Node> nodes;
+    std::vector<std::unique_ptr<GuidingQuadtree>> quadtrees;
+    int iterationSamplesPerPixel = 0;
+
+    // GuidingSDTree Private Methods
+    int Leaf(Point3f p) const {
+        // Descend to the leaf node whose region contains _p_
+        int node = 0;
+        while (nodes[node].child[0])
+            node = nodes[node].child[p[nodes[node].axis] >= nodes[node].split];
+        return nodes[node].quadtree;
+    }
+
+    void Subdivide(int node, const Bounds3f &nodeBounds, int depth, int maxRecords);
+};
+
+// AdjointWeightWindow Definition
+// Adjoint-driven Russian roulette and splitting, following Vorba and K\v{r}iv\'anek
+// 2016: paths whose expected contribution, estimated from learned incident
+// radiance, is far below the estimate for the whole path are terminated with
+// Russian roulette and ones far above it are split, so that the contributions of
+// the continuing paths stay within a window around that estimate.
+struct AdjointWeightWindow {
+    // AdjointWeightWindow Public Methods
+    // Both methods take the expected contribution of continuing a path from a
+    // vertex relative to the path's estimate.
+    static Float ContinueProbability(Float ratio) {
+        // Bring contributions up to the window's center, but don't continue so
+        // rarely that surviving paths become fireflies
+        if (!(ratio > 0) || ratio >= Min)
+            return 1;
+        return std::max(ratio, MinContinueProbability);
+    }
+
+    static int Splits(Float ratio, int maxSplits = MaxSplits) {
+        if (!(ratio > Max) || IsInf(ratio))
+            return 1;
+        return std::min<int>(std::ceil(ratio), maxSplits);
+    }
+
+    // AdjointWeightWindow Public Members
+    // Bounds of a window with a ratio of 5 between its ends and centered at 1
+    static constexpr Float Min = 1.f / 3.f, Max = 5.f / 3.f;
+    static constexpr Float MinContinueProbability = 0.05f;
+    static constexpr int MaxSplits = 8;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_GUIDING_H
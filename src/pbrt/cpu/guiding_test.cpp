@@ -0,0 +1,133 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/bsdf.h>
+#include <pbrt/bxdfs.h>
+#include <pbrt/cpu/guiding.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+
+using namespace pbrt;
+
+// Records radiance arriving from around _w_ along with a little from everywhere
+// for _nVertices_ path vertices.
+static void RecordAround(GuidingQuadtree &quadtree, Vector3f w, int nVertices, RNG &rng) {
+    for (int i = 0; i < nVertices; ++i) {
+        quadtree.CountVertex();
+        Vector3f wr = Normalize(w + 0.05f * Vector3f(rng.Uniform<Float>(),
+                                                     rng.Uniform<Float>(),
+                                                     rng.Uniform<Float>()));
+        quadtree.Record(wr, 1);
+        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+        quadtree.Record(SampleUniformSphere(u), 0.01f);
+    }
+}
+
+TEST(GuidingQuadtree, LearnsIncidentRadiance) {
+    GuidingQuadtree quadtree;
+    EXPECT_FALSE(quadtree.HasDistribution());
+    Vector3f wLight = Normalize(Vector3f(-0.3f, 0.4f, 0.8f));
+    RNG rng;
+    // Train over a few iterations so that the quadtree is refined around the light
+    for (int iter = 0; iter < 4; ++iter) {
+        RecordAround(quadtree, wLight, 4096, rng);
+        quadtree.Update(0.01f, 20);
+    }
+    ASSERT_TRUE(quadtree.HasDistribution());
+    EXPECT_GT(quadtree.NodeCount(), 4);
+    EXPECT_GT(quadtree.PDF(wLight), 50 * UniformSpherePDF());
+    EXPECT_NEAR(1.01f, quadtree.IncidentRadiance(), 1e-3f);
+
+    // The PDF is normalized
+    Float sum = 0;
+    int sqrtSamples = 256;
+    for (Point2f u : Stratified2D(sqrtSamples, sqrtSamples))
+        sum += quadtree.PDF(SampleUniformSphere(u)) / UniformSpherePDF();
+    EXPECT_NEAR(1, sum / Sqr(sqrtSamples), 3e-2);
+
+    // Samples have consistent PDFs and most of them go toward the light
+    int nTowardLight = 0, nSamples = 1024;
+    for (Point2f u : Stratified2D(32, 32)) {
+        Float pdf;
+        Vector3f w = quadtree.Sample(u, &pdf);
+        EXPECT_NEAR(1, Length(w), 1e-4f);
+        EXPECT_NEAR(pdf, quadtree.PDF(w), 1e-3f * pdf);
+        if (Dot(w, wLight) > 0.95f)
+            ++nTowardLight;
+    }
+    EXPECT_GT(nTowardLight, nSamples * 3 / 4);
+}
+
+TEST(GuidingSDTree, SplitsRegions) {
+    GuidingSDTree sdTree(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)));
+    DiffuseBxDF diffuse(SampledSpectrum(0.5f));
+    BSDF bsdf(Normal3f(0, 0, 1), Vector3f(1, 0, 0), &diffuse);
+    Point3f p0(0.1f, 0.5f, 0.5f), p1(0.9f, 0.5f, 0.5f);
+    Vector3f w0 = Normalize(Vector3f(1, 0, 1)), w1 = Normalize(Vector3f(-1, 0, 1));
+
+    // Nothing is guided before the first update
+    sdTree.StartIteration(1);
+    EXPECT_EQ(nullptr, sdTree.Lookup(p0, bsdf));
+
+    // With enough records, the two halves of the scene learn their own distributions
+    RNG rng;
+    auto jitter = [&](Vector3f w) {
+        return Normalize(w + 0.05f * Vector3f(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                                              rng.Uniform<Float>()));
+    };
+    for (int iter = 0; iter < 2; ++iter) {
+        for (int i = 0; i < 20000; ++i) {
+            sdTree.RecordVertex(p0, jitter(w0), 1);
+            sdTree.RecordVertex(p1, jitter(w1), 1);
+        }
+        sdTree.StartIteration(1);
+    }
+    const GuidingQuadtree *q0 = sdTree.Lookup(p0, bsdf);
+    const GuidingQuadtree *q1 = sdTree.Lookup(p1, bsdf);
+    ASSERT_TRUE(q0 != nullptr && q1 != nullptr);
+    EXPECT_NE(q0, q1);
+    Vector3f offset(0.025f, 0.025f, 0.025f);
+    Vector3f wc0 = Normalize(w0 + offset), wc1 = Normalize(w1 + offset);
+    EXPECT_GT(q0->PDF(wc0), 10 * q0->PDF(wc1));
+    EXPECT_GT(q1->PDF(wc1), 10 * q1->PDF(wc0));
+
+    // Guided BSDF samples have the PDF of the mixture
+    GuidedBSDF guided(&bsdf, q0);
+    Vector3f wo(0, 0, 1);
+    for (int i = 0; i < 64; ++i) {
+        Float uc = rng.Uniform<Float>();
+        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+        pstd::optional<BSDFSample> bs = guided.Sample_f(wo, uc, u);
+        if (!bs)
+            continue;
+        EXPECT_FALSE(bs->pdfIsProportional);
+        EXPECT_NEAR(bs->pdf, guided.PDF(wo, bs->wi), 1e-3f * bs->pdf);
+    }
+}
+
+TEST(AdjointWeightWindow, Continuations) {
+    // Contributions inside the window are left alone
+    EXPECT_EQ(1, AdjointWeightWindow::ContinueProbability(1));
+    EXPECT_EQ(1, AdjointWeightWindow::Splits(1));
+    EXPECT_EQ(1, AdjointWeightWindow::ContinueProbability(0.4f));
+    EXPECT_EQ(1, AdjointWeightWindow::Splits(1.6f));
+
+    // Low contributions are brought to the window's center by Russian roulette
+    EXPECT_FLOAT_EQ(0.2f, AdjointWeightWindow::ContinueProbability(0.2f));
+    EXPECT_FLOAT_EQ(AdjointWeightWindow::MinContinueProbability,
+                    AdjointWeightWindow::ContinueProbability(1e-4f));
+
+    // High contributions are split, up to a limit
+    EXPECT_EQ(3, AdjointWeightWindow::Splits(2.5f));
+    EXPECT_EQ(AdjointWeightWindow::MaxSplits, AdjointWeightWindow::Splits(1000));
+    EXPECT_EQ(1, AdjointWeightWindow::Splits(1000, 1));
+
+    // Missing estimates don't affect paths
+    EXPECT_EQ(1, AdjointWeightWindow::ContinueProbability(0));
+    EXPECT_EQ(1, AdjointWeightWindow::Splits(Infinity));
+}
@@ -7,6 +7,10 @@
 #include <pbrt/bsdf.h>
 #include <pbrt/bssrdf.h>
 #include <pbrt/cameras.h>
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/guiding.h>
+#include <pbrt/cpu/irradiancecache.h>
+#include <pbrt/cpu/traversalbench.h>
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
 #include <pbrt/interaction.h>
@@ -39,10 +43,106 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 
 namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Intersections/Regular ray intersection tests", nIntersectionTests);
+STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
+STAT_COUNTER("Integrator/Pixel samples skipped by adaptive sampling",
+             nAdaptiveSkippedSamples);
+
+// Reports the outcome of a light sample to light samplers that learn from them
+static void RecordLightSample(LightSampler lightSampler, const LightSampleContext &ctx,
+                              Light light, Float contribution) {
+    if (BVHLightSampler *bvhSampler = lightSampler.CastOrNullptr<BVHLightSampler>())
+        bvhSampler->RecordSample(ctx, light, contribution);
+}
+
+STAT_COUNTER("Integrator/Area lights culled from light sampling", nCulledAreaLights);
+
+// Removes area lights whose share of the light importance at all points in a coarse
+// sampling of those that the camera sees, directly and after one bounce, is less
+// than _threshold_. Culled lights still emit; they are only found by BSDF
+// sampling, which light sampler PDFs of zero account for.
+static std::vector<Light> CullAreaLights(std::vector<Light> lights, Camera camera,
+                                         Primitive aggregate, Float threshold,
+                                         const std::string &lightStrategy) {
+    if (threshold <= 0)
+        return lights;
+    if (lightStrategy == "uniform") {
+        Warning("Light culling isn't supported with the \"uniform\" light sampler.");
+        return lights;
+    }
+
+    // Find a coarse set of points visible from the camera
+    constexpr int gridRes = 16;
+    Film film = camera.GetFilm();
+    Bounds2f pixelBounds(film.PixelBounds());
+    SampledWavelengths lambda = film.SampleWavelengths(0.5f);
+    RNG rng;
+    std::vector<LightSampleContext> points;
+    for (int y = 0; y < gridRes; ++y)
+        for (int x = 0; x < gridRes; ++x) {
+            CameraSample cameraSample;
+            cameraSample.pFilm =
+                pixelBounds.Lerp(Point2f((x + 0.5f) / gridRes, (y + 0.5f) / gridRes));
+            cameraSample.pLens = Point2f(0.5f, 0.5f);
+            cameraSample.time = 0.5f;
+            pstd::optional<CameraRay> cameraRay =
+                camera.GenerateRay(cameraSample, lambda);
+            if (!cameraRay)
+                continue;
+            pstd::optional<ShapeIntersection> si =
+                aggregate.Intersect(cameraRay->ray, Infinity);
+            if (!si)
+                continue;
+            points.push_back(LightSampleContext(si->intr));
+
+            // Follow a cosine-distributed bounce to find an indirectly-lit point
+            Normal3f n = FaceForward(si->intr.n, si->intr.wo);
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Vector3f wi = Frame::FromZ(Vector3f(n)).FromLocal(SampleCosineHemisphere(u));
+            si = aggregate.Intersect(si->intr.SpawnRay(wi), Infinity);
+            if (si)
+                points.push_back(LightSampleContext(si->intr));
+        }
+    if (points.empty())
+        return lights;
+
+    // Compute total light importance at each point
+    std::vector<pstd::optional<LightBounds>> lightBounds(lights.size());
+    ParallelFor(0, lights.size(),
+                [&](int64_t i) { lightBounds[i] = lights[i].Bounds(); });
+    std::vector<Float> totalImportance(points.size(), Float(0));
+    ParallelFor(0, points.size(), [&](int64_t j) {
+        for (const pstd::optional<LightBounds> &lb : lightBounds)
+            if (lb)
+                totalImportance[j] += lb->Importance(points[j].p(), points[j].n);
+    });
+
+    // Keep area lights whose largest share of the importance meets _threshold_
+    std::vector<uint8_t> keep(lights.size(), 1);
+    ParallelFor(0, lights.size(), [&](int64_t i) {
+        if (lights[i].Type() != LightType::Area || !lightBounds[i])
+            return;
+        for (size_t j = 0; j < points.size(); ++j)
+            if (totalImportance[j] > 0 &&
+                lightBounds[i]->Importance(points[j].p(), points[j].n) >=
+                    threshold * totalImportance[j])
+                return;
+        keep[i] = 0;
+    });
+    std::vector<Light> keptLights;
+    for (size_t i = 0; i < lights.size(); ++i)
+        if (keep[i])
+            keptLights.push_back(lights[i]);
+    nCulledAreaLights += lights.size() - keptLights.size();
+    LOG_VERBOSE("Culled %d of %d lights from light sampling",
+                lights.size() - keptLights.size(), lights.size());
+    return keptLights;
+}
 
 // RandomWalkIntegrator Method Definitions
 std::unique_ptr<RandomWalkIntegrator> RandomWalkIntegrator::Create(
@@ -60,6 +160,50 @@ std::string RandomWalkIntegrator::ToString() const {
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
+// ConvergenceEstimate Definition
+struct ConvergenceEstimate {
+    int64_t nPixels = 0;
+    Float relMSE = Infinity, medianRelError = Infinity, p95RelError = Infinity;
+};
+
+// Summarizes the film's estimated relative errors of the pixels in _bounds_,
+// excluding pixels without a finite estimate, such as those with too few
+// samples or a zero mean. The relative MSE is the mean of the squared relative
+// errors less the largest 0.1% of them, which are usually due to a few pixels
+// that have sampled rare bright paths.
+static ConvergenceEstimate EstimateConvergence(Film film, Bounds2i bounds) {
+    Array2D<Float> pixelErrors(bounds);
+    ParallelFor2D(bounds, [&](Bounds2i tileBounds) {
+        for (Point2i p : tileBounds)
+            pixelErrors[p] = film.GetPixelRelativeError(p);
+    });
+    std::vector<Float> errors;
+    errors.reserve(bounds.Area());
+    for (Float e : pixelErrors)
+        if (IsFinite(e))
+            errors.push_back(e);
+
+    ConvergenceEstimate estimate;
+    estimate.nPixels = errors.size();
+    if (errors.empty())
+        return estimate;
+    auto percentile = [&](Float f) {
+        size_t i = std::min(errors.size() - 1, size_t(f * errors.size()));
+        std::nth_element(errors.begin(), errors.begin() + i, errors.end());
+        return errors[i];
+    };
+    estimate.medianRelError = percentile(0.5f);
+    estimate.p95RelError = percentile(0.95f);
+
+    size_t nKept = errors.size() - errors.size() / 1000;
+    std::nth_element(errors.begin(), errors.begin() + nKept, errors.end());
+    double sumSqr = 0;
+    for (size_t i = 0; i < nKept; ++i)
+        sumSqr += Sqr(double(errors[i]));
+    estimate.relMSE = sumSqr / nKept;
+    return estimate;
+}
+
 // ImageTileIntegrator Method Definitions
 void ImageTileIntegrator::Render() {
     // Handle debugStart, if set
@@ -75,7 +219,7 @@ void ImageTileIntegrator::Render() {
         Point2i pPixel(c[0], c[1]);
         int sampleIndex = c[2];
 
-        ScratchBuffer scratchBuffer(65536);
+        ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
         Sampler tileSampler = samplerPrototype.Clone(1, Allocator())[0];
         tileSampler.StartPixelSample(pPixel, sampleIndex);
 
@@ -94,55 +238,81 @@ void ImageTileIntegrator::Render() {
     });
 
     // Declare common variables for rendering image in tiles
-    std::vector<ScratchBuffer> scratchBuffers;
-    for (int i = 0; i < MaxThreadIndex(); ++i)
-        scratchBuffers.push_back(ScratchBuffer(65536));
-
     std::vector<Sampler> samplers = samplerPrototype.Clone(MaxThreadIndex());
 
     Bounds2i pixelBounds = camera.GetFilm().PixelBounds();
     int spp = samplerPrototype.SamplesPerPixel();
     ProgressReporter progress(int64_t(spp) * pixelBounds.Area(), "Rendering",
                               Options->quiet);
+    progress.SetRenderingRates(1, []() -> int64_t {
+        return nIntersectionTests.Total() + nShadowTests.Total();
+    });
 
     int waveStart = 0, waveEnd = 1, nextWaveSize = 1;
 
+    // Streaming films only store one band of the image at a time, which rules
+    // out features that need all of its pixels
+    int bandHeight = camera.GetFilm().StreamingBandHeight();
+    bool streaming = bandHeight > 0;
+    if (streaming && (!Options->mseReferenceImage.empty() ||
+                      !Options->displayServer.empty() || Options->writePartialImages ||
+                      Options->timeLimit))
+        Warning("Ignoring --mse-reference-image, --display-server, "
+                "--write-partial-images, and --time-limit with a streaming film.");
+
+    // Set up checkpointing and resume from the last checkpoint, if requested
+    RGBFilm *checkpointFilm = nullptr;
+    int resumeSamples = 0;
+    if (!Options->checkpointFile.empty()) {
+        Film film = camera.GetFilm();
+        if (!film.Is<RGBFilm>() || streaming)
+            Warning("Ignoring --checkpoint, which is only supported with a "
+                    "non-streaming RGBFilm.");
+        else {
+            checkpointFilm = film.Cast<RGBFilm>();
+            if (Options->resume)
+                resumeSamples = checkpointFilm->ReadCheckpoint(Options->checkpointFile);
+            if (resumeSamples > spp)
+                ErrorExit("%s: checkpoint has %d samples per pixel but only %d were "
+                          "requested.",
+                          Options->checkpointFile, resumeSamples, spp);
+            progress.Update(int64_t(resumeSamples) * pixelBounds.Area());
+            if (resumeSamples == spp) {
+                // Write the image of a render that was already finished
+                ImageMetadata metadata;
+                metadata.samplesPerPixel = spp;
+                camera.InitMetadata(&metadata);
+                film.WriteImage(metadata, 1.0f / spp);
+                progress.Done();
+                return;
+            }
+        }
+    }
+    Float lastCheckpointTime = 0;
+
     if (Options->recordPixelStatistics)
         StatsEnablePixelStats(pixelBounds,
                               RemoveExtension(camera.GetFilm().GetFilename()));
+    // Allocate storage for per-pixel cycle counts if a cost image was requested
+    bool recordPixelCost = !Options->pixelCostFile.empty();
+    Array2D<uint64_t> pixelCycles(recordPixelCost ? pixelBounds
+                                                  : Bounds2i({0, 0}, {0, 0}),
+                                  uint64_t(0));
+    uint64_t renderStartCycles = ReadCycleCounter();
+    double renderStartSeconds = progress.ElapsedSeconds();
+
     // Handle MSE reference image, if provided
     pstd::optional<Image> referenceImage;
     FILE *mseOutFile = nullptr;
-    if (!Options->mseReferenceImage.empty()) {
-        auto mse = Image::Read(Options->mseReferenceImage);
-        referenceImage = mse.image;
-
-        Bounds2i msePixelBounds =
-            mse.metadata.pixelBounds
-                ? *mse.metadata.pixelBounds
-                : Bounds2i(Point2i(0, 0), referenceImage->Resolution());
-        if (!Inside(pixelBounds, msePixelBounds))
-            ErrorExit("Output image pixel bounds %s aren't inside the MSE "
-                      "image's pixel bounds %s.",
-                      pixelBounds, msePixelBounds);
-
-        // Transform the pixelBounds of the image we're rendering to the
-        // coordinate system with msePixelBounds.pMin at the origin, which
-        // in turn gives us the section of the MSE image to crop. (This is
-        // complicated by the fact that Image doesn't support pixel
-        // bounds...)
-        Bounds2i cropBounds(Point2i(pixelBounds.pMin - msePixelBounds.pMin),
-                            Point2i(pixelBounds.pMax - msePixelBounds.pMin));
-        *referenceImage = referenceImage->Crop(cropBounds);
-        CHECK_EQ(referenceImage->Resolution(), Point2i(pixelBounds.Diagonal()));
-
+    if (!Options->mseReferenceImage.empty() && !streaming) {
+        referenceImage = ReadMSEReferenceImage(Options->mseReferenceImage, pixelBounds);
         mseOutFile = FOpenWrite(Options->mseReferenceOutput);
         if (!mseOutFile)
             ErrorExit("%s: %s", Options->mseReferenceOutput, ErrorString());
     }
 
     // Connect to display server if needed
-    if (!Options->displayServer.empty()) {
+    if (!Options->displayServer.empty() && !streaming) {
         Film film = camera.GetFilm();
         DisplayDynamic(film.GetFilename(), Point2i(pixelBounds.Diagonal()),
                        {"R", "G", "B"},
@@ -158,45 +328,143 @@ void ImageTileIntegrator::Render() {
                        });
     }
 
-    // Render image in waves
-    while (waveStart < spp) {
-        // Render current wave's image tiles in parallel
-        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
-            // Render image tile given by _tileBounds_
-            ScratchBuffer &scratchBuffer = scratchBuffers[ThreadIndex];
-            Sampler &sampler = samplers[ThreadIndex];
-            PBRT_DBG("Starting image tile (%d,%d)-(%d,%d) waveStart %d, waveEnd %d\n",
-                     tileBounds.pMin.x, tileBounds.pMin.y, tileBounds.pMax.x,
-                     tileBounds.pMax.y, waveStart, waveEnd);
-            for (Point2i pPixel : tileBounds) {
-                StatsReportPixelStart(pPixel);
-                threadPixel = pPixel;
-                // Render samples in pixel _pPixel_
-                for (int sampleIndex = waveStart; sampleIndex < waveEnd; ++sampleIndex) {
-                    threadSampleIndex = sampleIndex;
-                    sampler.StartPixelSample(pPixel, sampleIndex);
-                    EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
-                    scratchBuffer.Reset();
+    // Initialize adaptive sampling, if requested
+    bool adaptive = Options->adaptiveError.has_value();
+    if (adaptive && AddsSplats()) {
+        Warning("Ignoring --adaptive-error since the integrator splats to the film.");
+        adaptive = false;
+    }
+    // Pixels are tested for convergence after each wave once they have at
+    // least _adaptiveMinSamples_ samples; converged pixels are skipped in later
+    // waves.
+    constexpr int adaptiveMinSamples = 16;
+
+    // Open the convergence file, if requested; convergence is estimated from
+    // the film's per-pixel variance estimates after each wave
+    bool estimateConvergence =
+        !Options->convergenceFile.empty() || Options->targetRelMSE.has_value();
+    if (estimateConvergence && AddsSplats()) {
+        Warning("Ignoring --convergence-file and --target-rel-mse since the "
+                "integrator splats to the film.");
+        estimateConvergence = false;
+    }
+    FILE *convergenceOutFile = nullptr;
+    if (estimateConvergence && !Options->convergenceFile.empty()) {
+        convergenceOutFile = FOpenWrite(Options->convergenceFile);
+        if (!convergenceOutFile)
+            ErrorExit("%s: %s", Options->convergenceFile, ErrorString());
+    }
+
+    // Render the image a band of scanlines at a time if the film is streaming,
+    // or all at once otherwise
+    if (!streaming)
+        bandHeight = pixelBounds.pMax.y - pixelBounds.pMin.y;
+    for (int bandStart = pixelBounds.pMin.y; bandStart < pixelBounds.pMax.y;
+         bandStart += bandHeight) {
+        int bandEnd = std::min(bandStart + bandHeight, pixelBounds.pMax.y);
+        Bounds2i bandBounds(Point2i(pixelBounds.pMin.x, bandStart),
+                            Point2i(pixelBounds.pMax.x, bandEnd));
+        bool lastBand = bandEnd == pixelBounds.pMax.y;
+        if (streaming)
+            camera.GetFilm().StartBand(bandBounds);
+        Array2D<uint8_t> pixelConverged(adaptive ? bandBounds
+                                                 : Bounds2i({0, 0}, {0, 0}));
+        waveStart = 0;
+        waveEnd = 1;
+        nextWaveSize = 1;
+        if (resumeSamples > 0) {
+            // Continue with the wave that follows the checkpoint's last one
+            int waveSize = referenceImage ? 1 : std::min(resumeSamples, 64);
+            waveStart = resumeSamples;
+            waveEnd = std::min(spp, waveStart + waveSize);
+            nextWaveSize = referenceImage ? 1 : std::min(2 * waveSize, 64);
+        }
+
+        // Render image in waves
+        while (waveStart < spp) {
+            StartWave(bandBounds, waveStart, waveEnd);
+            // Render current wave's image tiles in parallel
+            ParallelFor2D(bandBounds, [&](Bounds2i tileBounds) {
+                // Render image tile given by _tileBounds_
+                TraceScope trace("Tile", "render");
+                if (TracingEnabled())
+                    trace.SetDetail(StringPrintf("%s samples %d-%d", tileBounds,
+                                                 waveStart, waveEnd));
+                ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
+                Sampler &sampler = samplers[ThreadIndex];
+                PBRT_DBG("Starting image tile (%d,%d)-(%d,%d) waveStart %d, waveEnd %d\n",
+                         tileBounds.pMin.x, tileBounds.pMin.y, tileBounds.pMax.x,
+                         tileBounds.pMax.y, waveStart, waveEnd);
+                // Accumulate the tile's samples locally and merge them into the film
+                // once the tile is done
+                Film film = camera.GetFilm();
+                film.StartTile(tileBounds);
+                for (Point2i pPixel : tileBounds) {
+                    if (adaptive && pixelConverged[pPixel]) {
+                        nAdaptiveSkippedSamples += waveEnd - waveStart;
+                        continue;
+                    }
+                    StatsReportPixelStart(pPixel);
+                    uint64_t pixelStartCycles = recordPixelCost ? ReadCycleCounter() : 0;
+                    threadPixel = pPixel;
+                    // Render samples in pixel _pPixel_
+                    for (int sampleIndex = waveStart; sampleIndex < waveEnd;
+                         ++sampleIndex) {
+                        threadSampleIndex = sampleIndex;
+                        ScratchScope scratchScope(scratchBuffer);
+                        sampler.StartPixelSample(pPixel, sampleIndex);
+                        EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
+                    }
+
+                    if (recordPixelCost)
+                        pixelCycles[pPixel] += ReadCycleCounter() - pixelStartCycles;
+                    StatsReportPixelEnd(pPixel);
                 }
+                film.MergeTile();
+                PBRT_DBG("Finished image tile (%d,%d)-(%d,%d)\n", tileBounds.pMin.x,
+                         tileBounds.pMin.y, tileBounds.pMax.x, tileBounds.pMax.y);
+                progress.Update((waveEnd - waveStart) * tileBounds.Area());
+            });
 
-                StatsReportPixelEnd(pPixel);
+            // Find pixels that have converged, finishing if all of them have
+            if (adaptive && waveEnd >= adaptiveMinSamples && waveEnd < spp) {
+                Film film = camera.GetFilm();
+                std::atomic<int64_t> nConverged{0};
+                ParallelFor2D(bandBounds, [&](Bounds2i tileBounds) {
+                    int64_t nTileConverged = 0;
+                    for (Point2i p : tileBounds) {
+                        if (!pixelConverged[p] &&
+                            film.GetPixelRelativeError(p) < *Options->adaptiveError)
+                            pixelConverged[p] = 1;
+                        nTileConverged += pixelConverged[p];
+                    }
+                    nConverged += nTileConverged;
+                });
+                LOG_VERBOSE("%d of %d pixels converged after %d spp", nConverged.load(),
+                            bandBounds.Area(), waveEnd);
+                if (nConverged == bandBounds.Area())
+                    waveEnd = spp;
             }
-            PBRT_DBG("Finished image tile (%d,%d)-(%d,%d)\n", tileBounds.pMin.x,
-                     tileBounds.pMin.y, tileBounds.pMax.x, tileBounds.pMax.y);
-            progress.Update((waveEnd - waveStart) * tileBounds.Area());
-        });
 
-        // Update start and end wave
-        waveStart = waveEnd;
-        waveEnd = std::min(spp, waveEnd + nextWaveSize);
-        if (!referenceImage)
-            nextWaveSize = std::min(2 * nextWaveSize, 64);
-        if (waveStart == spp)
-            progress.Done();
+            // Update start and end wave
+            waveStart = waveEnd;
+            waveEnd = std::min(spp, waveEnd + nextWaveSize);
+            if (!referenceImage)
+                nextWaveSize = std::min(2 * nextWaveSize, 64);
+
+            // Finish early if the next wave would exceed the time limit
+            bool finished = waveStart == spp;
+            if (!finished && Options->timeLimit && !streaming) {
+                Float elapsed = progress.ElapsedSeconds();
+                Float nextWaveSeconds =
+                    elapsed / (waveStart - resumeSamples) * (waveEnd - waveStart);
+                if (elapsed + nextWaveSeconds > *Options->timeLimit) {
+                    LOG_VERBOSE("Stopping at %d spp for time limit", waveStart);
+                    finished = true;
+                }
+            }
 
-        // Optionally write current image to disk
-        if (waveStart == spp || Options->writePartialImages || referenceImage) {
-            LOG_VERBOSE("Writing image with spp = %d", waveStart);
+            // Compute MSE with respect to reference image, if provided
             ImageMetadata metadata;
             metadata.renderTimeSeconds = progress.ElapsedSeconds();
             metadata.samplesPerPixel = waveStart;
@@ -209,20 +477,123 @@ void ImageTileIntegrator::Render() {
                 fprintf(mseOutFile, "%d, %.9g\n", waveStart, mse.Average());
                 metadata.MSE = mse.Average();
                 fflush(mseOutFile);
+                // Finish early if the target MSE has been reached
+                if (Options->targetMSE && mse.Average() <= *Options->targetMSE) {
+                    LOG_VERBOSE("Reached target MSE at %d spp", waveStart);
+                    finished = true;
+                }
+            }
+
+            // Estimate convergence without a reference image, if requested
+            if (estimateConvergence) {
+                ConvergenceEstimate estimate =
+                    EstimateConvergence(camera.GetFilm(), bandBounds);
+                LOG_VERBOSE("%d spp: relative MSE %f, median relative error %f, 95th "
+                            "percentile %f over %d pixels",
+                            waveStart, estimate.relMSE, estimate.medianRelError,
+                            estimate.p95RelError, estimate.nPixels);
+                if (convergenceOutFile) {
+                    // JSON has no infinity, so metrics without any pixels to
+                    // estimate them from are null
+                    auto value = [&](Float v) {
+                        return estimate.nPixels > 0 ? StringPrintf("%.9g", v)
+                                                    : std::string("null");
+                    };
+                    fprintf(convergenceOutFile,
+                            "{\"band\": %d, \"spp\": %d, \"seconds\": %.3f, "
+                            "\"pixels\": %lld, \"relMSE\": %s, \"relErrorMedian\": %s, "
+                            "\"relErrorP95\": %s}\n",
+                            bandBounds.pMin.y, waveStart, progress.ElapsedSeconds(),
+                            (long long)estimate.nPixels, value(estimate.relMSE).c_str(),
+                            value(estimate.medianRelError).c_str(),
+                            value(estimate.p95RelError).c_str());
+                    fflush(convergenceOutFile);
+                }
+                // Finish early if the target relative MSE has been reached
+                if (Options->targetRelMSE && waveStart >= adaptiveMinSamples &&
+                    estimate.relMSE <= *Options->targetRelMSE) {
+                    LOG_VERBOSE("Reached target relative MSE at %d spp", waveStart);
+                    finished = true;
+                }
             }
-            if (waveStart == spp || Options->writePartialImages) {
+            if (finished && lastBand)
+                progress.Done();
+
+            // Optionally write current image to disk
+            if (finished && streaming) {
+                camera.InitMetadata(&metadata);
+                camera.GetFilm().EndBand(metadata, 1.0f / waveStart);
+            } else if (!streaming && (finished || Options->writePartialImages)) {
+                LOG_VERBOSE("Writing image with spp = %d", waveStart);
                 camera.InitMetadata(&metadata);
                 camera.GetFilm().WriteImage(metadata, 1.0f / waveStart);
             }
+
+            // Write a checkpoint if enough time has passed since the last one; the
+            // final one allows rendering to be continued with more samples
+            if (checkpointFilm &&
+                (finished || progress.ElapsedSeconds() - lastCheckpointTime >=
+                                 Options->checkpointInterval)) {
+                checkpointFilm->WriteCheckpoint(Options->checkpointFile, waveStart);
+                lastCheckpointTime = progress.ElapsedSeconds();
+            }
+            if (finished)
+                break;
         }
     }
 
     if (mseOutFile)
         fclose(mseOutFile);
+    if (convergenceOutFile)
+        fclose(convergenceOutFile);
     DisconnectFromDisplayServer();
+
+    // Write the image of per-pixel rendering cost in milliseconds, converting
+    // cycle counts to time using the counter's rate over the entire render
+    if (recordPixelCost) {
+        double seconds = progress.ElapsedSeconds() - renderStartSeconds;
+        uint64_t cycles = ReadCycleCounter() - renderStartCycles;
+        double msPerCycle = cycles > 0 ? 1000 * seconds / cycles : 0;
+        Image costImage(PixelFormat::Float, Point2i(pixelBounds.Diagonal()), {"ms"});
+        for (Point2i p : pixelBounds)
+            costImage.SetChannel(Point2i(p - pixelBounds.pMin), 0,
+                                 pixelCycles[p] * msPerCycle);
+        if (!costImage.Write(Options->pixelCostFile))
+            ErrorExit("%s: unable to write pixel cost image.", Options->pixelCostFile);
+    }
+
     LOG_VERBOSE("Rendering finished");
 }
 
+void ImageTileIntegrator::RenderTiles(
+    std::function<pstd::optional<Bounds2i>()> nextTile) {
+    std::vector<Sampler> samplers = samplerPrototype.Clone(MaxThreadIndex());
+    int spp = samplerPrototype.SamplesPerPixel();
+    while (pstd::optional<Bounds2i> bounds = nextTile()) {
+        int waveStart = 0, waveEnd = 1, nextWaveSize = 1;
+        while (waveStart < spp) {
+            StartWave(*bounds, waveStart, waveEnd);
+            ParallelFor2D(*bounds, [&](Bounds2i tileBounds) {
+                ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
+                Sampler &sampler = samplers[ThreadIndex];
+                Film film = camera.GetFilm();
+                film.StartTile(tileBounds);
+                for (Point2i pPixel : tileBounds)
+                    for (int sampleIndex = waveStart; sampleIndex < waveEnd;
+                         ++sampleIndex) {
+                        ScratchScope scratchScope(scratchBuffer);
+                        sampler.StartPixelSample(pPixel, sampleIndex);
+                        EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
+                    }
+                film.MergeTile();
+            });
+            waveStart = waveEnd;
+            waveEnd = std::min(spp, waveEnd + nextWaveSize);
+            nextWaveSize = std::min(2 * nextWaveSize, 64);
+        }
+    }
+}
+
 // RayIntegrator Method Definitions
 void RayIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex, Sampler sampler,
                                         ScratchBuffer &scratchBuffer) {
@@ -291,27 +662,43 @@ void RayIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex, Sampler
 }
 
 // Integrator Utility Functions
-STAT_COUNTER("Intersections/Regular ray intersection tests", nIntersectionTests);
-STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
 
 // Integrator Method Definitions
-pstd::optional<ShapeIntersection> Integrator::Intersect(const Ray &ray,
-                                                        Float tMax) const {
+pstd::optional<ShapeIntersection> Integrator::Intersect(const Ray &ray, Float tMax,
+                                                        RayType type) const {
     ++nIntersectionTests;
     DCHECK_NE(ray.d, Vector3f(0, 0, 0));
-    if (aggregate)
-        return aggregate.Intersect(ray, tMax);
-    else
+    if (!aggregate)
         return {};
+    RecordRay(ray, tMax, type, false);
+    pstd::optional<ShapeIntersection> si = aggregate.Intersect(ray, tMax);
+    StatsReportRays(type, 1, si.has_value());
+    return si;
 }
 
 bool Integrator::IntersectP(const Ray &ray, Float tMax) const {
     ++nShadowTests;
     DCHECK_NE(ray.d, Vector3f(0, 0, 0));
-    if (aggregate)
-        return aggregate.IntersectP(ray, tMax);
-    else
+    if (!aggregate)
         return false;
+    RecordRay(ray, tMax, RayType::Shadow, true);
+    bool hit = aggregate.IntersectP(ray, tMax);
+    StatsReportRays(RayType::Shadow, 1, hit);
+    return hit;
+}
+
+void Integrator::IntersectP(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                            pstd::span<bool> hit) const {
+    nShadowTests += rays.size();
+    for (size_t i = 0; i < rays.size(); ++i)
+        RecordRay(rays[i], tMax[i], RayType::Shadow, true);
+    if (const BVHAggregate *bvh = aggregate.CastOrNullptr<BVHAggregate>())
+        bvh->IntersectPStream(rays, tMax, hit);
+    else
+        for (size_t i = 0; i < rays.size(); ++i)
+            hit[i] = aggregate && aggregate.IntersectP(rays[i], tMax[i]);
+    StatsReportRays(RayType::Shadow, rays.size(),
+                    std::count(hit.begin(), hit.end(), true));
 }
 
 SampledSpectrum Integrator::Tr(const Interaction &p0, const Interaction &p1,
@@ -333,7 +720,8 @@ SampledSpectrum Integrator::Tr(const Interaction &p0, const Interaction &p1,
         return Tr;
 
     while (true) {
-        pstd::optional<ShapeIntersection> si = Intersect(ray, 1 - ShadowEpsilon);
+        pstd::optional<ShapeIntersection> si =
+            Intersect(ray, 1 - ShadowEpsilon, RayType::Shadow);
         // Handle opaque surface along ray's path
         if (si && si->intr.material)
             return SampledSpectrum(0.0f);
@@ -382,16 +770,125 @@ std::string Integrator::ToString() const {
     return s + " ]";
 }
 
+// VisibilityCache Method Definitions
+STAT_PERCENT("Integrator/Reused visibility estimates", nReusedVisibility,
+             nVisibilityLookups);
+
+VisibilityCache::VisibilityCache(const Bounds3f &sceneBounds, Float cellSize,
+                                 Float maxError, int nEntries)
+    : pMin(sceneBounds.pMin),
+      cellSize(cellSize * MaxComponentValue(sceneBounds.Diagonal())),
+      maxError(maxError),
+      entries(nEntries) {}
+
+int VisibilityCache::Cell(Point3f p, Normal3f n, uint64_t key) {
+    // Hash the grid cell containing _p_ and the axis direction closest to _n_
+    Vector3f pCell = (p - pMin) / cellSize;
+    int axis = MaxComponentIndex(Abs(n));
+    int side = 2 * axis + (n[axis] < 0);
+    uint64_t hash = Hash(int(std::floor(pCell.x)), int(std::floor(pCell.y)),
+                         int(std::floor(pCell.z)), side, key) |
+                    1;
+
+    // Find the cell's entry with linear probing, claiming an unused one if needed
+    for (int i = 0; i < MaxProbes; ++i) {
+        int index = (hash + i) % entries.size();
+        uint64_t entryKey = entries[index].key.load(std::memory_order_relaxed);
+        if (entryKey == 0 && entries[index].key.compare_exchange_strong(entryKey, hash))
+            return index;
+        if (entryKey == hash)
+            return index;
+    }
+    return -1;
+}
+
+bool VisibilityCache::Lookup(int cell, Float *value) const {
+    ++nVisibilityLookups;
+    const Entry &entry = entries[cell];
+    int count = entry.count.load(std::memory_order_relaxed);
+    if (count < MinSamples)
+        return false;
+    // Reuse the cell's mean if its standard error is small enough
+    Float mean = entry.sum / count;
+    Float variance = std::max<Float>(0, entry.sumSquared / count - Sqr(mean));
+    if (variance / count > Sqr(maxError))
+        return false;
+    ++nReusedVisibility;
+    *value = mean;
+    return true;
+}
+
+void VisibilityCache::Add(int cell, Float value) {
+    Entry &entry = entries[cell];
+    entry.sum.Add(value);
+    entry.sumSquared.Add(Sqr(value));
+    entry.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VisibilityCache::Clear() {
+    ParallelFor(0, entries.size(), [&](int64_t i) {
+        entries[i].key = 0;
+        entries[i].count = 0;
+        entries[i].sum = 0;
+        entries[i].sumSquared = 0;
+    });
+}
+
+std::string VisibilityCache::ToString() const {
+    return StringPrintf("[ VisibilityCache pMin: %s cellSize: %f maxError: %f "
+                        "entries: %d ]",
+                        pMin, cellSize, maxError, entries.size());
+}
+
+// Returns a _VisibilityCache_ if the integrator's parameters enable one.
+static VisibilityCache *CreateVisibilityCache(const ParameterDictionary &parameters,
+                                              Primitive aggregate, const FileLoc *loc) {
+    if (!parameters.GetOneBool("visibilitycache", false))
+        return nullptr;
+    Float cellSize = parameters.GetOneFloat("visibilitycellsize", 0.002f);
+    Float maxError = parameters.GetOneFloat("visibilityerror", 0.05f);
+    if (cellSize <= 0 || maxError < 0)
+        ErrorExit(loc, "\"visibilitycellsize\" must be positive and "
+                       "\"visibilityerror\" can't be negative.");
+    if (!aggregate)
+        return nullptr;
+    return Allocator().new_object<VisibilityCache>(aggregate.Bounds(), cellSize,
+                                                   maxError);
+}
+
 // SimplePathIntegrator Method Definitions
 SimplePathIntegrator::SimplePathIntegrator(int maxDepth, bool sampleLights,
                                            bool sampleBSDF, Camera camera,
                                            Sampler sampler, Primitive aggregate,
-                                           std::vector<Light> lights)
+                                           std::vector<Light> lights,
+                                           VisibilityCache *visibilityCache)
     : RayIntegrator(camera, sampler, aggregate, lights),
       maxDepth(maxDepth),
       sampleLights(sampleLights),
       sampleBSDF(sampleBSDF),
-      lightSampler(lights, Allocator()) {}
+      lightSampler(lights, Allocator()),
+      visibilityCache(visibilityCache) {}
+
+void SimplePathIntegrator::StartWave(Bounds2i bandBounds, int waveStart, int waveEnd) {
+    // Only reuse visibility within a wave so that waves make independent estimates
+    if (visibilityCache)
+        visibilityCache->Clear();
+}
+
+Float SimplePathIntegrator::Visibility(const SurfaceInteraction &intr, Vector3f wi,
+                                       Light light, const Interaction &pLight) const {
+    // Reuse the light's visibility from around _intr_ if it is accurate enough
+    int cell = visibilityCache ? visibilityCache->Cell(intr.p(), FaceForward(intr.n, wi),
+                                                       Hash(light.ptr()))
+                               : -1;
+    Float V;
+    if (cell >= 0 && visibilityCache->Lookup(cell, &V))
+        return V;
+    V = Unoccluded(intr, pLight) ? 1 : 0;
+    if (cell >= 0)
+        visibilityCache->Add(cell, V);
+    return V;
+}
 
 SampledSpectrum SimplePathIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                          Sampler sampler, ScratchBuffer &scratchBuffer,
@@ -403,6 +900,7 @@ SampledSpectrum SimplePathIntegrator::Li(RayDifferential ray, SampledWavelengths
     while (beta) {
         // Find next _SimplePathIntegrator_ vertex and accumulate contribution
         // Intersect _ray_ with scene
+        StatsSetRayDepth(depth);
         pstd::optional<ShapeIntersection> si = Intersect(ray);
 
         // Account for infinite lights if ray has no intersection
@@ -443,8 +941,10 @@ SampledSpectrum SimplePathIntegrator::Li(RayDifferential ray, SampledWavelengths
                     // Evaluate BSDF for light and possibly add scattered radiance
                     Vector3f wi = ls->wi;
                     SampledSpectrum f = bsdf.f(wo, wi) * AbsDot(wi, isect.shading.n);
-                    if (f && Unoccluded(isect, ls->pLight))
-                        L += beta * f * ls->L / (sampledLight->pdf * ls->pdf);
+                    if (f)
+                        L += beta * f * ls->L *
+                             Visibility(isect, wi, sampledLight->light, ls->pLight) /
+                             (sampledLight->pdf * ls->pdf);
                 }
             }
         }
@@ -489,8 +989,9 @@ SampledSpectrum SimplePathIntegrator::Li(RayDifferential ray, SampledWavelengths
 
 std::string SimplePathIntegrator::ToString() const {
     return StringPrintf("[ SimplePathIntegrator maxDepth: %d sampleLights: %s "
-                        "sampleBSDF: %s ]",
-                        maxDepth, sampleLights, sampleBSDF);
+                        "sampleBSDF: %s visibilityCache: %s ]",
+                        maxDepth, sampleLights, sampleBSDF,
+                        visibilityCache ? visibilityCache->ToString() : "(nullptr)");
 }
 
 std::unique_ptr<SimplePathIntegrator> SimplePathIntegrator::Create(
@@ -499,8 +1000,10 @@ std::unique_ptr<SimplePathIntegrator> SimplePathIntegrator::Create(
     int maxDepth = parameters.GetOneInt("maxdepth", 5);
     bool sampleLights = parameters.GetOneBool("samplelights", true);
     bool sampleBSDF = parameters.GetOneBool("samplebsdf", true);
+    VisibilityCache *visibilityCache = CreateVisibilityCache(parameters, aggregate, loc);
     return std::make_unique<SimplePathIntegrator>(maxDepth, sampleLights, sampleBSDF,
-                                                  camera, sampler, aggregate, lights);
+                                                  camera, sampler, aggregate, lights,
+                                                  visibilityCache);
 }
 
 // LightPathIntegrator Method Definitions
@@ -617,30 +1120,81 @@ std::unique_ptr<LightPathIntegrator> LightPathIntegrator::Create(
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_PERCENT("Integrator/Regularized BSDFs", regularizedBSDFs, totalBSDFs);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_COUNTER("Integrator/Paths with reused wavelengths", reusedWavelengthPaths);
+STAT_PERCENT("Integrator/Adjoint-driven terminations", adjointTerminations,
+             adjointTerminationTests);
+STAT_COUNTER("Integrator/Adjoint-driven split paths", adjointSplitPaths);
 
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth, Camera camera, Sampler sampler,
                                Primitive aggregate, std::vector<Light> lights,
-                               const std::string &lightSampleStrategy, bool regularize)
+                               const std::string &lightSampleStrategy, bool regularize,
+                               bool spectralReuse, int nLightSamples,
+                               GuidingSDTree *sdTree, bool adrrs)
     : RayIntegrator(camera, sampler, aggregate, lights),
       maxDepth(maxDepth),
       lightSampler(LightSampler::Create(lightSampleStrategy, lights, Allocator())),
-      regularize(regularize) {}
+      regularize(regularize),
+      spectralReuse(spectralReuse),
+      nLightSamples(nLightSamples),
+      sdTree(sdTree),
+      adrrs(adrrs) {}
+
+void PathIntegrator::StartWave(Bounds2i bandBounds, int waveStart, int waveEnd) {
+    // Train the guiding tree on the previous wave's records
+    if (sdTree)
+        sdTree->StartIteration(waveEnd - waveStart);
+}
 
 SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                    Sampler sampler, ScratchBuffer &scratchBuffer,
                                    VisibleSurface *visibleSurf) const {
-    // Declare local variables for _PathIntegrator::Li()_
-    SampledSpectrum L(0.f), beta(1.f);
-    int depth = 0;
+    return TracePath(ray, lambda, sampler, scratchBuffer, visibleSurf, PathPrefix());
+}
 
-    Float bsdfPDF, etaScale = 1;
-    bool specularBounce = false, anyNonSpecularBounces = false;
-    LightSampleContext prevIntrCtx;
+SampledSpectrum PathIntegrator::TracePath(RayDifferential ray, SampledWavelengths &lambda,
+                                          Sampler sampler, ScratchBuffer &scratchBuffer,
+                                          VisibleSurface *visibleSurf,
+                                          const PathPrefix &prefix) const {
+    // Declare local variables for _PathIntegrator::TracePath()_
+    SampledSpectrum L(0.f), beta = prefix.beta;
+    int depth = prefix.depth;
+
+    Float bsdfPDF = prefix.bsdfPDF, etaScale = prefix.etaScale;
+    bool specularBounce = prefix.specularBounce;
+    bool anyNonSpecularBounces = prefix.anyNonSpecularBounces;
+    LightSampleContext prevIntrCtx = prefix.prevIntrCtx;
+    Float pathEstimate = prefix.pathEstimate;
+
+    // Declare state for continuing terminated wavelengths along their own paths
+    bool reusedWavelengths = false;
+    SampledWavelengths lambdaPrefix;
+    SampledSpectrum LPrefix, LReused;
+
+    // Declare state for recording incident radiance at guided surface vertices
+    struct GuidedVertex {
+        Point3f p;
+        Vector3f wi;
+        // Path radiance before the radiance that arrives along _wi_
+        SampledSpectrum L;
+        // Converts radiance added to the path to incident radiance over its PDF
+        Float scale;
+    };
+    constexpr int MaxGuidedVertices = 16;
+    GuidedVertex guidedVertices[MaxGuidedVertices];
+    int nGuidedVertices = 0;
 
     // Sample path from camera and accumulate radiance estimate
     while (true) {
+        // Record path prefix state if secondary wavelengths may be terminated here
+        bool canReuseWavelengths = spectralReuse && !lambda.SecondaryTerminated();
+        if (canReuseWavelengths) {
+            lambdaPrefix = lambda;
+            LPrefix = L;
+        }
+
         // Trace ray and find closest path vertex and its BSDF
+        StatsSetRayDepth(depth);
         pstd::optional<ShapeIntersection> si = Intersect(ray);
         // Add emitted light at path vertex or from the environment
         if (!si) {
@@ -654,7 +1208,7 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
                     Float lightPDF =
                         lightSampler.PDF(prevIntrCtx, light) *
                         light.PDF_Li(prevIntrCtx, ray.d, LightSamplingMode::WithMIS);
-                    Float weight = PowerHeuristic(1, bsdfPDF, 1, lightPDF);
+                    Float weight = PowerHeuristic(1, bsdfPDF, nLightSamples, lightPDF);
 
                     L += beta * weight * Le;
                 }
@@ -673,7 +1227,7 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
                 Float lightPDF =
                     lightSampler.PDF(prevIntrCtx, areaLight) *
                     areaLight.PDF_Li(prevIntrCtx, ray.d, LightSamplingMode::WithMIS);
-                Float weight = PowerHeuristic(1, bsdfPDF, 1, lightPDF);
+                Float weight = PowerHeuristic(1, bsdfPDF, nLightSamples, lightPDF);
 
                 L += beta * weight * Le;
             }
@@ -682,6 +1236,21 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         SurfaceInteraction &isect = si->intr;
         // Get BSDF and skip over medium boundaries
         BSDF bsdf = isect.GetBSDF(ray, lambda, camera, scratchBuffer, sampler);
+        if (canReuseWavelengths && lambda.SecondaryTerminated()) {
+            // Trace terminated wavelengths' paths onward from the shared prefix
+            reusedWavelengths = true;
+            ++reusedWavelengthPaths;
+            PathPrefix wavelengthPrefix{beta,           depth,
+                                        bsdfPDF,        etaScale,
+                                        specularBounce, anyNonSpecularBounces,
+                                        prevIntrCtx,    pathEstimate};
+            for (int i = 1; i < NSpectrumSamples; ++i) {
+                SampledWavelengths lambdaHero = lambdaPrefix.TerminatedWithHero(i);
+                wavelengthPrefix.beta = SampledSpectrum(beta[i]);
+                LReused[i] = TracePath(ray, lambdaHero, sampler, scratchBuffer, nullptr,
+                                       wavelengthPrefix)[0];
+            }
+        }
         if (!bsdf) {
             isect.SkipIntersection(&ray, si->tHit);
             continue;
@@ -724,25 +1293,92 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         if (depth++ == maxDepth)
             break;
 
+        // Find the incident radiance learned at the vertex for guiding, if any
+        const GuidingQuadtree *quadtree =
+            sdTree ? sdTree->Lookup(isect.p(), bsdf) : nullptr;
+
         // Sample direct illumination from the light sources
         if (IsNonSpecular(bsdf.Flags())) {
             ++totalPaths;
-            SampledSpectrum Ld = SampleLd(isect, &bsdf, lambda, sampler);
+            SampledSpectrum Ld = SampleLd(isect, &bsdf, lambda, sampler, quadtree);
             if (!Ld)
                 ++zeroRadiancePaths;
             L += beta * Ld;
         }
 
-        // Sample BSDF to get new path direction
+        // Choose how many paths continue from the vertex using the learned radiance
         Vector3f wo = -ray.d;
+        GuidedBSDF guidedBSDF(&bsdf, quadtree);
+        bool adjointRR = false;
+        int nSplits = 1;
+        if (adrrs && quadtree) {
+            Float contribution = beta.Average() * guidedBSDF.ReflectedRadiance(wo);
+            if (pathEstimate == 0)
+                pathEstimate = L.Average() + contribution;
+            if (contribution > 0) {
+                // Apply Russian roulette or splitting to keep the path's expected
+                // contribution within the weight window
+                adjointRR = true;
+                Float ratio = contribution / pathEstimate;
+                Float pContinue = AdjointWeightWindow::ContinueProbability(ratio);
+                if (pContinue < 1) {
+                    ++adjointTerminationTests;
+                    if (sampler.Get1D() >= pContinue) {
+                        ++adjointTerminations;
+                        break;
+                    }
+                    beta /= pContinue;
+                }
+                nSplits = AdjointWeightWindow::Splits(ratio);
+            }
+        }
+        for (int i = 1; i < nSplits; ++i) {
+            // Sample direction for split path and trace it from the vertex
+            ++adjointSplitPaths;
+            Float u = sampler.Get1D();
+            pstd::optional<BSDFSample> bs = guidedBSDF.Sample_f(wo, u, sampler.Get2D());
+            if (!bs)
+                continue;
+            PathPrefix splitPrefix{
+                beta * bs->f * AbsDot(bs->wi, isect.shading.n) / (bs->pdf * nSplits),
+                depth,
+                bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf,
+                bs->IsTransmission() ? etaScale * Sqr(bs->eta) : etaScale,
+                bs->IsSpecular(),
+                anyNonSpecularBounces || !bs->IsSpecular(),
+                si->intr,
+                pathEstimate};
+            SampledWavelengths lambdaSplit = lambda;
+            SampledSpectrum LSplit =
+                TracePath(isect.SpawnRay(ray, bsdf, bs->wi, bs->flags, bs->eta),
+                          lambdaSplit, sampler, scratchBuffer, nullptr, splitPrefix);
+            if (lambdaSplit.SecondaryTerminated() && !lambda.SecondaryTerminated()) {
+                // Add split path's radiance as an estimate for the hero wavelength
+                SampledSpectrum LHero(0.f);
+                LHero[0] = LSplit[0] * NSpectrumSamples;
+                LSplit = LHero;
+            }
+            L += LSplit;
+        }
+        beta /= nSplits;
+
+        // Sample BSDF, possibly guided, to get new path direction
         Float u = sampler.Get1D();
-        pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, sampler.Get2D());
+        pstd::optional<BSDFSample> bs = guidedBSDF.Sample_f(wo, u, sampler.Get2D());
         if (!bs)
             break;
         // Update path state variables after surface scattering
         beta *= bs->f * AbsDot(bs->wi, isect.shading.n) / bs->pdf;
         bsdfPDF = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
         DCHECK(!IsInf(beta.y(lambda)));
+        // Remember vertex to record the radiance that arrives along _wi_
+        if (sdTree && GuidingSDTree::CanGuide(bsdf.Flags()) &&
+            nGuidedVertices < MaxGuidedVertices) {
+            Float pathScale = beta.Average() * bsdfPDF;
+            if (pathScale > 0)
+                guidedVertices[nGuidedVertices++] =
+                    GuidedVertex{isect.p(), bs->wi, L, 1 / pathScale};
+        }
         specularBounce = bs->IsSpecular();
         anyNonSpecularBounces |= !bs->IsSpecular();
         if (bs->IsTransmission())
@@ -753,7 +1389,7 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
 
         // Possibly terminate the path with Russian roulette
         SampledSpectrum rrBeta = beta * etaScale;
-        if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+        if (!adjointRR && rrBeta.MaxComponentValue() < 1 && depth > 1) {
             Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
             if (sampler.Get1D() < q)
                 break;
@@ -761,13 +1397,24 @@ SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
             DCHECK(!IsInf(beta.y(lambda)));
         }
     }
+    // Record incident radiance estimates at the path's guided vertices
+    for (int i = 0; i < nGuidedVertices; ++i)
+        sdTree->RecordVertex(guidedVertices[i].p, guidedVertices[i].wi,
+                             (L - guidedVertices[i].L).Average() *
+                                 guidedVertices[i].scale);
+    if (reusedWavelengths) {
+        // Replace secondary wavelengths' radiance with their own paths' estimates
+        for (int i = 1; i < NSpectrumSamples; ++i)
+            L[i] = LPrefix[i] + LReused[i];
+        lambda = lambdaPrefix;
+    }
     pathLength << depth;
     return L;
 }
 
 SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const BSDF *bsdf,
-                                         SampledWavelengths &lambda,
-                                         Sampler sampler) const {
+                                         SampledWavelengths &lambda, Sampler sampler,
+                                         const GuidingQuadtree *quadtree) const {
     // Initialize _LightSampleContext_ for light sampling
     LightSampleContext ctx(intr);
     // Try to nudge the light sampling position to correct side of the surface
@@ -776,6 +1423,8 @@ SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const B
         ctx.pi = intr.OffsetRayOrigin(intr.wo);
     else if (IsTransmissive(flags) && !IsReflective(flags))
         ctx.pi = intr.OffsetRayOrigin(-intr.wo);
+    if (nLightSamples > 1)
+        return SampleLdBatch(intr, bsdf, ctx, lambda, sampler, quadtree);
 
     // Choose a light source for the direct lighting calculation
     Float u = sampler.Get1D();
@@ -789,29 +1438,116 @@ SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const B
     DCHECK(light != nullptr && sampledLight->pdf > 0);
     pstd::optional<LightLiSample> ls =
         light.SampleLi(ctx, uLight, lambda, LightSamplingMode::WithMIS);
-    if (!ls || !ls->L || ls->pdf == 0)
+    if (!ls || !ls->L || ls->pdf == 0) {
+        RecordLightSample(lightSampler, ctx, light, 0);
         return {};
+    }
 
     // Evaluate BSDF for light sample and check light visibility
     Vector3f wo = intr.wo, wi = ls->wi;
     SampledSpectrum f = bsdf->f(wo, wi) * AbsDot(wi, intr.shading.n);
-    if (!f || !Unoccluded(intr, ls->pLight))
+    if (!f || !Unoccluded(intr, ls->pLight)) {
+        RecordLightSample(lightSampler, ctx, light, 0);
         return {};
+    }
 
     // Return light's contribution to reflected radiance
     Float lightPDF = sampledLight->pdf * ls->pdf;
-    if (IsDeltaLight(light.Type()))
-        return f * ls->L / lightPDF;
-    else {
-        Float bsdfPDF = bsdf->PDF(wo, wi);
-        Float weight = PowerHeuristic(1, lightPDF, 1, bsdfPDF);
-        return f * ls->L * weight / lightPDF;
+    RecordLightSample(lightSampler, ctx, light, (f * ls->L).Average() / lightPDF);
+    Float weight = 1;
+    if (!IsDeltaLight(light.Type())) {
+        Float bsdfPDF = GuidedBSDF(bsdf, quadtree).PDF(wo, wi);
+        weight = PowerHeuristic(1, lightPDF, 1, bsdfPDF);
+    }
+    // Record the light's radiance arriving along _wi_ for guiding
+    if (sdTree && GuidingSDTree::CanGuide(flags))
+        sdTree->Record(intr.p(), wi, ls->L.Average() * weight / lightPDF);
+    return f * ls->L * weight / lightPDF;
+}
+
+SampledSpectrum PathIntegrator::SampleLdBatch(const SurfaceInteraction &intr,
+                                              const BSDF *bsdf,
+                                              const LightSampleContext &ctx,
+                                              SampledWavelengths &lambda,
+                                              Sampler sampler,
+                                              const GuidingQuadtree *quadtree) const {
+    // Choose _nLightSamples_ stratified light sources for direct lighting
+    constexpr int maxSamples = BVHLightSampler::MaxBatchSamples;
+    Float u = sampler.Get1D();
+    Point2f uLight[maxSamples];
+    for (int i = 0; i < nLightSamples; ++i)
+        uLight[i] = sampler.Get2D();
+    SampledLight sampledLights[maxSamples];
+    int nSampled = 0;
+    if (const BVHLightSampler *bvh = lightSampler.CastOrNullptr<BVHLightSampler>())
+        nSampled = bvh->Sample(ctx, u, pstd::MakeSpan(sampledLights, nLightSamples));
+    else
+        for (int i = 0; i < nLightSamples; ++i)
+            if (pstd::optional<SampledLight> sampledLight =
+                    lightSampler.Sample(ctx, (i + u) / nLightSamples))
+                sampledLights[nSampled++] = *sampledLight;
+
+    // Sample points on the lights and find their unoccluded contributions
+    Ray rays[maxSamples];
+    Float tMax[maxSamples], observed[maxSamples], guideRadiance[maxSamples];
+    Light rayLights[maxSamples];
+    SampledSpectrum Ld[maxSamples];
+    int nRays = 0;
+    Vector3f wo = intr.wo;
+    for (int i = 0; i < nSampled; ++i) {
+        Light light = sampledLights[i].light;
+        DCHECK(light != nullptr && sampledLights[i].pdf > 0);
+        pstd::optional<LightLiSample> ls =
+            light.SampleLi(ctx, uLight[i], lambda, LightSamplingMode::WithMIS);
+        if (!ls || !ls->L || ls->pdf == 0) {
+            RecordLightSample(lightSampler, ctx, light, 0);
+            continue;
+        }
+        Vector3f wi = ls->wi;
+        SampledSpectrum f = bsdf->f(wo, wi) * AbsDot(wi, intr.shading.n);
+        if (!f) {
+            RecordLightSample(lightSampler, ctx, light, 0);
+            continue;
+        }
+
+        // Compute the sample's contribution, weighted for _nLightSamples_ light samples
+        Float lightPDF = sampledLights[i].pdf * ls->pdf;
+        Float weight = 1;
+        if (!IsDeltaLight(light.Type()))
+            weight = PowerHeuristic(nLightSamples, lightPDF, 1,
+                                    GuidedBSDF(bsdf, quadtree).PDF(wo, wi));
+        Ld[nRays] = f * ls->L * weight / (nLightSamples * lightPDF);
+        observed[nRays] = (f * ls->L).Average() / lightPDF;
+        guideRadiance[nRays] = ls->L.Average() * weight / (nLightSamples * lightPDF);
+        rayLights[nRays] = light;
+        rays[nRays] = intr.SpawnRayTo(ls->pLight);
+        tMax[nRays] = 1 - ShadowEpsilon;
+        ++nRays;
+    }
+
+    // Trace the shadow rays together and sum the unoccluded contributions
+    bool hit[maxSamples];
+    IntersectP(pstd::MakeConstSpan(rays, nRays), pstd::MakeConstSpan(tMax, nRays),
+               pstd::MakeSpan(hit, nRays));
+    SampledSpectrum L(0.f);
+    bool recordGuiding = sdTree && GuidingSDTree::CanGuide(bsdf->Flags());
+    for (int i = 0; i < nRays; ++i) {
+        RecordLightSample(lightSampler, ctx, rayLights[i], hit[i] ? 0 : observed[i]);
+        if (!hit[i]) {
+            L += Ld[i];
+            // Record the light's radiance arriving along the ray for guiding
+            if (recordGuiding)
+                sdTree->Record(intr.p(), Normalize(rays[i].d), guideRadiance[i]);
+        }
     }
+    return L;
 }
 
 std::string PathIntegrator::ToString() const {
-    return StringPrintf("[ PathIntegrator maxDepth: %d lightSampler: %s regularize: %s ]",
-                        maxDepth, lightSampler, regularize);
+    return StringPrintf("[ PathIntegrator maxDepth: %d lightSampler: %s regularize: %s "
+                        "spectralReuse: %s nLightSamples: %d guiding: %s adrrs: %s ]",
+                        maxDepth, lightSampler, regularize, spectralReuse, nLightSamples,
+                        sdTree != nullptr, adrrs);
 }
 
 std::unique_ptr<PathIntegrator> PathIntegrator::Create(
@@ -820,8 +1556,29 @@ std::unique_ptr<PathIntegrator> PathIntegrator::Create(
     int maxDepth = parameters.GetOneInt("maxdepth", 5);
     std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
     bool regularize = parameters.GetOneBool("regularize", false);
+    bool spectralReuse = parameters.GetOneBool("spectralreuse", false);
+    int nLightSamples = parameters.GetOneInt("lightsamples", 1);
+    if (nLightSamples < 1 || nLightSamples > BVHLightSampler::MaxBatchSamples)
+        ErrorExit(loc, "\"lightsamples\" must be between 1 and %d.",
+                  BVHLightSampler::MaxBatchSamples);
+    Float lightCullThreshold = parameters.GetOneFloat("lightcullthreshold", 0.f);
+    lights = CullAreaLights(std::move(lights), camera, aggregate, lightCullThreshold,
+                            lightStrategy);
+    // Create the tree that learns radiance arriving at surfaces, if requested
+    bool guiding = parameters.GetOneBool("guiding", false);
+    bool adrrs = parameters.GetOneBool("adrrs", false);
+    if (adrrs && !guiding) {
+        Warning(loc, "\"adrrs\" uses the radiance learned for path guiding, which "
+                     "will be enabled.");
+        guiding = true;
+    }
+    GuidingSDTree *sdTree = nullptr;
+    if (guiding)
+        sdTree = Allocator().new_object<GuidingSDTree>(aggregate ? aggregate.Bounds()
+                                                                 : Bounds3f());
     return std::make_unique<PathIntegrator>(maxDepth, camera, sampler, aggregate, lights,
-                                            lightStrategy, regularize);
+                                            lightStrategy, regularize, spectralReuse,
+                                            nLightSamples, sdTree, adrrs);
 }
 
 // SimpleVolPathIntegrator Method Definitions
@@ -849,6 +1606,7 @@ SampledSpectrum SimpleVolPathIntegrator::Li(RayDifferential ray,
 
     while (true) {
         // Estimate radiance for ray path using delta tracking
+        StatsSetRayDepth(depth);
         pstd::optional<ShapeIntersection> si = Intersect(ray);
         bool scattered = false, terminated = false;
         if (ray.medium) {
@@ -953,7 +1711,51 @@ std::unique_ptr<SimpleVolPathIntegrator> SimpleVolPathIntegrator::Create(
 STAT_COUNTER("Integrator/Volume interactions", volumeInteractions);
 STAT_COUNTER("Integrator/Surface interactions", surfaceInteractions);
 
+// PathSampleDimensions Method Definitions
+PathSampleDimensions::PathSampleDimensions(bool haveMedia, bool haveSubsurface) {
+    offset.fill(-1);
+    count.fill(0);
+    auto allocate = [&](Use use, int n) {
+        offset[int(use)] = blockSize;
+        count[int(use)] = n;
+        blockSize += n;
+    };
+    // Allocate dimensions for each use at a path vertex
+    if (haveMedia)
+        allocate(Use::Medium, 3);
+    allocate(Use::Material, Options->forceDiffuse ? 3 : 0);
+    allocate(Use::DirectLighting, 3);
+    allocate(Use::Scattering, 3);
+    offset[int(Use::Phase)] = offset[int(Use::Scattering)];
+    count[int(Use::Phase)] = 2;
+    if (haveSubsurface)
+        allocate(Use::Subsurface, 10);
+    allocate(Use::RussianRoulette, 1);
+}
+
+void PathSampleDimensions::Begin(Sampler sampler, Use use) {
+    DCHECK_GE(offset[int(use)], 0);
+    int start = block * blockSize + offset[int(use)];
+    DCHECK_LE(next, start);
+    // Skip the dimensions of uses that didn't happen at this vertex
+    for (; next < start; ++next)
+        sampler.Get1D();
+    next = start + count[int(use)];
+}
+
+std::string PathSampleDimensions::ToString() const {
+    return StringPrintf("[ PathSampleDimensions offset: %s count: %s blockSize: %d "
+                        "block: %d next: %d ]",
+                        offset, count, blockSize, block, next);
+}
+
 // VolPathIntegrator Method Definitions
+void VolPathIntegrator::StartWave(Bounds2i bandBounds, int waveStart, int waveEnd) {
+    // Train the surface guiding tree on the previous wave's records
+    if (sdTree)
+        sdTree->StartIteration(waveEnd - waveStart);
+}
+
 SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                       Sampler sampler, ScratchBuffer &scratchBuffer,
                                       VisibleSurface *visibleSurf) const {
@@ -962,8 +1764,45 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
     bool specularBounce = false, anyNonSpecularBounces = false;
     int depth = 0;
     Float etaScale = 1;
+    // Estimate of the path's radiance for adjoint-driven Russian roulette
+    Float pathEstimate = 0;
 
     LightSampleContext prevIntrContext;
+    using Use = PathSampleDimensions::Use;
+    PathSampleDimensions dims = sampleDimensions;
+
+    // Declare state for recording incident radiance at medium scattering vertices
+    struct GuidedVertex {
+        Point3f p;
+        Vector3f wi;
+        // Ratio of incident radiance to path contribution for this vertex
+        Float scale;
+    };
+    constexpr int MaxGuidedVertices = 4;
+    GuidedVertex guidedVertices[MaxGuidedVertices];
+    int nGuidedVertices = 0;
+    // Declare state for recording incident radiance at guided surface vertices
+    struct GuidedSurfaceVertex {
+        Point3f p;
+        Vector3f wi;
+        // Path radiance before the radiance that arrives along _wi_
+        SampledSpectrum L;
+        // Converts radiance added to the path to incident radiance over its PDF
+        Float scale;
+    };
+    constexpr int MaxGuidedSurfaceVertices = 16;
+    GuidedSurfaceVertex guidedSurfaceVertices[MaxGuidedSurfaceVertices];
+    int nGuidedSurfaceVertices = 0;
+    auto addRadiance = [&](const SampledSpectrum &Ld) {
+        // Add _Ld_ to _L_ and record it at the most recent medium scattering vertices
+        L += Ld;
+        if (!guidingField || !Ld)
+            return;
+        Float LdAverage = Ld.Average();
+        for (int i = 0; i < std::min(nGuidedVertices, MaxGuidedVertices); ++i)
+            guidingField->Record(guidedVertices[i].p, guidedVertices[i].wi,
+                                 LdAverage * guidedVertices[i].scale);
+    };
 
     while (true) {
         // Sample segment of volumetric scattering path
@@ -971,12 +1810,15 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                  StringPrintf("Path tracer depth %d, current L = %s, T_hat = %s\n", depth,
                               L, T_hat)
                      .c_str());
+        dims.StartBlock();
+        StatsSetRayDepth(depth);
         pstd::optional<ShapeIntersection> si = Intersect(ray);
         if (ray.medium) {
             // Sample the participating medium
             bool scattered = false, terminated = false;
             Float tMax = si ? si->tHit : Infinity;
             // Initialize RNG for delta tracking
+            dims.Begin(sampler, Use::Medium);
             uint64_t hash0 = Hash(sampler.Get1D());
             uint64_t hash1 = Hash(sampler.Get1D());
             RNG rng(hash0, hash1);
@@ -1006,7 +1848,19 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                         SampledSpectrum emitPDF = uniPathPDF * intr.sigma_maj * T_maj;
 
                         // Update _L_ for medium emission
-                        L += P_hat / emitPDF.Average();
+                        Light volumeLight = VolumeLight(ray.medium);
+                        if (depth == 0 || specularBounce || !volumeLight)
+                            addRadiance(P_hat / emitPDF.Average());
+                        else {
+                            // Add medium emission using both PDFs with MIS
+                            Float lightPDF =
+                                lightSampler.PDF(prevIntrContext, volumeLight) *
+                                volumeLight.Cast<VolumeEmitterLight>()->PDF_Li(
+                                    prevIntrContext, intr.p());
+                            SampledSpectrum lightEmitPDF =
+                                lightPathPDF * T_maj * lightPDF;
+                            addRadiance(P_hat / (emitPDF + lightEmitPDF).Average());
+                        }
                     }
 
                     // Compute medium event probabilities for interaction
@@ -1034,16 +1888,26 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                         T_hat *= T_maj * sigma_s;
                         uniPathPDF *= T_maj * sigma_s;
                         // Sample direct lighting at volume scattering event
-                        L += SampleLd(intr, nullptr, lambda, sampler, T_hat, uniPathPDF);
+                        dims.Begin(sampler, Use::DirectLighting);
+                        addRadiance(SampleLd(intr, nullptr, lambda, sampler, T_hat,
+                                             uniPathPDF, depth));
 
                         // Sample new direction at real scattering event
+                        dims.Begin(sampler, Use::Phase);
                         Point2f u = sampler.Get2D();
                         pstd::optional<PhaseFunctionSample> ps =
-                            intr.phase.Sample_p(-ray.d, u);
+                            guidingField
+                                ? guidingField->Sample_p(intr.phase, intr.p(), -ray.d, u)
+                                : intr.phase.Sample_p(-ray.d, u);
                         if (!ps || ps->pdf == 0) {
                             terminated = true;
                             return false;
                         }
+                        // Remember vertex to record radiance that arrives along _wi_
+                        Float pathScale = T_hat.Average() * ps->p / uniPathPDF.Average();
+                        if (guidingField && pathScale > 0)
+                            guidedVertices[nGuidedVertices++ % MaxGuidedVertices] =
+                                GuidedVertex{intr.p(), ps->wi, 1 / pathScale};
                         // Update ray path state for indirect volume scattering
                         T_hat *= ps->p;
                         lightPathPDF = uniPathPDF;
@@ -1068,7 +1932,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                 });
             // Handle terminated, scattered, and unscattered rays after medium sampling
             if (terminated)
-                return L;
+                break;
             if (scattered)
                 continue;
             T_hat *= T_maj;
@@ -1082,14 +1946,14 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
             for (const auto &light : infiniteLights) {
                 if (SampledSpectrum Le = light.Le(ray, lambda); Le) {
                     if (depth == 0 || specularBounce)
-                        L += T_hat * Le / uniPathPDF.Average();
+                        addRadiance(T_hat * Le / uniPathPDF.Average());
                     else {
                         // Add infinite light contribution using both PDFs with MIS
                         Float lightPDF = lightSampler.PDF(prevIntrContext, light) *
                                          light.PDF_Li(prevIntrContext, ray.d,
                                                       LightSamplingMode::WithMIS);
                         lightPathPDF *= lightPDF;
-                        L += T_hat * Le / (uniPathPDF + lightPathPDF).Average();
+                        addRadiance(T_hat * Le / (uniPathPDF + lightPathPDF).Average());
                     }
                 }
             }
@@ -1100,7 +1964,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
         if (SampledSpectrum Le = isect.Le(-ray.d, lambda); Le) {
             // Add contribution of emission from intersected surface
             if (depth == 0 || specularBounce)
-                L += T_hat * Le / uniPathPDF.Average();
+                addRadiance(T_hat * Le / uniPathPDF.Average());
             else {
                 // Add surface light contribution using both PDFs with MIS
                 Light areaLight(isect.areaLight);
@@ -1108,11 +1972,12 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                     lightSampler.PDF(prevIntrContext, areaLight) *
                     areaLight.PDF_Li(prevIntrContext, ray.d, LightSamplingMode::WithMIS);
                 lightPathPDF *= lightPDF;
-                L += T_hat * Le / (uniPathPDF + lightPathPDF).Average();
+                addRadiance(T_hat * Le / (uniPathPDF + lightPathPDF).Average());
             }
         }
 
         // Get BSDF and skip over medium boundaries
+        dims.Begin(sampler, Use::Material);
         BSDF bsdf = isect.GetBSDF(ray, lambda, camera, scratchBuffer, sampler);
         if (!bsdf) {
             isect.SkipIntersection(&ray, si->tHit);
@@ -1146,7 +2011,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
 
         // Terminate path if maximum depth reached
         if (depth++ >= maxDepth)
-            return L;
+            break;
 
         ++surfaceInteractions;
         // Possibly regularize the BSDF
@@ -1155,29 +2020,57 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
             bsdf.Regularize();
         }
 
+        // Find the incident radiance learned at the vertex for guiding, if any
+        const GuidingQuadtree *quadtree =
+            sdTree ? sdTree->Lookup(isect.p(), bsdf) : nullptr;
+
         // Sample illumination from lights to find attenuated path contribution
         if (IsNonSpecular(bsdf.Flags())) {
-            L += SampleLd(isect, &bsdf, lambda, sampler, T_hat, uniPathPDF);
+            dims.Begin(sampler, Use::DirectLighting);
+            addRadiance(SampleLd(isect, &bsdf, lambda, sampler, T_hat, uniPathPDF, depth,
+                                 quadtree));
             DCHECK(IsInf(L.y(lambda)) == false);
         }
         prevIntrContext = LightSampleContext(isect);
 
-        // Sample BSDF to get new volumetric path direction
+        // Find probability of continuing the path from the learned radiance, if used
         Vector3f wo = isect.wo;
+        GuidedBSDF guidedBSDF(&bsdf, quadtree);
+        Float adjointContinue = 0;
+        if (adrrs && quadtree) {
+            Float contribution = T_hat.Average() / uniPathPDF.Average() *
+                                 guidedBSDF.ReflectedRadiance(wo);
+            if (pathEstimate == 0)
+                pathEstimate = L.Average() + contribution;
+            if (contribution > 0)
+                adjointContinue =
+                    AdjointWeightWindow::ContinueProbability(contribution / pathEstimate);
+        }
+
+        // Sample BSDF, possibly guided, to get new volumetric path direction
+        dims.Begin(sampler, Use::Scattering);
         Float u = sampler.Get1D();
-        pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, sampler.Get2D());
+        pstd::optional<BSDFSample> bs = guidedBSDF.Sample_f(wo, u, sampler.Get2D());
         if (!bs)
             break;
         // Update _T_hat_ and PDFs for BSDF scattering
         T_hat *= bs->f * AbsDot(bs->wi, isect.shading.n);
         lightPathPDF = uniPathPDF;
+        Float scatterPDF = bs->pdf;
         if (bs->pdfIsProportional) {
-            Float pdf = bsdf.PDF(wo, bs->wi);
-            T_hat *= pdf / bs->pdf;
-            uniPathPDF *= pdf;
-        } else
-            uniPathPDF *= bs->pdf;
+            scatterPDF = bsdf.PDF(wo, bs->wi);
+            T_hat *= scatterPDF / bs->pdf;
+        }
+        uniPathPDF *= scatterPDF;
         Rescale(T_hat, uniPathPDF, lightPathPDF);
+        // Remember vertex to record the radiance that arrives along _wi_
+        if (sdTree && GuidingSDTree::CanGuide(bsdf.Flags()) &&
+            nGuidedSurfaceVertices < MaxGuidedSurfaceVertices) {
+            Float pathScale = T_hat.Average() / uniPathPDF.Average() * scatterPDF;
+            if (pathScale > 0)
+                guidedSurfaceVertices[nGuidedSurfaceVertices++] =
+                    GuidedSurfaceVertex{isect.p(), bs->wi, L, 1 / pathScale};
+        }
 
         PBRT_DBG("%s\n", StringPrintf("Sampled BSDF, f = %s, pdf = %f -> T_hat = %s",
                                       bs->f, bs->pdf, T_hat)
@@ -1194,6 +2087,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
         BSSRDF bssrdf = isect.GetBSSRDF(ray, lambda, camera, scratchBuffer);
         if (bssrdf && bs->IsTransmission()) {
             // Sample BSSRDF probe segment to find exit point
+            dims.Begin(sampler, Use::Subsurface);
             Float uc = sampler.Get1D();
             Point2f up = sampler.Get2D();
             pstd::optional<BSSRDFProbeSegment> probeSeg = bssrdf.SampleSp(uc, up);
@@ -1209,7 +2103,8 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                 Ray r = base.SpawnRayTo(probeSeg->p1);
                 if (r.d == Vector3f(0, 0, 0))
                     break;
-                pstd::optional<ShapeIntersection> si = Intersect(r, 1);
+                pstd::optional<ShapeIntersection> si =
+                    Intersect(r, 1, RayType::BSSRDFProbe);
                 if (!si)
                     break;
                 base = si->intr;
@@ -1242,7 +2137,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                 ++totalBSDFs;
 
             // Account for attenuated direct subsurface scattering
-            L += SampleLd(pi, &Sw, lambda, sampler, T_hat, uniPathPDF);
+            addRadiance(SampleLd(pi, &Sw, lambda, sampler, T_hat, uniPathPDF, depth));
 
             // Sample ray for indirect subsurface scattering
             Float u = sampler.Get1D();
@@ -1262,10 +2157,20 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
         if (!T_hat)
             break;
         SampledSpectrum rrBeta = T_hat * etaScale / uniPathPDF.Average();
+        dims.Begin(sampler, Use::RussianRoulette);
         Float uRR = sampler.Get1D();
         PBRT_DBG("%s\n",
                  StringPrintf("etaScale %f -> rrBeta %s", etaScale, rrBeta).c_str());
-        if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+        if (adjointContinue > 0) {
+            // Apply Russian roulette to keep the path's expected contribution within
+            // the weight window
+            if (adjointContinue < 1) {
+                if (uRR >= adjointContinue)
+                    break;
+                uniPathPDF *= adjointContinue;
+                lightPathPDF *= adjointContinue;
+            }
+        } else if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
             Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
             if (uRR < q)
                 break;
@@ -1273,13 +2178,19 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
             lightPathPDF *= 1 - q;
         }
     }
+    // Record incident radiance estimates at the path's guided surface vertices
+    for (int i = 0; i < nGuidedSurfaceVertices; ++i)
+        sdTree->RecordVertex(guidedSurfaceVertices[i].p, guidedSurfaceVertices[i].wi,
+                             (L - guidedSurfaceVertices[i].L).Average() *
+                                 guidedSurfaceVertices[i].scale);
     return L;
 }
 
 SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF *bsdf,
                                             SampledWavelengths &lambda, Sampler sampler,
                                             SampledSpectrum T_hat,
-                                            SampledSpectrum pathPDF) const {
+                                            SampledSpectrum pathPDF, int depth,
+                                            const GuidingQuadtree *quadtree) const {
     // Estimate light-sampled direct illumination at _intr_
     // Initialize _LightSampleContext_ for volumetric light sampling
     LightSampleContext ctx;
@@ -1307,8 +2218,10 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
     // Sample a point on the light source
     pstd::optional<LightLiSample> ls =
         light.SampleLi(ctx, uLight, lambda, LightSamplingMode::WithMIS);
-    if (!ls || !ls->L || ls->pdf == 0)
+    if (!ls || !ls->L || ls->pdf == 0) {
+        RecordLightSample(lightSampler, ctx, light, 0);
         return SampledSpectrum(0.f);
+    }
     Float lightPDF = sampledLight->pdf * ls->pdf;
 
     // Evaluate BSDF or phase function for light sample direction
@@ -1318,17 +2231,20 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
     if (bsdf) {
         // Update _bsdfLight_ and _scatterPDF_ accounting for the BSDF
         f_hat = bsdf->f(wo, wi) * AbsDot(wi, intr.AsSurface().shading.n);
-        scatterPDF = bsdf->PDF(wo, wi);
+        scatterPDF = GuidedBSDF(bsdf, quadtree).PDF(wo, wi);
 
     } else {
         // Update _bsdfLight_ and _scatterPDF_ accounting for the phase function
         CHECK(intr.IsMediumInteraction());
         PhaseFunction phase = intr.AsMedium().phase;
         f_hat = SampledSpectrum(phase.p(wo, wi));
-        scatterPDF = phase.PDF(wo, wi);
+        scatterPDF = guidingField ? guidingField->PDF(phase, intr.p(), wo, wi)
+                                  : phase.PDF(wo, wi);
     }
-    if (!f_hat)
+    if (!f_hat) {
+        RecordLightSample(lightSampler, ctx, light, 0);
         return SampledSpectrum(0.f);
+    }
 
     // Declare path state variables for ray to light source
     Ray lightRay = intr.SpawnRayTo(ls->pLight);
@@ -1337,42 +2253,56 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
 
     while (lightRay.d != Vector3f(0, 0, 0)) {
         // Trace ray through media to estimate transmittance
-        pstd::optional<ShapeIntersection> si = Intersect(lightRay, 1 - ShadowEpsilon);
+        pstd::optional<ShapeIntersection> si =
+            Intersect(lightRay, 1 - ShadowEpsilon, RayType::Shadow);
         // Handle opaque surface along ray's path
-        if (si && si->intr.material)
+        if (si && si->intr.material) {
+            RecordLightSample(lightSampler, ctx, light, 0);
             return SampledSpectrum(0.f);
+        }
 
         // Update transmittance for current ray segment
         if (lightRay.medium != nullptr) {
             Float tMax = si ? si->tHit : (1 - ShadowEpsilon);
             Float u = rng.Uniform<Float>();
-            SampledSpectrum T_maj = lightRay.medium.SampleT_maj(
-                lightRay, tMax, u, rng, lambda, [&](const MediumSample &mediumSample) {
-                    // Update ray transmittance estimate at sampled point
-                    // Update _T_ray_ and PDFs using ratio-tracking estimator
-                    const MediumInteraction &intr = mediumSample.intr;
-                    SampledSpectrum T_maj = mediumSample.T_maj, sigma_n = intr.sigma_n();
-                    T_ray *= T_maj * sigma_n;
-                    lightPathPDF *= T_maj * intr.sigma_maj;
-                    uniPathPDF *= T_maj * sigma_n;
-
-                    // Possibly terminate transmittance computation using Russian roulette
-                    SampledSpectrum Tr = T_ray / (lightPathPDF + uniPathPDF).Average();
-                    if (Tr.MaxComponentValue() < 0.05f) {
-                        Float q = 0.75f;
-                        if (rng.Uniform<Float>() < q)
-                            T_ray = SampledSpectrum(0.);
-                        else {
-                            lightPathPDF *= 1 - q;
-                            uniPathPDF *= 1 - q;
-                        }
+            auto updateTransmittance = [&](const MediumSample &mediumSample) {
+                // Update ray transmittance estimate at sampled point
+                // Update _T_ray_ and PDFs using ratio-tracking estimator
+                const MediumInteraction &intr = mediumSample.intr;
+                SampledSpectrum T_maj = mediumSample.T_maj;
+                SampledSpectrum sigma_n = mediumSample.sigma_n();
+                T_ray *= T_maj * sigma_n;
+                lightPathPDF *= T_maj * intr.sigma_maj;
+                uniPathPDF *= T_maj * sigma_n;
+
+                // Possibly terminate transmittance computation using Russian roulette
+                SampledSpectrum Tr = T_ray / (lightPathPDF + uniPathPDF).Average();
+                if (Tr.MaxComponentValue() < 0.05f) {
+                    Float q = 0.75f;
+                    if (rng.Uniform<Float>() < q)
+                        T_ray = SampledSpectrum(0.);
+                    else {
+                        lightPathPDF *= 1 - q;
+                        uniPathPDF *= 1 - q;
                     }
+                }
 
-                    if (!T_ray)
-                        return false;
-                    Rescale(T_ray, lightPathPDF, uniPathPDF);
-                    return true;
-                });
+                if (!T_ray)
+                    return false;
+                Rescale(T_ray, lightPathPDF, uniPathPDF);
+                return true;
+            };
+            SampledSpectrum T_maj;
+            if (residualTracking) {
+                // Sample residual extinction and apply control transmittance
+                SampledSpectrum T_c;
+                T_maj = lightRay.medium.SampleT_res(lightRay, tMax, u, rng, lambda, &T_c,
+                                                    updateTransmittance);
+                T_ray *= T_c;
+                uniPathPDF *= T_c;
+            } else
+                T_maj = lightRay.medium.SampleT_maj(lightRay, tMax, u, rng, lambda,
+                                                    updateTransmittance);
             // Update transmittance estimate for final unsampled segment
             T_ray *= T_maj;
             lightPathPDF *= T_maj;
@@ -1380,46 +2310,118 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
         }
 
         // Generate next ray segment or return final transmittance
-        if (!T_ray)
+        if (!T_ray) {
+            RecordLightSample(lightSampler, ctx, light, 0);
             return SampledSpectrum(0.f);
+        }
         if (!si)
             break;
         lightRay = si->intr.SpawnRayTo(ls->pLight);
     }
+    bool isVolumeLight = light.Is<VolumeEmitterLight>();
+    if (isVolumeLight) {
+        // Only count emission that paths can find by tracking through the medium
+        Medium medium = light.Cast<VolumeEmitterLight>()->GetMedium();
+        if (lightRay.medium != medium) {
+            RecordLightSample(lightSampler, ctx, light, 0);
+            return SampledSpectrum(0.f);
+        }
+        // Account for the majorant at the sampled point in the tracking PDF
+        uniPathPDF *= medium.Sample(ls->pLight.p(), lambda).sigma_maj;
+    }
+    RecordLightSample(lightSampler, ctx, light,
+                      (f_hat * T_ray * ls->L).Average() /
+                          (lightPDF * lightPathPDF.Average()));
     // Return path contribution function estimate for direct lighting
     lightPathPDF *= pathPDF * lightPDF;
     uniPathPDF *= pathPDF * scatterPDF;
-    if (IsDeltaLight(light.Type()))
-        return T_hat * f_hat * T_ray * ls->L / lightPathPDF.Average();
-    else
-        return T_hat * f_hat * T_ray * ls->L / (lightPathPDF + uniPathPDF).Average();
+    // Paths at the maximum depth don't add medium emission, so they can't sample it
+    bool lightOnly = IsDeltaLight(light.Type()) || (isVolumeLight && depth >= maxDepth);
+    SampledSpectrum Ld =
+        lightOnly
+            ? T_hat * f_hat * T_ray * ls->L / lightPathPDF.Average()
+            : T_hat * f_hat * T_ray * ls->L / (lightPathPDF + uniPathPDF).Average();
+    // Record radiance arriving at medium scattering vertex for guiding
+    if (guidingField && !bsdf)
+        guidingField->Record(intr.p(), wi,
+                             Ld.Average() * pathPDF.Average() /
+                                 (T_hat.Average() * f_hat[0]));
+    // Record radiance arriving at surface vertex for guiding
+    if (sdTree && bsdf && GuidingSDTree::CanGuide(bsdf->Flags()))
+        sdTree->Record(intr.p(), wi,
+                       Ld.Average() * pathPDF.Average() /
+                           (T_hat.Average() * f_hat.Average()));
+    return Ld;
 }
 
 std::string VolPathIntegrator::ToString() const {
     return StringPrintf(
-        "[ VolPathIntegrator maxDepth: %d lightSampler: %s regularize: %s ]", maxDepth,
-        lightSampler, regularize);
+        "[ VolPathIntegrator maxDepth: %d lightSampler: %s regularize: %s "
+        "residualTracking: %s guiding: %s surfaceGuiding: %s adrrs: %s "
+        "sampleDimensions: %s ]",
+        maxDepth, lightSampler, regularize, residualTracking, guidingField != nullptr,
+        sdTree != nullptr, adrrs, sampleDimensions);
 }
 
 std::unique_ptr<VolPathIntegrator> VolPathIntegrator::Create(
     const ParameterDictionary &parameters, Camera camera, Sampler sampler,
-    Primitive aggregate, std::vector<Light> lights, const FileLoc *loc) {
+    Primitive aggregate, std::vector<Light> lights, const std::vector<Medium> &media,
+    bool haveMedia, bool haveSubsurface, const FileLoc *loc) {
     int maxDepth = parameters.GetOneInt("maxdepth", 5);
     std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
     bool regularize = parameters.GetOneBool("regularize", false);
-    return std::make_unique<VolPathIntegrator>(maxDepth, camera, sampler, aggregate,
-                                               lights, lightStrategy, regularize);
+    std::string transmittance = parameters.GetOneString("transmittance", "ratio");
+    if (transmittance != "ratio" && transmittance != "residual")
+        ErrorExit(loc, "%s: transmittance estimator unknown.", transmittance);
+    Float lightCullThreshold = parameters.GetOneFloat("lightcullthreshold", 0.f);
+    lights = CullAreaLights(std::move(lights), camera, aggregate, lightCullThreshold,
+                            lightStrategy);
+    // Add lights that sample the emission of emissive media, if requested
+    if (parameters.GetOneBool("volumelights", true))
+        for (Medium medium : media)
+            if (VolumeEmitterLight *light = VolumeEmitterLight::Create(medium, {}))
+                lights.push_back(light);
+    // Create the structures that learn radiance arriving in media and at surfaces,
+    // if requested
+    bool guiding = parameters.GetOneBool("guiding", false);
+    bool adrrs = parameters.GetOneBool("adrrs", false);
+    if (adrrs && !guiding) {
+        Warning(loc, "\"adrrs\" uses the radiance learned for path guiding, which "
+                     "will be enabled.");
+        guiding = true;
+    }
+    VolumeGuidingField *guidingField = nullptr;
+    GuidingSDTree *sdTree = nullptr;
+    if (guiding) {
+        Allocator alloc;
+        Bounds3f bounds = aggregate ? aggregate.Bounds() : Bounds3f();
+        if (haveMedia)
+            guidingField = alloc.new_object<VolumeGuidingField>(bounds, alloc);
+        sdTree = alloc.new_object<GuidingSDTree>(bounds);
+    }
+    return std::make_unique<VolPathIntegrator>(
+        maxDepth, camera, sampler, aggregate, lights, lightStrategy, regularize,
+        haveMedia, haveSubsurface, transmittance == "residual", guidingField, sdTree,
+        adrrs);
 }
 
 // AOIntegrator Method Definitions
 AOIntegrator::AOIntegrator(bool cosSample, Float maxDist, Camera camera, Sampler sampler,
                            Primitive aggregate, std::vector<Light> lights,
-                           Spectrum illuminant)
+                           Spectrum illuminant, VisibilityCache *visibilityCache)
     : RayIntegrator(camera, sampler, aggregate, lights),
       cosSample(cosSample),
       maxDist(maxDist),
       illuminant(illuminant),
-      illumScale(1.f / SpectrumToPhotometric(illuminant)) {}
+      illumScale(1.f / SpectrumToPhotometric(illuminant)),
+      visibilityCache(visibilityCache) {}
+
+void AOIntegrator::StartWave(Bounds2i bandBounds, int waveStart, int waveEnd) {
+    // Only reuse ambient occlusion within a wave so that waves make independent
+    // estimates
+    if (visibilityCache)
+        visibilityCache->Clear();
+}
 
 SampledSpectrum AOIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                  Sampler sampler, ScratchBuffer &scratchBuffer,
@@ -1460,19 +2462,26 @@ retry:
         Frame f = Frame::FromZ(n);
         wi = f.FromLocal(wi);
 
-        // Divide by pi so that fully visible is one.
-        Ray r = isect.SpawnRay(wi);
-        if (!IntersectP(r, maxDist)) {
-            return illumScale * illuminant.Sample(lambda) *
-                   SampledSpectrum(Dot(wi, n) / (Pi * pdf));
+        // Reuse ambient occlusion from nearby points if it is accurate enough
+        int cell = visibilityCache ? visibilityCache->Cell(isect.p(), n) : -1;
+        Float ao;
+        if (cell < 0 || !visibilityCache->Lookup(cell, &ao)) {
+            // Divide by pi so that fully visible is one.
+            Ray r = isect.SpawnRay(wi);
+            ao = IntersectP(r, maxDist) ? 0 : Dot(wi, n) / (Pi * pdf);
+            if (cell >= 0)
+                visibilityCache->Add(cell, ao);
         }
+        return illumScale * illuminant.Sample(lambda) * SampledSpectrum(ao);
     }
     return SampledSpectrum(0.);
 }
 
 std::string AOIntegrator::ToString() const {
-    return StringPrintf("[ AOIntegrator cosSample: %s maxDist: %f illuminant: %s ]",
-                        cosSample, maxDist, illuminant);
+    return StringPrintf("[ AOIntegrator cosSample: %s maxDist: %f illuminant: %s "
+                        "visibilityCache: %s ]",
+                        cosSample, maxDist, illuminant,
+                        visibilityCache ? visibilityCache->ToString() : "(nullptr)");
 }
 
 std::unique_ptr<AOIntegrator> AOIntegrator::Create(const ParameterDictionary &parameters,
@@ -1482,21 +2491,233 @@ std::unique_ptr<AOIntegrator> AOIntegrator::Create(const ParameterDictionary &pa
                                                    const FileLoc *loc) {
     bool cosSample = parameters.GetOneBool("cossample", true);
     Float maxDist = parameters.GetOneFloat("maxdistance", Infinity);
+    VisibilityCache *visibilityCache = CreateVisibilityCache(parameters, aggregate, loc);
     return std::make_unique<AOIntegrator>(cosSample, maxDist, camera, sampler, aggregate,
-                                          lights, illuminant);
+                                          lights, illuminant, visibilityCache);
+}
+
+// IrradianceCacheIntegrator Method Definitions
+IrradianceCacheIntegrator::IrradianceCacheIntegrator(
+    int maxDepth, int nGatherSamples, std::vector<IrradianceCache *> caches,
+    const RGBColorSpace *colorSpace, Camera camera, Sampler sampler, Primitive aggregate,
+    std::vector<Light> lights, const std::string &lightSampleStrategy)
+    : RayIntegrator(camera, sampler, aggregate, lights),
+      maxDepth(maxDepth),
+      caches(caches),
+      colorSpace(colorSpace),
+      lightSampler(LightSampler::Create(lightSampleStrategy, lights, Allocator())) {
+    // Stratify final gathering with about $\pi$ times as many divisions in $\phi$
+    // as in $\theta$
+    gatherM = std::max(1, int(std::round(std::sqrt(nGatherSamples / Pi))));
+    gatherN = std::max(1, int(std::round(Float(nGatherSamples) / gatherM)));
+}
+
+SampledSpectrum IrradianceCacheIntegrator::Li(RayDifferential ray,
+                                              SampledWavelengths &lambda,
+                                              Sampler sampler,
+                                              ScratchBuffer &scratchBuffer,
+                                              VisibleSurface *) const {
+    SampledSpectrum L(0.f), beta(1.f);
+    int depth = 0;
+    while (beta) {
+        // Follow _ray_ to the next surface, only adding emission since light
+        // sampling accounts for it at non-specular surfaces
+        StatsSetRayDepth(depth);
+        pstd::optional<ShapeIntersection> si = Intersect(ray);
+        if (!si) {
+            for (const auto &light : infiniteLights)
+                L += beta * light.Le(ray, lambda);
+            break;
+        }
+        SurfaceInteraction &isect = si->intr;
+        L += beta * isect.Le(-ray.d, lambda);
+
+        // Get BSDF and skip over medium boundaries
+        BSDF bsdf = isect.GetBSDF(ray, lambda, camera, scratchBuffer, sampler);
+        if (!bsdf) {
+            isect.SkipIntersection(&ray, si->tHit);
+            continue;
+        }
+        if (depth++ == maxDepth)
+            break;
+
+        // Add direct and cached indirect light at non-specular surfaces
+        if (IsNonSpecular(bsdf.Flags())) {
+            Float u = sampler.Get1D();
+            SampledSpectrum Ld = SampleLd(isect, bsdf, lambda, u, sampler.Get2D());
+            Float uc = sampler.Get1D();
+            Ld += IndirectLight(isect, bsdf, lambda, 0, uc, sampler.Get2D(), sampler,
+                                scratchBuffer);
+            L += beta * Ld;
+            break;
+        }
+
+        // Follow the specular bounce
+        Float u = sampler.Get1D();
+        pstd::optional<BSDFSample> bs = bsdf.Sample_f(-ray.d, u, sampler.Get2D());
+        if (!bs)
+            break;
+        beta *= bs->f * AbsDot(bs->wi, isect.shading.n) / bs->pdf;
+        ray = isect.SpawnRay(ray, bsdf, bs->wi, bs->flags, bs->eta);
+    }
+    return L;
+}
+
+SampledSpectrum IrradianceCacheIntegrator::SampleLd(const SurfaceInteraction &intr,
+                                                    const BSDF &bsdf,
+                                                    SampledWavelengths &lambda, Float u,
+                                                    Point2f uLight) const {
+    // Initialize _LightSampleContext_ on the side of the surface that is lit
+    LightSampleContext ctx(intr);
+    BxDFFlags flags = bsdf.Flags();
+    if (IsReflective(flags) && !IsTransmissive(flags))
+        ctx.pi = intr.OffsetRayOrigin(intr.wo);
+    else if (IsTransmissive(flags) && !IsReflective(flags))
+        ctx.pi = intr.OffsetRayOrigin(-intr.wo);
+
+    // Sample a light and a point on it
+    pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, u);
+    if (!sampledLight)
+        return {};
+    pstd::optional<LightLiSample> ls = sampledLight->light.SampleLi(ctx, uLight, lambda);
+    if (!ls || !ls->L || ls->pdf == 0)
+        return {};
+
+    // Return the light's contribution if it is visible
+    SampledSpectrum f = bsdf.f(intr.wo, ls->wi) * AbsDot(ls->wi, intr.shading.n);
+    if (!f || !Unoccluded(intr, ls->pLight))
+        return {};
+    return f * ls->L / (sampledLight->pdf * ls->pdf);
+}
+
+SampledSpectrum IrradianceCacheIntegrator::IndirectLight(
+    const SurfaceInteraction &intr, const BSDF &bsdf, SampledWavelengths &lambda,
+    int bounce, Float uc, Point2f u, Sampler sampler,
+    ScratchBuffer &scratchBuffer) const {
+    if (bounce >= int(caches.size()))
+        return {};
+    RGB E = ClampZero(Irradiance(intr, bounce, sampler, scratchBuffer));
+    if (E.Average() == 0)
+        return {};
+    // Reflect irradiance with the BSDF's albedo as if it was Lambertian
+    SampledSpectrum rho = bsdf.rho(intr.wo, {uc}, {u});
+    return rho * InvPi * RGBIlluminantSpectrum(*colorSpace, E).Sample(lambda);
+}
+
+RGB IrradianceCacheIntegrator::Irradiance(const SurfaceInteraction &intr, int bounce,
+                                          Sampler sampler,
+                                          ScratchBuffer &scratchBuffer) const {
+    // Interpolate irradiance from nearby records if there are any
+    IrradianceCache *cache = caches[bounce];
+    Point3f p = intr.p();
+    Normal3f n = FaceForward(intr.shading.n, intr.wo);
+    RGB E;
+    if (cache->Interpolate(p, n, &E))
+        return E;
+
+    // Add a record to the cache by final gathering at _p_
+    RNG rng(Hash(p, n, bounce));
+    Frame frame = Frame::FromZ(n);
+    std::vector<IrradianceGatherSample> samples(gatherM * gatherN);
+    for (int j = 0; j < gatherM; ++j)
+        for (int k = 0; k < gatherN; ++k) {
+            // Trace gather ray to the next surface, with its own wavelengths so that
+            // the record's color is well estimated
+            IrradianceGatherSample &s = samples[j * gatherN + k];
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            s.wLocal = IrradianceCache::GatherDirection(j, k, gatherM, gatherN, u);
+            SampledWavelengths lambda =
+                SampledWavelengths::SampleXYZ(rng.Uniform<Float>());
+            RayDifferential ray = intr.SpawnRay(frame.FromLocal(s.wLocal));
+            pstd::optional<ShapeIntersection> si = Intersect(ray);
+            BSDF bsdf;
+            while (si) {
+                bsdf = si->intr.GetBSDF(ray, lambda, camera, scratchBuffer, sampler);
+                if (bsdf)
+                    break;
+                si->intr.SkipIntersection(&ray, si->tHit);
+                si = Intersect(ray);
+            }
+            // Light from infinite lights and emissive surfaces is direct lighting,
+            // which is sampled separately
+            if (!si)
+                continue;
+            SurfaceInteraction &isect = si->intr;
+            s.distance = Distance(p, isect.p());
+
+            // Gather light reflected from non-specular surfaces
+            if (!IsNonSpecular(bsdf.Flags()))
+                continue;
+            Float uLight = rng.Uniform<Float>();
+            SampledSpectrum L =
+                SampleLd(isect, bsdf, lambda, uLight,
+                         Point2f(rng.Uniform<Float>(), rng.Uniform<Float>()));
+            Float uc = rng.Uniform<Float>();
+            L += IndirectLight(isect, bsdf, lambda, bounce + 1, uc,
+                               Point2f(rng.Uniform<Float>(), rng.Uniform<Float>()),
+                               sampler, scratchBuffer);
+            s.L = L.ToRGB(lambda, *colorSpace);
+        }
+
+    IrradianceRecord record = cache->MakeRecord(p, n, gatherM, gatherN, samples);
+    cache->Add(record);
+    return record.E;
+}
+
+std::string IrradianceCacheIntegrator::ToString() const {
+    std::string s = StringPrintf("[ IrradianceCacheIntegrator maxDepth: %d gatherM: %d "
+                                 "gatherN: %d caches: [ ",
+                                 maxDepth, gatherM, gatherN);
+    for (const IrradianceCache *cache : caches)
+        s += cache->ToString() + " ";
+    return s + StringPrintf("] colorSpace: %s lightSampler: %s ]", *colorSpace,
+                            lightSampler);
+}
+
+std::unique_ptr<IrradianceCacheIntegrator> IrradianceCacheIntegrator::Create(
+    const ParameterDictionary &parameters, const RGBColorSpace *colorSpace,
+    Camera camera, Sampler sampler, Primitive aggregate, std::vector<Light> lights,
+    const FileLoc *loc) {
+    int maxDepth = parameters.GetOneInt("maxdepth", 5);
+    int bounces = parameters.GetOneInt("bounces", 1);
+    int nGatherSamples = parameters.GetOneInt("gathersamples", 256);
+    Float maxError = parameters.GetOneFloat("maxerror", 0.2f);
+    Float minSpacing = parameters.GetOneFloat("minspacing", 0.001f);
+    Float maxSpacing = parameters.GetOneFloat("maxspacing", 0.05f);
+    std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
+    if (nGatherSamples < 1)
+        ErrorExit(loc, "\"gathersamples\" must be at least one.");
+    if (maxError <= 0)
+        ErrorExit(loc, "\"maxerror\" must be positive.");
+    if (minSpacing <= 0 || maxSpacing < minSpacing)
+        ErrorExit(loc, "\"minspacing\" must be positive and no more than "
+                       "\"maxspacing\".");
+
+    // Create an irradiance cache for each bounce of indirect light
+    Bounds3f bounds = aggregate ? aggregate.Bounds() : Bounds3f();
+    std::vector<IrradianceCache *> caches;
+    for (int i = 0; i < bounces; ++i)
+        caches.push_back(Allocator().new_object<IrradianceCache>(bounds, maxError,
+                                                                 minSpacing, maxSpacing));
+    return std::make_unique<IrradianceCacheIntegrator>(maxDepth, nGatherSamples, caches,
+                                                       colorSpace, camera, sampler,
+                                                       aggregate, lights, lightStrategy);
 }
 
 // BDPT Utility Function Declarations
+struct MISVertex;
+
 int RandomWalk(const Integrator &integrator, SampledWavelengths &lambda,
                RayDifferential ray, Sampler sampler, Camera camera,
                ScratchBuffer &scratchBuffer, SampledSpectrum beta, Float pdf,
                int maxDepth, TransportMode mode, Vertex *path, bool regularize);
 
 SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &lambda,
-                            Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
+                            const Vertex *lightVertices, const Vertex *cameraVertices,
+                            MISVertex *lightMIS, MISVertex *cameraMIS, int s, int t,
                             LightSampler lightSampler, Camera camera, Sampler sampler,
                             pstd::optional<Point2f> *pRaster,
-                            Float *misWeightPtr = nullptr);
+                            Float *misWeightPtr = nullptr, Float mergeEta = 0);
 
 Float InfiniteLightDensity(const std::vector<Light> &infiniteLights,
                            LightSampler lightSampler, Vector3f w);
@@ -1504,6 +2725,16 @@ Float InfiniteLightDensity(const std::vector<Light> &infiniteLights,
 // VertexType Definition
 enum class VertexType { Camera, Light, Surface, Medium };
 
+// MISVertex Definition
+// Compact copy of the per-vertex state that _MISWeight()_ reads, stored
+// separately from the much larger _Vertex_ interaction data
+struct MISVertex {
+    Float pdfFwd = 0, pdfRev = 0;
+    bool delta = false, deltaLight = false;
+    // Whether vertex merging is possible at the vertex
+    bool mergeable = false;
+};
+
 // ScopedAssignment Definition
 template <typename Type>
 class ScopedAssignment {
@@ -1675,6 +2906,11 @@ struct Vertex {
                pbrt::IsDeltaLight(ei.light.Type());
     }
 
+    MISVertex MIS() const {
+        bool mergeable = type == VertexType::Surface && IsNonSpecular(bsdf.Flags());
+        return MISVertex{pdfFwd, pdfRev, delta, IsDeltaLight(), mergeable};
+    }
+
     bool IsInfiniteLight() const {
         return type == VertexType::Light &&
                (!ei.light || ei.light.Type() == LightType::Infinite ||
@@ -1802,8 +3038,9 @@ struct Vertex {
         } else if (IsOnSurface()) {
             // Compute sampling density at emissive surface
             if (type == VertexType::Light)
-                CHECK(ei.light.Is<DiffuseAreaLight>());  // since that's all we've
-                                                         // got currently...
+                CHECK(ei.light.Is<DiffuseAreaLight>() ||
+                      ei.light.Is<TriangleAreaLight>());  // since that's all we've
+                                                          // got currently...
             Light light = (type == VertexType::Light) ? ei.light : si.areaLight;
             Float pdfPos, pdfDir;
             light.PDF_Le(ei, w, &pdfPos, &pdfDir);
@@ -1824,7 +3061,7 @@ struct Vertex {
     }
 
     Float PDFLightOrigin(const std::vector<Light> &infiniteLights, const Vertex &v,
-                         LightSampler lightSampler) {
+                         LightSampler lightSampler) const {
         Vector3f w = v.p() - p();
         if (LengthSquared(w) == 0)
             return 0.;
@@ -1900,6 +3137,14 @@ inline int BufferIndex(int s, int t) {
     return s + above * (5 + above) / 2;
 }
 
+inline MISVertex *AllocMISVertices(ScratchBuffer &scratchBuffer, const Vertex *path,
+                                   int n) {
+    MISVertex *mis = scratchBuffer.Alloc<MISVertex[]>(n);
+    for (int i = 0; i < n; ++i)
+        mis[i] = path[i].MIS();
+    return mis;
+}
+
 int GenerateCameraSubpath(const Integrator &integrator, const RayDifferential &ray,
                           SampledWavelengths &lambda, Sampler sampler,
                           ScratchBuffer &scratchBuffer, int maxDepth, Camera camera,
@@ -2129,75 +3374,98 @@ SampledSpectrum G(const Integrator &integrator, Sampler sampler, const Vertex &v
     return g * integrator.Tr(v0.GetInteraction(), v1.GetInteraction(), lambda);
 }
 
-Float MISWeight(const Integrator &integrator, Vertex *lightVertices,
-                Vertex *cameraVertices, Vertex &sampled, int s, int t,
-                LightSampler lightSampler) {
+// With a nonzero _mergeEta_, the weights also account for vertex merging
+// at every mergeable vertex, where _mergeEta_ is the number of light subpaths
+// times the merging disk's area. If _merge_ is true, the returned weight is
+// the one for merging light vertex $s$ at $\pt{}_{t-1}$ instead of for
+// the $(s, t)$ connection.
+Float MISWeight(const Integrator &integrator, const Vertex *lightVertices,
+                const Vertex *cameraVertices, MISVertex *lightMIS, MISVertex *cameraMIS,
+                const Vertex &sampled, int s, int t, LightSampler lightSampler,
+                Float mergeEta = 0, bool merge = false) {
     if (s + t == 2)
         return 1;
     Float sumRi = 0;
     // Define helper function _remap0_ that deals with Dirac delta functions
     auto remap0 = [](float f) -> Float { return f != 0 ? f : 1; };
 
-    // Temporarily update vertex properties for current strategy
     // Look up connection vertices and their predecessors
-    Vertex *qs = s > 0 ? &lightVertices[s - 1] : nullptr,
-           *pt = t > 0 ? &cameraVertices[t - 1] : nullptr,
-           *qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr,
-           *ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+    const Vertex *qs = s > 0 ? &lightVertices[s - 1] : nullptr,
+                 *pt = t > 0 ? &cameraVertices[t - 1] : nullptr,
+                 *qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr,
+                 *ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+    MISVertex *qsMIS = s > 0 ? &lightMIS[s - 1] : nullptr,
+              *ptMIS = t > 0 ? &cameraMIS[t - 1] : nullptr,
+              *qsMinusMIS = s > 1 ? &lightMIS[s - 2] : nullptr,
+              *ptMinusMIS = t > 1 ? &cameraMIS[t - 2] : nullptr;
 
+    // Temporarily update vertex properties for current strategy
     // Update sampled vertex for $s=1$ or $t=1$ strategy
-    ScopedAssignment<Vertex> a1;
-    if (s == 1)
-        a1 = {qs, sampled};
-    else if (t == 1)
-        a1 = {pt, sampled};
+    ScopedAssignment<MISVertex> a1;
+    if (s == 1) {
+        qs = &sampled;
+        a1 = {qsMIS, sampled.MIS()};
+    } else if (t == 1) {
+        pt = &sampled;
+        a1 = {ptMIS, sampled.MIS()};
+    }
 
     // Mark connection vertices as non-degenerate
     ScopedAssignment<bool> a2, a3;
     if (pt)
-        a2 = {&pt->delta, false};
-    if (qs)
-        a3 = {&qs->delta, false};
+        a2 = {&ptMIS->delta, false};
+    if (qs && !merge)
+        a3 = {&qsMIS->delta, false};
 
     // Update reverse density of vertex $\pt{}_{t-1}$
     ScopedAssignment<Float> a4;
     if (pt)
-        a4 = {&pt->pdfRev, s > 0 ? qs->PDF(integrator, qsMinus, *pt)
-                                 : pt->PDFLightOrigin(integrator.infiniteLights, *ptMinus,
-                                                      lightSampler)};
+        a4 = {&ptMIS->pdfRev, s > 0 ? qs->PDF(integrator, qsMinus, *pt)
+                                    : pt->PDFLightOrigin(integrator.infiniteLights,
+                                                         *ptMinus, lightSampler)};
 
     // Update reverse density of vertex $\pt{}_{t-2}$
     ScopedAssignment<Float> a5;
     if (ptMinus)
-        a5 = {&ptMinus->pdfRev, s > 0 ? pt->PDF(integrator, qs, *ptMinus)
-                                      : pt->PDFLight(integrator, *ptMinus)};
+        a5 = {&ptMinusMIS->pdfRev, s > 0 ? pt->PDF(integrator, qs, *ptMinus)
+                                         : pt->PDFLight(integrator, *ptMinus)};
 
     // Update reverse density of vertices $\pq{}_{s-1}$ and $\pq{}_{s-2}$
     ScopedAssignment<Float> a6;
     if (qs)
-        a6 = {&qs->pdfRev, pt->PDF(integrator, ptMinus, *qs)};
+        a6 = {&qsMIS->pdfRev, pt->PDF(integrator, ptMinus, *qs)};
     ScopedAssignment<Float> a7;
     if (qsMinus)
-        a7 = {&qsMinus->pdfRev, qs->PDF(integrator, pt, *qsMinus)};
+        a7 = {&qsMinusMIS->pdfRev, qs->PDF(integrator, pt, *qsMinus)};
 
     // Consider hypothetical connection strategies along the camera subpath
     Float ri = 1;
     for (int i = t - 1; i > 0; --i) {
-        ri *= remap0(cameraVertices[i].pdfRev) / remap0(cameraVertices[i].pdfFwd);
-        if (!cameraVertices[i].delta && !cameraVertices[i - 1].delta)
+        ri *= remap0(cameraMIS[i].pdfRev) / remap0(cameraMIS[i].pdfFwd);
+        if (!cameraMIS[i].delta && !cameraMIS[i - 1].delta)
             sumRi += ri;
+        // Account for merging at the vertex; it can't happen at the light endpoint
+        if (mergeEta > 0 && cameraMIS[i].mergeable && !(s == 0 && i == t - 1))
+            sumRi += ri * remap0(cameraMIS[i].pdfFwd) * mergeEta;
     }
 
     // Consider hypothetical connection strategies along the light subpath
     ri = 1;
     for (int i = s - 1; i >= 0; --i) {
-        ri *= remap0(lightVertices[i].pdfRev) / remap0(lightVertices[i].pdfFwd);
-        bool deltaLightvertex =
-            i > 0 ? lightVertices[i - 1].delta : lightVertices[0].IsDeltaLight();
-        if (!lightVertices[i].delta && !deltaLightvertex)
+        ri *= remap0(lightMIS[i].pdfRev) / remap0(lightMIS[i].pdfFwd);
+        bool deltaLightvertex = i > 0 ? lightMIS[i - 1].delta : lightMIS[0].deltaLight;
+        if (!lightMIS[i].delta && !deltaLightvertex)
             sumRi += ri;
+        if (mergeEta > 0 && lightMIS[i].mergeable && i > 0)
+            sumRi += ri * remap0(lightMIS[i].pdfFwd) * mergeEta;
     }
 
+    if (merge) {
+        // Return weight for merging at $\pt{}_{t-1}$, which is only possible
+        // to connect if $\pq{}_{s-1}$ isn't specular
+        Float connect = qsMIS->delta ? 0 : 1;
+        return remap0(ptMIS->pdfRev) * mergeEta / (connect + sumRi);
+    }
     return 1 / (1 + sumRi);
 }
 
@@ -2209,7 +3477,113 @@ Float InfiniteLightDensity(const std::vector<Light> &infiniteLights,
     return pdf;
 }
 
+// LightVertexCache Definition
+// Light subpaths traced once per wave; camera subpaths from all of the wave's
+// samples connect to randomly chosen vertices of them
+struct LightVertexCache {
+    // LightVertexCache Public Members
+    // Connectible vertex, given by its path and its index along it
+    struct Entry {
+        int path, index;
+    };
+    SampledWavelengths lambda;
+    int maxPathVertices;
+    std::vector<Vertex> vertices;
+    std::vector<MISVertex> mis;
+    std::vector<int> pathVertices;
+    std::vector<uint8_t> secondaryTerminated;
+    std::vector<Entry> connectible;
+    // Average number of connectible vertices per light subpath
+    Float connectionScale = 0;
+    bool valid = false;
+    // Per-thread storage for the cached vertices' BSDFs
+    std::vector<ScratchBuffer> scratchBuffers;
+};
+
 // BDPT Method Definitions
+BDPTIntegrator::BDPTIntegrator(Camera camera, Sampler sampler, Primitive aggregate,
+                               std::vector<Light> lights, int maxDepth,
+                               bool visualizeStrategies, bool visualizeWeights,
+                               bool regularize, int lightVertexCachePaths)
+    : RayIntegrator(camera, sampler, aggregate, lights),
+      maxDepth(maxDepth),
+      regularize(regularize),
+      lightSampler(new PowerLightSampler(lights, Allocator())),
+      visualizeStrategies(visualizeStrategies),
+      visualizeWeights(visualizeWeights),
+      lightVertexCachePaths(lightVertexCachePaths) {
+    if (lightVertexCachePaths > 0) {
+        lightVertexCache = std::make_unique<LightVertexCache>();
+        LightVertexCache &cache = *lightVertexCache;
+        cache.maxPathVertices = maxDepth + 1;
+        cache.vertices.resize(size_t(lightVertexCachePaths) * cache.maxPathVertices);
+        cache.mis.resize(cache.vertices.size());
+        cache.pathVertices.resize(lightVertexCachePaths);
+        cache.secondaryTerminated.resize(lightVertexCachePaths);
+        for (int i = 0; i < MaxThreadIndex(); ++i)
+            cache.scratchBuffers.push_back(ScratchBuffer(65536));
+    }
+}
+
+BDPTIntegrator::~BDPTIntegrator() = default;
+
+void BDPTIntegrator::StartWave(Bounds2i bandBounds, int waveStart, int waveEnd) {
+    if (!lightVertexCache)
+        return;
+    LightVertexCache &cache = *lightVertexCache;
+    // Sample the wavelengths that all of the wave's paths use
+    RNG rng(Hash(bandBounds.pMin.y, waveStart));
+    Float lu = Options->disableWavelengthJitter ? 0.5f : rng.Uniform<Float>();
+    cache.lambda = camera.GetFilm().SampleWavelengths(lu);
+    for (ScratchBuffer &buf : cache.scratchBuffers)
+        buf.Reset();
+
+    // Trace the cache's light subpaths and splat their $t=1$ strategies
+    // Each light subpath stands in for the ones that the wave's camera samples
+    // would have traced
+    Float splatScale =
+        Float(bandBounds.Area()) * (waveEnd - waveStart) / lightVertexCachePaths;
+    Film film = camera.GetFilm();
+    ParallelFor(0, lightVertexCachePaths, [&](int64_t start, int64_t end) {
+        ScratchBuffer &scratchBuffer = cache.scratchBuffers[ThreadIndex];
+        for (int64_t i = start; i < end; ++i) {
+            IndependentSampler pathSampler(1);
+            pathSampler.StartPixelSample(Point2i(i, bandBounds.pMin.y), waveStart, 0);
+            Sampler sampler = &pathSampler;
+            SampledWavelengths lambda = cache.lambda;
+            Vertex *path = &cache.vertices[i * cache.maxPathVertices];
+            MISVertex *pathMIS = &cache.mis[i * cache.maxPathVertices];
+            Float time = camera.SampleTime(sampler.Get1D());
+            int nVertices =
+                GenerateLightSubpath(*this, lambda, sampler, camera, scratchBuffer,
+                                     maxDepth + 1, time, lightSampler, path, regularize);
+            for (int j = 0; j < nVertices; ++j)
+                pathMIS[j] = path[j].MIS();
+            cache.pathVertices[i] = nVertices;
+            cache.secondaryTerminated[i] = lambda.SecondaryTerminated();
+
+            Vertex cameraVertex;
+            MISVertex cameraMIS;
+            for (int s = 2; s <= nVertices; ++s) {
+                pstd::optional<Point2f> pRaster;
+                SampledSpectrum L =
+                    ConnectBDPT(*this, lambda, path, &cameraVertex, pathMIS, &cameraMIS,
+                                s, 1, lightSampler, camera, sampler, &pRaster);
+                if (L && pRaster)
+                    film.AddSplat(*pRaster, L * splatScale, lambda);
+            }
+        }
+    });
+
+    // Record the cache's connectible vertices
+    cache.connectible.clear();
+    for (int i = 0; i < lightVertexCachePaths; ++i)
+        for (int j = 1; j < cache.pathVertices[i]; ++j)
+            cache.connectible.push_back(LightVertexCache::Entry{i, j});
+    cache.connectionScale = Float(cache.connectible.size()) / lightVertexCachePaths;
+    cache.valid = true;
+}
+
 void BDPTIntegrator::Render() {
     // Allocate buffers for debug visualization
     if (visualizeStrategies || visualizeWeights) {
@@ -2252,14 +3626,28 @@ void BDPTIntegrator::Render() {
 SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                    Sampler sampler, ScratchBuffer &scratchBuffer,
                                    VisibleSurface *) const {
+    // Use the wavelengths of the light vertex cache, if it is in use
+    const LightVertexCache *cache =
+        (lightVertexCache && lightVertexCache->valid) ? lightVertexCache.get() : nullptr;
+    if (cache)
+        lambda = cache->lambda;
+
     // Trace the camera and light subpaths
     Vertex *cameraVertices = scratchBuffer.Alloc<Vertex[]>(maxDepth + 2);
     int nCamera = GenerateCameraSubpath(*this, ray, lambda, sampler, scratchBuffer,
                                         maxDepth + 2, camera, cameraVertices, regularize);
     Vertex *lightVertices = scratchBuffer.Alloc<Vertex[]>(maxDepth + 1);
-    int nLight = GenerateLightSubpath(*this, lambda, sampler, camera, scratchBuffer,
-                                      maxDepth + 1, cameraVertices[0].time(),
-                                      lightSampler, lightVertices, regularize);
+    // With the cache, only the $s=1$ strategy samples a light vertex per camera
+    // sample; it doesn't use _lightVertices_.
+    int nLight = cache ? 1
+                       : GenerateLightSubpath(*this, lambda, sampler, camera,
+                                              scratchBuffer, maxDepth + 1,
+                                              cameraVertices[0].time(), lightSampler,
+                                              lightVertices, regularize);
+    // Gather the compact MIS state of both subpaths for the connection loop
+    MISVertex *cameraMIS = AllocMISVertices(scratchBuffer, cameraVertices, nCamera);
+    MISVertex *lightMIS = cache ? scratchBuffer.Alloc<MISVertex[]>(1)
+                                : AllocMISVertices(scratchBuffer, lightVertices, nLight);
 
     SampledSpectrum L(0.f);
     // Execute all BDPT connection strategies
@@ -2271,9 +3659,9 @@ SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
             // Execute the $(s, t)$ connection strategy and update _L_
             pstd::optional<Point2f> pFilmNew;
             Float misWeight = 0.f;
-            SampledSpectrum Lpath =
-                ConnectBDPT(*this, lambda, lightVertices, cameraVertices, s, t,
-                            lightSampler, camera, sampler, &pFilmNew, &misWeight);
+            SampledSpectrum Lpath = ConnectBDPT(
+                *this, lambda, lightVertices, cameraVertices, lightMIS, cameraMIS, s, t,
+                lightSampler, camera, sampler, &pFilmNew, &misWeight);
             PBRT_DBG("%s\n",
                      StringPrintf("Connect bdpt s: %d, t: %d, Lpath: %s, misWeight: %f\n",
                                   s, t, Lpath, misWeight)
@@ -2296,13 +3684,39 @@ SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         }
     }
 
+    // Connect camera subpath vertices to randomly chosen cached light vertices
+    if (cache && !cache->connectible.empty()) {
+        MISVertex *pathMIS = scratchBuffer.Alloc<MISVertex[]>(cache->maxPathVertices);
+        for (int t = 2; t <= nCamera; ++t) {
+            int nConnectible = cache->connectible.size();
+            int c = std::min<int>(sampler.Get1D() * nConnectible, nConnectible - 1);
+            LightVertexCache::Entry entry = cache->connectible[c];
+            int s = entry.index + 1;
+            if (s + t - 2 > maxDepth)
+                continue;
+            // Copy the path's MIS state, which _MISWeight()_ updates temporarily
+            size_t offset = size_t(entry.path) * cache->maxPathVertices;
+            std::copy(&cache->mis[offset], &cache->mis[offset] + s, pathMIS);
+            if (cache->secondaryTerminated[entry.path])
+                lambda.TerminateSecondary();
+
+            SampledSpectrum Lpath =
+                ConnectBDPT(*this, lambda, &cache->vertices[offset], cameraVertices,
+                            pathMIS, cameraMIS, s, t, lightSampler, camera, sampler,
+                            nullptr);
+            L += Lpath * cache->connectionScale;
+        }
+    }
+
     return L;
 }
 
 SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &lambda,
-                            Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
+                            const Vertex *lightVertices, const Vertex *cameraVertices,
+                            MISVertex *lightMIS, MISVertex *cameraMIS, int s, int t,
                             LightSampler lightSampler, Camera camera, Sampler sampler,
-                            pstd::optional<Point2f> *pRaster, Float *misWeightPtr) {
+                            pstd::optional<Point2f> *pRaster, Float *misWeightPtr,
+                            Float mergeEta) {
     SampledSpectrum L(0.f);
     // Ignore invalid connections related to infinite area lights
     if (t > 1 && s != 0 && cameraVertices[t - 1].type == VertexType::Light)
@@ -2404,8 +3818,8 @@ SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &la
         ++zeroRadiancePaths;
     pathLength << s + t - 2;
     // Compute MIS weight for connection strategy
-    Float misWeight = L ? MISWeight(integrator, lightVertices, cameraVertices, sampled, s,
-                                    t, lightSampler)
+    Float misWeight = L ? MISWeight(integrator, lightVertices, cameraVertices, lightMIS,
+                                    cameraMIS, sampled, s, t, lightSampler, mergeEta)
                         : 0.f;
     PBRT_DBG("MIS weight for (s,t) = (%d, %d) connection: %f\n", s, t, misWeight);
     DCHECK(!IsNaN(misWeight));
@@ -2437,9 +3851,20 @@ std::unique_ptr<BDPTIntegrator> BDPTIntegrator::Create(
     }
 
     bool regularize = parameters.GetOneBool("regularize", false);
+    int lightVertexCachePaths = 0;
+    if (parameters.GetOneBool("lightvertexcache", false)) {
+        lightVertexCachePaths = parameters.GetOneInt("lightpaths", 65536);
+        if (lightVertexCachePaths <= 0)
+            ErrorExit(loc, "\"lightpaths\" must be positive.");
+        if (visualizeStrategies || visualizeWeights) {
+            Warning(loc, "visualizestrategies/visualizeweights was enabled, disabling "
+                         "lightvertexcache");
+            lightVertexCachePaths = 0;
+        }
+    }
     return std::make_unique<BDPTIntegrator>(camera, sampler, aggregate, lights, maxDepth,
                                             visualizeStrategies, visualizeWeights,
-                                            regularize);
+                                            regularize, lightVertexCachePaths);
 }
 
 STAT_PERCENT("Integrator/Acceptance rate", acceptedMutations, totalMutations);
@@ -2502,9 +3927,12 @@ SampledSpectrum MLTIntegrator::L(ScratchBuffer &scratchBuffer, MLTSampler &sampl
 
     // Execute connection strategy and return the radiance estimate
     sampler.StartStream(connectionStreamIndex);
+    MISVertex *cameraMIS = AllocMISVertices(scratchBuffer, cameraVertices, t);
+    MISVertex *lightMIS = AllocMISVertices(scratchBuffer, lightVertices, s);
     pstd::optional<Point2f> pRasterNew;
-    SampledSpectrum L = ConnectBDPT(*this, *lambda, lightVertices, cameraVertices, s, t,
-                                    lightSampler, camera, &sampler, &pRasterNew) *
+    SampledSpectrum L = ConnectBDPT(*this, *lambda, lightVertices, cameraVertices,
+                                    lightMIS, cameraMIS, s, t, lightSampler, camera,
+                                    &sampler, &pRasterNew) *
                         nStrategies;
     if (pRasterNew)
         *pRaster = *pRasterNew;
@@ -2533,7 +3961,7 @@ void MLTIntegrator::Render() {
 
         Point2f pRaster;
         SampledWavelengths lambda;
-        ScratchBuffer scratchBuffer(65536);
+        ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
         (void)L(scratchBuffer, sampler, depth, &pRaster, &lambda);
         return;
     }
@@ -2549,17 +3977,16 @@ void MLTIntegrator::Render() {
     Timer timer;
     int nBootstrapSamples = nBootstrap * (maxDepth + 1);
     std::vector<Float> bootstrapWeights(nBootstrapSamples, 0);
-    // Allocate scratch buffers for MLT samples
-    std::vector<ScratchBuffer> threadScratchBuffers;
-    for (int i = 0; i < MaxThreadIndex(); ++i)
-        threadScratchBuffers.push_back(ScratchBuffer(65536));
-
+    // Sum each bootstrap sample's weights as they are computed so that $b$
+    // doesn't require a serial pass over all of _bootstrapWeights_
+    std::vector<double> bootstrapSums(nBootstrap, 0.);
     // Generate bootstrap samples in parallel
     ProgressReporter progress(nBootstrap, "Generating bootstrap paths", Options->quiet);
     ParallelFor(0, nBootstrap, [&](int64_t start, int64_t end) {
-        ScratchBuffer &buf = threadScratchBuffers[ThreadIndex];
+        ScratchBuffer &buf = ThreadScratchBuffer();
         for (int64_t i = start; i < end; ++i) {
             // Generate _i_th bootstrap sample
+            double sum = 0;
             for (int depth = 0; depth <= maxDepth; ++depth) {
                 int rngIndex = i * (maxDepth + 1) + depth;
                 MLTSampler sampler(mutationsPerPixel, rngIndex, sigma,
@@ -2571,20 +3998,22 @@ void MLTIntegrator::Render() {
                 SampledWavelengths lambda;
                 SampledSpectrum L_i = L(buf, sampler, depth, &pRaster, &lambda);
                 bootstrapWeights[rngIndex] = c(L_i, lambda);
+                sum += bootstrapWeights[rngIndex];
 
                 buf.Reset();
             }
+            bootstrapSums[i] = sum;
         }
         progress.Update(end - start);
     });
     progress.Done();
 
-    if (std::accumulate(bootstrapWeights.begin(), bootstrapWeights.end(), 0.) == 0.)
+    double bootstrapSum = std::accumulate(bootstrapSums.begin(), bootstrapSums.end(), 0.);
+    if (bootstrapSum == 0.)
         ErrorExit("No light carrying paths found during bootstrap sampling! "
                   "Are you trying to render a black image?");
     AliasTable bootstrapTable(bootstrapWeights);
-    Float b = Float(maxDepth + 1) / bootstrapWeights.size() *
-              std::accumulate(bootstrapWeights.begin(), bootstrapWeights.end(), 0.);
+    Float b = Float(maxDepth + 1) / bootstrapWeights.size() * bootstrapSum;
 
     // Set up connection to display server, if enabled
     std::atomic<int> finishedChains(0);
@@ -2616,7 +4045,7 @@ void MLTIntegrator::Render() {
     ProgressReporter progressRender(nChains, "Rendering", Options->quiet);
     // Run _nChains_ Markov chains in parallel
     ParallelFor(0, nChains, [&](int i) {
-        ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
+        ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
         // Compute number of mutations to apply in current Markov chain
         int64_t nChainMutations =
             std::min((i + 1) * nTotalMutations / nChains, nTotalMutations) -
@@ -2636,6 +4065,9 @@ void MLTIntegrator::Render() {
         SampledWavelengths lambdaCurrent;
         SampledSpectrum LCurrent =
             L(scratchBuffer, sampler, depth, &pCurrent, &lambdaCurrent);
+        // Rejected-proposal weight for the current sample is accumulated
+        // locally and splatted once when the chain leaves that state
+        Float currentWeight = 0;
 
         // Run the Markov chain for _nChainMutations_ steps
         for (int64_t j = 0; j < nChainMutations; ++j) {
@@ -2652,13 +4084,17 @@ void MLTIntegrator::Render() {
             Float cCurrent = c(LCurrent, lambdaCurrent);
             Float accept = std::min<Float>(1, cProposed / cCurrent);
 
-            // Splat both current and proposed samples to _film_
+            // Splat proposed sample to _film_ and accumulate current sample's weight
             if (accept > 0)
                 film.AddSplat(pProposed, LProposed * accept / cProposed, lambdaProposed);
-            film.AddSplat(pCurrent, LCurrent * (1 - accept) / cCurrent, lambdaCurrent);
+            currentWeight += 1 - accept;
 
             // Accept or reject the proposal
             if (rng.Uniform<Float>() < accept) {
+                if (currentWeight > 0)
+                    film.AddSplat(pCurrent, LCurrent * currentWeight / cCurrent,
+                                  lambdaCurrent);
+                currentWeight = 0;
                 StatsReportPixelEnd(Point2i(pCurrent));
                 StatsReportPixelStart(Point2i(pProposed));
                 pCurrent = pProposed;
@@ -2673,6 +4109,10 @@ void MLTIntegrator::Render() {
             scratchBuffer.Reset();
             StatsReportPixelEnd(Point2i(pCurrent));
         }
+        // Splat remaining weight for the chain's final state
+        if (currentWeight > 0)
+            film.AddSplat(pCurrent, LCurrent * currentWeight / c(LCurrent, lambdaCurrent),
+                          lambdaCurrent);
 
         ++finishedChains;
         progressRender.Update(1);
@@ -2726,6 +4166,7 @@ STAT_INT_DISTRIBUTION(
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
 STAT_MEMORY_COUNTER("Memory/SPPM BSDF and Grid Memory", sppmMemoryArenaBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM Visible Point Grid", sppmGridBytes);
 
 // SPPMPixel Definition
 struct SPPMPixel {
@@ -2757,10 +4198,13 @@ struct SPPMPixel {
     Float n = 0;
 };
 
-// SPPMPixelListNode Definition
-struct SPPMPixelListNode {
+// SPPMGridEntry Definition
+// A visible point in a cell of the SPPM grid along with the values that are
+// needed to find whether a photon is within its pixel's search radius
+struct SPPMGridEntry {
+    Point3f p;
+    Float radius2;
     SPPMPixel *pixel;
-    SPPMPixelListNode *next;
 };
 
 // SPPM Utility Functions
@@ -2801,19 +4245,20 @@ void SPPMIntegrator::Render() {
     BVHLightSampler lightSampler(lights, Allocator());
     PowerLightSampler shootLightSampler(lights, Allocator());
 
-    // Allocate per-thread _ScratchBuffer_s for SPPM rendering
-    std::vector<ScratchBuffer> threadScratchBuffers;
-    for (int i = 0; i < MaxThreadIndex(); ++i) {
-        size_t allocSize = nPixels * 4096 / MaxThreadIndex();
-        threadScratchBuffers.push_back(ScratchBuffer(allocSize));
-    }
-
     // Allocate samplers for SPPM rendering
     std::vector<Sampler> threadSamplers =
         samplerPrototype.Clone(MaxThreadIndex(), Allocator());
     pstd::vector<DigitPermutation> *digitPermutations(
         ComputeRadicalInversePermutations(digitPermutationsSeed));
 
+    // Allocate SPPM grid storage that is reused for each iteration's visible points
+    // The entries of hash bucket _h_ are _gridEntries[gridOffsets[h]]_ through
+    // _gridEntries[gridOffsets[h + 1] - 1]_
+    int hashSize = NextPrime(nPixels);
+    std::vector<std::atomic<int>> gridCounts(hashSize);
+    std::vector<int> gridOffsets(hashSize + 1);
+    std::vector<SPPMGridEntry> gridEntries;
+
     for (int iter = 0; iter < nIterations; ++iter) {
         // Connect to display server for SPPM if requested
         if (iter == 0 && !Options->displayServer.empty()) {
@@ -2842,7 +4287,7 @@ void SPPMIntegrator::Render() {
 
         ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
             // Follow camera paths for _tileBounds_ in image for SPPM
-            ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
+            ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
             Sampler sampler = threadSamplers[ThreadIndex];
             for (Point2i pPixel : tileBounds) {
                 sampler.StartPixelSample(pPixel, iter);
@@ -2967,10 +4412,6 @@ void SPPMIntegrator::Render() {
         });
         progress.Update();
         // Create grid of all SPPM visible points
-        // Allocate grid for SPPM visible points
-        int hashSize = NextPrime(nPixels);
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
-
         // Compute grid bounds for SPPM visible points
         Bounds3f gridBounds;
         Float maxRadius = 0;
@@ -2991,13 +4432,16 @@ void SPPMIntegrator::Render() {
             gridRes[i] = std::max<int>(baseGridRes * diag[i] / maxDiag, 1);
 
         // Add visible points to SPPM grid
-        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
-            ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
-            for (Point2i pPixel : tileBounds) {
-                SPPMPixel &pixel = pixels[pPixel];
-                if (pixel.vp.beta) {
-                    // Add pixel's visible point to applicable grid cells
-                    // Find grid cell bounds for pixel's visible point, _pMin_ and _pMax_
+        auto forEachVisiblePointCell = [&](bool reportCells, auto func) {
+            // Call _func_ with each pixel whose visible point overlaps a grid cell
+            // and the cell's hash bucket
+            ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
+                for (Point2i pPixel : tileBounds) {
+                    SPPMPixel &pixel = pixels[pPixel];
+                    if (!pixel.vp.beta)
+                        continue;
+                    // Find grid cell bounds for pixel's visible point, _pMin_ and
+                    // _pMax_
                     Float r = pixel.radius;
                     Point3i pMin, pMax;
                     ToGrid(pixel.vp.p - Vector3f(r, r, r), gridBounds, gridRes, &pMin);
@@ -3006,38 +4450,47 @@ void SPPMIntegrator::Render() {
                     for (int z = pMin.z; z <= pMax.z; ++z)
                         for (int y = pMin.y; y <= pMax.y; ++y)
                             for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
                                 int h = Hash(Point3i(x, y, z)) % hashSize;
                                 CHECK_GE(h, 0);
-                                SPPMPixelListNode *node =
-                                    scratchBuffer.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of _grid[h]_'s
-                                // linked list
-                                node->next = grid[h];
-                                while (!grid[h].compare_exchange_weak(node->next, node))
-                                    ;
+                                func(pixel, h);
                             }
-                    gridCellsPerVisiblePoint << (1 + pMax.x - pMin.x) *
-                                                    (1 + pMax.y - pMin.y) *
-                                                    (1 + pMax.z - pMin.z);
+                    if (reportCells)
+                        gridCellsPerVisiblePoint << (1 + pMax.x - pMin.x) *
+                                                        (1 + pMax.y - pMin.y) *
+                                                        (1 + pMax.z - pMin.z);
                 }
-            }
+            });
+        };
+        // Count visible points in each hash bucket
+        for (std::atomic<int> &count : gridCounts)
+            count.store(0, std::memory_order_relaxed);
+        forEachVisiblePointCell(true, [&](SPPMPixel &pixel, int h) {
+            gridCounts[h].fetch_add(1, std::memory_order_relaxed);
         });
 
-        // Trace photons and accumulate contributions
-        // Create per-thread scratch buffers for photon shooting
-        std::vector<ScratchBuffer> photonShootScratchBuffers;
-        for (int i = 0; i < MaxThreadIndex(); ++i)
-            photonShootScratchBuffers.push_back(ScratchBuffer(65536));
+        // Compute bucket offsets and use the counts as buckets' insertion points
+        gridOffsets[0] = 0;
+        for (int h = 0; h < hashSize; ++h) {
+            gridOffsets[h + 1] =
+                gridOffsets[h] + gridCounts[h].load(std::memory_order_relaxed);
+            gridCounts[h].store(gridOffsets[h], std::memory_order_relaxed);
+        }
 
+        // Store visible points contiguously in their buckets' ranges of entries
+        gridEntries.resize(gridOffsets[hashSize]);
+        forEachVisiblePointCell(false, [&](SPPMPixel &pixel, int h) {
+            int index = gridCounts[h].fetch_add(1, std::memory_order_relaxed);
+            gridEntries[index] = SPPMGridEntry{pixel.vp.p, Sqr(pixel.radius), &pixel};
+        });
+
+        // Trace photons and accumulate contributions
         ParallelFor(0, photonsPerIteration, [&](int64_t start, int64_t end) {
             // Follow photon paths for photon index range _start_ - _end_
-            ScratchBuffer &scratchBuffer = photonShootScratchBuffers[ThreadIndex];
+            ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
             Sampler sampler = threadSamplers[ThreadIndex];
             for (int64_t photonIndex = start; photonIndex < end; ++photonIndex) {
                 // Follow photon path for _photonIndex_
+                ScratchScope scratchScope(scratchBuffer);
                 // Define sampling lambda functions for photon shooting
                 uint64_t haltonIndex =
                     (uint64_t)iter * (uint64_t)photonsPerIteration + photonIndex;
@@ -3100,15 +4553,13 @@ void SPPMIntegrator::Render() {
                         if (ToGrid(isect.p(), gridBounds, gridRes, &photonGridIndex)) {
                             int h = Hash(photonGridIndex) % hashSize;
                             CHECK_GE(h, 0);
-                            // Add photon contribution to visible points in _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
+                            // Add photon contribution to visible points in bucket _h_
+                            for (int i = gridOffsets[h]; i < gridOffsets[h + 1]; ++i) {
                                 ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                if (DistanceSquared(pixel.vp.p, isect.p()) >
-                                    Sqr(pixel.radius))
+                                const SPPMGridEntry &entry = gridEntries[i];
+                                if (DistanceSquared(entry.p, isect.p()) > entry.radius2)
                                     continue;
+                                SPPMPixel &pixel = *entry.pixel;
                                 // Update _pixel_ $\Phi$ and $m$ for nearby photon
                                 Vector3f wi = -photonRay.d;
                                 SampledSpectrum Phi =
@@ -3153,13 +4604,10 @@ void SPPMIntegrator::Render() {
 
                     photonRay = RayDifferential(isect.SpawnRay(bs->wi));
                 }
-
-                scratchBuffer.Reset();
             }
         });
-        // Reset _threadScratchBuffers_ after tracing photons
-        for (ScratchBuffer &scratchBuffer : threadScratchBuffers)
-            scratchBuffer.Reset();
+        // Reset the threads' scratch buffers after tracing photons
+        ForEachThread([]() { ThreadScratchBuffer().Reset(); });
 
         progress.Update();
         photonPaths += photonsPerIteration;
@@ -3241,6 +4689,9 @@ void SPPMIntegrator::Render() {
             }
         }
     }
+    sppmGridBytes += gridCounts.size() * sizeof(std::atomic<int>) +
+                     gridOffsets.size() * sizeof(int) +
+                     gridEntries.capacity() * sizeof(SPPMGridEntry);
 #if 0
     // FIXME
     sppmMemoryArenaBytes += std::accumulate(perThreadArenas.begin(), perThreadArenas.end(),
@@ -3317,6 +4768,330 @@ std::unique_ptr<SPPMIntegrator> SPPMIntegrator::Create(
                                             colorSpace);
 }
 
+STAT_RATIO("Vertex Connection and Merging/Light vertices checked per merge query",
+           vcmVerticesChecked, vcmMergeQueries);
+STAT_MEMORY_COUNTER("Memory/VCM Light Vertices", vcmLightVertexBytes);
+
+// VCMGridEntry Definition
+// A light subpath vertex that camera vertices may merge with, given by its
+// subpath and its index along it
+struct VCMGridEntry {
+    Point3f p;
+    int path, index;
+};
+
+// VCMIntegrator Method Definitions
+void VCMIntegrator::Render() {
+    if (Options->recordPixelStatistics)
+        StatsEnablePixelStats(camera.GetFilm().PixelBounds(),
+                              RemoveExtension(camera.GetFilm().GetFilename()));
+    // Define variables for commonly-used values in VCM rendering
+    int nIterations = samplerPrototype.SamplesPerPixel();
+    ProgressReporter progress(nIterations, "Rendering", Options->quiet);
+    Film film = camera.GetFilm();
+    Bounds2i pixelBounds = film.PixelBounds();
+    CHECK(!pixelBounds.IsEmpty());
+    // Each iteration traces one light subpath per pixel; pixels connect to
+    // the one with their index and merge with all of them
+    int nLightPaths = pixelBounds.Area();
+    int maxLightVertices = maxDepth + 1;
+
+    // Allocate storage for each iteration's light subpaths
+    std::vector<Vertex> lightVertices(size_t(nLightPaths) * maxLightVertices);
+    std::vector<MISVertex> lightMIS(lightVertices.size());
+    std::vector<int> lightPathVertices(nLightPaths);
+    std::vector<uint8_t> lightSecondaryTerminated(nLightPaths);
+    std::vector<ScratchBuffer> lightScratchBuffers;
+    for (int i = 0; i < MaxThreadIndex(); ++i)
+        lightScratchBuffers.push_back(ScratchBuffer(65536));
+    vcmLightVertexBytes += lightVertices.size() * (sizeof(Vertex) + sizeof(MISVertex));
+
+    // Allocate hash grid storage for light vertices that is reused for each
+    // iteration; bucket _h_'s entries are _gridEntries[gridOffsets[h]]_ through
+    // _gridEntries[gridOffsets[h + 1] - 1]_
+    int hashSize = NextPrime(nLightPaths);
+    std::vector<std::atomic<int>> gridCounts(hashSize);
+    std::vector<int> gridOffsets(hashSize + 1);
+    std::vector<VCMGridEntry> gridEntries;
+
+    std::vector<Sampler> threadSamplers =
+        samplerPrototype.Clone(MaxThreadIndex(), Allocator());
+
+    // Returns light subpath contribution _L_ for a camera sample's wavelengths
+    auto toCameraWavelengths = [](SampledSpectrum L, bool lightTerminated,
+                                  const SampledWavelengths &lambda) {
+        if (lightTerminated && !lambda.SecondaryTerminated()) {
+            // Express the primary wavelength-only estimate in terms of _lambda_
+            for (int i = 1; i < NSpectrumSamples; ++i)
+                L[i] = 0;
+            L[0] *= NSpectrumSamples;
+        }
+        return L;
+    };
+
+    for (int iter = 0; iter < nIterations; ++iter) {
+        // Sample wavelengths shared by all of the iteration's paths
+        const SampledWavelengths passLambda =
+            Options->disableWavelengthJitter
+                ? film.SampleWavelengths(0.5)
+                : film.SampleWavelengths(RadicalInverse(1, iter));
+
+        // Compute merging radius and normalization for VCM iteration
+        Float radius =
+            initialRadius * std::pow(Float(iter + 1), (radiusAlpha - 1) / 2);
+        Float mergeEta = nLightPaths * Pi * Sqr(radius);
+
+        // Trace light subpaths and splat their $t=1$ strategies
+        for (ScratchBuffer &buf : lightScratchBuffers)
+            buf.Reset();
+        ParallelFor(0, nLightPaths, [&](int64_t start, int64_t end) {
+            ScratchBuffer &scratchBuffer = lightScratchBuffers[ThreadIndex];
+            for (int64_t i = start; i < end; ++i) {
+                IndependentSampler pathSampler(1);
+                pathSampler.StartPixelSample(Point2i(i, -1), iter, 0);
+                Sampler sampler = &pathSampler;
+                SampledWavelengths lambda = passLambda;
+                Vertex *path = &lightVertices[i * maxLightVertices];
+                MISVertex *pathMIS = &lightMIS[i * maxLightVertices];
+                Float time = camera.SampleTime(sampler.Get1D());
+                int nVertices =
+                    GenerateLightSubpath(*this, lambda, sampler, camera, scratchBuffer,
+                                         maxDepth + 1, time, lightSampler, path,
+                                         regularize);
+                for (int j = 0; j < nVertices; ++j)
+                    pathMIS[j] = path[j].MIS();
+                lightPathVertices[i] = nVertices;
+                lightSecondaryTerminated[i] = lambda.SecondaryTerminated();
+
+                Vertex cameraVertex;
+                MISVertex cameraVertexMIS;
+                for (int s = 2; s <= nVertices; ++s) {
+                    pstd::optional<Point2f> pRaster;
+                    SampledSpectrum L = ConnectBDPT(
+                        *this, lambda, path, &cameraVertex, pathMIS, &cameraVertexMIS, s,
+                        1, lightSampler, camera, sampler, &pRaster, nullptr, mergeEta);
+                    if (L && pRaster)
+                        film.AddSplat(*pRaster, L, lambda);
+                }
+            }
+        });
+
+        // Add mergeable light vertices to hash grid
+        // Compute grid bounds and resolution for light vertices
+        Bounds3f gridBounds;
+        for (int i = 0; i < nLightPaths; ++i)
+            for (int j = 1; j < lightPathVertices[i]; ++j)
+                if (lightMIS[i * maxLightVertices + j].mergeable)
+                    gridBounds =
+                        Union(gridBounds, lightVertices[i * maxLightVertices + j].p());
+        int gridRes[3];
+        Vector3f diag = gridBounds.Diagonal();
+        Float maxDiag = MaxComponentValue(diag);
+        int baseGridRes = Clamp(maxDiag / (2 * radius), 1, 1 << 20);
+        for (int i = 0; i < 3; ++i)
+            gridRes[i] = std::max<int>(baseGridRes * diag[i] / maxDiag, 1);
+
+        auto forEachMergeableVertex = [&](auto func) {
+            // Call _func_ with each mergeable light vertex and its hash bucket
+            ParallelFor(0, nLightPaths, [&](int64_t i) {
+                for (int j = 1; j < lightPathVertices[i]; ++j) {
+                    size_t index = i * maxLightVertices + j;
+                    if (!lightMIS[index].mergeable)
+                        continue;
+                    Point3f p = lightVertices[index].p();
+                    Point3i pi;
+                    ToGrid(p, gridBounds, gridRes, &pi);
+                    func(VCMGridEntry{p, int(i), j}, Hash(pi) % hashSize);
+                }
+            });
+        };
+        // Count light vertices in each hash bucket
+        for (std::atomic<int> &count : gridCounts)
+            count.store(0, std::memory_order_relaxed);
+        forEachMergeableVertex([&](const VCMGridEntry &entry, int h) {
+            gridCounts[h].fetch_add(1, std::memory_order_relaxed);
+        });
+
+        // Compute bucket offsets and use the counts as buckets' insertion points
+        gridOffsets[0] = 0;
+        for (int h = 0; h < hashSize; ++h) {
+            gridOffsets[h + 1] =
+                gridOffsets[h] + gridCounts[h].load(std::memory_order_relaxed);
+            gridCounts[h].store(gridOffsets[h], std::memory_order_relaxed);
+        }
+
+        // Store light vertices contiguously in their buckets' ranges of entries
+        gridEntries.resize(gridOffsets[hashSize]);
+        forEachMergeableVertex([&](const VCMGridEntry &entry, int h) {
+            gridEntries[gridCounts[h].fetch_add(1, std::memory_order_relaxed)] = entry;
+        });
+
+        // Trace camera subpaths and apply connection and merging strategies
+        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
+            ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
+            Sampler sampler = threadSamplers[ThreadIndex];
+            film.StartTile(tileBounds);
+            for (Point2i pPixel : tileBounds) {
+                ScratchScope scratchScope(scratchBuffer);
+                StatsReportPixelStart(pPixel);
+                sampler.StartPixelSample(pPixel, iter);
+                // Generate camera ray for VCM camera subpath
+                SampledWavelengths lambda = passLambda;
+                CameraSample cameraSample =
+                    GetCameraSample(sampler, pPixel, film.GetFilter());
+                pstd::optional<CameraRayDifferential> cameraRay =
+                    camera.GenerateRayDifferential(cameraSample, lambda);
+                if (!cameraRay) {
+                    film.AddSample(pPixel, SampledSpectrum(0.f), lambda, nullptr,
+                                   cameraSample.filterWeight);
+                    StatsReportPixelEnd(pPixel);
+                    continue;
+                }
+                Float rayDiffScale =
+                    std::max<Float>(.125f, 1 / std::sqrt((Float)nIterations));
+                cameraRay->ray.ScaleDifferentials(rayDiffScale);
+                ++nCameraRays;
+
+                // Trace camera subpath
+                Vertex *cameraVertices = scratchBuffer.Alloc<Vertex[]>(maxDepth + 2);
+                int nCamera =
+                    GenerateCameraSubpath(*this, cameraRay->ray, lambda, sampler,
+                                          scratchBuffer, maxDepth + 2, camera,
+                                          cameraVertices, regularize);
+                MISVertex *cameraMIS =
+                    AllocMISVertices(scratchBuffer, cameraVertices, nCamera);
+                // Light subpath MIS state is copied before use since _MISWeight()_
+                // updates it temporarily
+                MISVertex *pathMIS = scratchBuffer.Alloc<MISVertex[]>(maxLightVertices);
+
+                // Execute connection strategies with pixel's light subpath
+                SampledSpectrum L(0.f);
+                size_t pathIndex = size_t(pPixel.y - pixelBounds.pMin.y) *
+                                       (pixelBounds.pMax.x - pixelBounds.pMin.x) +
+                                   (pPixel.x - pixelBounds.pMin.x);
+                const Vertex *path = &lightVertices[pathIndex * maxLightVertices];
+                int nLight = lightPathVertices[pathIndex];
+                std::copy(&lightMIS[pathIndex * maxLightVertices],
+                          &lightMIS[pathIndex * maxLightVertices] + nLight, pathMIS);
+                for (int t = 2; t <= nCamera; ++t)
+                    for (int s = 0; s <= std::max(nLight, 1); ++s) {
+                        if (s + t - 2 > maxDepth)
+                            continue;
+                        SampledSpectrum Lpath = ConnectBDPT(
+                            *this, lambda, path, cameraVertices, pathMIS, cameraMIS, s,
+                            t, lightSampler, camera, sampler, nullptr, nullptr,
+                            mergeEta);
+                        if (s >= 2)
+                            Lpath = toCameraWavelengths(
+                                Lpath, lightSecondaryTerminated[pathIndex], lambda);
+                        L += Lpath;
+                    }
+
+                // Merge mergeable camera vertices with nearby light vertices
+                bool canMerge = mergeEta > 0 && !gridEntries.empty();
+                for (int t = 2; t <= nCamera && canMerge; ++t) {
+                    const Vertex &pt = cameraVertices[t - 1];
+                    if (!cameraMIS[t - 1].mergeable)
+                        continue;
+                    ++vcmMergeQueries;
+                    // Find grid cells that overlap the merging disk around _pt_
+                    Point3f p = pt.p();
+                    Vector3f r(radius, radius, radius);
+                    Point3i pMin, pMax;
+                    ToGrid(p - r, gridBounds, gridRes, &pMin);
+                    ToGrid(p + r, gridBounds, gridRes, &pMax);
+
+                    for (int z = pMin.z; z <= pMax.z; ++z)
+                        for (int y = pMin.y; y <= pMax.y; ++y)
+                            for (int x = pMin.x; x <= pMax.x; ++x) {
+                                // Merge with light vertices in cell $(x,y,z)$
+                                int h = Hash(Point3i(x, y, z)) % hashSize;
+                                for (int e = gridOffsets[h]; e < gridOffsets[h + 1];
+                                     ++e) {
+                                    const VCMGridEntry &entry = gridEntries[e];
+                                    ++vcmVerticesChecked;
+                                    int s = entry.index;
+                                    if (DistanceSquared(entry.p, p) > Sqr(radius) ||
+                                        s + t - 2 > maxDepth)
+                                        continue;
+                                    // Skip entries from other cells in the same
+                                    // bucket
+                                    Point3i pe;
+                                    ToGrid(entry.p, gridBounds, gridRes, &pe);
+                                    if (pe != Point3i(x, y, z))
+                                        continue;
+
+                                    // Compute merged path contribution
+                                    size_t offset =
+                                        size_t(entry.path) * maxLightVertices;
+                                    const Vertex *mergePath = &lightVertices[offset];
+                                    Vector3f wi =
+                                        Normalize(mergePath[s - 1].p() - entry.p);
+                                    SampledSpectrum f = pt.bsdf.f(pt.si.wo, wi);
+                                    if (!f)
+                                        continue;
+                                    std::copy(&lightMIS[offset], &lightMIS[offset] + s,
+                                              pathMIS);
+                                    Float misWeight = MISWeight(
+                                        *this, mergePath, cameraVertices, pathMIS,
+                                        cameraMIS, mergePath[0], s, t, lightSampler,
+                                        mergeEta, true);
+                                    SampledSpectrum Lmerge = pt.beta * f *
+                                                             mergePath[s].beta *
+                                                             misWeight / mergeEta;
+                                    L += toCameraWavelengths(
+                                        Lmerge, lightSecondaryTerminated[entry.path],
+                                        lambda);
+                                }
+                            }
+                }
+
+                film.AddSample(pPixel, cameraRay->weight * L, lambda, nullptr,
+                               cameraSample.filterWeight);
+                StatsReportPixelEnd(pPixel);
+            }
+            film.MergeTile();
+        });
+        progress.Update();
+    }
+    progress.Done();
+
+    // Write VCM image to disk
+    ImageMetadata metadata;
+    metadata.renderTimeSeconds = progress.ElapsedSeconds();
+    metadata.samplesPerPixel = nIterations;
+    camera.InitMetadata(&metadata);
+    film.WriteImage(metadata, 1.0f / nIterations);
+}
+
+std::string VCMIntegrator::ToString() const {
+    return StringPrintf("[ VCMIntegrator camera: %s samplerPrototype: %s "
+                        "lightSampler: %s maxDepth: %d initialRadius: %f "
+                        "radiusAlpha: %f regularize: %s ]",
+                        camera, samplerPrototype, lightSampler, maxDepth, initialRadius,
+                        radiusAlpha, regularize);
+}
+
+std::unique_ptr<VCMIntegrator> VCMIntegrator::Create(
+    const ParameterDictionary &parameters, Camera camera, Sampler sampler,
+    Primitive aggregate, std::vector<Light> lights, const FileLoc *loc) {
+    int maxDepth = parameters.GetOneInt("maxdepth", 5);
+    // The default merging radius is relative to the size of the scene
+    Float radius = parameters.GetOneFloat("radius", 0);
+    if (radius <= 0 && aggregate) {
+        Point3f center;
+        Float sceneRadius;
+        aggregate.Bounds().BoundingSphere(&center, &sceneRadius);
+        radius = 0.003f * sceneRadius;
+    }
+    Float radiusAlpha = parameters.GetOneFloat("radiusalpha", 0.75f);
+    if (radiusAlpha <= 0 || radiusAlpha > 1)
+        ErrorExit(loc, "\"radiusalpha\" must be in (0, 1].");
+    bool regularize = parameters.GetOneBool("regularize", false);
+    return std::make_unique<VCMIntegrator>(camera, sampler, aggregate, lights, maxDepth,
+                                           radius, radiusAlpha, regularize);
+}
+
 // FunctionIntegrator Method Definitions
 FunctionIntegrator::FunctionIntegrator(std::function<Float(Point2f)> func,
                                        const std::string &outputFilename, Camera camera,
@@ -3521,7 +5296,8 @@ std::string FunctionIntegrator::ToString() const {
 std::unique_ptr<Integrator> Integrator::Create(
     const std::string &name, const ParameterDictionary &parameters, Camera camera,
     Sampler sampler, Primitive aggregate, std::vector<Light> lights,
-    const RGBColorSpace *colorSpace, const FileLoc *loc) {
+    const std::vector<Medium> &media, const RGBColorSpace *colorSpace, bool haveMedia,
+    bool haveSubsurface, const FileLoc *loc) {
     std::unique_ptr<Integrator> integrator;
     if (name == "path")
         integrator =
@@ -3539,7 +5315,8 @@ std::unique_ptr<Integrator> Integrator::Create(
                                                      aggregate, lights, loc);
     else if (name == "volpath")
         integrator = VolPathIntegrator::Create(parameters, camera, sampler, aggregate,
-                                               lights, loc);
+                                               lights, media, haveMedia, haveSubsurface,
+                                               loc);
     else if (name == "bdpt")
         integrator =
             BDPTIntegrator::Create(parameters, camera, sampler, aggregate, lights, loc);
@@ -3548,12 +5325,18 @@ std::unique_ptr<Integrator> Integrator::Create(
     else if (name == "ambientocclusion")
         integrator = AOIntegrator::Create(parameters, &colorSpace->illuminant, camera,
                                           sampler, aggregate, lights, loc);
+    else if (name == "irradiancecache")
+        integrator = IrradianceCacheIntegrator::Create(parameters, colorSpace, camera,
+                                                       sampler, aggregate, lights, loc);
     else if (name == "randomwalk")
         integrator = RandomWalkIntegrator::Create(parameters, camera, sampler, aggregate,
                                                   lights, loc);
     else if (name == "sppm")
         integrator = SPPMIntegrator::Create(parameters, colorSpace, camera, sampler,
                                             aggregate, lights, loc);
+    else if (name == "vcm")
+        integrator =
+            VCMIntegrator::Create(parameters, camera, sampler, aggregate, lights, loc);
     else
         ErrorExit(loc, "%s: integrator type unknown.", name);
 
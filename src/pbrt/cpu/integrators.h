@@ -17,11 +17,14 @@
 #include <pbrt/lights.h>
 #include <pbrt/lightsamplers.h>
 #include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/stats.h>
 
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <ostream>
@@ -30,6 +33,11 @@
 
 namespace pbrt {
 
+class GuidingQuadtree;
+class GuidingSDTree;
+class IrradianceCache;
+class VolumeGuidingField;
+
 // Integrator Definition
 class Integrator {
   public:
@@ -39,15 +47,27 @@ class Integrator {
     static std::unique_ptr<Integrator> Create(
         const std::string &name, const ParameterDictionary &parameters, Camera camera,
         Sampler sampler, Primitive aggregate, std::vector<Light> lights,
-        const RGBColorSpace *colorSpace, const FileLoc *loc);
+        const std::vector<Medium> &media, const RGBColorSpace *colorSpace,
+        bool haveMedia, bool haveSubsurface, const FileLoc *loc);
 
     virtual std::string ToString() const = 0;
 
     virtual void Render() = 0;
 
-    pstd::optional<ShapeIntersection> Intersect(const Ray &ray,
-                                                Float tMax = Infinity) const;
+    // Makes later calls to Render() render the view seen by _camera_, taking
+    // samples with _sampler_, which must have been created for the resolution
+    // of its film. Returns false if the integrator only renders one view.
+    virtual bool SetView(Camera camera, Sampler sampler) { return false; }
+
+    // The ray type is only used for --raystats; shadow rays that must find
+    // the closest intersection, e.g. to account for media, should be traced
+    // using Intersect() with _RayType::Shadow_.
+    pstd::optional<ShapeIntersection> Intersect(
+        const Ray &ray, Float tMax = Infinity, RayType type = RayType::Indirect) const;
     bool IntersectP(const Ray &ray, Float tMax = Infinity) const;
+    // Traces a batch of shadow rays together when the aggregate supports it
+    void IntersectP(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                    pstd::span<bool> hit) const;
 
     bool Unoccluded(const Interaction &p0, const Interaction &p1) const {
         return !IntersectP(p0.SpawnRayTo(p1), 1 - ShadowEpsilon);
@@ -86,9 +106,29 @@ class ImageTileIntegrator : public Integrator {
 
     void Render();
 
+    bool SetView(Camera camera, Sampler sampler) {
+        this->camera = camera;
+        samplerPrototype = sampler;
+        return true;
+    }
+
+    // Renders the image tiles returned by _nextTile_, which is called again
+    // after each one is finished, until it returns no tile. Tiles' samples are
+    // taken in the same waves as in Render(), so their pixels end up with the
+    // same values as when the entire image is rendered.
+    void RenderTiles(std::function<pstd::optional<Bounds2i>()> nextTile);
+
     virtual void EvaluatePixelSample(Point2i pPixel, int sampleIndex, Sampler sampler,
                                      ScratchBuffer &scratchBuffer) = 0;
 
+    // Called before the samples in [_waveStart_, _waveEnd_) are taken in
+    // the pixels of _bandBounds_.
+    virtual void StartWave(Bounds2i bandBounds, int waveStart, int waveEnd) {}
+
+    // Integrators that splat contributions to pixels other than the one being
+    // sampled can't use adaptive sampling.
+    virtual bool AddsSplats() const { return false; }
+
   protected:
     // ImageTileIntegrator Protected Members
     Camera camera;
@@ -179,17 +219,55 @@ class RandomWalkIntegrator : public RayIntegrator {
     int maxDepth;
 };
 
+// VisibilityCache Definition
+// Hash grid that shares visibility estimates among nearby points during a wave of
+// samples. Each cell accumulates the estimates traced from it until the standard
+// error of their mean is below _maxError_, after which the mean is used instead of
+// tracing more rays until the cache is cleared.
+class VisibilityCache {
+  public:
+    // VisibilityCache Public Methods
+    // _cellSize_ is relative to the extent of _sceneBounds_.
+    VisibilityCache(const Bounds3f &sceneBounds, Float cellSize, Float maxError,
+                    int nEntries = 1 << 20);
+
+    // Returns the index of the cell for _key_ around _p_ on the side of the surface
+    // that _n_ faces, or -1 if the cache is too full to add it.
+    int Cell(Point3f p, Normal3f n, uint64_t key = 0);
+    bool Lookup(int cell, Float *value) const;
+    void Add(int cell, Float value);
+    void Clear();
+
+    std::string ToString() const;
+
+  private:
+    // VisibilityCache Private Members
+    // A key of zero marks an unused entry
+    struct Entry {
+        std::atomic<uint64_t> key{0};
+        std::atomic<int> count{0};
+        AtomicFloat sum, sumSquared;
+    };
+    static constexpr int MinSamples = 8, MaxProbes = 16;
+    Point3f pMin;
+    Float cellSize, maxError;
+    std::vector<Entry> entries;
+};
+
 // SimplePathIntegrator Definition
 class SimplePathIntegrator : public RayIntegrator {
   public:
     // SimplePathIntegrator Public Methods
     SimplePathIntegrator(int maxDepth, bool sampleLights, bool sampleBSDF, Camera camera,
-                         Sampler sampler, Primitive aggregate, std::vector<Light> lights);
+                         Sampler sampler, Primitive aggregate, std::vector<Light> lights,
+                         VisibilityCache *visibilityCache = nullptr);
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
                        VisibleSurface *visibleSurface) const;
 
+    void StartWave(Bounds2i bandBounds, int waveStart, int waveEnd);
+
     static std::unique_ptr<SimplePathIntegrator> Create(
         const ParameterDictionary &parameters, Camera camera, Sampler sampler,
         Primitive aggregate, std::vector<Light> lights, const FileLoc *loc);
@@ -197,10 +275,16 @@ class SimplePathIntegrator : public RayIntegrator {
     std::string ToString() const;
 
   private:
+    // SimplePathIntegrator Private Methods
+    Float Visibility(const SurfaceInteraction &intr, Vector3f wi, Light light,
+                     const Interaction &pLight) const;
+
     // SimplePathIntegrator Private Members
     int maxDepth;
     bool sampleLights, sampleBSDF;
     UniformLightSampler lightSampler;
+    // Reuses shadow rays' results among nearby points for each light
+    VisibilityCache *visibilityCache;
 };
 
 // PathIntegrator Definition
@@ -210,12 +294,16 @@ class PathIntegrator : public RayIntegrator {
     PathIntegrator(int maxDepth, Camera camera, Sampler sampler, Primitive aggregate,
                    std::vector<Light> lights,
                    const std::string &lightSampleStrategy = "bvh",
-                   bool regularize = false);
+                   bool regularize = false, bool spectralReuse = false,
+                   int nLightSamples = 1, GuidingSDTree *sdTree = nullptr,
+                   bool adrrs = false);
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
                        VisibleSurface *visibleSurface) const;
 
+    void StartWave(Bounds2i bandBounds, int waveStart, int waveEnd);
+
     static std::unique_ptr<PathIntegrator> Create(const ParameterDictionary &parameters,
                                                   Camera camera, Sampler sampler,
                                                   Primitive aggregate,
@@ -225,14 +313,42 @@ class PathIntegrator : public RayIntegrator {
     std::string ToString() const;
 
   private:
+    // PathIntegrator::PathPrefix Definition
+    struct PathPrefix {
+        SampledSpectrum beta = SampledSpectrum(1.f);
+        int depth = 0;
+        Float bsdfPDF = 0, etaScale = 1;
+        bool specularBounce = false, anyNonSpecularBounces = false;
+        LightSampleContext prevIntrCtx;
+        // Estimate of the path's radiance for adjoint-driven Russian roulette
+        Float pathEstimate = 0;
+    };
+
     // PathIntegrator Private Methods
+    SampledSpectrum TracePath(RayDifferential ray, SampledWavelengths &lambda,
+                              Sampler sampler, ScratchBuffer &scratchBuffer,
+                              VisibleSurface *visibleSurface,
+                              const PathPrefix &prefix) const;
+
     SampledSpectrum SampleLd(const SurfaceInteraction &intr, const BSDF *bsdf,
-                             SampledWavelengths &lambda, Sampler sampler) const;
+                             SampledWavelengths &lambda, Sampler sampler,
+                             const GuidingQuadtree *quadtree) const;
+    SampledSpectrum SampleLdBatch(const SurfaceInteraction &intr, const BSDF *bsdf,
+                                  const LightSampleContext &ctx,
+                                  SampledWavelengths &lambda, Sampler sampler,
+                                  const GuidingQuadtree *quadtree) const;
 
     // PathIntegrator Private Members
     int maxDepth;
     LightSampler lightSampler;
-    bool regularize;
+    bool regularize, spectralReuse;
+    // Number of lights sampled at each path vertex, with their shadow rays traced
+    // together
+    int nLightSamples;
+    // Learn incident radiance at surfaces and use it to sample scattering directions
+    GuidingSDTree *sdTree;
+    // Terminate and split paths based on the incident radiance learned by _sdTree_
+    bool adrrs;
 };
 
 // SimpleVolPathIntegrator Definition
@@ -257,6 +373,45 @@ class SimpleVolPathIntegrator : public RayIntegrator {
     int maxDepth;
 };
 
+// PathSampleDimensions Definition
+// Consumes a path's sample dimensions in fixed-size blocks, one per path
+// vertex, where each use of sample values has a fixed offset in the block.
+// The dimensions of uses that don't happen at a vertex are skipped rather than
+// passed on to later uses, so that a given dimension always serves the same
+// purpose. Blocks only include the uses that the scene's features allow.
+class PathSampleDimensions {
+  public:
+    // PathSampleDimensions Public Types
+    // Uses are laid out in the order they are consumed at a vertex; _Phase_
+    // shares _Scattering_'s dimensions since a vertex has one or the other.
+    enum class Use {
+        Medium,
+        Material,
+        DirectLighting,
+        Scattering,
+        Phase,
+        Subsurface,
+        RussianRoulette
+    };
+    static constexpr int NumUses = 7;
+
+    // PathSampleDimensions Public Methods
+    PathSampleDimensions(bool haveMedia, bool haveSubsurface);
+
+    void StartBlock() { ++block; }
+    void Begin(Sampler sampler, Use use);
+
+    int BlockSize() const { return blockSize; }
+
+    std::string ToString() const;
+
+  private:
+    // PathSampleDimensions Private Members
+    pstd::array<int, NumUses> offset, count;
+    int blockSize = 0;
+    int block = -1, next = 0;
+};
+
 // VolPathIntegrator Definition
 class VolPathIntegrator : public RayIntegrator {
   public:
@@ -264,19 +419,34 @@ class VolPathIntegrator : public RayIntegrator {
     VolPathIntegrator(int maxDepth, Camera camera, Sampler sampler, Primitive aggregate,
                       std::vector<Light> lights,
                       const std::string &lightSampleStrategy = "bvh",
-                      bool regularize = false)
+                      bool regularize = false, bool haveMedia = true,
+                      bool haveSubsurface = true, bool residualTracking = false,
+                      VolumeGuidingField *guidingField = nullptr,
+                      GuidingSDTree *sdTree = nullptr, bool adrrs = false)
         : RayIntegrator(camera, sampler, aggregate, lights),
           maxDepth(maxDepth),
           lightSampler(LightSampler::Create(lightSampleStrategy, lights, Allocator())),
-          regularize(regularize) {}
+          regularize(regularize),
+          residualTracking(residualTracking),
+          guidingField(guidingField),
+          sdTree(sdTree),
+          adrrs(adrrs),
+          sampleDimensions(haveMedia, haveSubsurface) {
+        for (Light light : lights)
+            if (light.Is<VolumeEmitterLight>())
+                volumeLights.push_back(light);
+    }
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
                        VisibleSurface *visibleSurface) const;
 
+    void StartWave(Bounds2i bandBounds, int waveStart, int waveEnd);
+
     static std::unique_ptr<VolPathIntegrator> Create(
         const ParameterDictionary &parameters, Camera camera, Sampler sampler,
-        Primitive aggregate, std::vector<Light> lights, const FileLoc *loc);
+        Primitive aggregate, std::vector<Light> lights, const std::vector<Medium> &media,
+        bool haveMedia, bool haveSubsurface, const FileLoc *loc);
 
     std::string ToString() const;
 
@@ -284,7 +454,16 @@ class VolPathIntegrator : public RayIntegrator {
     // VolPathIntegrator Private Methods
     SampledSpectrum SampleLd(const Interaction &intr, const BSDF *bsdf,
                              SampledWavelengths &lambda, Sampler sampler,
-                             SampledSpectrum T_hat, SampledSpectrum pathPDF) const;
+                             SampledSpectrum T_hat, SampledSpectrum pathPDF,
+                             int depth, const GuidingQuadtree *quadtree = nullptr) const;
+
+    Light VolumeLight(Medium medium) const {
+        // Return the _VolumeEmitterLight_ that samples _medium_'s emission, if any
+        for (Light light : volumeLights)
+            if (light.Cast<VolumeEmitterLight>()->GetMedium() == medium)
+                return light;
+        return nullptr;
+    }
 
     static void Rescale(SampledSpectrum &T_hat, SampledSpectrum &uniPathPDF,
                         SampledSpectrum &lightPathPDF) {
@@ -310,6 +489,17 @@ class VolPathIntegrator : public RayIntegrator {
     int maxDepth;
     LightSampler lightSampler;
     bool regularize;
+    // Estimate shadow rays' transmittance with residual ratio tracking
+    bool residualTracking;
+    // Learn incident radiance in media and use it to sample scattering directions
+    VolumeGuidingField *guidingField;
+    // Learn incident radiance at surfaces and use it to sample scattering directions
+    GuidingSDTree *sdTree;
+    // Terminate paths at surfaces based on the incident radiance learned by _sdTree_
+    bool adrrs;
+    PathSampleDimensions sampleDimensions;
+    // Lights that sample emissive media, which paths also find by tracking
+    std::vector<Light> volumeLights;
 };
 
 // AOIntegrator Definition
@@ -317,12 +507,15 @@ class AOIntegrator : public RayIntegrator {
   public:
     // AOIntegrator Public Methods
     AOIntegrator(bool cosSample, Float maxDist, Camera camera, Sampler sampler,
-                 Primitive aggregate, std::vector<Light> lights, Spectrum illuminant);
+                 Primitive aggregate, std::vector<Light> lights, Spectrum illuminant,
+                 VisibilityCache *visibilityCache = nullptr);
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
                        VisibleSurface *visibleSurface) const;
 
+    void StartWave(Bounds2i bandBounds, int waveStart, int waveEnd);
+
     static std::unique_ptr<AOIntegrator> Create(const ParameterDictionary &parameters,
                                                 Spectrum illuminant, Camera camera,
                                                 Sampler sampler, Primitive aggregate,
@@ -336,6 +529,57 @@ class AOIntegrator : public RayIntegrator {
     Float maxDist;
     Spectrum illuminant;
     Float illumScale;
+    // Reuses ambient occlusion estimates among nearby points
+    VisibilityCache *visibilityCache;
+};
+
+// IrradianceCacheIntegrator Definition
+// Renders previews by following specular bounces from the camera and then adding
+// direct lighting and indirect lighting from _IrradianceCache_s at the first
+// non-specular surface. Reflected indirect light is approximated as if the BSDF
+// was Lambertian with the same albedo.
+class IrradianceCacheIntegrator : public RayIntegrator {
+  public:
+    // IrradianceCacheIntegrator Public Methods
+    IrradianceCacheIntegrator(int maxDepth, int nGatherSamples,
+                              std::vector<IrradianceCache *> caches,
+                              const RGBColorSpace *colorSpace, Camera camera,
+                              Sampler sampler, Primitive aggregate,
+                              std::vector<Light> lights,
+                              const std::string &lightSampleStrategy = "bvh");
+
+    SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
+                       ScratchBuffer &scratchBuffer,
+                       VisibleSurface *visibleSurface) const;
+
+    static std::unique_ptr<IrradianceCacheIntegrator> Create(
+        const ParameterDictionary &parameters, const RGBColorSpace *colorSpace,
+        Camera camera, Sampler sampler, Primitive aggregate, std::vector<Light> lights,
+        const FileLoc *loc);
+
+    std::string ToString() const;
+
+  private:
+    // IrradianceCacheIntegrator Private Methods
+    SampledSpectrum SampleLd(const SurfaceInteraction &intr, const BSDF &bsdf,
+                             SampledWavelengths &lambda, Float u, Point2f uLight) const;
+    SampledSpectrum IndirectLight(const SurfaceInteraction &intr, const BSDF &bsdf,
+                                  SampledWavelengths &lambda, int bounce, Float uc,
+                                  Point2f u, Sampler sampler,
+                                  ScratchBuffer &scratchBuffer) const;
+    RGB Irradiance(const SurfaceInteraction &intr, int bounce, Sampler sampler,
+                   ScratchBuffer &scratchBuffer) const;
+
+    // IrradianceCacheIntegrator Private Members
+    int maxDepth;
+    // Final gathering takes _gatherM_ by _gatherN_ samples stratified in $\theta$
+    // and $\phi$
+    int gatherM, gatherN;
+    // Irradiance caches for each bounce of indirect light, where the records in
+    // each cache gather light from the next one
+    std::vector<IrradianceCache *> caches;
+    const RGBColorSpace *colorSpace;
+    LightSampler lightSampler;
 };
 
 // LightPathIntegrator Definition
@@ -348,6 +592,8 @@ class LightPathIntegrator : public ImageTileIntegrator {
     void EvaluatePixelSample(Point2i pPixel, int sampleIndex, Sampler sampler,
                              ScratchBuffer &scratchBuffer);
 
+    bool AddsSplats() const { return true; }
+
     static std::unique_ptr<LightPathIntegrator> Create(
         const ParameterDictionary &parameters, Camera camera, Sampler sampler,
         Primitive aggregate, std::vector<Light> lights, const FileLoc *loc);
@@ -362,18 +608,15 @@ class LightPathIntegrator : public ImageTileIntegrator {
 
 // BDPTIntegrator Definition
 struct Vertex;
+struct LightVertexCache;
 class BDPTIntegrator : public RayIntegrator {
   public:
     // BDPTIntegrator Public Methods
     BDPTIntegrator(Camera camera, Sampler sampler, Primitive aggregate,
                    std::vector<Light> lights, int maxDepth, bool visualizeStrategies,
-                   bool visualizeWeights, bool regularize = false)
-        : RayIntegrator(camera, sampler, aggregate, lights),
-          maxDepth(maxDepth),
-          regularize(regularize),
-          lightSampler(new PowerLightSampler(lights, Allocator())),
-          visualizeStrategies(visualizeStrategies),
-          visualizeWeights(visualizeWeights) {}
+                   bool visualizeWeights, bool regularize = false,
+                   int lightVertexCachePaths = 0);
+    ~BDPTIntegrator();
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda, Sampler sampler,
                        ScratchBuffer &scratchBuffer,
@@ -388,6 +631,9 @@ class BDPTIntegrator : public RayIntegrator {
     std::string ToString() const;
 
     void Render();
+    void StartWave(Bounds2i bandBounds, int waveStart, int waveEnd);
+
+    bool AddsSplats() const { return true; }
 
   private:
     // BDPTIntegrator Private Members
@@ -396,6 +642,9 @@ class BDPTIntegrator : public RayIntegrator {
     LightSampler lightSampler;
     bool visualizeStrategies, visualizeWeights;
     mutable std::vector<Film> weightFilms;
+    // Light subpaths shared by all camera samples in a wave, if enabled
+    int lightVertexCachePaths;
+    std::unique_ptr<LightVertexCache> lightVertexCache;
 };
 
 // MLTIntegrator Definition
@@ -497,6 +746,45 @@ class SPPMIntegrator : public Integrator {
     const RGBColorSpace *colorSpace;
 };
 
+// VCMIntegrator Definition
+// Vertex connection and merging: BDPT's connection strategies combined with
+// merging camera vertices with nearby light subpath vertices, as in
+// progressive photon mapping, with MIS over all of them.
+class VCMIntegrator : public Integrator {
+  public:
+    // VCMIntegrator Public Methods
+    VCMIntegrator(Camera camera, Sampler sampler, Primitive aggregate,
+                  std::vector<Light> lights, int maxDepth, Float initialRadius,
+                  Float radiusAlpha, bool regularize)
+        : Integrator(aggregate, lights),
+          camera(camera),
+          samplerPrototype(sampler),
+          lightSampler(new PowerLightSampler(lights, Allocator())),
+          maxDepth(maxDepth),
+          initialRadius(initialRadius),
+          radiusAlpha(radiusAlpha),
+          regularize(regularize) {}
+
+    static std::unique_ptr<VCMIntegrator> Create(const ParameterDictionary &parameters,
+                                                 Camera camera, Sampler sampler,
+                                                 Primitive aggregate,
+                                                 std::vector<Light> lights,
+                                                 const FileLoc *loc);
+
+    std::string ToString() const;
+
+    void Render();
+
+  private:
+    // VCMIntegrator Private Members
+    Camera camera;
+    Sampler samplerPrototype;
+    LightSampler lightSampler;
+    int maxDepth;
+    Float initialRadius, radiusAlpha;
+    bool regularize;
+};
+
 // FunctionIntegrator Definition
 class FunctionIntegrator : public Integrator {
   public:
@@ -427,3 +427,89 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+TEST(PathSampleDimensions, SkippedUsesKeepLayout) {
+    PaddedSobolSampler s0(16, RandomizeStrategy::FastOwen);
+    PaddedSobolSampler s1(16, RandomizeStrategy::FastOwen);
+    Sampler sampler0 = &s0, sampler1 = &s1;
+    using Use = PathSampleDimensions::Use;
+
+    for (bool haveMedia : {false, true})
+        for (bool haveSubsurface : {false, true}) {
+            PathSampleDimensions dims0(haveMedia, haveSubsurface);
+            PathSampleDimensions dims1(haveMedia, haveSubsurface);
+            sampler0.StartPixelSample({3, 4}, 5);
+            sampler1.StartPixelSample({3, 4}, 5);
+
+            // Only the first path has direct lighting at its first vertex
+            dims0.StartBlock();
+            dims1.StartBlock();
+            dims0.Begin(sampler0, Use::DirectLighting);
+            for (int i = 0; i < 3; ++i)
+                sampler0.Get1D();
+            dims0.Begin(sampler0, Use::Scattering);
+            dims1.Begin(sampler1, Use::Scattering);
+            EXPECT_EQ(sampler0.Get1D(), sampler1.Get1D());
+            EXPECT_EQ(sampler0.Get2D(), sampler1.Get2D());
+
+            // Only the second path reaches Russian roulette
+            dims1.Begin(sampler1, Use::RussianRoulette);
+            sampler1.Get1D();
+
+            // Both paths' light samples at the next vertex should match
+            // those of a sampler that consumed one full block.
+            dims0.StartBlock();
+            dims1.StartBlock();
+            dims0.Begin(sampler0, Use::DirectLighting);
+            dims1.Begin(sampler1, Use::DirectLighting);
+            Float u0 = sampler0.Get1D(), u1 = sampler1.Get1D();
+            EXPECT_EQ(u0, u1);
+
+            PaddedSobolSampler ref(16, RandomizeStrategy::FastOwen);
+            ref.StartPixelSample({3, 4}, 5, 0);
+            for (int i = 0; i < dims0.BlockSize(); ++i)
+                ref.Get1D();
+            PathSampleDimensions layout(haveMedia, haveSubsurface);
+            layout.StartBlock();
+            Sampler refSampler = &ref;
+            layout.Begin(refSampler, Use::DirectLighting);
+            EXPECT_EQ(u0, ref.Get1D());
+        }
+}
+
+TEST(VisibilityCache, ReusesAccurateEstimates) {
+    VisibilityCache cache(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)), 0.1f, 0.05f,
+                          1024);
+    Point3f p(0.52f, 0.52f, 0.52f);
+    Normal3f n(0, 0, 1);
+    int cell = cache.Cell(p, n);
+    ASSERT_GE(cell, 0);
+
+    // Nearby points on the same side of a surface share cells
+    EXPECT_EQ(cell, cache.Cell(Point3f(0.55f, 0.58f, 0.51f), n));
+    EXPECT_NE(cell, cache.Cell(Point3f(0.75f, 0.52f, 0.52f), n));
+    EXPECT_NE(cell, cache.Cell(p, -n));
+    EXPECT_NE(cell, cache.Cell(p, n, 1));
+
+    // Cells that are always visible are reused after a few samples
+    Float V;
+    EXPECT_FALSE(cache.Lookup(cell, &V));
+    for (int i = 0; i < 8; ++i)
+        cache.Add(cell, 1);
+    ASSERT_TRUE(cache.Lookup(cell, &V));
+    EXPECT_EQ(1, V);
+
+    // Partially visible cells need more samples to meet the error bound
+    int other = cache.Cell(p, -n);
+    for (int i = 0; i < 16; ++i)
+        cache.Add(other, i & 1);
+    EXPECT_FALSE(cache.Lookup(other, &V));
+    for (int i = 0; i < 100; ++i)
+        cache.Add(other, i & 1);
+    ASSERT_TRUE(cache.Lookup(other, &V));
+    EXPECT_NEAR(0.5f, V, 1e-3f);
+
+    // Estimates aren't reused after the cache is cleared
+    cache.Clear();
+    EXPECT_FALSE(cache.Lookup(cell, &V));
+}
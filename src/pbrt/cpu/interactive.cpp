@@ -0,0 +1,448 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/interactive.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/film.h>
+#include <pbrt/lights.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
+#include <pbrt/parsedscene.h>
+#include <pbrt/parser.h>
+#include <pbrt/util/display.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#ifdef PBRT_IS_WINDOWS
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Ws2tcpip.h>
+#include <winsock2.h>
+#undef NOMINMAX
+using socket_t = SOCKET;
+#else
+using socket_t = int;
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define SOCKET_ERROR (-1)
+#define INVALID_SOCKET (-1)
+#endif
+
+namespace pbrt {
+
+static int closeSocket(socket_t socket) {
+#ifdef PBRT_IS_WINDOWS
+    return closesocket(socket);
+#else
+    return close(socket);
+#endif
+}
+
+// InteractiveSession Method Definitions
+InteractiveSession::InteractiveSession(
+    ParsedScene &parsedScene, Camera camera, Sampler sampler, Primitive aggregate,
+    SceneInstances *sceneInstances, const std::vector<Light> &lights,
+    const std::map<std::string, Medium> &media, const NamedTextures &textures,
+    const std::map<std::string, Material> &namedMaterials, bool haveScatteringMedia,
+    bool haveSubsurface, std::unique_ptr<Integrator> integrator, Allocator alloc)
+    : parsedScene(parsedScene),
+      camera(camera),
+      sampler(sampler),
+      aggregate(aggregate),
+      sceneInstances(sceneInstances),
+      media(media),
+      textures(textures),
+      namedMaterials(namedMaterials),
+      haveScatteringMedia(haveScatteringMedia),
+      haveSubsurface(haveSubsurface),
+      alloc(alloc),
+      integrator(std::move(integrator)) {
+    film = camera.GetFilm().CastOrNullptr<RGBFilm>();
+    if (!film || camera.GetFilm().StreamingBandHeight() > 0)
+        ErrorExit("Interactive and sequence rendering are only supported with a "
+                  "non-streaming \"rgb\" film.");
+
+    // The lights created from the scene's LightSource statements come before
+    // its area lights
+    size_t nLights = parsedScene.lights.size();
+    CHECK_LE(nLights, lights.size());
+    this->lights.assign(lights.begin(), lights.begin() + nLights);
+    areaLights.assign(lights.begin() + nLights, lights.end());
+
+    // Integrators created again after edits are of the same type
+    if (!dynamic_cast<ImageTileIntegrator *>(this->integrator.get()))
+        ErrorExit(&parsedScene.integrator.loc,
+                  "Interactive and sequence rendering aren't supported by the \"%s\" "
+                  "integrator.",
+                  parsedScene.integrator.name);
+
+    if (sceneInstances)
+        for (size_t i = 0; i < sceneInstances->names.size(); ++i)
+            instanceIndices[sceneInstances->names[i]].push_back(i);
+}
+
+void InteractiveSession::createIntegrator() {
+    std::vector<Light> allLights = lights;
+    allLights.insert(allLights.end(), areaLights.begin(), areaLights.end());
+    std::vector<Medium> allMedia;
+    for (const auto &m : media)
+        allMedia.push_back(m.second);
+    integrator = Integrator::Create(
+        parsedScene.integrator.name, parsedScene.integrator.parameters, camera, sampler,
+        aggregate, allLights, allMedia, parsedScene.film.parameters.ColorSpace(),
+        haveScatteringMedia, haveSubsurface, &parsedScene.integrator.loc);
+}
+
+Medium InteractiveSession::findMedium(const std::string &name,
+                                      const FileLoc *loc) const {
+    if (name.empty())
+        return nullptr;
+    auto iter = media.find(name);
+    if (iter == media.end())
+        ErrorExit(loc, "%s: medium not defined", name);
+    return iter->second;
+}
+
+// Prepares _edit_ for parsing an edit to the scene. Edits use the scene's
+// rendering space so that the geometry doesn't need to be created again.
+void InteractiveSession::startEdit(ParsedScene *edit) const {
+    edit->SetRenderingSpace(camera.GetCameraTransform().WorldFromRender());
+}
+
+// Applies the parsed edit _edit_, returning true if the integrator must be
+// created again.
+bool InteractiveSession::applyEdit(ParsedScene &edit) {
+    if (!edit.shapes.empty() || !edit.animatedShapes.empty() ||
+        !edit.floatTextures.empty() || !edit.spectrumTextures.empty() ||
+        !edit.media.empty())
+        Warning("Ignoring shapes outside of object definitions, textures, and media "
+                "in scene edit.");
+    edit.shapes.clear();
+    edit.animatedShapes.clear();
+
+    bool editsCamera = !edit.camera.loc.filename.empty();
+    if (editsCamera) {
+        Medium cameraMedium = findMedium(edit.camera.medium, &edit.camera.loc);
+        camera = Camera::Create(edit.camera.name, edit.camera.parameters, cameraMedium,
+                                edit.camera.cameraTransform, camera.GetFilm(),
+                                &edit.camera.loc, alloc);
+        integrator->SetView(camera, sampler);
+    }
+
+    bool editsLights = !edit.lights.empty();
+    if (editsLights) {
+        lights.clear();
+        for (const LightSceneEntity &light : edit.lights) {
+            Medium outsideMedium = findMedium(light.medium, &light.loc);
+            lights.push_back(Light::Create(
+                light.name, light.parameters, light.renderFromObject.startTransform,
+                camera.GetCameraTransform(), outsideMedium, &light.loc, alloc));
+        }
+    }
+
+    // Named materials are updated in place since the primitives refer to them
+    std::map<std::string, Material> editedMaterials;
+    std::vector<Material> materials;
+    if (!edit.namedMaterials.empty() || !edit.instanceDefinitions.empty())
+        edit.CreateMaterials(textures, alloc, &editedMaterials, &materials);
+    for (const auto &edited : editedMaterials) {
+        auto iter = namedMaterials.find(edited.first);
+        if (iter == namedMaterials.end()) {
+            Warning("%s: ignoring edit of named material that isn't in the scene.",
+                    edited.first);
+            continue;
+        }
+        Material material = iter->second;
+        Material newMaterial = edited.second;
+        if (!material || !newMaterial || material.Tag() != newMaterial.Tag()) {
+            Warning("%s: ignoring edit that changes the named material's type.",
+                    edited.first);
+            continue;
+        }
+        auto copy = [&](auto ptr) {
+            using M = typename std::remove_reference_t<decltype(*ptr)>;
+            *ptr = *newMaterial.Cast<M>();
+        };
+        material.DispatchCPU(copy);
+    }
+
+    // Lights are preprocessed with the scene's bounds when the integrator is
+    // created, so it's created again if they change
+    bool editsBounds = applyInstanceEdits(edit, materials);
+
+    return editsLights || editsBounds;
+}
+
+// Applies _edit_'s object definitions and instances, returning true if the
+// scene's bounds changed.
+bool InteractiveSession::applyInstanceEdits(ParsedScene &edit,
+                                            const std::vector<Material> &materials) {
+    if (edit.instances.empty() && edit.instanceDefinitions.empty())
+        return false;
+    if (!sceneInstances || !sceneInstances->topLevel) {
+        Warning("Ignoring object definitions and instances in scene edit of a scene "
+                "without object instances.");
+        return false;
+    }
+
+    // Create the primitives of the edit's object definitions; its instances are
+    // handled here since they refer to the scene's definitions
+    std::vector<InstanceSceneEntity> instances = std::move(edit.instances);
+    edit.instances.clear();
+    SceneInstances editInstances;
+    std::map<int, pstd::vector<Light> *> noAreaLights;
+    edit.CreatePrimitives(alloc, textures, noAreaLights, media, namedMaterials,
+                          materials, &editInstances);
+    for (const auto &definition : editInstances.definitions) {
+        auto iter = instanceIndices.find(definition.first);
+        if (iter == instanceIndices.end() || !definition.second) {
+            Warning("%s: ignoring edit of object definition that is empty or has no "
+                    "instances in the scene.",
+                    definition.first);
+            continue;
+        }
+        for (int index : iter->second) {
+            Primitive prim = sceneInstances->primitives[index];
+            if (TransformedPrimitive *tp = prim.CastOrNullptr<TransformedPrimitive>())
+                tp->SetPrimitive(definition.second);
+            else
+                prim.Cast<AnimatedPrimitive>()->SetPrimitive(definition.second);
+        }
+    }
+
+    // Update the transformations of the instances given by the edit
+    std::map<std::string, size_t> nEditedInstances;
+    for (InstanceSceneEntity &inst : instances) {
+        size_t k = nEditedInstances[inst.name]++;
+        auto iter = instanceIndices.find(inst.name);
+        if (iter == instanceIndices.end() || k >= iter->second.size())
+            Warning(&inst.loc, "%s: ignoring object instance that isn't in the scene.",
+                    inst.name);
+        else {
+            int index = iter->second[k];
+            Primitive prim = sceneInstances->primitives[index];
+            if (TransformedPrimitive *tp = prim.CastOrNullptr<TransformedPrimitive>()) {
+                if (!inst.renderFromInstance ||
+                    !AffineTransform::IsAffine(*inst.renderFromInstance))
+                    Warning(&inst.loc, "%s: ignoring animated or non-affine "
+                                       "transformation of an object instance that "
+                                       "isn't animated.",
+                            inst.name);
+                else {
+                    instanceTransforms[index] = AffineTransform(*inst.renderFromInstance);
+                    tp->SetRenderFromPrimitive(&instanceTransforms[index]);
+                }
+            } else {
+                AnimatedPrimitive *ap = prim.Cast<AnimatedPrimitive>();
+                if (inst.renderFromInstanceAnim)
+                    ap->SetRenderFromPrimitive(*inst.renderFromInstanceAnim);
+                else
+                    ap->SetRenderFromPrimitive(AnimatedTransform(
+                        *inst.renderFromInstance, 0, *inst.renderFromInstance, 1));
+            }
+        }
+        delete inst.renderFromInstance;
+        delete inst.renderFromInstanceAnim;
+    }
+
+    // Refit the top-level BVH, which rebuilds it if the instances have moved far
+    Bounds3f bounds = aggregate.Bounds();
+    sceneInstances->topLevel->Update();
+    return aggregate.Bounds() != bounds;
+}
+
+void InteractiveSession::Run(int port) {
+    // Start listening for edits
+#ifdef PBRT_IS_WINDOWS
+    WSADATA wsaData;
+    if (int err = WSAStartup(MAKEWORD(2, 2), &wsaData); err != NO_ERROR)
+        ErrorExit("Unable to initialize WinSock: %s", ErrorString(err));
+#endif
+    struct addrinfo hints = {}, *addrinfo;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    std::string portString = std::to_string(port);
+    if (int err = getaddrinfo(nullptr, portString.c_str(), &hints, &addrinfo); err)
+        ErrorExit("%s", gai_strerror(err));
+    socket_t listenSocket =
+        socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
+    int reuse = 1;
+    if (listenSocket == INVALID_SOCKET ||
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
+                   sizeof(reuse)) == SOCKET_ERROR ||
+        bind(listenSocket, addrinfo->ai_addr, addrinfo->ai_addrlen) == SOCKET_ERROR ||
+        listen(listenSocket, SOMAXCONN) == SOCKET_ERROR)
+        ErrorExit("Unable to listen for scene edits on port %d: %s", port,
+                  ErrorString());
+    freeaddrinfo(addrinfo);
+    if (!Options->quiet)
+        Printf("Listening for scene edits on port %d.\n", port);
+
+    // Read each connection's edit in a separate thread; an empty edit ends the
+    // session
+    std::mutex editsMutex;
+    std::condition_variable editsCondition;
+    std::vector<std::string> pendingEdits;
+    std::thread listenThread([&]() {
+        bool done = false;
+        while (!done) {
+            socket_t socket = accept(listenSocket, nullptr, nullptr);
+            if (socket == INVALID_SOCKET)
+                continue;
+            std::string text;
+            char buffer[4096];
+            int n;
+            while ((n = recv(socket, buffer, sizeof(buffer), 0)) > 0)
+                text.append(buffer, n);
+            closeSocket(socket);
+            done = text.find_first_not_of(" \t\r\n") == std::string::npos;
+
+            std::lock_guard<std::mutex> lock(editsMutex);
+            pendingEdits.push_back(done ? std::string() : std::move(text));
+            editsCondition.notify_all();
+        }
+    });
+
+    Bounds2i pixelBounds = film->PixelBounds();
+    if (!Options->displayServer.empty())
+        DisplayDynamic(film->GetFilename(), Point2i(pixelBounds.Diagonal()),
+                       {"R", "G", "B"},
+                       [&](Bounds2i b, pstd::span<pstd::span<Float>> displayValue) {
+                           Float scale = 2.f / (waveStart + waveEnd);
+                           int index = 0;
+                           for (Point2i p : b) {
+                               RGB rgb = film->GetPixelRGB(pixelBounds.pMin + p, scale);
+                               for (int c = 0; c < 3; ++c)
+                                   displayValue[c][index] = rgb[c];
+                               ++index;
+                           }
+                       });
+
+    auto writeImage = [&](int samplesPerPixel, double seconds) {
+        ImageMetadata metadata;
+        metadata.renderTimeSeconds = seconds;
+        metadata.samplesPerPixel = samplesPerPixel;
+        camera.InitMetadata(&metadata);
+        camera.GetFilm().WriteImage(metadata, 1.0f / samplesPerPixel);
+    };
+
+    std::vector<Sampler> samplers = sampler.Clone(MaxThreadIndex());
+    int spp = sampler.SamplesPerPixel();
+    while (true) {
+        // Render the image in waves of samples until all of them have been
+        // taken or an edit arrives
+        ImageTileIntegrator *tileIntegrator =
+            static_cast<ImageTileIntegrator *>(integrator.get());
+        film->Clear();
+        Timer timer;
+        waveStart = 0;
+        waveEnd = 1;
+        int nextWaveSize = 1;
+        bool edited = false;
+        while (waveStart < spp && !edited) {
+            tileIntegrator->StartWave(pixelBounds, waveStart, waveEnd);
+            ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
+                ScratchBuffer &scratchBuffer = ThreadScratchBuffer();
+                Sampler &threadSampler = samplers[ThreadIndex];
+                film->StartTile(tileBounds);
+                for (Point2i pPixel : tileBounds)
+                    for (int sampleIndex = waveStart; sampleIndex < waveEnd;
+                         ++sampleIndex) {
+                        ScratchScope scratchScope(scratchBuffer);
+                        threadSampler.StartPixelSample(pPixel, sampleIndex);
+                        tileIntegrator->EvaluatePixelSample(pPixel, sampleIndex,
+                                                            threadSampler, scratchBuffer);
+                    }
+                film->MergeTile();
+            });
+            waveStart = int(waveEnd);
+            waveEnd = std::min(spp, waveEnd + nextWaveSize);
+            nextWaveSize = std::min(2 * nextWaveSize, 64);
+
+            std::lock_guard<std::mutex> lock(editsMutex);
+            edited = !pendingEdits.empty();
+        }
+        if (!edited) {
+            writeImage(spp, timer.ElapsedSeconds());
+            if (!Options->quiet)
+                Printf("Finished rendering in %.1fs; waiting for scene edits.\n",
+                       timer.ElapsedSeconds());
+        }
+
+        // Apply the edits that have arrived, waiting for one if necessary
+        std::vector<std::string> edits;
+        {
+            std::unique_lock<std::mutex> lock(editsMutex);
+            editsCondition.wait(lock, [&]() { return !pendingEdits.empty(); });
+            std::swap(edits, pendingEdits);
+        }
+        bool recreateIntegrator = false;
+        for (std::string &text : edits) {
+            if (text.empty()) {
+                // Write the image of an unfinished render before ending the session
+                if (edited && waveStart > 0)
+                    writeImage(waveStart, timer.ElapsedSeconds());
+                listenThread.join();
+                closeSocket(listenSocket);
+                return;
+            }
+            ParsedScene edit;
+            startEdit(&edit);
+            ParseString(&edit, std::move(text));
+            recreateIntegrator |= applyEdit(edit);
+        }
+        if (recreateIntegrator)
+            createIntegrator();
+    }
+}
+
+void InteractiveSession::RunSequence(const std::string &filename) {
+    // Read the names of the frames' scene files, ignoring blank lines
+    std::vector<std::string> frameFiles;
+    for (const std::string &line : SplitString(ReadFileContents(filename), '\n')) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start != std::string::npos)
+            frameFiles.push_back(
+                line.substr(start, line.find_last_not_of(" \t\r") + 1 - start));
+    }
+
+    std::string baseFilename = film->GetFilename();
+    std::string stem = RemoveExtension(baseFilename);
+    std::string extension = baseFilename.substr(stem.size());
+    for (size_t frame = 0; frame <= frameFiles.size(); ++frame) {
+        // Apply the frame's edits to the previous frame
+        if (frame > 0) {
+            ParsedScene edit;
+            startEdit(&edit);
+            ParseFiles(&edit, pstd::MakeConstSpan(&frameFiles[frame - 1], 1));
+            if (applyEdit(edit))
+                createIntegrator();
+        }
+
+        LOG_VERBOSE("Rendering frame %d of %d", frame, frameFiles.size() + 1);
+        film->SetFilename(StringPrintf("%s_%04d%s", stem, frame, extension));
+        film->Clear();
+        integrator->Render();
+    }
+}
+
+}  // namespace pbrt
@@ -0,0 +1,104 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_INTERACTIVE_H
+#define PBRT_CPU_INTERACTIVE_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/base/camera.h>
+#include <pbrt/base/light.h>
+#include <pbrt/base/material.h>
+#include <pbrt/base/medium.h>
+#include <pbrt/base/sampler.h>
+#include <pbrt/cpu/integrators.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/paramdict.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+class ParsedScene;
+struct SceneInstances;
+
+// InteractiveSession Definition
+// An interactive session keeps the scene's objects alive and renders it again
+// after edits to it, which are given in the scene file format:
+// - a Camera statement replaces the camera,
+// - LightSource statements replace all of the scene's lights other than area
+//   lights,
+// - MakeNamedMaterial statements replace the parameters of the scene's named
+//   materials of the same types,
+// - ObjectBegin/ObjectEnd blocks replace the geometry of the scene's object
+//   definitions, and
+// - the k-th ObjectInstance statement for an object gives a new transformation
+//   for the scene's k-th instance of it.
+// Edits reuse the scene's textures and the geometry and acceleration
+// structures that they don't replace; the top-level BVH is refit after edits
+// to object instances. Memory used by replaced geometry isn't freed.
+//
+// Run() renders the scene progressively, showing the image on the display
+// server as its samples accumulate. Each connection to its port sends one
+// edit, after which rendering starts over; a connection that sends nothing
+// ends the session. RunSequence() renders the frames of an animation, each
+// given by an edit to the previous one.
+class InteractiveSession {
+  public:
+    // InteractiveSession Public Methods
+    // Object instances can only be edited if _sceneInstances_ is given.
+    InteractiveSession(ParsedScene &parsedScene, Camera camera, Sampler sampler,
+                       Primitive aggregate, SceneInstances *sceneInstances,
+                       const std::vector<Light> &lights,
+                       const std::map<std::string, Medium> &media,
+                       const NamedTextures &textures,
+                       const std::map<std::string, Material> &namedMaterials,
+                       bool haveScatteringMedia, bool haveSubsurface,
+                       std::unique_ptr<Integrator> integrator, Allocator alloc);
+
+    void Run(int port);
+    // Renders the scene and then a frame for each of the scene files listed in
+    // _filename_, one per line, which are edits to the previous frame. Frame
+    // images are written to the film's filename with the frame number
+    // appended, as in "image_0001.exr".
+    void RunSequence(const std::string &filename);
+
+  private:
+    // InteractiveSession Private Methods
+    void createIntegrator();
+    void startEdit(ParsedScene *edit) const;
+    bool applyEdit(ParsedScene &edit);
+    bool applyInstanceEdits(ParsedScene &edit, const std::vector<Material> &materials);
+    Medium findMedium(const std::string &name, const FileLoc *loc) const;
+
+    // InteractiveSession Private Members
+    ParsedScene &parsedScene;
+    Camera camera;
+    RGBFilm *film;
+    Sampler sampler;
+    Primitive aggregate;
+    SceneInstances *sceneInstances;
+    // Indices of each object's instances in _sceneInstances_ and the edited
+    // transformations of instances, which must stay at the same addresses
+    std::map<std::string, std::vector<int>> instanceIndices;
+    std::map<int, AffineTransform> instanceTransforms;
+    // Only the lights created from LightSource statements can be edited
+    std::vector<Light> lights, areaLights;
+    std::map<std::string, Medium> media;
+    const NamedTextures &textures;
+    std::map<std::string, Material> namedMaterials;
+    bool haveScatteringMedia, haveSubsurface;
+    Allocator alloc;
+    std::unique_ptr<Integrator> integrator;
+    // The samples in [_waveStart_, _waveEnd_) are being taken in all pixels
+    std::atomic<int> waveStart{0}, waveEnd{1};
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_INTERACTIVE_H
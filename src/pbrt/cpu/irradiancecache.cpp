@@ -0,0 +1,215 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/irradiancecache.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace pbrt {
+
+STAT_COUNTER("Irradiance cache/Records", nIrradianceRecords);
+STAT_PERCENT("Irradiance cache/Interpolated lookups", nInterpolatedLookups,
+             nIrradianceLookups);
+
+// IrradianceCache Utility Functions
+static Bounds3f OctreeChildBounds(const Bounds3f &b, int child) {
+    Point3f pMid = b.pMin + b.Diagonal() / 2;
+    Bounds3f childBounds;
+    for (int axis = 0; axis < 3; ++axis) {
+        bool upper = child & (1 << axis);
+        childBounds.pMin[axis] = upper ? pMid[axis] : b.pMin[axis];
+        childBounds.pMax[axis] = upper ? b.pMax[axis] : pMid[axis];
+    }
+    return childBounds;
+}
+
+// IrradianceCache Method Definitions
+IrradianceCache::IrradianceCache(const Bounds3f &sceneBounds, Float maxError,
+                                 Float minSpacing, Float maxSpacing)
+    : maxError(maxError) {
+    // Make the octree's bounds a cube so that its nodes stay cubical
+    Float extent = std::max<Float>(0, MaxComponentValue(sceneBounds.Diagonal()));
+    bounds = Bounds3f(sceneBounds.pMin,
+                      sceneBounds.pMin + Vector3f(extent, extent, extent));
+    // Records are used within _maxError_ times their radius of their position
+    minRadius = minSpacing * extent / maxError;
+    maxRadius = maxSpacing * extent / maxError;
+}
+
+bool IrradianceCache::Interpolate(Point3f p, Normal3f n, RGB *E) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    ++nIrradianceLookups;
+    RGB sum;
+    Float sumWeights = 0;
+    const Node *node = &root;
+    Bounds3f nodeBounds = bounds;
+    while (node) {
+        for (const IrradianceRecord &record : node->records) {
+            // Skip records in front of _p_, which may see surfaces that _p_ doesn't
+            if (Dot(p - record.p, (n + record.n) / 2) < -0.05f * record.R)
+                continue;
+
+            // Compute the record's weight from the estimate of its error at _p_
+            Float error =
+                Distance(p, record.p) / record.R + SafeSqrt(1 - Dot(n, record.n));
+            if (error >= maxError)
+                continue;
+            Float weight = 1 / std::max<Float>(error, 1e-4f);
+
+            // Extrapolate the record's irradiance to _p_ using its gradients
+            RGB Ei = record.E;
+            Vector3f nCross = Cross(Vector3f(record.n), Vector3f(n));
+            for (int c = 0; c < 3; ++c)
+                Ei[c] += Dot(nCross, record.rotationalGradient[c]) +
+                         Dot(p - record.p, record.translationalGradient[c]);
+            sum += weight * ClampZero(Ei);
+            sumWeights += weight;
+        }
+
+        // Continue to the child node that contains _p_
+        Point3f pMid = nodeBounds.pMin + nodeBounds.Diagonal() / 2;
+        int child = (p.x >= pMid.x) | ((p.y >= pMid.y) << 1) | ((p.z >= pMid.z) << 2);
+        nodeBounds = OctreeChildBounds(nodeBounds, child);
+        node = node->children[child].get();
+    }
+
+    if (sumWeights == 0)
+        return false;
+    ++nInterpolatedLookups;
+    *E = sum / sumWeights;
+    return true;
+}
+
+void IrradianceCache::Add(const IrradianceRecord &record) {
+    // Bound the region where _record_ is used
+    Float radius = maxError * record.R;
+    Vector3f r(radius, radius, radius);
+    Bounds3f recordBounds(record.p - r, record.p + r);
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    ++nIrradianceRecords;
+    ++nRecords;
+    Add(&root, bounds, 0, record, recordBounds, radius);
+}
+
+void IrradianceCache::Add(Node *node, const Bounds3f &nodeBounds, int depth,
+                          const IrradianceRecord &record, const Bounds3f &recordBounds,
+                          Float radius) {
+    // Store the record in the smallest nodes that are at least as large as its
+    // region, of which it overlaps at most eight
+    Float childExtent = MaxComponentValue(nodeBounds.Diagonal()) / 2;
+    if (childExtent < 2 * radius || depth == MaxDepth) {
+        node->records.push_back(record);
+        return;
+    }
+    for (int child = 0; child < 8; ++child) {
+        Bounds3f childBounds = OctreeChildBounds(nodeBounds, child);
+        if (!Overlaps(childBounds, recordBounds))
+            continue;
+        if (!node->children[child])
+            node->children[child] = std::make_unique<Node>();
+        Add(node->children[child].get(), childBounds, depth + 1, record, recordBounds,
+            radius);
+    }
+}
+
+Vector3f IrradianceCache::GatherDirection(int j, int k, int M, int N, Point2f u) {
+    // Sample the stratum uniformly with respect to projected solid angle
+    Float sin2Theta = (j + u[0]) / M;
+    Float phi = 2 * Pi * (k + u[1]) / N;
+    return SphericalDirection(SafeSqrt(sin2Theta), SafeSqrt(1 - sin2Theta), phi);
+}
+
+IrradianceRecord IrradianceCache::MakeRecord(
+    Point3f p, Normal3f n, int M, int N,
+    pstd::span<const IrradianceGatherSample> samples) const {
+    CHECK_EQ(samples.size(), size_t(M * N));
+    auto sample = [&](int j, int k) -> const IrradianceGatherSample & {
+        return samples[j * N + k];
+    };
+    // Distances are clamped so that very close surfaces don't make the
+    // gradients blow up
+    auto distance = [&](int j, int k) {
+        return std::max(sample(j, k).distance, minRadius);
+    };
+
+    // Estimate irradiance and the harmonic mean distance to the gathered surfaces
+    IrradianceRecord record;
+    record.p = p;
+    record.n = n;
+    Float invDistanceSum = 0;
+    for (int j = 0; j < M; ++j)
+        for (int k = 0; k < N; ++k) {
+            record.E += sample(j, k).L;
+            invDistanceSum += 1 / distance(j, k);
+        }
+    record.E *= Pi / (M * N);
+    Float R = M * N / invDistanceSum;
+
+    // Compute irradiance gradients in the local frame using Ward and Heckbert's
+    // estimators
+    Vector3f rotational[3], translational[3];
+    for (int k = 0; k < N; ++k) {
+        int kPrev = (k + N - 1) % N;
+        Float phiCenter = 2 * Pi * (k + 0.5f) / N, phiEdge = 2 * Pi * k / N;
+        Vector3f uk(std::cos(phiCenter), std::sin(phiCenter), 0);
+        Vector3f vkEdge(-std::sin(phiEdge), std::cos(phiEdge), 0);
+        for (int j = 0; j < M; ++j) {
+            // Add sample's contribution to the rotational gradient
+            const IrradianceGatherSample &s = sample(j, k);
+            Vector3f w = s.wLocal;
+            Vector3f vTan = Vector3f(-w.y, w.x, 0) / std::max<Float>(w.z, 1e-3f);
+            for (int c = 0; c < 3; ++c)
+                rotational[c] -= s.L[c] * vTan;
+
+            // Add changes across the stratum's edges to the translational gradient
+            if (j > 0) {
+                Float sinTheta = std::sqrt(Float(j) / M), cos2Theta = 1 - Float(j) / M;
+                Float scale = 2 * Pi / N * sinTheta * cos2Theta /
+                              std::min(distance(j, k), distance(j - 1, k));
+                for (int c = 0; c < 3; ++c)
+                    translational[c] += scale * (s.L[c] - sample(j - 1, k).L[c]) * uk;
+            }
+            Float scale = (std::sqrt(Float(j + 1) / M) - std::sqrt(Float(j) / M)) /
+                          std::min(distance(j, k), distance(j, kPrev));
+            for (int c = 0; c < 3; ++c)
+                translational[c] += scale * (s.L[c] - sample(j, kPrev).L[c]) * vkEdge;
+        }
+    }
+
+    // Transform gradients to rendering space
+    Frame frame = Frame::FromZ(n);
+    for (int c = 0; c < 3; ++c) {
+        record.rotationalGradient[c] = frame.FromLocal(rotational[c] * Pi / (M * N));
+        record.translationalGradient[c] = frame.FromLocal(translational[c]);
+    }
+
+    // Limit the radius so that the translational gradient doesn't extrapolate
+    // irradiance below zero, then clamp it to the allowed spacing
+    Vector3f gradient = (translational[0] + translational[1] + translational[2]) / 3;
+    if (Length(gradient) > 0)
+        R = std::min(R, record.E.Average() / Length(gradient));
+    record.R = Clamp(R, minRadius, maxRadius);
+    return record;
+}
+
+int IrradianceCache::RecordCount() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return nRecords;
+}
+
+std::string IrradianceCache::ToString() const {
+    return StringPrintf("[ IrradianceCache bounds: %s maxError: %f minRadius: %f "
+                        "maxRadius: %f nRecords: %d ]",
+                        bounds, maxError, minRadius, maxRadius, RecordCount());
+}
+
+}  // namespace pbrt
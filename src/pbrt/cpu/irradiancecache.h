@@ -0,0 +1,92 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_IRRADIANCECACHE_H
+#define PBRT_CPU_IRRADIANCECACHE_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/color.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// IrradianceGatherSample Definition
+// Radiance arriving along one final gather direction, which is given in the local
+// frame of the gathering point's normal, and the distance to the surface it left.
+struct IrradianceGatherSample {
+    Vector3f wLocal;
+    RGB L;
+    Float distance = Infinity;
+};
+
+// IrradianceRecord Definition
+struct IrradianceRecord {
+    Point3f p;
+    Normal3f n;
+    RGB E;
+    // Harmonic mean distance to the surfaces seen from _p_
+    Float R;
+    // Rotational and translational gradients of each of the components of _E_
+    Vector3f rotationalGradient[3], translationalGradient[3];
+};
+
+// IrradianceCache Definition
+// Caches irradiance estimates from final gathering at sparse points and
+// interpolates them elsewhere, following "A Ray Tracing Solution for Diffuse
+// Interreflection" by Ward et al. and "Irradiance Gradients" by Ward and Heckbert.
+// Records are stored in an octree in all of the nodes at the level matching the
+// size of the region where they are used, so that lookups only need to visit the
+// nodes that contain the lookup point.
+class IrradianceCache {
+  public:
+    // IrradianceCache Public Methods
+    // _minSpacing_ and _maxSpacing_ bound the radius of the region where each
+    // record is used, relative to the extent of _bounds_.
+    IrradianceCache(const Bounds3f &bounds, Float maxError, Float minSpacing,
+                    Float maxSpacing);
+
+    bool Interpolate(Point3f p, Normal3f n, RGB *E) const;
+    void Add(const IrradianceRecord &record);
+
+    // Final gathering takes $M \times N$ samples, stratified in $\cos^2\theta$ by
+    // _j_ and in $\phi$ by _k_.
+    static Vector3f GatherDirection(int j, int k, int M, int N, Point2f u);
+    IrradianceRecord MakeRecord(Point3f p, Normal3f n, int M, int N,
+                                pstd::span<const IrradianceGatherSample> samples) const;
+
+    int RecordCount() const;
+
+    std::string ToString() const;
+
+  private:
+    // IrradianceCache Private Members
+    // Children are ordered with bits 0, 1, and 2 set for the upper halves in $x$,
+    // $y$, and $z$, respectively.
+    struct Node {
+        std::unique_ptr<Node> children[8];
+        std::vector<IrradianceRecord> records;
+    };
+    static constexpr int MaxDepth = 24;
+    Bounds3f bounds;
+    Float maxError, minRadius, maxRadius;
+    Node root;
+    int nRecords = 0;
+    mutable std::shared_mutex mutex;
+
+    // IrradianceCache Private Methods
+    void Add(Node *node, const Bounds3f &nodeBounds, int depth,
+             const IrradianceRecord &record, const Bounds3f &recordBounds,
+             Float radius);
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_IRRADIANCECACHE_H
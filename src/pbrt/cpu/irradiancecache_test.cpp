@@ -0,0 +1,84 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/irradiancecache.h>
+#include <pbrt/util/rng.h>
+
+#include <functional>
+#include <vector>
+
+using namespace pbrt;
+
+// Gathers radiance given by _Li_ with all surfaces at distance one.
+static std::vector<IrradianceGatherSample> Gather(int M, int N,
+                                                  std::function<RGB(Vector3f)> Li) {
+    RNG rng;
+    std::vector<IrradianceGatherSample> samples;
+    for (int j = 0; j < M; ++j)
+        for (int k = 0; k < N; ++k) {
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Vector3f w = IrradianceCache::GatherDirection(j, k, M, N, u);
+            samples.push_back({w, Li(w), 1.f});
+        }
+    return samples;
+}
+
+TEST(IrradianceCache, Interpolation) {
+    IrradianceCache cache(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)), 0.5f, 0.01f,
+                          0.25f);
+    Point3f p(0.5f, 0.5f, 0.5f);
+    Normal3f n(0, 0, 1);
+    RGB E;
+    EXPECT_FALSE(cache.Interpolate(p, n, &E));
+
+    // Uniform radiance gives irradiance of $\pi$ times it and no translational
+    // gradient
+    int M = 8, N = 24;
+    std::vector<IrradianceGatherSample> samples =
+        Gather(M, N, [](Vector3f w) { return RGB(1, 0.5f, 0.25f); });
+    IrradianceRecord record = cache.MakeRecord(p, n, M, N, samples);
+    EXPECT_NEAR(Pi, record.E.r, 1e-4f);
+    EXPECT_NEAR(Pi / 4, record.E.b, 1e-4f);
+    EXPECT_EQ(0, Length(record.translationalGradient[0]));
+    // The harmonic mean distance of one is clamped to the maximum radius
+    EXPECT_FLOAT_EQ(0.5f, record.R);
+
+    // The record is used close to its position and with similar normals
+    cache.Add(record);
+    EXPECT_EQ(1, cache.RecordCount());
+    ASSERT_TRUE(cache.Interpolate(p + Vector3f(0.1f, 0, 0), n, &E));
+    EXPECT_NEAR(Pi / 2, E.g, 1e-2f);
+    EXPECT_FALSE(cache.Interpolate(p + Vector3f(0.6f, 0, 0), n, &E));
+    EXPECT_FALSE(cache.Interpolate(p, Normal3f(1, 0, 0), &E));
+    EXPECT_FALSE(cache.Interpolate(p, -n, &E));
+}
+
+TEST(IrradianceCache, TranslationalGradient) {
+    IrradianceCache cache(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)), 0.5f, 0.01f,
+                          0.25f);
+    Point3f p(0.5f, 0.5f, 0.5f);
+    Normal3f n(0, 0, 1);
+
+    // Irradiance increases toward a bright half of the hemisphere
+    int M = 8, N = 24;
+    std::vector<IrradianceGatherSample> samples = Gather(M, N, [](Vector3f w) {
+        return w.x > 0 ? RGB(1, 1, 1) : RGB(0, 0, 0);
+    });
+    IrradianceRecord record = cache.MakeRecord(p, n, M, N, samples);
+    EXPECT_NEAR(Pi / 2, record.E.r, 0.1f);
+    Vector3f gradient = record.translationalGradient[0];
+    EXPECT_GT(gradient.x, 0);
+    EXPECT_NEAR(0, gradient.y, 1e-3f * gradient.x);
+    EXPECT_EQ(0, gradient.z);
+
+    cache.Add(record);
+    RGB E0, E1;
+    ASSERT_TRUE(cache.Interpolate(p - Vector3f(0.01f, 0, 0), n, &E0));
+    ASSERT_TRUE(cache.Interpolate(p + Vector3f(0.01f, 0, 0), n, &E1));
+    EXPECT_GT(E1.r, E0.r);
+}
@@ -5,6 +5,7 @@
 #include <pbrt/cpu/primitive.h>
 
 #include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/displacement.h>
 #include <pbrt/interaction.h>
 #include <pbrt/materials.h>
 #include <pbrt/shapes.h>
@@ -21,6 +22,15 @@ Bounds3f Primitive::Bounds() const {
     return DispatchCPU(bounds);
 }
 
+Bounds3f Primitive::ClippedBounds(const Bounds3f &clip) const {
+    if (Is<GeometricPrimitive>())
+        return Cast<GeometricPrimitive>()->ClippedBounds(clip);
+    else if (Is<SimplePrimitive>())
+        return Cast<SimplePrimitive>()->ClippedBounds(clip);
+    // Clip the bounds of primitives that don't directly hold a _Shape_
+    return pbrt::Intersect(Bounds(), clip);
+}
+
 pstd::optional<ShapeIntersection> Primitive::Intersect(const Ray &r, Float tMax) const {
     auto isect = [&](auto ptr) { return ptr->Intersect(r, tMax); };
     return DispatchCPU(isect);
@@ -47,6 +57,10 @@ Bounds3f GeometricPrimitive::Bounds() const {
     return shape.Bounds();
 }
 
+Bounds3f GeometricPrimitive::ClippedBounds(const Bounds3f &clip) const {
+    return shape.ClippedBounds(clip);
+}
+
 pstd::optional<ShapeIntersection> GeometricPrimitive::Intersect(const Ray &r,
                                                                 Float tMax) const {
     pstd::optional<ShapeIntersection> si = shape.Intersect(r, tMax);
@@ -93,6 +107,10 @@ Bounds3f SimplePrimitive::Bounds() const {
     return shape.Bounds();
 }
 
+Bounds3f SimplePrimitive::ClippedBounds(const Bounds3f &clip) const {
+    return shape.ClippedBounds(clip);
+}
+
 bool SimplePrimitive::IntersectP(const Ray &r, Float tMax) const {
     return shape.IntersectP(r, tMax);
 }
@@ -119,7 +137,7 @@ pstd::optional<ShapeIntersection> TransformedPrimitive::Intersect(const Ray &r,
     CHECK_LT(si->tHit, 1.001 * tMax);
 
     // Return transformed instance's intersection information
-    si->intr = (*renderFromPrimitive)(si->intr);
+    si->intr = renderFromPrimitive->ToTransform()(si->intr);
     CHECK_GE(Dot(si->intr.n, si->intr.shading.n), 0);
     return si;
 }
@@ -27,17 +27,22 @@ class GeometricPrimitive;
 class TransformedPrimitive;
 class AnimatedPrimitive;
 class BVHAggregate;
+class LazyBVHAggregate;
 class KdTreeAggregate;
+class DisplacedTrianglePrimitive;
 
 // Primitive Definition
 class Primitive
     : public TaggedPointer<SimplePrimitive, GeometricPrimitive, TransformedPrimitive,
-                           AnimatedPrimitive, BVHAggregate, KdTreeAggregate> {
+                           AnimatedPrimitive, BVHAggregate, LazyBVHAggregate,
+                           KdTreeAggregate, DisplacedTrianglePrimitive> {
   public:
     // Primitive Interface
     using TaggedPointer::TaggedPointer;
 
     Bounds3f Bounds() const;
+    // Returns bounds of the part of the primitive inside _clip_
+    Bounds3f ClippedBounds(const Bounds3f &clip) const;
 
     pstd::optional<ShapeIntersection> Intersect(const Ray &r,
                                                 Float tMax = Infinity) const;
@@ -52,9 +57,12 @@ class GeometricPrimitive {
                        const MediumInterface &mediumInterface,
                        FloatTexture alpha = nullptr);
     Bounds3f Bounds() const;
+    Bounds3f ClippedBounds(const Bounds3f &clip) const;
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
 
+    Shape GetShape() const { return shape; }
+
   private:
     // GeometricPrimitive Private Members
     Shape shape;
@@ -69,10 +77,13 @@ class SimplePrimitive {
   public:
     // SimplePrimitive Public Methods
     Bounds3f Bounds() const;
+    Bounds3f ClippedBounds(const Bounds3f &clip) const;
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
     SimplePrimitive(Shape shape, Material material);
 
+    Shape GetShape() const { return shape; }
+
   private:
     // SimplePrimitive Private Members
     Shape shape;
@@ -80,10 +91,13 @@ class SimplePrimitive {
 };
 
 // TransformedPrimitive Definition
+// Instances' transformations are stored in the compact _AffineTransform_ form,
+// which is usually shared through the scene's _TransformCache_.
 class TransformedPrimitive {
   public:
     // TransformedPrimitive Public Methods
-    TransformedPrimitive(Primitive primitive, const Transform *renderFromPrimitive)
+    TransformedPrimitive(Primitive primitive,
+                         const AffineTransform *renderFromPrimitive)
         : primitive(primitive), renderFromPrimitive(renderFromPrimitive) {
         primitiveMemory += sizeof(*this);
     }
@@ -93,10 +107,14 @@ class TransformedPrimitive {
 
     Bounds3f Bounds() const { return (*renderFromPrimitive)(primitive.Bounds()); }
 
+    // Enclosing aggregates must be refit after the transform or primitive changes
+    void SetRenderFromPrimitive(const AffineTransform *t) { renderFromPrimitive = t; }
+    void SetPrimitive(Primitive p) { primitive = p; }
+
   private:
     // TransformedPrimitive Private Members
     Primitive primitive;
-    const Transform *renderFromPrimitive;
+    const AffineTransform *renderFromPrimitive;
 };
 
 // AnimatedPrimitive Definition
@@ -111,6 +129,10 @@ class AnimatedPrimitive {
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
 
+    // Enclosing aggregates must be refit after the transform or primitive changes
+    void SetRenderFromPrimitive(const AnimatedTransform &t) { renderFromPrimitive = t; }
+    void SetPrimitive(Primitive p) { primitive = p; }
+
   private:
     // AnimatedPrimitive Private Members
     Primitive primitive;
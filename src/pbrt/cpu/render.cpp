@@ -6,25 +6,62 @@
 
 #include <pbrt/cameras.h>
 #include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/distributed.h>
 #include <pbrt/cpu/integrators.h>
+#include <pbrt/cpu/interactive.h>
+#include <pbrt/cpu/traversalbench.h>
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
 #include <pbrt/lights.h>
 #include <pbrt/materials.h>
 #include <pbrt/media.h>
+#include <pbrt/options.h>
 #include <pbrt/parsedscene.h>
 #include <pbrt/samplers.h>
 #include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/stats.h>
 
 namespace pbrt {
 
+static bool hasSubsurfaceScattering(Material m) {
+    if (MixMaterial *mix = m.CastOrNullptr<MixMaterial>(); mix)
+        return hasSubsurfaceScattering(mix->GetMaterial(0)) ||
+               hasSubsurfaceScattering(mix->GetMaterial(1));
+    return m && m.HasSubsurfaceScattering();
+}
+
 void RenderCPU(ParsedScene &parsedScene) {
-    Allocator alloc;
+    // Allocate each part of the scene from its subsystem's tracked memory
+    // resource so that --stats reports how much memory each one uses
+    Allocator alloc(SubsystemMemory(MemorySubsystem::Scene));
+    Allocator textureAlloc(SubsystemMemory(MemorySubsystem::Textures));
+    Allocator materialAlloc(SubsystemMemory(MemorySubsystem::Materials));
+    Allocator lightAlloc(SubsystemMemory(MemorySubsystem::Lights));
+    Allocator mediaAlloc(SubsystemMemory(MemorySubsystem::Media));
+    Allocator filmAlloc(SubsystemMemory(MemorySubsystem::Film));
+    Allocator geometryAlloc(SubsystemMemory(MemorySubsystem::Geometry));
+
+    // Start loading textures, which don't depend on anything else, while the
+    // media, camera, and sampler are created. The coordinator of a distributed
+    // render only needs the camera and film.
+    bool coordinating = Options->coordinatorPort.has_value();
+    std::shared_ptr<AsyncJob<NamedTextures>> texturesJob;
+    if (!coordinating)
+        texturesJob = RunAsync([&]() {
+            StatsPhase phase("CreateTextures");
+            LOG_VERBOSE("Starting textures");
+            NamedTextures textures = parsedScene.CreateTextures(textureAlloc, false);
+            LOG_VERBOSE("Finished textures");
+            return textures;
+        });
 
     // Create media first (so have them for the camera...)
-    std::map<std::string, Medium> media = parsedScene.CreateMedia(alloc);
+    std::map<std::string, Medium> media = parsedScene.CreateMedia(mediaAlloc);
 
     bool haveScatteringMedia = false;
     auto findMedium = [&media, &haveScatteringMedia](const std::string &s,
@@ -41,60 +78,116 @@ void RenderCPU(ParsedScene &parsedScene) {
 
     // Filter
     Filter filter = Filter::Create(parsedScene.filter.name, parsedScene.filter.parameters,
-                                   &parsedScene.filter.loc, alloc);
-
-    // Film
-    // It's a little ugly to poke into the camera's parameters here, but we
-    // have this circular dependency that Camera::Create() expects a
-    // Film, yet now the film needs to know the exposure time from
-    // the camera....
-    Float exposureTime = parsedScene.camera.parameters.GetOneFloat("shutterclose", 1.f) -
-                         parsedScene.camera.parameters.GetOneFloat("shutteropen", 0.f);
-    if (exposureTime <= 0)
-        ErrorExit(&parsedScene.camera.loc,
-                  "The specified camera shutter times imply that the shutter "
-                  "does not open.  A black image will result.");
-    Film film = Film::Create(parsedScene.film.name, parsedScene.film.parameters,
-                             exposureTime, filter, &parsedScene.film.loc, alloc);
-
-    // Camera
-    Medium cameraMedium = findMedium(parsedScene.camera.medium, &parsedScene.camera.loc);
-    Camera camera = Camera::Create(parsedScene.camera.name, parsedScene.camera.parameters,
-                                   cameraMedium, parsedScene.camera.cameraTransform, film,
-                                   &parsedScene.camera.loc, alloc);
-
-    // Create _Sampler_ for rendering
-    Point2i fullImageResolution = camera.GetFilm().FullResolution();
-    Sampler sampler =
-        Sampler::Create(parsedScene.sampler.name, parsedScene.sampler.parameters,
-                        fullImageResolution, &parsedScene.sampler.loc, alloc);
-
-    // Textures
-    LOG_VERBOSE("Starting textures");
-    NamedTextures textures = parsedScene.CreateTextures(alloc, false);
-    LOG_VERBOSE("Finished textures");
-
-    // Lights
+                                   &parsedScene.filter.loc, filmAlloc);
+
+    auto createCamera = [&](const CameraSceneEntity &cameraEntity,
+                            const SceneEntity &filmEntity) {
+        // Film
+        // It's a little ugly to poke into the camera's parameters here, but we
+        // have this circular dependency that Camera::Create() expects a
+        // Film, yet now the film needs to know the exposure time from
+        // the camera....
+        Float exposureTime = cameraEntity.parameters.GetOneFloat("shutterclose", 1.f) -
+                             cameraEntity.parameters.GetOneFloat("shutteropen", 0.f);
+        if (exposureTime <= 0)
+            ErrorExit(&cameraEntity.loc,
+                      "The specified camera shutter times imply that the shutter "
+                      "does not open.  A black image will result.");
+        Film film = Film::Create(filmEntity.name, filmEntity.parameters, exposureTime,
+                                 filter, &filmEntity.loc, filmAlloc);
+
+        // Camera
+        Medium cameraMedium = findMedium(cameraEntity.medium, &cameraEntity.loc);
+        return Camera::Create(cameraEntity.name, cameraEntity.parameters, cameraMedium,
+                              cameraEntity.cameraTransform, film, &cameraEntity.loc,
+                              filmAlloc);
+    };
+    // Samplers may depend on the resolution of the film they're sampling
+    auto createSampler = [&](Camera camera) {
+        Point2i fullImageResolution = camera.GetFilm().FullResolution();
+        return Sampler::Create(parsedScene.sampler.name, parsedScene.sampler.parameters,
+                               fullImageResolution, &parsedScene.sampler.loc, filmAlloc);
+    };
+
+    // Create the camera and _Sampler_ for rendering
+    Camera camera = createCamera(parsedScene.camera, parsedScene.film);
+    Sampler sampler = createSampler(camera);
+
+    // Create the cameras and samplers of any additional views, which are
+    // rendered one after another after the main one
+    std::vector<Camera> viewCameras;
+    std::vector<Sampler> viewSamplers;
+    std::set<std::string> filenames = {camera.GetFilm().GetFilename()};
+    for (const ViewSceneEntity &view : parsedScene.views) {
+        if (coordinating || !Options->coordinatorAddress.empty() ||
+            Options->interactivePort || !Options->sequenceFile.empty())
+            ErrorExit(&view.camera.loc,
+                      "Multiple views can't be rendered with --coordinator, --worker, "
+                      "--interactive, or --sequence.");
+        if (!Options->checkpointFile.empty() || !Options->pixelCostFile.empty() ||
+            !Options->mseReferenceImage.empty() || !Options->convergenceFile.empty())
+            ErrorExit(&view.camera.loc,
+                      "Multiple views can't be rendered with --checkpoint, "
+                      "--pixel-cost, --mse-reference-image, or --convergence-file.");
+        viewCameras.push_back(createCamera(view.camera, view.film));
+        viewSamplers.push_back(createSampler(viewCameras.back()));
+        std::string filename = viewCameras.back().GetFilm().GetFilename();
+        if (!filenames.insert(filename).second)
+            ErrorExit(&view.film.loc,
+                      "%s: another view's film is also written to this file.", filename);
+    }
+
+    if (coordinating) {
+        RunDistributedCoordinator(camera, sampler.SamplesPerPixel(),
+                                  *Options->coordinatorPort);
+        return;
+    }
+
+    // Create the lights and materials concurrently once the textures are ready
     std::map<int, pstd::vector<Light> *> shapeIndexToAreaLights;
-    std::vector<Light> lights =
-        parsedScene.CreateLights(alloc, media, textures, &shapeIndexToAreaLights);
+    auto lightsJob = texturesJob->Then([&](const NamedTextures &textures) {
+        StatsPhase phase("CreateLights");
+        return parsedScene.CreateLights(lightAlloc, media, textures,
+                                        &shapeIndexToAreaLights);
+    });
 
-    LOG_VERBOSE("Starting materials");
     std::map<std::string, pbrt::Material> namedMaterials;
     std::vector<pbrt::Material> materials;
-    parsedScene.CreateMaterials(textures, alloc, &namedMaterials, &materials);
-    LOG_VERBOSE("Finished materials");
-
-    Primitive accel = parsedScene.CreateAggregate(alloc, textures, shapeIndexToAreaLights,
-                                                  media, namedMaterials, materials);
+    auto materialsJob = texturesJob->Then([&](const NamedTextures &textures) {
+        StatsPhase phase("CreateMaterials");
+        LOG_VERBOSE("Starting materials");
+        parsedScene.CreateMaterials(textures, materialAlloc, &namedMaterials, &materials);
+        LOG_VERBOSE("Finished materials");
+    });
+
+    NamedTextures &textures = texturesJob->GetResult();
+    std::vector<Light> &lights = lightsJob->GetResult();
+    materialsJob->Wait();
+
+    // Trace the rays recorded in an earlier render, without rendering, if the
+    // traversal benchmark's ray file exists
+    bool benchTraversal = !Options->benchTraversalFile.empty();
+    if (benchTraversal && FileExists(Options->benchTraversalFile)) {
+        std::vector<Primitive> primitives =
+            parsedScene.CreatePrimitives(geometryAlloc, textures, shapeIndexToAreaLights,
+                                         media, namedMaterials, materials);
+        BenchmarkTraversal(primitives, Options->benchTraversalFile);
+        return;
+    }
 
-    // Integrator
-    const RGBColorSpace *integratorColorSpace = parsedScene.film.parameters.ColorSpace();
-    std::unique_ptr<Integrator> integrator(Integrator::Create(
-        parsedScene.integrator.name, parsedScene.integrator.parameters, camera, sampler,
-        accel, lights, integratorColorSpace, &parsedScene.integrator.loc));
+    // Object instances are kept in a separate top level of the BVH if they may
+    // be edited later
+    bool editable = Options->interactivePort || !Options->sequenceFile.empty();
+    SceneInstances sceneInstances;
+    Primitive accel;
+    {
+        StatsPhase phase("CreateAggregate");
+        accel = parsedScene.CreateAggregate(
+            geometryAlloc, textures, shapeIndexToAreaLights, media, namedMaterials,
+            materials, editable ? &sceneInstances : nullptr);
+    }
 
-    // Helpful warnings
+    // Find the scene features that the integrator needs to know about
     for (const auto &sh : parsedScene.shapes)
         if (!sh.insideMedium.empty() || !sh.outsideMedium.empty())
             haveScatteringMedia = true;
@@ -102,12 +195,35 @@ void RenderCPU(ParsedScene &parsedScene) {
         if (!sh.insideMedium.empty() || !sh.outsideMedium.empty())
             haveScatteringMedia = true;
 
+    bool haveSubsurface = false;
+    for (Material mtl : materials)
+        haveSubsurface |= hasSubsurfaceScattering(mtl);
+    for (const auto &namedMtl : namedMaterials)
+        haveSubsurface |= hasSubsurfaceScattering(namedMtl.second);
+
+    // Integrator
+    const RGBColorSpace *integratorColorSpace = parsedScene.film.parameters.ColorSpace();
+    std::unique_ptr<Integrator> integrator;
+    {
+        // This includes building the light sampler
+        StatsPhase phase("CreateIntegrator");
+        std::vector<Medium> allMedia;
+        for (const auto &m : media)
+            allMedia.push_back(m.second);
+        integrator = Integrator::Create(
+            parsedScene.integrator.name, parsedScene.integrator.parameters, camera,
+            sampler, accel, lights, allMedia, integratorColorSpace, haveScatteringMedia,
+            haveSubsurface, &parsedScene.integrator.loc);
+    }
+
+    // Helpful warnings
     if (haveScatteringMedia && parsedScene.integrator.name != "volpath" &&
         parsedScene.integrator.name != "simplevolpath" &&
-        parsedScene.integrator.name != "bdpt" && parsedScene.integrator.name != "mlt")
+        parsedScene.integrator.name != "bdpt" && parsedScene.integrator.name != "mlt" &&
+        parsedScene.integrator.name != "vcm")
         Warning("Scene has scattering media but \"%s\" integrator doesn't support "
                 "volume scattering. Consider using \"volpath\", \"simplevolpath\", "
-                "\"bdpt\", or \"mlt\".",
+                "\"bdpt\", \"vcm\", or \"mlt\".",
                 parsedScene.integrator.name);
 
     bool haveLights = !lights.empty();
@@ -125,13 +241,27 @@ void RenderCPU(ParsedScene &parsedScene) {
                 "other than R, G, B will be zero.",
                 parsedScene.integrator.name);
 
-    bool haveSubsurface = false;
-    for (const auto &mtl : parsedScene.materials)
-        if (mtl.name == "subsurface")
-            haveSubsurface = true;
-    for (const auto &namedMtl : parsedScene.namedMaterials)
-        if (namedMtl.second.name == "subsurface")
-            haveSubsurface = true;
+    // Streaming films only store one band of scanlines at a time, so all of a
+    // pixel's samples must come from rendering its image tile
+    const std::string &integratorName = parsedScene.integrator.name;
+    bool streaming = camera.GetFilm().StreamingBandHeight() > 0;
+    for (Camera viewCamera : viewCameras)
+        streaming |= viewCamera.GetFilm().StreamingBandHeight() > 0;
+    if (streaming &&
+        (integratorName == "lightpath" || integratorName == "bdpt" ||
+         integratorName == "mlt" || integratorName == "sppm" || integratorName == "vcm"))
+        ErrorExit(&parsedScene.film.loc,
+                  "Streaming films aren't supported by the \"%s\" integrator.",
+                  integratorName);
+    if (!Options->checkpointFile.empty() &&
+        (integratorName == "mlt" || integratorName == "sppm" || integratorName == "vcm"))
+        Warning("Ignoring --checkpoint, which isn't supported by the \"%s\" integrator.",
+                integratorName);
+
+    if (!viewCameras.empty() && !integrator->SetView(camera, sampler))
+        ErrorExit(&parsedScene.views[0].camera.loc,
+                  "Multiple views aren't supported by the \"%s\" integrator.",
+                  integratorName);
 
     if (haveSubsurface && parsedScene.integrator.name != "volpath")
         Warning("Some objects in the scene have subsurface scattering, which is "
@@ -139,6 +269,10 @@ void RenderCPU(ParsedScene &parsedScene) {
                 "to render them correctly.",
                 parsedScene.integrator.name);
 
+    // All of the scene's objects have been created from its parameters, though
+    // an interactive session may create some of them again
+    if (!editable)
+        FreeParsedParameters();
     LOG_VERBOSE("Memory used after scene creation: %d", GetCurrentRSS());
 
     if (Options->pixelMaterial) {
@@ -179,7 +313,34 @@ void RenderCPU(ParsedScene &parsedScene) {
     }
 
     // Render!
-    integrator->Render();
+    if (benchTraversal)
+        RayRecordingStart(Options->benchTraversalRays);
+    {
+        StatsPhase phase("Render");
+        if (editable) {
+            InteractiveSession session(parsedScene, camera, sampler, accel,
+                                       &sceneInstances, lights, media, textures,
+                                       namedMaterials, haveScatteringMedia,
+                                       haveSubsurface, std::move(integrator), alloc);
+            if (Options->interactivePort)
+                session.Run(*Options->interactivePort);
+            else
+                session.RunSequence(Options->sequenceFile);
+        } else if (!Options->coordinatorAddress.empty())
+            RunDistributedWorker(integrator.get(), camera, sampler.SamplesPerPixel(),
+                                 Options->coordinatorAddress);
+        else {
+            integrator->Render();
+            // Render the additional views with the same integrator so that they
+            // share its aggregate, lights, and light sampler
+            for (size_t i = 0; i < viewCameras.size(); ++i) {
+                integrator->SetView(viewCameras[i], viewSamplers[i]);
+                integrator->Render();
+            }
+        }
+    }
+    if (benchTraversal)
+        RayRecordingWrite(Options->benchTraversalFile);
 
     LOG_VERBOSE("Memory used after rendering: %s", GetCurrentRSS());
 
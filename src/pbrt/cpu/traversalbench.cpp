@@ -0,0 +1,190 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/traversalbench.h>
+
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/paramdict.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+namespace pbrt {
+
+// RecordedRay Definition
+// Rays are stored in single precision regardless of _Float_ so that files can
+// be shared between builds.
+struct RecordedRay {
+    float o[3], d[3];
+    float time, tMax;
+    uint8_t type, anyHit;
+    uint8_t pad[2];
+};
+static_assert(sizeof(RecordedRay) == 36, "Unexpected RecordedRay size");
+
+// The file starts with this identifier followed by the number of rays
+static const char rayFileIdentifier[8] = {'p', 'b', 'r', 't', 'r', 'a', 'y', '1'};
+
+bool rayRecordingEnabled = false;
+
+// Each thread records rays in its own buffer, up to _maxThreadRays_ of them
+static std::mutex recordedRaysMutex;
+static std::vector<std::vector<RecordedRay> *> recordedRays;
+static thread_local std::vector<RecordedRay> *threadRecordedRays;
+static size_t maxThreadRays;
+
+// Ray Recording Function Definitions
+void RayRecordingStart(int64_t maxRays) {
+    maxThreadRays = std::max<int64_t>(1, maxRays / RunningThreads());
+    rayRecordingEnabled = true;
+}
+
+void RecordTracedRay(const Ray &ray, Float tMax, RayType type, bool anyHit) {
+    if (!threadRecordedRays) {
+        threadRecordedRays = new std::vector<RecordedRay>;
+        std::lock_guard<std::mutex> lock(recordedRaysMutex);
+        recordedRays.push_back(threadRecordedRays);
+    }
+    if (threadRecordedRays->size() == maxThreadRays)
+        return;
+
+    RecordedRay r;
+    for (int c = 0; c < 3; ++c) {
+        r.o[c] = ray.o[c];
+        r.d[c] = ray.d[c];
+    }
+    r.time = ray.time;
+    r.tMax = tMax;
+    r.type = uint8_t(type);
+    r.anyHit = anyHit;
+    r.pad[0] = r.pad[1] = 0;
+    threadRecordedRays->push_back(r);
+}
+
+void RayRecordingWrite(const std::string &filename) {
+    rayRecordingEnabled = false;
+    std::lock_guard<std::mutex> lock(recordedRaysMutex);
+    uint64_t nRays = 0;
+    bool full = false;
+    for (const std::vector<RecordedRay> *rays : recordedRays) {
+        nRays += rays->size();
+        full |= rays->size() == maxThreadRays;
+    }
+    if (full)
+        Warning("%s: ray limit reached; only the first %d rays traced by each "
+                "thread were recorded.",
+                filename, maxThreadRays);
+
+    FILE *f = FOpenWrite(filename);
+    if (!f)
+        ErrorExit("%s: %s", filename, ErrorString());
+    bool ok = fwrite(rayFileIdentifier, sizeof(rayFileIdentifier), 1, f) == 1 &&
+              fwrite(&nRays, sizeof(nRays), 1, f) == 1;
+    for (const std::vector<RecordedRay> *rays : recordedRays)
+        if (!rays->empty())
+            ok &= fwrite(rays->data(), sizeof(RecordedRay), rays->size(), f) ==
+                  rays->size();
+    if (fclose(f) != 0 || !ok)
+        ErrorExit("%s: error writing rays: %s", filename, ErrorString());
+    Printf("Wrote %d rays to \"%s\".\n", nRays, filename);
+
+    for (std::vector<RecordedRay> *rays : recordedRays)
+        rays->clear();
+}
+
+static std::vector<RecordedRay> ReadRecordedRays(const std::string &filename) {
+    FILE *f = FOpenRead(filename);
+    if (!f)
+        ErrorExit("%s: %s", filename, ErrorString());
+    char identifier[sizeof(rayFileIdentifier)];
+    uint64_t nRays;
+    if (fread(identifier, sizeof(identifier), 1, f) != 1 ||
+        memcmp(identifier, rayFileIdentifier, sizeof(identifier)) != 0 ||
+        fread(&nRays, sizeof(nRays), 1, f) != 1)
+        ErrorExit("%s: not a pbrt ray file.", filename);
+    std::vector<RecordedRay> rays(nRays);
+    if (fread(rays.data(), sizeof(RecordedRay), nRays, f) != nRays)
+        ErrorExit("%s: premature end of file.", filename);
+    fclose(f);
+    return rays;
+}
+
+// Traces _rays_ against _aggregate_ using all threads, returning the number of
+// rays that hit something and setting _seconds_ to the shortest time taken in
+// several runs.
+static int64_t TraceRecordedRays(Primitive aggregate, const std::vector<Ray> &rays,
+                                 const std::vector<Float> &tMax, bool anyHit,
+                                 double *seconds) {
+    constexpr int nRuns = 3;
+    std::atomic<int64_t> nHits{0};
+    *seconds = Infinity;
+    for (int run = 0; run < nRuns; ++run) {
+        nHits = 0;
+        Timer timer;
+        ParallelFor(0, rays.size(), [&](int64_t start, int64_t end) {
+            int64_t nChunkHits = 0;
+            for (int64_t i = start; i < end; ++i)
+                nChunkHits += anyHit ? aggregate.IntersectP(rays[i], tMax[i])
+                                     : aggregate.Intersect(rays[i], tMax[i]).has_value();
+            nHits += nChunkHits;
+        });
+        *seconds = std::min(*seconds, timer.ElapsedSeconds());
+    }
+    return nHits;
+}
+
+void BenchmarkTraversal(const std::vector<Primitive> &primitives,
+                        const std::string &filename) {
+    std::vector<RecordedRay> recorded = ReadRecordedRays(filename);
+
+    // Separate rays that need the closest intersection from those that only
+    // need to know whether there is one
+    std::vector<Ray> rays[2];
+    std::vector<Float> tMax[2];
+    for (const RecordedRay &r : recorded) {
+        Ray ray(Point3f(r.o[0], r.o[1], r.o[2]), Vector3f(r.d[0], r.d[1], r.d[2]),
+                r.time);
+        rays[r.anyHit].push_back(ray);
+        tMax[r.anyHit].push_back(r.tMax);
+    }
+    Printf("Traversal benchmark: %d rays from \"%s\", %d closest-hit and %d any-hit\n",
+           recorded.size(), filename, rays[0].size(), rays[1].size());
+    Printf("  %-10s %10s %20s %10s %20s %10s\n", "", "Build (s)", "Closest hit Mrays/s",
+           "Hit rate", "Any hit Mrays/s", "Hit rate");
+
+    for (const char *name : {"bvh", "kdtree"}) {
+        Timer buildTimer;
+        Primitive aggregate =
+            CreateAccelerator(name, primitives, ParameterDictionary());
+        double buildSeconds = buildTimer.ElapsedSeconds();
+
+        std::string results[2][2];
+        for (int anyHit = 0; anyHit < 2; ++anyHit) {
+            if (rays[anyHit].empty()) {
+                results[anyHit][0] = results[anyHit][1] = "-";
+                continue;
+            }
+            double seconds;
+            int64_t nHits = TraceRecordedRays(aggregate, rays[anyHit], tMax[anyHit],
+                                              anyHit, &seconds);
+            results[anyHit][0] =
+                StringPrintf("%.2f", rays[anyHit].size() / seconds / 1e6);
+            results[anyHit][1] =
+                StringPrintf("%.2f%%", 100. * nHits / rays[anyHit].size());
+        }
+        Printf("  %-10s %10.2f %20s %10s %20s %10s\n", name, buildSeconds,
+               results[0][0], results[0][1], results[1][0], results[1][1]);
+    }
+}
+
+}  // namespace pbrt
@@ -0,0 +1,46 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_TRAVERSALBENCH_H
+#define PBRT_CPU_TRAVERSALBENCH_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/ray.h>
+#include <pbrt/util/stats.h>
+
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// The rays that the CPU integrators trace during a render can be recorded and
+// written to a file; BenchmarkTraversal() later traces them against
+// accelerators built over the scene's primitives, which measures the cost of
+// finding intersections separately from that of shading them.
+
+// Ray Recording Declarations
+extern bool rayRecordingEnabled;
+
+// Starts recording rays; at most _maxRays_ are recorded.
+void RayRecordingStart(int64_t maxRays);
+// Writes the recorded rays to _filename_ and stops recording.
+void RayRecordingWrite(const std::string &filename);
+void RecordTracedRay(const Ray &ray, Float tMax, RayType type, bool anyHit);
+
+inline void RecordRay(const Ray &ray, Float tMax, RayType type, bool anyHit) {
+    if (rayRecordingEnabled)
+        RecordTracedRay(ray, tMax, type, anyHit);
+}
+
+// Reads the rays in _filename_ and traces them against BVH and kd-tree
+// accelerators built over _primitives_, printing the number of rays traced
+// per second with each.
+void BenchmarkTraversal(const std::vector<Primitive> &primitives,
+                        const std::string &filename);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_TRAVERSALBENCH_H
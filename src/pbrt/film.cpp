@@ -24,10 +24,19 @@
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 
+#include <cstring>
+#include <type_traits>
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <pbrt/gpu/denoiser.h>
+#include <pbrt/gpu/memory.h>
+#endif
+
 namespace pbrt {
 
 void Film::AddSplat(const Point2f &p, SampledSpectrum v,
@@ -36,6 +45,30 @@ void Film::AddSplat(const Point2f &p, SampledSpectrum v,
     return Dispatch(splat);
 }
 
+void Film::StartTile(Bounds2i tileBounds) {
+    auto start = [&](auto ptr) { return ptr->StartTile(tileBounds); };
+    return DispatchCPU(start);
+}
+
+void Film::MergeTile() {
+    auto merge = [&](auto ptr) { return ptr->MergeTile(); };
+    return DispatchCPU(merge);
+}
+
+int Film::StreamingBandHeight() const {
+    return Is<RGBFilm>() ? Cast<RGBFilm>()->StreamingBandHeight() : 0;
+}
+
+void Film::StartBand(Bounds2i bandBounds) {
+    CHECK(Is<RGBFilm>());
+    Cast<RGBFilm>()->StartBand(bandBounds);
+}
+
+void Film::EndBand(ImageMetadata metadata, Float splatScale) {
+    CHECK(Is<RGBFilm>());
+    Cast<RGBFilm>()->EndBand(metadata, splatScale);
+}
+
 void Film::WriteImage(ImageMetadata metadata, Float splatScale) {
     auto write = [&](auto ptr) { return ptr->WriteImage(metadata, splatScale); };
     return DispatchCPU(write);
@@ -466,19 +499,86 @@ Spectrum PixelSensor::swatchReflectances[nSwatchReflectances]{
         false, Allocator())};
 
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
+STAT_MEMORY_COUNTER("Memory/Film splat buffers", splatBufferBytes);
+STAT_PERCENT("Film/Buffered splats", nBufferedSplats, nSplats);
+STAT_COUNTER("Film/Splat compare-and-swap retries", nSplatCASRetries);
+
+// SplatBuffer Method Definitions
+SplatBuffer::SplatBuffer(Bounds2i pixelBounds) : pixelBounds(pixelBounds) {
+    nTiles = Point2i((pixelBounds.pMax.x - pixelBounds.pMin.x + TileSize - 1) / TileSize,
+                     (pixelBounds.pMax.y - pixelBounds.pMin.y + TileSize - 1) / TileSize);
+}
+
+void SplatBuffer::Add(Point2i p, RGB rgb, AtomicDouble pixelSplatRGB[3]) {
+    if (double *tileRGB = BufferedRGB(p))
+        for (int c = 0; c < 3; ++c)
+            tileRGB[c] += rgb[c];
+    else
+        for (int c = 0; c < 3; ++c)
+            nSplatCASRetries += pixelSplatRGB[c].Add(rgb[c]);
+}
+
+void SplatBuffer::Add(Point2i p, RGB rgb, AtomicFloat pixelSplatRGB[3]) {
+    if (double *tileRGB = BufferedRGB(p))
+        for (int c = 0; c < 3; ++c)
+            tileRGB[c] += rgb[c];
+    else
+        for (int c = 0; c < 3; ++c)
+            pixelSplatRGB[c].Add(rgb[c]);
+}
+
+double *SplatBuffer::BufferedRGB(Point2i p) {
+    ++nSplats;
+    // Allow the threads' buffers to use up to four times the memory of the
+    // film's splat values
+    std::call_once(threadBuffersFlag, [&]() {
+        threadBuffers.resize(MaxThreadIndex());
+        maxTilesPerThread =
+            std::max<int>(1, int64_t(4) * nTiles.x * nTiles.y / threadBuffers.size());
+    });
+
+    // Find the thread's tile for _p_, allocating it if possible
+    CHECK_LT(ThreadIndex, threadBuffers.size());
+    ThreadBuffer &buffer = threadBuffers[ThreadIndex];
+    if (buffer.tiles.empty())
+        buffer.tiles.resize(nTiles.x * nTiles.y);
+    int tile = (p.y - pixelBounds.pMin.y) / TileSize * nTiles.x +
+               (p.x - pixelBounds.pMin.x) / TileSize;
+    if (!buffer.tiles[tile] && buffer.nAllocated < maxTilesPerThread) {
+        buffer.tiles[tile] = std::make_unique<double[]>(3 * TileSize * TileSize);
+        ++buffer.nAllocated;
+        splatBufferBytes += 3 * TileSize * TileSize * sizeof(double);
+    }
+
+    if (!buffer.tiles[tile])
+        return nullptr;
+    ++nBufferedSplats;
+    return buffer.tiles[tile].get() + TexelOffset(p);
+}
+
 
 // RGBFilm Method Definitions
 RGBFilm::RGBFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
-                 Float maxComponentValue, bool writeFP16, Allocator alloc)
+                 Float maxComponentValue, bool writeFP16, int bandHeight,
+                 Allocator alloc)
     : FilmBase(p),
-      pixels(p.pixelBounds, alloc),
+      pixels(bandHeight > 0 ? Bounds2i({0, 0}, {0, 0}) : p.pixelBounds, alloc),
       colorSpace(colorSpace),
       maxComponentValue(maxComponentValue),
-      writeFP16(writeFP16) {
+      writeFP16(writeFP16),
+      bandHeight(bandHeight),
+      splatBuffer(p.pixelBounds) {
     filterIntegral = filter.Integral();
     CHECK(!pixelBounds.IsEmpty());
     CHECK(colorSpace != nullptr);
-    filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
+    CHECK_GE(bandHeight, 0);
+    if (bandHeight > 0)
+        filmPixelMemory += int64_t(bandHeight) * pixelBounds.Diagonal().x * sizeof(Pixel);
+    else
+        filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
+    // Spread the pixels across NUMA nodes; all threads write to them
+    if (Options && Options->numa)
+        InterleaveAcrossNUMANodes(pixels.begin(), pixels.size() * sizeof(Pixel));
     // Compute _outputRGBFromSensorRGB_ matrix
     outputRGBFromSensorRGB = colorSpace->RGBFromXYZ * sensor->XYZFromSensorRGB;
 }
@@ -506,27 +606,63 @@ void RGBFilm::AddSplat(const Point2f &p, SampledSpectrum L,
         // Evaluate filter at _pi_ and add splat contribution
         Float wt = filter.Evaluate(Point2f(p - pi - Vector2f(0.5, 0.5)));
         if (wt != 0) {
-            Pixel &pixel = pixels[pi];
+#ifdef PBRT_IS_GPU_CODE
             for (int i = 0; i < 3; ++i)
-                pixel.splatRGB[i].Add(wt * rgb[i]);
+                pixels[pi].splatRGB[i].Add(wt * rgb[i]);
+#else
+            splatBuffer.Add(pi, wt * rgb, pixels[pi].splatRGB);
+#endif
         }
     }
 }
 
+thread_local FilmTile<RGBFilm::TilePixel> RGBFilm::threadTile;
+
+void RGBFilm::StartTile(Bounds2i tileBounds) {
+    threadTile.Start(this, Intersect(tileBounds, pixelBounds));
+}
+
+void RGBFilm::MergeTile() {
+    threadTile.Merge(this, [&](Point2i p, const TilePixel &tilePixel) {
+        Pixel &pixel = pixels[p];
+        for (int c = 0; c < 3; ++c)
+            pixel.rgbSum[c] += PixelSumValue(tilePixel.rgbSum[c]);
+        pixel.weightSum += PixelSumValue(tilePixel.weightSum);
+        pixel.varianceEstimator.Merge(tilePixel.varianceEstimator);
+    });
+}
+
 void RGBFilm::WriteImage(ImageMetadata metadata, Float splatScale) {
     Image image = GetImage(&metadata, splatScale);
     LOG_VERBOSE("Writing image %s with bounds %s", filename, pixelBounds);
-    image.Write(filename, metadata);
+    WriteImageAsync(std::move(image), filename, metadata);
 }
 
 Image RGBFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
-    // Convert image to RGB and compute final pixel values
+    CHECK_EQ(bandHeight, 0);
+    // Add buffered splats to the film's pixels
+    splatBuffer.Flush([&](Point2i p, const double *rgb) {
+        for (int c = 0; c < 3; ++c)
+            pixels[p].splatRGB[c].Add(rgb[c]);
+    });
+
     LOG_VERBOSE("Converting image to RGB and computing final weighted pixel values");
+    Image image = getImage(pixelBounds, splatScale);
+
+    metadata->pixelBounds = pixelBounds;
+    metadata->fullResolution = fullResolution;
+    metadata->colorSpace = colorSpace;
+
+    return image;
+}
+
+Image RGBFilm::getImage(Bounds2i bounds, Float splatScale) {
+    // Convert image to RGB and compute final pixel values
     PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
-    Image image(format, Point2i(pixelBounds.Diagonal()), {"R", "G", "B"});
+    Image image(format, Point2i(bounds.Diagonal()), {"R", "G", "B"});
 
     std::atomic<int> nClamped{0};
-    ParallelFor2D(pixelBounds, [&](Point2i p) {
+    ParallelFor2D(bounds, [&](Point2i p) {
         RGB rgb = GetPixelRGB(p, splatScale);
 
         if (writeFP16 && std::max({rgb.r, rgb.g, rgb.b}) > 65504) {
@@ -539,24 +675,172 @@ Image RGBFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
             ++nClamped;
         }
 
-        Point2i pOffset(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
+        Point2i pOffset(p.x - bounds.pMin.x, p.y - bounds.pMin.y);
         image.SetChannels(pOffset, {rgb[0], rgb[1], rgb[2]});
     });
 
     if (nClamped.load() > 0)
         Warning("%d pixel values clamped to maximum fp16 value.", nClamped.load());
 
-    metadata->pixelBounds = pixelBounds;
-    metadata->fullResolution = fullResolution;
-    metadata->colorSpace = colorSpace;
-
     return image;
 }
 
+void RGBFilm::StartBand(Bounds2i bounds) {
+    CHECK_GT(bandHeight, 0);
+    CHECK_EQ(pixels.size(), 0);
+    bandBounds = Intersect(bounds, pixelBounds);
+    // _Pixel_'s atomics can't be copied as Array2D's move assignment may
+    // require, so the band's pixels are constructed in place.
+    pixels.~Array2D<Pixel>();
+    new (&pixels) Array2D<Pixel>(bandBounds);
+}
+
+void RGBFilm::EndBand(ImageMetadata metadata, Float splatScale) {
+    CHECK_GT(bandHeight, 0);
+    Image image = getImage(bandBounds, splatScale);
+
+    // Create the image file when the first band is done
+    if (!bandWriter) {
+        // The file's header is written before any of its pixels, so it can't
+        // record the render time or the MSE.
+        metadata.renderTimeSeconds.reset();
+        metadata.MSE.reset();
+        metadata.pixelBounds = pixelBounds;
+        metadata.fullResolution = fullResolution;
+        metadata.colorSpace = colorSpace;
+        bandWriter = std::make_unique<EXRScanlineWriter>(filename, image.ChannelNames(),
+                                                         image.Format(), metadata);
+    }
+    LOG_VERBOSE("Writing scanlines [%d, %d) to %s", bandBounds.pMin.y, bandBounds.pMax.y,
+                filename);
+    bandWriter->WriteScanlines(image);
+    if (bandWriter->IsComplete())
+        bandWriter.reset();
+
+    // Free the band's pixels
+    pixels.~Array2D<Pixel>();
+    new (&pixels) Array2D<Pixel>();
+}
+
+// RGBFilm Checkpoint Definitions
+struct RGBFilmCheckpointHeader {
+    char magic[8] = {'p', 'b', 'r', 't', 'c', 'k', 'p', 't'};
+    int32_t version = 1;
+    // Guard against reading checkpoints written with different _Float_ or
+    // pixel sum types
+    int32_t tilePixelBytes, compensatedSums;
+    int32_t pixelBounds[4];
+    int32_t samplesPerPixel;
+};
+
+void RGBFilm::WriteCheckpoint(const std::string &filename, int samplesPerPixel) {
+    CHECK_EQ(bandHeight, 0);
+    // Add buffered splats to the film's pixels
+    splatBuffer.Flush([&](Point2i p, const double *rgb) {
+        for (int c = 0; c < 3; ++c)
+            pixels[p].splatRGB[c].Add(rgb[c]);
+    });
+
+    // Copy the header and pixels into the checkpoint's contents
+    RGBFilmCheckpointHeader header;
+    header.tilePixelBytes = sizeof(TilePixel);
+    header.compensatedSums = !std::is_same_v<PixelSum, double>;
+    header.pixelBounds[0] = pixelBounds.pMin.x;
+    header.pixelBounds[1] = pixelBounds.pMin.y;
+    header.pixelBounds[2] = pixelBounds.pMax.x;
+    header.pixelBounds[3] = pixelBounds.pMax.y;
+    header.samplesPerPixel = samplesPerPixel;
+    std::string contents(sizeof(header) + pixelBounds.Area() * PixelValueBytes(),
+                         '\0');
+    std::memcpy(&contents[0], &header, sizeof(header));
+    CopyPixelValuesOut(pixelBounds, &contents[sizeof(header)]);
+
+    LOG_VERBOSE("Writing checkpoint %s with spp = %d", filename, samplesPerPixel);
+    WriteFileContentsAsync(filename, std::move(contents));
+}
+
+int RGBFilm::ReadCheckpoint(const std::string &filename) {
+    CHECK_EQ(bandHeight, 0);
+    if (!FileExists(filename))
+        return 0;
+    std::string contents = ReadFileContents(filename);
+
+    // Check that the checkpoint is for this film
+    RGBFilmCheckpointHeader header, expected;
+    if (contents.size() < sizeof(header))
+        ErrorExit("%s: checkpoint file is truncated.", filename);
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.version != expected.version ||
+        header.tilePixelBytes != sizeof(TilePixel) ||
+        header.compensatedSums != !std::is_same_v<PixelSum, double>)
+        ErrorExit("%s: not a checkpoint file written by this build of pbrt.", filename);
+    Bounds2i checkpointBounds(Point2i(header.pixelBounds[0], header.pixelBounds[1]),
+                              Point2i(header.pixelBounds[2], header.pixelBounds[3]));
+    if (checkpointBounds != pixelBounds)
+        ErrorExit("%s: checkpoint's pixel bounds %s don't match the film's %s.",
+                  filename, checkpointBounds, pixelBounds);
+    if (contents.size() != sizeof(header) + pixelBounds.Area() * PixelValueBytes())
+        ErrorExit("%s: checkpoint file is truncated.", filename);
+
+    // Restore the film's pixels
+    CopyPixelValuesIn(pixelBounds, &contents[sizeof(header)]);
+
+    LOG_VERBOSE("Read checkpoint %s with spp = %d", filename, header.samplesPerPixel);
+    return header.samplesPerPixel;
+}
+
+void RGBFilm::CopyPixelValuesOut(Bounds2i bounds, char *values) const {
+    CHECK_EQ(bandHeight, 0);
+    ParallelFor(bounds.pMin.y, bounds.pMax.y, [&](int64_t y) {
+        char *ptr =
+            values + (y - bounds.pMin.y) * bounds.Diagonal().x * PixelValueBytes();
+        for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x) {
+            const Pixel &pixel = pixels[{x, int(y)}];
+            std::memcpy(ptr, (const TilePixel *)&pixel, sizeof(TilePixel));
+            double splatRGB[3] = {pixel.splatRGB[0], pixel.splatRGB[1],
+                                  pixel.splatRGB[2]};
+            std::memcpy(ptr + sizeof(TilePixel), splatRGB, sizeof(splatRGB));
+            ptr += PixelValueBytes();
+        }
+    });
+}
+
+void RGBFilm::CopyPixelValuesIn(Bounds2i bounds, const char *values) {
+    CHECK_EQ(bandHeight, 0);
+    ParallelFor(bounds.pMin.y, bounds.pMax.y, [&](int64_t y) {
+        const char *ptr =
+            values + (y - bounds.pMin.y) * bounds.Diagonal().x * PixelValueBytes();
+        for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x) {
+            Pixel &pixel = pixels[{x, int(y)}];
+            std::memcpy((TilePixel *)&pixel, ptr, sizeof(TilePixel));
+            double splatRGB[3];
+            std::memcpy(splatRGB, ptr + sizeof(TilePixel), sizeof(splatRGB));
+            for (int c = 0; c < 3; ++c)
+                pixel.splatRGB[c] = splatRGB[c];
+            ptr += PixelValueBytes();
+        }
+    });
+}
+
+void RGBFilm::Clear() {
+    CHECK_EQ(bandHeight, 0);
+    splatBuffer.Flush([](Point2i p, const double *rgb) {});
+    ParallelFor(pixelBounds.pMin.y, pixelBounds.pMax.y, [&](int64_t y) {
+        for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; ++x) {
+            Pixel &pixel = pixels[{x, int(y)}];
+            (TilePixel &)pixel = TilePixel();
+            for (int c = 0; c < 3; ++c)
+                pixel.splatRGB[c] = 0;
+        }
+    });
+}
+
 std::string RGBFilm::ToString() const {
-    return StringPrintf(
-        "[ RGBFilm %s colorSpace: %s maxComponentValue: %f writeFP16: %s ]",
-        BaseToString(), *colorSpace, maxComponentValue, writeFP16);
+    return StringPrintf("[ RGBFilm %s colorSpace: %s maxComponentValue: %f writeFP16: %s "
+                        "bandHeight: %d ]",
+                        BaseToString(), *colorSpace, maxComponentValue, writeFP16,
+                        bandHeight);
 }
 
 RGBFilm *RGBFilm::Create(const ParameterDictionary &parameters, Float exposureTime,
@@ -569,8 +853,22 @@ RGBFilm *RGBFilm::Create(const ParameterDictionary &parameters, Float exposureTi
         PixelSensor::Create(parameters, colorSpace, exposureTime, loc, alloc);
     FilmBaseParameters filmBaseParameters(parameters, filter, sensor, loc);
 
+    // Streaming films store bands of _bandHeight_ scanlines at a time
+    int bandHeight = 0;
+    if (parameters.GetOneBool("streaming", false)) {
+        bandHeight = parameters.GetOneInt("bandheight", 64);
+        if (bandHeight <= 0)
+            ErrorExit(loc, "%d: \"bandheight\" must be positive.", bandHeight);
+        if (!HasExtension(filmBaseParameters.filename, "exr"))
+            ErrorExit(loc, "%s: streaming films can only write EXR images.",
+                      filmBaseParameters.filename);
+        if (Options->useGPU || Options->wavefront)
+            ErrorExit(loc, "Streaming films aren't supported by the wavefront "
+                           "integrator.");
+    }
+
     return alloc.new_object<RGBFilm>(filmBaseParameters, colorSpace, maxComponentValue,
-                                     writeFP16, alloc);
+                                     writeFP16, bandHeight, alloc);
 }
 
 // GBufferFilm Method Definitions
@@ -582,45 +880,149 @@ void GBufferFilm::AddSample(const Point2i &pFilm, SampledSpectrum L,
     if (m > maxComponentValue)
         rgb *= maxComponentValue / m;
 
-    Pixel &p = pixels[pFilm];
-    if (visibleSurface && *visibleSurface) {
-        // Update variance estimates.
-        for (int c = 0; c < 3; ++c)
-            p.varianceEstimator[c].Add(rgb[c]);
-
-        p.pSum += weight * visibleSurface->p;
-
-        p.nSum += weight * visibleSurface->n;
-        p.nsSum += weight * visibleSurface->ns;
-
-        p.dzdxSum += weight * visibleSurface->dzdx;
-        p.dzdySum += weight * visibleSurface->dzdy;
-
+    // Compute the visible surface's albedo if it is stored
+    bool haveSurface = visibleSurface && *visibleSurface;
+    RGB albedoRGB;
+    if (haveSurface && albedoSums.size() > 0) {
         SampledSpectrum albedo =
             visibleSurface->albedo * colorSpace->illuminant.Sample(lambda);
-        RGB albedoRGB = albedo.ToRGB(lambda, *colorSpace);
+        albedoRGB = albedo.ToRGB(lambda, *colorSpace);
+    }
+
+#ifndef PBRT_IS_GPU_CODE
+    if (TilePixel *tilePixel = threadTile.Lookup(this, pFilm)) {
+        // Add the sample to the thread's tile; MergeTile() only merges the
+        // channels that the film stores
+        TilePixel &p = *tilePixel;
+        if (haveSurface) {
+            for (int c = 0; c < 3; ++c) {
+                p.varianceEstimator[c].Add(rgb[c]);
+                p.albedoSum[c] += weight * albedoRGB[c];
+            }
+            p.pSum += weight * visibleSurface->p;
+            p.nSum += weight * visibleSurface->n;
+            p.nsSum += weight * visibleSurface->ns;
+            p.dzSum += weight * Vector2f(visibleSurface->dzdx, visibleSurface->dzdy);
+        }
         for (int c = 0; c < 3; ++c)
-            p.albedoSum[c] += weight * albedoRGB[c];
+            p.rgbSum[c] += rgb[c] * weight;
+        p.weightSum += weight;
+        return;
+    }
+#endif
+
+    // Add the sample to the film's stored channels
+    if (haveSurface) {
+        if (varianceEstimators.size() > 0)
+            for (int c = 0; c < 3; ++c)
+                varianceEstimators[pFilm][c].Add(rgb[c]);
+        if (pSums.size() > 0)
+            pSums[pFilm] += weight * visibleSurface->p;
+        if (nSums.size() > 0)
+            nSums[pFilm] += weight * visibleSurface->n;
+        if (nsSums.size() > 0)
+            nsSums[pFilm] += weight * visibleSurface->ns;
+        if (dzSums.size() > 0)
+            dzSums[pFilm] +=
+                weight * Vector2f(visibleSurface->dzdx, visibleSurface->dzdy);
+        if (albedoSums.size() > 0)
+            for (int c = 0; c < 3; ++c)
+                albedoSums[pFilm][c] += weight * albedoRGB[c];
     }
 
+    Pixel &p = pixels[pFilm];
     for (int c = 0; c < 3; ++c)
         p.rgbSum[c] += rgb[c] * weight;
     p.weightSum += weight;
 }
 
 GBufferFilm::GBufferFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
-                         Float maxComponentValue, bool writeFP16, Allocator alloc)
+                         Float maxComponentValue, bool writeFP16, uint32_t channels,
+                         bool denoise, Allocator alloc)
     : FilmBase(p),
       pixels(pixelBounds, alloc),
+      // Only allocate planes for the auxiliary channels that are stored;
+      // variance estimates are also needed for adaptive sampling and
+      // convergence estimates
+      pSums(planeBounds(channels & PositionChannels), alloc),
+      dzSums(planeBounds(channels & DepthDerivativeChannels), alloc),
+      nSums(planeBounds(channels & NormalChannels), alloc),
+      nsSums(planeBounds(channels & ShadingNormalChannels), alloc),
+      albedoSums(planeBounds(channels & AlbedoChannels), alloc),
+      varianceEstimators(
+          planeBounds((channels & (VarianceChannels | RelativeVarianceChannels)) ||
+                      Options->adaptiveError || !Options->convergenceFile.empty() ||
+                      Options->targetRelMSE),
+          alloc),
+      channels(channels),
+      denoise(denoise),
       colorSpace(colorSpace),
       maxComponentValue(maxComponentValue),
       writeFP16(writeFP16),
-      filterIntegral(filter.Integral()) {
+      filterIntegral(filter.Integral()),
+      splatBuffer(p.pixelBounds) {
     CHECK(!pixelBounds.IsEmpty());
-    filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
+    CHECK_EQ(channels & ~AllChannels, 0);
+    filmPixelMemory += pixelBounds.Area() * sizeof(Pixel) +
+                       pSums.size() * sizeof(Point3f) + dzSums.size() * sizeof(Vector2f) +
+                       (nSums.size() + nsSums.size()) * sizeof(Normal3f) +
+                       albedoSums.size() * sizeof(pstd::array<double, 3>) +
+                       varianceEstimators.size() *
+                           sizeof(pstd::array<VarianceEstimator<Float>, 3>);
+    if (Options && Options->numa)
+        InterleaveAcrossNUMANodes(pixels.begin(), pixels.size() * sizeof(Pixel));
     outputRGBFromSensorRGB = colorSpace->RGBFromXYZ * sensor->XYZFromSensorRGB;
 }
 
+size_t GBufferFilm::PixelBytes(uint32_t channels) {
+    size_t bytes = sizeof(Pixel);
+    if (channels & PositionChannels)
+        bytes += sizeof(Point3f);
+    if (channels & DepthDerivativeChannels)
+        bytes += sizeof(Vector2f);
+    if (channels & NormalChannels)
+        bytes += sizeof(Normal3f);
+    if (channels & ShadingNormalChannels)
+        bytes += sizeof(Normal3f);
+    if (channels & AlbedoChannels)
+        bytes += sizeof(pstd::array<double, 3>);
+    if ((channels & (VarianceChannels | RelativeVarianceChannels)) ||
+        Options->adaptiveError || !Options->convergenceFile.empty() ||
+        Options->targetRelMSE)
+        bytes += sizeof(pstd::array<VarianceEstimator<Float>, 3>);
+    return bytes;
+}
+
+thread_local FilmTile<GBufferFilm::TilePixel> GBufferFilm::threadTile;
+
+void GBufferFilm::StartTile(Bounds2i tileBounds) {
+    threadTile.Start(this, Intersect(tileBounds, pixelBounds));
+}
+
+void GBufferFilm::MergeTile() {
+    threadTile.Merge(this, [&](Point2i p, const TilePixel &tilePixel) {
+        Pixel &pixel = pixels[p];
+        for (int c = 0; c < 3; ++c)
+            pixel.rgbSum[c] += tilePixel.rgbSum[c];
+        pixel.weightSum += tilePixel.weightSum;
+
+        if (varianceEstimators.size() > 0)
+            for (int c = 0; c < 3; ++c)
+                varianceEstimators[p][c].Merge(tilePixel.varianceEstimator[c]);
+        if (albedoSums.size() > 0)
+            for (int c = 0; c < 3; ++c)
+                albedoSums[p][c] += tilePixel.albedoSum[c];
+        if (pSums.size() > 0)
+            pSums[p] += tilePixel.pSum;
+        if (dzSums.size() > 0)
+            dzSums[p] += tilePixel.dzSum;
+        if (nSums.size() > 0)
+            nSums[p] += tilePixel.nSum;
+        if (nsSums.size() > 0)
+            nsSums[p] += tilePixel.nsSum;
+    });
+}
+
 void GBufferFilm::AddSplat(const Point2f &p, SampledSpectrum v,
                            const SampledWavelengths &lambda) {
     // NOTE: same code as RGBFilm::AddSplat()...
@@ -637,77 +1039,75 @@ void GBufferFilm::AddSplat(const Point2f &p, SampledSpectrum v,
     for (Point2i pi : splatBounds) {
         Float wt = filter.Evaluate(Point2f(p - pi - Vector2f(0.5, 0.5)));
         if (wt != 0) {
-            Pixel &pixel = pixels[pi];
+#ifdef PBRT_IS_GPU_CODE
             for (int i = 0; i < 3; ++i)
-                pixel.splatRGB[i].Add(wt * rgb[i]);
+                pixels[pi].splatRGB[i].Add(wt * rgb[i]);
+#else
+            splatBuffer.Add(pi, wt * rgb, pixels[pi].splatRGB);
+#endif
         }
     }
 }
 
 void GBufferFilm::WriteImage(ImageMetadata metadata, Float splatScale) {
     Image image = GetImage(&metadata, splatScale);
+    if (denoise)
+        denoiseImage(&image);
     LOG_VERBOSE("Writing image %s with bounds %s", filename, pixelBounds);
-    image.Write(filename, metadata);
+    WriteImageAsync(std::move(image), filename, metadata);
 }
 
 Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
+    // Add buffered splats to the film's pixels
+    splatBuffer.Flush([&](Point2i p, const double *rgb) {
+        for (int c = 0; c < 3; ++c)
+            pixels[p].splatRGB[c].Add(rgb[c]);
+    });
+
     // Convert image to RGB and compute final pixel values
     LOG_VERBOSE("Converting image to RGB and computing final weighted pixel values");
+    // Only include the auxiliary channels that the film stores
+    std::vector<std::string> channelNames = {"R", "G", "B"};
+    auto addChannels = [&](uint32_t group, std::vector<std::string> names) {
+        if (channels & group)
+            channelNames.insert(channelNames.end(), names.begin(), names.end());
+    };
+    addChannels(AlbedoChannels, {"Albedo.R", "Albedo.G", "Albedo.B"});
+    addChannels(PositionChannels, {"Px", "Py", "Pz"});
+    addChannels(DepthDerivativeChannels, {"dzdx", "dzdy"});
+    addChannels(NormalChannels, {"Nx", "Ny", "Nz"});
+    addChannels(ShadingNormalChannels, {"Nsx", "Nsy", "Nsz"});
+    addChannels(VarianceChannels, {"Variance.R", "Variance.G", "Variance.B"});
+    addChannels(RelativeVarianceChannels,
+                {"RelativeVariance.R", "RelativeVariance.G", "RelativeVariance.B"});
     PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
-    Image image(format, Point2i(pixelBounds.Diagonal()),
-                {"R",
-                 "G",
-                 "B",
-                 "Albedo.R",
-                 "Albedo.G",
-                 "Albedo.B",
-                 "Px",
-                 "Py",
-                 "Pz",
-                 "dzdx",
-                 "dzdy",
-                 "Nx",
-                 "Ny",
-                 "Nz",
-                 "Nsx",
-                 "Nsy",
-                 "Nsz",
-                 "Variance.R",
-                 "Variance.G",
-                 "Variance.B",
-                 "RelativeVariance.R",
-                 "RelativeVariance.G",
-                 "RelativeVariance.B"});
+    Image image(format, Point2i(pixelBounds.Diagonal()), channelNames);
 
+    auto getDesc = [&](uint32_t group, std::vector<std::string> names) {
+        return (channels & group) ? image.GetChannelDesc(names) : ImageChannelDesc();
+    };
     ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
-    ImageChannelDesc pDesc = image.GetChannelDesc({"Px", "Py", "Pz"});
-    ImageChannelDesc dzDesc = image.GetChannelDesc({"dzdx", "dzdy"});
-    ImageChannelDesc nDesc = image.GetChannelDesc({"Nx", "Ny", "Nz"});
-    ImageChannelDesc nsDesc = image.GetChannelDesc({"Nsx", "Nsy", "Nsz"});
+    ImageChannelDesc pDesc = getDesc(PositionChannels, {"Px", "Py", "Pz"});
+    ImageChannelDesc dzDesc = getDesc(DepthDerivativeChannels, {"dzdx", "dzdy"});
+    ImageChannelDesc nDesc = getDesc(NormalChannels, {"Nx", "Ny", "Nz"});
+    ImageChannelDesc nsDesc = getDesc(ShadingNormalChannels, {"Nsx", "Nsy", "Nsz"});
     ImageChannelDesc albedoRgbDesc =
-        image.GetChannelDesc({"Albedo.R", "Albedo.G", "Albedo.B"});
+        getDesc(AlbedoChannels, {"Albedo.R", "Albedo.G", "Albedo.B"});
     ImageChannelDesc varianceDesc =
-        image.GetChannelDesc({"Variance.R", "Variance.G", "Variance.B"});
-    ImageChannelDesc relVarianceDesc = image.GetChannelDesc(
-        {"RelativeVariance.R", "RelativeVariance.G", "RelativeVariance.B"});
+        getDesc(VarianceChannels, {"Variance.R", "Variance.G", "Variance.B"});
+    ImageChannelDesc relVarianceDesc =
+        getDesc(RelativeVarianceChannels,
+                {"RelativeVariance.R", "RelativeVariance.G", "RelativeVariance.B"});
 
     std::atomic<int> nClamped{0};
     ParallelFor2D(pixelBounds, [&](Point2i p) {
         Pixel &pixel = pixels[p];
         RGB rgb(pixel.rgbSum[0], pixel.rgbSum[1], pixel.rgbSum[2]);
-        RGB albedoRgb(pixel.albedoSum[0], pixel.albedoSum[1], pixel.albedoSum[2]);
 
         // Normalize pixel with weight sum
         Float weightSum = pixel.weightSum;
-        Point3f pt = pixel.pSum;
-        Float dzdx = pixel.dzdxSum, dzdy = pixel.dzdySum;
-        if (weightSum != 0) {
+        if (weightSum != 0)
             rgb /= weightSum;
-            albedoRgb /= weightSum;
-            pt /= weightSum;
-            dzdx /= weightSum;
-            dzdy /= weightSum;
-        }
 
         // Add splat value at pixel
         for (int c = 0; c < 3; ++c)
@@ -727,25 +1127,46 @@ Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
 
         Point2i pOffset(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
         image.SetChannels(pOffset, rgbDesc, {rgb[0], rgb[1], rgb[2]});
-        image.SetChannels(pOffset, albedoRgbDesc,
-                          {albedoRgb[0], albedoRgb[1], albedoRgb[2]});
-
-        Normal3f n =
-            LengthSquared(pixel.nSum) > 0 ? Normalize(pixel.nSum) : Normal3f(0, 0, 0);
-        Normal3f ns =
-            LengthSquared(pixel.nsSum) > 0 ? Normalize(pixel.nsSum) : Normal3f(0, 0, 0);
-        image.SetChannels(pOffset, pDesc, {pt.x, pt.y, pt.z});
-        image.SetChannels(pOffset, dzDesc, {std::abs(dzdx), std::abs(dzdy)});
-        image.SetChannels(pOffset, nDesc, {n.x, n.y, n.z});
-        image.SetChannels(pOffset, nsDesc, {ns.x, ns.y, ns.z});
-        image.SetChannels(
-            pOffset, varianceDesc,
-            {pixel.varianceEstimator[0].Variance(), pixel.varianceEstimator[1].Variance(),
-             pixel.varianceEstimator[2].Variance()});
-        image.SetChannels(pOffset, relVarianceDesc,
-                          {pixel.varianceEstimator[0].RelativeVariance(),
-                           pixel.varianceEstimator[1].RelativeVariance(),
-                           pixel.varianceEstimator[2].RelativeVariance()});
+
+        // Set the pixel's auxiliary channels
+        Float invWeightSum = weightSum != 0 ? 1 / weightSum : 0;
+        if (albedoRgbDesc) {
+            const pstd::array<double, 3> &albedoSum = albedoSums[p];
+            image.SetChannels(pOffset, albedoRgbDesc,
+                              {Float(albedoSum[0] * invWeightSum),
+                               Float(albedoSum[1] * invWeightSum),
+                               Float(albedoSum[2] * invWeightSum)});
+        }
+        if (pDesc) {
+            Point3f pt = pSums[p] * invWeightSum;
+            image.SetChannels(pOffset, pDesc, {pt.x, pt.y, pt.z});
+        }
+        if (dzDesc) {
+            Vector2f dz = dzSums[p] * invWeightSum;
+            image.SetChannels(pOffset, dzDesc, {std::abs(dz.x), std::abs(dz.y)});
+        }
+        auto normalize = [](Normal3f n) {
+            return LengthSquared(n) > 0 ? Normalize(n) : Normal3f(0, 0, 0);
+        };
+        if (nDesc) {
+            Normal3f n = normalize(nSums[p]);
+            image.SetChannels(pOffset, nDesc, {n.x, n.y, n.z});
+        }
+        if (nsDesc) {
+            Normal3f ns = normalize(nsSums[p]);
+            image.SetChannels(pOffset, nsDesc, {ns.x, ns.y, ns.z});
+        }
+        if (varianceDesc) {
+            const pstd::array<VarianceEstimator<Float>, 3> &ve = varianceEstimators[p];
+            image.SetChannels(pOffset, varianceDesc,
+                              {ve[0].Variance(), ve[1].Variance(), ve[2].Variance()});
+        }
+        if (relVarianceDesc) {
+            const pstd::array<VarianceEstimator<Float>, 3> &ve = varianceEstimators[p];
+            image.SetChannels(pOffset, relVarianceDesc,
+                              {ve[0].RelativeVariance(), ve[1].RelativeVariance(),
+                               ve[2].RelativeVariance()});
+        }
     });
 
     if (nClamped.load() > 0)
@@ -758,10 +1179,86 @@ Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
     return image;
 }
 
+void GBufferFilm::denoiseImage(Image *image) const {
+    Timer timer;
+    Point2i resolution = image->Resolution();
+    ImageChannelDesc rgbDesc = image->GetChannelDesc({"R", "G", "B"});
+    ImageChannelDesc albedoDesc =
+        image->GetChannelDesc({"Albedo.R", "Albedo.G", "Albedo.B"});
+    ImageChannelDesc nsDesc = image->GetChannelDesc({"Nsx", "Nsy", "Nsz"});
+    CHECK(rgbDesc && albedoDesc && nsDesc);
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (Options->useGPU) {
+        // Denoise the image using OptiX's denoiser
+        CUDAMemoryResource cudaMemoryResource;
+        Allocator alloc(&cudaMemoryResource);
+        size_t nPixels = size_t(resolution.x) * resolution.y;
+        pstd::vector<RGB> rgb(nPixels, alloc), albedo(nPixels, alloc);
+        pstd::vector<RGB> result(nPixels, alloc);
+        pstd::vector<Normal3f> ns(nPixels, alloc);
+        ParallelFor(0, resolution.y, [&](int64_t y) {
+            for (int x = 0; x < resolution.x; ++x) {
+                size_t offset = y * resolution.x + x;
+                ImageChannelValues v = image->GetChannels({x, int(y)}, rgbDesc);
+                rgb[offset] = RGB(v[0], v[1], v[2]);
+                v = image->GetChannels({x, int(y)}, albedoDesc);
+                albedo[offset] = RGB(v[0], v[1], v[2]);
+                // OptiX expects normals in a right-handed coordinate system
+                v = image->GetChannels({x, int(y)}, nsDesc);
+                ns[offset] = Normal3f(v[0], v[1], -v[2]);
+            }
+        });
+
+        Denoiser denoiser(Vector2i(resolution), true);
+        denoiser.Denoise(rgb.data(), ns.data(), albedo.data(), result.data());
+
+        ParallelFor(0, resolution.y, [&](int64_t y) {
+            for (int x = 0; x < resolution.x; ++x) {
+                const RGB &d = result[y * resolution.x + x];
+                image->SetChannels({x, int(y)}, rgbDesc, {d.r, d.g, d.b});
+            }
+        });
+        LOG_VERBOSE("Denoised image with OptiX in %.3fs", timer.ElapsedSeconds());
+        return;
+    }
+#endif
+    // Denoise the image using the a-trous wavelet filter
+    ImageChannelDesc zDesc = image->GetChannelDesc({"Pz"});
+    ImageChannelDesc dzDesc = image->GetChannelDesc({"dzdx", "dzdy"});
+    ImageChannelDesc varianceDesc =
+        image->GetChannelDesc({"Variance.R", "Variance.G", "Variance.B"});
+    CHECK(zDesc && dzDesc && varianceDesc);
+
+    // Compute the per-pixel variance of the pixels' average and filter it
+    Image variance(PixelFormat::Float, resolution, {"Y", "Pz", "Nsx", "Nsy", "Nsz"});
+    ParallelFor(0, resolution.y, [&](int64_t y) {
+        for (int x = 0; x < resolution.x; ++x) {
+            Float v = image->GetChannels({x, int(y)}, varianceDesc).Average();
+            Float z = image->GetChannels({x, int(y)}, zDesc)[0];
+            ImageChannelValues ns = image->GetChannels({x, int(y)}, nsDesc);
+            variance.SetChannels({x, int(y)}, {v, z, ns[0], ns[1], ns[2]});
+        }
+    });
+    Float xySigma[2] = {2.f, 2.f};
+    Image filteredVariance = variance.JointBilateralFilter(
+        variance.GetChannelDesc({"Y"}), 7, xySigma,
+        variance.GetChannelDesc({"Pz", "Nsx", "Nsy", "Nsz"}), ImageChannelValues(4, 1));
+
+    Image denoised = DenoiseImage(*image, rgbDesc, filteredVariance, albedoDesc, zDesc,
+                                  dzDesc, nsDesc, 3 /* halfWidth */, 3 /* nLevels */);
+    ParallelFor(0, resolution.y, [&](int64_t y) {
+        for (int x = 0; x < resolution.x; ++x)
+            image->SetChannels({x, int(y)}, rgbDesc, denoised.GetChannels({x, int(y)}));
+    });
+    LOG_VERBOSE("Denoised image in %.3fs", timer.ElapsedSeconds());
+}
+
 std::string GBufferFilm::ToString() const {
     return StringPrintf("[ GBufferFilm %s colorSpace: %s maxComponentValue: %f "
-                        "writeFP16: %s ]",
-                        BaseToString(), *colorSpace, maxComponentValue, writeFP16);
+                        "writeFP16: %s channels: %#x denoise: %s ]",
+                        BaseToString(), *colorSpace, maxComponentValue, writeFP16,
+                        channels, denoise);
 }
 
 GBufferFilm *GBufferFilm::Create(const ParameterDictionary &parameters,
@@ -780,8 +1277,42 @@ GBufferFilm *GBufferFilm::Create(const ParameterDictionary &parameters,
         ErrorExit(loc, "%s: EXR is the only format supported by the GBufferFilm.",
                   filmBaseParameters.filename);
 
+    // Find the auxiliary channels to store and write; all of them are by default
+    uint32_t channels = GBufferFilm::AllChannels;
+    std::vector<std::string> channelNames = parameters.GetStringArray("channels");
+    if (!channelNames.empty()) {
+        static const std::pair<const char *, uint32_t> channelGroups[] = {
+            {"albedo", GBufferFilm::AlbedoChannels},
+            {"p", GBufferFilm::PositionChannels},
+            {"dzdxy", GBufferFilm::DepthDerivativeChannels},
+            {"n", GBufferFilm::NormalChannels},
+            {"ns", GBufferFilm::ShadingNormalChannels},
+            {"variance", GBufferFilm::VarianceChannels},
+            {"relativevariance", GBufferFilm::RelativeVarianceChannels}};
+        channels = 0;
+        for (const std::string &name : channelNames) {
+            auto iter = std::find_if(std::begin(channelGroups), std::end(channelGroups),
+                                     [&](const auto &g) { return name == g.first; });
+            if (iter == std::end(channelGroups))
+                ErrorExit(loc,
+                          "%s: unknown GBufferFilm channel. Expected \"albedo\", "
+                          "\"p\", \"dzdxy\", \"n\", \"ns\", \"variance\", or "
+                          "\"relativevariance\".",
+                          name);
+            channels |= iter->second;
+        }
+    }
+
+    // Store the channels that guide the denoiser if the image is to be denoised
+    bool denoise = parameters.GetOneBool("denoise", false);
+    if (denoise)
+        channels |= GBufferFilm::AlbedoChannels | GBufferFilm::PositionChannels |
+                    GBufferFilm::DepthDerivativeChannels |
+                    GBufferFilm::ShadingNormalChannels | GBufferFilm::VarianceChannels;
+
     return alloc.new_object<GBufferFilm>(filmBaseParameters, colorSpace,
-                                         maxComponentValue, writeFP16, alloc);
+                                         maxComponentValue, writeFP16, channels,
+                                         denoise, alloc);
 }
 
 Film Film::Create(const std::string &name, const ParameterDictionary &parameters,
@@ -804,4 +1335,28 @@ Film Film::Create(const std::string &name, const ParameterDictionary &parameters
     return film;
 }
 
+Image ReadMSEReferenceImage(const std::string &filename, Bounds2i pixelBounds) {
+    ImageAndMetadata mse = Image::Read(filename);
+    Image &referenceImage = mse.image;
+
+    Bounds2i msePixelBounds = mse.metadata.pixelBounds
+                                  ? *mse.metadata.pixelBounds
+                                  : Bounds2i(Point2i(0, 0), referenceImage.Resolution());
+    if (!Inside(pixelBounds, msePixelBounds))
+        ErrorExit("Output image pixel bounds %s aren't inside the MSE "
+                  "image's pixel bounds %s.",
+                  pixelBounds, msePixelBounds);
+
+    // Transform the pixelBounds of the image we're rendering to the
+    // coordinate system with msePixelBounds.pMin at the origin, which
+    // in turn gives us the section of the MSE image to crop. (This is
+    // complicated by the fact that Image doesn't support pixel
+    // bounds...)
+    Bounds2i cropBounds(Point2i(pixelBounds.pMin - msePixelBounds.pMin),
+                        Point2i(pixelBounds.pMax - msePixelBounds.pMin));
+    Image cropped = referenceImage.Crop(cropBounds);
+    CHECK_EQ(cropped.Resolution(), Point2i(pixelBounds.Diagonal()));
+    return cropped;
+}
+
 }  // namespace pbrt
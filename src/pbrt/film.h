@@ -17,6 +17,7 @@
 #include <pbrt/bsdf.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/image.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
@@ -26,6 +27,8 @@
 
 #include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -208,6 +211,7 @@ class FilmBase {
     PBRT_CPU_GPU
     const PixelSensor *GetPixelSensor() const { return sensor; }
     std::string GetFilename() const { return filename; }
+    void SetFilename(std::string f) { filename = std::move(f); }
 
     PBRT_CPU_GPU
     SampledWavelengths SampleWavelengths(Float u) const {
@@ -229,6 +233,118 @@ class FilmBase {
     std::string filename;
 };
 
+// Returns the estimated relative standard error of the mean of the samples
+// that _estimator_ has been given.
+PBRT_CPU_GPU inline Float RelativeError(const VarianceEstimator<Float> &estimator) {
+    int64_t n = estimator.Count();
+    Float mean = estimator.Mean(), variance = estimator.Variance();
+    if (n < 2)
+        return Infinity;
+    if (variance == 0)
+        return 0;
+    return mean > 0 ? std::sqrt(variance / n) / mean : Infinity;
+}
+
+// FilmTile Definition
+// FilmTile holds the sums of the samples that a thread has added to a tile of a
+// film's pixels since its Start() method was called, so that the thread only
+// writes to the film's pixels when the tile is merged.
+template <typename TilePixel>
+class FilmTile {
+  public:
+    // FilmTile Public Methods
+    void Start(const void *f, Bounds2i b) {
+        film = f;
+        bounds = b;
+        // Reuse the previous tile's storage
+        pixels.assign(bounds.Area(), TilePixel());
+    }
+
+    // Returns nullptr if the tile isn't accumulating samples for _p_ in _f_
+    TilePixel *Lookup(const void *f, Point2i p) {
+        if (f != film || !InsideExclusive(p, bounds))
+            return nullptr;
+        int width = bounds.pMax.x - bounds.pMin.x;
+        return &pixels[(p.y - bounds.pMin.y) * width + (p.x - bounds.pMin.x)];
+    }
+
+    template <typename F>
+    void Merge(const void *f, F func) {
+        CHECK(f == film);
+        int index = 0;
+        for (Point2i p : bounds)
+            func(p, pixels[index++]);
+        film = nullptr;
+    }
+
+  private:
+    // FilmTile Private Members
+    const void *film = nullptr;
+    Bounds2i bounds;
+    std::vector<TilePixel> pixels;
+};
+
+// SplatBuffer Definition
+// SplatBuffer accumulates each thread's splats separately in square tiles of
+// pixels that are allocated when the thread first splats to them, so that
+// splats don't contend for the film's pixels. The tiles that each thread may
+// allocate are limited to bound the buffers' total size; splats to other
+// tiles are added to the film's pixels atomically. Flush() adds the buffered
+// values to the film's pixels and must not be called while splats are added.
+class SplatBuffer {
+  public:
+    // SplatBuffer Public Methods
+    SplatBuffer(Bounds2i pixelBounds);
+
+    void Add(Point2i p, RGB rgb, AtomicDouble pixelSplatRGB[3]);
+    void Add(Point2i p, RGB rgb, AtomicFloat pixelSplatRGB[3]);
+
+    template <typename F>
+    void Flush(F add) {
+        // Add the threads' buffered splats for each tile in parallel
+        ParallelFor(0, nTiles.x * nTiles.y, [&](int64_t tile) {
+            Point2i pTile(tile % nTiles.x, tile / nTiles.x);
+            Point2i pMin = pixelBounds.pMin + TileSize * Vector2i(pTile);
+            Bounds2i tileBounds(pMin, pMin + Vector2i(TileSize, TileSize));
+            tileBounds = Intersect(tileBounds, pixelBounds);
+            for (ThreadBuffer &buffer : threadBuffers) {
+                if (buffer.tiles.empty() || !buffer.tiles[tile])
+                    continue;
+                for (Point2i p : tileBounds) {
+                    double *rgb = buffer.tiles[tile].get() + TexelOffset(p);
+                    if (rgb[0] != 0 || rgb[1] != 0 || rgb[2] != 0)
+                        add(p, rgb);
+                    rgb[0] = rgb[1] = rgb[2] = 0;
+                }
+            }
+        });
+    }
+
+  private:
+    // SplatBuffer Private Types
+    struct ThreadBuffer {
+        std::vector<std::unique_ptr<double[]>> tiles;
+        int nAllocated = 0;
+    };
+
+    // SplatBuffer Private Methods
+    // Returns nullptr if the thread can't buffer splats to _p_
+    double *BufferedRGB(Point2i p);
+
+    int TexelOffset(Point2i p) const {
+        Point2i pOffset(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
+        return 3 * ((pOffset.y % TileSize) * TileSize + pOffset.x % TileSize);
+    }
+
+    // SplatBuffer Private Members
+    static constexpr int TileSize = 16;
+    Bounds2i pixelBounds;
+    Point2i nTiles;
+    int maxTilesPerThread = 0;
+    std::once_flag threadBuffersFlag;
+    std::vector<ThreadBuffer> threadBuffers;
+};
+
 // RGBFilm Definition
 class RGBFilm : public FilmBase {
   public:
@@ -251,18 +367,26 @@ class RGBFilm : public FilmBase {
 
         DCHECK(InsideExclusive(pFilm, pixelBounds));
         // Update pixel values with filtered sample contribution
-        Pixel &pixel = pixels[pFilm];
+        TilePixel *pixel = &pixels[pFilm];
+#ifndef PBRT_IS_GPU_CODE
+        if (TilePixel *tilePixel = threadTile.Lookup(this, pFilm))
+            pixel = tilePixel;
+#endif
         for (int c = 0; c < 3; ++c)
-            pixel.rgbSum[c] += weight * rgb[c];
-        pixel.weightSum += weight;
+            pixel->rgbSum[c] += weight * rgb[c];
+        pixel->weightSum += weight;
+        pixel->varianceEstimator.Add(rgb.Average());
     }
 
+    void StartTile(Bounds2i tileBounds);
+    void MergeTile();
+
     PBRT_CPU_GPU
     RGB GetPixelRGB(const Point2i &p, Float splatScale = 1) const {
         const Pixel &pixel = pixels[p];
-        RGB rgb(pixel.rgbSum[0], pixel.rgbSum[1], pixel.rgbSum[2]);
+        RGB rgb(Float(pixel.rgbSum[0]), Float(pixel.rgbSum[1]), Float(pixel.rgbSum[2]));
         // Normalize _rgb_ with weight sum
-        Float weightSum = pixel.weightSum;
+        Float weightSum = Float(pixel.weightSum);
         if (weightSum != 0)
             rgb /= weightSum;
 
@@ -276,13 +400,20 @@ class RGBFilm : public FilmBase {
         return rgb;
     }
 
+    PBRT_CPU_GPU
+    Float GetPixelRelativeError(const Point2i &p) const {
+        return RelativeError(pixels[p].varianceEstimator);
+    }
+
     RGBFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
             Float maxComponentValue = Infinity, bool writeFP16 = true,
-            Allocator alloc = {});
+            int bandHeight = 0, Allocator alloc = {});
 
     static RGBFilm *Create(const ParameterDictionary &parameters, Float exposureTime,
                            Filter filter, const RGBColorSpace *colorSpace,
                            const FileLoc *loc, Allocator alloc);
+    // Returns the number of bytes that the film stores for each pixel.
+    static size_t PixelBytes() { return sizeof(Pixel); }
 
     PBRT_CPU_GPU
     void AddSplat(const Point2f &p, SampledSpectrum v, const SampledWavelengths &lambda);
@@ -290,6 +421,30 @@ class RGBFilm : public FilmBase {
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
+    int StreamingBandHeight() const { return bandHeight; }
+    void StartBand(Bounds2i bounds);
+    void EndBand(ImageMetadata metadata, Float splatScale = 1);
+
+    // Checkpoints hold the pixels' accumulated sample values and the number of
+    // samples that have been taken in each pixel. They are written in the
+    // machine's native format and can only be read by the same build of pbrt,
+    // for a film with the same pixel bounds.
+    void WriteCheckpoint(const std::string &filename, int samplesPerPixel);
+    // Returns the number of samples that were taken in each pixel, or zero if
+    // there's no checkpoint file.
+    int ReadCheckpoint(const std::string &filename);
+
+    // Copy the accumulated values of the pixels in _bounds_ to or from a buffer
+    // with _PixelValueBytes()_ bytes for each pixel in scanline order, in the
+    // format used by checkpoints.
+    static constexpr size_t PixelValueBytes() {
+        return sizeof(TilePixel) + 3 * sizeof(double);
+    }
+    void CopyPixelValuesOut(Bounds2i bounds, char *values) const;
+    void CopyPixelValuesIn(Bounds2i bounds, const char *values);
+    // Discards all of the samples and splats that have been added to the film.
+    void Clear();
+
     std::string ToString() const;
 
     PBRT_CPU_GPU
@@ -299,14 +454,36 @@ class RGBFilm : public FilmBase {
     }
 
   private:
+    // RGBFilm Private Methods
+    Image getImage(Bounds2i bounds, Float splatScale);
+
     // RGBFilm::Pixel Definition
-    struct Pixel {
+#ifdef PBRT_RGB_FILM_FLOAT_ACCUMULATION
+    // Compensated single-precision sums are accurate enough for most images
+    // and use float arithmetic, which is faster than double on most GPUs;
+    // single-precision splats halve their storage.
+    using PixelSum = CompensatedSum<float>;
+    using PixelSumValue = float;
+    using AtomicPixelSum = AtomicFloat;
+#else
+    using PixelSum = double;
+    using PixelSumValue = double;
+    using AtomicPixelSum = AtomicDouble;
+#endif
+    struct TilePixel {
+        PixelSum rgbSum[3] = {};
+        PixelSum weightSum = {};
+        // Estimates the variance of the average of the samples' RGB components
+        VarianceEstimator<Float> varianceEstimator;
+    };
+    struct Pixel : TilePixel {
         Pixel() = default;
-        double rgbSum[3] = {0., 0., 0.};
-        double weightSum = 0.;
-        AtomicDouble splatRGB[3];
+        AtomicPixelSum splatRGB[3];
     };
 
+    // The thread's tile is shared by all RGBFilms but only used for one at a time
+    static thread_local FilmTile<TilePixel> threadTile;
+
     // RGBFilm Private Members
     const RGBColorSpace *colorSpace;
     Float maxComponentValue;
@@ -314,19 +491,44 @@ class RGBFilm : public FilmBase {
     Float filterIntegral;
     SquareMatrix<3> outputRGBFromSensorRGB;
     Array2D<Pixel> pixels;
+    // Streaming films only allocate _pixels_ for the current band
+    int bandHeight;
+    Bounds2i bandBounds;
+    std::unique_ptr<EXRScanlineWriter> bandWriter;
+    SplatBuffer splatBuffer;
 };
 
 // GBufferFilm Definition
 class GBufferFilm : public FilmBase {
   public:
+    // GBufferFilm Channel Definitions
+    // Each group of auxiliary channels is only stored and written if it is
+    // requested; the R, G, and B channels always are. When the film's image
+    // is denoised before it is written, the channels that guide the denoiser
+    // must be stored.
+    enum Channels : uint32_t {
+        AlbedoChannels = 1 << 0,
+        PositionChannels = 1 << 1,
+        DepthDerivativeChannels = 1 << 2,
+        NormalChannels = 1 << 3,
+        ShadingNormalChannels = 1 << 4,
+        VarianceChannels = 1 << 5,
+        RelativeVarianceChannels = 1 << 6,
+        AllChannels = (1 << 7) - 1
+    };
+
     // GBufferFilm Public Methods
     GBufferFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
                 Float maxComponentValue = Infinity, bool writeFP16 = true,
+                uint32_t channels = AllChannels, bool denoise = false,
                 Allocator alloc = {});
 
     static GBufferFilm *Create(const ParameterDictionary &parameters, Float exposureTime,
                                Filter filter, const RGBColorSpace *colorSpace,
                                const FileLoc *loc, Allocator alloc);
+    // Returns the number of bytes that the film stores for each pixel when it
+    // stores the given auxiliary channels.
+    static size_t PixelBytes(uint32_t channels);
 
     PBRT_CPU_GPU
     void AddSample(const Point2i &pFilm, SampledSpectrum L,
@@ -345,6 +547,9 @@ class GBufferFilm : public FilmBase {
     PBRT_CPU_GPU
     bool UsesVisibleSurface() const { return true; }
 
+    void StartTile(Bounds2i tileBounds);
+    void MergeTile();
+
     PBRT_CPU_GPU
     RGB GetPixelRGB(const Point2i &p, Float splatScale = 1) const {
         const Pixel &pixel = pixels[p];
@@ -364,34 +569,73 @@ class GBufferFilm : public FilmBase {
         return rgb;
     }
 
+    // Only the samples of pixels with visible surfaces are used for their
+    // variance estimates, so other pixels' errors are infinite, as are all
+    // pixels' if variance estimates aren't being stored.
+    PBRT_CPU_GPU
+    Float GetPixelRelativeError(const Point2i &p) const {
+        if (varianceEstimators.size() == 0)
+            return Infinity;
+        const pstd::array<VarianceEstimator<Float>, 3> &ve = varianceEstimators[p];
+        return std::max(
+            {RelativeError(ve[0]), RelativeError(ve[1]), RelativeError(ve[2])});
+    }
+
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
     std::string ToString() const;
 
   private:
+    // GBufferFilm Private Methods
+    Bounds2i planeBounds(bool used) const {
+        return used ? pixelBounds : Bounds2i({0, 0}, {0, 0});
+    }
+    void denoiseImage(Image *image) const;
+
     // GBufferFilm::Pixel Definition
+    // The thread's tile holds all of the channels for its pixels, but the film
+    // only stores the auxiliary channels that are used, in planes of their own.
+    struct TilePixel {
+        double rgbSum[3] = {0., 0., 0.};
+        double weightSum = 0.;
+        Point3f pSum;
+        Vector2f dzSum;
+        Normal3f nSum, nsSum;
+        pstd::array<double, 3> albedoSum;
+        pstd::array<VarianceEstimator<Float>, 3> varianceEstimator;
+    };
     struct Pixel {
         Pixel() = default;
         double rgbSum[3] = {0., 0., 0.};
         double weightSum = 0.;
         AtomicDouble splatRGB[3];
-        Point3f pSum;
-        Float dzdxSum = 0, dzdySum = 0;
-        Normal3f nSum, nsSum;
-        double albedoSum[3] = {0., 0., 0.};
-        VarianceEstimator<Float> varianceEstimator[3];
     };
 
+    static thread_local FilmTile<TilePixel> threadTile;
+
     // GBufferFilm Private Members
     Array2D<Pixel> pixels;
+    // Planes for channels that aren't stored are empty
+    Array2D<Point3f> pSums;
+    Array2D<Vector2f> dzSums;
+    Array2D<Normal3f> nSums, nsSums;
+    Array2D<pstd::array<double, 3>> albedoSums;
+    Array2D<pstd::array<VarianceEstimator<Float>, 3>> varianceEstimators;
+    uint32_t channels;
+    bool denoise;
     const RGBColorSpace *colorSpace;
     Float maxComponentValue;
     bool writeFP16;
     Float filterIntegral;
     SquareMatrix<3> outputRGBFromSensorRGB;
+    SplatBuffer splatBuffer;
 };
 
+// Reads the reference image for MSE computations from _filename_ and returns
+// its pixels inside a film's _pixelBounds_.
+Image ReadMSEReferenceImage(const std::string &filename, Bounds2i pixelBounds);
+
 PBRT_CPU_GPU
 inline SampledWavelengths Film::SampleWavelengths(Float u) const {
     auto sample = [&](auto ptr) { return ptr->SampleWavelengths(u); };
@@ -440,6 +684,12 @@ inline RGB Film::GetPixelRGB(const Point2i &p, Float splatScale) const {
     return Dispatch(get);
 }
 
+PBRT_CPU_GPU
+inline Float Film::GetPixelRelativeError(const Point2i &p) const {
+    auto get = [&](auto ptr) { return ptr->GetPixelRelativeError(p); };
+    return Dispatch(get);
+}
+
 PBRT_CPU_GPU
 inline RGB Film::ToOutputRGB(const SampledSpectrum &L,
                              const SampledWavelengths &lambda) const {
@@ -18,6 +18,16 @@ std::string Filter::ToString() const {
     return DispatchCPU(ts);
 }
 
+// Returns true if the filter's "sampling" parameter selects alias sampling
+static bool useAliasSampling(const ParameterDictionary &parameters, const FileLoc *loc) {
+    std::string sampling = parameters.GetOneString("sampling", "inversion");
+    if (sampling != "inversion" && sampling != "alias")
+        ErrorExit(loc, "%s: unknown filter sampling method. Expected \"inversion\" or "
+                       "\"alias\".",
+                  sampling);
+    return sampling == "alias";
+}
+
 // Box Filter Method Definitions
 std::string BoxFilter::ToString() const {
     return StringPrintf("[ BoxFilter radius: %s ]", radius);
@@ -43,7 +53,8 @@ GaussianFilter *GaussianFilter::Create(const ParameterDictionary &parameters,
     Float xw = parameters.GetOneFloat("xradius", 1.5f);
     Float yw = parameters.GetOneFloat("yradius", 1.5f);
     Float sigma = parameters.GetOneFloat("sigma", 0.5f);  // equivalent to old alpha = 2
-    return alloc.new_object<GaussianFilter>(Vector2f(xw, yw), sigma, alloc);
+    return alloc.new_object<GaussianFilter>(Vector2f(xw, yw), sigma,
+                                            useAliasSampling(parameters, loc), alloc);
 }
 
 // Mitchell Filter Method Definitions
@@ -59,7 +70,8 @@ MitchellFilter *MitchellFilter::Create(const ParameterDictionary &parameters,
     Float yw = parameters.GetOneFloat("yradius", 2.f);
     Float B = parameters.GetOneFloat("B", 1.f / 3.f);
     Float C = parameters.GetOneFloat("C", 1.f / 3.f);
-    return alloc.new_object<MitchellFilter>(Vector2f(xw, yw), B, C, alloc);
+    return alloc.new_object<MitchellFilter>(Vector2f(xw, yw), B, C,
+                                            useAliasSampling(parameters, loc), alloc);
 }
 
 // Sinc Filter Method Definitions
@@ -90,7 +102,8 @@ LanczosSincFilter *LanczosSincFilter::Create(const ParameterDictionary &paramete
     Float xw = parameters.GetOneFloat("xradius", 4.);
     Float yw = parameters.GetOneFloat("yradius", 4.);
     Float tau = parameters.GetOneFloat("tau", 3.f);
-    return alloc.new_object<LanczosSincFilter>(Vector2f(xw, yw), tau, alloc);
+    return alloc.new_object<LanczosSincFilter>(Vector2f(xw, yw), tau,
+                                               useAliasSampling(parameters, loc), alloc);
 }
 
 // Triangle Filter Method Definitions
@@ -130,10 +143,11 @@ Filter Filter::Create(const std::string &name, const ParameterDictionary &parame
 }
 
 // FilterSampler Method Definitions
-FilterSampler::FilterSampler(Filter filter, Allocator alloc)
+FilterSampler::FilterSampler(Filter filter, bool aliasSampling, Allocator alloc)
     : domain(Point2f(-filter.Radius()), Point2f(filter.Radius())),
       f(int(32 * filter.Radius().x), int(32 * filter.Radius().y), alloc),
-      distrib(alloc) {
+      distrib(alloc),
+      aliasTable(alloc) {
     // Tabularize unnormalized filter function in _f_
     for (int y = 0; y < f.ySize(); ++y)
         for (int x = 0; x < f.xSize(); ++x) {
@@ -143,12 +157,18 @@ FilterSampler::FilterSampler(Filter filter, Allocator alloc)
         }
 
     // Compute sampling distribution for filter
-    distrib = PiecewiseConstant2D(f, domain, alloc);
+    if (aliasSampling) {
+        std::vector<Float> absF(f.begin(), f.end());
+        for (Float &v : absF)
+            v = std::abs(v);
+        aliasTable = AliasTable(absF, alloc);
+    } else
+        distrib = PiecewiseConstant2D(f, domain, alloc);
 }
 
 std::string FilterSampler::ToString() const {
-    return StringPrintf("[ FilterSampler domain: %s f: %s distrib: %s ]", domain, f,
-                        distrib);
+    return StringPrintf("[ FilterSampler domain: %s f: %s distrib: %s aliasTable: %s ]",
+                        domain, f, distrib, aliasTable);
 }
 
 }  // namespace pbrt
@@ -26,11 +26,26 @@ struct FilterSample {
 class FilterSampler {
   public:
     // FilterSampler Public Methods
-    FilterSampler(Filter filter, Allocator alloc = {});
+    // With _aliasSampling_, the tabularized filter is sampled in constant time
+    // using an alias table rather than by inverting its 2D distribution.
+    // Inversion maps well-distributed sample points to well-distributed filter
+    // offsets, while alias sampling doesn't, but it avoids the binary searches.
+    FilterSampler(Filter filter, bool aliasSampling = false, Allocator alloc = {});
     std::string ToString() const;
 
     PBRT_CPU_GPU
     FilterSample Sample(Point2f u) const {
+        if (aliasTable.size() > 0) {
+            // Sample a cell of the filter's table, then a point inside it
+            Float pmf, ux;
+            int index = aliasTable.Sample(u[0], &pmf, &ux);
+            Point2i pi(index % f.xSize(), index / f.xSize());
+            Point2f p = domain.Lerp(
+                Point2f((pi.x + ux) / f.xSize(), (pi.y + u[1]) / f.ySize()));
+            Float pdf = pmf * f.size() / domain.Area();
+            return {p, f[pi] / pdf};
+        }
+
         Float pdf;
         Point2i pi;
         Point2f p = distrib.Sample(u, &pdf, &pi);
@@ -42,6 +57,8 @@ class FilterSampler {
     Bounds2f domain;
     Array2D<Float> f;
     PiecewiseConstant2D distrib;
+    // Empty unless alias sampling is used
+    AliasTable aliasTable;
 };
 
 // BoxFilter Definition
@@ -80,12 +97,13 @@ class BoxFilter {
 class GaussianFilter {
   public:
     // GaussianFilter Public Methods
-    GaussianFilter(const Vector2f &radius, Float sigma = 0.5f, Allocator alloc = {})
+    GaussianFilter(const Vector2f &radius, Float sigma = 0.5f, bool aliasSampling = false,
+                   Allocator alloc = {})
         : radius(radius),
           sigma(sigma),
           expX(Gaussian(radius.x, 0, sigma)),
           expY(Gaussian(radius.y, 0, sigma)),
-          sampler(this, alloc) {}
+          sampler(this, aliasSampling, alloc) {}
 
     static GaussianFilter *Create(const ParameterDictionary &parameters,
                                   const FileLoc *loc, Allocator alloc);
@@ -122,8 +140,8 @@ class MitchellFilter {
   public:
     // MitchellFilter Public Methods
     MitchellFilter(const Vector2f &radius, Float b = 1.f / 3.f, Float c = 1.f / 3.f,
-                   Allocator alloc = {})
-        : radius(radius), b(b), c(c), sampler(this, alloc) {}
+                   bool aliasSampling = false, Allocator alloc = {})
+        : radius(radius), b(b), c(c), sampler(this, aliasSampling, alloc) {}
 
     static MitchellFilter *Create(const ParameterDictionary &parameters,
                                   const FileLoc *loc, Allocator alloc);
@@ -171,8 +189,9 @@ class MitchellFilter {
 class LanczosSincFilter {
   public:
     // LanczosSincFilter Public Methods
-    LanczosSincFilter(const Vector2f &radius, Float tau = 3.f, Allocator alloc = {})
-        : radius(radius), tau(tau), sampler(this, alloc) {}
+    LanczosSincFilter(const Vector2f &radius, Float tau = 3.f, bool aliasSampling = false,
+                      Allocator alloc = {})
+        : radius(radius), tau(tau), sampler(this, aliasSampling, alloc) {}
 
     static LanczosSincFilter *Create(const ParameterDictionary &parameters,
                                      const FileLoc *loc, Allocator alloc);
@@ -98,3 +98,27 @@ TEST(Filter, Integral) {
     for (Filter f : makeFilters(Vector2f(3.4, 2.5)))
         EXPECT_TRUE(approxEqual(f.Integral(), integrateFilter(f))) << f;
 }
+
+TEST(Filter, AliasSampling) {
+    // Both sampling methods' weights should average to the filter's integral
+    // and the samples should stay inside the filter's radius.
+    for (bool aliasSampling : {false, true}) {
+        Vector2f radius(1.5, 2.25);
+        std::vector<Filter> filters = {
+            new GaussianFilter(radius, 0.5f, aliasSampling),
+            new MitchellFilter(radius, 1.f / 3.f, 1.f / 3.f, aliasSampling),
+            new LanczosSincFilter(radius, 3.f, aliasSampling)};
+        for (Filter f : filters) {
+            double sum = 0;
+            int sqrtSamples = 128;
+            for (Point2f u : Stratified2D(sqrtSamples, sqrtSamples)) {
+                FilterSample fs = f.Sample(u);
+                EXPECT_LE(std::abs(fs.p.x), radius.x);
+                EXPECT_LE(std::abs(fs.p.y), radius.y);
+                sum += fs.weight;
+            }
+            Float estimate = sum / Sqr(sqrtSamples);
+            EXPECT_LT(std::abs(estimate - f.Integral()), 1e-2 * f.Integral()) << f;
+        }
+    }
+}
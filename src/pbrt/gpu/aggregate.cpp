@@ -8,7 +8,9 @@
 #include <pbrt/gpu/util.h>
 #include <pbrt/lights.h>
 #include <pbrt/materials.h>
+#include <pbrt/options.h>
 #include <pbrt/parsedscene.h>
+#include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
@@ -22,9 +24,11 @@
 
 #include <atomic>
 #include <mutex>
+#include <unordered_map>
 
 #include <optix.h>
 #include <optix_function_table_definition.h>
+#include <optix_stack_size.h>
 #include <optix_stubs.h>
 
 #ifdef NVTX
@@ -91,6 +95,7 @@ struct __align__(OPTIX_SBT_RECORD_ALIGNMENT) OptiXAggregate::HitgroupRecord {
         TriangleMeshRecord triRec;
         BilinearMeshRecord bilinearRec;
         QuadricRecord quadricRec;
+        CurveRecord curveRec;
     };
 };
 
@@ -99,60 +104,230 @@ extern const unsigned char PBRT_EMBEDDED_PTX[];
 }
 
 STAT_MEMORY_COUNTER("Memory/Acceleration structures", gpuBVHBytes);
-
-OptixTraversableHandle OptiXAggregate::buildBVH(
-    const std::vector<OptixBuildInput> &buildInputs) {
-    // Figure out memory requirements.
+STAT_MEMORY_COUNTER("Memory/Acceleration structures before compaction",
+                    gpuBVHUncompactedBytes);
+STAT_MEMORY_COUNTER("Memory/GAS build inputs prefetched", gpuBuildInputBytesPrefetched);
+STAT_COUNTER("Geometry/GAS builds", gpuGASBuilds);
+STAT_COUNTER("Geometry/Top-level IAS chunks", gpuIASChunks);
+STAT_INT_DISTRIBUTION("Geometry/Meshes per GAS build", gpuMeshesPerGAS);
+
+static OptixAccelBuildOptions AccelBuildOptions() {
     OptixAccelBuildOptions accelOptions = {};
     accelOptions.buildFlags =
         (OPTIX_BUILD_FLAG_ALLOW_COMPACTION | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE);
     accelOptions.motionOptions.numKeys = 1;
     accelOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
+    return accelOptions;
+}
 
-    OptixAccelBufferSizes blasBufferSizes;
-    OPTIX_CHECK(optixAccelComputeMemoryUsage(optixContext, &accelOptions,
-                                             buildInputs.data(), buildInputs.size(),
-                                             &blasBufferSizes));
+// pbrt's curves are cubic Beziers, which OptiX supports directly starting
+// with 7.7; before that, they are converted to the equivalent B-splines.
+#if (OPTIX_VERSION >= 70700)
+static constexpr OptixPrimitiveType CurvePrimitiveType =
+    OPTIX_PRIMITIVE_TYPE_ROUND_CUBIC_BEZIER;
+static constexpr unsigned int CurvePrimitiveTypeFlags =
+    OPTIX_PRIMITIVE_TYPE_FLAGS_ROUND_CUBIC_BEZIER;
+#else
+static constexpr OptixPrimitiveType CurvePrimitiveType =
+    OPTIX_PRIMITIVE_TYPE_ROUND_CUBIC_BSPLINE;
+static constexpr unsigned int CurvePrimitiveTypeFlags =
+    OPTIX_PRIMITIVE_TYPE_FLAGS_ROUND_CUBIC_BSPLINE;
+#endif
 
-    uint64_t *compactedSizeBufferPtr = alloc.new_object<uint64_t>();
+OptiXAggregate::PendingBuild OptiXAggregate::launchBuild(
+    const OptixBuildInput *buildInputs, int nBuildInputs, CUstream stream) {
+    // Figure out memory requirements.
+    OptixAccelBuildOptions accelOptions = AccelBuildOptions();
+    OptixAccelBufferSizes blasBufferSizes;
+    OPTIX_CHECK(optixAccelComputeMemoryUsage(optixContext, &accelOptions, buildInputs,
+                                             nBuildInputs, &blasBufferSizes));
+
+    PendingBuild build;
+    build.stream = stream;
+    build.nBuildInputs = nBuildInputs;
+    build.outputBytes = blasBufferSizes.outputSizeInBytes;
+
+    // The compacted size is copied back to pinned host memory on the build's
+    // stream so that it can be read without waiting on other streams.
+    CUDA_CHECK(cudaMalloc(&build.compactedSizeDevice, sizeof(uint64_t)));
+    CUDA_CHECK(cudaMallocHost(&build.compactedSize, sizeof(uint64_t)));
     OptixAccelEmitDesc emitDesc;
     emitDesc.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
-    emitDesc.result = (CUdeviceptr)compactedSizeBufferPtr;
+    emitDesc.result = (CUdeviceptr)build.compactedSizeDevice;
 
     // Allocate buffers.
-    void *tempBuffer;
-    CUDA_CHECK(cudaMalloc(&tempBuffer, blasBufferSizes.tempSizeInBytes));
-    void *outputBuffer;
-    CUDA_CHECK(cudaMalloc(&outputBuffer, blasBufferSizes.outputSizeInBytes));
+    CUDA_CHECK(cudaMalloc(&build.tempBuffer, blasBufferSizes.tempSizeInBytes));
+    CUDA_CHECK(cudaMalloc(&build.outputBuffer, blasBufferSizes.outputSizeInBytes));
 
     // Build.
-    OptixTraversableHandle traversableHandle{0};
+    build.handle = 0;
     OPTIX_CHECK(optixAccelBuild(
-        optixContext, cudaStream, &accelOptions, buildInputs.data(), buildInputs.size(),
-        CUdeviceptr(tempBuffer), blasBufferSizes.tempSizeInBytes,
-        CUdeviceptr(outputBuffer), blasBufferSizes.outputSizeInBytes, &traversableHandle,
-        &emitDesc, 1));
-
-    CUDA_CHECK(cudaDeviceSynchronize());
+        optixContext, stream, &accelOptions, buildInputs, nBuildInputs,
+        CUdeviceptr(build.tempBuffer), blasBufferSizes.tempSizeInBytes,
+        CUdeviceptr(build.outputBuffer), blasBufferSizes.outputSizeInBytes,
+        &build.handle, &emitDesc, 1));
+    CUDA_CHECK(cudaMemcpyAsync(build.compactedSize, build.compactedSizeDevice,
+                               sizeof(uint64_t), cudaMemcpyDeviceToHost, stream));
+
+    return build;
+}
 
-    gpuBVHBytes += *compactedSizeBufferPtr;
+OptixTraversableHandle OptiXAggregate::finishBuild(PendingBuild &build) {
+    CUDA_CHECK(cudaStreamSynchronize(build.stream));
+    CUDA_CHECK(cudaFree(build.tempBuffer));
+    CUDA_CHECK(cudaFree(build.compactedSizeDevice));
+
+    uint64_t compactedSize = *build.compactedSize;
+    CUDA_CHECK(cudaFreeHost(build.compactedSize));
+    gpuBVHUncompactedBytes += build.outputBytes;
+    LOG_VERBOSE("Acceleration structure for %d build inputs: %d bytes (%d compacted)",
+                build.nBuildInputs, build.outputBytes, compactedSize);
+
+    if (compactedSize >= build.outputBytes) {
+        // Keep uncompacted acceleration structure if compaction doesn't help
+        gpuBVHBytes += build.outputBytes;
+        return build.handle;
+    }
 
     // Compact
+    gpuBVHBytes += compactedSize;
     void *asBuffer;
-    CUDA_CHECK(cudaMalloc(&asBuffer, *compactedSizeBufferPtr));
+    CUDA_CHECK(cudaMalloc(&asBuffer, compactedSize));
 
-    OPTIX_CHECK(optixAccelCompact(optixContext, cudaStream, traversableHandle,
-                                  CUdeviceptr(asBuffer), *compactedSizeBufferPtr,
+    OptixTraversableHandle traversableHandle;
+    OPTIX_CHECK(optixAccelCompact(optixContext, build.stream, build.handle,
+                                  CUdeviceptr(asBuffer), compactedSize,
                                   &traversableHandle));
-    CUDA_CHECK(cudaDeviceSynchronize());
+    CUDA_CHECK(cudaStreamSynchronize(build.stream));
 
-    CUDA_CHECK(cudaFree(tempBuffer));
-    CUDA_CHECK(cudaFree(outputBuffer));
-    alloc.delete_object(compactedSizeBufferPtr);
+    CUDA_CHECK(cudaFree(build.outputBuffer));
 
     return traversableHandle;
 }
 
+OptixTraversableHandle OptiXAggregate::buildBVH(const OptixBuildInput *buildInputs,
+                                                int nBuildInputs) {
+    PendingBuild build = launchBuild(buildInputs, nBuildInputs, cudaStream);
+    return finishBuild(build);
+}
+
+void OptiXAggregate::prefetchBuildInput(const OptixBuildInput &input,
+                                        CUstream stream) const {
+    if (!prefetchBuildInputs)
+        return;
+    auto prefetch = [&](CUdeviceptr ptr, size_t bytes) {
+        if (!ptr || bytes == 0)
+            return;
+        // Buffers that aren't in managed memory can't be prefetched; that's
+        // fine since they're already wherever the build will read them from.
+        if (cudaMemPrefetchAsync((const void *)ptr, bytes, gpuDevice, stream) ==
+            cudaSuccess)
+            gpuBuildInputBytesPrefetched += bytes;
+        else
+            (void)cudaGetLastError();
+    };
+
+    if (input.type == OPTIX_BUILD_INPUT_TYPE_TRIANGLES) {
+        const OptixBuildInputTriangleArray &tris = input.triangleArray;
+        prefetch(tris.vertexBuffers[0],
+                 size_t(tris.numVertices) * tris.vertexStrideInBytes);
+        prefetch(tris.indexBuffer,
+                 size_t(tris.numIndexTriplets) * tris.indexStrideInBytes);
+    } else if (input.type == OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES) {
+        const OptixBuildInputCustomPrimitiveArray &custom = input.customPrimitiveArray;
+        prefetch(custom.aabbBuffers[0], size_t(custom.numPrimitives) * sizeof(OptixAabb));
+    } else if (input.type == OPTIX_BUILD_INPUT_TYPE_CURVES) {
+        const OptixBuildInputCurveArray &curves = input.curveArray;
+        prefetch(curves.vertexBuffers[0],
+                 size_t(curves.numVertices) * curves.vertexStrideInBytes);
+        prefetch(curves.widthBuffers[0], size_t(curves.numVertices) * sizeof(float));
+        prefetch(curves.indexBuffer, size_t(curves.numPrimitives) * sizeof(unsigned int));
+    }
+}
+
+// Returns true if none of the build input's geometry runs any-hit programs
+static bool buildInputIsOpaque(const OptixBuildInput &input) {
+    unsigned int flags = 0;
+    if (input.type == OPTIX_BUILD_INPUT_TYPE_TRIANGLES)
+        flags = input.triangleArray.flags[0];
+    else if (input.type == OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES)
+        flags = input.customPrimitiveArray.flags[0];
+    else if (input.type == OPTIX_BUILD_INPUT_TYPE_CURVES)
+        flags = input.curveArray.flag;
+    return flags & OPTIX_GEOMETRY_FLAG_DISABLE_ANYHIT;
+}
+
+std::vector<OptiXAggregate::GAS> OptiXAggregate::buildGAS(
+    const std::vector<OptixBuildInput> &buildInputs) {
+    // Find each build input's memory requirements; if they don't all fit in the
+    // budget, split the inputs into batches that each fit in one build stream's
+    // share of it. Opaque and alpha-tested inputs also always go into separate
+    // GASs so that shadow rays can skip the latter's any-hit programs.
+    OptixAccelBuildOptions accelOptions = AccelBuildOptions();
+    std::vector<size_t> inputBytes(buildInputs.size());
+    size_t totalBytes = 0;
+    for (int i = 0; i < buildInputs.size(); ++i) {
+        OptixAccelBufferSizes sizes;
+        OPTIX_CHECK(optixAccelComputeMemoryUsage(optixContext, &accelOptions,
+                                                 &buildInputs[i], 1, &sizes));
+        inputBytes[i] = sizes.tempSizeInBytes + sizes.outputSizeInBytes;
+        totalBytes += inputBytes[i];
+    }
+    size_t batchBudget = totalBytes <= gasBuildMemoryBudget
+                             ? gasBuildMemoryBudget
+                             : gasBuildMemoryBudget / buildStreams.size();
+
+    // Launch batches round-robin over the build streams, prefetching each
+    // batch's mesh data to the GPU on its stream first. Uploads and builds on
+    // different streams overlap while the CPU moves on to the next batch; a
+    // stream's previous batch is compacted before the stream is reused, so at
+    // most one batch per stream holds uncompacted build memory.
+    std::vector<GAS> gas;
+    std::vector<PendingBuild> pending(buildStreams.size());
+    std::vector<int> pendingGAS(buildStreams.size(), -1);
+    int nextStream = 0;
+    auto finishStream = [&](int s) {
+        if (pendingGAS[s] != -1)
+            gas[pendingGAS[s]].handle = finishBuild(pending[s]);
+        pendingGAS[s] = -1;
+    };
+
+    int batchStart = 0;
+    size_t batchBytes = 0;
+    auto buildBatch = [&](int batchEnd) {
+        int s = nextStream;
+        nextStream = (nextStream + 1) % buildStreams.size();
+        finishStream(s);
+
+        for (int i = batchStart; i < batchEnd; ++i)
+            prefetchBuildInput(buildInputs[i], buildStreams[s]);
+        pending[s] =
+            launchBuild(&buildInputs[batchStart], batchEnd - batchStart, buildStreams[s]);
+        pendingGAS[s] = gas.size();
+        gas.push_back(GAS{0, batchStart, buildInputIsOpaque(buildInputs[batchStart])});
+        ++gpuGASBuilds;
+        gpuMeshesPerGAS << batchEnd - batchStart;
+    };
+    for (int i = 0; i < buildInputs.size(); ++i) {
+        if (i > batchStart && (batchBytes + inputBytes[i] > batchBudget ||
+                               buildInputIsOpaque(buildInputs[i]) !=
+                                   buildInputIsOpaque(buildInputs[batchStart]))) {
+            buildBatch(i);
+            batchStart = i;
+            batchBytes = 0;
+        }
+        if (inputBytes[i] > batchBudget)
+            LOG_VERBOSE("Build input needs %d bytes, more than the %d byte budget",
+                        inputBytes[i], batchBudget);
+        batchBytes += inputBytes[i];
+    }
+    buildBatch(buildInputs.size());
+
+    for (int s = 0; s < buildStreams.size(); ++s)
+        finishStream(s);
+    return gas;
+}
+
 static Material getMaterial(
     const ShapeSceneEntity &shape,
     const std::map<std::string, Material> &namedMaterials,
@@ -230,7 +405,7 @@ static MediumInterface *getMediumInterface(
                                              getMedium(shape.outsideMedium));
 }
 
-OptixTraversableHandle OptiXAggregate::createGASForTriangles(
+std::vector<OptiXAggregate::GAS> OptiXAggregate::createGASForTriangles(
     const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
     const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
     const std::map<std::string, FloatTexture> &floatTextures,
@@ -368,8 +543,7 @@ OptixTraversableHandle OptiXAggregate::createGASForTriangles(
         OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
         hgRecord.triRec.mesh = mesh;
         hgRecord.triRec.material = material;
-        hgRecord.triRec.alphaTexture = alphaTexture;
-        hgRecord.triRec.areaLights = {};
+        hgRecord.triRec.areaLights = nullptr;
         if (shape.lightIndex != -1) {
             if (!material)
                 Warning(&shape.loc, "Ignoring area light specification for shape with \"interface\" material.");
@@ -379,7 +553,7 @@ OptixTraversableHandle OptiXAggregate::createGASForTriangles(
                 auto iter = shapeIndexToAreaLights.find(shapeIndex);
                 CHECK(iter != shapeIndexToAreaLights.end());
                 CHECK_EQ(iter->second->size(), mesh->nTriangles);
-                hgRecord.triRec.areaLights = pstd::MakeSpan(*iter->second);
+                hgRecord.triRec.areaLights = iter->second->data();
             }
         }
         hgRecord.triRec.mediumInterface = getMediumInterface(shape, media, alloc);
@@ -387,6 +561,7 @@ OptixTraversableHandle OptiXAggregate::createGASForTriangles(
         *gasBounds = Union(*gasBounds, meshBounds[shapeIndex]);
 
         intersectHGRecords.push_back(hgRecord);
+        hitgroupAlphaTextures.push_back(alphaTexture);
 
         OPTIX_CHECK(optixSbtRecordPackHeader(randomHitPG, &hgRecord));
         randomHitHGRecords.push_back(hgRecord);
@@ -400,10 +575,10 @@ OptixTraversableHandle OptiXAggregate::createGASForTriangles(
     if (buildInputs.empty())
         return {};
 
-    return buildBVH(buildInputs);
+    return buildGAS(buildInputs);
 }
 
-OptixTraversableHandle OptiXAggregate::createGASForBLPs(
+std::vector<OptiXAggregate::GAS> OptiXAggregate::createGASForBLPs(
     const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
     const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
     const std::map<std::string, FloatTexture> &floatTextures,
@@ -453,8 +628,7 @@ OptixTraversableHandle OptiXAggregate::createGASForBLPs(
         OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
         hgRecord.bilinearRec.mesh = mesh;
         hgRecord.bilinearRec.material = material;
-        hgRecord.bilinearRec.alphaTexture = alphaTexture;
-        hgRecord.bilinearRec.areaLights = {};
+        hgRecord.bilinearRec.areaLights = nullptr;
         if (shape.lightIndex != -1) {
             if (!material)
                 Warning(&shape.loc, "Ignoring area light specification for shape with \"interface\" material.");
@@ -464,12 +638,13 @@ OptixTraversableHandle OptiXAggregate::createGASForBLPs(
                 // light.
                 CHECK(iter != shapeIndexToAreaLights.end());
                 CHECK_EQ(iter->second->size(), mesh->nPatches);
-                hgRecord.bilinearRec.areaLights = pstd::MakeSpan(*iter->second);
+                hgRecord.bilinearRec.areaLights = iter->second->data();
             }
         }
         hgRecord.bilinearRec.mediumInterface = getMediumInterface(shape, media, alloc);
 
         intersectHGRecords.push_back(hgRecord);
+        hitgroupAlphaTextures.push_back(alphaTexture);
 
         OPTIX_CHECK(optixSbtRecordPackHeader(randomHitPG, &hgRecord));
         randomHitHGRecords.push_back(hgRecord);
@@ -490,10 +665,10 @@ OptixTraversableHandle OptiXAggregate::createGASForBLPs(
         buildInputs[i].customPrimitiveArray.flags = &flags[i];
     }
 
-    return buildBVH(buildInputs);
+    return buildGAS(buildInputs);
 }
 
-OptixTraversableHandle OptiXAggregate::createGASForQuadrics(
+std::vector<OptiXAggregate::GAS> OptiXAggregate::createGASForQuadrics(
     const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
     const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
     const std::map<std::string, FloatTexture> &floatTextures,
@@ -546,7 +721,6 @@ OptixTraversableHandle OptiXAggregate::createGASForQuadrics(
         OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
         hgRecord.quadricRec.shape = shape;
         hgRecord.quadricRec.material = material;
-        hgRecord.quadricRec.alphaTexture = alphaTexture;
         hgRecord.quadricRec.areaLight = nullptr;
         if (s.lightIndex != -1) {
             if (!material)
@@ -563,6 +737,7 @@ OptixTraversableHandle OptiXAggregate::createGASForQuadrics(
         hgRecord.quadricRec.mediumInterface = getMediumInterface(s, media, alloc);
 
         intersectHGRecords.push_back(hgRecord);
+        hitgroupAlphaTextures.push_back(alphaTexture);
 
         OPTIX_CHECK(optixSbtRecordPackHeader(randomHitPG, &hgRecord));
         randomHitHGRecords.push_back(hgRecord);
@@ -583,7 +758,141 @@ OptixTraversableHandle OptiXAggregate::createGASForQuadrics(
         buildInputs[i].customPrimitiveArray.flags = &flags[i];
     }
 
-    return buildBVH(buildInputs);
+    return buildGAS(buildInputs);
+}
+
+std::vector<OptiXAggregate::GAS> OptiXAggregate::createGASForCurves(
+    const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
+    const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
+    const std::map<std::string, FloatTexture> &floatTextures,
+    const std::map<std::string, Material> &namedMaterials,
+    const std::vector<Material> &materials,
+    const std::map<std::string, Medium> &media, Bounds3f *gasBounds) {
+    std::vector<OptixBuildInput> buildInputs;
+    // Control points, radii, and the index of each segment's first control
+    // point for each build input; the inner vectors aren't resized once
+    // filled, so pointers to their data stay valid
+    std::vector<pstd::vector<float3>> vertices;
+    std::vector<pstd::vector<float>> radii;
+    std::vector<pstd::vector<unsigned int>> indices;
+    std::vector<CUdeviceptr> vertexPtrs, radiusPtrs;
+    std::vector<unsigned int> flags;
+    buildInputs.reserve(shapes.size());
+    vertices.reserve(shapes.size());
+    radii.reserve(shapes.size());
+    indices.reserve(shapes.size());
+    vertexPtrs.reserve(shapes.size());
+    radiusPtrs.reserve(shapes.size());
+    flags.reserve(shapes.size());
+
+    int nRibbonWarnings = 0;
+    for (size_t shapeIndex = 0; shapeIndex < shapes.size(); ++shapeIndex) {
+        const auto &s = shapes[shapeIndex];
+        if (s.name != "curve")
+            continue;
+
+        pstd::vector<Shape> segments =
+            Shape::Create(s.name, s.renderFromObject, s.objectFromRender,
+                          s.reverseOrientation, s.parameters, &s.loc, alloc);
+        if (segments.empty())
+            continue;
+        // OptiX's round curves don't have an orientation to give ribbons
+        if (segments[0].Cast<Curve>()->Type() == CurveType::Ribbon) {
+            if (++nRibbonWarnings < 10)
+                Warning(&s.loc, "\"ribbon\" curves are not yet supported on the GPU.");
+            else if (nRibbonWarnings == 10)
+                Warning(&s.loc, "\"ribbon\" curves are not yet supported on the GPU. "
+                                "(Silencing further warnings.)");
+            continue;
+        }
+        if (s.lightIndex != -1)
+            Warning(&s.loc, "Ignoring area light specification for \"curve\" shape.");
+
+        // Copy the segments to an array that is indexed by primitive index
+        Curve *curves = alloc.allocate_object<Curve>(segments.size());
+        vertices.push_back(pstd::vector<float3>(alloc));
+        radii.push_back(pstd::vector<float>(alloc));
+        indices.push_back(pstd::vector<unsigned int>(alloc));
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const Curve *curve = segments[i].Cast<Curve>();
+            alloc.construct(&curves[i], *curve);
+            *gasBounds = Union(*gasBounds, curve->Bounds());
+
+            pstd::array<Point3f, 4> cp;
+            Float width[2];
+            curve->RenderSpaceSegment(&cp, width);
+            // Radii over the segment in the same basis as the control points
+            Float r[4] = {width[0] / 2, (2 * width[0] + width[1]) / 6,
+                          (width[0] + 2 * width[1]) / 6, width[1] / 2};
+#if (OPTIX_VERSION < 70700)
+            auto toBSpline = [](auto b, auto *q) {
+                q[0] = 6 * b[0] - 7 * b[1] + 2 * b[2];
+                q[1] = 2 * b[1] - b[2];
+                q[2] = 2 * b[2] - b[1];
+                q[3] = 2 * b[1] - 7 * b[2] + 6 * b[3];
+            };
+            Vector3f bv[4] = {Vector3f(cp[0]), Vector3f(cp[1]), Vector3f(cp[2]),
+                              Vector3f(cp[3])};
+            Vector3f qv[4];
+            toBSpline(bv, qv);
+            Float qr[4];
+            toBSpline(r, qr);
+            for (int j = 0; j < 4; ++j) {
+                cp[j] = Point3f(qv[j]);
+                // The B-spline radii of strongly tapered segments may be negative
+                r[j] = std::max<Float>(0, qr[j]);
+            }
+#endif
+            indices.back().push_back(vertices.back().size());
+            for (int j = 0; j < 4; ++j) {
+                vertices.back().push_back(
+                    float3{float(cp[j].x), float(cp[j].y), float(cp[j].z)});
+                radii.back().push_back(r[j]);
+            }
+        }
+        vertexPtrs.push_back(CUdeviceptr(vertices.back().data()));
+        radiusPtrs.push_back(CUdeviceptr(radii.back().data()));
+
+        Material material = getMaterial(s, namedMaterials, materials);
+        FloatTexture alphaTexture = getAlphaTexture(s, floatTextures, alloc);
+        // Curves use OptiX's intersection programs, like triangles do
+        flags.push_back(getOptixGeometryFlags(true, alphaTexture, material));
+
+        OptixBuildInput input = {};
+        input.type = OPTIX_BUILD_INPUT_TYPE_CURVES;
+        input.curveArray.curveType = CurvePrimitiveType;
+        input.curveArray.numPrimitives = segments.size();
+        input.curveArray.vertexBuffers = &vertexPtrs.back();
+        input.curveArray.numVertices = vertices.back().size();
+        input.curveArray.vertexStrideInBytes = sizeof(float3);
+        input.curveArray.widthBuffers = &radiusPtrs.back();
+        input.curveArray.widthStrideInBytes = sizeof(float);
+        input.curveArray.indexBuffer = CUdeviceptr(indices.back().data());
+        input.curveArray.indexStrideInBytes = sizeof(unsigned int);
+        input.curveArray.flag = flags.back();
+        input.curveArray.primitiveIndexOffset = 0;
+        buildInputs.push_back(input);
+
+        HitgroupRecord hgRecord;
+        OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
+        hgRecord.curveRec.segments = curves;
+        hgRecord.curveRec.material = material;
+        hgRecord.curveRec.mediumInterface = getMediumInterface(s, media, alloc);
+
+        intersectHGRecords.push_back(hgRecord);
+        hitgroupAlphaTextures.push_back(alphaTexture);
+
+        OPTIX_CHECK(optixSbtRecordPackHeader(randomHitPG, &hgRecord));
+        randomHitHGRecords.push_back(hgRecord);
+
+        OPTIX_CHECK(optixSbtRecordPackHeader(shadowPG, &hgRecord));
+        shadowHGRecords.push_back(hgRecord);
+    }
+
+    if (buildInputs.empty())
+        return {};
+
+    return buildGAS(buildInputs);
 }
 
 static void logCallback(unsigned int level, const char* tag, const char* message, void* cbdata) {
@@ -603,7 +912,8 @@ OptiXAggregate::OptiXAggregate(
       cudaStream(nullptr),
       intersectHGRecords(alloc),
       shadowHGRecords(alloc),
-      randomHitHGRecords(alloc) {
+      randomHitHGRecords(alloc),
+      hitgroupAlphaTextures(alloc) {
     CUcontext cudaContext;
     CU_CHECK(cuCtxGetCurrent(&cudaContext));
     CHECK(cudaContext != nullptr);
@@ -635,6 +945,26 @@ OptiXAggregate::OptiXAggregate(
     LOG_VERBOSE("Optix version %d.%d.%d successfully initialized", OPTIX_VERSION / 10000,
                 (OPTIX_VERSION % 10000) / 100, OPTIX_VERSION % 100);
 
+    // Set memory budget for building each batch of geometry acceleration structures
+    if (Options->gpuBuildMemory)
+        gasBuildMemoryBudget = size_t(*Options->gpuBuildMemory) * 1024 * 1024;
+    else {
+        size_t freeBytes, totalBytes;
+        CUDA_CHECK(cudaMemGetInfo(&freeBytes, &totalBytes));
+        gasBuildMemoryBudget = freeBytes / 2;
+    }
+    LOG_VERBOSE("GAS build memory budget %d MB", gasBuildMemoryBudget / (1024 * 1024));
+
+    // Create the streams that GAS builds and their input uploads are issued on
+    buildStreams.resize(4);
+    for (CUstream &stream : buildStreams)
+        CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+    CUDA_CHECK(cudaGetDevice(&gpuDevice));
+    int concurrentManagedAccess;
+    CUDA_CHECK(cudaDeviceGetAttribute(&concurrentManagedAccess,
+                                      cudaDevAttrConcurrentManagedAccess, gpuDevice));
+    prefetchBuildInputs = concurrentManagedAccess != 0;
+
     // OptiX module
     OptixModuleCompileOptions moduleCompileOptions = {};
     // TODO: REVIEW THIS
@@ -650,6 +980,9 @@ OptiXAggregate::OptiXAggregate(
     OptixPipelineCompileOptions pipelineCompileOptions = {};
     pipelineCompileOptions.traversableGraphFlags = OPTIX_TRAVERSABLE_GRAPH_FLAG_ALLOW_ANY;
     pipelineCompileOptions.usesMotionBlur = false;
+    pipelineCompileOptions.usesPrimitiveTypeFlags =
+        OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE | OPTIX_PRIMITIVE_TYPE_FLAGS_CUSTOM |
+        CurvePrimitiveTypeFlags;
     pipelineCompileOptions.numPayloadValues = 3;
     pipelineCompileOptions.numAttributeValues = 4;
     // OPTIX_EXCEPTION_FLAG_NONE;
@@ -891,6 +1224,58 @@ OptiXAggregate::OptiXAggregate(
         LOG_VERBOSE("%s", log);
     }
 
+    // Curves are intersected by OptiX's built-in intersection program
+    OptixModule curveModule;
+    {
+        OptixBuiltinISOptions builtinISOptions = {};
+        builtinISOptions.builtinISModuleType = CurvePrimitiveType;
+        builtinISOptions.usesMotionBlur = false;
+        OPTIX_CHECK(optixBuiltinISModuleGet(optixContext, &moduleCompileOptions,
+                                            &pipelineCompileOptions, &builtinISOptions,
+                                            &curveModule));
+    }
+
+    OptixProgramGroup hitPGCurve;
+    {
+        OptixProgramGroupDesc desc = {};
+        desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        desc.hitgroup.moduleIS = curveModule;
+        desc.hitgroup.moduleCH = optixModule;
+        desc.hitgroup.entryFunctionNameCH = "__closesthit__curve";
+        desc.hitgroup.moduleAH = optixModule;
+        desc.hitgroup.entryFunctionNameAH = "__anyhit__curve";
+        OPTIX_CHECK_WITH_LOG(optixProgramGroupCreate(optixContext, &desc, 1, &pgOptions,
+                                                     log, &logSize, &hitPGCurve),
+                             log);
+        LOG_VERBOSE("%s", log);
+    }
+
+    OptixProgramGroup anyhitPGShadowCurve;
+    {
+        OptixProgramGroupDesc desc = {};
+        desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        desc.hitgroup.moduleIS = curveModule;
+        desc.hitgroup.moduleAH = optixModule;
+        desc.hitgroup.entryFunctionNameAH = "__anyhit__shadowCurve";
+        OPTIX_CHECK_WITH_LOG(optixProgramGroupCreate(optixContext, &desc, 1, &pgOptions,
+                                                     log, &logSize, &anyhitPGShadowCurve),
+                             log);
+        LOG_VERBOSE("%s", log);
+    }
+
+    OptixProgramGroup hitPGRandomHitCurve;
+    {
+        OptixProgramGroupDesc desc = {};
+        desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        desc.hitgroup.moduleIS = curveModule;
+        desc.hitgroup.moduleCH = optixModule;
+        desc.hitgroup.entryFunctionNameCH = "__closesthit__randomHitCurve";
+        OPTIX_CHECK_WITH_LOG(optixProgramGroupCreate(optixContext, &desc, 1, &pgOptions,
+                                                     log, &logSize, &hitPGRandomHitCurve),
+                             log);
+        LOG_VERBOSE("%s", log);
+    }
+
     // Optix pipeline...
     OptixProgramGroup allPGs[] = {raygenPGClosest,
                                   missPGNoOp,
@@ -907,7 +1292,10 @@ OptiXAggregate::OptiXAggregate(
                                   raygenPGRandomHit,
                                   hitPGRandomHitTriangle,
                                   hitPGRandomHitBilinearPatch,
-                                  hitPGRandomHitQuadric};
+                                  hitPGRandomHitQuadric,
+                                  hitPGCurve,
+                                  anyhitPGShadowCurve,
+                                  hitPGRandomHitCurve};
     OPTIX_CHECK_WITH_LOG(
         optixPipelineCreate(optixContext, &pipelineCompileOptions, &pipelineLinkOptions,
                             allPGs, sizeof(allPGs) / sizeof(allPGs[0]), log, &logSize,
@@ -915,6 +1303,22 @@ OptiXAggregate::OptiXAggregate(
         log);
     LOG_VERBOSE("%s", log);
 
+    // Compute the pipeline's stack sizes, which are needed if instances are
+    // nested more deeply than the default allows for
+    OptixStackSizes stackSizes = {};
+    for (OptixProgramGroup pg : allPGs)
+#if (OPTIX_VERSION >= 80000)
+        OPTIX_CHECK(optixUtilAccumulateStackSizes(pg, &stackSizes, optixPipeline));
+#else
+        OPTIX_CHECK(optixUtilAccumulateStackSizes(pg, &stackSizes));
+#endif
+    unsigned int directCallableStackSizeFromTraversal, directCallableStackSizeFromState;
+    unsigned int continuationStackSize;
+    OPTIX_CHECK(optixUtilComputeStackSizes(
+        &stackSizes, pipelineLinkOptions.maxTraceDepth, 0 /* continuation callables */,
+        0 /* direct callables */, &directCallableStackSizeFromTraversal,
+        &directCallableStackSizeFromState, &continuationStackSize));
+
 #if 0
     OPTIX_CHECK(optixPipelineSetStackSize(
         optixPipeline,
@@ -971,108 +1375,190 @@ OptiXAggregate::OptiXAggregate(
     LOG_VERBOSE("Finished OptiX initialization");
 
     LOG_VERBOSE("Starting to create shapes and acceleration structures");
-    int nCurveWarnings = 0;
     for (const auto &shape : scene.shapes)
         if (shape.name != "sphere" && shape.name != "cylinder" && shape.name != "disk" &&
             shape.name != "trianglemesh" && shape.name != "plymesh" &&
-            shape.name != "loopsubdiv" && shape.name != "bilinearmesh") {
-            if (shape.name == "curve") {
-                if (++nCurveWarnings < 10)
-                    Warning(&shape.loc, "\"curve\" shape is not yet supported on the GPU.");
-                else if (nCurveWarnings == 10)
-                    Warning(&shape.loc, "\"curve\" shape is not yet supported on the GPU. (Silencing further warnings.) ");
-            } else
-                ErrorExit(&shape.loc, "%s: unknown shape", shape.name);
-        }
+            shape.name != "loopsubdiv" && shape.name != "bilinearmesh" &&
+            shape.name != "curve")
+            ErrorExit(&shape.loc, "%s: unknown shape", shape.name);
 
-    OptixTraversableHandle triangleGASTraversable = createGASForTriangles(
+    std::vector<GAS> triangleGAS = createGASForTriangles(
         scene.shapes, hitPGTriangle, anyhitPGShadowTriangle, hitPGRandomHitTriangle,
         textures.floatTextures, namedMaterials, materials, media, shapeIndexToAreaLights, &bounds);
     int bilinearSBTOffset = intersectHGRecords.size();
-    OptixTraversableHandle bilinearPatchGASTraversable =
+    std::vector<GAS> bilinearPatchGAS =
         createGASForBLPs(scene.shapes, hitPGBilinearPatch, anyhitPGShadowBilinearPatch,
                          hitPGRandomHitBilinearPatch, textures.floatTextures, namedMaterials,
                          materials, media, shapeIndexToAreaLights, &bounds);
     int quadricSBTOffset = intersectHGRecords.size();
-    OptixTraversableHandle quadricGASTraversable = createGASForQuadrics(
+    std::vector<GAS> quadricGAS = createGASForQuadrics(
         scene.shapes, hitPGQuadric, anyhitPGShadowQuadric, hitPGRandomHitQuadric,
         textures.floatTextures, namedMaterials, materials, media, shapeIndexToAreaLights, &bounds);
+    int curveSBTOffset = intersectHGRecords.size();
+    std::vector<GAS> curveGAS =
+        createGASForCurves(scene.shapes, hitPGCurve, anyhitPGShadowCurve,
+                           hitPGRandomHitCurve, textures.floatTextures, namedMaterials,
+                           materials, media, &bounds);
+
+    // Traversable graph depth: a top-level IAS over GASs
+    int graphDepth = 2;
+
+    // Top-level instances are built into an IAS of their own whenever there are
+    // more of them than one IAS can hold or than fit in the build memory
+    // budget; the root IAS then instances those.
+    unsigned int maxInstancesPerIAS;
+    OPTIX_CHECK(optixDeviceContextGetProperty(
+        optixContext, OPTIX_DEVICE_PROPERTY_LIMIT_MAX_INSTANCES_PER_IAS,
+        &maxInstancesPerIAS, sizeof(maxInstancesPerIAS)));
+    size_t chunkInstances;
+    {
+        OptixBuildInput sizeInput = {};
+        sizeInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+        sizeInput.instanceArray.numInstances = 1 << 20;
+        OptixAccelBuildOptions accelOptions = AccelBuildOptions();
+        OptixAccelBufferSizes sizes;
+        OPTIX_CHECK(optixAccelComputeMemoryUsage(optixContext, &accelOptions, &sizeInput,
+                                                 1, &sizes));
+        size_t instanceBytes = (sizes.tempSizeInBytes + sizes.outputSizeInBytes) /
+                                   sizeInput.instanceArray.numInstances +
+                               sizeof(OptixInstance);
+        chunkInstances = std::max<size_t>(1, gasBuildMemoryBudget / instanceBytes);
+        chunkInstances = std::min<size_t>(chunkInstances, maxInstancesPerIAS);
+    }
 
     pstd::vector<OptixInstance> iasInstances(alloc);
+    pstd::vector<OptixInstance> chunkIASInstances(alloc);
+    auto buildIAS = [&](const pstd::vector<OptixInstance> &instances) {
+        OptixBuildInput buildInput = {};
+        buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
+        buildInput.instanceArray.instances = CUdeviceptr(instances.data());
+        buildInput.instanceArray.numInstances = instances.size();
+        return buildBVH(&buildInput, 1);
+    };
+    // Returns an instance of _handle_ with the identity transformation.
+    // Instances of a single GAS are tagged as opaque or alpha-tested; those of
+    // IASs are visible to all rays and leave that to the instances they hold.
+    enum class InstanceGeometry { Opaque, AlphaTested, Mixed };
+    auto identityInstance = [&](OptixTraversableHandle handle, int sbtOffset,
+                                InstanceGeometry geometry) {
+        OptixInstance instance = {};
+        float identity[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
+        memcpy(instance.transform, identity, 12 * sizeof(float));
+        if (geometry == InstanceGeometry::Opaque) {
+            instance.visibilityMask = OpaqueGeometryVisibilityMask;
+            instance.flags = OPTIX_INSTANCE_FLAG_DISABLE_ANYHIT;
+        } else if (geometry == InstanceGeometry::AlphaTested) {
+            instance.visibilityMask = AlphaTestedGeometryVisibilityMask;
+            instance.flags = OPTIX_INSTANCE_FLAG_NONE;
+            hasAlphaTestedGeometry = true;
+        } else {
+            instance.visibilityMask = AllGeometryVisibilityMask;
+            instance.flags = OPTIX_INSTANCE_FLAG_NONE;
+        }
+        instance.sbtOffset = sbtOffset;
+        instance.traversableHandle = handle;
+        return instance;
+    };
+    auto addTopLevelInstance = [&](const OptixInstance &instance) {
+        if (iasInstances.size() == chunkInstances) {
+            chunkIASInstances.push_back(
+                identityInstance(buildIAS(iasInstances), 0, InstanceGeometry::Mixed));
+            ++gpuIASChunks;
+            // Free the instances of each chunk once it has been built
+            iasInstances = pstd::vector<OptixInstance>(alloc);
+        }
+        iasInstances.push_back(instance);
+    };
 
-    OptixInstance gasInstance = {};
-    float identity[12] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0};
-    memcpy(gasInstance.transform, identity, 12 * sizeof(float));
-    gasInstance.visibilityMask = 255;
-    gasInstance.flags =
-        OPTIX_INSTANCE_FLAG_NONE;  // TODO: OPTIX_INSTANCE_FLAG_DISABLE_ANYHIT
-    if (triangleGASTraversable) {
-        gasInstance.traversableHandle = triangleGASTraversable;
-        gasInstance.sbtOffset = 0;
-        iasInstances.push_back(gasInstance);
-    }
-    if (bilinearPatchGASTraversable) {
-        gasInstance.traversableHandle = bilinearPatchGASTraversable;
-        gasInstance.sbtOffset = bilinearSBTOffset;
-        iasInstances.push_back(gasInstance);
-    }
-    if (quadricGASTraversable) {
-        gasInstance.traversableHandle = quadricGASTraversable;
-        gasInstance.sbtOffset = quadricSBTOffset;
-        iasInstances.push_back(gasInstance);
-    }
+    auto gasGeometry = [](const GAS &g) {
+        return g.opaque ? InstanceGeometry::Opaque : InstanceGeometry::AlphaTested;
+    };
+    auto addGASInstances = [&](const std::vector<GAS> &gas, int sbtOffset) {
+        for (const GAS &g : gas)
+            addTopLevelInstance(
+                identityInstance(g.handle, sbtOffset + g.sbtOffset, gasGeometry(g)));
+    };
+    addGASInstances(triangleGAS, 0);
+    addGASInstances(bilinearPatchGAS, bilinearSBTOffset);
+    addGASInstances(quadricGAS, quadricSBTOffset);
+    addGASInstances(curveGAS, curveSBTOffset);
 
     // Create GASs for instance definitions
-    // TODO: better name here...
+    // Each definition's hit group records are shared by all of its instances.
+    // A definition with more than one GAS gets an IAS of its own so that each
+    // of its instances needs just one OptixInstance.
     struct Instance {
         OptixTraversableHandle handle;
         int sbtOffset;
+        InstanceGeometry geometry;
         Bounds3f bounds;
     };
-    std::multimap<std::string, Instance> instanceMap;
+    std::unordered_map<std::string, Instance> instanceMap;
     for (const auto &def : scene.instanceDefinitions) {
         if (!def.second.animatedShapes.empty())
             Warning("Ignoring %d animated shapes in instance \"%s\".",
                     def.second.animatedShapes.size(), def.first);
 
+        pstd::vector<OptixInstance> prototypeInstances(alloc);
+        Instance prototype{{}, -1, InstanceGeometry::Mixed, {}};
+        auto addInstances = [&](const std::vector<GAS> &gas, int sbtOffset,
+                                const Bounds3f &gasBounds) {
+            for (const GAS &g : gas) {
+                prototypeInstances.push_back(
+                    identityInstance(g.handle, sbtOffset + g.sbtOffset, gasGeometry(g)));
+                prototype = Instance{g.handle, sbtOffset + g.sbtOffset, gasGeometry(g),
+                                     Union(prototype.bounds, gasBounds)};
+            }
+        };
+
         int triSBTOffset = intersectHGRecords.size();
         Bounds3f triBounds;
-        OptixTraversableHandle triHandle = createGASForTriangles(
+        std::vector<GAS> triGAS = createGASForTriangles(
             def.second.shapes, hitPGTriangle, anyhitPGShadowTriangle,
             hitPGRandomHitTriangle, textures.floatTextures, namedMaterials, materials, media, {},
             &triBounds);
-        if (triHandle)
-            instanceMap.insert({def.first, Instance{triHandle, triSBTOffset, triBounds}});
+        addInstances(triGAS, triSBTOffset, triBounds);
 
         int bilinearSBTOffset = intersectHGRecords.size();
         Bounds3f bilinearBounds;
-        OptixTraversableHandle bilinearHandle =
+        std::vector<GAS> bilinearGAS =
             createGASForBLPs(def.second.shapes, hitPGBilinearPatch, anyhitPGShadowBilinearPatch,
                              hitPGRandomHitBilinearPatch, textures.floatTextures, namedMaterials,
                              materials, media, {}, &bilinearBounds);
-        if (bilinearHandle)
-            instanceMap.insert({def.first, Instance{bilinearHandle, bilinearSBTOffset, bilinearBounds}});
+        addInstances(bilinearGAS, bilinearSBTOffset, bilinearBounds);
 
         int quadricSBTOffset = intersectHGRecords.size();
         Bounds3f quadricBounds;
-        OptixTraversableHandle quadricHandle =
+        std::vector<GAS> quadricGAS =
             createGASForQuadrics(def.second.shapes, hitPGQuadric, anyhitPGShadowQuadric,
                                  hitPGRandomHitQuadric, textures.floatTextures, namedMaterials,
                                  materials, media, {}, &quadricBounds);
-        if (quadricHandle)
-            instanceMap.insert({def.first, Instance{quadricHandle, quadricSBTOffset, quadricBounds}});
-
-        if (!triHandle && !bilinearHandle && !quadricHandle)
-            // empty instance definition... put something there so we can
-            // tell the difference between an empty definition and no
-            // definition below.
-            instanceMap.insert({def.first, Instance{{}, -1, {}}});
+        addInstances(quadricGAS, quadricSBTOffset, quadricBounds);
+
+        int curveSBTOffset = intersectHGRecords.size();
+        Bounds3f curveBounds;
+        std::vector<GAS> curveGAS = createGASForCurves(
+            def.second.shapes, hitPGCurve, anyhitPGShadowCurve, hitPGRandomHitCurve,
+            textures.floatTextures, namedMaterials, materials, media, &curveBounds);
+        addInstances(curveGAS, curveSBTOffset, curveBounds);
+
+        if (prototypeInstances.size() > 1) {
+            // The SBT offsets of the OptixInstances that refer to the GASs
+            // are the ones that are used, so the prototype's is unused
+            prototype.handle = buildIAS(prototypeInstances);
+            prototype.sbtOffset = 0;
+            prototype.geometry = InstanceGeometry::Mixed;
+            graphDepth = 3;
+        }
+        // Empty instance definitions are recorded with a null handle so that
+        // they can be told apart from undefined instances below.
+        instanceMap[def.first] = prototype;
     }
 
     // Create OptixInstances for instances
     for (const auto &inst : scene.instances) {
-        auto iterPair = instanceMap.equal_range(inst.name);
-        if (std::distance(iterPair.first, iterPair.second) == 0)
+        auto iter = instanceMap.find(inst.name);
+        if (iter == instanceMap.end())
             ErrorExit(&inst.loc, "%s: object instance not defined.", inst.name);
 
         if (inst.renderFromInstance == nullptr) {
@@ -1081,43 +1567,49 @@ OptiXAggregate::OptiXAggregate(
             continue;
         }
 
-        for (auto iter = iterPair.first; iter != iterPair.second; ++iter) {
-            const Instance &in = iter->second;
-            if (!in.handle)
-                // empty instance definition
-                continue;
-
-            bounds = Union(bounds, (*inst.renderFromInstance)(in.bounds));
-
-            OptixInstance optixInstance = {};
-            for (int i = 0; i < 3; ++i)
-                for (int j = 0; j < 4; ++j)
-                    optixInstance.transform[4 * i + j] =
-                        inst.renderFromInstance->GetMatrix()[i][j];
-            optixInstance.visibilityMask = 255;
-            optixInstance.sbtOffset = in.sbtOffset;
-            optixInstance.flags =
-                OPTIX_INSTANCE_FLAG_NONE;  // TODO:
-            // OPTIX_INSTANCE_FLAG_DISABLE_ANYHIT
-            optixInstance.traversableHandle = in.handle;
-            iasInstances.push_back(optixInstance);
-        }
+        const Instance &in = iter->second;
+        if (!in.handle)
+            // empty instance definition
+            continue;
+
+        bounds = Union(bounds, (*inst.renderFromInstance)(in.bounds));
+
+        OptixInstance optixInstance =
+            identityInstance(in.handle, in.sbtOffset, in.geometry);
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                optixInstance.transform[4 * i + j] =
+                    inst.renderFromInstance->GetMatrix()[i][j];
+        addTopLevelInstance(optixInstance);
     }
 
     // Build the top-level IAS
-    OptixBuildInput buildInput = {};
-    buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
-    buildInput.instanceArray.instances = CUdeviceptr(iasInstances.data());
-    buildInput.instanceArray.numInstances = iasInstances.size();
-    std::vector<OptixBuildInput> buildInputs = {buildInput};
+    if (chunkIASInstances.empty())
+        rootTraversable = buildIAS(iasInstances);
+    else {
+        chunkIASInstances.push_back(
+            identityInstance(buildIAS(iasInstances), 0, InstanceGeometry::Mixed));
+        ++gpuIASChunks;
+        CHECK_LE(chunkIASInstances.size(), maxInstancesPerIAS);
+        rootTraversable = buildIAS(chunkIASInstances);
+        ++graphDepth;
+    }
 
-    rootTraversable = buildBVH({buildInput});
+    if (graphDepth > 2) {
+        // The default stack sizes only allow for a single level of instancing
+        LOG_VERBOSE("Setting OptiX traversable graph depth to %d", graphDepth);
+        OPTIX_CHECK(optixPipelineSetStackSize(
+            optixPipeline, directCallableStackSizeFromTraversal,
+            directCallableStackSizeFromState, continuationStackSize, graphDepth));
+    }
 
     LOG_VERBOSE("Finished creating shapes and acceleration structures");
 
     if (!scene.animatedShapes.empty())
         Warning("Ignoring %d animated shapes", scene.animatedShapes.size());
 
+    static_assert(sizeof(HitgroupRecord) <= 64,
+                  "Hit group records should fit in a single 64-byte line");
     intersectSBT.hitgroupRecordBase = (CUdeviceptr)intersectHGRecords.data();
     intersectSBT.hitgroupRecordStrideInBytes = sizeof(HitgroupRecord);
     intersectSBT.hitgroupRecordCount = intersectHGRecords.size();
@@ -1136,8 +1628,27 @@ OptiXAggregate::OptiXAggregate(
     randomHitSBT.hitgroupRecordCount = randomHitHGRecords.size();
 }
 
+void OptiXAggregate::setAlphaTextureParameters(
+    RayIntersectParameters *params, const OptixShaderBindingTable &sbt) const {
+    params->alphaTextures = hitgroupAlphaTextures.data();
+    params->hitgroupRecordBase = sbt.hitgroupRecordBase;
+    params->hitgroupRecordStride = sbt.hitgroupRecordStrideInBytes;
+}
+
 OptiXAggregate::ParamBufferState &OptiXAggregate::getParamBuffer(
     const RayIntersectParameters &params) const {
+    if (GPUCapturingGraph()) {
+        // Graphs are launched repeatedly with the same parameters, so give
+        // them buffers of their own that are initialized now
+        ParamBufferState &pbs = graphParams.emplace_back();
+        void *ptr;
+        CUDA_CHECK(cudaMalloc(&ptr, sizeof(RayIntersectParameters)));
+        CUDA_CHECK(cudaMemcpy(ptr, &params, sizeof(params), cudaMemcpyHostToDevice));
+        pbs.ptr = (CUdeviceptr)ptr;
+        pbs.used = true;
+        return pbs;
+    }
+
     CHECK(nextParamOffset < paramsPool.size());
 
     ParamBufferState &pbs = paramsPool[nextParamOffset];
@@ -1163,14 +1674,18 @@ void OptiXAggregate::IntersectClosest(
     MaterialEvalQueue *universalEvalMaterialQueue,
     MediumSampleQueue *mediumSampleQueue,
     RayQueue *nextRayQueue) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events =
-        GetProfilerEvents("Tracing closest hit rays");
-
-    cudaEventRecord(events.first);
+    // Profiler events aren't recorded when capturing a CUDA graph
+    bool capturing = GPUCapturingGraph();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing closest hit rays", maxRays);
+        cudaEventRecord(events.first);
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
         params.traversable = rootTraversable;
+        setAlphaTextureParameters(&params, intersectSBT);
         params.rayQueue = rayQueue;
         params.nextRayQueue = nextRayQueue;
         params.escapedRayQueue = escapedRayQueue;
@@ -1188,34 +1703,43 @@ void OptiXAggregate::IntersectClosest(
         nvtxRangePush("OptiXAggregate::IntersectClosest");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, launchStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &intersectSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!capturing)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
+        if (!capturing)
+            CUDA_CHECK(cudaDeviceSynchronize());
         LOG_VERBOSE("Post-sync triangle intersect closest");
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second);
 };
 
 void OptiXAggregate::IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue,
                                SOA<PixelSampleState> *pixelSampleState) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents("Tracing shadow rays");
-
-    cudaEventRecord(events.first);
+    // Profiler events aren't recorded when capturing a CUDA graph
+    bool capturing = GPUCapturingGraph();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing shadow rays", maxRays);
+        cudaEventRecord(events.first);
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
         params.traversable = rootTraversable;
+        setAlphaTextureParameters(&params, shadowSBT);
         params.shadowRayQueue = shadowRayQueue;
         params.pixelSampleState = *pixelSampleState;
+        params.hasAlphaTestedGeometry = hasAlphaTestedGeometry;
 
         ParamBufferState &pbs = getParamBuffer(params);
 
@@ -1226,34 +1750,44 @@ void OptiXAggregate::IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue
         nvtxRangePush("OptiXAggregate::IntersectShadow");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, launchStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &shadowSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!capturing)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
+        if (!capturing)
+            CUDA_CHECK(cudaDeviceSynchronize());
         LOG_VERBOSE("Post-sync intersect shadow");
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second);
 }
 
 void OptiXAggregate::IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
-                                 SOA<PixelSampleState> *pixelSampleState) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents("Tracing shadow Tr rays");
-
-    cudaEventRecord(events.first);
+                                 SOA<PixelSampleState> *pixelSampleState,
+                                 bool residualTracking) const {
+    // Profiler events aren't recorded when capturing a CUDA graph
+    bool capturing = GPUCapturingGraph();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing shadow Tr rays", maxRays);
+        cudaEventRecord(events.first);
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
         params.traversable = rootTraversable;
+        setAlphaTextureParameters(&params, shadowTrSBT);
         params.shadowRayQueue = shadowRayQueue;
         params.pixelSampleState = *pixelSampleState;
+        params.residualTracking = residualTracking;
 
         ParamBufferState &pbs = getParamBuffer(params);
 
@@ -1264,33 +1798,40 @@ void OptiXAggregate::IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQue
         nvtxRangePush("OptiXAggregate::IntersectShadowTr");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, launchStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &shadowTrSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!capturing)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
+        if (!capturing)
+            CUDA_CHECK(cudaDeviceSynchronize());
         LOG_VERBOSE("Post-sync intersect shadow Tr");
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second);
 }
 
 void OptiXAggregate::IntersectOneRandom(int maxRays,
                                   SubsurfaceScatterQueue *subsurfaceScatterQueue) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events =
-        GetProfilerEvents("Tracing subsurface scattering probe rays");
-
-    cudaEventRecord(events.first);
+    // Profiler events aren't recorded when capturing a CUDA graph
+    bool capturing = GPUCapturingGraph();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing subsurface scattering probe rays", maxRays);
+        cudaEventRecord(events.first);
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
         params.traversable = rootTraversable;
+        setAlphaTextureParameters(&params, randomHitSBT);
         params.subsurfaceScatterQueue = subsurfaceScatterQueue;
 
         ParamBufferState &pbs = getParamBuffer(params);
@@ -1302,21 +1843,24 @@ void OptiXAggregate::IntersectOneRandom(int maxRays,
         nvtxRangePush("OptiXAggregate::IntersectOneRandom");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, launchStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &randomHitSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!capturing)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
+        if (!capturing)
+            CUDA_CHECK(cudaDeviceSynchronize());
         LOG_VERBOSE("Post-sync intersect random");
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second);
 }
 
 } // namespace pbrt
@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/gpu/optix.h>
+#include <pbrt/gpu/util.h>
 #include <pbrt/materials.h>
 #include <pbrt/parsedscene.h>
 #include <pbrt/util/containers.h>
@@ -17,6 +18,7 @@
 #include <pbrt/wavefront/integrator.h>
 #include <pbrt/wavefront/workitems.h>
 
+#include <deque>
 #include <map>
 #include <string>
 
@@ -46,14 +48,24 @@ class OptiXAggregate : public WavefrontAggregate {
                          SOA<PixelSampleState> *pixelSampleState) const;
 
     void IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
-                           SOA<PixelSampleState> *pixelSampleState) const;
+                           SOA<PixelSampleState> *pixelSampleState,
+                           bool residualTracking) const;
 
     void IntersectOneRandom(int maxRays, SubsurfaceScatterQueue *subsurfaceScatterQueue) const;
 
   private:
     struct HitgroupRecord;
 
-    OptixTraversableHandle createGASForTriangles(
+    // A GAS built from a batch of build inputs; _sbtOffset_ gives the index of
+    // the batch's first build input, relative to the first one passed in
+    struct GAS {
+        OptixTraversableHandle handle;
+        int sbtOffset;
+        // Set if none of the GAS's geometry runs any-hit programs
+        bool opaque;
+    };
+
+    std::vector<GAS> createGASForTriangles(
         const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
         const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
         const std::map<std::string, FloatTexture> &floatTextures,
@@ -63,7 +75,7 @@ class OptiXAggregate : public WavefrontAggregate {
         const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
         Bounds3f *gasBounds);
 
-    OptixTraversableHandle createGASForBLPs(
+    std::vector<GAS> createGASForBLPs(
         const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
         const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
         const std::map<std::string, FloatTexture> &floatTextures,
@@ -73,7 +85,7 @@ class OptiXAggregate : public WavefrontAggregate {
         const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
         Bounds3f *gasBounds);
 
-    OptixTraversableHandle createGASForQuadrics(
+    std::vector<GAS> createGASForQuadrics(
         const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
         const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
         const std::map<std::string, FloatTexture> &floatTextures,
@@ -83,11 +95,39 @@ class OptiXAggregate : public WavefrontAggregate {
         const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
         Bounds3f *gasBounds);
 
-    OptixTraversableHandle buildBVH(const std::vector<OptixBuildInput> &buildInputs);
+    std::vector<GAS> createGASForCurves(
+        const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
+        const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
+        const std::map<std::string, FloatTexture> &floatTextures,
+        const std::map<std::string, Material> &namedMaterials,
+        const std::vector<Material> &materials,
+        const std::map<std::string, Medium> &media, Bounds3f *gasBounds);
+
+    // An acceleration structure build that has been issued on a stream but
+    // not yet synchronized with and compacted
+    struct PendingBuild {
+        CUstream stream;
+        OptixTraversableHandle handle;
+        int nBuildInputs;
+        void *tempBuffer, *outputBuffer, *compactedSizeDevice;
+        size_t outputBytes;
+        uint64_t *compactedSize;
+    };
+    PendingBuild launchBuild(const OptixBuildInput *buildInputs, int nBuildInputs,
+                             CUstream stream);
+    OptixTraversableHandle finishBuild(PendingBuild &build);
+    void prefetchBuildInput(const OptixBuildInput &input, CUstream stream) const;
+
+    OptixTraversableHandle buildBVH(const OptixBuildInput *buildInputs, int nBuildInputs);
+    std::vector<GAS> buildGAS(const std::vector<OptixBuildInput> &buildInputs);
 
     Allocator alloc;
     Bounds3f bounds;
+    size_t gasBuildMemoryBudget;
     CUstream cudaStream;
+    std::vector<CUstream> buildStreams;
+    int gpuDevice;
+    bool prefetchBuildInputs;
     OptixDeviceContext optixContext;
     OptixModule optixModule;
     OptixPipeline optixPipeline;
@@ -100,15 +140,27 @@ class OptiXAggregate : public WavefrontAggregate {
     };
     mutable std::vector<ParamBufferState> paramsPool;
     mutable size_t nextParamOffset = 0;
+    // Parameter buffers used by launches recorded in CUDA graphs
+    mutable std::deque<ParamBufferState> graphParams;
 
     ParamBufferState &getParamBuffer(const RayIntersectParameters &) const;
+    void setAlphaTextureParameters(RayIntersectParameters *params,
+                                   const OptixShaderBindingTable &sbt) const;
+    CUstream launchStream() const {
+        return GPUCapturingGraph() ? GPULaunchStream() : cudaStream;
+    }
 
     pstd::vector<HitgroupRecord> intersectHGRecords;
     pstd::vector<HitgroupRecord> shadowHGRecords;
     pstd::vector<HitgroupRecord> randomHitHGRecords;
+    // Alpha texture for each hitgroup record, which is the same in all three
+    // SBTs; they're only needed by any-hit and intersection programs, so they
+    // are kept out of the records
+    pstd::vector<FloatTexture> hitgroupAlphaTextures;
     OptixShaderBindingTable intersectSBT = {}, shadowSBT = {}, shadowTrSBT = {};
     OptixShaderBindingTable randomHitSBT = {};
     OptixTraversableHandle rootTraversable = {};
+    bool hasAlphaTestedGeometry = false;
 };
 
 } // namespace pbrt
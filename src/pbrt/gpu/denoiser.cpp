@@ -0,0 +1,128 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/gpu/denoiser.h>
+
+#include <pbrt/gpu/util.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/log.h>
+
+#include <optix_stubs.h>
+
+#define OPTIX_CHECK(EXPR)                                                           \
+    do {                                                                            \
+        OptixResult res = EXPR;                                                     \
+        if (res != OPTIX_SUCCESS)                                                   \
+            LOG_FATAL("OptiX call " #EXPR " failed with code %d: \"%s\"", int(res), \
+                      optixGetErrorString(res));                                    \
+    } while (false) /* eat semicolon */
+
+namespace pbrt {
+
+static_assert(sizeof(RGB) == 3 * sizeof(float) && sizeof(Normal3f) == 3 * sizeof(float),
+              "The OptiX denoiser requires 32-bit float RGB and Normal3f values");
+
+// Denoiser Method Definitions
+Denoiser::Denoiser(Vector2i resolution, bool haveAlbedoAndNormal)
+    : resolution(resolution), haveAlbedoAndNormal(haveAlbedoAndNormal) {
+    CUcontext cudaContext;
+    CU_CHECK(cuCtxGetCurrent(&cudaContext));
+    CHECK(cudaContext != nullptr);
+
+    OPTIX_CHECK(optixInit());
+    OptixDeviceContext optixContext;
+    OPTIX_CHECK(optixDeviceContextCreate(cudaContext, 0, &optixContext));
+
+    OptixDenoiserOptions options = {};
+#if (OPTIX_VERSION >= 70300)
+    if (haveAlbedoAndNormal)
+        options.guideAlbedo = options.guideNormal = 1;
+
+    OPTIX_CHECK(optixDenoiserCreate(optixContext, OPTIX_DENOISER_MODEL_KIND_HDR,
+                                    &options, &denoiserHandle));
+#else
+    options.inputKind = haveAlbedoAndNormal ? OPTIX_DENOISER_INPUT_RGB_ALBEDO_NORMAL
+                                            : OPTIX_DENOISER_INPUT_RGB;
+
+    OPTIX_CHECK(optixDenoiserCreate(optixContext, &options, &denoiserHandle));
+
+    OPTIX_CHECK(
+        optixDenoiserSetModel(denoiserHandle, OPTIX_DENOISER_MODEL_KIND_HDR, nullptr, 0));
+#endif
+
+    OPTIX_CHECK(optixDenoiserComputeMemoryResources(denoiserHandle, resolution.x,
+                                                    resolution.y, &memorySizes));
+
+    CUDA_CHECK(cudaMalloc(&denoiserState, memorySizes.stateSizeInBytes));
+    CUDA_CHECK(cudaMalloc(&scratchBuffer, memorySizes.withoutOverlapScratchSizeInBytes));
+    CUDA_CHECK(cudaMalloc(&intensity, sizeof(float)));
+
+    OPTIX_CHECK(optixDenoiserSetup(
+        denoiserHandle, 0 /* stream */, resolution.x, resolution.y,
+        CUdeviceptr(denoiserState), memorySizes.stateSizeInBytes,
+        CUdeviceptr(scratchBuffer), memorySizes.withoutOverlapScratchSizeInBytes));
+}
+
+Denoiser::~Denoiser() {
+    OPTIX_CHECK(optixDenoiserDestroy(denoiserHandle));
+    CUDA_CHECK(cudaFree(denoiserState));
+    CUDA_CHECK(cudaFree(scratchBuffer));
+    CUDA_CHECK(cudaFree(intensity));
+}
+
+void Denoiser::Denoise(RGB *rgb, Normal3f *n, RGB *albedo, RGB *result) {
+    CHECK(rgb != nullptr && result != nullptr);
+    CHECK_EQ(n != nullptr, haveAlbedoAndNormal);
+    CHECK_EQ(albedo != nullptr, haveAlbedoAndNormal);
+
+    auto makeImage = [&](void *data) {
+        OptixImage2D image;
+        image.width = resolution.x;
+        image.height = resolution.y;
+        image.rowStrideInBytes = resolution.x * 3 * sizeof(float);
+        image.pixelStrideInBytes = 0;
+        image.format = OPTIX_PIXEL_FORMAT_FLOAT3;
+        image.data = CUdeviceptr(data);
+        return image;
+    };
+    OptixImage2D inputLayers[3] = {makeImage(rgb), makeImage(albedo), makeImage(n)};
+    OptixImage2D outputImage = makeImage(result);
+    int nLayers = haveAlbedoAndNormal ? 3 : 1;
+
+    OPTIX_CHECK(optixDenoiserComputeIntensity(
+        denoiserHandle, 0 /* stream */, &inputLayers[0], CUdeviceptr(intensity),
+        CUdeviceptr(scratchBuffer), memorySizes.withoutOverlapScratchSizeInBytes));
+
+    OptixDenoiserParams params = {};
+    params.denoiseAlpha = 0;
+    params.hdrIntensity = CUdeviceptr(intensity);
+    params.blendFactor = 0;
+
+#if (OPTIX_VERSION >= 70300)
+    OptixDenoiserGuideLayer guideLayer = {};
+    if (haveAlbedoAndNormal) {
+        guideLayer.albedo = inputLayers[1];
+        guideLayer.normal = inputLayers[2];
+    }
+    OptixDenoiserLayer layers = {};
+    layers.input = inputLayers[0];
+    layers.output = outputImage;
+
+    OPTIX_CHECK(optixDenoiserInvoke(
+        denoiserHandle, 0 /* stream */, &params, CUdeviceptr(denoiserState),
+        memorySizes.stateSizeInBytes, &guideLayer, &layers, 1 /* # layers to denoise */,
+        0 /* offset x */, 0 /* offset y */, CUdeviceptr(scratchBuffer),
+        memorySizes.withoutOverlapScratchSizeInBytes));
+#else
+    OPTIX_CHECK(optixDenoiserInvoke(
+        denoiserHandle, 0 /* stream */, &params, CUdeviceptr(denoiserState),
+        memorySizes.stateSizeInBytes, inputLayers, nLayers, 0 /* offset x */,
+        0 /* offset y */, &outputImage, CUdeviceptr(scratchBuffer),
+        memorySizes.withoutOverlapScratchSizeInBytes));
+#endif
+
+    CUDA_CHECK(cudaDeviceSynchronize());
+}
+
+}  // namespace pbrt
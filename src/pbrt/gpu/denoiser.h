@@ -0,0 +1,45 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_GPU_DENOISER_H
+#define PBRT_GPU_DENOISER_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/color.h>
+#include <pbrt/util/vecmath.h>
+
+#include <optix.h>
+
+namespace pbrt {
+
+// Denoiser Definition
+// Denoiser runs NVIDIA's OptiX denoiser on images of the given resolution.
+class Denoiser {
+  public:
+    // Denoiser Public Methods
+    Denoiser(Vector2i resolution, bool haveAlbedoAndNormal);
+    ~Denoiser();
+
+    Denoiser(const Denoiser &) = delete;
+    Denoiser &operator=(const Denoiser &) = delete;
+
+    // All of the pointers must be to GPU memory, with pixels in scanline
+    // order. _n_ and _albedo_ must be nullptr if and only if the denoiser was
+    // created without _haveAlbedoAndNormal_; normals are in a right-handed
+    // coordinate system.
+    void Denoise(RGB *rgb, Normal3f *n, RGB *albedo, RGB *result);
+
+  private:
+    // Denoiser Private Members
+    Vector2i resolution;
+    bool haveAlbedoAndNormal;
+    OptixDenoiser denoiserHandle;
+    OptixDenoiserSizes memorySizes;
+    void *denoiserState, *scratchBuffer, *intensity;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_GPU_DENOISER_H
@@ -7,12 +7,19 @@
 #include <pbrt/gpu/util.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/log.h>
+#include <pbrt/util/stats.h>
 
 #include <cuda.h>
 #include <cuda_runtime.h>
 
+#include <algorithm>
+#include <vector>
+
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/GPU managed memory prefetched", prefetchedBytes);
+STAT_MEMORY_COUNTER("Memory/GPU managed memory read from host", hostResidentBytes);
+
 void *CUDAMemoryResource::do_allocate(size_t size, size_t alignment) {
     void *ptr;
     CUDA_CHECK(cudaMallocManaged(&ptr, size));
@@ -54,7 +61,10 @@ void *CUDATrackedMemoryResource::cudaAllocate(size_t size, size_t alignment) {
     CUDA_CHECK(cudaMallocManaged(&ptr, size));
     DCHECK_EQ(0, intptr_t(ptr) % alignment);
 
-    allocations[ptr] = size;
+    if (readMostlyAllocations)
+        CUDA_CHECK(cudaMemAdvise(ptr, size, cudaMemAdviseSetReadMostly,
+                                 /* ignored argument */ 0));
+    allocations[ptr] = Allocation{size, readMostlyAllocations};
     bytesAllocated += size;
     return ptr;
 }
@@ -75,21 +85,76 @@ void CUDATrackedMemoryResource::do_deallocate(void *p, size_t size, size_t align
     // Note: no deallocation is done if it is in a slab...
 }
 
-void CUDATrackedMemoryResource::PrefetchToGPU() const {
+size_t CUDATrackedMemoryResource::PrefetchToGPU(size_t maxBytes) const {
     int deviceIndex;
     CUDA_CHECK(cudaGetDevice(&deviceIndex));
 
     std::lock_guard<std::mutex> lock(mutex);
 
+    // Prefetch the allocations that are written on the GPU, which must be
+    // resident, and sort the read-mostly ones so that the many small objects
+    // that most rays access are prefetched before large meshes and textures
     LOG_VERBOSE("Prefetching %d allocations to GPU memory", allocations.size());
     size_t bytes = 0;
+    std::vector<std::pair<void *, size_t>> readMostly;
     for (auto iter : allocations) {
-        CUDA_CHECK(
-            cudaMemPrefetchAsync(iter.first, iter.second, deviceIndex, 0 /* stream */));
-        bytes += iter.second;
+        if (iter.second.readMostly) {
+            readMostly.push_back(std::make_pair(iter.first, iter.second.size));
+            continue;
+        }
+        CUDA_CHECK(cudaMemPrefetchAsync(iter.first, iter.second.size, deviceIndex,
+                                        0 /* stream */));
+        bytes += iter.second.size;
+    }
+    std::sort(readMostly.begin(), readMostly.end(),
+              [](const std::pair<void *, size_t> &a, const std::pair<void *, size_t> &b) {
+                  return a.second < b.second;
+              });
+
+    size_t hostBytes = 0;
+    for (const std::pair<void *, size_t> &alloc : readMostly) {
+        if (bytes + alloc.second <= maxBytes) {
+            CUDA_CHECK(cudaMemPrefetchAsync(alloc.first, alloc.second, deviceIndex,
+                                            0 /* stream */));
+            bytes += alloc.second;
+        } else {
+            // Keep the allocation in host memory and map it for the GPU;
+            // faulting its pages in would evict others that are also needed
+            CUDA_CHECK(cudaMemAdvise(alloc.first, alloc.second,
+                                     cudaMemAdviseUnsetReadMostly, 0));
+            CUDA_CHECK(cudaMemAdvise(alloc.first, alloc.second,
+                                     cudaMemAdviseSetPreferredLocation, cudaCpuDeviceId));
+            CUDA_CHECK(cudaMemAdvise(alloc.first, alloc.second,
+                                     cudaMemAdviseSetAccessedBy, deviceIndex));
+            hostBytes += alloc.second;
+        }
     }
     CUDA_CHECK(cudaDeviceSynchronize());
-    LOG_VERBOSE("Done prefetching: %d bytes total", bytes);
+    LOG_VERBOSE("Done prefetching: %d bytes total, %d bytes left in host memory", bytes,
+                hostBytes);
+
+    prefetchedBytes += bytes;
+    hostResidentBytes += hostBytes;
+    return bytes;
+}
+
+void CUDATrackedMemoryResource::SetReadMostly() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &iter : allocations) {
+        CUDA_CHECK(cudaMemAdvise(iter.first, iter.second.size,
+                                 cudaMemAdviseSetReadMostly, /* ignored argument */ 0));
+        iter.second.readMostly = true;
+    }
+    // Start a new slab so that later allocations aren't in a read-mostly one
+    slabOffset = slabSize;
+}
+
+void CUDATrackedMemoryResource::SetReadMostlyAllocations(bool readMostly) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (readMostly != readMostlyAllocations)
+        // Don't share a slab between allocations with different advice
+        slabOffset = slabSize;
+    readMostlyAllocations = readMostly;
 }
 
 static CUDATrackedMemoryResource cudaTrackedMemoryResource;
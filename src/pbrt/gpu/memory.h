@@ -12,6 +12,7 @@
 #include <pbrt/util/pstd.h>
 
 #include <cstddef>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <type_traits>
@@ -39,7 +40,18 @@ class CUDATrackedMemoryResource : public CUDAMemoryResource {
         return this == &other;
     }
 
-    void PrefetchToGPU() const;
+    // Prefetches the allocations that are written on the GPU and then as many
+    // of the read-mostly ones as fit in _maxBytes_, smallest first. The rest
+    // stay in host memory and are mapped so that the GPU reads them remotely
+    // rather than migrating their pages back and forth. Returns the number of
+    // bytes prefetched.
+    size_t PrefetchToGPU(size_t maxBytes = std::numeric_limits<size_t>::max()) const;
+    // Advises CUDA that the current allocations are rarely written, so that
+    // each GPU that reads them may keep its own copy.
+    void SetReadMostly();
+    // Advises subsequent allocations to be read-mostly as well, until this is
+    // called again with _readMostly_ set to false.
+    void SetReadMostlyAllocations(bool readMostly);
     size_t BytesAllocated() const { return bytesAllocated; }
 
   private:
@@ -53,12 +65,18 @@ class CUDATrackedMemoryResource : public CUDAMemoryResource {
 
     void *cudaAllocate(size_t size, size_t alignment);
 
+    struct Allocation {
+        size_t size;
+        bool readMostly;
+    };
+
     size_t bytesAllocated = 0;
+    bool readMostlyAllocations = false;
     uint8_t *currentSlab = nullptr;
     static constexpr int slabSize = 1024 * 1024;
     size_t slabOffset = slabSize;
     mutable std::mutex mutex;
-    std::unordered_map<void *, size_t> allocations;
+    std::unordered_map<void *, Allocation> allocations;
 };
 
 extern Allocator gpuMemoryAllocator;
@@ -2,6 +2,10 @@
 // The pbrt source code is licensed under the Apache License, Version 2.0.
 // SPDX: Apache-2.0
 
+// OptiX programs may not use warp-wide intrinsics, which WorkQueue otherwise
+// uses to allocate entries
+#define PBRT_NO_WARP_INTRINSICS
+
 #include <pbrt/pbrt.h>
 
 #include <pbrt/gpu/aggregate.h>
@@ -59,10 +63,11 @@ static __forceinline__ __device__ T *getPayload() {
 
 template <typename... Args>
 __device__ inline void Trace(OptixTraversableHandle traversable, Ray ray, Float tMin,
-                             Float tMax, OptixRayFlags flags, Args &&... payload) {
+                             Float tMax, OptixRayFlags flags,
+                             unsigned int visibilityMask, Args &&... payload) {
     optixTrace(traversable, make_float3(ray.o.x, ray.o.y, ray.o.z),
                make_float3(ray.d.x, ray.d.y, ray.d.z), tMin, tMax, ray.time,
-               OptixVisibilityMask(255), flags, 0, /* ray type */
+               OptixVisibilityMask(visibilityMask), flags, 0, /* ray type */
                1,                                  /* number of ray types */
                0,                                  /* missSBTIndex */
                std::forward<Args>(payload)...);
@@ -110,8 +115,8 @@ extern "C" __global__ void __raygen__findClosest() {
         ray.d.y, ray.d.z, tMax);
 
     uint32_t missed = 0;
-    Trace(params.traversable, ray, 0.f /* tMin */, tMax, OPTIX_RAY_FLAG_NONE, p0, p1,
-          missed);
+    Trace(params.traversable, ray, 0.f /* tMin */, tMax, OPTIX_RAY_FLAG_NONE,
+          AllGeometryVisibilityMask, p0, p1, missed);
 
     if (missed)
         EnqueueWorkAfterMiss(r, params.mediumSampleQueue, params.escapedRayQueue);
@@ -148,8 +153,18 @@ static __forceinline__ __device__ void ProcessClosestIntersection(
                                  params.universalEvalMaterialQueue);
 }
 
+// Hit group records don't store alpha textures; they are found in a side array
+// using the current record's index in the launch's shader binding table.
+static __forceinline__ __device__ FloatTexture getAlphaTexture() {
+    CUdeviceptr record = optixGetSbtDataPointer() - OPTIX_SBT_RECORD_HEADER_SIZE;
+    return params.alphaTextures[(record - params.hitgroupRecordBase) /
+                                params.hitgroupRecordStride];
+}
+
 static __forceinline__ __device__ Transform getWorldFromInstance() {
-    assert(optixGetTransformListSize() == 1);
+    // Prototypes with several GASs and chunked top-level IASs add instance
+    // transformations, which the returned matrices include
+    assert(optixGetTransformListSize() >= 1);
     float worldFromObj[12], objFromWorld[12];
     optixGetObjectToWorldTransformMatrix(worldFromObj);
     optixGetWorldToObjectTransformMatrix(objFromWorld);
@@ -193,14 +208,15 @@ getTriangleIntersection() {
     return worldFromInstance(intr);
 }
 
-static __forceinline__ __device__ bool alphaKilled(const TriangleMeshRecord &rec) {
-    if (!rec.alphaTexture)
+static __forceinline__ __device__ bool triangleAlphaKilled() {
+    FloatTexture alphaTexture = getAlphaTexture();
+    if (!alphaTexture)
         return false;
 
     SurfaceInteraction intr = getTriangleIntersection();
 
     BasicTextureEvaluator eval;
-    Float alpha = eval(rec.alphaTexture, intr);
+    Float alpha = eval(alphaTexture, intr);
     if (alpha >= 1)
         return false;
     if (alpha <= 0)
@@ -221,23 +237,19 @@ extern "C" __global__ void __closesthit__triangle() {
     if (rec.mediumInterface && rec.mediumInterface->IsMediumTransition())
         intr.mediumInterface = rec.mediumInterface;
     intr.material = rec.material;
-    if (!rec.areaLights.empty())
+    if (rec.areaLights)
         intr.areaLight = rec.areaLights[optixGetPrimitiveIndex()];
 
     ProcessClosestIntersection(intr);
 }
 
 extern "C" __global__ void __anyhit__triangle() {
-    const TriangleMeshRecord &rec = *(const TriangleMeshRecord *)optixGetSbtDataPointer();
-
-    if (alphaKilled(rec))
+    if (triangleAlphaKilled())
         optixIgnoreIntersection();
 }
 
 extern "C" __global__ void __anyhit__shadowTriangle() {
-    const TriangleMeshRecord &rec = *(const TriangleMeshRecord *)optixGetSbtDataPointer();
-
-    if (alphaKilled(rec))
+    if (triangleAlphaKilled())
         optixIgnoreIntersection();
 }
 
@@ -254,9 +266,21 @@ extern "C" __global__ void __raygen__shadow() {
              index, sr.ray.o.x, sr.ray.o.y, sr.ray.o.z,
              sr.ray.d.x, sr.ray.d.y, sr.ray.d.z);
 
+    // Any hit along the ray occludes it, so traversal ends at the first one
+    // found and no closest-hit program is needed. Opaque geometry is traced
+    // first with any-hit programs disabled; the alpha-tested geometry is only
+    // traced if that ray wasn't occluded.
+    const OptixRayFlags shadowFlags = OptixRayFlags(
+        OPTIX_RAY_FLAG_TERMINATE_ON_FIRST_HIT | OPTIX_RAY_FLAG_DISABLE_CLOSESTHIT);
     uint32_t missed = 0;
-    Trace(params.traversable, sr.ray, 1e-5f /* tMin */, sr.tMax, OPTIX_RAY_FLAG_NONE,
-          missed);
+    Trace(params.traversable, sr.ray, 1e-5f /* tMin */, sr.tMax,
+          OptixRayFlags(shadowFlags | OPTIX_RAY_FLAG_DISABLE_ANYHIT),
+          OpaqueGeometryVisibilityMask, missed);
+    if (missed && params.hasAlphaTestedGeometry) {
+        missed = 0;
+        Trace(params.traversable, sr.ray, 1e-5f /* tMin */, sr.tMax, shadowFlags,
+              AlphaTestedGeometryVisibilityMask, missed);
+    }
 
     RecordShadowRayIntersection(sr, &params.pixelSampleState, !missed);
 }
@@ -275,14 +299,15 @@ extern "C" __global__ void __raygen__shadow_Tr() {
 
     ClosestHitContext ctx;
 
-    TraceTransmittance(sr, &params.pixelSampleState,
+    TraceTransmittance(sr, &params.pixelSampleState, params.residualTracking,
                        [&](Ray ray, Float tMax) -> TransmittanceTraceResult {
                            ctx = ClosestHitContext(ray.medium, true);
                            uint32_t p0 = packPointer0(&ctx), p1 = packPointer1(&ctx);
 
                            uint32_t missed = 0;
 
-                           Trace(params.traversable, ray, 1e-5f /* tMin */, tMax, OPTIX_RAY_FLAG_NONE, p0,
+                           Trace(params.traversable, ray, 1e-5f /* tMin */, tMax,
+                                 OPTIX_RAY_FLAG_NONE, AllGeometryVisibilityMask, p0,
                                  p1, missed);
 
                            return TransmittanceTraceResult{!missed, Point3f(ctx.piHit), ctx.material};
@@ -363,11 +388,11 @@ extern "C" __global__ void __intersection__quadric() {
     if (!isect)
         return;
 
-    if (rec.alphaTexture) {
+    if (FloatTexture alphaTexture = getAlphaTexture()) {
         SurfaceInteraction intr = getQuadricIntersection(*isect);
 
         BasicTextureEvaluator eval;
-        Float alpha = eval(rec.alphaTexture, intr);
+        Float alpha = eval(alphaTexture, intr);
         if (alpha < 1) {
             if (alpha == 0)
                 // No hit
@@ -387,6 +412,68 @@ extern "C" __global__ void __intersection__quadric() {
                             FloatToBits(isect->phi));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Curves
+
+static __forceinline__ __device__ SurfaceInteraction getCurveIntersection() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    // OptiX's curves are built from the segments' control points in rendering
+    // (or instance) space, which is what its object space is here
+    float3 ro = optixGetObjectRayOrigin();
+    float3 rd = optixGetObjectRayDirection();
+    Ray ray(Point3f(ro.x, ro.y, ro.z), Vector3f(rd.x, rd.y, rd.z));
+    const Curve &curve = rec.segments[optixGetPrimitiveIndex()];
+    SurfaceInteraction intr = curve.InteractionFromIntersection(
+        optixGetCurveParameter(), ray(optixGetRayTmax()), ray.d, optixGetRayTime());
+
+    Transform worldFromInstance = getWorldFromInstance();
+    return worldFromInstance(intr);
+}
+
+static __forceinline__ __device__ bool curveAlphaKilled() {
+    FloatTexture alphaTexture = getAlphaTexture();
+    if (!alphaTexture)
+        return false;
+
+    SurfaceInteraction intr = getCurveIntersection();
+
+    BasicTextureEvaluator eval;
+    Float alpha = eval(alphaTexture, intr);
+    if (alpha >= 1)
+        return false;
+    if (alpha <= 0)
+        return true;
+    else {
+        float3 o = optixGetWorldRayOrigin();
+        float3 d = optixGetWorldRayDirection();
+        Float u = HashFloat(o, d);
+        return u > alpha;
+    }
+}
+
+extern "C" __global__ void __closesthit__curve() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    SurfaceInteraction intr = getCurveIntersection();
+
+    if (rec.mediumInterface && rec.mediumInterface->IsMediumTransition())
+        intr.mediumInterface = rec.mediumInterface;
+    intr.material = rec.material;
+
+    ProcessClosestIntersection(intr);
+}
+
+extern "C" __global__ void __anyhit__curve() {
+    if (curveAlphaKilled())
+        optixIgnoreIntersection();
+}
+
+extern "C" __global__ void __anyhit__shadowCurve() {
+    if (curveAlphaKilled())
+        optixIgnoreIntersection();
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // Bilinear patches
 
@@ -410,7 +497,7 @@ extern "C" __global__ void __closesthit__bilinearPatch() {
     if (rec.mediumInterface && rec.mediumInterface->IsMediumTransition())
         intr.mediumInterface = rec.mediumInterface;
     intr.material = rec.material;
-    if (!rec.areaLights.empty())
+    if (rec.areaLights)
         intr.areaLight = rec.areaLights[optixGetPrimitiveIndex()];
 
     Transform worldFromInstance = getWorldFromInstance();
@@ -441,10 +528,10 @@ extern "C" __global__ void __intersection__bilinearPatch() {
     if (!isect)
         return;
 
-    if (rec.alphaTexture) {
+    if (FloatTexture alphaTexture = getAlphaTexture()) {
         SurfaceInteraction intr = getBilinearPatchIntersection(isect->uv);
         BasicTextureEvaluator eval;
-        Float alpha = eval(rec.alphaTexture, intr);
+        Float alpha = eval(alphaTexture, intr);
         if (alpha < 1) {
             if (alpha == 0)
                 // No hit
@@ -493,7 +580,7 @@ extern "C" __global__ void __raygen__randomHit() {
 
     while (true) {
         Trace(params.traversable, ray, 0.f /* tMin */, 1.f /* tMax */,
-              OPTIX_RAY_FLAG_NONE, ptr0, ptr1);
+              OPTIX_RAY_FLAG_NONE, AllGeometryVisibilityMask, ptr0, ptr1);
 
         if (payload.intr) {
             ray = payload.intr->SpawnRayTo(s.p1);
@@ -566,3 +653,18 @@ extern "C" __global__ void __closesthit__randomHitQuadric() {
     if (rec.material == p->material)
         p->wrs.Add([&] PBRT_CPU_GPU() { return intr; }, 1.f);
 }
+
+extern "C" __global__ void __closesthit__randomHitCurve() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    RandomHitPayload *p = getPayload<RandomHitPayload>();
+
+    PBRT_DBG("Anyhit curve for random hit: rec.material %p params.materials %p\n",
+        rec.material.ptr(), p->material.ptr());
+
+    SurfaceInteraction intr = getCurveIntersection();
+    p->intr = intr;
+
+    if (rec.material == p->material)
+        p->wrs.Add([&] PBRT_CPU_GPU() { return intr; }, 1.f);
+}
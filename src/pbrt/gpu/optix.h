@@ -22,31 +22,48 @@ namespace pbrt {
 
 class TriangleMesh;
 class BilinearPatchMesh;
+class Curve;
 
+// The hitgroup records only hold the data that closest-hit programs use, so
+// that with the SBT record header each one fits in 64 bytes. Alpha textures
+// are stored separately; see getAlphaTexture() in optix.cu.
 struct TriangleMeshRecord {
     const TriangleMesh *mesh;
     Material material;
-    FloatTexture alphaTexture;
-    pstd::span<Light> areaLights;
+    // nullptr, or the area light for each of the mesh's triangles
+    const Light *areaLights;
     MediumInterface *mediumInterface;
 };
 
 struct BilinearMeshRecord {
     const BilinearPatchMesh *mesh;
     Material material;
-    FloatTexture alphaTexture;
-    pstd::span<Light> areaLights;
+    // nullptr, or the area light for each of the mesh's patches
+    const Light *areaLights;
     MediumInterface *mediumInterface;
 };
 
 struct QuadricRecord {
     Shape shape;
     Material material;
-    FloatTexture alphaTexture;
     Light areaLight;
     MediumInterface *mediumInterface;
 };
 
+struct CurveRecord {
+    // The curve segment for each of the build input's primitives
+    const Curve *segments;
+    Material material;
+    MediumInterface *mediumInterface;
+};
+
+// Top-level instances of GASs that hold alpha-tested geometry get their own
+// visibility mask so that shadow rays can first be traced against the opaque
+// geometry alone, with any-hit programs disabled.
+constexpr unsigned int OpaqueGeometryVisibilityMask = 1;
+constexpr unsigned int AlphaTestedGeometryVisibilityMask = 2;
+constexpr unsigned int AllGeometryVisibilityMask = 255;
+
 struct RayIntersectParameters {
     OptixTraversableHandle traversable;
 
@@ -62,9 +79,17 @@ struct RayIntersectParameters {
     // shadow rays
     ShadowRayQueue *shadowRayQueue;
     SOA<PixelSampleState> pixelSampleState;
+    bool hasAlphaTestedGeometry;
+    // Estimate shadow rays' transmittance with residual ratio tracking
+    bool residualTracking;
 
     // Subsurface scattering...
     SubsurfaceScatterQueue *subsurfaceScatterQueue;
+
+    // Alpha texture of each of the launch's SBT hitgroup records
+    const FloatTexture *alphaTextures;
+    CUdeviceptr hitgroupRecordBase;
+    unsigned int hitgroupRecordStride;
 };
 
 }  // namespace pbrt
@@ -7,10 +7,14 @@
 #include <pbrt/options.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/trace.h>
 
 #include <algorithm>
+#include <map>
+#include <mutex>
 #include <vector>
 
 #ifdef NVTX
@@ -73,28 +77,30 @@ void GPUInit() {
 #endif
     }
 
-    int device = Options->gpuDevice ? *Options->gpuDevice : 0;
-    LOG_VERBOSE("Selecting GPU device %d", device);
+    for (int device : GPUDevices()) {
+        LOG_VERBOSE("Selecting GPU device %d", device);
 #ifdef NVTX
-    nvtxNameCuDevice(device, "PBRT_GPU");
+        nvtxNameCuDevice(device, "PBRT_GPU");
 #endif
-    CUDA_CHECK(cudaSetDevice(device));
+        CUDA_CHECK(cudaSetDevice(device));
 
-    int hasUnifiedAddressing;
-    CUDA_CHECK(cudaDeviceGetAttribute(&hasUnifiedAddressing, cudaDevAttrUnifiedAddressing,
-                                      device));
-    if (!hasUnifiedAddressing)
-        LOG_FATAL("The selected GPU device (%d) does not support unified addressing.",
-                  device);
+        int hasUnifiedAddressing;
+        CUDA_CHECK(cudaDeviceGetAttribute(&hasUnifiedAddressing,
+                                          cudaDevAttrUnifiedAddressing, device));
+        if (!hasUnifiedAddressing)
+            LOG_FATAL("The selected GPU device (%d) does not support unified addressing.",
+                      device);
 
-    CUDA_CHECK(cudaDeviceSetLimit(cudaLimitStackSize, 8192));
-    size_t stackSize;
-    CUDA_CHECK(cudaDeviceGetLimit(&stackSize, cudaLimitStackSize));
-    LOG_VERBOSE("Reset stack size to %d", stackSize);
+        CUDA_CHECK(cudaDeviceSetLimit(cudaLimitStackSize, 8192));
+        size_t stackSize;
+        CUDA_CHECK(cudaDeviceGetLimit(&stackSize, cudaLimitStackSize));
+        LOG_VERBOSE("Reset stack size to %d", stackSize);
 
-    CUDA_CHECK(cudaDeviceSetLimit(cudaLimitPrintfFifoSize, 32 * 1024 * 1024));
+        CUDA_CHECK(cudaDeviceSetLimit(cudaLimitPrintfFifoSize, 32 * 1024 * 1024));
 
-    CUDA_CHECK(cudaDeviceSetCacheConfig(cudaFuncCachePreferL1));
+        CUDA_CHECK(cudaDeviceSetCacheConfig(cudaFuncCachePreferL1));
+    }
+    CUDA_CHECK(cudaSetDevice(GPUDevices()[0]));
 
 #ifdef NVTX
 #ifdef PBRT_IS_WINDOWS
@@ -108,11 +114,44 @@ void GPUInit() {
 void GPUThreadInit() {
     if (!Options->useGPU)
         return;
-    int device = Options->gpuDevice ? *Options->gpuDevice : 0;
+    int device = GPUDevices()[0];
     LOG_VERBOSE("Selecting GPU device %d", device);
     CUDA_CHECK(cudaSetDevice(device));
 }
 
+const std::vector<int> &GPUDevices() {
+    static std::vector<int> devices = []() {
+        int primary = Options->gpuDevice ? *Options->gpuDevice : 0;
+        std::vector<int> devices = {primary};
+        if (!Options->multiGPU)
+            return devices;
+
+        // Additional devices render from managed memory that is resident on
+        // the primary device, so they must support concurrent access to it.
+        int nDevices;
+        CUDA_CHECK(cudaGetDeviceCount(&nDevices));
+        for (int device = 0; device < nDevices; ++device) {
+            if (device == primary)
+                continue;
+            int concurrentManagedAccess;
+            CUDA_CHECK(cudaDeviceGetAttribute(&concurrentManagedAccess,
+                                              cudaDevAttrConcurrentManagedAccess,
+                                              device));
+            if (!concurrentManagedAccess) {
+                Warning("Not using GPU device %d, which doesn't support concurrent "
+                        "managed memory access.",
+                        device);
+                continue;
+            }
+            devices.push_back(device);
+        }
+        if (devices.size() == 1)
+            Warning("Only one usable GPU device was found for --multi-gpu.");
+        return devices;
+    }();
+    return devices;
+}
+
 void GPURegisterThread(const char *name) {
 #ifdef NVTX
 #ifdef PBRT_IS_WINDOWS
@@ -136,12 +175,27 @@ struct KernelStats {
     std::string description;
     int numLaunches = 0;
     float sumMS = 0, minMS = 0, maxMS = 0;
+    // Total number of items, such as queue entries, that launches processed
+    int64_t numItems = 0;
+    // Launch configuration; zero for OptiX launches and graphs
+    int blockSize = 0, registers = 0;
+    Float occupancy = 0;
 };
 
 // Store pointers so that reallocs don't mess up held KernelStats pointers
 // in ProfilerEvent..
 static std::vector<KernelStats *> kernelStats;
 
+// TraceTimeBase Definition
+// An event recorded on a device when it is first profiled along with the
+// trace time at which it completed, so that kernels' times can be placed on
+// the trace's timeline.
+struct TraceTimeBase {
+    cudaEvent_t event;
+    double microseconds;
+};
+static std::map<int, TraceTimeBase> traceTimeBases;
+
 struct ProfilerEvent {
     ProfilerEvent() {
         CUDA_CHECK(cudaEventCreate(&start));
@@ -155,6 +209,13 @@ struct ProfilerEvent {
 
         float ms = 0;
         CUDA_CHECK(cudaEventElapsedTime(&ms, start, stop));
+        if (TracingEnabled()) {
+            const TraceTimeBase &base = traceTimeBases[device];
+            float startMS = 0;
+            CUDA_CHECK(cudaEventElapsedTime(&startMS, base.event, start));
+            double t0 = base.microseconds + 1000. * startMS;
+            TraceRecordGPU(stats->description.c_str(), device, t0, t0 + 1000. * ms);
+        }
 
         ++stats->numLaunches;
         if (stats->numLaunches == 1)
@@ -170,14 +231,59 @@ struct ProfilerEvent {
 
     cudaEvent_t start, stop;
     bool active = false;
+    int device = 0;
     KernelStats *stats = nullptr;
 };
 
-// Ring buffer
-static std::vector<ProfilerEvent> eventPool;
-static size_t eventPoolOffset = 0;
+// Ring buffer of events for each device; kernels are launched from multiple
+// threads when rendering with more than one GPU.
+struct ProfilerEventPool {
+    std::vector<ProfilerEvent> events;
+    size_t offset = 0;
+};
+static std::map<int, ProfilerEventPool> eventPools;
+static std::mutex profilerMutex;
 
-std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description) {
+// Returns the _KernelStats_ for _description_; _profilerMutex_ must be held.
+static KernelStats *FindKernelStats(const char *description) {
+    for (size_t i = 0; i < kernelStats.size(); ++i)
+        if (kernelStats[i]->description == description)
+            return kernelStats[i];
+    kernelStats.push_back(new KernelStats(description));
+    return kernelStats.back();
+}
+
+void SetKernelOccupancy(const char *description, int blockSize, int registers,
+                        int residentThreads) {
+    int device, maxThreads;
+    CUDA_CHECK(cudaGetDevice(&device));
+    CUDA_CHECK(cudaDeviceGetAttribute(&maxThreads,
+                                      cudaDevAttrMaxThreadsPerMultiProcessor, device));
+
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    KernelStats *stats = FindKernelStats(description);
+    stats->blockSize = blockSize;
+    stats->registers = registers;
+    stats->occupancy = Float(residentThreads) / Float(maxThreads);
+}
+
+std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description,
+                                                      int nItems) {
+    int device;
+    CUDA_CHECK(cudaGetDevice(&device));
+    std::lock_guard<std::mutex> lock(profilerMutex);
+
+    if (TracingEnabled() && traceTimeBases.find(device) == traceTimeBases.end()) {
+        TraceTimeBase base;
+        CUDA_CHECK(cudaEventCreate(&base.event));
+        CUDA_CHECK(cudaEventRecord(base.event));
+        CUDA_CHECK(cudaEventSynchronize(base.event));
+        base.microseconds = TraceMicroseconds();
+        traceTimeBases[device] = base;
+    }
+
+    std::vector<ProfilerEvent> &eventPool = eventPools[device].events;
+    size_t &eventPoolOffset = eventPools[device].offset;
     if (eventPool.empty())
         eventPool.resize(1024);  // how many? This is probably more than we need...
 
@@ -189,18 +295,9 @@ std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description) {
         pe.Sync();
 
     pe.active = true;
-    pe.stats = nullptr;
-
-    for (size_t i = 0; i < kernelStats.size(); ++i) {
-        if (kernelStats[i]->description == description) {
-            pe.stats = kernelStats[i];
-            break;
-        }
-    }
-    if (!pe.stats) {
-        kernelStats.push_back(new KernelStats(description));
-        pe.stats = kernelStats.back();
-    }
+    pe.device = device;
+    pe.stats = FindKernelStats(description);
+    pe.stats->numItems += nItems;
 
     return {pe.start, pe.stop};
 }
@@ -209,13 +306,61 @@ void GPUWait() {
     CUDA_CHECK(cudaDeviceSynchronize());
 }
 
-void ReportKernelStats() {
-    CUDA_CHECK(cudaDeviceSynchronize());
+// Each thread renders with a single device, so graph capture is per thread
+static thread_local cudaStream_t graphCaptureStream = nullptr;
+
+bool GPUCapturingGraph() {
+    return graphCaptureStream != nullptr;
+}
+
+cudaStream_t GPULaunchStream() {
+    return graphCaptureStream;
+}
+
+void GPULaunchGraph(const char *description, cudaGraphExec_t *graph,
+                    const std::function<void()> &launch) {
+    if (!*graph) {
+        // Capture the work that _launch_ submits to a stream of its own. The
+        // stream doesn't synchronize with the default stream, and capture is
+        // relaxed so that constant parameters can be uploaded during it.
+        CHECK(!GPUCapturingGraph());
+        CUDA_CHECK(cudaStreamCreateWithFlags(&graphCaptureStream, cudaStreamNonBlocking));
+        CUDA_CHECK(
+            cudaStreamBeginCapture(graphCaptureStream, cudaStreamCaptureModeRelaxed));
+        launch();
+        cudaGraph_t capturedGraph;
+        CUDA_CHECK(cudaStreamEndCapture(graphCaptureStream, &capturedGraph));
+        CUDA_CHECK(cudaGraphInstantiateWithFlags(graph, capturedGraph, 0));
+        CUDA_CHECK(cudaGraphDestroy(capturedGraph));
+        CUDA_CHECK(cudaStreamDestroy(graphCaptureStream));
+        graphCaptureStream = nullptr;
+    }
+
+    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents(description);
+    cudaEventRecord(events.first);
+    CUDA_CHECK(cudaGraphLaunch(*graph, 0));
+    cudaEventRecord(events.second);
+}
+
+// Waits for all of the kernels to finish and adds their times to their stats
+static void SyncProfilerEvents() {
+    for (auto &pool : eventPools) {
+        CUDA_CHECK(cudaSetDevice(pool.first));
+        CUDA_CHECK(cudaDeviceSynchronize());
+        for (size_t i = 0; i < pool.second.events.size(); ++i)
+            if (pool.second.events[i].active)
+                pool.second.events[i].Sync();
+    }
+    CUDA_CHECK(cudaSetDevice(GPUDevices()[0]));
+}
+
+// Returns the number of items processed per second, in millions
+static double MItemsPerSecond(const KernelStats *stats) {
+    return stats->sumMS > 0 ? stats->numItems / (1000. * stats->sumMS) : 0.;
+}
 
-    // Drain active profiler events
-    for (size_t i = 0; i < eventPool.size(); ++i)
-        if (eventPool[i].active)
-            eventPool[i].Sync();
+void ReportKernelStats() {
+    SyncProfilerEvents();
 
     // Compute total milliseconds over all kernels and launches
     float totalMS = 0;
@@ -228,14 +373,20 @@ void ReportKernelStats() {
     const float otherCutoff = 0.001f * totalMS;
     for (size_t i = 0; i < kernelStats.size(); ++i) {
         KernelStats *stats = kernelStats[i];
-        if (stats->sumMS > otherCutoff)
+        if (stats->sumMS > otherCutoff) {
             Printf("  %-49s %5d launches %9.2f ms / %5.1f%s (avg %6.3f, min "
-                   "%6.3f, max %7.3f)\n",
+                   "%6.3f, max %7.3f)",
                    stats->description, stats->numLaunches, stats->sumMS,
                    100.f * stats->sumMS / totalMS, "%",
                    stats->sumMS / stats->numLaunches, stats->minMS,
                    stats->maxMS);
-        else {
+            if (stats->numItems > 0)
+                Printf(" %9.2f M items/s", MItemsPerSecond(stats));
+            if (stats->blockSize > 0)
+                Printf(" [%3d regs, %5.1f%s occupancy]", stats->registers,
+                       100.f * stats->occupancy, "%");
+            Printf("\n");
+        } else {
             otherMS += stats->sumMS;
             otherLaunches += stats->numLaunches;
         }
@@ -247,4 +398,41 @@ void ReportKernelStats() {
     Printf("\n");
 }
 
+void WriteKernelStats(const std::string &filename) {
+    SyncProfilerEvents();
+
+    std::string contents;
+    bool csv = HasExtension(filename, "csv");
+    if (csv)
+        contents = "kernel,launches,total_ms,avg_ms,min_ms,max_ms,items,mitems_per_s,"
+                   "block_size,registers,occupancy\n";
+    else
+        contents = "{\n  \"kernels\": [\n";
+    for (size_t i = 0; i < kernelStats.size(); ++i) {
+        const KernelStats *stats = kernelStats[i];
+        double avgMS = stats->numLaunches > 0 ? stats->sumMS / stats->numLaunches : 0.;
+        if (csv)
+            contents += StringPrintf("\"%s\",%d,%.4f,%.4f,%.4f,%.4f,%d,%.4f,%d,%d,%.4f\n",
+                                     stats->description, stats->numLaunches,
+                                     stats->sumMS, avgMS, stats->minMS, stats->maxMS,
+                                     stats->numItems, MItemsPerSecond(stats),
+                                     stats->blockSize, stats->registers,
+                                     stats->occupancy);
+        else
+            contents += StringPrintf(
+                "    {\"kernel\": \"%s\", \"launches\": %d, \"totalMS\": %.4f, "
+                "\"avgMS\": %.4f, \"minMS\": %.4f, \"maxMS\": %.4f, \"items\": %d, "
+                "\"mItemsPerSecond\": %.4f, \"blockSize\": %d, \"registers\": %d, "
+                "\"occupancy\": %.4f}%s\n",
+                stats->description, stats->numLaunches, stats->sumMS, avgMS,
+                stats->minMS, stats->maxMS, stats->numItems, MItemsPerSecond(stats),
+                stats->blockSize, stats->registers, stats->occupancy,
+                i + 1 < kernelStats.size() ? "," : "");
+    }
+    if (!csv)
+        contents += "  ]\n}\n";
+
+    WriteFileContents(filename, contents);
+}
+
 }  // namespace pbrt
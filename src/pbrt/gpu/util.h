@@ -12,7 +12,10 @@
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/progressreporter.h>
 
+#include <functional>
 #include <map>
+#include <mutex>
+#include <string>
 #include <typeindex>
 #include <typeinfo>
 #include <utility>
@@ -43,12 +46,29 @@
 
 namespace pbrt {
 
-std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description);
+// Returns events for timing a launch of the kernel with the given description
+// that processes _nItems_ items.
+std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description,
+                                                      int nItems = 0);
+// Records a kernel's launch configuration for the kernel profile: its block
+// size, registers per thread, and how many of its threads are resident on each
+// multiprocessor.
+void SetKernelOccupancy(const char *description, int blockSize, int registers,
+                        int residentThreads);
+
+// While GPULaunchGraph() is capturing a CUDA graph, returns true and gives
+// the stream that work must be submitted to for it to be recorded. Profiler
+// events aren't recorded for the work in graphs, which are timed as a whole.
+bool GPUCapturingGraph();
+cudaStream_t GPULaunchStream();
 
 template <typename F>
 inline int GetBlockSize(const char *description, F kernel) {
-    // Note: this isn't re-entrant, but that's fine for our purposes...
+    // Kernels may be launched from multiple threads when rendering on
+    // multiple GPUs; all of them have the same shader model.
     static std::map<std::type_index, int> kernelBlockSizes;
+    static std::mutex kernelBlockSizesMutex;
+    std::lock_guard<std::mutex> lock(kernelBlockSizesMutex);
 
     std::type_index index = std::type_index(typeid(F));
 
@@ -62,6 +82,14 @@ inline int GetBlockSize(const char *description, F kernel) {
     kernelBlockSizes[index] = blockSize;
     LOG_VERBOSE("[%s]: block size %d", description, blockSize);
 
+    cudaFuncAttributes attributes;
+    CUDA_CHECK(cudaFuncGetAttributes(&attributes, kernel));
+    int blocksPerMultiprocessor;
+    CUDA_CHECK(cudaOccupancyMaxActiveBlocksPerMultiprocessor(&blocksPerMultiprocessor,
+                                                             kernel, blockSize, 0));
+    SetKernelOccupancy(description, blockSize, attributes.numRegs,
+                       blocksPerMultiprocessor * blockSize);
+
     return blockSize;
 }
 
@@ -87,18 +115,24 @@ void GPUParallelFor(const char *description, int nItems, F func) {
     auto kernel = &Kernel<F>;
 
     int blockSize = GetBlockSize(description, kernel);
-    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents(description);
+    bool capturing = GPUCapturingGraph();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing)
+        events = GetProfilerEvents(description, nItems);
 
 #ifdef PBRT_DEBUG_BUILD
     LOG_VERBOSE("Launching %s", description);
 #endif
-    cudaEventRecord(events.first);
+    if (!capturing)
+        cudaEventRecord(events.first);
     int gridSize = (nItems + blockSize - 1) / blockSize;
-    kernel<<<gridSize, blockSize>>>(func, nItems);
-    cudaEventRecord(events.second);
+    kernel<<<gridSize, blockSize, 0, GPULaunchStream()>>>(func, nItems);
+    if (!capturing)
+        cudaEventRecord(events.second);
 
 #ifdef PBRT_DEBUG_BUILD
-    CUDA_CHECK(cudaDeviceSynchronize());
+    if (!capturing)
+        CUDA_CHECK(cudaDeviceSynchronize());
     LOG_VERBOSE("Post-sync %s", description);
 #endif
 #ifdef NVTX
@@ -111,11 +145,36 @@ void GPUParallelFor(const char *description, int nItems, F func) {
 // GPU Synchronization Function Declarations
 void GPUWait();
 
+// Records the work that _launch_ submits in a CUDA graph the first time that
+// it is called with a given _graph_ and launches the graph, which avoids the
+// cost of launching each of its kernels individually.
+void GPULaunchGraph(const char *description, cudaGraphExec_t *graph,
+                    const std::function<void()> &launch);
+
 void ReportKernelStats();
+// Writes the kernel profile to _filename_ as JSON or, if it has a ".csv"
+// extension, as comma-separated values.
+void WriteKernelStats(const std::string &filename);
 
 void GPUInit();
 void GPUThreadInit();
 
+// Returns the CUDA devices used for rendering; the first one is the primary
+// device that holds the film and the scene description.
+const std::vector<int> &GPUDevices();
+
+// Calls the given function with each of the rendering devices current in
+// turn, leaving the primary device current afterward.
+template <typename F>
+void ForEachGPU(F func) {
+    const std::vector<int> &devices = GPUDevices();
+    for (int device : devices) {
+        CUDA_CHECK(cudaSetDevice(device));
+        func(device);
+    }
+    CUDA_CHECK(cudaSetDevice(devices[0]));
+}
+
 void GPURegisterThread(const char *name);
 void GPUNameStream(cudaStream_t stream, const char *name);
 
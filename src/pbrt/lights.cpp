@@ -9,6 +9,7 @@
 #include <pbrt/lights.h>
 
 #include <pbrt/cameras.h>
+#include <pbrt/media.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/samplers.h>
 #include <pbrt/shapes.h>
@@ -17,6 +18,7 @@
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/float.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
@@ -25,6 +27,9 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 
+#include <algorithm>
+#include <numeric>
+
 namespace pbrt {
 
 STAT_COUNTER("Scene/Lights", numLights);
@@ -151,12 +156,12 @@ Float LightBounds::Importance(Point3f p, Normal3f n) const {
 
 // PointLight Method Definitions
 SampledSpectrum PointLight::Phi(SampledWavelengths lambda) const {
-    return 4 * Pi * scale * I.Sample(lambda);
+    return 4 * Pi * scale * I->Sample(lambda);
 }
 
 pstd::optional<LightBounds> PointLight::Bounds() const {
     Point3f p = renderFromLight(Point3f(0, 0, 0));
-    Float phi = 4 * Pi * scale * I.MaxValue();
+    Float phi = 4 * Pi * scale * I->MaxValue();
     return LightBounds(Bounds3f(p, p), Vector3f(0, 0, 1), phi, std::cos(Pi),
                        std::cos(Pi / 2), false);
 }
@@ -166,7 +171,7 @@ pstd::optional<LightLeSample> PointLight::SampleLe(Point2f u1, Point2f u2,
                                                    Float time) const {
     Point3f p = renderFromLight(Point3f(0, 0, 0));
     Ray ray(p, SampleUniformSphere(u1), time, mediumInterface.outside);
-    return LightLeSample(scale * I.Sample(lambda), ray, 1, UniformSpherePDF());
+    return LightLeSample(scale * I->Sample(lambda), ray, 1, UniformSpherePDF());
 }
 
 void PointLight::PDF_Le(const Ray &, Float *pdfPos, Float *pdfDir) const {
@@ -175,7 +180,7 @@ void PointLight::PDF_Le(const Ray &, Float *pdfPos, Float *pdfDir) const {
 }
 
 std::string PointLight::ToString() const {
-    return StringPrintf("[ PointLight %s I: %s scale: %f ]", BaseToString(), I, scale);
+    return StringPrintf("[ PointLight %s I: %s scale: %f ]", BaseToString(), *I, scale);
 }
 
 PointLight *PointLight::Create(const Transform &renderFromLight, Medium medium,
@@ -203,7 +208,7 @@ PointLight *PointLight::Create(const Transform &renderFromLight, Medium medium,
 
 // DistantLight Method Definitions
 SampledSpectrum DistantLight::Phi(SampledWavelengths lambda) const {
-    return scale * Lemit.Sample(lambda) * Pi * Sqr(sceneRadius);
+    return scale * Lemit->Sample(lambda) * Pi * Sqr(sceneRadius);
 }
 
 pstd::optional<LightLeSample> DistantLight::SampleLe(Point2f u1, Point2f u2,
@@ -218,7 +223,7 @@ pstd::optional<LightLeSample> DistantLight::SampleLe(Point2f u1, Point2f u2,
     // Compute _DistantLight_ light ray
     Ray ray(pDisk + sceneRadius * w, -w, time);
 
-    return LightLeSample(scale * Lemit.Sample(lambda), ray, 1 / (Pi * Sqr(sceneRadius)),
+    return LightLeSample(scale * Lemit->Sample(lambda), ray, 1 / (Pi * Sqr(sceneRadius)),
                          1);
 }
 
@@ -228,7 +233,7 @@ void DistantLight::PDF_Le(const Ray &, Float *pdfPos, Float *pdfDir) const {
 }
 
 std::string DistantLight::ToString() const {
-    return StringPrintf("[ DistantLight %s Lemit: %s scale: %f ]", BaseToString(), Lemit,
+    return StringPrintf("[ DistantLight %s Lemit: %s scale: %f ]", BaseToString(), *Lemit,
                         scale);
 }
 
@@ -503,7 +508,7 @@ GoniometricLight::GoniometricLight(const Transform &renderFromLight,
                                    const MediumInterface &mediumInterface, Spectrum Iemit,
                                    Float scale, Image im, Allocator alloc)
     : LightBase(LightType::DeltaPosition, renderFromLight, mediumInterface),
-      Iemit(Iemit, alloc),
+      Iemit(LookupSpectrum(Iemit, alloc)),
       scale(scale),
       image(std::move(im)),
       distrib(alloc) {
@@ -537,7 +542,7 @@ SampledSpectrum GoniometricLight::Phi(SampledWavelengths lambda) const {
     for (int y = 0; y < image.Resolution().y; ++y)
         for (int x = 0; x < image.Resolution().x; ++x)
             sumY += image.GetChannel({x, y}, 0);
-    return scale * Iemit.Sample(lambda) * 4 * Pi * sumY /
+    return scale * Iemit->Sample(lambda) * 4 * Pi * sumY /
            (image.Resolution().x * image.Resolution().y);
 }
 
@@ -546,7 +551,7 @@ pstd::optional<LightBounds> GoniometricLight::Bounds() const {
     for (int y = 0; y < image.Resolution().y; ++y)
         for (int x = 0; x < image.Resolution().x; ++x)
             sumY += image.GetChannel({x, y}, 0);
-    Float phi = scale * Iemit.MaxValue() * 4 * Pi * sumY /
+    Float phi = scale * Iemit->MaxValue() * 4 * Pi * sumY /
                 (image.Resolution().x * image.Resolution().y);
 
     Point3f p = renderFromLight(Point3f(0, 0, 0));
@@ -578,7 +583,7 @@ void GoniometricLight::PDF_Le(const Ray &ray, Float *pdfPos, Float *pdfDir) cons
 
 std::string GoniometricLight::ToString() const {
     return StringPrintf("[ GoniometricLight %s Iemit: %s scale: %f ]", BaseToString(),
-                        Iemit, scale);
+                        *Iemit, scale);
 }
 
 GoniometricLight *GoniometricLight::Create(const Transform &renderFromLight,
@@ -651,35 +656,34 @@ GoniometricLight *GoniometricLight::Create(const Transform &renderFromLight,
 }
 
 // DiffuseAreaLight Method Definitions
+// Returns the _LightType_ of a diffuse area light with the given alpha texture.
+// Special case handling for area lights with constant zero-valued alpha
+// textures to allow invisible area lights: we will null out the alpha
+// texture so that as far as the light is concerned, there is no alpha
+// texture and the light is fully emissive. However, such lights will never
+// be intersected by rays (because their associated primitives still have
+// the alpha texture), so we mark them as DeltaPosition lights here so that
+// MIS isn't used for direct illumination. Thus, light sampling is the only
+// strategy used and we get an unbiased (if potentially high variance)
+// estimate.
+static LightType DiffuseAreaLightType(FloatTexture alpha) {
+    const FloatConstantTexture *fc = alpha.CastOrNullptr<FloatConstantTexture>();
+    if (fc && fc->Evaluate(TextureEvalContext()) == 0)
+        return LightType::DeltaPosition;
+    return LightType::Area;
+}
+
 DiffuseAreaLight::DiffuseAreaLight(const Transform &renderFromLight,
                                    const MediumInterface &mediumInterface, Spectrum Le,
                                    Float scale, const Shape shape, FloatTexture alpha,
                                    Image im, const RGBColorSpace *imageColorSpace,
                                    bool twoSided, Allocator alloc)
-    : LightBase(
-          [](FloatTexture alpha) {
-              // Special case handling for area lights with constant zero-valued alpha
-              // textures to allow invisible area lights: we will null out the alpha
-              // texture below so that as far as the DiffuseAreaLight is concerned, there
-              // is no alpha texture and the light is fully emissive. However, such lights
-              // will never be intersected by rays (because their associated primitives
-              // still have the alpha texture), so we mark them as DeltaPosition lights
-              // here so that MIS isn't used for direct illumination. Thus, light sampling
-              // is the only strategy used and we get an unbiased (if potentially high
-              // variance) estimate.
-
-              const FloatConstantTexture *fc =
-                  alpha.CastOrNullptr<FloatConstantTexture>();
-              if (fc && fc->Evaluate(TextureEvalContext()) == 0)
-                  return LightType::DeltaPosition;
-              return LightType::Area;
-          }(alpha),
-          renderFromLight, mediumInterface),
+    : LightBase(DiffuseAreaLightType(alpha), renderFromLight, mediumInterface),
       shape(shape),
       alpha(type == LightType::Area ? alpha : nullptr),
       area(shape.Area()),
       twoSided(twoSided),
-      Lemit(Le, alloc),
+      Lemit(LookupSpectrum(Le, alloc)),
       scale(scale),
       image(std::move(im)),
       imageColorSpace(imageColorSpace) {
@@ -751,7 +755,7 @@ SampledSpectrum DiffuseAreaLight::Phi(SampledWavelengths lambda) const {
         L *= scale / (image.Resolution().x * image.Resolution().y);
 
     } else
-        L = Lemit.Sample(lambda) * scale;
+        L = Lemit->Sample(lambda) * scale;
     return Pi * (twoSided ? 2 : 1) * area * L;
 }
 
@@ -768,7 +772,7 @@ pstd::optional<LightBounds> DiffuseAreaLight::Bounds() const {
         phi /= 3 * image.Resolution().x * image.Resolution().y;
 
     } else
-        phi = Lemit.MaxValue();
+        phi = Lemit->MaxValue();
     phi *= scale * area * Pi;
 
     DirectionCone nb = shape.NormalBounds();
@@ -831,25 +835,24 @@ void DiffuseAreaLight::PDF_Le(const Interaction &intr, Vector3f w, Float *pdfPos
 std::string DiffuseAreaLight::ToString() const {
     return StringPrintf("[ DiffuseAreaLight %s Lemit: %s scale: %f shape: %s alpha: %s "
                         "twoSided: %s area: %f image: %s ]",
-                        BaseToString(), Lemit, scale, shape, alpha,
+                        BaseToString(), *Lemit, scale, shape, alpha,
                         twoSided ? "true" : "false", area, image);
 }
 
-DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
-                                           Medium medium,
-                                           const ParameterDictionary &parameters,
-                                           const RGBColorSpace *colorSpace,
-                                           const FileLoc *loc, Allocator alloc,
-                                           const Shape shape, FloatTexture alphaTex) {
-    Spectrum L = parameters.GetOneSpectrum("L", nullptr, SpectrumType::Illuminant, alloc);
-    Float scale = parameters.GetOneFloat("scale", 1);
-    bool twoSided = parameters.GetOneBool("twosided", false);
+// Reads the emission parameters of a "diffuse" area light
+static void GetDiffuseAreaLightEmission(const ParameterDictionary &parameters,
+                                        const RGBColorSpace *colorSpace,
+                                        const FileLoc *loc, Allocator alloc, Spectrum *L,
+                                        Float *scale, bool *twoSided, Image *image,
+                                        const RGBColorSpace **imageColorSpace) {
+    *L = parameters.GetOneSpectrum("L", nullptr, SpectrumType::Illuminant, alloc);
+    *scale = parameters.GetOneFloat("scale", 1);
+    *twoSided = parameters.GetOneBool("twosided", false);
 
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
-    Image image(alloc);
-    const RGBColorSpace *imageColorSpace = nullptr;
+    *imageColorSpace = nullptr;
     if (!filename.empty()) {
-        if (L != nullptr)
+        if (*L != nullptr)
             ErrorExit(loc, "Both \"L\" and \"filename\" specified for DiffuseAreaLight.");
         ImageAndMetadata im = Image::Read(filename, alloc);
 
@@ -859,14 +862,29 @@ DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
                       "%s: Image provided to \"diffuse\" area light must have "
                       "R, G, and B channels.",
                       filename);
-        image = im.image.SelectChannels(channelDesc, alloc);
+        *image = im.image.SelectChannels(channelDesc, alloc);
 
-        imageColorSpace = im.metadata.GetColorSpace();
-    } else if (L == nullptr)
-        L = &colorSpace->illuminant;
+        *imageColorSpace = im.metadata.GetColorSpace();
+    } else if (*L == nullptr)
+        *L = &colorSpace->illuminant;
 
     // scale so that radiance is equivalent to 1 nit
-    scale /= SpectrumToPhotometric(L ? L : &colorSpace->illuminant);
+    *scale /= SpectrumToPhotometric(*L ? *L : &colorSpace->illuminant);
+}
+
+DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
+                                           Medium medium,
+                                           const ParameterDictionary &parameters,
+                                           const RGBColorSpace *colorSpace,
+                                           const FileLoc *loc, Allocator alloc,
+                                           const Shape shape, FloatTexture alphaTex) {
+    Spectrum L;
+    Float scale;
+    bool twoSided;
+    Image image(alloc);
+    const RGBColorSpace *imageColorSpace;
+    GetDiffuseAreaLightEmission(parameters, colorSpace, loc, alloc, &L, &scale, &twoSided,
+                                &image, &imageColorSpace);
 
     Float phi_v = parameters.GetOneFloat("power", -1.0f);
     if (phi_v > 0) {
@@ -903,16 +921,202 @@ DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
                                               twoSided, alloc);
 }
 
+// DiffuseMeshAreaLight Method Definitions
+STAT_MEMORY_COUNTER("Memory/Triangle area lights", triangleAreaLightBytes);
+
+DiffuseMeshAreaLight::DiffuseMeshAreaLight(const Transform &renderFromLight,
+                                           const MediumInterface &mediumInterface,
+                                           Spectrum Le, Float scale, FloatTexture alpha,
+                                           Image im, const RGBColorSpace *imageColorSpace,
+                                           bool twoSided, Allocator alloc)
+    : LightBase(DiffuseAreaLightType(alpha), renderFromLight, mediumInterface),
+      alpha(type == LightType::Area ? alpha : nullptr),
+      twoSided(twoSided),
+      Lemit(LookupSpectrum(Le, alloc)),
+      scale(scale),
+      image(std::move(im)),
+      imageColorSpace(imageColorSpace) {
+    // Compute _phiPerArea_ for the triangles' light bounds
+    if (image) {
+        ImageChannelDesc desc = image.GetChannelDesc({"R", "G", "B"});
+        if (!desc)
+            ErrorExit("Image used for DiffuseAreaLight doesn't have R, G, B "
+                      "channels.");
+        CHECK_EQ(3, desc.size());
+        CHECK(desc.IsIdentity());
+        CHECK(imageColorSpace != nullptr);
+        // Compute average image channel value
+        // Assume no distortion in the mapping, FWIW...
+        phiPerArea = 0;
+        for (int y = 0; y < image.Resolution().y; ++y)
+            for (int x = 0; x < image.Resolution().x; ++x)
+                for (int c = 0; c < 3; ++c)
+                    phiPerArea += image.GetChannel({x, y}, c);
+        phiPerArea /= 3 * image.Resolution().x * image.Resolution().y;
+    } else {
+        CHECK(Le);
+        phiPerArea = Lemit->MaxValue();
+    }
+    phiPerArea *= scale * Pi;
+}
+
+pstd::vector<Light> DiffuseMeshAreaLight::Create(const Transform &renderFromLight,
+                                                 Medium medium,
+                                                 const ParameterDictionary &parameters,
+                                                 const RGBColorSpace *colorSpace,
+                                                 const FileLoc *loc, Allocator alloc,
+                                                 pstd::span<const Shape> triangles,
+                                                 FloatTexture alphaTex) {
+    Spectrum L;
+    Float scale;
+    bool twoSided;
+    Image image(alloc);
+    const RGBColorSpace *imageColorSpace;
+    GetDiffuseAreaLightEmission(parameters, colorSpace, loc, alloc, &L, &scale, &twoSided,
+                                &image, &imageColorSpace);
+    DiffuseMeshAreaLight *meshLight = alloc.new_object<DiffuseMeshAreaLight>(
+        renderFromLight, medium, L, scale, alphaTex, std::move(image), imageColorSpace,
+        twoSided, alloc);
+
+    // Allocate a _TriangleAreaLight_ for each triangle
+    pstd::vector<Light> lights(triangles.size(), alloc);
+    TriangleAreaLight *t = alloc.allocate_object<TriangleAreaLight>(triangles.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const Triangle *triangle = triangles[i].Cast<Triangle>();
+        alloc.construct(&t[i], meshLight, *triangle);
+        lights[i] = &t[i];
+    }
+    numAreaLights += triangles.size();
+    triangleAreaLightBytes +=
+        sizeof(DiffuseMeshAreaLight) + triangles.size() * sizeof(TriangleAreaLight);
+    return lights;
+}
+
+pstd::optional<LightLiSample> DiffuseMeshAreaLight::SampleLi(
+    const Triangle &triangle, LightSampleContext ctx, Point2f u,
+    SampledWavelengths lambda) const {
+    // Sample point on triangle for _DiffuseMeshAreaLight_
+    ShapeSampleContext shapeCtx(ctx.pi, ctx.n, ctx.ns, 0 /* time */);
+    pstd::optional<ShapeSample> ss = triangle.Sample(shapeCtx, u);
+    if (!ss || ss->pdf == 0 || LengthSquared(ss->intr.p() - ctx.p()) == 0)
+        return {};
+    DCHECK(!IsNaN(ss->pdf));
+    ss->intr.mediumInterface = &mediumInterface;
+
+    // Check sampled point on triangle against alpha texture, if present
+    if (AlphaMasked(ss->intr))
+        return {};
+
+    // Return _LightLiSample_ for sampled point on triangle
+    Vector3f wi = Normalize(ss->intr.p() - ctx.p());
+    SampledSpectrum Le = L(ss->intr.p(), ss->intr.n, ss->intr.uv, -wi, lambda);
+    if (!Le)
+        return {};
+    return LightLiSample(Le, wi, ss->pdf, ss->intr);
+}
+
+SampledSpectrum DiffuseMeshAreaLight::Phi(const Triangle &triangle,
+                                          SampledWavelengths lambda) const {
+    SampledSpectrum L(0.f);
+    if (image) {
+        // Compute average light image emission
+        for (int y = 0; y < image.Resolution().y; ++y)
+            for (int x = 0; x < image.Resolution().x; ++x) {
+                RGB rgb;
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] = image.GetChannel({x, y}, c);
+                L += RGBIlluminantSpectrum(*imageColorSpace, ClampZero(rgb))
+                         .Sample(lambda);
+            }
+        L *= scale / (image.Resolution().x * image.Resolution().y);
+
+    } else
+        L = Lemit->Sample(lambda) * scale;
+    return Pi * (twoSided ? 2 : 1) * triangle.Area() * L;
+}
+
+pstd::optional<LightBounds> DiffuseMeshAreaLight::Bounds(const Triangle &triangle) const {
+    DirectionCone nb = triangle.NormalBounds();
+    return LightBounds(triangle.Bounds(), nb.w, phiPerArea * triangle.Area(),
+                       nb.cosTheta, std::cos(Pi / 2), twoSided);
+}
+
+pstd::optional<LightLeSample> DiffuseMeshAreaLight::SampleLe(const Triangle &triangle,
+                                                             Point2f u1, Point2f u2,
+                                                             SampledWavelengths &lambda,
+                                                             Float time) const {
+    // Sample a point on the triangle
+    pstd::optional<ShapeSample> ss = triangle.Sample(u1);
+    if (!ss)
+        return {};
+    ss->intr.time = time;
+    ss->intr.mediumInterface = &mediumInterface;
+
+    // Check sampled point on triangle against alpha texture, if present
+    if (AlphaMasked(ss->intr))
+        return {};
+
+    // Sample a cosine-weighted outgoing direction _w_ for area light
+    Vector3f w;
+    Float pdfDir;
+    if (twoSided) {
+        // Choose side of surface and sample cosine-weighted outgoing direction
+        if (u2[0] < 0.5f) {
+            u2[0] = std::min(u2[0] * 2, OneMinusEpsilon);
+            w = SampleCosineHemisphere(u2);
+        } else {
+            u2[0] = std::min((u2[0] - 0.5f) * 2, OneMinusEpsilon);
+            w = SampleCosineHemisphere(u2);
+            w.z *= -1;
+        }
+        pdfDir = CosineHemispherePDF(std::abs(w.z)) / 2;
+
+    } else {
+        w = SampleCosineHemisphere(u2);
+        pdfDir = CosineHemispherePDF(w.z);
+    }
+    if (pdfDir == 0)
+        return {};
+
+    // Return _LightLeSample_ for ray leaving area light
+    const Interaction &intr = ss->intr;
+    Frame nFrame = Frame::FromZ(intr.n);
+    w = nFrame.FromLocal(w);
+    return LightLeSample(L(intr.p(), intr.n, intr.uv, w, lambda), intr.SpawnRay(w), intr,
+                         ss->pdf, pdfDir);
+}
+
+void DiffuseMeshAreaLight::PDF_Le(const Triangle &triangle, const Interaction &intr,
+                                  Vector3f w, Float *pdfPos, Float *pdfDir) const {
+    CHECK_NE(intr.n, Normal3f(0, 0, 0));
+    *pdfPos = triangle.PDF(intr);
+    *pdfDir = twoSided ? (CosineHemispherePDF(AbsDot(intr.n, w)) / 2)
+                       : CosineHemispherePDF(Dot(intr.n, w));
+}
+
+std::string DiffuseMeshAreaLight::ToString() const {
+    return StringPrintf("[ DiffuseMeshAreaLight %s Lemit: %s scale: %f alpha: %s "
+                        "twoSided: %s image: %s ]",
+                        BaseToString(), *Lemit, scale, alpha, twoSided ? "true" : "false",
+                        image);
+}
+
+// TriangleAreaLight Method Definitions
+std::string TriangleAreaLight::ToString() const {
+    return StringPrintf("[ TriangleAreaLight meshLight: %s triangle: %s ]",
+                        meshLight->ToString(), triangle.ToString());
+}
+
 // UniformInfiniteLight Method Definitions
 UniformInfiniteLight::UniformInfiniteLight(const Transform &renderFromLight,
                                            Spectrum Lemit, Float scale, Allocator alloc)
     : LightBase(LightType::Infinite, renderFromLight, MediumInterface()),
-      Lemit(Lemit, alloc),
+      Lemit(LookupSpectrum(Lemit, alloc)),
       scale(scale) {}
 
 SampledSpectrum UniformInfiniteLight::Le(const Ray &ray,
                                          const SampledWavelengths &lambda) const {
-    return scale * Lemit.Sample(lambda);
+    return scale * Lemit->Sample(lambda);
 }
 
 pstd::optional<LightLiSample> UniformInfiniteLight::SampleLi(
@@ -923,7 +1127,7 @@ pstd::optional<LightLiSample> UniformInfiniteLight::SampleLi(
     // Return uniform spherical sample for uniform infinite light
     Vector3f wi = SampleUniformSphere(u);
     Float pdf = UniformSpherePDF();
-    return LightLiSample(scale * Lemit.Sample(lambda), wi, pdf,
+    return LightLiSample(scale * Lemit->Sample(lambda), wi, pdf,
                          Interaction(ctx.p() + wi * (2 * sceneRadius), &mediumInterface));
 }
 
@@ -935,7 +1139,7 @@ Float UniformInfiniteLight::PDF_Li(LightSampleContext ctx, Vector3f w,
 }
 
 SampledSpectrum UniformInfiniteLight::Phi(SampledWavelengths lambda) const {
-    return 4 * Pi * Pi * Sqr(sceneRadius) * scale * Lemit.Sample(lambda);
+    return 4 * Pi * Pi * Sqr(sceneRadius) * scale * Lemit->Sample(lambda);
 }
 
 pstd::optional<LightLeSample> UniformInfiniteLight::SampleLe(Point2f u1, Point2f u2,
@@ -954,7 +1158,7 @@ pstd::optional<LightLeSample> UniformInfiniteLight::SampleLe(Point2f u1, Point2f
     Float pdfPos = 1 / (Pi * Sqr(sceneRadius));
     Float pdfDir = UniformSpherePDF();
 
-    return LightLeSample(scale * Lemit.Sample(lambda), ray, pdfPos, pdfDir);
+    return LightLeSample(scale * Lemit->Sample(lambda), ray, pdfPos, pdfDir);
 }
 
 void UniformInfiniteLight::PDF_Le(const Ray &ray, Float *pdfPos, Float *pdfDir) const {
@@ -963,7 +1167,7 @@ void UniformInfiniteLight::PDF_Le(const Ray &ray, Float *pdfPos, Float *pdfDir)
 }
 
 std::string UniformInfiniteLight::ToString() const {
-    return StringPrintf("[ UniformInfiniteLight %s Lemit: %s ]", BaseToString(), Lemit);
+    return StringPrintf("[ UniformInfiniteLight %s Lemit: %s ]", BaseToString(), *Lemit);
 }
 
 // ImageInfiniteLight Method Definitions
@@ -991,15 +1195,20 @@ ImageInfiniteLight::ImageInfiniteLight(Transform renderFromLight, Image im,
                   filename, image.Resolution().x, image.Resolution().y);
     Array2D<Float> d = image.GetSamplingDistribution();
     Bounds2f domain = Bounds2f(Point2f(0, 0), Point2f(1, 1));
-    distribution = PiecewiseConstant2D(d, domain, alloc);
+    distribution = AliasTable2D(d, domain, alloc);
 
     // Initialize compensated PDF for image infinite area light
-    Float average = std::accumulate(d.begin(), d.end(), 0.) / d.size();
-    for (Float &v : d)
-        v = std::max<Float>(v - average, 0);
-    if (std::all_of(d.begin(), d.end(), [](Float v) { return v == 0; }))
-        std::fill(d.begin(), d.end(), Float(1));
-    compensatedDistribution = PiecewiseConstant2D(d, domain, alloc);
+    std::vector<double> rowSums(d.ySize());
+    ParallelFor(0, d.ySize(), [&](int64_t y) {
+        for (int x = 0; x < d.xSize(); ++x)
+            rowSums[y] += d(x, y);
+    });
+    Float average = std::accumulate(rowSums.begin(), rowSums.end(), 0.) / d.size();
+    ParallelFor(0, d.ySize(), [&](int64_t y) {
+        for (int x = 0; x < d.xSize(); ++x)
+            d(x, y) = std::max<Float>(d(x, y) - average, 0);
+    });
+    compensatedDistribution = AliasTable2D(d, domain, alloc);
 }
 
 Float ImageInfiniteLight::PDF_Li(LightSampleContext ctx, Vector3f w,
@@ -1307,7 +1516,7 @@ SpotLight::SpotLight(const Transform &renderFromLight,
                      const MediumInterface &mediumInterface, Spectrum Iemit, Float scale,
                      Float totalWidth, Float falloffStart, Allocator alloc)
     : LightBase(LightType::DeltaPosition, renderFromLight, mediumInterface),
-      Iemit(Iemit, alloc),
+      Iemit(LookupSpectrum(Iemit, alloc)),
       scale(scale),
       cosFalloffEnd(std::cos(Radians(totalWidth))),
       cosFalloffStart(std::cos(Radians(falloffStart))) {
@@ -1320,18 +1529,18 @@ Float SpotLight::PDF_Li(LightSampleContext, Vector3f, LightSamplingMode mode) co
 
 SampledSpectrum SpotLight::I(Vector3f w, SampledWavelengths lambda) const {
     return SmoothStep(CosTheta(w), cosFalloffEnd, cosFalloffStart) * scale *
-           Iemit.Sample(lambda);
+           Iemit->Sample(lambda);
 }
 
 SampledSpectrum SpotLight::Phi(SampledWavelengths lambda) const {
-    return scale * Iemit.Sample(lambda) * 2 * Pi *
+    return scale * Iemit->Sample(lambda) * 2 * Pi *
            ((1 - cosFalloffStart) + (cosFalloffStart - cosFalloffEnd) / 2);
 }
 
 pstd::optional<LightBounds> SpotLight::Bounds() const {
     Point3f p = renderFromLight(Point3f(0, 0, 0));
     Vector3f w = Normalize(renderFromLight(Vector3f(0, 0, 1)));
-    Float phi = scale * Iemit.MaxValue() * 4 * Pi;
+    Float phi = scale * Iemit->MaxValue() * 4 * Pi;
     Float cosTheta_e = std::cos(std::acos(cosFalloffEnd) - std::acos(cosFalloffStart));
     // Allow a little slop here to deal with fp round-off error in the computation of
     // cosTheta_p in the importance function.
@@ -1388,7 +1597,7 @@ void SpotLight::PDF_Le(const Ray &ray, Float *pdfPos, Float *pdfDir) const {
 std::string SpotLight::ToString() const {
     return StringPrintf(
         "[ SpotLight %s Iemit: %s cosFalloffStart: %f cosFalloffEnd: %f ]",
-        BaseToString(), Iemit, cosFalloffStart, cosFalloffEnd);
+        BaseToString(), *Iemit, cosFalloffStart, cosFalloffEnd);
 }
 
 SpotLight *SpotLight::Create(const Transform &renderFromLight, Medium medium,
@@ -1424,6 +1633,101 @@ SpotLight *SpotLight::Create(const Transform &renderFromLight, Medium medium,
                                        coneangle - conedelta, alloc);
 }
 
+// VolumeEmitterLight Method Definitions
+VolumeEmitterLight::VolumeEmitterLight(Medium medium, MediumEmissionGrid grid,
+                                       Allocator alloc)
+    : LightBase(LightType::Area, grid.renderFromMedium, MediumInterface(medium)),
+      bounds(grid.bounds),
+      res(grid.res),
+      distrib(grid.maxEmission, alloc) {
+    // Compute rendering space voxel volume and bound on emitted power
+    Float det = std::abs(grid.renderFromMedium.GetMatrix().Determinant());
+    voxelVolume = det * bounds.Volume() / (res.x * res.y * res.z);
+    Float sumEmission = std::accumulate(grid.maxEmission.begin(),
+                                        grid.maxEmission.end(), Float(0));
+    phi = 4 * Pi * voxelVolume * sumEmission;
+}
+
+VolumeEmitterLight *VolumeEmitterLight::Create(Medium medium, Allocator alloc) {
+    pstd::optional<MediumEmissionGrid> grid = medium.GetEmissionGrid(alloc);
+    if (!grid || std::all_of(grid->maxEmission.begin(), grid->maxEmission.end(),
+                             [](Float e) { return e == 0; }))
+        return nullptr;
+    return alloc.new_object<VolumeEmitterLight>(medium, std::move(*grid), alloc);
+}
+
+Point3f VolumeEmitterLight::SamplePoint(Point2f u, Float *pdf) const {
+    // Choose a voxel and reuse the remapped sample to place the point within it
+    Float voxelPMF, ux;
+    int index = distrib.Sample(u[0], &voxelPMF, &ux);
+    *pdf = voxelPMF / voxelVolume;
+    int ix = index % res.x, iy = (index / res.x) % res.y, iz = index / (res.x * res.y);
+    Point3f p((ix + ux) / res.x, (iy + u[1]) / res.y, (iz + HashFloat(u)) / res.z);
+    return renderFromLight(bounds.Lerp(p));
+}
+
+Float VolumeEmitterLight::PDF(Point3f pRender) const {
+    Point3f p = renderFromLight.ApplyInverse(pRender);
+    if (!Inside(p, bounds))
+        return 0;
+    Point3f pg(bounds.Offset(p));
+    int ix = Clamp(int(pg.x * res.x), 0, res.x - 1);
+    int iy = Clamp(int(pg.y * res.y), 0, res.y - 1);
+    int iz = Clamp(int(pg.z * res.z), 0, res.z - 1);
+    return distrib.PDF(ix + res.x * (iy + res.y * iz)) / voxelVolume;
+}
+
+pstd::optional<LightLiSample> VolumeEmitterLight::SampleLi(LightSampleContext ctx,
+                                                           Point2f u,
+                                                           SampledWavelengths lambda,
+                                                           LightSamplingMode mode) const {
+    // Sample point in medium and return its emission per unit length
+    Float pdf;
+    Point3f p = SamplePoint(u, &pdf);
+    Float dist2 = DistanceSquared(ctx.p(), p);
+    if (pdf == 0 || dist2 == 0)
+        return {};
+    MediumProperties mp = GetMedium().Sample(p, lambda);
+    SampledSpectrum Le = mp.sigma_a * mp.Le;
+    if (!Le)
+        return {};
+    Vector3f wi = Normalize(p - ctx.p());
+    return LightLiSample(Le, wi, pdf * dist2, Interaction(p, &mediumInterface));
+}
+
+SampledSpectrum VolumeEmitterLight::Phi(SampledWavelengths lambda) const {
+    return SampledSpectrum(phi);
+}
+
+pstd::optional<LightBounds> VolumeEmitterLight::Bounds() const {
+    // Emission is isotropic, like a point light's over the medium's bounds
+    return LightBounds(renderFromLight(bounds), Vector3f(0, 0, 1), phi, std::cos(Pi),
+                       std::cos(Pi / 2), false);
+}
+
+pstd::optional<LightLeSample> VolumeEmitterLight::SampleLe(Point2f u1, Point2f u2,
+                                                           SampledWavelengths &lambda,
+                                                           Float time) const {
+    Float pdfPos;
+    Point3f p = SamplePoint(u1, &pdfPos);
+    if (pdfPos == 0)
+        return {};
+    MediumProperties mp = GetMedium().Sample(p, lambda);
+    Ray ray(p, SampleUniformSphere(u2), time, GetMedium());
+    return LightLeSample(mp.sigma_a * mp.Le, ray, pdfPos, UniformSpherePDF());
+}
+
+void VolumeEmitterLight::PDF_Le(const Ray &ray, Float *pdfPos, Float *pdfDir) const {
+    *pdfPos = PDF(ray.o);
+    *pdfDir = UniformSpherePDF();
+}
+
+std::string VolumeEmitterLight::ToString() const {
+    return StringPrintf("[ VolumeEmitterLight %s bounds: %s res: %s voxelVolume: %f "
+                        "phi: %f (distrib elided) ]",
+                        BaseToString(), bounds, res, voxelVolume, phi);
+}
+
 SampledSpectrum Light::Phi(SampledWavelengths lambda) const {
     auto phi = [&](auto ptr) { return ptr->Phi(lambda); };
     return DispatchCPU(phi);
@@ -1618,4 +1922,32 @@ Light Light::CreateArea(const std::string &name, const ParameterDictionary &para
     return area;
 }
 
+pstd::vector<Light> Light::CreateAreaLights(const std::string &name,
+                                            const ParameterDictionary &parameters,
+                                            const Transform &renderFromLight,
+                                            const MediumInterface &mediumInterface,
+                                            pstd::span<const Shape> shapes,
+                                            FloatTexture alpha, const FileLoc *loc,
+                                            Allocator alloc) {
+    // Share a _DiffuseMeshAreaLight_ across the triangles of a diffuse emissive mesh,
+    // unless a "power" is given, which is currently the power of each triangle
+    bool allTriangles = shapes.size() > 1 &&
+                        std::all_of(shapes.begin(), shapes.end(),
+                                    [](Shape s) { return s.Is<Triangle>(); });
+    if (name == "diffuse" && allTriangles && parameters.GetOneFloat("power", -1) <= 0) {
+        pstd::vector<Light> lights = DiffuseMeshAreaLight::Create(
+            renderFromLight, mediumInterface.outside, parameters, parameters.ColorSpace(),
+            loc, alloc, shapes, alpha);
+        parameters.ReportUnused();
+        return lights;
+    }
+
+    // Create a separate area light for each shape
+    pstd::vector<Light> lights(alloc);
+    for (Shape shape : shapes)
+        lights.push_back(CreateArea(name, parameters, renderFromLight, mediumInterface,
+                                    shape, alpha, loc, alloc));
+    return lights;
+}
+
 }  // namespace pbrt
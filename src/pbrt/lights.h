@@ -171,7 +171,7 @@ class PointLight : public LightBase {
     PointLight(Transform renderFromLight, MediumInterface mediumInterface, Spectrum I,
                Float scale, Allocator alloc)
         : LightBase(LightType::DeltaPosition, renderFromLight, mediumInterface),
-          I(I, alloc),
+          I(LookupSpectrum(I, alloc)),
           scale(scale) {}
 
     static PointLight *Create(const Transform &renderFromLight, Medium medium,
@@ -202,7 +202,7 @@ class PointLight : public LightBase {
                                            LightSamplingMode mode) const {
         Point3f p = renderFromLight(Point3f(0, 0, 0));
         Vector3f wi = Normalize(p - ctx.p());
-        SampledSpectrum Li = scale * I.Sample(lambda) / DistanceSquared(p, ctx.p());
+        SampledSpectrum Li = scale * I->Sample(lambda) / DistanceSquared(p, ctx.p());
         return LightLiSample(Li, wi, 1, Interaction(p, &mediumInterface));
     }
 
@@ -211,7 +211,7 @@ class PointLight : public LightBase {
 
   private:
     // PointLight Private Members
-    DenselySampledSpectrum I;
+    const DenselySampledSpectrum *I;
     Float scale;
 };
 
@@ -222,7 +222,7 @@ class DistantLight : public LightBase {
     DistantLight(const Transform &renderFromLight, Spectrum Lemit, Float scale,
                  Allocator alloc)
         : LightBase(LightType::DeltaDirection, renderFromLight, MediumInterface()),
-          Lemit(Lemit, alloc),
+          Lemit(LookupSpectrum(Lemit, alloc)),
           scale(scale) {}
 
     static DistantLight *Create(const Transform &renderFromLight,
@@ -260,13 +260,13 @@ class DistantLight : public LightBase {
                                            LightSamplingMode mode) const {
         Vector3f wi = Normalize(renderFromLight(Vector3f(0, 0, 1)));
         Point3f pOutside = ctx.p() + wi * (2 * sceneRadius);
-        return LightLiSample(scale * Lemit.Sample(lambda), wi, 1,
+        return LightLiSample(scale * Lemit->Sample(lambda), wi, 1,
                              Interaction(pOutside, &mediumInterface));
     }
 
   private:
     // DistantLight Private Members
-    DenselySampledSpectrum Lemit;
+    const DenselySampledSpectrum *Lemit;
     Float scale;
     Point3f sceneCenter;
     Float sceneRadius;
@@ -368,12 +368,12 @@ class GoniometricLight : public LightBase {
     PBRT_CPU_GPU
     SampledSpectrum I(Vector3f w, const SampledWavelengths &lambda) const {
         Point2f uv = EqualAreaSphereToSquare(w);
-        return scale * Iemit.Sample(lambda) * image.LookupNearestChannel(uv, 0);
+        return scale * Iemit->Sample(lambda) * image.LookupNearestChannel(uv, 0);
     }
 
   private:
     // GoniometricLight Private Members
-    DenselySampledSpectrum Iemit;
+    const DenselySampledSpectrum *Iemit;
     Float scale;
     Image image;
     PiecewiseConstant2D distrib;
@@ -433,7 +433,7 @@ class DiffuseAreaLight : public LightBase {
                    RGBIlluminantSpectrum(*imageColorSpace, ClampZero(rgb)).Sample(lambda);
 
         } else
-            return scale * Lemit.Sample(lambda);
+            return scale * Lemit->Sample(lambda);
     }
 
     PBRT_CPU_GPU
@@ -450,7 +450,7 @@ class DiffuseAreaLight : public LightBase {
     FloatTexture alpha;
     Float area;
     bool twoSided;
-    DenselySampledSpectrum Lemit;
+    const DenselySampledSpectrum *Lemit;
     Float scale;
     Image image;
     const RGBColorSpace *imageColorSpace;
@@ -473,6 +473,168 @@ class DiffuseAreaLight : public LightBase {
     }
 };
 
+// DiffuseMeshAreaLight Definition
+// Holds the emission parameters that are shared by all of the triangles of a
+// mesh with a diffuse area light; each triangle's _TriangleAreaLight_ refers to it.
+// It is not itself a _Light_.
+class DiffuseMeshAreaLight : public LightBase {
+  public:
+    // DiffuseMeshAreaLight Public Methods
+    DiffuseMeshAreaLight(const Transform &renderFromLight,
+                         const MediumInterface &mediumInterface, Spectrum Le, Float scale,
+                         FloatTexture alpha, Image image,
+                         const RGBColorSpace *imageColorSpace, bool twoSided,
+                         Allocator alloc);
+
+    static pstd::vector<Light> Create(const Transform &renderFromLight, Medium medium,
+                                      const ParameterDictionary &parameters,
+                                      const RGBColorSpace *colorSpace, const FileLoc *loc,
+                                      Allocator alloc, pstd::span<const Shape> triangles,
+                                      FloatTexture alpha);
+
+    SampledSpectrum Phi(const Triangle &triangle, SampledWavelengths lambda) const;
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLeSample> SampleLe(const Triangle &triangle, Point2f u1,
+                                           Point2f u2, SampledWavelengths &lambda,
+                                           Float time) const;
+    PBRT_CPU_GPU
+    void PDF_Le(const Triangle &triangle, const Interaction &, Vector3f w, Float *pdfPos,
+                Float *pdfDir) const;
+
+    pstd::optional<LightBounds> Bounds(const Triangle &triangle) const;
+
+    std::string ToString() const;
+
+    PBRT_CPU_GPU
+    SampledSpectrum L(Point3f p, Normal3f n, Point2f uv, Vector3f w,
+                      const SampledWavelengths &lambda) const {
+        // Check for zero emitted radiance from point on area light
+        if (!twoSided && Dot(n, w) < 0)
+            return SampledSpectrum(0.f);
+        if (AlphaMasked(Interaction(p, uv)))
+            return SampledSpectrum(0.f);
+
+        if (image) {
+            // Return _DiffuseMeshAreaLight_ emission using image
+            RGB rgb;
+            uv[1] = 1 - uv[1];
+            for (int c = 0; c < 3; ++c)
+                rgb[c] = image.BilerpChannel(uv, c);
+            return scale *
+                   RGBIlluminantSpectrum(*imageColorSpace, ClampZero(rgb)).Sample(lambda);
+
+        } else
+            return scale * Lemit->Sample(lambda);
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLiSample> SampleLi(const Triangle &triangle,
+                                           LightSampleContext ctx, Point2f u,
+                                           SampledWavelengths lambda) const;
+
+    PBRT_CPU_GPU
+    Float PDF_Li(const Triangle &triangle, LightSampleContext ctx, Vector3f wi) const {
+        ShapeSampleContext shapeCtx(ctx.pi, ctx.n, ctx.ns, 0 /* time */);
+        return triangle.PDF(shapeCtx, wi);
+    }
+
+  private:
+    // DiffuseMeshAreaLight Private Members
+    FloatTexture alpha;
+    bool twoSided;
+    const DenselySampledSpectrum *Lemit;
+    Float scale;
+    Image image;
+    const RGBColorSpace *imageColorSpace;
+    // Emitted power per unit area used for the triangles' _LightBounds_
+    Float phiPerArea;
+
+    // DiffuseMeshAreaLight Private Methods
+    PBRT_CPU_GPU
+    bool AlphaMasked(const Interaction &intr) const {
+        if (!alpha)
+            return false;
+#ifdef PBRT_IS_GPU_CODE
+        Float a = BasicTextureEvaluator()(alpha, intr);
+#else
+        Float a = UniversalTextureEvaluator()(alpha, intr);
+#endif  // PBRT_IS_GPU_CODE
+        if (a >= 1)
+            return false;
+        if (a <= 0)
+            return true;
+        return HashFloat(intr.p()) > a;
+    }
+};
+
+// TriangleAreaLight Definition
+// The light for a single triangle of a mesh with a diffuse area light, addressed
+// by the mesh and triangle indices of its _Triangle_; everything else is shared
+// through its mesh's _DiffuseMeshAreaLight_.
+class TriangleAreaLight {
+  public:
+    // TriangleAreaLight Public Methods
+    TriangleAreaLight(const DiffuseMeshAreaLight *meshLight, const Triangle &triangle)
+        : meshLight(meshLight), triangle(triangle) {}
+
+    PBRT_CPU_GPU
+    LightType Type() const { return meshLight->Type(); }
+
+    void Preprocess(const Bounds3f &sceneBounds) {}
+
+    SampledSpectrum Phi(SampledWavelengths lambda) const {
+        return meshLight->Phi(triangle, lambda);
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLeSample> SampleLe(Point2f u1, Point2f u2,
+                                           SampledWavelengths &lambda, Float time) const {
+        return meshLight->SampleLe(triangle, u1, u2, lambda, time);
+    }
+    PBRT_CPU_GPU
+    void PDF_Le(const Interaction &intr, Vector3f w, Float *pdfPos, Float *pdfDir) const {
+        meshLight->PDF_Le(triangle, intr, w, pdfPos, pdfDir);
+    }
+
+    pstd::optional<LightBounds> Bounds() const { return meshLight->Bounds(triangle); }
+
+    PBRT_CPU_GPU
+    void PDF_Le(const Ray &, Float *pdfPos, Float *pdfDir) const {
+        LOG_FATAL("Shouldn't be called for area lights");
+    }
+
+    std::string ToString() const;
+
+    PBRT_CPU_GPU
+    SampledSpectrum L(Point3f p, Normal3f n, Point2f uv, Vector3f w,
+                      const SampledWavelengths &lambda) const {
+        return meshLight->L(p, n, uv, w, lambda);
+    }
+
+    PBRT_CPU_GPU
+    SampledSpectrum Le(const Ray &, const SampledWavelengths &) const {
+        return SampledSpectrum(0.f);
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLiSample> SampleLi(LightSampleContext ctx, Point2f u,
+                                           SampledWavelengths lambda,
+                                           LightSamplingMode mode) const {
+        return meshLight->SampleLi(triangle, ctx, u, lambda);
+    }
+
+    PBRT_CPU_GPU
+    Float PDF_Li(LightSampleContext ctx, Vector3f wi, LightSamplingMode) const {
+        return meshLight->PDF_Li(triangle, ctx, wi);
+    }
+
+  private:
+    // TriangleAreaLight Private Members
+    const DiffuseMeshAreaLight *meshLight;
+    Triangle triangle;
+};
+
 // UniformInfiniteLight Definition
 class UniformInfiniteLight : public LightBase {
   public:
@@ -512,7 +674,7 @@ class UniformInfiniteLight : public LightBase {
 
   private:
     // UniformInfiniteLight Private Members
-    DenselySampledSpectrum Lemit;
+    const DenselySampledSpectrum *Lemit;
     Float scale;
     Point3f sceneCenter;
     Float sceneRadius;
@@ -601,8 +763,8 @@ class ImageInfiniteLight : public LightBase {
     Float scale;
     Point3f sceneCenter;
     Float sceneRadius;
-    PiecewiseConstant2D distribution;
-    PiecewiseConstant2D compensatedDistribution;
+    AliasTable2D distribution;
+    AliasTable2D compensatedDistribution;
 };
 
 // PortalImageInfiniteLight Definition
@@ -762,10 +924,73 @@ class SpotLight : public LightBase {
 
   private:
     // SpotLight Private Members
-    DenselySampledSpectrum Iemit;
+    const DenselySampledSpectrum *Iemit;
     Float scale, cosFalloffStart, cosFalloffEnd;
 };
 
+// VolumeEmitterLight Definition
+// Samples points inside an emissive medium proportionally to the bound on its
+// emission $\sigma_\roman{a} L_\roman{e}$ over the voxels of the medium's
+// maximum density grid. Its _LightLiSample_s report emission per unit length and
+// PDFs with respect to solid angle and distance from the reference point.
+class VolumeEmitterLight : public LightBase {
+  public:
+    // VolumeEmitterLight Public Methods
+    VolumeEmitterLight(Medium medium, MediumEmissionGrid grid, Allocator alloc);
+
+    static VolumeEmitterLight *Create(Medium medium, Allocator alloc);
+
+    SampledSpectrum Phi(SampledWavelengths lambda) const;
+    void Preprocess(const Bounds3f &sceneBounds) {}
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLeSample> SampleLe(Point2f u1, Point2f u2,
+                                           SampledWavelengths &lambda, Float time) const;
+    PBRT_CPU_GPU
+    void PDF_Le(const Ray &, Float *pdfPos, Float *pdfDir) const;
+
+    PBRT_CPU_GPU
+    void PDF_Le(const Interaction &, Vector3f w, Float *pdfPos, Float *pdfDir) const {
+        LOG_FATAL("Shouldn't be called for volume lights");
+    }
+
+    pstd::optional<LightBounds> Bounds() const;
+
+    std::string ToString() const;
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLiSample> SampleLi(LightSampleContext ctx, Point2f u,
+                                           SampledWavelengths lambda,
+                                           LightSamplingMode mode) const;
+
+    // Directions alone don't determine a point inside the medium
+    PBRT_CPU_GPU
+    Float PDF_Li(LightSampleContext, Vector3f, LightSamplingMode mode) const { return 0; }
+
+    PBRT_CPU_GPU
+    Float PDF_Li(LightSampleContext ctx, Point3f p) const {
+        return PDF(p) * DistanceSquared(ctx.p(), p);
+    }
+
+    PBRT_CPU_GPU
+    Medium GetMedium() const { return mediumInterface.inside; }
+
+  private:
+    // VolumeEmitterLight Private Methods
+    PBRT_CPU_GPU
+    Point3f SamplePoint(Point2f u, Float *pdf) const;
+
+    PBRT_CPU_GPU
+    Float PDF(Point3f pRender) const;
+
+    // VolumeEmitterLight Private Members
+    Bounds3f bounds;
+    Point3i res;
+    AliasTable distrib;
+    // Rendering space volume of a voxel and bound on the emitted power
+    Float voxelVolume, phi;
+};
+
 inline pstd::optional<LightLiSample> Light::SampleLi(LightSampleContext ctx, Point2f u,
                                                      SampledWavelengths lambda,
                                                      LightSamplingMode mode) const {
@@ -7,8 +7,11 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/lights.h>
+#include <pbrt/media.h>
+#include <pbrt/shapes.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/containers.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/sampling.h>
@@ -204,3 +207,115 @@ TEST(LightBounds, Basics) {
         EXPECT_LT(impLow / impHigh, .2);
     }
 }
+
+TEST(TriangleAreaLight, MatchesDiffuseAreaLight) {
+    Transform id;
+    std::vector<int> indices{0, 1, 2, 2, 1, 3};
+    std::vector<Point3f> p{Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0, 1, .5),
+                           Point3f(1, 1, .25)};
+    TriangleMesh mesh(id, false /* rev orientation */, indices, p, {}, {}, {}, {});
+    pstd::vector<Shape> tris = Triangle::CreateTriangles(&mesh, Allocator());
+
+    ConstantSpectrum Le(2.f);
+    for (bool twoSided : {false, true}) {
+        DiffuseMeshAreaLight meshLight(id, MediumInterface(), &Le, 3.f, nullptr, Image(),
+                                       nullptr, twoSided, Allocator());
+        for (Shape tri : tris) {
+            // The mesh light's triangle should behave just like a _DiffuseAreaLight_
+            TriangleAreaLight triLight(&meshLight, *tri.Cast<Triangle>());
+            DiffuseAreaLight areaLight(id, MediumInterface(), &Le, 3.f, tri, nullptr,
+                                       Image(), nullptr, twoSided, Allocator());
+            SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5);
+            EXPECT_EQ(triLight.Type(), areaLight.Type());
+            EXPECT_EQ(triLight.Phi(lambda), areaLight.Phi(lambda));
+
+            pstd::optional<LightBounds> tb = triLight.Bounds(), ab = areaLight.Bounds();
+            ASSERT_TRUE(tb && ab);
+            EXPECT_EQ(tb->bounds, ab->bounds);
+            EXPECT_EQ(tb->w, ab->w);
+            EXPECT_FLOAT_EQ(tb->phi, ab->phi);
+            EXPECT_EQ(tb->cosTheta_o, ab->cosTheta_o);
+            EXPECT_EQ(tb->twoSided, ab->twoSided);
+
+            RNG rng;
+            for (int i = 0; i < 100; ++i) {
+                Point3f pRef(-2 + 4 * rng.Uniform<Float>(), -2 + 4 * rng.Uniform<Float>(),
+                             -2 + 4 * rng.Uniform<Float>());
+                Normal3f n(0, 0, 0);
+                LightSampleContext ctx(Point3fi(pRef), n, n);
+                Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+                pstd::optional<LightLiSample> ts =
+                    triLight.SampleLi(ctx, u, lambda, LightSamplingMode::WithMIS);
+                pstd::optional<LightLiSample> as =
+                    areaLight.SampleLi(ctx, u, lambda, LightSamplingMode::WithMIS);
+                ASSERT_EQ(ts.has_value(), as.has_value());
+                if (!ts)
+                    continue;
+                EXPECT_EQ(ts->L, as->L);
+                EXPECT_EQ(ts->wi, as->wi);
+                EXPECT_EQ(ts->pdf, as->pdf);
+                EXPECT_EQ(triLight.PDF_Li(ctx, ts->wi, LightSamplingMode::WithMIS),
+                          areaLight.PDF_Li(ctx, as->wi, LightSamplingMode::WithMIS));
+            }
+        }
+    }
+}
+
+TEST(VolumeEmitterLight, Sampling) {
+    // Emissive medium with a dense blob and emission that ramps up along x
+    constexpr int res = 32;
+    std::vector<Float> densities(res * res * res), LeScales(res * res * res);
+    for (int z = 0; z < res; ++z)
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x) {
+                Point3f p((x + 0.5f) / res, (y + 0.5f) / res, (z + 0.5f) / res);
+                int offset = x + res * (y + res * z);
+                densities[offset] = Distance(p, Point3f(0.6f, 0.4f, 0.5f)) < 0.3f ? 4 : 0;
+                LeScales[offset] = p.x;
+            }
+    Allocator alloc;
+    SampledGrid<Float> densityGrid(densities, res, res, res, alloc);
+    SampledGrid<Float> LeScaleGrid(LeScales, res, res, res, alloc);
+    UniformGridMediumProvider provider(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)),
+                                       densityGrid, {}, {}, {},
+                                       alloc.new_object<ConstantSpectrum>(2.f),
+                                       LeScaleGrid, alloc);
+    Transform renderFromMedium = Translate(Vector3f(1, -2, 3)) * Scale(2, 1, 3);
+    Medium medium = alloc.new_object<UniformGridMedium>(
+        &provider, alloc.new_object<ConstantSpectrum>(0.5f),
+        alloc.new_object<ConstantSpectrum>(0.5f), 1.f, 0.f, renderFromMedium, alloc);
+    VolumeEmitterLight *light = VolumeEmitterLight::Create(medium, alloc);
+    ASSERT_TRUE(light != nullptr);
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
+
+    // Compute total emission in rendering space using numerical quadrature
+    int nSteps = 128;
+    double expected = 0;
+    for (int z = 0; z < nSteps; ++z)
+        for (int y = 0; y < nSteps; ++y)
+            for (int x = 0; x < nSteps; ++x) {
+                Point3f p((x + 0.5f) / nSteps, (y + 0.5f) / nSteps, (z + 0.5f) / nSteps);
+                MediumProperties mp = medium.Sample(renderFromMedium(p), lambda);
+                expected += (mp.sigma_a * mp.Le)[0];
+            }
+    expected *= 6. / (nSteps * nSteps * nSteps);
+
+    // Estimate it from light samples and check their PDFs
+    LightSampleContext ctx(Point3fi(Point3f(-5, 1, 2)), Normal3f(0, 0, 0),
+                           Normal3f(0, 0, 0));
+    int nSamples = 64 * 1024;
+    double sum = 0;
+    for (int i = 0; i < nSamples; ++i) {
+        Point2f u(RadicalInverse(0, i), RadicalInverse(1, i));
+        pstd::optional<LightLiSample> ls =
+            light->SampleLi(ctx, u, lambda, LightSamplingMode::WithMIS);
+        if (!ls)
+            continue;
+        Point3f p = ls->pLight.p();
+        EXPECT_FLOAT_EQ(ls->pdf, light->PDF_Li(ctx, p));
+        sum += ls->L[0] * DistanceSquared(ctx.p(), p) / ls->pdf;
+    }
+    Float estimate = sum / nSamples;
+    EXPECT_LT(std::abs(estimate - expected), 0.02 * expected)
+        << "estimate: " << estimate << ", quadrature: " << expected;
+}
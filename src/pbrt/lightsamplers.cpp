@@ -12,13 +12,16 @@
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
 
 #include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <numeric>
+#include <tuple>
 #include <vector>
 
 namespace pbrt {
@@ -52,6 +55,8 @@ LightSampler LightSampler::Create(const std::string &name, pstd::span<const Ligh
         return alloc.new_object<PowerLightSampler>(lights, alloc);
     else if (name == "bvh")
         return alloc.new_object<BVHLightSampler>(lights, alloc);
+    else if (name == "learned")
+        return alloc.new_object<BVHLightSampler>(lights, alloc, true);
     else if (name == "exhaustive")
         return alloc.new_object<ExhaustiveLightSampler>(lights, alloc);
     else {
@@ -84,12 +89,14 @@ PowerLightSampler::PowerLightSampler(pstd::span<const Light> lights, Allocator a
         lightToIndex.Insert(lights[i], i);
 
     // Compute lights' power and initialize alias table
-    std::vector<Float> lightPower;
+    std::vector<Float> lightPower(lights.size());
     SampledWavelengths lambda = SampledWavelengths::SampleXYZ(0.5f);
-    for (const auto &light : lights) {
-        SampledSpectrum phi = SafeDiv(light.Phi(lambda), lambda.PDF());
-        lightPower.push_back(phi.Average());
-    }
+    ParallelFor(0, lights.size(), [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            SampledSpectrum phi = SafeDiv(lights[i].Phi(lambda), lambda.PDF());
+            lightPower[i] = phi.Average();
+        }
+    });
     if (std::accumulate(lightPower.begin(), lightPower.end(), 0.f) == 0.f)
         std::fill(lightPower.begin(), lightPower.end(), 1.f);
     aliasTable = AliasTable(lightPower, alloc);
@@ -103,20 +110,83 @@ std::string PowerLightSampler::ToString() const {
 // BVHLightSampler
 
 STAT_MEMORY_COUNTER("Memory/Light BVH", lightBVHBytes);
+STAT_MEMORY_COUNTER("Memory/Light selection cache", lightSelectionCacheBytes);
+STAT_COUNTER("Integrator/Light selection cache misses", lightSelectionCacheMisses);
 STAT_INT_DISTRIBUTION("Integrator/Lights sampled per lookup", nLightsSampled);
 
+// Light BVH Construction Helpers
+// Nodes with more lights than this are binned and partitioned in parallel
+static constexpr int parallelLightBVHMinLights = 64 * 1024;
+// Child subtrees with more lights than this are built in parallel
+static constexpr int parallelLightBVHMinSubtreeLights = 4 * 1024;
+
+// LightSelectionCache Method Definitions
+LightSelectionCache::LightSelectionCache(const Bounds3f &lightBounds, Allocator alloc)
+    : nVoxels(16 * 1024), pMin(lightBounds.pMin) {
+    Float voxelSize = MaxComponentValue(lightBounds.Diagonal()) / 64;
+    invVoxelSize = voxelSize > 0 ? 1 / voxelSize : 1;
+    voxels = alloc.allocate_object<Voxel>(nVoxels);
+    for (int i = 0; i < nVoxels; ++i)
+        alloc.construct(&voxels[i]);
+    lightSelectionCacheBytes += nVoxels * sizeof(Voxel);
+}
+
+const LightSelectionCache::Voxel *LightSelectionCache::FindVoxel(uint64_t key,
+                                                                 bool insert) const {
+    // Find the voxel for _key_ using linear probing, claiming an empty one if requested
+    uint64_t hash = MixBits(key);
+    for (int i = 0; i < MaxProbes; ++i) {
+        Voxel &voxel = voxels[(hash + i) & (nVoxels - 1)];
+        uint64_t voxelKey = voxel.key.load(std::memory_order_acquire);
+        if (voxelKey == 0) {
+            if (!insert)
+                return nullptr;
+            if (voxel.key.compare_exchange_strong(voxelKey, key,
+                                                  std::memory_order_acq_rel))
+                return &voxel;
+        }
+        if (voxelKey == key)
+            return &voxel;
+    }
+    return nullptr;
+}
+
+void LightSelectionCache::Record(const LightSampleContext &ctx, uint64_t bitTrail,
+                                 Float contribution) {
+    if (!(contribution >= 0) || IsInf(contribution))
+        return;
+    Voxel *voxel = const_cast<Voxel *>(FindVoxel(VoxelKey(ctx), true));
+    if (!voxel) {
+        ++lightSelectionCacheMisses;
+        return;
+    }
+    // Stop learning once the voxel's estimates may be in use
+    if (voxel->nStarted.fetch_add(1, std::memory_order_relaxed) >= RecordsToLearn)
+        return;
+
+    // Add _contribution_ to the entries for the chosen child at each learned level
+    for (int depth = 0; depth < LearnedLevels; ++depth) {
+        int child = (bitTrail >> (2 * depth)) & 3;
+        voxel->contribution[EntryOffset(depth, bitTrail, child)].Add(contribution);
+    }
+    voxel->nFinished.fetch_add(1, std::memory_order_release);
+}
+
 // BVHLightSampler Method Definitions
-BVHLightSampler::BVHLightSampler(pstd::span<const Light> lights, Allocator alloc)
+BVHLightSampler::BVHLightSampler(pstd::span<const Light> lights, Allocator alloc,
+                                 bool learnSelection)
     : lights(lights.begin(), lights.end(), alloc),
       infiniteLights(alloc),
       nodes(alloc),
       lightToBitTrail(alloc) {
     // Initialize _infiniteLights_ array and light BVH
+    std::vector<pstd::optional<LightBounds>> allBounds(lights.size());
+    ParallelFor(0, lights.size(), [&](int64_t i) { allBounds[i] = lights[i].Bounds(); });
     std::vector<std::pair<int, LightBounds>> bvhLights;
     for (size_t i = 0; i < lights.size(); ++i) {
         // Partition $i$th light into _infiniteLights_ or _bvhLights_
         Light light = lights[i];
-        pstd::optional<LightBounds> lightBounds = light.Bounds();
+        const pstd::optional<LightBounds> &lightBounds = allBounds[i];
         if (!lightBounds)
             infiniteLights.push_back(light);
         else if (lightBounds->phi > 0) {
@@ -124,52 +194,174 @@ BVHLightSampler::BVHLightSampler(pstd::span<const Light> lights, Allocator alloc
             allLightBounds = Union(allLightBounds, lightBounds->bounds);
         }
     }
-    if (!bvhLights.empty())
-        buildBVH(bvhLights, 0, bvhLights.size(), 0, 0, alloc);
-    lightBVHBytes += nodes.size() * sizeof(LightBVHNode);
+    if (!bvhLights.empty()) {
+        // Build binary light BVH and collapse it into a wide BVH
+        std::vector<LightBVHNode> binaryNodes(2 * bvhLights.size() - 1);
+        buildBVH(bvhLights, 0, bvhLights.size(), 0, 0, binaryNodes);
+        buildWideBVH(binaryNodes, 0, 0, 0);
+        if (learnSelection)
+            selectionCache = alloc.new_object<LightSelectionCache>(allLightBounds, alloc);
+    }
+    lightBVHBytes += nodes.size() * sizeof(WideLightBVHNode);
 }
 
-std::pair<int, LightBounds> BVHLightSampler::buildBVH(
-    std::vector<std::pair<int, LightBounds>> &bvhLights, int start, int end,
-    uint32_t bitTrail, int depth, Allocator alloc) {
+int BVHLightSampler::Sample(const LightSampleContext &ctx, Float u,
+                            pstd::span<SampledLight> samples) const {
+    int n = samples.size(), nSampled = 0;
+    CHECK_LE(n, MaxBatchSamples);
+    // Sample infinite lights for the strata below _pInfinite_
+    Float pInfinite = Float(infiniteLights.size()) /
+                      Float(infiniteLights.size() + (nodes.empty() ? 0 : 1));
+    int first = 0;
+    for (; first < n && (first + u) / n < pInfinite; ++first) {
+        Float ui = std::min<Float>((first + u) / n / pInfinite, OneMinusEpsilon);
+        int index =
+            std::min<int>(ui * infiniteLights.size(), infiniteLights.size() - 1);
+        samples[nSampled++] = SampledLight{infiniteLights[index],
+                                           pInfinite / infiniteLights.size()};
+    }
+    if (first == n || nodes.empty())
+        return nSampled;
+
+    // Remap the remaining strata's sample values to the BVH
+    Float us[MaxBatchSamples];
+    for (int i = first; i < n; ++i)
+        us[i] = std::min<Float>(((i + u) / n - pInfinite) / (1 - pInfinite),
+                                OneMinusEpsilon);
+
+    // Traverse the BVH, choosing a child for each sample at each node; since the
+    // sample values stay sorted, each child receives a contiguous range of them
+    struct Group {
+        int nodeIndex, begin, end, depth;
+        uint64_t bitTrail;
+        Float pdf;
+    };
+    Group stack[128];
+    int stackSize = 0;
+    stack[stackSize++] = Group{0, first, n, 0, 0, 1 - pInfinite};
+    const AtomicFloat *learned = selectionCache ? selectionCache->Lookup(ctx) : nullptr;
+    while (stackSize > 0) {
+        Group g = stack[--stackSize];
+        // Compute light BVH node's child importances
+        const WideLightBVHNode &node = nodes[g.nodeIndex];
+        Float ci[WideLightBVHNode::Width];
+        node.Importance(ctx.p(), ctx.ns, allLightBounds, ci);
+        if (ci[0] == 0 && ci[1] == 0 && ci[2] == 0 && ci[3] == 0)
+            continue;
+        LightSelectionCache::Blend(learned, g.depth, g.bitTrail, ci);
+
+        // Choose children for the group's samples and process each run of them
+        int childOf[MaxBatchSamples];
+        Float childPDF[WideLightBVHNode::Width];
+        for (int i = g.begin; i < g.end; ++i) {
+            Float nodePDF;
+            childOf[i] = SampleDiscrete(ci, us[i], &nodePDF, &us[i]);
+            childPDF[childOf[i]] = nodePDF;
+        }
+        int begin = g.begin;
+        while (begin < g.end) {
+            int child = childOf[begin], end = begin + 1;
+            while (end < g.end && childOf[end] == child)
+                ++end;
+            Float pdf = g.pdf * childPDF[child];
+            if (node.IsLeaf(child)) {
+                for (int i = begin; i < end; ++i)
+                    samples[nSampled++] =
+                        SampledLight{lights[node.childOrLightIndex[child]], pdf};
+            } else {
+                CHECK_LT(stackSize, PBRT_ARRAYSIZE(stack));
+                uint64_t bitTrail = g.bitTrail | (uint64_t(child) << (2 * g.depth));
+                stack[stackSize++] = Group{int(node.childOrLightIndex[child]), begin, end,
+                                           g.depth + 1, bitTrail, pdf};
+            }
+            begin = end;
+        }
+    }
+    return nSampled;
+}
+
+LightBounds BVHLightSampler::buildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights,
+                                     int start, int end, int nodeIndex, int depth,
+                                     std::vector<LightBVHNode> &binaryNodes) {
     CHECK_LT(start, end);
     // Initialize leaf node if only a single light remains
     if (end - start == 1) {
-        int nodeIndex = nodes.size();
         CompactLightBounds cb(bvhLights[start].second, allLightBounds);
         int lightIndex = bvhLights[start].first;
-        nodes.push_back(LightBVHNode::MakeLeaf(lightIndex, cb));
-        lightToBitTrail.Insert(lights[lightIndex], bitTrail);
-        return {nodeIndex, bvhLights[start].second};
+        binaryNodes[nodeIndex] = LightBVHNode::MakeLeaf(lightIndex, cb);
+        return bvhLights[start].second;
     }
 
     // Choose split dimension and position using modified SAH
     // Compute bounds and centroid bounds for lights
     Bounds3f bounds, centroidBounds;
-    for (int i = start; i < end; ++i) {
-        const LightBounds &lb = bvhLights[i].second;
-        bounds = Union(bounds, lb.bounds);
-        centroidBounds = Union(centroidBounds, lb.Centroid());
+    auto computeBounds = [&](int s, int e) {
+        Bounds3f b, cb;
+        for (int i = s; i < e; ++i) {
+            const LightBounds &lb = bvhLights[i].second;
+            b = Union(b, lb.bounds);
+            cb = Union(cb, lb.Centroid());
+        }
+        return std::make_pair(b, cb);
+    };
+    if (end - start < parallelLightBVHMinLights)
+        std::tie(bounds, centroidBounds) = computeBounds(start, end);
+    else {
+        std::mutex boundsMutex;
+        ParallelFor(start, end, [&](int64_t s, int64_t e) {
+            std::pair<Bounds3f, Bounds3f> b = computeBounds(s, e);
+            std::lock_guard<std::mutex> lock(boundsMutex);
+            bounds = Union(bounds, b.first);
+            centroidBounds = Union(centroidBounds, b.second);
+        });
+    }
+
+    // Compute _LightBounds_ for each bucket along each dimension
+    constexpr int nBuckets = 12;
+    auto bucketIndex = [&](const LightBounds &lb, int dim) {
+        int b = nBuckets * centroidBounds.Offset(lb.Centroid())[dim];
+        if (b == nBuckets)
+            b = nBuckets - 1;
+        CHECK_GE(b, 0);
+        CHECK_LT(b, nBuckets);
+        return b;
+    };
+    auto binLights = [&](int s, int e, LightBounds *buckets) {
+        for (int i = s; i < e; ++i)
+            for (int dim = 0; dim < 3; ++dim) {
+                if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+                    continue;
+                const LightBounds &lb = bvhLights[i].second;
+                LightBounds &bucket = buckets[dim * nBuckets + bucketIndex(lb, dim)];
+                bucket = Union(bucket, lb);
+            }
+    };
+    LightBounds bucketLightBounds[3 * nBuckets];
+    if (end - start < parallelLightBVHMinLights)
+        binLights(start, end, bucketLightBounds);
+    else {
+        // Bin fixed-size chunks of lights in parallel and merge their buckets in
+        // order, so that the BVH doesn't depend on the number of threads
+        constexpr int chunkSize = 16 * 1024;
+        int nChunks = (end - start + chunkSize - 1) / chunkSize;
+        std::vector<LightBounds> chunkBuckets(nChunks * 3 * nBuckets);
+        ParallelFor(0, nChunks, [&](int64_t chunk) {
+            int s = start + chunk * chunkSize, e = std::min<int>(end, s + chunkSize);
+            binLights(s, e, &chunkBuckets[chunk * 3 * nBuckets]);
+        });
+        for (int chunk = 0; chunk < nChunks; ++chunk)
+            for (int b = 0; b < 3 * nBuckets; ++b)
+                bucketLightBounds[b] =
+                    Union(bucketLightBounds[b], chunkBuckets[chunk * 3 * nBuckets + b]);
     }
 
     Float minCost = Infinity;
     int minCostSplitBucket = -1, minCostSplitDim = -1;
-    constexpr int nBuckets = 12;
     for (int dim = 0; dim < 3; ++dim) {
         // Compute minimum cost bucket for splitting along dimension _dim_
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
             continue;
-        // Compute _LightBounds_ for each bucket
-        LightBounds bucketLightBounds[nBuckets];
-        for (int i = start; i < end; ++i) {
-            Point3f pc = bvhLights[i].second.Centroid();
-            int b = nBuckets * centroidBounds.Offset(pc)[dim];
-            if (b == nBuckets)
-                b = nBuckets - 1;
-            CHECK_GE(b, 0);
-            CHECK_LT(b, nBuckets);
-            bucketLightBounds[b] = Union(bucketLightBounds[b], bvhLights[i].second);
-        }
+        const LightBounds *buckets = &bucketLightBounds[dim * nBuckets];
 
         // Compute costs for splitting lights after each bucket
         Float cost[nBuckets - 1];
@@ -177,9 +369,9 @@ std::pair<int, LightBounds> BVHLightSampler::buildBVH(
             // Find _LightBounds_ for lights below and above bucket split
             LightBounds b0, b1;
             for (int j = 0; j <= i; ++j)
-                b0 = Union(b0, bucketLightBounds[j]);
+                b0 = Union(b0, buckets[j]);
             for (int j = i + 1; j < nBuckets; ++j)
-                b1 = Union(b1, bucketLightBounds[j]);
+                b1 = Union(b1, buckets[j]);
 
             // Compute final light split cost for bucket
             cost[i] = EvaluateCost(b0, bounds, dim) + EvaluateCost(b1, bounds, dim);
@@ -200,42 +392,83 @@ std::pair<int, LightBounds> BVHLightSampler::buildBVH(
     if (minCostSplitDim == -1) {
         mid = (start + end) / 2;
     } else {
-        const auto *pmid = std::partition(
+        std::pair<int, LightBounds> *pmid = ParallelPartition(
             &bvhLights[start], &bvhLights[end - 1] + 1,
             [=](const std::pair<int, LightBounds> &l) {
-                int b = nBuckets *
-                        centroidBounds.Offset(l.second.Centroid())[minCostSplitDim];
-                if (b == nBuckets)
-                    b = nBuckets - 1;
-                CHECK_GE(b, 0);
-                CHECK_LT(b, nBuckets);
-                return b <= minCostSplitBucket;
-            });
+                return bucketIndex(l.second, minCostSplitDim) <= minCostSplitBucket;
+            },
+            parallelLightBVHMinLights);
         mid = pmid - &bvhLights[0];
         if (mid == start || mid == end)
             mid = (start + end) / 2;
         CHECK(mid > start && mid < end);
     }
 
-    // Allocate interior _LightBVHNode_ and recursively initialize children
-    int nodeIndex = nodes.size();
-    nodes.push_back(LightBVHNode());
+    // Recursively initialize children and then the interior _LightBVHNode_
+    // A subtree with $n$ lights has $2n-1$ nodes, so the children's node indices
+    // are known before they are built
     CHECK_LT(depth, 64);
-    std::pair<int, LightBounds> child0 =
-        buildBVH(bvhLights, start, mid, bitTrail, depth + 1, alloc);
-    CHECK_EQ(nodeIndex + 1, child0.first);
-    std::pair<int, LightBounds> child1 =
-        buildBVH(bvhLights, mid, end, bitTrail | (1u << depth), depth + 1, alloc);
-
-    // Initialize interior node and return node index and bounds
-    LightBounds lb = Union(child0.second, child1.second);
+    int childIndex[2] = {nodeIndex + 1, nodeIndex + 2 * (mid - start)};
+    LightBounds childBounds[2];
+    auto buildChild = [&](int i) {
+        childBounds[i] = buildBVH(bvhLights, i == 0 ? start : mid, i == 0 ? mid : end,
+                                  childIndex[i], depth + 1, binaryNodes);
+    };
+    if (end - start > parallelLightBVHMinSubtreeLights)
+        ParallelFor(0, 2, buildChild);
+    else {
+        buildChild(0);
+        buildChild(1);
+    }
+
+    // Initialize interior node and return its bounds
+    LightBounds lb = Union(childBounds[0], childBounds[1]);
     CompactLightBounds cb(lb, allLightBounds);
-    nodes[nodeIndex] = LightBVHNode::MakeInterior(child1.first, cb);
-    return {nodeIndex, lb};
+    binaryNodes[nodeIndex] = LightBVHNode::MakeInterior(childIndex[1], cb);
+    return lb;
+}
+
+int BVHLightSampler::buildWideBVH(const std::vector<LightBVHNode> &binaryNodes,
+                                  int binaryNodeIndex, uint64_t bitTrail, int depth) {
+    // Collect the binary node's children and grandchildren for the wide node
+    int children[WideLightBVHNode::Width], nChildren = 0;
+    const LightBVHNode &binaryNode = binaryNodes[binaryNodeIndex];
+    if (binaryNode.isLeaf)
+        // A single light is the only child of the root node
+        children[nChildren++] = binaryNodeIndex;
+    else
+        for (int c : {binaryNodeIndex + 1, int(binaryNode.childOrLightIndex)}) {
+            if (binaryNodes[c].isLeaf)
+                children[nChildren++] = c;
+            else {
+                children[nChildren++] = c + 1;
+                children[nChildren++] = binaryNodes[c].childOrLightIndex;
+            }
+        }
+
+    // Allocate _WideLightBVHNode_ and recursively initialize its children
+    int nodeIndex = nodes.size();
+    nodes.push_back(WideLightBVHNode());
+    CHECK_LT(depth, 32);
+    for (int i = 0; i < nChildren; ++i) {
+        const LightBVHNode &child = binaryNodes[children[i]];
+        uint64_t childBitTrail = bitTrail | (uint64_t(i) << (2 * depth));
+        if (child.isLeaf) {
+            nodes[nodeIndex].SetChild(i, child.lightBounds, child.childOrLightIndex,
+                                      true);
+            lightToBitTrail.Insert(lights[child.childOrLightIndex], childBitTrail);
+        } else {
+            int childIndex =
+                buildWideBVH(binaryNodes, children[i], childBitTrail, depth + 1);
+            nodes[nodeIndex].SetChild(i, child.lightBounds, childIndex, false);
+        }
+    }
+    return nodeIndex;
 }
 
 std::string BVHLightSampler::ToString() const {
-    return StringPrintf("[ BVHLightSampler nodes: %s ]", nodes);
+    return StringPrintf("[ BVHLightSampler nodes: %s learnSelection: %s ]", nodes,
+                        selectionCache != nullptr);
 }
 
 std::string LightBVHNode::ToString() const {
@@ -244,6 +477,19 @@ std::string LightBVHNode::ToString() const {
         childOrLightIndex, isLeaf);
 }
 
+std::string WideLightBVHNode::ToString() const {
+    std::string s = StringPrintf("[ WideLightBVHNode nChildren: %d leafMask: %x "
+                                 "twoSidedMask: %x children: [ ",
+                                 nChildren, leafMask, twoSidedMask);
+    for (int i = 0; i < nChildren; ++i)
+        s += StringPrintf("[ qb: [ [ %u %u %u ] [ %u %u %u ] ] w: %s phi: %f "
+                          "qCosTheta_o: %u qCosTheta_e: %u childOrLightIndex: %u ] ",
+                          qb[0][0][i], qb[0][1][i], qb[0][2][i], qb[1][0][i], qb[1][1][i],
+                          qb[1][2][i], w[i], phi[i], qCosTheta_o[i], qCosTheta_e[i],
+                          childOrLightIndex[i]);
+    return s + "] ]";
+}
+
 // ExhaustiveLightSampler Method Definitions
 ExhaustiveLightSampler::ExhaustiveLightSampler(pstd::span<const Light> lights,
                                                Allocator alloc)
@@ -291,8 +537,11 @@ pstd::optional<SampledLight> ExhaustiveLightSampler::Sample(const LightSampleCon
 }
 
 Float ExhaustiveLightSampler::PDF(const LightSampleContext &ctx, Light light) const {
-    if (!lightToBoundedIndex.HasKey(light))
+    if (!lightToBoundedIndex.HasKey(light)) {
+        if (light.Type() == LightType::Area)
+            return 0;
         return 1.f / (infiniteLights.size() + (!lightBounds.empty() ? 1 : 0));
+    }
 
     Float importanceSum = 0;
     Float lightImportance = 0;
@@ -12,10 +12,12 @@
 #include <pbrt/lights.h>  // LightBounds. Should that live elsewhere?
 #include <pbrt/util/containers.h>
 #include <pbrt/util/hash.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/vecmath.h>
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 
@@ -81,7 +83,7 @@ class PowerLightSampler {
 
     PBRT_CPU_GPU
     Float PDF(Light light) const {
-        if (!aliasTable.size())
+        if (!aliasTable.size() || !lightToIndex.HasKey(light))
             return 0;
         return aliasTable.PDF(lightToIndex[light]);
     }
@@ -147,8 +149,14 @@ class CompactLightBounds {
 
     PBRT_CPU_GPU
     Float Importance(Point3f p, Normal3f n, const Bounds3f &allb) const {
-        Bounds3f bounds = Bounds(allb);
-        Float cosTheta_o = CosTheta_o(), cosTheta_e = CosTheta_e();
+        return Importance(p, n, Bounds(allb), Vector3f(w), phi, CosTheta_o(),
+                          CosTheta_e(), twoSided);
+    }
+
+    PBRT_CPU_GPU
+    static Float Importance(Point3f p, Normal3f n, const Bounds3f &bounds, Vector3f w,
+                            Float phi, Float cosTheta_o, Float cosTheta_e,
+                            bool twoSided) {
         // Return importance for light bounds at reference point
         // Compute clamped squared distance to reference point
         Point3f pc = (bounds.pMin + bounds.pMax) / 2;
@@ -172,7 +180,7 @@ class CompactLightBounds {
 
         // Compute sine and cosine of angle to vector _w_, $\theta_\roman{w}$
         Vector3f wi = Normalize(p - pc);
-        Float cosTheta_w = Dot(Vector3f(w), wi);
+        Float cosTheta_w = Dot(w, wi);
         if (twoSided)
             cosTheta_w = std::abs(cosTheta_w);
         Float sinTheta_w = SafeSqrt(1 - Sqr(cosTheta_w));
@@ -206,6 +214,7 @@ class CompactLightBounds {
     }
 
   private:
+    friend struct WideLightBVHNode;
     // CompactLightBounds Private Methods
     PBRT_CPU_GPU
     static unsigned int QuantizeCos(Float c) {
@@ -261,11 +270,166 @@ struct alignas(32) LightBVHNode {
     };
 };
 
+// WideLightBVHNode Definition
+struct alignas(64) WideLightBVHNode {
+    // WideLightBVHNode Public Methods
+    static constexpr int Width = 4;
+
+    PBRT_CPU_GPU
+    void SetChild(int i, const CompactLightBounds &cb, unsigned int index, bool isLeaf) {
+        // Store $i$th child's quantized light bounds in the node's lanes
+        for (int j = 0; j < 2; ++j)
+            for (int c = 0; c < 3; ++c)
+                qb[j][c][i] = cb.qb[j][c];
+        w[i] = cb.w;
+        phi[i] = cb.phi;
+        qCosTheta_o[i] = cb.qCosTheta_o;
+        qCosTheta_e[i] = cb.qCosTheta_e;
+        if (cb.twoSided)
+            twoSidedMask |= 1u << i;
+
+        childOrLightIndex[i] = index;
+        if (isLeaf)
+            leafMask |= 1u << i;
+        nChildren = std::max<int>(nChildren, i + 1);
+    }
+
+    PBRT_CPU_GPU
+    bool IsLeaf(int i) const { return leafMask & (1u << i); }
+
+    PBRT_CPU_GPU
+    void Importance(Point3f p, Normal3f n, const Bounds3f &allb, Float ci[Width]) const {
+        // Compute all children's importances in a single pass over the lanes
+        for (int i = 0; i < Width; ++i) {
+            if (i >= nChildren) {
+                ci[i] = 0;
+                continue;
+            }
+            Point3f pMin(Lerp(qb[0][0][i] / 65535.f, allb.pMin.x, allb.pMax.x),
+                         Lerp(qb[0][1][i] / 65535.f, allb.pMin.y, allb.pMax.y),
+                         Lerp(qb[0][2][i] / 65535.f, allb.pMin.z, allb.pMax.z));
+            Point3f pMax(Lerp(qb[1][0][i] / 65535.f, allb.pMin.x, allb.pMax.x),
+                         Lerp(qb[1][1][i] / 65535.f, allb.pMin.y, allb.pMax.y),
+                         Lerp(qb[1][2][i] / 65535.f, allb.pMin.z, allb.pMax.z));
+            Bounds3f bounds(pMin, pMax);
+            ci[i] = CompactLightBounds::Importance(
+                p, n, bounds, Vector3f(w[i]), phi[i], 2 * (qCosTheta_o[i] / 32767.f) - 1,
+                2 * (qCosTheta_e[i] / 32767.f) - 1, twoSidedMask & (1u << i));
+        }
+    }
+
+    std::string ToString() const;
+
+    // WideLightBVHNode Public Members
+    uint16_t qb[2][3][Width];
+    OctahedralVector w[Width];
+    Float phi[Width];
+    uint16_t qCosTheta_o[Width], qCosTheta_e[Width];
+    uint32_t childOrLightIndex[Width];
+    uint8_t nChildren = 0, leafMask = 0, twoSidedMask = 0;
+};
+
+// LightSelectionCache Definition
+// Learns how much the lights under each of the light BVH's top-level nodes
+// contribute to points in the voxels of a spatial hash grid, from the outcomes of
+// the shadow rays to the lights that the BVH sampled. Once a voxel has seen
+// enough light samples, its estimates are frozen and blended with the BVH's
+// importance when choosing among those nodes' children there, which steers
+// sampling away from lights that are occluded.
+class LightSelectionCache {
+  public:
+    // LightSelectionCache Public Methods
+    LightSelectionCache(const Bounds3f &lightBounds, Allocator alloc);
+
+    PBRT_CPU_GPU
+    const AtomicFloat *Lookup(const LightSampleContext &ctx) const {
+#ifdef PBRT_IS_GPU_CODE
+        // Only the CPU integrators record light samples
+        return nullptr;
+#else
+        const Voxel *voxel = FindVoxel(VoxelKey(ctx), false);
+        if (!voxel || voxel->nFinished.load(std::memory_order_acquire) < RecordsToLearn)
+            return nullptr;
+        return voxel->contribution;
+#endif
+    }
+
+    // Blends the learned contributions _learned_ for the children of the node at
+    // _depth_ in the wide BVH reached by _bitTrail_ into its child importances _ci_
+    PBRT_CPU_GPU
+    static void Blend(const AtomicFloat *learned, int depth, uint64_t bitTrail,
+                      Float ci[WideLightBVHNode::Width]) {
+        if (!learned || depth >= LearnedLevels)
+            return;
+        const AtomicFloat *I = &learned[EntryOffset(depth, bitTrail, 0)];
+        Float ciSum = ci[0] + ci[1] + ci[2] + ci[3];
+        Float ISum = Float(I[0]) + Float(I[1]) + Float(I[2]) + Float(I[3]);
+        if (ciSum == 0 || ISum == 0)
+            return;
+        for (int c = 0; c < WideLightBVHNode::Width; ++c)
+            ci[c] = (1 - LearnedFraction) * ci[c] / ciSum + LearnedFraction * I[c] / ISum;
+    }
+
+    void Record(const LightSampleContext &ctx, uint64_t bitTrail, Float contribution);
+
+    // LightSelectionCache Public Members
+    // Number of wide BVH levels whose child choices are learned and the fraction
+    // of the probability of each choice that comes from the learned estimates
+    static constexpr int LearnedLevels = 3;
+    static constexpr Float LearnedFraction = 0.5f;
+
+  private:
+    // LightSelectionCache Private Members
+    static constexpr int nEntries = 4 + 16 + 64;
+    static constexpr int RecordsToLearn = 1024;
+    static constexpr int MaxProbes = 8;
+    struct Voxel {
+        std::atomic<uint64_t> key{0};
+        // Records are counted both before and after they are accumulated so that
+        // a voxel's sums are only used once no more updates are in flight
+        std::atomic<int> nStarted{0}, nFinished{0};
+        // Sums of the recorded contributions of the lights under each node child
+        AtomicFloat contribution[nEntries];
+    };
+    Voxel *voxels;
+    int nVoxels;
+    Point3f pMin;
+    Float invVoxelSize;
+
+    // LightSelectionCache Private Methods
+    // Returns the index of the entry for the child _child_ of the node at _depth_
+    // reached by _bitTrail_; the entries for each level follow those of the ones above
+    PBRT_CPU_GPU
+    static int EntryOffset(int depth, uint64_t bitTrail, int child) {
+        static constexpr int levelOffset[LearnedLevels] = {0, 4, 20};
+        uint64_t prefix = bitTrail & ((uint64_t(1) << (2 * depth)) - 1);
+        return levelOffset[depth] + 4 * int(prefix) + child;
+    }
+
+    uint64_t VoxelKey(const LightSampleContext &ctx) const {
+        // Find voxel coordinates and the sign of the normal's largest component
+        // The grid is centered on the lights' bounds and extends far beyond them
+        Vector3f pv = (ctx.p() - pMin) * invVoxelSize;
+        uint64_t key = 0;
+        for (int i = 0; i < 3; ++i)
+            key = (key << 20) |
+                  uint64_t(Clamp<Float>(pv[i] + (1 << 19), 0, (1 << 20) - 1));
+        int axis = MaxComponentIndex(Abs(ctx.ns));
+        int side = ctx.ns == Normal3f(0, 0, 0) ? 0 : (ctx.ns[axis] > 0 ? 1 : 2);
+        key = (key << 2 | side) * 3 + axis;
+        // Keys of occupied voxels are nonzero
+        return key + 1;
+    }
+
+    const Voxel *FindVoxel(uint64_t key, bool insert) const;
+};
+
 // BVHLightSampler Definition
 class BVHLightSampler {
   public:
     // BVHLightSampler Public Methods
-    BVHLightSampler(pstd::span<const Light> lights, Allocator alloc);
+    BVHLightSampler(pstd::span<const Light> lights, Allocator alloc,
+                    bool learnSelection = false);
 
     PBRT_CPU_GPU
     pstd::optional<SampledLight> Sample(const LightSampleContext &ctx, Float u) const {
@@ -289,37 +453,29 @@ class BVHLightSampler {
             Point3f p = ctx.p();
             Normal3f n = ctx.ns;
             u = std::min<Float>((u - pInfinite) / (1 - pInfinite), OneMinusEpsilon);
-            int nodeIndex = 0;
+            int nodeIndex = 0, depth = 0;
+            uint64_t bitTrail = 0;
             Float pdf = 1 - pInfinite;
+            const AtomicFloat *learned =
+                selectionCache ? selectionCache->Lookup(ctx) : nullptr;
 
             while (true) {
-                // Process light BVH node for light sampling
-                LightBVHNode node = nodes[nodeIndex];
-                if (!node.isLeaf) {
-                    // Compute light BVH child node importances
-                    const LightBVHNode *children[2] = {&nodes[nodeIndex + 1],
-                                                       &nodes[node.childOrLightIndex]};
-                    Float ci[2] = {
-                        children[0]->lightBounds.Importance(p, n, allLightBounds),
-                        children[1]->lightBounds.Importance(p, n, allLightBounds)};
-                    if (ci[0] == 0 && ci[1] == 0)
-                        return {};
-
-                    // Randomly sample light BVH child node
-                    Float nodePDF;
-                    int child = SampleDiscrete(ci, u, &nodePDF, &u);
-                    pdf *= nodePDF;
-                    nodeIndex = (child == 0) ? (nodeIndex + 1) : node.childOrLightIndex;
-
-                } else {
-                    // Confirm light has non-zero importance before returning light sample
-                    if (nodeIndex > 0)
-                        DCHECK_GT(node.lightBounds.Importance(p, n, allLightBounds), 0);
-                    if (nodeIndex > 0 ||
-                        node.lightBounds.Importance(p, n, allLightBounds) > 0)
-                        return SampledLight{lights[node.childOrLightIndex], pdf};
+                // Compute light BVH node's child importances
+                const WideLightBVHNode &node = nodes[nodeIndex];
+                Float ci[WideLightBVHNode::Width];
+                node.Importance(p, n, allLightBounds, ci);
+                if (ci[0] == 0 && ci[1] == 0 && ci[2] == 0 && ci[3] == 0)
                     return {};
-                }
+                LightSelectionCache::Blend(learned, depth, bitTrail, ci);
+
+                // Randomly sample light BVH child node
+                Float nodePDF;
+                int child = SampleDiscrete(ci, u, &nodePDF, &u);
+                pdf *= nodePDF;
+                if (node.IsLeaf(child))
+                    return SampledLight{lights[node.childOrLightIndex[child]], pdf};
+                nodeIndex = node.childOrLightIndex[child];
+                bitTrail |= uint64_t(child) << (2 * depth++);
             }
         }
     }
@@ -327,34 +483,40 @@ class BVHLightSampler {
     PBRT_CPU_GPU
     Float PDF(const LightSampleContext &ctx, Light light) const {
         // Handle infinite _light_ PDF computation
-        if (!lightToBitTrail.HasKey(light))
+        // Area lights that aren't in the BVH are never sampled
+        if (!lightToBitTrail.HasKey(light)) {
+            if (light.Type() == LightType::Area)
+                return 0;
             return 1.f / (infiniteLights.size() + (nodes.empty() ? 0 : 1));
+        }
 
         // Initialize local variables for BVH traversal for PDF computation
-        uint32_t bitTrail = lightToBitTrail[light];
+        uint64_t lightBitTrail = lightToBitTrail[light], bitTrail = lightBitTrail;
         Point3f p = ctx.p();
         Normal3f n = ctx.ns;
         Float pdf = 1;
         int nodeIndex = 0;
+        const AtomicFloat *learned =
+            selectionCache ? selectionCache->Lookup(ctx) : nullptr;
 
         // Compute light's PDF by walking down tree nodes to the light
-        while (true) {
-            const LightBVHNode *node = &nodes[nodeIndex];
-            if (node->isLeaf) {
-                DCHECK_EQ(light, lights[node->childOrLightIndex]);
+        for (int depth = 0;; ++depth) {
+            // Compute child importances and update PDF for current node
+            const WideLightBVHNode &node = nodes[nodeIndex];
+            Float ci[WideLightBVHNode::Width];
+            node.Importance(p, n, allLightBounds, ci);
+            LightSelectionCache::Blend(learned, depth, lightBitTrail, ci);
+            int child = bitTrail & 3;
+            DCHECK_GT(ci[child], 0);
+            pdf *= ci[child] / (ci[0] + ci[1] + ci[2] + ci[3]);
+
+            if (node.IsLeaf(child)) {
+                DCHECK_EQ(light, lights[node.childOrLightIndex[child]]);
                 break;
             }
-            // Compute child importances and update PDF for current node
-            const LightBVHNode *child0 = &nodes[nodeIndex + 1];
-            const LightBVHNode *child1 = &nodes[node->childOrLightIndex];
-            Float ci[2] = {child0->lightBounds.Importance(p, n, allLightBounds),
-                           child1->lightBounds.Importance(p, n, allLightBounds)};
-            DCHECK_GT(ci[bitTrail & 1], 0);
-            pdf *= ci[bitTrail & 1] / (ci[0] + ci[1]);
-
             // Use _bitTrail_ to find next node index and update its value
-            nodeIndex = (bitTrail & 1) ? node->childOrLightIndex : (nodeIndex + 1);
-            bitTrail >>= 1;
+            nodeIndex = node.childOrLightIndex[child];
+            bitTrail >>= 2;
         }
 
         // Return final PDF accounting for infinite light sampling probability
@@ -380,13 +542,29 @@ class BVHLightSampler {
         return 1.f / lights.size();
     }
 
+    // Samples _samples.size()_ lights using the stratified sample values
+    // $(i+u)/n$, visiting each BVH node that they pass through once; returns the
+    // number of lights sampled. Each sample's PDF is that of _Sample()_.
+    static constexpr int MaxBatchSamples = 64;
+    int Sample(const LightSampleContext &ctx, Float u,
+               pstd::span<SampledLight> samples) const;
+
+    // Records the contribution of a sample of _light_ at _ctx_, divided by the
+    // light's sampling probability, if the sampler learns light selection
+    void RecordSample(const LightSampleContext &ctx, Light light, Float contribution) {
+        if (selectionCache && lightToBitTrail.HasKey(light))
+            selectionCache->Record(ctx, lightToBitTrail[light], contribution);
+    }
+
     std::string ToString() const;
 
   private:
     // BVHLightSampler Private Methods
-    std::pair<int, LightBounds> buildBVH(
-        std::vector<std::pair<int, LightBounds>> &bvhLights, int start, int end,
-        uint32_t bitTrail, int depth, Allocator alloc);
+    LightBounds buildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights, int start,
+                         int end, int nodeIndex, int depth,
+                         std::vector<LightBVHNode> &binaryNodes);
+    int buildWideBVH(const std::vector<LightBVHNode> &binaryNodes, int binaryNodeIndex,
+                     uint64_t bitTrail, int depth);
 
     Float EvaluateCost(const LightBounds &b, const Bounds3f &bounds, int dim) const {
         // Evaluate direction bounds measure for _LightBounds_
@@ -407,8 +585,9 @@ class BVHLightSampler {
     pstd::vector<Light> lights;
     pstd::vector<Light> infiniteLights;
     Bounds3f allLightBounds;
-    pstd::vector<LightBVHNode> nodes;
-    HashMap<Light, uint32_t, LightHash> lightToBitTrail;
+    pstd::vector<WideLightBVHNode> nodes;
+    HashMap<Light, uint64_t, LightHash> lightToBitTrail;
+    LightSelectionCache *selectionCache = nullptr;
 };
 
 // ExhaustiveLightSampler Definition
@@ -0,0 +1,55 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/lights.h>
+#include <pbrt/lightsamplers.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/transform.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// Light sampling micro-benchmark: the number of point lights given by the
+// benchmark's argument are scattered in the $[-10,10]^3$ cube and sampled from
+// random points inside it.
+
+static void BM_BVHLightSamplerSample(benchmark::State &state) {
+    static ConstantSpectrum one(1.f);
+    RNG rng;
+    auto randomPoint = [&rng]() {
+        return Point3f(Lerp(rng.Uniform<Float>(), -10, 10),
+                       Lerp(rng.Uniform<Float>(), -10, 10),
+                       Lerp(rng.Uniform<Float>(), -10, 10));
+    };
+    std::vector<Light> lights;
+    for (int i = 0; i < state.range(0); ++i)
+        lights.push_back(new PointLight(Translate(Vector3f(randomPoint())),
+                                        MediumInterface(), &one, 1.f, Allocator()));
+    BVHLightSampler sampler(lights, Allocator());
+
+    constexpr int nContexts = 1024;
+    std::vector<LightSampleContext> ctx;
+    std::vector<Float> u;
+    for (int i = 0; i < nContexts; ++i) {
+        ctx.push_back(LightSampleContext(Point3fi(randomPoint()), Normal3f(0, 0, 0),
+                                         Normal3f(0, 0, 0)));
+        u.push_back(rng.Uniform<Float>());
+    }
+
+    int index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sampler.Sample(ctx[index], u[index]));
+        if (++index == nContexts)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_BVHLightSamplerSample)->RangeMultiplier(8)->Range(8, 1 << 15);
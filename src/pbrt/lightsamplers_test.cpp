@@ -297,6 +297,169 @@ TEST(BVHLightSampling, PdfMethod) {
     }
 }
 
+TEST(BVHLightSampling, PdfMethodManyLights) {
+    RNG rng(1337);
+    auto r = [&rng]() { return rng.Uniform<Float>(); };
+
+    // Enough lights for a multi-level wide light BVH with partially-full nodes
+    std::vector<Light> lights;
+    std::vector<Shape> tris;
+    std::tie(lights, tris) = randomLights(333, Allocator());
+
+    BVHLightSampler distrib(lights, Allocator());
+    for (int i = 0; i < 1000; ++i) {
+        Point3f p{-1 + 3 * r(), -1 + 3 * r(), -1 + 3 * r()};
+        Interaction intr(Point3fi(p), Normal3f(0, 0, 0), Point2f(0, 0));
+        pstd::optional<SampledLight> sampledLight = distrib.Sample(intr, r());
+        if (sampledLight)
+            EXPECT_FLOAT_EQ(sampledLight->pdf, distrib.PDF(intr, sampledLight->light));
+    }
+}
+
+TEST(BVHLightSampling, ParallelBuild) {
+    RNG rng(6502);
+    auto r = [&rng]() { return rng.Uniform<Float>(); };
+
+    // Enough lights that the upper levels of the BVH are built in parallel
+    std::vector<Light> lights;
+    ConstantSpectrum one(1.f);
+    for (int i = 0; i < 80000; ++i) {
+        Vector3f p{-1 + 2 * r(), -1 + 2 * r(), -1 + 2 * r()};
+        lights.push_back(new PointLight(Translate(p), MediumInterface(), &one, .1f + r(),
+                                        Allocator()));
+    }
+
+    // Two builds should give the same BVH and consistent PDFs
+    BVHLightSampler distrib0(lights, Allocator()), distrib1(lights, Allocator());
+    for (int i = 0; i < 1000; ++i) {
+        Point3f p{-2 + 4 * r(), -2 + 4 * r(), -2 + 4 * r()};
+        Interaction intr(Point3fi(p), Normal3f(0, 0, 0), Point2f(0, 0));
+        Float u = r();
+        pstd::optional<SampledLight> s0 = distrib0.Sample(intr, u);
+        pstd::optional<SampledLight> s1 = distrib1.Sample(intr, u);
+        ASSERT_TRUE(s0.has_value());
+        ASSERT_TRUE(s1.has_value());
+        EXPECT_EQ(s0->light, s1->light);
+        EXPECT_EQ(s0->pdf, s1->pdf);
+        EXPECT_FLOAT_EQ(s0->pdf, distrib0.PDF(intr, s0->light));
+    }
+}
+
+TEST(BVHLightSampling, LearnedSelection) {
+    RNG rng(1234);
+    auto r = [&rng]() { return rng.Uniform<Float>(); };
+
+    std::vector<Light> lights;
+    ConstantSpectrum one(1.f);
+    for (int i = 0; i < 256; ++i) {
+        Vector3f p{-1 + 2 * r(), -1 + 2 * r(), -1 + 2 * r()};
+        lights.push_back(
+            new PointLight(Translate(p), MediumInterface(), &one, 1.f, Allocator()));
+    }
+    BVHLightSampler bvh(lights, Allocator()), learned(lights, Allocator(), true);
+
+    // Record samples as if the lights with $x<0$ were occluded
+    Point3f p(0.1, 0.2, 0.3);
+    Interaction intr(Point3fi(p), Normal3f(0, 0, 0), Point2f(0, 0));
+    auto visible = [](Light light) { return light.Bounds()->bounds.pMin.x > 0; };
+    for (int i = 0; i < 4096; ++i) {
+        pstd::optional<SampledLight> sl = learned.Sample(intr, r());
+        ASSERT_TRUE(sl.has_value());
+        learned.RecordSample(intr, sl->light, visible(sl->light) ? 1 / sl->pdf : 0);
+    }
+
+    // The learned sampler should prefer the visible lights and have consistent PDFs
+    Float bvhVisible = 0, learnedVisible = 0;
+    for (Light light : lights) {
+        Float pdf = learned.PDF(intr, light);
+        if (visible(light)) {
+            bvhVisible += bvh.PDF(intr, light);
+            learnedVisible += pdf;
+        }
+    }
+    EXPECT_GT(learnedVisible, bvhVisible);
+    for (int i = 0; i < 1000; ++i) {
+        pstd::optional<SampledLight> sl = learned.Sample(intr, r());
+        ASSERT_TRUE(sl.has_value());
+        EXPECT_FLOAT_EQ(sl->pdf, learned.PDF(intr, sl->light));
+    }
+}
+
+TEST(BVHLightSampling, BatchSample) {
+    RNG rng(5251);
+    auto r = [&rng]() { return rng.Uniform<Float>(); };
+
+    std::vector<Light> lights;
+    std::vector<Shape> tris;
+    std::tie(lights, tris) = randomLights(20, Allocator());
+    ConstantSpectrum one(1.f);
+    lights.push_back(new UniformInfiniteLight(Transform(), &one, 1.f, Allocator()));
+    BVHLightSampler distrib(lights, Allocator());
+
+    for (int i = 0; i < 100; ++i) {
+        Point3f p{-1 + 3 * r(), -1 + 3 * r(), -1 + 3 * r()};
+        Interaction intr(Point3fi(p), Normal3f(0, 0, 0), Point2f(0, 0));
+        int n = 1 + i % 16;
+        SampledLight samples[16];
+        int nSampled = distrib.Sample(intr, r(), pstd::MakeSpan(samples, n));
+        EXPECT_LE(nSampled, n);
+        for (int j = 0; j < nSampled; ++j)
+            EXPECT_FLOAT_EQ(samples[j].pdf, distrib.PDF(intr, samples[j].light));
+    }
+
+    // The batched samples' lights should be distributed according to their PDFs
+    Interaction intr(Point3fi(Point3f(0.5, 0.5, 0.5)), Normal3f(0, 0, 0), Point2f(0, 0));
+    std::unordered_map<Light, int, LightHash> counts;
+    constexpr int nBatches = 20000, batchSize = 8;
+    for (int i = 0; i < nBatches; ++i) {
+        SampledLight samples[batchSize];
+        int nSampled = distrib.Sample(intr, r(), pstd::MakeSpan(samples));
+        for (int j = 0; j < nSampled; ++j)
+            ++counts[samples[j].light];
+    }
+    for (Light light : lights) {
+        Float expected = distrib.PDF(intr, light) * nBatches * batchSize;
+        EXPECT_NEAR(expected, counts[light], 5 * std::sqrt(expected) + 1);
+    }
+}
+
+TEST(BVHLightSampling, WideNodeImportance) {
+    RNG rng(7);
+    auto r = [&rng]() { return rng.Uniform<Float>(); };
+    Bounds3f allb(Point3f(-2, -2, -2), Point3f(2, 2, 2));
+
+    for (int i = 0; i < 100; ++i) {
+        // Fill a wide node's lanes with random light bounds
+        WideLightBVHNode node;
+        CompactLightBounds cb[WideLightBVHNode::Width];
+        int nChildren = 1 + (i % WideLightBVHNode::Width);
+        for (int c = 0; c < nChildren; ++c) {
+            Point3f p0(-2 + 4 * r(), -2 + 4 * r(), -2 + 4 * r());
+            Point3f p1(-2 + 4 * r(), -2 + 4 * r(), -2 + 4 * r());
+            Vector3f w = Normalize(Vector3f(-1 + 2 * r(), -1 + 2 * r(), -1 + 2 * r()));
+            LightBounds lb(Bounds3f(p0, p1), w, 10 * r(), -1 + 2 * r(), -1 + 2 * r(),
+                           r() < .5);
+            cb[c] = CompactLightBounds(lb, allb);
+            node.SetChild(c, cb[c], c, c & 1);
+        }
+
+        // Make sure the lanes' importances match the scalar computation
+        for (int j = 0; j < 10; ++j) {
+            Point3f p(-4 + 8 * r(), -4 + 8 * r(), -4 + 8 * r());
+            Normal3f n = (j & 1) ? Normal3f(0, 0, 0) : Normal3f(0, 0, 1);
+            Float ci[WideLightBVHNode::Width];
+            node.Importance(p, n, allb, ci);
+            for (int c = 0; c < WideLightBVHNode::Width; ++c) {
+                if (c < nChildren) {
+                    EXPECT_FLOAT_EQ(cb[c].Importance(p, n, allb), ci[c]);
+                    EXPECT_EQ(bool(c & 1), node.IsLeaf(c));
+                } else
+                    EXPECT_EQ(0, ci[c]);
+            }
+        }
+    }
+}
+
 TEST(ExhaustiveLightSampling, PdfMethod) {
     RNG rng(5251);
     auto r = [&rng]() { return rng.Uniform<Float>(); };
@@ -353,3 +516,30 @@ TEST(PowerLightSampling, PdfMethod) {
         EXPECT_FLOAT_EQ(sampledLight->pdf, distrib.PDF(intr, sampledLight->light));
     }
 }
+
+TEST(LightSampling, UnsampledAreaLights) {
+    std::vector<Light> lights;
+    std::vector<Shape> tris;
+    std::tie(lights, tris) = randomLights(20, Allocator());
+
+    // Leave every other area light out of the samplers, as light culling does
+    std::vector<Light> sampledLights, unsampledLights;
+    int nAreaLights = 0;
+    for (Light light : lights) {
+        if (light.Type() == LightType::Area && (nAreaLights++ & 1))
+            unsampledLights.push_back(light);
+        else
+            sampledLights.push_back(light);
+    }
+    ASSERT_FALSE(unsampledLights.empty());
+
+    BVHLightSampler bvh(sampledLights, Allocator());
+    PowerLightSampler power(sampledLights, Allocator());
+    ExhaustiveLightSampler exhaustive(sampledLights, Allocator());
+    Interaction intr(Point3fi(Point3f(0.5, 0.5, 0.5)), Normal3f(0, 0, 0), Point2f(0, 0));
+    for (Light light : unsampledLights) {
+        EXPECT_EQ(0, bvh.PDF(intr, light));
+        EXPECT_EQ(0, power.PDF(intr, light));
+        EXPECT_EQ(0, exhaustive.PDF(intr, light));
+    }
+}
@@ -201,9 +201,9 @@ DiffuseMaterial *DiffuseMaterial::Create(const TextureParameterDictionary &param
 std::string ConductorMaterial::ToString() const {
     return StringPrintf("[ ConductorMaterial displacement: %s eta: %s k: %s reflectance: "
                         "%s uRoughness: %s "
-                        "vRoughness: %s remapRoughness: %s]",
+                        "vRoughness: %s remapRoughness: %s energyCompensation: %s ]",
                         displacement, eta, k, reflectance, uRoughness, vRoughness,
-                        remapRoughness);
+                        remapRoughness, energyCompensation);
 }
 
 ConductorMaterial *ConductorMaterial::Create(const TextureParameterDictionary &parameters,
@@ -236,10 +236,11 @@ ConductorMaterial *ConductorMaterial::Create(const TextureParameterDictionary &p
 
     FloatTexture displacement = parameters.GetFloatTextureOrNull("displacement", alloc);
     bool remapRoughness = parameters.GetOneBool("remaproughness", true);
+    bool energyCompensation = parameters.GetOneBool("energycompensation", false);
 
     return alloc.new_object<ConductorMaterial>(eta, k, reflectance, uRoughness,
                                                vRoughness, displacement, normalMap,
-                                               remapRoughness);
+                                               remapRoughness, energyCompensation);
 }
 
 // CoatedDiffuseMaterial Method Definitions
@@ -252,13 +253,18 @@ BSDF CoatedDiffuseMaterial::GetBSDF(TextureEvaluator texEval,
     SampledSpectrum r = Clamp(texEval(reflectance, ctx, lambda), 0, 1);
 
     // Create microfacet distribution _distrib_ for coated diffuse material
-    Float urough = texEval(uRoughness, ctx);
-    Float vrough = texEval(vRoughness, ctx);
-    if (remapRoughness) {
-        urough = TrowbridgeReitzDistribution::RoughnessToAlpha(urough);
-        vrough = TrowbridgeReitzDistribution::RoughnessToAlpha(vrough);
+    TrowbridgeReitzDistribution distrib;
+    if (constantDistrib)
+        distrib = *constantDistrib;
+    else {
+        Float urough = texEval(uRoughness, ctx);
+        Float vrough = texEval(vRoughness, ctx);
+        if (remapRoughness) {
+            urough = TrowbridgeReitzDistribution::RoughnessToAlpha(urough);
+            vrough = TrowbridgeReitzDistribution::RoughnessToAlpha(vrough);
+        }
+        distrib = TrowbridgeReitzDistribution(urough, vrough);
     }
-    TrowbridgeReitzDistribution distrib(urough, vrough);
 
     Float thick = texEval(thickness, ctx);
 
@@ -272,7 +278,7 @@ BSDF CoatedDiffuseMaterial::GetBSDF(TextureEvaluator texEval,
     Float gg = Clamp(texEval(g, ctx), -1, 1);
 
     *bxdf = CoatedDiffuseBxDF(DielectricBxDF(sampledEta, distrib), DiffuseBxDF(r), thick,
-                              a, gg, maxDepth, nSamples);
+                              a, gg, maxDepth, nSamples, fitted);
     return BSDF(ctx.ns, ctx.dpdus, bxdf);
 }
 
@@ -289,9 +295,9 @@ template BSDF CoatedDiffuseMaterial::GetBSDF(UniversalTextureEvaluator,
 std::string CoatedDiffuseMaterial::ToString() const {
     return StringPrintf(
         "[ CoatedDiffuseMaterial displacement: %s reflectance: %s uRoughness: %s "
-        "vRoughness: %s thickness: %s eta: %s remapRoughness: %s ]",
+        "vRoughness: %s thickness: %s eta: %s remapRoughness: %s fitted: %s ]",
         displacement, reflectance, uRoughness, vRoughness, thickness, eta,
-        remapRoughness);
+        remapRoughness, fitted);
 }
 
 CoatedDiffuseMaterial *CoatedDiffuseMaterial::Create(
@@ -322,6 +328,7 @@ CoatedDiffuseMaterial *CoatedDiffuseMaterial::Create(
 
     int maxDepth = parameters.GetOneInt("maxdepth", 10);
     int nSamples = parameters.GetOneInt("nsamples", 1);
+    bool fitted = parameters.GetOneBool("fitted", false);
 
     FloatTexture g = parameters.GetFloatTexture("g", 0.f, alloc);
     SpectrumTexture albedo =
@@ -335,7 +342,7 @@ CoatedDiffuseMaterial *CoatedDiffuseMaterial::Create(
 
     return alloc.new_object<CoatedDiffuseMaterial>(
         reflectance, uRoughness, vRoughness, thickness, albedo, g, eta, displacement,
-        normalMap, remapRoughness, maxDepth, nSamples);
+        normalMap, remapRoughness, maxDepth, nSamples, fitted);
 }
 
 template <typename TextureEvaluator>
@@ -343,13 +350,18 @@ BSDF CoatedConductorMaterial::GetBSDF(TextureEvaluator texEval,
                                       const MaterialEvalContext &ctx,
                                       SampledWavelengths &lambda,
                                       CoatedConductorBxDF *bxdf) const {
-    Float iurough = texEval(interfaceURoughness, ctx);
-    Float ivrough = texEval(interfaceVRoughness, ctx);
-    if (remapRoughness) {
-        iurough = TrowbridgeReitzDistribution::RoughnessToAlpha(iurough);
-        ivrough = TrowbridgeReitzDistribution::RoughnessToAlpha(ivrough);
+    TrowbridgeReitzDistribution interfaceDistrib;
+    if (constantInterfaceDistrib)
+        interfaceDistrib = *constantInterfaceDistrib;
+    else {
+        Float iurough = texEval(interfaceURoughness, ctx);
+        Float ivrough = texEval(interfaceVRoughness, ctx);
+        if (remapRoughness) {
+            iurough = TrowbridgeReitzDistribution::RoughnessToAlpha(iurough);
+            ivrough = TrowbridgeReitzDistribution::RoughnessToAlpha(ivrough);
+        }
+        interfaceDistrib = TrowbridgeReitzDistribution(iurough, ivrough);
     }
-    TrowbridgeReitzDistribution interfaceDistrib(iurough, ivrough);
 
     Float thick = texEval(thickness, ctx);
 
@@ -369,20 +381,25 @@ BSDF CoatedConductorMaterial::GetBSDF(TextureEvaluator texEval,
         ck = 2 * Sqrt(r) / Sqrt(ClampZero(SampledSpectrum(1) - r));
     }
 
-    Float curough = texEval(conductorURoughness, ctx);
-    Float cvrough = texEval(conductorVRoughness, ctx);
-    if (remapRoughness) {
-        curough = TrowbridgeReitzDistribution::RoughnessToAlpha(curough);
-        cvrough = TrowbridgeReitzDistribution::RoughnessToAlpha(cvrough);
+    TrowbridgeReitzDistribution conductorDistrib;
+    if (constantConductorDistrib)
+        conductorDistrib = *constantConductorDistrib;
+    else {
+        Float curough = texEval(conductorURoughness, ctx);
+        Float cvrough = texEval(conductorVRoughness, ctx);
+        if (remapRoughness) {
+            curough = TrowbridgeReitzDistribution::RoughnessToAlpha(curough);
+            cvrough = TrowbridgeReitzDistribution::RoughnessToAlpha(cvrough);
+        }
+        conductorDistrib = TrowbridgeReitzDistribution(curough, cvrough);
     }
-    TrowbridgeReitzDistribution conductorDistrib(curough, cvrough);
 
     SampledSpectrum a = Clamp(texEval(albedo, ctx, lambda), 0, 1);
     Float gg = Clamp(texEval(g, ctx), -1, 1);
 
     *bxdf = CoatedConductorBxDF(DielectricBxDF(ieta, interfaceDistrib),
                                 ConductorBxDF(conductorDistrib, ce, ck), thick, a, gg,
-                                maxDepth, nSamples);
+                                maxDepth, nSamples, fitted);
     return BSDF(ctx.ns, ctx.dpdus, bxdf);
 }
 
@@ -401,10 +418,11 @@ std::string CoatedConductorMaterial::ToString() const {
                         "interfaceEta: %f g: %s albedo: %s conductorURoughness: %s "
                         "conductorVRoughness: %s "
                         "conductorEta: %s k: %s conductorReflectance: %s remapRoughness: "
-                        "%s maxDepth: %d nSamples: %d ]",
+                        "%s maxDepth: %d nSamples: %d fitted: %s ]",
                         displacement, interfaceURoughness, interfaceVRoughness, thickness,
                         interfaceEta, g, albedo, conductorURoughness, conductorVRoughness,
-                        conductorEta, k, reflectance, remapRoughness, maxDepth, nSamples);
+                        conductorEta, k, reflectance, remapRoughness, maxDepth, nSamples,
+                        fitted);
 }
 
 CoatedConductorMaterial *CoatedConductorMaterial::Create(
@@ -465,6 +483,7 @@ CoatedConductorMaterial *CoatedConductorMaterial::Create(
 
     int maxDepth = parameters.GetOneInt("maxdepth", 10);
     int nSamples = parameters.GetOneInt("nsamples", 1);
+    bool fitted = parameters.GetOneBool("fitted", false);
 
     FloatTexture g = parameters.GetFloatTexture("g", 0.f, alloc);
     SpectrumTexture albedo =
@@ -479,7 +498,7 @@ CoatedConductorMaterial *CoatedConductorMaterial::Create(
     return alloc.new_object<CoatedConductorMaterial>(
         interfaceURoughness, interfaceVRoughness, thickness, interfaceEta, g, albedo,
         conductorURoughness, conductorVRoughness, conductorEta, k, reflectance,
-        displacement, normalMap, remapRoughness, maxDepth, nSamples);
+        displacement, normalMap, remapRoughness, maxDepth, nSamples, fitted);
 }
 
 // SubsurfaceMaterial Method Definitions
@@ -92,39 +92,54 @@ PBRT_CPU_GPU void Bump(TextureEvaluator texEval, FloatTexture displacement,
     if (displacement) {
         if (displacement)
             DCHECK(texEval.CanEvaluate({displacement}, {}));
-        // Compute offset positions and evaluate displacement texture
-        TextureEvalContext shiftedCtx = ctx;
-        // Shift _shiftedCtx_ _du_ in the $u$ direction
-        Float du = .5f * (std::abs(ctx.dudx) + std::abs(ctx.dudy));
-        if (du == 0)
-            du = .0005f;
-        shiftedCtx.p = ctx.p + du * ctx.shading.dpdu;
-        shiftedCtx.uv = ctx.uv + Vector2f(du, 0.f);
-
-        Float uDisplace = texEval(displacement, shiftedCtx);
-        // Shift _shiftedCtx_ _dv_ in the $v$ direction
-        Float dv = .5f * (std::abs(ctx.dvdx) + std::abs(ctx.dvdy));
-        if (dv == 0)
-            dv = .0005f;
-        shiftedCtx.p = ctx.p + dv * ctx.shading.dpdv;
-        shiftedCtx.uv = ctx.uv + Vector2f(0.f, dv);
-
-        Float vDisplace = texEval(displacement, shiftedCtx);
-        Float displace = texEval(displacement, ctx);
+        Float displace;
+        Vector2f dDisplace;
+        pstd::optional<Float> imageDisplace;
+#ifndef PBRT_IS_GPU_CODE
+        // Use analytic derivatives of image displacement textures if possible
+        if (const FloatImageTexture *image =
+                displacement.CastOrNullptr<FloatImageTexture>())
+            imageDisplace = image->EvaluateWithGradient(ctx, &dDisplace);
+#endif
+        if (imageDisplace)
+            displace = *imageDisplace;
+        else {
+            // Compute offset positions and evaluate displacement texture
+            TextureEvalContext shiftedCtx = ctx;
+            // Shift _shiftedCtx_ _du_ in the $u$ direction
+            Float du = .5f * (std::abs(ctx.dudx) + std::abs(ctx.dudy));
+            if (du == 0)
+                du = .0005f;
+            shiftedCtx.p = ctx.p + du * ctx.shading.dpdu;
+            shiftedCtx.uv = ctx.uv + Vector2f(du, 0.f);
+
+            Float uDisplace = texEval(displacement, shiftedCtx);
+            // Shift _shiftedCtx_ _dv_ in the $v$ direction
+            Float dv = .5f * (std::abs(ctx.dvdx) + std::abs(ctx.dvdy));
+            if (dv == 0)
+                dv = .0005f;
+            shiftedCtx.p = ctx.p + dv * ctx.shading.dpdv;
+            shiftedCtx.uv = ctx.uv + Vector2f(0.f, dv);
+
+            Float vDisplace = texEval(displacement, shiftedCtx);
+            displace = texEval(displacement, ctx);
+            dDisplace =
+                Vector2f((uDisplace - displace) / du, (vDisplace - displace) / dv);
+        }
 
         // Compute bump-mapped differential geometry
-        *dpdu = ctx.shading.dpdu + (uDisplace - displace) / du * Vector3f(ctx.shading.n) +
+        *dpdu = ctx.shading.dpdu + dDisplace.x * Vector3f(ctx.shading.n) +
                 displace * Vector3f(ctx.shading.dndu);
-        *dpdv = ctx.shading.dpdv + (vDisplace - displace) / dv * Vector3f(ctx.shading.n) +
+        *dpdv = ctx.shading.dpdv + dDisplace.y * Vector3f(ctx.shading.n) +
                 displace * Vector3f(ctx.shading.dndv);
 
     } else {
         // Sample normal map to compute shading normal
         WrapMode2D wrap(WrapMode::Repeat);
         Point2f uv(ctx.uv[0], 1 - ctx.uv[1]);
-        Vector3f ns(2 * normalMap->BilerpChannel(uv, 0, wrap) - 1,
-                    2 * normalMap->BilerpChannel(uv, 1, wrap) - 1,
-                    2 * normalMap->BilerpChannel(uv, 2, wrap) - 1);
+        Float rgb[3];
+        normalMap->BilerpChannels(uv, rgb, wrap);
+        Vector3f ns(2 * rgb[0] - 1, 2 * rgb[1] - 1, 2 * rgb[2] - 1);
         ns = Normalize(ns);
         Frame frame = Frame::FromZ(ctx.shading.n);
         ns = frame.FromLocal(ns);
@@ -135,6 +150,30 @@ PBRT_CPU_GPU void Bump(TextureEvaluator texEval, FloatTexture displacement,
     }
 }
 
+// Material Helper Functions
+// Materials whose parameters are given by constant textures can compute the
+// corresponding BxDF parameters once at scene creation time rather than evaluating
+// the textures at each intersection; these functions return unset values for
+// textures that vary over surfaces.
+inline pstd::optional<Float> ConstantTextureValue(FloatTexture tex) {
+    if (!tex || !tex.Is<FloatConstantTexture>())
+        return {};
+    return tex.Cast<FloatConstantTexture>()->Evaluate(TextureEvalContext());
+}
+
+inline pstd::optional<TrowbridgeReitzDistribution> ConstantDistribution(
+    FloatTexture uRoughness, FloatTexture vRoughness, bool remapRoughness) {
+    pstd::optional<Float> urough = ConstantTextureValue(uRoughness);
+    pstd::optional<Float> vrough = ConstantTextureValue(vRoughness);
+    if (!urough || !vrough)
+        return {};
+    if (remapRoughness) {
+        *urough = TrowbridgeReitzDistribution::RoughnessToAlpha(*urough);
+        *vrough = TrowbridgeReitzDistribution::RoughnessToAlpha(*vrough);
+    }
+    return TrowbridgeReitzDistribution(*urough, *vrough);
+}
+
 // DielectricMaterial Definition
 class DielectricMaterial {
   public:
@@ -150,7 +189,15 @@ class DielectricMaterial {
           uRoughness(uRoughness),
           vRoughness(vRoughness),
           eta(eta),
-          remapRoughness(remapRoughness) {}
+          remapRoughness(remapRoughness) {
+        // Prebuild _DielectricBxDF_ if the material's parameters are constant
+        pstd::optional<TrowbridgeReitzDistribution> distrib =
+            ConstantDistribution(uRoughness, vRoughness, remapRoughness);
+        if (distrib && eta.Is<ConstantSpectrum>()) {
+            Float e = eta(0);
+            constantBxDF = DielectricBxDF(e == 0 ? 1 : e, *distrib);
+        }
+    }
 
     static const char *Name() { return "DielectricMaterial"; }
 
@@ -179,6 +226,10 @@ class DielectricMaterial {
     template <typename TextureEvaluator>
     PBRT_CPU_GPU BSDF GetBSDF(TextureEvaluator texEval, MaterialEvalContext ctx,
                               SampledWavelengths &lambda, DielectricBxDF *bxdf) const {
+        if (constantBxDF) {
+            *bxdf = *constantBxDF;
+            return BSDF(ctx.ns, ctx.dpdus, bxdf);
+        }
         // Compute index of refraction for dielectric material
         Float sampledEta = eta(lambda[0]);
         if (!eta.template Is<ConstantSpectrum>())
@@ -206,6 +257,7 @@ class DielectricMaterial {
     FloatTexture uRoughness, vRoughness;
     Spectrum eta;
     bool remapRoughness;
+    pstd::optional<DielectricBxDF> constantBxDF;
 };
 
 // ThinDielectricMaterial Definition
@@ -223,6 +275,10 @@ class ThinDielectricMaterial {
     PBRT_CPU_GPU BSDF GetBSDF(TextureEvaluator texEval, MaterialEvalContext ctx,
                               SampledWavelengths &lambda,
                               ThinDielectricBxDF *bxdf) const {
+        if (constantBxDF) {
+            *bxdf = *constantBxDF;
+            return BSDF(ctx.ns, ctx.dpdus, bxdf);
+        }
         // Compute index of refraction for dielectric material
         Float sampledEta = eta(lambda[0]);
         if (!eta.template Is<ConstantSpectrum>())
@@ -236,7 +292,13 @@ class ThinDielectricMaterial {
     }
 
     ThinDielectricMaterial(Spectrum eta, FloatTexture displacement, Image *normalMap)
-        : displacement(displacement), normalMap(normalMap), eta(eta) {}
+        : displacement(displacement), normalMap(normalMap), eta(eta) {
+        // Prebuild _ThinDielectricBxDF_ if the index of refraction is constant
+        if (eta.Is<ConstantSpectrum>()) {
+            Float e = eta(0);
+            constantBxDF = ThinDielectricBxDF(e == 0 ? 1 : e);
+        }
+    }
 
     static const char *Name() { return "ThinDielectricMaterial"; }
 
@@ -262,6 +324,7 @@ class ThinDielectricMaterial {
     FloatTexture displacement;
     Image *normalMap;
     Spectrum eta;
+    pstd::optional<ThinDielectricBxDF> constantBxDF;
 };
 
 // MixMaterial Definition
@@ -496,10 +559,16 @@ class ConductorMaterial {
     PBRT_CPU_GPU BSDF GetBSDF(TextureEvaluator texEval, MaterialEvalContext ctx,
                               SampledWavelengths &lambda, ConductorBxDF *bxdf) const {
         // Return BSDF for _ConductorMaterial_
-        Float uRough = texEval(uRoughness, ctx), vRough = texEval(vRoughness, ctx);
-        if (remapRoughness) {
-            uRough = TrowbridgeReitzDistribution::RoughnessToAlpha(uRough);
-            vRough = TrowbridgeReitzDistribution::RoughnessToAlpha(vRough);
+        TrowbridgeReitzDistribution distrib;
+        if (constantDistrib)
+            distrib = *constantDistrib;
+        else {
+            Float uRough = texEval(uRoughness, ctx), vRough = texEval(vRoughness, ctx);
+            if (remapRoughness) {
+                uRough = TrowbridgeReitzDistribution::RoughnessToAlpha(uRough);
+                vRough = TrowbridgeReitzDistribution::RoughnessToAlpha(vRough);
+            }
+            distrib = TrowbridgeReitzDistribution(uRough, vRough);
         }
         SampledSpectrum etas, ks;
         if (eta) {
@@ -510,14 +579,14 @@ class ConductorMaterial {
             etas = SampledSpectrum(1.f);
             ks = 2 * Sqrt(r) / Sqrt(ClampZero(SampledSpectrum(1) - r));
         }
-        TrowbridgeReitzDistribution distrib(uRough, vRough);
-        *bxdf = ConductorBxDF(distrib, etas, ks);
+        *bxdf = ConductorBxDF(distrib, etas, ks, energyCompensation);
         return BSDF(ctx.ns, ctx.dpdus, bxdf);
     }
 
     ConductorMaterial(SpectrumTexture eta, SpectrumTexture k, SpectrumTexture reflectance,
                       FloatTexture uRoughness, FloatTexture vRoughness,
-                      FloatTexture displacement, Image *normalMap, bool remapRoughness)
+                      FloatTexture displacement, Image *normalMap, bool remapRoughness,
+                      bool energyCompensation)
         : displacement(displacement),
           normalMap(normalMap),
           eta(eta),
@@ -525,7 +594,9 @@ class ConductorMaterial {
           reflectance(reflectance),
           uRoughness(uRoughness),
           vRoughness(vRoughness),
-          remapRoughness(remapRoughness) {}
+          remapRoughness(remapRoughness),
+          energyCompensation(energyCompensation),
+          constantDistrib(ConstantDistribution(uRoughness, vRoughness, remapRoughness)) {}
 
     static const char *Name() { return "ConductorMaterial"; }
 
@@ -553,6 +624,8 @@ class ConductorMaterial {
     SpectrumTexture eta, k, reflectance;
     FloatTexture uRoughness, vRoughness;
     bool remapRoughness;
+    bool energyCompensation;
+    pstd::optional<TrowbridgeReitzDistribution> constantDistrib;
 };
 
 // CoatedDiffuseMaterial Definition
@@ -565,7 +638,7 @@ class CoatedDiffuseMaterial {
                           FloatTexture vRoughness, FloatTexture thickness,
                           SpectrumTexture albedo, FloatTexture g, Spectrum eta,
                           FloatTexture displacement, Image *normalMap,
-                          bool remapRoughness, int maxDepth, int nSamples)
+                          bool remapRoughness, int maxDepth, int nSamples, bool fitted)
         : displacement(displacement),
           normalMap(normalMap),
           reflectance(reflectance),
@@ -577,7 +650,9 @@ class CoatedDiffuseMaterial {
           eta(eta),
           remapRoughness(remapRoughness),
           maxDepth(maxDepth),
-          nSamples(nSamples) {}
+          nSamples(nSamples),
+          fitted(fitted),
+          constantDistrib(ConstantDistribution(uRoughness, vRoughness, remapRoughness)) {}
 
     static const char *Name() { return "CoatedDiffuseMaterial"; }
 
@@ -617,6 +692,8 @@ class CoatedDiffuseMaterial {
     Spectrum eta;
     bool remapRoughness;
     int maxDepth, nSamples;
+    bool fitted;
+    pstd::optional<TrowbridgeReitzDistribution> constantDistrib;
 };
 
 // CoatedConductorMaterial Definition
@@ -633,7 +710,7 @@ class CoatedConductorMaterial {
                             SpectrumTexture conductorEta, SpectrumTexture k,
                             SpectrumTexture reflectance, FloatTexture displacement,
                             Image *normalMap, bool remapRoughness, int maxDepth,
-                            int nSamples)
+                            int nSamples, bool fitted)
         : displacement(displacement),
           normalMap(normalMap),
           interfaceURoughness(interfaceURoughness),
@@ -649,7 +726,12 @@ class CoatedConductorMaterial {
           reflectance(reflectance),
           remapRoughness(remapRoughness),
           maxDepth(maxDepth),
-          nSamples(nSamples) {}
+          nSamples(nSamples),
+          fitted(fitted),
+          constantInterfaceDistrib(ConstantDistribution(
+              interfaceURoughness, interfaceVRoughness, remapRoughness)),
+          constantConductorDistrib(ConstantDistribution(
+              conductorURoughness, conductorVRoughness, remapRoughness)) {}
 
     static const char *Name() { return "CoatedConductorMaterial"; }
 
@@ -694,6 +776,9 @@ class CoatedConductorMaterial {
     SpectrumTexture conductorEta, k, reflectance;
     bool remapRoughness;
     int maxDepth, nSamples;
+    bool fitted;
+    pstd::optional<TrowbridgeReitzDistribution> constantInterfaceDistrib;
+    pstd::optional<TrowbridgeReitzDistribution> constantConductorDistrib;
 };
 
 // SubsurfaceMaterial Definition
@@ -720,9 +805,7 @@ class SubsurfaceMaterial {
           vRoughness(vRoughness),
           eta(eta),
           remapRoughness(remapRoughness),
-          table(100, 64, alloc) {
-        ComputeBeamDiffusionBSSRDF(g, eta, &table);
-    }
+          table(GetBeamDiffusionBSSRDFTable(g, eta, alloc)) {}
 
     static const char *Name() { return "SubsurfaceMaterial"; }
 
@@ -763,9 +846,9 @@ class SubsurfaceMaterial {
             DCHECK(reflectance && mfp);
             SampledSpectrum mfree = ClampZero(scale * texEval(mfp, ctx, lambda));
             SampledSpectrum r = Clamp(texEval(reflectance, ctx, lambda), 0, 1);
-            SubsurfaceFromDiffuse(table, r, mfree, &sig_a, &sig_s);
+            SubsurfaceFromDiffuse(*table, r, mfree, &sig_a, &sig_s);
         }
-        *bssrdf = TabulatedBSSRDF(ctx.p, ctx.ns, ctx.wo, eta, sig_a, sig_s, &table);
+        *bssrdf = TabulatedBSSRDF(ctx.p, ctx.ns, ctx.wo, eta, sig_a, sig_s, table);
     }
 
     PBRT_CPU_GPU
@@ -790,7 +873,7 @@ class SubsurfaceMaterial {
     Float scale, eta;
     FloatTexture uRoughness, vRoughness;
     bool remapRoughness;
-    BSSRDFTable table;
+    const BSSRDFTable *table;
 };
 
 // DiffuseTransmissionMaterial Definition
@@ -12,6 +12,7 @@
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/scattering.h>
@@ -49,6 +50,125 @@ std::string HGPhaseFunction::ToString() const {
     return StringPrintf("[ HGPhaseFunction g: %f ]", g);
 }
 
+// VolumeGuidingField Method Definitions
+STAT_MEMORY_COUNTER("Memory/Volume guiding field", volumeGuidingFieldBytes);
+STAT_COUNTER("Integrator/Volume guiding field misses", volumeGuidingFieldMisses);
+STAT_PERCENT("Integrator/Guided phase function samples", nGuidedPhaseSamples,
+             nPhaseSamples);
+
+VolumeGuidingField::VolumeGuidingField(const Bounds3f &bounds, Allocator alloc)
+    : nVoxels(32 * 1024), pMin(bounds.pMin) {
+    Float voxelSize = MaxComponentValue(bounds.Diagonal()) / 64;
+    invVoxelSize = voxelSize > 0 ? 1 / voxelSize : 1;
+    voxels = alloc.allocate_object<Voxel>(nVoxels);
+    for (int i = 0; i < nVoxels; ++i)
+        alloc.construct(&voxels[i]);
+    volumeGuidingFieldBytes += nVoxels * sizeof(Voxel);
+}
+
+const VolumeGuidingField::Voxel *VolumeGuidingField::FindVoxel(uint64_t key,
+                                                               bool insert) const {
+    // Find the voxel for _key_ using linear probing, claiming an empty one if requested
+    uint64_t hash = MixBits(key);
+    for (int i = 0; i < MaxProbes; ++i) {
+        Voxel &voxel = voxels[(hash + i) & (nVoxels - 1)];
+        uint64_t voxelKey = voxel.key.load(std::memory_order_acquire);
+        if (voxelKey == 0) {
+            if (!insert)
+                return nullptr;
+            if (voxel.key.compare_exchange_strong(voxelKey, key,
+                                                  std::memory_order_acq_rel))
+                return &voxel;
+        }
+        if (voxelKey == key)
+            return &voxel;
+    }
+    return nullptr;
+}
+
+const VolumeGuidingField::Voxel *VolumeGuidingField::Lookup(Point3f p,
+                                                            Float *sum) const {
+    const Voxel *voxel = FindVoxel(VoxelKey(p), false);
+    if (!voxel || voxel->nFinished.load(std::memory_order_acquire) < RecordsToLearn)
+        return nullptr;
+    *sum = 0;
+    for (int i = 0; i < nBins; ++i)
+        *sum += voxel->radiance[i];
+    return *sum > 0 ? voxel : nullptr;
+}
+
+pstd::optional<PhaseFunctionSample> VolumeGuidingField::Sample_p(PhaseFunction phase,
+                                                                 Point3f p, Vector3f wo,
+                                                                 Point2f u) const {
+    ++nPhaseSamples;
+    Float sum;
+    const Voxel *voxel = Lookup(p, &sum);
+    if (!voxel)
+        return phase.Sample_p(wo, u);
+
+    // Sample direction from histogram or phase function, remapping _u[0]_
+    Vector3f wi;
+    if (u[0] < GuidedFraction) {
+        ++nGuidedPhaseSamples;
+        // Find the histogram bin for the sample and sample a point in it
+        Float up = u[0] / GuidedFraction * sum, cdf = 0;
+        int bin = 0;
+        while (bin < nBins - 1 && up >= cdf + voxel->radiance[bin])
+            cdf += voxel->radiance[bin++];
+        Float binRadiance = voxel->radiance[bin];
+        Float uBin = binRadiance > 0
+                         ? std::min<Float>((up - cdf) / binRadiance, OneMinusEpsilon)
+                         : 0.5f;
+        Point2f uv((bin % DirectionResolution + uBin) / DirectionResolution,
+                   (bin / DirectionResolution + u[1]) / DirectionResolution);
+        wi = EqualAreaSquareToSphere(uv);
+    } else {
+        Point2f up(std::min<Float>((u[0] - GuidedFraction) / (1 - GuidedFraction),
+                                   OneMinusEpsilon),
+                   u[1]);
+        pstd::optional<PhaseFunctionSample> ps = phase.Sample_p(wo, up);
+        if (!ps)
+            return {};
+        wi = ps->wi;
+    }
+
+    // Return phase function sample with the PDF of the mixture
+    Float pdf = (1 - GuidedFraction) * phase.PDF(wo, wi) +
+                GuidedFraction * HistogramPDF(voxel, sum, wi);
+    return PhaseFunctionSample{phase.p(wo, wi), wi, pdf};
+}
+
+Float VolumeGuidingField::PDF(PhaseFunction phase, Point3f p, Vector3f wo,
+                              Vector3f wi) const {
+    Float sum;
+    const Voxel *voxel = Lookup(p, &sum);
+    if (!voxel)
+        return phase.PDF(wo, wi);
+    return (1 - GuidedFraction) * phase.PDF(wo, wi) +
+           GuidedFraction * HistogramPDF(voxel, sum, wi);
+}
+
+void VolumeGuidingField::Record(Point3f p, Vector3f wi, Float radiance) {
+    if (!(radiance > 0) || IsInf(radiance))
+        return;
+    Voxel *voxel = const_cast<Voxel *>(FindVoxel(VoxelKey(p), true));
+    if (!voxel) {
+        ++volumeGuidingFieldMisses;
+        return;
+    }
+    // Stop learning once the voxel's histogram may be in use
+    if (voxel->nStarted.load(std::memory_order_relaxed) >= RecordsToLearn ||
+        voxel->nStarted.fetch_add(1, std::memory_order_relaxed) >= RecordsToLearn)
+        return;
+    voxel->radiance[Bin(wi)].Add(radiance);
+    voxel->nFinished.fetch_add(1, std::memory_order_release);
+}
+
+std::string VolumeGuidingField::ToString() const {
+    return StringPrintf("[ VolumeGuidingField nVoxels: %d pMin: %s invVoxelSize: %f ]",
+                        nVoxels, pMin, invVoxelSize);
+}
+
 struct MeasuredSS {
     const char *name;
     RGB sigma_prime_s, sigma_a;  // mm^-1
@@ -133,6 +253,11 @@ bool Medium::IsEmissive() const {
     return DispatchCPU(is);
 }
 
+pstd::optional<MediumEmissionGrid> Medium::GetEmissionGrid(Allocator alloc) const {
+    auto get = [&](auto ptr) { return ptr->GetEmissionGrid(alloc); };
+    return DispatchCPU(get);
+}
+
 std::string Medium::ToString() const {
     if (ptr() == nullptr)
         return "(nullptr)";
@@ -266,15 +391,25 @@ UniformGridMediumProvider *UniformGridMediumProvider::Create(
                   "Uniform grid medium has %d density values; expected nx*ny*nz = %d",
                   nDensity, nx * ny * nz);
 
+    // Scalar grids may be stored as bricks of nonzero values and at half precision
+    bool sparse = parameters.GetOneBool("sparse", false);
+    bool halfPrecision = parameters.GetOneBool("halfprecision", false);
+
     pstd::optional<SampledGrid<Float>> densityGrid;
     pstd::optional<SampledGrid<Float>> sigma_aGrid, sigma_sGrid;
     pstd::optional<SampledGrid<RGBUnboundedSpectrum>> rgbDensityGrid;
     if (density.size())
-        densityGrid = SampledGrid<Float>(density, nx, ny, nz, alloc);
+        densityGrid =
+            SampledGrid<Float>(density, nx, ny, nz, alloc, sparse, halfPrecision);
     else if (sigma_a.size()) {
-        sigma_aGrid = SampledGrid<Float>(sigma_a, nx, ny, nz, alloc);
-        sigma_sGrid = SampledGrid<Float>(sigma_s, nx, ny, nz, alloc);
+        sigma_aGrid =
+            SampledGrid<Float>(sigma_a, nx, ny, nz, alloc, sparse, halfPrecision);
+        sigma_sGrid =
+            SampledGrid<Float>(sigma_s, nx, ny, nz, alloc, sparse, halfPrecision);
     } else {
+        if (sparse || halfPrecision)
+            Warning(loc, "\"sparse\" and \"halfprecision\" are ignored for RGB "
+                    "density grids.");
         const RGBColorSpace *colorSpace = parameters.ColorSpace();
         std::vector<RGBUnboundedSpectrum> rgbSpectrumDensity;
         for (RGB rgb : rgbDensity)
@@ -302,7 +437,7 @@ UniformGridMediumProvider *UniformGridMediumProvider::Create(
                       nx, ny, nz, nx * ny * nz, LeScale.size());
         for (int i = 0; i < nx * ny * nz; ++i)
             LeScale[i] *= LeNorm;
-        LeGrid = SampledGrid<Float>(LeScale, nx, ny, nz, alloc);
+        LeGrid = SampledGrid<Float>(LeScale, nx, ny, nz, alloc, sparse, halfPrecision);
     }
 
     Point3f p0 = parameters.GetOnePoint3f("p0", Point3f(0.f, 0.f, 0.f));
@@ -363,13 +498,18 @@ NanoVDBMediumProvider *NanoVDBMediumProvider::Create(
     if (filename.empty())
         ErrorExit(loc, "Must supply \"filename\" to \"nanovdb\" medium.");
 
+    // Read the temperature grid in parallel with the density grid
+    auto temperatureJob = RunAsync([&]() {
+        return readGrid<NanoVDBBuffer>(filename, "temperature", loc, alloc);
+    });
+
     nanovdb::GridHandle<NanoVDBBuffer> densityGrid;
     densityGrid = readGrid<NanoVDBBuffer>(filename, "density", loc, alloc);
     if (!densityGrid)
         ErrorExit(loc, "%s: didn't find \"density\" grid.", filename);
 
     nanovdb::GridHandle<NanoVDBBuffer> temperatureGrid;
-    temperatureGrid = readGrid<NanoVDBBuffer>(filename, "temperature", loc, alloc);
+    temperatureGrid = std::move(temperatureJob->GetResult());
 
     Float LeScale = parameters.GetOneFloat("LeScale", 1.f);
     Float temperatureCutoff = parameters.GetOneFloat("temperaturecutoff", 0.f);
@@ -9,6 +9,7 @@
 
 #include <pbrt/base/medium.h>
 #include <pbrt/interaction.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/colorspace.h>
@@ -28,6 +29,7 @@
 #include <nanovdb/util/CudaDeviceBuffer.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
 
+#include <atomic>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -44,15 +46,48 @@ class HGPhaseFunction {
     // HGPhaseFunction Public Methods
     HGPhaseFunction() = default;
     PBRT_CPU_GPU
-    HGPhaseFunction(Float g) : g(g) {}
+    HGPhaseFunction(Float g)
+        : g(g),
+          isotropic(std::abs(g) < 1e-3f),
+          pScale(Inv4Pi * (1 - Sqr(g))),
+          oneMinusG2(1 - Sqr(g)),
+          onePlusG2(1 + Sqr(g)),
+          twoG(2 * g),
+          invTwoG(isotropic ? 0 : 1 / (2 * g)) {}
 
     PBRT_CPU_GPU
-    Float p(Vector3f wo, Vector3f wi) const { return HenyeyGreenstein(Dot(wo, wi), g); }
+    Float p(Vector3f wo, Vector3f wi) const {
+        if (isotropic)
+            return Inv4Pi;
+        // Evaluate Henyey--Greenstein using the precomputed terms of its denominator
+        Float denom = onePlusG2 + twoG * Dot(wo, wi);
+        if (GetOptions().fastPhaseFunctions) {
+            Float r = FastRsqrt(denom);
+            return pScale * r * r * r;
+        }
+        return pScale / (denom * SafeSqrt(denom));
+    }
 
     PBRT_CPU_GPU
     pstd::optional<PhaseFunctionSample> Sample_p(Vector3f wo, Point2f u) const {
-        Float pdf;
-        Vector3f wi = SampleHenyeyGreenstein(wo, g, u, &pdf);
+        // Compute $\cos \theta$ and PDF for Henyey--Greenstein sample
+        Float cosTheta, pdf;
+        if (isotropic) {
+            cosTheta = 1 - 2 * u[0];
+            pdf = Inv4Pi;
+        } else {
+            // The denominator of the Henyey--Greenstein function at the sampled
+            // $\cos \theta$ is $t^2$, which gives the PDF without a square root
+            Float t = oneMinusG2 / (1 + g - twoG * u[0]);
+            cosTheta = Clamp((Sqr(t) - onePlusG2) * invTwoG, -1, 1);
+            pdf = pScale / (t * t * t);
+        }
+
+        // Compute direction _wi_ for Henyey--Greenstein sample
+        Float sinTheta = SafeSqrt(1 - Sqr(cosTheta));
+        Float phi = 2 * Pi * u[1];
+        Frame wFrame = Frame::FromZ(wo);
+        Vector3f wi = wFrame.FromLocal(SphericalDirection(sinTheta, cosTheta, phi));
         return PhaseFunctionSample{pdf, wi, pdf};
     }
 
@@ -66,20 +101,102 @@ class HGPhaseFunction {
   private:
     // HGPhaseFunction Private Members
     Float g;
+    bool isotropic;
+    Float pScale, oneMinusG2, onePlusG2, twoG, invTwoG;
+};
+
+// VolumeGuidingField Definition
+// Learns the distribution of radiance arriving at the voxels of a spatial hash
+// grid from the path contributions recorded at medium scattering events. Each
+// voxel holds a histogram over an equal-area mapping of directions that is
+// frozen once it has seen enough records; from then on, scattering directions
+// there are sampled from a mixture of the histogram and the phase function.
+class VolumeGuidingField {
+  public:
+    // VolumeGuidingField Public Methods
+    VolumeGuidingField(const Bounds3f &bounds, Allocator alloc);
+
+    pstd::optional<PhaseFunctionSample> Sample_p(PhaseFunction phase, Point3f p,
+                                                 Vector3f wo, Point2f u) const;
+    Float PDF(PhaseFunction phase, Point3f p, Vector3f wo, Vector3f wi) const;
+
+    void Record(Point3f p, Vector3f wi, Float radiance);
+
+    std::string ToString() const;
+
+    // VolumeGuidingField Public Members
+    // Fraction of the probability of each direction that comes from the histogram
+    static constexpr Float GuidedFraction = 0.5f;
+
+  private:
+    // VolumeGuidingField Private Members
+    static constexpr int DirectionResolution = 8;
+    static constexpr int nBins = DirectionResolution * DirectionResolution;
+    static constexpr int RecordsToLearn = 512;
+    static constexpr int MaxProbes = 8;
+    struct Voxel {
+        std::atomic<uint64_t> key{0};
+        // Records are counted both before and after they are accumulated so that
+        // a voxel's histogram is only used once no more updates are in flight
+        std::atomic<int> nStarted{0}, nFinished{0};
+        // Sums of the recorded radiance arriving from each histogram bin
+        AtomicFloat radiance[nBins];
+    };
+    Voxel *voxels;
+    int nVoxels;
+    Point3f pMin;
+    Float invVoxelSize;
+
+    // VolumeGuidingField Private Methods
+    static int Bin(Vector3f w) {
+        Point2f uv = EqualAreaSphereToSquare(w);
+        int x = std::min<int>(uv[0] * DirectionResolution, DirectionResolution - 1);
+        int y = std::min<int>(uv[1] * DirectionResolution, DirectionResolution - 1);
+        return y * DirectionResolution + x;
+    }
+
+    uint64_t VoxelKey(Point3f p) const {
+        // Find voxel coordinates; the grid extends far beyond the scene's bounds
+        Vector3f pv = (p - pMin) * invVoxelSize;
+        uint64_t key = 0;
+        for (int i = 0; i < 3; ++i)
+            key = (key << 20) |
+                  uint64_t(Clamp<Float>(pv[i] + (1 << 19), 0, (1 << 20) - 1));
+        // Keys of occupied voxels are nonzero
+        return key + 1;
+    }
+
+    const Voxel *FindVoxel(uint64_t key, bool insert) const;
+    // Returns the voxel at _p_ if its histogram has been learned
+    const Voxel *Lookup(Point3f p, Float *sum) const;
+    static Float HistogramPDF(const Voxel *voxel, Float sum, Vector3f wi) {
+        return voxel->radiance[Bin(wi)] / sum * nBins * Inv4Pi;
+    }
 };
 
 // MediumSample Definition
 struct MediumSample {
     PBRT_CPU_GPU
-    MediumSample(const MediumInteraction &intr, SampledSpectrum T_maj)
-        : intr(intr), T_maj(T_maj) {}
+    MediumSample(const MediumInteraction &intr, SampledSpectrum T_maj,
+                 SampledSpectrum sigma_c = SampledSpectrum(0.f))
+        : intr(intr), T_maj(T_maj), sigma_c(sigma_c) {}
     // MediumSample Public Methods
     MediumSample() = default;
 
+    PBRT_CPU_GPU
+    SampledSpectrum sigma_n() const {
+        // Return null-scattering coefficient with respect to control extinction
+        SampledSpectrum sigma_t = intr.sigma_a + intr.sigma_s;
+        return ClampZero(intr.sigma_maj - (sigma_t - sigma_c));
+    }
+
     std::string ToString() const;
 
     MediumInteraction intr;
     SampledSpectrum T_maj;
+    // Control extinction for residual tracking; _intr.sigma_maj_ then bounds the
+    // residual extinction _sigma_t - sigma_c_
+    SampledSpectrum sigma_c;
 };
 
 // MediumProperties Definition
@@ -87,6 +204,18 @@ struct MediumProperties {
     SampledSpectrum sigma_a, sigma;
     PhaseFunction phase;
     SampledSpectrum Le;
+    // Majorant that _SampleT_maj()_ uses at the point
+    SampledSpectrum sigma_maj;
+};
+
+// MediumEmissionGrid Definition
+// Bounds the emission $\sigma_\roman{a} L_\roman{e}$ of a medium over the voxels of
+// a grid that covers its medium-space bounds.
+struct MediumEmissionGrid {
+    Bounds3f bounds;
+    Transform renderFromMedium;
+    Point3i res;
+    pstd::vector<Float> maxEmission;
 };
 
 // HomogeneousMedium Definition
@@ -114,7 +243,12 @@ class HomogeneousMedium {
         SampledSpectrum sigma_a = sigma_a_spec.Sample(lambda);
         SampledSpectrum sigma_s = sigma_s_spec.Sample(lambda);
         SampledSpectrum Le = Le_spec.Sample(lambda);
-        return MediumProperties{sigma_a, sigma_s, &phase, Le};
+        return MediumProperties{sigma_a, sigma_s, &phase, Le, sigma_a + sigma_s};
+    }
+
+    // Homogeneous media are unbounded, so their emission can't be sampled by volume
+    pstd::optional<MediumEmissionGrid> GetEmissionGrid(Allocator alloc) const {
+        return {};
     }
 
     template <typename F>
@@ -151,6 +285,20 @@ class HomogeneousMedium {
             return FastExp(-tMax * sigma_maj);
     }
 
+    template <typename F>
+    PBRT_CPU_GPU SampledSpectrum SampleT_res(Ray ray, Float tMax, Float u, RNG &rng,
+                                             const SampledWavelengths &lambda,
+                                             SampledSpectrum *T_c, F callback) const {
+        // Use the medium's extinction as the control, leaving no residual to sample
+        tMax *= Length(ray.d);
+        if (IsInf(tMax))
+            tMax = std::numeric_limits<Float>::max();
+        SampledSpectrum sigma_t =
+            sigma_a_spec.Sample(lambda) + sigma_s_spec.Sample(lambda);
+        *T_c = FastExp(-tMax * sigma_t);
+        return SampledSpectrum(1.f);
+    }
+
     std::string ToString() const;
 
   private:
@@ -159,6 +307,73 @@ class HomogeneousMedium {
     HGPhaseFunction phase;
 };
 
+// MaxDensityGridDDA Definition
+// Steps through the voxels in [voxelMin, voxelMax) of a maximum density grid level
+// with _scale_ voxels per unit along each axis, reporting the ray's extent in each.
+class MaxDensityGridDDA {
+  public:
+    // MaxDensityGridDDA Public Methods
+    MaxDensityGridDDA() = default;
+    PBRT_CPU_GPU
+    MaxDensityGridDDA(const Ray &rayGrid, Float tMin, Float tMax, Vector3f scale,
+                      Point3i voxelMin, Point3i voxelMax)
+        : tMin(tMin), tMax(tMax) {
+        Point3f gridIntersect = rayGrid(tMin);
+        for (int axis = 0; axis < 3; ++axis) {
+            // Initialize ray stepping parameters for axis
+            // Compute current voxel for axis and handle negative zero direction
+            voxel[axis] = Clamp(int(gridIntersect[axis] * scale[axis]), voxelMin[axis],
+                                voxelMax[axis] - 1);
+            deltaT[axis] = 1 / std::abs(rayGrid.d[axis] * scale[axis]);
+            Float d = (rayGrid.d[axis] == -0.f) ? 0.f : rayGrid.d[axis];
+
+            if (d >= 0) {
+                // Handle ray with positive direction for voxel stepping
+                Float nextVoxelPos = Float(voxel[axis] + 1) / scale[axis];
+                nextCrossingT[axis] = tMin + (nextVoxelPos - gridIntersect[axis]) / d;
+                step[axis] = 1;
+                voxelLimit[axis] = voxelMax[axis];
+
+            } else {
+                // Handle ray with negative direction for voxel stepping
+                Float nextVoxelPos = Float(voxel[axis]) / scale[axis];
+                nextCrossingT[axis] = tMin + (nextVoxelPos - gridIntersect[axis]) / d;
+                step[axis] = -1;
+                voxelLimit[axis] = voxelMin[axis] - 1;
+            }
+        }
+    }
+
+    PBRT_CPU_GPU
+    bool Next(Point3i *v, Float *t0, Float *t1) {
+        if (tMin >= tMax)
+            return false;
+        // Find _stepAxis_ for stepping to next voxel and exit point _t1_
+        int bits = ((nextCrossingT[0] < nextCrossingT[1]) << 2) +
+                   ((nextCrossingT[0] < nextCrossingT[2]) << 1) +
+                   ((nextCrossingT[1] < nextCrossingT[2]));
+        const int cmpToAxis[8] = {2, 1, 2, 1, 2, 2, 0, 0};
+        int stepAxis = cmpToAxis[bits];
+        *v = Point3i(voxel[0], voxel[1], voxel[2]);
+        *t0 = tMin;
+        *t1 = std::max(tMin, std::min(tMax, nextCrossingT[stepAxis]));
+
+        // Advance to next voxel in maximum density grid
+        tMin = *t1;
+        voxel[stepAxis] += step[stepAxis];
+        if (nextCrossingT[stepAxis] > tMax || voxel[stepAxis] == voxelLimit[stepAxis])
+            tMin = tMax;
+        nextCrossingT[stepAxis] += deltaT[stepAxis];
+        return true;
+    }
+
+  private:
+    // MaxDensityGridDDA Private Members
+    Float tMin, tMax;
+    Float nextCrossingT[3], deltaT[3];
+    int step[3], voxelLimit[3], voxel[3];
+};
+
 // CuboidMedium Definition
 template <typename Provider>
 class CuboidMedium {
@@ -174,37 +389,142 @@ class CuboidMedium {
           sigScale(sigScale),
           phase(g),
           renderFromMedium(renderFromMedium),
-          maxDensityGrid(alloc) {
-        // Initialize _maxDensityGrid_
-        maxDensityGrid = provider->GetMaxDensityGrid(alloc, &gridResolution);
+          maxDensityGrid(alloc),
+          minDensityGrid(alloc) {
+        // Initialize _maxDensityGrid_ and _minDensityGrid_
+        maxDensityGrid = provider->GetMaxDensityGrid(alloc, &gridResolution[0]);
+        minDensityGrid = provider->GetMinDensityGrid(alloc, gridResolution[0]);
+        CHECK_EQ(maxDensityGrid.size(), minDensityGrid.size());
+        gridScale[0] = Vector3f(gridResolution[0]);
+        gridOffset[0] = 0;
+        nGridLevels = 1;
+        while (nGridLevels < MaxGridLevels &&
+               MaxComponentValue(gridResolution[nGridLevels - 1]) > GridLevelScale) {
+            // Add coarser level of maximum densities over blocks of finer voxels
+            int level = nGridLevels++;
+            Point3i fineRes = gridResolution[level - 1], res;
+            for (int axis = 0; axis < 3; ++axis)
+                res[axis] = (fineRes[axis] + GridLevelScale - 1) / GridLevelScale;
+            gridResolution[level] = res;
+            gridScale[level] = gridScale[level - 1] / GridLevelScale;
+            gridOffset[level] = maxDensityGrid.size();
+            maxDensityGrid.resize(gridOffset[level] + res.x * res.y * res.z);
+
+            const Float *fineGrid = &maxDensityGrid[gridOffset[level - 1]];
+            Float *grid = &maxDensityGrid[gridOffset[level]];
+            for (int z = 0; z < fineRes.z; ++z)
+                for (int y = 0; y < fineRes.y; ++y)
+                    for (int x = 0; x < fineRes.x; ++x) {
+                        int offset = x / GridLevelScale +
+                                     res.x * (y / GridLevelScale +
+                                              res.y * (z / GridLevelScale));
+                        grid[offset] =
+                            std::max(grid[offset],
+                                     fineGrid[x + fineRes.x * (y + fineRes.y * z)]);
+                    }
+        }
     }
 
     std::string ToString() const {
         return StringPrintf("[ CuboidMedium provider: %s mediumBounds: %s "
                             "sigma_a_spec: %s sigma_s_spec: %s sigScale: %f phase: %s "
-                            "maxDensityGrid: %s gridResolution: %s ]",
+                            "gridResolution: %s nGridLevels: %d ]",
                             *provider, mediumBounds, sigma_a_spec, sigma_s_spec, sigScale,
-                            phase, maxDensityGrid, gridResolution);
+                            phase, gridResolution[0], nGridLevels);
     }
 
     bool IsEmissive() const { return provider->IsEmissive(); }
 
     PBRT_CPU_GPU
-    MediumProperties Sample(Point3f p, const SampledWavelengths &lambda) const {
+    MediumProperties Sample(Point3f pRender, const SampledWavelengths &lambda) const {
         // Sample spectra for grid medium scattering
         SampledSpectrum sigma_a = sigScale * sigma_a_spec.Sample(lambda);
         SampledSpectrum sigma_s = sigScale * sigma_s_spec.Sample(lambda);
         SampledSpectrum sigma_t = sigma_a + sigma_s;
 
+        Point3f p = renderFromMedium.ApplyInverse(pRender);
         MediumDensity d = provider->Density(p, lambda);
         SampledSpectrum Le = provider->Le(p, lambda);
-        return MediumProperties{sigma_a * d.sigma_a, sigma_s * d.sigma_s, &phase, Le};
+        // Find majorant of the finest grid level's voxel that contains _p_
+        Point3f pg(mediumBounds.Offset(p));
+        Point3i res = gridResolution[0];
+        int offset = 0;
+        for (int axis = 2; axis >= 0; --axis)
+            offset = offset * res[axis] +
+                     Clamp(int(pg[axis] * res[axis]), 0, res[axis] - 1);
+        SampledSpectrum sigma_maj = sigma_t * maxDensityGrid[offset];
+        if (!Inside(p, mediumBounds))
+            sigma_maj = SampledSpectrum(0.f);
+        return MediumProperties{sigma_a * d.sigma_a, sigma_s * d.sigma_s, &phase, Le,
+                                sigma_maj};
+    }
+
+    pstd::optional<MediumEmissionGrid> GetEmissionGrid(Allocator alloc) const {
+        // Bound emission in each voxel of the finest maximum density grid level
+        if (!IsEmissive())
+            return {};
+        Point3i res = gridResolution[0];
+        pstd::vector<Float> maxEmission = provider->GetMaxEmissionGrid(alloc, res);
+        Float sigma_aMax = sigScale * sigma_a_spec.MaxValue();
+        for (size_t i = 0; i < maxEmission.size(); ++i)
+            maxEmission[i] *= sigma_aMax * maxDensityGrid[i];
+        return MediumEmissionGrid{mediumBounds, renderFromMedium, res,
+                                  std::move(maxEmission)};
     }
 
     template <typename F>
     PBRT_CPU_GPU SampledSpectrum SampleT_maj(Ray rRender, Float raytMax, Float u,
                                              RNG &rng, const SampledWavelengths &lambda,
                                              F callback) const {
+        return SampleT(rRender, raytMax, u, rng, lambda, nullptr, callback);
+    }
+
+    template <typename F>
+    PBRT_CPU_GPU SampledSpectrum SampleT_res(Ray rRender, Float raytMax, Float u,
+                                             RNG &rng, const SampledWavelengths &lambda,
+                                             SampledSpectrum *T_c, F callback) const {
+        *T_c = SampledSpectrum(1.f);
+        return SampleT(rRender, raytMax, u, rng, lambda, T_c, callback);
+    }
+
+    static CuboidMedium<Provider> *Create(const Provider *provider,
+                                          const ParameterDictionary &parameters,
+                                          const Transform &renderFromMedium,
+                                          const FileLoc *loc, Allocator alloc) {
+        Spectrum sig_a = nullptr, sig_s = nullptr;
+        std::string preset = parameters.GetOneString("preset", "");
+        if (!preset.empty()) {
+            if (!GetMediumScatteringProperties(preset, &sig_a, &sig_s, alloc))
+                Warning(loc, "Material preset \"%s\" not found.", preset);
+        }
+
+        if (sig_a == nullptr) {
+            sig_a = parameters.GetOneSpectrum("sigma_a", nullptr, SpectrumType::Unbounded,
+                                              alloc);
+            if (sig_a == nullptr)
+                sig_a = alloc.new_object<ConstantSpectrum>(1.f);
+        }
+        if (sig_s == nullptr) {
+            sig_s = parameters.GetOneSpectrum("sigma_s", nullptr, SpectrumType::Unbounded,
+                                              alloc);
+            if (sig_s == nullptr)
+                sig_s = alloc.new_object<ConstantSpectrum>(1.f);
+        }
+
+        Float sigScale = parameters.GetOneFloat("scale", 1.f);
+
+        Float g = parameters.GetOneFloat("g", 0.0f);
+
+        return alloc.new_object<CuboidMedium<Provider>>(provider, sig_a, sig_s, sigScale,
+                                                        g, renderFromMedium, alloc);
+    }
+
+  private:
+    // CuboidMedium Private Methods
+    template <typename F>
+    PBRT_CPU_GPU SampledSpectrum SampleT(Ray rRender, Float raytMax, Float u, RNG &rng,
+                                         const SampledWavelengths &lambda,
+                                         SampledSpectrum *T_c, F callback) const {
         // Transform ray to grid density's space and compute bounds overlap
         Ray ray = renderFromMedium.ApplyInverse(rRender, &raytMax);
         raytMax *= Length(ray.d);
@@ -219,59 +539,55 @@ class CuboidMedium {
         SampledSpectrum sigma_s = sigScale * sigma_s_spec.Sample(lambda);
         SampledSpectrum sigma_t = sigma_a + sigma_s;
 
-        // Set up 3D DDA for ray through grid
+        // Set up 3D DDA for ray through coarsest maximum density grid level
         Vector3f diag = mediumBounds.Diagonal();
         Ray rayGrid(Point3f(mediumBounds.Offset(ray.o)),
                     Vector3f(ray.d.x / diag.x, ray.d.y / diag.y, ray.d.z / diag.z));
-        Point3f gridIntersect = rayGrid(tMin);
-        Float nextCrossingT[3], deltaT[3];
-        int step[3], voxelLimit[3], voxel[3];
-        for (int axis = 0; axis < 3; ++axis) {
-            // Initialize ray stepping parameters for axis
-            // Compute current voxel for axis and handle negative zero direction
-            voxel[axis] = Clamp(gridIntersect[axis] * gridResolution[axis], 0,
-                                gridResolution[axis] - 1);
-            deltaT[axis] = 1 / std::abs(rayGrid.d[axis] * gridResolution[axis]);
-            if (rayGrid.d[axis] == -0.f)
-                rayGrid.d[axis] = 0.f;
-
-            if (rayGrid.d[axis] >= 0) {
-                // Handle ray with positive direction for voxel stepping
-                Float nextVoxelPos = Float(voxel[axis] + 1) / gridResolution[axis];
-                nextCrossingT[axis] =
-                    tMin + (nextVoxelPos - gridIntersect[axis]) / rayGrid.d[axis];
-                step[axis] = 1;
-                voxelLimit[axis] = gridResolution[axis];
+        MaxDensityGridDDA dda[MaxGridLevels];
+        int level = nGridLevels - 1;
+        dda[level] = MaxDensityGridDDA(rayGrid, tMin, tMax, gridScale[level],
+                                       Point3i(0, 0, 0), gridResolution[level]);
 
-            } else {
-                // Handle ray with negative direction for voxel stepping
-                Float nextVoxelPos = Float(voxel[axis]) / gridResolution[axis];
-                nextCrossingT[axis] =
-                    tMin + (nextVoxelPos - gridIntersect[axis]) / rayGrid.d[axis];
-                step[axis] = -1;
-                voxelLimit[axis] = -1;
-            }
-        }
-
-        // Walk ray through maximum density grid and sample medium
-        Float t0 = tMin;
+        // Walk ray through maximum density grid levels and sample medium
         SampledSpectrum T_majAccum(1.f);
         while (true) {
-            // Find _stepAxis_ for stepping to next voxel and exit point _t1_
-            int bits = ((nextCrossingT[0] < nextCrossingT[1]) << 2) +
-                       ((nextCrossingT[0] < nextCrossingT[2]) << 1) +
-                       ((nextCrossingT[1] < nextCrossingT[2]));
-            const int cmpToAxis[8] = {2, 1, 2, 1, 2, 2, 0, 0};
-            int stepAxis = cmpToAxis[bits];
-            Float t1 = std::min(tMax, nextCrossingT[stepAxis]);
+            // Get next voxel at current level, returning to coarser levels as needed
+            Point3i voxel;
+            Float t0, t1;
+            if (!dda[level].Next(&voxel, &t0, &t1)) {
+                if (++level == nGridLevels)
+                    break;
+                continue;
+            }
 
-            // Sample volume in current voxel
-            // Get _maxDensity_ for current voxel and compute _sigma_maj_
-            int offset =
-                voxel[0] + gridResolution.x * (voxel[1] + gridResolution.y * voxel[2]);
-            Float maxDensity = maxDensityGrid[offset];
-            SampledSpectrum sigma_maj(sigma_t * maxDensity);
+            // Get _maxDensity_ for current voxel and skip it if it's empty
+            Point3i res = gridResolution[level];
+            int offset = voxel.x + res.x * (voxel.y + res.y * voxel.z);
+            Float maxDensity = maxDensityGrid[gridOffset[level] + offset];
+            if (maxDensity == 0)
+                continue;
+
+            if (level > 0) {
+                // Descend to the finer level's voxels inside the current one
+                Point3i voxelMin(voxel.x * GridLevelScale, voxel.y * GridLevelScale,
+                                 voxel.z * GridLevelScale);
+                Point3i voxelMax = voxelMin + Vector3i(GridLevelScale, GridLevelScale,
+                                                       GridLevelScale);
+                --level;
+                voxelMax = Min(voxelMax, gridResolution[level]);
+                dda[level] = MaxDensityGridDDA(rayGrid, t0, t1, gridScale[level],
+                                               voxelMin, voxelMax);
+                continue;
+            }
 
+            // Sample volume in current voxel
+            SampledSpectrum sigma_maj(sigma_t * maxDensity), sigma_c(0.f);
+            if (T_c) {
+                // Split extinction into control and residual for residual tracking
+                sigma_c = sigma_t * minDensityGrid[offset];
+                sigma_maj -= sigma_c;
+                *T_c *= FastExp(-sigma_c * (t1 - t0));
+            }
             if (sigma_maj[0] == 0)
                 T_majAccum *= FastExp(-sigma_maj * (t1 - t0));
             else {
@@ -301,59 +617,17 @@ class CuboidMedium {
                         MediumInteraction intr(pRender, -Normalize(rRender.d),
                                                rRender.time, sigmap_a, sigmap_s,
                                                sigma_maj, Le, this, &phase);
-                        if (!callback(MediumSample(intr, T_maj)))
+                        if (!callback(MediumSample(intr, T_maj, sigma_c)))
                             return SampledSpectrum(1.f);
                     }
                     // Update _t0_ after medium interaction
                     t0 = t;
                 }
             }
-
-            // Advance to next voxel in maximum density grid
-            if (nextCrossingT[stepAxis] > tMax)
-                break;
-            voxel[stepAxis] += step[stepAxis];
-            if (voxel[stepAxis] == voxelLimit[stepAxis])
-                break;
-            nextCrossingT[stepAxis] += deltaT[stepAxis];
-            t0 = t1;
         }
         return T_majAccum;
     }
 
-    static CuboidMedium<Provider> *Create(const Provider *provider,
-                                          const ParameterDictionary &parameters,
-                                          const Transform &renderFromMedium,
-                                          const FileLoc *loc, Allocator alloc) {
-        Spectrum sig_a = nullptr, sig_s = nullptr;
-        std::string preset = parameters.GetOneString("preset", "");
-        if (!preset.empty()) {
-            if (!GetMediumScatteringProperties(preset, &sig_a, &sig_s, alloc))
-                Warning(loc, "Material preset \"%s\" not found.", preset);
-        }
-
-        if (sig_a == nullptr) {
-            sig_a = parameters.GetOneSpectrum("sigma_a", nullptr, SpectrumType::Unbounded,
-                                              alloc);
-            if (sig_a == nullptr)
-                sig_a = alloc.new_object<ConstantSpectrum>(1.f);
-        }
-        if (sig_s == nullptr) {
-            sig_s = parameters.GetOneSpectrum("sigma_s", nullptr, SpectrumType::Unbounded,
-                                              alloc);
-            if (sig_s == nullptr)
-                sig_s = alloc.new_object<ConstantSpectrum>(1.f);
-        }
-
-        Float sigScale = parameters.GetOneFloat("scale", 1.f);
-
-        Float g = parameters.GetOneFloat("g", 0.0f);
-
-        return alloc.new_object<CuboidMedium<Provider>>(provider, sig_a, sig_s, sigScale,
-                                                        g, renderFromMedium, alloc);
-    }
-
-  private:
     // CuboidMedium Private Members
     const Provider *provider;
     Bounds3f mediumBounds;
@@ -361,8 +635,14 @@ class CuboidMedium {
     Float sigScale;
     HGPhaseFunction phase;
     Transform renderFromMedium;
-    pstd::vector<Float> maxDensityGrid;
-    Point3i gridResolution;
+    // Maximum density grid levels, finest first, with each voxel of a coarser
+    // level bounding _GridLevelScale_^3 voxels of the level below it
+    static constexpr int MaxGridLevels = 4, GridLevelScale = 4;
+    pstd::vector<Float> maxDensityGrid, minDensityGrid;
+    Point3i gridResolution[MaxGridLevels];
+    Vector3f gridScale[MaxGridLevels];
+    int gridOffset[MaxGridLevels];
+    int nGridLevels;
 };
 
 // UniformGridMediumProvider Definition
@@ -438,6 +718,44 @@ class UniformGridMediumProvider {
         return maxGrid;
     }
 
+    pstd::vector<Float> GetMinDensityGrid(Allocator alloc, Point3i res) const {
+        pstd::vector<Float> minGrid(res.x * res.y * res.z, Float(0), alloc);
+        // RGB densities leave the minimum at zero, which disables the control
+        if (rgb)
+            return minGrid;
+        // Compute minimum density for each _minGrid_ cell
+        int offset = 0;
+        for (Float z = 0; z < res.z; ++z)
+            for (Float y = 0; y < res.y; ++y)
+                for (Float x = 0; x < res.x; ++x) {
+                    Bounds3f bounds(
+                        Point3f(x / res.x, y / res.y, z / res.z),
+                        Point3f((x + 1) / res.x, (y + 1) / res.y, (z + 1) / res.z));
+                    if (density)
+                        minGrid[offset++] = density->MinValue(bounds);
+                    else
+                        minGrid[offset++] = std::min(sigma_a->MinValue(bounds),
+                                                     sigma_s->MinValue(bounds));
+                }
+        return minGrid;
+    }
+
+    pstd::vector<Float> GetMaxEmissionGrid(Allocator alloc, Point3i res) const {
+        pstd::vector<Float> maxGrid(res.x * res.y * res.z, Float(0), alloc);
+        // Compute maximum emitted radiance for each _maxGrid_ cell
+        Float LeMax = Le_spec.MaxValue();
+        int offset = 0;
+        for (Float z = 0; z < res.z; ++z)
+            for (Float y = 0; y < res.y; ++y)
+                for (Float x = 0; x < res.x; ++x) {
+                    Bounds3f bounds(
+                        Point3f(x / res.x, y / res.y, z / res.z),
+                        Point3f((x + 1) / res.x, (y + 1) / res.y, (z + 1) / res.z));
+                    maxGrid[offset++] = LeMax * LeScale.MaxValue(bounds);
+                }
+        return maxGrid;
+    }
+
   private:
     // UniformGridMediumProvider Private Members
     Bounds3f bounds;
@@ -508,6 +826,14 @@ class CloudMediumProvider {
         return pstd::vector<Float>(1, 1.f, alloc);
     }
 
+    pstd::vector<Float> GetMinDensityGrid(Allocator alloc, Point3i res) const {
+        return pstd::vector<Float>(1, 0.f, alloc);
+    }
+
+    pstd::vector<Float> GetMaxEmissionGrid(Allocator alloc, Point3i res) const {
+        return pstd::vector<Float>(res.x * res.y * res.z, 0.f, alloc);
+    }
+
   private:
     // CloudMediumProvider Private Members
     Bounds3f bounds;
@@ -652,61 +978,56 @@ class NanoVDBMediumProvider {
     densityFloatGrid->tree().extrema(minDensity, maxDensity);
     return pstd::vector<Float>(1, maxDensity, alloc);
 #else
-        *res = Point3i(64, 64, 64);
+        // Choose resolution of about one cell per leaf node of the VDB's index
+        // bounds; _CuboidMedium_ builds coarser levels above it to skip empty space
+        auto bbox = densityFloatGrid->indexBBox();
+        for (int axis = 0; axis < 3; ++axis) {
+            int extent = bbox.max()[axis] - bbox.min()[axis] + 1;
+            (*res)[axis] = Clamp((extent + 7) / 8, 1, 256);
+        }
 
         LOG_VERBOSE("Starting nanovdb grid GetMaxDensityGrid()");
 
         pstd::vector<Float> maxGrid(res->x * res->y * res->z, 0.f, alloc);
 
-        ParallelFor(0, maxGrid.size(), [&](size_t index) {
-            // Indices into maxGrid
-            int x = index % res->x;
-            int y = (index / res->x) % res->y;
-            int z = index / (res->x * res->y);
-            CHECK_EQ(index, x + res->x * (y + res->y * z));
-
-            // World (aka medium) space bounds of this max grid cell
-            Bounds3f wb(bounds.Lerp(Point3f(Float(x) / res->x, Float(y) / res->y,
-                                            Float(z) / res->z)),
-                        bounds.Lerp(Point3f(Float(x + 1) / res->x, Float(y + 1) / res->y,
-                                            Float(z + 1) / res->z)));
-
-            // Compute corresponding NanoVDB index-space bounds in floating-point.
-            nanovdb::Vec3R i0 = densityFloatGrid->worldToIndexF(
-                nanovdb::Vec3R(wb.pMin.x, wb.pMin.y, wb.pMin.z));
-            nanovdb::Vec3R i1 = densityFloatGrid->worldToIndexF(
-                nanovdb::Vec3R(wb.pMax.x, wb.pMax.y, wb.pMax.z));
-
-            // Now find integer index-space bounds, accounting for both
-            // filtering and the overall index bounding box.
-            auto bbox = densityFloatGrid->indexBBox();
-            Float delta = 1.f;  // Filter slop
-            int nx0 = std::max(int(i0[0] - delta), bbox.min()[0]);
-            int nx1 = std::min(int(i1[0] + delta), bbox.max()[0]);
-            int ny0 = std::max(int(i0[1] - delta), bbox.min()[1]);
-            int ny1 = std::min(int(i1[1] + delta), bbox.max()[1]);
-            int nz0 = std::max(int(i0[2] - delta), bbox.min()[2]);
-            int nz1 = std::min(int(i1[2] + delta), bbox.max()[2]);
-
-            float maxValue = 0;
-            auto accessor = densityFloatGrid->getAccessor();
-            // Apparently nanovdb integer bounding boxes are inclusive on
-            // the upper end...
-            for (int nz = nz0; nz <= nz1; ++nz)
-                for (int ny = ny0; ny <= ny1; ++ny)
-                    for (int nx = nx0; nx <= nx1; ++nx)
-                        maxValue = std::max(maxValue, accessor.getValue({nx, ny, nz}));
-
-            // Only write into maxGrid once when we're done to minimize
-            // cache thrashing..
-            maxGrid[index] = maxValue;
-        });
+        ForEachCell(densityFloatGrid, *res,
+                    [&](auto &accessor, int offset, Point3i n0, Point3i n1) {
+                        maxGrid[offset] =
+                            NodeValueBound<true>(densityFloatGrid, accessor, n0, n1);
+                    });
 
         LOG_VERBOSE("Finished nanovdb grid GetMaxDensityGrid()");
         return maxGrid;
 #endif
     }
 
+    pstd::vector<Float> GetMinDensityGrid(Allocator alloc, Point3i res) const {
+        pstd::vector<Float> minGrid(res.x * res.y * res.z, 0.f, alloc);
+        ForEachCell(densityFloatGrid, res,
+                    [&](auto &accessor, int offset, Point3i n0, Point3i n1) {
+                        minGrid[offset] =
+                            NodeValueBound<false>(densityFloatGrid, accessor, n0, n1);
+                    });
+        return minGrid;
+    }
+
+    pstd::vector<Float> GetMaxEmissionGrid(Allocator alloc, Point3i res) const {
+        pstd::vector<Float> maxGrid(res.x * res.y * res.z, 0.f, alloc);
+        if (!IsEmissive())
+            return maxGrid;
+        // Bound the normalized blackbody emission by _LeScale_ where the maximum
+        // temperature is hot enough for _Le()_ to be nonzero
+        ForEachCell(temperatureFloatGrid, res,
+                    [&](auto &accessor, int offset, Point3i n0, Point3i n1) {
+                        Float maxTemperature = NodeValueBound<true>(
+                            temperatureFloatGrid, accessor, n0, n1);
+                        Float temp = (maxTemperature - temperatureCutoff) *
+                                     temperatureScale;
+                        maxGrid[offset] = (temp > 100.f) ? LeScale : 0;
+                    });
+        return maxGrid;
+    }
+
     PBRT_CPU_GPU
     MediumDensity Density(const Point3f &p, const SampledWavelengths &lambda) const {
         nanovdb::Vec3<float> pIndex =
@@ -717,6 +1038,94 @@ class NanoVDBMediumProvider {
     }
 
   private:
+    // NanoVDBMediumProvider Private Methods
+    template <typename F>
+    void ForEachCell(const nanovdb::FloatGrid *grid, Point3i res, F func) const {
+        // Call _func_ with _grid_'s index-space bounds of each cell of a grid over
+        // _bounds_
+        ParallelFor(0, res.z, [&](int64_t z0, int64_t z1) {
+            auto accessor = grid->getAccessor();
+            for (int z = z0; z < z1; ++z)
+                for (int y = 0; y < res.y; ++y)
+                    for (int x = 0; x < res.x; ++x) {
+                        // World (aka medium) space bounds of this grid cell
+                        Bounds3f wb(
+                            bounds.Lerp(Point3f(Float(x) / res.x, Float(y) / res.y,
+                                                Float(z) / res.z)),
+                            bounds.Lerp(Point3f(Float(x + 1) / res.x,
+                                                Float(y + 1) / res.y,
+                                                Float(z + 1) / res.z)));
+
+                        // Compute corresponding NanoVDB index-space bounds in
+                        // floating-point.
+                        nanovdb::Vec3R i0 = grid->worldToIndexF(
+                            nanovdb::Vec3R(wb.pMin.x, wb.pMin.y, wb.pMin.z));
+                        nanovdb::Vec3R i1 = grid->worldToIndexF(
+                            nanovdb::Vec3R(wb.pMax.x, wb.pMax.y, wb.pMax.z));
+
+                        // Now find integer index-space bounds, accounting for
+                        // filtering; voxels outside the index bounding box are
+                        // skipped but are noted by bounds that extend past it.
+                        Float delta = 1.f;  // Filter slop
+                        Point3i n0, n1;
+                        for (int axis = 0; axis < 3; ++axis) {
+                            n0[axis] = int(i0[axis] - delta);
+                            n1[axis] = int(i1[axis] + delta);
+                        }
+                        func(accessor, x + res.x * (y + res.y * z), n0, n1);
+                    }
+        });
+    }
+
+    template <bool Max, typename Accessor>
+    Float NodeValueBound(const nanovdb::FloatGrid *grid, Accessor &accessor, Point3i n0,
+                         Point3i n1) const {
+        // Return maximum or minimum value of _grid_ over inclusive index bounds using
+        // the tree's node metadata
+        auto bbox = grid->indexBBox();
+        Float bound = Max ? 0 : Infinity;
+        for (int axis = 0; axis < 3; ++axis) {
+            // Clamp bounds to index bounding box, outside of which density is zero
+            if (!Max && (n0[axis] < bbox.min()[axis] || n1[axis] > bbox.max()[axis]))
+                return 0;
+            n0[axis] = std::max(n0[axis], bbox.min()[axis]);
+            n1[axis] = std::min(n1[axis], bbox.max()[axis]);
+        }
+        for (int nz = n0.z; nz <= n1.z;) {
+            int zNext = n1.z + 1;
+            for (int ny = n0.y; ny <= n1.y;) {
+                int yNext = n1.y + 1;
+                for (int nx = n0.x; nx <= n1.x;) {
+                    // Find the deepest tree node containing the voxel and the extent
+                    // of its region with the same bound
+                    nanovdb::Coord ijk(nx, ny, nz);
+                    auto info = accessor.getNodeInfo(ijk);
+                    Float value;
+                    int dim;
+                    if (info.mLevel == 0) {
+                        // Use the leaf node's maximum value; its minimum only
+                        // covers active voxels, so bound inactive ones by zero
+                        value = Max ? info.mMaximum : std::min<Float>(info.mMinimum, 0);
+                        dim = info.mDim;
+                    } else {
+                        // Use the value of the internal node or root tile
+                        value = accessor.getValue(ijk);
+                        dim = (info.mLevel == 1) ? 8 : (info.mLevel == 2 ? 128 : 4096);
+                    }
+                    bound = Max ? std::max(bound, value) : std::min(bound, value);
+                    // Advance to the start of the next node or tile
+                    auto next = [dim](int v) { return (v & ~(dim - 1)) + dim; };
+                    nx = next(nx);
+                    yNext = std::min(yNext, next(ny));
+                    zNext = std::min(zNext, next(nz));
+                }
+                ny = yNext;
+            }
+            nz = zNext;
+        }
+        return bound;
+    }
+
     // NanoVDBMediumProvider Private Members
     Bounds3f bounds;
     nanovdb::GridHandle<NanoVDBBuffer> densityGrid;
@@ -757,6 +1166,16 @@ SampledSpectrum Medium::SampleT_maj(Ray ray, Float tMax, Float u, RNG &rng,
     return Dispatch(sampletn);
 }
 
+template <typename F>
+SampledSpectrum Medium::SampleT_res(Ray ray, Float tMax, Float u, RNG &rng,
+                                    const SampledWavelengths &lambda,
+                                    SampledSpectrum *T_c, F func) const {
+    auto sampletr = [&](auto ptr) {
+        return ptr->SampleT_res(ray, tMax, u, rng, lambda, T_c, func);
+    };
+    return Dispatch(sampletr);
+}
+
 }  // namespace pbrt
 
 #endif  // PBRT_MEDIA_H
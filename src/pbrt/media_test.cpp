@@ -7,6 +7,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/media.h>
+#include <pbrt/options.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 
@@ -96,3 +97,154 @@ TEST(HenyeyGreenstein, g) {
         EXPECT_NEAR(g, gEst, .01);
     }
 }
+
+TEST(HenyeyGreenstein, FastApproximation) {
+    RNG rng;
+    for (float g : {-0.9f, -0.5f, 0.f, 0.3f, 0.8f, 0.95f, 0.99f}) {
+        HGPhaseFunction hg(g);
+        for (int i = 0; i < 100; ++i) {
+            Vector3f wo =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Vector3f wi =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Float exact = HenyeyGreenstein(Dot(wo, wi), g);
+            Options->fastPhaseFunctions = true;
+            Float fast = hg.p(wo, wi);
+            Options->fastPhaseFunctions = false;
+            EXPECT_LT(std::abs(fast - exact), 6e-3f * exact) << "g = " << g;
+        }
+    }
+}
+
+TEST(VolumeGuidingField, LearnsIncidentRadiance) {
+    static pstd::pmr::monotonic_buffer_resource resource;
+    Allocator alloc(&resource);
+    VolumeGuidingField field(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)), alloc);
+    HGPhaseFunction hg(0.3f);
+    PhaseFunction phase(&hg);
+    Point3f p(0.5f, 0.5f, 0.5f);
+    Vector3f wo(1, 0, 0), wLight = Normalize(Vector3f(0.2f, 0.3f, 1));
+
+    // The phase function is used until enough radiance has been recorded
+    EXPECT_EQ(phase.PDF(wo, wLight), field.PDF(phase, p, wo, wLight));
+    RNG rng;
+    for (int i = 0; i < 2048; ++i) {
+        Vector3f w = Normalize(wLight + 0.01f * Vector3f(rng.Uniform<Float>(),
+                                                          rng.Uniform<Float>(),
+                                                          rng.Uniform<Float>()));
+        field.Record(p, w, 1);
+    }
+    EXPECT_GT(field.PDF(phase, p, wo, wLight), 10 * phase.PDF(wo, wLight));
+    // Records elsewhere don't affect the learned distribution
+    EXPECT_EQ(phase.PDF(wo, wLight),
+              field.PDF(phase, Point3f(0.1f, 0.1f, 0.1f), wo, wLight));
+
+    // The mixture PDF is normalized
+    Float sum = 0;
+    int sqrtSamples = 128;
+    for (Point2f u : Stratified2D(sqrtSamples, sqrtSamples))
+        sum += field.PDF(phase, p, wo, SampleUniformSphere(u)) / UniformSpherePDF();
+    EXPECT_NEAR(1, sum / Sqr(sqrtSamples), 2e-2);
+
+    // Samples have consistent PDFs and about half of them go toward the light
+    int nTowardLight = 0, nSamples = 1024;
+    for (Point2f u : Stratified2D(32, 32)) {
+        pstd::optional<PhaseFunctionSample> ps = field.Sample_p(phase, p, wo, u);
+        ASSERT_TRUE(ps.has_value());
+        EXPECT_NEAR(ps->pdf, field.PDF(phase, p, wo, ps->wi), 1e-3f * ps->pdf);
+        EXPECT_FLOAT_EQ(ps->p, phase.p(wo, ps->wi));
+        if (Dot(ps->wi, wLight) > 0.8f)
+            ++nTowardLight;
+    }
+    EXPECT_GT(nTowardLight, nSamples / 2);
+}
+
+TEST(CuboidMedium, SparseGridTransmittance) {
+    // Density that's zero except for a small blob and a thin slab
+    constexpr int res = 64;
+    std::vector<Float> densities(res * res * res, Float(0));
+    for (int z = 0; z < res; ++z)
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x) {
+                Point3f p((x + 0.5f) / res, (y + 0.5f) / res, (z + 0.5f) / res);
+                Float d = 0;
+                if (Distance(p, Point3f(0.3f, 0.6f, 0.4f)) < 0.15f)
+                    d = 8;
+                else if (x == 45)
+                    d = 3;
+                densities[x + res * (y + res * z)] = d;
+            }
+
+    Allocator alloc;
+    SampledGrid<Float> densityGrid(densities, res, res, res, alloc);
+    std::vector<Float> LeScale(1, Float(1));
+    UniformGridMediumProvider provider(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)),
+                                       densityGrid, {}, {}, {},
+                                       alloc.new_object<ConstantSpectrum>(0.f),
+                                       SampledGrid<Float>(LeScale, 1, 1, 1, alloc), alloc);
+    CuboidMedium<UniformGridMediumProvider> medium(
+        &provider, alloc.new_object<ConstantSpectrum>(0.5f),
+        alloc.new_object<ConstantSpectrum>(0.5f), 1.f, 0.f, Transform(), alloc);
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
+
+    RNG rng;
+    for (int i = 0; i < 10; ++i) {
+        // Choose ray through the medium
+        Point3f o(rng.Uniform<Float>(), rng.Uniform<Float>(), -0.5f);
+        Point3f p1(rng.Uniform<Float>(), rng.Uniform<Float>(), 1.5f);
+        if (i < 5) {
+            o[0] = 0.3f + 0.1f * (o[0] - 0.5f);
+            o[1] = 0.6f + 0.1f * (o[1] - 0.5f);
+            p1 = Point3f(0.3f, 0.6f, 1.5f);
+        }
+        Ray ray(o, p1 - o);
+
+        // Compute transmittance along ray using numerical quadrature
+        int nSteps = 10000;
+        Float tau = 0;
+        for (int j = 0; j < nSteps; ++j) {
+            Point3f p = ray((j + 0.5f) / nSteps);
+            if (Inside(p, Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1))))
+                tau += provider.Density(p, lambda).sigma_a[0] * Length(ray.d) / nSteps;
+        }
+        Float expected = std::exp(-tau);
+
+        // Estimate transmittance using ratio tracking and residual ratio tracking
+        int nTrials = 20000;
+        int64_t nEvents = 0, nResidualEvents = 0;
+        double sum = 0, residualSum = 0;
+        for (int trial = 0; trial < nTrials; ++trial) {
+            Float T = 1;
+            medium.SampleT_maj(ray, 1.f, rng.Uniform<Float>(), rng, lambda,
+                               [&](const MediumSample &ms) {
+                                   const MediumInteraction &intr = ms.intr;
+                                   SampledSpectrum sigma_t = intr.sigma_a + intr.sigma_s;
+                                   EXPECT_LE(sigma_t[0], intr.sigma_maj[0] * 1.0001f);
+                                   T *= 1 - sigma_t[0] / intr.sigma_maj[0];
+                                   ++nEvents;
+                                   return true;
+                               });
+            sum += T;
+
+            T = 1;
+            SampledSpectrum T_c;
+            medium.SampleT_res(ray, 1.f, rng.Uniform<Float>(), rng, lambda, &T_c,
+                               [&](const MediumSample &ms) {
+                                   const MediumInteraction &intr = ms.intr;
+                                   SampledSpectrum sigma_t = intr.sigma_a + intr.sigma_s;
+                                   EXPECT_LE(ms.sigma_c[0], sigma_t[0] * 1.0001f);
+                                   T *= ms.sigma_n()[0] / intr.sigma_maj[0];
+                                   ++nResidualEvents;
+                                   return true;
+                               });
+            residualSum += T * T_c[0];
+        }
+        EXPECT_NEAR(expected, sum / nTrials, 0.01 + 0.02 * expected)
+            << "ray " << ray << " tau " << tau;
+        EXPECT_NEAR(expected, residualSum / nTrials, 0.01 + 0.02 * expected)
+            << "ray " << ray << " tau " << tau;
+        // The blob's interior is skipped with its control density
+        if (i < 5)
+            EXPECT_LT(nResidualEvents, nEvents);
+    }
+}
@@ -28,17 +28,44 @@ std::string ToString(const RenderingCoordinateSystem &r) {
 std::string PBRTOptions::ToString() const {
     return StringPrintf(
         "[ PBRTOptions seed: %s quiet: %s disablePixelJitter: %s "
-        "disableWavelengthJitter: %s "
-        "forceDiffuse: %s useGPU: %s wavefront: %s renderingSpace: %s nThreads: %s "
-        "logLevel: %s logFile: %s writePartialImages: %s recordPixelStatistics: %s "
-        "printStatistics: %s pixelSamples: %s gpuDevice: %s quickRender: %s upgrade: %s "
-        "imageFile: %s mseReferenceImage: %s mseReferenceOutput: %s debugStart: %s "
-        "displayServer: %s cropWindow: %s pixelBounds: %s pixelMaterial: %s ]",
-        seed, quiet, disablePixelJitter, disableWavelengthJitter, forceDiffuse, useGPU,
-        wavefront, renderingSpace, nThreads, logLevel, logFile, writePartialImages,
-        recordPixelStatistics, printStatistics, pixelSamples, gpuDevice, quickRender,
-        upgrade, imageFile, mseReferenceImage, mseReferenceOutput, debugStart,
-        displayServer, cropWindow, pixelBounds, pixelMaterial);
+        "disableWavelengthJitter: %s forceDiffuse: %s fastPhaseFunctions: %s useGPU: %s "
+        "wavefront: %s renderingSpace: %s nThreads: %s numa: %s pinThreads: %s "
+        "hybrid: %s multiGPU: %s "
+        "logLevel: %s logFile: %s progressFile: %s writePartialImages: %s "
+        "exrCompression: %s recordPixelStatistics: %s pixelCostFile: %s "
+        "recordRayStatistics: %s recordPerfCounters: %s traceFile: %s "
+        "printStatistics: %s "
+        "pixelSamples: %s adaptiveError: %s timeLimit: %s targetMSE: %s "
+        "convergenceFile: %s targetRelMSE: %s "
+        "checkpointFile: %s checkpointInterval: %s resume: %s coordinatorPort: %s "
+        "coordinatorAddress: %s interactivePort: %s sequenceFile: %s gpuDevice: %s "
+        "gpuBuildMemory: %s compressGPUTextures: %s gpuGraphs: %s gpuKernelProfile: %s "
+        "gpuTextureMemory: %s sortMaterials: %s sortRays: %s regeneratePaths: %s "
+        "compactSpectra: %s quickRender: %s upgrade: %s imageFile: %s "
+        "mseReferenceImage: %s mseReferenceOutput: %s debugStart: %s displayServer: %s "
+        "bvhCacheDirectory: %s benchTraversalFile: %s benchTraversalRays: %s "
+        "bssrdfCacheDirectory: %s lazyInstances: %s "
+        "compressMeshes: %s splitPlanarPatches: %s hugePages: %s "
+        "displacementCacheMemory: %s sharedBufferDirectory: %s "
+        "textureCacheDirectory: %s textureCacheMemory: %s floatNormalMaps: %s "
+        "ptexCacheFiles: %s ptexCacheMemory: %s ptexThreadHandles: %s cropWindow: %s "
+        "pixelBounds: %s pixelMaterial: %s ]",
+        seed, quiet, disablePixelJitter, disableWavelengthJitter, forceDiffuse,
+        fastPhaseFunctions, useGPU, wavefront, renderingSpace, nThreads, numa, pinThreads,
+        hybrid, multiGPU, logLevel, logFile, progressFile, writePartialImages,
+        exrCompression, recordPixelStatistics, pixelCostFile, recordRayStatistics,
+        recordPerfCounters, traceFile, printStatistics, pixelSamples, adaptiveError,
+        timeLimit, targetMSE, convergenceFile, targetRelMSE, checkpointFile,
+        checkpointInterval, resume, coordinatorPort, coordinatorAddress, interactivePort,
+        sequenceFile, gpuDevice, gpuBuildMemory, compressGPUTextures, gpuGraphs,
+        gpuKernelProfile, gpuTextureMemory, sortMaterials, sortRays, regeneratePaths,
+        compactSpectra, quickRender, upgrade, imageFile, mseReferenceImage,
+        mseReferenceOutput, debugStart, displayServer, bvhCacheDirectory,
+        benchTraversalFile, benchTraversalRays, bssrdfCacheDirectory, lazyInstances,
+        compressMeshes, splitPlanarPatches, hugePages, displacementCacheMemory,
+        sharedBufferDirectory, textureCacheDirectory, textureCacheMemory, floatNormalMaps,
+        ptexCacheFiles, ptexCacheMemory, ptexThreadHandles, cropWindow, pixelBounds,
+        pixelMaterial);
 }
 
 }  // namespace pbrt
@@ -24,6 +24,8 @@ struct BasicPBRTOptions {
     bool quiet = false;
     bool disablePixelJitter = false, disableWavelengthJitter = false;
     bool forceDiffuse = false;
+    // Evaluate phase functions with approximations that have bounded error
+    bool fastPhaseFunctions = false;
     bool useGPU = false;
     bool wavefront = false;
     RenderingCoordinateSystem renderingSpace = RenderingCoordinateSystem::CameraWorld;
@@ -32,19 +34,114 @@ struct BasicPBRTOptions {
 // PBRTOptions Definition
 struct PBRTOptions : BasicPBRTOptions {
     int nThreads = 0;
+    // Pin threads to the CPUs of NUMA nodes, or to individual CPUs if
+    // pinThreads is set, and interleave shared scene data across the nodes
+    bool numa = false, pinThreads = false;
+    // Render part of each sample on the CPU along with the GPU
+    bool hybrid = false;
+    // Split each sample's rows between all of the visible GPUs
+    bool multiGPU = false;
     LogLevel logLevel = LogLevel::Error;
     std::string logFile;
+    // Write rendering progress to this file as one JSON object per line
+    std::string progressFile;
     bool writePartialImages = false;
+    // OpenEXR compression method for EXR images
+    std::string exrCompression = "zip";
     bool recordPixelStatistics = false;
+    // Write an image of the time spent rendering each pixel to this file
+    std::string pixelCostFile;
+    // Count rays by type and depth along with their traversal work
+    bool recordRayStatistics = false;
+    // Measure hardware performance counters for each phase of rendering
+    bool recordPerfCounters = false;
+    // Write a timeline of thread pool jobs, image tiles, rendering phases, and
+    // GPU kernels to this file in the Chrome trace event format
+    std::string traceFile;
     bool printStatistics = false;
     pstd::optional<int> pixelSamples;
+    // Stop sampling pixels once their estimated relative error is below this
+    pstd::optional<Float> adaptiveError;
+    // Stop rendering before this many seconds have passed or once the MSE
+    // with respect to the reference image is at most targetMSE
+    pstd::optional<Float> timeLimit, targetMSE;
+    // Write convergence estimates from pixels' sample variances to
+    // convergenceFile after each wave and stop rendering once the estimated
+    // relative MSE is at most targetRelMSE
+    std::string convergenceFile;
+    pstd::optional<Float> targetRelMSE;
+    // Write the film's pixels to checkpointFile at most every checkpointInterval
+    // seconds, and continue rendering from the checkpoint if resume is set
+    std::string checkpointFile;
+    Float checkpointInterval = 300;
+    bool resume = false;
+    // Coordinate a distributed render, listening for workers on coordinatorPort,
+    // or render tiles for the coordinator at coordinatorAddress ("host:port")
+    pstd::optional<int> coordinatorPort;
+    std::string coordinatorAddress;
+    // Keep the scene loaded and render it progressively, restarting whenever
+    // scene edits are received on interactivePort
+    pstd::optional<int> interactivePort;
+    // Render the frames of an animation given by the edits to the scene in the
+    // scene files listed in sequenceFile
+    std::string sequenceFile;
     pstd::optional<int> gpuDevice;
+    // Memory budget in MB for building each batch of GPU acceleration structures
+    pstd::optional<int> gpuBuildMemory;
+    // Store 8-bit GPU image textures block-compressed
+    bool compressGPUTextures = false;
+    // Launch the wavefront integrator's kernels for each depth as a CUDA graph
+    bool gpuGraphs = false;
+    // Write the GPU kernel profile to this file as JSON or CSV
+    std::string gpuKernelProfile;
+    // Memory budget in MB for the tiles of GPU image textures that are
+    // streamed in as they're accessed; unset to upload whole textures
+    pstd::optional<int> gpuTextureMemory;
+    // Sort the wavefront integrator's material evaluation queues by material
+    bool sortMaterials = false;
+    // Reorder the wavefront integrator's rays by origin and direction before tracing
+    bool sortRays = false;
+    // Start pixels' next samples in the wavefront integrator as their paths end
+    bool regeneratePaths = false;
+    // Store the wavefront integrator's queued spectra with a shared exponent
+    bool compactSpectra = false;
     bool quickRender = false;
     bool upgrade = false;
     std::string imageFile;
     std::string mseReferenceImage, mseReferenceOutput;
     std::string debugStart;
     std::string displayServer;
+    std::string bvhCacheDirectory;
+    // Record the rays traced while rendering to this file or, if it exists,
+    // trace its rays against each accelerator rather than rendering
+    std::string benchTraversalFile;
+    int benchTraversalRays = 1 << 24;
+    // Subsurface scattering profile tables are loaded from and saved here
+    std::string bssrdfCacheDirectory;
+    // Defer building object instances' BVHs until a ray reaches them
+    bool lazyInstances = false;
+    // Store triangle meshes' vertex positions quantized to 16 bits, normals as
+    // octahedral vectors, and uvs as half floats
+    bool compressMeshes = false;
+    // Bilinear patches that are parallelograms are rendered as pairs of triangles
+    bool splitPlanarPatches = false;
+    // Comma-separated subsystems whose large allocations use huge pages
+    std::string hugePages;
+    // Tessellated micro-geometry of displaced meshes is cached using at most
+    // displacementCacheMemory MB
+    int displacementCacheMemory = 512;
+    // Large mesh buffers are stored in files here and mapped into memory
+    std::string sharedBufferDirectory;
+    // Image textures are stored as tiles here and loaded on demand, keeping
+    // at most textureCacheMemory MB of them in memory
+    std::string textureCacheDirectory;
+    int textureCacheMemory = 1024;
+    // Store normal maps' texels as 32-bit floats
+    bool floatNormalMaps = false;
+    // Ptex cache limits (memory in MB) and whether each thread holds its own
+    // handles to Ptex textures
+    int ptexCacheFiles = 100, ptexCacheMemory = 4096;
+    bool ptexThreadHandles = false;
     pstd::optional<Bounds2f> cropWindow;
     pstd::optional<Bounds2i> pixelBounds;
     pstd::optional<Point2i> pixelMaterial;
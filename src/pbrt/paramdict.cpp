@@ -208,8 +208,11 @@ typename ParameterTypeTraits<PT>::ReturnType ParameterDictionary::lookupSingle(
 }
 
 void ParameterDictionary::FreeParameters() {
+    // Parameters are allocated by NewParsedParameter(); their memory is
+    // reclaimed by FreeParsedParameters(), but destroying them here frees
+    // their large value arrays right away.
     for (int i = 0; i < nOwnedParams; ++i)
-        delete params[i];
+        params[i]->~ParsedParameter();
     params.clear();
 }
 
@@ -568,7 +571,7 @@ void ParameterDictionary::RenameParameter(const std::string &before,
                                           const std::string &after) {
     for (ParsedParameter *p : params)
         if (p->name == before)
-            p->name = after;
+            p->name = InternParameterString(after);
 }
 
 void ParameterDictionary::RenameUsedTextures(
@@ -586,7 +589,7 @@ void ParameterDictionary::RenameUsedTextures(
 
 void ParameterDictionary::ReportUnused() const {
     // type / name
-    InlinedVector<std::pair<const std::string *, const std::string *>, 16> seen;
+    InlinedVector<std::pair<std::string_view, std::string_view>, 16> seen;
 
     for (const ParsedParameter *p : params) {
         if (p->mayBeUnused)
@@ -594,15 +597,15 @@ void ParameterDictionary::ReportUnused() const {
 
         bool haveSeen =
             std::find_if(seen.begin(), seen.end(),
-                         [&p](std::pair<const std::string *, const std::string *> p2) {
-                             return *p2.first == p->type && *p2.second == p->name;
+                         [&p](std::pair<std::string_view, std::string_view> p2) {
+                             return p2.first == p->type && p2.second == p->name;
                          }) != seen.end();
         if (p->lookedUp) {
             // A parameter may be used when creating an initial Material, say,
             // but then an override from a Shape may shadow it such that its
             // name is already in the seen array.
             if (!haveSeen)
-                seen.push_back(std::make_pair(&p->type, &p->name));
+                seen.push_back(std::make_pair(p->type, p->name));
         } else if (haveSeen) {
             // It's shadowed by another parameter; that's fine.
         } else
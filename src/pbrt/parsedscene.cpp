@@ -5,6 +5,8 @@
 #include <pbrt/parsedscene.h>
 
 #include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/displacement.h>
+#include <pbrt/film.h>
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <pbrt/gpu/memory.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
@@ -16,7 +18,10 @@
 #include <pbrt/util/check.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/containers.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/loopsubdiv.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/mesh.h>
 #include <pbrt/util/parallel.h>
@@ -24,8 +29,13 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/transform.h>
 
+#include <algorithm>
 #include <iostream>
 #include <mutex>
+#ifdef PBRT_IS_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 namespace pbrt {
 
@@ -44,12 +54,12 @@ static std::string ToString(const std::pair<T, U> &p) {
 }
 
 std::string ParsedScene::ToString() const {
-    return StringPrintf("[ ParsedScene camera: %s film: %s sampler: %s integrator: %s "
-                        "filter: %s accelerator: %s namedMaterials: %s materials: %s "
-                        "media: %s floatTextures: %s spectrumTextures: %s "
+    return StringPrintf("[ ParsedScene camera: %s film: %s views: %s sampler: %s "
+                        "integrator: %s filter: %s accelerator: %s namedMaterials: %s "
+                        "materials: %s media: %s floatTextures: %s spectrumTextures: %s "
                         "instanceDefinitions: %s lights: %s "
                         "shapes: %s instances: %s ]",
-                        camera, film, sampler, integrator, filter, accelerator,
+                        camera, film, views, sampler, integrator, filter, accelerator,
                         namedMaterials, materials, media, floatTextures, spectrumTextures,
                         instanceDefinitions, lights, shapes, instances);
 }
@@ -86,38 +96,56 @@ STAT_MEMORY_COUNTER("Memory/TransformCache", transformCacheBytes);
 STAT_PERCENT("Geometry/TransformCache hits", nTransformCacheHits, nTransformCacheLookups);
 
 // TransformCache Method Definitions
-TransformCache::TransformCache()
+TransformCache::TransformCache() {
 #ifdef PBRT_BUILD_GPU_RENDERER
-    : bufferResource(Options->useGPU ? gpuMemoryAllocator.resource()
-                                     : Allocator().resource()),
+    pstd::pmr::memory_resource *upstream =
+        Options->useGPU ? gpuMemoryAllocator.resource() : Allocator().resource();
 #else
-    : bufferResource(Allocator().resource()),
+    pstd::pmr::memory_resource *upstream = Allocator().resource();
 #endif
-      alloc(&bufferResource) {
+    for (std::unique_ptr<Shard> &shard : shards)
+        shard = std::make_unique<Shard>(upstream);
 }
 
 const Transform *TransformCache::Lookup(const Transform &t) {
+    return Lookup(t, &Shard::hashTable);
+}
+
+const AffineTransform *TransformCache::Lookup(const AffineTransform &t) {
+    return Lookup(t, &Shard::affineHashTable);
+}
+
+template <typename T>
+const T *TransformCache::Lookup(const T &t,
+                                std::unordered_set<T *, TransformHash> Shard::*table) {
     ++nTransformCacheLookups;
 
+    size_t hash = t.Hash();
+    Shard &shard = *shards[hash % NumShards];
+    std::unordered_set<T *, TransformHash> &hashTable = shard.*table;
+    std::lock_guard<std::mutex> lock(shard.mutex);
     if (!hashTable.empty()) {
-        size_t offset = t.Hash() % hashTable.bucket_count();
-        for (auto iter = hashTable.begin(offset); iter != hashTable.end(offset); ++iter) {
+        size_t offset = hash % hashTable.bucket_count();
+        for (auto iter = hashTable.begin(offset); iter != hashTable.end(offset);
+             ++iter) {
             if (**iter == t) {
                 ++nTransformCacheHits;
                 return *iter;
             }
         }
     }
-    Transform *tptr = alloc.new_object<Transform>(t);
-    transformCacheBytes += sizeof(Transform);
+    T *tptr = shard.alloc.new_object<T>(t);
+    transformCacheBytes += sizeof(T);
     hashTable.insert(tptr);
     return tptr;
 }
 
 TransformCache::~TransformCache() {
-    for (const auto &iter : hashTable) {
-        Transform *tptr = iter;
-        alloc.delete_object(tptr);
+    for (std::unique_ptr<Shard> &shard : shards) {
+        for (Transform *tptr : shard->hashTable)
+            shard->alloc.delete_object(tptr);
+        for (AffineTransform *tptr : shard->affineHashTable)
+            shard->alloc.delete_object(tptr);
     }
 }
 
@@ -125,7 +153,7 @@ STAT_COUNTER("Scene/Object instances created", nObjectInstancesCreated);
 STAT_COUNTER("Scene/Object instances used", nObjectInstancesUsed);
 
 // ParsedScene Method Definitions
-ParsedScene::ParsedScene() {
+ParsedScene::ParsedScene() : transformCache(std::make_shared<TransformCache>()) {
     // Set scene defaults
     camera.name = "perspective";
     sampler.name = "zsobol";
@@ -179,11 +207,26 @@ void ParsedScene::Camera(const std::string &name, ParsedParameterVector params,
 
     TransformSet cameraFromWorld = graphicsState.ctm;
     TransformSet worldFromCamera = Inverse(graphicsState.ctm);
+    AnimatedTransform animatedWorldFromCamera(
+        worldFromCamera[0], graphicsState.transformStartTime, worldFromCamera[1],
+        graphicsState.transformEndTime);
+    if (haveCamera) {
+        // Add a view that uses the first camera's rendering space
+        CameraTransform cameraTransform(animatedWorldFromCamera,
+                                        camera.cameraTransform.WorldFromRender());
+        ViewSceneEntity view;
+        view.camera = CameraSceneEntity(name, std::move(dict), loc, cameraTransform,
+                                        graphicsState.currentOutsideMedium);
+        views.push_back(std::move(view));
+        return;
+    }
+    haveCamera = true;
     namedCoordinateSystems["camera"] = Inverse(cameraFromWorld);
 
-    CameraTransform cameraTransform(
-        AnimatedTransform(worldFromCamera[0], graphicsState.transformStartTime,
-                          worldFromCamera[1], graphicsState.transformEndTime));
+    CameraTransform cameraTransform =
+        fixedRenderingSpace
+            ? CameraTransform(animatedWorldFromCamera, Inverse(renderFromWorld))
+            : CameraTransform(animatedWorldFromCamera);
     renderFromWorld = cameraTransform.RenderFromWorld();
 
     camera = CameraSceneEntity(name, std::move(dict), loc, cameraTransform,
@@ -249,10 +292,27 @@ void ParsedScene::Attribute(const std::string &target, ParsedParameterVector att
 void ParsedScene::WorldBegin(FileLoc loc) {
     VERIFY_OPTIONS("WorldBegin");
     currentBlock = BlockState::WorldBlock;
+    for (const ViewSceneEntity &view : views)
+        if (view.film.name.empty())
+            ErrorExitDeferred(&view.camera.loc,
+                              "No Film statement follows this Camera statement. "
+                              "Each additional view needs its own film.");
     for (int i = 0; i < MaxTransforms; ++i)
         graphicsState.ctm[i] = pbrt::Transform();
     graphicsState.activeTransformBits = AllTransformsBits;
     namedCoordinateSystems["world"] = graphicsState.ctm;
+
+    // Describe the camera to Loop subdivision surfaces for adaptive subdivision;
+    // the perspective camera's field of view spans the shorter image axis
+    Float pixelsPerRadian = 0;
+    if (camera.name == "perspective") {
+        int xRes = film.parameters.GetOneInt("xresolution", 1280);
+        int yRes = film.parameters.GetOneInt("yresolution", 720);
+        pixelsPerRadian =
+            std::min(xRes, yRes) / Radians(camera.parameters.GetOneFloat("fov", 90.));
+    }
+    SetLoopSubdivCamera(camera.cameraTransform.RenderFromCamera(Point3f(0, 0, 0), 0),
+                        pixelsPerRadian);
 }
 
 void ParsedScene::LightSource(const std::string &name, ParsedParameterVector params,
@@ -288,7 +348,7 @@ void ParsedScene::Shape(const std::string &name, ParsedParameterVector params,
         }
 
         AnimatedTransform renderFromShape = RenderFromObject();
-        const class Transform *identity = transformCache.Lookup(pbrt::Transform());
+        const class Transform *identity = transformCache->Lookup(pbrt::Transform());
 
         as->push_back(AnimatedShapeSceneEntity(
             {name, std::move(dict), loc, renderFromShape, identity,
@@ -304,9 +364,9 @@ void ParsedScene::Shape(const std::string &name, ParsedParameterVector params,
         }
 
         const class Transform *renderFromObject =
-            transformCache.Lookup(RenderFromObject(0));
+            transformCache->Lookup(RenderFromObject(0));
         const class Transform *objectFromRender =
-            transformCache.Lookup(Inverse(*renderFromObject));
+            transformCache->Lookup(Inverse(*renderFromObject));
 
         s->push_back(ShapeSceneEntity(
             {name, std::move(dict), loc, renderFromObject, objectFromRender,
@@ -380,13 +440,19 @@ void ParsedScene::ObjectInstance(const std::string &name, FileLoc loc) {
 
         instances.push_back(InstanceSceneEntity(name, loc, animatedRenderFromInstance));
     } else {
-        const class Transform *renderFromInstance =
-            transformCache.Lookup(RenderFromObject(0) * worldFromRender);
+        // Instance transforms are only interned once they have been converted
+        // to the compact form that _TransformedPrimitive_ uses
+        class Transform renderFromInstance = RenderFromObject(0) * worldFromRender;
 
         instances.push_back(InstanceSceneEntity(name, loc, renderFromInstance));
     }
 }
 
+void ParsedScene::SetRenderingSpace(const class Transform &worldFromRender) {
+    renderFromWorld = Inverse(worldFromRender);
+    fixedRenderingSpace = true;
+}
+
 void ParsedScene::EndOfFiles() {
     if (currentBlock != BlockState::WorldBlock)
         ErrorExitDeferred("End of files before \"WorldBegin\".");
@@ -464,6 +530,7 @@ ParsedScene *ParsedScene::CopyForImport() {
     importScene->renderFromWorld = renderFromWorld;
     importScene->graphicsState = graphicsState;
     importScene->currentBlock = currentBlock;
+    importScene->transformCache = transformCache;
     if (currentInstance) {
         importScene->currentInstance = new InstanceDefinitionSceneEntity;
         importScene->currentInstance->name = currentInstance->name;
@@ -669,7 +736,11 @@ void ParsedScene::Film(const std::string &type, ParsedParameterVector params,
                        FileLoc loc) {
     ParameterDictionary dict(std::move(params), graphicsState.colorSpace);
     VERIFY_OPTIONS("Film");
-    film = SceneEntity(type, std::move(dict), loc);
+    // A Film statement after an additional view's Camera statement is its film
+    if (!views.empty())
+        views.back().film = SceneEntity(type, std::move(dict), loc);
+    else
+        film = SceneEntity(type, std::move(dict), loc);
 }
 
 void ParsedScene::Sampler(const std::string &name, ParsedParameterVector params,
@@ -813,6 +884,8 @@ void ParsedScene::CreateMaterials(
         ImageAndMetadata immeta =
             Image::Read(filename, Allocator(), ColorEncoding::Linear);
         Image &image = immeta.image;
+        if (Options->floatNormalMaps)
+            image = image.ConvertToFormat(PixelFormat::Float);
         ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
         if (!rgbDesc)
             ErrorExitDeferred("%s: normal map image must contain R, G, and B channels",
@@ -869,13 +942,26 @@ void ParsedScene::CreateMaterials(
 NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
     NamedTextures textures;
 
-    std::set<std::string> seenFloatTextureFilenames, seenSpectrumTextureFilenames;
+    std::set<std::string> seenImageTextures;
     std::vector<size_t> parallelFloatTextures, serialFloatTextures;
     std::vector<size_t> parallelSpectrumTextures, serialSpectrumTextures;
 
     // Figure out which textures to load in parallel
     // Need to be careful since two textures can use the same image file;
-    // we only want to load it once in that case...
+    // we only want to load it once in that case... Textures that read the
+    // same image with different MIPMap settings create different MIPMaps,
+    // though, so they can be loaded concurrently. The parameters are found
+    // directly so that they aren't marked as used.
+    auto imageTextureKey = [](const TextureSceneEntity &tex,
+                              const std::string &filename) {
+        std::string key = tex.texName + " " + filename;
+        for (const ParsedParameter *p : tex.parameters.GetParameterVector())
+            if (p->name == "filter" || p->name == "maxanisotropy" || p->name == "wrap" ||
+                p->name == "encoding")
+                key += " " + p->ToString();
+        return key;
+    };
+
     int nMissingTextures = 0;
     for (size_t i = 0; i < floatTextures.size(); ++i) {
         const auto &tex = floatTextures[i];
@@ -899,10 +985,9 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
             ++nMissingTextures;
         }
 
-        if (seenFloatTextureFilenames.find(filename) == seenFloatTextureFilenames.end()) {
-            seenFloatTextureFilenames.insert(filename);
+        if (seenImageTextures.insert(imageTextureKey(tex.second, filename)).second)
             parallelFloatTextures.push_back(i);
-        } else
+        else
             serialFloatTextures.push_back(i);
     }
     for (size_t i = 0; i < spectrumTextures.size(); ++i) {
@@ -927,11 +1012,9 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
             ++nMissingTextures;
         }
 
-        if (seenSpectrumTextureFilenames.find(filename) ==
-            seenSpectrumTextureFilenames.end()) {
-            seenSpectrumTextureFilenames.insert(filename);
+        if (seenImageTextures.insert(imageTextureKey(tex.second, filename)).second)
             parallelSpectrumTextures.push_back(i);
-        } else
+        else
             serialSpectrumTextures.push_back(i);
     }
 
@@ -942,24 +1025,26 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
                 parallelFloatTextures.size(), parallelSpectrumTextures.size(),
                 serialFloatTextures.size(), serialSpectrumTextures.size());
 
-    // Load textures in parallel
+    // Load float and spectrum textures in parallel
     std::mutex mutex;
+    int64_t nParallelFloat = parallelFloatTextures.size();
+    ParallelFor(0, nParallelFloat + parallelSpectrumTextures.size(), [&](int64_t i) {
+        if (i < nParallelFloat) {
+            const auto &tex = floatTextures[parallelFloatTextures[i]];
+
+            pbrt::Transform renderFromTexture =
+                tex.second.renderFromObject.startTransform;
+            // Pass nullptr for the textures, since they shouldn't be accessed
+            // anyway.
+            TextureParameterDictionary texDict(&tex.second.parameters, nullptr);
+            FloatTexture t = FloatTexture::Create(tex.second.texName, renderFromTexture,
+                                                  texDict, &tex.second.loc, alloc, gpu);
+            std::lock_guard<std::mutex> lock(mutex);
+            textures.floatTextures[tex.first] = t;
+            return;
+        }
 
-    ParallelFor(0, parallelFloatTextures.size(), [&](int64_t i) {
-        const auto &tex = floatTextures[parallelFloatTextures[i]];
-
-        pbrt::Transform renderFromTexture = tex.second.renderFromObject.startTransform;
-        // Pass nullptr for the textures, since they shouldn't be accessed
-        // anyway.
-        TextureParameterDictionary texDict(&tex.second.parameters, nullptr);
-        FloatTexture t = FloatTexture::Create(tex.second.texName, renderFromTexture,
-                                              texDict, &tex.second.loc, alloc, gpu);
-        std::lock_guard<std::mutex> lock(mutex);
-        textures.floatTextures[tex.first] = t;
-    });
-
-    ParallelFor(0, parallelSpectrumTextures.size(), [&](int64_t i) {
-        const auto &tex = spectrumTextures[parallelSpectrumTextures[i]];
+        const auto &tex = spectrumTextures[parallelSpectrumTextures[i - nParallelFloat]];
 
         pbrt::Transform renderFromTexture = tex.second.renderFromObject.startTransform;
         // nullptr for the textures, as above.
@@ -1023,7 +1108,14 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
 std::map<std::string, Medium> ParsedScene::CreateMedia(Allocator alloc) const {
     std::map<std::string, Medium> mediaMap;
 
-    for (const auto &m : media) {
+    // Create media in parallel, since grid media may read large files
+    std::mutex mediaMutex;
+    std::vector<std::map<std::string, TransformedSceneEntity>::const_iterator>
+        mediaIterators;
+    for (auto iter = media.begin(); iter != media.end(); ++iter)
+        mediaIterators.push_back(iter);
+    ParallelFor(0, mediaIterators.size(), [&](int64_t i) {
+        const auto &m = *mediaIterators[i];
         std::string type = m.second.parameters.GetOneString("type", "");
         if (type.empty())
             ErrorExit(&m.second.loc, "No parameter string \"type\" found for medium.");
@@ -1035,8 +1127,9 @@ std::map<std::string, Medium> ParsedScene::CreateMedia(Allocator alloc) const {
         Medium medium = Medium::Create(type, m.second.parameters,
                                        m.second.renderFromObject.startTransform,
                                        &m.second.loc, alloc);
+        std::lock_guard<std::mutex> lock(mediaMutex);
         mediaMap[m.first] = medium;
-    }
+    });
 
     return mediaMap;
 }
@@ -1124,14 +1217,11 @@ std::vector<Light> ParsedScene::CreateLights(
 
         pstd::vector<Light> *shapeLights = new pstd::vector<Light>;
         const auto &areaLightEntity = areaLights[sh.lightIndex];
-        for (pbrt::Shape ps : shapeObjects) {
-            Light area = Light::CreateArea(
-                areaLightEntity.name, areaLightEntity.parameters, *sh.renderFromObject,
-                mi, ps, alphaTex, &areaLightEntity.loc, alloc);
-            if (area) {
-                lights.push_back(area);
-                shapeLights->push_back(area);
-            }
+        for (Light area : Light::CreateAreaLights(
+                 areaLightEntity.name, areaLightEntity.parameters, *sh.renderFromObject,
+                 mi, shapeObjects, alphaTex, &areaLightEntity.loc, alloc)) {
+            lights.push_back(area);
+            shapeLights->push_back(area);
         }
 
         (*shapeIndexToAreaLights)[i] = shapeLights;
@@ -1141,12 +1231,12 @@ std::vector<Light> ParsedScene::CreateLights(
     return lights;
 }
 
-Primitive ParsedScene::CreateAggregate(
+std::vector<Primitive> ParsedScene::CreatePrimitives(
     Allocator alloc, const NamedTextures &textures,
     const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
     const std::map<std::string, Medium> &media,
     const std::map<std::string, pbrt::Material> &namedMaterials,
-    const std::vector<pbrt::Material> &materials) {
+    const std::vector<pbrt::Material> &materials, SceneInstances *sceneInstances) {
     auto findMedium = [&media](const std::string &s, const FileLoc *loc) -> Medium {
         if (s.empty())
             return nullptr;
@@ -1157,9 +1247,18 @@ Primitive ParsedScene::CreateAggregate(
         return iter->second;
     };
 
+    // Shapes are created in parallel; give each thread its own allocator
+    // that carves small allocations out of large blocks from _alloc_'s memory
+    // resource so that threads don't contend for it. The resources are
+    // intentionally leaked since the shapes live as long as the scene.
+    std::vector<Allocator> threadAllocators;
+    for (int i = 0; i < MaxThreadIndex(); ++i)
+        threadAllocators.push_back(
+            Allocator(new pstd::pmr::monotonic_buffer_resource(alloc.resource())));
+
     // Primitives
     auto getAlphaTexture = [&](const ParameterDictionary &parameters,
-                               const FileLoc *loc) -> FloatTexture {
+                               const FileLoc *loc, Allocator alloc) -> FloatTexture {
         std::string alphaTexName = parameters.GetTexture("alpha");
         if (!alphaTexName.empty()) {
             if (auto iter = textures.floatTextures.find(alphaTexName);
@@ -1174,62 +1273,118 @@ Primitive ParsedScene::CreateAggregate(
             return nullptr;
     };
 
+    // Named materials and shapes' area lights are found for each shape entity
+    // using _FlatHashMap_s, which have much faster lookups than _std::map_
+    FlatHashMap<std::string, pbrt::Material> materialsByName;
+    materialsByName.Reserve(namedMaterials.size());
+    for (const auto &mtl : namedMaterials)
+        materialsByName.Insert(mtl.first, mtl.second);
+    FlatHashMap<int, pstd::vector<Light> *> areaLightsByShape;
+    areaLightsByShape.Reserve(shapeIndexToAreaLights.size());
+    for (const auto &lights : shapeIndexToAreaLights)
+        areaLightsByShape.Insert(lights.first, lights.second);
+
+    auto getMaterial = [&](const std::string &materialName, int materialIndex,
+                           const FileLoc *loc) -> pbrt::Material {
+        if (!materialName.empty()) {
+            const pbrt::Material *mtl = materialsByName.Find(materialName);
+            if (!mtl)
+                ErrorExit(loc, "%s: no named material defined.", materialName);
+            return *mtl;
+        } else {
+            CHECK_LT(materialIndex, materials.size());
+            return materials[materialIndex];
+        }
+    };
+
+    // Gather per-entity primitives in entity order so that the resulting
+    // primitive order doesn't depend on how the work was scheduled.
+    auto gatherPrimitives = [](std::vector<std::vector<Primitive>> &entityPrimitives) {
+        size_t nPrimitives = 0;
+        for (const std::vector<Primitive> &prims : entityPrimitives)
+            nPrimitives += prims.size();
+        std::vector<Primitive> primitives;
+        primitives.reserve(nPrimitives);
+        for (std::vector<Primitive> &prims : entityPrimitives) {
+            primitives.insert(primitives.end(), prims.begin(), prims.end());
+            prims = std::vector<Primitive>();
+        }
+        return primitives;
+    };
+
     // Non-animated shapes
     auto CreatePrimitivesForShapes =
         [&](std::vector<ShapeSceneEntity> &shapes) -> std::vector<Primitive> {
         // Parallelize Shape::Create calls, which will in turn
-        // parallelize PLY file loading, etc...
-        pstd::vector<pstd::vector<pbrt::Shape>> shapeVectors(shapes.size());
+        // parallelize PLY file loading, etc., along with the creation of
+        // each entity's primitives.
+        std::vector<std::vector<Primitive>> entityPrimitives(shapes.size());
         ParallelFor(0, shapes.size(), [&](int64_t i) {
-            const auto &sh = shapes[i];
-            shapeVectors[i] =
-                Shape::Create(sh.name, sh.renderFromObject, sh.objectFromRender,
-                              sh.reverseOrientation, sh.parameters, &sh.loc, alloc);
-        });
-
-        std::vector<Primitive> primitives;
-        for (size_t i = 0; i < shapes.size(); ++i) {
+            Allocator threadAlloc = threadAllocators[ThreadIndex];
             auto &sh = shapes[i];
-            pstd::vector<pbrt::Shape> &shapes = shapeVectors[i];
+            pstd::vector<pbrt::Shape> shapes =
+                Shape::Create(sh.name, sh.renderFromObject, sh.objectFromRender,
+                              sh.reverseOrientation, sh.parameters, &sh.loc, threadAlloc);
             if (shapes.empty())
-                continue;
+                return;
 
-            FloatTexture alphaTex = getAlphaTexture(sh.parameters, &sh.loc);
+            FloatTexture alphaTex = getAlphaTexture(sh.parameters, &sh.loc, threadAlloc);
+            Float maxDisplacement = sh.parameters.GetOneFloat("maxdisplacement", 0);
+            Float edgeLength = sh.parameters.GetOneFloat("displacementedgelength", 0);
+            int maxLevel = sh.parameters.GetOneInt("displacementmaxlevel", 6);
             sh.parameters.ReportUnused();  // do now so can grab alpha...
 
-            pbrt::Material mtl = nullptr;
-            if (!sh.materialName.empty()) {
-                auto iter = namedMaterials.find(sh.materialName);
-                if (iter == namedMaterials.end())
-                    ErrorExit(&sh.loc, "%s: no named material defined.", sh.materialName);
-                mtl = iter->second;
-            } else {
-                CHECK_LT(sh.materialIndex, materials.size());
-                mtl = materials[sh.materialIndex];
-            }
-
+            pbrt::Material mtl = getMaterial(sh.materialName, sh.materialIndex, &sh.loc);
             pbrt::MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                      findMedium(sh.outsideMedium, &sh.loc));
 
-            auto iter = shapeIndexToAreaLights.find(i);
+            std::vector<Primitive> &prims = entityPrimitives[i];
+            if (maxDisplacement > 0) {
+                // Tessellate triangles displaced by the material's displacement
+                // texture on demand
+                bool allTriangles =
+                    std::all_of(shapes.begin(), shapes.end(),
+                                [](pbrt::Shape s) { return s.Is<Triangle>(); });
+                if (!mtl || mtl.Is<MixMaterial>() || !mtl.GetDisplacement())
+                    Warning(&sh.loc, "Ignoring \"maxdisplacement\" since the shape's "
+                                     "material has no displacement texture.");
+                else if (!allTriangles)
+                    Warning(&sh.loc, "Ignoring \"maxdisplacement\" since only triangle "
+                                     "meshes can be displaced.");
+                else if (sh.lightIndex != -1 || alphaTex)
+                    Warning(&sh.loc, "Ignoring \"maxdisplacement\" since displaced "
+                                     "shapes can't be area lights or have alpha.");
+                else {
+                    DisplacedTrianglePrimitive::SetCacheMemory(
+                        size_t(Options->displacementCacheMemory) << 20);
+                    prims = DisplacedTrianglePrimitive::Create(
+                        shapes, mtl, mi, maxDisplacement, edgeLength, maxLevel,
+                        threadAlloc);
+                    sh.parameters.FreeParameters();
+                    sh = ShapeSceneEntity();
+                    return;
+                }
+            }
+            prims.reserve(shapes.size());
+            pstd::vector<Light> *const *shapeLights = areaLightsByShape.Find(i);
             for (size_t j = 0; j < shapes.size(); ++j) {
                 // Possibly create area light for shape
                 Light area = nullptr;
                 // Will not be present in the map if it has an "interface"
                 // material...
-                if (sh.lightIndex != -1 && iter != shapeIndexToAreaLights.end())
-                    area = (*iter->second)[j];
+                if (sh.lightIndex != -1 && shapeLights)
+                    area = (**shapeLights)[j];
 
                 if (area == nullptr && !mi.IsMediumTransition() && !alphaTex)
-                    primitives.push_back(new SimplePrimitive(shapes[j], mtl));
+                    prims.push_back(new SimplePrimitive(shapes[j], mtl));
                 else
-                    primitives.push_back(
+                    prims.push_back(
                         new GeometricPrimitive(shapes[j], mtl, area, mi, alphaTex));
             }
             sh.parameters.FreeParameters();
             sh = ShapeSceneEntity();
-        }
-        return primitives;
+        });
+        return gatherPrimitives(entityPrimitives);
     };
 
     LOG_VERBOSE("Starting shapes");
@@ -1241,32 +1396,21 @@ Primitive ParsedScene::CreateAggregate(
     // Animated shapes
     auto CreatePrimitivesForAnimatedShapes =
         [&](std::vector<AnimatedShapeSceneEntity> &shapes) -> std::vector<Primitive> {
-        std::vector<Primitive> primitives;
-        primitives.reserve(shapes.size());
-
-        for (auto &sh : shapes) {
+        std::vector<std::vector<Primitive>> entityPrimitives(shapes.size());
+        ParallelFor(0, shapes.size(), [&](int64_t i) {
+            Allocator threadAlloc = threadAllocators[ThreadIndex];
+            auto &sh = shapes[i];
             pstd::vector<pbrt::Shape> shapes =
                 Shape::Create(sh.name, sh.identity, sh.identity, sh.reverseOrientation,
-                              sh.parameters, &sh.loc, alloc);
+                              sh.parameters, &sh.loc, threadAlloc);
             if (shapes.empty())
-                continue;
+                return;
 
-            FloatTexture alphaTex = getAlphaTexture(sh.parameters, &sh.loc);
+            FloatTexture alphaTex = getAlphaTexture(sh.parameters, &sh.loc, threadAlloc);
             sh.parameters.ReportUnused();  // do now so can grab alpha...
 
             // Create initial shape or shapes for animated shape
-
-            pbrt::Material mtl = nullptr;
-            if (!sh.materialName.empty()) {
-                auto iter = namedMaterials.find(sh.materialName);
-                if (iter == namedMaterials.end())
-                    ErrorExit(&sh.loc, "%s: no named material defined.", sh.materialName);
-                mtl = iter->second;
-            } else {
-                CHECK_LT(sh.materialIndex, materials.size());
-                mtl = materials[sh.materialIndex];
-            }
-
+            pbrt::Material mtl = getMaterial(sh.materialName, sh.materialIndex, &sh.loc);
             pbrt::MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                      findMedium(sh.outsideMedium, &sh.loc));
 
@@ -1293,12 +1437,13 @@ Primitive ParsedScene::CreateAggregate(
                 prims.clear();
                 prims.push_back(bvh);
             }
-            primitives.push_back(new AnimatedPrimitive(prims[0], sh.renderFromObject));
+            entityPrimitives[i].push_back(
+                new AnimatedPrimitive(prims[0], sh.renderFromObject));
 
             sh.parameters.FreeParameters();
             sh = AnimatedShapeSceneEntity();
-        }
-        return primitives;
+        });
+        return gatherPrimitives(entityPrimitives);
     };
     std::vector<Primitive> animatedPrimitives =
         CreatePrimitivesForAnimatedShapes(animatedShapes);
@@ -1311,7 +1456,10 @@ Primitive ParsedScene::CreateAggregate(
 
     // Instance definitions
     LOG_VERBOSE("Starting instances");
-    std::map<std::string, Primitive> instanceDefinitions;
+    // Instances' definitions are found in a _FlatHashMap_ since scenes may have
+    // millions of instances
+    FlatHashMap<std::string, Primitive> instanceDefinitions;
+    instanceDefinitions.Reserve(this->instanceDefinitions.size());
     std::mutex instanceDefinitionsMutex;
     std::vector<std::map<std::string, InstanceDefinitionSceneEntity>::iterator>
         instanceDefinitionIterators;
@@ -1330,16 +1478,21 @@ Primitive ParsedScene::CreateAggregate(
                                   movingInstancePrimitives.end());
 
         if (instancePrimitives.size() > 1) {
-            Primitive bvh = new BVHAggregate(std::move(instancePrimitives));
+            Primitive bvh;
+            if (Options->lazyInstances)
+                bvh = new LazyBVHAggregate(std::move(instancePrimitives));
+            else
+                bvh = new BVHAggregate(std::move(instancePrimitives));
             instancePrimitives.clear();
             instancePrimitives.push_back(bvh);
         }
 
+        Primitive definition =
+            instancePrimitives.empty() ? nullptr : instancePrimitives[0];
         std::lock_guard<std::mutex> lock(instanceDefinitionsMutex);
-        if (instancePrimitives.empty())
-            instanceDefinitions[inst.first] = nullptr;
-        else
-            instanceDefinitions[inst.first] = instancePrimitives[0];
+        instanceDefinitions[inst.first] = definition;
+        if (sceneInstances)
+            sceneInstances->definitions[inst.first] = definition;
 
         inst.second = InstanceDefinitionSceneEntity();
     });
@@ -1348,38 +1501,347 @@ Primitive ParsedScene::CreateAggregate(
 
     // Instances
     for (const auto &inst : instances) {
-        auto iter = instanceDefinitions.find(inst.name);
-        if (iter == instanceDefinitions.end())
+        const Primitive *definition = instanceDefinitions.Find(inst.name);
+        if (!definition)
             ErrorExit(&inst.loc, "%s: object instance not defined", inst.name);
 
-        if (iter->second == nullptr)
+        if (*definition == nullptr)
             // empty instance
             continue;
 
-        if (inst.renderFromInstance)
-            primitives.push_back(
-                new TransformedPrimitive(iter->second, inst.renderFromInstance));
-        else {
-            primitives.push_back(
-                new AnimatedPrimitive(iter->second, *inst.renderFromInstanceAnim));
+        Primitive prim;
+        if (inst.renderFromInstance) {
+            if (!AffineTransform::IsAffine(*inst.renderFromInstance))
+                ErrorExit(&inst.loc, "%s: object instance transformation must be affine.",
+                          inst.name);
+            AffineTransform renderFromInstance(*inst.renderFromInstance);
+            prim = new TransformedPrimitive(*definition,
+                                            transformCache->Lookup(renderFromInstance));
+            delete inst.renderFromInstance;
+        } else {
+            prim = new AnimatedPrimitive(*definition, *inst.renderFromInstanceAnim);
             delete inst.renderFromInstanceAnim;
         }
+        if (sceneInstances) {
+            sceneInstances->names.push_back(inst.name);
+            sceneInstances->primitives.push_back(prim);
+        } else
+            primitives.push_back(prim);
     }
 
     instances.clear();
     instances.shrink_to_fit();
     LOG_VERBOSE("Finished instances");
+    return primitives;
+}
+
+Primitive ParsedScene::CreateAggregate(
+    Allocator alloc, const NamedTextures &textures,
+    const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
+    const std::map<std::string, Medium> &media,
+    const std::map<std::string, pbrt::Material> &namedMaterials,
+    const std::vector<pbrt::Material> &materials, SceneInstances *sceneInstances) {
+    std::vector<Primitive> primitives =
+        CreatePrimitives(alloc, textures, shapeIndexToAreaLights, media, namedMaterials,
+                         materials, sceneInstances);
 
     // Accelerator
     Primitive aggregate = nullptr;
     LOG_VERBOSE("Starting top-level accelerator");
-    if (!primitives.empty())
-        aggregate = CreateAccelerator(accelerator.name, std::move(primitives),
-                                      accelerator.parameters);
+    if (!sceneInstances) {
+        if (!primitives.empty())
+            aggregate = CreateAccelerator(accelerator.name, std::move(primitives),
+                                          accelerator.parameters);
+    } else {
+        // Build two-level hierarchy whose top level only holds instances
+        // and a single aggregate of the non-instanced primitives
+        std::vector<Primitive> topLevelPrimitives = sceneInstances->primitives;
+        if (!primitives.empty())
+            topLevelPrimitives.push_back(CreateAccelerator(
+                accelerator.name, std::move(primitives), accelerator.parameters));
+        if (!topLevelPrimitives.empty()) {
+            sceneInstances->topLevel = new BVHAggregate(std::move(topLevelPrimitives));
+            aggregate = sceneInstances->topLevel;
+        }
+    }
     LOG_VERBOSE("Finished top-level accelerator");
     return aggregate;
 }
 
+// SceneAnalysis Function Definitions
+// Returns the number of values the named parameter has, without copying them
+static size_t ParameterValueCount(const ParameterDictionary &dict,
+                                  std::string_view name) {
+    for (const ParsedParameter *p : dict.GetParameterVector())
+        if (p->name == name)
+            return p->floats.size() + p->ints.size();
+    return 0;
+}
+
+// Returns the size of the given file in bytes, or zero if it can't be opened.
+static int64_t FileBytes(const std::string &filename) {
+    FILE *f = FOpenRead(filename);
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    int64_t bytes = ftell(f);
+    fclose(f);
+    return bytes;
+}
+
+// Adds the primitives that a shape creates and the size of its mesh data to
+// _analysis_ and returns the number of primitives.
+template <typename ShapeEntity>
+static int64_t AnalyzeShape(const ShapeEntity &sh, SceneAnalysis *analysis) {
+    const std::string &name = sh.name;
+    const ParameterDictionary &parameters = sh.parameters;
+    int64_t nPrimitives = 0, objectBytes = 0;
+    if (name == "trianglemesh" || name == "bilinearmesh") {
+        // Meshes store all of their array parameters' values
+        int vertsPerFace = (name == "trianglemesh") ? 3 : 4;
+        size_t nIndices = ParameterValueCount(parameters, "indices");
+        size_t nP = ParameterValueCount(parameters, "P") / 3;
+        nPrimitives = (nIndices == 0 && nP == vertsPerFace) ? 1 : nIndices / vertsPerFace;
+        for (const ParsedParameter *p : parameters.GetParameterVector())
+            analysis->meshBytes += p->floats.size() * sizeof(Float) +
+                                   p->ints.size() * sizeof(int);
+        if (name == "trianglemesh") {
+            analysis->nTriangles += nPrimitives;
+            objectBytes = sizeof(Triangle);
+        } else {
+            analysis->nBilinearPatches += nPrimitives;
+            objectBytes = sizeof(BilinearPatch);
+        }
+    } else if (name == "plymesh") {
+        // Quads are counted as triangles since only the number of faces is
+        // in the header; displacement isn't accounted for.
+        std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+        PLYHeader header;
+        if (!TriQuadMesh::ReadPLYHeader(filename, &header))
+            Warning(&sh.loc, "%s: unable to read PLY file header.", filename);
+        else {
+            nPrimitives = header.nFaces;
+            analysis->nTriangles += nPrimitives;
+            analysis->meshBytes +=
+                header.nVertices *
+                    (sizeof(Point3f) + (header.hasNormals ? sizeof(Normal3f) : 0) +
+                     (header.hasUVs ? sizeof(Point2f) : 0)) +
+                nPrimitives * 3 * sizeof(int);
+            objectBytes = sizeof(Triangle);
+        }
+    } else if (name == "loopsubdiv") {
+        // Each level of subdivision splits each triangle into four; the
+        // subdivided mesh has about half as many vertices as triangles.
+        int nLevels = parameters.GetOneInt("levels", 3);
+        nPrimitives = ParameterValueCount(parameters, "indices") / 3;
+        for (int i = 0; i < nLevels; ++i)
+            nPrimitives *= 4;
+        analysis->nTriangles += nPrimitives;
+        analysis->meshBytes += nPrimitives * 3 * sizeof(int) +
+                               nPrimitives / 2 * (sizeof(Point3f) + sizeof(Normal3f));
+        objectBytes = sizeof(Triangle);
+    } else if (name == "curve" && parameters.GetOneString("filename", "") != "") {
+        // Curve files hold one cubic Bezier segment per 56-byte record
+        std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+        int64_t nSegments = std::max<int64_t>(0, (FileBytes(filename) - 16) / 56);
+        nPrimitives = nSegments << parameters.GetOneInt("splitdepth", 3);
+        analysis->nCurves += nPrimitives;
+        objectBytes = sizeof(Curve);
+    } else if (name == "curve") {
+        // Each segment is split into 2^splitdepth curves
+        int64_t nCP = ParameterValueCount(parameters, "P") / 3;
+        int degree = parameters.GetOneInt("degree", 3);
+        int64_t nSegments = (parameters.GetOneString("basis", "bezier") == "bezier")
+                                ? (nCP - 1) / std::max(1, degree)
+                                : nCP - degree;
+        nPrimitives = std::max<int64_t>(0, nSegments)
+                      << parameters.GetOneInt("splitdepth", 3);
+        analysis->nCurves += nPrimitives;
+        analysis->meshBytes += nCP * sizeof(Point3f);
+        objectBytes = sizeof(Curve);
+    } else if (name == "sphere" || name == "disk" || name == "cylinder") {
+        nPrimitives = 1;
+        analysis->nQuadrics += 1;
+        objectBytes = std::max({sizeof(Sphere), sizeof(Disk), sizeof(Cylinder)});
+    }
+
+    // Only emissive shapes, those with alpha textures, and those at medium
+    // boundaries need _GeometricPrimitive_s
+    bool geometric = sh.lightIndex != -1 || sh.insideMedium != sh.outsideMedium ||
+                     !parameters.GetTexture("alpha").empty();
+    objectBytes += geometric ? sizeof(GeometricPrimitive) : sizeof(SimplePrimitive);
+    analysis->primitiveBytes += nPrimitives * objectBytes;
+    ++analysis->shapeTypes[name];
+    return nPrimitives;
+}
+
+SceneAnalysis AnalyzeScene(const ParsedScene &scene) {
+    SceneAnalysis analysis;
+    // Film
+    analysis.filmType = scene.film.name;
+    const ParameterDictionary &filmParameters = scene.film.parameters;
+    analysis.filmResolution = Point2i(filmParameters.GetOneInt("xresolution", 1280),
+                                      filmParameters.GetOneInt("yresolution", 720));
+    int64_t nPixels = int64_t(analysis.filmResolution.x) * analysis.filmResolution.y;
+    // All of the G-buffer film's auxiliary channels are stored by default
+    if (scene.film.name == "gbuffer")
+        analysis.filmBytes = nPixels * GBufferFilm::PixelBytes(GBufferFilm::AllChannels);
+    else
+        analysis.filmBytes = nPixels * RGBFilm::PixelBytes();
+
+    // Shapes and area lights
+    int64_t nPrimitives = 0;
+    for (const ShapeSceneEntity &sh : scene.shapes) {
+        int64_t n = AnalyzeShape(sh, &analysis);
+        nPrimitives += n;
+        if (sh.lightIndex != -1) {
+            // Area lights are created for each of the shape's primitives
+            analysis.nAreaLights += n;
+            analysis.lightTypes[scene.areaLights[sh.lightIndex].name] += n;
+        }
+    }
+    for (const AnimatedShapeSceneEntity &sh : scene.animatedShapes)
+        nPrimitives += AnalyzeShape(sh, &analysis);
+    analysis.nInstancedPrimitives = nPrimitives;
+    analysis.bvhBytes =
+        BVHAggregate::EstimateBytes(nPrimitives, scene.accelerator.parameters);
+
+    // Object instances
+    std::map<std::string, int64_t> definitionPrimitives;
+    for (const auto &def : scene.instanceDefinitions) {
+        int64_t n = 0;
+        for (const ShapeSceneEntity &sh : def.second.shapes)
+            n += AnalyzeShape(sh, &analysis);
+        for (const AnimatedShapeSceneEntity &sh : def.second.animatedShapes)
+            n += AnalyzeShape(sh, &analysis);
+        definitionPrimitives[def.first] = n;
+        analysis.bvhBytes += BVHAggregate::EstimateBytes(n, scene.accelerator.parameters);
+    }
+    analysis.nInstanceDefinitions = scene.instanceDefinitions.size();
+    for (const InstanceSceneEntity &inst : scene.instances) {
+        auto iter = definitionPrimitives.find(inst.name);
+        if (iter == definitionPrimitives.end())
+            continue;
+        ++analysis.nInstances;
+        analysis.nInstancedPrimitives += iter->second;
+    }
+    analysis.primitiveBytes +=
+        analysis.nInstances * (sizeof(TransformedPrimitive) + sizeof(Transform));
+    // The top-level BVH holds the instances and the other primitives' BVH
+    if (analysis.nInstances > 0)
+        analysis.bvhBytes +=
+            BVHAggregate::EstimateBytes(analysis.nInstances + 1, ParameterDictionary());
+
+    // Materials
+    for (const SceneEntity &mtl : scene.materials)
+        ++analysis.materialTypes[mtl.name];
+    for (const auto &nm : scene.namedMaterials)
+        ++analysis.materialTypes[nm.second.parameters.GetOneString("type", "")];
+
+    // Lights
+    analysis.nLights = scene.lights.size() + analysis.nAreaLights;
+    for (const LightSceneEntity &light : scene.lights)
+        ++analysis.lightTypes[light.name];
+    analysis.nMedia = scene.media.size();
+
+    // Images used by textures, lights, and materials; each file is only
+    // counted once
+    std::set<std::string> imageFilenames;
+    auto addImage = [&](std::string filename, bool mipmap, const FileLoc &loc) {
+        filename = ResolveFilename(filename);
+        if (filename.empty() || !imageFilenames.insert(filename).second)
+            return;
+        ++analysis.nImages;
+        Point2i resolution;
+        int nChannels;
+        PixelFormat format;
+        if (HasExtension(filename, "ptex"))
+            analysis.imageBytes += FileBytes(filename);
+        else if (!Image::ReadInfo(filename, &resolution, &nChannels, &format))
+            Warning(&loc, "%s: unable to read image file.", filename);
+        else {
+            // MIP maps' lower-resolution levels take another third
+            int64_t bytes = int64_t(resolution.x) * resolution.y * nChannels *
+                            TexelBytes(format);
+            analysis.imageBytes += mipmap ? bytes * 4 / 3 : bytes;
+        }
+    };
+    for (const auto &tex : scene.floatTextures)
+        addImage(tex.second.parameters.GetOneString("filename", ""), true,
+                 tex.second.loc);
+    for (const auto &tex : scene.spectrumTextures)
+        addImage(tex.second.parameters.GetOneString("filename", ""), true,
+                 tex.second.loc);
+    for (const LightSceneEntity &light : scene.lights)
+        addImage(light.parameters.GetOneString("filename", ""), false, light.loc);
+    for (const SceneEntity &light : scene.areaLights)
+        addImage(light.parameters.GetOneString("filename", ""), false, light.loc);
+    for (const SceneEntity &mtl : scene.materials)
+        addImage(mtl.parameters.GetOneString("normalmap", ""), false, mtl.loc);
+    for (const auto &nm : scene.namedMaterials)
+        addImage(nm.second.parameters.GetOneString("normalmap", ""), false,
+                 nm.second.loc);
+
+    // The GPU renderer doesn't use the CPU's shape and primitive objects or its
+    // BVH; assume that OptiX's acceleration structures take about 64 bytes per
+    // primitive and instance and that each of the up to 1M samples in flight
+    // takes about 1 kB of queue storage.
+    int64_t nGPUPrimitives = analysis.nTriangles + analysis.nBilinearPatches +
+                             analysis.nCurves + analysis.nQuadrics + analysis.nInstances;
+    int64_t nQueueSamples = std::min<int64_t>(nPixels, 1024 * 1024);
+    analysis.gpuBytes = analysis.meshBytes + analysis.imageBytes + analysis.filmBytes +
+                        64 * nGPUPrimitives + 1024 * nQueueSamples;
+
+    return analysis;
+}
+
+void SceneAnalysis::Print(FILE *dest) const {
+    auto printValue = [dest](const std::string &name, const std::string &value) {
+        fprintf(dest, "  %-40s %16s\n", name.c_str(), value.c_str());
+    };
+    auto printCount = [&](const std::string &name, int64_t count) {
+        printValue(name, StringPrintf("%d", count));
+    };
+    auto printBytes = [&](const std::string &name, int64_t bytes) {
+        printValue(name, StringPrintf("%.2f MiB", bytes / (1024. * 1024.)));
+    };
+
+    fprintf(dest, "Scene:\n");
+    printValue("Film", StringPrintf("%s %d x %d", filmType, filmResolution.x,
+                                    filmResolution.y));
+    printCount("Triangles", nTriangles);
+    printCount("Bilinear patches", nBilinearPatches);
+    printCount("Curves", nCurves);
+    printCount("Quadrics", nQuadrics);
+    printCount("Object instance definitions", nInstanceDefinitions);
+    printCount("Object instances", nInstances);
+    printCount("Primitives after instancing", nInstancedPrimitives);
+    printCount("Lights", nLights);
+    printCount("Area lights", nAreaLights);
+    printCount("Media", nMedia);
+    printCount("Image files", nImages);
+
+    fprintf(dest, "Shape types:\n");
+    for (const auto &type : shapeTypes)
+        printCount(type.first, type.second);
+    fprintf(dest, "Material types:\n");
+    for (const auto &type : materialTypes)
+        printCount(type.first, type.second);
+    fprintf(dest, "Light types:\n");
+    for (const auto &type : lightTypes)
+        printCount(type.first, type.second);
+
+    fprintf(dest, "Estimated memory:\n");
+    printBytes("Mesh vertices and indices", meshBytes);
+    printBytes("Shapes and primitives", primitiveBytes);
+    printBytes("BVH", bvhBytes);
+    printBytes("Images", imageBytes);
+    printBytes("Film", filmBytes);
+    printBytes("CPU total",
+               meshBytes + primitiveBytes + bvhBytes + imageBytes + filmBytes);
+    printBytes("GPU total", gpuBytes);
+}
+
 // FormattingScene Method Definitions
 FormattingScene::~FormattingScene() {
     if (errorExit)
@@ -2271,4 +2733,294 @@ void FormattingScene::ObjectInstance(const std::string &name, FileLoc loc) {
 
 void FormattingScene::EndOfFiles() {}
 
+// BinaryFormattingScene Method Definitions
+BinaryFormattingScene::BinaryFormattingScene(FILE *out) : out(out) {
+#ifdef PBRT_IS_WINDOWS
+    if (out == stdout)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    write(BinarySceneMagic, 8);
+    writeUInt(BinarySceneVersion);
+    align(16);
+}
+
+BinaryFormattingScene::~BinaryFormattingScene() {
+    flush();
+    if (errorExit)
+        ErrorExit("Fatal errors during scene updating.");
+}
+
+void BinaryFormattingScene::write(const void *ptr, size_t size) {
+    buffer.append((const char *)ptr, size);
+    offset += size;
+    // Write the buffer out in large chunks so that memory use stays bounded
+    // for big scenes.
+    if (buffer.size() > 16 * 1024 * 1024)
+        flush();
+}
+
+void BinaryFormattingScene::writeString(std::string_view str) {
+    writeUInt(str.size());
+    write(str.data(), str.size());
+    align(4);
+}
+
+void BinaryFormattingScene::align(int alignment) {
+    static const char zeros[16] = {};
+    CHECK_LE(alignment, sizeof(zeros));
+    if (size_t pad = (alignment - offset % alignment) % alignment; pad > 0)
+        write(zeros, pad);
+}
+
+void BinaryFormattingScene::flush() {
+    if (fwrite(buffer.data(), 1, buffer.size(), out) != buffer.size())
+        ErrorExit("Error writing binary scene: %s", ErrorString());
+    buffer.clear();
+}
+
+void BinaryFormattingScene::writeParameter(const ParsedParameter &param) {
+    writeString(param.type);
+    writeString(param.name);
+
+    if (!param.floats.empty()) {
+        writeUInt(uint32_t(BinaryParameterKind::Float));
+        writeUInt(param.floats.size());
+        align(16);
+        for (Float v : param.floats) {
+            float f = v;
+            write(&f, sizeof(f));
+        }
+    } else if (!param.ints.empty()) {
+        writeUInt(uint32_t(BinaryParameterKind::Int));
+        writeUInt(param.ints.size());
+        align(16);
+        static_assert(sizeof(int) == sizeof(int32_t), "Unexpected int size");
+        write(param.ints.data(), param.ints.size() * sizeof(int));
+    } else if (!param.bools.empty()) {
+        writeUInt(uint32_t(BinaryParameterKind::Bool));
+        writeUInt(param.bools.size());
+        align(16);
+        write(param.bools.data(), param.bools.size());
+        align(4);
+    } else {
+        writeUInt(uint32_t(BinaryParameterKind::String));
+        writeUInt(param.strings.size());
+        align(16);
+        for (const std::string &str : param.strings)
+            writeString(str);
+    }
+}
+
+void BinaryFormattingScene::writeRecord(BinarySceneDirective directive, FileLoc loc,
+                                        std::initializer_list<std::string_view> strings,
+                                        pstd::span<const Float> floats,
+                                        const ParsedParameterVector &params) {
+    // Emit a _SourceFile_ record whenever the file the directives come from
+    // changes so that error messages can refer to the original text files.
+    if (directive != BinarySceneDirective::SourceFile &&
+        loc.filename != currentFilename) {
+        currentFilename = std::string(loc.filename);
+        writeRecord(BinarySceneDirective::SourceFile, FileLoc(), {currentFilename});
+    }
+
+    writeUInt(uint32_t(directive));
+    writeUInt(loc.line);
+    writeUInt(loc.column);
+    writeUInt(strings.size());
+    writeUInt(floats.size());
+    writeUInt(params.size());
+    for (std::string_view str : strings)
+        writeString(str);
+    for (Float v : floats) {
+        float f = v;
+        write(&f, sizeof(f));
+    }
+    for (const ParsedParameter *param : params)
+        writeParameter(*param);
+}
+
+void BinaryFormattingScene::Option(const std::string &name, const std::string &value,
+                                   FileLoc loc) {
+    writeRecord(BinarySceneDirective::Option, loc, {name, value});
+}
+
+void BinaryFormattingScene::Identity(FileLoc loc) {
+    writeRecord(BinarySceneDirective::Identity, loc);
+}
+
+void BinaryFormattingScene::Translate(Float dx, Float dy, Float dz, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Translate, loc, {}, {dx, dy, dz});
+}
+
+void BinaryFormattingScene::Rotate(Float angle, Float ax, Float ay, Float az,
+                                   FileLoc loc) {
+    writeRecord(BinarySceneDirective::Rotate, loc, {}, {angle, ax, ay, az});
+}
+
+void BinaryFormattingScene::Scale(Float sx, Float sy, Float sz, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Scale, loc, {}, {sx, sy, sz});
+}
+
+void BinaryFormattingScene::LookAt(Float ex, Float ey, Float ez, Float lx, Float ly,
+                                   Float lz, Float ux, Float uy, Float uz, FileLoc loc) {
+    writeRecord(BinarySceneDirective::LookAt, loc, {},
+                {ex, ey, ez, lx, ly, lz, ux, uy, uz});
+}
+
+void BinaryFormattingScene::ConcatTransform(Float transform[16], FileLoc loc) {
+    writeRecord(BinarySceneDirective::ConcatTransform, loc, {},
+                pstd::span<const Float>(transform, 16));
+}
+
+void BinaryFormattingScene::Transform(Float transform[16], FileLoc loc) {
+    writeRecord(BinarySceneDirective::Transform, loc, {},
+                pstd::span<const Float>(transform, 16));
+}
+
+void BinaryFormattingScene::CoordinateSystem(const std::string &name, FileLoc loc) {
+    writeRecord(BinarySceneDirective::CoordinateSystem, loc, {name});
+}
+
+void BinaryFormattingScene::CoordSysTransform(const std::string &name, FileLoc loc) {
+    writeRecord(BinarySceneDirective::CoordSysTransform, loc, {name});
+}
+
+void BinaryFormattingScene::ActiveTransformAll(FileLoc loc) {
+    writeRecord(BinarySceneDirective::ActiveTransformAll, loc);
+}
+
+void BinaryFormattingScene::ActiveTransformEndTime(FileLoc loc) {
+    writeRecord(BinarySceneDirective::ActiveTransformEndTime, loc);
+}
+
+void BinaryFormattingScene::ActiveTransformStartTime(FileLoc loc) {
+    writeRecord(BinarySceneDirective::ActiveTransformStartTime, loc);
+}
+
+void BinaryFormattingScene::TransformTimes(Float start, Float end, FileLoc loc) {
+    writeRecord(BinarySceneDirective::TransformTimes, loc, {}, {start, end});
+}
+
+void BinaryFormattingScene::ColorSpace(const std::string &n, FileLoc loc) {
+    writeRecord(BinarySceneDirective::ColorSpace, loc, {n});
+}
+
+void BinaryFormattingScene::PixelFilter(const std::string &name,
+                                        ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::PixelFilter, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::Film(const std::string &type, ParsedParameterVector params,
+                                 FileLoc loc) {
+    writeRecord(BinarySceneDirective::Film, loc, {type}, {}, params);
+}
+
+void BinaryFormattingScene::Sampler(const std::string &name,
+                                    ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Sampler, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::Accelerator(const std::string &name,
+                                        ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Accelerator, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::Integrator(const std::string &name,
+                                       ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Integrator, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::Camera(const std::string &name, ParsedParameterVector params,
+                                   FileLoc loc) {
+    writeRecord(BinarySceneDirective::Camera, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::MakeNamedMedium(const std::string &name,
+                                            ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::MakeNamedMedium, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::MediumInterface(const std::string &insideName,
+                                            const std::string &outsideName,
+                                            FileLoc loc) {
+    writeRecord(BinarySceneDirective::MediumInterface, loc, {insideName, outsideName});
+}
+
+void BinaryFormattingScene::WorldBegin(FileLoc loc) {
+    writeRecord(BinarySceneDirective::WorldBegin, loc);
+}
+
+void BinaryFormattingScene::AttributeBegin(FileLoc loc) {
+    writeRecord(BinarySceneDirective::AttributeBegin, loc);
+}
+
+void BinaryFormattingScene::AttributeEnd(FileLoc loc) {
+    writeRecord(BinarySceneDirective::AttributeEnd, loc);
+}
+
+void BinaryFormattingScene::Attribute(const std::string &target,
+                                      ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Attribute, loc, {target}, {}, params);
+}
+
+void BinaryFormattingScene::Texture(const std::string &name, const std::string &type,
+                                    const std::string &texname,
+                                    ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Texture, loc, {name, type, texname}, {}, params);
+}
+
+void BinaryFormattingScene::Material(const std::string &name,
+                                     ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Material, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::MakeNamedMaterial(const std::string &name,
+                                              ParsedParameterVector params,
+                                              FileLoc loc) {
+    writeRecord(BinarySceneDirective::MakeNamedMaterial, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::NamedMaterial(const std::string &name, FileLoc loc) {
+    writeRecord(BinarySceneDirective::NamedMaterial, loc, {name});
+}
+
+void BinaryFormattingScene::LightSource(const std::string &name,
+                                        ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::LightSource, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::AreaLightSource(const std::string &name,
+                                            ParsedParameterVector params, FileLoc loc) {
+    writeRecord(BinarySceneDirective::AreaLightSource, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::Shape(const std::string &name, ParsedParameterVector params,
+                                  FileLoc loc) {
+    writeRecord(BinarySceneDirective::Shape, loc, {name}, {}, params);
+}
+
+void BinaryFormattingScene::ReverseOrientation(FileLoc loc) {
+    writeRecord(BinarySceneDirective::ReverseOrientation, loc);
+}
+
+void BinaryFormattingScene::ObjectBegin(const std::string &name, FileLoc loc) {
+    writeRecord(BinarySceneDirective::ObjectBegin, loc, {name});
+}
+
+void BinaryFormattingScene::ObjectEnd(FileLoc loc) {
+    writeRecord(BinarySceneDirective::ObjectEnd, loc);
+}
+
+void BinaryFormattingScene::ObjectInstance(const std::string &name, FileLoc loc) {
+    writeRecord(BinarySceneDirective::ObjectInstance, loc, {name});
+}
+
+void BinaryFormattingScene::Import(const std::string &filename, FileLoc loc) {
+    writeRecord(BinarySceneDirective::Import, loc, {filename});
+}
+
+void BinaryFormattingScene::EndOfFiles() {
+    flush();
+}
+
 }  // namespace pbrt
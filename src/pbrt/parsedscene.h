@@ -11,13 +11,19 @@
 #include <pbrt/cpu/primitive.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/transform.h>
 
+#include <cstdio>
+#include <initializer_list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <vector>
 
@@ -76,6 +82,19 @@ struct CameraSceneEntity : public SceneEntity {
     std::string medium;
 };
 
+// ViewSceneEntity Definition
+// Each Camera statement after the first adds a view of the scene that is
+// rendered to the film given by the Film statement that follows it. All views
+// share the first camera's rendering space.
+struct ViewSceneEntity {
+    std::string ToString() const {
+        return StringPrintf("[ ViewSceneEntity camera: %s film: %s ]", camera, film);
+    }
+
+    CameraSceneEntity camera;
+    SceneEntity film;
+};
+
 struct ShapeSceneEntity : public SceneEntity {
     ShapeSceneEntity() = default;
     ShapeSceneEntity(const std::string &name, ParameterDictionary parameters, FileLoc loc,
@@ -202,8 +221,9 @@ struct InstanceSceneEntity : public SceneEntity {
         : SceneEntity(name, {}, loc),
           renderFromInstanceAnim(new AnimatedTransform(renderFromInstanceAnim)) {}
     InstanceSceneEntity(const std::string &name, FileLoc loc,
-                        const Transform *renderFromInstance)
-        : SceneEntity(name, {}, loc), renderFromInstance(renderFromInstance) {}
+                        const Transform &renderFromInstance)
+        : SceneEntity(name, {}, loc),
+          renderFromInstance(new Transform(renderFromInstance)) {}
 
     std::string ToString() const {
         return StringPrintf(
@@ -216,12 +236,28 @@ struct InstanceSceneEntity : public SceneEntity {
     }
 
     AnimatedTransform *renderFromInstanceAnim = nullptr;
-    const Transform *renderFromInstance = nullptr;
+    Transform *renderFromInstance = nullptr;
+};
+
+// SceneInstances Definition
+// Filled in by ParsedScene::CreateAggregate() for renderers that update instance
+// transforms between frames. Instance definition BVHs are kept as they are;
+// after changing transforms with SetRenderFromPrimitive(), only _topLevel_
+// needs to be updated.
+struct SceneInstances {
+    // Object instance names and their TransformedPrimitive or AnimatedPrimitive
+    std::vector<std::string> names;
+    std::vector<Primitive> primitives;
+    // The primitives of the object definitions, or nullptr for empty ones
+    std::map<std::string, Primitive> definitions;
+    // BVH over the instances and an aggregate of all non-instanced primitives
+    BVHAggregate *topLevel = nullptr;
 };
 
 // TransformHash Definition
 struct TransformHash {
     size_t operator()(const Transform *t) const { return t->Hash(); }
+    size_t operator()(const AffineTransform *t) const { return t->Hash(); }
 };
 
 // TransformCache Definition
@@ -231,13 +267,30 @@ class TransformCache {
     TransformCache();
     ~TransformCache();
 
+    // Lookup() may be called concurrently by multiple threads
     const Transform *Lookup(const Transform &t);
+    const AffineTransform *Lookup(const AffineTransform &t);
 
   private:
     // TransformCache Private Members
-    pstd::pmr::monotonic_buffer_resource bufferResource;
-    Allocator alloc;
-    std::unordered_set<Transform *, TransformHash> hashTable;
+    // Transforms are distributed over independently locked shards according
+    // to their hash so that threads parsing in parallel rarely contend.
+    static constexpr int NumShards = 64;
+    struct alignas(64) Shard {
+        Shard(pstd::pmr::memory_resource *upstream)
+            : bufferResource(upstream), alloc(&bufferResource) {}
+
+        std::mutex mutex;
+        pstd::pmr::monotonic_buffer_resource bufferResource;
+        Allocator alloc;
+        std::unordered_set<Transform *, TransformHash> hashTable;
+        std::unordered_set<AffineTransform *, TransformHash> affineHashTable;
+    };
+
+    // TransformCache Private Methods
+    template <typename T>
+    const T *Lookup(const T &t, std::unordered_set<T *, TransformHash> Shard::*table);
+    std::unique_ptr<Shard> shards[NumShards];
 };
 
 // MaxTransforms Definition
@@ -325,6 +378,11 @@ class ParsedScene : public SceneRepresentation {
 
     void EndOfFiles();
 
+    // Makes the scene use the given rendering space rather than one based on
+    // its camera, so that it can describe edits to a scene that has already
+    // been created. Must be called before parsing.
+    void SetRenderingSpace(const class Transform &worldFromRender);
+
     ParsedScene *CopyForImport();
     void MergeImported(ParsedScene *);
 
@@ -343,16 +401,28 @@ class ParsedScene : public SceneRepresentation {
         const NamedTextures &textures,
         std::map<int, pstd::vector<Light> *> *shapeIndexToAreaLights);
 
+    // Creates the scene's primitives without building an accelerator over
+    // them. Object instances are included unless _sceneInstances_ is given,
+    // in which case they are stored there instead.
+    std::vector<Primitive> CreatePrimitives(
+        Allocator alloc, const NamedTextures &textures,
+        const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
+        const std::map<std::string, Medium> &media,
+        const std::map<std::string, pbrt::Material> &namedMaterials,
+        const std::vector<pbrt::Material> &materials,
+        SceneInstances *sceneInstances = nullptr);
     Primitive CreateAggregate(
         Allocator alloc, const NamedTextures &textures,
         const std::map<int, pstd::vector<Light> *> &shapeIndexToAreaLights,
         const std::map<std::string, Medium> &media,
         const std::map<std::string, pbrt::Material> &namedMaterials,
-        const std::vector<pbrt::Material> &materials);
+        const std::vector<pbrt::Material> &materials,
+        SceneInstances *sceneInstances = nullptr);
 
     // ParsedScene Public Members
     SceneEntity film, sampler, integrator, filter, accelerator;
     CameraSceneEntity camera;
+    std::vector<ViewSceneEntity> views;
     std::vector<std::pair<std::string, SceneEntity>> namedMaterials;
     std::set<std::string> namedMaterialNames;
     std::vector<SceneEntity> materials;
@@ -396,6 +466,7 @@ class ParsedScene : public SceneRepresentation {
     };
 
     friend void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t);
+    friend void parseBinary(SceneRepresentation *scene, const MappedFile &file);
     // ParsedScene Private Methods
     class Transform RenderFromObject(int index) const {
         return pbrt::Transform((renderFromWorld * graphicsState.ctm[index]).GetMatrix());
@@ -412,17 +483,45 @@ class ParsedScene : public SceneRepresentation {
     GraphicsState graphicsState;
     enum class BlockState { OptionsBlock, WorldBlock };
     BlockState currentBlock = BlockState::OptionsBlock;
+    bool haveCamera = false, fixedRenderingSpace = false;
     static constexpr int StartTransformBits = 1 << 0;
     static constexpr int EndTransformBits = 1 << 1;
     static constexpr int AllTransformsBits = (1 << MaxTransforms) - 1;
     std::map<std::string, TransformSet> namedCoordinateSystems;
     class Transform renderFromWorld;
-    TransformCache transformCache;
+    // Shared with the scenes that imported files are parsed into
+    std::shared_ptr<TransformCache> transformCache;
     std::vector<GraphicsState> pushedGraphicsStates;
     std::vector<std::pair<char, FileLoc>> pushStack;  // 'a': attribute, 'o': object
     InstanceDefinitionSceneEntity *currentInstance = nullptr;
 };
 
+// SceneAnalysis Definition
+// Summarizes the complexity of a parsed scene and estimates the memory needed
+// to render it. AnalyzeScene() only reads the headers of mesh and image files
+// and creates none of the scene's objects, so it is much faster than loading
+// the scene; the memory estimates are rough.
+struct SceneAnalysis {
+    // SceneAnalysis Public Methods
+    void Print(FILE *dest) const;
+
+    // SceneAnalysis Public Members
+    Point2i filmResolution;
+    std::string filmType;
+    // Primitives in object instance definitions are only counted once, while
+    // _nInstancedPrimitives_ counts them for each instance.
+    int64_t nTriangles = 0, nBilinearPatches = 0, nCurves = 0, nQuadrics = 0;
+    int64_t nInstanceDefinitions = 0, nInstances = 0, nInstancedPrimitives = 0;
+    int64_t nLights = 0, nAreaLights = 0, nMedia = 0, nImages = 0;
+    // Vertex and index buffers, per-primitive shape and primitive objects, BVH
+    // nodes, image textures and maps, film pixels, and total GPU memory
+    int64_t meshBytes = 0, primitiveBytes = 0, bvhBytes = 0, imageBytes = 0;
+    int64_t filmBytes = 0, gpuBytes = 0;
+    std::map<std::string, int64_t> shapeTypes, materialTypes, lightTypes;
+};
+
+SceneAnalysis AnalyzeScene(const ParsedScene &scene);
+
 class FormattingScene : public SceneRepresentation {
   public:
     FormattingScene(bool toPly, bool upgrade) : toPly(toPly), upgrade(upgrade) {}
@@ -495,6 +594,82 @@ class FormattingScene : public SceneRepresentation {
     std::map<std::string, std::string> definedObjectInstances;
 };
 
+// BinaryFormattingScene Definition
+class BinaryFormattingScene : public SceneRepresentation {
+  public:
+    BinaryFormattingScene(FILE *out);
+    ~BinaryFormattingScene();
+
+    void Option(const std::string &name, const std::string &value, FileLoc loc);
+    void Identity(FileLoc loc);
+    void Translate(Float dx, Float dy, Float dz, FileLoc loc);
+    void Rotate(Float angle, Float ax, Float ay, Float az, FileLoc loc);
+    void Scale(Float sx, Float sy, Float sz, FileLoc loc);
+    void LookAt(Float ex, Float ey, Float ez, Float lx, Float ly, Float lz, Float ux,
+                Float uy, Float uz, FileLoc loc);
+    void ConcatTransform(Float transform[16], FileLoc loc);
+    void Transform(Float transform[16], FileLoc loc);
+    void CoordinateSystem(const std::string &, FileLoc loc);
+    void CoordSysTransform(const std::string &, FileLoc loc);
+    void ActiveTransformAll(FileLoc loc);
+    void ActiveTransformEndTime(FileLoc loc);
+    void ActiveTransformStartTime(FileLoc loc);
+    void TransformTimes(Float start, Float end, FileLoc loc);
+    void ColorSpace(const std::string &n, FileLoc loc);
+    void PixelFilter(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void Film(const std::string &type, ParsedParameterVector params, FileLoc loc);
+    void Sampler(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void Accelerator(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void Integrator(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void Camera(const std::string &, ParsedParameterVector params, FileLoc loc);
+    void MakeNamedMedium(const std::string &name, ParsedParameterVector params,
+                         FileLoc loc);
+    void MediumInterface(const std::string &insideName, const std::string &outsideName,
+                         FileLoc loc);
+    void WorldBegin(FileLoc loc);
+    void AttributeBegin(FileLoc loc);
+    void AttributeEnd(FileLoc loc);
+    void Attribute(const std::string &target, ParsedParameterVector params, FileLoc loc);
+    void Texture(const std::string &name, const std::string &type,
+                 const std::string &texname, ParsedParameterVector params, FileLoc loc);
+    void Material(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void MakeNamedMaterial(const std::string &name, ParsedParameterVector params,
+                           FileLoc loc);
+    void NamedMaterial(const std::string &name, FileLoc loc);
+    void LightSource(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void AreaLightSource(const std::string &name, ParsedParameterVector params,
+                         FileLoc loc);
+    void Shape(const std::string &name, ParsedParameterVector params, FileLoc loc);
+    void ReverseOrientation(FileLoc loc);
+    void ObjectBegin(const std::string &name, FileLoc loc);
+    void ObjectEnd(FileLoc loc);
+    void ObjectInstance(const std::string &name, FileLoc loc);
+    // Imported files are referenced by name rather than being inlined, so
+    // that they are still parsed independently when the scene is loaded.
+    void Import(const std::string &filename, FileLoc loc);
+
+    void EndOfFiles();
+
+  private:
+    // BinaryFormattingScene Private Methods
+    void writeRecord(BinarySceneDirective directive, FileLoc loc,
+                     std::initializer_list<std::string_view> strings = {},
+                     pstd::span<const Float> floats = {},
+                     const ParsedParameterVector &params = {});
+    void writeParameter(const ParsedParameter &param);
+    void write(const void *ptr, size_t size);
+    void writeUInt(uint32_t v) { write(&v, sizeof(v)); }
+    void writeString(std::string_view str);
+    void align(int alignment);
+    void flush();
+
+    // BinaryFormattingScene Private Members
+    FILE *out;
+    std::string buffer;
+    size_t offset = 0;
+    std::string currentFilename;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_PARSEDSCENE_H
@@ -19,6 +19,7 @@
 #include <double-conversion/double-conversion.h>
 
 #include <cctype>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #ifdef PBRT_HAVE_MMAP
@@ -33,7 +34,9 @@
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -64,7 +67,7 @@ void ParsedParameter::AddBool(bool v) {
 
 std::string ParsedParameter::ToString() const {
     std::string str;
-    str += std::string("\"") + type + " " + name + std::string("\" [ ");
+    str += StringPrintf("\"%s %s\" [ ", type, name);
     if (!floats.empty())
         for (Float d : floats)
             str += StringPrintf("%f ", d);
@@ -82,6 +85,80 @@ std::string ParsedParameter::ToString() const {
     return str;
 }
 
+STAT_MEMORY_COUNTER("Memory/Parsed parameters", parsedParameterBytes);
+
+// ParameterArena Definition
+// Small allocations are carved out of large blocks that are only freed by
+// Release(); large ones, from geometry-sized parameter arrays, go to the
+// heap so that they can be freed as soon as their parameter is destroyed.
+class ParameterArena : public pstd::pmr::memory_resource {
+  public:
+    // ParameterArena Public Methods
+    void Release() { blocks.release(); }
+
+  private:
+    // ParameterArena Private Methods
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        if (bytes > MaxArenaAllocation)
+            return pstd::pmr::new_delete_resource()->allocate(bytes, alignment);
+        parsedParameterBytes += bytes;
+        return blocks.allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        if (bytes > MaxArenaAllocation)
+            pstd::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    // ParameterArena Private Members
+    static constexpr size_t MaxArenaAllocation = 4096;
+    pstd::pmr::monotonic_buffer_resource blocks{1024 * 1024,
+                                                pstd::pmr::new_delete_resource()};
+};
+
+static std::mutex parameterArenasMutex;
+static std::vector<ParameterArena *> parameterArenas;
+
+ParsedParameter *NewParsedParameter(FileLoc loc) {
+    // Scene files may be parsed by threads that aren't in the thread pool, so
+    // arenas are found using a thread-local pointer rather than _ThreadIndex_
+    thread_local ParameterArena *arena = nullptr;
+    if (!arena) {
+        arena = new ParameterArena;
+        std::lock_guard<std::mutex> lock(parameterArenasMutex);
+        parameterArenas.push_back(arena);
+    }
+    Allocator alloc(arena);
+    return alloc.new_object<ParsedParameter>(loc, alloc);
+}
+
+void FreeParsedParameters() {
+    std::lock_guard<std::mutex> lock(parameterArenasMutex);
+    for (ParameterArena *arena : parameterArenas)
+        arena->Release();
+}
+
+std::string_view InternParameterString(std::string_view str) {
+    // Parameter names and types come from a small set of strings, so each
+    // thread keeps its own cache in front of the shared table
+    thread_local std::unordered_set<std::string_view> threadStrings;
+    if (auto iter = threadStrings.find(str); iter != threadStrings.end())
+        return *iter;
+
+    static std::mutex mutex;
+    // References to elements of an unordered_set remain valid as it grows
+    static std::unordered_set<std::string> *strings = new std::unordered_set<std::string>;
+    std::string_view interned;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        interned = *strings->insert(std::string(str)).first;
+    }
+    threadStrings.insert(interned);
+    return interned;
+}
+
 SceneRepresentation::~SceneRepresentation() {}
 
 static std::string toString(std::string_view s) {
@@ -395,6 +472,106 @@ static double parseFloat(const Token &t) {
     return val;
 }
 
+// Returns true if all eight bytes of v are ASCII digits.
+static bool isEightDigits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0) |
+             (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+            0x3333333333333333);
+}
+
+// Converts eight ASCII digits loaded from memory into a little-endian
+// integer to their value by combining adjacent pairs of digits, then pairs
+// of pairs, and so forth, all within a single 64-bit register.
+static uint32_t parseEightDigits(uint64_t v) {
+    v = (v & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+    v = (v & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+    return uint32_t((v & 0x0000FFFF0000FFFF) * 42949672960001 >> 32);
+}
+
+// Parses plain decimal numbers with an optional exponent, as are found in
+// nearly all scene files. If the number's significand is exactly
+// representable as a double and it has a small exponent, a single
+// correctly-rounded double multiply or divide gives the correctly-rounded
+// result.  Returns false in other cases, which are left for parseFloat().
+static bool parseFloatFast(std::string_view str, Float *value) {
+    const char *p = str.data(), *end = p + str.size();
+    bool negate = false;
+    if (p != end && (*p == '-' || *p == '+'))
+        negate = *p++ == '-';
+
+    uint64_t significand = 0;
+    int nDigits = 0, exponent = 0;
+    auto parseDigits = [&]() {
+        const char *start = p;
+        while (end - p >= 8 && nDigits + (p - start) + 8 <= 19) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            if (!isEightDigits(v))
+                break;
+            significand = significand * 100000000 + parseEightDigits(v);
+            p += 8;
+        }
+        while (p != end && *p >= '0' && *p <= '9') {
+            if (nDigits + (p - start) < 19)
+                significand = 10 * significand + (*p - '0');
+            ++p;
+        }
+        return int(p - start);
+    };
+
+    nDigits = parseDigits();
+    if (p != end && *p == '.') {
+        ++p;
+        int nFraction = parseDigits();
+        nDigits += nFraction;
+        exponent -= nFraction;
+    }
+    if (nDigits == 0 || nDigits > 19)
+        return false;
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negateExponent = false;
+        if (p != end && (*p == '-' || *p == '+'))
+            negateExponent = *p++ == '-';
+        if (p == end)
+            return false;
+        int e = 0;
+        for (; p != end && *p >= '0' && *p <= '9'; ++p)
+            if (e < 1000)
+                e = 10 * e + (*p - '0');
+        exponent += negateExponent ? -e : e;
+    }
+    if (p != end || significand > (uint64_t(1) << 53) || exponent < -22 ||
+        exponent > 22)
+        return false;
+
+    // Powers of ten up to 1e22 are exactly representable as doubles.
+    static const double powersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                         1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                         1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    double d = double(significand);
+    d = exponent < 0 ? d / powersOfTen[-exponent] : d * powersOfTen[exponent];
+    if (negate)
+        d = -d;
+
+#ifdef PBRT_FLOAT_AS_DOUBLE
+    *value = d;
+#else
+    // Rounding the double to a float gives the correctly-rounded float
+    // unless the double landed exactly halfway between two floats, or the
+    // result isn't a normal float.
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    if ((bits & 0x1FFFFFFF) == 0x10000000 ||
+        (d != 0 && (std::abs(d) < std::numeric_limits<float>::min() ||
+                    std::abs(d) > std::numeric_limits<float>::max())))
+        return false;
+    *value = float(d);
+#endif
+    return true;
+}
+
 inline bool isQuotedString(std::string_view str) {
     return str.size() >= 2 && str[0] == '"' && str.back() == '"';
 }
@@ -409,12 +586,69 @@ static std::string_view dequoteString(const Token &t) {
     return str;
 }
 
+// Tokenizer Number Array Parsing
+template <typename T, typename ParseValue>
+bool Tokenizer::parseNumberArray(pstd::vector<T> *values, ParseValue parseValue) {
+    auto isSpace = [](char ch) {
+        return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+    };
+
+    // Make sure that the array only holds numbers and count them so that
+    // storage for them can be allocated up front.
+    size_t count = 0;
+    bool inValue = false;
+    const char *p = pos;
+    for (; p != end && *p != ']'; ++p) {
+        char ch = *p;
+        if (isSpace(ch))
+            inValue = false;
+        else if (!inValue) {
+            if (!((ch >= '0' && ch <= '9') || ch == '-' || ch == '+' || ch == '.'))
+                return false;
+            inValue = true;
+            ++count;
+        } else if (ch == '"' || ch == '[' || ch == '#')
+            return false;
+    }
+    if (p == end)
+        return false;
+    values->reserve(values->size() + count);
+
+    while (true) {
+        while (isSpace(*pos))
+            getChar();
+        if (*pos == ']') {
+            getChar();
+            return true;
+        }
+
+        const char *valueStart = pos;
+        FileLoc valueLoc = loc;
+        while (!isSpace(*pos) && *pos != ']')
+            ++pos;
+        loc.column += pos - valueStart;
+        values->push_back(
+            parseValue(Token({valueStart, size_t(pos - valueStart)}, valueLoc)));
+    }
+}
+
+bool Tokenizer::ParseNumberArray(pstd::vector<Float> *values) {
+    return parseNumberArray(values, [](const Token &t) -> Float {
+        Float v;
+        return parseFloatFast(t.token, &v) ? v : parseFloat(t);
+    });
+}
+
+bool Tokenizer::ParseNumberArray(pstd::vector<int> *values) {
+    return parseNumberArray(values, [](const Token &t) { return parseInt(t); });
+}
+
 constexpr int TokenOptional = 0;
 constexpr int TokenRequired = 1;
 
-template <typename Next, typename Unget>
+template <typename Next, typename Unget, typename ParseNumbers>
 static ParsedParameterVector parseParameters(
-    Next nextToken, Unget ungetToken, bool formatting,
+    Next nextToken, Unget ungetToken, ParseNumbers parseNumbers, bool formatting,
     const std::function<void(const Token &token, const char *)> &errorCallback) {
     ParsedParameterVector parameterVector;
 
@@ -428,7 +662,7 @@ static ParsedParameterVector parseParameters(
             return parameterVector;
         }
 
-        ParsedParameter *param = new ParsedParameter(t->loc);
+        ParsedParameter *param = NewParsedParameter(t->loc);
 
         std::string_view decl = dequoteString(*t);
 
@@ -451,7 +685,8 @@ static ParsedParameterVector parseParameters(
 
         // Find end of type declaration
         auto typeEnd = skipToSpace(typeBegin);
-        param->type.assign(typeBegin, typeEnd);
+        param->type = InternParameterString(
+            decl.substr(typeBegin - decl.begin(), typeEnd - typeBegin));
 
         if (formatting) {  // close enough: upgrade...
             if (param->type == "point")
@@ -468,7 +703,8 @@ static ParsedParameterVector parseParameters(
                       std::string(decl.begin(), decl.end()));
 
         auto nameEnd = skipToSpace(nameBegin);
-        param->name.assign(nameBegin, nameEnd);
+        param->name = InternParameterString(
+            decl.substr(nameBegin - decl.begin(), nameEnd - nameBegin));
 
         enum ValType { Unknown, String, Bool, Float, Int } valType = Unknown;
 
@@ -548,7 +784,13 @@ static ParsedParameterVector parseParameters(
 
         Token val = *nextToken(TokenRequired);
 
-        if (val.token == "[") {
+        // Large numeric arrays are parsed directly from the file contents,
+        // bypassing tokenization of the individual values.
+        bool isNumeric = param->type != "string" && param->type != "bool" &&
+                         param->type != "texture";
+        if (val.token == "[" && isNumeric && parseNumbers(param, valType == Int)) {
+            // All the values have been added.
+        } else if (val.token == "[") {
             while (true) {
                 val = *nextToken(TokenRequired);
                 if (val.token == "]")
@@ -580,6 +822,11 @@ static ParsedParameterVector parseParameters(
     return parameterVector;
 }
 
+// Binary scene loading is defined after parse() since the two call each other
+// to handle Include and Import directives.
+static std::unique_ptr<MappedFile> openBinaryScene(const std::string &filename);
+void parseBinary(SceneRepresentation *scene, const MappedFile &file);
+
 void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
     FormattingScene *formattingScene = dynamic_cast<FormattingScene *>(scene);
     bool formatting = formattingScene != nullptr;
@@ -640,6 +887,15 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
         ungetToken = t;
     };
 
+    // parseNumbers parses a numeric array from the current file after its
+    // opening bracket has been returned by nextToken().
+    auto parseNumbers = [&](ParsedParameter *param, bool isInt) {
+        if (ungetToken.has_value() || fileStack.empty())
+            return false;
+        return isInt ? fileStack.back()->ParseNumberArray(&param->ints)
+                     : fileStack.back()->ParseNumberArray(&param->floats);
+    };
+
     // Helper function for pbrt API entrypoints that take a single string
     // parameter and a ParameterVector (e.g. pbrtShape()).
     // using BasicEntrypoint = void (ParsedScene::*)(const std::string &,
@@ -652,7 +908,8 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
             std::string_view dequoted = dequoteString(t);
             std::string n = toString(dequoted);
             ParsedParameterVector parameterVector = parseParameters(
-                nextToken, unget, formatting, [&](const Token &t, const char *msg) {
+                nextToken, unget, parseNumbers, formatting,
+                [&](const Token &t, const char *msg) {
                     std::string token = toString(t.token);
                     std::string str = StringPrintf("%s: %s", token, msg);
                     parseError(str.c_str(), &t.loc);
@@ -740,8 +997,14 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
                            dynamic_cast<FormattingScene *>(scene)->indent(), filename);
                 else {
                     filename = ResolveFilename(filename);
-                    std::unique_ptr<Tokenizer> tinc =
-                        Tokenizer::CreateFromFile(filename, parseError);
+                    // Included binary scenes can be parsed in place since all
+                    // of their directives precede the ones that follow here.
+                    std::unique_ptr<MappedFile> binc = openBinaryScene(filename);
+                    std::unique_ptr<Tokenizer> tinc;
+                    if (binc)
+                        parseBinary(scene, *binc);
+                    else
+                        tinc = Tokenizer::CreateFromFile(filename, parseError);
                     if (tinc) {
                         LOG_VERBOSE("Started parsing %s",
                                     std::string(tinc->loc.filename.begin(),
@@ -755,6 +1018,9 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
                 if (formatting)
                     Printf("%sImport \"%s\"\n",
                            dynamic_cast<FormattingScene *>(scene)->indent(), filename);
+                else if (BinaryFormattingScene *binaryScene =
+                             dynamic_cast<BinaryFormattingScene *>(scene))
+                    binaryScene->Import(filename, tok->loc);
                 else {
                     ParsedScene *parsedScene = dynamic_cast<ParsedScene *>(scene);
                     CHECK(parsedScene != nullptr);
@@ -764,43 +1030,55 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
                                              "definition block.");
 
                     filename = ResolveFilename(filename);
-                    std::unique_ptr<Tokenizer> timport =
-                        Tokenizer::CreateFromFile(filename, parseError);
+                    std::unique_ptr<MappedFile> bimport = openBinaryScene(filename);
+                    std::unique_ptr<Tokenizer> timport;
+                    if (bimport) {
+                        // Binary scenes load quickly enough that there's no
+                        // need for a separate thread.
+                        ParsedScene *importScene = parsedScene->CopyForImport();
+                        parseBinary(importScene, *bimport);
+                        imports.push_back(std::make_pair(std::thread(), importScene));
+                    } else
+                        timport = Tokenizer::CreateFromFile(filename, parseError);
                     if (timport) {
                         ParsedScene *importScene = parsedScene->CopyForImport();
 
+                        // Parse imported file on a new thread if one is available
+                        // Otherwise it is parsed here rather than waiting, so that
+                        // nested imports can't deadlock with all threads blocked.
                         static int maxThreads = MaxThreadIndex();
-                        if (maxThreads == 1) {
-                            parse(importScene, std::move(timport));
-                            parsedScene->MergeImported(importScene);
-                        } else {
-                            static std::mutex importThreadMutex;
-                            static std::condition_variable importThreadCV;
-                            static int nRunningImportThreads = 0;
-
-                            std::unique_lock<std::mutex> lock(importThreadMutex);
-                            while (nRunningImportThreads == maxThreads)
-                                importThreadCV.wait(lock);
+                        static std::mutex importThreadMutex;
+                        static int nRunningImportThreads = 0;
+                        std::unique_lock<std::mutex> lock(importThreadMutex);
+                        bool spawnThread = nRunningImportThreads + 1 < maxThreads;
+                        if (spawnThread)
                             ++nRunningImportThreads;
-                            lock.unlock();
-
-                            std::thread importThread(
-                                [filename](ParsedScene *scene,
-                                           std::unique_ptr<Tokenizer> timport) {
-                                    Timer timer;
-                                    parse(scene, std::move(timport));
-                                    LOG_VERBOSE("Elapsed time to parse \"%s\": %.2fs",
-                                                filename, timer.ElapsedSeconds());
-
-                                    std::unique_lock<std::mutex> lock(importThreadMutex);
+                        lock.unlock();
+
+                        std::thread importThread;
+                        auto parseImport = [filename](
+                                               ParsedScene *scene,
+                                               std::unique_ptr<Tokenizer> timport) {
+                            Timer timer;
+                            parse(scene, std::move(timport));
+                            LOG_VERBOSE("Elapsed time to parse \"%s\": %.2fs", filename,
+                                        timer.ElapsedSeconds());
+                        };
+                        if (spawnThread)
+                            importThread = std::thread(
+                                [parseImport](ParsedScene *scene,
+                                              std::unique_ptr<Tokenizer> timport) {
+                                    parseImport(scene, std::move(timport));
+                                    std::lock_guard<std::mutex> lock(importThreadMutex);
                                     --nRunningImportThreads;
-                                    importThreadCV.notify_all();
-                                    lock.unlock();
                                 },
                                 importScene, std::move(timport));
-                            imports.push_back(
-                                std::make_pair(std::move(importThread), importScene));
-                        }
+                        else
+                            parseImport(importScene, std::move(timport));
+                        // Imported scenes are always merged in file order once parsing
+                        // of this file finishes, independent of the number of threads
+                        imports.push_back(
+                            std::make_pair(std::move(importThread), importScene));
                     }
                 }
             } else if (tok->token == "Identity")
@@ -956,7 +1234,8 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
                 std::string_view dequoted = dequoteString(t);
                 std::string texName = toString(dequoted);
                 ParsedParameterVector params = parseParameters(
-                    nextToken, unget, formatting, [&](const Token &t, const char *msg) {
+                    nextToken, unget, parseNumbers, formatting,
+                    [&](const Token &t, const char *msg) {
                         std::string token = toString(t.token);
                         std::string str = StringPrintf("%s: %s", token, msg);
                         parseError(str.c_str(), &t.loc);
@@ -982,15 +1261,369 @@ void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
     }
 
     for (auto &import : imports) {
-        import.first.join();
+        if (import.first.joinable())
+            import.first.join();
 
         ParsedScene *parsedScene = dynamic_cast<ParsedScene *>(scene);
         CHECK(parsedScene != nullptr);
         parsedScene->MergeImported(import.second);
-        // HACK: let import.second leak so that its TransformCache isn't deallocated...
+        // The imported scene shares our TransformCache, so the transforms
+        // its entities refer to remain valid
+        delete import.second;
     }
 }
 
+// Binary Scene Loading Definitions
+STAT_COUNTER("Scene/Binary scene records", nBinaryRecords);
+STAT_MEMORY_COUNTER("Memory/Binary scene files", binarySceneBytes);
+
+static std::unique_ptr<MappedFile> openBinaryScene(const std::string &filename) {
+    // Only peek at the start of the file here; if it isn't a binary scene,
+    // errors opening it are reported by the Tokenizer.
+    FILE *f = FOpenRead(filename);
+    if (!f)
+        return nullptr;
+    char magic[8];
+    bool isBinary = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+                    memcmp(magic, BinarySceneMagic, sizeof(magic)) == 0;
+    fclose(f);
+    if (!isBinary)
+        return nullptr;
+
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file)
+        ErrorExit("%s: %s", filename, ErrorString());
+    binarySceneBytes += file->size();
+    return file;
+}
+
+// BinarySceneReader Definition
+class BinarySceneReader {
+  public:
+    BinarySceneReader(const MappedFile &file, const FileLoc *loc)
+        : start(file.data()), pos(file.data()), end(file.data() + file.size()),
+          loc(loc) {}
+
+    bool AtEnd() const { return pos == end; }
+
+    void Align(int alignment) {
+        size_t offset = pos - start;
+        Skip((alignment - offset % alignment) % alignment);
+    }
+
+    uint32_t ReadUInt() {
+        uint32_t v;
+        memcpy(&v, Skip(sizeof(v)), sizeof(v));
+        return v;
+    }
+
+    std::string ReadString() {
+        uint32_t length = ReadUInt();
+        const char *ptr = Skip(length);
+        Align(4);
+        return std::string(ptr, length);
+    }
+
+    // Values are copied with memcpy, which handles unaligned data and lets
+    // the compiler move whole arrays at once when Float is a 32-bit float.
+    void ReadFloats(Float *dst, size_t n) {
+        const char *ptr = Skip(n * sizeof(float));
+#ifdef PBRT_FLOAT_AS_DOUBLE
+        for (size_t i = 0; i < n; ++i) {
+            float f;
+            memcpy(&f, ptr + i * sizeof(float), sizeof(float));
+            dst[i] = f;
+        }
+#else
+        memcpy(dst, ptr, n * sizeof(float));
+#endif
+    }
+
+    const char *Skip(size_t n) {
+        if (n > size_t(end - pos))
+            ErrorExit(loc, "unexpected end of binary scene file");
+        return std::exchange(pos, pos + n);
+    }
+
+  private:
+    const char *start, *pos, *end;
+    const FileLoc *loc;
+};
+
+static ParsedParameter *readBinaryParameter(BinarySceneReader &reader, FileLoc loc) {
+    ParsedParameter *param = NewParsedParameter(loc);
+    param->type = InternParameterString(reader.ReadString());
+    param->name = InternParameterString(reader.ReadString());
+    BinaryParameterKind kind = BinaryParameterKind(reader.ReadUInt());
+    uint32_t count = reader.ReadUInt();
+    reader.Align(16);
+
+    switch (kind) {
+    case BinaryParameterKind::Float:
+        param->floats.resize(count);
+        reader.ReadFloats(param->floats.data(), count);
+        break;
+    case BinaryParameterKind::Int:
+        param->ints.resize(count);
+        memcpy(param->ints.data(), reader.Skip(count * sizeof(int32_t)),
+               count * sizeof(int32_t));
+        break;
+    case BinaryParameterKind::Bool:
+        param->bools.resize(count);
+        memcpy(param->bools.data(), reader.Skip(count), count);
+        reader.Align(4);
+        break;
+    case BinaryParameterKind::String:
+        for (uint32_t i = 0; i < count; ++i)
+            param->strings.push_back(reader.ReadString());
+        break;
+    default:
+        ErrorExit(&loc, "%d: unknown parameter kind in binary scene file", int(kind));
+    }
+    return param;
+}
+
+void parseBinary(SceneRepresentation *scene, const MappedFile &file) {
+    FormattingScene *formattingScene = dynamic_cast<FormattingScene *>(scene);
+    BinaryFormattingScene *binaryScene = dynamic_cast<BinaryFormattingScene *>(scene);
+    std::vector<ParsedScene *> imports;
+
+    LOG_VERBOSE("Started parsing binary scene %s", file.Filename());
+    // As with the Tokenizer, the filename is leaked so that FileLocs remain
+    // valid after parsing finishes.
+    FileLoc loc(*new std::string(file.Filename()));
+    BinarySceneReader reader(file, &loc);
+
+    if (memcmp(reader.Skip(8), BinarySceneMagic, 8) != 0)
+        ErrorExit(&loc, "not a binary scene file");
+    if (uint32_t version = reader.ReadUInt(); version != BinarySceneVersion)
+        ErrorExit(&loc, "%d: unsupported binary scene file version", int(version));
+    reader.Align(16);
+
+    std::vector<std::string> strings;
+    std::vector<Float> floats;
+    while (!reader.AtEnd()) {
+        ++nBinaryRecords;
+        BinarySceneDirective directive = BinarySceneDirective(reader.ReadUInt());
+        loc.line = int32_t(reader.ReadUInt());
+        loc.column = int32_t(reader.ReadUInt());
+        uint32_t nStrings = reader.ReadUInt(), nFloats = reader.ReadUInt();
+        uint32_t nParams = reader.ReadUInt();
+
+        strings.clear();
+        for (uint32_t i = 0; i < nStrings; ++i)
+            strings.push_back(reader.ReadString());
+        floats.resize(nFloats);
+        reader.ReadFloats(floats.data(), nFloats);
+        ParsedParameterVector params;
+        for (uint32_t i = 0; i < nParams; ++i)
+            params.push_back(readBinaryParameter(reader, loc));
+
+        // Make sure the record has the arguments its directive expects
+        auto expect = [&](uint32_t ns, uint32_t nf) {
+            if (nStrings != ns || nFloats != nf)
+                ErrorExit(&loc, "malformed record in binary scene file");
+        };
+        auto basicParamListEntrypoint =
+            [&](void (SceneRepresentation::*apiFunc)(const std::string &,
+                                                     ParsedParameterVector, FileLoc)) {
+                expect(1, 0);
+                (scene->*apiFunc)(strings[0], std::move(params), loc);
+            };
+
+        switch (directive) {
+        case BinarySceneDirective::SourceFile:
+            expect(1, 0);
+            loc.filename = *new std::string(strings[0]);
+            break;
+        case BinarySceneDirective::Option:
+            expect(2, 0);
+            scene->Option(strings[0], strings[1], loc);
+            break;
+        case BinarySceneDirective::Identity:
+            expect(0, 0);
+            scene->Identity(loc);
+            break;
+        case BinarySceneDirective::Translate:
+            expect(0, 3);
+            scene->Translate(floats[0], floats[1], floats[2], loc);
+            break;
+        case BinarySceneDirective::Rotate:
+            expect(0, 4);
+            scene->Rotate(floats[0], floats[1], floats[2], floats[3], loc);
+            break;
+        case BinarySceneDirective::Scale:
+            expect(0, 3);
+            scene->Scale(floats[0], floats[1], floats[2], loc);
+            break;
+        case BinarySceneDirective::LookAt:
+            expect(0, 9);
+            scene->LookAt(floats[0], floats[1], floats[2], floats[3], floats[4],
+                          floats[5], floats[6], floats[7], floats[8], loc);
+            break;
+        case BinarySceneDirective::ConcatTransform:
+            expect(0, 16);
+            scene->ConcatTransform(floats.data(), loc);
+            break;
+        case BinarySceneDirective::Transform:
+            expect(0, 16);
+            scene->Transform(floats.data(), loc);
+            break;
+        case BinarySceneDirective::CoordinateSystem:
+            expect(1, 0);
+            scene->CoordinateSystem(strings[0], loc);
+            break;
+        case BinarySceneDirective::CoordSysTransform:
+            expect(1, 0);
+            scene->CoordSysTransform(strings[0], loc);
+            break;
+        case BinarySceneDirective::ActiveTransformAll:
+            expect(0, 0);
+            scene->ActiveTransformAll(loc);
+            break;
+        case BinarySceneDirective::ActiveTransformEndTime:
+            expect(0, 0);
+            scene->ActiveTransformEndTime(loc);
+            break;
+        case BinarySceneDirective::ActiveTransformStartTime:
+            expect(0, 0);
+            scene->ActiveTransformStartTime(loc);
+            break;
+        case BinarySceneDirective::TransformTimes:
+            expect(0, 2);
+            scene->TransformTimes(floats[0], floats[1], loc);
+            break;
+        case BinarySceneDirective::ColorSpace:
+            expect(1, 0);
+            scene->ColorSpace(strings[0], loc);
+            break;
+        case BinarySceneDirective::PixelFilter:
+            basicParamListEntrypoint(&SceneRepresentation::PixelFilter);
+            break;
+        case BinarySceneDirective::Film:
+            basicParamListEntrypoint(&SceneRepresentation::Film);
+            break;
+        case BinarySceneDirective::Sampler:
+            basicParamListEntrypoint(&SceneRepresentation::Sampler);
+            break;
+        case BinarySceneDirective::Accelerator:
+            basicParamListEntrypoint(&SceneRepresentation::Accelerator);
+            break;
+        case BinarySceneDirective::Integrator:
+            basicParamListEntrypoint(&SceneRepresentation::Integrator);
+            break;
+        case BinarySceneDirective::Camera:
+            basicParamListEntrypoint(&SceneRepresentation::Camera);
+            break;
+        case BinarySceneDirective::MakeNamedMedium:
+            basicParamListEntrypoint(&SceneRepresentation::MakeNamedMedium);
+            break;
+        case BinarySceneDirective::MediumInterface:
+            expect(2, 0);
+            scene->MediumInterface(strings[0], strings[1], loc);
+            break;
+        case BinarySceneDirective::WorldBegin:
+            expect(0, 0);
+            scene->WorldBegin(loc);
+            break;
+        case BinarySceneDirective::AttributeBegin:
+            expect(0, 0);
+            scene->AttributeBegin(loc);
+            break;
+        case BinarySceneDirective::AttributeEnd:
+            expect(0, 0);
+            scene->AttributeEnd(loc);
+            break;
+        case BinarySceneDirective::Attribute:
+            basicParamListEntrypoint(&SceneRepresentation::Attribute);
+            break;
+        case BinarySceneDirective::Texture:
+            expect(3, 0);
+            scene->Texture(strings[0], strings[1], strings[2], std::move(params), loc);
+            break;
+        case BinarySceneDirective::Material:
+            basicParamListEntrypoint(&SceneRepresentation::Material);
+            break;
+        case BinarySceneDirective::MakeNamedMaterial:
+            basicParamListEntrypoint(&SceneRepresentation::MakeNamedMaterial);
+            break;
+        case BinarySceneDirective::NamedMaterial:
+            expect(1, 0);
+            scene->NamedMaterial(strings[0], loc);
+            break;
+        case BinarySceneDirective::LightSource:
+            basicParamListEntrypoint(&SceneRepresentation::LightSource);
+            break;
+        case BinarySceneDirective::AreaLightSource:
+            basicParamListEntrypoint(&SceneRepresentation::AreaLightSource);
+            break;
+        case BinarySceneDirective::Shape:
+            basicParamListEntrypoint(&SceneRepresentation::Shape);
+            break;
+        case BinarySceneDirective::ReverseOrientation:
+            expect(0, 0);
+            scene->ReverseOrientation(loc);
+            break;
+        case BinarySceneDirective::ObjectBegin:
+            expect(1, 0);
+            scene->ObjectBegin(strings[0], loc);
+            break;
+        case BinarySceneDirective::ObjectEnd:
+            expect(0, 0);
+            scene->ObjectEnd(loc);
+            break;
+        case BinarySceneDirective::ObjectInstance:
+            expect(1, 0);
+            scene->ObjectInstance(strings[0], loc);
+            break;
+        case BinarySceneDirective::Import: {
+            expect(1, 0);
+            if (formattingScene)
+                Printf("%sImport \"%s\"\n", formattingScene->indent(), strings[0]);
+            else if (binaryScene)
+                binaryScene->Import(strings[0], loc);
+            else {
+                ParsedScene *parsedScene = dynamic_cast<ParsedScene *>(scene);
+                CHECK(parsedScene != nullptr);
+                if (parsedScene->currentBlock != ParsedScene::BlockState::WorldBlock)
+                    ErrorExit(&loc, "Import statement only allowed inside world "
+                                    "definition block.");
+
+                // Binary scenes parse quickly enough that imports are handled
+                // serially; they are merged in file order at the end, as in
+                // parse().
+                std::string filename = ResolveFilename(strings[0]);
+                ParsedScene *importScene = parsedScene->CopyForImport();
+                if (std::unique_ptr<MappedFile> bimport = openBinaryScene(filename))
+                    parseBinary(importScene, *bimport);
+                else {
+                    auto parseError = [](const char *msg, const FileLoc *loc) {
+                        ErrorExit(loc, "%s", msg);
+                    };
+                    std::unique_ptr<Tokenizer> timport =
+                        Tokenizer::CreateFromFile(filename, parseError);
+                    if (timport)
+                        parse(importScene, std::move(timport));
+                }
+                imports.push_back(importScene);
+            }
+            break;
+        }
+        default:
+            ErrorExit(&loc, "%d: unknown directive in binary scene file",
+                      int(directive));
+        }
+    }
+
+    for (ParsedScene *importScene : imports) {
+        ParsedScene *parsedScene = dynamic_cast<ParsedScene *>(scene);
+        CHECK(parsedScene != nullptr);
+        parsedScene->MergeImported(importScene);
+        delete importScene;
+    }
+    LOG_VERBOSE("Finished parsing binary scene %s", file.Filename());
+}
+
 void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filenames) {
     auto tokError = [](const char *msg, const FileLoc *loc) {
         ErrorExit(loc, "%s", msg);
@@ -1005,8 +1638,13 @@ void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filena
     } else {
         // Parse scene from input files
         for (const std::string &fn : filenames) {
-            if (fn != "-")
+            if (fn != "-") {
                 SetSearchDirectory(fn);
+                if (std::unique_ptr<MappedFile> file = openBinaryScene(fn)) {
+                    parseBinary(scene, *file);
+                    continue;
+                }
+            }
 
             std::unique_ptr<Tokenizer> t = Tokenizer::CreateFromFile(fn, tokError);
             if (t)
@@ -23,7 +23,8 @@ namespace pbrt {
 class ParsedParameter {
   public:
     // ParsedParameter Public Methods
-    ParsedParameter(FileLoc loc) : loc(loc) {}
+    ParsedParameter(FileLoc loc, Allocator alloc = {})
+        : loc(loc), floats(alloc), ints(alloc), strings(alloc), bools(alloc) {}
 
     void AddFloat(Float v);
     void AddInt(int i);
@@ -33,7 +34,9 @@ class ParsedParameter {
     std::string ToString() const;
 
     // ParsedParameter Public Members
-    std::string type, name;
+    // Types and names are either string literals or returned by
+    // InternParameterString(), so they remain valid for the life of the program.
+    std::string_view type, name;
     FileLoc loc;
     pstd::vector<Float> floats;
     pstd::vector<int> ints;
@@ -47,6 +50,17 @@ class ParsedParameter {
 // ParsedParameterVector Definition
 using ParsedParameterVector = InlinedVector<ParsedParameter *, 8>;
 
+// ParsedParameter Allocation Declarations
+// The parser allocates parameters and their values from per-thread arenas,
+// which avoids millions of small heap allocations for large scenes. Only
+// parameters with large arrays of values give their memory back when they
+// are destroyed; FreeParsedParameters() frees all of it at once and may only
+// be called once no parsed parameters are in use.
+ParsedParameter *NewParsedParameter(FileLoc loc);
+void FreeParsedParameters();
+
+std::string_view InternParameterString(std::string_view str);
+
 // SceneRepresentation Definition
 class SceneRepresentation {
   public:
@@ -137,6 +151,66 @@ class SceneRepresentation {
 void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filenames);
 void ParseString(SceneRepresentation *scene, std::string str);
 
+// Binary Scene Format Declarations
+// Binary scene files start with the 8-byte BinarySceneMagic string and a 32-bit
+// version number, padded to 16 bytes. A sequence of records follows, one per
+// scene description directive. Each record stores the directive, the line and
+// column of the directive in the original text file, and counts of its string
+// arguments, Float arguments, and parameters; all values are 32-bit and little
+// endian. Strings are stored as a 32-bit length followed by the characters,
+// padded to a multiple of 4 bytes, and Float arguments are stored as 32-bit
+// floats. Each parameter stores its type and name strings, the kind and number
+// of its values and then the values themselves, starting at an offset that is
+// a multiple of 16 bytes, so that the loader can copy numeric arrays out of the
+// mapped file in bulk.
+constexpr char BinarySceneMagic[] = "pbrt-bin";
+constexpr uint32_t BinarySceneVersion = 1;
+
+enum class BinarySceneDirective : uint32_t {
+    SourceFile,
+    Option,
+    Identity,
+    Translate,
+    Rotate,
+    Scale,
+    LookAt,
+    ConcatTransform,
+    Transform,
+    CoordinateSystem,
+    CoordSysTransform,
+    ActiveTransformAll,
+    ActiveTransformEndTime,
+    ActiveTransformStartTime,
+    TransformTimes,
+    ColorSpace,
+    PixelFilter,
+    Film,
+    Sampler,
+    Accelerator,
+    Integrator,
+    Camera,
+    MakeNamedMedium,
+    MediumInterface,
+    WorldBegin,
+    AttributeBegin,
+    AttributeEnd,
+    Attribute,
+    Texture,
+    Material,
+    MakeNamedMaterial,
+    NamedMaterial,
+    LightSource,
+    AreaLightSource,
+    Shape,
+    ReverseOrientation,
+    ObjectBegin,
+    ObjectEnd,
+    ObjectInstance,
+    Import
+};
+
+enum class BinaryParameterKind : uint32_t { Float, Int, String, Bool };
+
 // Token Definition
 struct Token {
     Token() = default;
@@ -167,6 +241,14 @@ class Tokenizer {
 
     pstd::optional<Token> Next();
 
+    // Parses the values of a bracketed numeric array directly from the
+    // input, appending them to *values and consuming the closing bracket;
+    // the opening bracket must already have been returned by Next(). If the
+    // array holds anything other than numbers, false is returned without
+    // consuming any input so that it can be tokenized as usual.
+    bool ParseNumberArray(pstd::vector<Float> *values);
+    bool ParseNumberArray(pstd::vector<int> *values);
+
     // Just for parse().
     // TODO? Have a method to set this?
     FileLoc loc;
@@ -174,6 +256,8 @@ class Tokenizer {
   private:
     // Tokenizer Private Methods
     void CheckUTF(const void *ptr, int len) const;
+    template <typename T, typename ParseValue>
+    bool parseNumberArray(pstd::vector<T> *values, ParseValue parseValue);
 
     int getChar() {
         if (pos == end)
@@ -4,13 +4,20 @@
 
 #include <gtest/gtest.h>
 
+#include <pbrt/film.h>
+#include <pbrt/parsedscene.h>
 #include <pbrt/parser.h>
 #include <pbrt/pbrt.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/rng.h>
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <initializer_list>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace pbrt;
@@ -119,6 +126,72 @@ TEST(Parser, TokenizerErrors) {
     }
 }
 
+TEST(Parser, NumberArray) {
+    std::vector<std::string> errors;
+    auto err = [&](const char *err, const FileLoc *) { errors.push_back(err); };
+
+    // Numbers in a variety of formats and magnitudes should match the values
+    // from strtof()/strtod() exactly.
+    RNG rng;
+    const char *formats[] = {"%.9g", "%f", "%e", "%.3f", "%.0f", "%.17g"};
+    std::string str = "[";
+    std::vector<Float> expected;
+    for (int i = 0; i < 10000; ++i) {
+        double v = (rng.Uniform<double>() - 0.5) *
+                   std::pow(10., int(rng.Uniform<uint32_t>(24)) - 12);
+        char buf[64];
+        snprintf(buf, sizeof(buf), formats[rng.Uniform<uint32_t>(6)], v);
+#ifdef PBRT_FLOAT_AS_DOUBLE
+        expected.push_back(strtod(buf, nullptr));
+#else
+        expected.push_back(strtof(buf, nullptr));
+#endif
+        str += buf;
+        str += (i % 10 == 9) ? "\n" : " ";
+    }
+    str += "] \"next\"";
+
+    auto t = Tokenizer::CreateFromString(str, err);
+    ASSERT_TRUE(t.get() != nullptr);
+    EXPECT_EQ("[", t->Next()->token);
+    pstd::vector<Float> values;
+    ASSERT_TRUE(t->ParseNumberArray(&values));
+    ASSERT_EQ(expected.size(), values.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        EXPECT_EQ(0, memcmp(&expected[i], &values[i], sizeof(Float))) << i;
+    pstd::optional<Token> next = t->Next();
+    ASSERT_TRUE(next.has_value());
+    EXPECT_EQ("\"next\"", next->token);
+    EXPECT_EQ(1001, next->loc.line);
+
+    // Integers
+    t = Tokenizer::CreateFromString("[ 1 -2 +3\t40000 ]", err);
+    EXPECT_EQ("[", t->Next()->token);
+    pstd::vector<int> ints;
+    ASSERT_TRUE(t->ParseNumberArray(&ints));
+    EXPECT_EQ(4, ints.size());
+    EXPECT_EQ(1, ints[0]);
+    EXPECT_EQ(-2, ints[1]);
+    EXPECT_EQ(3, ints[2]);
+    EXPECT_EQ(40000, ints[3]);
+    EXPECT_FALSE(t->Next().has_value());
+
+    // Arrays with anything other than numbers are left for regular
+    // tokenization.
+    for (const char *s :
+         {"[ 1 2 \"three\" ]", "[ 1 # comment\n 2 ]", "[ true ]", "[ 1 2"}) {
+        t = Tokenizer::CreateFromString(s, err);
+        EXPECT_EQ("[", t->Next()->token);
+        values.clear();
+        EXPECT_FALSE(t->ParseNumberArray(&values)) << s;
+        EXPECT_TRUE(values.empty());
+        std::string_view first = t->Next()->token;
+        EXPECT_TRUE(first == "1" || first == "true") << s;
+    }
+
+    EXPECT_TRUE(errors.empty());
+}
+
 TEST(Parser, TokenizeFile) {
     std::string filename = inTestDir("test.tok");
     std::ofstream out(filename);
@@ -144,3 +217,145 @@ Integrator "deep" "float density" [ 2 2.66612 -5e-51]
 
     EXPECT_EQ(0, remove(filename.c_str()));
 }
+
+TEST(Parser, ImportOrder) {
+    // Imported files, including nested imports, are merged in file order
+    // no matter how many of them were parsed in parallel.
+    std::vector<std::pair<std::string, std::string>> files = {
+        {"test-import-a.pbrt",
+         "Shape \"sphere\" \"float radius\" 1\nImport \"test-import-c.pbrt\"\n"},
+        {"test-import-b.pbrt", "Shape \"sphere\" \"float radius\" 2\n"},
+        {"test-import-c.pbrt", "Shape \"sphere\" \"float radius\" 3\n"}};
+    for (const auto &file : files) {
+        std::ofstream out(inTestDir(file.first));
+        out << file.second;
+        out.close();
+        ASSERT_TRUE(out.good());
+    }
+
+    ParsedScene scene;
+    ParseString(&scene, R"(
+WorldBegin
+Shape "sphere" "float radius" 0
+Import "test-import-a.pbrt"
+Import "test-import-b.pbrt"
+Shape "sphere" "float radius" 4
+)");
+    std::vector<Float> radii;
+    for (const ShapeSceneEntity &shape : scene.shapes)
+        radii.push_back(shape.parameters.GetOneFloat("radius", -1));
+    EXPECT_EQ((std::vector<Float>{0, 4, 1, 3, 2}), radii);
+
+    for (const auto &file : files)
+        EXPECT_EQ(0, remove(inTestDir(file.first).c_str()));
+}
+
+TEST(Parser, InternedParameterStrings) {
+    ParsedScene scene;
+    ParseString(&scene, R"(
+WorldBegin
+Shape "sphere" "float radius" 1
+Shape "sphere" "float radius" 2
+)");
+    ASSERT_EQ(2, scene.shapes.size());
+    const ParsedParameter *p0 = scene.shapes[0].parameters.GetParameterVector()[0];
+    const ParsedParameter *p1 = scene.shapes[1].parameters.GetParameterVector()[0];
+    EXPECT_EQ("radius", p0->name);
+    EXPECT_EQ(p0->name.data(), p1->name.data());
+    EXPECT_EQ(p0->type.data(), p1->type.data());
+
+    // Other threads get the same interned strings
+    std::string name = "radius";
+    std::string_view interned;
+    std::thread([&]() { interned = InternParameterString(name); }).join();
+    EXPECT_EQ(p0->name.data(), interned.data());
+}
+
+TEST(Parser, BinaryRoundTrip) {
+    std::string scene = R"(
+WorldBegin
+AttributeBegin
+Translate 1 2 3
+Shape "trianglemesh" "point3 P" [ 0 0 0 1 0 0 0 1 0.5 ]
+    "integer indices" [ 0 1 2 ] "string alpha" "tex" "bool emissive" true
+AttributeEnd
+)";
+    std::string filename = inTestDir("test.pbrtb");
+    FILE *f = fopen(filename.c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    {
+        BinaryFormattingScene binaryScene(f);
+        ParseString(&binaryScene, scene);
+    }
+    fclose(f);
+
+    ParsedScene textScene, binaryScene;
+    ParseString(&textScene, scene);
+    ParseFiles(&binaryScene, {filename});
+    ASSERT_EQ(1, binaryScene.shapes.size());
+
+    const ShapeSceneEntity &text = textScene.shapes[0], &binary = binaryScene.shapes[0];
+    EXPECT_EQ(text.name, binary.name);
+    EXPECT_EQ(text.loc.line, binary.loc.line);
+    EXPECT_EQ(*text.renderFromObject, *binary.renderFromObject);
+    EXPECT_EQ(text.parameters.GetPoint3fArray("P"),
+              binary.parameters.GetPoint3fArray("P"));
+    EXPECT_EQ((std::vector<int>{0, 1, 2}), binary.parameters.GetIntArray("indices"));
+    EXPECT_EQ("tex", binary.parameters.GetOneString("alpha", ""));
+    EXPECT_TRUE(binary.parameters.GetOneBool("emissive", false));
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(TransformCache, Concurrent) {
+    TransformCache cache;
+    std::vector<const Transform *> first(100, nullptr);
+    for (int i = 0; i < 100; ++i)
+        first[i] = cache.Lookup(Translate(Vector3f(i, 0, 0)));
+
+    // Every thread gets the transforms that were cached first
+    ParallelFor(0, 10000, [&](int64_t i) {
+        const Transform *t = cache.Lookup(Translate(Vector3f(i % 100, 0, 0)));
+        EXPECT_EQ(first[i % 100], t);
+    });
+}
+
+TEST(Parser, AnalyzeScene) {
+    ParsedScene scene;
+    ParseString(&scene, R"(
+Film "rgb" "integer xresolution" 200 "integer yresolution" 100
+WorldBegin
+LightSource "infinite"
+ObjectBegin "tri"
+Shape "trianglemesh" "point3 P" [ 0 0 0 1 0 0 0 1 0 1 1 0 ]
+    "integer indices" [ 0 1 2 2 1 3 ]
+ObjectEnd
+ObjectInstance "tri"
+ObjectInstance "tri"
+ObjectInstance "tri"
+Material "diffuse"
+AttributeBegin
+AreaLightSource "diffuse"
+Shape "sphere"
+AttributeEnd
+Material "conductor"
+Shape "disk"
+)");
+    SceneAnalysis analysis = AnalyzeScene(scene);
+    EXPECT_EQ(Point2i(200, 100), analysis.filmResolution);
+    EXPECT_EQ(2, analysis.nTriangles);
+    EXPECT_EQ(2, analysis.nQuadrics);
+    EXPECT_EQ(1, analysis.nInstanceDefinitions);
+    EXPECT_EQ(3, analysis.nInstances);
+    EXPECT_EQ(2 + 3 * 2, analysis.nInstancedPrimitives);
+    EXPECT_EQ(2, analysis.nLights);
+    EXPECT_EQ(1, analysis.nAreaLights);
+    EXPECT_EQ(1, analysis.shapeTypes["trianglemesh"]);
+    EXPECT_EQ(1, analysis.materialTypes["conductor"]);
+    EXPECT_EQ(1, analysis.lightTypes["infinite"]);
+    EXPECT_EQ(1, analysis.lightTypes["diffuse"]);
+    EXPECT_EQ(200 * 100 * RGBFilm::PixelBytes(), analysis.filmBytes);
+    EXPECT_EQ(4 * 3 * sizeof(Float) + 6 * sizeof(int), analysis.meshBytes);
+    EXPECT_GT(analysis.bvhBytes, 0);
+    EXPECT_GT(analysis.gpuBytes, analysis.filmBytes);
+}
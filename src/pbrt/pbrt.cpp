@@ -3,6 +3,7 @@
 // SPDX: Apache-2.0
 
 #include <pbrt/pbrt.h>
+#include <pbrt/bxdfs.h>
 
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <pbrt/gpu/memory.h>
@@ -15,11 +16,15 @@
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/display.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/image.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/tilecache.h>
+#include <pbrt/util/trace.h>
 
 #include <stdlib.h>
 
@@ -29,14 +34,16 @@ namespace pbrt {
 void InitPBRT(const PBRTOptions &opt) {
     Options = new PBRTOptions(opt);
     // API Initialization
+    if (!Options->traceFile.empty())
+        TraceInit(Options->traceFile);
 
 #if defined(PBRT_IS_WINDOWS) && defined(PBRT_BUILD_GPU_RENDERER)
-    if (Options->useGPU && Options->gpuDevice &&
+    if (Options->useGPU && Options->gpuDevice && !Options->multiGPU &&
         getenv("CUDA_VISIBLE_DEVICES") == nullptr) {
         // Limit CUDA to considering only a single GPU on Windows.  pbrt
-        // only uses a single GPU anyway, and if there are multiple GPUs
-        // plugged in with different architectures, pbrt's use of unified
-        // memory causes a performance hit.  We set this early, before CUDA
+        // only uses a single GPU without --multi-gpu anyway, and if there
+        // are multiple GPUs plugged in with different architectures, pbrt's
+        // use of unified memory causes a performance hit.  We set this early, before CUDA
         // gets going...
         std::string env = StringPrintf("CUDA_VISIBLE_DEVICES=%d", *Options->gpuDevice);
         _putenv(env.c_str());
@@ -51,16 +58,29 @@ void InitPBRT(const PBRTOptions &opt) {
 
     InitLogging(opt.logLevel, opt.logFile, Options->useGPU);
 
+#ifdef PBRT_DISABLE_STATS
+    if (Options->printStatistics)
+        Warning("pbrt was built with PBRT_DISABLE_STATS; only the phase timings will "
+                "be reported by --stats.");
+#endif
+
     // General \pbrt Initialization
     int nThreads = Options->nThreads != 0 ? Options->nThreads : AvailableCores();
-    ParallelInit(nThreads);  // Threads must be launched before the
-                             // profiler is initialized.
+    ThreadAffinity affinity = Options->pinThreads ? ThreadAffinity::CPU
+                              : Options->numa     ? ThreadAffinity::NUMANode
+                                                  : ThreadAffinity::None;
+    // Threads must be launched before the profiler is initialized.
+    ParallelInit(nThreads, affinity);
+    if (Options->recordPerfCounters)
+        StatsEnablePerfCounters();
 
     if (Options->useGPU) {
 #ifdef PBRT_BUILD_GPU_RENDERER
         GPUInit();
 
-        CUDA_CHECK(cudaMemcpyToSymbol(OptionsGPU, Options, sizeof(OptionsGPU)));
+        ForEachGPU([](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(OptionsGPU, Options, sizeof(OptionsGPU)));
+        });
 
         ColorEncoding::Init(gpuMemoryAllocator);
         Spectra::Init(gpuMemoryAllocator);
@@ -70,6 +90,8 @@ void InitPBRT(const PBRTOptions &opt) {
         InitBufferCaches(gpuMemoryAllocator);
         Triangle::Init(gpuMemoryAllocator);
         BilinearPatch::Init(gpuMemoryAllocator);
+        MicrofacetAlbedoTable::Init(gpuMemoryAllocator);
+        DielectricAlbedoTable::Init(gpuMemoryAllocator);
 #else
         LOG_FATAL("Options::useGPU set with non-GPU build");
 #endif
@@ -80,17 +102,29 @@ void InitPBRT(const PBRTOptions &opt) {
         RGBToSpectrumTable::Init(Allocator{});
 
         RGBColorSpace::Init(Allocator{});
-        InitBufferCaches({});
+        InitBufferCaches(SubsystemMemory(MemorySubsystem::Meshes),
+                         Options->sharedBufferDirectory);
+        if (!Options->textureCacheDirectory.empty())
+            InitTextureTileCache(Options->textureCacheDirectory,
+                                 size_t(Options->textureCacheMemory) << 20);
         Triangle::Init({});
         BilinearPatch::Init({});
+        MicrofacetAlbedoTable::Init({});
+        DielectricAlbedoTable::Init({});
     }
 
+    if (Options->recordRayStatistics)
+        StatsEnableRayStats();
+
     if (!Options->displayServer.empty())
         ConnectToDisplayServer(Options->displayServer);
 }
 
 void CleanupPBRT() {
-    ForEachThread(ReportThreadStats);
+    FlushImageWrites();
+    FlushFileWrites();
+    TraceWrite();
+    ReportThreadStats();
 
     if (Options->recordPixelStatistics)
         StatsWritePixelImages();
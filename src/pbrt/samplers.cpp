@@ -49,6 +49,19 @@ HaltonSampler::HaltonSampler(int samplesPerPixel, const Point2i &fullRes,
     // Compute multiplicative inverses for _baseScales_
     multInverse[0] = multiplicativeInverse(baseScales[1], baseScales[0]);
     multInverse[1] = multiplicativeInverse(baseScales[0], baseScales[1]);
+
+    // Precompute per-pixel offsets to the first sample's Halton index
+    int sampleStride = baseScales[0] * baseScales[1];
+    int *offsets = alloc.allocate_object<int>(2 * MaxHaltonResolution);
+    for (int i = 0; i < 2; ++i)
+        for (int p = 0; p < MaxHaltonResolution; ++p) {
+            uint64_t dimOffset =
+                InverseRadicalInverse(p, i == 0 ? 2 : 3, baseExponents[i]);
+            offsets[i * MaxHaltonResolution + p] =
+                dimOffset * (sampleStride / baseScales[i]) * multInverse[i] %
+                sampleStride;
+        }
+    pixelOffsets = offsets;
 }
 
 std::vector<Sampler> HaltonSampler::Clone(int n, Allocator alloc) {
@@ -201,9 +214,17 @@ PMJ02BNSampler::PMJ02BNSampler(int samplesPerPixel, int seed, Allocator alloc)
     if (!IsPowerOf4(samplesPerPixel))
         Warning("PMJ02BNSampler results are best with power-of-4 samples per "
                 "pixel (1, 4, 16, 64, ...)");
+    if (samplesPerPixel > nPMJ02bnSamples) {
+        // Generate all samples on the fly when the tables are too small
+        LOG_VERBOSE("PMJ02BNSampler: generating (0,2) samples for %d samples per "
+                    "pixel beyond the %d in its tables", samplesPerPixel,
+                    nPMJ02bnSamples);
+        pixelTileSize = 1;
+        pixelSamples = nullptr;
+        return;
+    }
+
     // Get sorted pmj02bn samples for pixel samples
-    if (samplesPerPixel > nPMJ02bnSamples)
-        Error("PMJ02BNSampler only supports up to %d samples per pixel", nPMJ02bnSamples);
     // Compute _pixelTileSize_ for pmj02bn pixel samples and allocate _pixelSamples_
     pixelTileSize =
         1 << (Log4Int(nPMJ02bnSamples) - Log4Int(RoundUpPow4(samplesPerPixel)));
@@ -261,6 +282,34 @@ std::string PMJ02BNSampler::ToString() const {
                         pixelSamples);
 }
 
+BlueNoiseSampler *BlueNoiseSampler::Create(const ParameterDictionary &parameters,
+                                           const FileLoc *loc, Allocator alloc) {
+    int nsamp = parameters.GetOneInt("pixelsamples", 4);
+    if (Options->pixelSamples)
+        nsamp = *Options->pixelSamples;
+    if (Options->quickRender)
+        nsamp = 1;
+    int seed = parameters.GetOneInt("seed", Options->seed);
+    return alloc.new_object<BlueNoiseSampler>(nsamp, seed);
+}
+
+std::vector<Sampler> BlueNoiseSampler::Clone(int n, Allocator alloc) {
+    std::vector<Sampler> samplers(n);
+    BlueNoiseSampler *samplerMem =
+        (BlueNoiseSampler *)alloc.allocate_object<BlueNoiseSampler>(n);
+    for (int i = 0; i < n; ++i) {
+        alloc.construct(&samplerMem[i], *this);
+        samplers[i] = &samplerMem[i];
+    }
+    return samplers;
+}
+
+std::string BlueNoiseSampler::ToString() const {
+    return StringPrintf("[ BlueNoiseSampler pixel: %s sampleIndex: %d dimension: %d "
+                        "samplesPerPixel: %d seed: %d ]",
+                        pixel, sampleIndex, dimension, samplesPerPixel, seed);
+}
+
 std::string IndependentSampler::ToString() const {
     return StringPrintf("[ IndependentSampler samplesPerPixel: %d seed: %d rng: %s ]",
                         samplesPerPixel, seed, rng);
@@ -471,6 +520,8 @@ Sampler Sampler::Create(const std::string &name, const ParameterDictionary &para
         sampler = SobolSampler::Create(parameters, fullRes, loc, alloc);
     else if (name == "pmj02bn")
         sampler = PMJ02BNSampler::Create(parameters, loc, alloc);
+    else if (name == "bluenoise")
+        sampler = BlueNoiseSampler::Create(parameters, loc, alloc);
     else if (name == "independent")
         sampler = IndependentSampler::Create(parameters, loc, alloc);
     else if (name == "stratified")
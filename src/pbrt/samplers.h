@@ -50,22 +50,14 @@ class HaltonSampler {
 
     PBRT_CPU_GPU
     void StartPixelSample(const Point2i &p, int sampleIndex, int dim) {
-        haltonIndex = 0;
         int sampleStride = baseScales[0] * baseScales[1];
-        // Compute Halton sample offset for first sample in pixel _p_
-        if (sampleStride > 1) {
-            Point2i pm(Mod(p[0], MaxHaltonResolution), Mod(p[1], MaxHaltonResolution));
-            for (int i = 0; i < 2; ++i) {
-                uint64_t dimOffset =
-                    (i == 0) ? InverseRadicalInverse(pm[i], 2, baseExponents[i])
-                             : InverseRadicalInverse(pm[i], 3, baseExponents[i]);
-                haltonIndex +=
-                    dimOffset * (sampleStride / baseScales[i]) * multInverse[i];
-            }
-            haltonIndex %= sampleStride;
-        }
+        // Look up Halton sample offset for first sample in pixel _p_
+        Point2i pm(Mod(p[0], MaxHaltonResolution), Mod(p[1], MaxHaltonResolution));
+        haltonIndex = pixelOffsets[pm[0]] + pixelOffsets[MaxHaltonResolution + pm[1]];
+        if (haltonIndex >= sampleStride)
+            haltonIndex -= sampleStride;
 
-        haltonIndex += sampleIndex * sampleStride;
+        haltonIndex += int64_t(sampleIndex) * sampleStride;
         dimension = std::max(2, dim);
     }
 
@@ -133,6 +125,9 @@ class HaltonSampler {
     RandomizeStrategy randomize;
     pstd::vector<DigitPermutation> *digitPermutations = nullptr;
     static constexpr int MaxHaltonResolution = 128;
+    // Each pixel coordinate's contribution to the Halton index of the pixel's
+    // first sample, modulo the sample stride; x's come first, then y's
+    const int *pixelOffsets = nullptr;
     Point2i baseScales, baseExponents;
     int multInverse[2];
     int64_t haltonIndex = 0;
@@ -258,14 +253,7 @@ class ZSobolSampler {
         ++dimension;
         // Generate 1D Sobol sample at _sampleIndex_
         uint32_t sampleHash = MixBits(dimension ^ seed);
-        if (randomize == RandomizeStrategy::None)
-            return SobolSample(sampleIndex, 0, NoRandomizer());
-        else if (randomize == RandomizeStrategy::PermuteDigits)
-            return SobolSample(sampleIndex, 0, BinaryPermuteScrambler(sampleHash));
-        else if (randomize == RandomizeStrategy::FastOwen)
-            return SobolSample(sampleIndex, 0, FastOwenScrambler(sampleHash));
-        else
-            return SobolSample(sampleIndex, 0, OwenScrambler(sampleHash));
+        return randomizeSample(SobolSampleBits<1>(sampleIndex, 0)[0], sampleHash);
     }
 
     PBRT_CPU_GPU
@@ -274,19 +262,60 @@ class ZSobolSampler {
         dimension += 2;
         // Generate 2D Sobol sample at _sampleIndex_
         uint64_t bits = MixBits(dimension ^ seed);
-        uint32_t sampleHash[2] = {uint32_t(bits), uint32_t(bits >> 32)};
-        if (randomize == RandomizeStrategy::None)
-            return {SobolSample(sampleIndex, 0, NoRandomizer()),
-                    SobolSample(sampleIndex, 1, NoRandomizer())};
-        else if (randomize == RandomizeStrategy::PermuteDigits)
-            return {SobolSample(sampleIndex, 0, BinaryPermuteScrambler(sampleHash[0])),
-                    SobolSample(sampleIndex, 1, BinaryPermuteScrambler(sampleHash[1]))};
-        else if (randomize == RandomizeStrategy::FastOwen)
-            return {SobolSample(sampleIndex, 0, FastOwenScrambler(sampleHash[0])),
-                    SobolSample(sampleIndex, 1, FastOwenScrambler(sampleHash[1]))};
-        else
-            return {SobolSample(sampleIndex, 0, OwenScrambler(sampleHash[0])),
-                    SobolSample(sampleIndex, 1, OwenScrambler(sampleHash[1]))};
+        pstd::array<uint32_t, 2> v = SobolSampleBits<2>(sampleIndex, 0);
+        return {randomizeSample(v[0], uint32_t(bits)),
+                randomizeSample(v[1], uint32_t(bits >> 32))};
+    }
+
+    // Returns the same samples as _N_ successive calls to Get1D() or Get2D(),
+    // but finds all of their sample indices with a single pass over the digits
+    // of the Morton index.
+    template <int N>
+    PBRT_CPU_GPU pstd::array<Float, N> Get1DArray() {
+        pstd::array<uint64_t, N> sampleIndex = GetSampleIndices<N>(1);
+        pstd::array<Float, N> u;
+        for (int i = 0; i < N; ++i) {
+            ++dimension;
+            u[i] = randomizeSample(SobolSampleBits<1>(sampleIndex[i], 0)[0],
+                                   MixBits(dimension ^ seed));
+        }
+        return u;
+    }
+    template <int N>
+    PBRT_CPU_GPU pstd::array<Point2f, N> Get2DArray() {
+        pstd::array<uint64_t, N> sampleIndex = GetSampleIndices<N>(2);
+        pstd::array<Point2f, N> u;
+        for (int i = 0; i < N; ++i) {
+            dimension += 2;
+            uint64_t bits = MixBits(dimension ^ seed);
+            pstd::array<uint32_t, 2> v = SobolSampleBits<2>(sampleIndex[i], 0);
+            u[i] = Point2f(randomizeSample(v[0], uint32_t(bits)),
+                           randomizeSample(v[1], uint32_t(bits >> 32)));
+        }
+        return u;
+    }
+
+    // Returns the samples from a sequence of _N_ Get1D() or Get2D() calls, where
+    // _nDims_ gives the number of dimensions, zero, one or two, taken by each.
+    // Only the _x_ component of one-dimensional samples is set.
+    template <int N>
+    PBRT_CPU_GPU pstd::array<Point2f, N> GetSamples(const pstd::array<int, N> &nDims) {
+        pstd::array<int, N> offsets;
+        for (int i = 0, offset = 0; i < N; offset += nDims[i++])
+            offsets[i] = offset;
+        pstd::array<uint64_t, N> sampleIndex = GetSampleIndices<N>(offsets);
+
+        pstd::array<Point2f, N> u;
+        for (int i = 0; i < N; ++i) {
+            if (nDims[i] == 0)
+                continue;
+            dimension += nDims[i];
+            uint64_t bits = MixBits(dimension ^ seed);
+            pstd::array<uint32_t, 2> v = SobolSampleBits<2>(sampleIndex[i], 0);
+            u[i].x = randomizeSample(v[0], uint32_t(bits));
+            u[i].y = nDims[i] == 2 ? randomizeSample(v[1], uint32_t(bits >> 32)) : 0;
+        }
+        return u;
     }
 
     PBRT_CPU_GPU
@@ -296,7 +325,23 @@ class ZSobolSampler {
     std::string ToString() const;
 
     PBRT_CPU_GPU
-    uint64_t GetSampleIndex() const {
+    uint64_t GetSampleIndex() const { return GetSampleIndices<1>(1)[0]; }
+
+    // Returns the sample indices for the _N_ dimensions starting at the current
+    // one that are _dimensionStride_ apart
+    template <int N>
+    PBRT_CPU_GPU pstd::array<uint64_t, N> GetSampleIndices(int dimensionStride) const {
+        pstd::array<int, N> offsets;
+        for (int j = 0; j < N; ++j)
+            offsets[j] = j * dimensionStride;
+        return GetSampleIndices<N>(offsets);
+    }
+
+    // Returns the sample indices for the _N_ dimensions at the given offsets
+    // from the current one
+    template <int N>
+    PBRT_CPU_GPU pstd::array<uint64_t, N> GetSampleIndices(
+        const pstd::array<int, N> &dimensionOffsets) const {
         // Define the full set of 4-way permutations in _permutations_
         static const uint8_t permutations[24][4] = {
             {0, 1, 2, 3},
@@ -327,7 +372,12 @@ class ZSobolSampler {
 
         };
 
-        uint64_t sampleIndex = 0;
+        pstd::array<uint64_t, N> sampleIndex;
+        pstd::array<int, N> dimensionHash;
+        for (int j = 0; j < N; ++j) {
+            sampleIndex[j] = 0;
+            dimensionHash[j] = 0x55555555 * (dimension + dimensionOffsets[j]);
+        }
         // Apply random permutations to full base-4 digits
         bool pow2Samples = log2SamplesPerPixel & 1;
         int lastDigit = pow2Samples ? 1 : 0;
@@ -335,25 +385,38 @@ class ZSobolSampler {
             // Randomly permute $i$th base 4 digit in _mortonIndex_
             int digitShift = 2 * i - (pow2Samples ? 1 : 0);
             int digit = (mortonIndex >> digitShift) & 3;
-            // Choose permutation _p_ to use for _digit_
             uint64_t higherDigits = mortonIndex >> (digitShift + 2);
-            int p = (MixBits(higherDigits ^ (0x55555555 * dimension)) >> 24) % 24;
-
-            digit = permutations[p][digit];
-            sampleIndex |= uint64_t(digit) << digitShift;
+            for (int j = 0; j < N; ++j) {
+                // Choose permutation _p_ to use for _digit_ in dimension _j_
+                int p = (MixBits(higherDigits ^ dimensionHash[j]) >> 24) % 24;
+                sampleIndex[j] |= uint64_t(permutations[p][digit]) << digitShift;
+            }
         }
 
         // Handle power-of-2 (but not 4) sample count
         if (pow2Samples) {
             int digit = mortonIndex & 1;
-            sampleIndex |=
-                digit ^ (MixBits((mortonIndex >> 1) ^ (0x55555555 * dimension)) & 1);
+            for (int j = 0; j < N; ++j)
+                sampleIndex[j] |=
+                    digit ^ (MixBits((mortonIndex >> 1) ^ dimensionHash[j]) & 1);
         }
 
         return sampleIndex;
     }
 
   private:
+    // ZSobolSampler Private Methods
+    PBRT_CPU_GPU
+    Float randomizeSample(uint32_t v, uint32_t sampleHash) const {
+        if (randomize == RandomizeStrategy::PermuteDigits)
+            v = BinaryPermuteScrambler(sampleHash)(v);
+        else if (randomize == RandomizeStrategy::FastOwen)
+            v = FastOwenScrambler(sampleHash)(v);
+        else if (randomize == RandomizeStrategy::Owen)
+            v = OwenScrambler(sampleHash)(v);
+        return std::min(v * 0x1p-32f, FloatOneMinusEpsilon);
+    }
+
     // ZSobolSampler Private Members
     RandomizeStrategy randomize;
     int seed, log2SamplesPerPixel, nBase4Digits;
@@ -396,6 +459,8 @@ class PMJ02BNSampler {
 
     PBRT_CPU_GPU
     Point2f GetPixel2D() {
+        if (!pixelSamples)
+            return Sample02(sampleIndex, Hash(pixel, seed));
         int px = pixel.x % pixelTileSize, py = pixel.y % pixelTileSize;
         int offset = (px + py * pixelTileSize) * samplesPerPixel;
         return (*pixelSamples)[offset + sampleIndex];
@@ -403,19 +468,25 @@ class PMJ02BNSampler {
 
     PBRT_CPU_GPU
     Point2f Get2D() {
-        // Compute index for 2D pmj02bn sample
-        int index = sampleIndex;
-        int pmjInstance = dimension / 2;
-        if (pmjInstance >= nPMJ02bnSets) {
-            // Permute index to be used for pmj02bn sample array
-            uint64_t hash =
-                MixBits(((uint64_t)pixel.x << 48) ^ ((uint64_t)pixel.y << 32) ^
-                        ((uint64_t)dimension << 16) ^ seed);
-            index = PermutationElement(sampleIndex, samplesPerPixel, hash);
+        Point2f u;
+        if (samplesPerPixel > nPMJ02bnSamples)
+            // Generate $(0,2)$ sample for sample counts beyond the pmj02bn tables
+            u = Sample02(sampleIndex, Hash(pixel, dimension, seed));
+        else {
+            // Compute index for 2D pmj02bn sample
+            int index = sampleIndex;
+            int pmjInstance = dimension / 2;
+            if (pmjInstance >= nPMJ02bnSets) {
+                // Permute index to be used for pmj02bn sample array
+                uint64_t hash =
+                    MixBits(((uint64_t)pixel.x << 48) ^ ((uint64_t)pixel.y << 32) ^
+                            ((uint64_t)dimension << 16) ^ seed);
+                index = PermutationElement(sampleIndex, samplesPerPixel, hash);
+            }
+            u = GetPMJ02BNSample(pmjInstance, index);
         }
 
         // Return randomized pmj02bn sample for current dimension
-        Point2f u = GetPMJ02BNSample(pmjInstance, index);
         // Apply Cranley-Patterson rotation to pmj02bn sample _u_
         u += Vector2f(BlueNoise(dimension, pixel), BlueNoise(dimension + 1, pixel));
         if (u.x >= 1)
@@ -431,6 +502,17 @@ class PMJ02BNSampler {
     std::string ToString() const;
 
   private:
+    // PMJ02BNSampler Private Methods
+    PBRT_CPU_GPU
+    static Point2f Sample02(int index, uint64_t hash) {
+        // The first two Owen-scrambled Sobol dimensions are a $(0,2)$-sequence;
+        // truncate to _float_ precision so that rounding cannot cross strata
+        pstd::array<uint32_t, 2> v = SobolSampleBits<2>(index, 0);
+        v[0] = OwenScrambler(uint32_t(hash))(v[0]);
+        v[1] = OwenScrambler(uint32_t(hash >> 32))(v[1]);
+        return Point2f((v[0] >> 8) * 0x1p-24f, (v[1] >> 8) * 0x1p-24f);
+    }
+
     // PMJ02BNSampler Private Members
     int samplesPerPixel, seed;
     int pixelTileSize;
@@ -439,6 +521,83 @@ class PMJ02BNSampler {
     int sampleIndex, dimension;
 };
 
+// BlueNoiseSampler Definition
+// Intended for previews at a few samples per pixel: each dimension's samples
+// in a pixel come from an Owen-scrambled Sobol sequence that is shared by all
+// pixels and Cranley-Patterson rotated by a blue noise texture. The error for
+// any one sample index is thus distributed as blue noise in screen space, and
+// successive sample indices rotate the same pattern through the sequence.
+class BlueNoiseSampler {
+  public:
+    // BlueNoiseSampler Public Methods
+    BlueNoiseSampler(int samplesPerPixel, int seed = 0)
+        : samplesPerPixel(samplesPerPixel), seed(seed) {}
+
+    static BlueNoiseSampler *Create(const ParameterDictionary &parameters,
+                                    const FileLoc *loc, Allocator alloc);
+    PBRT_CPU_GPU
+    static constexpr const char *Name() { return "BlueNoiseSampler"; }
+
+    PBRT_CPU_GPU
+    int SamplesPerPixel() const { return samplesPerPixel; }
+
+    PBRT_CPU_GPU
+    void StartPixelSample(const Point2i &p, int index, int dim) {
+        pixel = p;
+        sampleIndex = index;
+        dimension = dim;
+    }
+
+    PBRT_CPU_GPU
+    Float Get1D() {
+        uint32_t hash = MixBits(dimension ^ seed);
+        Float u = SobolSample(sampleIndex, 0, FastOwenScrambler(hash));
+        u = rotate(u, dimension);
+        ++dimension;
+        return u;
+    }
+
+    PBRT_CPU_GPU
+    Point2f Get2D() {
+        uint64_t hash = MixBits(dimension ^ seed);
+        Point2f u(SobolSample(sampleIndex, 0, FastOwenScrambler(uint32_t(hash))),
+                  SobolSample(sampleIndex, 1, FastOwenScrambler(uint32_t(hash >> 32))));
+        u = Point2f(rotate(u.x, dimension), rotate(u.y, dimension + 1));
+        dimension += 2;
+        return u;
+    }
+
+    PBRT_CPU_GPU
+    Point2f GetPixel2D() { return Get2D(); }
+
+    std::vector<Sampler> Clone(int n, Allocator alloc);
+    std::string ToString() const;
+
+  private:
+    // BlueNoiseSampler Private Methods
+    PBRT_CPU_GPU
+    Float rotate(Float u, int dim) const {
+        // Dimensions that reuse a blue noise texture look it up at an offset
+        // so that they aren't correlated with the earlier ones
+        Point2i p(pixel.x & (BlueNoiseResolution - 1),
+                  pixel.y & (BlueNoiseResolution - 1));
+        if (int repeat = dim / NumBlueNoiseTextures; repeat > 0) {
+            uint64_t offset = MixBits(repeat ^ seed);
+            p.x += offset & (BlueNoiseResolution - 1);
+            p.y += (offset >> 32) & (BlueNoiseResolution - 1);
+        }
+        u += BlueNoise(dim, p);
+        if (u >= 1)
+            u -= 1;
+        return std::min(u, OneMinusEpsilon);
+    }
+
+    // BlueNoiseSampler Private Members
+    int samplesPerPixel, seed;
+    Point2i pixel;
+    int sampleIndex, dimension;
+};
+
 // IndependentSampler Definition
 class IndependentSampler {
   public:
@@ -456,8 +615,8 @@ class IndependentSampler {
 
     PBRT_CPU_GPU
     void StartPixelSample(const Point2i &p, int sampleIndex, int dimension) {
-        rng.SetSequence((p.x + p.y * 65536) | (uint64_t(seed) << 32));
-        rng.Advance(sampleIndex * 65536 + dimension);
+        rng.SetSequence(Hash(p, seed));
+        rng.Advance((uint64_t(sampleIndex) << 16) + dimension);
     }
 
     PBRT_CPU_GPU
@@ -588,8 +747,8 @@ class StratifiedSampler {
         pixel = p;
         sampleIndex = index;
         dimension = dim;
-        rng.SetSequence((p.x + p.y * 65536) | (uint64_t(seed) << 32));
-        rng.Advance(sampleIndex * 65536 + dimension);
+        rng.SetSequence(Hash(p, seed));
+        rng.Advance((uint64_t(sampleIndex) << 16) + dimension);
     }
 
     PBRT_CPU_GPU
@@ -641,6 +800,7 @@ class MLTSampler {
                Float largeStepProbability, int streamCount)
         : mutationsPerPixel(mutationsPerPixel),
           rng(MixBits(rngSequenceIndex) ^ MixBits(Options->seed)),
+          seed(Options->seed),
           sigma(sigma),
           largeStepProbability(largeStepProbability),
           streamCount(streamCount) {}
@@ -662,8 +822,8 @@ class MLTSampler {
 
     PBRT_CPU_GPU
     void StartPixelSample(const Point2i &p, int sampleIndex, int dim) {
-        rng.SetSequence(p.x + p.y * 65536);
-        rng.Advance(sampleIndex * 65536 + dim * 8192);
+        rng.SetSequence(Hash(p, seed));
+        rng.Advance((uint64_t(sampleIndex) << 16) + uint64_t(dim) * 8192);
     }
 
     PBRT_CPU_GPU
@@ -726,6 +886,7 @@ class MLTSampler {
     // MLTSampler Private Members
     int mutationsPerPixel;
     RNG rng;
+    int seed;
     Float sigma, largeStepProbability;
     int streamCount;
     pstd::vector<PrimarySample> X;
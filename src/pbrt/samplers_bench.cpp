@@ -0,0 +1,71 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/samplers.h>
+
+using namespace pbrt;
+
+// Sampler micro-benchmarks: each benchmark generates samples the way the
+// CPU integrators do, visiting the pixels of a tile in scanline order and
+// taking all of a pixel's samples before moving on, with the benchmark's
+// argument giving the number of 2D sample dimensions consumed per pixel
+// sample. The "time/sample" counter reports the cost of a single Get2D()
+// call. Run with --benchmark_format=json for machine-readable output, and
+// with --benchmark_perf_counters=CYCLES,CACHE-MISSES to also report cache
+// behavior where Google Benchmark was built with libpfm.
+
+static constexpr int BenchmarkSpp = 16;
+static const Point2i BenchmarkResolution(64, 64);
+
+static void BenchmarkGet2D(benchmark::State &state, Sampler sampler) {
+    int nDimensions = state.range(0);
+    Point2i pPixel(0, 0);
+    int sampleIndex = 0;
+    int64_t nSamples = 0;
+
+    for (auto _ : state) {
+        sampler.StartPixelSample(pPixel, sampleIndex);
+        for (int i = 0; i < nDimensions; ++i)
+            benchmark::DoNotOptimize(sampler.Get2D());
+        nSamples += nDimensions;
+
+        // Advance to the next pixel sample
+        if (++sampleIndex == BenchmarkSpp) {
+            sampleIndex = 0;
+            if (++pPixel.x == BenchmarkResolution.x) {
+                pPixel.x = 0;
+                if (++pPixel.y == BenchmarkResolution.y)
+                    pPixel.y = 0;
+            }
+        }
+    }
+
+    state.SetItemsProcessed(nSamples);
+    state.counters["time/sample"] = benchmark::Counter(
+        nSamples, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+#define PBRT_SAMPLER_BENCHMARK(name, ...)            \
+    static void BM_##name(benchmark::State &state) { \
+        BenchmarkGet2D(state, __VA_ARGS__);          \
+    }                                                \
+    BENCHMARK(BM_##name)->RangeMultiplier(4)->Range(2, 128)
+
+PBRT_SAMPLER_BENCHMARK(IndependentSampler, new IndependentSampler(BenchmarkSpp));
+PBRT_SAMPLER_BENCHMARK(HaltonSampler, new HaltonSampler(BenchmarkSpp, BenchmarkResolution,
+                                                        RandomizeStrategy::PermuteDigits));
+PBRT_SAMPLER_BENCHMARK(PaddedSobolSampler,
+                       new PaddedSobolSampler(BenchmarkSpp, RandomizeStrategy::FastOwen));
+PBRT_SAMPLER_BENCHMARK(ZSobolSampler, new ZSobolSampler(BenchmarkSpp, BenchmarkResolution,
+                                                        RandomizeStrategy::FastOwen));
+PBRT_SAMPLER_BENCHMARK(ZSobolOwenSampler,
+                       new ZSobolSampler(BenchmarkSpp, BenchmarkResolution,
+                                         RandomizeStrategy::Owen));
+PBRT_SAMPLER_BENCHMARK(PMJ02BNSampler, new PMJ02BNSampler(BenchmarkSpp));
+PBRT_SAMPLER_BENCHMARK(SobolSampler, new SobolSampler(BenchmarkSpp, BenchmarkResolution,
+                                                      RandomizeStrategy::FastOwen));
@@ -8,6 +8,8 @@
 
 #include <pbrt/samplers.h>
 
+#include <algorithm>
+#include <map>
 #include <set>
 
 using namespace pbrt;
@@ -31,6 +33,7 @@ TEST(Sampler, ConsistentValues) {
     samplers.push_back(new ZSobolSampler(spp, resolution, RandomizeStrategy::FastOwen));
     samplers.push_back(new ZSobolSampler(spp, resolution, RandomizeStrategy::Owen));
     samplers.push_back(new PMJ02BNSampler(spp));
+    samplers.push_back(new BlueNoiseSampler(spp));
     samplers.push_back(new StratifiedSampler(rootSpp, rootSpp, true));
     samplers.push_back(new SobolSampler(spp, resolution, RandomizeStrategy::None));
     samplers.push_back(new SobolSampler(spp, resolution, RandomizeStrategy::PermuteDigits));
@@ -69,6 +72,69 @@ TEST(Sampler, ConsistentValues) {
     }
 }
 
+// Rendering an image as independent tiles, each with its own sampler and
+// in any order, should give exactly the same sample values as rendering it
+// all at once; distributed rendering relies on this.
+TEST(Sampler, TileSplitInvariance) {
+    constexpr int rootSpp = 2;
+    constexpr int spp = rootSpp * rootSpp;
+    Point2i resolution(100, 101);
+    Bounds2i pixelBounds(Point2i(3, 2), Point2i(15, 10));
+    constexpr int tileSize = 4;
+
+    std::vector<Sampler> samplers;
+    samplers.push_back(new HaltonSampler(spp, resolution));
+    samplers.push_back(new IndependentSampler(spp));
+    samplers.push_back(new PaddedSobolSampler(spp, RandomizeStrategy::FastOwen));
+    samplers.push_back(new ZSobolSampler(spp, resolution, RandomizeStrategy::FastOwen));
+    samplers.push_back(new PMJ02BNSampler(spp));
+    samplers.push_back(new BlueNoiseSampler(spp));
+    samplers.push_back(new StratifiedSampler(rootSpp, rootSpp, true));
+    samplers.push_back(new SobolSampler(spp, resolution, RandomizeStrategy::Owen));
+
+    auto generate = [](Sampler sampler, Point2i p, int sampleIndex) {
+        std::vector<Float> values;
+        sampler.StartPixelSample(p, sampleIndex);
+        Point2f pPixel = sampler.GetPixel2D();
+        values.push_back(pPixel.x);
+        values.push_back(pPixel.y);
+        for (int i = 0; i < 8; ++i) {
+            Point2f u = sampler.Get2D();
+            values.push_back(u.x);
+            values.push_back(u.y);
+            values.push_back(sampler.Get1D());
+        }
+        return values;
+    };
+
+    for (Sampler &sampler : samplers) {
+        // Generate reference values with a single sampler, pixel by pixel
+        Sampler reference = sampler.Clone(1)[0];
+        std::map<std::pair<int, int>, std::vector<Float>> expected[spp];
+        for (Point2i p : pixelBounds)
+            for (int s = 0; s < spp; ++s)
+                expected[s][std::make_pair(p.x, p.y)] = generate(reference, p, s);
+
+        // Regenerate them tile by tile in reverse order, sample-major within
+        // each tile, with a fresh sampler for each tile
+        std::vector<Bounds2i> tiles;
+        for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; y += tileSize)
+            for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; x += tileSize)
+                tiles.push_back(Intersect(
+                    Bounds2i({x, y}, {x + tileSize, y + tileSize}), pixelBounds));
+        std::reverse(tiles.begin(), tiles.end());
+        for (const Bounds2i &tile : tiles) {
+            Sampler tileSampler = sampler.Clone(1)[0];
+            for (int s = spp - 1; s >= 0; --s)
+                for (Point2i p : tile) {
+                    std::pair<int, int> key(p.x, p.y);
+                    EXPECT_EQ(expected[s][key], generate(tileSampler, p, s))
+                        << sampler.ToString() << " p " << p << " sample " << s;
+                }
+        }
+    }
+}
+
 static void checkElementary(const char *name, std::vector<Point2f> samples,
                             int logSamples) {
     for (int i = 0; i <= logSamples; ++i) {
@@ -164,6 +230,26 @@ TEST(PMJ02BNSampler, ElementaryIntervals) {
                                logSamples);
 }
 
+TEST(PMJ02BNSampler, TableElementaryIntervals) {
+    // Check the tables' samples directly, as reconstructed from their
+    // compact representation.
+    std::vector<Point2f> samples(nPMJ02bnSamples);
+    for (int set = 0; set < nPMJ02bnSets; ++set) {
+        for (int i = 0; i < nPMJ02bnSamples; ++i) {
+            samples[i] = GetPMJ02BNSample(set, i);
+            ASSERT_LT(samples[i].x, 1);
+            ASSERT_LT(samples[i].y, 1);
+        }
+        checkElementary("PMJ02BN table", samples, Log2Int(nPMJ02bnSamples));
+    }
+}
+
+TEST(PMJ02BNSampler, BeyondTables) {
+    // Pixel samples for counts beyond the tables' are generated on the fly.
+    PMJ02BNSampler sampler(4 * nPMJ02bnSamples);
+    checkElementarySampler("PMJ02BNSampler", &sampler, Log2Int(4 * nPMJ02bnSamples));
+}
+
 TEST(ZSobolSampler, ValidIndices) {
     Point2i res(16, 9);
     for (int logSamples = 0; logSamples <= 10; ++logSamples) {
@@ -193,3 +279,74 @@ TEST(ZSobolSampler, ValidIndices) {
         }
     }
 }
+
+TEST(ZSobolSampler, SampleArrays) {
+    Point2i res(16, 9);
+    for (RandomizeStrategy rand :
+         {RandomizeStrategy::None, RandomizeStrategy::PermuteDigits,
+          RandomizeStrategy::FastOwen, RandomizeStrategy::Owen}) {
+        for (int logSamples = 0; logSamples <= 5; ++logSamples) {
+            ZSobolSampler sampler(1 << logSamples, res, rand, 3);
+            ZSobolSampler arraySampler = sampler;
+            for (Point2i p : Bounds2i(Point2i(0, 0), res)) {
+                // The sample arrays should match successive individual samples
+                sampler.StartPixelSample(p, 1 % sampler.SamplesPerPixel(), 2);
+                arraySampler.StartPixelSample(p, 1 % sampler.SamplesPerPixel(), 2);
+                pstd::array<Float, 3> u1 = arraySampler.Get1DArray<3>();
+                pstd::array<Point2f, 2> u2 = arraySampler.Get2DArray<2>();
+                for (int i = 0; i < 3; ++i)
+                    EXPECT_EQ(sampler.Get1D(), u1[i]);
+                for (int i = 0; i < 2; ++i)
+                    EXPECT_EQ(sampler.Get2D(), u2[i]);
+                EXPECT_EQ(sampler.Get1D(), arraySampler.Get1D());
+            }
+        }
+    }
+}
+
+TEST(ZSobolSampler, BatchedSamples) {
+    Point2i res(16, 9);
+    for (RandomizeStrategy rand :
+         {RandomizeStrategy::PermuteDigits, RandomizeStrategy::FastOwen}) {
+        for (int logSamples = 0; logSamples <= 5; ++logSamples) {
+            ZSobolSampler sampler(1 << logSamples, res, rand, 7);
+            ZSobolSampler batchSampler = sampler;
+            for (Point2i p : Bounds2i(Point2i(0, 0), res)) {
+                // Batched samples should match the corresponding individual
+                // Get1D() and Get2D() calls, skipping unused entries
+                int index = 3 % sampler.SamplesPerPixel();
+                sampler.StartPixelSample(p, index, 6);
+                batchSampler.StartPixelSample(p, index, 6);
+                pstd::array<int, 6> nDims = {1, 2, 0, 2, 1, 1};
+                pstd::array<Point2f, 6> u = batchSampler.GetSamples<6>(nDims);
+                for (int i = 0; i < 6; ++i) {
+                    if (nDims[i] == 1)
+                        EXPECT_EQ(sampler.Get1D(), u[i].x);
+                    else if (nDims[i] == 2)
+                        EXPECT_EQ(sampler.Get2D(), u[i]);
+                }
+                EXPECT_EQ(sampler.Get2D(), batchSampler.Get2D());
+            }
+        }
+    }
+}
+
+TEST(BlueNoiseSampler, Stratified) {
+    // Each pixel's samples in a dimension are a rotated (0,1)-sequence, so
+    // with wraparound no gap between successive values is more than 2/spp
+    constexpr int spp = 16;
+    BlueNoiseSampler sampler(spp);
+    for (Point2i p : {Point2i(0, 0), Point2i(17, 3), Point2i(130, 250)})
+        for (int dim = 0; dim < 100; ++dim) {
+            std::vector<Float> u;
+            for (int i = 0; i < spp; ++i) {
+                sampler.StartPixelSample(p, i, dim);
+                u.push_back(sampler.Get1D());
+            }
+            std::sort(u.begin(), u.end());
+            for (int i = 0; i < spp; ++i) {
+                Float gap = (i + 1 < spp) ? u[i + 1] - u[i] : u[0] + 1 - u[i];
+                EXPECT_LE(gap, 2.f / spp + 1e-6f) << p << " dim " << dim;
+            }
+        }
+}
@@ -28,6 +28,8 @@
 #include <cuda.h>
 #endif
 
+#include <cstring>
+
 namespace pbrt {
 
 // Sphere Method Definitions
@@ -157,8 +159,10 @@ void Triangle::Init(Allocator alloc) {
     allMeshes = alloc.new_object<pstd::vector<const TriangleMesh *>>(alloc);
 #if defined(PBRT_BUILD_GPU_RENDERER)
     if (Options->useGPU)
-        CUDA_CHECK(
-            cudaMemcpyToSymbol(allTriangleMeshesGPU, &allMeshes, sizeof(allMeshes)));
+        ForEachGPU([&](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(allTriangleMeshesGPU, &allMeshes,
+                                          sizeof(allMeshes)));
+        });
 #endif
 }
 
@@ -268,6 +272,97 @@ pstd::optional<TriangleIntersection> IntersectTriangle(const Ray &ray, Float tMa
     return TriangleIntersection{b0, b1, b2, t};
 }
 
+// TriangleBatch Method Definitions
+int TriangleBatch::Candidates(const Ray &ray) const {
+    // Permute and shear as in IntersectTriangle()
+    int kz = MaxComponentIndex(Abs(ray.d));
+    int kx = kz + 1;
+    if (kx == 3)
+        kx = 0;
+    int ky = kx + 1;
+    if (ky == 3)
+        ky = 0;
+    Vector3f d = Permute(ray.d, {kx, ky, kz});
+    Float Sx = -d.x / d.z;
+    Float Sy = -d.y / d.z;
+    Float ox = ray.o[kx], oy = ray.o[ky], oz = ray.o[kz];
+
+    // Compute sheared vertex $x$ and $y$ and bounds on their rounding error
+    Float x[3][Width], y[3][Width], xErr[3][Width], yErr[3][Width];
+    for (int v = 0; v < 3; ++v)
+        for (int i = 0; i < Width; ++i) {
+            Float dx = p[v][kx][i] - ox, dy = p[v][ky][i] - oy, dz = p[v][kz][i] - oz;
+            x[v][i] = dx + Sx * dz;
+            y[v][i] = dy + Sy * dz;
+            xErr[v][i] = gamma(4) * (std::abs(dx) + std::abs(Sx * dz));
+            yErr[v][i] = gamma(4) * (std::abs(dy) + std::abs(Sy * dz));
+        }
+
+    // Compute edge functions for all triangles with conservative error bounds
+    // Triangles are only rejected where the edge functions have differing signs
+    // even after accounting for the error in both this test and
+    // IntersectTriangle()'s.
+    int mask = 0;
+    for (int i = 0; i < Width; ++i) {
+        bool anyNeg = false, anyPos = false;
+        for (int e = 0; e < 3; ++e) {
+            int a = (e + 1) % 3, b = (e + 2) % 3;
+            Float ab = x[a][i] * y[b][i], ba = y[a][i] * x[b][i];
+            Float edge = ab - ba;
+            Float err = std::abs(x[a][i]) * yErr[b][i] + std::abs(y[b][i]) * xErr[a][i] +
+                        std::abs(y[a][i]) * xErr[b][i] + std::abs(x[b][i]) * yErr[a][i] +
+                        xErr[a][i] * yErr[b][i] + yErr[a][i] * xErr[b][i] +
+                        gamma(2) * (std::abs(ab) + std::abs(ba));
+            err = 2 * (1 + gamma(4)) * err;
+            anyNeg |= edge < -err;
+            anyPos |= edge > err;
+        }
+        mask |= int(!(anyNeg && anyPos)) << i;
+    }
+    return mask & ((1 << count) - 1);
+}
+
+// Returns the sums of the magnitudes of the products in the components of
+// Cross(_a_, _b_)
+static Vector3f AbsCross(Vector3f a, Vector3f b) {
+    return Vector3f(std::abs(a.y * b.z) + std::abs(a.z * b.y),
+                    std::abs(a.z * b.x) + std::abs(a.x * b.z),
+                    std::abs(a.x * b.y) + std::abs(a.y * b.x));
+}
+
+// PrecomputedTriangle Method Definitions
+bool PrecomputedTriangle::MayIntersect(const Ray &ray, Float tMax) const {
+    // Compute scaled barycentrics and $t$ of the ray's plane intersection with
+    // Cramer's rule, using the precomputed normal
+    Vector3f s = ray.o - p0, r = Cross(s, ray.d);
+    Float det = -Dot(ray.d, n);
+    Float b1 = Dot(e2, r), b2 = -Dot(e1, r), t = Dot(s, n);
+    if (det < 0) {
+        det = -det;
+        b1 = -b1;
+        b2 = -b2;
+        t = -t;
+    }
+
+    // Bound rounding error in these values; the bounds are doubled so that they
+    // also cover the error in IntersectTriangle()'s watertight test
+    Vector3f sd = AbsCross(s, ray.d), e12 = AbsCross(e1, e2);
+    Float detErr = 2 * gamma(9) * Dot(Abs(ray.d), e12);
+    Float b1Err = 2 * gamma(9) * Dot(Abs(e2), sd);
+    Float b2Err = 2 * gamma(9) * Dot(Abs(e1), sd);
+    Float tErr = 2 * gamma(9) * Dot(Abs(s), e12);
+    // Rays that are nearly parallel to the triangle can't be rejected reliably
+    if (det <= detErr)
+        return true;
+
+    // Reject intersections outside the triangle or the ray's extent
+    Float b0 = det - b1 - b2;
+    Float b0Err = detErr + b1Err + b2Err + gamma(2) * (det + std::abs(b1) + std::abs(b2));
+    if (b0 < -b0Err || b1 < -b1Err || b2 < -b2Err)
+        return false;
+    return t >= -tErr && t <= (1 + gamma(2)) * tMax * (det + detErr) + tErr;
+}
+
 // Triangle Method Definitions
 pstd::vector<Shape> Triangle::CreateTriangles(const TriangleMesh *mesh, Allocator alloc) {
     static std::mutex allMeshesLock;
@@ -291,21 +386,62 @@ Bounds3f Triangle::Bounds() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const TriangleMesh *mesh = GetMesh();
     const int *v = &mesh->vertexIndices[3 * triIndex];
-    Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+    Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
     return Union(Bounds3f(p0, p1), p2);
 }
 
+Bounds3f Triangle::ClippedBounds(const Bounds3f &clip) const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const TriangleMesh *mesh = GetMesh();
+    const int *v = &mesh->vertexIndices[3 * triIndex];
+    Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
+
+    // Clip triangle polygon against the six planes of _clip_
+    // Each plane adds at most one vertex, so the polygon has at most nine.
+    Point3f poly[9] = {p0, p1, p2}, clipped[9];
+    int nVertices = 3;
+    for (int axis = 0; axis < 3; ++axis)
+        for (int side = 0; side < 2; ++side) {
+            Float plane = (side == 0) ? clip.pMin[axis] : clip.pMax[axis];
+            auto inside = [&](Point3f p) {
+                return (side == 0) ? p[axis] >= plane : p[axis] <= plane;
+            };
+            int nClipped = 0;
+            for (int i = 0; i < nVertices; ++i) {
+                Point3f a = poly[i], b = poly[(i + 1) % nVertices];
+                bool aInside = inside(a), bInside = inside(b);
+                if (aInside)
+                    clipped[nClipped++] = a;
+                if (aInside != bInside) {
+                    Point3f p = Lerp((plane - a[axis]) / (b[axis] - a[axis]), a, b);
+                    p[axis] = plane;
+                    clipped[nClipped++] = p;
+                }
+            }
+            if (nClipped == 0)
+                return {};
+            nVertices = nClipped;
+            std::copy(clipped, clipped + nVertices, poly);
+        }
+
+    // Bound clipped polygon, guarding against round-off in clipping
+    Bounds3f bounds;
+    for (int i = 0; i < nVertices; ++i)
+        bounds = Union(bounds, poly[i]);
+    return pbrt::Intersect(bounds, clip);
+}
+
 DirectionCone Triangle::NormalBounds() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const TriangleMesh *mesh = GetMesh();
     const int *v = &mesh->vertexIndices[3 * triIndex];
-    Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+    Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
     Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
     // Ensure correct orientation of geometric normal for normal bounds
-    if (mesh->n != nullptr) {
-        Normal3f ns(mesh->n[v[0]] + mesh->n[v[1]] + mesh->n[v[2]]);
+    if (mesh->HasNormals()) {
+        Normal3f ns(mesh->N(v[0]) + mesh->N(v[1]) + mesh->N(v[2]));
         n = FaceForward(n, ns);
     } else if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
         n *= -1;
@@ -320,7 +456,7 @@ pstd::optional<ShapeIntersection> Triangle::Intersect(const Ray &ray, Float tMax
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const TriangleMesh *mesh = GetMesh();
     const int *v = &mesh->vertexIndices[3 * triIndex];
-    Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+    Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
     pstd::optional<TriangleIntersection> triIsect =
         IntersectTriangle(ray, tMax, p0, p1, p2);
@@ -341,7 +477,7 @@ bool Triangle::IntersectP(const Ray &ray, Float tMax) const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const TriangleMesh *mesh = GetMesh();
     const int *v = &mesh->vertexIndices[3 * triIndex];
-    Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+    Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
     pstd::optional<TriangleIntersection> isect = IntersectTriangle(ray, tMax, p0, p1, p2);
     if (isect) {
@@ -357,9 +493,9 @@ std::string Triangle::ToString() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     auto mesh = GetMesh();
     const int *v = &mesh->vertexIndices[3 * triIndex];
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    Point3f p0 = mesh->P(v[0]);
+    Point3f p1 = mesh->P(v[1]);
+    Point3f p2 = mesh->P(v[2]);
 
     return StringPrintf("[ Triangle meshIndex: %d triIndex: %d -> p [ %s %s %s ] ]",
                         meshIndex, triIndex, p0, p1, p2);
@@ -368,7 +504,8 @@ std::string Triangle::ToString() const {
 TriangleMesh *Triangle::CreateMesh(const Transform *renderFromObject,
                                    bool reverseOrientation,
                                    const ParameterDictionary &parameters,
-                                   const FileLoc *loc, Allocator alloc) {
+                                   const FileLoc *loc, Allocator alloc,
+                                   bool compress) {
     std::vector<int> vi = parameters.GetIntArray("indices");
     std::vector<Point3f> P = parameters.GetPoint3fArray("P");
     std::vector<Point2f> uvs = parameters.GetPoint2fArray("uv");
@@ -434,7 +571,7 @@ TriangleMesh *Triangle::CreateMesh(const Transform *renderFromObject,
 
     return alloc.new_object<TriangleMesh>(
         *renderFromObject, reverseOrientation, std::move(vi), std::move(P), std::move(S),
-        std::move(N), std::move(uvs), std::move(faceIndices));
+        std::move(N), std::move(uvs), std::move(faceIndices), compress);
 }
 
 STAT_MEMORY_COUNTER("Memory/Curves", curveBytes);
@@ -517,19 +654,26 @@ pstd::vector<Shape> CreateCurve(const Transform *renderFromObject,
 
 // Curve Method Definitions
 Bounds3f Curve::Bounds() const {
-    pstd::span<const Point3f> cpSpan(common->cpObj);
-    Bounds3f objBounds = BoundCubicBezier(cpSpan, uMin, uMax);
+    Bounds3f objBounds = BoundCubicBezier(pstd::MakeConstSpan(cpObj));
     // Expand _objBounds_ by maximum curve width over $u$ range
-    Float width[2] = {Lerp(uMin, common->width[0], common->width[1]),
-                      Lerp(uMax, common->width[0], common->width[1])};
-    objBounds = Expand(objBounds, std::max(width[0], width[1]) * 0.5f);
+    objBounds = Expand(objBounds, maxWidth * 0.5f);
 
     return (*common->renderFromObject)(objBounds);
 }
 
+void Curve::RenderSpaceSegment(pstd::array<Point3f, 4> *cpRender, Float width[2]) const {
+    for (int i = 0; i < 4; ++i)
+        (*cpRender)[i] = (*common->renderFromObject)(cpObj[i]);
+    // Scale the widths by the transformation's average scale factor
+    SquareMatrix<4> m = common->renderFromObject->GetMatrix();
+    SquareMatrix<3> m3(m[0][0], m[0][1], m[0][2], m[1][0], m[1][1], m[1][2], m[2][0],
+                       m[2][1], m[2][2]);
+    Float scale = std::cbrt(std::abs(m3.Determinant()));
+    width[0] = scale * Lerp(uMin, common->width[0], common->width[1]);
+    width[1] = scale * Lerp(uMax, common->width[0], common->width[1]);
+}
+
 Float Curve::Area() const {
-    pstd::array<Point3f, 4> cpObj =
-        CubicBezierControlPoints(pstd::MakeConstSpan(common->cpObj), uMin, uMax);
     Float width0 = Lerp(uMin, common->width[0], common->width[1]);
     Float width1 = Lerp(uMax, common->width[0], common->width[1]);
     Float avgWidth = (width0 + width1) * 0.5f;
@@ -557,36 +701,37 @@ bool Curve::IntersectRay(const Ray &r, Float tMax,
     // Transform _Ray_ to curve's object space
     Ray ray = (*common->objectFromRender)(r);
 
-    // Get object-space control points for curve segment, _cpObj_
-    pstd::array<Point3f, 4> cpObj =
-        CubicBezierControlPoints(pstd::span<const Point3f>(common->cpObj), uMin, uMax);
-
     // Project curve control points to plane perpendicular to ray
+    // The ray's frame has the basis that _LookAt()_ gives with the segment's
+    // chord as the up vector, but projecting with it directly avoids inverting
+    // transformation matrices.
     Vector3f dx = Cross(ray.d, cpObj[3] - cpObj[0]);
     if (LengthSquared(dx) == 0) {
         Vector3f dy;
         CoordinateSystem(ray.d, &dx, &dy);
     }
-    Transform rayFromObject = LookAt(ray.o, ray.o + ray.d, dx);
-    pstd::array<Point3f, 4> cp = {rayFromObject(cpObj[0]), rayFromObject(cpObj[1]),
-                                  rayFromObject(cpObj[2]), rayFromObject(cpObj[3])};
+    Vector3f dir = Normalize(ray.d);
+    Vector3f right = Normalize(Cross(Normalize(dx), dir));
+    Frame rayFrame(right, Cross(dir, right), dir);
+    pstd::array<Point3f, 4> cpRay;
+    for (int i = 0; i < 4; ++i)
+        cpRay[i] = Point3f(rayFrame.ToLocal(cpObj[i] - ray.o));
 
     // Test ray against bound of projected control points
-    Float maxWidth = std::max(Lerp(uMin, common->width[0], common->width[1]),
-                              Lerp(uMax, common->width[0], common->width[1]));
-    Bounds3f curveBounds = Union(Bounds3f(cp[0], cp[1]), Bounds3f(cp[2], cp[3]));
-    curveBounds = Expand(curveBounds, 0.5f * maxWidth);
     Bounds3f rayBounds(Point3f(0, 0, 0), Point3f(0, 0, Length(ray.d) * tMax));
-    if (!Overlaps(rayBounds, curveBounds))
+    auto overlapsRay = [&](const pstd::array<Point3f, 4> &c, Float width) {
+        Bounds3f curveBounds = Union(Bounds3f(c[0], c[1]), Bounds3f(c[2], c[3]));
+        return Overlaps(rayBounds, Expand(curveBounds, 0.5f * width));
+    };
+    if (!overlapsRay(cpRay, maxWidth))
         return false;
 
     // Compute refinement depth for curve, _maxDepth_
     Float L0 = 0;
-    for (int i = 0; i < 2; ++i)
-        L0 = std::max(
-            L0, std::max(std::max(std::abs(cp[i].x - 2 * cp[i + 1].x + cp[i + 2].x),
-                                  std::abs(cp[i].y - 2 * cp[i + 1].y + cp[i + 2].y)),
-                         std::abs(cp[i].z - 2 * cp[i + 1].z + cp[i + 2].z)));
+    for (int i = 0; i < 2; ++i) {
+        Vector3f d2 = cpRay[i] - 2 * cpRay[i + 1] + Vector3f(cpRay[i + 2]);
+        L0 = std::max(L0, MaxComponentValue(Abs(d2)));
+    }
     int maxDepth = 0;
     if (L0 > 0) {
         Float eps = std::max(common->width[0], common->width[1]) * .05f;  // width / 20
@@ -595,141 +740,147 @@ bool Curve::IntersectRay(const Ray &r, Float tMax,
         maxDepth = Clamp(r0, 0, 10);
     }
 
-    // Recursively test for ray--curve intersection
-    pstd::span<const Point3f> cpSpan(cp);
-    return RecursiveIntersect(ray, tMax, cpSpan, Inverse(rayFromObject), uMin, uMax,
-                              maxDepth, si);
-}
+    // Test for ray--curve intersection by iteratively subdividing the segment
+    struct SubSegment {
+        pstd::array<Point3f, 4> cp;
+        Float u0, u1;
+        int depth;
+    };
+    // Subdividing replaces a sub-segment with at most two at the next depth
+    SubSegment toVisit[11];
+    int toVisitOffset = 0;
+    toVisit[toVisitOffset++] = SubSegment{cpRay, uMin, uMax, maxDepth};
+    bool hit = false;
+    while (toVisitOffset > 0) {
+        SubSegment seg = toVisit[--toVisitOffset];
+        if (seg.depth == 0) {
+            if (IntersectSegment(ray, tMax, seg.cp, rayFrame, seg.u0, seg.u1, si)) {
+                hit = true;
+                if (si == nullptr)
+                    return true;
+            }
+            continue;
+        }
 
-bool Curve::RecursiveIntersect(const Ray &ray, Float tMax, pstd::span<const Point3f> cp,
-                               const Transform &objectFromRay, Float u0, Float u1,
-                               int depth, pstd::optional<ShapeIntersection> *si) const {
-    Float rayLength = Length(ray.d);
-    if (depth > 0) {
-        // Split curve segment into sub-segments and test for intersection
-        pstd::array<Point3f, 7> cpSplit = SubdivideCubicBezier(cp);
-        Float u[3] = {u0, (u0 + u1) / 2, u1};
-        for (int seg = 0; seg < 2; ++seg) {
-            // Check ray against curve segment's bounding box
-            Float maxWidth =
-                std::max(Lerp(u[seg], common->width[0], common->width[1]),
-                         Lerp(u[seg + 1], common->width[0], common->width[1]));
-            pstd::span<const Point3f> cps = pstd::MakeConstSpan(&cpSplit[3 * seg], 4);
-            Bounds3f curveBounds =
-                Union(Bounds3f(cps[0], cps[1]), Bounds3f(cps[2], cps[3]));
-            curveBounds = Expand(curveBounds, 0.5f * maxWidth);
-            Bounds3f rayBounds(Point3f(0, 0, 0), Point3f(0, 0, Length(ray.d) * tMax));
-            if (!Overlaps(rayBounds, curveBounds))
-                continue;
-
-            // Recursively test ray-segment intersection
-            bool hit = RecursiveIntersect(ray, tMax, cps, objectFromRay, u[seg],
-                                          u[seg + 1], depth - 1, si);
-            if (hit && si == nullptr)
-                return true;
+        // Split sub-segment and enqueue the halves that the ray may intersect,
+        // the first one last so that they are visited in order along the curve
+        pstd::array<Point3f, 7> cpSplit = SubdivideCubicBezier(seg.cp);
+        Float u[3] = {seg.u0, (seg.u0 + seg.u1) / 2, seg.u1};
+        for (int half = 1; half >= 0; --half) {
+            pstd::array<Point3f, 4> cps = {cpSplit[3 * half], cpSplit[3 * half + 1],
+                                           cpSplit[3 * half + 2], cpSplit[3 * half + 3]};
+            Float width = std::max(Lerp(u[half], common->width[0], common->width[1]),
+                                   Lerp(u[half + 1], common->width[0], common->width[1]));
+            if (overlapsRay(cps, width))
+                toVisit[toVisitOffset++] =
+                    SubSegment{cps, u[half], u[half + 1], seg.depth - 1};
         }
-        return si ? si->has_value() : false;
+    }
+    return hit;
+}
 
-    } else {
-        // Intersect ray with curve segment
-        // Test ray against segment endpoint boundaries
-        // Test sample point against tangent perpendicular at curve start
-        Float edge = (cp[1].y - cp[0].y) * -cp[0].y + cp[0].x * (cp[0].x - cp[1].x);
-        if (edge < 0)
-            return false;
+bool Curve::IntersectSegment(const Ray &ray, Float tMax, pstd::span<const Point3f> cp,
+                             const Frame &rayFrame, Float u0, Float u1,
+                             pstd::optional<ShapeIntersection> *si) const {
+    Float rayLength = Length(ray.d);
+    // Intersect ray with curve segment
+    // Test ray against segment endpoint boundaries
+    // Test sample point against tangent perpendicular at curve start
+    Float edge = (cp[1].y - cp[0].y) * -cp[0].y + cp[0].x * (cp[0].x - cp[1].x);
+    if (edge < 0)
+        return false;
 
-        // Test sample point against tangent perpendicular at curve end
-        edge = (cp[2].y - cp[3].y) * -cp[3].y + cp[3].x * (cp[3].x - cp[2].x);
-        if (edge < 0)
-            return false;
+    // Test sample point against tangent perpendicular at curve end
+    edge = (cp[2].y - cp[3].y) * -cp[3].y + cp[3].x * (cp[3].x - cp[2].x);
+    if (edge < 0)
+        return false;
 
-        // Find line $w$ that gives minimum distance to sample point
-        Vector2f segmentDir = Point2f(cp[3].x, cp[3].y) - Point2f(cp[0].x, cp[0].y);
-        Float denom = LengthSquared(segmentDir);
-        if (denom == 0)
-            return false;
-        Float w = Dot(-Vector2f(cp[0].x, cp[0].y), segmentDir) / denom;
-
-        // Compute $u$ coordinate of curve intersection point and _hitWidth_
-        Float u = Clamp(Lerp(w, u0, u1), u0, u1);
-        Float hitWidth = Lerp(u, common->width[0], common->width[1]);
-        Normal3f nHit;
-        if (common->type == CurveType::Ribbon) {
-            // Scale _hitWidth_ based on ribbon orientation
-            if (common->normalAngle == 0)
-                nHit = common->n[0];
-            else {
-                Float sin0 =
-                    std::sin((1 - u) * common->normalAngle) * common->invSinNormalAngle;
-                Float sin1 =
-                    std::sin(u * common->normalAngle) * common->invSinNormalAngle;
-                nHit = sin0 * common->n[0] + sin1 * common->n[1];
-            }
-            hitWidth *= AbsDot(nHit, ray.d) / rayLength;
+    // Find line $w$ that gives minimum distance to sample point
+    Vector2f segmentDir = Point2f(cp[3].x, cp[3].y) - Point2f(cp[0].x, cp[0].y);
+    Float denom = LengthSquared(segmentDir);
+    if (denom == 0)
+        return false;
+    Float w = Dot(-Vector2f(cp[0].x, cp[0].y), segmentDir) / denom;
+
+    // Compute $u$ coordinate of curve intersection point and _hitWidth_
+    Float u = Clamp(Lerp(w, u0, u1), u0, u1);
+    Float hitWidth = Lerp(u, common->width[0], common->width[1]);
+    Normal3f nHit;
+    if (common->type == CurveType::Ribbon) {
+        // Scale _hitWidth_ based on ribbon orientation
+        if (common->normalAngle == 0)
+            nHit = common->n[0];
+        else {
+            Float sin0 =
+                std::sin((1 - u) * common->normalAngle) * common->invSinNormalAngle;
+            Float sin1 =
+                std::sin(u * common->normalAngle) * common->invSinNormalAngle;
+            nHit = sin0 * common->n[0] + sin1 * common->n[1];
         }
+        hitWidth *= AbsDot(nHit, ray.d) / rayLength;
+    }
 
-        // Test intersection point against curve width
-        Vector3f dpcdw;
-        Point3f pc =
-            EvaluateCubicBezier(pstd::span<const Point3f>(cp), Clamp(w, 0, 1), &dpcdw);
-        Float ptCurveDist2 = Sqr(pc.x) + Sqr(pc.y);
-        if (ptCurveDist2 > Sqr(hitWidth) * 0.25f)
-            return false;
-        if (pc.z < 0 || pc.z > rayLength * tMax)
+    // Test intersection point against curve width
+    Vector3f dpcdw;
+    Point3f pc =
+        EvaluateCubicBezier(pstd::span<const Point3f>(cp), Clamp(w, 0, 1), &dpcdw);
+    Float ptCurveDist2 = Sqr(pc.x) + Sqr(pc.y);
+    if (ptCurveDist2 > Sqr(hitWidth) * 0.25f)
+        return false;
+    if (pc.z < 0 || pc.z > rayLength * tMax)
+        return false;
+
+    if (si != nullptr) {
+        // Initialize _ShapeIntersection_ for curve intersection
+        // Compute _tHit_ for curve intersection
+        // FIXME: this tHit isn't quite right for ribbons...
+        Float tHit = pc.z / rayLength;
+        if (si->has_value() && tHit > si->value().tHit)
             return false;
 
-        if (si != nullptr) {
-            // Initialize _ShapeIntersection_ for curve intersection
-            // Compute _tHit_ for curve intersection
-            // FIXME: this tHit isn't quite right for ribbons...
-            Float tHit = pc.z / rayLength;
-            if (si->has_value() && tHit > si->value().tHit)
-                return false;
-
-            // Initialize _SurfaceInteraction_ _intr_ for curve intersection
-            // Compute $v$ coordinate of curve intersection point
-            Float ptCurveDist = std::sqrt(ptCurveDist2);
-            Float edgeFunc = dpcdw.x * -pc.y + pc.x * dpcdw.y;
-            Float v = (edgeFunc > 0) ? 0.5f + ptCurveDist / hitWidth
-                                     : 0.5f - ptCurveDist / hitWidth;
-
-            // Compute $\dpdu$ and $\dpdv$ for curve intersection
-            Vector3f dpdu, dpdv;
-            EvaluateCubicBezier(pstd::MakeConstSpan(common->cpObj), u, &dpdu);
-            CHECK_NE(Vector3f(0, 0, 0), dpdu);
-            if (common->type == CurveType::Ribbon)
-                dpdv = Normalize(Cross(nHit, dpdu)) * hitWidth;
-            else {
-                // Compute curve $\dpdv$ for flat and cylinder curves
-                Vector3f dpduPlane = objectFromRay.ApplyInverse(dpdu);
-                Vector3f dpdvPlane =
-                    Normalize(Vector3f(-dpduPlane.y, dpduPlane.x, 0)) * hitWidth;
-                if (common->type == CurveType::Cylinder) {
-                    // Rotate _dpdvPlane_ to give cylindrical appearance
-                    Float theta = Lerp(v, -90., 90.);
-                    Transform rot = Rotate(-theta, dpduPlane);
-                    dpdvPlane = rot(dpdvPlane);
-                }
-                dpdv = objectFromRay(dpdvPlane);
+        // Initialize _SurfaceInteraction_ _intr_ for curve intersection
+        // Compute $v$ coordinate of curve intersection point
+        Float ptCurveDist = std::sqrt(ptCurveDist2);
+        Float edgeFunc = dpcdw.x * -pc.y + pc.x * dpcdw.y;
+        Float v = (edgeFunc > 0) ? 0.5f + ptCurveDist / hitWidth
+                                 : 0.5f - ptCurveDist / hitWidth;
+
+        // Compute $\dpdu$ and $\dpdv$ for curve intersection
+        Vector3f dpdu, dpdv;
+        EvaluateCubicBezier(pstd::MakeConstSpan(common->cpObj), u, &dpdu);
+        CHECK_NE(Vector3f(0, 0, 0), dpdu);
+        if (common->type == CurveType::Ribbon)
+            dpdv = Normalize(Cross(nHit, dpdu)) * hitWidth;
+        else {
+            // Compute curve $\dpdv$ for flat and cylinder curves
+            Vector3f dpduPlane = rayFrame.ToLocal(dpdu);
+            Vector3f dpdvPlane =
+                Normalize(Vector3f(-dpduPlane.y, dpduPlane.x, 0)) * hitWidth;
+            if (common->type == CurveType::Cylinder) {
+                // Rotate _dpdvPlane_ to give cylindrical appearance
+                Float theta = Lerp(v, -90., 90.);
+                Transform rot = Rotate(-theta, dpduPlane);
+                dpdvPlane = rot(dpdvPlane);
             }
+            dpdv = rayFrame.FromLocal(dpdvPlane);
+        }
 
-            // Compute error bounds for curve intersection
-            Vector3f pError(hitWidth, hitWidth, hitWidth);
+        // Compute error bounds for curve intersection
+        Vector3f pError(hitWidth, hitWidth, hitWidth);
 
-            bool flipNormal =
-                common->reverseOrientation ^ common->transformSwapsHandedness;
-            Point3fi pi(ray(tHit), pError);
-            SurfaceInteraction intr(pi, {u, v}, -ray.d, dpdu, dpdv, Normal3f(),
-                                    Normal3f(), ray.time, flipNormal);
-            intr = (*common->renderFromObject)(intr);
+        bool flipNormal =
+            common->reverseOrientation ^ common->transformSwapsHandedness;
+        Point3fi pi(ray(tHit), pError);
+        SurfaceInteraction intr(pi, {u, v}, -ray.d, dpdu, dpdv, Normal3f(),
+                                Normal3f(), ray.time, flipNormal);
+        intr = (*common->renderFromObject)(intr);
 
-            *si = ShapeIntersection{intr, tHit};
-        }
+        *si = ShapeIntersection{intr, tHit};
+    }
 #ifndef PBRT_IS_GPU_CODE
-        ++nCurveHits;
+    ++nCurveHits;
 #endif
-        return true;
-    }
+    return true;
 }
 
 pstd::optional<ShapeSample> Curve::Sample(Point2f u) const {
@@ -757,11 +908,79 @@ std::string Curve::ToString() const {
     return StringPrintf("[ Curve common: %s uMin: %f uMax: %f ]", *common, uMin, uMax);
 }
 
+// Curve files hold cubic Bezier segments after a 16-byte header with the
+// magic string "pbrtcrv1" and the number of segments as a 64-bit integer.
+// Each segment is stored as 14 little-endian 32-bit floats: its four control
+// points and then its widths at its two ends.
+static pstd::vector<Shape> ReadCurveFile(const std::string &filename,
+                                         const Transform *renderFromObject,
+                                         const Transform *objectFromRender,
+                                         bool reverseOrientation, CurveType type,
+                                         int splitDepth, const FileLoc *loc,
+                                         Allocator alloc) {
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file) {
+        Error(loc, "%s: unable to open curve file.", filename);
+        return {};
+    }
+    uint64_t nSegments = 0;
+    if (file->size() < 16 || std::memcmp(file->data(), "pbrtcrv1", 8) != 0) {
+        Error(loc, "%s: not a curve file.", filename);
+        return {};
+    }
+    std::memcpy(&nSegments, file->data() + 8, sizeof(nSegments));
+    if (nSegments > (file->size() - 16) / (14 * sizeof(float))) {
+        Error(loc, "%s: truncated curve file.", filename);
+        return {};
+    }
+
+    pstd::vector<Shape> curves(alloc);
+    curves.reserve(nSegments << splitDepth);
+    const char *ptr = file->data() + 16;
+    for (uint64_t seg = 0; seg < nSegments; ++seg, ptr += 14 * sizeof(float)) {
+        float v[14];
+        std::memcpy(v, ptr, sizeof(v));
+        pstd::array<Point3f, 4> cp;
+        for (int i = 0; i < 4; ++i)
+            cp[i] = Point3f(v[3 * i], v[3 * i + 1], v[3 * i + 2]);
+        pstd::vector<Shape> c =
+            CreateCurve(renderFromObject, objectFromRender, reverseOrientation, cp,
+                        v[12], v[13], type, {}, splitDepth, alloc);
+        curves.insert(curves.end(), c.begin(), c.end());
+    }
+    return curves;
+}
+
 pstd::vector<Shape> Curve::Create(const Transform *renderFromObject,
                                   const Transform *objectFromRender,
                                   bool reverseOrientation,
                                   const ParameterDictionary &parameters,
                                   const FileLoc *loc, Allocator alloc) {
+    CurveType type;
+    std::string curveType = parameters.GetOneString("type", "flat");
+    if (curveType == "flat")
+        type = CurveType::Flat;
+    else if (curveType == "ribbon")
+        type = CurveType::Ribbon;
+    else if (curveType == "cylinder")
+        type = CurveType::Cylinder;
+    else {
+        Error(loc, R"(Unknown curve type "%s".  Using "cylinder".)", curveType);
+        type = CurveType::Cylinder;
+    }
+
+    int sd = parameters.GetOneInt("splitdepth", 3);
+
+    std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+    if (!filename.empty()) {
+        if (type == CurveType::Ribbon) {
+            Error(loc, "Ribbon curves can't be read from curve files.");
+            return {};
+        }
+        return ReadCurveFile(filename, renderFromObject, objectFromRender,
+                             reverseOrientation, type, sd, loc, alloc);
+    }
+
     Float width = parameters.GetOneFloat("width", 1.f);
     Float width0 = parameters.GetOneFloat("width0", width);
     Float width1 = parameters.GetOneFloat("width1", width);
@@ -807,19 +1026,6 @@ pstd::vector<Shape> Curve::Create(const Transform *renderFromObject,
         nSegments = cp.size() - degree;
     }
 
-    CurveType type;
-    std::string curveType = parameters.GetOneString("type", "flat");
-    if (curveType == "flat")
-        type = CurveType::Flat;
-    else if (curveType == "ribbon")
-        type = CurveType::Ribbon;
-    else if (curveType == "cylinder")
-        type = CurveType::Cylinder;
-    else {
-        Error(loc, R"(Unknown curve type "%s".  Using "cylinder".)", curveType);
-        type = CurveType::Cylinder;
-    }
-
     std::vector<Normal3f> n = parameters.GetNormal3fArray("N");
     if (!n.empty()) {
         if (type != CurveType::Ribbon) {
@@ -839,8 +1045,6 @@ pstd::vector<Shape> Curve::Create(const Transform *renderFromObject,
         return {};
     }
 
-    int sd = parameters.GetOneInt("splitdepth", 3);
-
     if (type == CurveType::Ribbon && n.empty()) {
         Error(loc, "Must provide normals \"N\" at curve endpoints with ribbon "
                    "curves.");
@@ -995,8 +1199,97 @@ BilinearPatchMesh *BilinearPatch::CreateMesh(const Transform *renderFromObject,
         std::move(N), std::move(uv), std::move(faceIndices), imageDist);
 }
 
+// Returns whether the bilinear patch with the given vertices is a parallelogram
+template <typename P>
+static bool IsParallelogram(P p00, P p10, P p01, P p11) {
+    auto diagonal = (p11 - p10) - (p01 - p00);
+    Float scale = std::max(Length(p10 - p00), Length(p01 - p00));
+    return Length(diagonal) <= 1e-5f * scale;
+}
+
 pstd::vector<Shape> BilinearPatch::CreatePatches(const BilinearPatchMesh *mesh,
-                                                 Allocator alloc) {
+                                                 Allocator alloc,
+                                                 bool splitParallelograms) {
+    if (splitParallelograms && !mesh->imageDistribution) {
+        // Find the patches that are parallelograms in all of their vertex data
+        std::vector<int> parallelograms, rest;
+        for (int i = 0; i < mesh->nPatches; ++i) {
+            const int *v = &mesh->vertexIndices[4 * i];
+            bool split = IsParallelogram(mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]],
+                                         mesh->p[v[3]]);
+            if (mesh->n)
+                split &= IsParallelogram(mesh->n[v[0]], mesh->n[v[1]], mesh->n[v[2]],
+                                         mesh->n[v[3]]);
+            if (mesh->uv)
+                split &= IsParallelogram(mesh->uv[v[0]], mesh->uv[v[1]],
+                                         mesh->uv[v[2]], mesh->uv[v[3]]);
+            (split ? parallelograms : rest).push_back(i);
+        }
+
+        if (!parallelograms.empty()) {
+            // Return the parallelograms as a triangle mesh and the rest as patches
+            // The bilinear interpolation of a parallelogram's vertex data is
+            // affine, so triangles with the patch's own $(u,v)$ as their texture
+            // coordinates if the mesh has none have the same positions, normals,
+            // and texture coordinates. Each patch gets its own four vertices. The
+            // meshes' vertices are already in rendering space; normals are passed
+            // unflipped since the constructors flip them again.
+            auto unflip = [&](Normal3f n) { return mesh->reverseOrientation ? -n : n; };
+            std::vector<int> indices, faceIndices;
+            std::vector<Point3f> p;
+            std::vector<Normal3f> n;
+            std::vector<Point2f> uv;
+            for (int i : parallelograms) {
+                const int *v = &mesh->vertexIndices[4 * i];
+                int base = p.size();
+                for (int j : {0, 1, 3, 0, 3, 2})
+                    indices.push_back(base + j);
+                for (int j = 0; j < 4; ++j) {
+                    p.push_back(mesh->p[v[j]]);
+                    if (mesh->n)
+                        n.push_back(unflip(mesh->n[v[j]]));
+                    uv.push_back(mesh->uv ? mesh->uv[v[j]]
+                                          : Point2f(Float(j & 1), Float(j >> 1)));
+                }
+                if (mesh->faceIndices)
+                    faceIndices.insert(faceIndices.end(), 2, mesh->faceIndices[i]);
+            }
+            TriangleMesh *triMesh = alloc.new_object<TriangleMesh>(
+                Transform(), mesh->reverseOrientation, std::move(indices), std::move(p),
+                std::vector<Vector3f>(), std::move(n), std::move(uv),
+                std::move(faceIndices));
+            triMesh->transformSwapsHandedness = mesh->transformSwapsHandedness;
+            pstd::vector<Shape> shapes = Triangle::CreateTriangles(triMesh, alloc);
+            if (rest.empty())
+                return shapes;
+
+            // Gather the remaining patches' indices into a new mesh that shares
+            // the original vertex data
+            std::vector<int> restIndices, restFaceIndices;
+            for (int i : rest) {
+                restIndices.insert(restIndices.end(), &mesh->vertexIndices[4 * i],
+                                   &mesh->vertexIndices[4 * i + 4]);
+                if (mesh->faceIndices)
+                    restFaceIndices.push_back(mesh->faceIndices[i]);
+            }
+            std::vector<Normal3f> restN;
+            if (mesh->n)
+                for (int v = 0; v < mesh->nVertices; ++v)
+                    restN.push_back(unflip(mesh->n[v]));
+            BilinearPatchMesh *restMesh = alloc.new_object<BilinearPatchMesh>(
+                Transform(), mesh->reverseOrientation, std::move(restIndices),
+                std::vector<Point3f>(mesh->p, mesh->p + mesh->nVertices),
+                std::move(restN),
+                mesh->uv ? std::vector<Point2f>(mesh->uv, mesh->uv + mesh->nVertices)
+                         : std::vector<Point2f>(),
+                std::move(restFaceIndices), nullptr);
+            restMesh->transformSwapsHandedness = mesh->transformSwapsHandedness;
+            pstd::vector<Shape> patches = CreatePatches(restMesh, alloc);
+            shapes.insert(shapes.end(), patches.begin(), patches.end());
+            return shapes;
+        }
+    }
+
     static std::mutex allMeshesLock;
     allMeshesLock.lock();
     CHECK_LT(allMeshes->size(), 1 << 31);
@@ -1023,8 +1316,10 @@ void BilinearPatch::Init(Allocator alloc) {
     allMeshes = alloc.new_object<pstd::vector<const BilinearPatchMesh *>>(alloc);
 #if defined(PBRT_BUILD_GPU_RENDERER)
     if (Options->useGPU)
-        CUDA_CHECK(
-            cudaMemcpyToSymbol(allBilinearMeshesGPU, &allMeshes, sizeof(allMeshes)));
+        ForEachGPU([&](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(allBilinearMeshesGPU, &allMeshes,
+                                          sizeof(allMeshes)));
+        });
 #endif
 }
 
@@ -1148,6 +1443,51 @@ bool BilinearPatch::IntersectP(const Ray &ray, Float tMax) const {
     return IntersectBilinearPatch(ray, tMax, p00, p10, p01, p11).has_value();
 }
 
+// BilinearPatchBatch Method Definitions
+int BilinearPatchBatch::Candidates(const Ray &ray, Float tMax) const {
+    // Relative slack of the tests, orders of magnitude larger than rounding error
+    constexpr Float eps = 1e-3f;
+    int mask = 0;
+    for (int i = 0; i < Width; ++i) {
+        Point3f p00(p[0][0][i], p[0][1][i], p[0][2][i]);
+        Point3f p10(p[1][0][i], p[1][1][i], p[1][2][i]);
+        Point3f p01(p[2][0][i], p[2][1][i], p[2][2][i]);
+        Point3f p11(p[3][0][i], p[3][1][i], p[3][2][i]);
+        // Find quadratic coefficients as in IntersectBilinearPatch()
+        Float a = Dot(Cross(p10 - p00, p01 - p11), ray.d);
+        Float c = Dot(Cross(p00 - ray.o, ray.d), p01 - p00);
+        Float b = Dot(Cross(p10 - ray.o, ray.d), p11 - p10) - (a + c);
+
+        // Solve quadratic for both roots with selects rather than branches
+        // Patches with discriminants too close to zero to be sure of their
+        // signs are always candidates.
+        Float discrim = DifferenceOfProducts(b, b, 4 * a, c);
+        bool hit = std::abs(discrim) <= eps * (b * b + std::abs(4 * a * c));
+        Float q = -0.5f * (b + pstd::copysign(std::sqrt(std::max<Float>(0, discrim)), b));
+        Float u[2] = {a != 0 ? q / a : -c / b, a != 0 ? c / q : -c / b};
+
+        for (int r = 0; r < 2; ++r) {
+            // Compute unnormalized $v$ and $t$ for root and bounds on their error
+            Point3f uo = Lerp(u[r], p00, p10);
+            Vector3f ud = Lerp(u[r], p01, p11) - uo;
+            Vector3f deltao = uo - ray.o;
+            Vector3f perp = Cross(ray.d, ud);
+            Float p2 = LengthSquared(perp);
+            Vector3f dPerp = Cross(ray.d, perp), udPerp = Cross(ud, perp);
+            Float v = Dot(deltao, dPerp), t = Dot(deltao, udPerp);
+            Float vErr = eps * Dot(Abs(deltao), AbsCross(ray.d, perp));
+            Float tErr = eps * Dot(Abs(deltao), AbsCross(ud, perp));
+
+            // Accept root if $u$, $v$, and $t$ are within the slack of valid
+            hit |= (u[r] >= -eps && u[r] <= 1 + eps && v >= -vErr &&
+                    v <= (1 + eps) * p2 + vErr && t > -tErr &&
+                    t < (1 + eps) * tMax * p2 + tErr);
+        }
+        mask |= int(hit) << i;
+    }
+    return mask & ((1 << count) - 1);
+}
+
 pstd::optional<ShapeSample> BilinearPatch::Sample(Point2f u) const {
     const BilinearPatchMesh *mesh = GetMesh();
     // Get bilinear patch vertices in _p00_, _p01_, _p10_, and _p11_
@@ -1385,7 +1725,7 @@ pstd::vector<Shape> Shape::Create(const std::string &name,
     } else if (name == "bilinearmesh") {
         BilinearPatchMesh *mesh = BilinearPatch::CreateMesh(
             renderFromObject, reverseOrientation, parameters, loc, alloc);
-        shapes = BilinearPatch::CreatePatches(mesh, alloc);
+        shapes = BilinearPatch::CreatePatches(mesh, alloc, Options->splitPlanarPatches);
     }
     // Create multiple-_Shape_ types
     else if (name == "curve")
@@ -1393,7 +1733,8 @@ pstd::vector<Shape> Shape::Create(const std::string &name,
                                parameters, loc, alloc);
     else if (name == "trianglemesh") {
         TriangleMesh *mesh = Triangle::CreateMesh(renderFromObject, reverseOrientation,
-                                                  parameters, loc, alloc);
+                                                  parameters, loc, alloc,
+                                                  Options->compressMeshes);
         shapes = Triangle::CreateTriangles(mesh, alloc);
     } else if (name == "plymesh") {
         std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
@@ -1402,7 +1743,8 @@ pstd::vector<Shape> Shape::Create(const std::string &name,
         if (!plyMesh.triIndices.empty()) {
             TriangleMesh *mesh = alloc.new_object<TriangleMesh>(
                 *renderFromObject, reverseOrientation, plyMesh.triIndices, plyMesh.p,
-                std::vector<Vector3f>(), plyMesh.n, plyMesh.uv, plyMesh.faceIndices);
+                std::vector<Vector3f>(), plyMesh.n, plyMesh.uv, plyMesh.faceIndices,
+                Options->compressMeshes);
             shapes = Triangle::CreateTriangles(mesh, alloc);
         }
 
@@ -1410,7 +1752,8 @@ pstd::vector<Shape> Shape::Create(const std::string &name,
             BilinearPatchMesh *mesh = alloc.new_object<BilinearPatchMesh>(
                 *renderFromObject, reverseOrientation, plyMesh.quadIndices, plyMesh.p,
                 plyMesh.n, plyMesh.uv, plyMesh.faceIndices, nullptr /* image dist */);
-            pstd::vector<Shape> quadMesh = BilinearPatch::CreatePatches(mesh, alloc);
+            pstd::vector<Shape> quadMesh =
+                BilinearPatch::CreatePatches(mesh, alloc, Options->splitPlanarPatches);
             shapes.insert(shapes.end(), quadMesh.begin(), quadMesh.end());
         }
     } else if (name == "loopsubdiv") {
@@ -1427,8 +1770,11 @@ pstd::vector<Shape> Shape::Create(const std::string &name,
         // don't actually use this for now...
         std::string scheme = parameters.GetOneString("scheme", "loop");
 
+        // Subdivide until edges are at most this many pixels long, if given
+        Float edgeLength = parameters.GetOneFloat("edgelength", 0.f);
+
         TriangleMesh *mesh = LoopSubdivide(renderFromObject, reverseOrientation, nLevels,
-                                           vertexIndices, P, alloc);
+                                           vertexIndices, P, alloc, edgeLength);
 
         shapes = Triangle::CreateTriangles(mesh, alloc);
     } else
@@ -14,6 +14,7 @@
 #include <pbrt/util/mesh.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/splines.h>
 #include <pbrt/util/transform.h>
 #include <pbrt/util/vecmath.h>
 
@@ -837,6 +838,49 @@ pstd::optional<TriangleIntersection> IntersectTriangle(const Ray &ray, Float tMa
                                                        Point3f p0, Point3f p1,
                                                        Point3f p2);
 
+// TriangleBatch Definition
+// Vertices of up to _Width_ triangles stored in SoA layout so that the
+// watertight edge tests run across all of them together. The test is
+// conservative: it never rejects a triangle that IntersectTriangle() would
+// hit, so reported candidates only need to be confirmed with the usual test.
+struct alignas(32) TriangleBatch {
+    static constexpr int Width = 8;
+    // TriangleBatch Public Methods
+    void Set(int i, Point3f p0, Point3f p1, Point3f p2) {
+        for (int axis = 0; axis < 3; ++axis) {
+            p[0][axis][i] = p0[axis];
+            p[1][axis][i] = p1[axis];
+            p[2][axis][i] = p2[axis];
+        }
+        count = std::max(count, i + 1);
+    }
+
+    // Returns a bitmask of the triangles that the ray may intersect
+    int Candidates(const Ray &ray) const;
+
+    // Vertices are stored as [vertex][axis][triangle]
+    Float p[3][3][Width];
+    int count = 0;
+};
+
+// PrecomputedTriangle Definition
+// A triangle's first vertex, its two edges from it, and their cross product,
+// stored together so that rays can be tested against it without gathering its
+// vertices through its mesh. As with _TriangleBatch_, the test is conservative
+// and the triangles it reports must be confirmed with IntersectTriangle().
+struct PrecomputedTriangle {
+    // PrecomputedTriangle Public Methods
+    PrecomputedTriangle() = default;
+    PrecomputedTriangle(Point3f p0, Point3f p1, Point3f p2)
+        : p0(p0), e1(p1 - p0), e2(p2 - p0), n(Cross(e1, e2)) {}
+
+    // Returns false if the ray certainly doesn't hit the triangle before _tMax_
+    bool MayIntersect(const Ray &ray, Float tMax) const;
+
+    Point3f p0;
+    Vector3f e1, e2, n;
+};
+
 // Triangle Definition
 class Triangle {
   public:
@@ -850,6 +894,7 @@ class Triangle {
 
     PBRT_CPU_GPU
     Bounds3f Bounds() const;
+    Bounds3f ClippedBounds(const Bounds3f &clip) const;
 
     PBRT_CPU_GPU
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray,
@@ -857,12 +902,30 @@ class Triangle {
     PBRT_CPU_GPU
     bool IntersectP(const Ray &ray, Float tMax = Infinity) const;
 
+    PBRT_CPU_GPU
+    const TriangleMesh *GetMesh() const {
+#ifdef PBRT_IS_GPU_CODE
+        return (*allTriangleMeshesGPU)[meshIndex];
+#else
+        return (*allMeshes)[meshIndex];
+#endif
+    }
+    PBRT_CPU_GPU
+    int GetTriangleIndex() const { return triIndex; }
+
+    PBRT_CPU_GPU
+    pstd::array<Point3f, 3> Vertices() const {
+        const TriangleMesh *mesh = GetMesh();
+        const int *v = &mesh->vertexIndices[3 * triIndex];
+        return {mesh->P(v[0]), mesh->P(v[1]), mesh->P(v[2])};
+    }
+
     PBRT_CPU_GPU
     Float Area() const {
         // Get triangle vertices in _p0_, _p1_, and _p2_
         const TriangleMesh *mesh = GetMesh();
         const int *v = &mesh->vertexIndices[3 * triIndex];
-        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
         return 0.5f * Length(Cross(p1 - p0, p2 - p0));
     }
@@ -875,14 +938,15 @@ class Triangle {
     static TriangleMesh *CreateMesh(const Transform *renderFromObject,
                                     bool reverseOrientation,
                                     const ParameterDictionary &parameters,
-                                    const FileLoc *loc, Allocator alloc);
+                                    const FileLoc *loc, Allocator alloc,
+                                    bool compress = false);
 
     PBRT_CPU_GPU
     Float SolidAngle(const Point3f &p) const {
         // Get triangle vertices in _p0_, _p1_, and _p2_
         const TriangleMesh *mesh = GetMesh();
         const int *v = &mesh->vertexIndices[3 * triIndex];
-        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
         return SphericalTriangleArea(Normalize(p0 - p), Normalize(p1 - p),
                                      Normalize(p2 - p));
@@ -895,14 +959,14 @@ class Triangle {
                                                           Float time,
                                                           const Vector3f &wo) {
         const int *v = &mesh->vertexIndices[3 * triIndex];
-        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
         // Compute triangle partial derivatives
         // Compute deltas and matrix determinant for triangle partial derivatives
         // Get triangle texture coordinates in _uv_ array
         pstd::array<Point2f, 3> uv =
-            mesh->uv
+            mesh->HasUVs()
                 ? pstd::array<Point2f, 3>(
-                      {mesh->uv[v[0]], mesh->uv[v[1]], mesh->uv[v[2]]})
+                      {mesh->UV(v[0]), mesh->UV(v[1]), mesh->UV(v[2])})
                 : pstd::array<Point2f, 3>({Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
 
         Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
@@ -951,13 +1015,13 @@ class Triangle {
         if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
             isect.n = isect.shading.n = -isect.n;
 
-        if (mesh->n || mesh->s) {
+        if (mesh->HasNormals() || mesh->s) {
             // Initialize _Triangle_ shading geometry
             // Compute shading normal _ns_ for triangle
             Normal3f ns;
-            if (mesh->n != nullptr) {
+            if (mesh->HasNormals()) {
                 ns =
-                    ti.b0 * mesh->n[v[0]] + ti.b1 * mesh->n[v[1]] + ti.b2 * mesh->n[v[2]];
+                    ti.b0 * mesh->N(v[0]) + ti.b1 * mesh->N(v[1]) + ti.b2 * mesh->N(v[2]);
                 ns = LengthSquared(ns) > 0 ? Normalize(ns) : isect.n;
             } else
                 ns = isect.n;
@@ -981,12 +1045,12 @@ class Triangle {
 
             // Compute $\dndu$ and $\dndv$ for triangle shading geometry
             Normal3f dndu, dndv;
-            if (mesh->n != nullptr) {
+            if (mesh->HasNormals()) {
                 // Compute deltas for triangle partial derivatives of normal
                 Vector2f duv02 = uv[0] - uv[2];
                 Vector2f duv12 = uv[1] - uv[2];
-                Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-                Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+                Normal3f dn1 = mesh->N(v[0]) - mesh->N(v[2]);
+                Normal3f dn2 = mesh->N(v[1]) - mesh->N(v[2]);
 
                 Float determinant =
                     DifferenceOfProducts(duv02[0], duv12[1], duv02[1], duv12[0]);
@@ -998,8 +1062,8 @@ class Triangle {
                     // (rather than giving up) so that ray differentials for
                     // rays reflected from triangles with degenerate
                     // parameterizations are still reasonable.
-                    Vector3f dn = Cross(Vector3f(mesh->n[v[2]] - mesh->n[v[0]]),
-                                        Vector3f(mesh->n[v[1]] - mesh->n[v[0]]));
+                    Vector3f dn = Cross(Vector3f(mesh->N(v[2]) - mesh->N(v[0])),
+                                        Vector3f(mesh->N(v[1]) - mesh->N(v[0])));
 
                     if (LengthSquared(dn) == 0)
                         dndu = dndv = Normal3f(0, 0, 0);
@@ -1028,7 +1092,7 @@ class Triangle {
         // Get triangle vertices in _p0_, _p1_, and _p2_
         const TriangleMesh *mesh = GetMesh();
         const int *v = &mesh->vertexIndices[3 * triIndex];
-        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
         // Sample point on triangle uniformly by area
         pstd::array<Float, 3> b = SampleUniformTriangle(u);
@@ -1036,9 +1100,9 @@ class Triangle {
 
         // Compute surface normal for sampled point on triangle
         Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
-        if (mesh->n != nullptr) {
-            Normal3f ns(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                        (1 - b[0] - b[1]) * mesh->n[v[2]]);
+        if (mesh->HasNormals()) {
+            Normal3f ns(b[0] * mesh->N(v[0]) + b[1] * mesh->N(v[1]) +
+                        (1 - b[0] - b[1]) * mesh->N(v[2]));
             n = FaceForward(n, ns);
         } else if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
             n *= -1;
@@ -1046,9 +1110,9 @@ class Triangle {
         // Compute $(u,v)$ for sampled point on triangle
         // Get triangle texture coordinates in _uv_ array
         pstd::array<Point2f, 3> uv =
-            mesh->uv
+            mesh->HasUVs()
                 ? pstd::array<Point2f, 3>(
-                      {mesh->uv[v[0]], mesh->uv[v[1]], mesh->uv[v[2]]})
+                      {mesh->UV(v[0]), mesh->UV(v[1]), mesh->UV(v[2])})
                 : pstd::array<Point2f, 3>({Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
 
         Point2f uvSample = b[0] * uv[0] + b[1] * uv[1] + b[2] * uv[2];
@@ -1068,7 +1132,7 @@ class Triangle {
         // Get triangle vertices in _p0_, _p1_, and _p2_
         const TriangleMesh *mesh = GetMesh();
         const int *v = &mesh->vertexIndices[3 * triIndex];
-        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
         // Use uniform area sampling for numerically unstable cases
         Float solidAngle = SolidAngle(ctx.p());
@@ -1123,9 +1187,9 @@ class Triangle {
         Point3f p = b[0] * p0 + b[1] * p1 + b[2] * p2;
         // Compute surface normal for sampled point on triangle
         Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
-        if (mesh->n != nullptr) {
-            Normal3f ns(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                        (1 - b[0] - b[1]) * mesh->n[v[2]]);
+        if (mesh->HasNormals()) {
+            Normal3f ns(b[0] * mesh->N(v[0]) + b[1] * mesh->N(v[1]) +
+                        (1 - b[0] - b[1]) * mesh->N(v[2]));
             n = FaceForward(n, ns);
         } else if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
             n *= -1;
@@ -1133,9 +1197,9 @@ class Triangle {
         // Compute $(u,v)$ for sampled point on triangle
         // Get triangle texture coordinates in _uv_ array
         pstd::array<Point2f, 3> uv =
-            mesh->uv
+            mesh->HasUVs()
                 ? pstd::array<Point2f, 3>(
-                      {mesh->uv[v[0]], mesh->uv[v[1]], mesh->uv[v[2]]})
+                      {mesh->UV(v[0]), mesh->UV(v[1]), mesh->UV(v[2])})
                 : pstd::array<Point2f, 3>({Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
 
         Point2f uvSample = b[0] * uv[0] + b[1] * uv[1] + b[2] * uv[2];
@@ -1169,7 +1233,7 @@ class Triangle {
             // Get triangle vertices in _p0_, _p1_, and _p2_
             const TriangleMesh *mesh = GetMesh();
             const int *v = &mesh->vertexIndices[3 * triIndex];
-            Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+            Point3f p0 = mesh->P(v[0]), p1 = mesh->P(v[1]), p2 = mesh->P(v[2]);
 
             Point2f u = InvertSphericalTriangleSample({p0, p1, p2}, ctx.p(), wi);
             // Compute $\cos \theta$-based weights _w_ at sample domain corners
@@ -1188,16 +1252,6 @@ class Triangle {
     }
 
   private:
-    // Triangle Private Methods
-    PBRT_CPU_GPU
-    const TriangleMesh *GetMesh() const {
-#ifdef PBRT_IS_GPU_CODE
-        return (*allTriangleMeshesGPU)[meshIndex];
-#else
-        return (*allMeshes)[meshIndex];
-#endif
-    }
-
     // Triangle Private Members
     int meshIndex = -1, triIndex = -1;
     static pstd::vector<const TriangleMesh *> *allMeshes;
@@ -1259,7 +1313,54 @@ class Curve {
     std::string ToString() const;
 
     Curve(const CurveCommon *common, Float uMin, Float uMax)
-        : common(common), uMin(uMin), uMax(uMax) {}
+        : common(common),
+          uMin(uMin),
+          uMax(uMax),
+          cpObj(CubicBezierControlPoints(pstd::MakeConstSpan(common->cpObj), uMin,
+                                         uMax)),
+          maxWidth(std::max(Lerp(uMin, common->width[0], common->width[1]),
+                            Lerp(uMax, common->width[0], common->width[1]))) {}
+
+    CurveType Type() const { return common->type; }
+    // Returns the segment's Bezier control points and its widths at its
+    // endpoints in rendering space
+    void RenderSpaceSegment(pstd::array<Point3f, 4> *cp, Float width[2]) const;
+
+    // Returns the interaction at parametric distance _w_ along the segment for
+    // a ray with direction _dRender_ that hit its surface at _pRender_, both
+    // in rendering space, for intersections found without _IntersectRay()_.
+    PBRT_CPU_GPU
+    SurfaceInteraction InteractionFromIntersection(Float w, Point3f pRender,
+                                                   Vector3f dRender, Float time) const {
+        // Find the curve's center and $\dpdu$ at the intersection
+        Float u = Lerp(Clamp(w, 0, 1), uMin, uMax);
+        Float hitWidth = Lerp(u, common->width[0], common->width[1]);
+        Point3f p = (*common->objectFromRender)(pRender);
+        Vector3f d = Normalize((*common->objectFromRender)(dRender));
+        Vector3f dpdu;
+        Point3f pc = EvaluateCubicBezier(pstd::MakeConstSpan(common->cpObj), u, &dpdu);
+
+        // Compute $v$ from the hit's offset across the curve as seen by the ray
+        Vector3f across = Cross(d, dpdu);
+        if (LengthSquared(across) == 0) {
+            Vector3f unused;
+            CoordinateSystem(Normalize(dpdu), &across, &unused);
+        }
+        across = Normalize(across);
+        Float v =
+            hitWidth > 0 ? Clamp(0.5f + Dot(p - pc, across) / hitWidth, 0, 1) : 0.5f;
+
+        // Compute $\dpdv$ as _IntersectRay()_ does for flat and cylinder curves
+        Vector3f dpdv = across * hitWidth;
+        if (common->type == CurveType::Cylinder)
+            dpdv = Rotate(-Lerp(v, -90.f, 90.f), dpdu)(dpdv);
+
+        Vector3f pError(hitWidth, hitWidth, hitWidth);
+        bool flipNormal = common->reverseOrientation ^ common->transformSwapsHandedness;
+        SurfaceInteraction intr(Point3fi(p, pError), {u, v}, -d, dpdu, dpdv, Normal3f(),
+                                Normal3f(), time, flipNormal);
+        return (*common->renderFromObject)(intr);
+    }
 
     PBRT_CPU_GPU
     DirectionCone NormalBounds() const { return DirectionCone::EntireSphere(); }
@@ -1268,13 +1369,17 @@ class Curve {
     // Curve Private Methods
     bool IntersectRay(const Ray &r, Float tMax,
                       pstd::optional<ShapeIntersection> *si) const;
-    bool RecursiveIntersect(const Ray &r, Float tMax, pstd::span<const Point3f> cp,
-                            const Transform &ObjectFromRay, Float u0, Float u1, int depth,
-                            pstd::optional<ShapeIntersection> *si) const;
+    bool IntersectSegment(const Ray &r, Float tMax, pstd::span<const Point3f> cp,
+                          const Frame &rayFrame, Float u0, Float u1,
+                          pstd::optional<ShapeIntersection> *si) const;
 
     // Curve Private Members
     const CurveCommon *common;
     Float uMin, uMax;
+    // Object-space control points of the segment and its maximum width, which
+    // are precomputed so that rays don't need to compute them
+    pstd::array<Point3f, 4> cpObj;
+    Float maxWidth;
 };
 
 // BilinearPatch Declarations
@@ -1356,6 +1461,34 @@ PBRT_CPU_GPU inline pstd::optional<BilinearIntersection> IntersectBilinearPatch(
     return BilinearIntersection{{u, v}, t};
 }
 
+// BilinearPatchBatch Definition
+// Vertices of up to _Width_ bilinear patches stored in SoA layout so that the
+// ray's quadratic for all of them is solved together, without branches. As with
+// _TriangleBatch_, the test is conservative: its slack is far larger than the
+// rounding error of IntersectBilinearPatch(), so the reported candidates only
+// need to be confirmed with it.
+struct alignas(32) BilinearPatchBatch {
+    static constexpr int Width = 8;
+    // BilinearPatchBatch Public Methods
+    void Set(int i, Point3f p00, Point3f p10, Point3f p01, Point3f p11) {
+        for (int axis = 0; axis < 3; ++axis) {
+            p[0][axis][i] = p00[axis];
+            p[1][axis][i] = p10[axis];
+            p[2][axis][i] = p01[axis];
+            p[3][axis][i] = p11[axis];
+        }
+        count = std::max(count, i + 1);
+    }
+
+    // Returns a bitmask of the patches that the ray may intersect before _tMax_
+    int Candidates(const Ray &ray, Float tMax) const;
+
+    // Vertices are stored as [vertex][axis][patch], with vertices in the order
+    // $\pt{}_{00}$, $\pt{}_{10}$, $\pt{}_{01}$, $\pt{}_{11}$
+    Float p[4][3][Width];
+    int count = 0;
+};
+
 // BilinearPatch Definition
 class BilinearPatch {
   public:
@@ -1369,8 +1502,11 @@ class BilinearPatch {
                                          const ParameterDictionary &parameters,
                                          const FileLoc *loc, Allocator alloc);
 
+    // If _splitParallelograms_ is set, patches that are parallelograms are
+    // returned as the pair of triangles that represents each of them exactly
     static pstd::vector<Shape> CreatePatches(const BilinearPatchMesh *mesh,
-                                             Allocator alloc);
+                                             Allocator alloc,
+                                             bool splitParallelograms = false);
 
     PBRT_CPU_GPU
     Bounds3f Bounds() const;
@@ -1402,6 +1538,13 @@ class BilinearPatch {
     PBRT_CPU_GPU
     Float Area() const { return area; }
 
+    PBRT_CPU_GPU
+    pstd::array<Point3f, 4> Vertices() const {
+        const BilinearPatchMesh *mesh = GetMesh();
+        const int *v = &mesh->vertexIndices[4 * blpIndex];
+        return {mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]], mesh->p[v[3]]};
+    }
+
     PBRT_CPU_GPU
     static SurfaceInteraction InteractionFromIntersection(const BilinearPatchMesh *mesh,
                                                           int blpIndex, Point2f uv,
@@ -1557,6 +1700,13 @@ inline Bounds3f Shape::Bounds() const {
     return Dispatch(bounds);
 }
 
+inline Bounds3f Shape::ClippedBounds(const Bounds3f &clip) const {
+    // Only triangles are clipped exactly; other shapes use their bounds
+    if (Is<Triangle>())
+        return Cast<Triangle>()->ClippedBounds(clip);
+    return pbrt::Intersect(Bounds(), clip);
+}
+
 inline pstd::optional<ShapeIntersection> Shape::Intersect(const Ray &ray,
                                                           Float tMax) const {
     auto intr = [&](auto ptr) { return ptr->Intersect(ray, tMax); };
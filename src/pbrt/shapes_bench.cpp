@@ -0,0 +1,44 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/shapes.h>
+#include <pbrt/util/rng.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// Ray--triangle micro-benchmark: rays from random points above the $z=0$
+// plane toward it are tested against random triangles in the unit square, so
+// that about a quarter of the tests report a hit.
+
+static void BM_IntersectTriangle(benchmark::State &state) {
+    constexpr int nTests = 4096;
+    RNG rng;
+    std::vector<Ray> rays;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nTests; ++i) {
+        Point3f o(rng.Uniform<Float>(), rng.Uniform<Float>(), 1);
+        rays.push_back(Ray(o, Vector3f(.1f * rng.Uniform<Float>() - .05f,
+                                       .1f * rng.Uniform<Float>() - .05f, -1)));
+        for (int j = 0; j < 3; ++j)
+            p.push_back(Point3f(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                                .1f * rng.Uniform<Float>()));
+    }
+
+    int index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(IntersectTriangle(rays[index], Infinity, p[3 * index],
+                                                   p[3 * index + 1], p[3 * index + 2]));
+        if (++index == nTests)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_IntersectTriangle);
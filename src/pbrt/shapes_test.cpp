@@ -335,6 +335,37 @@ static Transform randomTransform(RNG &rng) {
 
 const int nReintersect = 1000;
 
+TEST(Triangle, ClippedBounds) {
+    Transform identity;
+    std::vector<int> indices{0, 1, 2};
+    std::vector<Point3f> p{Point3f(0, 0, 0), Point3f(4, 0, 0), Point3f(0, 4, 2)};
+    TriangleMesh mesh(identity, false, indices, p, {}, {}, {}, {});
+    auto tris = Triangle::CreateTriangles(&mesh, Allocator());
+    ASSERT_EQ(1, tris.size());
+    Shape tri = tris[0];
+
+    // Clipping to a box containing the triangle gives its bounds
+    Bounds3f all(Point3f(-1, -1, -1), Point3f(5, 5, 5));
+    EXPECT_EQ(tri.Bounds(), tri.ClippedBounds(all));
+
+    // Clip away the part with x > 2; the hypotenuse runs from (4,0,0) to
+    // (0,4,2), so at x = 2 it is at y = 2, z = 1.
+    Bounds3f left(Point3f(-1, -1, -1), Point3f(2, 5, 5));
+    EXPECT_EQ(Bounds3f(Point3f(0, 0, 0), Point3f(2, 4, 2)), tri.ClippedBounds(left));
+
+    // A box around the corner at (4,0,0) only bounds that corner's region
+    Bounds3f corner(Point3f(3, -1, -1), Point3f(5, 5, 5));
+    Bounds3f cb = tri.ClippedBounds(corner);
+    EXPECT_EQ(3, cb.pMin.x);
+    EXPECT_EQ(4, cb.pMax.x);
+    EXPECT_FLOAT_EQ(1, cb.pMax.y);
+    EXPECT_FLOAT_EQ(.5f, cb.pMax.z);
+
+    // Disjoint boxes give empty bounds
+    Bounds3f disjoint(Point3f(3, 3, -1), Point3f(5, 5, 5));
+    EXPECT_TRUE(tri.ClippedBounds(disjoint).IsDegenerate());
+}
+
 TEST(FullSphere, Reintersect) {
     ParallelFor(0, nReintersect, [](int64_t i) {
         RNG rng(i);
@@ -431,6 +462,76 @@ TEST(Cylinder, Reintersect) {
     });
 }
 
+TEST(Triangle, BatchCandidates) {
+    // Rays aimed at vertices and edges of random triangles are only
+    // reported as candidates or missed, never wrongly rejected.
+    RNG rng(431);
+    for (int trial = 0; trial < 2000; ++trial) {
+        TriangleBatch batch;
+        Point3f p[TriangleBatch::Width][3];
+        for (int i = 0; i < TriangleBatch::Width; ++i) {
+            for (int v = 0; v < 3; ++v)
+                p[i][v] = Point3f(pUnif(rng), pUnif(rng), pUnif(rng));
+            batch.Set(i, p[i][0], p[i][1], p[i][2]);
+        }
+
+        // Aim ray at a vertex, an edge point, or an interior point of one triangle
+        int target = trial % TriangleBatch::Width;
+        Float b0 = rng.Uniform<Float>(), b1 = (1 - b0) * rng.Uniform<Float>();
+        if (trial % 3 == 0)
+            b0 = 1, b1 = 0;
+        else if (trial % 3 == 1)
+            b1 = 1 - b0;
+        Point3f pTarget = b0 * p[target][0] + b1 * p[target][1] +
+                          (1 - b0 - b1) * p[target][2];
+        Point3f o(pUnif(rng, 20), pUnif(rng, 20), pUnif(rng, 20));
+        Ray ray(o, pTarget - o);
+
+        int candidates = batch.Candidates(ray);
+        for (int i = 0; i < TriangleBatch::Width; ++i)
+            if (IntersectTriangle(ray, Infinity, p[i][0], p[i][1], p[i][2]))
+                EXPECT_TRUE(candidates & (1 << i)) << ray << " triangle " << i;
+    }
+
+    // Unused lanes of partially filled batches are never reported
+    TriangleBatch batch;
+    batch.Set(0, Point3f(-1, -1, 0), Point3f(1, -1, 0), Point3f(0, 1, 0));
+    EXPECT_EQ(1, batch.Candidates(Ray(Point3f(0, 0, -1), Vector3f(0, 0, 1))));
+    EXPECT_EQ(0, batch.Candidates(Ray(Point3f(5, 0, -1), Vector3f(0, 0, 1))));
+}
+
+TEST(Triangle, PrecomputedCandidates) {
+    // As with batches, rays aimed at vertices and edges of random triangles are
+    // never wrongly rejected by precomputed triangles.
+    RNG rng(97);
+    for (int trial = 0; trial < 10000; ++trial) {
+        Point3f p[3];
+        for (int v = 0; v < 3; ++v)
+            p[v] = Point3f(pUnif(rng), pUnif(rng), pUnif(rng));
+        PrecomputedTriangle tri(p[0], p[1], p[2]);
+
+        Float b0 = rng.Uniform<Float>(), b1 = (1 - b0) * rng.Uniform<Float>();
+        if (trial % 3 == 0)
+            b0 = 1, b1 = 0;
+        else if (trial % 3 == 1)
+            b1 = 1 - b0;
+        Point3f pTarget = b0 * p[0] + b1 * p[1] + (1 - b0 - b1) * p[2];
+        Point3f o(pUnif(rng, 20), pUnif(rng, 20), pUnif(rng, 20));
+        Ray ray(o, pTarget - o);
+        for (Float tMax : {Infinity, Float(1), Float(0.5)})
+            if (IntersectTriangle(ray, tMax, p[0], p[1], p[2]))
+                EXPECT_TRUE(tri.MayIntersect(ray, tMax)) << ray << " tMax " << tMax;
+    }
+
+    // Clear misses are rejected
+    PrecomputedTriangle tri(Point3f(-1, -1, 0), Point3f(1, -1, 0), Point3f(0, 1, 0));
+    EXPECT_TRUE(tri.MayIntersect(Ray(Point3f(0, 0, -1), Vector3f(0, 0, 1)), Infinity));
+    EXPECT_TRUE(tri.MayIntersect(Ray(Point3f(0, 0, 1), Vector3f(0, 0, -1)), Infinity));
+    EXPECT_FALSE(tri.MayIntersect(Ray(Point3f(5, 0, -1), Vector3f(0, 0, 1)), Infinity));
+    EXPECT_FALSE(tri.MayIntersect(Ray(Point3f(0, 0, -1), Vector3f(0, 0, 1)), 0.5f));
+    EXPECT_FALSE(tri.MayIntersect(Ray(Point3f(0, 0, 1), Vector3f(0, 0, 1)), Infinity));
+}
+
 TEST(Triangle, BadCases) {
     Transform identity;
     std::vector<int> indices{0, 1, 2};
@@ -446,3 +547,182 @@ TEST(Triangle, BadCases) {
 
     EXPECT_FALSE(tris[0].Intersect(ray).has_value());
 }
+
+TEST(Triangle, CompressedMesh) {
+    Transform identity;
+    std::vector<int> indices{0, 1, 2, 2, 1, 3};
+    std::vector<Point3f> p{Point3f(-1, -2, 0.5f), Point3f(3, -2, 0.25f),
+                           Point3f(-1, 1, 0), Point3f(3, 1, 0.125f)};
+    std::vector<Normal3f> n{Normal3f(0, 0, 1), Normal3f(0.1f, 0, 1),
+                            Normal3f(0, -0.2f, 1), Normal3f(0.3f, 0.3f, 1)};
+    std::vector<Point2f> uv{Point2f(0, 0), Point2f(1, 0), Point2f(0, 1),
+                            Point2f(1, 1)};
+    TriangleMesh mesh(identity, false, indices, p, {}, n, uv, {}, true);
+    ASSERT_TRUE(mesh.HasNormals() && mesh.HasUVs());
+
+    // Reconstructed vertices are close to the originals
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_LT(Distance(p[i], mesh.P(i)), 1e-4f);
+        EXPECT_GT(Dot(Normalize(n[i]), mesh.N(i)), 0.9999f);
+        EXPECT_EQ(uv[i], mesh.UV(i));
+    }
+
+    // A ray through the shared edge hits one of the triangles, which have
+    // identical copies of its vertices
+    auto tris = Triangle::CreateTriangles(&mesh, Allocator());
+    ASSERT_EQ(2, tris.size());
+    Point3f pEdge = (mesh.P(1) + mesh.P(2)) / 2;
+    Ray ray(pEdge + Vector3f(0, 0, 1), Vector3f(0, 0, -1));
+    EXPECT_TRUE(tris[0].IntersectP(ray) || tris[1].IntersectP(ray));
+}
+
+TEST(Curve, InteractionFromIntersection) {
+    // Interactions computed from a hit point should match the ones that
+    // Curve::Intersect() returns
+    Point3f cp[4] = {Point3f(-1, 0, 0), Point3f(-0.3, 0.5, 0.2), Point3f(0.3, -0.4, 0.1),
+                     Point3f(1, 0.1, 0)};
+    Transform renderFromObject = Translate(Vector3f(0.5, -0.25, 3));
+    Transform objectFromRender = Inverse(renderFromObject);
+    RNG rng(5);
+    for (CurveType type : {CurveType::Flat, CurveType::Cylinder}) {
+        CurveCommon common(cp, 0.2, 0.1, type, {}, &renderFromObject, &objectFromRender,
+                           false);
+        Curve curve(&common, 0.25, 0.75);
+        int nHits = 0;
+        for (int i = 0; i < 100; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), 0.2, 0.8),
+                      Lerp(rng.Uniform<Float>(), -0.5, 0), 0);
+            Ray ray(o, Vector3f(0, 0, 1));
+            pstd::optional<ShapeIntersection> si = curve.Intersect(ray, Infinity);
+            if (!si)
+                continue;
+            ++nHits;
+
+            Float w = (si->intr.uv[0] - 0.25f) / 0.5f;
+            SurfaceInteraction intr =
+                curve.InteractionFromIntersection(w, si->intr.p(), ray.d, ray.time);
+            EXPECT_NEAR(si->intr.uv[0], intr.uv[0], 1e-4f);
+            EXPECT_NEAR(si->intr.uv[1], intr.uv[1], 5e-3f);
+            EXPECT_GT(Dot(si->intr.n, intr.n), 0.999f);
+        }
+        EXPECT_GT(nHits, 10);
+    }
+}
+
+TEST(Curve, IntersectPMatchesIntersect) {
+    // Rays from random directions that pass near the curve should be reported
+    // as hitting it by IntersectP() exactly when Intersect() finds a hit
+    Point3f cp[4] = {Point3f(-1, 0, 0), Point3f(-0.3, 0.5, 0.2), Point3f(0.3, -0.4, 0.1),
+                     Point3f(1, 0.1, 0)};
+    Normal3f n[2] = {Normal3f(0, 0, 1), Normal3f(0, 1, 1)};
+    Transform identity;
+    RNG rng(7);
+    for (CurveType type : {CurveType::Flat, CurveType::Cylinder, CurveType::Ribbon}) {
+        pstd::span<const Normal3f> norm;
+        if (type == CurveType::Ribbon)
+            norm = pstd::span<const Normal3f>(n);
+        CurveCommon common(cp, 0.2, 0.1, type, norm, &identity, &identity, false);
+        Curve curve(&common, 0.25, 0.75);
+        int nHits = 0;
+        for (int i = 0; i < 1000; ++i) {
+            Point3f pTarget = EvaluateCubicBezier(pstd::MakeConstSpan(cp),
+                                                  Lerp(rng.Uniform<Float>(), 0.2, 0.8));
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Vector3f w = SampleUniformSphere(u);
+            Vector3f offset(rng.Uniform<Float>() - 0.5f, rng.Uniform<Float>() - 0.5f,
+                            rng.Uniform<Float>() - 0.5f);
+            Ray ray(pTarget + 0.2f * offset - 3 * w, w);
+            pstd::optional<ShapeIntersection> si = curve.Intersect(ray, Infinity);
+            EXPECT_EQ(si.has_value(), curve.IntersectP(ray, Infinity));
+            if (!si)
+                continue;
+            ++nHits;
+            EXPECT_LT(si->tHit, 6);
+            EXPECT_GE(si->intr.uv[0], 0.25f);
+            EXPECT_LE(si->intr.uv[0], 0.75f);
+            // A ray ending just before the hit shouldn't reach the curve
+            EXPECT_FALSE(curve.IntersectP(ray, 0.99f * si->tHit));
+        }
+        EXPECT_GT(nHits, 50);
+    }
+}
+
+TEST(BilinearPatch, BatchCandidates) {
+    // Rays aimed at random points of random patches are never wrongly rejected
+    RNG rng(517);
+    for (int trial = 0; trial < 2000; ++trial) {
+        BilinearPatchBatch batch;
+        Point3f p[BilinearPatchBatch::Width][4];
+        for (int i = 0; i < BilinearPatchBatch::Width; ++i) {
+            for (int v = 0; v < 4; ++v)
+                p[i][v] = Point3f(pUnif(rng), pUnif(rng), pUnif(rng));
+            // Make some of the patches planar
+            if (trial % 2)
+                p[i][3] = p[i][1] + (p[i][2] - p[i][0]);
+            batch.Set(i, p[i][0], p[i][1], p[i][2], p[i][3]);
+        }
+
+        int target = trial % BilinearPatchBatch::Width;
+        Float u = rng.Uniform<Float>(), v = rng.Uniform<Float>();
+        if (trial % 3 == 0)
+            u = 0;
+        Point3f pTarget = Lerp(u, Lerp(v, p[target][0], p[target][2]),
+                               Lerp(v, p[target][1], p[target][3]));
+        Point3f o(pUnif(rng, 20), pUnif(rng, 20), pUnif(rng, 20));
+        Ray ray(o, pTarget - o);
+        for (Float tMax : {Infinity, Float(1.5), Float(0.5)}) {
+            int candidates = batch.Candidates(ray, tMax);
+            for (int i = 0; i < BilinearPatchBatch::Width; ++i)
+                if (IntersectBilinearPatch(ray, tMax, p[i][0], p[i][1], p[i][2],
+                                           p[i][3]))
+                    EXPECT_TRUE(candidates & (1 << i))
+                        << ray << " tMax " << tMax << " patch " << i;
+        }
+    }
+
+    // Clear misses and unused lanes are not reported
+    BilinearPatchBatch batch;
+    batch.Set(0, Point3f(-1, -1, 0), Point3f(1, -1, 0), Point3f(-1, 1, 0),
+              Point3f(1, 1, 1));
+    Ray ray(Point3f(0, 0, -1), Vector3f(0, 0, 1));
+    EXPECT_EQ(1, batch.Candidates(ray, Infinity));
+    EXPECT_EQ(0, batch.Candidates(ray, 0.5f));
+    EXPECT_EQ(0, batch.Candidates(Ray(Point3f(5, 0, -1), Vector3f(0, 0, 1)), Infinity));
+    EXPECT_EQ(0, batch.Candidates(Ray(Point3f(0, 0, 1), Vector3f(0, 0, 1)), Infinity));
+}
+
+TEST(BilinearPatch, SplitParallelograms) {
+    // A parallelogram becomes two triangles and a nonplanar patch is kept
+    Transform identity;
+    std::vector<int> indices = {0, 1, 2, 3, 4, 5, 6, 7};
+    std::vector<Point3f> p = {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0.5, 1, 0),
+                              Point3f(1.5, 1, 0), Point3f(2, 0, 0), Point3f(3, 0, 0),
+                              Point3f(2, 1, 0),   Point3f(3, 1, 1)};
+    BilinearPatchMesh *mesh =
+        new BilinearPatchMesh(identity, true, indices, p, {}, {}, {}, nullptr);
+    pstd::vector<Shape> patches = BilinearPatch::CreatePatches(mesh, Allocator());
+    pstd::vector<Shape> split = BilinearPatch::CreatePatches(mesh, Allocator(), true);
+    ASSERT_EQ(3, split.size());
+    EXPECT_TRUE(split[0].Is<Triangle>());
+    EXPECT_TRUE(split[1].Is<Triangle>());
+    EXPECT_TRUE(split[2].Is<BilinearPatch>());
+    EXPECT_EQ(patches[1].Bounds(), split[2].Bounds());
+
+    // The triangles match the patch's points, parameterization, and normals
+    RNG rng(3);
+    for (int i = 0; i < 100; ++i) {
+        Point3f pTarget(rng.Uniform<Float>() * 1.5f, rng.Uniform<Float>(), 0);
+        Ray ray(pTarget + Vector3f(0, 0, 1), Vector3f(0.1f, 0.2f, -1));
+        pstd::optional<ShapeIntersection> si = patches[0].Intersect(ray);
+        pstd::optional<ShapeIntersection> siSplit = split[0].Intersect(ray);
+        if (!siSplit)
+            siSplit = split[1].Intersect(ray);
+        ASSERT_EQ(si.has_value(), siSplit.has_value()) << ray;
+        if (!si)
+            continue;
+        EXPECT_NEAR(si->tHit, siSplit->tHit, 1e-5f);
+        EXPECT_LT(Distance(si->intr.p(), siSplit->intr.p()), 1e-5f);
+        EXPECT_LT(Distance(si->intr.uv, siSplit->intr.uv), 1e-5f);
+        EXPECT_GT(Dot(si->intr.n, siSplit->intr.n), 0.9999f);
+    }
+}
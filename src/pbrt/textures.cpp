@@ -8,17 +8,26 @@
 #include <pbrt/gpu/util.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
 #include <pbrt/interaction.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
+#include <pbrt/util/blockcompress.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/float.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/splines.h>
 #include <pbrt/util/stats.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include <Ptexture.h>
 
@@ -354,6 +363,16 @@ SampledSpectrum SpectrumImageTexture::Evaluate(TextureEvalContext ctx,
     Point2f st = mapping.Map(ctx, &dstdx, &dstdy);
     st[1] = 1 - st[1];
 
+    if (rgbCoefficients) {
+        // Evaluate sigmoid polynomial with filtered precomputed coefficients
+        RGB c = rgbCoefficients->Filter<RGB>(st, dstdx, dstdy);
+        RGBSigmoidPolynomial rsp(c.r, c.g, c.b);
+        SampledSpectrum s;
+        for (int i = 0; i < NSpectrumSamples; ++i)
+            s[i] = rsp(lambda[i]);
+        return s;
+    }
+
     // Lookup filtered RGB value in _MIPMap_
     RGB rgb = scale * mipmap->Filter<RGB>(st, dstdx, dstdy);
     rgb = ClampZero(invert ? (RGB(1, 1, 1) - rgb) : rgb);
@@ -374,6 +393,55 @@ SampledSpectrum SpectrumImageTexture::Evaluate(TextureEvalContext ctx,
 #endif
 }
 
+// Sigmoid polynomial coefficient MIP maps, indexed by the RGB _MIPMap_ as well
+// as the texture's scale and whether it is inverted
+static std::mutex coefficientCacheMutex;
+static std::map<std::tuple<const MIPMap *, Float, bool>, MIPMap *> coefficientCache;
+
+bool SpectrumImageTexture::PrecomputeRGBCoefficients(Allocator alloc) {
+    rgbCoefficients = nullptr;
+#ifdef PBRT_RGB_SPECTRUM_FAST_PATH
+    // RGB spectra don't use sigmoid polynomials in this configuration
+    return false;
+#else
+    const RGBColorSpace *cs = mipmap->GetRGBColorSpace();
+    // Only albedo spectra can be represented using coefficients alone; the
+    // others also need a per-texel scale factor
+    if (!cs || spectrumType != SpectrumType::Albedo)
+        return false;
+
+    std::tuple<const MIPMap *, Float, bool> key(mipmap, scale, invert);
+    std::unique_lock<std::mutex> lock(coefficientCacheMutex);
+    if (auto iter = coefficientCache.find(key); iter != coefficientCache.end()) {
+        rgbCoefficients = iter->second;
+        return rgbCoefficients != nullptr;
+    }
+    lock.unlock();
+
+    // Compute coefficients from the RGB values that Evaluate() would use
+    const std::string channelNames[3] = {"c0", "c1", "c2"};
+    MIPMap *coefficients = mipmap->MapTexels(
+        channelNames,
+        [&](pstd::span<const Float> texel, pstd::span<Float> c) {
+            RGB rgb = texel.size() >= 3 ? RGB(texel[0], texel[1], texel[2])
+                                        : RGB(texel[0], texel[0], texel[0]);
+            rgb = ClampZero(invert ? (RGB(1, 1, 1) - scale * rgb) : scale * rgb);
+            pstd::array<Float, 3> coeffs =
+                cs->ToRGBCoeffs(Clamp(rgb, 0, 1)).Coefficients();
+            for (int i = 0; i < 3; ++i)
+                c[i] = coeffs[i];
+        },
+        alloc);
+
+    lock.lock();
+    if (auto iter = coefficientCache.find(key); iter != coefficientCache.end())
+        rgbCoefficients = iter->second;
+    else
+        coefficientCache[key] = rgbCoefficients = coefficients;
+    return rgbCoefficients != nullptr;
+#endif
+}
+
 std::string SpectrumImageTexture::ToString() const {
     return StringPrintf("[ SpectrumImageTexture filename: %s mapping: %s scale: %f "
                         "invert: %s mipmap: %s ]",
@@ -395,6 +463,12 @@ std::string TexInfo::ToString() const {
 std::mutex ImageTextureBase::textureCacheMutex;
 std::map<TexInfo, MIPMap *> ImageTextureBase::textureCache;
 
+void ImageTextureBase::ClearCache() {
+    textureCache.clear();
+    std::lock_guard<std::mutex> lock(coefficientCacheMutex);
+    coefficientCache.clear();
+}
+
 FloatImageTexture *FloatImageTexture::Create(const Transform &renderFromTexture,
                                              const TextureParameterDictionary &parameters,
                                              const FileLoc *loc, Allocator alloc) {
@@ -459,14 +533,28 @@ SpectrumImageTexture *SpectrumImageTexture::Create(
     std::string encodingString = parameters.GetOneString("encoding", defaultEncoding);
     ColorEncoding encoding = ColorEncoding::Get(encodingString, alloc);
 
-    return alloc.new_object<SpectrumImageTexture>(map, filename, filterOptions, *wrapMode,
-                                                  scale, invert, encoding, spectrumType,
-                                                  alloc);
+    SpectrumImageTexture *texture = alloc.new_object<SpectrumImageTexture>(
+        map, filename, filterOptions, *wrapMode, scale, invert, encoding, spectrumType,
+        alloc);
+    if (parameters.GetOneBool("precomputespectra", false) &&
+        !texture->PrecomputeRGBCoefficients(alloc))
+        Warning(loc, "%s: unable to precompute spectra for texture; only in-memory "
+                "RGB albedo textures are supported.", filename);
+    return texture;
 }
 
 // MarbleTexture Method Definitions
 SampledSpectrum MarbleTexture::Evaluate(TextureEvalContext ctx,
                                         SampledWavelengths lambda) const {
+    RGB rgb = EvaluateRGB(ctx);
+#ifdef PBRT_IS_GPU_CODE
+    return RGBAlbedoSpectrum(*RGBColorSpace_sRGB, rgb).Sample(lambda);
+#else
+    return RGBAlbedoSpectrum(*RGBColorSpace::sRGB, rgb).Sample(lambda);
+#endif
+}
+
+RGB MarbleTexture::EvaluateRGB(TextureEvalContext ctx) const {
     Vector3f dpdx, dpdy;
     Point3f p = mapping.Map(ctx, &dpdx, &dpdy);
     p *= scale;
@@ -481,13 +569,7 @@ SampledSpectrum MarbleTexture::Evaluate(TextureEvalContext ctx,
     int nSeg = PBRT_ARRAYSIZE(c) - 3;
     int first = std::min<int>(pstd::floor(t * nSeg), nSeg - 1);
     t = t * nSeg - first;
-    RGB rgb = 1.5f * EvaluateCubicBezier(pstd::span(c + first, 4), t);
-
-#ifdef PBRT_IS_GPU_CODE
-    return RGBAlbedoSpectrum(*RGBColorSpace_sRGB, rgb).Sample(lambda);
-#else
-    return RGBAlbedoSpectrum(*RGBColorSpace::sRGB, rgb).Sample(lambda);
-#endif
+    return 1.5f * EvaluateCubicBezier(pstd::span(c + first, 4), t);
 }
 
 std::string MarbleTexture::ToString() const {
@@ -542,25 +624,49 @@ static Ptex::PtexCache *cache;
 
 STAT_COUNTER("Texture/Ptex lookups", nLookups);
 STAT_COUNTER("Texture/Ptex files accessed", nFilesAccessed);
+STAT_COUNTER("Texture/Ptex file reopens", nFileReopens);
 STAT_COUNTER("Texture/Ptex block reads", nBlockReads);
+STAT_MEMORY_COUNTER("Memory/Ptex memory used", memoryUsed);
 STAT_MEMORY_COUNTER("Memory/Ptex peak memory used", peakMemoryUsed);
 STAT_MEMORY_COUNTER("Memory/GPU Ptex memory used", gpuPtexMemoryUsed);
-STAT_RATIO("Texture/Ptex file cache hits", ptexCacheHits, ptexCacheLookups);
+STAT_PERCENT("Texture/Ptex thread handle hits", nThreadHandleHits, nThreadHandleLookups);
 
 struct : public PtexErrorHandler {
     void reportError(const char *error) override { Error("%s", error); }
 } errorHandler;
 
+// Ptex Thread Handle Definitions
+// With --ptex-thread-handles, each thread keeps the texture handle and filter
+// for each Ptex texture it has used, indexed by the texture's id, until it exits.
+struct PtexThreadHandle {
+    Ptex::PtexTexture *texture = nullptr;
+    Ptex::PtexFilter *filter = nullptr;
+};
+
+struct PtexThreadHandles {
+    ~PtexThreadHandles() {
+        for (PtexThreadHandle &handle : handles)
+            if (handle.texture) {
+                handle.filter->release();
+                handle.texture->release();
+            }
+    }
+    std::vector<PtexThreadHandle> handles;
+};
+
+static thread_local PtexThreadHandles ptexThreadHandles;
+static std::atomic<int> nextPtexTextureId{0};
+
 // PtexTexture Method Definitions
 
 PtexTextureBase::PtexTextureBase(const std::string &filename, ColorEncoding encoding,
                                  Float scale)
-    : filename(filename), encoding(encoding), scale(scale) {
-    std::mutex mutex;
+    : filename(filename), encoding(encoding), scale(scale), id(nextPtexTextureId++) {
+    static std::mutex mutex;
     mutex.lock();
     if (cache == nullptr) {
-        int maxFiles = 100;
-        size_t maxMem = 1ull << 32;  // 4GB
+        int maxFiles = Options->ptexCacheFiles;
+        size_t maxMem = size_t(Options->ptexCacheMemory) << 20;
         bool premultiply = true;
 
         cache = Ptex::PtexCache::create(maxFiles, maxMem, premultiply, nullptr,
@@ -593,7 +699,9 @@ void PtexTextureBase::ReportStats() {
     cache->getStats(stats);
 
     nFilesAccessed += stats.filesAccessed;
+    nFileReopens += stats.fileReopens;
     nBlockReads += stats.blockReads;
+    memoryUsed = std::max(memoryUsed, int64_t(stats.memUsed));
     peakMemoryUsed = std::max(peakMemoryUsed, int64_t(stats.peakMemUsed));
 }
 
@@ -604,19 +712,38 @@ int PtexTextureBase::SampleTexture(TextureEvalContext ctx, float result[3]) cons
     }
 
     ++nLookups;
-    Ptex::String error;
-    Ptex::PtexTexture *texture = cache->get(filename.c_str(), error);
-    CHECK(texture != nullptr);
-    // TODO: make the filter an option?
-    Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
-    Ptex::PtexFilter *filter = Ptex::PtexFilter::getFilter(texture, opts);
-    int nc = texture->numChannels();
+    // Get the texture and a filter for it, reusing the thread's if it has them
+    PtexThreadHandle handle;
+    PtexThreadHandle *threadHandle = nullptr;
+    if (Options->ptexThreadHandles) {
+        std::vector<PtexThreadHandle> &handles = ptexThreadHandles.handles;
+        if (size_t(id) >= handles.size())
+            handles.resize(id + 1);
+        threadHandle = &handles[id];
+        handle = *threadHandle;
+        ++nThreadHandleLookups;
+        if (handle.texture)
+            ++nThreadHandleHits;
+    }
+    if (!handle.texture) {
+        Ptex::String error;
+        handle.texture = cache->get(filename.c_str(), error);
+        CHECK(handle.texture != nullptr);
+        // TODO: make the filter an option?
+        Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
+        handle.filter = Ptex::PtexFilter::getFilter(handle.texture, opts);
+        if (threadHandle)
+            *threadHandle = handle;
+    }
+    int nc = handle.texture->numChannels();
 
     int firstChan = 0;
-    filter->eval(result, firstChan, nc, ctx.faceIndex, ctx.uv[0], ctx.uv[1], ctx.dudx,
-                 ctx.dvdx, ctx.dudy, ctx.dvdy);
-    filter->release();
-    texture->release();
+    handle.filter->eval(result, firstChan, nc, ctx.faceIndex, ctx.uv[0], ctx.uv[1],
+                        ctx.dudx, ctx.dvdx, ctx.dudy, ctx.dvdy);
+    if (!threadHandle) {
+        handle.filter->release();
+        handle.texture->release();
+    }
 
     if (encoding != ColorEncoding::Linear) {
         // It feels a little dirty to convert to 8-bits to run through the
@@ -948,6 +1075,7 @@ struct LuminanceTextureCacheItem {
     cudaTextureReadMode readMode;
     int nMIPMapLevels;
     bool originallySingleChannel;
+    const GPUVirtualTexture *virtualTexture;
 };
 
 struct RGBTextureCacheItem {
@@ -955,14 +1083,70 @@ struct RGBTextureCacheItem {
     cudaTextureReadMode readMode;
     int nMIPMapLevels;
     const RGBColorSpace *colorSpace;
+    const GPUVirtualTexture *virtualTexture;
 };
 
+// CUDA arrays belong to a single GPU, so each GPU has its own cache entries
+using TextureCacheKey = std::pair<int, std::string>;
 static std::mutex textureCacheMutex;
-static std::map<std::string, LuminanceTextureCacheItem> lumTextureCache;
-static std::map<std::string, RGBTextureCacheItem> rgbTextureCache;
+static std::map<TextureCacheKey, LuminanceTextureCacheItem> lumTextureCache;
+static std::map<TextureCacheKey, RGBTextureCacheItem> rgbTextureCache;
+
+static TextureCacheKey textureCacheKey(const std::string &filename) {
+    int device;
+    CUDA_CHECK(cudaGetDevice(&device));
+    return {device, filename};
+}
 
 STAT_MEMORY_COUNTER("Memory/ImageTextures", gpuImageTextureBytes);
 
+// Stores the levels of an 8-bit MIP map with one or three channels in BC4 or BC1
+// blocks. Since blocks are 4x4 texels, the smallest levels may be omitted;
+// false is returned if even the first level can't be compressed.
+static bool createBlockCompressedTextureArray(const MIPMap &mipmap,
+                                              cudaMipmappedArray_t *mipArray,
+                                              int *nMIPMapLevels) {
+    const Image &baseImage = mipmap.GetLevel(0);
+    int nChannels = baseImage.NChannels();
+    if (baseImage.Format() != PixelFormat::U256 || (nChannels != 1 && nChannels != 3))
+        return false;
+    int nLevels = 0;
+    while (nLevels < mipmap.Levels() &&
+           CanBlockCompress(mipmap.GetLevel(nLevels).Resolution()))
+        ++nLevels;
+    if (nLevels == 0)
+        return false;
+    *nMIPMapLevels = nLevels;
+
+    cudaChannelFormatDesc channelDesc =
+        nChannels == 3
+            ? cudaCreateChannelDesc<cudaChannelFormatKindUnsignedBlockCompressed1>()
+            : cudaCreateChannelDesc<cudaChannelFormatKindUnsignedBlockCompressed4>();
+    cudaExtent extent =
+        make_cudaExtent(baseImage.Resolution().x, baseImage.Resolution().y, 0);
+    CUDA_CHECK(cudaMallocMipmappedArray(mipArray, &channelDesc, extent, nLevels,
+                                        0 /* flags */));
+
+    for (int level = 0; level < nLevels; ++level) {
+        const Image &levelImage = mipmap.GetLevel(level);
+        Point2i resolution = levelImage.Resolution();
+        std::vector<uint8_t> blocks =
+            BlockCompress((const uint8_t *)levelImage.RawPointer({0, 0}), nChannels,
+                          resolution);
+        cudaArray_t levelArray;
+        CUDA_CHECK(cudaGetMipmappedArrayLevel(&levelArray, *mipArray, level));
+
+        // Block-compressed arrays are copied a row of blocks at a time
+        int pitch = resolution.x / 4 * BlockCompressedBlockBytes;
+        gpuImageTextureBytes += blocks.size();
+        CUDA_CHECK(cudaMemcpy2DToArray(levelArray, /* offset */ 0, 0, blocks.data(),
+                                       pitch, pitch, resolution.y / 4,
+                                       cudaMemcpyHostToDevice));
+    }
+
+    return true;
+}
+
 static cudaMipmappedArray_t createSingleChannelTextureArray(
     const Image &image, const RGBColorSpace *colorSpace, int *nMIPMapLevels) {
     CHECK_EQ(1, image.NChannels());
@@ -986,6 +1170,9 @@ static cudaMipmappedArray_t createSingleChannelTextureArray(
     MIPMap mipmap(image, colorSpace, WrapMode::Clamp /* TODO */, Allocator(),
                   MIPMapFilterOptions());
     *nMIPMapLevels = mipmap.Levels();
+    if (Options->compressGPUTextures &&
+        createBlockCompressedTextureArray(mipmap, &mipArray, nMIPMapLevels))
+        return mipArray;
 
     const Image &baseImage = mipmap.GetLevel(0);
     cudaExtent extent =
@@ -1021,6 +1208,383 @@ static cudaMipmappedArray_t createSingleChannelTextureArray(
     return mipArray;
 }
 
+static cudaMipmappedArray_t createRGBTextureArray(const MIPMap &mipmap,
+                                                  int *nMIPMapLevels) {
+    const Image &baseImage = mipmap.GetLevel(0);
+    CHECK_EQ(3, baseImage.NChannels());
+    cudaMipmappedArray_t mipArray;
+    *nMIPMapLevels = mipmap.Levels();
+    cudaExtent extent =
+        make_cudaExtent(baseImage.Resolution().x, baseImage.Resolution().y, 0);
+
+    switch (baseImage.Format()) {
+    case PixelFormat::U256: {
+        if (Options->compressGPUTextures &&
+            createBlockCompressedTextureArray(mipmap, &mipArray, nMIPMapLevels))
+            break;
+
+        cudaChannelFormatDesc channelDesc =
+            cudaCreateChannelDesc(8, 8, 8, 8, cudaChannelFormatKindUnsigned);
+        CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc, extent,
+                                            mipmap.Levels(), 0 /* flags */));
+        for (int level = 0; level < mipmap.Levels(); ++level) {
+            const Image &levelImage = mipmap.GetLevel(level);
+            cudaArray_t levelArray;
+            CUDA_CHECK(cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
+
+            std::vector<uint8_t> rgba(4 * levelImage.Resolution().x *
+                                      levelImage.Resolution().y);
+            size_t offset = 0;
+            for (int y = 0; y < levelImage.Resolution().y; ++y)
+                for (int x = 0; x < levelImage.Resolution().x; ++x) {
+                    for (int c = 0; c < 3; ++c)
+                        rgba[offset++] = ((uint8_t *)levelImage.RawPointer({x, y}))[c];
+                    rgba[offset++] = 255;
+                }
+
+            int pitch = levelImage.Resolution().x * 4 * sizeof(uint8_t);
+            gpuImageTextureBytes += pitch * levelImage.Resolution().y;
+
+            CUDA_CHECK(cudaMemcpy2DToArray(levelArray, /* offset */ 0, 0, rgba.data(),
+                                           pitch, pitch, levelImage.Resolution().y,
+                                           cudaMemcpyHostToDevice));
+        }
+        break;
+    }
+    case PixelFormat::Half: {
+        cudaChannelFormatDesc channelDesc =
+            cudaCreateChannelDesc(16, 16, 16, 16, cudaChannelFormatKindFloat);
+        CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc, extent,
+                                            mipmap.Levels(), 0 /* flags */));
+
+        for (int level = 0; level < mipmap.Levels(); ++level) {
+            const Image &levelImage = mipmap.GetLevel(level);
+            cudaArray_t levelArray;
+            CUDA_CHECK(cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
+
+            std::vector<Half> rgba(4 * levelImage.Resolution().x *
+                                   levelImage.Resolution().y);
+
+            size_t offset = 0;
+            for (int y = 0; y < levelImage.Resolution().y; ++y)
+                for (int x = 0; x < levelImage.Resolution().x; ++x) {
+                    for (int c = 0; c < 3; ++c)
+                        rgba[offset++] = Half(levelImage.GetChannel({x, y}, c));
+                    rgba[offset++] = Half(1.f);
+                }
+
+            int pitch = levelImage.Resolution().x * 4 * sizeof(Half);
+            gpuImageTextureBytes += pitch * levelImage.Resolution().y;
+
+            CUDA_CHECK(cudaMemcpy2DToArray(levelArray, /* offset */ 0, 0, rgba.data(),
+                                           pitch, pitch, levelImage.Resolution().y,
+                                           cudaMemcpyHostToDevice));
+        }
+        break;
+    }
+    case PixelFormat::Float: {
+        cudaChannelFormatDesc channelDesc =
+            cudaCreateChannelDesc(32, 32, 32, 32, cudaChannelFormatKindFloat);
+        CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc, extent,
+                                            mipmap.Levels(), 0 /* flags */));
+
+        for (int level = 0; level < mipmap.Levels(); ++level) {
+            const Image &levelImage = mipmap.GetLevel(level);
+            cudaArray_t levelArray;
+            CUDA_CHECK(cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
+
+            std::vector<float> rgba(4 * levelImage.Resolution().x *
+                                    levelImage.Resolution().y);
+
+            size_t offset = 0;
+            for (int y = 0; y < levelImage.Resolution().y; ++y)
+                for (int x = 0; x < levelImage.Resolution().x; ++x) {
+                    for (int c = 0; c < 3; ++c)
+                        rgba[offset++] = levelImage.GetChannel({x, y}, c);
+                    rgba[offset++] = 1.f;
+                }
+
+            int pitch = levelImage.Resolution().x * 4 * sizeof(float);
+            gpuImageTextureBytes += pitch * levelImage.Resolution().y;
+
+            CUDA_CHECK(cudaMemcpy2DToArray(levelArray, /* offset */ 0, 0, rgba.data(),
+                                           pitch, pitch, levelImage.Resolution().y,
+                                           cudaMemcpyHostToDevice));
+        }
+        break;
+    }
+    default:
+        LOG_FATAL("Unexpected PixelFormat");
+    }
+
+    return mipArray;
+}
+
+STAT_COUNTER("Texture/GPU texture tiles streamed", gpuTextureTilesStreamed);
+STAT_COUNTER("Texture/GPU texture tiles evicted", gpuTextureTilesEvicted);
+
+// Converts the texel at _p_ to _nChannels_ _Half_ values, where four-channel
+// texels have an alpha of one
+static void getHalfTexel(const Image &image, Point2i p, int nChannels, Half *texel) {
+    for (int c = 0; c < image.NChannels(); ++c)
+        texel[c] = Half(image.GetChannel(p, c));
+    if (nChannels == 4)
+        texel[3] = Half(1.f);
+}
+
+// Stores the MIP map's levels starting at _firstLevel_ using _Half_ texels
+// with one or four channels
+static cudaMipmappedArray_t createHalfTextureArray(const MIPMap &mipmap, int firstLevel,
+                                                   int nChannels) {
+    Point2i resolution = mipmap.GetLevel(firstLevel).Resolution();
+    int nLevels = mipmap.Levels() - firstLevel;
+    cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
+        16, nChannels == 4 ? 16 : 0, nChannels == 4 ? 16 : 0, nChannels == 4 ? 16 : 0,
+        cudaChannelFormatKindFloat);
+    cudaExtent extent = make_cudaExtent(resolution.x, resolution.y, 0);
+    cudaMipmappedArray_t mipArray;
+    CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc, extent, nLevels,
+                                        0 /* flags */));
+
+    for (int level = 0; level < nLevels; ++level) {
+        const Image &levelImage = mipmap.GetLevel(firstLevel + level);
+        Point2i res = levelImage.Resolution();
+        std::vector<Half> texels(size_t(nChannels) * res.x * res.y);
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x)
+                getHalfTexel(levelImage, {x, y}, nChannels,
+                             &texels[nChannels * (size_t(y) * res.x + x)]);
+
+        cudaArray_t levelArray;
+        CUDA_CHECK(cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
+        int pitch = res.x * nChannels * sizeof(Half);
+        gpuImageTextureBytes += pitch * res.y;
+        CUDA_CHECK(cudaMemcpy2DToArray(levelArray, /* offset */ 0, 0, texels.data(),
+                                       pitch, pitch, res.y, cudaMemcpyHostToDevice));
+    }
+    return mipArray;
+}
+
+// GPUTextureResidencyManager Definition
+// Owns the pool of GPU memory that the tiles of all of the GPU virtual
+// textures share, along with the host-side MIP maps that tiles are loaded from.
+class GPUTextureResidencyManager {
+  public:
+    GPUTextureResidencyManager(size_t poolBytes) {
+        slots.resize(std::max<size_t>(1, poolBytes / TileSlotBytes));
+        CUDA_CHECK(cudaMalloc(&pool, slots.size() * TileSlotBytes));
+        gpuImageTextureBytes += slots.size() * TileSlotBytes;
+        for (int i = slots.size() - 1; i >= 0; --i)
+            freeSlots.push_back(i);
+        LOG_VERBOSE("GPU texture tile pool: %d tiles", slots.size());
+    }
+
+    // Returns nullptr if the image is small enough that it isn't worth streaming
+    GPUVirtualTexture *CreateTexture(const Image &image, const RGBColorSpace *colorSpace,
+                                     cudaMipmappedArray_t *residentArray,
+                                     int *nResidentLevels, Allocator alloc);
+
+    void Update();
+
+  private:
+    static constexpr size_t TileSlotBytes =
+        GPUVirtualTexture::TileSlotHalfs * sizeof(Half);
+
+    struct Texture {
+        GPUVirtualTexture *vtex;
+        std::unique_ptr<MIPMap> mipmap;
+        int nTiles;
+    };
+    struct Slot {
+        int texture = -1, tile;
+        int64_t lastUsed;
+    };
+
+    void loadTile(const Texture &texture, int tile, Half *texels) const;
+
+    std::mutex mutex;
+    Half *pool;
+    std::vector<Texture> textures;
+    std::vector<Slot> slots;
+    std::vector<int> freeSlots;
+    int64_t currentPass = 0;
+    bool warnedPoolFull = false;
+};
+
+GPUVirtualTexture *GPUTextureResidencyManager::CreateTexture(
+    const Image &image, const RGBColorSpace *colorSpace,
+    cudaMipmappedArray_t *residentArray, int *nResidentLevels, Allocator alloc) {
+    // Stream the levels that are larger than a tile, keeping at least one resident
+    CHECK(image.NChannels() == 1 || image.NChannels() == 3);
+    int nChannels = image.NChannels() == 1 ? 1 : 4;
+    int tileRes = nChannels == 1 ? 128 : 64;
+    auto mipmap = std::make_unique<MIPMap>(image, colorSpace, WrapMode::Clamp,
+                                           Allocator(), MIPMapFilterOptions());
+    int nStreamedLevels = 0;
+    while (nStreamedLevels <
+           std::min(mipmap->Levels() - 1, GPUVirtualTexture::MaxStreamedLevels)) {
+        Point2i res = mipmap->GetLevel(nStreamedLevels).Resolution();
+        if (res.x <= tileRes && res.y <= tileRes)
+            break;
+        ++nStreamedLevels;
+    }
+    if (nStreamedLevels == 0)
+        return nullptr;
+
+    // Initialize _GPUVirtualTexture_ with all of its tiles non-resident
+    GPUVirtualTexture *vtex = alloc.new_object<GPUVirtualTexture>();
+    vtex->nChannels = nChannels;
+    vtex->tileRes = tileRes;
+    vtex->nStreamedLevels = nStreamedLevels;
+    int nTiles = 0;
+    for (int level = 0; level < nStreamedLevels; ++level) {
+        Point2i res = mipmap->GetLevel(level).Resolution();
+        vtex->levelResolution[level] = res;
+        vtex->levelTiles[level] =
+            Point2i((res.x + tileRes - 1) / tileRes, (res.y + tileRes - 1) / tileRes);
+        vtex->levelTileOffset[level] = nTiles;
+        nTiles += vtex->levelTiles[level].x * vtex->levelTiles[level].y;
+    }
+    CUDA_CHECK(cudaMallocManaged(&vtex->pageTable, nTiles * sizeof(int)));
+    std::fill(vtex->pageTable, vtex->pageTable + nTiles, -1);
+    CUDA_CHECK(cudaMallocManaged(&vtex->requested, nTiles));
+    std::memset(vtex->requested, 0, nTiles);
+    vtex->pool = pool;
+
+    *residentArray = createHalfTextureArray(*mipmap, nStreamedLevels, nChannels);
+    *nResidentLevels = mipmap->Levels() - nStreamedLevels;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    textures.push_back(Texture{vtex, std::move(mipmap), nTiles});
+    return vtex;
+}
+
+void GPUTextureResidencyManager::loadTile(const Texture &texture, int tile,
+                                          Half *texels) const {
+    // Find the tile's MIP level and position in it
+    const GPUVirtualTexture *vtex = texture.vtex;
+    int level = vtex->nStreamedLevels - 1;
+    while (vtex->levelTileOffset[level] > tile)
+        --level;
+    int levelTile = tile - vtex->levelTileOffset[level];
+    Point2i tileRes(vtex->tileRes, vtex->tileRes);
+    Point2i pTile(levelTile % vtex->levelTiles[level].x,
+                  levelTile / vtex->levelTiles[level].x);
+
+    // Convert the tile's texels; the parts of tiles past the edge of the level
+    // are never read
+    const Image &image = texture.mipmap->GetLevel(level);
+    for (int y = 0; y < vtex->tileRes; ++y)
+        for (int x = 0; x < vtex->tileRes; ++x) {
+            Point2i p(pTile.x * vtex->tileRes + x, pTile.y * vtex->tileRes + y);
+            if (p.x < image.Resolution().x && p.y < image.Resolution().y)
+                getHalfTexel(image, p, vtex->nChannels,
+                             texels + vtex->nChannels * (y * vtex->tileRes + x));
+        }
+}
+
+void GPUTextureResidencyManager::Update() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++currentPass;
+    // Find the requested tiles that aren't resident and note the use of those
+    // that are
+    std::vector<std::pair<int, int>> missing;
+    for (int t = 0; t < textures.size(); ++t) {
+        GPUVirtualTexture *vtex = textures[t].vtex;
+        for (int tile = 0; tile < textures[t].nTiles; ++tile) {
+            if (!vtex->requested[tile])
+                continue;
+            vtex->requested[tile] = 0;
+            if (int slot = vtex->pageTable[tile]; slot >= 0)
+                slots[slot].lastUsed = currentPass;
+            else
+                missing.push_back({t, tile});
+        }
+    }
+    if (missing.empty())
+        return;
+
+    // Evict the least recently used tiles that this pass didn't need to make room
+    if (missing.size() > freeSlots.size()) {
+        std::vector<int> candidates;
+        for (int s = 0; s < slots.size(); ++s)
+            if (slots[s].texture != -1 && slots[s].lastUsed < currentPass)
+                candidates.push_back(s);
+        size_t nEvict = std::min(candidates.size(), missing.size() - freeSlots.size());
+        std::nth_element(candidates.begin(), candidates.begin() + nEvict,
+                         candidates.end(), [&](int a, int b) {
+                             return slots[a].lastUsed < slots[b].lastUsed;
+                         });
+        for (size_t i = 0; i < nEvict; ++i) {
+            Slot &slot = slots[candidates[i]];
+            textures[slot.texture].vtex->pageTable[slot.tile] = -1;
+            slot.texture = -1;
+            freeSlots.push_back(candidates[i]);
+        }
+        gpuTextureTilesEvicted += nEvict;
+    }
+    if (missing.size() > freeSlots.size()) {
+        if (!warnedPoolFull)
+            Warning("%d GPU texture tiles needed by a single pass didn't fit in the "
+                    "tile pool, so coarser MIP levels are used for them. Consider "
+                    "increasing --gpu-texture-memory.",
+                    missing.size() - freeSlots.size());
+        warnedPoolFull = true;
+        missing.resize(freeSlots.size());
+    }
+
+    // Convert the tiles' texels in parallel, a bounded number at a time, and
+    // copy them to free slots
+    constexpr size_t maxStagedTiles = 1024;
+    std::vector<Half> staging(std::min(missing.size(), maxStagedTiles) *
+                              GPUVirtualTexture::TileSlotHalfs);
+    for (size_t start = 0; start < missing.size(); start += maxStagedTiles) {
+        size_t end = std::min(start + maxStagedTiles, missing.size());
+        ParallelFor(start, end, [&](int64_t i) {
+            loadTile(textures[missing[i].first], missing[i].second,
+                     &staging[(i - start) * GPUVirtualTexture::TileSlotHalfs]);
+        });
+        for (size_t i = start; i < end; ++i) {
+            int s = freeSlots.back();
+            freeSlots.pop_back();
+            const Half *texels = &staging[(i - start) * GPUVirtualTexture::TileSlotHalfs];
+            CUDA_CHECK(cudaMemcpy(pool + size_t(s) * GPUVirtualTexture::TileSlotHalfs,
+                                  texels, TileSlotBytes, cudaMemcpyHostToDevice));
+            auto [t, tile] = missing[i];
+            slots[s] = Slot{t, tile, currentPass};
+            textures[t].vtex->pageTable[tile] = s;
+        }
+    }
+    gpuTextureTilesStreamed += missing.size();
+}
+
+static GPUTextureResidencyManager *residencyManager;
+
+// Returns the virtual texture for _image_ if it should be streamed, given
+// --gpu-texture-memory, and otherwise nullptr
+static GPUVirtualTexture *createVirtualTexture(const Image &image,
+                                               const RGBColorSpace *colorSpace,
+                                               cudaMipmappedArray_t *residentArray,
+                                               int *nResidentLevels,
+                                               Allocator alloc) {
+    if (!Options->gpuTextureMemory)
+        return nullptr;
+    textureCacheMutex.lock();
+    if (!residencyManager)
+        residencyManager = new GPUTextureResidencyManager(
+            size_t(*Options->gpuTextureMemory) * 1024 * 1024);
+    textureCacheMutex.unlock();
+    return residencyManager->CreateTexture(image, colorSpace, residentArray,
+                                           nResidentLevels, alloc);
+}
+
+void UpdateGPUTextureResidency() {
+    if (!residencyManager)
+        return;
+    CUDA_CHECK(cudaDeviceSynchronize());
+    residencyManager->Update();
+}
+
 static cudaTextureAddressMode convertAddressMode(const std::string &mode) {
     if (mode == "repeat")
         return cudaAddressModeWrap;
@@ -1045,6 +1609,7 @@ GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
     */
 
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+    TextureCacheKey cacheKey = textureCacheKey(filename);
 
     // These have to be initialized one way or another in the below
     cudaMipmappedArray_t mipArray;
@@ -1052,18 +1617,20 @@ GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
     cudaTextureReadMode readMode;
     const RGBColorSpace *colorSpace = nullptr;
     bool isSingleChannel = false;
+    const GPUVirtualTexture *virtualTexture = nullptr;
 
     textureCacheMutex.lock();
-    auto rgbIter = rgbTextureCache.find(filename);
+    auto rgbIter = rgbTextureCache.find(cacheKey);
     if (rgbIter != rgbTextureCache.end()) {
         LOG_VERBOSE("Found %s in RGB tex array cache!", filename);
         mipArray = rgbIter->second.mipArray;
         readMode = rgbIter->second.readMode;
         nMIPMapLevels = rgbIter->second.nMIPMapLevels;
         colorSpace = rgbIter->second.colorSpace;
+        virtualTexture = rgbIter->second.virtualTexture;
         textureCacheMutex.unlock();
     } else {
-        auto lumIter = lumTextureCache.find(filename);
+        auto lumIter = lumTextureCache.find(cacheKey);
         // We don't want to take it if it was originally an RGB texture and
         // GPUFloatImageTexture converted it to single channel
         if (lumIter != lumTextureCache.end() && lumIter->second.originallySingleChannel) {
@@ -1072,6 +1639,7 @@ GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
             readMode = lumIter->second.readMode;
             nMIPMapLevels = lumIter->second.nMIPMapLevels;
             colorSpace = RGBColorSpace::sRGB;
+            virtualTexture = lumIter->second.virtualTexture;
             textureCacheMutex.unlock();
             isSingleChannel = true;
         } else {
@@ -1090,138 +1658,32 @@ GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
                 if (rgbDesc) {
                     image = image.SelectChannels(rgbDesc);
 
-                    MIPMap mipmap(image, colorSpace, WrapMode::Clamp /* TODO */,
-                                  Allocator(), MIPMapFilterOptions());
-                    nMIPMapLevels = mipmap.Levels();
-                    const Image &baseImage = mipmap.GetLevel(0);
-
-                    switch (image.Format()) {
-                    case PixelFormat::U256: {
-                        cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
-                            8, 8, 8, 8, cudaChannelFormatKindUnsigned);
-
-                        cudaExtent extent = make_cudaExtent(baseImage.Resolution().x,
-                                                            baseImage.Resolution().y, 0);
-                        CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc,
-                                                            extent, mipmap.Levels(),
-                                                            0 /* flags */));
-                        for (int level = 0; level < mipmap.Levels(); ++level) {
-                            const Image &levelImage = mipmap.GetLevel(level);
-                            cudaArray_t levelArray;
-                            CUDA_CHECK(
-                                cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
-
-                            std::vector<uint8_t> rgba(4 * levelImage.Resolution().x *
-                                                      levelImage.Resolution().y);
-                            size_t offset = 0;
-                            for (int y = 0; y < levelImage.Resolution().y; ++y)
-                                for (int x = 0; x < levelImage.Resolution().x; ++x) {
-                                    for (int c = 0; c < 3; ++c)
-                                        rgba[offset++] =
-                                            ((uint8_t *)levelImage.RawPointer({x, y}))[c];
-                                    rgba[offset++] = 255;
-                                }
-
-                            int pitch = levelImage.Resolution().x * 4 * sizeof(uint8_t);
-                            gpuImageTextureBytes += pitch * levelImage.Resolution().y;
-
-                            CUDA_CHECK(cudaMemcpy2DToArray(
-                                levelArray,
-                                /* offset */ 0, 0, rgba.data(), pitch, pitch,
-                                levelImage.Resolution().y, cudaMemcpyHostToDevice));
-                        }
-                        break;
-                    }
-                    case PixelFormat::Half: {
-                        cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
-                            16, 16, 16, 16, cudaChannelFormatKindFloat);
-
-                        cudaExtent extent = make_cudaExtent(baseImage.Resolution().x,
-                                                            baseImage.Resolution().y, 0);
-                        CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc,
-                                                            extent, mipmap.Levels(),
-                                                            0 /* flags */));
-
-                        for (int level = 0; level < mipmap.Levels(); ++level) {
-                            const Image &levelImage = mipmap.GetLevel(level);
-                            cudaArray_t levelArray;
-                            CUDA_CHECK(
-                                cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
-
-                            std::vector<Half> rgba(4 * levelImage.Resolution().x *
-                                                   levelImage.Resolution().y);
-
-                            size_t offset = 0;
-                            for (int y = 0; y < levelImage.Resolution().y; ++y)
-                                for (int x = 0; x < levelImage.Resolution().x; ++x) {
-                                    for (int c = 0; c < 3; ++c)
-                                        rgba[offset++] =
-                                            Half(levelImage.GetChannel({x, y}, c));
-                                    rgba[offset++] = Half(1.f);
-                                }
-
-                            int pitch = levelImage.Resolution().x * 4 * sizeof(Half);
-                            gpuImageTextureBytes += pitch * levelImage.Resolution().y;
-
-                            CUDA_CHECK(cudaMemcpy2DToArray(
-                                levelArray,
-                                /* offset */ 0, 0, rgba.data(), pitch, pitch,
-                                levelImage.Resolution().y, cudaMemcpyHostToDevice));
-                        }
-                        break;
-                    }
-                    case PixelFormat::Float: {
-                        cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
-                            32, 32, 32, 32, cudaChannelFormatKindFloat);
-
-                        cudaExtent extent = make_cudaExtent(baseImage.Resolution().x,
-                                                            baseImage.Resolution().y, 0);
-                        CUDA_CHECK(cudaMallocMipmappedArray(&mipArray, &channelDesc,
-                                                            extent, mipmap.Levels(),
-                                                            0 /* flags */));
-
-                        for (int level = 0; level < mipmap.Levels(); ++level) {
-                            const Image &levelImage = mipmap.GetLevel(level);
-                            cudaArray_t levelArray;
-                            CUDA_CHECK(
-                                cudaGetMipmappedArrayLevel(&levelArray, mipArray, level));
-
-                            std::vector<float> rgba(4 * levelImage.Resolution().x *
-                                                    levelImage.Resolution().y);
-
-                            size_t offset = 0;
-                            for (int y = 0; y < levelImage.Resolution().y; ++y)
-                                for (int x = 0; x < levelImage.Resolution().x; ++x) {
-                                    for (int c = 0; c < 3; ++c)
-                                        rgba[offset++] = levelImage.GetChannel({x, y}, c);
-                                    rgba[offset++] = 1.f;
-                                }
-
-                            int pitch = levelImage.Resolution().x * 4 * sizeof(float);
-                            gpuImageTextureBytes += pitch * levelImage.Resolution().y;
-
-                            CUDA_CHECK(cudaMemcpy2DToArray(
-                                levelArray,
-                                /* offset */ 0, 0, rgba.data(), pitch, pitch,
-                                levelImage.Resolution().y, cudaMemcpyHostToDevice));
-                        }
-                        break;
-                    }
-                    default:
-                        LOG_FATAL("Unexpected PixelFormat");
+                    virtualTexture = createVirtualTexture(image, colorSpace, &mipArray,
+                                                          &nMIPMapLevels, alloc);
+                    if (virtualTexture)
+                        readMode = cudaReadModeElementType;
+                    else {
+                        MIPMap mipmap(image, colorSpace, WrapMode::Clamp /* TODO */,
+                                      Allocator(), MIPMapFilterOptions());
+                        mipArray = createRGBTextureArray(mipmap, &nMIPMapLevels);
                     }
 
                     textureCacheMutex.lock();
-                    rgbTextureCache[filename] = RGBTextureCacheItem{
-                        mipArray, readMode, nMIPMapLevels, colorSpace};
+                    rgbTextureCache[cacheKey] = RGBTextureCacheItem{
+                        mipArray, readMode, nMIPMapLevels, colorSpace, virtualTexture};
                     textureCacheMutex.unlock();
                 } else if (image.NChannels() == 1) {
-                    mipArray = createSingleChannelTextureArray(image, colorSpace,
-                                                               &nMIPMapLevels);
+                    virtualTexture = createVirtualTexture(image, colorSpace, &mipArray,
+                                                          &nMIPMapLevels, alloc);
+                    if (virtualTexture)
+                        readMode = cudaReadModeElementType;
+                    else
+                        mipArray = createSingleChannelTextureArray(image, colorSpace,
+                                                                   &nMIPMapLevels);
 
                     textureCacheMutex.lock();
-                    lumTextureCache[filename] = LuminanceTextureCacheItem{
-                        mipArray, readMode, nMIPMapLevels, true};
+                    lumTextureCache[cacheKey] = LuminanceTextureCacheItem{
+                        mipArray, readMode, nMIPMapLevels, true, virtualTexture};
                     textureCacheMutex.unlock();
                     isSingleChannel = true;
                 } else {
@@ -1260,9 +1722,9 @@ GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
     Float scale = parameters.GetOneFloat("scale", 1.f);
     bool invert = parameters.GetOneBool("invert", false);
 
-    return alloc.new_object<GPUSpectrumImageTexture>(filename, mapping, texObj, scale,
-                                                     invert, isSingleChannel, colorSpace,
-                                                     spectrumType);
+    return alloc.new_object<GPUSpectrumImageTexture>(
+        filename, mapping, texObj, scale, invert, isSingleChannel, colorSpace,
+        spectrumType, virtualTexture, *ParseWrapMode(wrap.c_str()));
 }
 
 std::string GPUSpectrumImageTexture::ToString() const {
@@ -1283,18 +1745,21 @@ GPUFloatImageTexture *GPUFloatImageTexture::Create(
       ColorEncoding::Get(encodingString, alloc);
     */
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+    TextureCacheKey cacheKey = textureCacheKey(filename);
 
     cudaMipmappedArray_t mipArray;
     int nMIPMapLevels = 0;
     cudaTextureReadMode readMode;
+    const GPUVirtualTexture *virtualTexture = nullptr;
 
     textureCacheMutex.lock();
-    auto iter = lumTextureCache.find(filename);
+    auto iter = lumTextureCache.find(cacheKey);
     if (iter != lumTextureCache.end()) {
         LOG_VERBOSE("Found %s in luminance tex array cache!", filename);
         mipArray = iter->second.mipArray;
         readMode = iter->second.readMode;
         nMIPMapLevels = iter->second.nMIPMapLevels;
+        virtualTexture = iter->second.virtualTexture;
         textureCacheMutex.unlock();
     } else {
         textureCacheMutex.unlock();
@@ -1335,13 +1800,20 @@ GPUFloatImageTexture *GPUFloatImageTexture::Create(
                           image.NChannels());
         }
 
-        mipArray = createSingleChannelTextureArray(image, colorSpace, &nMIPMapLevels);
-        readMode = (image.Format() == PixelFormat::U256) ? cudaReadModeNormalizedFloat
-                                                         : cudaReadModeElementType;
+        virtualTexture =
+            createVirtualTexture(image, colorSpace, &mipArray, &nMIPMapLevels, alloc);
+        if (virtualTexture)
+            readMode = cudaReadModeElementType;
+        else {
+            mipArray = createSingleChannelTextureArray(image, colorSpace, &nMIPMapLevels);
+            readMode = (image.Format() == PixelFormat::U256)
+                           ? cudaReadModeNormalizedFloat
+                           : cudaReadModeElementType;
+        }
 
         textureCacheMutex.lock();
-        lumTextureCache[filename] =
-            LuminanceTextureCacheItem{mipArray, readMode, nMIPMapLevels, !convertedImage};
+        lumTextureCache[cacheKey] = LuminanceTextureCacheItem{
+            mipArray, readMode, nMIPMapLevels, !convertedImage, virtualTexture};
         textureCacheMutex.unlock();
     }
 
@@ -1374,7 +1846,8 @@ GPUFloatImageTexture *GPUFloatImageTexture::Create(
     bool invert = parameters.GetOneBool("invert", false);
 
     return alloc.new_object<GPUFloatImageTexture>(filename, mapping, texObj, scale,
-                                                  invert);
+                                                  invert, virtualTexture,
+                                                  *ParseWrapMode(wrap.c_str()));
 }
 
 std::string GPUFloatImageTexture::ToString() const {
@@ -1385,6 +1858,109 @@ std::string GPUFloatImageTexture::ToString() const {
 
 #endif  // PBRT_BUILD_GPU_RENDERER
 
+// Procedural Texture Baking Definitions
+STAT_COUNTER("Scene/Baked procedural textures", nBakedTextures);
+STAT_MEMORY_COUNTER("Memory/Baked procedural textures", bakedTextureBytes);
+
+// Evaluates a procedural texture at the centers of the texels of a square
+// image that covers $[0,1]^2$ in $(s,t)$ and returns its _MIPMap_. The
+// procedural is evaluated at the point $(s,t,0)$ in its texture space with
+// differentials that span one texel, so that its higher frequencies are
+// filtered out according to the resolution.
+static MIPMap *bakeProceduralTexture(
+    const std::string &name, int resolution, pstd::span<const std::string> channels,
+    std::function<void(TextureEvalContext, Float *)> evaluate,
+    const Transform &renderFromTexture, const TextureParameterDictionary &parameters,
+    const FileLoc *loc, Allocator alloc) {
+    std::string filter = parameters.GetOneString("filter", "bilinear");
+    MIPMapFilterOptions filterOptions;
+    filterOptions.maxAnisotropy = parameters.GetOneFloat("maxanisotropy", 8.f);
+    if (pstd::optional<FilterFunction> ff = ParseFilter(filter); ff)
+        filterOptions.filter = *ff;
+    else
+        Error(loc, "%s: filter function unknown", filter);
+    std::string wrapString = parameters.GetOneString("wrap", "repeat");
+    pstd::optional<WrapMode> wrapMode = ParseWrapMode(wrapString.c_str());
+    if (!wrapMode)
+        ErrorExit(loc, "%s: wrap mode unknown", wrapString);
+
+    Point2i res(resolution, resolution);
+    Image image(PixelFormat::Float, res, channels, nullptr, alloc);
+    Vector3f dpdx = renderFromTexture(Vector3f(Float(1) / resolution, 0, 0));
+    Vector3f dpdy = renderFromTexture(Vector3f(0, Float(1) / resolution, 0));
+    ParallelFor(0, resolution, [&](int64_t y) {
+        // Image coordinates are (0,0) in the upper left, but texture
+        // coordinates are (0,0) in the lower left.
+        Float t = 1 - (y + 0.5f) / resolution;
+        for (int x = 0; x < resolution; ++x) {
+            Float s = (x + 0.5f) / resolution;
+            TextureEvalContext ctx(renderFromTexture(Point3f(s, t, 0)), dpdx, dpdy,
+                                   Point2f(s, t), 0, 0, 0, 0, 0);
+            Float values[3];
+            evaluate(ctx, values);
+            for (int c = 0; c < channels.size(); ++c)
+                image.SetChannel({x, int(y)}, c, values[c]);
+        }
+    });
+
+    ++nBakedTextures;
+    bakedTextureBytes += 4 * image.BytesUsed() / 3;
+    LOG_VERBOSE("%s: baked procedural texture at %d x %d", name, resolution,
+                resolution);
+    return alloc.new_object<MIPMap>(std::move(image), RGBColorSpace::sRGB, *wrapMode,
+                                    alloc, filterOptions);
+}
+
+static FloatTexture bakeFloatTexture(const std::string &name, FloatTexture tex,
+                                     int resolution, const Transform &renderFromTexture,
+                                     const TextureParameterDictionary &parameters,
+                                     const FileLoc *loc, Allocator alloc) {
+    std::string channels[1] = {"Y"};
+    MIPMap *mipmap = bakeProceduralTexture(
+        name, resolution, channels,
+        [&](TextureEvalContext ctx, Float *values) { values[0] = tex.Evaluate(ctx); },
+        renderFromTexture, parameters, loc, alloc);
+    TextureMapping2D map =
+        TextureMapping2D::Create(parameters, renderFromTexture, loc, alloc);
+    return alloc.new_object<FloatImageTexture>(
+        map, StringPrintf("(baked %s)", name), mipmap, 1.f, false);
+}
+
+static SpectrumTexture bakeMarbleTexture(MarbleTexture *marble, int resolution,
+                                         const Transform &renderFromTexture,
+                                         const TextureParameterDictionary &parameters,
+                                         const FileLoc *loc, Allocator alloc) {
+    std::string channels[3] = {"R", "G", "B"};
+    MIPMap *mipmap = bakeProceduralTexture(
+        "marble", resolution, channels,
+        [&](TextureEvalContext ctx, Float *values) {
+            RGB rgb = marble->EvaluateRGB(ctx);
+            for (int c = 0; c < 3; ++c)
+                values[c] = rgb[c];
+        },
+        renderFromTexture, parameters, loc, alloc);
+    TextureMapping2D map =
+        TextureMapping2D::Create(parameters, renderFromTexture, loc, alloc);
+    // Marble's colors are always albedos in sRGB
+    return alloc.new_object<SpectrumImageTexture>(map, "(baked marble)", mipmap, 1.f,
+                                                  false, SpectrumType::Albedo);
+}
+
+// Returns the resolution that the procedural texture should be baked at, or
+// zero if it should be evaluated directly.
+static int proceduralBakeResolution(const TextureParameterDictionary &parameters,
+                                    const FileLoc *loc, bool gpu) {
+    int resolution = parameters.GetOneInt("bakeresolution", 0);
+    if (resolution < 0)
+        ErrorExit(loc, "\"bakeresolution\" must not be negative.");
+    if (resolution > 0 && gpu) {
+        Warning(loc, "\"bakeresolution\" is not supported with the GPU renderer. "
+                     "Evaluating the texture directly.");
+        return 0;
+    }
+    return resolution;
+}
+
 STAT_COUNTER("Scene/Textures", nTextures);
 
 FloatTexture FloatTexture::Create(const std::string &name,
@@ -1409,12 +1985,17 @@ FloatTexture FloatTexture::Create(const std::string &name,
         tex = FloatCheckerboardTexture::Create(renderFromTexture, parameters, loc, alloc);
     else if (name == "dots")
         tex = FloatDotsTexture::Create(renderFromTexture, parameters, loc, alloc);
-    else if (name == "fbm")
-        tex = FBmTexture::Create(renderFromTexture, parameters, loc, alloc);
-    else if (name == "wrinkled")
-        tex = WrinkledTexture::Create(renderFromTexture, parameters, loc, alloc);
-    else if (name == "windy")
-        tex = WindyTexture::Create(renderFromTexture, parameters, loc, alloc);
+    else if (name == "fbm" || name == "wrinkled" || name == "windy") {
+        if (name == "fbm")
+            tex = FBmTexture::Create(renderFromTexture, parameters, loc, alloc);
+        else if (name == "wrinkled")
+            tex = WrinkledTexture::Create(renderFromTexture, parameters, loc, alloc);
+        else
+            tex = WindyTexture::Create(renderFromTexture, parameters, loc, alloc);
+        if (int res = proceduralBakeResolution(parameters, loc, gpu); res > 0)
+            tex = bakeFloatTexture(name, tex, res, renderFromTexture, parameters, loc,
+                                   alloc);
+    }
     else if (name == "ptex") {
         if (gpu)
             tex = GPUFloatPtexTexture::Create(renderFromTexture, parameters, loc, alloc);
@@ -1464,8 +2045,15 @@ SpectrumTexture SpectrumTexture::Create(const std::string &name,
     else if (name == "dots")
         tex = SpectrumDotsTexture::Create(renderFromTexture, parameters, spectrumType,
                                           loc, alloc);
-    else if (name == "marble")
-        tex = MarbleTexture::Create(renderFromTexture, parameters, loc, alloc);
+    else if (name == "marble") {
+        MarbleTexture *marble =
+            MarbleTexture::Create(renderFromTexture, parameters, loc, alloc);
+        if (int res = proceduralBakeResolution(parameters, loc, gpu); res > 0)
+            tex = bakeMarbleTexture(marble, res, renderFromTexture, parameters, loc,
+                                    alloc);
+        else
+            tex = marble;
+    }
     else if (name == "ptex") {
         if (gpu)
             tex = GPUSpectrumPtexTexture::Create(renderFromTexture, parameters,
@@ -23,6 +23,7 @@
 #include <map>
 #include <mutex>
 #include <string>
+#include <tuple>
 
 namespace pbrt {
 
@@ -84,6 +85,9 @@ class UVMapping2D {
         return {su * ctx.uv[0] + du, sv * ctx.uv[1] + dv};
     }
 
+    PBRT_CPU_GPU
+    Vector2f Scale() const { return {su, sv}; }
+
   private:
     Float su, sv, du, dv;
 };
@@ -544,14 +548,24 @@ class ImageTextureBase {
         mipmap =
             MIPMap::CreateFromFile(filename, filterOptions, wrapMode, encoding, alloc);
         lock.lock();
-        // This is actually ok, but if it hits, it means we've wastefully
-        // loaded this texture. (Note that in that case, should just return
-        // the one that's already in there and not replace it.)
-        CHECK(textureCache.find(texInfo) == textureCache.end());
-        textureCache[texInfo] = mipmap;
+        // Textures are created in parallel, so another thread may have
+        // loaded the same texture meanwhile; if so, use its _MIPMap_.
+        if (auto iter = textureCache.find(texInfo); iter != textureCache.end())
+            mipmap = iter->second;
+        else
+            textureCache[texInfo] = mipmap;
     }
+    // Uses _mipmap_, which is not added to the texture cache, rather than
+    // loading an image file
+    ImageTextureBase(TextureMapping2D mapping, std::string filename, MIPMap *mipmap,
+                     Float scale, bool invert)
+        : mapping(mapping),
+          filename(filename),
+          scale(scale),
+          invert(invert),
+          mipmap(mipmap) {}
 
-    static void ClearCache() { textureCache.clear(); }
+    static void ClearCache();
 
     void MultiplyScale(Float s) { scale *= s; }
 
@@ -577,6 +591,9 @@ class FloatImageTexture : public ImageTextureBase {
                       bool invert, ColorEncoding encoding, Allocator alloc)
         : ImageTextureBase(m, filename, filterOptions, wm, scale, invert, encoding,
                            alloc) {}
+    FloatImageTexture(TextureMapping2D m, const std::string &filename, MIPMap *mipmap,
+                      Float scale, bool invert)
+        : ImageTextureBase(m, filename, mipmap, scale, invert) {}
     PBRT_CPU_GPU
     Float Evaluate(TextureEvalContext ctx) const {
 #ifdef PBRT_IS_GPU_CODE
@@ -593,6 +610,33 @@ class FloatImageTexture : public ImageTextureBase {
 #endif
     }
 
+    // Returns the texture's value along with its partial derivatives with respect
+    // to $(u,v)$, found from the texels of a single MIP map lookup, if it has a
+    // $(u,v)$ mapping and a filter other than EWA.
+    PBRT_CPU_GPU
+    pstd::optional<Float> EvaluateWithGradient(TextureEvalContext ctx,
+                                               Vector2f *dvduv) const {
+#ifdef PBRT_IS_GPU_CODE
+        assert(!"Should not be called in GPU code");
+        return {};
+#else
+        if (!mapping.Is<UVMapping2D>() ||
+            mipmap->GetFilterOptions().filter == FilterFunction::EWA)
+            return {};
+        Vector2f dstdx, dstdy, dst;
+        Point2f st = mapping.Map(ctx, &dstdx, &dstdy);
+        st[1] = 1 - st[1];
+        Float v = scale * mipmap->FilterWithGradient(st, dstdx, dstdy, &dst);
+        // Apply chain rule for $(u,v)$ mapping, scale, and image $t$ flip
+        Vector2f suv = mapping.Cast<UVMapping2D>()->Scale();
+        *dvduv = Vector2f(scale * dst.x * suv.x, -scale * dst.y * suv.y);
+        if (!invert)
+            return v;
+        *dvduv = (v < 1) ? -*dvduv : Vector2f(0, 0);
+        return std::max<Float>(0, 1 - v);
+#endif
+    }
+
     static FloatImageTexture *Create(const Transform &renderFromTexture,
                                      const TextureParameterDictionary &parameters,
                                      const FileLoc *loc, Allocator alloc);
@@ -611,6 +655,11 @@ class SpectrumImageTexture : public ImageTextureBase {
         : ImageTextureBase(mapping, filename, filterOptions, wrapMode, scale, invert,
                            encoding, alloc),
           spectrumType(spectrumType) {}
+    SpectrumImageTexture(TextureMapping2D mapping, std::string filename,
+                         MIPMap *mipmap, Float scale, bool invert,
+                         SpectrumType spectrumType)
+        : ImageTextureBase(mapping, filename, mipmap, scale, invert),
+          spectrumType(spectrumType) {}
 
     PBRT_CPU_GPU
     SampledSpectrum Evaluate(TextureEvalContext ctx, SampledWavelengths lambda) const;
@@ -620,20 +669,116 @@ class SpectrumImageTexture : public ImageTextureBase {
                                         SpectrumType spectrumType, const FileLoc *loc,
                                         Allocator alloc);
 
+    // Computes the RGB sigmoid polynomial coefficients for all of the MIP map's
+    // texels so that Evaluate() filters them directly rather than converting
+    // filtered RGB values to spectra. Returns false if that isn't possible.
+    bool PrecomputeRGBCoefficients(Allocator alloc);
+
+    void MultiplyScale(Float s) {
+        ImageTextureBase::MultiplyScale(s);
+        // The coefficients include the scale, so they must be recomputed
+        if (rgbCoefficients)
+            PrecomputeRGBCoefficients({});
+    }
+
     std::string ToString() const;
 
   private:
     // SpectrumImageTexture Private Members
     SpectrumType spectrumType;
+    // Stores sigmoid polynomial coefficients for the texels in its RGB channels
+    MIPMap *rgbCoefficients = nullptr;
 };
 
 #if defined(PBRT_BUILD_GPU_RENDERER) && defined(__NVCC__)
+// GPUVirtualTexture Definition
+// Stores the finer MIP levels of an image texture as tiles that are streamed
+// into a fixed-size pool of GPU memory between rendering passes, as lookups
+// request them; the coarser levels are always resident in a CUDA array.
+struct GPUVirtualTexture {
+    // Each tile is stored in a pool slot of _TileSlotHalfs_ _Half_ values:
+    // 64x64 texels with four channels or 128x128 texels with one
+    static constexpr int TileSlotHalfs = 64 * 64 * 4;
+    static constexpr int MaxStreamedLevels = 16;
+
+    // Returns bilinearly-filtered texels from the MIP level that best matches
+    // the filter width, using coarser levels where its tiles aren't resident
+    template <typename T>
+    PBRT_GPU T Lookup(cudaTextureObject_t residentLevels, WrapMode2D wrapMode,
+                      Point2f st, Vector2f dst0, Vector2f dst1) const {
+        Point2i res = levelResolution[0];
+        Float width = std::max(Length(Vector2f(dst0[0] * res.x, dst0[1] * res.y)),
+                               Length(Vector2f(dst1[0] * res.x, dst1[1] * res.y)));
+        int level = width <= 1 ? 0 : int(Log2(width) + 0.5f);
+        float4 v;
+        for (int l = level; l < nStreamedLevels; ++l)
+            if (Bilerp(l, st, wrapMode, l == level, &v)) {
+                if constexpr (std::is_same_v<T, float>)
+                    return v.x;
+                else
+                    return v;
+            }
+        return tex2DLod<T>(residentLevels, st[0], st[1],
+                           std::max(0, level - nStreamedLevels));
+    }
+
+    PBRT_GPU bool Bilerp(int level, Point2f st, WrapMode2D wrapMode, bool request,
+                         float4 *v) const {
+        Point2i res = levelResolution[level];
+        Float x = st[0] * res.x - 0.5f, y = st[1] * res.y - 0.5f;
+        int x0 = int(pstd::floor(x)), y0 = int(pstd::floor(y));
+        float4 texels[4];
+        for (int i = 0; i < 4; ++i) {
+            Point2i p(x0 + (i & 1), y0 + (i >> 1));
+            texels[i] = make_float4(0, 0, 0, 0);
+            if (!RemapPixelCoords(&p, res, wrapMode))
+                continue;
+            // Record the tile's use, whether or not it's resident
+            int tile = levelTileOffset[level] +
+                       (p.y / tileRes) * levelTiles[level].x + p.x / tileRes;
+            if (request && !requested[tile])
+                requested[tile] = 1;
+            int slot = pageTable[tile];
+            if (slot < 0)
+                return false;
+
+            const Half *t = pool + size_t(slot) * TileSlotHalfs +
+                            nChannels * ((p.y % tileRes) * tileRes + p.x % tileRes);
+            if (nChannels == 1)
+                texels[i].x = float(t[0]);
+            else
+                texels[i] = make_float4(float(t[0]), float(t[1]), float(t[2]), 1);
+        }
+
+        Float dx = x - x0, dy = y - y0;
+        auto bilerp = [&](float a, float b, float c, float d) {
+            return (1 - dy) * ((1 - dx) * a + dx * b) + dy * ((1 - dx) * c + dx * d);
+        };
+        *v = make_float4(bilerp(texels[0].x, texels[1].x, texels[2].x, texels[3].x),
+                         bilerp(texels[0].y, texels[1].y, texels[2].y, texels[3].y),
+                         bilerp(texels[0].z, texels[1].z, texels[2].z, texels[3].z), 1);
+        return true;
+    }
+
+    // GPUVirtualTexture Public Members
+    int nChannels, tileRes, nStreamedLevels;
+    pstd::array<Point2i, MaxStreamedLevels> levelResolution, levelTiles;
+    pstd::array<int, MaxStreamedLevels> levelTileOffset;
+    // Pool slot of each tile of the streamed levels, or -1 if it isn't resident
+    int *pageTable;
+    // Set for tiles that lookups needed since the last residency update
+    uint8_t *requested;
+    const Half *pool;
+};
+
 class GPUSpectrumImageTexture {
   public:
     GPUSpectrumImageTexture(std::string filename, TextureMapping2D mapping,
                             cudaTextureObject_t texObj, Float scale, bool invert,
                             bool isSingleChannel, const RGBColorSpace *colorSpace,
-                            SpectrumType spectrumType)
+                            SpectrumType spectrumType,
+                            const GPUVirtualTexture *virtualTexture = nullptr,
+                            WrapMode wrapMode = WrapMode::Repeat)
         : mapping(mapping),
           filename(filename),
           texObj(texObj),
@@ -641,7 +786,9 @@ class GPUSpectrumImageTexture {
           invert(invert),
           isSingleChannel(isSingleChannel),
           colorSpace(colorSpace),
-          spectrumType(spectrumType) {}
+          spectrumType(spectrumType),
+          virtualTexture(virtualTexture),
+          wrapMode(wrapMode) {}
 
     PBRT_CPU_GPU
     SampledSpectrum Evaluate(TextureEvalContext ctx, SampledWavelengths lambda) const {
@@ -654,7 +801,16 @@ class GPUSpectrumImageTexture {
         Vector2f dstdx, dstdy;
         Point2f st = mapping.Map(ctx, &dstdx, &dstdy);
         RGB rgb;
-        if (isSingleChannel) {
+        if (virtualTexture && isSingleChannel) {
+            float tex = scale * virtualTexture->Lookup<float>(
+                                    texObj, wrapMode, Point2f(st[0], 1 - st[1]),
+                                    dstdx, dstdy);
+            rgb = RGB(tex, tex, tex);
+        } else if (virtualTexture) {
+            float4 tex = virtualTexture->Lookup<float4>(
+                texObj, wrapMode, Point2f(st[0], 1 - st[1]), dstdx, dstdy);
+            rgb = scale * RGB(tex.x, tex.y, tex.z);
+        } else if (isSingleChannel) {
             float tex = scale * tex2DGrad<float>(texObj, st[0], 1 - st[1],
                                                  make_float2(dstdx[0], dstdy[0]),
                                                  make_float2(dstdx[1], dstdy[1]));
@@ -693,17 +849,23 @@ class GPUSpectrumImageTexture {
     bool invert, isSingleChannel;
     const RGBColorSpace *colorSpace;
     SpectrumType spectrumType;
+    const GPUVirtualTexture *virtualTexture;
+    WrapMode wrapMode;
 };
 
 class GPUFloatImageTexture {
   public:
     GPUFloatImageTexture(std::string filename, TextureMapping2D mapping,
-                         cudaTextureObject_t texObj, Float scale, bool invert)
+                         cudaTextureObject_t texObj, Float scale, bool invert,
+                         const GPUVirtualTexture *virtualTexture = nullptr,
+                         WrapMode wrapMode = WrapMode::Repeat)
         : mapping(mapping),
           filename(filename),
           texObj(texObj),
           scale(scale),
-          invert(invert) {}
+          invert(invert),
+          virtualTexture(virtualTexture),
+          wrapMode(wrapMode) {}
 
     PBRT_CPU_GPU
     Float Evaluate(TextureEvalContext ctx) const {
@@ -715,9 +877,13 @@ class GPUFloatImageTexture {
         Point2f st = mapping.Map(ctx, &dstdx, &dstdy);
         // flip y coord since image has (0,0) at upper left, texture at lower
         // left
-        Float v = scale * tex2DGrad<float>(texObj, st[0], 1 - st[1],
-                                           make_float2(dstdx[0], dstdy[0]),
-                                           make_float2(dstdx[1], dstdy[1]));
+        Float v = virtualTexture
+                      ? scale * virtualTexture->Lookup<float>(
+                                    texObj, wrapMode, Point2f(st[0], 1 - st[1]),
+                                    dstdx, dstdy)
+                      : scale * tex2DGrad<float>(texObj, st[0], 1 - st[1],
+                                                 make_float2(dstdx[0], dstdy[0]),
+                                                 make_float2(dstdx[1], dstdy[1]));
         return invert ? std::max<Float>(0, 1 - v) : v;
 #endif
     }
@@ -735,6 +901,8 @@ class GPUFloatImageTexture {
     cudaTextureObject_t texObj;
     Float scale;
     bool invert;
+    const GPUVirtualTexture *virtualTexture;
+    WrapMode wrapMode;
 };
 
 #else  // PBRT_BUILD_GPU_RENDERER && __NVCC__
@@ -776,6 +944,13 @@ class GPUFloatImageTexture {
 
 #endif  // PBRT_BUILD_GPU_RENDERER && __NVCC__
 
+#ifdef PBRT_BUILD_GPU_RENDERER
+// Streams in the tiles of GPU virtual textures that lookups have requested
+// since the last call, evicting the least recently used tiles as needed. Must
+// be called when no kernels are running.
+void UpdateGPUTextureResidency();
+#endif  // PBRT_BUILD_GPU_RENDERER
+
 // MarbleTexture Definition
 class MarbleTexture {
   public:
@@ -791,6 +966,9 @@ class MarbleTexture {
     PBRT_CPU_GPU
     SampledSpectrum Evaluate(TextureEvalContext ctx, SampledWavelengths lambda) const;
 
+    PBRT_CPU_GPU
+    RGB EvaluateRGB(TextureEvalContext ctx) const;
+
     static MarbleTexture *Create(const Transform &renderFromTexture,
                                  const TextureParameterDictionary &parameters,
                                  const FileLoc *loc, Allocator alloc);
@@ -879,6 +1057,8 @@ class PtexTextureBase {
     std::string filename;
     ColorEncoding encoding;
     Float scale;
+    // Indexes the texture's per-thread handles with --ptex-thread-handles
+    int id;
 };
 
 class FloatPtexTexture : public PtexTextureBase {
@@ -0,0 +1,228 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/blockcompress.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace pbrt {
+
+// Block Compression Utility Functions
+static uint16_t packRGB565(const float rgb[3]) {
+    auto quantize = [](float v, int maxValue) {
+        return Clamp(int(v / 255 * maxValue + 0.5f), 0, maxValue);
+    };
+    return (quantize(rgb[0], 31) << 11) | (quantize(rgb[1], 63) << 5) |
+           quantize(rgb[2], 31);
+}
+
+static void unpackRGB565(uint16_t v, int rgb[3]) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+static void bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        int v0 = palette[0][c], v1 = palette[1][c];
+        if (c0 > c1) {
+            palette[2][c] = (2 * v0 + v1 + 1) / 3;
+            palette[3][c] = (v0 + 2 * v1 + 1) / 3;
+        } else {
+            // Blocks with _c0 <= c1_ have a single intermediate color and black
+            palette[2][c] = (v0 + v1) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+static void bc4Palette(int v0, int v1, int palette[8]) {
+    palette[0] = v0;
+    palette[1] = v1;
+    if (v0 > v1)
+        for (int i = 1; i <= 6; ++i)
+            palette[i + 1] = ((7 - i) * v0 + i * v1 + 3) / 7;
+    else {
+        // Blocks with _v0 <= v1_ have four intermediate values, zero, and one
+        for (int i = 1; i <= 4; ++i)
+            palette[i + 1] = ((5 - i) * v0 + i * v1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+// Block Compression Function Definitions
+void EncodeBC1Block(const uint8_t *texels, int rowStride, uint8_t block[8]) {
+    // Gather the block's colors and compute their mean
+    float rgb[16][3], mean[3] = {0, 0, 0};
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 4; ++x)
+            for (int c = 0; c < 3; ++c) {
+                rgb[4 * y + x][c] = texels[y * rowStride + 3 * x + c];
+                mean[c] += rgb[4 * y + x][c] / 16;
+            }
+
+    // Find the principal axis of the colors' distribution by power iteration
+    float cov[3][3] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int c0 = 0; c0 < 3; ++c0)
+            for (int c1 = 0; c1 < 3; ++c1)
+                cov[c0][c1] += (rgb[i][c0] - mean[c0]) * (rgb[i][c1] - mean[c1]);
+    // Start with the covariance matrix's row with the largest variance, which has
+    // a nonzero component along the principal axis unless all colors are equal
+    int maxRow = 0;
+    for (int c = 1; c < 3; ++c)
+        if (cov[c][c] > cov[maxRow][maxRow])
+            maxRow = c;
+    float axis[3] = {cov[maxRow][0], cov[maxRow][1], cov[maxRow][2]};
+    for (int iter = 0; iter < 8; ++iter) {
+        float next[3];
+        for (int c = 0; c < 3; ++c)
+            next[c] = cov[c][0] * axis[0] + cov[c][1] * axis[1] + cov[c][2] * axis[2];
+        float maxComponent =
+            std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+        if (maxComponent == 0)
+            break;
+        for (int c = 0; c < 3; ++c)
+            axis[c] = next[c] / maxComponent;
+    }
+    float length = std::sqrt(Sqr(axis[0]) + Sqr(axis[1]) + Sqr(axis[2]));
+    for (int c = 0; c < 3; ++c)
+        axis[c] = length > 0 ? axis[c] / length : 0;
+
+    // Use the extremes of the colors' projections onto the axis as endpoints
+    float minT = std::numeric_limits<float>::infinity(), maxT = -minT;
+    for (int i = 0; i < 16; ++i) {
+        float t = (rgb[i][0] - mean[0]) * axis[0] + (rgb[i][1] - mean[1]) * axis[1] +
+                  (rgb[i][2] - mean[2]) * axis[2];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+    float e0[3], e1[3];
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = mean[c] + maxT * axis[c];
+        e1[c] = mean[c] + minT * axis[c];
+    }
+    uint16_t c0 = packRGB565(e0), c1 = packRGB565(e1);
+    // Order the endpoints so that the block has two intermediate colors
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    // Select the palette color closest to each texel
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int palette[4][3];
+        bc1Palette(c0, c1, palette);
+        for (int i = 0; i < 16; ++i) {
+            int bestIndex = 0;
+            float bestDistance = std::numeric_limits<float>::infinity();
+            for (int j = 0; j < 4; ++j) {
+                float d = Sqr(rgb[i][0] - palette[j][0]) +
+                          Sqr(rgb[i][1] - palette[j][1]) +
+                          Sqr(rgb[i][2] - palette[j][2]);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    bestIndex = j;
+                }
+            }
+            indices |= uint32_t(bestIndex) << (2 * i);
+        }
+    }
+
+    // Store the endpoints and indices in little-endian order
+    block[0] = c0 & 0xff;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xff;
+    block[3] = c1 >> 8;
+    for (int i = 0; i < 4; ++i)
+        block[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+void EncodeBC4Block(const uint8_t *texels, int rowStride, uint8_t block[8]) {
+    // Use the block's extreme values as endpoints
+    uint8_t values[16];
+    int minValue = 255, maxValue = 0;
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 4; ++x) {
+            values[4 * y + x] = texels[y * rowStride + x];
+            minValue = std::min<int>(minValue, values[4 * y + x]);
+            maxValue = std::max<int>(maxValue, values[4 * y + x]);
+        }
+
+    // Select the palette value closest to each texel
+    uint64_t indices = 0;
+    if (maxValue > minValue) {
+        int palette[8];
+        bc4Palette(maxValue, minValue, palette);
+        for (int i = 0; i < 16; ++i) {
+            int bestIndex = 0;
+            for (int j = 1; j < 8; ++j)
+                if (std::abs(values[i] - palette[j]) <
+                    std::abs(values[i] - palette[bestIndex]))
+                    bestIndex = j;
+            indices |= uint64_t(bestIndex) << (3 * i);
+        }
+    }
+
+    block[0] = maxValue;
+    block[1] = minValue;
+    for (int i = 0; i < 6; ++i)
+        block[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+void DecodeBC1Block(const uint8_t block[8], uint8_t rgb[16 * 3]) {
+    uint16_t c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+    uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) |
+                       (uint32_t(block[7]) << 24);
+    int palette[4][3];
+    bc1Palette(c0, c1, palette);
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            rgb[3 * i + c] = palette[(indices >> (2 * i)) & 3][c];
+}
+
+void DecodeBC4Block(const uint8_t block[8], uint8_t values[16]) {
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; ++i)
+        indices |= uint64_t(block[2 + i]) << (8 * i);
+    int palette[8];
+    bc4Palette(block[0], block[1], palette);
+    for (int i = 0; i < 16; ++i)
+        values[i] = palette[(indices >> (3 * i)) & 7];
+}
+
+std::vector<uint8_t> BlockCompress(const uint8_t *texels, int nChannels,
+                                   Point2i resolution) {
+    CHECK(nChannels == 1 || nChannels == 3);
+    CHECK(CanBlockCompress(resolution));
+    Point2i nBlocks(resolution.x / 4, resolution.y / 4);
+    std::vector<uint8_t> blocks(size_t(nBlocks.x) * nBlocks.y * BlockCompressedBlockBytes);
+
+    int rowStride = nChannels * resolution.x;
+    ParallelFor(0, nBlocks.y, [&](int64_t by) {
+        for (int bx = 0; bx < nBlocks.x; ++bx) {
+            const uint8_t *blockTexels =
+                texels + 4 * by * rowStride + 4 * bx * nChannels;
+            uint8_t *block =
+                &blocks[(by * nBlocks.x + bx) * BlockCompressedBlockBytes];
+            if (nChannels == 3)
+                EncodeBC1Block(blockTexels, rowStride, block);
+            else
+                EncodeBC4Block(blockTexels, rowStride, block);
+        }
+    });
+    return blocks;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,47 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_BLOCKCOMPRESS_H
+#define PBRT_UTIL_BLOCKCOMPRESS_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/vecmath.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace pbrt {
+
+// Block Compression Declarations
+// The BC1 and BC4 formats store 4x4 blocks of 8-bit texels in 8 bytes: BC1
+// blocks hold two RGB 5:6:5 endpoint colors and a 2-bit index per texel that
+// selects one of the endpoints or one of two colors between them, and BC4
+// blocks hold two 8-bit endpoint values and a 3-bit index per texel that
+// selects one of the endpoints or one of six values between them. GPUs decode
+// both formats in hardware when textures are accessed.
+constexpr int BlockCompressedBlockBytes = 8;
+
+// Texel (x, y) of the block is at texels[y * rowStride + x * nChannels].
+void EncodeBC1Block(const uint8_t *texels, int rowStride, uint8_t block[8]);
+void EncodeBC4Block(const uint8_t *texels, int rowStride, uint8_t block[8]);
+
+// The block's texels are stored in scanline order.
+void DecodeBC1Block(const uint8_t block[8], uint8_t rgb[16 * 3]);
+void DecodeBC4Block(const uint8_t block[8], uint8_t values[16]);
+
+inline bool CanBlockCompress(Point2i resolution) {
+    return resolution.x > 0 && resolution.y > 0 && resolution.x % 4 == 0 &&
+           resolution.y % 4 == 0;
+}
+
+// Compresses an image with 3 (to BC1) or 1 (to BC4) 8-bit channels that are
+// stored in scanline order without padding; CanBlockCompress() must be true
+// for its resolution. The blocks are returned in scanline order.
+std::vector<uint8_t> BlockCompress(const uint8_t *texels, int nChannels,
+                                   Point2i resolution);
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_BLOCKCOMPRESS_H
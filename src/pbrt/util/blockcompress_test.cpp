@@ -0,0 +1,105 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/blockcompress.h>
+#include <pbrt/util/rng.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+using namespace pbrt;
+
+TEST(BlockCompress, BC1Solid) {
+    uint8_t texels[16 * 3], block[8], decoded[16 * 3];
+    for (int i = 0; i < 16; ++i) {
+        texels[3 * i] = 200;
+        texels[3 * i + 1] = 17;
+        texels[3 * i + 2] = 99;
+    }
+    EncodeBC1Block(texels, 4 * 3, block);
+    DecodeBC1Block(block, decoded);
+
+    // A solid block is only off by the endpoint's 5:6:5 quantization error
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_LE(std::abs(decoded[3 * i] - 200), 4);
+        EXPECT_LE(std::abs(decoded[3 * i + 1] - 17), 2);
+        EXPECT_LE(std::abs(decoded[3 * i + 2] - 99), 4);
+    }
+}
+
+TEST(BlockCompress, BC1Gradient) {
+    // Colors along a line through RGB space can be represented closely
+    uint8_t texels[16 * 3], block[8], decoded[16 * 3];
+    for (int i = 0; i < 16; ++i) {
+        texels[3 * i] = 16 + 12 * i;
+        texels[3 * i + 1] = 240 - 14 * i;
+        texels[3 * i + 2] = 100 + 4 * i;
+    }
+    EncodeBC1Block(texels, 4 * 3, block);
+    DecodeBC1Block(block, decoded);
+
+    for (int i = 0; i < 16 * 3; ++i)
+        EXPECT_LE(std::abs(decoded[i] - texels[i]), 40) << i;
+    // The gradient's ends are endpoints
+    for (int c = 0; c < 3; ++c) {
+        EXPECT_LE(std::abs(decoded[c] - texels[c]), 4);
+        EXPECT_LE(std::abs(decoded[45 + c] - texels[45 + c]), 4);
+    }
+}
+
+TEST(BlockCompress, BC4) {
+    RNG rng;
+    for (int trial = 0; trial < 100; ++trial) {
+        uint8_t texels[16], block[8], decoded[16];
+        int minValue = 255, maxValue = 0;
+        for (int i = 0; i < 16; ++i) {
+            texels[i] = rng.Uniform<uint32_t>() % 256;
+            minValue = std::min<int>(minValue, texels[i]);
+            maxValue = std::max<int>(maxValue, texels[i]);
+        }
+        EncodeBC4Block(texels, 4, block);
+        DecodeBC4Block(block, decoded);
+
+        // Values are at most half of the palette's spacing away
+        for (int i = 0; i < 16; ++i)
+            EXPECT_LE(std::abs(decoded[i] - texels[i]), (maxValue - minValue) / 14 + 1);
+    }
+}
+
+TEST(BlockCompress, Image) {
+    // Each block of an 8x4 image is solid and distinct
+    Point2i resolution(8, 4);
+    std::vector<uint8_t> gray(8 * 4), rgb(8 * 4 * 3);
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 8; ++x) {
+            gray[8 * y + x] = x < 4 ? 10 : 250;
+            for (int c = 0; c < 3; ++c)
+                rgb[3 * (8 * y + x) + c] = x < 4 ? 0 : 255;
+        }
+
+    std::vector<uint8_t> bc4 = BlockCompress(gray.data(), 1, resolution);
+    ASSERT_EQ(2 * BlockCompressedBlockBytes, bc4.size());
+    uint8_t values[16];
+    DecodeBC4Block(&bc4[0], values);
+    for (int i = 0; i < 16; ++i)
+        EXPECT_EQ(10, values[i]);
+    DecodeBC4Block(&bc4[BlockCompressedBlockBytes], values);
+    for (int i = 0; i < 16; ++i)
+        EXPECT_EQ(250, values[i]);
+
+    std::vector<uint8_t> bc1 = BlockCompress(rgb.data(), 3, resolution);
+    ASSERT_EQ(2 * BlockCompressedBlockBytes, bc1.size());
+    uint8_t colors[16 * 3];
+    DecodeBC1Block(&bc1[0], colors);
+    for (int i = 0; i < 16 * 3; ++i)
+        EXPECT_EQ(0, colors[i]);
+    DecodeBC1Block(&bc1[BlockCompressedBlockBytes], colors);
+    for (int i = 0; i < 16 * 3; ++i)
+        EXPECT_EQ(255, colors[i]);
+}
@@ -4,24 +4,100 @@
 
 #include <pbrt/util/buffercache.h>
 
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/log.h>
 #include <pbrt/util/stats.h>
 
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <vector>
+
 namespace pbrt {
 
+// Shared Buffer Definitions
+STAT_COUNTER("Geometry/Shared buffer files written", nSharedBuffersWritten);
+STAT_MEMORY_COUNTER("Memory/Shared mesh buffers (mapped)", sharedBufferBytes);
+
+static std::mutex sharedBuffersMutex;
+static std::vector<std::unique_ptr<MappedFile>> sharedBuffers;
+
+static bool writeSharedBuffer(const std::string &filename, const void *ptr,
+                              size_t size) {
+    // As with BVH cache files, write to a temporary file and rename it so
+    // that concurrent renders never see a partially-written file
+    uint64_t tempSuffix = MixBits(uint64_t(time(nullptr)) ^ (uintptr_t)ptr);
+    std::string tempFilename =
+        StringPrintf("%s.%016llx.tmp", filename, (unsigned long long)tempSuffix);
+    FILE *f = FOpenWrite(tempFilename);
+    if (!f) {
+        Warning("%s: %s", tempFilename, ErrorString());
+        return false;
+    }
+    bool ok = fwrite(ptr, 1, size, f) == size;
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        Warning("%s: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tempFilename.c_str());
+        // Another process may have written the same file first
+        return FileExists(filename);
+    }
+    ++nSharedBuffersWritten;
+    return true;
+}
+
+const void *MapSharedBuffer(const std::string &directory, const void *ptr, size_t size) {
+    uint64_t hash = HashBuffer((const char *)ptr, size);
+    std::string filename = StringPrintf("%s/buffer-%016llx-%d.bin", directory,
+                                        (unsigned long long)hash, size);
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file) {
+        if (!writeSharedBuffer(filename, ptr, size))
+            return nullptr;
+        file = MappedFile::Open(filename);
+        if (!file)
+            return nullptr;
+        LOG_VERBOSE("Wrote shared buffer file %s", filename);
+    }
+    // Check the contents in case of a hash collision or a damaged file
+    if (file->size() != size || std::memcmp(file->data(), ptr, size) != 0) {
+        Warning("%s: shared buffer file doesn't match scene geometry. Ignoring it.",
+                filename);
+        return nullptr;
+    }
+
+    sharedBufferBytes += size;
+    std::lock_guard<std::mutex> lock(sharedBuffersMutex);
+    sharedBuffers.push_back(std::move(file));
+    return sharedBuffers.back()->data();
+}
+
 // BufferCache Global Definitions
 BufferCache<int> *intBufferCache;
 BufferCache<Point2f> *point2BufferCache;
 BufferCache<Point3f> *point3BufferCache;
 BufferCache<Vector3f> *vector3BufferCache;
 BufferCache<Normal3f> *normal3BufferCache;
+BufferCache<uint16_t> *uint16BufferCache;
+BufferCache<OctahedralVector> *octahedralBufferCache;
+BufferCache<Half> *halfBufferCache;
 
-void InitBufferCaches(Allocator alloc) {
+void InitBufferCaches(Allocator alloc, std::string sharedDirectory) {
     CHECK(intBufferCache == nullptr);
-    intBufferCache = alloc.new_object<BufferCache<int>>(alloc);
-    point2BufferCache = alloc.new_object<BufferCache<Point2f>>(alloc);
-    point3BufferCache = alloc.new_object<BufferCache<Point3f>>(alloc);
-    vector3BufferCache = alloc.new_object<BufferCache<Vector3f>>(alloc);
-    normal3BufferCache = alloc.new_object<BufferCache<Normal3f>>(alloc);
+    intBufferCache = alloc.new_object<BufferCache<int>>(alloc, sharedDirectory);
+    point2BufferCache = alloc.new_object<BufferCache<Point2f>>(alloc, sharedDirectory);
+    point3BufferCache = alloc.new_object<BufferCache<Point3f>>(alloc, sharedDirectory);
+    vector3BufferCache = alloc.new_object<BufferCache<Vector3f>>(alloc, sharedDirectory);
+    normal3BufferCache = alloc.new_object<BufferCache<Normal3f>>(alloc, sharedDirectory);
+    uint16BufferCache = alloc.new_object<BufferCache<uint16_t>>(alloc, sharedDirectory);
+    octahedralBufferCache =
+        alloc.new_object<BufferCache<OctahedralVector>>(alloc, sharedDirectory);
+    halfBufferCache = alloc.new_object<BufferCache<Half>>(alloc, sharedDirectory);
 }
 
 STAT_MEMORY_COUNTER("Memory/Mesh indices", meshIndexBytes);
@@ -39,18 +115,30 @@ void FreeBufferCaches() {
     LOG_VERBOSE("p bytes: %d", point3BufferCache->BytesUsed());
     meshPositionBytes += point3BufferCache->BytesUsed();
     point3BufferCache->Clear();
+    LOG_VERBOSE("quantized p bytes: %d", uint16BufferCache->BytesUsed());
+    meshPositionBytes += uint16BufferCache->BytesUsed();
+    uint16BufferCache->Clear();
 
     LOG_VERBOSE("n bytes: %d", normal3BufferCache->BytesUsed());
     meshNormalBytes += normal3BufferCache->BytesUsed();
     normal3BufferCache->Clear();
+    LOG_VERBOSE("octahedral n bytes: %d", octahedralBufferCache->BytesUsed());
+    meshNormalBytes += octahedralBufferCache->BytesUsed();
+    octahedralBufferCache->Clear();
 
     LOG_VERBOSE("uv bytes: %d", point2BufferCache->BytesUsed());
     meshUVBytes += point2BufferCache->BytesUsed();
     point2BufferCache->Clear();
+    LOG_VERBOSE("half uv bytes: %d", halfBufferCache->BytesUsed());
+    meshUVBytes += halfBufferCache->BytesUsed();
+    halfBufferCache->Clear();
 
     LOG_VERBOSE("s bytes: %d", vector3BufferCache->BytesUsed());
     meshTangentBytes += vector3BufferCache->BytesUsed();
     vector3BufferCache->Clear();
+
+    std::lock_guard<std::mutex> lock(sharedBuffersMutex);
+    sharedBuffers.clear();
 }
 
 }  // namespace pbrt
@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/float.h>
 #include <pbrt/util/hash.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
@@ -24,29 +25,55 @@ namespace pbrt {
 STAT_MEMORY_COUNTER("Memory/Redundant vertex and index buffers", redundantBufferBytes);
 STAT_PERCENT("Geometry/Buffer cache hits", nBufferCacheHits, nBufferCacheLookups);
 
+// Shared Buffer Declarations
+// Buffer caches that are given a directory store buffers of at least this many
+// bytes in files there and map them into memory. Since unmodified mapped pages
+// come from the operating system's file cache, processes that render the same
+// geometry concurrently share a single copy of it.
+constexpr size_t MinSharedBufferBytes = 64 * 1024;
+
+// Returns a read-only mapping of a file in _directory_ that holds a copy of
+// the given bytes, creating the file if necessary, or nullptr if the file
+// can't be used. The mapping remains valid until FreeBufferCaches() is called.
+const void *MapSharedBuffer(const std::string &directory, const void *ptr, size_t size);
+
 // BufferCache Definition
 template <typename T>
 class BufferCache {
   public:
     // BufferCache Public Methods
-    BufferCache(Allocator alloc) : alloc(alloc) {}
+    BufferCache(Allocator alloc, std::string sharedDirectory = {})
+        : alloc(alloc), sharedDirectory(std::move(sharedDirectory)) {}
 
     const T *LookupOrAdd(const std::vector<T> &buf) {
         ++nBufferCacheLookups;
-        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_lock<std::mutex> lock(mutex);
         // Return pointer to data if _buf_ contents is already in the cache
         Buffer lookupBuffer(buf.data(), buf.size());
         if (auto iter = cache.find(lookupBuffer); iter != cache.end()) {
             DCHECK(std::memcmp(buf.data(), iter->ptr, buf.size() * sizeof(T)) == 0);
+            const T *ptr = iter->ptr;
+            lock.unlock();
             ++nBufferCacheHits;
             redundantBufferBytes += buf.capacity() * sizeof(T);
-            return iter->ptr;
+            return ptr;
+        }
+
+        // Use a shared file-backed copy of large buffers if possible
+        size_t bytes = buf.size() * sizeof(T);
+        if (!sharedDirectory.empty() && bytes >= MinSharedBufferBytes) {
+            if (const T *ptr = (const T *)MapSharedBuffer(sharedDirectory, buf.data(),
+                                                          bytes);
+                ptr) {
+                cache.insert(Buffer(ptr, buf.size(), true));
+                return ptr;
+            }
         }
 
         // Add _buf_ contents to cache and return pointer to cached copy
         T *ptr = alloc.allocate_object<T>(buf.size());
         std::copy(buf.begin(), buf.end(), ptr);
-        bytesUsed += buf.size() * sizeof(T);
+        bytesUsed += bytes;
         cache.insert(Buffer(ptr, buf.size()));
         return ptr;
     }
@@ -54,7 +81,8 @@ class BufferCache {
     void Clear() {
         std::lock_guard<std::mutex> lock(mutex);
         for (auto iter : cache)
-            alloc.deallocate_object(const_cast<T *>(iter.ptr), iter.size);
+            if (!iter.shared)
+                alloc.deallocate_object(const_cast<T *>(iter.ptr), iter.size);
         cache.clear();
         bytesUsed = 0;
     }
@@ -66,7 +94,8 @@ class BufferCache {
     struct Buffer {
         // BufferCache::Buffer Public Methods
         Buffer() = default;
-        Buffer(const T *ptr, size_t size) : ptr(ptr), size(size) {}
+        Buffer(const T *ptr, size_t size, bool shared = false)
+            : ptr(ptr), size(size), shared(shared) {}
 
         bool operator==(const Buffer &b) const {
             return size == b.size && std::memcmp(ptr, b.ptr, size * sizeof(T)) == 0;
@@ -74,6 +103,8 @@ class BufferCache {
 
         const T *ptr = nullptr;
         size_t size = 0;
+        // Shared buffers are mapped from files rather than allocated
+        bool shared = false;
     };
 
     // BufferCache::BufferHasher Definition
@@ -83,6 +114,7 @@ class BufferCache {
 
     // BufferCache Private Members
     Allocator alloc;
+    std::string sharedDirectory;
     std::mutex mutex;
     std::unordered_set<Buffer, BufferHasher> cache;
     size_t bytesUsed = 0;
@@ -94,8 +126,12 @@ extern BufferCache<Point2f> *point2BufferCache;
 extern BufferCache<Point3f> *point3BufferCache;
 extern BufferCache<Vector3f> *vector3BufferCache;
 extern BufferCache<Normal3f> *normal3BufferCache;
+// Buffer caches for compressed triangle mesh vertex data
+extern BufferCache<uint16_t> *uint16BufferCache;
+extern BufferCache<OctahedralVector> *octahedralBufferCache;
+extern BufferCache<Half> *halfBufferCache;
 
-void InitBufferCaches(Allocator alloc);
+void InitBufferCaches(Allocator alloc, std::string sharedDirectory = {});
 void FreeBufferCaches();
 
 }  // namespace pbrt
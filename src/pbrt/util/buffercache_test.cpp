@@ -6,7 +6,11 @@
 
 #include <pbrt/pbrt.h>
 #include <pbrt/util/buffercache.h>
+#include <pbrt/util/file.h>
 
+#include <cstdio>
+#include <cstring>
+#include <string>
 #include <vector>
 
 using namespace pbrt;
@@ -38,3 +42,26 @@ TEST(BufferCache, Basics) {
 
     EXPECT_EQ(9 * sizeof(int), intBufferCache->BytesUsed());
 }
+
+TEST(BufferCache, Shared) {
+    BufferCache<int> cache(Allocator(), ".");
+    std::vector<int> v(MinSharedBufferBytes / sizeof(int));
+    for (size_t i = 0; i < v.size(); ++i)
+        v[i] = i;
+
+    // Large buffers are stored in a file and mapped rather than allocated
+    const int *ptr = cache.LookupOrAdd(v);
+    EXPECT_EQ(0, cache.BytesUsed());
+    EXPECT_EQ(0, std::memcmp(ptr, v.data(), v.size() * sizeof(int)));
+    EXPECT_EQ(ptr, cache.LookupOrAdd(v));
+
+    // Another cache, as in another process, maps the same file
+    BufferCache<int> otherCache(Allocator(), ".");
+    const int *otherPtr = otherCache.LookupOrAdd(v);
+    EXPECT_EQ(0, std::memcmp(otherPtr, v.data(), v.size() * sizeof(int)));
+
+    std::vector<std::string> files = MatchingFilenames("./buffer-");
+    EXPECT_EQ(1, files.size());
+    for (const std::string &file : files)
+        EXPECT_EQ(0, remove(file.c_str()));
+}
@@ -85,8 +85,10 @@ void PrintStackTrace();
 
 #define CHECK_RARE_TO_STRING(x) #x
 #define CHECK_RARE_EXPAND_AND_TO_STRING(x) CHECK_RARE_TO_STRING(x)
+#define CHECK_RARE_NAME(cond) \
+    __FILE__ " " CHECK_RARE_EXPAND_AND_TO_STRING(__LINE__) ": CHECK_RARE failed: " #cond
 
-#ifdef PBRT_IS_GPU_CODE
+#if defined(PBRT_IS_GPU_CODE) || defined(PBRT_DISABLE_STATS)
 
 #define CHECK_RARE(freq, condition)
 #define DCHECK_RARE(freq, condition)
@@ -99,12 +101,11 @@ void PrintStackTrace();
     static_assert(std::is_integral<decltype(condition)>::value,                         \
                   "Expected Boolean condition as second argument to CHECK_RARE");       \
     do {                                                                                \
-        static thread_local int64_t numTrue, total;                                     \
-        static StatRegisterer reg([](StatsAccumulator &accum) {                         \
-            accum.ReportRareCheck(__FILE__ " " CHECK_RARE_EXPAND_AND_TO_STRING(         \
-                                      __LINE__) ": CHECK_RARE failed: " #condition,     \
-                                  freq, numTrue, total);                                \
-            numTrue = total = 0;                                                        \
+        static thread_local StatCounter numTrue([](StatsAccumulator &accum, int64_t v) { \
+            accum.ReportRareCheck(CHECK_RARE_NAME(condition), freq, v, 0);              \
+        });                                                                             \
+        static thread_local StatCounter total([](StatsAccumulator &accum, int64_t v) {  \
+            accum.ReportRareCheck(CHECK_RARE_NAME(condition), freq, 0, v);              \
         });                                                                             \
         ++total;                                                                        \
         if (condition)                                                                  \
@@ -117,7 +118,7 @@ void PrintStackTrace();
 #define DCHECK_RARE(freq, condition)
 #endif  // NDEBUG
 
-#endif  // PBRT_IS_GPU_CODE
+#endif  // PBRT_IS_GPU_CODE || PBRT_DISABLE_STATS
 
 // CheckCallbackScope Definition
 class CheckCallbackScope {
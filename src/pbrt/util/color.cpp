@@ -32,6 +32,10 @@ std::string RGBSigmoidPolynomial::ToString() const {
     return StringPrintf("[ RGBSigmoidPolynomial c0: %f c1: %f c2: %f ]", c0, c1, c2);
 }
 
+std::string RGBBoxSpectrum::ToString() const {
+    return StringPrintf("[ RGBBoxSpectrum r: %f g: %f b: %f ]", r, g, b);
+}
+
 // RGBToSpectrumTable Method Definitions
 RGBSigmoidPolynomial RGBToSpectrumTable::operator()(const RGB &rgb) const {
     CHECK(rgb[0] >= 0.f && rgb[1] >= 0.f && rgb[2] >= 0.f && rgb[0] <= 1.f &&
@@ -355,6 +355,9 @@ class RGBSigmoidPolynomial {
         return std::max((*this)(360), (*this)(830));
     }
 
+    PBRT_CPU_GPU
+    pstd::array<Float, 3> Coefficients() const { return {c0, c1, c2}; }
+
   private:
     // RGBSigmoidPolynomial Private Methods
     PBRT_CPU_GPU
@@ -364,6 +367,40 @@ class RGBSigmoidPolynomial {
     Float c0, c1, c2;
 };
 
+// RGBBoxSpectrum Definition
+// _RGBBoxSpectrum_ is the cheaper stand-in for _RGBSigmoidPolynomial_ that
+// is used by builds with PBRT_RGB_SPECTRUM_FAST_PATH for preview renders: it
+// gives the blue, green, or red value for wavelengths in the corresponding
+// part of the visible range. Gray values are represented exactly, while
+// saturated colors only approximately round-trip.
+class RGBBoxSpectrum {
+  public:
+    // RGBBoxSpectrum Public Methods
+    RGBBoxSpectrum() = default;
+    PBRT_CPU_GPU
+    RGBBoxSpectrum(Float r, Float g, Float b) : r(r), g(g), b(b) {}
+    std::string ToString() const;
+
+    PBRT_CPU_GPU
+    Float operator()(Float lambda) const {
+        return lambda < 490 ? b : (lambda < 580 ? g : r);
+    }
+
+    PBRT_CPU_GPU
+    Float MaxValue() const { return std::max({r, g, b}); }
+
+  private:
+    // RGBBoxSpectrum Private Members
+    Float r, g, b;
+};
+
+// The function of wavelength that the _RGB*Spectrum_ classes evaluate
+#ifdef PBRT_RGB_SPECTRUM_FAST_PATH
+using RGBSpectrumFunction = RGBBoxSpectrum;
+#else
+using RGBSpectrumFunction = RGBSigmoidPolynomial;
+#endif
+
 // RGBToSpectrumTable Definition
 class RGBToSpectrumTable {
   public:
@@ -463,6 +500,8 @@ class GammaColorEncoding {
     PBRT_CPU_GPU
     void FromLinear(pstd::span<const Float> vin, pstd::span<uint8_t> vout) const;
 
+    Float Gamma() const { return gamma; }
+
     std::string ToString() const;
 
   private:
@@ -125,6 +125,7 @@ TEST(RGBAlbedoSpectrum, MaxValue) {
     }
 }
 
+#ifndef PBRT_RGB_SPECTRUM_FAST_PATH
 TEST(RGBAlbedoSpectrum, RoundTripsRGB) {
     RNG rng;
     const RGBColorSpace &cs = *RGBColorSpace::sRGB;
@@ -268,6 +269,37 @@ TEST(RGBIlluminantSpectrum, RoundTripACES) {
             << rgb << " vs " << rgb2 << " xyz " << xyz;
     }
 }
+#else
+// With PBRT_RGB_SPECTRUM_FAST_PATH, only gray values round-trip exactly; the
+// dominant channel of saturated colors should still be preserved.
+TEST(RGBBoxSpectrum, RoundTrips) {
+    RNG rng;
+    for (const RGBColorSpace *cs :
+         {RGBColorSpace::sRGB, RGBColorSpace::Rec2020, RGBColorSpace::ACES2065_1}) {
+        for (int i = 0; i < 100; ++i) {
+            Float g = rng.Uniform<Float>();
+            RGB rgb(.15f, .15f, .15f);
+            rgb[i % 3] = .85f;
+            for (bool gray : {true, false}) {
+                RGB in = gray ? RGB(g, g, g) : rgb;
+                RGBAlbedoSpectrum rs(*cs, in);
+                DenselySampledSpectrum rsIllum = DenselySampledSpectrum::SampleFunction(
+                    [&](Float lambda) { return rs(lambda) * cs->illuminant(lambda); });
+                RGB out = cs->ToRGB(SpectrumToXYZ(&rsIllum));
+
+                if (gray) {
+                    for (int c = 0; c < 3; ++c)
+                        EXPECT_LT(std::abs(in[c] - out[c]), .01) << in << " vs " << out;
+                } else {
+                    int maxc = (out.r > out.g) ? (out.r > out.b ? 0 : 2)
+                                               : (out.g > out.b ? 1 : 2);
+                    EXPECT_EQ(i % 3, maxc) << in << " vs " << out;
+                }
+            }
+        }
+    }
+}
+#endif  // !PBRT_RGB_SPECTRUM_FAST_PATH
 
 TEST(sRGB, Conversion) {
     // Check the basic 8 bit values
@@ -8,17 +8,31 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/float.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/math.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
 #include <cstring>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <type_traits>
+#include <utility>
+
+// _FlatHashMap_ matches control bytes with SSE2 where it's available and
+// otherwise with a loop over each group.
+#if !defined(PBRT_IS_GPU_CODE) && !defined(__CUDACC__) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PBRT_FLAT_HASH_MAP_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace pbrt {
 
@@ -790,6 +804,209 @@ class HashMap {
     size_t nStored = 0;
 };
 
+// FlatHashMap Definition
+// _FlatHashMap_ is an open-addressing hash map for CPU code in the style of
+// Abseil's "Swiss tables." Each slot has a control byte that is either
+// _Empty_ or holds 7 bits of its key's hash; slots are probed in groups of 16
+// whose control bytes are compared to a key's bits all at once, so that keys
+// are rarely compared unless they match. Entries are stored inline, without
+// a node allocation per entry, and can't be erased. Unlike _HashMap_, it
+// isn't usable in GPU code.
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Equal = std::equal_to<Key>>
+class FlatHashMap {
+  public:
+    // FlatHashMap Type Definitions
+    using Entry = std::pair<Key, Value>;
+
+    class Iterator {
+      public:
+        Iterator &operator++() {
+            while (++index < map->capacity() && map->ctrl[index] == Empty)
+                ;
+            return *this;
+        }
+
+        bool operator==(const Iterator &iter) const { return index == iter.index; }
+        bool operator!=(const Iterator &iter) const { return index != iter.index; }
+
+        Entry &operator*() const { return map->slots[index]; }
+        Entry *operator->() const { return &map->slots[index]; }
+
+      private:
+        friend class FlatHashMap;
+        Iterator(const FlatHashMap *map, size_t index) : map(map), index(index) {}
+        const FlatHashMap *map;
+        size_t index;
+    };
+
+    using iterator = Iterator;
+
+    // FlatHashMap Public Methods
+    FlatHashMap(Allocator alloc = {}) : alloc(alloc) {}
+    ~FlatHashMap() { Clear(); }
+
+    FlatHashMap(const FlatHashMap &) = delete;
+    FlatHashMap &operator=(const FlatHashMap &) = delete;
+
+    size_t size() const { return nStored; }
+    size_t capacity() const { return nGroups * GroupSize; }
+    bool empty() const { return nStored == 0; }
+
+    void Clear() {
+        if (nGroups == 0)
+            return;
+        for (size_t i = 0; i < capacity(); ++i)
+            if (ctrl[i] != Empty)
+                slots[i].~Entry();
+        alloc.deallocate_object(ctrl, capacity());
+        alloc.deallocate_object(slots, capacity());
+        ctrl = nullptr;
+        slots = nullptr;
+        nGroups = nStored = 0;
+    }
+
+    // Ensures that _n_ entries can be stored without the table growing
+    void Reserve(size_t n) {
+        size_t groups = std::max<size_t>(nGroups, 1);
+        while (MaxStored(groups) < n)
+            groups *= 2;
+        if (groups > nGroups)
+            Rehash(groups);
+    }
+
+    Value *Find(const Key &key) {
+        size_t index = FindIndex(key, HashKey(key));
+        return index == NotFound ? nullptr : &slots[index].second;
+    }
+    const Value *Find(const Key &key) const {
+        size_t index = FindIndex(key, HashKey(key));
+        return index == NotFound ? nullptr : &slots[index].second;
+    }
+    bool HasKey(const Key &key) const { return Find(key) != nullptr; }
+
+    // Returns the value for _key_, inserting a default-constructed value if
+    // it isn't present
+    Value &operator[](const Key &key) {
+        uint64_t hash = HashKey(key);
+        if (size_t index = FindIndex(key, hash); index != NotFound)
+            return slots[index].second;
+        return slots[InsertNew(key, hash)].second;
+    }
+
+    void Insert(const Key &key, Value value) { (*this)[key] = std::move(value); }
+
+    iterator begin() const {
+        Iterator iter(this, 0);
+        if (capacity() > 0 && ctrl[0] == Empty)
+            ++iter;
+        return iter;
+    }
+    iterator end() const { return Iterator(this, capacity()); }
+
+  private:
+    // FlatHashMap Private Methods
+    static size_t MaxStored(size_t groups) { return groups * GroupSize / 8 * 7; }
+
+    static uint64_t HashKey(const Key &key) {
+        // Mix the hash's bits since many standard library hash functions for
+        // integers return their argument
+        return MixBits(uint64_t(Hash()(key)));
+    }
+
+    // Returns a bit mask of the slots in the group starting at _group_ whose
+    // control byte is _c_
+    static uint32_t Match(const int8_t *group, int8_t c) {
+#ifdef PBRT_FLAT_HASH_MAP_SSE2
+        __m128i g = _mm_loadu_si128((const __m128i *)group);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < GroupSize; ++i)
+            mask |= uint32_t(group[i] == c) << i;
+        return mask;
+#endif
+    }
+
+    // Returns the index of the lowest set bit in _mask_, which must be nonzero
+    static int LowestBit(uint32_t mask) { return Log2Int(mask & (~mask + 1)); }
+
+    size_t FindIndex(const Key &key, uint64_t hash) const {
+        if (nGroups == 0)
+            return NotFound;
+        // Probe groups using triangular numbers, which visits all of them since
+        // their count is a power of two; the table is never full, so the
+        // search ends at a group with an empty slot
+        int8_t h2 = hash & 0x7f;
+        size_t group = (hash >> 7) & (nGroups - 1);
+        for (size_t step = 1;; ++step) {
+            const int8_t *g = ctrl + group * GroupSize;
+            for (uint32_t m = Match(g, h2); m != 0; m &= m - 1) {
+                size_t index = group * GroupSize + LowestBit(m);
+                if (Equal()(slots[index].first, key))
+                    return index;
+            }
+            if (Match(g, Empty) != 0)
+                return NotFound;
+            group = (group + step) & (nGroups - 1);
+        }
+    }
+
+    // Returns the first empty slot along _hash_'s probe sequence
+    size_t FindEmpty(uint64_t hash) const {
+        size_t group = (hash >> 7) & (nGroups - 1);
+        for (size_t step = 1;; ++step) {
+            if (uint32_t m = Match(ctrl + group * GroupSize, Empty); m != 0)
+                return group * GroupSize + LowestBit(m);
+            group = (group + step) & (nGroups - 1);
+        }
+    }
+
+    size_t InsertNew(const Key &key, uint64_t hash) {
+        if (nStored + 1 > MaxStored(nGroups))
+            Rehash(std::max<size_t>(2 * nGroups, 1));
+        size_t index = FindEmpty(hash);
+        ctrl[index] = hash & 0x7f;
+        new (&slots[index]) Entry(key, Value());
+        ++nStored;
+        return index;
+    }
+
+    void Rehash(size_t newGroups) {
+        int8_t *oldCtrl = ctrl;
+        Entry *oldSlots = slots;
+        size_t oldCapacity = capacity();
+
+        nGroups = newGroups;
+        ctrl = alloc.allocate_object<int8_t>(capacity());
+        std::fill(ctrl, ctrl + capacity(), Empty);
+        slots = alloc.allocate_object<Entry>(capacity());
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            // Move _oldSlots[i]_ to the new table if it is set
+            if (oldCtrl[i] == Empty)
+                continue;
+            uint64_t hash = HashKey(oldSlots[i].first);
+            size_t index = FindEmpty(hash);
+            ctrl[index] = hash & 0x7f;
+            new (&slots[index]) Entry(std::move(oldSlots[i]));
+            oldSlots[i].~Entry();
+        }
+        if (oldCapacity > 0) {
+            alloc.deallocate_object(oldCtrl, oldCapacity);
+            alloc.deallocate_object(oldSlots, oldCapacity);
+        }
+    }
+
+    // FlatHashMap Private Members
+    static constexpr int GroupSize = 16;
+    static constexpr int8_t Empty = -128;
+    static constexpr size_t NotFound = ~size_t(0);
+    Allocator alloc;
+    int8_t *ctrl = nullptr;
+    Entry *slots = nullptr;
+    size_t nGroups = 0, nStored = 0;
+};
+
 // SampledGrid Definition
 template <typename T>
 class SampledGrid {
@@ -797,13 +1014,38 @@ class SampledGrid {
     using const_iterator = typename pstd::vector<T>::const_iterator;
     // SampledGrid Public Methods
     SampledGrid() = default;
-    SampledGrid(Allocator alloc) : values(alloc) {}
-    SampledGrid(pstd::span<const T> v, int nx, int ny, int nz, Allocator alloc)
-        : values(v.begin(), v.end(), alloc), nx(nx), ny(ny), nz(nz) {
-        CHECK_EQ(nx * ny * nz, values.size());
+    SampledGrid(Allocator alloc)
+        : values(alloc), halfValues(alloc), brickMask(alloc), brickRank(alloc) {}
+    SampledGrid(pstd::span<const T> v, int nx, int ny, int nz, Allocator alloc,
+                bool sparse = false, bool halfPrecision = false)
+        : values(alloc),
+          halfValues(alloc),
+          brickMask(alloc),
+          brickRank(alloc),
+          nx(nx),
+          ny(ny),
+          nz(nz) {
+        CHECK_EQ(nx * ny * nz, v.size());
+        std::vector<T> stored(v.begin(), v.end());
+        if constexpr (std::is_same_v<T, Float>) {
+            if (sparse)
+                stored = StoreBricks(v);
+            if (halfPrecision) {
+                halfValues.reserve(stored.size());
+                for (Float value : stored)
+                    halfValues.push_back(Half(value));
+                return;
+            }
+        } else
+            // Only _Float_ grids can be stored sparsely or at half precision
+            CHECK(!sparse && !halfPrecision);
+        values = pstd::vector<T>(stored.begin(), stored.end(), alloc);
     }
 
-    size_t BytesAllocated() const { return values.size() * sizeof(T); }
+    size_t BytesAllocated() const {
+        return values.size() * sizeof(T) + halfValues.size() * sizeof(Half) +
+               brickMask.size() * sizeof(uint64_t) + brickRank.size() * sizeof(int);
+    }
     int xSize() const { return nx; }
     int ySize() const { return ny; }
     int zSize() const { return nz; }
@@ -814,19 +1056,17 @@ class SampledGrid {
     template <typename F>
     PBRT_CPU_GPU auto Lookup(const Point3f &p, F convert) const {
         // Compute voxel coordinates and offsets for _p_
-        Point3f pSamples(p.x * nx - .5f, p.y * ny - .5f, p.z * nz - .5f);
-        Point3i pi = (Point3i)Floor(pSamples);
-        Vector3f d = pSamples - (Point3f)pi;
+        Point3i pi;
+        Vector3f d;
+        SampleCoordinates(p, &pi, &d);
 
         // Return trilinearly interpolated voxel values
-        auto d00 =
-            Lerp(d.x, Lookup(pi, convert), Lookup(pi + Vector3i(1, 0, 0), convert));
-        auto d10 = Lerp(d.x, Lookup(pi + Vector3i(0, 1, 0), convert),
-                        Lookup(pi + Vector3i(1, 1, 0), convert));
-        auto d01 = Lerp(d.x, Lookup(pi + Vector3i(0, 0, 1), convert),
-                        Lookup(pi + Vector3i(1, 0, 1), convert));
-        auto d11 = Lerp(d.x, Lookup(pi + Vector3i(0, 1, 1), convert),
-                        Lookup(pi + Vector3i(1, 1, 1), convert));
+        decltype(convert(T{})) v[8];
+        CornerValues(pi, convert, v);
+        auto d00 = Lerp(d.x, v[0], v[1]);
+        auto d10 = Lerp(d.x, v[2], v[3]);
+        auto d01 = Lerp(d.x, v[4], v[5]);
+        auto d11 = Lerp(d.x, v[6], v[7]);
         return Lerp(d.z, Lerp(d.y, d00, d10), Lerp(d.y, d01, d11));
     }
 
@@ -835,12 +1075,55 @@ class SampledGrid {
         return Lookup(p, [] PBRT_CPU_GPU(T value) { return value; });
     }
 
+    // Computes the trilinearly interpolated values at all of the points _p_. Four
+    // points are interpolated at once using _SIMDFloat_ operations, which is
+    // worthwhile when many points along a ray segment are needed together.
+    void Lookup(pstd::span<const Point3f> p, pstd::span<Float> result) const {
+        static_assert(std::is_same_v<T, Float>, "Batched lookups require Float grids");
+        CHECK_EQ(p.size(), result.size());
+        using Float4 = SIMDFloat<4>;
+        auto lerp = [](Float4 t, Float4 a, Float4 b) {
+            return (Float4(1) - t) * a + t * b;
+        };
+        size_t i = 0;
+        for (; i + 4 <= p.size(); i += 4) {
+            // Gather corner values and offsets for four points
+            Float v[8][4], d[3][4];
+            for (int j = 0; j < 4; ++j) {
+                Point3i pi;
+                Vector3f dj;
+                SampleCoordinates(p[i + j], &pi, &dj);
+                for (int axis = 0; axis < 3; ++axis)
+                    d[axis][j] = dj[axis];
+                Float corners[8];
+                CornerValues(pi, [](Float value) { return value; }, corners);
+                for (int c = 0; c < 8; ++c)
+                    v[c][j] = corners[c];
+            }
+
+            // Interpolate the corner values of all four points together
+            Float4 dx = Float4::Load(d[0]), dy = Float4::Load(d[1]),
+                   dz = Float4::Load(d[2]);
+            Float4 d00 = lerp(dx, Float4::Load(v[0]), Float4::Load(v[1]));
+            Float4 d10 = lerp(dx, Float4::Load(v[2]), Float4::Load(v[3]));
+            Float4 d01 = lerp(dx, Float4::Load(v[4]), Float4::Load(v[5]));
+            Float4 d11 = lerp(dx, Float4::Load(v[6]), Float4::Load(v[7]));
+            lerp(dz, lerp(dy, d00, d10), lerp(dy, d01, d11)).Store(&result[i]);
+        }
+        // Look up any remaining points individually
+        for (; i < p.size(); ++i)
+            result[i] = Lookup(p[i]);
+    }
+
     template <typename F>
     PBRT_CPU_GPU auto Lookup(const Point3i &p, F convert) const {
         Bounds3i sampleBounds(Point3i(0, 0, 0), Point3i(nx, ny, nz));
         if (!InsideExclusive(p, sampleBounds))
             return convert(T{});
-        return convert(values[(p.z * ny + p.y) * nx + p.x]);
+        int index = ValueIndex(p);
+        if (index == -1)
+            return convert(T{});
+        return convert(Value(index));
     }
 
     PBRT_CPU_GPU
@@ -871,15 +1154,153 @@ class SampledGrid {
         return MaxValue(bounds, [](T value) { return value; });
     }
 
+    template <typename F>
+    Float MinValue(const Bounds3f &bounds, F convert) const {
+        Point3f ps[2] = {Point3f(bounds.pMin.x * nx - .5f, bounds.pMin.y * ny - .5f,
+                                 bounds.pMin.z * nz - .5f),
+                         Point3f(bounds.pMax.x * nx - .5f, bounds.pMax.y * ny - .5f,
+                                 bounds.pMax.z * nz - .5f)};
+        // Include samples outside the grid, which _Lookup()_ returns as zero
+        Point3i pi[2] = {Point3i(Floor(ps[0])),
+                         Point3i(Floor(ps[1])) + Vector3i(1, 1, 1)};
+
+        Float minValue = Lookup(Point3i(pi[0]), convert);
+        for (int z = pi[0].z; z <= pi[1].z; ++z)
+            for (int y = pi[0].y; y <= pi[1].y; ++y)
+                for (int x = pi[0].x; x <= pi[1].x; ++x)
+                    minValue = std::min(minValue, Lookup(Point3i(x, y, z), convert));
+
+        return minValue;
+    }
+
+    T MinValue(const Bounds3f &bounds) const {
+        return MinValue(bounds, [](T value) { return value; });
+    }
+
     std::string ToString() const {
-        return StringPrintf("[ SampledGrid nx: %d ny: %d nz: %d values: %s ]", nx, ny, nz,
-                            values);
+        return StringPrintf("[ SampledGrid nx: %d ny: %d nz: %d values: %s "
+                            "halfValues: %s brickMask: %s ]",
+                            nx, ny, nz, values, halfValues, brickMask);
     }
 
   private:
+    // SampledGrid Private Methods
+    std::vector<Float> StoreBricks(pstd::span<const Float> v) {
+        // Initialize brick layout for grid
+        nBricks = Point3i((nx + BrickSize - 1) / BrickSize,
+                          (ny + BrickSize - 1) / BrickSize,
+                          (nz + BrickSize - 1) / BrickSize);
+        int nBrick = nBricks.x * nBricks.y * nBricks.z;
+        brickMask.resize((nBrick + 63) / 64);
+        brickRank.resize(brickMask.size());
+
+        // Return the values of bricks that aren't entirely zero
+        std::vector<Float> stored, brick(BrickSize * BrickSize * BrickSize);
+        for (int b = 0; b < nBrick; ++b) {
+            // Gather values for brick _b_ and check whether it's empty
+            Point3i p0 = BrickSize * Point3i(b % nBricks.x, (b / nBricks.x) % nBricks.y,
+                                             b / (nBricks.x * nBricks.y));
+            bool empty = true;
+            for (int i = 0; i < brick.size(); ++i) {
+                Point3i p = p0 + Vector3i(i % BrickSize, (i / BrickSize) % BrickSize,
+                                          i / (BrickSize * BrickSize));
+                brick[i] = 0;
+                if (p.x < nx && p.y < ny && p.z < nz) {
+                    brick[i] = v[(p.z * ny + p.y) * nx + p.x];
+                    empty &= brick[i] == 0;
+                }
+            }
+            if (!empty) {
+                brickMask[b / 64] |= uint64_t(1) << (b % 64);
+                stored.insert(stored.end(), brick.begin(), brick.end());
+            }
+        }
+        for (size_t i = 1; i < brickMask.size(); ++i)
+            brickRank[i] = brickRank[i - 1] + PopCount(brickMask[i - 1]);
+        return stored;
+    }
+
+    PBRT_CPU_GPU
+    void SampleCoordinates(const Point3f &p, Point3i *pi, Vector3f *d) const {
+        Point3f pSamples(p.x * nx - .5f, p.y * ny - .5f, p.z * nz - .5f);
+        *pi = (Point3i)Floor(pSamples);
+        *d = pSamples - (Point3f)*pi;
+    }
+
+    template <typename F, typename R>
+    PBRT_CPU_GPU void CornerValues(Point3i pi, F convert, R v[8]) const {
+        // Return the values of the eight samples around _pi_, with $x$ varying
+        // fastest; when they're all stored in one block, only one index is computed
+        // and their bounds aren't checked individually
+        int base, dy, dz;
+        if (CornerStrides(pi, &base, &dy, &dz)) {
+            const int offset[8] = {0,  1,      dy,      dy + 1,
+                                   dz, dz + 1, dy + dz, dy + dz + 1};
+            for (int c = 0; c < 8; ++c)
+                v[c] = convert(Value(base + offset[c]));
+        } else
+            for (int c = 0; c < 8; ++c)
+                v[c] = Lookup(pi + Vector3i(c & 1, (c >> 1) & 1, c >> 2), convert);
+    }
+
+    PBRT_CPU_GPU
+    bool CornerStrides(Point3i pi, int *base, int *dy, int *dz) const {
+        // Find the index of the sample at _pi_ and the strides to its neighbors in
+        // $y$ and $z$ if all eight samples around it are stored together
+        if (pi.x < 0 || pi.y < 0 || pi.z < 0 || pi.x >= nx - 1 || pi.y >= ny - 1 ||
+            pi.z >= nz - 1)
+            return false;
+        if (brickMask.empty()) {
+            *base = (pi.z * ny + pi.y) * nx + pi.x;
+            *dy = nx;
+            *dz = nx * ny;
+            return true;
+        }
+        // Sparse grids need the samples to be in a single stored brick
+        if (pi.x % BrickSize == BrickSize - 1 || pi.y % BrickSize == BrickSize - 1 ||
+            pi.z % BrickSize == BrickSize - 1)
+            return false;
+        *base = ValueIndex(pi);
+        *dy = BrickSize;
+        *dz = BrickSize * BrickSize;
+        return *base != -1;
+    }
+
+    PBRT_CPU_GPU
+    T Value(int index) const {
+        if constexpr (std::is_same_v<T, Float>)
+            if (!halfValues.empty())
+                return Float(halfValues[index]);
+        return values[index];
+    }
+
+    PBRT_CPU_GPU
+    int ValueIndex(Point3i p) const {
+        if (brickMask.empty())
+            return (p.z * ny + p.y) * nx + p.x;
+        // Find the brick's value offset using the ranks of occupied bricks
+        int b = (p.z / BrickSize * nBricks.y + p.y / BrickSize) * nBricks.x +
+                p.x / BrickSize;
+        uint64_t word = brickMask[b / 64], bit = uint64_t(1) << (b % 64);
+        if (!(word & bit))
+            return -1;
+        int brick = brickRank[b / 64] + PopCount(word & (bit - 1));
+        return brick * BrickSize * BrickSize * BrickSize +
+               ((p.z % BrickSize) * BrickSize + p.y % BrickSize) * BrickSize +
+               p.x % BrickSize;
+    }
+
     // SampledGrid Private Members
+    // Sparse grids store _BrickSize_^3 bricks of values that aren't all zero, with
+    // one _brickMask_ bit per brick and the number of bricks stored before each
+    // mask word in _brickRank_; half-precision grids store values in _halfValues_
+    static constexpr int BrickSize = 8;
     pstd::vector<T> values;
+    pstd::vector<Half> halfValues;
+    pstd::vector<uint64_t> brickMask;
+    pstd::vector<int> brickRank;
     int nx, ny, nz;
+    Point3i nBricks;
 };
 
 }  // namespace pbrt
@@ -108,6 +108,63 @@ TEST(HashMap, Randoms) {
     EXPECT_EQ(0, values.size());
 }
 
+TEST(FlatHashMap, Basics) {
+    FlatHashMap<std::string, int> map;
+    EXPECT_EQ(nullptr, map.Find("yolo"));
+    EXPECT_TRUE(map.begin() == map.end());
+
+    map.Insert("yolo", 1);
+    map["hello"] = 10;
+    map.Insert("test", 42);
+    EXPECT_EQ(3, map.size());
+    EXPECT_EQ(1, *map.Find("yolo"));
+    EXPECT_EQ(10, *map.Find("hello"));
+    EXPECT_EQ(42, map["test"]);
+    EXPECT_FALSE(map.HasKey("hai"));
+
+    map.Insert("hello", 11);
+    EXPECT_EQ(3, map.size());
+    EXPECT_EQ(11, *map.Find("hello"));
+
+    map.Clear();
+    EXPECT_EQ(0, map.size());
+    EXPECT_FALSE(map.HasKey("yolo"));
+}
+
+TEST(FlatHashMap, Randoms) {
+    FlatHashMap<int, int> map;
+    std::set<int> values;
+    RNG rng(1234);
+
+    // Start with a table that holds a few entries so that it grows many times
+    map.Reserve(10);
+    size_t capacity = map.capacity();
+    for (int i = 0; i < 100000; ++i) {
+        int v = rng.Uniform<uint32_t>(50000);
+        values.insert(v);
+        map.Insert(v, -v);
+    }
+    EXPECT_EQ(values.size(), map.size());
+    EXPECT_GT(map.capacity(), capacity);
+    EXPECT_LE(8 * map.size(), 7 * map.capacity());
+
+    for (int v = 0; v < 50000; ++v) {
+        const int *value = map.Find(v);
+        ASSERT_EQ(values.count(v) == 1, value != nullptr) << v;
+        if (value)
+            EXPECT_EQ(-v, *value);
+    }
+
+    int nVisited = 0;
+    for (const auto &entry : map) {
+        ++nVisited;
+        EXPECT_EQ(entry.first, -entry.second);
+        EXPECT_EQ(1, values.erase(entry.first));
+    }
+    EXPECT_EQ(nVisited, map.size());
+    EXPECT_TRUE(values.empty());
+}
+
 TEST(TypePack, Index) {
     using Pack = TypePack<int, float, double>;
 
@@ -158,3 +215,62 @@ TEST(TypePack, Filter) {
     static_assert(std::is_same_v<TypePack<double>,
                   typename TakeFirstN<1, typename RemoveFirstN<1, FilteredPack>::type>::type>);
 }
+
+TEST(SampledGrid, SparseHalf) {
+    // Grid that's zero apart from a few blocks of random values
+    int nx = 37, ny = 20, nz = 29;
+    std::vector<Float> v(nx * ny * nz, 0.f);
+    RNG rng;
+    for (int z = 0; z < nz; ++z)
+        for (int y = 0; y < ny; ++y)
+            for (int x = 0; x < nx; ++x)
+                if ((x > 30 && y < 5) || (z >= 10 && z < 14 && x < 9))
+                    v[(z * ny + y) * nx + x] = 1 + rng.Uniform<Float>();
+
+    SampledGrid<Float> dense(v, nx, ny, nz, {});
+    SampledGrid<Float> sparse(v, nx, ny, nz, {}, true);
+    SampledGrid<Float> sparseHalf(v, nx, ny, nz, {}, true, true);
+    EXPECT_LT(sparse.BytesAllocated(), dense.BytesAllocated() / 2);
+    EXPECT_LT(sparseHalf.BytesAllocated(), sparse.BytesAllocated());
+
+    for (int z = -1; z <= nz; ++z)
+        for (int y = -1; y <= ny; ++y)
+            for (int x = -1; x <= nx; ++x) {
+                Point3i p(x, y, z);
+                EXPECT_EQ(dense.Lookup(p), sparse.Lookup(p));
+                EXPECT_NEAR(dense.Lookup(p), sparseHalf.Lookup(p), 1e-3f);
+            }
+
+    for (int i = 0; i < 1000; ++i) {
+        Point3f p(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        EXPECT_EQ(dense.Lookup(p), sparse.Lookup(p));
+    }
+    Bounds3f b(Point3f(0.7f, 0.1f, 0.2f), Point3f(0.9f, 0.3f, 0.6f));
+    EXPECT_EQ(dense.MaxValue(b), sparse.MaxValue(b));
+    EXPECT_EQ(dense.MinValue(b), sparse.MinValue(b));
+}
+
+TEST(SampledGrid, BatchedLookup) {
+    int nx = 19, ny = 24, nz = 17;
+    std::vector<Float> v(nx * ny * nz, 0.f);
+    RNG rng;
+    for (int z = 0; z < nz; ++z)
+        for (int y = 0; y < ny; ++y)
+            for (int x = 0; x < nx; ++x)
+                if (x < 12 || z > 10)
+                    v[(z * ny + y) * nx + x] = rng.Uniform<Float>();
+
+    for (bool sparse : {false, true}) {
+        SampledGrid<Float> grid(v, nx, ny, nz, {}, sparse);
+        // Include points outside the grid and an incomplete final batch
+        std::vector<Point3f> p(1003);
+        for (Point3f &pt : p)
+            pt = Point3f(-0.1f + 1.2f * rng.Uniform<Float>(),
+                         -0.1f + 1.2f * rng.Uniform<Float>(),
+                         -0.1f + 1.2f * rng.Uniform<Float>());
+        std::vector<Float> result(p.size());
+        grid.Lookup(pstd::span<const Point3f>(p), pstd::span<Float>(result));
+        for (size_t i = 0; i < p.size(); ++i)
+            EXPECT_NEAR(grid.Lookup(p[i]), result[i], 1e-5f) << p[i];
+    }
+}
@@ -5,11 +5,13 @@
 #include <pbrt/util/display.h>
 
 #include <pbrt/util/error.h>
+#include <pbrt/util/float.h>
 #include <pbrt/util/hash.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/string.h>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <mutex>
@@ -321,11 +323,22 @@ void DisplayItem::ImageChannelBuffer::SetTileBounds(int x, int y, int width, int
 
 bool DisplayItem::ImageChannelBuffer::SendIfChanged(IPCChannel &ipcChannel,
                                                     int tileIndex) {
-    int excess = setCount - tileSize * tileSize;
+    int excess = tileSize * tileSize - setCount;
     if (excess > 0)
         memset(buffer.data() + channelValuesOffset + setCount * sizeof(float), 0,
                excess * sizeof(float));
 
+    // Round the values to half precision, which is plenty for display, so that
+    // tiles that only change by amounts too small to see aren't sent again.
+    // (The display server's protocol only takes 32-bit floats.)
+    uint8_t *values = buffer.data() + channelValuesOffset;
+    for (int i = 0; i < setCount; ++i) {
+        float v;
+        memcpy(&v, values + i * sizeof(float), sizeof(float));
+        v = float(Half(v));
+        memcpy(values + i * sizeof(float), &v, sizeof(float));
+    }
+
     uint64_t hash = HashBuffer(buffer.data() + channelValuesOffset,
                                tileSize * tileSize * sizeof(float));
     if (hash == tileHashes[tileIndex])
@@ -408,12 +421,27 @@ static std::vector<DisplayItem> dynamicItems;
 static IPCChannel *channel;
 
 static void updateDynamicItems() {
+    // Updates are sent at most every 250ms. When sending them takes longer,
+    // e.g. for large images over a slow link, the interval grows so that at
+    // most a fifth of the time is spent updating the display.
+    using clock = std::chrono::steady_clock;
+    constexpr std::chrono::milliseconds minInterval(250), maxInterval(10000);
+    clock::duration interval = minInterval;
     while (!exitThread) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(250));
-
-        std::lock_guard<std::mutex> lock(mutex);
-        for (auto &item : dynamicItems)
-            item.Display(*channel);
+        clock::time_point next = clock::now() + interval;
+        while (!exitThread && clock::now() < next)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        if (exitThread)
+            break;
+
+        clock::time_point start = clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &item : dynamicItems)
+                item.Display(*channel);
+        }
+        clock::duration elapsed = clock::now() - start;
+        interval = std::clamp<clock::duration>(4 * elapsed, minInterval, maxInterval);
     }
 
     // One last time to get the last bits
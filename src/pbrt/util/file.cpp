@@ -12,15 +12,28 @@
 #include <algorithm>
 #include <cctype>
 #include <climits>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <utility>
 #ifndef PBRT_IS_WINDOWS
 #include <dirent.h>
 #include <sys/dir.h>
 #include <sys/types.h>
 #endif
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#elif defined(PBRT_IS_WINDOWS)
+#include <windows.h>  // Windows file mapping API
+#endif
 
 namespace pbrt {
 
@@ -193,4 +206,126 @@ bool WriteFileContents(std::string filename, const std::string &contents) {
     return true;
 }
 
+// Asynchronous File Writing Definitions
+static std::mutex fileWriteMutex;
+static std::condition_variable fileWriterDone;
+static std::deque<std::pair<std::string, std::string>> pendingFileWrites;
+static bool fileWriterRunning = false;
+static std::thread fileWriterThread;
+
+static void writePendingFiles() {
+    std::unique_lock<std::mutex> lock(fileWriteMutex);
+    while (!pendingFileWrites.empty()) {
+        std::pair<std::string, std::string> write = std::move(pendingFileWrites.front());
+        pendingFileWrites.pop_front();
+        lock.unlock();
+        std::string tempFilename = write.first + ".tmp";
+        if (WriteFileContents(tempFilename, write.second) &&
+            std::rename(tempFilename.c_str(), write.first.c_str()) != 0)
+            Error("%s: %s", write.first, ErrorString());
+        lock.lock();
+    }
+    fileWriterRunning = false;
+    fileWriterDone.notify_all();
+}
+
+void WriteFileContentsAsync(std::string filename, std::string contents) {
+    std::lock_guard<std::mutex> lock(fileWriteMutex);
+    auto iter = std::find_if(
+        pendingFileWrites.begin(), pendingFileWrites.end(),
+        [&](const std::pair<std::string, std::string> &write) {
+            return write.first == filename;
+        });
+    if (iter != pendingFileWrites.end())
+        // Replace the older contents, which would be overwritten anyway
+        iter->second = std::move(contents);
+    else
+        pendingFileWrites.push_back({std::move(filename), std::move(contents)});
+
+    // Start a writer thread if the last one has finished
+    if (!fileWriterRunning) {
+        if (fileWriterThread.joinable())
+            fileWriterThread.join();
+        fileWriterRunning = true;
+        fileWriterThread = std::thread(writePendingFiles);
+    }
+}
+
+void FlushFileWrites() {
+    std::unique_lock<std::mutex> lock(fileWriteMutex);
+    fileWriterDone.wait(lock, []() { return !fileWriterRunning; });
+    if (fileWriterThread.joinable())
+        fileWriterThread.join();
+}
+
+// MappedFile Method Definitions
+std::unique_ptr<MappedFile> MappedFile::Open(std::string filename) {
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+
+    struct stat stat;
+    if (fstat(fd, &stat) != 0 || stat.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    size_t len = stat.st_size;
+    void *ptr =
+        mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        Warning("%s: mmap: %s", filename, ErrorString());
+        return nullptr;
+    }
+
+    return std::make_unique<MappedFile>(ptr, len, std::move(filename));
+#elif defined(PBRT_IS_WINDOWS)
+    HANDLE fileHandle =
+        CreateFileW(WStringFromUTF8(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    size_t len = GetFileSize(fileHandle, 0);
+    HANDLE mapping =
+        len > 0 ? CreateFileMapping(fileHandle, 0, PAGE_WRITECOPY, 0, 0, 0) : 0;
+    CloseHandle(fileHandle);
+    if (mapping == 0)
+        return nullptr;
+
+    LPVOID ptr = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    CloseHandle(mapping);
+    if (ptr == nullptr)
+        return nullptr;
+
+    return std::make_unique<MappedFile>(ptr, len, std::move(filename));
+#else
+    if (!FileExists(filename))
+        return nullptr;
+    std::string contents = ReadFileContents(filename);
+    return std::make_unique<MappedFile>(std::move(contents), std::move(filename));
+#endif
+}
+
+MappedFile::MappedFile(void *ptr, size_t length, std::string filename)
+    : ptr((char *)ptr), length(length), filename(std::move(filename)), unmapPtr(ptr) {}
+
+MappedFile::MappedFile(std::string str, std::string filename)
+    : filename(std::move(filename)), contents(std::move(str)) {
+    ptr = &contents[0];
+    length = contents.size();
+}
+
+MappedFile::~MappedFile() {
+#ifdef PBRT_HAVE_MMAP
+    if (unmapPtr && munmap(unmapPtr, length) != 0)
+        Warning("%s: munmap: %s", filename, ErrorString());
+#elif defined(PBRT_IS_WINDOWS)
+    if (unmapPtr && UnmapViewOfFile(unmapPtr) == 0)
+        Warning("%s: UnmapViewOfFile: %s", filename, ErrorString());
+#endif
+}
+
 }  // namespace pbrt
@@ -9,6 +9,7 @@
 
 #include <pbrt/util/pstd.h>
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -17,6 +18,12 @@ namespace pbrt {
 // File and Filename Function Declarations
 std::string ReadFileContents(std::string filename);
 bool WriteFileContents(std::string filename, const std::string &contents);
+// WriteFileContentsAsync() writes the file's contents on a background thread,
+// first to a temporary file that is then renamed, so that an existing file is
+// only ever replaced by a complete one. A pending write is replaced if another
+// is queued for the same file; FlushFileWrites() waits for all of them.
+void WriteFileContentsAsync(std::string filename, std::string contents);
+void FlushFileWrites();
 
 std::vector<Float> ReadFloatFile(std::string filename);
 
@@ -32,6 +39,36 @@ std::vector<std::string> MatchingFilenames(std::string filename);
 FILE *FOpenRead(std::string filename);
 FILE *FOpenWrite(std::string filename);
 
+// MappedFile Definition
+class MappedFile {
+  public:
+    // MappedFile Public Methods
+    // Returns nullptr if the file can't be opened. Pages are mapped
+    // copy-on-write, so callers may modify the contents in memory without
+    // affecting the file.
+    static std::unique_ptr<MappedFile> Open(std::string filename);
+
+    MappedFile(void *ptr, size_t length, std::string filename);
+    MappedFile(std::string contents, std::string filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    char *data() { return ptr; }
+    const char *data() const { return ptr; }
+    size_t size() const { return length; }
+    const std::string &Filename() const { return filename; }
+
+  private:
+    // MappedFile Private Members
+    char *ptr = nullptr;
+    size_t length = 0;
+    std::string filename;
+    void *unmapPtr = nullptr;
+    std::string contents;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_FILE_H
@@ -38,6 +38,16 @@ TEST(File, ReadWriteFile) {
     EXPECT_EQ(0, remove(fn.c_str()));
 }
 
+TEST(File, WriteFileAsync) {
+    std::string fn = inTestDir("writeasync.txt");
+    WriteFileContentsAsync(fn, "first");
+    WriteFileContentsAsync(fn, "second");
+    FlushFileWrites();
+    EXPECT_EQ("second", ReadFileContents(fn));
+    EXPECT_FALSE(FileExists(fn + ".tmp"));
+    EXPECT_EQ(0, remove(fn.c_str()));
+}
+
 TEST(File, Success) {
     std::string fn = inTestDir("floatfile_good.txt");
     EXPECT_TRUE(WriteFileContents(fn, R"(1
@@ -78,3 +88,20 @@ l5l
 
     remove(fn.c_str());
 }
+
+TEST(File, MappedFile) {
+    std::string fn = inTestDir("mapped.txt");
+    std::string str = "this is a test.";
+    EXPECT_TRUE(WriteFileContents(fn, str));
+    {
+        std::unique_ptr<MappedFile> file = MappedFile::Open(fn);
+        ASSERT_TRUE(file != nullptr);
+        EXPECT_EQ(str, std::string(file->data(), file->size()));
+        // Modifying the mapping is private to the process
+        file->data()[0] = 'T';
+    }
+    EXPECT_EQ(str, ReadFileContents(fn));
+    EXPECT_EQ(0, remove(fn.c_str()));
+
+    EXPECT_TRUE(MappedFile::Open(inTestDir("nonexistent.txt")) == nullptr);
+}
@@ -9,6 +9,7 @@
 
 #include <pbrt/util/pstd.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstring>
@@ -573,6 +574,45 @@ class Half {
     uint16_t h;
 };
 
+// Shared-Exponent Encoding Inline Functions
+// Packs four values into 64 bits as an 8-bit exponent shared by all of them
+// and a sign bit and 13-bit mantissa for each one. Values much smaller than
+// the largest of the four lose precision and NaNs are encoded as zero.
+PBRT_CPU_GPU
+inline uint64_t EncodeSharedExponent4(const float v[4]) {
+    float vMax = 0;
+    for (int i = 0; i < 4; ++i)
+        vMax = std::max(vMax, std::abs(v[i]));
+    if (!(vMax >= 0x1p-100f))
+        return 0;
+
+    // Find exponent _e_ such that all of the values are less than $2^e$ and scale
+    // them to 13-bit mantissas
+    int e = std::min(Exponent(vMax) + 1, 128);
+    float scale = BitsToFloat(uint32_t(127 + 13 - e) << 23);
+    uint64_t bits = uint64_t(e + 127);
+    for (int i = 0; i < 4; ++i) {
+        uint64_t m = std::min<float>(8191, std::abs(v[i]) * scale + 0.5f);
+        bits |= (m | (v[i] < 0 ? (1 << 13) : 0)) << (8 + 14 * i);
+    }
+    return bits;
+}
+
+PBRT_CPU_GPU
+inline void DecodeSharedExponent4(uint64_t bits, float v[4]) {
+    int eBits = bits & 0xff;
+    if (eBits == 0) {
+        for (int i = 0; i < 4; ++i)
+            v[i] = 0;
+        return;
+    }
+    float invScale = BitsToFloat(uint32_t(eBits - 13) << 23);
+    for (int i = 0; i < 4; ++i) {
+        int m = (bits >> (8 + 14 * i)) & 0x3fff;
+        v[i] = (m & 0x1fff) * ((m & (1 << 13)) ? -invScale : invScale);
+    }
+}
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_FLOAT_H
@@ -283,3 +283,32 @@ TEST(Half, RoundToNearestEven) {
         h1 = h0.NextDown();
     }
 }
+
+TEST(SharedExponent, RoundTrip) {
+    float zero[4] = {0, 0, 0, 0}, d[4];
+    DecodeSharedExponent4(EncodeSharedExponent4(zero), d);
+    for (int i = 0; i < 4; ++i)
+        EXPECT_EQ(0, d[i]);
+
+    // Small integers and powers of two are represented exactly
+    float exact[4] = {1, -3, 0.375f, 12};
+    DecodeSharedExponent4(EncodeSharedExponent4(exact), d);
+    for (int i = 0; i < 4; ++i)
+        EXPECT_EQ(exact[i], d[i]);
+
+    RNG rng;
+    for (int i = 0; i < 10000; ++i) {
+        // Values are accurate relative to the largest of them
+        float v[4], scale = std::pow(2.f, rng.Uniform<float>() * 160 - 90);
+        float vMax = 0;
+        for (int j = 0; j < 4; ++j) {
+            v[j] = (rng.Uniform<float>() - 0.25f) * scale;
+            vMax = std::max(vMax, std::abs(v[j]));
+        }
+        DecodeSharedExponent4(EncodeSharedExponent4(v), d);
+        for (int j = 0; j < 4; ++j) {
+            EXPECT_LE(std::abs(d[j] - v[j]), vMax / 4096) << v[j] << " " << d[j];
+            EXPECT_FALSE(d[j] > 0 && v[j] < 0);
+        }
+    }
+}
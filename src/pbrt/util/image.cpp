@@ -4,6 +4,8 @@
 
 #include <pbrt/util/image.h>
 
+#include <pbrt/options.h>
+
 #include <pbrt/util/bluenoise.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
@@ -14,12 +16,14 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 
 #include <lodepng/lodepng.h>
 #ifndef PBRT_IS_GPU_CODE
 // Work around conflict with "half".
 #include <ImfChannelList.h>
 #include <ImfChromaticitiesAttribute.h>
+#include <ImfCompression.h>
 #include <ImfFloatAttribute.h>
 #include <ImfFrameBuffer.h>
 #include <ImfInputFile.h>
@@ -27,10 +31,16 @@
 #include <ImfMatrixAttribute.h>
 #include <ImfOutputFile.h>
 #include <ImfStringVectorAttribute.h>
+#include <ImfThreading.h>
 #endif
 
+#include <algorithm>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <numeric>
+#include <thread>
 
 // use lodepng and get 16-bit.
 #define STBI_NO_PNG
@@ -121,6 +131,29 @@ void ForExtent(const Bounds2i &extent, WrapMode2D wrapMode, const Image &image,
     }
 }
 
+// Returns the per-channel averages of the values that _op_ adds to its second
+// argument for each pixel of an image with the given resolution. Rows are
+// processed in parallel but their sums are added in order, so the result
+// doesn't depend on how the work was divided among threads.
+template <typename F>
+ImageChannelValues ParallelChannelAverages(Point2i resolution, int nc, F op) {
+    std::vector<double> rowSums(size_t(resolution.y) * nc, 0.);
+    ParallelFor(0, resolution.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = 0; x < resolution.x; ++x)
+                op(Point2i(x, y), &rowSums[size_t(y) * nc]);
+    });
+
+    std::vector<double> sum(nc, 0.);
+    for (int y = 0; y < resolution.y; ++y)
+        for (int c = 0; c < nc; ++c)
+            sum[c] += rowSums[size_t(y) * nc + c];
+    ImageChannelValues average(nc);
+    for (int c = 0; c < nc; ++c)
+        average[c] = sum[c] / (double(resolution.x) * resolution.y);
+    return average;
+}
+
 // Image Method Definitions
 pstd::vector<Image> Image::GeneratePyramid(Image image, WrapMode2D wrapMode,
                                            Allocator alloc) {
@@ -132,22 +165,25 @@ pstd::vector<Image> Image::GeneratePyramid(Image image, WrapMode2D wrapMode,
         image = image.FloatResizeUp(
             {RoundUpPow2(image.resolution[0]), RoundUpPow2(image.resolution[1])},
             wrapMode);
-    else if (!Is32Bit(image.format))
-        image = image.ConvertToFormat(PixelFormat::Float);
-    CHECK(Is32Bit(image.format));
 
     // Initialize levels of pyramid from _image_
     int nLevels = 1 + Log2Int(std::max(image.resolution[0], image.resolution[1]));
     pstd::vector<Image> pyramid(alloc);
     pyramid.reserve(nLevels);
     for (int i = 0; i < nLevels - 1; ++i) {
-        // Initialize $i+1$st level from $i$th level and copy $i$th into pyramid
-        pyramid.push_back(
-            Image(origFormat, image.resolution, image.channelNames, origEncoding, alloc));
+        // Initialize $i+1$st level from $i$th level and add $i$th to pyramid
+        // Levels that are already in the original format are moved into the
+        // pyramid; others are converted to it as they are downsampled.
+        bool convertLevel = image.format != origFormat;
+        if (convertLevel)
+            pyramid.push_back(Image(origFormat, image.resolution, image.channelNames,
+                                    origEncoding, alloc));
         // Initialize _nextImage_ for $i+1$st level
         Point2i nextResolution(std::max(1, image.resolution[0] / 2),
                                std::max(1, image.resolution[1] / 2));
-        Image nextImage(image.format, nextResolution, image.channelNames, origEncoding);
+        Image nextImage(PixelFormat::Float, nextResolution, image.channelNames,
+                        origEncoding,
+                        origFormat == PixelFormat::Float ? alloc : Allocator());
 
         // Compute offsets from pixel to the 4 neighbors used for down filtering
         int srcDeltas[4] = {0, nChannels, nChannels * image.resolution[0],
@@ -163,33 +199,50 @@ pstd::vector<Image> Image::GeneratePyramid(Image image, WrapMode2D wrapMode,
 
         // Downsample _image_ to create next level and update _pyramid_
         ParallelFor(0, nextResolution[1], [&](int64_t y) {
+            // Find the 2 scanlines of _image_ as floats, converting them if needed
+            int yStart = 2 * y;
+            int yEnd = std::min(2 * int(y) + 2, image.resolution[1]);
+            Bounds2i rows({0, yStart}, {image.resolution[0], yEnd});
+            size_t count = (yEnd - yStart) * nChannels * image.resolution[0];
+            const float *src;
+            std::vector<float> convertedRows;
+            if (Is32Bit(image.format))
+                src = image.p32.data() + image.PixelOffset({0, yStart});
+            else {
+                convertedRows.resize(count);
+                image.CopyRectOut(rows, pstd::span<float>(convertedRows));
+                src = convertedRows.data();
+            }
+
             // Loop over pixels in scanline $y$ and downfilter for the next pyramid level
-            int srcOffset = image.PixelOffset({0, 2 * int(y)});
+            int srcOffset = 0;
             int nextOffset = nextImage.PixelOffset({0, int(y)});
             for (int x = 0; x < nextResolution[0]; ++x, srcOffset += nChannels)
                 for (int c = 0; c < nChannels; ++c, ++srcOffset, ++nextOffset)
                     nextImage.p32[nextOffset] =
-                        (image.p32[srcOffset] + image.p32[srcOffset + srcDeltas[1]] +
-                         image.p32[srcOffset + srcDeltas[2]] +
-                         image.p32[srcOffset + srcDeltas[3]]) /
+                        (src[srcOffset] + src[srcOffset + srcDeltas[1]] +
+                         src[srcOffset + srcDeltas[2]] + src[srcOffset + srcDeltas[3]]) /
                         4;
 
-            // Copy 2 scalines from _image_ out to its pyramid level
-            int yStart = 2 * y;
-            int yEnd = std::min(2 * int(y) + 2, image.resolution[1]);
-            int offset = image.PixelOffset({0, yStart});
-            size_t count = (yEnd - yStart) * nChannels * image.resolution[0];
-            pyramid[i].CopyRectIn(Bounds2i({0, yStart}, {image.resolution[0], yEnd}),
-                                  {image.p32.data() + offset, count});
+            // Copy the 2 scanlines out to their pyramid level if necessary
+            if (convertLevel)
+                pyramid[i].CopyRectIn(rows, {src, count});
         });
+        if (!convertLevel)
+            pyramid.push_back(std::move(image));
         image = std::move(nextImage);
     }
 
     // Initialize top level of pyramid and return it
     CHECK(image.resolution[0] == 1 && image.resolution[1] == 1);
-    pyramid.push_back(Image(origFormat, {1, 1}, image.channelNames, origEncoding, alloc));
-    pyramid[nLevels - 1].CopyRectIn({{0, 0}, {1, 1}},
-                                    {image.p32.data(), size_t(nChannels)});
+    if (image.format == origFormat)
+        pyramid.push_back(std::move(image));
+    else {
+        pyramid.push_back(
+            Image(origFormat, {1, 1}, image.channelNames, origEncoding, alloc));
+        pyramid[nLevels - 1].CopyRectIn({{0, 0}, {1, 1}},
+                                        {image.p32.data(), size_t(nChannels)});
+    }
     return pyramid;
 }
 
@@ -458,10 +511,12 @@ Image Image::ConvertToFormat(PixelFormat newFormat, ColorEncoding encoding) cons
         return *this;
 
     Image newImage(newFormat, resolution, channelNames, encoding);
-    for (int y = 0; y < resolution.y; ++y)
-        for (int x = 0; x < resolution.x; ++x)
-            for (int c = 0; c < NChannels(); ++c)
-                newImage.SetChannel({x, y}, c, GetChannel({x, y}, c));
+    ParallelFor(0, resolution.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = 0; x < resolution.x; ++x)
+                for (int c = 0; c < NChannels(); ++c)
+                    newImage.SetChannel({x, y}, c, GetChannel({x, y}, c));
+    });
     return newImage;
 }
 
@@ -507,8 +562,6 @@ std::vector<std::string> Image::ChannelNames(const ImageChannelDesc &desc) const
 
 ImageChannelValues Image::MAE(const ImageChannelDesc &desc, const Image &ref,
                               Image *errorImage) const {
-    std::vector<double> sumError(desc.size(), 0.);
-
     ImageChannelDesc refDesc = ref.GetChannelDesc(ChannelNames(desc));
     CHECK((bool)refDesc);
     CHECK_EQ(Resolution(), ref.Resolution());
@@ -516,10 +569,10 @@ ImageChannelValues Image::MAE(const ImageChannelDesc &desc, const Image &ref,
     if (errorImage)
         *errorImage = Image(PixelFormat::Float, Resolution(), ChannelNames());
 
-    for (int y = 0; y < Resolution().y; ++y)
-        for (int x = 0; x < Resolution().x; ++x) {
-            ImageChannelValues v = GetChannels({x, y}, desc);
-            ImageChannelValues vref = ref.GetChannels({x, y}, refDesc);
+    return ParallelChannelAverages(
+        Resolution(), desc.size(), [&](Point2i p, double *sumError) {
+            ImageChannelValues v = GetChannels(p, desc);
+            ImageChannelValues vref = ref.GetChannels(p, refDesc);
 
             for (int c = 0; c < desc.size(); ++c) {
                 Float error = v[c] - vref[c];
@@ -527,20 +580,13 @@ ImageChannelValues Image::MAE(const ImageChannelDesc &desc, const Image &ref,
                     continue;
                 sumError[c] += error;
                 if (errorImage)
-                    errorImage->SetChannel({x, y}, c, error);
+                    errorImage->SetChannel(p, c, error);
             }
-        }
-
-    ImageChannelValues error(desc.size());
-    for (int c = 0; c < desc.size(); ++c)
-        error[c] = sumError[c] / (Resolution().x * Resolution().y);
-    return error;
+        });
 }
 
 ImageChannelValues Image::MSE(const ImageChannelDesc &desc, const Image &ref,
                               Image *mseImage) const {
-    std::vector<double> sumSE(desc.size(), 0.);
-
     ImageChannelDesc refDesc = ref.GetChannelDesc(ChannelNames(desc));
     if (!refDesc)
         ErrorExit("Channels not found in image: %s", ChannelNames(desc));
@@ -550,10 +596,10 @@ ImageChannelValues Image::MSE(const ImageChannelDesc &desc, const Image &ref,
     if (mseImage)
         *mseImage = Image(PixelFormat::Float, Resolution(), ChannelNames());
 
-    for (int y = 0; y < Resolution().y; ++y)
-        for (int x = 0; x < Resolution().x; ++x) {
-            ImageChannelValues v = GetChannels({x, y}, desc);
-            ImageChannelValues vref = ref.GetChannels({x, y}, refDesc);
+    return ParallelChannelAverages(
+        Resolution(), desc.size(), [&](Point2i p, double *sumSE) {
+            ImageChannelValues v = GetChannels(p, desc);
+            ImageChannelValues vref = ref.GetChannels(p, refDesc);
 
             for (int c = 0; c < desc.size(); ++c) {
                 Float se = Sqr(v[c] - vref[c]);
@@ -561,20 +607,13 @@ ImageChannelValues Image::MSE(const ImageChannelDesc &desc, const Image &ref,
                     continue;
                 sumSE[c] += se;
                 if (mseImage)
-                    mseImage->SetChannel({x, y}, c, se);
+                    mseImage->SetChannel(p, c, se);
             }
-        }
-
-    ImageChannelValues mse(desc.size());
-    for (int c = 0; c < desc.size(); ++c)
-        mse[c] = sumSE[c] / (Resolution().x * Resolution().y);
-    return mse;
+        });
 }
 
 ImageChannelValues Image::MRSE(const ImageChannelDesc &desc, const Image &ref,
                                Image *mrseImage) const {
-    std::vector<double> sumRSE(desc.size(), 0.);
-
     ImageChannelDesc refDesc = ref.GetChannelDesc(ChannelNames(desc));
     CHECK((bool)refDesc);
     CHECK_EQ(Resolution(), ref.Resolution());
@@ -582,10 +621,10 @@ ImageChannelValues Image::MRSE(const ImageChannelDesc &desc, const Image &ref,
     if (mrseImage)
         *mrseImage = Image(PixelFormat::Float, Resolution(), ChannelNames());
 
-    for (int y = 0; y < Resolution().y; ++y)
-        for (int x = 0; x < Resolution().x; ++x) {
-            ImageChannelValues v = GetChannels({x, y}, desc);
-            ImageChannelValues vref = ref.GetChannels({x, y}, refDesc);
+    return ParallelChannelAverages(
+        Resolution(), desc.size(), [&](Point2i p, double *sumRSE) {
+            ImageChannelValues v = GetChannels(p, desc);
+            ImageChannelValues vref = ref.GetChannels(p, refDesc);
 
             for (int c = 0; c < desc.size(); ++c) {
                 Float rse = Sqr(v[c] - vref[c]) / Sqr(vref[c] + 0.01);
@@ -593,30 +632,18 @@ ImageChannelValues Image::MRSE(const ImageChannelDesc &desc, const Image &ref,
                     continue;
                 sumRSE[c] += rse;
                 if (mrseImage)
-                    mrseImage->SetChannel({x, y}, c, rse);
+                    mrseImage->SetChannel(p, c, rse);
             }
-        }
-
-    ImageChannelValues mrse(desc.size());
-    for (int c = 0; c < desc.size(); ++c)
-        mrse[c] = sumRSE[c] / (Resolution().x * Resolution().y);
-    return mrse;
+        });
 }
 
 ImageChannelValues Image::Average(const ImageChannelDesc &desc) const {
-    std::vector<double> sum(desc.size(), 0.);
-
-    for (int y = 0; y < Resolution().y; ++y)
-        for (int x = 0; x < Resolution().x; ++x) {
-            ImageChannelValues v = GetChannels({x, y}, desc);
+    return ParallelChannelAverages(
+        Resolution(), desc.size(), [&](Point2i p, double *sum) {
+            ImageChannelValues v = GetChannels(p, desc);
             for (int c = 0; c < desc.size(); ++c)
                 sum[c] += v[c];
-        }
-
-    ImageChannelValues average(desc.size());
-    for (int c = 0; c < desc.size(); ++c)
-        average[c] = sum[c] / (Resolution().x * Resolution().y);
-    return average;
+        });
 }
 
 void Image::CopyRectOut(const Bounds2i &extent, pstd::span<float> buf,
@@ -830,6 +857,157 @@ Image Image::JointBilateralFilter(const ImageChannelDesc &toFilterDesc, int half
     return result;
 }
 
+// Image Denoising Function Definitions
+Image DenoiseImage(const Image &in, const ImageChannelDesc &Ldesc,
+                   const Image &varianceImage, const ImageChannelDesc &albedoDesc,
+                   const ImageChannelDesc &zDesc, const ImageChannelDesc &deltaZDesc,
+                   const ImageChannelDesc &nDesc, int halfWidth, int nLevels) {
+    Image illum(PixelFormat::Float, in.Resolution(), {"R", "G", "B"});
+    for (int y = 0; y < in.Resolution().y; ++y)
+        for (int x = 0; x < in.Resolution().x; ++x) {
+            ImageChannelValues albedo = in.GetChannels({x, y}, albedoDesc);
+            ImageChannelValues L = in.GetChannels({x, y}, Ldesc);
+            for (int c = 0; c < 3; ++c)
+                if (albedo[c] > 0)
+                    illum.SetChannel({x, y}, c, L[c] / albedo[c]);
+                else
+                    illum.SetChannel({x, y}, c, L[c]);
+        }
+
+    std::vector<Float> f(halfWidth + 1, 0.);
+    for (int i = 0; i <= halfWidth; ++i)
+        f[i] = FastExp(-Float(i) / halfWidth * 3.f);
+
+    Image currentImage = std::move(illum);
+    for (int i = 0; i < nLevels; ++i) {
+        int delta = 1 << i;  // A-Trous step between samples.
+
+        Image filtered(PixelFormat::Float, in.Resolution(), {"R", "G", "B"});
+        // Image wImage(PixelFormat::Float, in.Resolution(), 3, "Wp,Wn,Wc");
+        // Image dzImage(PixelFormat::Float, in.Resolution(), 1, "Y");
+
+        ParallelFor(0, currentImage.Resolution().y, [&](int64_t start, int64_t end) {
+            for (int y = start; y < end; ++y) {
+                for (int x = 0; x < currentImage.Resolution().x; ++x) {
+                    float wsum = 0;
+                    ImageChannelValues c = currentImage.GetChannels({x, y});
+
+                    Float z = in.GetChannels({x, y}, zDesc);
+                    // FIXME: hack multiply to cancel out scaled ray
+                    // differentials...
+                    Float dzdx = 8 * in.GetChannels({x, y}, deltaZDesc)[0];
+                    Float dzdy = 8 * in.GetChannels({x, y}, deltaZDesc)[1];
+
+                    ImageChannelValues nChan = in.GetChannels({x, y}, nDesc);
+                    Normal3f n = Normal3f(nChan[0], nChan[1], nChan[2]);
+                    if (n == Normal3f(0, 0, 0))
+                        // background pixel
+                        continue;
+
+                    Float pixelVariance = varianceImage.GetChannel({x, y}, 0);
+                    float result[3] = {0.f};
+                    float wpSum = 0, wnSum = 0, wcSum = 0;
+                    // if (pixelVariance > .001) {
+                    // pixelVariance = std::max<Float>(pixelVariance,
+                    // .000001); {
+                    {
+                        // Higher sigma -> more blur
+                        // Float sigma_y = .05;
+                        Float sigma_z = .005;
+
+                        // sigma_y = pixelVariance * 50;
+                        // sigma_y = std::sqrt(std::sqrt(pixelVariance)) *
+                        // 10 * sigmaYScale;
+
+                        for (int dy = -halfWidth * delta; dy <= halfWidth * delta;
+                             dy += delta) {
+                            if (y + dy < 0 || y + dy >= currentImage.Resolution().y)
+                                continue;
+                            for (int dx = -halfWidth * delta; dx <= halfWidth * delta;
+                                 dx += delta) {
+                                if (x + dx < 0 || x + dx >= currentImage.Resolution().x)
+                                    continue;
+                                ImageChannelValues co =
+                                    currentImage.GetChannels({x + dx, y + dy});
+                                Float dc2 = (Sqr(c[0] - co[0]) + Sqr(c[1] - co[1]) +
+                                             Sqr(c[2] - co[2]));  // squared color
+                                                                  // difference
+                                Float otherVariance =
+                                    varianceImage.GetChannel({x + dx, y + dy}, 0);
+                                Float d2 =
+                                    std::max<Float>(0, dc2 - (pixelVariance +
+                                                              std::min(pixelVariance,
+                                                                       otherVariance))) /
+                                    (1e-4 + 0.36f * (pixelVariance + otherVariance));
+
+                                Float zo = in.GetChannels({x + dx, y + dy}, zDesc);
+                                ImageChannelValues noChan =
+                                    in.GetChannels({x + dx, y + dy}, nDesc);
+                                Normal3f no = Normal3f(noChan[0], noChan[1], noChan[2]);
+                                if (no == Normal3f(0, 0, 0))
+                                    // background pixel;
+                                    continue;
+
+                                Float zp = z + dx * dzdx + dy * dzdy;
+                                Float dz = (z - zp) / ((z + zp) * 0.5f);
+
+                                // Assume camera space position...
+                                Float wp = Gaussian(dz, 0, sigma_z) *
+                                           f[std::abs(dy / delta)] *
+                                           f[std::abs(dx / delta)];
+                                Float wn = Pow<32>(std::max<float>(0, Dot(n, no)));
+                                Float wc =
+                                    FastExp(-d2 / 90);  // Gaussian(dc, 0, sigma_y);
+                                CHECK(!std::isnan(wc));
+                                wpSum += wp;
+                                wnSum += wn;
+                                wcSum += wc;
+                                Float w = wp * wn * wc;
+
+                                // CO fprintf(stderr, "(%d, %d) dc2 %f var
+                                // %f other var %f -> d2 %f\n", CO x, y,
+                                // dc2, pixelVariance, otherVariance, d2);
+
+                                CHECK(!std::isnan(w));
+                                if (w == 0)
+                                    continue;
+
+                                for (int c = 0; c < 3; ++c) {
+                                    result[c] +=
+                                        w * currentImage.GetChannel({x + dx, y + dy}, c);
+                                    CHECK(!std::isnan(result[c]));
+                                }
+                                wsum += w;
+                            }
+                        }
+                    }
+                    for (int c = 0; c < 3; ++c)
+                        if (wsum > 0) {
+                            filtered.SetChannel({x, y}, c, result[c] / wsum);
+                            // wImage.SetChannels({x, y}, {wpSum, wnSum,
+                            // wcSum});
+                        } else
+                            filtered.SetChannel({x, y}, c,
+                                                currentImage.GetChannel({x, y}, c));
+                }
+            }
+        });
+
+        pstd::swap(filtered, currentImage);
+    }
+
+    // reincorporate albedo
+    for (int y = 0; y < currentImage.Resolution().y; ++y)
+        for (int x = 0; x < currentImage.Resolution().x; ++x) {
+            ImageChannelValues albedo = in.GetChannels({x, y}, albedoDesc);
+            for (int c = 0; c < 3; ++c)
+                currentImage.SetChannel({x, y}, c,
+                                        currentImage.GetChannel({x, y}, c) * albedo[c]);
+        }
+
+    return currentImage;
+}
+
 // ImageIO Local Declarations
 static ImageAndMetadata ReadEXR(const std::string &name, Allocator alloc);
 static ImageAndMetadata ReadPNG(const std::string &name, Allocator alloc,
@@ -883,6 +1061,8 @@ ImageAndMetadata Image::Read(std::string name, Allocator alloc, ColorEncoding en
 }
 
 bool Image::Write(std::string name, const ImageMetadata &metadata) const {
+    TraceScope trace("Image::Write", "io");
+    trace.SetDetail(name);
     if (metadata.pixelBounds)
         CHECK_EQ(metadata.pixelBounds->Area(), resolution.x * resolution.y);
 
@@ -970,7 +1150,29 @@ static Imf::FrameBuffer imageToFrameBuffer(const Image &image,
     return fb;
 }
 
+// OpenEXR Compression Methods
+static const std::pair<const char *, Imf::Compression> exrCompressions[] = {
+    {"none", Imf::NO_COMPRESSION},   {"rle", Imf::RLE_COMPRESSION},
+    {"zips", Imf::ZIPS_COMPRESSION}, {"zip", Imf::ZIP_COMPRESSION},
+    {"piz", Imf::PIZ_COMPRESSION},   {"pxr24", Imf::PXR24_COMPRESSION},
+    {"b44", Imf::B44_COMPRESSION},   {"b44a", Imf::B44A_COMPRESSION},
+    {"dwaa", Imf::DWAA_COMPRESSION}, {"dwab", Imf::DWAB_COMPRESSION}};
+
+bool IsEXRCompression(const std::string &name) {
+    for (const auto &compression : exrCompressions)
+        if (name == compression.first)
+            return true;
+    return false;
+}
+
+// Lets OpenEXR compress and decompress blocks of scanlines in parallel
+static void initEXRThreads() {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() { Imf::setGlobalThreadCount(AvailableCores()); });
+}
+
 static ImageAndMetadata ReadEXR(const std::string &name, Allocator alloc) {
+    initEXRThreads();
     try {
         Imf::InputFile file(name.c_str());
         Imath::Box2i dw = file.header().dataWindow();
@@ -1085,77 +1287,87 @@ static ImageAndMetadata ReadEXR(const std::string &name, Allocator alloc) {
     return {};
 }
 
+// Returns the EXR header for an image with the given metadata and resolution,
+// without any channels
+static Imf::Header exrHeader(const ImageMetadata &metadata, Point2i resolution) {
+    Imath::Box2i displayWindow, dataWindow;
+    if (metadata.fullResolution)
+        // Agan, -1 offsets to handle inclusive indexing in OpenEXR...
+        displayWindow = {Imath::V2i(0, 0),
+                         Imath::V2i(metadata.fullResolution->x - 1,
+                                    metadata.fullResolution->y - 1)};
+    else
+        displayWindow = {Imath::V2i(0, 0),
+                         Imath::V2i(resolution.x - 1, resolution.y - 1)};
+
+    if (metadata.pixelBounds)
+        dataWindow = {
+            Imath::V2i(metadata.pixelBounds->pMin.x, metadata.pixelBounds->pMin.y),
+            Imath::V2i(metadata.pixelBounds->pMax.x - 1,
+                       metadata.pixelBounds->pMax.y - 1)};
+    else
+        dataWindow = {Imath::V2i(0, 0), Imath::V2i(resolution.x - 1, resolution.y - 1)};
+
+    Imf::Header header(displayWindow, dataWindow);
+    std::string compression = Options ? Options->exrCompression : "zip";
+    for (const auto &c : exrCompressions)
+        if (compression == c.first)
+            header.compression() = c.second;
+
+    if (metadata.renderTimeSeconds)
+        header.insert("renderTimeSeconds",
+                      Imf::FloatAttribute(*metadata.renderTimeSeconds));
+    if (metadata.cameraFromWorld) {
+        float m[4][4];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = (*metadata.cameraFromWorld)[i][j];
+        header.insert("worldToCamera", Imf::M44fAttribute(m));
+    }
+    if (metadata.NDCFromWorld) {
+        float m[4][4];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = (*metadata.NDCFromWorld)[i][j];
+        header.insert("worldToNDC", Imf::M44fAttribute(m));
+    }
+    if (metadata.samplesPerPixel)
+        header.insert("samplesPerPixel", Imf::IntAttribute(*metadata.samplesPerPixel));
+    if (metadata.MSE)
+        header.insert("MSE", Imf::FloatAttribute(*metadata.MSE));
+    for (const auto &iter : metadata.stringVectors)
+        header.insert(iter.first, Imf::StringVectorAttribute(iter.second));
+
+    // The OpenEXR spec says that the default is sRGB if no
+    // chromaticities are provided.  It should be innocuous to write
+    // the sRGB primaries anyway, but for completely indecipherable
+    // reasons, OSX's Preview.app decides to gamma correct the pixels
+    // in EXR files if it finds primaries.  So, we don't write them in
+    // that case in the interests of nicer looking images on the
+    // screen.
+    if (*metadata.GetColorSpace() != *RGBColorSpace::sRGB) {
+        const RGBColorSpace &cs = *metadata.GetColorSpace();
+        Imf::Chromaticities chromaticities(
+            Imath::V2f(cs.r.x, cs.r.y), Imath::V2f(cs.g.x, cs.g.y),
+            Imath::V2f(cs.b.x, cs.b.y), Imath::V2f(cs.w.x, cs.w.y));
+        header.insert("chromaticities", Imf::ChromaticitiesAttribute(chromaticities));
+    }
+    return header;
+}
+
 bool Image::WriteEXR(const std::string &name, const ImageMetadata &metadata) const {
     if (Is8Bit(format))
         return ConvertToFormat(PixelFormat::Half).WriteEXR(name, metadata);
     CHECK(Is16Bit(format) || Is32Bit(format));
 
+    initEXRThreads();
     try {
-        Imath::Box2i displayWindow, dataWindow;
-        if (metadata.fullResolution)
-            // Agan, -1 offsets to handle inclusive indexing in OpenEXR...
-            displayWindow = {Imath::V2i(0, 0),
-                             Imath::V2i(metadata.fullResolution->x - 1,
-                                        metadata.fullResolution->y - 1)};
-        else
-            displayWindow = {Imath::V2i(0, 0),
-                             Imath::V2i(resolution.x - 1, resolution.y - 1)};
-
-        if (metadata.pixelBounds)
-            dataWindow = {
-                Imath::V2i(metadata.pixelBounds->pMin.x, metadata.pixelBounds->pMin.y),
-                Imath::V2i(metadata.pixelBounds->pMax.x - 1,
-                           metadata.pixelBounds->pMax.y - 1)};
-        else
-            dataWindow = {Imath::V2i(0, 0),
-                          Imath::V2i(resolution.x - 1, resolution.y - 1)};
-
-        Imf::FrameBuffer fb = imageToFrameBuffer(*this, AllChannelsDesc(), dataWindow);
-
-        Imf::Header header(displayWindow, dataWindow);
+        Imf::Header header = exrHeader(metadata, resolution);
+        Imf::FrameBuffer fb =
+            imageToFrameBuffer(*this, AllChannelsDesc(), header.dataWindow());
         for (auto iter = fb.begin(); iter != fb.end(); ++iter)
             header.channels().insert(iter.name(), iter.slice().type);
 
-        if (metadata.renderTimeSeconds)
-            header.insert("renderTimeSeconds",
-                          Imf::FloatAttribute(*metadata.renderTimeSeconds));
-        if (metadata.cameraFromWorld) {
-            float m[4][4];
-            for (int i = 0; i < 4; ++i)
-                for (int j = 0; j < 4; ++j)
-                    m[i][j] = (*metadata.cameraFromWorld)[i][j];
-            header.insert("worldToCamera", Imf::M44fAttribute(m));
-        }
-        if (metadata.NDCFromWorld) {
-            float m[4][4];
-            for (int i = 0; i < 4; ++i)
-                for (int j = 0; j < 4; ++j)
-                    m[i][j] = (*metadata.NDCFromWorld)[i][j];
-            header.insert("worldToNDC", Imf::M44fAttribute(m));
-        }
-        if (metadata.samplesPerPixel)
-            header.insert("samplesPerPixel",
-                          Imf::IntAttribute(*metadata.samplesPerPixel));
-        if (metadata.MSE)
-            header.insert("MSE", Imf::FloatAttribute(*metadata.MSE));
-        for (const auto &iter : metadata.stringVectors)
-            header.insert(iter.first, Imf::StringVectorAttribute(iter.second));
-
-        // The OpenEXR spec says that the default is sRGB if no
-        // chromaticities are provided.  It should be innocuous to write
-        // the sRGB primaries anyway, but for completely indecipherable
-        // reasons, OSX's Preview.app decides to gamma correct the pixels
-        // in EXR files if it finds primaries.  So, we don't write them in
-        // that case in the interests of nicer looking images on the
-        // screen.
-        if (*metadata.GetColorSpace() != *RGBColorSpace::sRGB) {
-            const RGBColorSpace &cs = *metadata.GetColorSpace();
-            Imf::Chromaticities chromaticities(
-                Imath::V2f(cs.r.x, cs.r.y), Imath::V2f(cs.g.x, cs.g.y),
-                Imath::V2f(cs.b.x, cs.b.y), Imath::V2f(cs.w.x, cs.w.y));
-            header.insert("chromaticities", Imf::ChromaticitiesAttribute(chromaticities));
-        }
-
         Imf::OutputFile file(name.c_str(), header);
         file.setFrameBuffer(fb);
         file.writePixels(resolution.y);
@@ -1167,6 +1379,110 @@ bool Image::WriteEXR(const std::string &name, const ImageMetadata &metadata) con
     return true;
 }
 
+// EXRScanlineWriter Method Definitions
+struct EXRScanlineWriter::EXRFile : public Imf::OutputFile {
+    using Imf::OutputFile::OutputFile;
+};
+
+EXRScanlineWriter::EXRScanlineWriter(const std::string &filename,
+                                     std::vector<std::string> channelNames,
+                                     PixelFormat format, const ImageMetadata &metadata)
+    : filename(filename), channelNames(std::move(channelNames)), format(format) {
+    CHECK(metadata.pixelBounds.has_value());
+    CHECK(format == PixelFormat::Half || format == PixelFormat::Float);
+    dataWindow = *metadata.pixelBounds;
+    nextScanline = dataWindow.pMin.y;
+
+    initEXRThreads();
+    try {
+        Imf::Header header = exrHeader(metadata, Point2i(dataWindow.Diagonal()));
+        Imf::PixelType type = (format == PixelFormat::Half) ? Imf::HALF : Imf::FLOAT;
+        for (const std::string &name : this->channelNames)
+            header.channels().insert(name, Imf::Channel(type));
+        file = std::make_unique<EXRFile>(filename.c_str(), header);
+    } catch (const std::exception &exc) {
+        ErrorExit("%s: error creating EXR: %s", filename, exc.what());
+    }
+}
+
+EXRScanlineWriter::~EXRScanlineWriter() = default;
+
+bool EXRScanlineWriter::WriteScanlines(const Image &image) {
+    int nScanlines = image.Resolution().y;
+    CHECK_EQ(image.Resolution().x, dataWindow.pMax.x - dataWindow.pMin.x);
+    CHECK_LE(nextScanline + nScanlines, dataWindow.pMax.y);
+    CHECK(image.Format() == format && image.ChannelNames() == channelNames);
+
+    try {
+        // Map the image's first scanline to the file's next one
+        int lastScanline = nextScanline + nScanlines - 1;
+        Imath::Box2i window(Imath::V2i(dataWindow.pMin.x, nextScanline),
+                            Imath::V2i(dataWindow.pMax.x - 1, lastScanline));
+        file->setFrameBuffer(imageToFrameBuffer(image, image.AllChannelsDesc(), window));
+        file->writePixels(nScanlines);
+    } catch (const std::exception &exc) {
+        Error("%s: error writing EXR: %s", filename, exc.what());
+        return false;
+    }
+    nextScanline += nScanlines;
+    return true;
+}
+
+// Asynchronous Image Writing Definitions
+struct PendingImageWrite {
+    std::string filename;
+    Image image;
+    ImageMetadata metadata;
+};
+
+static std::mutex imageWriteMutex;
+static std::condition_variable imageWriterDone;
+static std::deque<PendingImageWrite> pendingImageWrites;
+static bool imageWriterRunning = false;
+static std::thread imageWriterThread;
+
+static void writePendingImages() {
+    std::unique_lock<std::mutex> lock(imageWriteMutex);
+    while (!pendingImageWrites.empty()) {
+        PendingImageWrite write = std::move(pendingImageWrites.front());
+        pendingImageWrites.pop_front();
+        lock.unlock();
+        write.image.Write(write.filename, write.metadata);
+        lock.lock();
+    }
+    imageWriterRunning = false;
+    imageWriterDone.notify_all();
+}
+
+void WriteImageAsync(Image image, std::string filename, ImageMetadata metadata) {
+    std::lock_guard<std::mutex> lock(imageWriteMutex);
+    auto iter = std::find_if(
+        pendingImageWrites.begin(), pendingImageWrites.end(),
+        [&](const PendingImageWrite &write) { return write.filename == filename; });
+    if (iter != pendingImageWrites.end()) {
+        // Replace the older image, which would be overwritten anyway
+        iter->image = std::move(image);
+        iter->metadata = std::move(metadata);
+    } else
+        pendingImageWrites.push_back(
+            {std::move(filename), std::move(image), std::move(metadata)});
+
+    // Start a writer thread if the last one has finished
+    if (!imageWriterRunning) {
+        if (imageWriterThread.joinable())
+            imageWriterThread.join();
+        imageWriterRunning = true;
+        imageWriterThread = std::thread(writePendingImages);
+    }
+}
+
+void FlushImageWrites() {
+    std::unique_lock<std::mutex> lock(imageWriteMutex);
+    imageWriterDone.wait(lock, []() { return !imageWriterRunning; });
+    if (imageWriterThread.joinable())
+        imageWriterThread.join();
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // PNG Function Definitions
 
@@ -1286,9 +1602,11 @@ Image Image::SelectChannels(const ImageChannelDesc &desc, Allocator alloc) const
         descChannelNames.push_back(channelNames[desc.offset[i]]);
 
     Image image(format, resolution, descChannelNames, encoding, alloc);
-    for (int y = 0; y < resolution.y; ++y)
-        for (int x = 0; x < resolution.x; ++x)
-            image.SetChannels({x, y}, GetChannels({x, y}, desc));
+    ParallelFor(0, resolution.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = 0; x < resolution.x; ++x)
+                image.SetChannels({x, y}, GetChannels({x, y}, desc));
+    });
     return image;
 }
 
@@ -1297,9 +1615,13 @@ Image Image::Crop(const Bounds2i &bounds, Allocator alloc) const {
     CHECK(bounds.pMin.x >= 0 && bounds.pMin.y >= 0);
     Image image(format, Point2i(bounds.pMax - bounds.pMin), channelNames, encoding,
                 alloc);
-    for (Point2i p : bounds)
-        for (int c = 0; c < NChannels(); ++c)
-            image.SetChannel(Point2i(p - bounds.pMin), c, GetChannel(p, c));
+    ParallelFor(bounds.pMin.y, bounds.pMax.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y)
+            for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x)
+                for (int c = 0; c < NChannels(); ++c)
+                    image.SetChannel({x - bounds.pMin.x, y - bounds.pMin.y}, c,
+                                     GetChannel({x, y}, c));
+    });
     return image;
 }
 
@@ -1546,6 +1868,73 @@ static ImageAndMetadata ReadHDR(const std::string &filename, Allocator alloc) {
     }
 }
 
+bool Image::ReadInfo(const std::string &filename, Point2i *resolution,
+                     int *nChannels, PixelFormat *format) {
+    if (HasExtension(filename, "exr")) {
+        initEXRThreads();
+        try {
+            Imf::InputFile file(filename.c_str());
+            Imath::Box2i dw = file.header().dataWindow();
+            *resolution = Point2i(dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+            *nChannels = 0;
+            *format = PixelFormat::Half;
+            const Imf::ChannelList &channels = file.header().channels();
+            for (auto iter = channels.begin(); iter != channels.end(); ++iter) {
+                ++*nChannels;
+                if (iter.channel().type != Imf::HALF)
+                    *format = PixelFormat::Float;
+            }
+            return true;
+        } catch (const std::exception &) {
+            return false;
+        }
+    }
+
+    FILE *fp = FOpenRead(filename);
+    if (!fp)
+        return false;
+    char header[64];
+    size_t headerBytes = fread(header, 1, sizeof(header), fp);
+    fclose(fp);
+
+    if (HasExtension(filename, "png")) {
+        // The resolution and color type are in the IHDR chunk at the start
+        unsigned width, height;
+        LodePNGState state;
+        lodepng_state_init(&state);
+        if (lodepng_inspect(&width, &height, &state, (const unsigned char *)header,
+                            headerBytes) != 0)
+            return false;
+        *resolution = Point2i(width, height);
+        LodePNGColorType colorType = state.info_png.color.colortype;
+        *nChannels = (colorType == LCT_GREY || colorType == LCT_GREY_ALPHA) ? 1
+                     : (colorType == LCT_RGBA)                              ? 4
+                                                                            : 3;
+        *format = state.info_png.color.bitdepth == 16 ? PixelFormat::Half
+                                                      : PixelFormat::U256;
+        return true;
+    } else if (HasExtension(filename, "pfm")) {
+        // The header is the type, width, and height separated by whitespace
+        std::vector<std::string> words =
+            SplitStringsFromWhitespace(std::string(header, headerBytes));
+        if (words.size() < 3 || (words[0] != "Pf" && words[0] != "PF") ||
+            !Atoi(words[1], &resolution->x) || !Atoi(words[2], &resolution->y))
+            return false;
+        *nChannels = (words[0] == "Pf") ? 1 : 3;
+        *format = PixelFormat::Float;
+        return true;
+    } else {
+        // Two- and four-channel images' alpha channels are discarded
+        int x, y, n;
+        if (!stbi_info(filename.c_str(), &x, &y, &n))
+            return false;
+        *resolution = Point2i(x, y);
+        *nChannels = (n <= 2) ? 1 : 3;
+        *format = HasExtension(filename, "hdr") ? PixelFormat::Float : PixelFormat::U256;
+        return true;
+    }
+}
+
 bool Image::WritePFM(const std::string &filename, const ImageMetadata &metadata) const {
     FILE *fp = FOpenWrite(filename);
     if (fp == nullptr) {
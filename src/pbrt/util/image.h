@@ -19,6 +19,8 @@
 #include <cstdint>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace pbrt {
@@ -289,6 +291,47 @@ class Image {
                 dx * dy * v[3]);
     }
 
+    // Bilinearly interpolates the first _values.size()_ channels at _p_, finding the
+    // pixels' coordinates and offsets once for all of them.
+    PBRT_CPU_GPU
+    void BilerpChannels(Point2f p, pstd::span<Float> values,
+                        WrapMode2D wrapMode = WrapMode::Clamp) const {
+        DCHECK_LE(values.size(), NChannels());
+        // Compute discrete pixel coordinates and bilinear weights for _p_
+        Float x = p[0] * resolution.x - 0.5f, y = p[1] * resolution.y - 0.5f;
+        int xi = pstd::floor(x), yi = pstd::floor(y);
+        Float dx = x - xi, dy = y - yi;
+        Float w[4] = {(1 - dx) * (1 - dy), dx * (1 - dy), (1 - dx) * dy, dx * dy};
+
+        for (Float &v : values)
+            v = 0;
+        for (int i = 0; i < 4; ++i) {
+            // Accumulate weighted channel values of pixel _i_
+            Point2i pi(xi + (i & 1), yi + (i >> 1));
+            if (!RemapPixelCoords(&pi, resolution, wrapMode))
+                continue;
+            size_t offset = PixelOffset(pi);
+            for (size_t c = 0; c < values.size(); ++c) {
+                Float v;
+                switch (format) {
+                case PixelFormat::U256:
+                    encoding.ToLinear({&p8[offset + c], 1}, {&v, 1});
+                    break;
+                case PixelFormat::Half:
+                    v = Float(p16[offset + c]);
+                    break;
+                case PixelFormat::Float:
+                    v = p32[offset + c];
+                    break;
+                default:
+                    LOG_FATAL("Unhandled PixelFormat");
+                    v = 0;
+                }
+                values[c] += w[i] * v;
+            }
+        }
+    }
+
     PBRT_CPU_GPU
     void SetChannel(Point2i p, int c, Float value);
 
@@ -336,6 +379,11 @@ class Image {
 
     static ImageAndMetadata Read(std::string filename, Allocator alloc = {},
                                  ColorEncoding encoding = nullptr);
+    // Reads only as much of the file as is needed to find the resolution,
+    // number of channels, and pixel format of the image that Read() returns
+    // for it; returns false if the file can't be read.
+    static bool ReadInfo(const std::string &filename, Point2i *resolution,
+                         int *nChannels, PixelFormat *format);
 
     bool Write(std::string name, const ImageMetadata &metadata = {}) const;
 
@@ -466,6 +514,65 @@ struct ImageAndMetadata {
     ImageMetadata metadata;
 };
 
+// Image Writing Declarations
+// EXR images are written using the compression method given by
+// Options->exrCompression, which must be one for which IsEXRCompression()
+// returns true: "none", "rle", "zips", "zip", "piz", "pxr24", "b44", "b44a",
+// "dwaa", or "dwab".
+bool IsEXRCompression(const std::string &name);
+
+// WriteImageAsync() queues an image for a background thread to write, so that
+// the caller doesn't wait for it to be encoded and compressed. A queued image
+// that hasn't been written yet is replaced if another is queued for the same
+// file. FlushImageWrites() returns once all queued images have been written.
+void WriteImageAsync(Image image, std::string filename, ImageMetadata metadata);
+void FlushImageWrites();
+
+// Image Denoising Declarations
+// DenoiseImage() filters the RGB channels _Ldesc_ of _in_ with an edge-avoiding
+// a-trous wavelet filter that is guided by the surfaces' albedo, camera-space
+// depth and its screen-space derivatives, and shading normals, along with the
+// per-pixel variance in the first channel of _varianceImage_. It returns an
+// image with just the filtered "R", "G", and "B" channels.
+Image DenoiseImage(const Image &in, const ImageChannelDesc &Ldesc,
+                   const Image &varianceImage, const ImageChannelDesc &albedoDesc,
+                   const ImageChannelDesc &zDesc, const ImageChannelDesc &deltaZDesc,
+                   const ImageChannelDesc &nDesc, int halfWidth, int nLevels);
+
+// EXRScanlineWriter Definition
+// EXRScanlineWriter writes an EXR image a band of scanlines at a time, so that
+// the whole image never needs to be in memory. The file's header is written
+// when it is opened, using the metadata's _pixelBounds_ (which are required)
+// as the data window; bands must then be written in top-to-bottom order until
+// all of the scanlines in the data window have been written.
+class EXRScanlineWriter {
+  public:
+    // EXRScanlineWriter Public Methods
+    EXRScanlineWriter(const std::string &filename,
+                      std::vector<std::string> channelNames, PixelFormat format,
+                      const ImageMetadata &metadata);
+    ~EXRScanlineWriter();
+
+    EXRScanlineWriter(const EXRScanlineWriter &) = delete;
+    EXRScanlineWriter &operator=(const EXRScanlineWriter &) = delete;
+
+    // Writes all of the image's scanlines, which must have the data window's
+    // width and the channels and format given to the constructor.
+    bool WriteScanlines(const Image &image);
+
+    bool IsComplete() const { return nextScanline == dataWindow.pMax.y; }
+
+  private:
+    // EXRScanlineWriter Private Members
+    struct EXRFile;
+    std::unique_ptr<EXRFile> file;
+    std::string filename;
+    std::vector<std::string> channelNames;
+    PixelFormat format;
+    Bounds2i dataWindow;
+    int nextScanline;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_IMAGE_H
@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstring>
 
 using namespace pbrt;
 
@@ -457,6 +458,44 @@ TEST(Image, ExrMetadata) {
     EXPECT_EQ(0, remove(filename.c_str()));
 }
 
+TEST(Image, ExrScanlineWriter) {
+    Point2i res(16, 45);
+    pstd::vector<float> rgbPixels = GetFloatPixels(res, 3);
+    Image image(rgbPixels, res, {"R", "G", "B"});
+
+    // Write the image in bands of 8 scanlines, the last of which is shorter
+    std::string filename = "scanlines.exr";
+    ImageMetadata metadata;
+    metadata.pixelBounds = Bounds2i(Point2i(3, 5), Point2i(3, 5) + res);
+    metadata.fullResolution = Point2i(20, 60);
+    {
+        EXRScanlineWriter writer(filename, {"R", "G", "B"}, PixelFormat::Float,
+                                 metadata);
+        for (int y0 = 0; y0 < res.y; y0 += 8) {
+            EXPECT_FALSE(writer.IsComplete());
+            int height = std::min(8, res.y - y0);
+            Image band(PixelFormat::Float, {res.x, height}, {"R", "G", "B"});
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < res.x; ++x)
+                    for (int c = 0; c < 3; ++c)
+                        band.SetChannel({x, y}, c, image.GetChannel({x, y0 + y}, c));
+            EXPECT_TRUE(writer.WriteScanlines(band));
+        }
+        EXPECT_TRUE(writer.IsComplete());
+    }
+
+    ImageAndMetadata read = Image::Read(filename);
+    ASSERT_EQ(res, read.image.Resolution());
+    EXPECT_EQ(*metadata.pixelBounds, *read.metadata.pixelBounds);
+    EXPECT_EQ(*metadata.fullResolution, *read.metadata.fullResolution);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_EQ(image.GetChannel({x, y}, c), read.image.GetChannel({x, y}, c));
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
 TEST(Image, PngRgbIO) {
     Point2i res(11, 50);
     pstd::vector<float> rgbPixels = GetFloatPixels(res, 3);
@@ -615,6 +654,99 @@ TEST(Image, Select) {
         }
 }
 
+TEST(Image, PyramidNativeFormat) {
+    Point2i res(8, 4);
+    pstd::vector<uint8_t> pix(3 * res.x * res.y);
+    RNG rng;
+    for (uint8_t &p : pix)
+        p = rng.Uniform<uint32_t>() % 256;
+    Image image(pix, res, {"R", "G", "B"}, ColorEncoding::sRGB);
+
+    pstd::vector<Image> pyramid = Image::GeneratePyramid(image, WrapMode::Clamp);
+    ASSERT_EQ(4, pyramid.size());
+    for (const Image &level : pyramid) {
+        EXPECT_EQ(PixelFormat::U256, level.Format());
+        EXPECT_EQ(3, level.NChannels());
+    }
+
+    // The first level holds the original texels
+    EXPECT_EQ(res, pyramid[0].Resolution());
+    EXPECT_EQ(0, memcmp(pix.data(), pyramid[0].RawPointer({0, 0}), pix.size()));
+
+    // The next level averages them in linear space
+    EXPECT_EQ(Point2i(4, 2), pyramid[1].Resolution());
+    for (int y = 0; y < 2; ++y)
+        for (int x = 0; x < 4; ++x)
+            for (int c = 0; c < 3; ++c) {
+                Float avg = (image.GetChannel({2 * x, 2 * y}, c) +
+                             image.GetChannel({2 * x + 1, 2 * y}, c) +
+                             image.GetChannel({2 * x, 2 * y + 1}, c) +
+                             image.GetChannel({2 * x + 1, 2 * y + 1}, c)) /
+                            4;
+                EXPECT_NEAR(avg, pyramid[1].GetChannel({x, y}, c), 0.01f);
+            }
+}
+
+TEST(Image, BilerpChannels) {
+    Point2i res(7, 5);
+    pstd::vector<uint8_t> pix(3 * res.x * res.y);
+    RNG rng;
+    for (uint8_t &p : pix)
+        p = rng.Uniform<uint32_t>() % 256;
+    Image image(pix, res, {"R", "G", "B"}, ColorEncoding::sRGB);
+
+    for (WrapMode wrap : {WrapMode::Clamp, WrapMode::Repeat, WrapMode::Black})
+        for (int i = 0; i < 100; ++i) {
+            Point2f p(Lerp(rng.Uniform<Float>(), -0.5f, 1.5f),
+                      Lerp(rng.Uniform<Float>(), -0.5f, 1.5f));
+            Float values[3];
+            image.BilerpChannels(p, values, wrap);
+            for (int c = 0; c < 3; ++c)
+                EXPECT_EQ(image.BilerpChannel(p, c, wrap), values[c]) << p << " " << c;
+        }
+}
+
+TEST(MIPMap, FilterWithGradient) {
+    Point2i res(16, 16);
+    Image image(PixelFormat::Float, res, {"Y"});
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            image.SetChannel({x, y}, 0, std::sin(0.4f * x) * std::cos(0.7f * y));
+
+    RNG rng;
+    for (FilterFunction filter : {FilterFunction::Bilinear, FilterFunction::Trilinear}) {
+        MIPMapFilterOptions options;
+        options.filter = filter;
+        MIPMap mipmap(image, RGBColorSpace::sRGB, WrapMode::Repeat, Allocator(), options);
+        for (int i = 0; i < 100; ++i) {
+            // Keep _st_ away from the texel centers of all of the levels used, where
+            // the gradient is discontinuous
+            auto coord = [&]() {
+                Float offset = Lerp(rng.Uniform<Float>(), .2f, .8f);
+                return (int(32 * rng.Uniform<Float>()) + offset) / 32;
+            };
+            Point2f st(coord(), coord());
+            Vector2f dst0(rng.Uniform<Float>() * 0.1f, 0), dst1(0, 0);
+
+            // The value should match the one that _Filter()_ returns
+            Vector2f dst;
+            Float v = mipmap.FilterWithGradient(st, dst0, dst1, &dst);
+            EXPECT_FLOAT_EQ(mipmap.Filter<Float>(st, dst0, dst1), v);
+
+            // Compare the gradient to central differences within the same texels
+            const Float eps = 1e-4f;
+            Vector2f dsteps[2] = {Vector2f(eps, 0), Vector2f(0, eps)};
+            for (int c = 0; c < 2; ++c) {
+                Vector2f unused;
+                Float vp = mipmap.FilterWithGradient(st + dsteps[c], dst0, dst1, &unused);
+                Float vm = mipmap.FilterWithGradient(st - dsteps[c], dst0, dst1, &unused);
+                Float tolerance = 0.01f + 0.01f * std::abs(dst[c]);
+                EXPECT_NEAR((vp - vm) / (2 * eps), dst[c], tolerance) << st << " " << c;
+            }
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 
 static std::string inTestDir(const std::string &path) {
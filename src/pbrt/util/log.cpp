@@ -79,8 +79,10 @@ void InitLogging(LogLevel level, std::string logFile, bool useGPU) {
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     if (useGPU)
-        CUDA_CHECK(cudaMemcpyToSymbol(LOGGING_LogLevelGPU, &logging::logLevel,
-                                      sizeof(logging::logLevel)));
+        ForEachGPU([](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(LOGGING_LogLevelGPU, &logging::logLevel,
+                                          sizeof(logging::logLevel)));
+        });
 #endif
 }
 
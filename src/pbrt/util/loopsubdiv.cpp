@@ -4,120 +4,86 @@
 
 #include <pbrt/util/loopsubdiv.h>
 
+#include <pbrt/util/check.h>
 #include <pbrt/util/containers.h>
 #include <pbrt/util/error.h>
-#include <pbrt/util/memory.h>
+#include <pbrt/util/math.h>
 #include <pbrt/util/mesh.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 #include <pbrt/util/vecmath.h>
 
-#include <map>
-#include <set>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
 
 namespace pbrt {
 
-struct SDFace;
-struct SDVertex;
-
-// LoopSubdiv Macros
-#define NEXT(i) (((i) + 1) % 3)
-#define PREV(i) (((i) + 2) % 3)
+STAT_INT_DISTRIBUTION("Geometry/Loop subdivision levels", loopSubdivLevels);
 
 // LoopSubdiv Local Structures
-struct SDVertex {
-    // SDVertex Constructor
-    SDVertex(const Point3f &p = Point3f(0, 0, 0)) : p(p) {}
-
-    // SDVertex Methods
-    int valence();
-    void oneRing(Point3f *p);
-    Point3f p;
-    SDFace *startFace = nullptr;
-    SDVertex *child = nullptr;
-    bool regular = false, boundary = false;
+// Index-based half-edge representation of a triangle mesh. Half-edge $3f+k$ runs
+// from vertex $k$ of face $f$ to its vertex $k+1$; _twin_ gives the half-edge
+// that runs the other way along the same edge, or -1 on the boundary, and
+// _vertexHalfEdge_ gives one of the half-edges that leave each vertex.
+struct SDMesh {
+    // SDMesh Public Methods
+    int nFaces() const { return indices.size() / 3; }
+
+    static int Next(int h) { return h % 3 == 2 ? h - 2 : h + 1; }
+    static int Prev(int h) { return h % 3 == 0 ? h + 2 : h - 1; }
+
+    // Return the next and previous half-edges leaving the start of _h_, or -1
+    // past the boundary
+    int NextOutgoing(int h) const { return twin[h] < 0 ? -1 : Next(twin[h]); }
+    int PrevOutgoing(int h) const { return twin[Prev(h)]; }
+
+    bool OneRing(int v, InlinedVector<int, 16> *ring) const;
+
+    // SDMesh Public Members
+    std::vector<Point3f> p;
+    std::vector<int> indices, twin, vertexHalfEdge;
 };
 
-struct SDFace {
-    // SDFace Constructor
-    SDFace() {
-        for (int i = 0; i < 3; ++i) {
-            v[i] = nullptr;
-            f[i] = nullptr;
+// Puts the vertices adjacent to _v_ in _ring_, in order around it, and returns
+// whether _v_ is on the boundary. Boundary vertices' rings start and end with
+// their neighbors along the boundary.
+bool SDMesh::OneRing(int v, InlinedVector<int, 16> *ring) const {
+    ring->clear();
+    int start = vertexHalfEdge[v];
+    if (start < 0)
+        return false;
+    // Find the last half-edge around _v_ before the boundary, if there is one
+    int h = start;
+    while (true) {
+        int hNext = NextOutgoing(h);
+        if (hNext < 0)
+            break;
+        if (hNext == start) {
+            // Get one-ring vertices for interior vertex
+            do {
+                ring->push_back(indices[Next(h)]);
+                h = NextOutgoing(h);
+            } while (h != start);
+            return false;
         }
-        for (int i = 0; i < 4; ++i)
-            children[i] = nullptr;
-    }
-
-    // SDFace Methods
-    int vnum(SDVertex *vert) const {
-        for (int i = 0; i < 3; ++i)
-            if (v[i] == vert)
-                return i;
-        LOG_FATAL("Basic logic error in SDFace::vnum()");
-        return -1;
-    }
-    SDFace *nextFace(SDVertex *vert) { return f[vnum(vert)]; }
-    SDFace *prevFace(SDVertex *vert) { return f[PREV(vnum(vert))]; }
-    SDVertex *nextVert(SDVertex *vert) { return v[NEXT(vnum(vert))]; }
-    SDVertex *prevVert(SDVertex *vert) { return v[PREV(vnum(vert))]; }
-    SDVertex *otherVert(SDVertex *v0, SDVertex *v1) {
-        for (int i = 0; i < 3; ++i)
-            if (v[i] != v0 && v[i] != v1)
-                return v[i];
-        LOG_FATAL("Basic logic error in SDVertex::otherVert()");
-        return nullptr;
-    }
-    SDVertex *v[3];
-    SDFace *f[3];
-    SDFace *children[4];
-};
-
-struct SDEdge {
-    // SDEdge Constructor
-    SDEdge(SDVertex *v0 = nullptr, SDVertex *v1 = nullptr) {
-        v[0] = std::min(v0, v1);
-        v[1] = std::max(v0, v1);
-        f[0] = f[1] = nullptr;
-        f0edgeNum = -1;
-    }
-
-    // SDEdge Comparison Function
-    bool operator<(const SDEdge &e2) const {
-        if (v[0] == e2.v[0])
-            return v[1] < e2.v[1];
-        return v[0] < e2.v[0];
+        h = hNext;
     }
-    SDVertex *v[2];
-    SDFace *f[2];
-    int f0edgeNum;
-};
 
-// LoopSubdiv Local Declarations
-static Point3f weightOneRing(SDVertex *vert, Float beta);
-static Point3f weightBoundary(SDVertex *vert, Float beta);
-
-// LoopSubdiv Inline Functions
-inline int SDVertex::valence() {
-    SDFace *f = startFace;
-    if (!boundary) {
-        // Compute valence of interior vertex
-        int nf = 1;
-        while ((f = f->nextFace(this)) != startFace)
-            ++nf;
-        return nf;
-    } else {
-        // Compute valence of boundary vertex
-        int nf = 1;
-        while ((f = f->nextFace(this)) != nullptr)
-            ++nf;
-        f = startFace;
-        while ((f = f->prevFace(this)) != nullptr)
-            ++nf;
-        return nf + 1;
-    }
+    // Get one-ring vertices for boundary vertex
+    ring->push_back(indices[Next(h)]);
+    do {
+        ring->push_back(indices[Prev(h)]);
+        h = PrevOutgoing(h);
+    } while (h >= 0);
+    return true;
 }
 
+// LoopSubdiv Inline Functions
 inline Float beta(int valence) {
     if (valence == 3)
         return 3.f / 16.f;
@@ -129,303 +95,240 @@ inline Float loopGamma(int valence) {
     return 1.f / (valence + 3.f / (8.f * beta(valence)));
 }
 
-// LoopSubdiv Function Definitions
-TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrientation,
-                            int nLevels, pstd::span<const int> vertexIndices,
-                            pstd::span<const Point3f> p, Allocator alloc) {
-    std::vector<SDVertex *> vertices;
-    std::vector<SDFace *> faces;
-    // Allocate _LoopSubdiv_ vertices and faces
-    std::unique_ptr<SDVertex[]> verts = std::make_unique<SDVertex[]>(p.size());
-    for (int i = 0; i < p.size(); ++i) {
-        verts[i] = SDVertex(p[i]);
-        vertices.push_back(&verts[i]);
-    }
-    size_t nFaces = vertexIndices.size() / 3;
-    std::unique_ptr<SDFace[]> fs = std::make_unique<SDFace[]>(nFaces);
-    for (int i = 0; i < nFaces; ++i)
-        faces.push_back(&fs[i]);
-
-    // Set face to vertex pointers
-    const int *vp = vertexIndices.data();
-    for (size_t i = 0; i < nFaces; ++i, vp += 3) {
-        SDFace *f = faces[i];
-        for (int j = 0; j < 3; ++j) {
-            SDVertex *v = vertices[vp[j]];
-            f->v[j] = v;
-            v->startFace = f;
-        }
-    }
+static Point3f weightOneRing(const std::vector<Point3f> &p, int v,
+                             const InlinedVector<int, 16> &ring, Float beta) {
+    Point3f pv = (1 - ring.size() * beta) * p[v];
+    for (size_t i = 0; i < ring.size(); ++i)
+        pv += beta * p[ring[i]];
+    return pv;
+}
 
-    // Set neighbor pointers in _faces_
-    std::set<SDEdge> edges;
-    for (int i = 0; i < nFaces; ++i) {
-        SDFace *f = faces[i];
-        for (int edgeNum = 0; edgeNum < 3; ++edgeNum) {
-            // Update neighbor pointer for _edgeNum_
-            int v0 = edgeNum, v1 = NEXT(edgeNum);
-            SDEdge e(f->v[v0], f->v[v1]);
-            if (edges.find(e) == edges.end()) {
-                // Handle new edge
-                e.f[0] = f;
-                e.f0edgeNum = edgeNum;
-                edges.insert(e);
-            } else {
-                // Handle previously seen edge
-                e = *edges.find(e);
-                e.f[0]->f[e.f0edgeNum] = f;
-                f->f[edgeNum] = e.f[0];
-                edges.erase(e);
-            }
-        }
-    }
+static Point3f weightBoundary(const std::vector<Point3f> &p, int v,
+                              const InlinedVector<int, 16> &ring, Float beta) {
+    Point3f pv = (1 - 2 * beta) * p[v];
+    pv += beta * p[ring[0]];
+    pv += beta * p[ring.back()];
+    return pv;
+}
 
-    // Finish vertex initialization
-    for (size_t i = 0; i < p.size(); ++i) {
-        SDVertex *v = vertices[i];
-        SDFace *f = v->startFace;
-        do {
-            f = f->nextFace(v);
-        } while ((f != nullptr) && f != v->startFace);
-        v->boundary = (f == nullptr);
-        if (!v->boundary && v->valence() == 6)
-            v->regular = true;
-        else if (v->boundary && v->valence() == 4)
-            v->regular = true;
-        else
-            v->regular = false;
+// LoopSubdiv Function Definitions
+// Returns the control mesh for the given triangles; edges that are shared by
+// more than two faces or by faces with inconsistent orientations are treated
+// as boundary edges.
+static SDMesh MakeSDMesh(pstd::span<const int> vertexIndices,
+                         pstd::span<const Point3f> p) {
+    SDMesh mesh;
+    mesh.p.assign(p.begin(), p.end());
+    mesh.indices.assign(vertexIndices.begin(), vertexIndices.end());
+    int nHalfEdges = mesh.indices.size();
+    auto key = [&](int v0, int v1) { return (uint64_t(v0) << 32) | uint32_t(v1); };
+
+    // Find the first half-edge between each ordered pair of vertices
+    std::unordered_map<uint64_t, int> halfEdges;
+    halfEdges.reserve(nHalfEdges);
+    for (int h = 0; h < nHalfEdges; ++h)
+        halfEdges.insert({key(mesh.indices[h], mesh.indices[SDMesh::Next(h)]), h});
+
+    // Pair each of them with the half-edge that runs the other way, if any
+    mesh.twin.assign(nHalfEdges, -1);
+    mesh.vertexHalfEdge.assign(p.size(), -1);
+    for (int h = 0; h < nHalfEdges; ++h) {
+        int v0 = mesh.indices[h], v1 = mesh.indices[SDMesh::Next(h)];
+        mesh.vertexHalfEdge[v0] = h;
+        if (v0 == v1 || halfEdges[key(v0, v1)] != h)
+            continue;
+        if (auto iter = halfEdges.find(key(v1, v0)); iter != halfEdges.end())
+            mesh.twin[h] = iter->second;
     }
+    return mesh;
+}
 
-    // Refine _LoopSubdiv_ into triangles
-    std::vector<SDFace *> f = faces;
-    std::vector<SDVertex *> v = vertices;
-    pstd::pmr::monotonic_buffer_resource resource;
-    Allocator vertexFaceAllocator(&resource);
-
-    for (int i = 0; i < nLevels; ++i) {
-        // Update _f_ and _v_ for next level of subdivision
-        std::vector<SDFace *> newFaces;
-        std::vector<SDVertex *> newVertices;
-
-        // Allocate next level of children in mesh tree
-        for (SDVertex *vertex : v) {
-            vertex->child = vertexFaceAllocator.new_object<SDVertex>();
-            vertex->child->regular = vertex->regular;
-            vertex->child->boundary = vertex->boundary;
-            newVertices.push_back(vertex->child);
-        }
-        for (SDFace *face : f) {
-            for (int k = 0; k < 4; ++k) {
-                face->children[k] = vertexFaceAllocator.new_object<SDFace>();
-                newFaces.push_back(face->children[k]);
-            }
-        }
-
-        // Update vertex positions and create new edge vertices
-
-        // Update vertex positions for even vertices
-        for (SDVertex *vertex : v) {
-            if (!vertex->boundary) {
-                // Apply one-ring rule for even vertex
-                if (vertex->regular)
-                    vertex->child->p = weightOneRing(vertex, 1.f / 16.f);
-                else
-                    vertex->child->p = weightOneRing(vertex, beta(vertex->valence()));
-            } else {
-                // Apply boundary rule for even vertex
-                vertex->child->p = weightBoundary(vertex, 1.f / 8.f);
-            }
+// Returns _mesh_ after one level of Loop subdivision, which splits each face
+// into four: child $k<3$ holds the face's $k$th vertex and child 3 is in the
+// middle. All new vertices and faces are computed in parallel.
+static SDMesh Refine(const SDMesh &mesh) {
+    int nFaces = mesh.nFaces(), nVertices = mesh.p.size();
+    // Number new odd vertices, one for each edge, after the even ones
+    std::vector<int> edgeVertex(3 * nFaces);
+    int nEdges = 0;
+    for (int h = 0; h < 3 * nFaces; ++h)
+        if (mesh.twin[h] < 0 || mesh.twin[h] > h)
+            edgeVertex[h] = nVertices + nEdges++;
+    ParallelFor(0, 3 * nFaces, [&](int64_t h) {
+        if (mesh.twin[h] >= 0 && mesh.twin[h] < h)
+            edgeVertex[h] = edgeVertex[mesh.twin[h]];
+    });
+
+    SDMesh refined;
+    refined.p.resize(nVertices + nEdges);
+    refined.vertexHalfEdge.assign(nVertices + nEdges, -1);
+    // Update vertex positions for even vertices
+    ParallelFor(0, nVertices, [&](int64_t v) {
+        InlinedVector<int, 16> ring;
+        if (mesh.OneRing(v, &ring))
+            // Apply boundary rule for even vertex
+            refined.p[v] = weightBoundary(mesh.p, v, ring, 1.f / 8.f);
+        else if (ring.empty())
+            // Leave vertices that aren't used by any faces where they are
+            refined.p[v] = mesh.p[v];
+        else
+            // Apply one-ring rule for even vertex
+            refined.p[v] = weightOneRing(mesh.p, v, ring, beta(ring.size()));
+        // The vertex's outgoing half-edge continues in the child at its corner
+        if (int h = mesh.vertexHalfEdge[v]; h >= 0)
+            refined.vertexHalfEdge[v] = 3 * (4 * (h / 3) + h % 3) + h % 3;
+    });
+
+    // Compute new odd edge vertices
+    ParallelFor(0, 3 * nFaces, [&](int64_t h) {
+        int t = mesh.twin[h];
+        if (t >= 0 && t < h)
+            return;
+        const Point3f &p0 = mesh.p[mesh.indices[h]];
+        const Point3f &p1 = mesh.p[mesh.indices[SDMesh::Next(h)]];
+        Point3f p;
+        if (t < 0)
+            p = 0.5f * p0 + 0.5f * p1;
+        else {
+            p = 3.f / 8.f * p0 + 3.f / 8.f * p1;
+            p += 1.f / 8.f * mesh.p[mesh.indices[SDMesh::Prev(h)]];
+            p += 1.f / 8.f * mesh.p[mesh.indices[SDMesh::Prev(t)]];
         }
-
-        // Compute new odd edge vertices
-        std::map<SDEdge, SDVertex *> edgeVerts;
-        for (SDFace *face : f) {
-            for (int k = 0; k < 3; ++k) {
-                // Compute odd vertex on _k_th edge
-                SDEdge edge(face->v[k], face->v[NEXT(k)]);
-                SDVertex *vert = edgeVerts[edge];
-                if (vert == nullptr) {
-                    // Create and initialize new odd vertex
-                    vert = vertexFaceAllocator.new_object<SDVertex>();
-                    newVertices.push_back(vert);
-                    vert->regular = true;
-                    vert->boundary = (face->f[k] == nullptr);
-                    vert->startFace = face->children[3];
-
-                    // Apply edge rules to compute new vertex position
-                    if (vert->boundary) {
-                        vert->p = 0.5f * edge.v[0]->p;
-                        vert->p += 0.5f * edge.v[1]->p;
-                    } else {
-                        vert->p = 3.f / 8.f * edge.v[0]->p;
-                        vert->p += 3.f / 8.f * edge.v[1]->p;
-                        vert->p += 1.f / 8.f * face->otherVert(edge.v[0], edge.v[1])->p;
-                        vert->p +=
-                            1.f / 8.f * face->f[k]->otherVert(edge.v[0], edge.v[1])->p;
-                    }
-                    edgeVerts[edge] = vert;
-                }
+        int f = h / 3, k = h % 3;
+        refined.p[edgeVertex[h]] = p;
+        refined.vertexHalfEdge[edgeVertex[h]] = 3 * (4 * f + (k + 1) % 3) + k;
+    });
+
+    // Create child faces and their half-edges' twins
+    refined.indices.resize(12 * nFaces);
+    refined.twin.resize(12 * nFaces);
+    ParallelFor(0, nFaces, [&](int64_t f) {
+        const int *v = &mesh.indices[3 * f];
+        int *indices = &refined.indices[12 * f], *twin = &refined.twin[12 * f];
+        for (int k = 0; k < 3; ++k) {
+            int next = (k + 1) % 3, prev = (k + 2) % 3;
+            // Set vertices of corner child and of middle child
+            indices[3 * k + k] = v[k];
+            indices[3 * k + next] = edgeVertex[3 * f + k];
+            indices[3 * k + prev] = edgeVertex[3 * f + prev];
+            indices[9 + k] = edgeVertex[3 * f + k];
+
+            // Pair half-edges between the corner child and the middle child
+            twin[3 * k + next] = 12 * f + 9 + prev;
+            twin[9 + prev] = 12 * f + 3 * k + next;
+
+            // Pair halves of the _k_th edge with those in the neighboring face
+            if (int t = mesh.twin[3 * f + k]; t < 0)
+                twin[3 * k + k] = twin[3 * next + k] = -1;
+            else {
+                int g = t / 3, m = t % 3;
+                twin[3 * k + k] = 12 * g + 3 * ((m + 1) % 3) + m;
+                twin[3 * next + k] = 12 * g + 3 * m + m;
             }
         }
+    });
+    return refined;
+}
 
-        // Update new mesh topology
-
-        // Update even vertex face pointers
-        for (SDVertex *vertex : v) {
-            int vertNum = vertex->startFace->vnum(vertex);
-            vertex->child->startFace = vertex->startFace->children[vertNum];
-        }
+// Global camera used to choose subdivision levels
+static Point3f loopSubdivCameraP;
+static Float loopSubdivPixelsPerRadian = 0;
 
-        // Update face neighbor pointers
-        for (SDFace *face : f) {
-            for (int j = 0; j < 3; ++j) {
-                // Update children _f_ pointers for siblings
-                face->children[3]->f[j] = face->children[NEXT(j)];
-                face->children[j]->f[NEXT(j)] = face->children[3];
-
-                // Update children _f_ pointers for neighbor children
-                SDFace *f2 = face->f[j];
-                face->children[j]->f[j] =
-                    f2 != nullptr ? f2->children[f2->vnum(face->v[j])] : nullptr;
-                f2 = face->f[PREV(j)];
-                face->children[j]->f[PREV(j)] =
-                    f2 != nullptr ? f2->children[f2->vnum(face->v[j])] : nullptr;
-            }
-        }
+void SetLoopSubdivCamera(Point3f pCamera, Float pixelsPerRadian) {
+    loopSubdivCameraP = pCamera;
+    loopSubdivPixelsPerRadian = pixelsPerRadian;
+}
 
-        // Update face vertex pointers
-        for (SDFace *face : f) {
-            for (int j = 0; j < 3; ++j) {
-                // Update child vertex pointer to new even vertex
-                face->children[j]->v[j] = face->v[j]->child;
-
-                // Update child vertex pointer to new odd vertex
-                SDVertex *vert = edgeVerts[SDEdge(face->v[j], face->v[NEXT(j)])];
-                face->children[j]->v[NEXT(j)] = vert;
-                face->children[NEXT(j)]->v[j] = vert;
-                face->children[3]->v[j] = vert;
+TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrientation,
+                            int nLevels, pstd::span<const int> vertexIndices,
+                            pstd::span<const Point3f> p, Allocator alloc,
+                            Float maxEdgePixels) {
+    if (maxEdgePixels > 0) {
+        if (loopSubdivPixelsPerRadian == 0)
+            Warning("Ignoring \"edgelength\" for Loop subdivision surface since "
+                    "the camera isn't a perspective camera.");
+        else {
+            // Find the largest edge length in pixels from the camera
+            Float maxPixels = 0;
+            for (int h = 0; h < vertexIndices.size(); ++h) {
+                Point3f p0 = (*renderFromObject)(p[vertexIndices[h]]);
+                Point3f p1 = (*renderFromObject)(
+                    p[vertexIndices[SDMesh::Next(h)]]);
+                Float distance = Distance(loopSubdivCameraP, (p0 + p1) / 2);
+                maxPixels = std::max(maxPixels, Distance(p0, p1) / distance *
+                                                    loopSubdivPixelsPerRadian);
             }
+            // Each level of subdivision roughly halves the lengths of edges
+            if (maxPixels <= maxEdgePixels)
+                nLevels = 0;
+            else if (!IsInf(maxPixels))
+                nLevels = std::min<int>(nLevels,
+                                        std::ceil(std::log2(maxPixels / maxEdgePixels)));
         }
-
-        // Prepare for next level of subdivision
-        f = newFaces;
-        v = newVertices;
     }
+    loopSubdivLevels << nLevels;
+
+    // Refine _LoopSubdiv_ into triangles
+    SDMesh mesh = MakeSDMesh(vertexIndices, p);
+    for (int i = 0; i < nLevels; ++i)
+        mesh = Refine(mesh);
 
     // Push vertices to limit surface
-    std::vector<Point3f> pLimit(v.size());
-    for (size_t i = 0; i < v.size(); ++i) {
-        if (v[i]->boundary)
-            pLimit[i] = weightBoundary(v[i], 1.f / 5.f);
+    int nVertices = mesh.p.size();
+    std::vector<Point3f> pLimit(nVertices);
+    ParallelFor(0, nVertices, [&](int64_t v) {
+        InlinedVector<int, 16> ring;
+        if (mesh.OneRing(v, &ring))
+            pLimit[v] = weightBoundary(mesh.p, v, ring, 1.f / 5.f);
+        else if (ring.empty())
+            pLimit[v] = mesh.p[v];
         else
-            pLimit[i] = weightOneRing(v[i], loopGamma(v[i]->valence()));
-    }
-    for (size_t i = 0; i < v.size(); ++i)
-        v[i]->p = pLimit[i];
+            pLimit[v] = weightOneRing(mesh.p, v, ring, loopGamma(ring.size()));
+    });
 
     // Compute vertex tangents on limit surface
-    std::vector<Normal3f> Ns;
-    Ns.reserve(v.size());
-    std::vector<Point3f> pRing(16, Point3f());
-    for (SDVertex *vertex : v) {
+    std::vector<Normal3f> Ns(nVertices);
+    ParallelFor(0, nVertices, [&](int64_t v) {
+        InlinedVector<int, 16> ring;
+        bool boundary = mesh.OneRing(v, &ring);
+        int valence = ring.size();
+        auto pRing = [&](int j) { return pLimit[ring[j]]; };
+        Point3f pv = pLimit[v];
         Vector3f S(0, 0, 0), T(0, 0, 0);
-        int valence = vertex->valence();
-        if (valence > (int)pRing.size())
-            pRing.resize(valence);
-        vertex->oneRing(&pRing[0]);
-        if (!vertex->boundary) {
+        if (!boundary) {
             // Compute tangents of interior face
             for (int j = 0; j < valence; ++j) {
-                S += std::cos(2 * Pi * j / valence) * Vector3f(pRing[j]);
-                T += std::sin(2 * Pi * j / valence) * Vector3f(pRing[j]);
+                S += std::cos(2 * Pi * j / valence) * Vector3f(pRing(j));
+                T += std::sin(2 * Pi * j / valence) * Vector3f(pRing(j));
             }
         } else {
             // Compute tangents of boundary face
-            S = pRing[valence - 1] - pRing[0];
+            S = pRing(valence - 1) - pRing(0);
             if (valence == 2)
-                T = Vector3f(pRing[0] + pRing[1] - 2 * vertex->p);
+                T = Vector3f(pRing(0) + pRing(1) - 2 * pv);
             else if (valence == 3)
-                T = pRing[1] - vertex->p;
+                T = pRing(1) - pv;
             else if (valence == 4)  // regular
-                T = Vector3f(-1 * pRing[0] + 2 * pRing[1] + 2 * pRing[2] + -1 * pRing[3] +
-                             -2 * vertex->p);
+                T = Vector3f(-1 * pRing(0) + 2 * pRing(1) + 2 * pRing(2) +
+                             -1 * pRing(3) + -2 * pv);
             else {
                 Float theta = Pi / float(valence - 1);
-                T = Vector3f(std::sin(theta) * (pRing[0] + pRing[valence - 1]));
+                T = Vector3f(std::sin(theta) * (pRing(0) + pRing(valence - 1)));
                 for (int k = 1; k < valence - 1; ++k) {
                     Float wt = (2 * std::cos(theta) - 2) * std::sin((k)*theta);
-                    T += Vector3f(wt * pRing[k]);
+                    T += Vector3f(wt * pRing(k));
                 }
                 T = -T;
             }
         }
-        Ns.push_back(Normal3f(Cross(S, T)));
-    }
+        Ns[v] = Normal3f(Cross(S, T));
+    });
 
     // Create triangle mesh from subdivision mesh
-    {
-        size_t ntris = f.size();
-        std::vector<int> verts(3 * ntris);
-        int *vp = verts.data();
-        size_t totVerts = v.size();
-        std::map<SDVertex *, int> usedVerts;
-        for (size_t i = 0; i < totVerts; ++i)
-            usedVerts[v[i]] = i;
-        for (size_t i = 0; i < ntris; ++i) {
-            for (int j = 0; j < 3; ++j) {
-                *vp = usedVerts[f[i]->v[j]];
-                ++vp;
-            }
-        }
-        return alloc.new_object<TriangleMesh>(*renderFromObject, reverseOrientation,
-                                              verts, pLimit, std::vector<Vector3f>(), Ns,
-                                              std::vector<Point2f>(), std::vector<int>());
-    }
-}
-
-static Point3f weightOneRing(SDVertex *vert, Float beta) {
-    // Put _vert_ one-ring in _pRing_
-    int valence = vert->valence();
-    InlinedVector<Point3f, 16> pRing(valence);
-
-    vert->oneRing(pRing.data());
-    Point3f p = (1 - valence * beta) * vert->p;
-    for (int i = 0; i < valence; ++i)
-        p += beta * pRing[i];
-    return p;
-}
-
-void SDVertex::oneRing(Point3f *p) {
-    if (!boundary) {
-        // Get one-ring vertices for interior vertex
-        SDFace *face = startFace;
-        do {
-            *p++ = face->nextVert(this)->p;
-            face = face->nextFace(this);
-        } while (face != startFace);
-    } else {
-        // Get one-ring vertices for boundary vertex
-        SDFace *face = startFace, *f2;
-        while ((f2 = face->nextFace(this)) != nullptr)
-            face = f2;
-        *p++ = face->nextVert(this)->p;
-        do {
-            *p++ = face->prevVert(this)->p;
-            face = face->prevFace(this);
-        } while (face != nullptr);
-    }
-}
-
-static Point3f weightBoundary(SDVertex *vert, Float beta) {
-    // Put _vert_ one-ring in _pRing_
-    int valence = vert->valence();
-    InlinedVector<Point3f, 16> pRing(valence);
-
-    vert->oneRing(pRing.data());
-    Point3f p = (1 - 2 * beta) * vert->p;
-    p += beta * pRing[0];
-    p += beta * pRing[valence - 1];
-    return p;
+    return alloc.new_object<TriangleMesh>(
+        *renderFromObject, reverseOrientation, std::move(mesh.indices), std::move(pLimit),
+        std::vector<Vector3f>(), std::move(Ns), std::vector<Point2f>(),
+        std::vector<int>());
 }
 
 }  // namespace pbrt
@@ -8,13 +8,24 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
 
 namespace pbrt {
 
 // LoopSubdiv Declarations
+// Returns the mesh after _nLevels_ levels of Loop subdivision with its vertices
+// pushed to the limit surface. If _maxEdgePixels_ is positive, only as many of
+// those levels are used as are needed for the longest edge to span at most that
+// many pixels as seen from the camera given to SetLoopSubdivCamera().
 TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrientation,
                             int nLevels, pstd::span<const int> vertexIndices,
-                            pstd::span<const Point3f> p, Allocator alloc);
+                            pstd::span<const Point3f> p, Allocator alloc,
+                            Float maxEdgePixels = 0);
+
+// Sets the rendering-space position of a perspective camera and the number of
+// pixels its image has per radian of field of view; the latter is zero for
+// other cameras.
+void SetLoopSubdivCamera(Point3f pCamera, Float pixelsPerRadian);
 
 }  // namespace pbrt
 
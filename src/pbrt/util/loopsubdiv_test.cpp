@@ -0,0 +1,87 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/loopsubdiv.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/transform.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace pbrt;
+
+static const std::vector<Point3f> octahedronP = {
+    Point3f(1, 0, 0), Point3f(-1, 0, 0), Point3f(0, 1, 0),
+    Point3f(0, -1, 0), Point3f(0, 0, 1), Point3f(0, 0, -1)};
+static const std::vector<int> octahedronIndices = {0, 2, 4, 2, 1, 4, 1, 3, 4, 3, 0, 4,
+                                                   2, 0, 5, 1, 2, 5, 3, 1, 5, 0, 3, 5};
+
+TEST(LoopSubdiv, ClosedMesh) {
+    Transform identity;
+    for (int nLevels = 1; nLevels <= 3; ++nLevels) {
+        TriangleMesh *mesh = LoopSubdivide(&identity, false, nLevels, octahedronIndices,
+                                           octahedronP, Allocator());
+        // Each level splits faces into four and adds a vertex for each edge
+        int nFaces = 8 << (2 * nLevels), nEdges = 3 * nFaces / 2;
+        ASSERT_EQ(nFaces, mesh->nTriangles);
+        EXPECT_EQ(nEdges - nFaces + 2, mesh->nVertices);
+
+        // Each edge is shared by two consistently oriented faces
+        std::map<std::pair<int, int>, int> halfEdges;
+        for (int i = 0; i < 3 * mesh->nTriangles; ++i) {
+            int v0 = mesh->vertexIndices[i];
+            int v1 = mesh->vertexIndices[i % 3 == 2 ? i - 2 : i + 1];
+            ++halfEdges[{v0, v1}];
+        }
+        for (auto [edge, count] : halfEdges) {
+            EXPECT_EQ(1, count);
+            EXPECT_EQ(1, halfEdges.count({edge.second, edge.first}));
+        }
+
+        // The original vertices are pushed to symmetric points on the limit
+        // surface and all normals point the same way relative to the center
+        for (int v = 1; v < 6; ++v)
+            EXPECT_NEAR(Length(Vector3f(mesh->P(0))), Length(Vector3f(mesh->P(v))),
+                        1e-5f);
+        Float sign = Dot(mesh->N(0), Vector3f(mesh->P(0)));
+        for (int v = 0; v < mesh->nVertices; ++v)
+            EXPECT_GT(sign * Dot(mesh->N(v), Vector3f(mesh->P(v))), 0) << v;
+    }
+}
+
+TEST(LoopSubdiv, Boundary) {
+    Transform identity;
+    std::vector<Point3f> p = {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0, 1, 0)};
+    TriangleMesh *mesh =
+        LoopSubdivide(&identity, false, 2, std::vector<int>{0, 1, 2}, p, Allocator());
+    ASSERT_EQ(16, mesh->nTriangles);
+    EXPECT_EQ(15, mesh->nVertices);
+    // A flat mesh stays flat and its normals are perpendicular to it
+    for (int v = 0; v < mesh->nVertices; ++v) {
+        EXPECT_EQ(0, mesh->P(v).z);
+        EXPECT_EQ(0, mesh->N(v).x);
+        EXPECT_EQ(0, mesh->N(v).y);
+    }
+}
+
+TEST(LoopSubdiv, Adaptive) {
+    // A camera 10 units away with 1000 pixels across a 90 degree field of view
+    // sees the octahedron's edges as up to about 95 pixels long
+    SetLoopSubdivCamera(Point3f(0, 0, -10), 1000 / Radians(90));
+    Transform identity;
+    auto nTriangles = [&](Float maxEdgePixels) {
+        return LoopSubdivide(&identity, false, 5, octahedronIndices, octahedronP,
+                             Allocator(), maxEdgePixels)
+            ->nTriangles;
+    };
+    EXPECT_EQ(8, nTriangles(100));
+    EXPECT_EQ(8 << 4, nTriangles(30));
+    EXPECT_EQ(8 << 10, nTriangles(1));
+    SetLoopSubdivCamera(Point3f(0, 0, 0), 0);
+}
@@ -10,6 +10,11 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
 
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
 namespace pbrt {
 
 std::string DigitPermutation::ToString() const {
@@ -44,15 +49,42 @@ std::string ToString(RandomizeStrategy r) {
     }
 }
 
+STAT_COUNTER("Sampling/Radical inverse permutations reused", permutationsReused);
+
 // Low Discrepancy Function Definitions
 pstd::vector<DigitPermutation> *ComputeRadicalInversePermutations(uint32_t seed,
                                                                   Allocator alloc) {
+    // The permutations only depend on the seed, so samplers that use the same
+    // one and allocator share them
+    static std::mutex cacheMutex;
+    static std::map<std::pair<uint32_t, pstd::pmr::memory_resource *>,
+                    pstd::vector<DigitPermutation> *>
+        cache;
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto iter = cache.find({seed, alloc.resource()});
+    if (iter != cache.end()) {
+        ++permutationsReused;
+        return iter->second;
+    }
+
+    // Allocate a single block for all of the permutations, with each base's
+    // starting on a cache line
+    constexpr int lineValues = 64 / sizeof(uint16_t);
+    std::vector<size_t> offsets(PrimeTableSize + 1, 0);
+    for (int i = 0; i < PrimeTableSize; ++i) {
+        int size = DigitPermutation::StorageSize(Primes[i]);
+        offsets[i + 1] = offsets[i] + (size + lineValues - 1) / lineValues * lineValues;
+    }
+    uint16_t *storage = (uint16_t *)alloc.allocate_bytes(
+        offsets[PrimeTableSize] * sizeof(uint16_t), 64);
+
     pstd::vector<DigitPermutation> *perms =
         alloc.new_object<pstd::vector<DigitPermutation>>(alloc);
     perms->resize(PrimeTableSize);
-    ParallelFor(0, PrimeTableSize, [&perms, &alloc, seed](int64_t i) {
-        (*perms)[i] = DigitPermutation(Primes[i], seed, alloc);
+    ParallelFor(0, PrimeTableSize, [&](int64_t i) {
+        (*perms)[i] = DigitPermutation(Primes[i], seed, storage + offsets[i]);
     });
+    cache[{seed, alloc.resource()}] = perms;
     return perms;
 }
 
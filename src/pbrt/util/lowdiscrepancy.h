@@ -23,21 +23,30 @@
 namespace pbrt {
 
 // DigitPermutation Definition
+// Returns the number of base _base_ digits that a radical inverse computes
+// before further digits no longer affect its _Float_ value
+PBRT_CPU_GPU constexpr int RadicalInverseDigits(int base) {
+    int nDigits = 0;
+    Float invBase = (Float)1 / (Float)base, invBaseM = 1;
+    while (1 - invBaseM < 1) {
+        ++nDigits;
+        invBaseM *= invBase;
+    }
+    return nDigits;
+}
+
 class DigitPermutation {
   public:
     // DigitPermutation Public Methods
     DigitPermutation() = default;
-    DigitPermutation(int base, uint32_t seed, Allocator alloc) : base(base) {
+    DigitPermutation(int base, uint32_t seed, Allocator alloc)
+        : DigitPermutation(base, seed,
+                           alloc.allocate_object<uint16_t>(StorageSize(base))) {}
+    // Stores the permutations in _storage_, which must have room for
+    // _StorageSize(base)_ values
+    DigitPermutation(int base, uint32_t seed, uint16_t *storage)
+        : base(base), nDigits(RadicalInverseDigits(base)), permutations(storage) {
         CHECK_LT(base, 65536);  // uint16_t
-        // Compute number of digits needed for _base_
-        nDigits = 0;
-        Float invBase = (Float)1 / (Float)base, invBaseM = 1;
-        while (1 - invBaseM < 1) {
-            ++nDigits;
-            invBaseM *= invBase;
-        }
-
-        permutations = alloc.allocate_object<uint16_t>(nDigits * base);
         // Compute random permutations for all digits
         for (int digitIndex = 0; digitIndex < nDigits; ++digitIndex) {
             uint32_t digitSeed = MixBits(((base << 8) + digitIndex) ^ seed);
@@ -46,8 +55,16 @@ class DigitPermutation {
                 permutations[index] = PermutationElement(digitValue, base, digitSeed);
             }
         }
+
+        // Record which base-2 digits are flipped
+        if (base == 2)
+            for (int digitIndex = 0; digitIndex < nDigits; ++digitIndex)
+                if (permutations[2 * digitIndex] == 1)
+                    base2Flips |= uint64_t(1) << (nDigits - 1 - digitIndex);
     }
 
+    static int StorageSize(int base) { return RadicalInverseDigits(base) * base; }
+
     PBRT_CPU_GPU
     int Permute(int digitIndex, int digitValue) const {
         DCHECK_LT(digitIndex, nDigits);
@@ -55,12 +72,21 @@ class DigitPermutation {
         return permutations[digitIndex * base + digitValue];
     }
 
+    // For base 2, returns the bits to XOR with the reversed digits to apply
+    // the permutations; the first digit's is the most significant bit
+    PBRT_CPU_GPU
+    uint64_t Base2Flips() const {
+        DCHECK_EQ(base, 2);
+        return base2Flips;
+    }
+
     std::string ToString() const;
 
   private:
     // DigitPermutation Private Members
     int base, nDigits;
     uint16_t *permutations;
+    uint64_t base2Flips = 0;
 };
 
 // Low Discrepancy Declarations
@@ -109,8 +135,51 @@ PBRT_CPU_GPU inline uint64_t InverseRadicalInverse(uint64_t inverse, int base,
     return index;
 }
 
+// Computes the scrambled radical inverse in a compile-time base, which turns
+// each digit's division into a multiplication; base 2 reduces to reversing
+// and flipping bits
+template <int base>
+PBRT_CPU_GPU inline Float ScrambledRadicalInverse(uint64_t a,
+                                                  const DigitPermutation &perm) {
+    constexpr int nDigits = RadicalInverseDigits(base);
+    if constexpr (base == 2) {
+        constexpr Float invBaseM = 1 / Float(uint64_t(1) << nDigits);
+        uint64_t reversedDigits =
+            (ReverseBits64(a) >> (64 - nDigits)) ^ perm.Base2Flips();
+        return std::min(invBaseM * reversedDigits, OneMinusEpsilon);
+    } else {
+        Float invBase = (Float)1 / (Float)base, invBaseM = 1;
+        uint64_t reversedDigits = 0;
+        for (int digitIndex = 0; digitIndex < nDigits; ++digitIndex) {
+            // Permute least significant digit from _a_ and update _reversedDigits_
+            uint64_t next = a / base;
+            int digitValue = a - next * base;
+            reversedDigits = reversedDigits * base + perm.Permute(digitIndex, digitValue);
+            invBaseM *= invBase;
+            a = next;
+        }
+        return std::min(invBaseM * reversedDigits, OneMinusEpsilon);
+    }
+}
+
 PBRT_CPU_GPU inline Float ScrambledRadicalInverse(int baseIndex, uint64_t a,
                                                   const DigitPermutation &perm) {
+    // Use a specialized implementation for the first few bases
+    switch (baseIndex) {
+    case 0:
+        return ScrambledRadicalInverse<2>(a, perm);
+    case 1:
+        return ScrambledRadicalInverse<3>(a, perm);
+    case 2:
+        return ScrambledRadicalInverse<5>(a, perm);
+    case 3:
+        return ScrambledRadicalInverse<7>(a, perm);
+    case 4:
+        return ScrambledRadicalInverse<11>(a, perm);
+    case 5:
+        return ScrambledRadicalInverse<13>(a, perm);
+    }
+
     int base = Primes[baseIndex];
     Float invBase = (Float)1 / (Float)base, invBaseM = 1;
     uint64_t reversedDigits = 0;
@@ -155,6 +224,23 @@ PBRT_CPU_GPU inline uint32_t MultiplyGenerator(pstd::span<const uint32_t> C, uin
     return v;
 }
 
+// Computes the unrandomized Sobol samples for the _N_ dimensions starting at
+// _dimension_ with a single pass over the bits of _a_. The inner loop is
+// branch-free so that it can be vectorized across dimensions.
+template <int N>
+PBRT_CPU_GPU inline pstd::array<uint32_t, N> SobolSampleBits(int64_t a, int dimension) {
+    DCHECK_LE(dimension + N, NSobolDimensions);
+    DCHECK(a >= 0 && a < (1ull << SobolMatrixSize));
+    pstd::array<uint32_t, N> v;
+    v.fill(0);
+    for (int i = dimension * SobolMatrixSize; a != 0; a >>= 1, i++) {
+        uint32_t mask = -uint32_t(a & 1);
+        for (int d = 0; d < N; ++d)
+            v[d] ^= SobolMatrices32[i + d * SobolMatrixSize] & mask;
+    }
+    return v;
+}
+
 template <typename R>
 PBRT_CPU_GPU inline Float SobolSample(int64_t a, int dimension, R randomizer) {
     DCHECK_LT(dimension, NSobolDimensions);
@@ -449,6 +449,21 @@ inline int Log2Int(int64_t v) {
     return Log2Int((uint64_t)v);
 }
 
+PBRT_CPU_GPU
+inline int PopCount(uint64_t v) {
+#ifdef PBRT_IS_GPU_CODE
+    return __popcll(v);
+#elif defined(PBRT_HAS_INTRIN_H)
+#if defined(_WIN64)
+    return __popcnt64(v);
+#else
+    return __popcnt(uint32_t(v >> 32)) + __popcnt(uint32_t(v));
+#endif  // _WIN64
+#else   // PBRT_HAS_INTRIN_H
+    return __builtin_popcountll(v);
+#endif
+}
+
 template <typename T>
 PBRT_CPU_GPU inline int Log4Int(T v) {
     return Log2Int(v) / 2;
@@ -483,6 +498,17 @@ PBRT_CPU_GPU inline float FastExp(float x) {
 #endif
 }
 
+// Approximates $1/\sqrt{x}$ with a relative error below $1.8 \times 10^{-3}$
+PBRT_CPU_GPU inline float FastRsqrt(float x) {
+#ifdef PBRT_IS_GPU_CODE
+    return rsqrtf(x);
+#else
+    // Compute initial estimate from the bits of _x_ and refine it with Newton's method
+    float y = BitsToFloat(0x5f3759dfu - (FloatToBits(x) >> 1));
+    return y * (1.5f - 0.5f * x * y * y);
+#endif
+}
+
 PBRT_CPU_GPU inline Float Gaussian(Float x, Float mu = 0, Float sigma = 1) {
     return 1 / std::sqrt(2 * Pi * sigma * sigma) *
            FastExp(-Sqr(x - mu) / (2 * sigma * sigma));
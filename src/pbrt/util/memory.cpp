@@ -4,8 +4,12 @@
 
 #include <pbrt/util/memory.h>
 
+#include <pbrt/options.h>
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+#include <pbrt/util/string.h>
 
 #include <cstdlib>
 #ifdef PBRT_HAVE_MALLOC_H
@@ -19,15 +23,206 @@
 // clang-format on
 #endif  // PBRT_IS_WINDOWS
 #ifdef PBRT_IS_LINUX
+#include <sys/mman.h>
 #include <unistd.h>
 #include <cstdio>
 #endif  // PBRT_IS_LINUX
+#ifndef PBRT_IS_WINDOWS
+#include <sys/resource.h>
+#endif  // !PBRT_IS_WINDOWS
 #ifdef PBRT_IS_OSX
 #include <mach/mach.h>
 #endif  // PBRT_IS_OSX
 
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/Thread scratch buffers (peak)", threadScratchBufferBytes);
+STAT_COUNTER("Memory/Scratch buffer block allocations", nScratchBufferGrows);
+STAT_MEMORY_COUNTER("Memory/Huge page mappings", hugePageBytes);
+STAT_COUNTER("Memory/Huge page requests refused", nHugePageAdviceFailures);
+
+// Named TrackedMemoryResources, in order of creation
+static std::mutex namedResourcesMutex;
+static std::vector<const TrackedMemoryResource *> *namedResources;
+
+// TrackedMemoryResource Method Definitions
+TrackedMemoryResource::TrackedMemoryResource(const char *name,
+                                             pstd::pmr::memory_resource *source)
+    : name(name), source(source), parent(dynamic_cast<TrackedMemoryResource *>(source)) {
+    if (HugePageMemoryResource *huge = dynamic_cast<HugePageMemoryResource *>(source);
+        huge)
+        parent = huge->Tracked();
+    if (name) {
+        std::lock_guard<std::mutex> lock(namedResourcesMutex);
+        if (!namedResources)
+            namedResources = new std::vector<const TrackedMemoryResource *>;
+        namedResources->push_back(this);
+    }
+}
+
+TrackedMemoryResource::~TrackedMemoryResource() {
+    if (name) {
+        std::lock_guard<std::mutex> lock(namedResourcesMutex);
+        namedResources->erase(
+            std::find(namedResources->begin(), namedResources->end(), this));
+    }
+}
+
+std::vector<const TrackedMemoryResource *> TrackedMemoryResource::NamedResources() {
+    std::lock_guard<std::mutex> lock(namedResourcesMutex);
+    return namedResources ? *namedResources
+                          : std::vector<const TrackedMemoryResource *>();
+}
+
+// HugePageMemoryResource Method Definitions
+void *HugePageMemoryResource::do_allocate(size_t size, size_t alignment) {
+#ifdef PBRT_IS_LINUX
+    if (size >= threshold && alignment <= HugePageSize) {
+        // Map enough memory to find a huge page aligned range in it and unmap
+        // the rest
+        size_t mapSize = (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+        void *map = mmap(nullptr, mapSize + HugePageSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+            ErrorExit("Unable to map %d bytes of memory: %s", mapSize, ErrorString());
+        uintptr_t start = (uintptr_t)map;
+        uintptr_t aligned = (start + HugePageSize - 1) / HugePageSize * HugePageSize;
+        if (aligned > start)
+            munmap(map, aligned - start);
+        munmap((void *)(aligned + mapSize), start + HugePageSize - aligned);
+
+        // Request huge pages, which the kernel may not provide
+        if (madvise((void *)aligned, mapSize, MADV_HUGEPAGE) != 0)
+            ++nHugePageAdviceFailures;
+        hugePageBytes += mapSize;
+        if (tracked)
+            tracked->RecordAllocation(size);
+        return (void *)aligned;
+    }
+#endif
+    return source->allocate(size, alignment);
+}
+
+void HugePageMemoryResource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+#ifdef PBRT_IS_LINUX
+    if (bytes >= threshold && alignment <= HugePageSize) {
+        munmap(p, (bytes + HugePageSize - 1) / HugePageSize * HugePageSize);
+        if (tracked)
+            tracked->RecordDeallocation(bytes);
+        return;
+    }
+#endif
+    source->deallocate(p, bytes, alignment);
+}
+
+// Returns a _HugePageMemoryResource_ over _source_ if the subsystem with the
+// given name is listed in the --huge-pages option and _source_ otherwise
+static pstd::pmr::memory_resource *HugePageSource(const char *name,
+                                                  pstd::pmr::memory_resource *source) {
+    if (!Options || Options->hugePages.empty())
+        return source;
+    for (const std::string &s : SplitString(Options->hugePages, ','))
+        if (s == name)
+            return new HugePageMemoryResource(source);
+    return source;
+}
+
+TrackedMemoryResource *SubsystemMemory(MemorySubsystem subsystem) {
+    // Create the subsystems' resources the first time one is needed
+    static TrackedMemoryResource scene(
+        "Scene", HugePageSource("scene", pstd::pmr::get_default_resource()));
+    static TrackedMemoryResource textures("Textures", HugePageSource("textures", &scene));
+    static TrackedMemoryResource materials("Materials",
+                                           HugePageSource("materials", &scene));
+    static TrackedMemoryResource lights("Lights", HugePageSource("lights", &scene));
+    static TrackedMemoryResource media("Media", HugePageSource("media", &scene));
+    static TrackedMemoryResource film("Film and camera", HugePageSource("film", &scene));
+    static TrackedMemoryResource geometry("Geometry",
+                                          HugePageSource("geometry", &scene));
+    static TrackedMemoryResource meshes("Meshes", HugePageSource("meshes", &geometry));
+    static TrackedMemoryResource bvh("BVH", HugePageSource("bvh", &geometry));
+
+    switch (subsystem) {
+    case MemorySubsystem::Scene:
+        return &scene;
+    case MemorySubsystem::Textures:
+        return &textures;
+    case MemorySubsystem::Materials:
+        return &materials;
+    case MemorySubsystem::Lights:
+        return &lights;
+    case MemorySubsystem::Media:
+        return &media;
+    case MemorySubsystem::Film:
+        return &film;
+    case MemorySubsystem::Geometry:
+        return &geometry;
+    case MemorySubsystem::Meshes:
+        return &meshes;
+    case MemorySubsystem::BVH:
+        return &bvh;
+    }
+    LOG_FATAL("Unhandled MemorySubsystem");
+    return nullptr;
+}
+
+static size_t RoundUpToCacheLine(size_t size) {
+    return (size + PBRT_L1_CACHE_LINE_SIZE - 1) / PBRT_L1_CACHE_LINE_SIZE *
+           PBRT_L1_CACHE_LINE_SIZE;
+}
+
+// ScratchBuffer Method Definitions
+ScratchBuffer::~ScratchBuffer() {
+    for (const std::pair<uint8_t *, size_t> &block : retiredBlocks)
+        Allocator().deallocate_bytes(block.first, block.second, align);
+    Allocator().deallocate_bytes(ptr, allocatedBytes, align);
+}
+
+void ScratchBuffer::Grow(size_t minSize) {
+    // Start a new block, leaving the current one's allocations valid until
+    // the next Reset()
+    ++nScratchBufferGrows;
+    if (ptr) {
+        retiredBlocks.push_back({ptr, allocatedBytes});
+        retiredBytes += offset;
+    }
+    allocatedBytes = RoundUpToCacheLine(std::max(2 * allocatedBytes, minSize));
+    ptr = (uint8_t *)Allocator().allocate_bytes(allocatedBytes, align);
+    offset = 0;
+}
+
+void ScratchBuffer::Resize() {
+    highWaterBytes = std::max(highWaterBytes, recentPeakBytes);
+    size_t newSize = allocatedBytes;
+    if (!retiredBlocks.empty()) {
+        // Free the earlier blocks and replace the current one with a block
+        // that holds as much as was allocated from all of them
+        for (const std::pair<uint8_t *, size_t> &block : retiredBlocks)
+            Allocator().deallocate_bytes(block.first, block.second, align);
+        retiredBlocks.clear();
+        retiredBytes = 0;
+        newSize = std::max(allocatedBytes, RoundUpToCacheLine(recentPeakBytes));
+    } else if (allocatedBytes > 4 * std::max(recentPeakBytes, initialBytes))
+        // Shrink the buffer if it is much larger than recent use needed
+        newSize = std::max(initialBytes, RoundUpToCacheLine(2 * recentPeakBytes));
+    // Start measuring use for the next check from here
+    nResets = 0;
+    recentPeakBytes = 0;
+
+    if (newSize != allocatedBytes) {
+        Allocator().deallocate_bytes(ptr, allocatedBytes, align);
+        allocatedBytes = newSize;
+        ptr = (uint8_t *)Allocator().allocate_bytes(allocatedBytes, align);
+    }
+}
+
+ScratchBuffer &ThreadScratchBuffer() {
+    thread_local ScratchBuffer buffer(65536);
+    threadScratchBufferBytes =
+        std::max<int64_t>(threadScratchBufferBytes, buffer.AllocatedBytes());
+    return buffer;
+}
+
 /*
  * Author:  David Robert Nadeau
  * Site:    http://NadeauSoftware.com/
@@ -75,4 +270,59 @@ size_t GetCurrentRSS() {
 #endif
 }
 
+// Returns the physical memory that is available for new allocations, in bytes,
+// or zero if it cannot be determined.
+size_t GetAvailableMemory() {
+#ifdef PBRT_IS_WINDOWS
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status))
+        return 0;
+    return (size_t)status.ullAvailPhys;
+#elif defined(PBRT_IS_OSX)
+    vm_statistics64_data_t info;
+    mach_msg_type_number_t infoCount = HOST_VM_INFO64_COUNT;
+    if (host_statistics64(mach_host_self(), HOST_VM_INFO64, (host_info64_t)&info,
+                          &infoCount) != KERN_SUCCESS)
+        return 0;
+    return (size_t)(info.free_count + info.inactive_count) * (size_t)vm_page_size;
+#elif defined(PBRT_IS_LINUX)
+    // MemAvailable includes the page cache that the kernel can reclaim, which
+    // the count of free pages from sysconf() doesn't
+    if (FILE *fp = fopen("/proc/meminfo", "r"); fp) {
+        char line[256];
+        long long kb;
+        while (fgets(line, sizeof(line), fp))
+            if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) {
+                fclose(fp);
+                return (size_t)kb * 1024;
+            }
+        fclose(fp);
+    }
+    return (size_t)sysconf(_SC_AVPHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+// Returns the largest resident set size the process has had so far, in bytes,
+// or zero if it cannot be determined.
+size_t GetPeakRSS() {
+#ifdef PBRT_IS_WINDOWS
+    PROCESS_MEMORY_COUNTERS info;
+    GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info));
+    return (size_t)info.PeakWorkingSetSize;
+#else
+    struct rusage rusage;
+    if (getrusage(RUSAGE_SELF, &rusage) != 0)
+        return 0;
+#ifdef PBRT_IS_OSX
+    // macOS reports bytes; other systems report kilobytes.
+    return (size_t)rusage.ru_maxrss;
+#else
+    return (size_t)rusage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
 }  // namespace pbrt
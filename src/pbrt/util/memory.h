@@ -11,48 +11,148 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/pstd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstddef>
 #include <memory>
 #include <mutex>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace pbrt {
 
 size_t GetCurrentRSS();
+size_t GetPeakRSS();
+size_t GetAvailableMemory();
 
+// TrackedMemoryResource Definition
+// Counts the bytes currently allocated through it and their peak. Resources
+// may be given a name, in which case they are reported by --stats; those whose
+// source is another tracked resource, possibly through a
+// _HugePageMemoryResource_, are reported under it, which also counts their
+// allocations, so that memory use can be broken down hierarchically.
 class TrackedMemoryResource : public pstd::pmr::memory_resource {
   public:
+    // TrackedMemoryResource Public Methods
     TrackedMemoryResource(
         pstd::pmr::memory_resource *source = pstd::pmr::get_default_resource())
-        : source(source) {}
+        : TrackedMemoryResource(nullptr, source) {}
+    TrackedMemoryResource(
+        const char *name,
+        pstd::pmr::memory_resource *source = pstd::pmr::get_default_resource());
+    ~TrackedMemoryResource();
+
+    TrackedMemoryResource(const TrackedMemoryResource &) = delete;
+    TrackedMemoryResource &operator=(const TrackedMemoryResource &) = delete;
 
     void *do_allocate(size_t size, size_t alignment) {
         void *ptr = source->allocate(size, alignment);
-        uint64_t currentBytes = allocatedBytes.fetch_add(size) + size;
-        uint64_t prevMax = maxAllocatedBytes.load(std::memory_order_relaxed);
-        while (prevMax < currentBytes &&
-               !maxAllocatedBytes.compare_exchange_weak(prevMax, currentBytes))
-            ;
+        record(size);
         return ptr;
     }
     void do_deallocate(void *p, size_t bytes, size_t alignment) {
         source->deallocate(p, bytes, alignment);
-        allocatedBytes -= bytes;
+        record(-int64_t(bytes));
     }
 
     bool do_is_equal(const memory_resource &other) const noexcept {
         return this == &other;
     }
 
+    // Account for memory that its user allocates by other means, such as
+    // operator new[]; it is also counted by the resource's parents
+    void RecordAllocation(size_t bytes) {
+        for (TrackedMemoryResource *r = this; r; r = r->parent)
+            r->record(bytes);
+    }
+    void RecordDeallocation(size_t bytes) {
+        for (TrackedMemoryResource *r = this; r; r = r->parent)
+            r->record(-int64_t(bytes));
+    }
+
     size_t CurrentAllocatedBytes() const { return allocatedBytes.load(); }
     size_t MaxAllocatedBytes() const { return maxAllocatedBytes.load(); }
+    const char *Name() const { return name; }
+    const TrackedMemoryResource *Parent() const { return parent; }
+    TrackedMemoryResource *Parent() { return parent; }
+
+    // Returns the named resources that currently exist, in order of creation
+    static std::vector<const TrackedMemoryResource *> NamedResources();
 
   private:
+    // TrackedMemoryResource Private Methods
+    void record(int64_t bytes) {
+        uint64_t currentBytes = allocatedBytes.fetch_add(bytes) + bytes;
+        uint64_t prevMax = maxAllocatedBytes.load(std::memory_order_relaxed);
+        while (prevMax < currentBytes &&
+               !maxAllocatedBytes.compare_exchange_weak(prevMax, currentBytes))
+            ;
+    }
+
+    // TrackedMemoryResource Private Members
+    const char *name;
     pstd::pmr::memory_resource *source;
+    TrackedMemoryResource *parent;
     std::atomic<uint64_t> allocatedBytes{0}, maxAllocatedBytes{0};
 };
 
+// HugePageMemoryResource Definition
+// Allocates blocks of at least _threshold_ bytes from anonymous memory mappings
+// that are aligned to 2MB and marked with MADV_HUGEPAGE so that the kernel backs
+// them with transparent huge pages, which reduces TLB misses when large
+// read-mostly structures are accessed incoherently. Smaller allocations, and
+// all allocations on systems other than Linux, are passed to _source_.
+class HugePageMemoryResource : public pstd::pmr::memory_resource {
+  public:
+    // HugePageMemoryResource Public Methods
+    HugePageMemoryResource(
+        pstd::pmr::memory_resource *source = pstd::pmr::get_default_resource(),
+        size_t threshold = HugePageSize)
+        : source(source),
+          tracked(dynamic_cast<TrackedMemoryResource *>(source)),
+          threshold(threshold) {}
+
+    void *do_allocate(size_t size, size_t alignment);
+    void do_deallocate(void *p, size_t bytes, size_t alignment);
+
+    bool do_is_equal(const memory_resource &other) const noexcept {
+        return this == &other;
+    }
+
+    TrackedMemoryResource *Tracked() const { return tracked; }
+
+    static constexpr size_t HugePageSize = 2 << 20;
+
+  private:
+    // HugePageMemoryResource Private Members
+    pstd::pmr::memory_resource *source;
+    // Huge page allocations bypass _source_, so they are recorded with it
+    // directly if it is tracked
+    TrackedMemoryResource *tracked;
+    size_t threshold;
+};
+
+// MemorySubsystem Definition
+enum class MemorySubsystem {
+    Scene,
+    Textures,
+    Materials,
+    Lights,
+    Media,
+    Film,
+    Geometry,
+    Meshes,
+    BVH
+};
+
+// Returns the named tracked resource for the given subsystem of the scene. All
+// of them are nested under _Scene_'s; meshes and BVHs are under _Geometry_'s.
+// The large allocations of the subsystems listed by the --huge-pages option,
+// and of the subsystems nested under them, are made with a
+// _HugePageMemoryResource_.
+TrackedMemoryResource *SubsystemMemory(MemorySubsystem subsystem);
+
 template <typename T>
 struct AllocationTraits {
     using SingleObject = T *;
@@ -67,33 +167,36 @@ struct AllocationTraits<T[n]> {
 };
 
 // ScratchBuffer Definition
+// A ScratchBuffer is an arena for short-lived allocations that are freed all
+// at once by Reset(). If an allocation doesn't fit, the buffer starts a new,
+// larger block on the CPU; earlier blocks stay valid and are consolidated into
+// one block of the combined size at the next Reset(). Buffers shrink again if
+// they are much larger than recent use has needed, so that a single unusually
+// large allocation doesn't hold on to memory indefinitely.
 class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
   public:
+    // ScratchBuffer Public Types
+    // Records a point in the sequence of allocations; see ScratchScope
+    struct Mark {
+        size_t nRetiredBlocks, offset;
+    };
+
     // ScratchBuffer Public Methods
     ScratchBuffer() = default;
-    ScratchBuffer(int size) : allocatedBytes(size) {
+    ScratchBuffer(int size) : allocatedBytes(size), initialBytes(size) {
         ptr = (uint8_t *)Allocator().allocate_bytes(size, align);
     }
 
     ScratchBuffer(const ScratchBuffer &) = delete;
 
-    ScratchBuffer(ScratchBuffer &&b) {
-        ptr = b.ptr;
-        allocatedBytes = b.allocatedBytes;
-        offset = b.offset;
-
-        b.ptr = nullptr;
-        b.allocatedBytes = b.offset = 0;
-    }
+    ScratchBuffer(ScratchBuffer &&b) { swap(b); }
 
-    ~ScratchBuffer() { Allocator().deallocate_bytes(ptr, allocatedBytes, align); }
+    ~ScratchBuffer();
 
     ScratchBuffer &operator=(const ScratchBuffer &) = delete;
 
     ScratchBuffer &operator=(ScratchBuffer &&b) {
-        std::swap(b.ptr, ptr);
-        std::swap(b.allocatedBytes, allocatedBytes);
-        std::swap(b.offset, offset);
+        swap(b);
         return *this;
     }
 
@@ -101,7 +204,14 @@ class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
     void *Alloc(size_t size, size_t align) {
         if ((offset % align) != 0)
             offset += align - (offset % align);
-        CHECK_LE(offset + size, allocatedBytes);
+        if (offset + size > allocatedBytes) {
+#ifdef PBRT_IS_GPU_CODE
+            CHECK_LE(offset + size, allocatedBytes);
+#else
+            Grow(size + align);
+            return Alloc(size, align);
+#endif
+        }
         void *p = ptr + offset;
         offset += size;
         return p;
@@ -124,15 +234,83 @@ class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
     }
 
     PBRT_CPU_GPU
-    void Reset() { offset = 0; }
+    void Reset() {
+        recentPeakBytes = std::max(recentPeakBytes, retiredBytes + offset);
+        offset = 0;
+#ifndef PBRT_IS_GPU_CODE
+        if (!retiredBlocks.empty() || ++nResets == resizeCheckResets)
+            Resize();
+#endif
+    }
+
+    Mark GetMark() const { return Mark{retiredBlocks.size(), offset}; }
+    // Frees the allocations made since _mark_ was taken if the buffer hasn't
+    // grown since; otherwise they are freed by the next Reset()
+    void Release(Mark mark) {
+        if (mark.nRetiredBlocks == 0 && mark.offset == 0)
+            Reset();
+        else if (mark.nRetiredBlocks == retiredBlocks.size()) {
+            recentPeakBytes = std::max(recentPeakBytes, retiredBytes + offset);
+            offset = mark.offset;
+        }
+    }
+
+    // Returns the largest number of bytes that have been allocated between
+    // resets, as of the last time the buffer was resized or checked
+    size_t HighWaterBytes() const { return highWaterBytes; }
+    size_t AllocatedBytes() const { return allocatedBytes; }
 
   private:
+    // ScratchBuffer Private Methods
+    void Grow(size_t minSize);
+    void Resize();
+
+    void swap(ScratchBuffer &b) {
+        std::swap(ptr, b.ptr);
+        std::swap(allocatedBytes, b.allocatedBytes);
+        std::swap(offset, b.offset);
+        std::swap(initialBytes, b.initialBytes);
+        std::swap(retiredBlocks, b.retiredBlocks);
+        std::swap(retiredBytes, b.retiredBytes);
+        std::swap(recentPeakBytes, b.recentPeakBytes);
+        std::swap(highWaterBytes, b.highWaterBytes);
+        std::swap(nResets, b.nResets);
+    }
+
     // ScratchBuffer Private Members
     static constexpr int align = PBRT_L1_CACHE_LINE_SIZE;
+    // Number of calls to Reset() between checks for whether to shrink
+    static constexpr int resizeCheckResets = 65536;
     uint8_t *ptr = nullptr;
-    int allocatedBytes = 0, offset = 0;
+    size_t allocatedBytes = 0, offset = 0, initialBytes = 0;
+    // Earlier blocks that are still in use, and the bytes used in them
+    std::vector<std::pair<uint8_t *, size_t>> retiredBlocks;
+    size_t retiredBytes = 0;
+    size_t recentPeakBytes = 0, highWaterBytes = 0;
+    int nResets = 0;
+};
+
+// ScratchScope Definition
+// Frees the memory allocated from a ScratchBuffer during the scope's lifetime
+// when it ends, leaving earlier allocations in place.
+class ScratchScope {
+  public:
+    explicit ScratchScope(ScratchBuffer &buffer)
+        : buffer(buffer), mark(buffer.GetMark()) {}
+    ~ScratchScope() { buffer.Release(mark); }
+
+    ScratchScope(const ScratchScope &) = delete;
+    ScratchScope &operator=(const ScratchScope &) = delete;
+
+  private:
+    ScratchBuffer &buffer;
+    ScratchBuffer::Mark mark;
 };
 
+// Returns a ScratchBuffer that only the calling thread uses; it starts out
+// with 64kB and grows as needed.
+ScratchBuffer &ThreadScratchBuffer();
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_MEMORY_H
@@ -0,0 +1,138 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/memory.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace pbrt;
+
+TEST(ScratchBuffer, Grow) {
+    ScratchBuffer buf(256);
+    // Allocations that don't fit in the first block start new ones and leave
+    // earlier ones intact
+    uint8_t *a = buf.Alloc<uint8_t[]>(200);
+    memset(a, 1, 200);
+    uint8_t *b = buf.Alloc<uint8_t[]>(1000);
+    memset(b, 2, 1000);
+    for (int i = 0; i < 200; ++i)
+        EXPECT_EQ(1, a[i]);
+    EXPECT_EQ(0, (uintptr_t)b % alignof(std::max_align_t));
+
+    // After a reset, everything fits in a single block
+    buf.Reset();
+    EXPECT_GE(buf.AllocatedBytes(), 1200);
+    EXPECT_GE(buf.HighWaterBytes(), 1200);
+    size_t allocated = buf.AllocatedBytes();
+    (void)buf.Alloc<uint8_t[]>(1100);
+    buf.Reset();
+    EXPECT_EQ(allocated, buf.AllocatedBytes());
+}
+
+TEST(ScratchBuffer, Shrink) {
+    ScratchBuffer buf(256);
+    (void)buf.Alloc<uint8_t[]>(1 << 20);
+    buf.Reset();
+    EXPECT_GE(buf.AllocatedBytes(), 1 << 20);
+
+    // The buffer shrinks once many resets haven't needed the space
+    for (int i = 0; i < 100000; ++i) {
+        (void)buf.Alloc<uint8_t[]>(100);
+        buf.Reset();
+    }
+    EXPECT_LT(buf.AllocatedBytes(), 1024);
+    EXPECT_GE(buf.HighWaterBytes(), 1 << 20);
+}
+
+TEST(ScratchBuffer, Scope) {
+    ScratchBuffer buf(1024);
+    int *outer = buf.Alloc<int>(17);
+    int *inner;
+    {
+        ScratchScope scope(buf);
+        inner = buf.Alloc<int>(3);
+    }
+    // Memory allocated in the scope is reused; earlier allocations are kept
+    int *reused = buf.Alloc<int>(4);
+    EXPECT_EQ(inner, reused);
+    EXPECT_EQ(17, *outer);
+
+    // Allocations in a scope that grows the buffer are freed by Reset()
+    {
+        ScratchScope scope(buf);
+        (void)buf.Alloc<uint8_t[]>(4096);
+    }
+    EXPECT_EQ(17, *outer);
+    buf.Reset();
+    EXPECT_GE(buf.AllocatedBytes(), 4096);
+}
+
+TEST(TrackedMemoryResource, Hierarchy) {
+    TrackedMemoryResource parent("Parent");
+    TrackedMemoryResource child("Child", &parent);
+    EXPECT_EQ(&parent, child.Parent());
+    EXPECT_EQ(nullptr, parent.Parent());
+
+    // Allocations through the child are also counted by its parent
+    Allocator childAlloc(&child), parentAlloc(&parent);
+    int *a = childAlloc.allocate_object<int>(100);
+    int *b = parentAlloc.allocate_object<int>(50);
+    EXPECT_EQ(100 * sizeof(int), child.CurrentAllocatedBytes());
+    EXPECT_EQ(150 * sizeof(int), parent.CurrentAllocatedBytes());
+
+    // So is memory that is recorded as allocated by other means
+    child.RecordAllocation(1000);
+    EXPECT_EQ(1000 + 100 * sizeof(int), child.CurrentAllocatedBytes());
+    EXPECT_EQ(1000 + 150 * sizeof(int), parent.CurrentAllocatedBytes());
+    child.RecordDeallocation(1000);
+
+    // Peak values remain after memory is freed
+    childAlloc.deallocate_object(a, 100);
+    parentAlloc.deallocate_object(b, 50);
+    EXPECT_EQ(0, child.CurrentAllocatedBytes());
+    EXPECT_EQ(0, parent.CurrentAllocatedBytes());
+    EXPECT_EQ(1000 + 100 * sizeof(int), child.MaxAllocatedBytes());
+    EXPECT_EQ(1000 + 150 * sizeof(int), parent.MaxAllocatedBytes());
+
+    // Only named resources are reported
+    TrackedMemoryResource unnamed;
+    std::vector<const TrackedMemoryResource *> named =
+        TrackedMemoryResource::NamedResources();
+    EXPECT_NE(named.end(), std::find(named.begin(), named.end(), &child));
+    EXPECT_EQ(named.end(), std::find(named.begin(), named.end(), &unnamed));
+}
+
+TEST(HugePageMemoryResource, Allocate) {
+    TrackedMemoryResource parent("Parent");
+    HugePageMemoryResource huge(&parent);
+    TrackedMemoryResource child("Child", &huge);
+    EXPECT_EQ(&parent, child.Parent());
+
+    // Large allocations are huge page aligned and are counted by the parent
+    // even though they don't come from it
+    Allocator alloc(&child);
+    size_t n = 2 * HugePageMemoryResource::HugePageSize + 100;
+    std::byte *large = alloc.allocate_object<std::byte>(n);
+#ifdef PBRT_IS_LINUX
+    EXPECT_EQ(0, (uintptr_t)large % HugePageMemoryResource::HugePageSize);
+#endif
+    memset(large, 1, n);
+    EXPECT_EQ(n, child.CurrentAllocatedBytes());
+    EXPECT_EQ(n, parent.CurrentAllocatedBytes());
+
+    // Small ones pass through to the parent
+    int *small = alloc.allocate_object<int>(10);
+    EXPECT_EQ(n + 10 * sizeof(int), parent.CurrentAllocatedBytes());
+
+    alloc.deallocate_object(small, 10);
+    alloc.deallocate_object(large, n);
+    EXPECT_EQ(0, child.CurrentAllocatedBytes());
+    EXPECT_EQ(0, parent.CurrentAllocatedBytes());
+}
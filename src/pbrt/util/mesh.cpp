@@ -7,23 +7,30 @@
 #include <pbrt/util/buffercache.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/string.h>
 #include <pbrt/util/transform.h>
 
 #include <rply/rply.h>
 
+#include <algorithm>
+#include <cstring>
+
 namespace pbrt {
 
 STAT_RATIO("Geometry/Triangles per mesh", nTris, nTriMeshes);
 STAT_MEMORY_COUNTER("Memory/Triangles", triangleBytes);
+STAT_COUNTER("Geometry/Compressed triangle meshes", nCompressedMeshes);
 
 // TriangleMesh Method Definitions
 TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrientation,
                            std::vector<int> indices, std::vector<Point3f> p,
                            std::vector<Vector3f> s, std::vector<Normal3f> n,
-                           std::vector<Point2f> uv, std::vector<int> faceIndices)
+                           std::vector<Point2f> uv, std::vector<int> faceIndices,
+                           bool compress)
     : nTriangles(indices.size() / 3), nVertices(p.size()) {
     CHECK_EQ((indices.size() % 3), 0);
     ++nTriMeshes;
@@ -35,7 +42,23 @@ TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrient
     // Transform mesh vertices to rendering space and initialize mesh _p_
     for (Point3f &pt : p)
         pt = renderFromObject(pt);
-    this->p = point3BufferCache->LookupOrAdd(p);
+    if (compress) {
+        // Quantize positions to 16 bits per axis over the mesh's bounds
+        ++nCompressedMeshes;
+        Bounds3f bounds;
+        for (const Point3f &pt : p)
+            bounds = Union(bounds, pt);
+        pQuantizedMin = bounds.pMin;
+        pQuantizedScale = bounds.Diagonal() / 65535;
+        std::vector<uint16_t> q(3 * p.size());
+        for (size_t i = 0; i < p.size(); ++i)
+            for (int c = 0; c < 3; ++c)
+                if (pQuantizedScale[c] > 0)
+                    q[3 * i + c] = pstd::round(Clamp(
+                        (p[i][c] - pQuantizedMin[c]) / pQuantizedScale[c], 0, 65535));
+        pQuantized = uint16BufferCache->LookupOrAdd(q);
+    } else
+        this->p = point3BufferCache->LookupOrAdd(p);
 
     // Remainder of _TriangleMesh_ constructor
     this->reverseOrientation = reverseOrientation;
@@ -43,7 +66,20 @@ TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrient
 
     if (!uv.empty()) {
         CHECK_EQ(nVertices, uv.size());
-        this->uv = point2BufferCache->LookupOrAdd(uv);
+        // Half floats are only precise enough for texture coordinates near $[0,1]$
+        bool halfUVs = compress && std::all_of(uv.begin(), uv.end(), [](Point2f st) {
+                           return std::abs(st.x) <= 2 && std::abs(st.y) <= 2;
+                       });
+        if (halfUVs) {
+            std::vector<Half> uvh;
+            uvh.reserve(2 * uv.size());
+            for (Point2f st : uv) {
+                uvh.push_back(Half(st.x));
+                uvh.push_back(Half(st.y));
+            }
+            uvHalf = halfBufferCache->LookupOrAdd(uvh);
+        } else
+            this->uv = point2BufferCache->LookupOrAdd(uv);
     }
     if (!n.empty()) {
         CHECK_EQ(nVertices, n.size());
@@ -52,7 +88,18 @@ TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrient
             if (reverseOrientation)
                 nn = -nn;
         }
-        this->n = normal3BufferCache->LookupOrAdd(n);
+        if (compress) {
+            // Store unit normals as octahedral vectors; degenerate ones, which
+            // can't be encoded, are replaced with an arbitrary direction
+            std::vector<OctahedralVector> nOct;
+            nOct.reserve(n.size());
+            for (Normal3f nn : n) {
+                Vector3f v = LengthSquared(nn) > 0 ? Vector3f(nn) : Vector3f(0, 0, 1);
+                nOct.push_back(OctahedralVector(v));
+            }
+            nOctahedral = octahedralBufferCache->LookupOrAdd(nOct);
+        } else
+            this->n = normal3BufferCache->LookupOrAdd(n);
     }
     if (!s.empty()) {
         CHECK_EQ(nVertices, s.size());
@@ -80,7 +127,7 @@ std::string TriangleMesh::ToString() const {
     return StringPrintf(
         "[ TriangleMesh reverseOrientation: %s transformSwapsHandedness: %s "
         "nTriangles: %d nVertices: %d vertexIndices: %s p: %s n: %s "
-        "s: %s uv: %s faceIndices: %s ]",
+        "s: %s uv: %s faceIndices: %s compressed: %s ]",
         reverseOrientation, transformSwapsHandedness, nTriangles, nVertices,
         vertexIndices ? StringPrintf("%s", pstd::MakeSpan(vertexIndices, 3 * nTriangles))
                       : np,
@@ -89,7 +136,8 @@ std::string TriangleMesh::ToString() const {
         s ? StringPrintf("%s", pstd::MakeSpan(s, nVertices)) : nullptr,
         uv ? StringPrintf("%s", pstd::MakeSpan(uv, nVertices)) : nullptr,
         faceIndices ? StringPrintf("%s", pstd::MakeSpan(faceIndices, nTriangles))
-                    : nullptr);
+                    : nullptr,
+        pQuantized != nullptr);
 }
 
 static void PlyErrorCallback(p_ply, const char *message) {
@@ -106,12 +154,12 @@ bool TriangleMesh::WritePLY(const std::string &filename) const {
     ply_add_scalar_property(plyFile, "x", PLY_FLOAT);
     ply_add_scalar_property(plyFile, "y", PLY_FLOAT);
     ply_add_scalar_property(plyFile, "z", PLY_FLOAT);
-    if (n != nullptr) {
+    if (HasNormals()) {
         ply_add_scalar_property(plyFile, "nx", PLY_FLOAT);
         ply_add_scalar_property(plyFile, "ny", PLY_FLOAT);
         ply_add_scalar_property(plyFile, "nz", PLY_FLOAT);
     }
-    if (uv != nullptr) {
+    if (HasUVs()) {
         ply_add_scalar_property(plyFile, "u", PLY_FLOAT);
         ply_add_scalar_property(plyFile, "v", PLY_FLOAT);
     }
@@ -126,17 +174,20 @@ bool TriangleMesh::WritePLY(const std::string &filename) const {
     ply_write_header(plyFile);
 
     for (int i = 0; i < nVertices; ++i) {
-        ply_write(plyFile, p[i].x);
-        ply_write(plyFile, p[i].y);
-        ply_write(plyFile, p[i].z);
-        if (n != nullptr) {
-            ply_write(plyFile, n[i].x);
-            ply_write(plyFile, n[i].y);
-            ply_write(plyFile, n[i].z);
+        Point3f pi = P(i);
+        ply_write(plyFile, pi.x);
+        ply_write(plyFile, pi.y);
+        ply_write(plyFile, pi.z);
+        if (HasNormals()) {
+            Normal3f ni = N(i);
+            ply_write(plyFile, ni.x);
+            ply_write(plyFile, ni.y);
+            ply_write(plyFile, ni.z);
         }
-        if (uv != nullptr) {
-            ply_write(plyFile, uv[i].x);
-            ply_write(plyFile, uv[i].y);
+        if (HasUVs()) {
+            Point2f uvi = UV(i);
+            ply_write(plyFile, uvi.x);
+            ply_write(plyFile, uvi.y);
         }
     }
 
@@ -296,7 +347,297 @@ int rply_faceindex_callback(p_ply_argument argument) {
     return 1;
 }
 
-TriQuadMesh TriQuadMesh::ReadPLY(const std::string &filename) {
+STAT_COUNTER("Geometry/PLY files read from memory", nPLYFilesMapped);
+STAT_COUNTER("Geometry/PLY files read with rply", nPLYFilesRply);
+
+// PLYProperty Definition
+struct PLYProperty {
+    std::string name;
+    // Size in bytes of the property's value or, for lists, of each item
+    int size = 0;
+    bool isFloat = false, isSigned = false;
+    // Size in bytes of the item count for list properties; zero otherwise
+    int countSize = 0;
+    bool countIsSigned = false;
+};
+
+// PLYElement Definition
+struct PLYElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PLYProperty> properties;
+};
+
+static bool parsePLYType(const std::string &type, int *size, bool *isFloat,
+                         bool *isSigned) {
+    static const struct {
+        const char *name;
+        int size;
+        bool isFloat, isSigned;
+    } types[] = {{"char", 1, false, true},    {"int8", 1, false, true},
+                 {"uchar", 1, false, false},  {"uint8", 1, false, false},
+                 {"short", 2, false, true},   {"int16", 2, false, true},
+                 {"ushort", 2, false, false}, {"uint16", 2, false, false},
+                 {"int", 4, false, true},     {"int32", 4, false, true},
+                 {"uint", 4, false, false},   {"uint32", 4, false, false},
+                 {"float", 4, true, true},    {"float32", 4, true, true},
+                 {"double", 8, true, true},   {"float64", 8, true, true}};
+    for (const auto &t : types)
+        if (type == t.name) {
+            *size = t.size;
+            *isFloat = t.isFloat;
+            *isSigned = t.isSigned;
+            return true;
+        }
+    return false;
+}
+
+static Float readPLYFloat(const char *ptr, const PLYProperty &prop) {
+    if (prop.size == 4) {
+        float v;
+        std::memcpy(&v, ptr, sizeof(v));
+        return v;
+    } else {
+        double v;
+        std::memcpy(&v, ptr, sizeof(v));
+        return v;
+    }
+}
+
+static int64_t readPLYInt(const char *ptr, int size, bool isSigned) {
+    switch (size) {
+    case 1:
+        return isSigned ? int64_t(int8_t(*ptr)) : int64_t(uint8_t(*ptr));
+    case 2: {
+        uint16_t v;
+        std::memcpy(&v, ptr, sizeof(v));
+        return isSigned ? int64_t(int16_t(v)) : int64_t(v);
+    }
+    default: {
+        uint32_t v;
+        std::memcpy(&v, ptr, sizeof(v));
+        return isSigned ? int64_t(int32_t(v)) : int64_t(v);
+    }
+    }
+}
+
+// Reads binary little-endian PLY files directly from a memory mapping of the
+// file, copying vertex data in bulk where possible. Returns false without
+// modifying *mesh for any other kind of file or for layouts it doesn't
+// handle, in which case the file should be read with rply.
+static bool readBinaryPLY(const std::string &filename, TriQuadMesh *mesh) {
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file)
+        return false;
+    const char *ptr = file->data(), *end = ptr + file->size();
+
+    // Parse the PLY header
+    std::vector<PLYElement> elements;
+    bool sawFormat = false;
+    for (int lineNumber = 0;; ++lineNumber) {
+        const char *eol = (const char *)memchr(ptr, '\n', end - ptr);
+        if (!eol)
+            return false;
+        std::vector<std::string> tokens =
+            SplitStringsFromWhitespace(std::string_view(ptr, eol - ptr));
+        tokens.erase(std::remove(tokens.begin(), tokens.end(), std::string()),
+                     tokens.end());
+        ptr = eol + 1;
+
+        if (lineNumber == 0) {
+            if (tokens.size() != 1 || tokens[0] != "ply")
+                return false;
+        } else if (tokens.empty() || tokens[0] == "comment" || tokens[0] == "obj_info")
+            continue;
+        else if (tokens[0] == "format") {
+            if (tokens.size() != 3 || tokens[1] != "binary_little_endian")
+                return false;
+            sawFormat = true;
+        } else if (tokens[0] == "element") {
+            if (tokens.size() != 3)
+                return false;
+            PLYElement element;
+            element.name = tokens[1];
+            element.count = std::strtoull(tokens[2].c_str(), nullptr, 10);
+            elements.push_back(element);
+        } else if (tokens[0] == "property") {
+            if (elements.empty())
+                return false;
+            PLYProperty prop;
+            if (tokens.size() == 3) {
+                if (!parsePLYType(tokens[1], &prop.size, &prop.isFloat, &prop.isSigned))
+                    return false;
+                prop.name = tokens[2];
+            } else if (tokens.size() == 5 && tokens[1] == "list") {
+                bool countIsFloat;
+                if (!parsePLYType(tokens[2], &prop.countSize, &countIsFloat,
+                                  &prop.countIsSigned) ||
+                    countIsFloat ||
+                    !parsePLYType(tokens[3], &prop.size, &prop.isFloat, &prop.isSigned))
+                    return false;
+                prop.name = tokens[4];
+            } else
+                return false;
+            elements.back().properties.push_back(prop);
+        } else if (tokens[0] == "end_header")
+            break;
+        else
+            return false;
+    }
+    if (!sawFormat)
+        return false;
+
+    TriQuadMesh m;
+    bool sawVertices = false, sawFaces = false;
+    for (const PLYElement &element : elements) {
+        // Determine the size of each element instance if its properties all
+        // have fixed sizes.
+        size_t stride = 0;
+        bool hasLists = false;
+        for (const PLYProperty &prop : element.properties) {
+            hasLists |= prop.countSize > 0;
+            stride += prop.size;
+        }
+
+        if (element.name == "vertex") {
+            if (hasLists ||
+                element.count > size_t(end - ptr) / std::max<size_t>(stride, 1))
+                return false;
+            sawVertices = true;
+
+            // Find the offsets of the properties that are used, using any
+            // of the common names for texture coordinates.
+            auto findProperty = [&](const char *name,
+                                    size_t *offset) -> const PLYProperty * {
+                *offset = 0;
+                for (const PLYProperty &prop : element.properties) {
+                    if (prop.name == name)
+                        return prop.isFloat ? &prop : nullptr;
+                    *offset += prop.size;
+                }
+                return nullptr;
+            };
+            size_t pOffset[3], nOffset[3], uvOffset[2];
+            const PLYProperty *pProp[3] = {findProperty("x", &pOffset[0]),
+                                           findProperty("y", &pOffset[1]),
+                                           findProperty("z", &pOffset[2])};
+            const PLYProperty *nProp[3] = {findProperty("nx", &nOffset[0]),
+                                           findProperty("ny", &nOffset[1]),
+                                           findProperty("nz", &nOffset[2])};
+            const PLYProperty *uvProp[2] = {nullptr, nullptr};
+            static const char *uvNameSets[][2] = {{"u", "v"},
+                                                  {"s", "t"},
+                                                  {"texture_u", "texture_v"},
+                                                  {"texture_s", "texture_t"}};
+            for (const auto &uvNames : uvNameSets) {
+                uvProp[0] = findProperty(uvNames[0], &uvOffset[0]);
+                uvProp[1] = findProperty(uvNames[1], &uvOffset[1]);
+                if (uvProp[0] && uvProp[1])
+                    break;
+            }
+            if (!pProp[0] || !pProp[1] || !pProp[2])
+                return false;
+            bool hasN = nProp[0] && nProp[1] && nProp[2];
+            bool hasUV = uvProp[0] && uvProp[1];
+
+            m.p.resize(element.count);
+            if (hasN)
+                m.n.resize(element.count);
+            if (hasUV)
+                m.uv.resize(element.count);
+
+            if (sizeof(Float) == 4 && stride == sizeof(Point3f) && pProp[0]->size == 4 &&
+                pOffset[0] == 0 && pOffset[1] == 4 && pOffset[2] == 8)
+                // The vertex positions are exactly an array of _Point3f_s
+                std::memcpy(m.p.data(), ptr, element.count * stride);
+            else
+                for (size_t i = 0; i < element.count; ++i) {
+                    const char *v = ptr + i * stride;
+                    for (int c = 0; c < 3; ++c)
+                        m.p[i][c] = readPLYFloat(v + pOffset[c], *pProp[c]);
+                    if (hasN)
+                        for (int c = 0; c < 3; ++c)
+                            m.n[i][c] = readPLYFloat(v + nOffset[c], *nProp[c]);
+                    if (hasUV)
+                        for (int c = 0; c < 2; ++c)
+                            m.uv[i][c] = readPLYFloat(v + uvOffset[c], *uvProp[c]);
+                }
+            ptr += element.count * stride;
+        } else if (element.name == "face") {
+            // Only the vertex indices list may have variable size; any
+            // other properties must be scalars.
+            const PLYProperty *indicesProp = nullptr;
+            for (const PLYProperty &prop : element.properties)
+                if (prop.name == "vertex_indices" && prop.countSize > 0 && !prop.isFloat)
+                    indicesProp = &prop;
+                else if (prop.countSize > 0 || prop.size > 4)
+                    return false;
+            if (!indicesProp)
+                return false;
+            sawFaces = true;
+
+            m.triIndices.reserve(3 * element.count);
+            for (size_t f = 0; f < element.count; ++f) {
+                for (const PLYProperty &prop : element.properties) {
+                    if (&prop != indicesProp) {
+                        if (end - ptr < prop.size)
+                            return false;
+                        if (prop.name == "face_indices" && !prop.isFloat)
+                            m.faceIndices.push_back(
+                                readPLYInt(ptr, prop.size, prop.isSigned));
+                        ptr += prop.size;
+                        continue;
+                    }
+
+                    if (end - ptr < prop.countSize)
+                        return false;
+                    int64_t length = readPLYInt(ptr, prop.countSize, prop.countIsSigned);
+                    ptr += prop.countSize;
+                    if (length < 0 || length * prop.size > end - ptr)
+                        return false;
+                    if (length != 3 && length != 4) {
+                        Warning("plymesh: Ignoring face with %i vertices (only triangles "
+                                "and quads are supported!)",
+                                int(length));
+                        ptr += length * prop.size;
+                        continue;
+                    }
+
+                    int face[4];
+                    for (int i = 0; i < length; ++i, ptr += prop.size)
+                        face[i] = int(readPLYInt(ptr, prop.size, prop.isSigned));
+                    if (length == 3)
+                        m.triIndices.insert(m.triIndices.end(), face, face + 3);
+                    else {
+                        // Note: modify order since we're specifying it as a blp...
+                        m.quadIndices.push_back(face[0]);
+                        m.quadIndices.push_back(face[1]);
+                        m.quadIndices.push_back(face[3]);
+                        m.quadIndices.push_back(face[2]);
+                    }
+                }
+            }
+        } else {
+            // Skip over other elements if possible
+            if (hasLists ||
+                element.count > size_t(end - ptr) / std::max<size_t>(stride, 1))
+                return false;
+            ptr += element.count * stride;
+        }
+    }
+
+    if (!sawVertices || !sawFaces || m.p.empty() ||
+        (m.triIndices.empty() && m.quadIndices.empty()))
+        return false;
+    if (!m.faceIndices.empty() &&
+        m.faceIndices.size() != m.triIndices.size() / 3 + m.quadIndices.size() / 4)
+        return false;
+
+    *mesh = std::move(m);
+    return true;
+}
+
+static TriQuadMesh readPLYWithRply(const std::string &filename) {
     TriQuadMesh mesh;
 
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
@@ -384,6 +725,17 @@ TriQuadMesh TriQuadMesh::ReadPLY(const std::string &filename) {
     mesh.quadIndices = std::move(context.quadIndices);
 
     ply_close(ply);
+    return mesh;
+}
+
+TriQuadMesh TriQuadMesh::ReadPLY(const std::string &filename) {
+    TriQuadMesh mesh;
+    if (readBinaryPLY(filename, &mesh))
+        ++nPLYFilesMapped;
+    else {
+        mesh = readPLYWithRply(filename);
+        ++nPLYFilesRply;
+    }
 
     for (int idx : mesh.triIndices)
         if (idx < 0 || idx >= mesh.p.size())
@@ -399,6 +751,44 @@ TriQuadMesh TriQuadMesh::ReadPLY(const std::string &filename) {
     return mesh;
 }
 
+bool TriQuadMesh::ReadPLYHeader(const std::string &filename, PLYHeader *header) {
+    p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
+    if (ply == nullptr)
+        return false;
+    if (ply_read_header(ply) == 0) {
+        ply_close(ply);
+        return false;
+    }
+
+    *header = PLYHeader();
+    p_ply_element element = nullptr;
+    while ((element = ply_get_next_element(ply, element)) != nullptr) {
+        const char *name;
+        long nInstances;
+        ply_get_element_info(element, &name, &nInstances);
+        if (strcmp(name, "face") == 0)
+            header->nFaces = nInstances;
+        else if (strcmp(name, "vertex") == 0) {
+            header->nVertices = nInstances;
+            p_ply_property property = nullptr;
+            while ((property = ply_get_next_property(element, property)) != nullptr) {
+                const char *propertyName;
+                ply_get_property_info(property, &propertyName, nullptr, nullptr,
+                                      nullptr);
+                if (strcmp(propertyName, "nx") == 0)
+                    header->hasNormals = true;
+                else if (strcmp(propertyName, "u") == 0 ||
+                         strcmp(propertyName, "s") == 0 ||
+                         strcmp(propertyName, "texture_u") == 0 ||
+                         strcmp(propertyName, "texture_s") == 0)
+                    header->hasUVs = true;
+            }
+        }
+    }
+    ply_close(ply);
+    return true;
+}
+
 void TriQuadMesh::ConvertToOnlyTriangles() {
     if (quadIndices.empty())
         return;
@@ -7,6 +7,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/float.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/vecmath.h>
 
@@ -22,7 +23,32 @@ class TriangleMesh {
     TriangleMesh(const Transform &renderFromObject, bool reverseOrientation,
                  std::vector<int> vertexIndices, std::vector<Point3f> p,
                  std::vector<Vector3f> S, std::vector<Normal3f> N,
-                 std::vector<Point2f> uv, std::vector<int> faceIndices);
+                 std::vector<Point2f> uv, std::vector<int> faceIndices,
+                 bool compress = false);
+
+    // Vertex data is accessed through these methods, which reconstruct it from
+    // its compressed representation if necessary
+    PBRT_CPU_GPU
+    Point3f P(int v) const {
+        if (p)
+            return p[v];
+        const uint16_t *q = &pQuantized[3 * v];
+        return Point3f(pQuantizedMin.x + q[0] * pQuantizedScale.x,
+                       pQuantizedMin.y + q[1] * pQuantizedScale.y,
+                       pQuantizedMin.z + q[2] * pQuantizedScale.z);
+    }
+    PBRT_CPU_GPU
+    Normal3f N(int v) const {
+        return n ? n[v] : Normal3f(Vector3f(nOctahedral[v]));
+    }
+    PBRT_CPU_GPU
+    Point2f UV(int v) const {
+        return uv ? uv[v] : Point2f(float(uvHalf[2 * v]), float(uvHalf[2 * v + 1]));
+    }
+    PBRT_CPU_GPU
+    bool HasNormals() const { return n || nOctahedral; }
+    PBRT_CPU_GPU
+    bool HasUVs() const { return uv || uvHalf; }
 
     std::string ToString() const;
 
@@ -39,6 +65,15 @@ class TriangleMesh {
     const Point2f *uv = nullptr;
     const int *faceIndices = nullptr;
     bool reverseOrientation, transformSwapsHandedness;
+    // Compressed meshes store positions quantized to 16 bits per axis over their
+    // bounds, normals as octahedral vectors, and $(u,v)$ as half floats, if they
+    // are all near $[0,1]$, in place of _p_, _n_, and _uv_. Triangles are intersected with the reconstructed
+    // positions, so they remain watertight.
+    Point3f pQuantizedMin;
+    Vector3f pQuantizedScale;
+    const uint16_t *pQuantized = nullptr;
+    const OctahedralVector *nOctahedral = nullptr;
+    const Half *uvHalf = nullptr;
 };
 
 // BilinearPatchMesh Definition
@@ -65,8 +100,17 @@ class BilinearPatchMesh {
     PiecewiseConstant2D *imageDistribution;
 };
 
+// PLYHeader Definition
+struct PLYHeader {
+    int64_t nVertices = 0, nFaces = 0;
+    bool hasNormals = false, hasUVs = false;
+};
+
 struct TriQuadMesh {
     static TriQuadMesh ReadPLY(const std::string &filename);
+    // Reads only the header of the PLY file, returning false if it can't be
+    // read.
+    static bool ReadPLYHeader(const std::string &filename, PLYHeader *header);
 
     void ConvertToOnlyTriangles();
     std::string ToString() const;
@@ -0,0 +1,148 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/mesh.h>
+
+#include <cstdint>
+#include <string>
+
+using namespace pbrt;
+
+static std::string inTestDir(const std::string &path) {
+    return path;
+}
+
+template <typename T>
+static void append(std::string *str, T v) {
+    str->append((const char *)&v, sizeof(v));
+}
+
+static void checkEqual(const TriQuadMesh &a, const TriQuadMesh &b) {
+    EXPECT_EQ(a.p, b.p);
+    EXPECT_EQ(a.n, b.n);
+    EXPECT_EQ(a.uv, b.uv);
+    EXPECT_EQ(a.faceIndices, b.faceIndices);
+    EXPECT_EQ(a.triIndices, b.triIndices);
+    EXPECT_EQ(a.quadIndices, b.quadIndices);
+}
+
+TEST(TriQuadMesh, ReadBinaryPLY) {
+    // The same mesh, as ASCII (which is read via rply) and as binary little
+    // endian with a few differently-sized types (which is read directly).
+    std::string ascii = R"(ply
+format ascii 1.0
+comment test mesh
+element vertex 5
+property float x
+property float y
+property float z
+property float nx
+property float ny
+property float nz
+property float u
+property float v
+element face 2
+property list uchar int vertex_indices
+property int face_indices
+end_header
+0 0 0 0 0 1 0 0
+1 0 0 0 0 1 1 0
+1 1 0 0 0 1 1 1
+0 1 0 0 0 1 0 1
+0.5 2 0.25 0 0 1 0.5 2
+3 0 1 4 7
+4 0 1 2 3 8
+)";
+    std::string asciiFilename = inTestDir("test-ascii.ply");
+    ASSERT_TRUE(WriteFileContents(asciiFilename, ascii));
+
+    float vertices[5][8] = {{0, 0, 0, 0, 0, 1, 0, 0},         {1, 0, 0, 0, 0, 1, 1, 0},
+                            {1, 1, 0, 0, 0, 1, 1, 1},         {0, 1, 0, 0, 0, 1, 0, 1},
+                            {0.5f, 2, 0.25f, 0, 0, 1, 0.5f, 2}};
+    std::string binary = R"(ply
+format binary_little_endian 1.0
+element vertex 5
+property double x
+property double y
+property double z
+property float nx
+property float ny
+property float nz
+property uchar red
+property float s
+property float t
+element face 2
+property int face_indices
+property list uint8 uint16 vertex_indices
+element extra 1
+property int unused
+end_header
+)";
+    for (int i = 0; i < 5; ++i) {
+        for (int c = 0; c < 3; ++c)
+            append(&binary, double(vertices[i][c]));
+        for (int c = 3; c < 6; ++c)
+            append(&binary, vertices[i][c]);
+        append(&binary, uint8_t(255));
+        for (int c = 6; c < 8; ++c)
+            append(&binary, vertices[i][c]);
+    }
+    append(&binary, int32_t(7));
+    append(&binary, uint8_t(3));
+    for (uint16_t index : {0, 1, 4})
+        append(&binary, index);
+    append(&binary, int32_t(8));
+    append(&binary, uint8_t(4));
+    for (uint16_t index : {0, 1, 2, 3})
+        append(&binary, index);
+    append(&binary, int32_t(0));
+    std::string binaryFilename = inTestDir("test-binary.ply");
+    ASSERT_TRUE(WriteFileContents(binaryFilename, binary));
+
+    TriQuadMesh asciiMesh = TriQuadMesh::ReadPLY(asciiFilename);
+    TriQuadMesh binaryMesh = TriQuadMesh::ReadPLY(binaryFilename);
+    checkEqual(asciiMesh, binaryMesh);
+    ASSERT_EQ(5, binaryMesh.p.size());
+    EXPECT_EQ(Point3f(0.5, 2, 0.25), binaryMesh.p[4]);
+    EXPECT_EQ(Point2f(0.5, 2), binaryMesh.uv[4]);
+    EXPECT_EQ((std::vector<int>{0, 1, 4}), binaryMesh.triIndices);
+    EXPECT_EQ((std::vector<int>{0, 1, 3, 2}), binaryMesh.quadIndices);
+    EXPECT_EQ((std::vector<int>{7, 8}), binaryMesh.faceIndices);
+
+    // Positions only, which are copied in bulk
+    std::string positions = R"(ply
+format binary_little_endian 1.0
+element vertex 3
+property float x
+property float y
+property float z
+element face 1
+property list uchar int vertex_indices
+end_header
+)";
+    for (int i = 0; i < 3; ++i)
+        for (int c = 0; c < 3; ++c)
+            append(&positions, vertices[i][c]);
+    append(&positions, uint8_t(3));
+    for (int32_t index : {2, 1, 0})
+        append(&positions, index);
+    std::string positionsFilename = inTestDir("test-positions.ply");
+    ASSERT_TRUE(WriteFileContents(positionsFilename, positions));
+
+    TriQuadMesh positionsMesh = TriQuadMesh::ReadPLY(positionsFilename);
+    EXPECT_EQ(
+        (std::vector<Point3f>{Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(1, 1, 0)}),
+        positionsMesh.p);
+    EXPECT_TRUE(positionsMesh.n.empty());
+    EXPECT_TRUE(positionsMesh.uv.empty());
+    EXPECT_EQ((std::vector<int>{2, 1, 0}), positionsMesh.triIndices);
+
+    EXPECT_EQ(0, remove(asciiFilename.c_str()));
+    EXPECT_EQ(0, remove(binaryFilename.c_str()));
+    EXPECT_EQ(0, remove(positionsFilename.c_str()));
+}
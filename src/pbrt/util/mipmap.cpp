@@ -11,10 +11,12 @@
 #include <pbrt/util/file.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 
 namespace pbrt {
@@ -199,29 +201,169 @@ MIPMap::MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
                   [](const Image &im) { imageMapBytes += im.BytesUsed(); });
 }
 
+MIPMap::MIPMap(pstd::vector<Image> p, const RGBColorSpace *colorSpace, WrapMode wrapMode,
+               const MIPMapFilterOptions &options)
+    : pyramid(std::move(p)),
+      colorSpace(colorSpace),
+      wrapMode(wrapMode),
+      options(options) {
+    CHECK(colorSpace != nullptr);
+    std::for_each(pyramid.begin(), pyramid.end(),
+                  [](const Image &im) { imageMapBytes += im.BytesUsed(); });
+}
+
+MIPMap::MIPMap(TiledImagePyramid *tiles, WrapMode wrapMode,
+               const MIPMapFilterOptions &options)
+    : tiles(tiles),
+      colorSpace(tiles->GetRGBColorSpace()),
+      wrapMode(wrapMode),
+      options(options) {}
+
+void MIPMap::TexelChannels(int level, Point2i st, Float *values) const {
+    if (tiles) {
+        if (!RemapPixelCoords(&st, tiles->LevelResolution(level), wrapMode)) {
+            for (int c = 0; c < tiles->NChannels(); ++c)
+                values[c] = 0;
+            return;
+        }
+        tiles->GetTexel(level, st, values);
+        return;
+    }
+
+    DCHECK(level >= 0 && level < pyramid.size());
+    const Image &image = pyramid[level];
+    int nChannels = image.NChannels();
+    if (!RemapPixelCoords(&st, image.Resolution(), wrapMode)) {
+        for (int c = 0; c < nChannels; ++c)
+            values[c] = 0;
+        return;
+    }
+    // Decode all of the texel's channels, which are stored contiguously
+    const void *texel = image.RawPointer(st);
+    switch (image.Format()) {
+    case PixelFormat::U256:
+        image.Encoding().ToLinear({(const uint8_t *)texel, size_t(nChannels)},
+                                  {values, size_t(nChannels)});
+        break;
+    case PixelFormat::Half:
+        for (int c = 0; c < nChannels; ++c)
+            values[c] = Float(((const Half *)texel)[c]);
+        break;
+    case PixelFormat::Float:
+        for (int c = 0; c < nChannels; ++c)
+            values[c] = ((const float *)texel)[c];
+        break;
+    default:
+        LOG_FATAL("Unhandled PixelFormat");
+    }
+}
+
+void MIPMap::BilerpChannels(int level, Point2f st, Float *values) const {
+    // Compute discrete texel coordinates and offsets for _st_
+    Point2i res = LevelResolution(level);
+    Float x = st[0] * res.x - 0.5f, y = st[1] * res.y - 0.5f;
+    int xi = pstd::floor(x), yi = pstd::floor(y);
+    Float dx = x - xi, dy = y - yi;
+
+    // Load texel channel values and bilinearly interpolate them
+    Float v[4][4];
+    TexelChannels(level, {xi, yi}, v[0]);
+    TexelChannels(level, {xi + 1, yi}, v[1]);
+    TexelChannels(level, {xi, yi + 1}, v[2]);
+    TexelChannels(level, {xi + 1, yi + 1}, v[3]);
+    for (int c = 0; c < LevelChannels(level); ++c)
+        values[c] = ((1 - dx) * (1 - dy) * v[0][c] + dx * (1 - dy) * v[1][c] +
+                     (1 - dx) * dy * v[2][c] + dx * dy * v[3][c]);
+}
+
+Float MIPMap::BilerpWithGradient(int level, Point2f st, Vector2f *dst) const {
+    // Compute discrete texel coordinates and offsets for _st_
+    Point2i res = LevelResolution(level);
+    Float x = st[0] * res.x - 0.5f, y = st[1] * res.y - 0.5f;
+    int xi = pstd::floor(x), yi = pstd::floor(y);
+    Float dx = x - xi, dy = y - yi;
+
+    // Load the four texels' values, reduced to a single channel as in _Bilerp()_
+    Float v[4];
+    for (int i = 0; i < 4; ++i) {
+        Float values[4];
+        TexelChannels(level, {xi + (i & 1), yi + (i >> 1)}, values);
+        switch (LevelChannels(level)) {
+        case 1:
+            v[i] = values[0];
+            break;
+        case 3:
+            v[i] = (values[0] + values[1] + values[2]) / 3;
+            break;
+        case 4:
+            v[i] = values[3];
+            break;
+        default:
+            LOG_FATAL("Unexpected number of image channels: %d", LevelChannels(level));
+        }
+    }
+
+    // Differentiate the bilinear interpolant with respect to $s$ and $t$
+    *dst = Vector2f(res.x * Lerp(dy, v[1] - v[0], v[3] - v[2]),
+                    res.y * Lerp(dx, v[2] - v[0], v[3] - v[1]));
+    return ((1 - dx) * (1 - dy) * v[0] + dx * (1 - dy) * v[1] + (1 - dx) * dy * v[2] +
+            dx * dy * v[3]);
+}
+
+Float MIPMap::FilterWithGradient(Point2f st, Vector2f dst0, Vector2f dst1,
+                                 Vector2f *dst) const {
+    CHECK(options.filter != FilterFunction::EWA);
+    TileCache::ReadScope tileScope(tiles ? tiles->GetTileCache() : nullptr);
+    // Compute MIP Map level for the filter footprint as in _Filter()_
+    Float width = 2 * std::max({std::abs(dst0[0]), std::abs(dst0[1]),
+                                std::abs(dst1[0]), std::abs(dst1[1])});
+    int nLevels = Levels();
+    Float level = nLevels - 1 + Log2(std::max<Float>(width, 1e-8));
+    if (level >= Levels() - 1) {
+        *dst = Vector2f(0, 0);
+        return Texel<Float>(Levels() - 1, {0, 0});
+    }
+    int iLevel = std::max(0, int(pstd::floor(level)));
+
+    if (options.filter != FilterFunction::Trilinear || iLevel == 0)
+        return BilerpWithGradient(iLevel, st, dst);
+    // Blend values and gradients of the two nearest levels
+    Vector2f dstNext;
+    Float delta = level - iLevel;
+    Float v0 = BilerpWithGradient(iLevel, st, dst);
+    Float v1 = BilerpWithGradient(iLevel + 1, st, &dstNext);
+    *dst = (1 - delta) * *dst + delta * dstNext;
+    return Lerp(delta, v0, v1);
+}
+
+// Converts the channel values of a texel to the type of a texture lookup
+template <typename T>
+static T texelValue(const Float *values, int nChannels);
+
 template <>
-Float MIPMap::Texel(int level, Point2i st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    return pyramid[level].GetChannel(st, 0, wrapMode);
+Float texelValue(const Float *values, int nChannels) {
+    return values[0];
 }
 
 template <>
-RGB MIPMap::Texel(int level, Point2i st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    if (pyramid[level].NChannels() == 3 || pyramid[level].NChannels() == 4) {
-        RGB rgb;
-        for (int c = 0; c < 3; ++c)
-            rgb[c] = pyramid[level].GetChannel(st, c, wrapMode);
-        return rgb;
-    } else {
-        CHECK_EQ(1, pyramid[level].NChannels());
-        Float v = pyramid[level].GetChannel(st, 0, wrapMode);
-        return RGB(v, v, v);
-    }
+RGB texelValue(const Float *values, int nChannels) {
+    if (nChannels == 1)
+        return RGB(values[0], values[0], values[0]);
+    return RGB(values[0], values[1], values[2]);
+}
+
+template <typename T>
+T MIPMap::Texel(int level, Point2i st) const {
+    Float values[4];
+    TexelChannels(level, st, values);
+    return texelValue<T>(values, LevelChannels(level));
 }
 
 template <typename T>
 T MIPMap::Filter(Point2f st, Vector2f dst0, Vector2f dst1) const {
+    // Keep tiles that the lookup uses in memory until it is done
+    TileCache::ReadScope tileScope(tiles ? tiles->GetTileCache() : nullptr);
+
     if (options.filter != FilterFunction::EWA) {
         // Handle non-EWA MIP Map filter
         Float width = 2 * std::max({std::abs(dst0[0]), std::abs(dst0[1]),
@@ -279,17 +421,9 @@ T MIPMap::Filter(Point2f st, Vector2f dst0, Vector2f dst1) const {
 
 template <>
 RGB MIPMap::Bilerp(int level, Point2f st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    if (pyramid[level].NChannels() == 3 || pyramid[level].NChannels() == 4) {
-        RGB rgb;
-        for (int c = 0; c < 3; ++c)
-            rgb[c] = pyramid[level].BilerpChannel(st, c, wrapMode);
-        return rgb;
-    } else {
-        CHECK_EQ(1, pyramid[level].NChannels());
-        Float v = pyramid[level].BilerpChannel(st, 0, wrapMode);
-        return RGB(v, v, v);
-    }
+    Float values[4];
+    BilerpChannels(level, st, values);
+    return texelValue<RGB>(values, LevelChannels(level));
 }
 
 template <typename T>
@@ -324,28 +458,45 @@ T MIPMap::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     int t1 = pstd::floor(st[1] + 2 * invDet * vSqrt);
 
     // Scan over ellipse bound and evaluate quadratic equation to filter image
-    T sum{};
-    Float sumWts = 0;
+    int nChannels = LevelChannels(level);
+    Float sum[4] = {0, 0, 0, 0}, sumWts = 0;
     for (int it = t0; it <= t1; ++it) {
         Float tt = it - st[1];
-        for (int is = s0; is <= s1; ++is) {
+        // Find the row's texels that may be inside the ellipse, where the
+        // quadratic in $ss$ is less than one
+        Float discrim = Sqr(B * tt) - 4 * A * (C * tt * tt - 1);
+        if (discrim <= 0)
+            continue;
+        Float rootDiscrim = std::sqrt(discrim), invA2 = 1 / (2 * A);
+        int rowS0 =
+            std::max<int>(s0, pstd::floor(st[0] + (-B * tt - rootDiscrim) * invA2));
+        int rowS1 =
+            std::min<int>(s1, pstd::ceil(st[0] + (-B * tt + rootDiscrim) * invA2));
+
+        for (int is = rowS0; is <= rowS1; ++is) {
             Float ss = is - st[0];
             // Compute squared radius and filter texel if it is inside the ellipse
             Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
             if (r2 < 1) {
                 int index = std::min<int>(r2 * MIPFilterLUTSize, MIPFilterLUTSize - 1);
                 Float weight = MIPFilterLUT[index];
-                sum += weight * Texel<T>(level, {is, it});
+                // Accumulate all of the texel's channels at once
+                Float values[4];
+                TexelChannels(level, {is, it}, values);
+                for (int c = 0; c < nChannels; ++c)
+                    sum[c] += weight * values[c];
                 sumWts += weight;
             }
         }
     }
-    return sum / sumWts;
+    for (int c = 0; c < nChannels; ++c)
+        sum[c] /= sumWts;
+    return texelValue<T>(sum, nChannels);
 }
 
-MIPMap *MIPMap::CreateFromFile(const std::string &filename,
-                               const MIPMapFilterOptions &options, WrapMode wrapMode,
-                               ColorEncoding encoding, Allocator alloc) {
+// Reads the image for a MIPMap and selects its channels
+static ImageAndMetadata readMIPMapImage(const std::string &filename,
+                                        ColorEncoding encoding, Allocator alloc) {
     ImageAndMetadata imageAndMetadata = Image::Read(filename, alloc, encoding);
 
     Image &image = imageAndMetadata.image;
@@ -355,11 +506,12 @@ MIPMap *MIPMap::CreateFromFile(const std::string &filename,
         ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
         if (rgbaDesc) {
             // Is alpha all ones?
-            bool allOne = true;
-            for (int y = 0; y < image.Resolution().y; ++y)
-                for (int x = 0; x < image.Resolution().x; ++x)
-                    if (image.GetChannels({x, y}, rgbaDesc)[3] != 1)
+            std::atomic<bool> allOne{true};
+            ParallelFor(0, image.Resolution().y, [&](int64_t y) {
+                for (int x = 0; x < image.Resolution().x && allOne; ++x)
+                    if (image.GetChannels({x, int(y)}, rgbaDesc)[3] != 1)
                         allOne = false;
+            });
             if (allOne)
                 image = image.SelectChannels(rgbDesc, alloc);
             else
@@ -372,14 +524,82 @@ MIPMap *MIPMap::CreateFromFile(const std::string &filename,
         }
     }
 
+    return imageAndMetadata;
+}
+
+// Writes _pyramid_ to a tile file, if its texels can be decoded from one
+static bool writeTiledPyramid(const std::string &tileFilename,
+                              pstd::span<const Image> pyramid,
+                              const RGBColorSpace *colorSpace, WrapMode wrapMode,
+                              ColorEncoding encoding) {
+    // 8-bit texels can only be decoded if the image's encoding is the texture's
+    if (pyramid[0].Format() == PixelFormat::U256 && pyramid[0].Encoding() != encoding)
+        return false;
+    return TiledImagePyramid::Write(tileFilename, pyramid, colorSpace, wrapMode,
+                                    encoding);
+}
+
+MIPMap *MIPMap::CreateFromFile(const std::string &filename,
+                               const MIPMapFilterOptions &options, WrapMode wrapMode,
+                               ColorEncoding encoding, Allocator alloc) {
+    // Use the image's pyramid file from "imgtool makemip" if it is up to date
+    if (PyramidFileIsCurrent(filename)) {
+        std::string pyramidFilename = PyramidFilename(filename);
+        TiledImagePyramid *tiles = TiledImagePyramid::Read(pyramidFilename, wrapMode,
+                                                           encoding, textureTileCache,
+                                                           alloc);
+        if (tiles) {
+            LOG_VERBOSE("%s: using pyramid file %s", filename, pyramidFilename);
+            if (textureTileCache)
+                return alloc.new_object<MIPMap>(tiles, wrapMode, options);
+            return alloc.new_object<MIPMap>(tiles->ReadLevels(alloc),
+                                            tiles->GetRGBColorSpace(), wrapMode,
+                                            options);
+        }
+    }
+
+    if (textureTileCache) {
+        // Use the texture's tile file, creating it if necessary
+        std::string tileFilename = TextureTileFilename(filename, wrapMode, encoding);
+        TiledImagePyramid *tiles = TiledImagePyramid::Read(
+            tileFilename, wrapMode, encoding, textureTileCache, alloc);
+        if (tiles)
+            return alloc.new_object<MIPMap>(tiles, wrapMode, options);
+
+        ImageAndMetadata imageAndMetadata = readMIPMapImage(filename, encoding, alloc);
+        const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
+        pstd::vector<Image> pyramid =
+            Image::GeneratePyramid(std::move(imageAndMetadata.image), wrapMode, alloc);
+        if (writeTiledPyramid(tileFilename, pyramid, colorSpace, wrapMode, encoding)) {
+            tiles = TiledImagePyramid::Read(tileFilename, wrapMode, encoding,
+                                            textureTileCache, alloc);
+            if (tiles) {
+                LOG_VERBOSE("%s: using texture tile file %s", filename, tileFilename);
+                return alloc.new_object<MIPMap>(tiles, wrapMode, options);
+            }
+        }
+        Warning("%s: unable to create texture tile file. Keeping the full texture "
+                "in memory.",
+                filename);
+        return alloc.new_object<MIPMap>(std::move(pyramid), colorSpace, wrapMode,
+                                        options);
+    }
+
+    ImageAndMetadata imageAndMetadata = readMIPMapImage(filename, encoding, alloc);
+    Image &image = imageAndMetadata.image;
     const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
     return alloc.new_object<MIPMap>(std::move(image), colorSpace, wrapMode, alloc,
                                     options);
 }
 
-template <typename T>
-T MIPMap::Texel(int level, Point2i st) const {
-    T::unimplemented_function;
+bool MIPMap::WritePyramidFile(const std::string &filename, WrapMode wrapMode,
+                              ColorEncoding encoding,
+                              const std::string &pyramidFilename) {
+    ImageAndMetadata imageAndMetadata = readMIPMapImage(filename, encoding, {});
+    const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
+    pstd::vector<Image> pyramid =
+        Image::GeneratePyramid(std::move(imageAndMetadata.image), wrapMode, {});
+    return writeTiledPyramid(pyramidFilename, pyramid, colorSpace, wrapMode, encoding);
 }
 
 template <typename T>
@@ -389,21 +609,50 @@ T MIPMap::Bilerp(int level, Point2f st) const {
 
 template <>
 Float MIPMap::Bilerp(int level, Point2f st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    switch (pyramid[level].NChannels()) {
+    Float values[4];
+    BilerpChannels(level, st, values);
+    switch (LevelChannels(level)) {
     case 1:
-        return pyramid[level].BilerpChannel(st, 0, wrapMode);
+        return values[0];
     case 3:
-        return pyramid[level].Bilerp(st, wrapMode).Average();
+        return (values[0] + values[1] + values[2]) / 3;
     case 4:
         // Return alpha
-        return pyramid[level].BilerpChannel(st, 3, wrapMode);
+        return values[3];
     default:
-        LOG_FATAL("Unexpected number of image channels: %d", pyramid[level].NChannels());
+        LOG_FATAL("Unexpected number of image channels: %d", LevelChannels(level));
+    }
+}
+
+MIPMap *MIPMap::MapTexels(
+    pstd::span<const std::string> channelNames,
+    std::function<void(pstd::span<const Float>, pstd::span<Float>)> func,
+    Allocator alloc) const {
+    if (tiles)
+        return nullptr;
+    pstd::vector<Image> mapped(alloc);
+    for (const Image &level : pyramid) {
+        Image image(PixelFormat::Float, level.Resolution(), channelNames, nullptr, alloc);
+        ParallelFor(0, level.Resolution().y, [&](int64_t y0, int64_t y1) {
+            std::vector<Float> in(level.NChannels()), out(channelNames.size());
+            for (int y = y0; y < y1; ++y)
+                for (int x = 0; x < level.Resolution().x; ++x) {
+                    for (int c = 0; c < in.size(); ++c)
+                        in[c] = level.GetChannel({x, y}, c);
+                    func(pstd::span<const Float>(in), pstd::span<Float>(out));
+                    image.SetChannels({x, y}, out);
+                }
+        });
+        mapped.push_back(std::move(image));
     }
+    return alloc.new_object<MIPMap>(std::move(mapped), colorSpace, wrapMode, options);
 }
 
 std::string MIPMap::ToString() const {
+    if (tiles)
+        return StringPrintf("[ MIPMap tiles: %s colorSpace: %s wrapMode: %s "
+                            "options: %s ]",
+                            *tiles, colorSpace->ToString(), wrapMode, options);
     return StringPrintf("[ MIPMap pyramid: %s colorSpace: %s wrapMode: %s "
                         "options: %s ]",
                         pyramid, colorSpace->ToString(), wrapMode, options);
@@ -9,8 +9,10 @@
 
 #include <pbrt/util/image.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/tilecache.h>
 #include <pbrt/util/vecmath.h>
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -51,22 +53,51 @@ class MIPMap {
     // MIPMap Public Methods
     MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
            Allocator alloc, const MIPMapFilterOptions &options);
+    MIPMap(pstd::vector<Image> pyramid, const RGBColorSpace *colorSpace,
+           WrapMode wrapMode, const MIPMapFilterOptions &options);
+    MIPMap(TiledImagePyramid *tiles, WrapMode wrapMode,
+           const MIPMapFilterOptions &options);
     static MIPMap *CreateFromFile(const std::string &filename,
                                   const MIPMapFilterOptions &options, WrapMode wrapMode,
                                   ColorEncoding encoding, Allocator alloc);
+    // Writes the pyramid that CreateFromFile() would create for the image to
+    // a tiled pyramid file that it will use instead
+    static bool WritePyramidFile(const std::string &filename, WrapMode wrapMode,
+                                 ColorEncoding encoding,
+                                 const std::string &pyramidFilename);
 
     template <typename T>
     T Filter(Point2f st, Vector2f dstdx, Vector2f dstdy) const;
+    // Returns the same value as Filter<Float>() for the bilinear, trilinear and
+    // point filters (where the point filter is treated as bilinear) along with its
+    // gradient with respect to $(s,t)$, found analytically from the texels that
+    // the lookup interpolates. It must not be called with the EWA filter.
+    Float FilterWithGradient(Point2f st, Vector2f dstdx, Vector2f dstdy,
+                             Vector2f *dst) const;
+
+    // Returns a _MIPMap_ with the same levels, wrap mode, and filter whose
+    // float-valued texels store the channels that _func_ computes from the
+    // corresponding texels of this one, or nullptr if its levels are tiled.
+    MIPMap *MapTexels(
+        pstd::span<const std::string> channelNames,
+        std::function<void(pstd::span<const Float>, pstd::span<Float>)> func,
+        Allocator alloc) const;
 
     std::string ToString() const;
 
     Point2i LevelResolution(int level) const {
+        if (tiles)
+            return tiles->LevelResolution(level);
         CHECK(level >= 0 && level < pyramid.size());
         return pyramid[level].Resolution();
     }
-    int Levels() const { return int(pyramid.size()); }
+    int Levels() const { return tiles ? tiles->Levels() : int(pyramid.size()); }
     const RGBColorSpace *GetRGBColorSpace() const { return colorSpace; }
-    const Image &GetLevel(int level) const { return pyramid[level]; }
+    const MIPMapFilterOptions &GetFilterOptions() const { return options; }
+    const Image &GetLevel(int level) const {
+        CHECK(!tiles);
+        return pyramid[level];
+    }
 
   private:
     // MIPMap Private Methods
@@ -76,9 +107,19 @@ class MIPMap {
     T Bilerp(int level, Point2f st) const;
     template <typename T>
     T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
+    Float BilerpWithGradient(int level, Point2f st, Vector2f *dst) const;
+
+    // These store the values of all of the texel's channels in _values_
+    void TexelChannels(int level, Point2i st, Float *values) const;
+    void BilerpChannels(int level, Point2f st, Float *values) const;
+    int LevelChannels(int level) const {
+        return tiles ? tiles->NChannels() : pyramid[level].NChannels();
+    }
 
     // MIPMap Private Members
     pstd::vector<Image> pyramid;
+    // Levels are stored in _tiles_ rather than _pyramid_ if it is non-null
+    TiledImagePyramid *tiles = nullptr;
     const RGBColorSpace *colorSpace;
     WrapMode wrapMode;
     MIPMapFilterOptions options;
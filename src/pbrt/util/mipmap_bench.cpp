@@ -0,0 +1,63 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/color.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/mipmap.h>
+#include <pbrt/util/rng.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// Texture filtering micro-benchmarks: an RGB MIP map of a 1024x1024 image is
+// filtered at random points with random, mostly anisotropic, filter footprints
+// whose widths span a few texels up to about a tenth of the image.
+
+static void BenchmarkFilter(benchmark::State &state, FilterFunction filter) {
+    Point2i res(1024, 1024);
+    Image image(PixelFormat::Half, res, {"R", "G", "B"});
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < 3; ++c)
+                image.SetChannel({x, y}, c,
+                                 .5f + .5f * std::sin(.05f * (c + 1) * x + .03f * y));
+    MIPMapFilterOptions options;
+    options.filter = filter;
+    MIPMap mipmap(image, RGBColorSpace::sRGB, WrapMode::Repeat, Allocator(), options);
+
+    constexpr int nLookups = 4096;
+    RNG rng;
+    std::vector<Point2f> st;
+    std::vector<Vector2f> dst0, dst1;
+    for (int i = 0; i < nLookups; ++i) {
+        st.push_back(Point2f(rng.Uniform<Float>(), rng.Uniform<Float>()));
+        Float scale = std::pow(2.f, Lerp(rng.Uniform<Float>(), -9, -3));
+        dst0.push_back(scale * Vector2f(rng.Uniform<Float>(), rng.Uniform<Float>()));
+        dst1.push_back(scale * Vector2f(rng.Uniform<Float>(), rng.Uniform<Float>()) / 4);
+    }
+
+    int index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mipmap.Filter<RGB>(st[index], dst0[index], dst1[index]));
+        if (++index == nLookups)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_MIPMapFilterTrilinear(benchmark::State &state) {
+    BenchmarkFilter(state, FilterFunction::Trilinear);
+}
+BENCHMARK(BM_MIPMapFilterTrilinear);
+
+static void BM_MIPMapFilterEWA(benchmark::State &state) {
+    BenchmarkFilter(state, FilterFunction::EWA);
+}
+BENCHMARK(BM_MIPMapFilterEWA);
@@ -4,6 +4,7 @@
 
 #include <pbrt/util/noise.h>
 
+#include <pbrt/util/check.h>
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
@@ -14,6 +15,8 @@ namespace pbrt {
 PBRT_CPU_GPU
 inline Float Grad(int x, int y, int z, Float dx, Float dy, Float dz);
 PBRT_CPU_GPU
+inline Float GradHash(int h, Float dx, Float dy, Float dz);
+PBRT_CPU_GPU
 inline Float NoiseWeight(Float t);
 
 // Perlin Noise Data
@@ -86,16 +89,81 @@ Float Noise(Point3f p) {
     return Noise(p.x, p.y, p.z);
 }
 
+void Noise(pstd::span<const Point3f> p, pstd::span<Float> result) {
+    DCHECK_EQ(p.size(), result.size());
+    for (size_t start = 0; start < p.size(); start += NoiseBatchSize) {
+        int n = std::min<int>(NoiseBatchSize, p.size() - start);
+        const Point3f *pb = &p[start];
+        // Compute noise cell coordinates and offsets for the batch's points
+        int ix[NoiseBatchSize], iy[NoiseBatchSize], iz[NoiseBatchSize];
+        Float dx[NoiseBatchSize], dy[NoiseBatchSize], dz[NoiseBatchSize];
+        for (int i = 0; i < n; ++i) {
+            ix[i] = pstd::floor(pb[i].x);
+            iy[i] = pstd::floor(pb[i].y);
+            iz[i] = pstd::floor(pb[i].z);
+            dx[i] = pb[i].x - ix[i];
+            dy[i] = pb[i].y - iy[i];
+            dz[i] = pb[i].z - iz[i];
+            ix[i] &= NoisePermSize - 1;
+            iy[i] &= NoisePermSize - 1;
+            iz[i] &= NoisePermSize - 1;
+        }
+
+        // Look up the gradient hashes at the cells' corners, sharing the
+        // permutation table lookups that corners have in common
+        int h[8][NoiseBatchSize];
+        for (int i = 0; i < n; ++i) {
+            int x0 = NoisePerm[ix[i]] + iy[i], x1 = NoisePerm[ix[i] + 1] + iy[i];
+            int y00 = NoisePerm[x0] + iz[i], y10 = NoisePerm[x1] + iz[i];
+            int y01 = NoisePerm[x0 + 1] + iz[i], y11 = NoisePerm[x1 + 1] + iz[i];
+            h[0][i] = NoisePerm[y00];
+            h[1][i] = NoisePerm[y10];
+            h[2][i] = NoisePerm[y01];
+            h[3][i] = NoisePerm[y11];
+            h[4][i] = NoisePerm[y00 + 1];
+            h[5][i] = NoisePerm[y10 + 1];
+            h[6][i] = NoisePerm[y01 + 1];
+            h[7][i] = NoisePerm[y11 + 1];
+        }
+
+        // Compute gradient weights and their trilinear interpolation
+        for (int i = 0; i < n; ++i) {
+            Float w000 = GradHash(h[0][i], dx[i], dy[i], dz[i]);
+            Float w100 = GradHash(h[1][i], dx[i] - 1, dy[i], dz[i]);
+            Float w010 = GradHash(h[2][i], dx[i], dy[i] - 1, dz[i]);
+            Float w110 = GradHash(h[3][i], dx[i] - 1, dy[i] - 1, dz[i]);
+            Float w001 = GradHash(h[4][i], dx[i], dy[i], dz[i] - 1);
+            Float w101 = GradHash(h[5][i], dx[i] - 1, dy[i], dz[i] - 1);
+            Float w011 = GradHash(h[6][i], dx[i], dy[i] - 1, dz[i] - 1);
+            Float w111 = GradHash(h[7][i], dx[i] - 1, dy[i] - 1, dz[i] - 1);
+
+            Float wx = NoiseWeight(dx[i]), wy = NoiseWeight(dy[i]);
+            Float wz = NoiseWeight(dz[i]);
+            Float x00 = Lerp(wx, w000, w100);
+            Float x10 = Lerp(wx, w010, w110);
+            Float x01 = Lerp(wx, w001, w101);
+            Float x11 = Lerp(wx, w011, w111);
+            Float y0 = Lerp(wy, x00, x10);
+            Float y1 = Lerp(wy, x01, x11);
+            result[start + i] = Lerp(wz, y0, y1);
+        }
+    }
+}
+
 Vector3f DNoise(Point3f p) {
     Float delta = .01f;
-    Float n = Noise(p);
-    Point3f noiseDelta(Noise(p + Vector3f(delta, 0, 0)), Noise(p + Vector3f(0, delta, 0)),
-                       Noise(p + Vector3f(0, 0, delta)));
-    return (noiseDelta - Point3f(n, n, n)) / delta;
+    Point3f pDelta[4] = {p, p + Vector3f(delta, 0, 0), p + Vector3f(0, delta, 0),
+                         p + Vector3f(0, 0, delta)};
+    Float n[4];
+    Noise(pDelta, n);
+    return Vector3f(n[1] - n[0], n[2] - n[0], n[3] - n[0]) / delta;
 }
 
 inline Float Grad(int x, int y, int z, Float dx, Float dy, Float dz) {
-    int h = NoisePerm[NoisePerm[NoisePerm[x] + y] + z];
+    return GradHash(NoisePerm[NoisePerm[NoisePerm[x] + y] + z], dx, dy, dz);
+}
+
+inline Float GradHash(int h, Float dx, Float dy, Float dz) {
     h &= 15;
     Float u = h < 8 || h == 12 || h == 13 ? dx : dy;
     Float v = h < 4 || h == 12 || h == 13 ? dy : dz;
@@ -114,13 +182,27 @@ Float FBm(Point3f p, Vector3f dpdx, Vector3f dpdy, Float omega, int maxOctaves)
 
     // Compute sum of octaves of noise for FBm
     Float sum = 0, lambda = 1, o = 1;
-    for (int i = 0; i < nInt; ++i) {
-        sum += o * Noise(lambda * p);
-        lambda *= 1.99f;
-        o *= omega;
-    }
     Float nPartial = n - nInt;
-    sum += o * SmoothStep(nPartial, .3f, .7f) * Noise(lambda * p);
+    for (int start = 0; start <= nInt; start += NoiseBatchSize) {
+        // Evaluate a batch of octaves, the last of which is partial
+        int count = std::min(NoiseBatchSize, nInt + 1 - start);
+        Point3f pOctave[NoiseBatchSize];
+        Float oOctave[NoiseBatchSize], noise[NoiseBatchSize];
+        for (int i = 0; i < count; ++i) {
+            pOctave[i] = lambda * p;
+            oOctave[i] = o;
+            lambda *= 1.99f;
+            o *= omega;
+        }
+        Noise(pstd::MakeConstSpan(pOctave, count), pstd::MakeSpan(noise, count));
+
+        for (int i = 0; i < count; ++i) {
+            if (start + i < nInt)
+                sum += oOctave[i] * noise[i];
+            else
+                sum += oOctave[i] * SmoothStep(nPartial, .3f, .7f) * noise[i];
+        }
+    }
 
     return sum;
 }
@@ -133,15 +215,30 @@ Float Turbulence(Point3f p, Vector3f dpdx, Vector3f dpdy, Float omega, int maxOc
 
     // Compute sum of octaves of noise for turbulence
     Float sum = 0, lambda = 1, o = 1;
-    for (int i = 0; i < nInt; ++i) {
-        sum += o * std::abs(Noise(lambda * p));
-        lambda *= 1.99f;
-        o *= omega;
-    }
-
-    // Account for contributions of clamped octaves in turbulence
     Float nPartial = n - nInt;
-    sum += o * Lerp(SmoothStep(nPartial, .3f, .7f), 0.2, std::abs(Noise(lambda * p)));
+    for (int start = 0; start <= nInt; start += NoiseBatchSize) {
+        // Evaluate a batch of octaves, the last of which is partial
+        int count = std::min(NoiseBatchSize, nInt + 1 - start);
+        Point3f pOctave[NoiseBatchSize];
+        Float oOctave[NoiseBatchSize], noise[NoiseBatchSize];
+        for (int i = 0; i < count; ++i) {
+            pOctave[i] = lambda * p;
+            oOctave[i] = o;
+            lambda *= 1.99f;
+            o *= omega;
+        }
+        Noise(pstd::MakeConstSpan(pOctave, count), pstd::MakeSpan(noise, count));
+
+        for (int i = 0; i < count; ++i) {
+            if (start + i < nInt)
+                sum += oOctave[i] * std::abs(noise[i]);
+            else {
+                // Account for contributions of clamped octaves in turbulence
+                o = oOctave[i];
+                sum += o * Lerp(SmoothStep(nPartial, .3f, .7f), 0.2, std::abs(noise[i]));
+            }
+        }
+    }
     for (int i = nInt; i < maxOctaves; ++i) {
         sum += o * 0.2f;
         o *= omega;
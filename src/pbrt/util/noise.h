@@ -7,12 +7,19 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/pstd.h>
+
 namespace pbrt {
 
 PBRT_CPU_GPU
 Float Noise(Float x, Float y = .5f, Float z = .5f);
 PBRT_CPU_GPU
 Float Noise(Point3f p);
+// Stores Noise(p[i]) in result[i]; each set of up to NoiseBatchSize points is
+// processed in separate passes over the points that the compiler can vectorize.
+static constexpr int NoiseBatchSize = 8;
+PBRT_CPU_GPU
+void Noise(pstd::span<const Point3f> p, pstd::span<Float> result);
 PBRT_CPU_GPU
 Vector3f DNoise(Point3f p);
 PBRT_CPU_GPU
@@ -0,0 +1,67 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/noise.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/vecmath.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace pbrt;
+
+TEST(Noise, Batch) {
+    // Include a partial batch and points with negative coordinates
+    RNG rng;
+    std::vector<Point3f> p(5 * NoiseBatchSize + 3);
+    for (Point3f &pt : p)
+        pt = Point3f(Lerp(rng.Uniform<Float>(), -300, 300),
+                     Lerp(rng.Uniform<Float>(), -300, 300),
+                     Lerp(rng.Uniform<Float>(), -300, 300));
+    std::vector<Float> result(p.size());
+    Noise(p, pstd::MakeSpan(result));
+
+    for (size_t i = 0; i < p.size(); ++i)
+        EXPECT_FLOAT_EQ(Noise(p[i]), result[i]) << p[i];
+}
+
+TEST(Noise, FBmOctaves) {
+    // Compare against summing the octaves one at a time
+    RNG rng;
+    for (int octaves : {1, 5, 8, 13, 20}) {
+        for (int trial = 0; trial < 20; ++trial) {
+            Point3f p(Lerp(rng.Uniform<Float>(), -10, 10),
+                      Lerp(rng.Uniform<Float>(), -10, 10),
+                      Lerp(rng.Uniform<Float>(), -10, 10));
+            Vector3f dpdx(std::pow(2.f, -Float(trial)), 0, 0), dpdy(0, 0, 0);
+            Float omega = .6f;
+
+            Float len2 = LengthSquared(dpdx);
+            Float n = Clamp(-1 - .5f * Log2(len2), 0, octaves);
+            int nInt = pstd::floor(n);
+            Float fbm = 0, turb = 0, lambda = 1, o = 1;
+            for (int i = 0; i < nInt; ++i) {
+                fbm += o * Noise(lambda * p);
+                turb += o * std::abs(Noise(lambda * p));
+                lambda *= 1.99f;
+                o *= omega;
+            }
+            Float s = SmoothStep(n - nInt, .3f, .7f);
+            fbm += o * s * Noise(lambda * p);
+            turb += o * Lerp(s, 0.2, std::abs(Noise(lambda * p)));
+            for (int i = nInt; i < octaves; ++i) {
+                turb += o * 0.2f;
+                o *= omega;
+            }
+
+            EXPECT_NEAR(fbm, FBm(p, dpdx, dpdy, omega, octaves), 1e-5f);
+            EXPECT_NEAR(turb, Turbulence(p, dpdx, dpdy, omega, octaves), 1e-5f);
+        }
+    }
+}
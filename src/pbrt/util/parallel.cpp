@@ -5,16 +5,33 @@
 #include <pbrt/util/parallel.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/math.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <pbrt/gpu/util.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
 
-#include <iterator>
-#include <list>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
 #include <thread>
 #include <vector>
 
+#ifdef PBRT_IS_LINUX
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // PBRT_IS_LINUX
+
 namespace pbrt {
 
 std::string AtomicFloat::ToString() const {
@@ -40,61 +57,133 @@ bool Barrier::Block() {
     return --numToExit == 0;
 }
 
+// NUMA Topology Definitions
+// The CPUs of each NUMA node; systems where the topology can't be found are
+// treated as a single node with no known CPUs.
+static std::vector<std::vector<int>> numaNodeCPUs;
+
+static void FindNUMATopology() {
+    if (!numaNodeCPUs.empty())
+        return;
+#ifdef PBRT_IS_LINUX
+    // Each node's CPUs are listed as comma-separated ranges, e.g. "0-3,8-11"
+    for (int node = 0;; ++node) {
+        std::string filename =
+            StringPrintf("/sys/devices/system/node/node%d/cpulist", node);
+        if (!FileExists(filename))
+            break;
+        std::string cpuList = ReadFileContents(filename);
+        std::vector<int> cpus;
+        for (std::string range : SplitString(cpuList, ',')) {
+            int first, last;
+            if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2)
+                for (int cpu = first; cpu <= last; ++cpu)
+                    cpus.push_back(cpu);
+            else if (sscanf(range.c_str(), "%d", &first) == 1)
+                cpus.push_back(first);
+        }
+        numaNodeCPUs.push_back(std::move(cpus));
+    }
+#endif  // PBRT_IS_LINUX
+    if (numaNodeCPUs.empty())
+        numaNodeCPUs.push_back({});
+    LOG_VERBOSE("Found %d NUMA nodes", numaNodeCPUs.size());
+}
+
 // ParallelJob Definition
+// A ParallelJob's work is divided into chunks that are numbered from zero;
+// chunks may run in any order and concurrently on different threads.
 class ParallelJob {
   public:
     // ParallelJob Public Methods
-    virtual ~ParallelJob() { DCHECK(removed); }
+    explicit ParallelJob(int64_t nChunks) : nChunks(nChunks), chunksRemaining(nChunks) {}
+    virtual ~ParallelJob() { DCHECK(Finished()); }
 
-    virtual bool HaveWork() const = 0;
-    virtual void RunStep(std::unique_lock<std::mutex> *lock) = 0;
+    virtual void RunChunk(int64_t chunk) = 0;
+    // Called on the thread that ran the last chunk once all have finished;
+    // the thread pool doesn't access the job afterward
+    virtual void OnFinished() {}
 
-    bool Finished() const { return !HaveWork() && activeWorkers == 0; }
+    bool Finished() const { return chunksRemaining.load(std::memory_order_acquire) == 0; }
 
     virtual std::string ToString() const = 0;
+    // Returns the name of the job's chunks in traces
+    virtual const char *Name() const = 0;
 
   protected:
     std::string BaseToString() const {
-        return StringPrintf("activeWorkers: %d removed: %s", activeWorkers, removed);
+        return StringPrintf("nChunks: %d chunksRemaining: %d", nChunks,
+                            chunksRemaining.load());
     }
 
   private:
     // ParallelJob Private Members
     friend class ThreadPool;
-    int activeWorkers = 0;
-    ParallelJob *prev = nullptr, *next = nullptr;
-    bool removed = false;
+    int64_t nChunks;
+    std::atomic<int64_t> chunksRemaining;
 };
 
 // ThreadPool Definition
+// ThreadPool runs the chunks of ParallelJobs using a work-stealing scheduler:
+// each thread has a queue of tasks, each of which is a range of a job's
+// chunks. Threads split the ranges of the tasks they run in half, queueing the
+// upper halves, until a single chunk remains to run. They take tasks from the
+// back of their own queue, which keeps recently split ranges on the same
+// thread, and when it's empty steal from the front of other threads' queues,
+// where the largest ranges are, trying threads on the same NUMA node first.
+// Threads only sleep when there are no queued tasks at all.
 class ThreadPool {
   public:
     // ThreadPool Public Methods
-    explicit ThreadPool(int nThreads);
+    ThreadPool(int nThreads, ThreadAffinity affinity);
 
     ~ThreadPool();
 
     size_t size() const { return threads.size(); }
 
-    std::unique_lock<std::mutex> AddToJobList(ParallelJob *job);
-    void RemoveFromJobList(ParallelJob *job);
-
-    void WorkOrWait(std::unique_lock<std::mutex> *lock);
+    void Run(ParallelJob *job);
+    // Queues the job's chunks without waiting for them to run
+    void Enqueue(ParallelJob *job);
+    // Runs queued tasks until _done_ returns true
+    void WaitUntil(const std::function<bool(void)> &done);
 
     void ForEachThread(std::function<void(void)> func);
 
     std::string ToString() const;
 
   private:
+    // ThreadPool Private Types
+    struct Task {
+        ParallelJob *job;
+        int64_t chunkStart, chunkEnd;
+    };
+    struct alignas(64) TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
     // ThreadPool Private Methods
     void workerFunc(int tIndex);
+    void Push(Task task);
+    bool PopOrSteal(Task *task);
+    void RunTask(Task task);
+    void PinThread(int tIndex) const;
 
     // ThreadPool Private Members
     std::vector<std::thread> threads;
-    mutable std::mutex mutex;
+    // Threads that aren't in the pool have a _ThreadIndex_ of zero and share
+    // the first queue
+    std::vector<TaskQueue> queues;
+    // The thread indices whose queues each thread steals from, in order
+    std::vector<std::vector<int>> stealOrder;
+    ThreadAffinity affinity;
+    // Each thread's NUMA node and its index among the node's threads
+    std::vector<int> threadNode, threadNodeIndex;
+    std::atomic<int64_t> nQueuedTasks{0};
+    std::atomic<int> nSleeping{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeCondition;
     bool shutdownThreads = false;
-    ParallelJob *jobList = nullptr;
-    std::condition_variable jobListCondition;
 };
 
 thread_local int ThreadIndex;
@@ -103,73 +192,174 @@ static std::unique_ptr<ThreadPool> threadPool;
 static bool maxThreadIndexCalled = false;
 
 // ThreadPool Method Definitions
-ThreadPool::ThreadPool(int nThreads) {
+ThreadPool::ThreadPool(int nThreads, ThreadAffinity affinity)
+    : queues(nThreads),
+      stealOrder(nThreads),
+      affinity(affinity),
+      threadNode(nThreads, 0),
+      threadNodeIndex(nThreads) {
+    // Assign threads to NUMA nodes in contiguous blocks
+    int nNodes = affinity == ThreadAffinity::None ? 1 : NUMANodes();
+    for (int i = 0; i < nThreads; ++i) {
+        threadNode[i] = int64_t(i) * nNodes / nThreads;
+        bool sameNode = i > 0 && threadNode[i] == threadNode[i - 1];
+        threadNodeIndex[i] = sameNode ? threadNodeIndex[i - 1] + 1 : 0;
+    }
+
+    // Order each thread's steal victims with the threads on its node first
+    for (int t = 0; t < nThreads; ++t) {
+        for (int i = 1; i < nThreads; ++i)
+            if (threadNode[(t + i) % nThreads] == threadNode[t])
+                stealOrder[t].push_back((t + i) % nThreads);
+        for (int i = 1; i < nThreads; ++i)
+            if (threadNode[(t + i) % nThreads] != threadNode[t])
+                stealOrder[t].push_back((t + i) % nThreads);
+    }
+
     ThreadIndex = 0;
+    PinThread(0);
     for (int i = 0; i < nThreads - 1; ++i)
         threads.push_back(std::thread(&ThreadPool::workerFunc, this, i + 1));
 }
 
+void ThreadPool::PinThread(int tIndex) const {
+    if (affinity == ThreadAffinity::None)
+        return;
+#ifdef PBRT_IS_LINUX
+    const std::vector<int> &cpus = numaNodeCPUs[threadNode[tIndex]];
+    if (cpus.empty())
+        return;
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if (affinity == ThreadAffinity::CPU)
+        CPU_SET(cpus[threadNodeIndex[tIndex] % cpus.size()], &cpuSet);
+    else
+        for (int cpu : cpus)
+            CPU_SET(cpu, &cpuSet);
+    if (int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet))
+        Warning("Thread %d: unable to set CPU affinity: %s", tIndex, ErrorString(err));
+#endif  // PBRT_IS_LINUX
+}
+
 void ThreadPool::workerFunc(int tIndex) {
     LOG_VERBOSE("Started execution in worker thread %d", tIndex);
     ThreadIndex = tIndex;
+    PinThread(tIndex);
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     GPUThreadInit();
 #endif  // PBRT_BUILD_GPU_RENDERER
 
-    std::unique_lock<std::mutex> lock(mutex);
-    while (!shutdownThreads)
-        WorkOrWait(&lock);
+    while (true) {
+        Task task;
+        if (PopOrSteal(&task)) {
+            RunTask(task);
+            continue;
+        }
+        // Wait for tasks to be queued or for the pool to shut down
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        ++nSleeping;
+        wakeCondition.wait(lock,
+                           [this]() { return shutdownThreads || nQueuedTasks > 0; });
+        --nSleeping;
+        if (shutdownThreads)
+            break;
+    }
 
     LOG_VERBOSE("Exiting worker thread %d", tIndex);
 }
 
-std::unique_lock<std::mutex> ThreadPool::AddToJobList(ParallelJob *job) {
-    std::unique_lock<std::mutex> lock(mutex);
-    // Add _job_ to head of _jobList_
-    if (jobList != nullptr)
-        jobList->prev = job;
-    job->next = jobList;
-    jobList = job;
-
-    jobListCondition.notify_all();
-    return lock;
+void ThreadPool::Push(Task task) {
+    TaskQueue &queue = queues[ThreadIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    ++nQueuedTasks;
+
+    // Wake a sleeping thread to take the task; holding _sleepMutex_ ensures
+    // that it isn't between checking for tasks and waiting
+    if (nSleeping > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeCondition.notify_one();
+    }
 }
 
-void ThreadPool::WorkOrWait(std::unique_lock<std::mutex> *lock) {
-    DCHECK(lock->owns_lock());
-
-    ParallelJob *job = jobList;
-    while (job != nullptr && !job->HaveWork())
-        job = job->next;
-    if (job != nullptr) {
-        // Execute work for _job_
-        job->activeWorkers++;
-        job->RunStep(lock);
-        DCHECK(!lock->owns_lock());
-        lock->lock();
-        job->activeWorkers--;
-        if (job->Finished())
-            jobListCondition.notify_all();
+bool ThreadPool::PopOrSteal(Task *task) {
+    if (nQueuedTasks == 0)
+        return false;
+    // Take the most recently queued task from the thread's own queue
+    TaskQueue &queue = queues[ThreadIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            *task = queue.tasks.back();
+            queue.tasks.pop_back();
+            --nQueuedTasks;
+            return true;
+        }
+    }
 
-    } else
-        // Wait for new work to arrive or the job to finish
-        jobListCondition.wait(*lock);
+    // Steal the oldest task from another thread's queue, skipping queues that
+    // other threads are using; callers try again if tasks remain queued
+    for (int victimIndex : stealOrder[ThreadIndex]) {
+        TaskQueue &victim = queues[victimIndex];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (lock.owns_lock() && !victim.tasks.empty()) {
+            *task = victim.tasks.front();
+            victim.tasks.pop_front();
+            --nQueuedTasks;
+            return true;
+        }
+    }
+    return false;
 }
 
-void ThreadPool::RemoveFromJobList(ParallelJob *job) {
-    DCHECK(!job->removed);
+void ThreadPool::RunTask(Task task) {
+    // Queue the upper halves of the task's range until one chunk is left
+    while (task.chunkEnd - task.chunkStart > 1) {
+        int64_t mid = task.chunkStart + (task.chunkEnd - task.chunkStart) / 2;
+        Push(Task{task.job, mid, task.chunkEnd});
+        task.chunkEnd = mid;
+    }
 
-    if (job->prev != nullptr)
-        job->prev->next = job->next;
-    else {
-        DCHECK(jobList == job);
-        jobList = job->next;
+    ParallelJob *job = task.job;
+    {
+        TraceScope trace(job->Name(), "parallel");
+        job->RunChunk(task.chunkStart);
+    }
+    if (job->chunksRemaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        job->OnFinished();
+        // Wake the threads that are waiting for the job to finish
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeCondition.notify_all();
     }
-    if (job->next != nullptr)
-        job->next->prev = job->prev;
+}
+
+void ThreadPool::Run(ParallelJob *job) {
+    Enqueue(job);
+    WaitUntil([job]() { return job->Finished(); });
+}
 
-    job->removed = true;
+void ThreadPool::Enqueue(ParallelJob *job) {
+    if (job->nChunks > 0)
+        Push(Task{job, 0, job->nChunks});
+}
+
+void ThreadPool::WaitUntil(const std::function<bool(void)> &done) {
+    // Help out with queued tasks until _done_ returns true
+    while (!done()) {
+        Task task;
+        if (PopOrSteal(&task)) {
+            RunTask(task);
+            continue;
+        }
+        // Wait for the work that _done_ depends on to finish on other threads
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        ++nSleeping;
+        wakeCondition.wait(lock, [&]() { return done() || nQueuedTasks > 0; });
+        --nSleeping;
+    }
 }
 
 void ThreadPool::ForEachThread(std::function<void(void)> func) {
@@ -187,9 +377,9 @@ ThreadPool::~ThreadPool() {
         return;
 
     {
-        std::lock_guard<std::mutex> lock(mutex);
+        std::lock_guard<std::mutex> lock(sleepMutex);
         shutdownThreads = true;
-        jobListCondition.notify_all();
+        wakeCondition.notify_all();
     }
 
     for (std::thread &thread : threads)
@@ -197,111 +387,187 @@ ThreadPool::~ThreadPool() {
 }
 
 std::string ThreadPool::ToString() const {
-    std::string s = StringPrintf("[ ThreadPool threads.size(): %d shutdownThreads: %s ",
-                                 threads.size(), shutdownThreads);
-    if (mutex.try_lock()) {
-        s += "jobList: [ ";
-        ParallelJob *job = jobList;
-        while (job) {
-            s += job->ToString() + " ";
-            job = job->next;
-        }
-        s += "] ";
-        mutex.unlock();
-    } else
-        s += "(job list mutex locked) ";
-    return s + "]";
+    return StringPrintf("[ ThreadPool threads.size(): %d nQueuedTasks: %d "
+                        "nSleeping: %d shutdownThreads: %s affinity: %s ]",
+                        threads.size(), nQueuedTasks.load(), nSleeping.load(),
+                        shutdownThreads, affinity);
 }
 
 // ParallelForLoop1D Definition
 class ParallelForLoop1D : public ParallelJob {
   public:
     // ParallelForLoop1D Public Methods
-    ParallelForLoop1D(int64_t startIndex, int64_t endIndex, int chunkSize,
+    ParallelForLoop1D(int64_t startIndex, int64_t endIndex, int64_t chunkSize,
                       std::function<void(int64_t, int64_t)> func)
-        : func(std::move(func)),
-          nextIndex(startIndex),
+        : ParallelJob((endIndex - startIndex + chunkSize - 1) / chunkSize),
+          func(std::move(func)),
+          startIndex(startIndex),
           endIndex(endIndex),
           chunkSize(chunkSize) {}
 
-    bool HaveWork() const { return nextIndex < endIndex; }
-
-    void RunStep(std::unique_lock<std::mutex> *lock);
+    void RunChunk(int64_t chunk) {
+        // Execute loop iterations in the chunk's range of indices
+        int64_t indexStart = startIndex + chunk * chunkSize;
+        int64_t indexEnd = std::min(indexStart + chunkSize, endIndex);
+        func(indexStart, indexEnd);
+    }
 
     std::string ToString() const {
-        return StringPrintf("[ ParallelForLoop1D nextIndex: %d endIndex: %d "
-                            "chunkSize: %d ]",
-                            nextIndex, endIndex, chunkSize);
+        return StringPrintf("[ ParallelForLoop1D startIndex: %d endIndex: %d "
+                            "chunkSize: %d %s ]",
+                            startIndex, endIndex, chunkSize, BaseToString());
     }
+    const char *Name() const { return "ParallelFor"; }
 
   private:
     // ParallelForLoop1D Private Members
     std::function<void(int64_t, int64_t)> func;
-    int64_t nextIndex, endIndex;
-    int chunkSize;
+    int64_t startIndex, endIndex;
+    int64_t chunkSize;
 };
 
+// ParallelForLoop2D Definition
 class ParallelForLoop2D : public ParallelJob {
   public:
+    // ParallelForLoop2D Public Methods
     ParallelForLoop2D(const Bounds2i &extent, int chunkSize,
                       std::function<void(Bounds2i)> func)
-        : func(std::move(func)),
+        : ParallelJob(int64_t(nTiles(extent.Diagonal().x, chunkSize)) *
+                      nTiles(extent.Diagonal().y, chunkSize)),
+          func(std::move(func)),
           extent(extent),
-          nextStart(extent.pMin),
-          chunkSize(chunkSize) {}
+          chunkSize(chunkSize) {
+        // Number the tiles along a Hilbert curve, so that both consecutive
+        // tiles and the ranges of tiles that the thread pool hands out are
+        // close together in the image and share cached scene data
+        Point2i tiles(nTiles(extent.Diagonal().x, chunkSize),
+                      nTiles(extent.Diagonal().y, chunkSize));
+        int curveSize = RoundUpPow2(std::max(tiles.x, tiles.y));
+        std::vector<std::pair<int64_t, Point2i>> tileIndices;
+        tileIndices.reserve(tiles.x * tiles.y);
+        for (int y = 0; y < tiles.y; ++y)
+            for (int x = 0; x < tiles.x; ++x)
+                tileIndices.push_back({HilbertIndex(curveSize, x, y), Point2i(x, y)});
+        std::sort(tileIndices.begin(), tileIndices.end(),
+                  [](const auto &a, const auto &b) { return a.first < b.first; });
+        tileOrder.reserve(tileIndices.size());
+        for (const auto &ti : tileIndices)
+            tileOrder.push_back(ti.second);
+    }
 
-    bool HaveWork() const { return nextStart.y < extent.pMax.y; }
-    void RunStep(std::unique_lock<std::mutex> *lock);
+    void RunChunk(int64_t chunk) {
+        // Compute the tile's extent and run the loop iteration
+        Point2i start = extent.pMin + chunkSize * Vector2i(tileOrder[chunk]);
+        Bounds2i b =
+            Intersect(Bounds2i(start, start + Vector2i(chunkSize, chunkSize)), extent);
+        CHECK(!b.IsEmpty());
+        func(b);
+    }
 
     std::string ToString() const {
-        return StringPrintf("[ ParallelForLoop2D extent: %s nextStart: %s "
-                            "chunkSize: %d ]",
-                            extent, nextStart, chunkSize);
+        return StringPrintf("[ ParallelForLoop2D extent: %s chunkSize: %d %s ]", extent,
+                            chunkSize, BaseToString());
     }
+    const char *Name() const { return "ParallelFor2D"; }
 
   private:
+    // ParallelForLoop2D Private Methods
+    static int nTiles(int extent, int chunkSize) {
+        return (extent + chunkSize - 1) / chunkSize;
+    }
+
+    // Returns the distance along the Hilbert curve that fills an _n_x_n_ grid,
+    // with _n_ a power of two, to the given cell
+    static int64_t HilbertIndex(int n, int x, int y) {
+        int64_t d = 0;
+        for (int s = n / 2; s > 0; s /= 2) {
+            int rx = (x & s) > 0, ry = (y & s) > 0;
+            d += int64_t(s) * s * ((3 * rx) ^ ry);
+            // Rotate the quadrant so that the curve within it starts and ends
+            // at the right corners
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = n - 1 - x;
+                    y = n - 1 - y;
+                }
+                pstd::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    // ParallelForLoop2D Private Members
     std::function<void(Bounds2i)> func;
     const Bounds2i extent;
-    Point2i nextStart;
     int chunkSize;
+    std::vector<Point2i> tileOrder;
 };
 
-// ParallelForLoop1D Method Definitions
-void ParallelForLoop1D::RunStep(std::unique_lock<std::mutex> *lock) {
-    // Determine the range of loop iterations to run in this step
-    int64_t indexStart = nextIndex;
-    int64_t indexEnd = std::min(indexStart + chunkSize, endIndex);
-    nextIndex = indexEnd;
+// AsyncParallelJob Definition
+// Runs an AsyncJob as a single-chunk job on the thread pool; it deletes
+// itself after the job has run.
+class AsyncParallelJob : public ParallelJob {
+  public:
+    // AsyncParallelJob Public Methods
+    explicit AsyncParallelJob(std::shared_ptr<AsyncJobBase> job)
+        : ParallelJob(1), job(std::move(job)) {}
 
-    // Remove job from list if all work has been started
-    if (!HaveWork())
-        threadPool->RemoveFromJobList(this);
+    void RunChunk(int64_t) { job->Execute(); }
 
-    // Release lock and execute loop iterations in _[indexStart, indexEnd)_
-    lock->unlock();
-    func(indexStart, indexEnd);
-}
+    void OnFinished() {
+        job->Finish();
+        delete this;
+    }
+
+    std::string ToString() const {
+        return StringPrintf("[ AsyncParallelJob %s ]", BaseToString());
+    }
+    const char *Name() const { return "AsyncJob"; }
+
+  private:
+    std::shared_ptr<AsyncJobBase> job;
+};
 
-void ParallelForLoop2D::RunStep(std::unique_lock<std::mutex> *lock) {
-    // Compute extent for this step
-    Point2i end = nextStart + Vector2i(chunkSize, chunkSize);
-    Bounds2i b = Intersect(Bounds2i(nextStart, end), extent);
-    CHECK(!b.IsEmpty());
-
-    // Advance to be ready for the next extent.
-    nextStart.x += chunkSize;
-    if (nextStart.x >= extent.pMax.x) {
-        nextStart.x = extent.pMin.x;
-        nextStart.y += chunkSize;
+// AsyncJobBase Method Definitions
+void AsyncJobBase::Start(const std::vector<std::shared_ptr<AsyncJobBase>> &dependencies) {
+    // Hold an extra reference to the pending count so that the job isn't
+    // queued before all of its dependencies have been recorded
+    nPendingDependencies = dependencies.size() + 1;
+    for (const std::shared_ptr<AsyncJobBase> &dependency : dependencies) {
+        std::unique_lock<std::mutex> lock(dependency->mutex);
+        if (dependency->finished) {
+            lock.unlock();
+            DependencyFinished();
+        } else
+            dependency->dependents.push_back(shared_from_this());
     }
+    DependencyFinished();
+}
 
-    if (!HaveWork())
-        threadPool->RemoveFromJobList(this);
+void AsyncJobBase::DependencyFinished() {
+    if (--nPendingDependencies == 0) {
+        CHECK(threadPool);
+        threadPool->Enqueue(new AsyncParallelJob(shared_from_this()));
+    }
+}
 
-    lock->unlock();
+void AsyncJobBase::Finish() {
+    std::vector<std::shared_ptr<AsyncJobBase>> finishedDependents;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        std::swap(finishedDependents, dependents);
+    }
+    ready.store(true, std::memory_order_release);
+    for (const std::shared_ptr<AsyncJobBase> &dependent : finishedDependents)
+        dependent->DependencyFinished();
+}
 
-    // Run the loop iteration
-    func(b);
+void AsyncJobBase::Wait() {
+    if (IsReady())
+        return;
+    CHECK(threadPool);
+    threadPool->WaitUntil([this]() { return IsReady(); });
 }
 
 // Parallel Function Definitions
@@ -309,18 +575,15 @@ void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t
     CHECK(threadPool);
     // Compute chunk size and possibly run entire loop on current thread
     int64_t chunkSize = std::max<int64_t>(1, (end - start) / (8 * RunningThreads()));
-    if (end - start < chunkSize) {
-        func(start, end);
+    if (end - start <= chunkSize) {
+        if (end > start)
+            func(start, end);
         return;
     }
 
-    // Create and enqueue _ParallelForLoop1D_ for this loop
+    // Run a _ParallelForLoop1D_ for this loop
     ParallelForLoop1D loop(start, end, chunkSize, std::move(func));
-    std::unique_lock<std::mutex> lock = threadPool->AddToJobList(&loop);
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished())
-        threadPool->WorkOrWait(&lock);
+    threadPool->Run(&loop);
 }
 
 int MaxThreadIndex() {
@@ -346,11 +609,7 @@ void ParallelFor2D(const Bounds2i &extent, std::function<void(Bounds2i)> func) {
                          1, 32);
 
     ParallelForLoop2D loop(extent, tileSize, std::move(func));
-    std::unique_lock<std::mutex> lock = threadPool->AddToJobList(&loop);
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished())
-        threadPool->WorkOrWait(&lock);
+    threadPool->Run(&loop);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -363,7 +622,21 @@ int RunningThreads() {
     return threadPool ? (1 + threadPool->size()) : 1;
 }
 
-void ParallelInit(int nThreads) {
+std::string ToString(ThreadAffinity affinity) {
+    switch (affinity) {
+    case ThreadAffinity::None:
+        return "none";
+    case ThreadAffinity::NUMANode:
+        return "numa-node";
+    case ThreadAffinity::CPU:
+        return "cpu";
+    default:
+        LOG_FATAL("Unhandled ThreadAffinity");
+        return {};
+    }
+}
+
+void ParallelInit(int nThreads, ThreadAffinity affinity) {
     // This is risky: if the caller has allocated per-thread data
     // structures before calling ParallelInit(), then we may end up having
     // them accessed with a higher ThreadIndex than the caller expects.
@@ -372,7 +645,13 @@ void ParallelInit(int nThreads) {
     CHECK(!threadPool);
     if (nThreads <= 0)
         nThreads = AvailableCores();
-    threadPool = std::make_unique<ThreadPool>(nThreads);
+    FindNUMATopology();
+    if (affinity != ThreadAffinity::None && NUMANodes() == 1 &&
+        numaNodeCPUs[0].empty()) {
+        Warning("Unable to find the system's CPUs; threads will not be pinned.");
+        affinity = ThreadAffinity::None;
+    }
+    threadPool = std::make_unique<ThreadPool>(nThreads, affinity);
 }
 
 void ParallelCleanup() {
@@ -385,4 +664,31 @@ void ForEachThread(std::function<void(void)> func) {
         threadPool->ForEachThread(std::move(func));
 }
 
+// NUMA Function Definitions
+int NUMANodes() {
+    FindNUMATopology();
+    return numaNodeCPUs.size();
+}
+
+void InterleaveAcrossNUMANodes(void *ptr, size_t size) {
+    int nNodes = NUMANodes();
+    if (nNodes == 1 || size == 0)
+        return;
+#ifdef PBRT_IS_LINUX
+    // Round the range out to whole pages and bind them to all of the nodes;
+    // pages that have already been touched are migrated
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = uintptr_t(ptr) & ~(pageSize - 1);
+    uintptr_t end = (uintptr_t(ptr) + size + pageSize - 1) & ~(pageSize - 1);
+    constexpr int bitsPerMask = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> nodeMask((nNodes + bitsPerMask - 1) / bitsPerMask);
+    for (int node = 0; node < nNodes; ++node)
+        nodeMask[node / bitsPerMask] |= 1ul << (node % bitsPerMask);
+    if (syscall(SYS_mbind, start, end - start, MPOL_INTERLEAVE, nodeMask.data(),
+                nNodes + 1, MPOL_MF_MOVE) != 0)
+        LOG_VERBOSE("Unable to interleave %d bytes across NUMA nodes: %s", size,
+                    ErrorString());
+#endif  // PBRT_IS_LINUX
+}
+
 }  // namespace pbrt
@@ -10,13 +10,17 @@
 #include <pbrt/util/float.h>
 #include <pbrt/util/vecmath.h>
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
 #include <initializer_list>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 namespace pbrt {
 
@@ -107,8 +111,11 @@ class AtomicDouble {
 #endif
     }
 
+    // Returns the number of times that the compare-and-swap that updates the
+    // value had to be retried
     PBRT_CPU_GPU
-    void Add(double v) {
+    int Add(double v) {
+        int retries = 0;
 #if (defined(__CUDA_ARCH__) && __CUDA_ARCH__ >= 600)
         atomicAdd(&value, v);
 #elif defined(__CUDA_ARCH__)
@@ -118,13 +125,14 @@ class AtomicDouble {
             assumed = old;
             old = atomicCAS((unsigned long long int *)&bits, assumed,
                             __double_as_longlong(v + __longlong_as_double(assumed)));
-        } while (assumed != old);
+        } while (assumed != old && ++retries);
 #else
         uint64_t oldBits = bits, newBits;
         do {
             newBits = FloatToBits(BitsToFloat(oldBits) + v);
-        } while (!bits.compare_exchange_weak(oldBits, newBits));
+        } while (!bits.compare_exchange_weak(oldBits, newBits) && ++retries);
 #endif
+        return retries;
     }
 
     std::string ToString() const;
@@ -162,33 +170,208 @@ void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t
 void ParallelFor2D(const Bounds2i &extent, std::function<void(Bounds2i)> func);
 
 // Parallel Inline Functions
-inline void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t)> func) {
-    ParallelFor(start, end, [&func](int64_t start, int64_t end) {
-        for (int64_t i = start; i < end; ++i)
-            func(i);
-    });
+// These take callables that are invoked for single indices or pixels, as well
+// as ones that are invoked for ranges of them. In the first case, each chunk
+// of the loop calls _func_ directly in a loop, so that it can be inlined and
+// the loop vectorized; only the call for each chunk goes through a
+// std::function.
+template <typename F>
+inline void ParallelFor(int64_t start, int64_t end, F func) {
+    if constexpr (std::is_invocable_v<F &, int64_t, int64_t>)
+        ParallelFor(start, end, std::function<void(int64_t, int64_t)>(std::move(func)));
+    else
+        ParallelFor(start, end,
+                    std::function<void(int64_t, int64_t)>(
+                        [&func](int64_t chunkStart, int64_t chunkEnd) {
+                            for (int64_t i = chunkStart; i < chunkEnd; ++i)
+                                func(i);
+                        }));
 }
 
-inline void ParallelFor2D(const Bounds2i &extent, std::function<void(Point2i)> func) {
-    ParallelFor2D(extent, [&func](Bounds2i b) {
-        for (Point2i p : b)
-            func(p);
-    });
+template <typename F>
+inline void ParallelFor2D(const Bounds2i &extent, F func) {
+    if constexpr (std::is_invocable_v<F &, Bounds2i>)
+        ParallelFor2D(extent, std::function<void(Bounds2i)>(std::move(func)));
+    else
+        ParallelFor2D(extent, std::function<void(Bounds2i)>([&func](Bounds2i b) {
+                          for (int y = b.pMin.y; y < b.pMax.y; ++y)
+                              for (int x = b.pMin.x; x < b.pMax.x; ++x)
+                                  func(Point2i(x, y));
+                      }));
 }
 
 void ForEachThread(std::function<void(void)> func);
 
+// AsyncJobBase Definition
+// An AsyncJob runs a function on the thread pool once all of the jobs it
+// depends on have finished. Threads that wait for a job run other queued work
+// until it is ready rather than blocking. Since that work may in turn wait,
+// jobs should only wait for their dependencies, which have already finished,
+// and express other orderings as dependencies or continuations.
+class AsyncJobBase : public std::enable_shared_from_this<AsyncJobBase> {
+  public:
+    // AsyncJobBase Public Methods
+    virtual ~AsyncJobBase() = default;
+
+    bool IsReady() const { return ready.load(std::memory_order_acquire); }
+    void Wait();
+
+    // Called once by RunAsyncAfter() to queue the job after its dependencies
+    void Start(const std::vector<std::shared_ptr<AsyncJobBase>> &dependencies);
+
+  protected:
+    // AsyncJobBase Protected Methods
+    virtual void Execute() = 0;
+
+  private:
+    // AsyncJobBase Private Methods
+    friend class AsyncParallelJob;
+    void Finish();
+    void DependencyFinished();
+
+    // AsyncJobBase Private Members
+    std::mutex mutex;
+    // _finished_ and _dependents_ are protected by _mutex_
+    bool finished = false;
+    std::vector<std::shared_ptr<AsyncJobBase>> dependents;
+    std::atomic<int> nPendingDependencies{0};
+    std::atomic<bool> ready{false};
+};
+
+// AsyncJob Definition
+template <typename T>
+class AsyncJob : public AsyncJobBase {
+  public:
+    // AsyncJob Public Methods
+    explicit AsyncJob(std::function<T(void)> func) : func(std::move(func)) {}
+
+    template <typename U = T>
+    std::enable_if_t<!std::is_void_v<U>, U &> GetResult() {
+        Wait();
+        return result.value();
+    }
+
+    // Returns a job that runs _func_ with this job's result once it is ready
+    template <typename F>
+    auto Then(F func);
+
+  private:
+    // AsyncJob Private Methods
+    void Execute() {
+        if constexpr (std::is_void_v<T>)
+            func();
+        else
+            result = func();
+        func = nullptr;
+    }
+
+    // AsyncJob Private Members
+    std::function<T(void)> func;
+    pstd::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+};
+
+// AsyncJob Function Definitions
+template <typename F>
+auto RunAsyncAfter(const std::vector<std::shared_ptr<AsyncJobBase>> &dependencies,
+                   F func) {
+    using R = std::invoke_result_t<F>;
+    auto job = std::make_shared<AsyncJob<R>>(std::move(func));
+    job->Start(dependencies);
+    return job;
+}
+
+template <typename F>
+auto RunAsync(F func) {
+    return RunAsyncAfter({}, std::move(func));
+}
+
+template <typename T>
+template <typename F>
+auto AsyncJob<T>::Then(F func) {
+    auto self = std::static_pointer_cast<AsyncJob<T>>(shared_from_this());
+    if constexpr (std::is_void_v<T>)
+        return RunAsyncAfter({self}, std::move(func));
+    else
+        return RunAsyncAfter({self}, [self, func = std::move(func)]() mutable {
+            return func(self->result.value());
+        });
+}
+
 // ThreadIndex Declaration
 extern thread_local int ThreadIndex;
 
+// ThreadAffinity Definition
+// Threads may be left unpinned, pinned to the CPUs of a NUMA node, or pinned
+// to individual CPUs. With either form of pinning, threads are assigned to
+// NUMA nodes in contiguous blocks of thread indices, and idle threads steal
+// work from threads on their own node first.
+enum class ThreadAffinity { None, NUMANode, CPU };
+
+std::string ToString(ThreadAffinity affinity);
+
 // ParallelFunction Declarations
-void ParallelInit(int nThreads = -1);
+void ParallelInit(int nThreads = -1, ThreadAffinity affinity = ThreadAffinity::None);
 void ParallelCleanup();
 
 int AvailableCores();
 int RunningThreads();
 int MaxThreadIndex();
 
+// Partitions the elements in [_begin_, _end_) so that those satisfying _pred_
+// come first, in parallel when there are at least _minParallelSize_ of them,
+// and returns a pointer to the first element that doesn't. Each chunk of
+// elements is counted and then scattered to its offsets on both sides, so
+// _pred_ is evaluated twice per element.
+template <typename T, typename Pred>
+T *ParallelPartition(T *begin, T *end, Pred pred, int64_t minParallelSize) {
+    int64_t n = end - begin;
+    if (n < minParallelSize)
+        return std::partition(begin, end, pred);
+
+    // Count elements satisfying _pred_ in each chunk
+    int64_t chunkSize = std::max<int64_t>(4096, n / (8 * RunningThreads()));
+    int64_t nChunks = (n + chunkSize - 1) / chunkSize;
+    std::vector<int64_t> chunkBelow(nChunks);
+    ParallelFor(0, nChunks, [&](int64_t chunk) {
+        int64_t count = 0;
+        for (int64_t i = chunk * chunkSize; i < std::min(n, (chunk + 1) * chunkSize); ++i)
+            count += pred(begin[i]) ? 1 : 0;
+        chunkBelow[chunk] = count;
+    });
+
+    // Compute output offsets for each chunk's elements on both sides
+    std::vector<int64_t> belowOffset(nChunks), aboveOffset(nChunks);
+    int64_t nBelow = 0;
+    for (int64_t chunk = 0; chunk < nChunks; ++chunk) {
+        belowOffset[chunk] = nBelow;
+        nBelow += chunkBelow[chunk];
+    }
+    for (int64_t chunk = 0, nAbove = 0; chunk < nChunks; ++chunk) {
+        aboveOffset[chunk] = nBelow + nAbove;
+        int64_t chunkEnd = std::min(n, (chunk + 1) * chunkSize);
+        nAbove += (chunkEnd - chunk * chunkSize) - chunkBelow[chunk];
+    }
+
+    // Scatter elements into temporary buffer and copy back
+    std::vector<T> partitioned(n);
+    ParallelFor(0, nChunks, [&](int64_t chunk) {
+        int64_t below = belowOffset[chunk], above = aboveOffset[chunk];
+        for (int64_t i = chunk * chunkSize; i < std::min(n, (chunk + 1) * chunkSize); ++i)
+            partitioned[pred(begin[i]) ? below++ : above++] = begin[i];
+    });
+    ParallelFor(0, n, [&](int64_t start, int64_t end) {
+        std::copy(&partitioned[start], &partitioned[end - 1] + 1, begin + start);
+    });
+    return begin + nBelow;
+}
+
+// NUMA Function Declarations
+int NUMANodes();
+// Spreads the pages that overlap the given memory round-robin across the NUMA
+// nodes so that no node's memory bandwidth is a bottleneck for data that all
+// threads read. It does nothing on systems with a single node.
+void InterleaveAcrossNUMANodes(void *ptr, size_t size);
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_PARALLEL_H
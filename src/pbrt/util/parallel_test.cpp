@@ -6,6 +6,7 @@
 #include <pbrt/pbrt.h>
 #include <pbrt/util/parallel.h>
 #include <atomic>
+#include <vector>
 
 using namespace pbrt;
 
@@ -44,3 +45,78 @@ TEST(Parallel, ForEachThread) {
     ForEachThread([&count] { --count; });
     EXPECT_EQ(0, count);
 }
+
+TEST(Parallel, Nested) {
+    std::atomic<int> counter{0};
+    ParallelFor(0, 100, [&](int64_t) {
+        ParallelFor(0, 100, [&](int64_t) { ++counter; });
+    });
+    EXPECT_EQ(100 * 100, counter);
+}
+
+TEST(Parallel, ChunkRanges) {
+    // Each index is visited exactly once, for ranges of various sizes
+    for (int n : {1, 2, 7, 64, 1000, 12345}) {
+        std::vector<std::atomic<int>> visits(n);
+        ParallelFor(0, n, [&](int64_t i) { ++visits[i]; });
+        for (int i = 0; i < n; ++i)
+            EXPECT_EQ(1, visits[i]) << n << " " << i;
+    }
+
+    // Tiles are ordered along a curve over a square grid, which doesn't match
+    // the tiling of wide or tall extents
+    for (Bounds2i extent : {Bounds2i({-3, 5}, {97, 44}), Bounds2i({0, 0}, {2000, 3}),
+                            Bounds2i({10, 10}, {13, 700})}) {
+        std::vector<std::atomic<int>> visits(extent.Area());
+        ParallelFor2D(extent, [&](Point2i p) {
+            ++visits[(p.y - extent.pMin.y) * extent.Diagonal().x + p.x - extent.pMin.x];
+        });
+        for (size_t i = 0; i < visits.size(); ++i)
+            EXPECT_EQ(1, visits[i]) << extent << " " << i;
+    }
+}
+
+TEST(Parallel, AsyncJob) {
+    auto job = RunAsync([]() { return 42; });
+    EXPECT_EQ(42, job->GetResult());
+    EXPECT_TRUE(job->IsReady());
+
+    auto square = RunAsync([]() { return 7; })->Then([](int v) { return v * v; });
+    EXPECT_EQ(49, square->GetResult());
+
+    std::atomic<int> counter{0};
+    auto incr = RunAsync([&]() { ++counter; });
+    incr->Then([&]() { ++counter; })->Wait();
+    EXPECT_EQ(2, counter);
+}
+
+TEST(Parallel, AsyncDependencies) {
+    // Each job of the diamond only runs after the ones it depends on
+    std::atomic<int> order{0};
+    int aOrder = -1, bOrder = -1, cOrder = -1, dOrder = -1;
+    auto a = RunAsync([&]() { aOrder = order++; });
+    auto b = RunAsyncAfter({a}, [&]() { bOrder = order++; });
+    auto c = RunAsyncAfter({a}, [&]() { cOrder = order++; });
+    auto d = RunAsyncAfter({b, c}, [&]() { dOrder = order++; });
+    d->Wait();
+    EXPECT_EQ(0, aOrder);
+    EXPECT_GT(bOrder, aOrder);
+    EXPECT_GT(cOrder, aOrder);
+    EXPECT_EQ(3, dOrder);
+
+    // Dependencies that have already finished don't hold jobs back
+    EXPECT_EQ(5, RunAsyncAfter({a, d}, []() { return 5; })->GetResult());
+}
+
+TEST(Parallel, AsyncChain) {
+    // Continuations are queued as their predecessors finish, so long chains
+    // don't tie up threads; ParallelFor() may be used inside jobs
+    auto job = RunAsync([]() { return 0; });
+    for (int i = 1; i < 100; ++i)
+        job = job->Then([i](int sum) {
+            std::atomic<int> count{0};
+            ParallelFor(0, i, [&](int64_t) { ++count; });
+            return sum + count;
+        });
+    EXPECT_EQ(99 * 100 / 2, job->GetResult());
+}
@@ -7,6 +7,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/hash.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/vecmath.h>
 
@@ -17,7 +18,9 @@ namespace pbrt {
 // PMJ02BN Table Declarations
 constexpr int nPMJ02bnSets = 5;
 constexpr int nPMJ02bnSamples = 65536;
-extern PBRT_CONST uint32_t pmj02bnSamples[nPMJ02bnSets][nPMJ02bnSamples][2];
+// Only the high 16 bits of each sample coordinate are stored; they are all that
+// the (0,2) stratification of the full set of samples depends on.
+extern PBRT_CONST uint16_t pmj02bnSamples[nPMJ02bnSets][nPMJ02bnSamples][2];
 
 // PMJ02BN Table Inline Functions
 PBRT_CPU_GPU inline Point2f GetPMJ02BNSample(int setIndex, int sampleIndex);
@@ -28,15 +31,21 @@ inline Point2f GetPMJ02BNSample(int setIndex, int sampleIndex) {
     DCHECK_LT(sampleIndex, nPMJ02bnSamples);
     sampleIndex %= nPMJ02bnSamples;
 
+    // Jitter the sample's low bits within its finest stratum; 8 more bits
+    // match _float_ precision and keep the sample less than one.
+    uint64_t jitter = MixBits((uint64_t(setIndex) << 32) | uint32_t(sampleIndex));
+    uint32_t x = (uint32_t(pmj02bnSamples[setIndex][sampleIndex][0]) << 16) |
+                 (uint32_t(jitter & 0xff) << 8);
+    uint32_t y = (uint32_t(pmj02bnSamples[setIndex][sampleIndex][1]) << 16) |
+                 (uint32_t((jitter >> 8) & 0xff) << 8);
+
     // Convert from fixed-point.
 #ifdef PBRT_IS_GPU_CODE
-    return Point2f(pmj02bnSamples[setIndex][sampleIndex][0] * 0x1p-32f,
-                   pmj02bnSamples[setIndex][sampleIndex][1] * 0x1p-32f);
+    return Point2f(x * 0x1p-32f, y * 0x1p-32f);
 #else
     // Double precision is key here for the pixel sample sorting, but not
     // necessary otherwise.
-    return Point2f(pmj02bnSamples[setIndex][sampleIndex][0] * 0x1p-32,
-                   pmj02bnSamples[setIndex][sampleIndex][1] * 0x1p-32);
+    return Point2f(x * 0x1p-32, y * 0x1p-32);
 #endif
 }
 
@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 
 #include <string>
+#include <string_view>
 
 // Hack: make util/log.h happy
 namespace pbrt {
@@ -134,6 +135,10 @@ using HasData =
 inline std::ostream &operator<<(std::ostream &os, const std::string &str) {
     return std::operator<<(os, str);
 }
+// ...or std::string_view
+inline std::ostream &operator<<(std::ostream &os, std::string_view str) {
+    return std::operator<<(os, str);
+}
 
 template <typename T>
 inline std::enable_if_t<HasSize<T>::value && HasData<T>::value, std::ostream &>
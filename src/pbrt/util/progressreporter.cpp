@@ -7,7 +7,10 @@
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <pbrt/gpu/util.h>
 #endif
+#include <pbrt/options.h>
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 
@@ -33,12 +36,22 @@ std::string Timer::ToString() const {
             .count());
 }
 
+// Progress Stream Local Variables
+// The --progress-file stream is shared by all of the ProgressReporters
+static std::mutex progressStreamMutex;
+static FILE *progressStream;
+
 // ProgressReporter Method Definitions
 ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title,
                                    bool quiet, bool gpu)
     : totalWork(std::max<int64_t>(1, totalWork)), title(title), quiet(quiet) {
-    workDone = 0;
     exitThread = false;
+    writeStream = Options && !Options->progressFile.empty();
+    if (quiet && !writeStream)
+        return;
+
+    nThreadWork = MaxThreadIndex();
+    threadWork = std::make_unique<ThreadWork[]>(nThreadWork);
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     if (gpu) {
@@ -54,8 +67,15 @@ ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title,
 #endif
 
     // Launch thread to periodically update progress bar
-    if (!quiet)
-        launchThread();
+    launchThread();
+}
+
+void ProgressReporter::SetRenderingRates(int64_t spw,
+                                         std::function<int64_t()> raysTracedFunc) {
+    std::lock_guard<std::mutex> lock(ratesMutex);
+    samplesPerWork = spw;
+    raysTraced = std::move(raysTracedFunc);
+    lastLineRays = raysTraced ? raysTraced() : 0;
 }
 
 void ProgressReporter::launchThread() {
@@ -78,6 +98,17 @@ ProgressReporter::~ProgressReporter() {
     Done();
 }
 
+int64_t ProgressReporter::workDone() const {
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (gpuEvents.size())
+        return gpuWorkDone;
+#endif
+    int64_t done = 0;
+    for (int i = 0; i < nThreadWork; ++i)
+        done += threadWork[i].done.load(std::memory_order_relaxed);
+    return std::min(done, totalWork);
+}
+
 void ProgressReporter::printBar() {
     int barLength = TerminalWidth() - 28;
     int totalPlusses = std::max<int>(2, barLength - title.size());
@@ -94,8 +125,10 @@ void ProgressReporter::printBar() {
     *s++ = ']';
     *s++ = ' ';
     *s++ = '\0';
-    fputs(buf.get(), stdout);
-    fflush(stdout);
+    if (!quiet) {
+        fputs(buf.get(), stdout);
+        fflush(stdout);
+    }
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     std::chrono::milliseconds sleepDuration(gpuEvents.size() ? 50 : 250);
@@ -106,10 +139,14 @@ void ProgressReporter::printBar() {
     int iterCount = 0;
     bool reallyExit = false;  // make sure we do one more go-round to get the final report
     while (!reallyExit) {
-        if (exitThread)
-            reallyExit = true;
-        else
-            std::this_thread::sleep_for(sleepDuration);
+        // Sleep until it's time for the next update; Done() wakes the thread
+        // up early so that it doesn't have to wait for the end of a long one
+        {
+            std::unique_lock<std::mutex> lock(exitMutex);
+            exitCondition.wait_for(lock, sleepDuration,
+                                   [this] { return bool(exitThread); });
+            reallyExit = exitThread;
+        }
 
         // Periodically increase sleepDuration to reduce overhead of
         // updates.
@@ -135,11 +172,17 @@ void ProgressReporter::printBar() {
                 else
                     LOG_FATAL("CUDA error: %s", cudaGetErrorString(err));
             }
-            workDone = gpuEventsFinishedOffset;
+            gpuWorkDone = gpuEventsFinishedOffset;
         }
 #endif
 
-        Float percentDone = Float(workDone) / Float(totalWork);
+        int64_t done = reallyExit ? totalWork : workDone();
+        if (writeStream)
+            writeProgressLine(done, reallyExit);
+        if (quiet)
+            continue;
+
+        Float percentDone = Float(done) / Float(totalWork);
         int plussesNeeded = std::round(totalPlusses * percentDone);
         while (plussesPrinted < plussesNeeded) {
             *curSpace++ = '+';
@@ -160,8 +203,51 @@ void ProgressReporter::printBar() {
     }
 }
 
+void ProgressReporter::writeProgressLine(int64_t done, bool finished) {
+    // Compute the rates since the previous line and the estimated time remaining
+    double elapsed = ElapsedSeconds();
+    std::string rates;
+    {
+        std::lock_guard<std::mutex> lock(ratesMutex);
+        double interval = std::max(elapsed - lastLineSeconds, 1e-6);
+        if (samplesPerWork > 0)
+            rates += StringPrintf(", \"samplesPerSecond\": %.1f",
+                                  (done - lastLineWork) * samplesPerWork / interval);
+        if (raysTraced) {
+            int64_t rays = raysTraced();
+            rates += StringPrintf(", \"raysPerSecond\": %.1f",
+                                  (rays - lastLineRays) / interval);
+            lastLineRays = rays;
+        }
+        lastLineSeconds = elapsed;
+        lastLineWork = done;
+    }
+    double fraction = double(done) / double(totalWork);
+    std::string eta = "null";
+    if (fraction > 0)
+        eta = StringPrintf("%.3f", std::max(0., elapsed / fraction - elapsed));
+
+    std::string line = StringPrintf(
+        "{\"title\": \"%s\", \"elapsedSeconds\": %.3f, \"workDone\": %d, "
+        "\"totalWork\": %d, \"fraction\": %.4f, \"etaSeconds\": %s%s, \"done\": %s}\n",
+        title, elapsed, done, totalWork, fraction, eta, rates, finished);
+
+    std::lock_guard<std::mutex> lock(progressStreamMutex);
+    if (!progressStream) {
+        progressStream = FOpenWrite(Options->progressFile);
+        if (!progressStream) {
+            Warning("%s: unable to open progress file: %s", Options->progressFile,
+                    ErrorString());
+            writeStream = false;
+            return;
+        }
+    }
+    fputs(line.c_str(), progressStream);
+    fflush(progressStream);
+}
+
 void ProgressReporter::Done() {
-    if (!quiet) {
+    if (threadWork) {
 #ifdef PBRT_BUILD_GPU_RENDERER
         if (gpuEvents.size()) {
             while (gpuEventsFinishedOffset < gpuEventsLaunchedOffset) {
@@ -170,18 +256,23 @@ void ProgressReporter::Done() {
                 if (err != cudaSuccess)
                     LOG_FATAL("CUDA error: %s", cudaGetErrorString(err));
             }
-            workDone = gpuEvents.size();
+            gpuWorkDone = gpuEvents.size();
         }
 #endif
 
         // Only let one thread shut things down.
         bool fa = false;
         if (exitThread.compare_exchange_strong(fa, true)) {
-            workDone = totalWork;
-            exitThread = true;
+            {
+                // Take the lock so that the update thread either sees
+                // _exitThread_ before it waits or is woken up here
+                std::lock_guard<std::mutex> lock(exitMutex);
+            }
+            exitCondition.notify_all();
             if (updateThread.joinable())
                 updateThread.join();
-            printf("\n");
+            if (!quiet)
+                printf("\n");
         }
     }
 }
@@ -189,7 +280,7 @@ void ProgressReporter::Done() {
 std::string ProgressReporter::ToString() const {
     return StringPrintf("[ ProgressReporter totalWork: %d title: %s "
                         "timer: %s workDone: %d exitThread: %s",
-                        totalWork, title, timer, workDone, exitThread);
+                        totalWork, title, timer, workDone(), exitThread);
 }
 
 static int TerminalWidth() {
@@ -7,9 +7,15 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/parallel.h>
+
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
@@ -53,22 +59,49 @@ class ProgressReporter {
     void Done();
     double ElapsedSeconds() const;
 
+    // Provides the number of pixel samples that each unit of work represents
+    // and a function that returns the number of rays traced so far, which are
+    // used for the rates written to the --progress-file stream.
+    void SetRenderingRates(int64_t samplesPerWork,
+                           std::function<int64_t()> raysTraced = {});
+
     std::string ToString() const;
 
   private:
     // ProgressReporter Private Methods
     void launchThread();
     void printBar();
+    int64_t workDone() const;
+    void writeProgressLine(int64_t done, bool finished);
 
     // ProgressReporter Private Members
     int64_t totalWork;
     std::string title;
     bool quiet;
+    // Whether progress is written to the --progress-file stream
+    bool writeStream = false;
     Timer timer;
-    std::atomic<int64_t> workDone;
+    // Each thread adds its work to its own counter, on its own cache line, so
+    // that updates from different threads don't contend; the update thread
+    // sums them when it wakes up.
+    struct alignas(64) ThreadWork {
+        std::atomic<int64_t> done{0};
+    };
+    std::unique_ptr<ThreadWork[]> threadWork;
+    int nThreadWork = 0;
+    std::atomic<int64_t> gpuWorkDone{0};
     std::atomic<bool> exitThread;
+    std::mutex exitMutex;
+    std::condition_variable exitCondition;
     std::thread updateThread;
 
+    // Rates for the --progress-file stream, protected by _ratesMutex_
+    std::mutex ratesMutex;
+    int64_t samplesPerWork = 0;
+    std::function<int64_t()> raysTraced;
+    double lastLineSeconds = 0;
+    int64_t lastLineWork = 0, lastLineRays = 0;
+
 #ifdef PBRT_BUILD_GPU_RENDERER
     std::vector<cudaEvent_t> gpuEvents;
     std::atomic<size_t> gpuEventsLaunchedOffset;
@@ -93,9 +126,10 @@ inline void ProgressReporter::Update(int64_t num) {
         return;
     }
 #endif
-    if (num == 0 || quiet)
+    if (num == 0 || !threadWork)
         return;
-    workDone += num;
+    int index = ThreadIndex < nThreadWork ? ThreadIndex : 0;
+    threadWork[index].done.fetch_add(num, std::memory_order_relaxed);
 }
 
 }  // namespace pbrt
@@ -12,6 +12,7 @@
 #include <pbrt/util/float.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/scattering.h>
@@ -553,25 +554,51 @@ void PiecewiseConstant2D::TestCompareDistributions(const PiecewiseConstant2D &da
 // AliasTable Method Definitions
 AliasTable::AliasTable(pstd::span<const Float> weights, Allocator alloc)
     : bins(weights.size(), alloc) {
+    // Large tables are normalized and sorted into work lists in parallel over
+    // fixed-size chunks whose results are merged in order, so that the table
+    // doesn't depend on the number of threads
+    constexpr size_t chunkSize = 64 * 1024;
+    size_t nChunks = (weights.size() + chunkSize - 1) / chunkSize;
+    auto forEachChunk = [&](std::function<void(size_t, size_t, size_t)> func) {
+        auto chunk = [&](int64_t c) {
+            func(c, c * chunkSize, std::min(weights.size(), (c + 1) * chunkSize));
+        };
+        if (nChunks > 1)
+            ParallelFor(0, nChunks, chunk);
+        else if (nChunks == 1)
+            chunk(0);
+    };
+
     // Normalize _weights_ to compute alias table PDF
-    Float sum = std::accumulate(weights.begin(), weights.end(), 0.);
+    std::vector<double> chunkSums(nChunks);
+    forEachChunk([&](size_t c, size_t start, size_t end) {
+        chunkSums[c] =
+            std::accumulate(weights.begin() + start, weights.begin() + end, 0.);
+    });
+    Float sum = std::accumulate(chunkSums.begin(), chunkSums.end(), 0.);
     CHECK_GT(sum, 0);
-    for (size_t i = 0; i < weights.size(); ++i)
-        bins[i].pdf = weights[i] / sum;
 
     // Create alias table work lists
     struct Outcome {
         Float pHat;
         size_t index;
     };
+    std::vector<std::vector<Outcome>> chunkUnder(nChunks), chunkOver(nChunks);
+    forEachChunk([&](size_t c, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            bins[i].pdf = weights[i] / sum;
+            // Add outcome _i_ to an alias table work list
+            Float pHat = bins[i].pdf * bins.size();
+            if (pHat < 1)
+                chunkUnder[c].push_back(Outcome{pHat, i});
+            else
+                chunkOver[c].push_back(Outcome{pHat, i});
+        }
+    });
     std::vector<Outcome> under, over;
-    for (size_t i = 0; i < bins.size(); ++i) {
-        // Add outcome _i_ to an alias table work list
-        Float pHat = bins[i].pdf * bins.size();
-        if (pHat < 1)
-            under.push_back(Outcome{pHat, i});
-        else
-            over.push_back(Outcome{pHat, i});
+    for (size_t c = 0; c < nChunks; ++c) {
+        under.insert(under.end(), chunkUnder[c].begin(), chunkUnder[c].end());
+        over.insert(over.end(), chunkOver[c].begin(), chunkOver[c].end());
     }
 
     // Process under and over work item together
@@ -636,6 +663,17 @@ int AliasTable::Sample(Float u, Float *pdfOut, Float *uRemapped) const {
     }
 }
 
+// AliasTable2D Method Definitions
+AliasTable2D::AliasTable2D(const Array2D<Float> &func, Bounds2f domain, Allocator alloc)
+    : domain(domain), resolution(func.xSize(), func.ySize()), table(alloc) {
+    // Sample uniformly if _func_ is zero everywhere
+    if (std::all_of(func.begin(), func.end(), [](Float v) { return v == 0; })) {
+        std::vector<Float> uniform(func.size(), Float(1));
+        table = AliasTable(uniform, alloc);
+    } else
+        table = AliasTable(pstd::span<const Float>(func), alloc);
+}
+
 std::string AliasTable::ToString() const {
     std::string s = "[ AliasTable bins: [ ";
     for (const auto &b : bins)
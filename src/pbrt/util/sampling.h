@@ -821,6 +821,52 @@ class AliasTable {
     pstd::vector<Bin> bins;
 };
 
+// AliasTable2D Definition
+// Samples a 2D piecewise-constant function in constant time by choosing one of its
+// cells with an alias table and then sampling uniformly within the cell.
+class AliasTable2D {
+  public:
+    // AliasTable2D Public Methods
+    AliasTable2D(Allocator alloc = {}) : table(alloc) {}
+    AliasTable2D(const Array2D<Float> &func, Bounds2f domain, Allocator alloc = {});
+
+    PBRT_CPU_GPU
+    Point2f Sample(Point2f u, Float *pdf = nullptr) const {
+        // Choose a cell and reuse the remapped sample to place the point within it
+        Float cellPMF, ux;
+        int index = table.Sample(u[0], &cellPMF, &ux);
+        int ix = index % resolution.x, iy = index / resolution.x;
+        if (pdf)
+            *pdf = cellPMF * resolution.x * resolution.y / domain.Area();
+        Point2f p((ix + ux) / resolution.x, std::min<Float>((iy + u[1]) / resolution.y,
+                                                            OneMinusEpsilon));
+        return domain.Lerp(p);
+    }
+
+    PBRT_CPU_GPU
+    Float PDF(Point2f pr) const {
+        Point2f p = Point2f(domain.Offset(pr));
+        int ix = Clamp(int(p[0] * resolution.x), 0, resolution.x - 1);
+        int iy = Clamp(int(p[1] * resolution.y), 0, resolution.y - 1);
+        return table.PDF(iy * resolution.x + ix) * resolution.x * resolution.y /
+               domain.Area();
+    }
+
+    PBRT_CPU_GPU
+    Point2i Resolution() const { return resolution; }
+
+    std::string ToString() const {
+        return StringPrintf("[ AliasTable2D domain: %s resolution: %s table: %s ]",
+                            domain, resolution, table);
+    }
+
+  private:
+    // AliasTable2D Private Members
+    Bounds2f domain;
+    Point2i resolution;
+    AliasTable table;
+};
+
 // SummedAreaTable Definition
 class SummedAreaTable {
   public:
@@ -1302,11 +1348,16 @@ class PiecewiseLinear2D {
   public:
     PiecewiseLinear2D(Allocator alloc)
         : m_param_values(alloc),
+          m_param_guide(alloc),
           m_data(alloc),
           m_marginal_cdf(alloc),
-          m_conditional_cdf(alloc) {
-        for (int i = 0; i < ArraySize; ++i)
+          m_conditional_cdf(alloc),
+          m_marginal_guide(alloc),
+          m_conditional_guide(alloc) {
+        for (int i = 0; i < ArraySize; ++i) {
             m_param_values.emplace_back(alloc);
+            m_param_guide.emplace_back(alloc);
+        }
     }
 
     /**
@@ -1334,16 +1385,21 @@ class PiecewiseLinear2D {
           m_patch_size(1.f / (xSize - 1), 1.f / (ySize - 1)),
           m_inv_patch_size(m_size - Vector2i(1, 1)),
           m_param_values(alloc),
+          m_param_guide(alloc),
           m_data(alloc),
           m_marginal_cdf(alloc),
-          m_conditional_cdf(alloc) {
+          m_conditional_cdf(alloc),
+          m_marginal_guide(alloc),
+          m_conditional_guide(alloc) {
         if (build_cdf && !normalize)
             LOG_FATAL("PiecewiseLinear2D: build_cdf implies normalize=true");
 
         /* Keep track of the dependence on additional parameters (optional) */
         uint32_t slices = 1;
-        for (int i = 0; i < ArraySize; ++i)
+        for (int i = 0; i < ArraySize; ++i) {
             m_param_values.emplace_back(alloc);
+            m_param_guide.emplace_back(alloc);
+        }
         for (int i = (int)Dimension - 1; i >= 0; --i) {
             if (param_res[i] < 1)
                 LOG_FATAL("PiecewiseLinear2D(): parameter resolution must be >= 1!");
@@ -1354,6 +1410,22 @@ class PiecewiseLinear2D {
                    sizeof(float) * param_res[i]);
             m_param_strides[i] = param_res[i] > 1 ? slices : 0;
             slices *= m_param_size[i];
+
+            /* Build guide table for finding parameter intervals */
+            m_param_guide_scale[i] = 0;
+            if (param_res[i] > 1) {
+                const float *values = m_param_values[i].data();
+                uint32_t n_buckets = 2 * param_res[i];
+                float range = values[param_res[i] - 1] - values[0];
+                if (range > 0)
+                    m_param_guide_scale[i] = n_buckets / range;
+                m_param_guide[i] = pstd::vector<uint32_t>(n_buckets);
+                for (uint32_t b = 0; b < n_buckets; ++b) {
+                    float start = values[0] + b * range / n_buckets;
+                    m_param_guide[i][b] = FindInterval(
+                        param_res[i], [&](size_t idx) { return values[idx] <= start; });
+                }
+            }
         }
 
         uint32_t n_values = xSize * ySize;
@@ -1402,6 +1474,8 @@ class PiecewiseLinear2D {
                 data_out += n_values;
                 data += n_values;
             }
+
+            build_guides(slices);
         } else {
             float *data_out = m_data.data();
 
@@ -1449,25 +1523,7 @@ class PiecewiseLinear2D {
 
         /* Look up parameter-related indices and weights (if Dimension != 0) */
         float param_weight[2 * ArraySize];
-        uint32_t slice_offset = 0u;
-        for (size_t dim = 0; dim < Dimension; ++dim) {
-            if (m_param_size[dim] == 1) {
-                param_weight[2 * dim] = 1.f;
-                param_weight[2 * dim + 1] = 0.f;
-                continue;
-            }
-
-            uint32_t param_index = FindInterval(m_param_size[dim], [&](uint32_t idx) {
-                return m_param_values[dim].data()[idx] <= param[dim];
-            });
-
-            Float p0 = m_param_values[dim][param_index],
-                  p1 = m_param_values[dim][param_index + 1];
-
-            param_weight[2 * dim + 1] = Clamp((param[dim] - p0) / (p1 - p0), 0, 1);
-            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
-            slice_offset += m_param_strides[dim] * param_index;
-        }
+        uint32_t slice_offset = param_lookup(param, param_weight);
 
         /* Sample the row first */
         uint32_t offset = 0;
@@ -1479,8 +1535,25 @@ class PiecewiseLinear2D {
                                      param_weight);
         };
 
-        uint32_t row = FindInterval(
-            m_size.y, [&](uint32_t idx) { return fetch_marginal(idx) < sample.y; });
+        /* Bound the row search using the guide tables of the interpolated slices */
+        uint32_t row_lo = 0, row_hi = m_size.y - 2;
+        if (!m_marginal_guide.empty()) {
+            uint32_t n_buckets = m_size.y;
+            uint32_t b = std::min<uint32_t>(sample.y * n_buckets, n_buckets - 1);
+            row_lo = m_size.y - 2;
+            row_hi = 0;
+            for_each_slice(slice_offset, param_weight, [&](uint32_t slice) {
+                const uint16_t *guide = &m_marginal_guide[slice * (n_buckets + 1)];
+                row_lo = std::min<uint32_t>(row_lo, guide[b]);
+                row_hi = std::max<uint32_t>(row_hi, guide[b + 1]);
+            });
+            /* Allow for round-off error in the bucket computation */
+            row_lo = row_lo > 0 ? row_lo - 1 : 0;
+            row_hi = std::min<uint32_t>(row_hi + 1, m_size.y - 2);
+        }
+        uint32_t row = row_lo + FindInterval(row_hi - row_lo + 2, [&](uint32_t idx) {
+                           return fetch_marginal(row_lo + idx) < sample.y;
+                       });
 
         sample.y -= fetch_marginal(row);
 
@@ -1512,8 +1585,41 @@ class PiecewiseLinear2D {
             return (1.f - sample.y) * v0 + sample.y * v1;
         };
 
-        uint32_t col = FindInterval(
-            m_size.x, [&](uint32_t idx) { return fetch_conditional(idx) < sample.x; });
+        /* Bound the column search using the guides of the interpolated rows */
+        uint32_t col_lo = 0, col_hi = m_size.x - 2;
+        if (!m_conditional_guide.empty() && sample.x > 0) {
+            uint32_t n_buckets = m_size.x;
+            col_lo = m_size.x - 2;
+            col_hi = 0;
+            for_each_slice(slice_offset, param_weight, [&](uint32_t slice) {
+                for (int r = 0; r < 2; ++r) {
+                    if ((r == 0 && sample.y == 1) || (r == 1 && sample.y == 0))
+                        continue;
+                    uint32_t row_index = slice * m_size.y + row + r;
+                    float total = m_conditional_cdf[(row_index + 1) * m_size.x - 1];
+                    if (sample.x >= total) {
+                        /* The row's interval is the last one with a CDF below
+                           _sample.x_ */
+                        col_lo = std::min<uint32_t>(
+                            col_lo, m_conditional_guide[row_index * (n_buckets + 1) +
+                                                        n_buckets - 1]);
+                        col_hi = m_size.x - 2;
+                        continue;
+                    }
+                    uint32_t b = std::min<uint32_t>(sample.x / total * n_buckets,
+                                                    n_buckets - 1);
+                    const uint16_t *guide =
+                        &m_conditional_guide[row_index * (n_buckets + 1)];
+                    col_lo = std::min<uint32_t>(col_lo, guide[b]);
+                    col_hi = std::max<uint32_t>(col_hi, guide[b + 1]);
+                }
+            });
+            col_lo = col_lo > 0 ? col_lo - 1 : 0;
+            col_hi = std::min<uint32_t>(col_hi + 1, m_size.x - 2);
+        }
+        uint32_t col = col_lo + FindInterval(col_hi - col_lo + 2, [&](uint32_t idx) {
+                           return fetch_conditional(col_lo + idx) < sample.x;
+                       });
 
         sample.x -= fetch_conditional(col);
 
@@ -1544,25 +1650,7 @@ class PiecewiseLinear2D {
     PLSample Invert(Vector2f sample, const Float *param = nullptr) const {
         /* Look up parameter-related indices and weights (if Dimension != 0) */
         float param_weight[2 * ArraySize];
-        uint32_t slice_offset = 0u;
-        for (size_t dim = 0; dim < Dimension; ++dim) {
-            if (m_param_size[dim] == 1) {
-                param_weight[2 * dim] = 1.f;
-                param_weight[2 * dim + 1] = 0.f;
-                continue;
-            }
-
-            uint32_t param_index = FindInterval(m_param_size[dim], [&](uint32_t idx) {
-                return m_param_values[dim][idx] <= param[dim];
-            });
-
-            float p0 = m_param_values[dim][param_index],
-                  p1 = m_param_values[dim][param_index + 1];
-
-            param_weight[2 * dim + 1] = Clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
-            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
-            slice_offset += m_param_strides[dim] * param_index;
-        }
+        uint32_t slice_offset = param_lookup(param, param_weight);
 
         /* Fetch values at corners of bilinear patch */
         sample.x *= m_inv_patch_size.x;
@@ -1631,26 +1719,7 @@ class PiecewiseLinear2D {
     float Evaluate(Vector2f pos, const Float *param = nullptr) const {
         /* Look up parameter-related indices and weights (if Dimension != 0) */
         float param_weight[2 * ArraySize];
-        uint32_t slice_offset = 0u;
-
-        for (size_t dim = 0; dim < Dimension; ++dim) {
-            if (m_param_size[dim] == 1) {
-                param_weight[2 * dim] = 1.f;
-                param_weight[2 * dim + 1] = 0.f;
-                continue;
-            }
-
-            uint32_t param_index = FindInterval(m_param_size[dim], [&](uint32_t idx) {
-                return m_param_values[dim][idx] <= param[dim];
-            });
-
-            float p0 = m_param_values[dim][param_index],
-                  p1 = m_param_values[dim][param_index + 1];
-
-            param_weight[2 * dim + 1] = Clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
-            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
-            slice_offset += m_param_strides[dim] * param_index;
-        }
+        uint32_t slice_offset = param_lookup(param, param_weight);
 
         /* Compute linear interpolation weights */
         pos.x *= m_inv_patch_size.x;
@@ -1680,12 +1749,91 @@ class PiecewiseLinear2D {
     size_t BytesUsed() const {
         size_t sum = 4 * (m_data.capacity() + m_marginal_cdf.capacity() +
                           m_conditional_cdf.capacity());
+        sum += 2 * (m_marginal_guide.capacity() + m_conditional_guide.capacity());
         for (int i = 0; i < ArraySize; ++i)
-            sum += m_param_values[i].capacity();
+            sum += 4 * (m_param_values[i].capacity() + m_param_guide[i].capacity());
         return sum;
     }
 
   private:
+    /// Build guide tables that bound the CDF searches in \c Sample()
+    void build_guides(uint32_t slices) {
+        /* The guide for a CDF stores the interval that contains each of a set
+           of uniformly-spaced values; the interval of any value in between is
+           bounded by the entries for the neighboring values. */
+        if (m_size.x > 65535 || m_size.y > 65535)
+            return;
+        auto build = [](const float *cdf, int n, float total, uint16_t *guide) {
+            for (int b = 0; b <= n; ++b) {
+                float u = total * b / n;
+                guide[b] = FindInterval(n, [&](size_t idx) { return cdf[idx] < u; });
+            }
+        };
+
+        m_marginal_guide = pstd::vector<uint16_t>(slices * (m_size.y + 1));
+        m_conditional_guide = pstd::vector<uint16_t>(slices * m_size.y * (m_size.x + 1));
+        for (uint32_t slice = 0; slice < slices; ++slice) {
+            const float *marginal_cdf = &m_marginal_cdf[slice * m_size.y];
+            build(marginal_cdf, m_size.y, 1.f,
+                  &m_marginal_guide[slice * (m_size.y + 1)]);
+            for (int y = 0; y < m_size.y; ++y) {
+                uint32_t row_index = slice * m_size.y + y;
+                const float *cdf = &m_conditional_cdf[row_index * m_size.x];
+                build(cdf, m_size.x, cdf[m_size.x - 1],
+                      &m_conditional_guide[row_index * (m_size.x + 1)]);
+            }
+        }
+    }
+
+    /// Compute the slice offset and interpolation weights for \c param
+    PBRT_CPU_GPU
+    uint32_t param_lookup(const Float *param, float *param_weight) const {
+        uint32_t slice_offset = 0u;
+        for (size_t dim = 0; dim < Dimension; ++dim) {
+            if (m_param_size[dim] == 1) {
+                param_weight[2 * dim] = 1.f;
+                param_weight[2 * dim + 1] = 0.f;
+                continue;
+            }
+
+            /* Find the parameter interval starting from its guide table entry */
+            const float *values = m_param_values[dim].data();
+            uint32_t n_buckets = m_param_guide[dim].size();
+            Float t = (param[dim] - values[0]) * m_param_guide_scale[dim];
+            uint32_t b = (t > 0) ? ((t < n_buckets) ? uint32_t(t) : n_buckets - 1) : 0;
+            uint32_t param_index = m_param_guide[dim][b];
+            while (param_index > 0 && values[param_index] > param[dim])
+                --param_index;
+            while (param_index < m_param_size[dim] - 2 &&
+                   values[param_index + 1] <= param[dim])
+                ++param_index;
+
+            float p0 = values[param_index], p1 = values[param_index + 1];
+
+            param_weight[2 * dim + 1] = Clamp((param[dim] - p0) / (p1 - p0), 0.f, 1.f);
+            param_weight[2 * dim] = 1.f - param_weight[2 * dim + 1];
+            slice_offset += m_param_strides[dim] * param_index;
+        }
+        return slice_offset;
+    }
+
+    /// Call \c func for each slice that contributes to the interpolated value
+    template <typename F>
+    PBRT_CPU_GPU void for_each_slice(uint32_t slice_offset, const float *param_weight,
+                                     F func) const {
+        for (uint32_t corner = 0; corner < (1u << Dimension); ++corner) {
+            uint32_t slice = slice_offset;
+            float weight = 1.f;
+            for (size_t dim = 0; dim < Dimension; ++dim) {
+                bool upper = corner & (1u << dim);
+                weight *= param_weight[2 * dim + (upper ? 1 : 0)];
+                slice += upper ? m_param_strides[dim] : 0;
+            }
+            if (weight > 0)
+                func(slice);
+        }
+    }
+
     template <size_t Dim, std::enable_if_t<Dim != 0, int> = 0>
     PBRT_CPU_GPU Float lookup(const float *data, uint32_t i0, uint32_t size,
                               const float *param_weight) const {
@@ -1719,12 +1867,20 @@ class PiecewiseLinear2D {
     /// Discretization of each parameter domain
     pstd::vector<FloatStorage> m_param_values;
 
+    /// Guide tables giving initial parameter intervals and their scale factors
+    pstd::vector<pstd::vector<uint32_t>> m_param_guide;
+    float m_param_guide_scale[ArraySize];
+
     /// Density values
     FloatStorage m_data;
 
     /// Marginal and conditional PDFs
     FloatStorage m_marginal_cdf;
     FloatStorage m_conditional_cdf;
+
+    /// Guide tables for the marginal and conditional CDFs
+    pstd::vector<uint16_t> m_marginal_guide;
+    pstd::vector<uint16_t> m_conditional_guide;
 };
 
 }  // namespace pbrt
@@ -152,6 +152,50 @@ TEST(LowDiscrepancy, SobolFirstDimension) {
     }
 }
 
+TEST(LowDiscrepancy, RadicalInversePermutationsShared) {
+    pstd::vector<DigitPermutation> *perms = ComputeRadicalInversePermutations(17);
+    EXPECT_EQ(perms, ComputeRadicalInversePermutations(17));
+    EXPECT_NE(perms, ComputeRadicalInversePermutations(18));
+}
+
+TEST(LowDiscrepancy, ScrambledRadicalInverseFastBases) {
+    // The specialized implementations for small bases should match the
+    // general one
+    pstd::vector<DigitPermutation> *perms = ComputeRadicalInversePermutations(5);
+    for (int baseIndex = 0; baseIndex < 8; ++baseIndex) {
+        const DigitPermutation &perm = (*perms)[baseIndex];
+        int base = Primes[baseIndex];
+        for (uint64_t a : {0ull, 1ull, 2ull, 17ull, 1234567ull, 0xfedcba9876543ull})
+            for (uint64_t i = a; i < a + 1000; ++i) {
+                Float invBase = (Float)1 / (Float)base, invBaseM = 1;
+                uint64_t reversedDigits = 0, ai = i;
+                for (int digitIndex = 0; 1 - invBaseM < 1; ++digitIndex) {
+                    uint64_t next = ai / base;
+                    int digitValue = ai - next * base;
+                    reversedDigits =
+                        reversedDigits * base + perm.Permute(digitIndex, digitValue);
+                    invBaseM *= invBase;
+                    ai = next;
+                }
+                EXPECT_EQ(std::min(invBaseM * reversedDigits, OneMinusEpsilon),
+                          ScrambledRadicalInverse(baseIndex, i, perm))
+                    << "base " << base << " a " << i;
+            }
+    }
+}
+
+TEST(LowDiscrepancy, SobolSampleBits) {
+    // Sobol samples computed for several dimensions at once should match the
+    // ones computed one dimension at a time
+    for (int dim = 0; dim < 8; ++dim)
+        for (int i = 0; i < 4096; i += 7) {
+            pstd::array<uint32_t, 4> v = SobolSampleBits<4>(i, dim);
+            for (int d = 0; d < 4; ++d)
+                EXPECT_EQ(SobolSample(i, dim + d, NoRandomizer()),
+                          std::min(v[d] * 0x1p-32f, FloatOneMinusEpsilon));
+        }
+}
+
 TEST(Sobol, IntervalToIndex) {
     for (int logRes = 0; logRes < 8; ++logRes) {
         int res = 1 << logRes;
@@ -380,6 +424,39 @@ TEST(PiecewiseConstant2D, InverseRandoms) {
     }
 }
 
+TEST(PiecewiseLinear2D, InverseRandoms) {
+    // Two-parameter distribution with a non-uniform parameter grid and some
+    // rows and slices with zero density.
+    int nx = 9, ny = 7;
+    pstd::array<int, 2> paramRes = {3, 4};
+    float param0[3] = {0.f, 0.1f, 1.f}, param1[4] = {-2.f, -1.5f, 0.f, 4.f};
+    std::vector<float> values;
+    RNG rng;
+    for (int slice = 0; slice < paramRes[0] * paramRes[1]; ++slice)
+        for (int y = 0; y < ny; ++y)
+            for (int x = 0; x < nx; ++x) {
+                bool zero = (y == 2 && slice % 2 == 0) || (x < 3 && slice == 5);
+                values.push_back(zero ? 0.f : rng.Uniform<float>());
+            }
+    PiecewiseLinear2D<2> dist(Allocator(), values.data(), nx, ny, paramRes,
+                              {param0, param1});
+
+    for (int i = 0; i < 1000; ++i) {
+        Float param[2] = {Lerp(rng.Uniform<Float>(), -0.1f, 1.1f),
+                          Lerp(rng.Uniform<Float>(), -3.f, 5.f)};
+        if (i % 10 == 0)
+            param[0] = 0.1f;
+        Vector2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+
+        auto s = dist.Sample(u, param);
+        auto inv = dist.Invert(s.p, param);
+        EXPECT_LT(std::abs(inv.p.x - u.x), 1e-3f) << u << " -> " << s.p;
+        EXPECT_LT(std::abs(inv.p.y - u.y), 1e-3f) << u << " -> " << s.p;
+        EXPECT_LT(std::abs(s.pdf - inv.pdf), 1e-3f * inv.pdf);
+        EXPECT_LT(std::abs(s.pdf - dist.Evaluate(s.p, param)), 1e-3f * s.pdf);
+    }
+}
+
 TEST(PiecewiseConstant2D, FromFuncLInfinity) {
     auto f = [](Float x, Float y) { return x * x * y; };
     auto values = Sample2DFunction(f, 4, 2, 1, Bounds2f(Point2f(0, 0), Point2f(1, 1)));
@@ -1209,6 +1286,46 @@ TEST(AliasTable, Varying) {
     }
 }
 
+TEST(AliasTable, Large) {
+    // Enough outcomes that the table is built in parallel over several chunks
+    RNG rng;
+    std::vector<Float> values;
+    int n = 300000;
+    for (int i = 0; i < n; ++i)
+        values.push_back(i % 7 == 0 ? 0 : rng.Uniform<Float>());
+    double sum = std::accumulate(values.begin(), values.end(), 0.);
+
+    AliasTable table(values);
+    for (int i = 0; i < n; ++i)
+        EXPECT_FLOAT_EQ(values[i] / sum, table.PDF(i));
+    for (Float u : Stratified1D(10000)) {
+        Float pdf;
+        int offset = table.Sample(u, &pdf);
+        ASSERT_TRUE(offset >= 0 && offset < n);
+        EXPECT_GT(values[offset], 0);
+        EXPECT_EQ(pdf, table.PDF(offset));
+    }
+}
+
+TEST(AliasTable2D, VsPiecewiseConstant2D) {
+    RNG rng;
+    Array2D<Float> func(17, 9);
+    for (Float &v : func)
+        v = rng.Uniform<Float>() < .2f ? 0 : rng.Uniform<Float>();
+    Bounds2f domain(Point2f(-1, 0), Point2f(3, 2));
+    AliasTable2D alias(func, domain);
+    PiecewiseConstant2D pc(func, domain);
+
+    for (Point2f u : Stratified2D(64, 64)) {
+        Float pdf;
+        Point2f p = alias.Sample(u, &pdf);
+        EXPECT_TRUE(Inside(p, domain));
+        EXPECT_GT(pdf, 0);
+        EXPECT_FLOAT_EQ(pdf, alias.PDF(p));
+        EXPECT_FLOAT_EQ(pdf, pc.PDF(p));
+    }
+}
+
 TEST(SummedArea, Constant) {
     Array2D<Float> v(4, 4);
 
@@ -113,29 +113,31 @@ class TrowbridgeReitzDistribution {
         : alpha_x(alpha_x), alpha_y(alpha_y) {}
 
     PBRT_CPU_GPU inline Float D(const Vector3f &wm) const {
-        Float tan2Theta = Tan2Theta(wm);
-        if (IsInf(tan2Theta))
-            return 0;
-        Float cos4Theta = Sqr(Cos2Theta(wm));
+        Float cos2Theta = Cos2Theta(wm), cos4Theta = Sqr(cos2Theta);
         if (cos4Theta < 1e-16f)
             return 0;
-        Float e = tan2Theta * (Sqr(CosPhi(wm) / alpha_x) + Sqr(SinPhi(wm) / alpha_y));
+        // Compute $\tan^2\theta (\cos^2\phi/\alpha_x^2 + \sin^2\phi/\alpha_y^2)$ directly
+        Float e = (Sqr(wm.x / alpha_x) + Sqr(wm.y / alpha_y)) / cos2Theta;
         return 1 / (Pi * alpha_x * alpha_y * cos4Theta * Sqr(1 + e));
     }
 
     PBRT_CPU_GPU
     bool EffectivelySmooth() const { return std::max(alpha_x, alpha_y) < 1e-3f; }
 
+    PBRT_CPU_GPU
+    Float EffectiveAlpha() const { return std::sqrt(alpha_x * alpha_y); }
+
     PBRT_CPU_GPU
     Float G1(const Vector3f &w) const { return 1 / (1 + Lambda(w)); }
 
     PBRT_CPU_GPU
     Float Lambda(const Vector3f &w) const {
-        Float tan2Theta = Tan2Theta(w);
-        if (IsInf(tan2Theta))
+        Float cos2Theta = Cos2Theta(w);
+        if (cos2Theta == 0)
             return 0;
-        Float alpha2 = Sqr(CosPhi(w) * alpha_x) + Sqr(SinPhi(w) * alpha_y);
-        return .5f * (std::sqrt(1 + alpha2 * tan2Theta) - 1);
+        // Compute $\alpha^2\tan^2\theta$ without finding $\phi$
+        Float alpha2Tan2Theta = (Sqr(w.x * alpha_x) + Sqr(w.y * alpha_y)) / cos2Theta;
+        return .5f * (std::sqrt(1 + alpha2Tan2Theta) - 1);
     }
 
     PBRT_CPU_GPU
@@ -162,8 +164,9 @@ class TrowbridgeReitzDistribution {
 
         // Sample parameterization of projected microfacet area
         Float r = std::sqrt(u[0]);
-        Float phi = 2 * Pi * u[1];
-        Float t1 = r * std::cos(phi), t2 = r * std::sin(phi);
+        Float cosPhi = std::cos(2 * Pi * u[1]);
+        Float sinPhi = std::copysign(SafeSqrt(1 - Sqr(cosPhi)), Float(0.5f) - u[1]);
+        Float t1 = r * cosPhi, t2 = r * sinPhi;
         Float s = .5f * (1 + wh.z);
         t2 = (1 - s) * std::sqrt(1 - Sqr(t1)) + s * t2;
 
@@ -0,0 +1,474 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_SIMD_H
+#define PBRT_UTIL_SIMD_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/float.h>
+#include <pbrt/util/math.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// SIMD instruction set selection: explicit vector code is only used for
+// 32-bit floats in CPU code; everything else uses the portable loops in the
+// generic _SIMDFloat_ template.
+#if !defined(PBRT_IS_GPU_CODE) && !defined(__CUDACC__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PBRT_HAS_SSE2
+#include <emmintrin.h>
+#if defined(__AVX__)
+#define PBRT_HAS_AVX
+#endif
+#if defined(__AVX__) || defined(__FMA__)
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define PBRT_HAS_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+namespace pbrt {
+
+// SIMDFloat Definition
+// _SIMDFloat<N>_ holds _N_ _Float_ values and provides the elementwise
+// operations that _SampledSpectrum_ needs. The generic template uses scalar
+// loops; the specializations below map the operations directly to SSE2,
+// NEON, or AVX instructions. They give the same results as the scalar code
+// for non-NaN values other than in the order of the additions in _ReduceSum()_
+// and, without FMA instructions, the rounding of _FastExp()_'s polynomial.
+template <int N>
+class SIMDFloat {
+  public:
+    // SIMDFloat Public Methods
+    SIMDFloat() = default;
+    PBRT_CPU_GPU
+    explicit SIMDFloat(Float f) {
+        for (int i = 0; i < N; ++i)
+            v[i] = f;
+    }
+
+    PBRT_CPU_GPU
+    static SIMDFloat Load(const Float *p) {
+        SIMDFloat r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = p[i];
+        return r;
+    }
+    PBRT_CPU_GPU
+    void Store(Float *p) const {
+        for (int i = 0; i < N; ++i)
+            p[i] = v[i];
+    }
+
+    PBRT_CPU_GPU
+    SIMDFloat operator+(SIMDFloat b) const {
+        return Map(b, [](Float x, Float y) { return x + y; });
+    }
+    PBRT_CPU_GPU
+    SIMDFloat operator-(SIMDFloat b) const {
+        return Map(b, [](Float x, Float y) { return x - y; });
+    }
+    PBRT_CPU_GPU
+    SIMDFloat operator*(SIMDFloat b) const {
+        return Map(b, [](Float x, Float y) { return x * y; });
+    }
+    PBRT_CPU_GPU
+    SIMDFloat operator/(SIMDFloat b) const {
+        return Map(b, [](Float x, Float y) { return x / y; });
+    }
+    PBRT_CPU_GPU
+    SIMDFloat operator-() const {
+        SIMDFloat r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = -v[i];
+        return r;
+    }
+
+    PBRT_CPU_GPU
+    friend SIMDFloat Min(SIMDFloat a, SIMDFloat b) {
+        return a.Map(b, [](Float x, Float y) { return std::min(x, y); });
+    }
+    PBRT_CPU_GPU
+    friend SIMDFloat Max(SIMDFloat a, SIMDFloat b) {
+        return a.Map(b, [](Float x, Float y) { return std::max(x, y); });
+    }
+    PBRT_CPU_GPU
+    friend SIMDFloat SafeDiv(SIMDFloat a, SIMDFloat b) {
+        return a.Map(b, [](Float x, Float y) { return (y != 0) ? x / y : Float(0); });
+    }
+    PBRT_CPU_GPU
+    friend SIMDFloat FastExp(SIMDFloat a) {
+        SIMDFloat r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = FastExp(a.v[i]);
+        return r;
+    }
+    PBRT_CPU_GPU
+    friend SIMDFloat Abs(SIMDFloat a) {
+        SIMDFloat r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = std::abs(a.v[i]);
+        return r;
+    }
+
+    PBRT_CPU_GPU
+    Float ReduceMin() const {
+        Float m = v[0];
+        for (int i = 1; i < N; ++i)
+            m = std::min(m, v[i]);
+        return m;
+    }
+    PBRT_CPU_GPU
+    Float ReduceMax() const {
+        Float m = v[0];
+        for (int i = 1; i < N; ++i)
+            m = std::max(m, v[i]);
+        return m;
+    }
+    PBRT_CPU_GPU
+    Float ReduceSum() const {
+        Float sum = v[0];
+        for (int i = 1; i < N; ++i)
+            sum += v[i];
+        return sum;
+    }
+
+  private:
+    // SIMDFloat Private Methods
+    template <typename F>
+    PBRT_CPU_GPU SIMDFloat Map(SIMDFloat b, F func) const {
+        SIMDFloat r;
+        for (int i = 0; i < N; ++i)
+            r.v[i] = func(v[i], b.v[i]);
+        return r;
+    }
+
+    // SIMDFloat Private Members
+    Float v[N];
+};
+
+#if defined(PBRT_HAS_SSE2)
+// SIMDFloat<4> SSE2 Specialization
+template <>
+class SIMDFloat<4> {
+  public:
+    // SIMDFloat<4> Public Methods
+    SIMDFloat() = default;
+    explicit SIMDFloat(float f) : v(_mm_set1_ps(f)) {}
+    explicit SIMDFloat(__m128 v) : v(v) {}
+
+    static SIMDFloat Load(const float *p) { return SIMDFloat(_mm_loadu_ps(p)); }
+    void Store(float *p) const { _mm_storeu_ps(p, v); }
+
+    SIMDFloat operator+(SIMDFloat b) const { return SIMDFloat(_mm_add_ps(v, b.v)); }
+    SIMDFloat operator-(SIMDFloat b) const { return SIMDFloat(_mm_sub_ps(v, b.v)); }
+    SIMDFloat operator*(SIMDFloat b) const { return SIMDFloat(_mm_mul_ps(v, b.v)); }
+    SIMDFloat operator/(SIMDFloat b) const { return SIMDFloat(_mm_div_ps(v, b.v)); }
+    SIMDFloat operator-() const {
+        return SIMDFloat(_mm_xor_ps(v, _mm_set1_ps(-0.f)));
+    }
+
+    // The operand order matches std::min() and std::max(), which return their
+    // first argument if either is NaN.
+    friend SIMDFloat Min(SIMDFloat a, SIMDFloat b) {
+        return SIMDFloat(_mm_min_ps(b.v, a.v));
+    }
+    friend SIMDFloat Max(SIMDFloat a, SIMDFloat b) {
+        return SIMDFloat(_mm_max_ps(b.v, a.v));
+    }
+    friend SIMDFloat SafeDiv(SIMDFloat a, SIMDFloat b) {
+        // Divide by one in the zero lanes so that no infinities are generated
+        __m128 nonZero = _mm_cmpneq_ps(b.v, _mm_setzero_ps());
+        __m128 d = _mm_or_ps(_mm_and_ps(nonZero, b.v),
+                             _mm_andnot_ps(nonZero, _mm_set1_ps(1.f)));
+        return SIMDFloat(_mm_and_ps(nonZero, _mm_div_ps(a.v, d)));
+    }
+    friend SIMDFloat Abs(SIMDFloat a) {
+        return SIMDFloat(_mm_andnot_ps(_mm_set1_ps(-0.f), a.v));
+    }
+    friend SIMDFloat FastExp(SIMDFloat a) {
+        // Compute $x'$ such that $\roman{e}^x = 2^{x'}$
+        __m128 xp = _mm_mul_ps(a.v, _mm_set1_ps(1.442695041f));
+
+        // Find integer and fractional components of $x'$
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(xp));
+        __m128 fxp = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, xp), _mm_set1_ps(1.f)));
+        __m128 f = _mm_sub_ps(xp, fxp);
+        __m128i i = _mm_cvttps_epi32(fxp);
+
+        // Evaluate polynomial approximation of $2^f$
+        __m128 twoToF = MulAdd(f, _mm_set1_ps(0.0781455737f), _mm_set1_ps(0.226173572f));
+        twoToF = MulAdd(f, twoToF, _mm_set1_ps(0.695556856f));
+        twoToF = MulAdd(f, twoToF, _mm_set1_ps(1.f));
+
+        // Scale $2^f$ by $2^i$ and return final result
+        __m128i bits = _mm_castps_si128(twoToF);
+        __m128i exponent = _mm_add_epi32(
+            _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)), i);
+        __m128i signAndSignificand = _mm_set1_epi32(int(0x807fffffu));
+        bits = _mm_and_si128(bits, signAndSignificand);
+        bits = _mm_or_si128(
+            bits, _mm_slli_epi32(_mm_add_epi32(exponent, _mm_set1_epi32(127)), 23));
+        __m128 underflow =
+            _mm_castsi128_ps(_mm_cmplt_epi32(exponent, _mm_set1_epi32(-126)));
+        __m128 overflow =
+            _mm_castsi128_ps(_mm_cmpgt_epi32(exponent, _mm_set1_epi32(127)));
+        __m128 r = _mm_andnot_ps(underflow, _mm_castsi128_ps(bits));
+        r = _mm_or_ps(_mm_andnot_ps(overflow, r),
+                      _mm_and_ps(overflow, _mm_set1_ps(Infinity)));
+        return SIMDFloat(r);
+    }
+
+    float ReduceMin() const {
+        __m128 m = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_min_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(m);
+    }
+    float ReduceMax() const {
+        __m128 m = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(m);
+    }
+    float ReduceSum() const {
+        __m128 s = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+        s = _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+        return _mm_cvtss_f32(s);
+    }
+
+    __m128 v;
+
+  private:
+    static __m128 MulAdd(__m128 a, __m128 b, __m128 c) {
+#if defined(__FMA__)
+        return _mm_fmadd_ps(a, b, c);
+#else
+        return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+    }
+};
+
+#elif defined(PBRT_HAS_NEON)
+// SIMDFloat<4> NEON Specialization
+template <>
+class SIMDFloat<4> {
+  public:
+    // SIMDFloat<4> Public Methods
+    SIMDFloat() = default;
+    explicit SIMDFloat(float f) : v(vdupq_n_f32(f)) {}
+    explicit SIMDFloat(float32x4_t v) : v(v) {}
+
+    static SIMDFloat Load(const float *p) { return SIMDFloat(vld1q_f32(p)); }
+    void Store(float *p) const { vst1q_f32(p, v); }
+
+    SIMDFloat operator+(SIMDFloat b) const { return SIMDFloat(vaddq_f32(v, b.v)); }
+    SIMDFloat operator-(SIMDFloat b) const { return SIMDFloat(vsubq_f32(v, b.v)); }
+    SIMDFloat operator*(SIMDFloat b) const { return SIMDFloat(vmulq_f32(v, b.v)); }
+    SIMDFloat operator/(SIMDFloat b) const { return SIMDFloat(vdivq_f32(v, b.v)); }
+    SIMDFloat operator-() const { return SIMDFloat(vnegq_f32(v)); }
+
+    friend SIMDFloat Min(SIMDFloat a, SIMDFloat b) {
+        return SIMDFloat(vbslq_f32(vcltq_f32(b.v, a.v), b.v, a.v));
+    }
+    friend SIMDFloat Max(SIMDFloat a, SIMDFloat b) {
+        return SIMDFloat(vbslq_f32(vcltq_f32(a.v, b.v), b.v, a.v));
+    }
+    friend SIMDFloat SafeDiv(SIMDFloat a, SIMDFloat b) {
+        // Divide by one in the zero lanes so that no infinities are generated
+        uint32x4_t zero = vceqq_f32(b.v, vdupq_n_f32(0.f));
+        float32x4_t q = vdivq_f32(a.v, vbslq_f32(zero, vdupq_n_f32(1.f), b.v));
+        return SIMDFloat(vbslq_f32(zero, vdupq_n_f32(0.f), q));
+    }
+    friend SIMDFloat Abs(SIMDFloat a) { return SIMDFloat(vabsq_f32(a.v)); }
+    friend SIMDFloat FastExp(SIMDFloat a) {
+        // Compute $x'$ such that $\roman{e}^x = 2^{x'}$
+        float32x4_t xp = vmulq_f32(a.v, vdupq_n_f32(1.442695041f));
+
+        // Find integer and fractional components of $x'$
+        float32x4_t fxp = vrndmq_f32(xp), f = vsubq_f32(xp, fxp);
+        int32x4_t i = vcvtq_s32_f32(fxp);
+
+        // Evaluate polynomial approximation of $2^f$
+        float32x4_t twoToF =
+            vfmaq_f32(vdupq_n_f32(0.226173572f), f, vdupq_n_f32(0.0781455737f));
+        twoToF = vfmaq_f32(vdupq_n_f32(0.695556856f), f, twoToF);
+        twoToF = vfmaq_f32(vdupq_n_f32(1.f), f, twoToF);
+
+        // Scale $2^f$ by $2^i$ and return final result
+        uint32x4_t bits = vreinterpretq_u32_f32(twoToF);
+        int32x4_t exponent = vaddq_s32(
+            vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127)), i);
+        bits = vandq_u32(bits, vdupq_n_u32(0x807fffffu));
+        bits = vorrq_u32(bits, vreinterpretq_u32_s32(vshlq_n_s32(
+                                   vaddq_s32(exponent, vdupq_n_s32(127)), 23)));
+        float32x4_t r = vbslq_f32(vcltq_s32(exponent, vdupq_n_s32(-126)),
+                                  vdupq_n_f32(0.f), vreinterpretq_f32_u32(bits));
+        r = vbslq_f32(vcgtq_s32(exponent, vdupq_n_s32(127)), vdupq_n_f32(Infinity), r);
+        return SIMDFloat(r);
+    }
+
+    float ReduceMin() const { return vminnmvq_f32(v); }
+    float ReduceMax() const { return vmaxnmvq_f32(v); }
+    float ReduceSum() const { return vaddvq_f32(v); }
+
+    float32x4_t v;
+};
+#endif  // PBRT_HAS_SSE2
+
+#if defined(PBRT_HAS_AVX)
+// SIMDFloat<8> AVX Specialization
+template <>
+class SIMDFloat<8> {
+  public:
+    // SIMDFloat<8> Public Methods
+    SIMDFloat() = default;
+    explicit SIMDFloat(float f) : v(_mm256_set1_ps(f)) {}
+    explicit SIMDFloat(__m256 v) : v(v) {}
+
+    static SIMDFloat Load(const float *p) { return SIMDFloat(_mm256_loadu_ps(p)); }
+    void Store(float *p) const { _mm256_storeu_ps(p, v); }
+
+    SIMDFloat operator+(SIMDFloat b) const { return SIMDFloat(_mm256_add_ps(v, b.v)); }
+    SIMDFloat operator-(SIMDFloat b) const { return SIMDFloat(_mm256_sub_ps(v, b.v)); }
+    SIMDFloat operator*(SIMDFloat b) const { return SIMDFloat(_mm256_mul_ps(v, b.v)); }
+    SIMDFloat operator/(SIMDFloat b) const { return SIMDFloat(_mm256_div_ps(v, b.v)); }
+    SIMDFloat operator-() const {
+        return SIMDFloat(_mm256_xor_ps(v, _mm256_set1_ps(-0.f)));
+    }
+
+    friend SIMDFloat Min(SIMDFloat a, SIMDFloat b) {
+        return SIMDFloat(_mm256_min_ps(b.v, a.v));
+    }
+    friend SIMDFloat Max(SIMDFloat a, SIMDFloat b) {
+        return SIMDFloat(_mm256_max_ps(b.v, a.v));
+    }
+    friend SIMDFloat SafeDiv(SIMDFloat a, SIMDFloat b) {
+        __m256 nonZero = _mm256_cmp_ps(b.v, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+        __m256 d = _mm256_blendv_ps(_mm256_set1_ps(1.f), b.v, nonZero);
+        return SIMDFloat(_mm256_and_ps(nonZero, _mm256_div_ps(a.v, d)));
+    }
+    friend SIMDFloat Abs(SIMDFloat a) {
+        return SIMDFloat(_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v));
+    }
+    friend SIMDFloat FastExp(SIMDFloat a) {
+        // Evaluate the two halves using the 4-wide implementation; AVX lacks the
+        // 256-bit integer operations that it needs.
+        SIMDFloat<4> lo(_mm256_castps256_ps128(a.v)), hi(_mm256_extractf128_ps(a.v, 1));
+        return SIMDFloat(_mm256_insertf128_ps(_mm256_castps128_ps256(FastExp(lo).v),
+                                              FastExp(hi).v, 1));
+    }
+
+    float ReduceMin() const { return Min(Half(0), Half(1)).ReduceMin(); }
+    float ReduceMax() const { return Max(Half(0), Half(1)).ReduceMax(); }
+    float ReduceSum() const { return (Half(0) + Half(1)).ReduceSum(); }
+
+    __m256 v;
+
+  private:
+    SIMDFloat<4> Half(int i) const {
+        return SIMDFloat<4>(i == 0 ? _mm256_castps256_ps128(v)
+                                   : _mm256_extractf128_ps(v, 1));
+    }
+};
+#endif  // PBRT_HAS_AVX
+
+// SIMDFloatPair Definition
+// _SIMDFloatPair_ implements _Derived_, a _SIMDFloat_ that is twice as wide
+// as _Half_, using two _Half_ values. It provides the wider specializations
+// for CPUs that don't have vector registers that are wide enough.
+template <typename Derived, typename Half, int HalfN>
+class SIMDFloatPair {
+  public:
+    // SIMDFloatPair Public Methods
+    SIMDFloatPair() = default;
+    explicit SIMDFloatPair(Float f) : lo(f), hi(f) {}
+    SIMDFloatPair(Half lo, Half hi) : lo(lo), hi(hi) {}
+
+    static Derived Load(const Float *p) {
+        return Derived(Half::Load(p), Half::Load(p + HalfN));
+    }
+    void Store(Float *p) const {
+        lo.Store(p);
+        hi.Store(p + HalfN);
+    }
+
+    Derived operator+(Derived b) const { return Derived(lo + b.lo, hi + b.hi); }
+    Derived operator-(Derived b) const { return Derived(lo - b.lo, hi - b.hi); }
+    Derived operator*(Derived b) const { return Derived(lo * b.lo, hi * b.hi); }
+    Derived operator/(Derived b) const { return Derived(lo / b.lo, hi / b.hi); }
+    Derived operator-() const { return Derived(-lo, -hi); }
+
+    friend Derived Min(Derived a, Derived b) {
+        return Derived(Min(a.lo, b.lo), Min(a.hi, b.hi));
+    }
+    friend Derived Max(Derived a, Derived b) {
+        return Derived(Max(a.lo, b.lo), Max(a.hi, b.hi));
+    }
+    friend Derived SafeDiv(Derived a, Derived b) {
+        return Derived(SafeDiv(a.lo, b.lo), SafeDiv(a.hi, b.hi));
+    }
+    friend Derived FastExp(Derived a) { return Derived(FastExp(a.lo), FastExp(a.hi)); }
+    friend Derived Abs(Derived a) { return Derived(Abs(a.lo), Abs(a.hi)); }
+
+    Float ReduceMin() const { return Min(lo, hi).ReduceMin(); }
+    Float ReduceMax() const { return Max(lo, hi).ReduceMax(); }
+    Float ReduceSum() const { return (lo + hi).ReduceSum(); }
+
+    Half lo, hi;
+};
+
+#if defined(PBRT_HAS_SSE2) || defined(PBRT_HAS_NEON)
+#if !defined(PBRT_HAS_AVX)
+// SIMDFloat<8> Specialization Using Two SIMDFloat<4>s
+template <>
+class SIMDFloat<8> : public SIMDFloatPair<SIMDFloat<8>, SIMDFloat<4>, 4> {
+  public:
+    using SIMDFloatPair::SIMDFloatPair;
+};
+#endif  // !PBRT_HAS_AVX
+
+// SIMDFloat<16> Specialization Using Two SIMDFloat<8>s
+template <>
+class SIMDFloat<16> : public SIMDFloatPair<SIMDFloat<16>, SIMDFloat<8>, 8> {
+  public:
+    using SIMDFloatPair::SIMDFloatPair;
+};
+#endif
+
+// Returns the columns of the 3x4 matrix with rows starting at _m_, _m + 4_, and
+// _m + 8_ in _c_, with zero fourth components. Matrix-vector products can then
+// be computed as sums of the scaled columns.
+inline void LoadColumns3x4(const Float *m, SIMDFloat<4> c[4]) {
+#if defined(PBRT_HAS_SSE2)
+    __m128 r0 = _mm_loadu_ps(m), r1 = _mm_loadu_ps(m + 4), r2 = _mm_loadu_ps(m + 8);
+    __m128 r3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    c[0] = SIMDFloat<4>(r0);
+    c[1] = SIMDFloat<4>(r1);
+    c[2] = SIMDFloat<4>(r2);
+    c[3] = SIMDFloat<4>(r3);
+#elif defined(PBRT_HAS_NEON)
+    float32x4_t r0 = vld1q_f32(m), r1 = vld1q_f32(m + 4), r2 = vld1q_f32(m + 8);
+    float32x4_t r3 = vdupq_n_f32(0.f);
+    float32x4_t t0 = vzip1q_f32(r0, r2), t1 = vzip1q_f32(r1, r3);
+    float32x4_t t2 = vzip2q_f32(r0, r2), t3 = vzip2q_f32(r1, r3);
+    c[0] = SIMDFloat<4>(vzip1q_f32(t0, t1));
+    c[1] = SIMDFloat<4>(vzip2q_f32(t0, t1));
+    c[2] = SIMDFloat<4>(vzip1q_f32(t2, t3));
+    c[3] = SIMDFloat<4>(vzip2q_f32(t2, t3));
+#else
+    for (int j = 0; j < 4; ++j) {
+        Float column[4] = {m[j], m[4 + j], m[8 + j], 0};
+        c[j] = SIMDFloat<4>::Load(column);
+    }
+#endif
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_SIMD_H
@@ -0,0 +1,111 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/float.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/simd.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace pbrt;
+
+// Checks _SIMDFloat<N>_'s operations against the corresponding scalar
+// computations, including zeros and values that under- and overflow in
+// _FastExp()_.
+template <int N>
+static void TestSIMDFloat() {
+    RNG rng(N);
+    for (int trial = 0; trial < 1000; ++trial) {
+        Float a[N], b[N];
+        for (int i = 0; i < N; ++i) {
+            a[i] = Lerp(rng.Uniform<Float>(), -200, 200);
+            b[i] = (rng.Uniform<Float>() < 0.25f) ? 0 : Lerp(rng.Uniform<Float>(), -4, 4);
+        }
+        if (trial == 0)
+            a[0] = -Infinity;
+
+        SIMDFloat<N> va = SIMDFloat<N>::Load(a), vb = SIMDFloat<N>::Load(b);
+        Float sum[N], diff[N], prod[N], quot[N], neg[N], mn[N], mx[N], sd[N], ex[N];
+        Float abs[N];
+        (va + vb).Store(sum);
+        (va - vb).Store(diff);
+        (va * vb).Store(prod);
+        (vb / SIMDFloat<N>(Float(3))).Store(quot);
+        (-vb).Store(neg);
+        Min(va, vb).Store(mn);
+        Max(va, vb).Store(mx);
+        SafeDiv(va, vb).Store(sd);
+        FastExp(va * SIMDFloat<N>(Float(0.5))).Store(ex);
+        Abs(va).Store(abs);
+
+        for (int i = 0; i < N; ++i) {
+            EXPECT_EQ(a[i] + b[i], sum[i]);
+            EXPECT_EQ(a[i] - b[i], diff[i]);
+            EXPECT_EQ(a[i] * b[i], prod[i]);
+            EXPECT_EQ(b[i] / 3, quot[i]);
+            EXPECT_EQ(-b[i], neg[i]);
+            EXPECT_EQ(std::signbit(-b[i]), std::signbit(neg[i]));
+            EXPECT_EQ(std::min(a[i], b[i]), mn[i]);
+            EXPECT_EQ(std::max(a[i], b[i]), mx[i]);
+            EXPECT_EQ((b[i] != 0) ? a[i] / b[i] : 0, sd[i]);
+            EXPECT_EQ(std::abs(a[i]), abs[i]);
+
+            Float e = FastExp(a[i] * Float(0.5));
+            if (IsInf(e) || e == 0)
+                EXPECT_EQ(e, ex[i]);
+            else
+                EXPECT_LT(std::abs(e - ex[i]), 1e-6f * e) << e << " vs " << ex[i];
+        }
+
+        EXPECT_EQ(*std::min_element(a, a + N), va.ReduceMin());
+        EXPECT_EQ(*std::max_element(a, a + N), va.ReduceMax());
+        Float s = 0, sAbs = 0;
+        for (int i = 0; i < N; ++i) {
+            s += b[i];
+            sAbs += std::abs(b[i]);
+        }
+        EXPECT_LE(std::abs(s - vb.ReduceSum()), 1e-6f * sAbs);
+    }
+}
+
+TEST(SIMDFloat, Four) {
+    TestSIMDFloat<4>();
+}
+
+TEST(SIMDFloat, Eight) {
+    TestSIMDFloat<8>();
+}
+
+TEST(SIMDFloat, Sixteen) {
+    TestSIMDFloat<16>();
+}
+
+TEST(SIMDFloat, One) {
+    TestSIMDFloat<1>();
+}
+
+TEST(SIMDFloat, Three) {
+    TestSIMDFloat<3>();
+}
+
+TEST(SIMDFloat, LoadColumns3x4) {
+    Float m[12];
+    for (int i = 0; i < 12; ++i)
+        m[i] = i + 1;
+    SIMDFloat<4> c[4];
+    LoadColumns3x4(m, c);
+    for (int j = 0; j < 4; ++j) {
+        Float column[4];
+        c[j].Store(column);
+        for (int i = 0; i < 3; ++i)
+            EXPECT_EQ(m[4 * i + j], column[i]);
+        EXPECT_EQ(0, column[3]);
+    }
+}
@@ -13,12 +13,17 @@
 #include <pbrt/bsdf.h>
 #include <pbrt/bssrdf.h>
 #include <pbrt/interaction.h>
+#include <pbrt/options.h>
 #include <pbrt/ray.h>
+#include <pbrt/util/float.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
+#include <algorithm>
+#include <type_traits>
+
 namespace pbrt {
 
 struct alignas(16) Float4 {
@@ -44,11 +49,83 @@ inline void Store4(Float4 *p, Float4 v) {
 #endif
 }
 
+// AoSoA Definitions
+// When soac is run with --aosoa, the SOA types that it generates store their
+// values in blocks of _Width_ items: each block holds _Width_ consecutive
+// values of each of the type's fields, including those of its nested SOA
+// types, so that an item's fields are near each other in memory. Fields are
+// accessed with the same _field[i]_ syntax as with arrays, and _Block()_
+// gives a block's values of a field for aligned vector loads and stores.
+template <typename T, int Width>
+class AOSOAArray {
+  public:
+    AOSOAArray() = default;
+    AOSOAArray(char *base, size_t blockBytes) : base(base), blockBytes(blockBytes) {}
+
+    PBRT_CPU_GPU
+    T &operator[](int i) const { return Block(i / Width)[i % Width]; }
+    PBRT_CPU_GPU
+    T *Block(int b) const { return (T *)(base + b * blockBytes); }
+
+  private:
+    char *base = nullptr;
+    size_t blockBytes = 0;
+};
+
+template <typename S, typename = void>
+struct IsAOSOA : std::false_type {};
+template <typename S>
+struct IsAOSOA<S, std::void_t<decltype(S::aosoaWidth)>> : std::true_type {};
+
+// The Layout() methods of generated AoSoA types call AOSOALayout() for each
+// of their fields in turn. It places the field at or after _offset_ in each
+// of the blocks starting at _blocks_, or just measures it if _blocks_ is
+// null, and returns the offset after it. Fields whose blocks fill whole
+// vector registers are aligned to them.
+template <typename T, int Width>
+inline size_t AOSOALayout(AOSOAArray<T, Width> *field, char *blocks, size_t blockBytes,
+                          size_t offset, int n, Allocator alloc) {
+    size_t align = alignof(T);
+    for (size_t a : {64, 32, 16})
+        if ((Width * sizeof(T)) % a == 0) {
+            align = std::max(align, a);
+            break;
+        }
+    offset = (offset + align - 1) / align * align;
+    if (blocks)
+        *field = AOSOAArray<T, Width>(blocks + offset, blockBytes);
+    return offset + Width * sizeof(T);
+}
+
+// Nested AoSoA types are stored in the same blocks; other SOA types are
+// allocated separately.
+template <typename S>
+inline size_t AOSOALayout(S *field, char *blocks, size_t blockBytes, size_t offset,
+                          int n, Allocator alloc) {
+    if constexpr (IsAOSOA<S>::value)
+        return field->Layout(blocks, blockBytes, offset, n, alloc);
+    else {
+        if (blocks)
+            *field = S(n, alloc);
+        return offset;
+    }
+}
+
+// Blocks are aligned to cache lines
+inline size_t AOSOABlockBytes(size_t bytes) {
+    return (bytes + 63) / 64 * 64;
+}
+
+// With the _compactSpectra_ option, _SOA<SampledSpectrum>_ stores each group of
+// four spectral samples in 64 bits using a shared exponent.
 template <>
 struct SOA<SampledSpectrum> {
     SOA() = default;
     SOA(int size, Allocator alloc) {
-        if constexpr ((NSpectrumSamples % 4) == 0) {
+        if (Options && Options->compactSpectra) {
+            nAlloc = n4 * size;
+            ptrCompact = alloc.allocate_object<uint64_t>(nAlloc);
+        } else if constexpr ((NSpectrumSamples % 4) == 0) {
             nAlloc = n4 * size;
             ptr4 = alloc.allocate_object<Float4>(nAlloc);
         } else {
@@ -60,12 +137,22 @@ struct SOA<SampledSpectrum> {
         nAlloc = s.nAlloc;
         ptr4 = s.ptr4;
         ptr1 = s.ptr1;
+        ptrCompact = s.ptrCompact;
         return *this;
     }
     PBRT_CPU_GPU
     SampledSpectrum operator[](int i) const {
         SampledSpectrum s;
-        if constexpr ((NSpectrumSamples % 4) == 0) {
+        if (ptrCompact) {
+            int offset = n4 * i;
+            DCHECK_LT(offset, nAlloc);
+            for (int i = 0; i < n4; ++i, ++offset) {
+                float v[4];
+                DecodeSharedExponent4(ptrCompact[offset], v);
+                for (int j = 0; j < 4 && 4 * i + j < NSpectrumSamples; ++j)
+                    s[4 * i + j] = v[j];
+            }
+        } else if constexpr ((NSpectrumSamples % 4) == 0) {
             int offset = n4 * i;
             DCHECK_LT(offset, nAlloc);
             for (int i = 0; i < n4; ++i, ++offset) {
@@ -89,7 +176,16 @@ struct SOA<SampledSpectrum> {
         }
         PBRT_CPU_GPU
         void operator=(const SampledSpectrum &s) {
-            if constexpr ((NSpectrumSamples % 4) == 0) {
+            if (soa->ptrCompact) {
+                int offset = n4 * index;
+                DCHECK_LT(offset, soa->nAlloc);
+                for (int i = 0; i < n4; ++i, ++offset) {
+                    float v[4] = {0, 0, 0, 0};
+                    for (int j = 0; j < 4 && 4 * i + j < NSpectrumSamples; ++j)
+                        v[j] = s[4 * i + j];
+                    soa->ptrCompact[offset] = EncodeSharedExponent4(v);
+                }
+            } else if constexpr ((NSpectrumSamples % 4) == 0) {
                 int offset = n4 * index;
                 DCHECK_LT(offset, soa->nAlloc);
                 for (int i = 0; i < n4; ++i, ++offset)
@@ -124,6 +220,7 @@ struct SOA<SampledSpectrum> {
     int nAlloc;
     Float4 * PBRT_RESTRICT ptr4 = nullptr;
     Float * PBRT_RESTRICT ptr1 = nullptr;
+    uint64_t * PBRT_RESTRICT ptrCompact = nullptr;
 };
 
 template <>
@@ -16,6 +16,7 @@
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
@@ -24,6 +25,8 @@
 #include <algorithm>
 #include <cmath>
 #include <map>
+#include <mutex>
+#include <unordered_map>
 
 // I don't know how this is happening (somehow via wingdi.h?), but not cool,
 // Windows, not cool...
@@ -184,6 +187,56 @@ std::string DenselySampledSpectrum::ToString() const {
     return s;
 }
 
+uint64_t DenselySampledSpectrum::Hash() const {
+    return HashBuffer(values.data(), values.size() * sizeof(Float),
+                      pbrt::Hash(lambda_min, lambda_max));
+}
+
+STAT_COUNTER("Scene/Shared light spectra", nSharedSpectra);
+
+uint64_t ConstantSpectrum::Hash() const {
+    return pbrt::Hash(c);
+}
+
+uint64_t RGBIlluminantSpectrum::Hash() const {
+    return pbrt::Hash(scale, rsp, illuminant);
+}
+
+const DenselySampledSpectrum *LookupSpectrum(Spectrum s, Allocator alloc) {
+    static std::mutex mutex;
+    static std::unordered_map<uint64_t, const DenselySampledSpectrum *> parameterCache;
+    static std::unordered_multimap<uint64_t, const DenselySampledSpectrum *> valueCache;
+    // Look up _s_ using its parameters, if it is described by them
+    pstd::optional<uint64_t> parameterHash;
+    if (const RGBIlluminantSpectrum *rs = s.CastOrNullptr<RGBIlluminantSpectrum>())
+        parameterHash = pbrt::Hash(s.Tag(), rs->Hash());
+    else if (const ConstantSpectrum *cs = s.CastOrNullptr<ConstantSpectrum>())
+        parameterHash = pbrt::Hash(s.Tag(), cs->Hash());
+    if (parameterHash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto iter = parameterCache.find(*parameterHash); iter != parameterCache.end())
+            return iter->second;
+    }
+
+    // Sample _s_ and search for an existing spectrum with the same values
+    DenselySampledSpectrum d(s, Allocator());
+    uint64_t valueHash = d.Hash();
+    std::lock_guard<std::mutex> lock(mutex);
+    const DenselySampledSpectrum *shared = nullptr;
+    auto range = valueCache.equal_range(valueHash);
+    for (auto iter = range.first; iter != range.second; ++iter)
+        if (*iter->second == d)
+            shared = iter->second;
+    if (!shared) {
+        shared = alloc.new_object<DenselySampledSpectrum>(s, alloc);
+        ++nSharedSpectra;
+        valueCache.insert(std::make_pair(valueHash, shared));
+    }
+    if (parameterHash)
+        parameterCache[*parameterHash] = shared;
+    return shared;
+}
+
 std::string SampledSpectrum::ToString() const {
     std::string str = "[ ";
     for (int i = 0; i < NSpectrumSamples; ++i) {
@@ -231,19 +284,28 @@ RGB SampledSpectrum::ToRGB(const SampledWavelengths &lambda,
     return cs.ToRGB(xyz);
 }
 
+// Returns the function of wavelength that represents _rgb_ in _cs_
+static RGBSpectrumFunction ToSpectrumFunction(const RGBColorSpace &cs, const RGB &rgb) {
+#ifdef PBRT_RGB_SPECTRUM_FAST_PATH
+    return RGBBoxSpectrum(rgb.r, rgb.g, rgb.b);
+#else
+    return cs.ToRGBCoeffs(rgb);
+#endif
+}
+
 RGBAlbedoSpectrum::RGBAlbedoSpectrum(const RGBColorSpace &cs, const RGB &rgb) {
     DCHECK_LE(std::max({rgb.r, rgb.g, rgb.b}), 1);
     DCHECK_GE(std::min({rgb.r, rgb.g, rgb.b}), 0);
-    rsp = cs.ToRGBCoeffs(rgb);
+    rsp = ToSpectrumFunction(cs, rgb);
 }
 
 RGBUnboundedSpectrum::RGBUnboundedSpectrum(const RGBColorSpace &cs, const RGB &rgb) {
     Float m = std::max({rgb.r, rgb.g, rgb.b});
     if (m <= 1)
-        rsp = cs.ToRGBCoeffs(rgb);
+        rsp = ToSpectrumFunction(cs, rgb);
     else {
         scale = 2 * m;
-        rsp = cs.ToRGBCoeffs(scale ? rgb / scale : RGB(0, 0, 0));
+        rsp = ToSpectrumFunction(cs, scale ? rgb / scale : RGB(0, 0, 0));
     }
 }
 
@@ -251,7 +313,7 @@ RGBIlluminantSpectrum::RGBIlluminantSpectrum(const RGBColorSpace &cs, const RGB
     : illuminant(&cs.illuminant) {
     Float m = std::max({rgb.r, rgb.g, rgb.b});
     scale = 2 * m;
-    rsp = cs.ToRGBCoeffs(scale ? rgb / scale : RGB(0, 0, 0));
+    rsp = ToSpectrumFunction(cs, scale ? rgb / scale : RGB(0, 0, 0));
 }
 
 std::string RGBAlbedoSpectrum::ToString() const {
@@ -2651,11 +2713,12 @@ void Init(Allocator alloc) {
     z = alloc.new_object<DenselySampledSpectrum>(&zpls, alloc);
 
 #ifdef PBRT_BUILD_GPU_RENDERER
-    if (Options->useGPU) {
-        CUDA_CHECK(cudaMemcpyToSymbol(xGPU, &x, sizeof(x)));
-        CUDA_CHECK(cudaMemcpyToSymbol(yGPU, &y, sizeof(y)));
-        CUDA_CHECK(cudaMemcpyToSymbol(zGPU, &z, sizeof(z)));
-    }
+    if (Options->useGPU)
+        ForEachGPU([&](int) {
+            CUDA_CHECK(cudaMemcpyToSymbol(xGPU, &x, sizeof(x)));
+            CUDA_CHECK(cudaMemcpyToSymbol(yGPU, &y, sizeof(y)));
+            CUDA_CHECK(cudaMemcpyToSymbol(zGPU, &z, sizeof(z)));
+        });
 #endif
 
     Spectrum illuma = PiecewiseLinearSpectrum::FromInterleaved(CIE_Illum_A, true, alloc);
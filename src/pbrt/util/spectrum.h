@@ -17,6 +17,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/taggedptr.h>
 
 #include <cmath>
@@ -30,7 +31,13 @@ namespace pbrt {
 // Spectrum Constants
 constexpr Float Lambda_min = 360, Lambda_max = 830;
 
-static constexpr int NSpectrumSamples = 4;
+// The number of wavelengths sampled by _SampledSpectrum_ is set at build time
+// using the PBRT_SPECTRUM_SAMPLES CMake option.
+#ifndef PBRT_SPECTRUM_SAMPLES
+#define PBRT_SPECTRUM_SAMPLES 4
+#endif
+static constexpr int NSpectrumSamples = PBRT_SPECTRUM_SAMPLES;
+static_assert(NSpectrumSamples >= 1, "PBRT_SPECTRUM_SAMPLES must be positive");
 
 static constexpr Float CIE_Y_integral = 106.856895;
 
@@ -97,8 +104,7 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator-=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] -= s.values[i];
+        (SIMD() - s.SIMD()).Store(values.data());
         return *this;
     }
     PBRT_CPU_GPU
@@ -109,16 +115,12 @@ class SampledSpectrum {
     PBRT_CPU_GPU
     friend SampledSpectrum operator-(Float a, const SampledSpectrum &s) {
         DCHECK(!IsNaN(a));
-        SampledSpectrum ret;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] = a - s.values[i];
-        return ret;
+        return SampledSpectrum(SIMDType(a) - s.SIMD());
     }
 
     PBRT_CPU_GPU
     SampledSpectrum &operator*=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] *= s.values[i];
+        (SIMD() * s.SIMD()).Store(values.data());
         return *this;
     }
     PBRT_CPU_GPU
@@ -129,16 +131,12 @@ class SampledSpectrum {
     PBRT_CPU_GPU
     SampledSpectrum operator*(Float a) const {
         DCHECK(!IsNaN(a));
-        SampledSpectrum ret = *this;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] *= a;
-        return ret;
+        return SampledSpectrum(SIMD() * SIMDType(a));
     }
     PBRT_CPU_GPU
     SampledSpectrum &operator*=(Float a) {
         DCHECK(!IsNaN(a));
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] *= a;
+        (SIMD() * SIMDType(a)).Store(values.data());
         return *this;
     }
     PBRT_CPU_GPU
@@ -146,10 +144,9 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator/=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i) {
+        for (int i = 0; i < NSpectrumSamples; ++i)
             DCHECK_NE(0, s.values[i]);
-            values[i] /= s.values[i];
-        }
+        (SIMD() / s.SIMD()).Store(values.data());
         return *this;
     }
     PBRT_CPU_GPU
@@ -161,8 +158,7 @@ class SampledSpectrum {
     SampledSpectrum &operator/=(Float a) {
         DCHECK_NE(a, 0);
         DCHECK(!IsNaN(a));
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] /= a;
+        (SIMD() / SIMDType(a)).Store(values.data());
         return *this;
     }
     PBRT_CPU_GPU
@@ -172,12 +168,7 @@ class SampledSpectrum {
     }
 
     PBRT_CPU_GPU
-    SampledSpectrum operator-() const {
-        SampledSpectrum ret;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] = -values[i];
-        return ret;
-    }
+    SampledSpectrum operator-() const { return SampledSpectrum(-SIMD()); }
     PBRT_CPU_GPU
     bool operator==(const SampledSpectrum &s) const { return values == s.values; }
     PBRT_CPU_GPU
@@ -231,32 +222,25 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator+=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            values[i] += s.values[i];
+        (SIMD() + s.SIMD()).Store(values.data());
         return *this;
     }
 
     PBRT_CPU_GPU
-    Float MinComponentValue() const {
-        Float m = values[0];
-        for (int i = 1; i < NSpectrumSamples; ++i)
-            m = std::min(m, values[i]);
-        return m;
-    }
+    Float MinComponentValue() const { return SIMD().ReduceMin(); }
     PBRT_CPU_GPU
-    Float MaxComponentValue() const {
-        Float m = values[0];
-        for (int i = 1; i < NSpectrumSamples; ++i)
-            m = std::max(m, values[i]);
-        return m;
-    }
+    Float MaxComponentValue() const { return SIMD().ReduceMax(); }
     PBRT_CPU_GPU
-    Float Average() const {
-        Float sum = values[0];
-        for (int i = 1; i < NSpectrumSamples; ++i)
-            sum += values[i];
-        return sum / NSpectrumSamples;
-    }
+    Float Average() const { return SIMD().ReduceSum() / NSpectrumSamples; }
+
+    // Arithmetic goes through _SIMDFloat_, which uses vector instructions where
+    // they are available rather than leaving it to the compiler to vectorize
+    // the loops over the samples.
+    using SIMDType = SIMDFloat<NSpectrumSamples>;
+    PBRT_CPU_GPU
+    explicit SampledSpectrum(SIMDType v) { v.Store(values.data()); }
+    PBRT_CPU_GPU
+    SIMDType SIMD() const { return SIMDType::Load(values.data()); }
 
   private:
     friend struct SOA<SampledSpectrum>;
@@ -325,6 +309,18 @@ class SampledWavelengths {
         return true;
     }
 
+    PBRT_CPU_GPU
+    SampledWavelengths TerminatedWithHero(int i) const {
+        // Return wavelengths with the $i$th one as the only remaining sample
+        SampledWavelengths swl;
+        for (int j = 0; j < NSpectrumSamples; ++j) {
+            swl.lambda[j] = lambda[i];
+            swl.pdf[j] = 0;
+        }
+        swl.pdf[0] = pdf[i] / NSpectrumSamples;
+        return swl;
+    }
+
     PBRT_CPU_GPU
     static SampledWavelengths SampleXYZ(Float u) {
         SampledWavelengths swl;
@@ -361,6 +357,7 @@ class ConstantSpectrum {
     Float MaxValue() const { return c; }
 
     std::string ToString() const;
+    uint64_t Hash() const;
 
   private:
     Float c;
@@ -401,6 +398,12 @@ class DenselySampledSpectrum {
 
     std::string ToString() const;
 
+    bool operator==(const DenselySampledSpectrum &d) const {
+        return lambda_min == d.lambda_min && lambda_max == d.lambda_max &&
+               std::equal(values.begin(), values.end(), d.values.begin());
+    }
+    uint64_t Hash() const;
+
     DenselySampledSpectrum(Spectrum spec, int lambda_min = Lambda_min,
                            int lambda_max = Lambda_max, Allocator alloc = {})
         : lambda_min(lambda_min),
@@ -533,7 +536,7 @@ class RGBAlbedoSpectrum {
 
   private:
     // RGBAlbedoSpectrum Private Members
-    RGBSigmoidPolynomial rsp;
+    RGBSpectrumFunction rsp;
 };
 
 class RGBUnboundedSpectrum {
@@ -563,7 +566,7 @@ class RGBUnboundedSpectrum {
   private:
     // RGBUnboundedSpectrum Private Members
     Float scale = 1;
-    RGBSigmoidPolynomial rsp;
+    RGBSpectrumFunction rsp;
 };
 
 class RGBIlluminantSpectrum {
@@ -592,20 +595,19 @@ class RGBIlluminantSpectrum {
     }
 
     std::string ToString() const;
+    // Hashes the parameters that define the spectrum
+    uint64_t Hash() const;
 
   private:
     // RGBIlluminantSpectrum Private Members
     Float scale;
-    RGBSigmoidPolynomial rsp;
+    RGBSpectrumFunction rsp;
     const DenselySampledSpectrum *illuminant;
 };
 
 // SampledSpectrum Inline Functions
 PBRT_CPU_GPU inline SampledSpectrum SafeDiv(SampledSpectrum a, SampledSpectrum b) {
-    SampledSpectrum r;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        r[i] = (b[i] != 0) ? a[i] / b[i] : 0.;
-    return r;
+    return SampledSpectrum(SafeDiv(a.SIMD(), b.SIMD()));
 }
 
 template <typename U, typename V>
@@ -619,9 +621,7 @@ PBRT_CPU_GPU inline SampledSpectrum Clamp(const SampledSpectrum &s, U low, V hig
 
 PBRT_CPU_GPU
 inline SampledSpectrum ClampZero(const SampledSpectrum &s) {
-    SampledSpectrum ret;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        ret[i] = std::max<Float>(0, s[i]);
+    SampledSpectrum ret(Max(SampledSpectrum::SIMDType(0), s.SIMD()));
     DCHECK(!ret.HasNaNs());
     return ret;
 }
@@ -663,9 +663,7 @@ inline SampledSpectrum Exp(const SampledSpectrum &s) {
 
 PBRT_CPU_GPU
 inline SampledSpectrum FastExp(const SampledSpectrum &s) {
-    SampledSpectrum ret;
-    for (int i = 0; i < NSpectrumSamples; ++i)
-        ret[i] = FastExp(s[i]);
+    SampledSpectrum ret(FastExp(s.SIMD()));
     DCHECK(!ret.HasNaNs());
     return ret;
 }
@@ -683,6 +681,13 @@ inline SampledSpectrum Lerp(Float t, const SampledSpectrum &s1,
     return (1 - t) * s1 + t * s2;
 }
 
+// Returns a _DenselySampledSpectrum_ for _s_ that is shared with all other callers
+// that pass an equal spectrum. Spectra that are described by a few parameters, like
+// RGB illuminants, are found using those, so that they are only sampled once;
+// others are found by their sampled values. The shared spectrum is allocated
+// using _alloc_ the first time that it's needed.
+const DenselySampledSpectrum *LookupSpectrum(Spectrum s, Allocator alloc);
+
 // Spectral Data Declarations
 namespace Spectra {
 
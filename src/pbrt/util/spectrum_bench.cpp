@@ -0,0 +1,89 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <benchmark/benchmark.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/color.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/spectrum.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+// SampledSpectrum micro-benchmarks of the operations that integrators perform
+// at each path vertex: updating the path throughput, sampling RGB
+// reflectances at the path's wavelengths, and converting radiance to XYZ.
+
+static constexpr int nSpectra = 1024;
+
+static std::vector<SampledSpectrum> RandomSpectra() {
+    RNG rng;
+    std::vector<SampledSpectrum> s;
+    for (int i = 0; i < nSpectra; ++i) {
+        SampledSpectrum v;
+        for (int j = 0; j < NSpectrumSamples; ++j)
+            v[j] = rng.Uniform<Float>();
+        s.push_back(v);
+    }
+    return s;
+}
+
+static void BM_SampledSpectrumThroughput(benchmark::State &state) {
+    std::vector<SampledSpectrum> f = RandomSpectra(), pdf = RandomSpectra();
+    SampledSpectrum beta(1.f);
+    int index = 0;
+    for (auto _ : state) {
+        // Update the throughput the way the path tracers do, renormalizing
+        // so that it doesn't underflow
+        beta *= SafeDiv(f[index] * .5f, pdf[index] + SampledSpectrum(.1f));
+        if (beta.MaxComponentValue() < .01f)
+            beta /= beta.MaxComponentValue();
+        benchmark::DoNotOptimize(beta);
+        if (++index == nSpectra)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SampledSpectrumThroughput);
+
+static void BM_RGBAlbedoSpectrumSample(benchmark::State &state) {
+    RNG rng;
+    std::vector<RGBAlbedoSpectrum> spectra;
+    std::vector<SampledWavelengths> lambda;
+    for (int i = 0; i < nSpectra; ++i) {
+        RGB rgb(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        spectra.push_back(RGBAlbedoSpectrum(*RGBColorSpace::sRGB, rgb));
+        lambda.push_back(SampledWavelengths::SampleXYZ(rng.Uniform<Float>()));
+    }
+
+    int index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(spectra[index].Sample(lambda[index]));
+        if (++index == nSpectra)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RGBAlbedoSpectrumSample);
+
+static void BM_SampledSpectrumToXYZ(benchmark::State &state) {
+    std::vector<SampledSpectrum> L = RandomSpectra();
+    RNG rng;
+    std::vector<SampledWavelengths> lambda;
+    for (int i = 0; i < nSpectra; ++i)
+        lambda.push_back(SampledWavelengths::SampleXYZ(rng.Uniform<Float>()));
+
+    int index = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(L[index].ToXYZ(lambda[index]));
+        if (++index == nSpectra)
+            index = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SampledSpectrumToXYZ);
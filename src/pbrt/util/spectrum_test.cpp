@@ -120,6 +120,21 @@ TEST(Spectrum, MaxValue) {
     }
 }
 
+TEST(Spectrum, TerminatedWithHero) {
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.3f);
+    for (int i = 0; i < NSpectrumSamples; ++i) {
+        SampledWavelengths hero = lambda.TerminatedWithHero(i);
+        EXPECT_TRUE(hero.SecondaryTerminated());
+        EXPECT_EQ(lambda[i], hero[0]);
+
+        // Terminating the hero's wavelengths again should leave them unchanged
+        SampledWavelengths terminated = hero;
+        terminated.TerminateSecondary();
+        EXPECT_EQ(hero, terminated);
+        EXPECT_EQ(lambda.PDF()[i] / NSpectrumSamples, hero.PDF()[0]);
+    }
+}
+
 TEST(Spectrum, SamplingPdfY) {
     // Make sure we can integrate the y matching curve correctly
     Float ysum = 0;
@@ -162,3 +177,20 @@ TEST(Spectrum, SamplingPdfXYZ) {
     EXPECT_LT(std::abs((impInt - unifInt) / unifInt), 1e-3)
         << impInt << " vs. " << unifInt;
 }
+
+TEST(Spectrum, LookupShared) {
+    ConstantSpectrum c0(0.25f), c1(0.25f), c2(0.5f);
+    const DenselySampledSpectrum *d0 = LookupSpectrum(&c0, {});
+    EXPECT_EQ(d0, LookupSpectrum(&c1, {}));
+    EXPECT_NE(d0, LookupSpectrum(&c2, {}));
+    EXPECT_EQ(0.25f, d0->Sample(SampledWavelengths::SampleUniform(0.5f))[0]);
+
+    // Spectra of different types with equal values should be shared as well
+    DenselySampledSpectrum d(&c2, Allocator());
+    EXPECT_EQ(LookupSpectrum(&c2, {}), LookupSpectrum(&d, {}));
+
+    BlackbodySpectrum b0(3000), b1(3000), b2(5000);
+    const DenselySampledSpectrum *db = LookupSpectrum(&b0, {});
+    EXPECT_EQ(db, LookupSpectrum(&b1, {}));
+    EXPECT_NE(db, LookupSpectrum(&b2, {}));
+}
@@ -5,22 +5,41 @@
 #include <pbrt/util/stats.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
 #include <chrono>
 #include <cinttypes>
 #include <csignal>
+#include <cstring>
 #include <functional>
 #include <map>
 #include <mutex>
 #include <string>
 
+#ifdef PBRT_IS_WINDOWS
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif  // PBRT_IS_WINDOWS
+#ifdef PBRT_IS_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // PBRT_IS_LINUX
+#if defined(PBRT_IS_MSVC) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
 namespace pbrt {
 
 // ThreadStatsState Definition
@@ -31,11 +50,43 @@ struct ThreadStatsState {
     PixelStatsAccumulator accum;
 };
 
+// ThreadStats Definition
+// Records the statistics values that a thread has updated, along with the
+// values that have been reported for them so far.
+struct ThreadStats {
+    ThreadStats();
+    ~ThreadStats();
+    void Report(StatsAccumulator &accum);
+
+    template <typename T>
+    struct DistributionRecord {
+        StatDistribution<T> *distrib;
+        T reportedSum = 0;
+        int64_t reportedCount = 0;
+    };
+    std::vector<std::pair<StatCounter *, int64_t>> counters;
+    std::vector<DistributionRecord<int64_t>> intDistributions;
+    std::vector<DistributionRecord<double>> floatDistributions;
+    std::atomic<bool> pixelStatsActive{false};
+    ThreadStatsState pixelState;
+
+    // Numbers of rays, hits, BVH nodes visited, and primitives tested for each
+    // ray type and depth, the values reported so far, and the totals for each
+    // ray type when the current pixel was started
+    static constexpr int NRayTypes = 4;
+    std::atomic<int64_t> rays[NRayTypes][RayStatsMaxDepth + 1][4] = {};
+    int64_t raysReported[NRayTypes][RayStatsMaxDepth + 1][4] = {};
+    int64_t pixelRaysStart[NRayTypes][4] = {};
+};
+
 // Statistics Local Variables
-static std::vector<StatRegisterer::AccumFunc> *statFuncs;
+// _statsMutex_ protects all of the threads' _ThreadStats_ and the accumulator.
+static std::mutex statsMutex;
+static std::vector<ThreadStats *> *allThreadStats;
+static thread_local ThreadStats threadStats;
+static thread_local bool threadStatsDestroyed;
 
 bool pixelStatsEnabled = false;
-static thread_local ThreadStatsState threadStatsState;
 
 static std::vector<StatRegisterer::PixelAccumFunc> *pixelStatFuncs;
 
@@ -44,31 +95,169 @@ static StatsAccumulator statsAccumulator;
 static Bounds2i imageBounds;
 std::string pixelStatsBaseName;
 
+bool rayStatsEnabled = false;
+thread_local int rayStatsDepth;
+thread_local RayTraversalCounts rayTraversalCounts;
+
+static const char *rayTypeNames[] = {"Camera", "Indirect", "Shadow", "BSSRDF probe"};
+
+// StatsPhaseRecord Definition
+struct StatsPhaseRecord {
+    const char *name;
+    int depth;
+    double wallSeconds = 0, cpuSeconds = 0;
+    size_t peakRSS = 0;
+    double perfCounts[NumPerfCounters] = {};
+};
+
+static std::mutex phasesMutex;
+static std::vector<StatsPhaseRecord> phases;
+static thread_local int phaseDepth;
+
+// ThreadStats Method Definitions
+ThreadStats::ThreadStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (allThreadStats == nullptr)
+        allThreadStats = new std::vector<ThreadStats *>;
+    allThreadStats->push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+    // Report the thread's remaining statistics before they go away
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Report(statsAccumulator);
+    allThreadStats->erase(
+        std::find(allThreadStats->begin(), allThreadStats->end(), this));
+    threadStatsDestroyed = true;
+}
+
+void ThreadStats::Report(StatsAccumulator &accum) {
+    for (auto &[counter, reported] : counters) {
+        int64_t v = counter->value.load(std::memory_order_relaxed);
+        if (v != reported)
+            counter->report(accum, v - reported);
+        reported = v;
+    }
+
+    auto reportDistributions = [&accum](auto &records) {
+        for (auto &r : records) {
+            int64_t count = r.distrib->count.load(std::memory_order_relaxed);
+            if (count == r.reportedCount)
+                continue;
+            auto sum = r.distrib->sum.load(std::memory_order_relaxed);
+            r.distrib->report(accum, sum - r.reportedSum, count - r.reportedCount,
+                              r.distrib->min.load(std::memory_order_relaxed),
+                              r.distrib->max.load(std::memory_order_relaxed));
+            r.reportedSum = sum;
+            r.reportedCount = count;
+        }
+    };
+    reportDistributions(intDistributions);
+    reportDistributions(floatDistributions);
+
+    if (rayStatsEnabled)
+        for (int type = 0; type < NRayTypes; ++type)
+            for (int depth = 0; depth <= RayStatsMaxDepth; ++depth) {
+                int64_t delta[4];
+                for (int i = 0; i < 4; ++i) {
+                    int64_t v = rays[type][depth][i].load(std::memory_order_relaxed);
+                    delta[i] = v - raysReported[type][depth][i];
+                    raysReported[type][depth][i] = v;
+                }
+                if (delta[0] > 0)
+                    accum.ReportRays(RayType(type), depth, delta);
+            }
+
+    if (pixelStatsActive.exchange(false)) {
+        accum.AccumulatePixelStats(pixelState.accum);
+        pixelState.accum = PixelStatsAccumulator();
+    }
+}
+
+// StatCounter Method Definitions
+int64_t StatCounter::Total() const {
+    // Each thread's instance of the counter reports to the same function
+    std::lock_guard<std::mutex> lock(statsMutex);
+    int64_t total = 0;
+    if (allThreadStats)
+        for (const ThreadStats *ts : *allThreadStats)
+            for (const auto &c : ts->counters)
+                if (c.first->report == report)
+                    total += c.first->value.load(std::memory_order_relaxed);
+    return total;
+}
+
+void StatCounter::Register() {
+    if (threadStatsDestroyed)
+        return;
+    ThreadStats &ts = threadStats;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ts.counters.push_back({this, 0});
+    registered = true;
+}
+
+// StatDistribution Method Definitions
+template <>
+void StatDistribution<int64_t>::Register() {
+    if (threadStatsDestroyed)
+        return;
+    ThreadStats &ts = threadStats;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ts.intDistributions.push_back({this});
+    registered = true;
+}
+
+template <>
+void StatDistribution<double>::Register() {
+    if (threadStatsDestroyed)
+        return;
+    ThreadStats &ts = threadStats;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    ts.floatDistributions.push_back({this});
+    registered = true;
+}
+
 // Statistics Function Definitions
 void ReportThreadStats() {
-    static std::mutex mutex;
-    std::lock_guard<std::mutex> lock(mutex);
-    StatRegisterer::CallCallbacks(statsAccumulator);
-    if (pixelStatsEnabled) {
-        statsAccumulator.AccumulatePixelStats(threadStatsState.accum);
-        threadStatsState.accum = PixelStatsAccumulator();
-    }
+    // Collect all threads' values; they continue to be updated concurrently,
+    // though pixel statistics should only be collected after rendering.
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (allThreadStats)
+        for (ThreadStats *ts : *allThreadStats)
+            ts->Report(statsAccumulator);
+}
+
+// Returns the thread's total count of the given kind for rays of the type
+static int64_t ThreadRayTotal(const ThreadStats &ts, int type, int index) {
+    int64_t total = 0;
+    for (int depth = 0; depth <= RayStatsMaxDepth; ++depth)
+        total += ts.rays[type][depth][index].load(std::memory_order_relaxed);
+    return total;
 }
 
 void StatsReportPixelStart(const Point2i &p) {
     if (!pixelStatsEnabled)
         return;
-    CHECK(threadStatsState.active == false);
-    threadStatsState.active = true;
-    threadStatsState.p = p;
-    threadStatsState.start = std::chrono::steady_clock::now();
+    ThreadStatsState &tss = threadStats.pixelState;
+    CHECK(tss.active == false);
+    if (!threadStats.pixelStatsActive.load(std::memory_order_relaxed))
+        threadStats.pixelStatsActive = true;
+    tss.active = true;
+    tss.p = p;
+    tss.start = std::chrono::steady_clock::now();
+
+    if (rayStatsEnabled)
+        for (int type = 0; type < ThreadStats::NRayTypes; ++type)
+            for (int i = 0; i < 4; ++i)
+                threadStats.pixelRaysStart[type][i] =
+                    ThreadRayTotal(threadStats, type, i);
 }
 
 void StatsReportPixelEnd(const Point2i &p) {
     if (!pixelStatsEnabled)
         return;
 
-    ThreadStatsState &tss = threadStatsState;
+    ThreadStatsState &tss = threadStats.pixelState;
     CHECK(tss.active == true && tss.p == p);
     tss.active = false;
 
@@ -78,6 +267,55 @@ void StatsReportPixelEnd(const Point2i &p) {
     tss.accum.ReportPixelMS(p, deltaMS);
 
     StatRegisterer::CallPixelCallbacks(p, tss.accum);
+
+    if (rayStatsEnabled) {
+        // Report the pixel's ray statistics for each ray type, using indices
+        // after those of the registered pixel statistics
+        static const char *countNames[] = {"Rays/Camera rays", "Rays/Indirect rays",
+                                           "Rays/Shadow rays", "Rays/BSSRDF probe rays"};
+        static const char *ratioNames[][3] = {
+            {"Rays/Camera ray hit rate", "Rays/Camera ray nodes visited",
+             "Rays/Camera ray primitives tested"},
+            {"Rays/Indirect ray hit rate", "Rays/Indirect ray nodes visited",
+             "Rays/Indirect ray primitives tested"},
+            {"Rays/Shadow ray hit rate", "Rays/Shadow ray nodes visited",
+             "Rays/Shadow ray primitives tested"},
+            {"Rays/BSSRDF probe ray hit rate", "Rays/BSSRDF probe ray nodes visited",
+             "Rays/BSSRDF probe ray primitives tested"}};
+        int base = pixelStatFuncs ? pixelStatFuncs->size() : 0;
+        for (int type = 0; type < ThreadStats::NRayTypes; ++type) {
+            int64_t delta[4];
+            for (int i = 0; i < 4; ++i)
+                delta[i] = ThreadRayTotal(threadStats, type, i) -
+                           threadStats.pixelRaysStart[type][i];
+            if (delta[0] == 0)
+                continue;
+            tss.accum.ReportCounter(p, base + type, countNames[type], delta[0]);
+            for (int i = 0; i < 3; ++i)
+                tss.accum.ReportRatio(p, base + 3 * type + i, ratioNames[type][i],
+                                      delta[i + 1], delta[0]);
+        }
+    }
+}
+
+void StatsEnableRayStats() {
+    rayStatsEnabled = true;
+}
+
+void StatsAccumulateRays(RayType type, int64_t nRays, int64_t nHits) {
+    if (threadStatsDestroyed)
+        return;
+    // Attribute the traversal work since the last report to these rays
+    if (type == RayType::Indirect && rayStatsDepth == 0)
+        type = RayType::Camera;
+    int depth = std::min(rayStatsDepth, RayStatsMaxDepth);
+    std::atomic<int64_t> *counts = threadStats.rays[int(type)][depth];
+    int64_t values[4] = {nRays, nHits, rayTraversalCounts.nodesVisited,
+                         rayTraversalCounts.primitivesTested};
+    for (int i = 0; i < 4; ++i)
+        counts[i].store(counts[i].load(std::memory_order_relaxed) + values[i],
+                        std::memory_order_relaxed);
+    rayTraversalCounts = RayTraversalCounts();
 }
 
 void StatsEnablePixelStats(const Bounds2i &b, const std::string &baseName) {
@@ -87,27 +325,18 @@ void StatsEnablePixelStats(const Bounds2i &b, const std::string &baseName) {
 }
 
 // StatRegisterer Method Definitions
-void StatRegisterer::CallCallbacks(StatsAccumulator &accum) {
-    for (AccumFunc func : *statFuncs)
-        func(accum);
-}
-
-StatRegisterer::StatRegisterer(AccumFunc func, PixelAccumFunc pfunc) {
+StatRegisterer::StatRegisterer(PixelAccumFunc func) {
     static std::mutex mutex;
     std::lock_guard<std::mutex> lock(mutex);
 
-    if (statFuncs == nullptr)
-        statFuncs = new std::vector<AccumFunc>;
-    if (func)
-        statFuncs->push_back(func);
-
     if (pixelStatFuncs == nullptr)
         pixelStatFuncs = new std::vector<PixelAccumFunc>;
-    if (pfunc)
-        pixelStatFuncs->push_back(pfunc);
+    pixelStatFuncs->push_back(func);
 }
 
 void StatRegisterer::CallPixelCallbacks(const Point2i &p, PixelStatsAccumulator &accum) {
+    if (pixelStatFuncs == nullptr)
+        return;
     for (size_t i = 0; i < pixelStatFuncs->size(); ++i)
         (*pixelStatFuncs)[i](p, i, accum);
 }
@@ -140,8 +369,9 @@ void PixelStatsAccumulator::ReportCounter(const Point2i &p, int statIndex,
     if (statIndex >= stats->counterImages.size()) {
         stats->counterImages.resize(statIndex + 1);
         stats->counterNames.resize(statIndex + 1);
-        stats->counterNames[statIndex] = name;
     }
+    if (stats->counterNames[statIndex].empty())
+        stats->counterNames[statIndex] = name;
 
     Image &im = stats->counterImages[statIndex];
     Point2i res = Point2i(imageBounds.Diagonal());
@@ -157,8 +387,9 @@ void PixelStatsAccumulator::ReportRatio(const Point2i &p, int statIndex, const c
     if (statIndex >= stats->ratioImages.size()) {
         stats->ratioImages.resize(statIndex + 1);
         stats->ratioNames.resize(statIndex + 1);
-        stats->ratioNames[statIndex] = name;
     }
+    if (stats->ratioNames[statIndex].empty())
+        stats->ratioNames[statIndex] = name;
 
     Image &im = stats->ratioImages[statIndex];
     Point2i res = Point2i(imageBounds.Diagonal());
@@ -195,6 +426,7 @@ struct StatsAccumulator::Stats {
         int64_t numTrue = 0, total = 0;
     };
     std::map<std::string, RareCheck> rareChecks;
+    int64_t rays[4][RayStatsMaxDepth + 1][4] = {};
 
     Image pixelTime;
     std::vector<std::string> pixelCounterNames;
@@ -253,6 +485,11 @@ void StatsAccumulator::ReportFloatDistribution(const char *name, double sum,
     distrib.max = std::max(distrib.max, max);
 }
 
+void StatsAccumulator::ReportRays(RayType type, int depth, const int64_t counts[4]) {
+    for (int i = 0; i < 4; ++i)
+        stats->rays[int(type)][depth][i] += counts[i];
+}
+
 void StatsAccumulator::AccumulatePixelStats(const PixelStatsAccumulator &accum) {
     Point2i res = Point2i(imageBounds.Diagonal());
     if (stats->pixelTime.Resolution() == Point2i(0, 0))
@@ -321,8 +558,310 @@ void StatsAccumulator::AccumulatePixelStats(const PixelStatsAccumulator &accum)
     }
 }
 
+uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#elif defined(__aarch64__) && !defined(PBRT_IS_MSVC)
+    // The virtual counter runs at a fixed frequency, independent of the clock
+    uint64_t count;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(count));
+    return count;
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Returns the user and system CPU time used by all of the process's threads
+static double ProcessCPUSeconds() {
+#ifdef PBRT_IS_WINDOWS
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime,
+                         &userTime))
+        return 0;
+    auto seconds = [](FILETIME t) {
+        // FILETIME values are in units of 100 nanoseconds
+        return ((uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime) * 1e-7;
+    };
+    return seconds(kernelTime) + seconds(userTime);
+#else
+    struct rusage rusage;
+    if (getrusage(RUSAGE_SELF, &rusage) != 0)
+        return 0;
+    auto seconds = [](struct timeval t) { return t.tv_sec + t.tv_usec * 1e-6; };
+    return seconds(rusage.ru_utime) + seconds(rusage.ru_stime);
+#endif
+}
+
+// Hardware Performance Counter Definitions
+bool perfCountersEnabled = false;
+
+// Whether each counter could be opened; not all are available on all CPUs and
+// virtual machines
+static bool perfCounterAvailable[NumPerfCounters];
+
+// PerfCounterGroup Definition
+// The counters for a single thread, which are read together; _counters_ gives
+// the counter that each of the group's values is for.
+struct PerfCounterGroup {
+    int fd;
+    std::vector<int> counters;
+};
+
+// PerfKernelCounts Definition
+struct PerfKernelCounts {
+    int64_t count = 0;
+    double perfCounts[NumPerfCounters] = {};
+};
+
+static std::mutex perfCountersMutex;
+static std::vector<PerfCounterGroup> perfCounterGroups;
+static std::map<std::string, PerfKernelCounts> perfKernelCounts;
+
+#ifdef PBRT_IS_LINUX
+// Opens the counters for the calling thread, returning false if none are
+// available.
+static bool OpenThreadPerfCounters() {
+    const std::pair<uint32_t, uint64_t> events[NumPerfCounters] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+                                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+    PerfCounterGroup group{-1, {}};
+    for (int i = 0; i < NumPerfCounters; ++i) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].first;
+        attr.config = events[i].second;
+        // Only count user-space events, which unprivileged processes may do
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = syscall(__NR_perf_event_open, &attr, 0 /* calling thread */,
+                         -1 /* any CPU */, group.fd, 0);
+        if (fd < 0)
+            continue;
+        if (group.fd < 0)
+            group.fd = fd;
+        group.counters.push_back(i);
+    }
+    if (group.fd < 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    for (int c : group.counters)
+        perfCounterAvailable[c] = true;
+    perfCounterGroups.push_back(group);
+    return true;
+}
+#endif  // PBRT_IS_LINUX
+
+void StatsEnablePerfCounters() {
+#ifdef PBRT_IS_LINUX
+    std::atomic<int> nFailed{0};
+    ForEachThread([&nFailed]() {
+        if (!OpenThreadPerfCounters())
+            ++nFailed;
+    });
+    if (perfCounterGroups.empty())
+        Warning("Unable to open hardware performance counters. Check the value "
+                "of /proc/sys/kernel/perf_event_paranoid.");
+    else {
+        if (nFailed > 0)
+            Warning("Unable to open hardware performance counters for %d threads.",
+                    nFailed.load());
+        perfCountersEnabled = true;
+    }
+#else
+    Warning("Hardware performance counters are only supported on Linux.");
+#endif  // PBRT_IS_LINUX
+}
+
+void StatsReadPerfCounters(double counts[NumPerfCounters]) {
+#ifdef PBRT_IS_LINUX
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    for (const PerfCounterGroup &group : perfCounterGroups) {
+        // The group's values follow its size and times enabled and running
+        uint64_t values[3 + NumPerfCounters];
+        if (read(group.fd, values, sizeof(values)) <= 0 ||
+            values[0] != group.counters.size() || values[2] == 0)
+            continue;
+        // Scale the counts to make up for the counters being multiplexed
+        double scale = double(values[1]) / double(values[2]);
+        for (size_t i = 0; i < group.counters.size(); ++i)
+            counts[group.counters[i]] += scale * values[3 + i];
+    }
+#endif  // PBRT_IS_LINUX
+}
+
+void StatsReportPerfCounts(const char *name, const double start[NumPerfCounters]) {
+    double end[NumPerfCounters] = {};
+    StatsReadPerfCounters(end);
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    PerfKernelCounts &counts = perfKernelCounts[name];
+    ++counts.count;
+    for (int i = 0; i < NumPerfCounters; ++i)
+        counts.perfCounts[i] += end[i] - start[i];
+}
+
+// StatsPhase Method Definitions
+StatsPhase::StatsPhase(const char *name) : name(name) {
+    traceStart = TracingEnabled() ? TraceMicroseconds() : 0;
+    double perfStart[NumPerfCounters] = {};
+    if (perfCountersEnabled)
+        StatsReadPerfCounters(perfStart);
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    // Record the phase now so that phases are reported in the order they begin
+    index = phases.size();
+    phases.push_back(StatsPhaseRecord{name, phaseDepth++});
+    for (int i = 0; i < NumPerfCounters; ++i)
+        phases.back().perfCounts[i] = -perfStart[i];
+    start = std::chrono::steady_clock::now();
+    startCPUSeconds = ProcessCPUSeconds();
+}
+
+StatsPhase::~StatsPhase() {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    double cpuSeconds = ProcessCPUSeconds() - startCPUSeconds;
+    size_t peakRSS = GetPeakRSS();
+    if (TracingEnabled())
+        TraceRecord(name, "phase", traceStart, TraceMicroseconds());
+    double perfEnd[NumPerfCounters] = {};
+    if (perfCountersEnabled)
+        StatsReadPerfCounters(perfEnd);
+
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    --phaseDepth;
+    if (index >= int(phases.size()))
+        // ClearStats() was called while the phase was running
+        return;
+    StatsPhaseRecord &phase = phases[index];
+    phase.wallSeconds = std::chrono::duration<double>(end - start).count();
+    phase.cpuSeconds = cpuSeconds;
+    phase.peakRSS = peakRSS;
+    for (int i = 0; i < NumPerfCounters; ++i)
+        phase.perfCounts[i] += perfEnd[i];
+}
+
+static std::string printBytes(size_t bytes) {
+    float kb = (double)bytes / 1024.;
+    if (std::abs(kb) < 1024.)
+        return StringPrintf("%9.2f kB", kb);
+
+    float mib = kb / 1024.;
+    if (std::abs(mib) < 1024.)
+        return StringPrintf("%9.2f MiB", mib);
+
+    float gib = mib / 1024.;
+    return StringPrintf("%9.2f GiB", gib);
+}
+
+// Prints the current and peak memory of the named _TrackedMemoryResource_s,
+// with each one's children indented under it
+static void printTrackedMemory(FILE *dest) {
+    std::vector<const TrackedMemoryResource *> resources =
+        TrackedMemoryResource::NamedResources();
+    // Resources whose parents aren't named are printed at the top level
+    auto namedParent = [](const TrackedMemoryResource *r) {
+        return (r->Parent() && r->Parent()->Name()) ? r->Parent() : nullptr;
+    };
+    std::function<void(const TrackedMemoryResource *, int)> print;
+    bool printedHeader = false;
+    print = [&](const TrackedMemoryResource *parent, int depth) {
+        for (const TrackedMemoryResource *r : resources) {
+            if (namedParent(r) != parent || r->MaxAllocatedBytes() == 0)
+                continue;
+            if (!printedHeader) {
+                fprintf(dest, "Memory by subsystem:%36s%15s\n", "current", "peak");
+                printedHeader = true;
+            }
+            std::string title = std::string(2 * depth, ' ') + r->Name();
+            fprintf(dest, "  %-40s %s  %s\n", title.c_str(),
+                    printBytes(r->CurrentAllocatedBytes()).c_str(),
+                    printBytes(r->MaxAllocatedBytes()).c_str());
+            print(r, depth + 1);
+        }
+    };
+    print(nullptr, 0);
+}
+
+static void printPhases(FILE *dest) {
+    std::lock_guard<std::mutex> lock(phasesMutex);
+    if (phases.empty())
+        return;
+    // The JSON is printed on a single line so that it is easily extracted
+    fprintf(dest, "Phases (JSON):\n{\"phases\": [");
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const StatsPhaseRecord &phase = phases[i];
+        fprintf(dest,
+                "%s{\"name\": \"%s\", \"depth\": %d, \"wallSeconds\": %.6f, "
+                "\"cpuSeconds\": %.6f, \"peakRSSBytes\": %zu}",
+                i > 0 ? ", " : "", phase.name, phase.depth, phase.wallSeconds,
+                phase.cpuSeconds, phase.peakRSS);
+    }
+    fprintf(dest, "]}\n");
+}
+
+// Prints the hardware counts for each phase and StatsPerfScope name, giving
+// misses per thousand instructions (MPKI); counts include the work done by
+// all threads while a phase ran, including other phases running concurrently.
+static void printPerfCounters(FILE *dest) {
+    if (!perfCountersEnabled)
+        return;
+    auto print = [&](const std::string &title, const double counts[NumPerfCounters]) {
+        std::string values[NumPerfCounters + 1];
+        double instructions = counts[1];
+        for (int i = 0; i < NumPerfCounters; ++i) {
+            if (!perfCounterAvailable[i])
+                values[i] = "-";
+            else if (i < 2)
+                values[i] = StringPrintf("%.3fG", counts[i] / 1e9);
+            else
+                values[i] = instructions > 0
+                                ? StringPrintf("%.3f", 1000 * counts[i] / instructions)
+                                : "-";
+        }
+        // Compute instructions per cycle
+        values[NumPerfCounters] =
+            (perfCounterAvailable[0] && perfCounterAvailable[1] && counts[0] > 0)
+                ? StringPrintf("%.2f", instructions / counts[0])
+                : "-";
+        fprintf(dest, "  %-40s %11s %11s %6s %10s %10s %10s\n", title.c_str(),
+                values[0].c_str(), values[1].c_str(), values[NumPerfCounters].c_str(),
+                values[2].c_str(), values[3].c_str(), values[4].c_str());
+    };
+
+    fprintf(dest, "%-42s %11s %11s %6s %10s %10s %10s\n", "Hardware counters:",
+            "Cycles", "Instrs", "IPC", "LLC MPKI", "dTLB MPKI", "Br. MPKI");
+    {
+        std::lock_guard<std::mutex> lock(phasesMutex);
+        for (const StatsPhaseRecord &phase : phases)
+            print(std::string(2 * phase.depth, ' ') + phase.name, phase.perfCounts);
+    }
+
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    std::vector<std::pair<std::string, PerfKernelCounts>> kernels(
+        perfKernelCounts.begin(), perfKernelCounts.end());
+    std::sort(kernels.begin(), kernels.end(), [](const auto &a, const auto &b) {
+        return a.second.perfCounts[0] > b.second.perfCounts[0];
+    });
+    for (const auto &kernel : kernels)
+        print(StringPrintf("%s (%d)", kernel.first, kernel.second.count),
+              kernel.second.perfCounts);
+}
+
 void PrintStats(FILE *dest) {
     statsAccumulator.Print(dest);
+    printTrackedMemory(dest);
+    printPhases(dest);
+    printPerfCounters(dest);
 }
 
 bool PrintCheckRare(FILE *dest) {
@@ -331,6 +870,12 @@ bool PrintCheckRare(FILE *dest) {
 
 void ClearStats() {
     statsAccumulator.Clear();
+    {
+        std::lock_guard<std::mutex> lock(phasesMutex);
+        phases.clear();
+    }
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    perfKernelCounts.clear();
 }
 
 static void getCategoryAndTitle(const std::string &str, std::string *category,
@@ -359,19 +904,6 @@ void StatsAccumulator::Print(FILE *dest) {
     }
 
     size_t totalMemoryReported = 0;
-    auto printBytes = [](size_t bytes) -> std::string {
-        float kb = (double)bytes / 1024.;
-        if (std::abs(kb) < 1024.)
-            return StringPrintf("%9.2f kB", kb);
-
-        float mib = kb / 1024.;
-        if (std::abs(mib) < 1024.)
-            return StringPrintf("%9.2f MiB", mib);
-
-        float gib = mib / 1024.;
-        return StringPrintf("%9.2f GiB", gib);
-    };
-
     for (auto &counter : stats->memoryCounters) {
         if (counter.second == 0)
             continue;
@@ -438,6 +970,26 @@ void StatsAccumulator::Print(FILE *dest) {
         for (auto &item : categories.second)
             fprintf(dest, "    %s\n", item.c_str());
     }
+
+    // Print ray statistics by type and depth
+    bool printedRayHeader = false;
+    for (int type = 0; type < 4; ++type)
+        for (int depth = 0; depth <= RayStatsMaxDepth; ++depth) {
+            const int64_t *r = stats->rays[type][depth];
+            if (r[0] == 0)
+                continue;
+            if (!printedRayHeader) {
+                fprintf(dest, "  Rays\n    %-14s %6s %14s %10s %12s %12s\n", "Type",
+                        "Depth", "Rays", "Hit rate", "Nodes/ray", "Prims/ray");
+                printedRayHeader = true;
+            }
+            std::string depthString = depth == RayStatsMaxDepth
+                                          ? StringPrintf("%d+", depth)
+                                          : StringPrintf("%d", depth);
+            fprintf(dest, "    %-14s %6s %14" PRId64 " %9.2f%% %12.2f %12.2f\n",
+                    rayTypeNames[type], depthString.c_str(), r[0],
+                    100. * r[1] / r[0], double(r[2]) / r[0], double(r[3]) / r[0]);
+        }
 }
 
 void StatsWritePixelImages() {
@@ -508,6 +1060,7 @@ void StatsAccumulator::Clear() {
     stats->floatDistributions.clear();
     stats->percentages.clear();
     stats->ratios.clear();
+    std::memset(stats->rays, 0, sizeof(stats->rays));
 }
 
 }  // namespace pbrt
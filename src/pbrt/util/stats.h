@@ -7,6 +7,8 @@
 
 #include <pbrt/pbrt.h>
 
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <limits>
 #include <string>
@@ -15,16 +17,125 @@ namespace pbrt {
 
 class StatsAccumulator;
 class PixelStatsAccumulator;
+// StatCounter Definition
+// Per-thread statistics value. Only the thread that owns a counter updates
+// it, so updates can be plain relaxed loads and stores of an atomic, without
+// the cost of read-modify-write instructions; other threads may read it at
+// any time. A thread's counter registers itself the first time it is
+// updated, and the values reported to the _StatsAccumulator_ are the
+// increments since it was last collected.
+class StatCounter {
+  public:
+    // StatCounter Public Methods
+    using ReportFunc = void (*)(StatsAccumulator &, int64_t);
+    constexpr StatCounter(ReportFunc report) : report(report) {}
+
+    StatCounter(const StatCounter &) = delete;
+    StatCounter &operator=(const StatCounter &) = delete;
+
+    operator int64_t() const { return value.load(std::memory_order_relaxed); }
+
+    StatCounter &operator=(int64_t v) {
+        Store(v);
+        return *this;
+    }
+    StatCounter &operator+=(int64_t d) {
+        Store(int64_t(*this) + d);
+        return *this;
+    }
+    StatCounter &operator-=(int64_t d) { return *this += -d; }
+    StatCounter &operator++() { return *this += 1; }
+    int64_t operator++(int) {
+        int64_t v = *this;
+        Store(v + 1);
+        return v;
+    }
+
+    // Returns the sum of the counter's values over all of the running threads,
+    // which may be called while they are updating it.
+    int64_t Total() const;
+
+  private:
+    friend struct ThreadStats;
+    // StatCounter Private Methods
+    void Store(int64_t v) {
+        if (!registered)
+            Register();
+        value.store(v, std::memory_order_relaxed);
+    }
+    void Register();
+
+    // StatCounter Private Members
+    std::atomic<int64_t> value{0};
+    ReportFunc report;
+    bool registered = false;
+};
+
+// StatDistribution Definition
+// Per-thread distribution of values, updated and collected in the same way
+// as _StatCounter_; only the sum and count are reported incrementally, as the
+// extrema can be merged any number of times.
+template <typename T>
+class StatDistribution {
+  public:
+    // StatDistribution Public Methods
+    using ReportFunc = void (*)(StatsAccumulator &, T sum, int64_t count, T min, T max);
+    constexpr StatDistribution(ReportFunc report) : report(report) {}
+
+    StatDistribution(const StatDistribution &) = delete;
+    StatDistribution &operator=(const StatDistribution &) = delete;
+
+    void operator<<(T v) {
+        if (!registered)
+            Register();
+        sum.store(sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+        if (v < min.load(std::memory_order_relaxed))
+            min.store(v, std::memory_order_relaxed);
+        if (v > max.load(std::memory_order_relaxed))
+            max.store(v, std::memory_order_relaxed);
+    }
+
+  private:
+    friend struct ThreadStats;
+    // StatDistribution Private Methods
+    void Register();
+
+    // StatDistribution Private Members
+    std::atomic<T> sum{0};
+    std::atomic<int64_t> count{0};
+    std::atomic<T> min{std::numeric_limits<T>::max()};
+    std::atomic<T> max{std::numeric_limits<T>::lowest()};
+    ReportFunc report;
+    bool registered = false;
+};
+
+// DisabledStat Definition
+// Stand-in for statistics values when they are compiled out with
+// PBRT_DISABLE_STATS; all of its operations do nothing.
+struct DisabledStat {
+    operator int64_t() const { return 0; }
+    DisabledStat &operator=(int64_t) { return *this; }
+    DisabledStat &operator+=(int64_t) { return *this; }
+    DisabledStat &operator-=(int64_t) { return *this; }
+    DisabledStat &operator++() { return *this; }
+    int64_t operator++(int) { return 0; }
+    int64_t Total() const { return 0; }
+    template <typename T>
+    void operator<<(T) {}
+};
+
 // StatRegisterer Definition
+// Registers a function that reports per-pixel statistics values, which is
+// called by the thread that rendered each pixel.
 class StatRegisterer {
   public:
     // StatRegisterer Public Methods
-    using AccumFunc = void (*)(StatsAccumulator &);
     using PixelAccumFunc = void (*)(const Point2i &p, int counterIndex,
                                     PixelStatsAccumulator &);
-    StatRegisterer(AccumFunc func, PixelAccumFunc = {});
+    StatRegisterer(PixelAccumFunc func);
 
-    static void CallCallbacks(StatsAccumulator &accum);
     static void CallPixelCallbacks(const Point2i &p, PixelStatsAccumulator &accum);
 };
 
@@ -32,12 +143,131 @@ void StatsEnablePixelStats(const Bounds2i &b, const std::string &baseName);
 void StatsReportPixelStart(const Point2i &p);
 void StatsReportPixelEnd(const Point2i &p);
 
+// RayType Definition
+enum class RayType { Camera, Indirect, Shadow, BSSRDFProbe };
+
+// Ray Statistics Declarations
+// With --raystats, the rays traced by the CPU integrators are counted by type
+// and path depth, along with the acceleration structure nodes that they
+// visited, the primitives in the leaves that they reached, and how many found an
+// intersection. The aggregates add their traversal work to the thread's
+// _rayTraversalCounts_ and the integrators report each ray or batch of rays
+// after tracing it, which attributes the work done since the previous report
+// to it. Indirect rays reported at depth 0 are counted as camera rays and
+// rays deeper than _RayStatsMaxDepth_ are counted at that depth.
+static constexpr int RayStatsMaxDepth = 16;
+
+struct RayTraversalCounts {
+    int64_t nodesVisited = 0, primitivesTested = 0;
+};
+
+void StatsEnableRayStats();
+void StatsAccumulateRays(RayType type, int64_t nRays, int64_t nHits);
+
+#ifndef PBRT_DISABLE_STATS
+extern bool rayStatsEnabled;
+extern thread_local int rayStatsDepth;
+extern thread_local RayTraversalCounts rayTraversalCounts;
+#endif  // PBRT_DISABLE_STATS
+
+// Sets the path depth of the rays that the thread subsequently reports
+inline void StatsSetRayDepth(int depth) {
+#ifndef PBRT_DISABLE_STATS
+    rayStatsDepth = depth;
+#endif
+}
+
+inline void StatsReportTraversal(int64_t nodesVisited, int64_t primitivesTested) {
+#ifndef PBRT_DISABLE_STATS
+    rayTraversalCounts.nodesVisited += nodesVisited;
+    rayTraversalCounts.primitivesTested += primitivesTested;
+#endif
+}
+
+inline void StatsReportRays(RayType type, int64_t nRays, int64_t nHits) {
+#ifndef PBRT_DISABLE_STATS
+    if (rayStatsEnabled)
+        StatsAccumulateRays(type, nRays, nHits);
+#endif
+}
+
+// Returns the value of the CPU's cycle counter, or of a high-resolution clock
+// where one isn't available. It is cheap enough to read for every pixel, but
+// its rate must be found by comparing elapsed counts to elapsed time.
+uint64_t ReadCycleCounter();
+
 void PrintStats(FILE *dest);
 void StatsWritePixelImages();
 bool PrintCheckRare(FILE *dest);
 void ClearStats();
 void ReportThreadStats();
 
+// StatsPhase Definition
+// Measures the wall-clock time, process CPU time, and peak resident set size
+// of a phase of rendering, such as parsing or building the acceleration
+// structures, from the object's construction to its destruction. Phases may
+// be nested; they are reported in JSON after the other statistics and are
+// recorded in the trace if tracing is enabled. Hardware performance counts
+// are also measured for them if the counters are enabled.
+class StatsPhase {
+  public:
+    // StatsPhase Public Methods
+    StatsPhase(const char *name);
+    ~StatsPhase();
+
+    StatsPhase(const StatsPhase &) = delete;
+    StatsPhase &operator=(const StatsPhase &) = delete;
+
+  private:
+    // StatsPhase Private Members
+    const char *name;
+    int index;
+    std::chrono::steady_clock::time_point start;
+    double startCPUSeconds, traceStart;
+};
+
+// Hardware performance counters are measured for all of pbrt's threads using
+// Linux's perf_event interface; they are reported for each StatsPhase and
+// StatsPerfScope name with the other statistics.
+constexpr int NumPerfCounters = 5;
+extern bool perfCountersEnabled;
+
+// Starts counting cycles, instructions, last-level cache and data TLB misses,
+// and branch mispredictions on all threads, which must have been launched.
+void StatsEnablePerfCounters();
+// Adds the current value of each counter, summed over all threads, to _counts_
+void StatsReadPerfCounters(double counts[NumPerfCounters]);
+void StatsReportPerfCounts(const char *name, const double start[NumPerfCounters]);
+
+// StatsPerfScope Definition
+// Accumulates the hardware performance counts from the object's construction
+// to its destruction with those of other scopes with the same name, which may
+// be a temporary string. It is cheaper than a StatsPhase but still reads the
+// counters of every thread, so it is meant for parallel loops rather than the
+// work done for individual items.
+class StatsPerfScope {
+  public:
+    // StatsPerfScope Public Methods
+    StatsPerfScope(const char *name) {
+        if (perfCountersEnabled) {
+            this->name = name;
+            StatsReadPerfCounters(start);
+        }
+    }
+    ~StatsPerfScope() {
+        if (name)
+            StatsReportPerfCounts(name, start);
+    }
+
+    StatsPerfScope(const StatsPerfScope &) = delete;
+    StatsPerfScope &operator=(const StatsPerfScope &) = delete;
+
+  private:
+    // StatsPerfScope Private Members
+    const char *name = nullptr;
+    double start[NumPerfCounters] = {};
+};
+
 // StatsAccumulator Definition
 class StatsAccumulator {
   public:
@@ -56,6 +286,10 @@ class StatsAccumulator {
     void ReportFloatDistribution(const char *name, double sum, int64_t count, double min,
                                  double max);
 
+    // Adds the given numbers of rays, rays that hit, BVH nodes visited, and
+    // primitives tested to the totals for rays of the type at the depth
+    void ReportRays(RayType type, int depth, const int64_t counts[4]);
+
     void AccumulatePixelStats(const PixelStatsAccumulator &accum);
     void WritePixelImages() const;
 
@@ -86,107 +320,83 @@ class PixelStatsAccumulator {
 };
 
 // Statistics Macros
-#define STAT_COUNTER(title, var)                                       \
-    static thread_local int64_t var;                                   \
-    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) { \
-        accum.ReportCounter(title, var);                               \
-        var = 0;                                                       \
-    });
+#ifdef PBRT_DISABLE_STATS
 
-#define STAT_PIXEL_COUNTER(title, var)                                         \
-    static thread_local int64_t var, var##Sum;                                 \
-    static StatRegisterer STATS_REG##var(                                      \
-        [](StatsAccumulator &accum) {                                          \
-            /* report sum, since if disabled, it all just goes into var... */  \
-            accum.ReportCounter(title, var + var##Sum);                        \
-            var##Sum = 0;                                                      \
-            var = 0;                                                           \
-        },                                                                     \
-        [](const Point2i &p, int counterIndex, PixelStatsAccumulator &accum) { \
-            accum.ReportCounter(p, counterIndex, title, var);                  \
-            var##Sum += var;                                                   \
-            var = 0;                                                           \
-        });
+#define STAT_COUNTER(title, var) [[maybe_unused]] static DisabledStat var;
+#define STAT_PIXEL_COUNTER(title, var) [[maybe_unused]] static DisabledStat var;
+#define STAT_MEMORY_COUNTER(title, var) [[maybe_unused]] static DisabledStat var;
+#define STAT_INT_DISTRIBUTION(title, var) [[maybe_unused]] static DisabledStat var;
+#define STAT_FLOAT_DISTRIBUTION(title, var) [[maybe_unused]] static DisabledStat var;
+#define STAT_PERCENT(title, numVar, denomVar)              \
+    [[maybe_unused]] static DisabledStat numVar, denomVar;
+#define STAT_RATIO(title, numVar, denomVar)                \
+    [[maybe_unused]] static DisabledStat numVar, denomVar;
+#define STAT_PIXEL_RATIO(title, numVar, denomVar)          \
+    [[maybe_unused]] static DisabledStat numVar, denomVar;
 
-#define STAT_MEMORY_COUNTER(title, var)                                \
-    static thread_local int64_t var;                                   \
-    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) { \
-        accum.ReportMemoryCounter(title, var);                         \
-        var = 0;                                                       \
-    });
+#else
 
-struct StatIntDistribution {
-    int64_t sum = 0, count = 0;
-    int64_t min = std::numeric_limits<int64_t>::max();
-    int64_t max = std::numeric_limits<int64_t>::lowest();
-    void operator<<(int64_t value) {
-        sum += value;
-        count += 1;
-        min = (value < min) ? value : min;
-        max = (value > max) ? value : max;
-    }
-};
+#define STAT_COUNTER(title, var)                                                    \
+    static thread_local StatCounter var(                                            \
+        [](StatsAccumulator &accum, int64_t v) { accum.ReportCounter(title, v); });
 
-#define STAT_INT_DISTRIBUTION(title, var)                                         \
-    static thread_local StatIntDistribution var;                                  \
-    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) {            \
-        accum.ReportIntDistribution(title, var.sum, var.count, var.min, var.max); \
-        var.sum = 0;                                                              \
-        var.count = 0;                                                            \
-        var.min = int64_t(std::numeric_limits<int64_t>::max());                   \
-        var.max = int64_t(std::numeric_limits<int64_t>::lowest());                \
-    });
+// Pixel statistics are reported as the change in the counter's value over the
+// course of rendering each pixel.
+#define STAT_PIXEL_COUNTER(title, var)                                              \
+    static thread_local StatCounter var(                                            \
+        [](StatsAccumulator &accum, int64_t v) { accum.ReportCounter(title, v); }); \
+    static thread_local int64_t var##PixelStart;                                    \
+    static StatRegisterer STATS_REG##var(                                           \
+        [](const Point2i &p, int counterIndex, PixelStatsAccumulator &accum) {      \
+            accum.ReportCounter(p, counterIndex, title, var - var##PixelStart);     \
+            var##PixelStart = var;                                                  \
+        });
 
-#define STAT_FLOAT_DISTRIBUTION(title, var)                                             \
-    static thread_local StatCounter<double> var##sum;                                   \
-    static thread_local int64_t var##count;                                             \
-    static thread_local StatCounter<double> var##min(                                   \
-        std::numeric_limits<double>::max());                                            \
-    static thread_local StatCounter<double> var##max(                                   \
-        std::numeric_limits<double>::lowest());                                         \
-    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) {                  \
-        accum.ReportFloatDistribution(title, var##sum, var##count, var##min, var##max); \
-        var##sum = 0;                                                                   \
-        var##count = 0;                                                                 \
-        var##min = StatCounter<double>(std::numeric_limits<double>::max());             \
-        var##max = StatCounter<double>(std::numeric_limits<double>::lowest());          \
+#define STAT_MEMORY_COUNTER(title, var)                                          \
+    static thread_local StatCounter var([](StatsAccumulator &accum, int64_t v) { \
+        accum.ReportMemoryCounter(title, v);                                     \
     });
 
-#define STAT_PERCENT(title, numVar, denomVar)                             \
-    static thread_local int64_t numVar, denomVar;                         \
-    static StatRegisterer STATS_REG##numVar([](StatsAccumulator &accum) { \
-        accum.ReportPercentage(title, numVar, denomVar);                  \
-        numVar = 0;                                                       \
-        denomVar = 0;                                                     \
-    });
+#define STAT_INT_DISTRIBUTION(title, var)                                               \
+    static thread_local StatDistribution<int64_t> var(                                  \
+        [](StatsAccumulator &accum, int64_t sum, int64_t count, int64_t min,            \
+           int64_t max) { accum.ReportIntDistribution(title, sum, count, min, max); });
 
-#define STAT_RATIO(title, numVar, denomVar)                               \
-    static thread_local int64_t numVar, denomVar;                         \
-    static StatRegisterer STATS_REG##numVar([](StatsAccumulator &accum) { \
-        accum.ReportRatio(title, numVar, denomVar);                       \
-        numVar = 0;                                                       \
-        denomVar = 0;                                                     \
-    });
+#define STAT_FLOAT_DISTRIBUTION(title, var)                                              \
+    static thread_local StatDistribution<double> var(                                    \
+        [](StatsAccumulator &accum, double sum, int64_t count, double min,               \
+           double max) { accum.ReportFloatDistribution(title, sum, count, min, max); });
 
-#define STAT_PIXEL_RATIO(title, numVar, denomVar)                                     \
-    static thread_local int64_t numVar, numVar##Sum, denomVar, denomVar##Sum;         \
-    static StatRegisterer STATS_REG##numVar##denomVar(                                \
-        [](StatsAccumulator &accum) {                                                 \
-            /* report sum, since if disabled, it all just goes into var... */         \
-            accum.ReportRatio(title, numVar + numVar##Sum, denomVar + denomVar##Sum); \
-            numVar = 0;                                                               \
-            numVar##Sum = 0;                                                          \
-            denomVar = 0;                                                             \
-            denomVar##Sum = 0;                                                        \
-        },                                                                            \
-        [](const Point2i &p, int counterIndex, PixelStatsAccumulator &accum) {        \
-            accum.ReportRatio(p, counterIndex, title, numVar, denomVar);              \
-            numVar##Sum += numVar;                                                    \
-            denomVar##Sum += denomVar;                                                \
-            numVar = 0;                                                               \
-            denomVar = 0;                                                             \
+// The numerator and denominator of percentages and ratios are separate
+// counters, each of which reports its half of the fraction.
+#define STAT_PERCENT(title, numVar, denomVar)                                       \
+    static thread_local StatCounter numVar([](StatsAccumulator &accum, int64_t v) { \
+        accum.ReportPercentage(title, v, 0);                                        \
+    });                                                                             \
+    static thread_local StatCounter denomVar(                                       \
+        [](StatsAccumulator &accum, int64_t v) {                                    \
+            accum.ReportPercentage(title, 0, v);                                    \
         });
 
+#define STAT_RATIO(title, numVar, denomVar)                                          \
+    static thread_local StatCounter numVar(                                          \
+        [](StatsAccumulator &accum, int64_t v) { accum.ReportRatio(title, v, 0); }); \
+    static thread_local StatCounter denomVar(                                        \
+        [](StatsAccumulator &accum, int64_t v) { accum.ReportRatio(title, 0, v); });
+
+#define STAT_PIXEL_RATIO(title, numVar, denomVar)                                  \
+    STAT_RATIO(title, numVar, denomVar)                                            \
+    static thread_local int64_t numVar##PixelStart, denomVar##PixelStart;          \
+    static StatRegisterer STATS_REG##numVar##denomVar(                             \
+        [](const Point2i &p, int counterIndex, PixelStatsAccumulator &accum) {     \
+            accum.ReportRatio(p, counterIndex, title, numVar - numVar##PixelStart, \
+                              denomVar - denomVar##PixelStart);                    \
+            numVar##PixelStart = numVar;                                           \
+            denomVar##PixelStart = denomVar;                                       \
+        });
+
+#endif  // PBRT_DISABLE_STATS
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_STATS_H
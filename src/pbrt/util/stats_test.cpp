@@ -0,0 +1,98 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+#include <pbrt/pbrt.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/stats.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+using namespace pbrt;
+
+#ifndef PBRT_DISABLE_STATS
+
+STAT_COUNTER("StatsTest/Iterations", nTestIterations);
+STAT_INT_DISTRIBUTION("StatsTest/Index", testIndex);
+STAT_COUNTER("StatsTest/Totaled", nTestTotaled);
+
+static std::string PrintedStats() {
+    FILE *f = std::tmpfile();
+    PrintStats(f);
+    std::string str(std::ftell(f), '\0');
+    std::rewind(f);
+    size_t n = std::fread(str.data(), 1, str.size(), f);
+    std::fclose(f);
+    str.resize(n);
+    return str;
+}
+
+TEST(Stats, CollectWithoutBarrier) {
+    ClearStats();
+    ParallelFor(0, 10000, [](int64_t i) {
+        ++nTestIterations;
+        testIndex << i;
+    });
+
+    // Values are collected from all of the threads that updated them,
+    // without running anything on those threads
+    ReportThreadStats();
+    std::string stats = PrintedStats();
+    EXPECT_NE(std::string::npos, stats.find("Iterations")) << stats;
+    EXPECT_NE(std::string::npos, stats.find("10000")) << stats;
+    EXPECT_NE(std::string::npos, stats.find("4999.500 avg [range 0 - 9999]")) << stats;
+
+    // Collecting again only reports what has changed since
+    ParallelFor(0, 5, [](int64_t i) { ++nTestIterations; });
+    ReportThreadStats();
+    stats = PrintedStats();
+    EXPECT_NE(std::string::npos, stats.find("10005")) << stats;
+    ClearStats();
+}
+
+TEST(Stats, CounterTotal) {
+    // The total includes every thread's value while they're still running
+    int64_t start = nTestTotaled.Total();
+    ParallelFor(0, 1000, [](int64_t) { ++nTestTotaled; });
+    EXPECT_EQ(start + 1000, nTestTotaled.Total());
+}
+
+TEST(Stats, RayStats) {
+    ClearStats();
+    StatsEnableRayStats();
+
+    // Two camera rays that visit 10 nodes and test 4 primitives in all
+    StatsSetRayDepth(0);
+    StatsReportTraversal(6, 3);
+    StatsReportRays(RayType::Indirect, 1, 1);
+    StatsReportTraversal(4, 1);
+    StatsReportRays(RayType::Camera, 1, 0);
+    // A batch of four shadow rays at depth 2, one of which is occluded
+    StatsSetRayDepth(2);
+    StatsReportTraversal(20, 8);
+    StatsReportRays(RayType::Shadow, 4, 1);
+    StatsSetRayDepth(0);
+
+    ReportThreadStats();
+    std::string stats = PrintedStats();
+    EXPECT_NE(std::string::npos, stats.find("Camera              0              2     "
+                                            "50.00%         5.00         2.00"))
+        << stats;
+    EXPECT_NE(std::string::npos, stats.find("Shadow              2              4     "
+                                            "25.00%         5.00         2.00"))
+        << stats;
+    EXPECT_EQ(std::string::npos, stats.find("Indirect")) << stats;
+    ClearStats();
+}
+
+#endif  // PBRT_DISABLE_STATS
+
+TEST(Stats, CycleCounter) {
+    uint64_t start = ReadCycleCounter();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_GT(ReadCycleCounter(), start);
+}
@@ -249,6 +249,32 @@ PBRT_CPU_GPU R Dispatch(F &&func, void *ptr, int index) {
     }
 }
 
+template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
+          typename T4, typename T5, typename T6, typename T7>
+PBRT_CPU_GPU R Dispatch(F &&func, const void *ptr, int index) {
+    DCHECK_GE(index, 0);
+    DCHECK_LT(index, 8);
+
+    switch (index) {
+    case 0:
+        return func((const T0 *)ptr);
+    case 1:
+        return func((const T1 *)ptr);
+    case 2:
+        return func((const T2 *)ptr);
+    case 3:
+        return func((const T3 *)ptr);
+    case 4:
+        return func((const T4 *)ptr);
+    case 5:
+        return func((const T5 *)ptr);
+    case 6:
+        return func((const T6 *)ptr);
+    default:
+        return func((const T7 *)ptr);
+    }
+}
+
 template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
           typename T4, typename T5, typename T6, typename T7>
 PBRT_CPU_GPU R Dispatch(F &&func, void *ptr, int index) {
@@ -276,7 +302,8 @@ PBRT_CPU_GPU R Dispatch(F &&func, void *ptr, int index) {
 }
 
 template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
-          typename T4, typename T5, typename T6, typename T7, typename... Ts>
+          typename T4, typename T5, typename T6, typename T7, typename T8,
+          typename... Ts>
 PBRT_CPU_GPU R Dispatch(F &&func, const void *ptr, int index) {
     DCHECK_GE(index, 0);
 
@@ -298,12 +325,13 @@ PBRT_CPU_GPU R Dispatch(F &&func, const void *ptr, int index) {
     case 7:
         return func((const T7 *)ptr);
     default:
-        return Dispatch<F, R, Ts...>(func, ptr, index - 8);
+        return Dispatch<F, R, T8, Ts...>(func, ptr, index - 8);
     }
 }
 
 template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
-          typename T4, typename T5, typename T6, typename T7, typename... Ts>
+          typename T4, typename T5, typename T6, typename T7, typename T8,
+          typename... Ts>
 PBRT_CPU_GPU R Dispatch(F &&func, void *ptr, int index) {
     DCHECK_GE(index, 0);
 
@@ -325,7 +353,7 @@ PBRT_CPU_GPU R Dispatch(F &&func, void *ptr, int index) {
     case 7:
         return func((T7 *)ptr);
     default:
-        return Dispatch<F, R, Ts...>(func, ptr, index - 8);
+        return Dispatch<F, R, T8, Ts...>(func, ptr, index - 8);
     }
 }
 
@@ -559,6 +587,32 @@ auto DispatchCPU(F &&func, void *ptr, int index) {
     }
 }
 
+template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
+          typename T4, typename T5, typename T6, typename T7>
+auto DispatchCPU(F &&func, const void *ptr, int index) {
+    DCHECK_GE(index, 0);
+    DCHECK_LT(index, 8);
+
+    switch (index) {
+    case 0:
+        return func((const T0 *)ptr);
+    case 1:
+        return func((const T1 *)ptr);
+    case 2:
+        return func((const T2 *)ptr);
+    case 3:
+        return func((const T3 *)ptr);
+    case 4:
+        return func((const T4 *)ptr);
+    case 5:
+        return func((const T5 *)ptr);
+    case 6:
+        return func((const T6 *)ptr);
+    default:
+        return func((const T7 *)ptr);
+    }
+}
+
 template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
           typename T4, typename T5, typename T6, typename T7>
 auto DispatchCPU(F &&func, void *ptr, int index) {
@@ -586,7 +640,8 @@ auto DispatchCPU(F &&func, void *ptr, int index) {
 }
 
 template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
-          typename T4, typename T5, typename T6, typename T7, typename... Ts>
+          typename T4, typename T5, typename T6, typename T7, typename T8,
+          typename... Ts>
 auto DispatchCPU(F &&func, const void *ptr, int index) {
     DCHECK_GE(index, 0);
 
@@ -608,12 +663,13 @@ auto DispatchCPU(F &&func, const void *ptr, int index) {
     case 7:
         return func((const T7 *)ptr);
     default:
-        return DispatchCPU<F, R, Ts...>(func, ptr, index - 8);
+        return DispatchCPU<F, R, T8, Ts...>(func, ptr, index - 8);
     }
 }
 
 template <typename F, typename R, typename T0, typename T1, typename T2, typename T3,
-          typename T4, typename T5, typename T6, typename T7, typename... Ts>
+          typename T4, typename T5, typename T6, typename T7, typename T8,
+          typename... Ts>
 auto DispatchCPU(F &&func, void *ptr, int index) {
     DCHECK_GE(index, 0);
 
@@ -635,7 +691,7 @@ auto DispatchCPU(F &&func, void *ptr, int index) {
     case 7:
         return func((T7 *)ptr);
     default:
-        return DispatchCPU<F, R, Ts...>(func, ptr, index - 8);
+        return DispatchCPU<F, R, T8, Ts...>(func, ptr, index - 8);
     }
 }
 
@@ -0,0 +1,563 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/tilecache.h>
+
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Texture tiles", tileBytes);
+STAT_COUNTER("Textures/Tiles loaded", nTilesLoaded);
+STAT_COUNTER("Textures/Tiles evicted", nTilesEvicted);
+STAT_PERCENT("Textures/Tile microcache hits", nMicrocacheHits, nTileLookups);
+STAT_COUNTER("Textures/Tile files written", nTileFilesWritten);
+
+// TileCache::ThreadState Definition
+struct TileCache::ThreadState {
+    // The epoch in which the thread's outermost ReadScope began, or zero if
+    // the thread isn't reading tiles
+    std::atomic<uint64_t> epoch{0};
+    int depth = 0;
+
+    // Tiles found in _microcache_ can't have been freed if _microcacheEpoch_
+    // matches the current ReadScope's epoch
+    static constexpr int MicrocacheSize = 64;
+    struct Entry {
+        uint64_t key = 0;
+        const Tile *tile = nullptr;
+    };
+    uint64_t microcacheEpoch = 0;
+    Entry microcache[MicrocacheSize];
+};
+
+static std::atomic<uint64_t> nextTileCacheId{1};
+thread_local uint64_t TileCache::threadCacheId;
+thread_local TileCache::ThreadState *TileCache::threadState;
+
+// TileCache Method Definitions
+TileCache::TileCache(size_t maxBytes) : maxBytes(maxBytes), id(nextTileCacheId++) {}
+
+TileCache::~TileCache() {
+    for (Shard &shard : shards)
+        for (auto &t : shard.tiles) {
+            tileBytes -= t.second->data.size();
+            delete t.second;
+        }
+    for (auto &r : retired) {
+        tileBytes -= r.first->data.size();
+        delete r.first;
+    }
+}
+
+int TileCache::AddSource(TileLoader loader) {
+    std::lock_guard<std::mutex> lock(sourcesMutex);
+    sources.push_back(std::move(loader));
+    CHECK_LT(sources.size(), 1 << 24);
+    return int(sources.size()) - 1;
+}
+
+TileCache::ThreadState *TileCache::GetThreadState() {
+    if (threadCacheId != id) {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threads.push_back(std::make_unique<ThreadState>());
+        threadState = threads.back().get();
+        threadCacheId = id;
+    }
+    return threadState;
+}
+
+TileCache::ReadScope::ReadScope(TileCache *cache) : cache(cache) {
+    if (!cache)
+        return;
+    ThreadState *state = cache->GetThreadState();
+    if (state->depth++ > 0)
+        return;
+    // Record the epoch that the scope starts in, retrying if an eviction
+    // advanced it before the record was visible to the evicting thread
+    uint64_t e;
+    do {
+        e = cache->epoch.load();
+        state->epoch.store(e);
+    } while (cache->epoch.load() != e);
+
+    if (state->microcacheEpoch != e) {
+        // Tiles may have been evicted since the microcache was filled
+        for (ThreadState::Entry &entry : state->microcache)
+            entry = ThreadState::Entry();
+        state->microcacheEpoch = e;
+    }
+}
+
+TileCache::ReadScope::~ReadScope() {
+    if (!cache)
+        return;
+    ThreadState *state = threadState;
+    if (--state->depth > 0)
+        return;
+    state->epoch.store(0);
+    if (cache->nRetired.load(std::memory_order_relaxed) > 0)
+        cache->Reclaim();
+}
+
+const uint8_t *TileCache::GetTile(int source, int level, Point2i p) {
+    ThreadState *state = GetThreadState();
+    DCHECK_GT(state->depth, 0);
+    DCHECK(level >= 0 && level < 256);
+    DCHECK(p.x >= 0 && p.x < 65536 && p.y >= 0 && p.y < 65536);
+    uint64_t key = (uint64_t(source) << 40) | (uint64_t(level) << 32) |
+                   (uint64_t(p.y) << 16) | uint64_t(p.x);
+
+    // Return the tile from the thread's microcache if it is there
+    ++nTileLookups;
+    uint64_t hash = MixBits(key);
+    ThreadState::Entry &entry =
+        state->microcache[hash & (ThreadState::MicrocacheSize - 1)];
+    if (entry.tile && entry.key == key) {
+        ++nMicrocacheHits;
+        return entry.tile->data.data();
+    }
+
+    // Look up the tile in the cache and load it if necessary
+    Shard &shard = shards[(hash >> 32) % NumShards];
+    Tile *tile = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (auto iter = shard.tiles.find(key); iter != shard.tiles.end())
+            tile = iter->second;
+    }
+    if (!tile)
+        tile = LoadTile(source, level, p, key);
+    tile->referenced.store(true, std::memory_order_relaxed);
+
+    entry.key = key;
+    entry.tile = tile;
+    return tile->data.data();
+}
+
+TileCache::Tile *TileCache::LoadTile(int source, int level, Point2i p, uint64_t key) {
+    const TileLoader *loader;
+    {
+        std::lock_guard<std::mutex> lock(sourcesMutex);
+        CHECK_LT(source, sources.size());
+        loader = &sources[source];
+    }
+    Tile *tile = new Tile;
+    tile->key = key;
+    (*loader)(level, p, &tile->data);
+
+    // Add the tile to the cache unless another thread loaded it first
+    Shard &shard = shards[(MixBits(key) >> 32) % NumShards];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto result = shard.tiles.insert({key, tile});
+        if (!result.second) {
+            delete tile;
+            return result.first->second;
+        }
+    }
+    ++nTilesLoaded;
+    tileBytes += tile->data.size();
+    {
+        std::lock_guard<std::mutex> lock(residentMutex);
+        resident.push_back(tile);
+    }
+
+    size_t size = tile->data.size();
+    if (residentBytes.fetch_add(size) + size > maxBytes)
+        Evict();
+    return tile;
+}
+
+void TileCache::Evict() {
+    // Only one thread evicts at a time; others keep loading tiles meanwhile
+    std::unique_lock<std::mutex> lock(residentMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    // Sweep the clock hand over resident tiles until enough memory is free
+    size_t target = maxBytes - maxBytes / 8;
+    uint64_t e = epoch.load();
+    bool evicted = false;
+    while (residentBytes.load() > target && !resident.empty()) {
+        if (clockHand >= resident.size())
+            clockHand = 0;
+        Tile *tile = resident[clockHand];
+        if (tile->referenced.exchange(false, std::memory_order_relaxed)) {
+            ++clockHand;
+            continue;
+        }
+        // Remove the tile from the cache and retire it
+        Shard &shard = shards[(MixBits(tile->key) >> 32) % NumShards];
+        {
+            std::lock_guard<std::mutex> shardLock(shard.mutex);
+            shard.tiles.erase(tile->key);
+        }
+        resident[clockHand] = resident.back();
+        resident.pop_back();
+        residentBytes -= tile->data.size();
+        retired.push_back({tile, e});
+        ++nTilesEvicted;
+        evicted = true;
+    }
+
+    if (evicted) {
+        // Threads that start reading after this can't find the retired tiles
+        epoch.fetch_add(1);
+        nRetired = retired.size();
+    }
+    lock.unlock();
+    Reclaim();
+}
+
+void TileCache::Reclaim() {
+    std::unique_lock<std::mutex> lock(residentMutex, std::try_to_lock);
+    if (!lock.owns_lock() || retired.empty())
+        return;
+
+    // Find the earliest epoch in which a thread that is reading tiles began
+    uint64_t minEpoch = ~uint64_t(0);
+    {
+        std::lock_guard<std::mutex> threadsLock(threadsMutex);
+        for (const std::unique_ptr<ThreadState> &state : threads)
+            if (uint64_t e = state->epoch.load(); e != 0)
+                minEpoch = std::min(minEpoch, e);
+    }
+
+    // Free retired tiles that no reading thread may hold pointers to
+    auto iter = std::partition(retired.begin(), retired.end(),
+                               [&](const std::pair<Tile *, uint64_t> &r) {
+                                   return r.second >= minEpoch;
+                               });
+    for (auto r = iter; r != retired.end(); ++r) {
+        tileBytes -= r->first->data.size();
+        delete r->first;
+    }
+    retired.erase(iter, retired.end());
+    nRetired = retired.size();
+}
+
+std::string TileCache::ToString() const {
+    return StringPrintf("[ TileCache maxBytes: %d residentBytes: %d epoch: %d ]",
+                        maxBytes, residentBytes.load(), epoch.load());
+}
+
+// TiledImagePyramid Helper Definitions
+static constexpr char tileFileMagic[8] = "pbrttex";
+static constexpr uint32_t tileFileVersion = 2;
+
+struct TileFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    int32_t nChannels;
+    int32_t nLevels;
+    float primaries[8];
+    int32_t wrapMode[2];
+    char encoding[32];
+    int64_t dataOffset;
+};
+
+static std::string encodingName(ColorEncoding encoding) {
+    if (!encoding || encoding == ColorEncoding::Linear)
+        return "linear";
+    if (encoding == ColorEncoding::sRGB)
+        return "sRGB";
+    return StringPrintf("gamma %f", encoding.Cast<GammaColorEncoding>()->Gamma());
+}
+
+// Returns the file's modification time, or zero if it doesn't exist.
+static long long modificationTime(const std::string &filename, long long *size) {
+#ifdef PBRT_IS_WINDOWS
+    struct _stat64 s;
+    if (_stat64(filename.c_str(), &s) != 0)
+        return 0;
+#else
+    struct stat s;
+    if (stat(filename.c_str(), &s) != 0)
+        return 0;
+#endif
+    if (size)
+        *size = s.st_size;
+    return s.st_mtime;
+}
+
+// TiledImagePyramid Method Definitions
+TiledImagePyramid::TiledImagePyramid(std::string fn, PixelFormat format, int nChannels,
+                                     ColorEncoding encoding,
+                                     const RGBColorSpace *colorSpace,
+                                     pstd::span<const Point2i> resolutions,
+                                     int64_t dataOffset, TileCache *cache,
+                                     Allocator alloc)
+    : filename(std::move(fn)),
+      format(format),
+      nChannels(nChannels),
+      encoding(encoding),
+      colorSpace(colorSpace),
+      levels(alloc),
+      cache(cache) {
+    // Compute the layout of each level's tiles in the file
+    int64_t offset = dataOffset;
+    for (Point2i res : resolutions) {
+        Level level;
+        level.resolution = res;
+        level.tileExtent = Point2i(std::min(res.x, TileSize), std::min(res.y, TileSize));
+        level.nTiles = Point2i((res.x + level.tileExtent.x - 1) / level.tileExtent.x,
+                               (res.y + level.tileExtent.y - 1) / level.tileExtent.y);
+        level.tileBytes = size_t(level.tileExtent.x) * level.tileExtent.y * nChannels *
+                          TexelBytes(format);
+        level.offset = offset;
+        offset += int64_t(level.tileBytes) * level.nTiles.x * level.nTiles.y;
+        levels.push_back(level);
+    }
+
+    if (cache)
+        source = cache->AddSource(
+            [this](int level, Point2i tile, std::vector<uint8_t> *data) {
+                LoadTile(level, tile, data);
+            });
+}
+
+bool TiledImagePyramid::Write(const std::string &filename,
+                              pstd::span<const Image> pyramid,
+                              const RGBColorSpace *colorSpace, WrapMode2D wrapMode,
+                              ColorEncoding encoding) {
+    // Check that the pyramid can be stored as tiles
+    CHECK(!pyramid.empty());
+    for (const Image &image : pyramid)
+        for (int c = 0; c < 2; ++c)
+            if (!IsPowerOf2(image.Resolution()[c]))
+                return false;
+    if (!RGBColorSpace::Lookup(colorSpace->r, colorSpace->g, colorSpace->b,
+                               colorSpace->w))
+        return false;
+
+    // Initialize _TileFileHeader_ for the pyramid
+    TileFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, tileFileMagic, sizeof(tileFileMagic));
+    header.version = tileFileVersion;
+    header.format = uint32_t(pyramid[0].Format());
+    header.nChannels = pyramid[0].NChannels();
+    header.nLevels = int32_t(pyramid.size());
+    Point2f primaries[4] = {colorSpace->r, colorSpace->g, colorSpace->b, colorSpace->w};
+    for (int i = 0; i < 4; ++i) {
+        header.primaries[2 * i] = primaries[i].x;
+        header.primaries[2 * i + 1] = primaries[i].y;
+    }
+    header.wrapMode[0] = int32_t(wrapMode.wrap[0]);
+    header.wrapMode[1] = int32_t(wrapMode.wrap[1]);
+    std::string name = encodingName(encoding);
+    CHECK_LT(name.size(), sizeof(header.encoding));
+    std::memcpy(header.encoding, name.data(), name.size());
+    int64_t levelsBytes = header.nLevels * 2 * sizeof(int32_t);
+    header.dataOffset = (sizeof(header) + levelsBytes + 4095) & ~int64_t(4095);
+
+    // As with BVH cache files, write to a temporary file and rename it so
+    // that concurrent renders never see a partially-written file
+    uint64_t tempSuffix =
+        MixBits(uint64_t(time(nullptr)) ^ (uintptr_t)pyramid.data());
+    std::string tempFilename =
+        StringPrintf("%s.%016llx.tmp", filename, (unsigned long long)tempSuffix);
+    FILE *f = FOpenWrite(tempFilename);
+    if (!f) {
+        Warning("%s: %s", tempFilename, ErrorString());
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (const Image &image : pyramid) {
+        int32_t res[2] = {image.Resolution().x, image.Resolution().y};
+        ok &= fwrite(res, sizeof(res), 1, f) == 1;
+    }
+    std::vector<char> padding(header.dataOffset - sizeof(header) - levelsBytes, 0);
+    ok &= fwrite(padding.data(), 1, padding.size(), f) == padding.size();
+
+    // Write the tiles of each level in scanline order
+    size_t texelBytes = pyramid[0].NChannels() * TexelBytes(pyramid[0].Format());
+    for (const Image &image : pyramid) {
+        Point2i res = image.Resolution();
+        Point2i extent(std::min(res.x, TileSize), std::min(res.y, TileSize));
+        for (int ty = 0; ty < res.y; ty += extent.y)
+            for (int tx = 0; tx < res.x; tx += extent.x)
+                for (int y = ty; y < ty + extent.y; ++y)
+                    ok &= fwrite(image.RawPointer({tx, y}), texelBytes * extent.x, 1,
+                                 f) == 1;
+    }
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        Warning("%s: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tempFilename.c_str());
+        // Another process may have written the same file first
+        return FileExists(filename);
+    }
+    ++nTileFilesWritten;
+    return true;
+}
+
+TiledImagePyramid *TiledImagePyramid::Read(const std::string &filename,
+                                           WrapMode2D wrapMode, ColorEncoding encoding,
+                                           TileCache *cache, Allocator alloc) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return nullptr;
+
+    // Read and validate the tile file's header
+    TileFileHeader header;
+    if (!in.read((char *)&header, sizeof(header)) ||
+        std::memcmp(header.magic, tileFileMagic, sizeof(tileFileMagic)) != 0 ||
+        header.version != tileFileVersion ||
+        header.format > uint32_t(PixelFormat::Float) || header.nChannels < 1 ||
+        header.nChannels > 4 || header.nChannels == 2 || header.nLevels < 1 ||
+        header.nLevels > 32 || header.encoding[sizeof(header.encoding) - 1] != '\0') {
+        Warning("%s: invalid texture tile file. Ignoring it.", filename);
+        return nullptr;
+    }
+    const RGBColorSpace *colorSpace = RGBColorSpace::Lookup(
+        Point2f(header.primaries[0], header.primaries[1]),
+        Point2f(header.primaries[2], header.primaries[3]),
+        Point2f(header.primaries[4], header.primaries[5]),
+        Point2f(header.primaries[6], header.primaries[7]));
+    if (!colorSpace) {
+        Warning("%s: unknown color space in texture tile file. Ignoring it.", filename);
+        return nullptr;
+    }
+
+    // Check that the pyramid was created for the texture's settings
+    PixelFormat format = PixelFormat(header.format);
+    ColorEncoding fileEncoding = ColorEncoding::Get(header.encoding, alloc);
+    if (header.wrapMode[0] != int32_t(wrapMode.wrap[0]) ||
+        header.wrapMode[1] != int32_t(wrapMode.wrap[1]) ||
+        (format == PixelFormat::U256 && fileEncoding != encoding)) {
+        Warning("%s: texture tile file was created with a different wrap mode or "
+                "color encoding. Ignoring it.",
+                filename);
+        return nullptr;
+    }
+
+    std::vector<Point2i> resolutions(header.nLevels);
+    for (Point2i &res : resolutions) {
+        int32_t r[2];
+        if (!in.read((char *)r, sizeof(r)) || r[0] < 1 || r[1] < 1) {
+            Warning("%s: invalid texture tile file. Ignoring it.", filename);
+            return nullptr;
+        }
+        res = Point2i(r[0], r[1]);
+    }
+
+    // Make sure that the file holds all of the tiles
+    int64_t dataBytes = 0;
+    for (Point2i res : resolutions)
+        dataBytes += int64_t(res.x) * res.y * header.nChannels * TexelBytes(format);
+    in.seekg(0, std::ios::end);
+    if (header.dataOffset < int64_t(sizeof(header)) ||
+        int64_t(in.tellg()) < header.dataOffset + dataBytes) {
+        Warning("%s: truncated texture tile file. Ignoring it.", filename);
+        return nullptr;
+    }
+
+    return alloc.new_object<TiledImagePyramid>(filename, format, header.nChannels,
+                                               fileEncoding, colorSpace, resolutions,
+                                               header.dataOffset, cache, alloc);
+}
+
+pstd::vector<Image> TiledImagePyramid::ReadLevels(Allocator alloc) const {
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file)
+        ErrorExit("%s: %s", filename, ErrorString());
+
+    // Copy each level's tiles into an _Image_
+    static const std::vector<std::string> channelNames[4] = {
+        {"Y"}, {}, {"R", "G", "B"}, {"R", "G", "B", "A"}};
+    pstd::vector<Image> pyramid(alloc);
+    size_t texelBytes = nChannels * TexelBytes(format);
+    for (const Level &level : levels) {
+        Image image(format, level.resolution, channelNames[nChannels - 1],
+                    Is8Bit(format) ? encoding : nullptr, alloc);
+        ParallelFor(0, level.nTiles.y, [&](int64_t ty) {
+            for (int tx = 0; tx < level.nTiles.x; ++tx) {
+                const char *tile = file->data() + level.offset +
+                                   level.tileBytes * (ty * level.nTiles.x + tx);
+                Point2i p0(tx * level.tileExtent.x, ty * level.tileExtent.y);
+                for (int y = 0; y < level.tileExtent.y; ++y)
+                    std::memcpy(image.RawPointer({p0.x, p0.y + y}),
+                                tile + y * level.tileExtent.x * texelBytes,
+                                level.tileExtent.x * texelBytes);
+            }
+        });
+        pyramid.push_back(std::move(image));
+    }
+    return pyramid;
+}
+
+void TiledImagePyramid::LoadTile(int level, Point2i tile,
+                                 std::vector<uint8_t> *data) const {
+    // Files are opened for each tile so that there's no limit to the number
+    // of textures that can be in use
+    const Level &l = levels[level];
+    data->resize(l.tileBytes);
+    std::ifstream in(filename, std::ios::binary);
+    in.seekg(l.offset + int64_t(l.tileBytes) * (tile.y * l.nTiles.x + tile.x));
+    if (!in.read((char *)data->data(), l.tileBytes))
+        ErrorExit("%s: unable to read texture tile.", filename);
+}
+
+std::string TiledImagePyramid::ToString() const {
+    return StringPrintf("[ TiledImagePyramid filename: %s format: %s nChannels: %d "
+                        "levels: %d colorSpace: %s ]",
+                        filename, format, nChannels, levels.size(),
+                        colorSpace->ToString());
+}
+
+// Texture Tile Cache Definitions
+TileCache *textureTileCache;
+static std::string textureTileDirectory;
+
+void InitTextureTileCache(std::string directory, size_t maxBytes) {
+    textureTileDirectory = std::move(directory);
+    textureTileCache = new TileCache(maxBytes);
+}
+
+std::string TextureTileFilename(const std::string &filename, WrapMode2D wrapMode,
+                                ColorEncoding encoding) {
+    // Include the image file's size and modification time in the tile file's
+    // name so that changes to the image aren't missed
+    long long size = 0, mtime = modificationTime(filename, &size);
+    std::string key = StringPrintf("%s %d %d %d %d %s", filename, size, mtime,
+                                   int(wrapMode.wrap[0]), int(wrapMode.wrap[1]),
+                                   encoding.ToString());
+    uint64_t hash = HashBuffer(key.data(), key.size());
+    return StringPrintf("%s/texture-%016llx.tiles", textureTileDirectory,
+                        (unsigned long long)hash);
+}
+
+// Pyramid File Definitions
+std::string PyramidFilename(const std::string &imageFilename) {
+    return imageFilename + ".mip";
+}
+
+bool PyramidFileIsCurrent(const std::string &imageFilename) {
+    long long pyramidTime = modificationTime(PyramidFilename(imageFilename), nullptr);
+    return pyramidTime != 0 && pyramidTime >= modificationTime(imageFilename, nullptr);
+}
+
+}  // namespace pbrt
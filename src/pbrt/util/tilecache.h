@@ -0,0 +1,228 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_TILECACHE_H
+#define PBRT_UTIL_TILECACHE_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pbrt {
+
+// TileCache Definition
+// TileCache holds tiles of data that are loaded on demand from registered
+// sources, evicting the least recently used ones (approximately, via the CLOCK
+// algorithm) so that the tiles' total size stays within a fixed budget.
+// Pointers returned by GetTile() remain valid until the calling thread's
+// outermost ReadScope ends; evicted tiles are only freed once no thread that
+// might still hold a pointer to them is inside a ReadScope.
+class TileCache {
+  public:
+    // TileCache Public Types
+    using TileLoader =
+        std::function<void(int level, Point2i tile, std::vector<uint8_t> *data)>;
+
+    // TileCache::ReadScope Definition
+    class ReadScope {
+      public:
+        // ReadScope Public Methods
+        ReadScope(TileCache *cache);
+        ~ReadScope();
+
+        ReadScope(const ReadScope &) = delete;
+        ReadScope &operator=(const ReadScope &) = delete;
+
+      private:
+        // ReadScope Private Members
+        TileCache *cache;
+    };
+
+    // TileCache Public Methods
+    TileCache(size_t maxBytes);
+    ~TileCache();
+
+    TileCache(const TileCache &) = delete;
+    TileCache &operator=(const TileCache &) = delete;
+
+    int AddSource(TileLoader loader);
+
+    const uint8_t *GetTile(int source, int level, Point2i tile);
+
+    size_t MaxBytes() const { return maxBytes; }
+    size_t BytesUsed() const { return residentBytes.load(std::memory_order_relaxed); }
+
+    std::string ToString() const;
+
+  private:
+    // TileCache Private Types
+    struct Tile {
+        uint64_t key;
+        std::atomic<bool> referenced{true};
+        std::vector<uint8_t> data;
+    };
+    struct ThreadState;
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Tile *> tiles;
+    };
+
+    // TileCache Private Methods
+    ThreadState *GetThreadState();
+    Tile *LoadTile(int source, int level, Point2i p, uint64_t key);
+    void Evict();
+    void Reclaim();
+
+    // TileCache Private Members
+    static constexpr int NumShards = 64;
+    size_t maxBytes;
+    uint64_t id;
+    Shard shards[NumShards];
+
+    std::mutex sourcesMutex;
+    std::deque<TileLoader> sources;
+
+    std::mutex threadsMutex;
+    std::vector<std::unique_ptr<ThreadState>> threads;
+
+    // Tiles are evicted and freed while _residentMutex_ is held
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<size_t> residentBytes{0}, nRetired{0};
+    std::mutex residentMutex;
+    std::vector<Tile *> resident;
+    size_t clockHand = 0;
+    std::vector<std::pair<Tile *, uint64_t>> retired;
+
+    // Each thread's state is owned by the cache it was last used with; the
+    // cache's unique id, rather than its address, identifies it here.
+    static thread_local uint64_t threadCacheId;
+    static thread_local ThreadState *threadState;
+};
+
+// TiledImagePyramid Definition
+// TiledImagePyramid stores the levels of an image pyramid in a file as square
+// tiles of TileSize texels, or of the level's resolution if it is smaller, and
+// loads them through a TileCache as they are accessed. Tile files start with a
+// header giving the pixel format, number of channels, color space primaries,
+// wrap mode and color encoding used to create the pyramid, and the resolution
+// of each level. Each level's tiles follow in scanline order, starting at an
+// offset that is a multiple of 4096 bytes so that they can be mapped into
+// memory; all values are little endian.
+class TiledImagePyramid {
+  public:
+    // TiledImagePyramid Public Methods
+    static bool Write(const std::string &filename, pstd::span<const Image> pyramid,
+                      const RGBColorSpace *colorSpace, WrapMode2D wrapMode,
+                      ColorEncoding encoding);
+    // Returns nullptr if the file can't be read or if its pyramid was created
+    // with a different wrap mode or, for 8-bit images, color encoding. If
+    // _cache_ is nullptr, tiles can't be accessed but ReadLevels() can be used.
+    static TiledImagePyramid *Read(const std::string &filename, WrapMode2D wrapMode,
+                                   ColorEncoding encoding, TileCache *cache,
+                                   Allocator alloc);
+
+    pstd::vector<Image> ReadLevels(Allocator alloc) const;
+
+    int Levels() const { return int(levels.size()); }
+    Point2i LevelResolution(int level) const {
+        CHECK(level >= 0 && level < levels.size());
+        return levels[level].resolution;
+    }
+    int NChannels() const { return nChannels; }
+    const RGBColorSpace *GetRGBColorSpace() const { return colorSpace; }
+    TileCache *GetTileCache() const { return cache; }
+
+    // Stores the channel values of the texel _p_, which must be inside the
+    // level, in _values_; the caller must be inside a TileCache::ReadScope.
+    void GetTexel(int level, Point2i p, Float *values) const {
+        // Find the tile that holds _p_ and the texel's offset in it
+        DCHECK(level >= 0 && level < levels.size());
+        Point2i extent = levels[level].tileExtent;
+        const uint8_t *tile =
+            cache->GetTile(source, level, {p.x / extent.x, p.y / extent.y});
+        int offset = nChannels * ((p.y % extent.y) * extent.x + p.x % extent.x);
+
+        switch (format) {
+        case PixelFormat::U256:
+            encoding.ToLinear({tile + offset, size_t(nChannels)},
+                              {values, size_t(nChannels)});
+            break;
+        case PixelFormat::Half:
+            for (int c = 0; c < nChannels; ++c)
+                values[c] = Float(((const Half *)tile)[offset + c]);
+            break;
+        case PixelFormat::Float:
+            for (int c = 0; c < nChannels; ++c)
+                values[c] = ((const float *)tile)[offset + c];
+            break;
+        default:
+            LOG_FATAL("Unhandled PixelFormat");
+        }
+    }
+
+    std::string ToString() const;
+
+    static constexpr int TileSize = 64;
+
+    TiledImagePyramid(std::string filename, PixelFormat format, int nChannels,
+                      ColorEncoding encoding, const RGBColorSpace *colorSpace,
+                      pstd::span<const Point2i> resolutions, int64_t dataOffset,
+                      TileCache *cache, Allocator alloc);
+
+  private:
+    // TiledImagePyramid Private Types
+    struct Level {
+        Point2i resolution, tileExtent, nTiles;
+        int64_t offset;
+        size_t tileBytes;
+    };
+
+    // TiledImagePyramid Private Methods
+    void LoadTile(int level, Point2i tile, std::vector<uint8_t> *data) const;
+
+    // TiledImagePyramid Private Members
+    std::string filename;
+    PixelFormat format;
+    int nChannels;
+    ColorEncoding encoding;
+    const RGBColorSpace *colorSpace;
+    pstd::vector<Level> levels;
+    TileCache *cache;
+    int source;
+};
+
+// Texture Tile Cache Declarations
+// Image textures are stored as tiled pyramid files in the directory given to
+// InitTextureTileCache() and loaded through _textureTileCache_ if it is set.
+extern TileCache *textureTileCache;
+
+void InitTextureTileCache(std::string directory, size_t maxBytes);
+std::string TextureTileFilename(const std::string &filename, WrapMode2D wrapMode,
+                                ColorEncoding encoding);
+
+// Pyramid File Declarations
+// "imgtool makemip" writes the TiledImagePyramid for an image texture to the
+// file given by PyramidFilename(); MIPMap::CreateFromFile() then uses it rather
+// than the image, as long as it is at least as new as the image.
+std::string PyramidFilename(const std::string &imageFilename);
+bool PyramidFileIsCurrent(const std::string &imageFilename);
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_TILECACHE_H
@@ -0,0 +1,157 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/tilecache.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+using namespace pbrt;
+
+static uint8_t tileValue(int source, int level, Point2i tile, int i) {
+    return uint8_t(source * 37 + level * 11 + tile.x * 5 + tile.y * 3 + i);
+}
+
+static TileCache::TileLoader makeLoader(int source, size_t tileBytes,
+                                        std::atomic<int> *nLoads) {
+    return [=](int level, Point2i tile, std::vector<uint8_t> *data) {
+        ++*nLoads;
+        data->resize(tileBytes);
+        for (size_t i = 0; i < tileBytes; ++i)
+            (*data)[i] = tileValue(source, level, tile, i);
+    };
+}
+
+TEST(TileCache, Basics) {
+    std::atomic<int> nLoads{0};
+    TileCache cache(1024 * 1024);
+    int a = cache.AddSource(makeLoader(0, 256, &nLoads));
+    int b = cache.AddSource(makeLoader(1, 512, &nLoads));
+    EXPECT_EQ(0, a);
+    EXPECT_EQ(1, b);
+
+    TileCache::ReadScope scope(&cache);
+    const uint8_t *t0 = cache.GetTile(a, 2, {3, 4});
+    const uint8_t *t1 = cache.GetTile(b, 2, {3, 4});
+    EXPECT_EQ(2, nLoads);
+    EXPECT_EQ(768, cache.BytesUsed());
+    for (int i = 0; i < 256; ++i)
+        EXPECT_EQ(tileValue(0, 2, {3, 4}, i), t0[i]);
+    for (int i = 0; i < 512; ++i)
+        EXPECT_EQ(tileValue(1, 2, {3, 4}, i), t1[i]);
+
+    // Tiles are only loaded once
+    EXPECT_EQ(t0, cache.GetTile(a, 2, {3, 4}));
+    EXPECT_EQ(t1, cache.GetTile(b, 2, {3, 4}));
+    EXPECT_EQ(2, nLoads);
+}
+
+TEST(TileCache, Eviction) {
+    std::atomic<int> nLoads{0};
+    constexpr size_t tileBytes = 1024, maxBytes = 16 * tileBytes;
+    TileCache cache(maxBytes);
+    int source = cache.AddSource(makeLoader(0, tileBytes, &nLoads));
+
+    for (int i = 0; i < 100; ++i) {
+        TileCache::ReadScope scope(&cache);
+        Point2i p(i % 10, i / 10);
+        const uint8_t *tile = cache.GetTile(source, 0, p);
+        EXPECT_EQ(tileValue(0, 0, p, 0), tile[0]);
+        EXPECT_EQ(tileValue(0, 0, p, tileBytes - 1), tile[tileBytes - 1]);
+        EXPECT_LE(cache.BytesUsed(), maxBytes);
+    }
+    EXPECT_EQ(100, nLoads);
+
+    // The most recently used tile is still resident
+    TileCache::ReadScope scope(&cache);
+    cache.GetTile(source, 0, {9, 9});
+    EXPECT_EQ(100, nLoads);
+}
+
+TEST(TileCache, Concurrent) {
+    std::atomic<int> nLoads{0};
+    constexpr size_t tileBytes = 4096, maxBytes = 64 * tileBytes;
+    TileCache cache(maxBytes);
+    int sources[3];
+    for (int i = 0; i < 3; ++i)
+        sources[i] = cache.AddSource(makeLoader(i, tileBytes, &nLoads));
+
+    std::atomic<int> nMismatches{0};
+    ParallelFor(0, 256, [&](int64_t index) {
+        RNG rng(index);
+        for (int i = 0; i < 64; ++i) {
+            // Read a few tiles within each scope, as a texture lookup would
+            TileCache::ReadScope scope(&cache);
+            for (int j = 0; j < 4; ++j) {
+                int s = rng.Uniform<uint32_t>() % 3, level = rng.Uniform<uint32_t>() % 4;
+                Point2i p(rng.Uniform<uint32_t>() % 8, rng.Uniform<uint32_t>() % 8);
+                const uint8_t *tile = cache.GetTile(sources[s], level, p);
+                for (size_t k = 0; k < tileBytes; k += 511)
+                    if (tile[k] != tileValue(s, level, p, k))
+                        ++nMismatches;
+            }
+        }
+    });
+    EXPECT_EQ(0, nMismatches);
+    EXPECT_GT(nLoads, 64);
+    EXPECT_LE(cache.BytesUsed(), maxBytes + RunningThreads() * tileBytes);
+}
+
+TEST(TiledImagePyramid, RoundTrip) {
+    Image image(PixelFormat::Half, {128, 64}, {"R", "G", "B"});
+    RNG rng;
+    for (int y = 0; y < 64; ++y)
+        for (int x = 0; x < 128; ++x)
+            for (int c = 0; c < 3; ++c)
+                image.SetChannel({x, y}, c, rng.Uniform<Float>());
+    pstd::vector<Image> pyramid =
+        Image::GeneratePyramid(std::move(image), WrapMode::Repeat, {});
+    const RGBColorSpace *colorSpace = RGBColorSpace::sRGB;
+
+    std::string filename = "tiledpyramid.mip";
+    ASSERT_TRUE(TiledImagePyramid::Write(filename, pyramid, colorSpace,
+                                         WrapMode::Repeat, ColorEncoding::Linear));
+
+    // Pyramids filtered with a different wrap mode aren't used
+    EXPECT_TRUE(TiledImagePyramid::Read(filename, WrapMode::Clamp, ColorEncoding::Linear,
+                                        nullptr, {}) == nullptr);
+
+    TileCache cache(1024 * 1024);
+    TiledImagePyramid *tiles = TiledImagePyramid::Read(
+        filename, WrapMode::Repeat, ColorEncoding::Linear, &cache, {});
+    ASSERT_TRUE(tiles != nullptr);
+    ASSERT_EQ(pyramid.size(), tiles->Levels());
+    EXPECT_EQ(colorSpace, tiles->GetRGBColorSpace());
+
+    pstd::vector<Image> levels = tiles->ReadLevels({});
+    ASSERT_EQ(pyramid.size(), levels.size());
+    TileCache::ReadScope scope(&cache);
+    for (int level = 0; level < tiles->Levels(); ++level) {
+        Point2i res = pyramid[level].Resolution();
+        EXPECT_EQ(res, tiles->LevelResolution(level));
+        EXPECT_EQ(res, levels[level].Resolution());
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x) {
+                Float texel[3];
+                tiles->GetTexel(level, {x, y}, texel);
+                for (int c = 0; c < 3; ++c) {
+                    EXPECT_EQ(pyramid[level].GetChannel({x, y}, c), texel[c]);
+                    EXPECT_EQ(pyramid[level].GetChannel({x, y}, c),
+                              levels[level].GetChannel({x, y}, c));
+                }
+            }
+    }
+
+    Allocator alloc;
+    alloc.delete_object(tiles);
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
@@ -0,0 +1,164 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/trace.h>
+
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+namespace pbrt {
+
+bool tracingEnabled = false;
+
+// TraceEvent Definition
+struct TraceEvent {
+    const char *name, *category;
+    double start, end;
+    std::string detail;
+};
+
+// TraceThreadEvents Definition
+// Each thread records events in its own buffer; the buffer's mutex is only
+// contended while the trace is written.
+struct TraceThreadEvents {
+    std::mutex mutex;
+    int threadIndex;
+    std::vector<TraceEvent> events;
+};
+
+// TraceGPUEvent Definition
+struct TraceGPUEvent {
+    const char *name;
+    int device;
+    double start, end;
+};
+
+static std::string traceFilename;
+static std::chrono::steady_clock::time_point traceStart;
+static std::mutex traceMutex;
+static std::vector<TraceThreadEvents *> traceThreadEvents;
+static std::vector<TraceGPUEvent> traceGPUEvents;
+// Buffers from a previous trace are freed when it is written, so threads
+// check that theirs is from the current one
+static int traceGeneration;
+static thread_local TraceThreadEvents *threadEvents;
+static thread_local int threadEventsGeneration = -1;
+
+// Tracing Function Definitions
+void TraceInit(const std::string &filename) {
+    traceFilename = filename;
+    traceStart = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(traceMutex);
+    ++traceGeneration;
+    tracingEnabled = true;
+}
+
+double TraceMicroseconds() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(now - traceStart).count();
+}
+
+void TraceRecord(const char *name, const char *category, double startMicroseconds,
+                 double endMicroseconds, std::string detail) {
+    // Events that end after the trace has been written are dropped
+    if (!tracingEnabled)
+        return;
+    if (threadEventsGeneration != traceGeneration) {
+        // Allocate the thread's buffer; it is freed when the trace is written,
+        // which may be after the thread has exited
+        std::lock_guard<std::mutex> lock(traceMutex);
+        threadEvents = new TraceThreadEvents;
+        threadEvents->threadIndex = ThreadIndex;
+        threadEventsGeneration = traceGeneration;
+        traceThreadEvents.push_back(threadEvents);
+    }
+    std::lock_guard<std::mutex> lock(threadEvents->mutex);
+    threadEvents->events.push_back(TraceEvent{name, category, startMicroseconds,
+                                              endMicroseconds, std::move(detail)});
+}
+
+void TraceRecordGPU(const char *name, int device, double startMicroseconds,
+                    double endMicroseconds) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceGPUEvents.push_back(
+        TraceGPUEvent{name, device, startMicroseconds, endMicroseconds});
+}
+
+// Returns _s_ as a quoted JSON string.
+static std::string JSONString(const std::string &s) {
+    std::string result = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c >= 0 && c < 0x20)
+            result += StringPrintf("\\u%04x", int(c));
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
+void TraceWrite() {
+    if (!tracingEnabled)
+        return;
+    tracingEnabled = false;
+
+    FILE *f = FOpenWrite(traceFilename);
+    if (!f) {
+        Warning("%s: unable to open trace file: %s", traceFilename, ErrorString());
+        return;
+    }
+
+    // CPU threads are in the first process and GPUs in the second; each
+    // thread's track is identified by the order in which it first recorded an
+    // event since threads outside the thread pool share _ThreadIndex_ zero.
+    std::lock_guard<std::mutex> lock(traceMutex);
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+               "\"args\": {\"name\": \"CPU\"}}");
+    for (size_t tid = 0; tid < traceThreadEvents.size(); ++tid) {
+        TraceThreadEvents *thread = traceThreadEvents[tid];
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        fprintf(f,
+                ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, "
+                "\"args\": {\"name\": \"Thread %d\"}}",
+                tid, thread->threadIndex);
+        for (const TraceEvent &e : thread->events) {
+            fprintf(f,
+                    ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                    "\"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f",
+                    e.name, e.category, tid, e.start, e.end - e.start);
+            if (!e.detail.empty())
+                fprintf(f, ", \"args\": {\"detail\": %s}", JSONString(e.detail).c_str());
+            fprintf(f, "}");
+        }
+        delete thread;
+    }
+    traceThreadEvents.clear();
+
+    if (!traceGPUEvents.empty())
+        fprintf(f,
+                ",\n{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"tid\": 0, "
+                "\"args\": {\"name\": \"GPU\"}}");
+    for (const TraceGPUEvent &e : traceGPUEvents)
+        fprintf(f,
+                ",\n{\"name\": %s, \"cat\": \"kernel\", \"ph\": \"X\", \"pid\": 2, "
+                "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                JSONString(e.name).c_str(), e.device, e.start, e.end - e.start);
+    traceGPUEvents.clear();
+
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0)
+        Warning("%s: error writing trace file: %s", traceFilename, ErrorString());
+}
+
+}  // namespace pbrt
@@ -0,0 +1,80 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_TRACE_H
+#define PBRT_UTIL_TRACE_H
+
+#include <pbrt/pbrt.h>
+
+#include <string>
+
+namespace pbrt {
+
+// Tracing records timed events on each thread, such as thread pool jobs,
+// image tiles, and rendering phases, as well as GPU kernel executions, and
+// writes them in the Chrome trace event format so that they can be viewed
+// as a timeline with Perfetto or chrome://tracing.
+
+// Tracing Function Declarations
+// Starts recording events, which TraceWrite() writes to _filename_.
+void TraceInit(const std::string &filename);
+void TraceWrite();
+
+// Returns the number of microseconds since TraceInit() was called.
+double TraceMicroseconds();
+
+// Records an event on the calling thread's track; _name_ and _category_ must
+// remain valid until the trace is written. _detail_ is shown with the event.
+void TraceRecord(const char *name, const char *category, double startMicroseconds,
+                 double endMicroseconds, std::string detail = {});
+// Records an event that ran on the given GPU, with times measured using
+// the same clock as TraceMicroseconds().
+void TraceRecordGPU(const char *name, int device, double startMicroseconds,
+                    double endMicroseconds);
+
+// Tracing Global Variable Declaration
+extern bool tracingEnabled;
+
+inline bool TracingEnabled() {
+    return tracingEnabled;
+}
+
+// TraceScope Definition
+// Records an event on the calling thread from the object's construction to
+// its destruction if tracing is enabled; otherwise it does nothing.
+class TraceScope {
+  public:
+    // TraceScope Public Methods
+    TraceScope(const char *name, const char *category) {
+        if (tracingEnabled) {
+            this->name = name;
+            this->category = category;
+            start = TraceMicroseconds();
+        }
+    }
+    ~TraceScope() {
+        if (name)
+            TraceRecord(name, category, start, TraceMicroseconds(), std::move(detail));
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    // Callers should check TracingEnabled() first if _detail_ is costly to
+    // compute.
+    void SetDetail(std::string d) {
+        if (name)
+            detail = std::move(d);
+    }
+
+  private:
+    // TraceScope Private Members
+    const char *name = nullptr, *category = nullptr;
+    double start = 0;
+    std::string detail;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_TRACE_H
@@ -0,0 +1,40 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/trace.h>
+
+#include <atomic>
+#include <string>
+
+using namespace pbrt;
+
+TEST(Trace, Write) {
+    std::string fn = "trace_test.json";
+    TraceInit(fn);
+    EXPECT_TRUE(TracingEnabled());
+    {
+        TraceScope trace("TestScope", "test");
+        trace.SetDetail("a \"quoted\" detail");
+    }
+    std::atomic<int64_t> sum{0};
+    ParallelFor(0, 10000, [&](int64_t i) { sum += i; });
+    EXPECT_EQ(10000 * 9999 / 2, sum.load());
+    TraceWrite();
+    EXPECT_FALSE(TracingEnabled());
+
+    std::string contents = ReadFileContents(fn);
+    EXPECT_EQ(0, contents.find("{\"displayTimeUnit\": \"ms\", \"traceEvents\": ["));
+    EXPECT_NE(std::string::npos, contents.find("{\"name\": \"TestScope\", \"cat\": "
+                                               "\"test\", \"ph\": \"X\""));
+    EXPECT_NE(std::string::npos,
+              contents.find("\"args\": {\"detail\": \"a \\\"quoted\\\" detail\"}"));
+    EXPECT_NE(std::string::npos, contents.find("\"name\": \"ParallelFor\""));
+    EXPECT_EQ(contents.size() - 3, contents.rfind("]}\n"));
+    EXPECT_EQ(0, remove(fn.c_str()));
+}
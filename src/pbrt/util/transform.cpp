@@ -371,6 +371,53 @@ std::string Transform::ToString() const {
     return StringPrintf("[ m: %s mInv: %s ]", m, mInv);
 }
 
+// AffineTransform Method Definitions
+AffineTransform::AffineTransform(const Transform &t) {
+    CHECK(IsAffine(t));
+    // The bottom rows of the matrix and its inverse are $(0, 0, 0, 1)$ and
+    // aren't stored
+    const SquareMatrix<4> &tm = t.GetMatrix(), &tmInv = t.GetInverseMatrix();
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j) {
+            m[i][j] = tm[i][j];
+            mInv[i][j] = tmInv[i][j];
+        }
+}
+
+bool AffineTransform::IsAffine(const Transform &t) {
+    const SquareMatrix<4> &m = t.GetMatrix();
+    return m[3][0] == 0 && m[3][1] == 0 && m[3][2] == 0 && m[3][3] == 1;
+}
+
+Transform AffineTransform::ToTransform() const {
+    SquareMatrix<4> tm, tmInv;
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j) {
+            tm[i][j] = m[i][j];
+            tmInv[i][j] = mInv[i][j];
+        }
+    return Transform(tm, tmInv);
+}
+
+Bounds3f AffineTransform::operator()(const Bounds3f &b) const {
+    Bounds3f bt;
+    for (int i = 0; i < 8; ++i)
+        bt = Union(bt, (*this)(b.Corner(i)));
+    return bt;
+}
+
+bool AffineTransform::operator==(const AffineTransform &t) const {
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j)
+            if (m[i][j] != t.m[i][j])
+                return false;
+    return true;
+}
+
+std::string AffineTransform::ToString() const {
+    return StringPrintf("[ AffineTransform %s ]", ToTransform());
+}
+
 // AnimatedTransform Method Definitions
 AnimatedTransform::AnimatedTransform(const Transform &startTransform, Float startTime,
                                      const Transform &endTransform, Float endTime)
@@ -12,6 +12,7 @@
 #include <pbrt/util/hash.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/simd.h>
 #include <pbrt/util/vecmath.h>
 
 #include <stdio.h>
@@ -441,6 +442,85 @@ inline RayDifferential Transform::ApplyInverse(const RayDifferential &r,
     return ret;
 }
 
+// AffineTransform Definition
+// _AffineTransform_ stores an affine transformation as the top three rows of its
+// matrix and of the matrix's inverse, which is 96 bytes rather than the 128 bytes
+// of a _Transform_ with 32-bit _Float_s. Points, vectors, and rays are
+// transformed using 4-wide SIMD operations on the matrices' columns.
+class AffineTransform {
+  public:
+    // AffineTransform Public Methods
+    AffineTransform() : AffineTransform(Transform()) {}
+    explicit AffineTransform(const Transform &t);
+
+    // Returns true if the bottom row of _t_'s matrix is $(0, 0, 0, 1)$
+    static bool IsAffine(const Transform &t);
+
+    Transform ToTransform() const;
+
+    Point3f operator()(Point3f p) const { return ApplyToPoint(m, p); }
+    Vector3f operator()(Vector3f v) const { return ApplyToVector(m, v); }
+    Point3f ApplyInverse(Point3f p) const { return ApplyToPoint(mInv, p); }
+    Vector3f ApplyInverse(Vector3f v) const { return ApplyToVector(mInv, v); }
+    inline Ray ApplyInverse(const Ray &r, Float *tMax = nullptr) const;
+
+    Bounds3f operator()(const Bounds3f &b) const;
+
+    bool operator==(const AffineTransform &t) const;
+    bool operator!=(const AffineTransform &t) const { return !(*this == t); }
+    uint64_t Hash() const { return HashBuffer<sizeof(m)>(&m); }
+
+    std::string ToString() const;
+
+  private:
+    // AffineTransform Private Methods
+    static Point3f ApplyToPoint(const Float m[3][4], Point3f p) {
+        SIMDFloat<4> c[4];
+        LoadColumns3x4(&m[0][0], c);
+        return Point3f(ToVector((c[0] * SIMDFloat<4>(p.x) + c[1] * SIMDFloat<4>(p.y)) +
+                                (c[2] * SIMDFloat<4>(p.z) + c[3])));
+    }
+    static Vector3f ApplyToVector(const Float m[3][4], Vector3f v) {
+        SIMDFloat<4> c[4];
+        LoadColumns3x4(&m[0][0], c);
+        return ToVector((c[0] * SIMDFloat<4>(v.x) + c[1] * SIMDFloat<4>(v.y)) +
+                        c[2] * SIMDFloat<4>(v.z));
+    }
+    static Vector3f ToVector(SIMDFloat<4> v) {
+        Float f[4];
+        v.Store(f);
+        return Vector3f(f[0], f[1], f[2]);
+    }
+
+    // AffineTransform Private Members
+    Float m[3][4], mInv[3][4];
+};
+
+// AffineTransform Inline Methods
+inline Ray AffineTransform::ApplyInverse(const Ray &r, Float *tMax) const {
+    // Transform ray origin and direction using the columns of _mInv_
+    SIMDFloat<4> c[4];
+    LoadColumns3x4(&mInv[0][0], c);
+    SIMDFloat<4> ox = c[0] * SIMDFloat<4>(r.o.x), oy = c[1] * SIMDFloat<4>(r.o.y);
+    SIMDFloat<4> oz = c[2] * SIMDFloat<4>(r.o.z);
+    SIMDFloat<4> o = (ox + oy) + (oz + c[3]);
+    SIMDFloat<4> d = (c[0] * SIMDFloat<4>(r.d.x) + c[1] * SIMDFloat<4>(r.d.y)) +
+                     c[2] * SIMDFloat<4>(r.d.z);
+
+    // Offset ray origin to edge of error bounds and compute _tMax_
+    // The bound on the origin's error is the one that _Transform_ computes for
+    // exact points; the fourth components of all of the values are zero.
+    Float lengthSquared = (d * d).ReduceSum();
+    if (lengthSquared > 0) {
+        SIMDFloat<4> oError = SIMDFloat<4>(gamma(3)) * ((Abs(ox) + Abs(oy)) + Abs(oz));
+        Float dt = (Abs(d) * oError).ReduceSum() / lengthSquared;
+        o = o + d * SIMDFloat<4>(dt);
+        if (tMax)
+            *tMax -= dt;
+    }
+    return Ray(Point3f(ToVector(o)), ToVector(d), r.time, r.medium);
+}
+
 // AnimatedTransform Definition
 class AnimatedTransform {
   public:
@@ -107,3 +107,36 @@ TEST(RotateFromTo, Randoms) {
         EXPECT_GT(Dot(to, toNew), .999f);
     }
 }
+
+TEST(AffineTransform, Randoms) {
+    RNG rng;
+    auto r = [&rng]() { return -10. + 20. * rng.Uniform<Float>(); };
+    auto expectNear = [](auto a, auto b) {
+        for (int c = 0; c < 3; ++c)
+            EXPECT_LE(std::abs(a[c] - b[c]), 1e-5f * std::max<Float>(1, std::abs(b[c])))
+                << a << " vs " << b;
+    };
+    for (int i = 0; i < 100; ++i) {
+        Transform t = RandomTransform(rng);
+        ASSERT_TRUE(AffineTransform::IsAffine(t));
+        AffineTransform at(t);
+        EXPECT_EQ(t, at.ToTransform());
+
+        Point3f p(r(), r(), r());
+        Vector3f v(r(), r(), r());
+        expectNear(at(p), t(p));
+        expectNear(at(v), t(v));
+        expectNear(at.ApplyInverse(p), t.ApplyInverse(p));
+        expectNear(at.ApplyInverse(v), t.ApplyInverse(v));
+
+        // Rays are offset by similar amounts to account for rounding error
+        Float tMax = 100, atMax = 100;
+        Ray ray = t.ApplyInverse(Ray(p, v), &tMax);
+        Ray aRay = at.ApplyInverse(Ray(p, v), &atMax);
+        expectNear(aRay.o, ray.o);
+        expectNear(aRay.d, ray.d);
+        EXPECT_LE(std::abs(tMax - atMax), 1e-5f * tMax);
+    }
+
+    EXPECT_FALSE(AffineTransform::IsAffine(Perspective(90, .1, 100)));
+}
@@ -39,10 +39,8 @@ void CPUAggregate::IntersectClosest(int maxRays, const RayQueue *rayQueue,
                                     MediumSampleQueue *mediumSampleQueue,
                                     RayQueue *nextRayQueue) const {
     // _CPUAggregate::IntersectClosest()_ method implementation
-    ParallelFor(0, rayQueue->Size(), [=](int index) {
-        const RayWorkItem r = (*rayQueue)[index];
-        // Intersect _r_'s ray with the scene and enqueue resulting work
-        pstd::optional<ShapeIntersection> si = aggregate.Intersect(r.ray);
+    auto enqueueWork = [=](const RayWorkItem &r,
+                           const pstd::optional<ShapeIntersection> &si) {
         if (!si)
             EnqueueWorkAfterMiss(r, mediumSampleQueue, escapedRayQueue);
         else
@@ -50,11 +48,62 @@ void CPUAggregate::IntersectClosest(int maxRays, const RayQueue *rayQueue,
             EnqueueWorkAfterIntersection(
                 r, r.ray.medium, si->tHit, si->intr, mediumSampleQueue, nextRayQueue,
                 hitAreaLightQueue, basicEvalMaterialQueue, universalEvalMaterialQueue);
+    };
+
+    if (const BVHAggregate *bvh = aggregate.CastOrNullptr<BVHAggregate>()) {
+        // Trace consecutive queue entries together as ray streams
+        constexpr int batchSize = BVHAggregate::MaxStreamRays;
+        int nBatches = (rayQueue->Size() + batchSize - 1) / batchSize;
+        ParallelFor(0, nBatches, [=](int batch) {
+            int start = batch * batchSize;
+            int n = std::min(batchSize, rayQueue->Size() - start);
+            Ray rays[batchSize];
+            Float tMax[batchSize];
+            for (int i = 0; i < n; ++i) {
+                rays[i] = rayQueue->ray[start + i];
+                tMax[i] = Infinity;
+            }
+            pstd::optional<ShapeIntersection> si[batchSize];
+            bvh->IntersectStream(pstd::MakeConstSpan(rays, n), pstd::MakeConstSpan(tMax, n),
+                                 pstd::MakeSpan(si, n));
+            for (int i = 0; i < n; ++i)
+                enqueueWork((*rayQueue)[start + i], si[i]);
+        });
+        return;
+    }
+
+    ParallelFor(0, rayQueue->Size(), [=](int index) {
+        const RayWorkItem r = (*rayQueue)[index];
+        // Intersect _r_'s ray with the scene and enqueue resulting work
+        enqueueWork(r, aggregate.Intersect(r.ray));
     });
 }
 
 void CPUAggregate::IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue,
                                    SOA<PixelSampleState> *pixelSampleState) const {
+    if (const BVHAggregate *bvh = aggregate.CastOrNullptr<BVHAggregate>()) {
+        // Trace consecutive shadow rays together as ray streams
+        constexpr int batchSize = BVHAggregate::MaxStreamRays;
+        int nBatches = (shadowRayQueue->Size() + batchSize - 1) / batchSize;
+        ParallelFor(0, nBatches, [=](int batch) {
+            int start = batch * batchSize;
+            int n = std::min(batchSize, shadowRayQueue->Size() - start);
+            Ray rays[batchSize];
+            Float tMax[batchSize];
+            for (int i = 0; i < n; ++i) {
+                rays[i] = shadowRayQueue->ray[start + i];
+                tMax[i] = shadowRayQueue->tMax[start + i];
+            }
+            bool hit[batchSize];
+            bvh->IntersectPStream(pstd::MakeConstSpan(rays, n),
+                                  pstd::MakeConstSpan(tMax, n), pstd::MakeSpan(hit, n));
+            for (int i = 0; i < n; ++i)
+                RecordShadowRayIntersection((*shadowRayQueue)[start + i],
+                                            pixelSampleState, hit[i]);
+        });
+        return;
+    }
+
     // Intersect shadow rays from _shadowRayQueue_ in parallel
     ParallelFor(0, shadowRayQueue->Size(), [=](int index) {
         const ShadowRayWorkItem w = (*shadowRayQueue)[index];
@@ -64,12 +113,13 @@ void CPUAggregate::IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue,
 }
 
 void CPUAggregate::IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
-                                     SOA<PixelSampleState> *pixelSampleState) const {
+                                     SOA<PixelSampleState> *pixelSampleState,
+                                     bool residualTracking) const {
     ParallelFor(0, shadowRayQueue->Size(), [=](int index) {
         const ShadowRayWorkItem w = (*shadowRayQueue)[index];
         pstd::optional<ShapeIntersection> si;
         TraceTransmittance(
-            w, pixelSampleState,
+            w, pixelSampleState, residualTracking,
             [&](Ray ray, Float tMax) -> TransmittanceTraceResult {
                 si = aggregate.Intersect(ray, tMax);
 
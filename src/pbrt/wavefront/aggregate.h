@@ -42,7 +42,8 @@ class CPUAggregate : public WavefrontAggregate {
                          SOA<PixelSampleState> *pixelSampleState) const;
 
     void IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
-                           SOA<PixelSampleState> *pixelSampleState) const;
+                           SOA<PixelSampleState> *pixelSampleState,
+                           bool residualTracking) const;
 
     void IntersectOneRandom(int maxRays, SubsurfaceScatterQueue *subsurfaceScatterQueue) const;
 
@@ -8,6 +8,7 @@
 #include <pbrt/options.h>
 #include <pbrt/samplers.h>
 #include <pbrt/util/bluenoise.h>
+#include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 #include <pbrt/wavefront/integrator.h>
@@ -15,63 +16,151 @@
 namespace pbrt {
 
 // WavefrontPathIntegrator Camera Ray Methods
-void WavefrontPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
+void WavefrontPathIntegrator::GenerateCameraRays(int y0, int y1, int sampleIndex) {
     // Define _generateRays_ lambda function
     auto generateRays = [=](auto sampler) {
         using ConcreteSampler = std::remove_reference_t<decltype(*sampler)>;
         if constexpr (!std::is_same_v<ConcreteSampler, MLTSampler> &&
                       !std::is_same_v<ConcreteSampler, DebugMLTSampler>)
-            GenerateCameraRays<ConcreteSampler>(y0, sampleIndex);
+            GenerateCameraRays<ConcreteSampler>(y0, y1, sampleIndex);
     };
 
     sampler.DispatchCPU(generateRays);
 }
 
 template <typename ConcreteSampler>
-void WavefrontPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
+PBRT_CPU_GPU bool WavefrontPathIntegrator::GenerateCameraRay(int pixelIndex,
+                                                             Point2i pPixel,
+                                                             int sampleIndex, Ray *ray,
+                                                             SampledWavelengths *lambda) {
+    // Initialize _Sampler_ for current pixel and sample
+    ConcreteSampler pixelSampler = *sampler.Cast<ConcreteSampler>();
+    pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
+
+    // Sample wavelengths for ray path
+    Float lu = pixelSampler.Get1D();
+    if (GetOptions().disableWavelengthJitter)
+        lu = 0.5f;
+    else if (sppm)
+        // The visible points and photons of an SPPM iteration share wavelengths
+        lu = RadicalInverse(1, sampleIndex);
+    *lambda = film.SampleWavelengths(lu);
+
+    // Generate _CameraSample_ and corresponding ray
+    CameraSample cameraSample = GetCameraSample(pixelSampler, pPixel, filter);
+    pstd::optional<CameraRay> cameraRay = camera.GenerateRay(cameraSample, *lambda);
+
+    // Initialize remainder of _PixelSampleState_ for ray
+    pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
+    pixelSampleState.lambda[pixelIndex] = *lambda;
+    pixelSampleState.filterWeight[pixelIndex] = cameraSample.filterWeight;
+    pixelSampleState.sampleIndex[pixelIndex] = sampleIndex;
+    if (initializeVisibleSurface)
+        pixelSampleState.visibleSurface[pixelIndex] = VisibleSurface();
+
+    // Return camera ray for intersection tests
+    if (cameraRay) {
+        *ray = cameraRay->ray;
+        pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay->weight;
+        return true;
+    }
+    pixelSampleState.cameraRayWeight[pixelIndex] = SampledSpectrum(0);
+    return false;
+}
+
+template <typename F>
+void WavefrontPathIntegrator::PushCameraRays(const char *description,
+                                             RayQueue *rayQueue, F generate) {
+    // Call _generate_ for all pixel indices and enqueue the camera rays it returns
+    if (useGPU) {
+        ParallelFor(
+            description, maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+                Ray ray;
+                SampledWavelengths lambda;
+                if (generate(pixelIndex, &ray, &lambda))
+                    rayQueue->PushCameraRay(ray, lambda, pixelIndex);
+            });
+        return;
+    }
+
+    // Generate camera rays for a batch of pixels on the CPU before allocating
+    // their queue entries with a single atomic operation
+    ParallelForLanes(maxQueueSize, [&](int start, int end) {
+        Ray rays[CPULaneCount];
+        SampledWavelengths lambdas[CPULaneCount];
+        int pixelIndices[CPULaneCount];
+        int nRays = 0;
+        for (int pixelIndex = start; pixelIndex < end; ++pixelIndex)
+            if (generate(pixelIndex, &rays[nRays], &lambdas[nRays]))
+                pixelIndices[nRays++] = pixelIndex;
+
+        if (nRays == 0)
+            return;
+        int index = rayQueue->AllocateEntries(nRays);
+        for (int i = 0; i < nRays; ++i)
+            rayQueue->SetCameraRay(index + i, rays[i], lambdas[i], pixelIndices[i]);
+    });
+}
+
+template <typename ConcreteSampler>
+void WavefrontPathIntegrator::GenerateCameraRays(int y0, int y1, int sampleIndex) {
     RayQueue *rayQueue = CurrentRayQueue(0);
-    ParallelFor(
-        "Generate Camera rays", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
-            // Enqueue camera ray and set pixel state for sample
+    PushCameraRays(
+        "Generate Camera rays", rayQueue,
+        PBRT_CPU_GPU_LAMBDA(int pixelIndex, Ray *ray, SampledWavelengths *lambda) {
+            // Set pixel state for sample and generate its camera ray
             // Compute pixel coordinates for _pixelIndex_
             Bounds2i pixelBounds = film.PixelBounds();
             int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
             Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
                            y0 + pixelIndex / xResolution);
+            // Pixels in rows at or past _y1_ are recorded as being outside the
+            // film so that the film and display updates skip them
+            if (pPixel.y >= y1)
+                pPixel.y = pixelBounds.pMax.y;
             pixelSampleState.pPixel[pixelIndex] = pPixel;
+            pixelSampleState.pathActive[pixelIndex] = 0;
 
             // Test pixel coordinates against pixel bounds
             if (!InsideExclusive(pPixel, pixelBounds))
-                return;
-
-            // Initialize _Sampler_ for current pixel and sample
-            ConcreteSampler pixelSampler = *sampler.Cast<ConcreteSampler>();
-            pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
-
-            // Sample wavelengths for ray path
-            Float lu = pixelSampler.Get1D();
-            if (GetOptions().disableWavelengthJitter)
-                lu = 0.5f;
-            SampledWavelengths lambda = film.SampleWavelengths(lu);
-
-            // Generate _CameraSample_ and corresponding ray
-            CameraSample cameraSample = GetCameraSample(pixelSampler, pPixel, filter);
-            pstd::optional<CameraRay> cameraRay =
-                camera.GenerateRay(cameraSample, lambda);
-
-            // Initialize remainder of _PixelSampleState_ for ray
-            pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
-            pixelSampleState.lambda[pixelIndex] = lambda;
-            pixelSampleState.filterWeight[pixelIndex] = cameraSample.filterWeight;
-            if (initializeVisibleSurface)
-                pixelSampleState.visibleSurface[pixelIndex] = VisibleSurface();
-
-            // Enqueue camera ray for intersection tests
-            if (cameraRay) {
-                rayQueue->PushCameraRay(cameraRay->ray, lambda, pixelIndex);
-                pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay->weight;
-            } else
-                pixelSampleState.cameraRayWeight[pixelIndex] = SampledSpectrum(0);
+                return false;
+
+            return GenerateCameraRay<ConcreteSampler>(pixelIndex, pPixel, sampleIndex,
+                                                      ray, lambda);
+        });
+}
+
+void WavefrontPathIntegrator::RegenerateCameraRays(int wavefrontDepth, int sampleEnd) {
+    auto regenerateRays = [=](auto sampler) {
+        using ConcreteSampler = std::remove_reference_t<decltype(*sampler)>;
+        if constexpr (!std::is_same_v<ConcreteSampler, MLTSampler> &&
+                      !std::is_same_v<ConcreteSampler, DebugMLTSampler>)
+            RegenerateCameraRays<ConcreteSampler>(wavefrontDepth, sampleEnd);
+    };
+
+    sampler.DispatchCPU(regenerateRays);
+}
+
+template <typename ConcreteSampler>
+void WavefrontPathIntegrator::RegenerateCameraRays(int wavefrontDepth, int sampleEnd) {
+    // Start the next sample of pixels whose paths have terminated, adding their
+    // camera rays to the queue for the next depth
+    RayQueue *rayQueue = NextRayQueue(wavefrontDepth);
+    PushCameraRays(
+        "Regenerate camera rays", rayQueue,
+        PBRT_CPU_GPU_LAMBDA(int pixelIndex, Ray *ray, SampledWavelengths *lambda) {
+            Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+            if (!InsideExclusive(pPixel, film.PixelBounds()))
+                return false;
+
+            bool pathActive = pixelSampleState.pathActive[pixelIndex];
+            pixelSampleState.pathActive[pixelIndex] = 0;
+            int sampleIndex = pixelSampleState.sampleIndex[pixelIndex];
+            if (pathActive || sampleIndex >= sampleEnd)
+                return false;
+
+            return GenerateCameraRay<ConcreteSampler>(pixelIndex, pPixel, sampleIndex,
+                                                      ray, lambda);
         });
 }
 
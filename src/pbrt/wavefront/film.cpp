@@ -10,7 +10,45 @@
 namespace pbrt {
 
 // WavefrontPathIntegrator Film Methods
+template <typename ConcreteFilm>
+PBRT_CPU_GPU void WavefrontPathIntegrator::AddPixelSample(ConcreteFilm *film,
+                                                          int pixelIndex) {
+    // Compute final weighted radiance value
+    Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+    SampledSpectrum Lw = SampledSpectrum(pixelSampleState.L[pixelIndex]) *
+                         pixelSampleState.cameraRayWeight[pixelIndex];
+
+    PBRT_DBG("Adding Lw %f %f %f %f at pixel (%d, %d)", Lw[0], Lw[1], Lw[2], Lw[3],
+             pPixel.x, pPixel.y);
+    // Provide sample radiance value to film
+    SampledWavelengths lambda = pixelSampleState.lambda[pixelIndex];
+    Float filterWeight = pixelSampleState.filterWeight[pixelIndex];
+    if (initializeVisibleSurface) {
+        // Call _Film::AddSample()_ with _VisibleSurface_ for pixel sample
+        VisibleSurface visibleSurface = pixelSampleState.visibleSurface[pixelIndex];
+        film->AddSample(pPixel, Lw, lambda, &visibleSurface, filterWeight);
+
+    } else
+        film->AddSample(pPixel, Lw, lambda, nullptr, filterWeight);
+}
+
 void WavefrontPathIntegrator::UpdateFilm() {
+    if (!useGPU) {
+        // Dispatch on the film's type once for each batch of pixels on the CPU
+        ParallelForLanes(maxQueueSize, [&](int start, int end) {
+            auto addSamples = [&](auto concreteFilm) {
+                Bounds2i pixelBounds = concreteFilm->PixelBounds();
+                for (int pixelIndex = start; pixelIndex < end; ++pixelIndex) {
+                    Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+                    if (InsideExclusive(pPixel, pixelBounds))
+                        AddPixelSample(concreteFilm, pixelIndex);
+                }
+            };
+            film.DispatchCPU(addSamples);
+        });
+        return;
+    }
+
     ParallelFor(
         "Update Film", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
             // Check pixel against film bounds
@@ -18,23 +56,25 @@ void WavefrontPathIntegrator::UpdateFilm() {
             if (!InsideExclusive(pPixel, film.PixelBounds()))
                 return;
 
-            // Compute final weighted radiance value
-            SampledSpectrum Lw = SampledSpectrum(pixelSampleState.L[pixelIndex]) *
-                                 pixelSampleState.cameraRayWeight[pixelIndex];
-
-            PBRT_DBG("Adding Lw %f %f %f %f at pixel (%d, %d)", Lw[0], Lw[1], Lw[2],
-                     Lw[3], pPixel.x, pPixel.y);
-            // Provide sample radiance value to film
-            SampledWavelengths lambda = pixelSampleState.lambda[pixelIndex];
-            Float filterWeight = pixelSampleState.filterWeight[pixelIndex];
-            if (initializeVisibleSurface) {
-                // Call _Film::AddSample()_ with _VisibleSurface_ for pixel sample
-                VisibleSurface visibleSurface =
-                    pixelSampleState.visibleSurface[pixelIndex];
-                film.AddSample(pPixel, Lw, lambda, &visibleSurface, filterWeight);
-
-            } else
-                film.AddSample(pPixel, Lw, lambda, nullptr, filterWeight);
+            AddPixelSample(&film, pixelIndex);
+        });
+}
+
+void WavefrontPathIntegrator::UpdateFilmForTerminatedPaths(int sampleEnd) {
+    ParallelFor(
+        "Update Film for terminated paths", maxQueueSize,
+        PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            // Add samples of the pixels whose paths didn't continue to the next
+            // depth and advance them to their next sample
+            Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+            if (!InsideExclusive(pPixel, film.PixelBounds()) ||
+                pixelSampleState.pathActive[pixelIndex] ||
+                pixelSampleState.sampleIndex[pixelIndex] >= sampleEnd)
+                return;
+
+            AddPixelSample(&film, pixelIndex);
+            pixelSampleState.sampleIndex[pixelIndex] =
+                pixelSampleState.sampleIndex[pixelIndex] + 1;
         });
 }
 
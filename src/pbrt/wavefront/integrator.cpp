@@ -14,6 +14,7 @@
 #endif  // PBRT_BUILD_GPU_RENDERER
 #include <pbrt/lights.h>
 #include <pbrt/lightsamplers.h>
+#include <pbrt/textures.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/display.h>
@@ -29,12 +30,16 @@
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/wavefront/aggregate.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <numeric>
+#include <set>
 
 #ifdef PBRT_BUILD_GPU_RENDERER
+#include <cub/cub.cuh>
 #include <cuda.h>
 #include <cuda_runtime.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
@@ -42,6 +47,12 @@
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Wavefront integrator pixel state", pathIntegratorBytes);
+STAT_MEMORY_COUNTER("Memory/Wavefront queues: pixel sample state", pixelStateQueueBytes);
+STAT_MEMORY_COUNTER("Memory/Wavefront queues: rays", rayQueueBytes);
+STAT_MEMORY_COUNTER("Memory/Wavefront queues: surface hits", surfaceQueueBytes);
+STAT_MEMORY_COUNTER("Memory/Wavefront queues: subsurface", subsurfaceQueueBytes);
+STAT_MEMORY_COUNTER("Memory/Wavefront queues: media", mediumQueueBytes);
+STAT_MEMORY_COUNTER("Memory/Wavefront queues: sorting", sortQueueBytes);
 
 static void updateMaterialNeeds(
     Material m, pstd::array<bool, Material::NumTags()> *haveBasicEvalMaterial,
@@ -74,9 +85,128 @@ static void updateMaterialNeeds(
     else
         (*haveUniversalEvalMaterial)[m.Tag()] = true;
 }
-WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &scene) {
+// CheckMaterialKernelsCallback Definition
+// Issues an error if the scene has materials whose evaluation kernels weren't
+// compiled, given the PBRT_WAVEFRONT_MATERIALS and
+// PBRT_WAVEFRONT_BASIC_TEXTURES_ONLY build options
+struct CheckMaterialKernelsCallback {
+    const pstd::array<bool, Material::NumTags()> &haveBasicEvalMaterial;
+    const pstd::array<bool, Material::NumTags()> &haveUniversalEvalMaterial;
+
+    template <typename ConcreteMaterial>
+    void operator()() {
+        [[maybe_unused]] int index = Material::TypeIndex<ConcreteMaterial>();
+        if constexpr (!WavefrontMaterialCompiled<ConcreteMaterial>())
+            if (haveBasicEvalMaterial[index] || haveUniversalEvalMaterial[index])
+                ErrorExit("Scene uses %s, but this build of pbrt only has wavefront "
+                          "kernels for the materials in PBRT_WAVEFRONT_MATERIALS. Add "
+                          "it to that list and rebuild.",
+                          ConcreteMaterial::Name());
+#ifdef PBRT_WAVEFRONT_BASIC_TEXTURES_ONLY
+        if (haveUniversalEvalMaterial[index])
+            ErrorExit("Scene has a %s with textures that the BasicTextureEvaluator "
+                      "can't evaluate, but this build of pbrt was configured with "
+                      "PBRT_WAVEFRONT_BASIC_TEXTURES_ONLY.",
+                      ConcreteMaterial::Name());
+#endif
+    }
+};
+
+// GPUMemoryEstimate Definition
+// Records the GPU memory used by each part of the scene as the integrator
+// creates it, so that the queues can be sized to fit alongside it. Managed
+// allocations come from the integrator's tracked memory resource; device
+// allocations such as texture arrays and acceleration structures are found from
+// the drop in the GPU's free memory.
+class GPUMemoryEstimate {
+  public:
+    GPUMemoryEstimate(Allocator alloc, bool useGPU) {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (useGPU)
+            mr = dynamic_cast<CUDATrackedMemoryResource *>(alloc.resource());
+#endif  // PBRT_BUILD_GPU_RENDERER
+    }
+
+    void Begin() {
+        managedStart = managedBytes();
+        freeStart = freeBytes();
+    }
+    void End(const char *category) {
+        if (!mr)
+            return;
+        size_t freeEnd = freeBytes();
+        categories.push_back(Category{category, managedBytes() - managedStart,
+                                      freeStart > freeEnd ? freeStart - freeEnd : 0});
+    }
+
+    size_t ManagedBytes() const {
+        size_t bytes = 0;
+        for (const Category &c : categories)
+            bytes += c.managedBytes;
+        return bytes;
+    }
+
+    std::string Breakdown(size_t queueBytes) const {
+        std::string str;
+        auto mib = [](size_t bytes) { return bytes / (1024. * 1024.); };
+        for (const Category &c : categories)
+            str += StringPrintf("\n    %-40s %10.2f MiB managed %10.2f MiB device",
+                                c.name, mib(c.managedBytes), mib(c.deviceBytes));
+        str += StringPrintf("\n    %-40s %10.2f MiB managed", "wavefront queues",
+                            mib(queueBytes));
+        return str;
+    }
+
+  private:
+    struct Category {
+        const char *name;
+        size_t managedBytes, deviceBytes;
+    };
+
+    size_t managedBytes() const {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (mr)
+            return mr->BytesAllocated();
+#endif  // PBRT_BUILD_GPU_RENDERER
+        return 0;
+    }
+    size_t freeBytes() const {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (mr) {
+            size_t bytesFree, bytesTotal;
+            CUDA_CHECK(cudaMemGetInfo(&bytesFree, &bytesTotal));
+            return bytesFree;
+        }
+#endif  // PBRT_BUILD_GPU_RENDERER
+        return 0;
+    }
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    CUDATrackedMemoryResource *mr = nullptr;
+#else
+    void *mr = nullptr;
+#endif  // PBRT_BUILD_GPU_RENDERER
+    size_t managedStart = 0, freeStart = 0;
+    std::vector<Category> categories;
+};
+
+WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &scene,
+                                                 bool useGPU, Film sharedFilm)
+    : useGPU(useGPU), alloc(alloc) {
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU)
+        CUDA_CHECK(cudaGetDevice(&gpuDevice));
+#endif  // PBRT_BUILD_GPU_RENDERER
+
+    // The phases below are nested within this one, which also includes
+    // allocating the queues in GPU memory
+    StatsPhase phase("WavefrontPathIntegrator");
+    GPUMemoryEstimate memoryEstimate(alloc, useGPU);
+
     // Allocate all of the data structures that represent the scene...
+    memoryEstimate.Begin();
     std::map<std::string, Medium> media = scene.CreateMedia(alloc);
+    memoryEstimate.End("media");
 
     haveMedia = false;
     // Check the shapes...
@@ -98,6 +228,7 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
         return iter->second;
     };
 
+    memoryEstimate.Begin();
     filter = Filter::Create(scene.filter.name, scene.filter.parameters, &scene.filter.loc,
                             alloc);
 
@@ -108,8 +239,11 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
                   "The specified camera shutter times imply that the shutter "
                   "does not open.  A black image will result.");
 
-    film = Film::Create(scene.film.name, scene.film.parameters, exposureTime, filter,
-                        &scene.film.loc, alloc);
+    if (sharedFilm)
+        film = sharedFilm;
+    else
+        film = Film::Create(scene.film.name, scene.film.parameters, exposureTime, filter,
+                            &scene.film.loc, alloc);
     initializeVisibleSurface = film.UsesVisibleSurface();
 
     sampler = Sampler::Create(scene.sampler.name, scene.sampler.parameters,
@@ -119,105 +253,142 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
     Medium cameraMedium = findMedium(scene.camera.medium, &scene.camera.loc);
     camera = Camera::Create(scene.camera.name, scene.camera.parameters, cameraMedium,
                             scene.camera.cameraTransform, film, &scene.camera.loc, alloc);
+    memoryEstimate.End("film, sampler, and camera");
+    if (!scene.views.empty())
+        Warning(&scene.views[0].camera.loc,
+                "Only the first camera's view is rendered with --gpu or --wavefront.");
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    // The textures, lights, shapes, and materials are only read while
+    // rendering; read-mostly pages can be duplicated where they are used and
+    // are dropped rather than written back if GPU memory is oversubscribed
+    CUDATrackedMemoryResource *sceneResource = nullptr;
+    if (useGPU) {
+        int hasConcurrentManagedAccess;
+        CUDA_CHECK(cudaDeviceGetAttribute(&hasConcurrentManagedAccess,
+                                          cudaDevAttrConcurrentManagedAccess, gpuDevice));
+        if (hasConcurrentManagedAccess)
+            sceneResource = dynamic_cast<CUDATrackedMemoryResource *>(alloc.resource());
+        if (sceneResource)
+            sceneResource->SetReadMostlyAllocations(true);
+    }
+#endif  // PBRT_BUILD_GPU_RENDERER
 
     // Textures
     LOG_VERBOSE("Starting to create textures");
-    NamedTextures textures = scene.CreateTextures(alloc, Options->useGPU);
+    NamedTextures textures;
+    {
+        StatsPhase phase("CreateTextures");
+        memoryEstimate.Begin();
+        textures = scene.CreateTextures(alloc, useGPU);
+        memoryEstimate.End("textures");
+    }
     LOG_VERBOSE("Done creating textures");
 
     pstd::vector<Light> allLights;
 
-    infiniteLights = alloc.new_object<pstd::vector<Light>>(alloc);
-    for (const auto &light : scene.lights) {
-        Medium outsideMedium = findMedium(light.medium, &light.loc);
-        if (light.renderFromObject.IsAnimated())
-            Warning(&light.loc,
-                    "Animated lights aren't supported. Using the start transform.");
-
-        Light l = Light::Create(
-            light.name, light.parameters, light.renderFromObject.startTransform,
-            scene.camera.cameraTransform, outsideMedium, &light.loc, alloc);
-
-        if (l.Is<UniformInfiniteLight>() || l.Is<ImageInfiniteLight>() ||
-            l.Is<PortalImageInfiniteLight>())
-            infiniteLights->push_back(l);
+    std::map<int, pstd::vector<Light> *> shapeIndexToAreaLights;
+    {
+        StatsPhase phase("CreateLights");
+        memoryEstimate.Begin();
+        infiniteLights = alloc.new_object<pstd::vector<Light>>(alloc);
+        for (const auto &light : scene.lights) {
+            Medium outsideMedium = findMedium(light.medium, &light.loc);
+            if (light.renderFromObject.IsAnimated())
+                Warning(&light.loc,
+                        "Animated lights aren't supported. Using the start transform.");
+
+            Light l = Light::Create(
+                light.name, light.parameters, light.renderFromObject.startTransform,
+                scene.camera.cameraTransform, outsideMedium, &light.loc, alloc);
+
+            if (l.Is<UniformInfiniteLight>() || l.Is<ImageInfiniteLight>() ||
+                l.Is<PortalImageInfiniteLight>())
+                infiniteLights->push_back(l);
+
+            allLights.push_back(l);
+        }
 
-        allLights.push_back(l);
-    }
+        // Area lights...
+        for (size_t i = 0; i < scene.shapes.size(); ++i) {
+            const auto &shape = scene.shapes[i];
+            if (shape.lightIndex == -1)
+                continue;
+
+            auto isInterface = [&]() {
+                std::string materialName;
+                if (shape.materialIndex != -1)
+                    materialName = scene.materials[shape.materialIndex].name;
+                else {
+                    for (auto iter = scene.namedMaterials.begin();
+                         iter != scene.namedMaterials.end(); ++iter)
+                        if (iter->first == shape.materialName) {
+                            materialName =
+                                iter->second.parameters.GetOneString("type", "");
+                            break;
+                        }
+                }
+                return (materialName == "interface" || materialName == "none" ||
+                        materialName.empty());
+            };
+            if (isInterface())
+                continue;
+
+            CHECK_LT(shape.lightIndex, scene.areaLights.size());
+            const auto &areaLightEntity = scene.areaLights[shape.lightIndex];
+            AnimatedTransform renderFromLight(*shape.renderFromObject);
+
+            pstd::vector<Shape> shapes = Shape::Create(
+                shape.name, shape.renderFromObject, shape.objectFromRender,
+                shape.reverseOrientation, shape.parameters, &shape.loc, alloc);
+
+            if (shapes.empty())
+                continue;
+
+            Medium outsideMedium = findMedium(shape.outsideMedium, &shape.loc);
+
+            FloatTexture alphaTex;
+            std::string alphaTexName = shape.parameters.GetTexture("alpha");
+            if (!alphaTexName.empty()) {
+                if (textures.floatTextures.find(alphaTexName) !=
+                    textures.floatTextures.end()) {
+                    alphaTex = textures.floatTextures[alphaTexName];
+                    if (!BasicTextureEvaluator().CanEvaluate({alphaTex}, {}))
+                        // A warning will be issued elsewhere...
+                        alphaTex = nullptr;
+                } else
+                    ErrorExit(&shape.loc,
+                              "%s: couldn't find float texture for \"alpha\" parameter.",
+                              alphaTexName);
+            } else if (Float alpha = shape.parameters.GetOneFloat("alpha", 1.f);
+                       alpha < 1.f)
+                alphaTex = alloc.new_object<FloatConstantTexture>(alpha);
 
-    // Area lights...
-    std::map<int, pstd::vector<Light> *> shapeIndexToAreaLights;
-    for (size_t i = 0; i < scene.shapes.size(); ++i) {
-        const auto &shape = scene.shapes[i];
-        if (shape.lightIndex == -1)
-            continue;
-
-        auto isInterface = [&]() {
-            std::string materialName;
-            if (shape.materialIndex != -1)
-                materialName = scene.materials[shape.materialIndex].name;
-            else {
-                for (auto iter = scene.namedMaterials.begin();
-                     iter != scene.namedMaterials.end(); ++iter)
-                    if (iter->first == shape.materialName) {
-                        materialName = iter->second.parameters.GetOneString("type", "");
-                        break;
-                    }
-            }
-            return (materialName == "interface" || materialName == "none" ||
-                    materialName.empty());
-        };
-        if (isInterface())
-            continue;
-
-        CHECK_LT(shape.lightIndex, scene.areaLights.size());
-        const auto &areaLightEntity = scene.areaLights[shape.lightIndex];
-        AnimatedTransform renderFromLight(*shape.renderFromObject);
-
-        pstd::vector<Shape> shapes =
-            Shape::Create(shape.name, shape.renderFromObject, shape.objectFromRender,
-                          shape.reverseOrientation, shape.parameters, &shape.loc, alloc);
-
-        if (shapes.empty())
-            continue;
-
-        Medium outsideMedium = findMedium(shape.outsideMedium, &shape.loc);
-
-        FloatTexture alphaTex;
-        std::string alphaTexName = shape.parameters.GetTexture("alpha");
-        if (!alphaTexName.empty()) {
-            if (textures.floatTextures.find(alphaTexName) !=
-                textures.floatTextures.end()) {
-                alphaTex = textures.floatTextures[alphaTexName];
-                if (!BasicTextureEvaluator().CanEvaluate({alphaTex}, {}))
-                    // A warning will be issued elsewhere...
-                    alphaTex = nullptr;
-            } else
-                ErrorExit(&shape.loc,
-                          "%s: couldn't find float texture for \"alpha\" parameter.",
-                          alphaTexName);
-        } else if (Float alpha = shape.parameters.GetOneFloat("alpha", 1.f); alpha < 1.f)
-            alphaTex = alloc.new_object<FloatConstantTexture>(alpha);
-
-        pstd::vector<Light> *lightsForShape =
-            alloc.new_object<pstd::vector<Light>>(alloc);
-        for (Shape sh : shapes) {
             if (renderFromLight.IsAnimated())
                 ErrorExit(&shape.loc, "Animated lights are not supported.");
-            DiffuseAreaLight *area = DiffuseAreaLight::Create(
-                renderFromLight.startTransform, outsideMedium, areaLightEntity.parameters,
-                areaLightEntity.parameters.ColorSpace(), &areaLightEntity.loc, alloc, sh,
-                alphaTex);
-            allLights.push_back(area);
-            lightsForShape->push_back(area);
+            pstd::vector<Light> *lightsForShape =
+                alloc.new_object<pstd::vector<Light>>(alloc);
+            for (Light area : Light::CreateAreaLights(
+                     areaLightEntity.name, areaLightEntity.parameters,
+                     renderFromLight.startTransform, MediumInterface(outsideMedium),
+                     shapes, alphaTex, &areaLightEntity.loc, alloc)) {
+                allLights.push_back(area);
+                lightsForShape->push_back(area);
+            }
+            shapeIndexToAreaLights[i] = lightsForShape;
         }
-        shapeIndexToAreaLights[i] = lightsForShape;
+        memoryEstimate.End("lights");
     }
 
     LOG_VERBOSE("Starting to create materials");
     std::map<std::string, pbrt::Material> namedMaterials;
     std::vector<pbrt::Material> materials;
-    scene.CreateMaterials(textures, alloc, &namedMaterials, &materials);
+    {
+        StatsPhase phase("CreateMaterials");
+        memoryEstimate.Begin();
+        scene.CreateMaterials(textures, alloc, &namedMaterials, &materials);
+        memoryEstimate.End("materials");
+    }
 
     haveBasicEvalMaterial.fill(false);
     haveUniversalEvalMaterial.fill(false);
@@ -228,18 +399,39 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
     for (const auto &m : namedMaterials)
         updateMaterialNeeds(m.second, &haveBasicEvalMaterial, &haveUniversalEvalMaterial,
                             &haveSubsurface);
+    ForEachType(CheckMaterialKernelsCallback{haveBasicEvalMaterial,
+                                             haveUniversalEvalMaterial},
+                Material::Types());
+    // Report the scene's materials, which are what a build specialized to
+    // this scene would list
+    std::set<std::string> sceneMaterials;
+    for (const SceneEntity &mtl : scene.materials)
+        sceneMaterials.insert(mtl.name);
+    for (const auto &namedMtl : scene.namedMaterials)
+        sceneMaterials.insert(namedMtl.second.name);
+    for (const char *name : {"", "none", "interface", "mix"})
+        sceneMaterials.erase(name);
+    std::string materialList;
+    for (const std::string &name : sceneMaterials)
+        materialList += (materialList.empty() ? "" : ";") + name;
+    LOG_VERBOSE("Scene's materials for PBRT_WAVEFRONT_MATERIALS: \"%s\"", materialList);
     LOG_VERBOSE("Finished creating materials");
 
-    if (Options->useGPU) {
+    if (useGPU) {
 #ifdef PBRT_BUILD_GPU_RENDERER
+        StatsPhase phase("CreateAggregate (OptiX)");
+        memoryEstimate.Begin();
         aggregate = new OptiXAggregate(scene, alloc, textures, shapeIndexToAreaLights,
                                        media, namedMaterials, materials);
+        memoryEstimate.End("shapes and acceleration structures");
 #else
-        LOG_FATAL("Options->useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
+        LOG_FATAL("useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
 #endif
-    } else
+    } else {
+        StatsPhase phase("CreateAggregate");
         aggregate = new CPUAggregate(scene, alloc, textures, shapeIndexToAreaLights,
                                      media, namedMaterials, materials);
+    }
 
     // Preprocess the light sources
     for (Light light : allLights)
@@ -251,13 +443,54 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
     if (!haveLights)
         ErrorExit("No light sources specified");
 
-    std::string lightSamplerName =
-        scene.integrator.parameters.GetOneString("lightsampler", "bvh");
+    // The "lightpath" integrator follows paths from the lights and splats the
+    // contributions of their vertices' connections to the camera into the film
+    lightTracing = scene.integrator.name == "lightpath";
+    if (lightTracing && (haveMedia || haveSubsurface)) {
+        Warning(&scene.integrator.loc,
+                "The wavefront \"lightpath\" integrator doesn't support participating "
+                "media or subsurface scattering. Using a \"volpath\" integrator.");
+        lightTracing = false;
+    }
+    if (lightTracing && !camera.Is<PerspectiveCamera>())
+        ErrorExit(&scene.camera.loc, "The wavefront \"lightpath\" integrator only "
+                                     "supports the \"perspective\" camera.");
+    if (lightTracing)
+        initializeVisibleSurface = false;
+
+    // The "sppm" integrator alternates passes of camera paths that end at visible
+    // points and of photons that deposit their flux at nearby visible points
+    sppm = scene.integrator.name == "sppm";
+    if (sppm && (haveMedia || haveSubsurface)) {
+        Warning(&scene.integrator.loc,
+                "The wavefront \"sppm\" integrator doesn't support participating "
+                "media or subsurface scattering. Using a \"volpath\" integrator.");
+        sppm = false;
+    }
+    if (sppm)
+        initializeVisibleSurface = false;
+
+    // Light paths are started with a light chosen without a reference point
+    std::string lightSamplerName = scene.integrator.parameters.GetOneString(
+        "lightsampler", lightTracing ? "power" : "bvh");
     if (allLights.size() == 1)
         lightSamplerName = "uniform";
-    lightSampler = LightSampler::Create(lightSamplerName, allLights, alloc);
+    {
+        StatsPhase phase("CreateLightSampler");
+        memoryEstimate.Begin();
+        lightSampler = LightSampler::Create(lightSamplerName, allLights, alloc);
+        // Photons are emitted from lights chosen according to their power
+        if (sppm)
+            photonLightSampler = LightSampler::Create("power", allLights, alloc);
+        memoryEstimate.End("light sampler");
+    }
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (sceneResource)
+        sceneResource->SetReadMostlyAllocations(false);
+#endif  // PBRT_BUILD_GPU_RENDERER
 
-    if (scene.integrator.name != "path" && scene.integrator.name != "volpath")
+    if (scene.integrator.name != "path" && scene.integrator.name != "volpath" &&
+        scene.integrator.name != "lightpath" && scene.integrator.name != "sppm")
         Warning(&scene.integrator.loc,
                 "Ignoring specified integrator \"%s\": the wavefront integrator "
                 "always uses a \"volpath\" integrator.",
@@ -266,6 +499,16 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
     // Integrator parameters
     regularize = scene.integrator.parameters.GetOneBool("regularize", false);
     maxDepth = scene.integrator.parameters.GetOneInt("maxdepth", 5);
+    std::string transmittance =
+        scene.integrator.parameters.GetOneString("transmittance", "ratio");
+    if (transmittance != "ratio" && transmittance != "residual")
+        ErrorExit(&scene.integrator.loc, "%s: transmittance estimator unknown.",
+                  transmittance);
+    residualTracking = transmittance == "residual";
+    if (scene.integrator.parameters.GetOneBool("guiding", false) ||
+        scene.integrator.parameters.GetOneBool("adrrs", false))
+        Warning(&scene.integrator.loc, "The wavefront integrator does not support path "
+                                       "guiding or adjoint-driven Russian roulette.");
 
     // Warn about unsupported stuff...
     if (Options->forceDiffuse)
@@ -283,16 +526,127 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
         // Allocate storage for all of the queues/buffers...
 
 #ifdef PBRT_BUILD_GPU_RENDERER
+    // Integrators that render on the CPU don't allocate GPU memory
     CUDATrackedMemoryResource *mr =
-        dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource());
-    CHECK(mr != nullptr);
-    size_t startSize = mr->BytesAllocated();
+        dynamic_cast<CUDATrackedMemoryResource *>(alloc.resource());
+    size_t startSize = mr ? mr->BytesAllocated() : 0;
 #endif  // PBRT_BUILD_GPU_RENDERER
 
-    // Compute number of scanlines to render per pass
+    // Find the memory used by each in-flight sample for the queues the scene needs
+    bool haveAreaLights = !shapeIndexToAreaLights.empty();
+    sortMaterials = Options->sortMaterials;
+    sortRays = Options->sortRays;
+    // Regeneration has nothing to refill if paths end at the camera rays' hits
+    regeneratePaths =
+        Options->regeneratePaths && maxDepth > 0 && !lightTracing && !sppm;
+    if (Options->regeneratePaths && lightTracing)
+        Warning("Ignoring --regenerate-paths with the \"lightpath\" integrator.");
+    if (Options->regeneratePaths && sppm)
+        Warning("Ignoring --regenerate-paths with the \"sppm\" integrator.");
+    // Reservoir resampling of direct lighting assumes that each pixel's camera
+    // ray hits a surface in the same wavefront as its neighbors' do
+    restirDI = scene.integrator.parameters.GetOneBool("restirdi", false);
+    restirCandidates = scene.integrator.parameters.GetOneInt("restircandidates", 8);
+    restirNeighbors = scene.integrator.parameters.GetOneInt("restirneighbors", 3);
+    restirRadius = scene.integrator.parameters.GetOneFloat("restirradius", 10.f);
+    if (restirDI && (haveMedia || haveSubsurface || lightTracing || regeneratePaths)) {
+        Warning(&scene.integrator.loc,
+                "\"restirdi\" is not supported with participating media, "
+                "subsurface scattering, light tracing, or --regenerate-paths. "
+                "Disabling it.");
+        restirDI = false;
+    }
+    if (restirDI && restirCandidates < 1)
+        ErrorExit(&scene.integrator.loc, "\"restircandidates\" must be at least 1.");
+#ifdef PBRT_BUILD_GPU_RENDERER
+    // SPPM's camera and photon passes launch different kernels at each depth
+    useGPUGraphs = useGPU && Options->gpuGraphs && !sppm;
+    if (useGPUGraphs)
+        depthGraphs.resize(maxDepth + 3, nullptr);
+#endif  // PBRT_BUILD_GPU_RENDERER
+    pstd::array<bool, PhaseFunction::NumTags()> havePhase;
+    // TODO: in the presence of multiple PhaseFunction implementations,
+    // it could be worthwhile to see which are present in the scene and
+    // then initialize havePhase accordingly...
+    havePhase.fill(true);
+    pstd::span<const bool> basicMaterials =
+        pstd::MakeConstSpan(&haveBasicEvalMaterial[1], haveBasicEvalMaterial.size() - 1);
+    pstd::span<const bool> universalMaterials = pstd::MakeConstSpan(
+        &haveUniversalEvalMaterial[1], haveUniversalEvalMaterial.size() - 1);
+
+    // Light paths don't need the queues for rays that escape or hit emitters
+    bool haveEscapedRays = infiniteLights->size() && !lightTracing;
+    bool haveEmitterHits = haveAreaLights && !lightTracing;
+    size_t pixelStateSampleBytes =
+        sizeof(PixelSampleState) + (lightTracing ? sizeof(Point2f) : 0);
+    size_t raySampleBytes = (sortRays ? 3 : 2) * sizeof(RayWorkItem) +
+                            sizeof(ShadowRayWorkItem);
+    size_t surfaceSampleBytes =
+        (haveEscapedRays ? sizeof(EscapedRayWorkItem) : 0) +
+        (haveEmitterHits ? sizeof(HitAreaLightWorkItem) : 0) +
+        MaterialEvalQueue::BytesPerItem(basicMaterials) +
+        MaterialEvalQueue::BytesPerItem(universalMaterials);
+    size_t subsurfaceSampleBytes =
+        haveSubsurface
+            ? sizeof(GetBSSRDFAndProbeRayWorkItem) + sizeof(SubsurfaceScatterWorkItem)
+            : 0;
+    size_t mediumSampleBytes =
+        haveMedia
+            ? sizeof(MediumSampleWorkItem) + MediumScatterQueue::BytesPerItem(havePhase)
+            : 0;
+    size_t sortSampleBytes =
+        (sortMaterials || sortRays) ? 2 * (sizeof(uint64_t) + sizeof(int)) : 0;
+    size_t bytesPerSample = pixelStateSampleBytes + raySampleBytes + surfaceSampleBytes +
+                            subsurfaceSampleBytes + mediumSampleBytes + sortSampleBytes;
+
+    // Limit the number of samples in flight to what fits in the available memory
     Vector2i resolution = film.PixelBounds().Diagonal();
-    // TODO: make this configurable. Base it on the amount of GPU memory?
     int maxSamples = 1024 * 1024;
+    size_t availableBytes = useGPU ? 0 : GetAvailableMemory();
+    if (availableBytes > 0)
+        // Leave half of the memory for the film and for allocations made later
+        maxSamples = std::min<size_t>(maxSamples, availableBytes / 2 / bytesPerSample);
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU) {
+        // The scene's device allocations are already reflected in the free
+        // memory, but its managed allocations will be prefetched to the GPU
+        // before rendering; leave room for them as well as for the
+        // allocations made while rendering.
+        size_t totalBytes;
+        CUDA_CHECK(cudaMemGetInfo(&availableBytes, &totalBytes));
+        size_t reservedBytes = totalBytes / 20;
+        size_t sceneBytes = memoryEstimate.ManagedBytes();
+        size_t minQueueBytes = bytesPerSample * resolution.x;
+        if (availableBytes < reservedBytes + minQueueBytes)
+            ErrorExit("Not enough GPU memory to render this scene: %.2f MiB are free "
+                      "but %.2f MiB are needed for the queues for a single scanline. "
+                      "GPU memory used by the scene:%s",
+                      availableBytes / (1024. * 1024.), minQueueBytes / (1024. * 1024.),
+                      memoryEstimate.Breakdown(minQueueBytes));
+        // Managed scene data that doesn't fit is read from host memory, so only
+        // shrink the queues for it down to a quarter of the free memory
+        size_t queueBytes = availableBytes - reservedBytes;
+        if (queueBytes > sceneBytes + minQueueBytes)
+            queueBytes = std::max(queueBytes - sceneBytes, queueBytes / 4);
+        else
+            queueBytes = std::max(queueBytes / 4, minQueueBytes);
+        maxSamples = std::min<size_t>(maxSamples, queueBytes / bytesPerSample);
+        size_t queueSampleBytes = size_t(maxSamples) * bytesPerSample;
+        if (availableBytes < reservedBytes + sceneBytes + queueSampleBytes)
+            Warning("Scene and queues need more than the %.2f MiB of free GPU memory; "
+                    "some scene data will be read from host memory. GPU memory "
+                    "used by the scene:%s",
+                    availableBytes / (1024. * 1024.),
+                    memoryEstimate.Breakdown(queueSampleBytes));
+        else
+            LOG_VERBOSE("GPU memory used by the scene:%s",
+                        memoryEstimate.Breakdown(queueSampleBytes));
+    }
+#endif  // PBRT_BUILD_GPU_RENDERER
+    LOG_VERBOSE("%d bytes of memory available; %d bytes used per wavefront sample",
+                availableBytes, bytesPerSample);
+
+    // Compute number of scanlines to render per pass
     scanlinesPerPass = std::max(1, maxSamples / resolution.x);
     int nPasses = (resolution.y + scanlinesPerPass - 1) / scanlinesPerPass;
     scanlinesPerPass = (resolution.y + nPasses - 1) / nPasses;
@@ -300,7 +654,100 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
     LOG_VERBOSE("Will render in %d passes %d scanlines per pass\n", nPasses,
                 scanlinesPerPass);
 
+    // Report the memory used by the queues
+    pixelStateQueueBytes += int64_t(maxQueueSize) * pixelStateSampleBytes;
+    rayQueueBytes += int64_t(maxQueueSize) * raySampleBytes;
+    surfaceQueueBytes += int64_t(maxQueueSize) * surfaceSampleBytes;
+    subsurfaceQueueBytes += int64_t(maxQueueSize) * subsurfaceSampleBytes;
+    mediumQueueBytes += int64_t(maxQueueSize) * mediumSampleBytes;
+    sortQueueBytes += int64_t(maxQueueSize) * sortSampleBytes;
+    LOG_VERBOSE("Wavefront queue memory: pixel state %d, rays %d, surface hits %d, "
+                "subsurface %d, media %d, sorting %d",
+                int64_t(maxQueueSize) * pixelStateSampleBytes,
+                int64_t(maxQueueSize) * raySampleBytes,
+                int64_t(maxQueueSize) * surfaceSampleBytes,
+                int64_t(maxQueueSize) * subsurfaceSampleBytes,
+                int64_t(maxQueueSize) * mediumSampleBytes,
+                int64_t(maxQueueSize) * sortSampleBytes);
+
     pixelSampleState = SOA<PixelSampleState>(maxQueueSize, alloc);
+    if (lightTracing)
+        splatRaster = alloc.allocate_object<Point2f>(maxQueueSize);
+    if (restirDI) {
+        // Allocate reservoirs for all of the film's pixels, since images that take
+        // multiple passes render all of a pass's samples before the next pass
+        int nPixels = film.PixelBounds().Area();
+        for (DirectLightingReservoir *&r : reservoirs) {
+            r = alloc.allocate_object<DirectLightingReservoir>(nPixels);
+            for (int i = 0; i < nPixels; ++i)
+                alloc.construct(&r[i]);
+        }
+        LOG_VERBOSE("Allocated %d bytes for direct lighting reservoirs",
+                    2 * nPixels * sizeof(DirectLightingReservoir));
+    }
+
+    if (sppm) {
+        // Allocate SPPM state for all of the film's pixels
+        int nPixels = film.PixelBounds().Area();
+        photonsPerIteration =
+            scene.integrator.parameters.GetOneInt("photonsperiteration", -1);
+        if (photonsPerIteration <= 0)
+            photonsPerIteration = nPixels;
+        Float radius = scene.integrator.parameters.GetOneFloat("radius", 1.f);
+        int seed = scene.integrator.parameters.GetOneInt("seed", 6502);
+        photonDigitPermutations = ComputeRadicalInversePermutations(seed, alloc);
+        outputColorSpace = scene.film.parameters.ColorSpace();
+        sppmPixels = alloc.allocate_object<SPPMPixelState>(nPixels);
+        for (int i = 0; i < nPixels; ++i) {
+            alloc.construct(&sppmPixels[i]);
+            sppmPixels[i].radius = radius;
+        }
+        sppmBxDFs = alloc.allocate_object<SPPMBxDFStorage>(nPixels);
+
+        // Initialize SPPM grid with cells at least as wide as search diameters
+        // Radii only shrink, so each visible point overlaps at most 8 cells
+        sppmGrid.bounds = aggregate->Bounds();
+        Vector3f diag = sppmGrid.bounds.Diagonal();
+        for (int i = 0; i < 3; ++i)
+            sppmGrid.res[i] = std::max<int>(
+                1, std::min<Float>(diag[i] / (2 * radius), 1 << 20));
+        sppmGrid.hashSize = NextPrime(nPixels);
+        sppmGrid.counts = alloc.allocate_object<SPPMCounter>(sppmGrid.hashSize + 1);
+        for (int h = 0; h <= sppmGrid.hashSize; ++h)
+            alloc.construct(&sppmGrid.counts[h]);
+        sppmGrid.offsets = alloc.allocate_object<int>(sppmGrid.hashSize + 1);
+        sppmGrid.entries = alloc.allocate_object<SPPMGridEntry>(8 * size_t(nPixels));
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (useGPU) {
+            // The counters are plain _int_s in GPU code
+            CUDA_CHECK(cub::DeviceScan::ExclusiveSum(
+                nullptr, sppmScanTempBytes, reinterpret_cast<int *>(sppmGrid.counts),
+                sppmGrid.offsets, sppmGrid.hashSize + 1));
+            CUDA_CHECK(cudaMalloc(&sppmScanTemp, sppmScanTempBytes));
+        }
+#endif  // PBRT_BUILD_GPU_RENDERER
+        LOG_VERBOSE("Allocated %d bytes for SPPM pixels and grid",
+                    nPixels * (sizeof(SPPMPixelState) + sizeof(SPPMBxDFStorage) +
+                               8 * sizeof(SPPMGridEntry)) +
+                        (sppmGrid.hashSize + 1) * (sizeof(SPPMCounter) + sizeof(int)));
+    }
+
+    if (sortMaterials || sortRays) {
+        queueSortKeys = alloc.allocate_object<uint64_t>(2 * maxQueueSize);
+        queueSortIndices = alloc.allocate_object<int>(2 * maxQueueSize);
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (useGPU) {
+            CUDA_CHECK(cub::DeviceRadixSort::SortPairs(
+                nullptr, queueSortTempBytes, queueSortKeys, queueSortKeys + maxQueueSize,
+                queueSortIndices, queueSortIndices + maxQueueSize, maxQueueSize));
+            CUDA_CHECK(cudaMalloc(&queueSortTemp, queueSortTempBytes));
+        }
+#endif  // PBRT_BUILD_GPU_RENDERER
+    }
+    if (sortRays) {
+        sceneBounds = aggregate->Bounds();
+        sortedRays = SOA<RayWorkItem>(maxQueueSize, alloc);
+    }
 
     rayQueues[0] = alloc.new_object<RayQueue>(maxQueueSize, alloc);
     rayQueues[1] = alloc.new_object<RayQueue>(maxQueueSize, alloc);
@@ -314,38 +761,46 @@ WavefrontPathIntegrator::WavefrontPathIntegrator(Allocator alloc, ParsedScene &s
             alloc.new_object<SubsurfaceScatterQueue>(maxQueueSize, alloc);
     }
 
-    if (infiniteLights->size())
+    if (haveEscapedRays)
         escapedRayQueue = alloc.new_object<EscapedRayQueue>(maxQueueSize, alloc);
-    hitAreaLightQueue = alloc.new_object<HitAreaLightQueue>(maxQueueSize, alloc);
+    if (haveEmitterHits)
+        hitAreaLightQueue = alloc.new_object<HitAreaLightQueue>(maxQueueSize, alloc);
 
-    basicEvalMaterialQueue = alloc.new_object<MaterialEvalQueue>(
-        maxQueueSize, alloc,
-        pstd::MakeConstSpan(&haveBasicEvalMaterial[1], haveBasicEvalMaterial.size() - 1));
-    universalEvalMaterialQueue = alloc.new_object<MaterialEvalQueue>(
-        maxQueueSize, alloc,
-        pstd::MakeConstSpan(&haveUniversalEvalMaterial[1],
-                            haveUniversalEvalMaterial.size() - 1));
+    basicEvalMaterialQueue =
+        alloc.new_object<MaterialEvalQueue>(maxQueueSize, alloc, basicMaterials);
+    universalEvalMaterialQueue =
+        alloc.new_object<MaterialEvalQueue>(maxQueueSize, alloc, universalMaterials);
 
     if (haveMedia) {
         mediumSampleQueue = alloc.new_object<MediumSampleQueue>(maxQueueSize, alloc);
-
-        // TODO: in the presence of multiple PhaseFunction implementations,
-        // it could be worthwhile to see which are present in the scene and
-        // then initialize havePhase accordingly...
-        pstd::array<bool, PhaseFunction::NumTags()> havePhase;
-        havePhase.fill(true);
         mediumScatterQueue =
             alloc.new_object<MediumScatterQueue>(maxQueueSize, alloc, havePhase);
     }
 
-    stats = alloc.new_object<Stats>(maxDepth, alloc);
+    stats = alloc.new_object<Stats>(maxDepth, haveMedia, alloc);
 
 #ifdef PBRT_BUILD_GPU_RENDERER
-    size_t endSize = mr->BytesAllocated();
-    pathIntegratorBytes += endSize - startSize;
+    if (mr)
+        pathIntegratorBytes += mr->BytesAllocated() - startSize;
 #endif  // PBRT_BUILD_GPU_RENDERER
 }
 
+#ifdef PBRT_BUILD_GPU_RENDERER
+// Prefetches as much of _mr_'s allocations to the current GPU as fits in its
+// free memory, leaving some for the allocations made while rendering
+static void PrefetchToFreeGPUMemory(const CUDATrackedMemoryResource *mr) {
+    size_t freeBytes, totalBytes;
+    CUDA_CHECK(cudaMemGetInfo(&freeBytes, &totalBytes));
+    size_t reservedBytes = totalBytes / 20;
+    size_t maxBytes = freeBytes > reservedBytes ? freeBytes - reservedBytes : 0;
+    size_t bytes = mr->PrefetchToGPU(maxBytes);
+    if (bytes < mr->BytesAllocated())
+        Warning("Scene data doesn't fit in GPU memory: %.2f MiB of it will be read "
+                "from host memory.",
+                (mr->BytesAllocated() - bytes) / (1024. * 1024.));
+}
+#endif  // PBRT_BUILD_GPU_RENDERER
+
 // WavefrontPathIntegrator Method Definitions
 Float WavefrontPathIntegrator::Render() {
     Bounds2i pixelBounds = film.PixelBounds();
@@ -353,7 +808,7 @@ Float WavefrontPathIntegrator::Render() {
     Timer timer;
     // Prefetch allocations to GPU memory
 #ifdef PBRT_BUILD_GPU_RENDERER
-    if (Options->useGPU) {
+    if (useGPU) {
         int deviceIndex;
         CUDA_CHECK(cudaGetDevice(&deviceIndex));
         int hasConcurrentManagedAccess;
@@ -378,10 +833,41 @@ Float WavefrontPathIntegrator::Render() {
             // Copy all of the scene data structures over to GPU memory.  This
             // ensures that there isn't a big performance hitch for the first batch
             // of rays as that stuff is copied over on demand.
+            StatsPhase phase("PrefetchToGPU");
             CUDATrackedMemoryResource *mr =
                 dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource());
             CHECK(mr != nullptr);
-            mr->PrefetchToGPU();
+            // Each device's own allocations are prefetched first since its
+            // queues are written by every kernel; the scene data that was
+            // allocated while parsing gets the memory that remains
+            auto prefetch = [mr](const CUDATrackedMemoryResource *ownResource) {
+                if (ownResource != mr)
+                    PrefetchToFreeGPUMemory(ownResource);
+                PrefetchToFreeGPUMemory(mr);
+            };
+
+            // The integrators for each GPU allocate their own objects and
+            // queues, which are prefetched to the device that uses them
+            for (WavefrontPathIntegrator *integrator : partners) {
+                if (!integrator->useGPU)
+                    continue;
+                CUDA_CHECK(cudaSetDevice(integrator->gpuDevice));
+                const CUDATrackedMemoryResource *partnerResource =
+                    dynamic_cast<CUDATrackedMemoryResource *>(
+                        integrator->alloc.resource());
+                CHECK(partnerResource != nullptr);
+                CUDA_CHECK(cudaMemAdvise(integrator, sizeof(*integrator),
+                                         cudaMemAdviseSetReadMostly, 0));
+                CUDA_CHECK(cudaMemAdvise(integrator, sizeof(*integrator),
+                                         cudaMemAdviseSetPreferredLocation,
+                                         integrator->gpuDevice));
+                prefetch(partnerResource);
+            }
+            CUDA_CHECK(cudaSetDevice(gpuDevice));
+            const CUDATrackedMemoryResource *ownResource =
+                dynamic_cast<CUDATrackedMemoryResource *>(alloc.resource());
+            CHECK(ownResource != nullptr);
+            prefetch(ownResource);
         } else {
             // TODO: on systems with basic unified memory, just launching a
             // kernel should cause everything to be copied over. Is an empty
@@ -390,6 +876,10 @@ Float WavefrontPathIntegrator::Render() {
     }
 #endif  // PBRT_BUILD_GPU_RENDERER
 
+    // SPPM renders iterations of camera and photon passes rather than samples
+    if (sppm)
+        return RenderSPPM();
+
     // Launch thread to copy image for display server, if enabled
     RGB *displayRGB = nullptr, *displayRGBHost = nullptr;
     std::atomic<bool> exitCopyThread{false};
@@ -397,7 +887,7 @@ Float WavefrontPathIntegrator::Render() {
 
     if (!Options->displayServer.empty()) {
 #ifdef PBRT_BUILD_GPU_RENDERER
-        if (Options->useGPU) {
+        if (useGPU) {
             // Allocate staging memory on the GPU to store the current WIP
             // image.
             CUDA_CHECK(
@@ -462,8 +952,7 @@ Float WavefrontPathIntegrator::Render() {
                                     pstd::span<pstd::span<Float>> displayValue) {
                     int index = 0;
                     for (Point2i p : b) {
-                        RGB rgb =
-                            film.GetPixelRGB(pixelBounds.pMin + p, 1.f /* splat scale */);
+                        RGB rgb = film.GetPixelRGB(pixelBounds.pMin + p, splatScale);
                         for (int c = 0; c < 3; ++c)
                             displayValue[c][index] = rgb[c];
                         ++index;
@@ -486,123 +975,181 @@ Float WavefrontPathIntegrator::Render() {
             lastSampleIndex = firstSampleIndex + 1;
     }
 
+    // Read the reference image for --target-mse, if specified
+    pstd::optional<Image> referenceImage;
+    if (Options->targetMSE)
+        referenceImage = ReadMSEReferenceImage(Options->mseReferenceImage, pixelBounds);
+
+    // Each sample's rows are split into consecutive bands; this integrator
+    // renders the first and its partners render the others. Additional GPUs
+    // initially take the same share as this one and the CPU a small one.
+    int nBands = 1 + partners.size();
+    std::vector<Float> bandFractions(nBands, 1.f);
+    for (size_t i = 0; i < partners.size(); ++i)
+        if (!partners[i]->useGPU)
+            bandFractions[i + 1] = 1.f / 16.f;
+    auto updateBands = [&]() {
+        // Normalize the fractions and find the first row of each band, making
+        // sure that every integrator renders at least one row
+        Float sum = std::accumulate(bandFractions.begin(), bandFractions.end(), 0.f);
+        std::vector<int> yBands(nBands + 1);
+        yBands[0] = pixelBounds.pMin.y;
+        Float cumulative = 0;
+        for (int i = 0; i < nBands; ++i) {
+            bandFractions[i] /= sum;
+            cumulative += bandFractions[i];
+            int y = pixelBounds.pMin.y + int(std::round(cumulative * resolution.y));
+            int yMax = pixelBounds.pMax.y - (nBands - 1 - i);
+            yBands[i + 1] = Clamp(y, yBands[i] + 1, yMax);
+        }
+        yBands[nBands] = pixelBounds.pMax.y;
+        return yBands;
+    };
+    std::vector<int> yBands = updateBands();
+
     ProgressReporter progress(lastSampleIndex - firstSampleIndex, "Rendering",
-                              Options->quiet, Options->useGPU);
+                              Options->quiet, useGPU);
+    // Each unit of progress is one sample for all of the pixels
+    progress.SetRenderingRates(pixelBounds.Area());
+    // With path regeneration, samples are rendered in batches so that pixels
+    // whose paths terminate can go on to their next sample in the batch
+    int samplesPerBatch = regeneratePaths ? 8 : 1;
+#ifdef PBRT_BUILD_GPU_RENDERER
+    // With a single GPU, the checks for the time limit only wait for the
+    // batch of samples before the last one, using these events
+    bool pipelineBatches = useGPU && partners.empty() && Options->timeLimit;
+    cudaEvent_t batchFinished[2];
+    if (pipelineBatches)
+        for (cudaEvent_t &event : batchFinished)
+            CUDA_CHECK(cudaEventCreateWithFlags(&event, cudaEventDisableTiming));
+    int batchIndex = 0, samplesRenderedBefore = 0;
+#endif  // PBRT_BUILD_GPU_RENDERER
+    int nSamples = 1;
     for (int sampleIndex = firstSampleIndex; sampleIndex < lastSampleIndex;
-         ++sampleIndex) {
+         sampleIndex += nSamples) {
+        nSamples = std::min(samplesPerBatch, lastSampleIndex - sampleIndex);
         CheckCallbackScope _([&]() {
             return StringPrintf("Wavefront rendering failed at sample %d. Debug with "
                                 "\"--debugstart %d\"\n",
                                 sampleIndex, sampleIndex);
         });
 
-        // Render image for sample _sampleIndex_
-        LOG_VERBOSE("Starting to submit work for sample %d", sampleIndex);
-        for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
-             y0 += scanlinesPerPass) {
-            // Generate camera rays for current scanline range
-            RayQueue *cameraRayQueue = CurrentRayQueue(0);
-            Do(
-                "Reset ray queue", PBRT_CPU_GPU_LAMBDA() {
-                    PBRT_DBG("Starting scanlines at y0 = %d, sample %d / %d\n", y0,
-                             sampleIndex, samplesPerPixel);
-                    cameraRayQueue->Reset();
-                });
-            GenerateCameraRays(y0, sampleIndex);
-            Do(
-                "Update camera ray stats",
-                PBRT_CPU_GPU_LAMBDA() { stats->cameraRays += cameraRayQueue->Size(); });
-
-            // Trace rays and estimate radiance up to maximum ray depth
-            for (int wavefrontDepth = 0; true; ++wavefrontDepth) {
-                // Reset queues before tracing rays
-                RayQueue *nextQueue = NextRayQueue(wavefrontDepth);
-                Do(
-                    "Reset queues before tracing rays", PBRT_CPU_GPU_LAMBDA() {
-                        nextQueue->Reset();
-                        // Reset queues before tracing next batch of rays
-                        if (mediumSampleQueue)
-                            mediumSampleQueue->Reset();
-                        if (mediumScatterQueue)
-                            mediumScatterQueue->Reset();
-
-                        if (escapedRayQueue)
-                            escapedRayQueue->Reset();
-                        hitAreaLightQueue->Reset();
-
-                        basicEvalMaterialQueue->Reset();
-                        universalEvalMaterialQueue->Reset();
-
-                        if (bssrdfEvalQueue)
-                            bssrdfEvalQueue->Reset();
-                        if (subsurfaceScatterQueue)
-                            subsurfaceScatterQueue->Reset();
-                    });
-
-                // Follow active ray paths and accumulate radiance estimates
-                GenerateRaySamples(wavefrontDepth, sampleIndex);
-
-                // Find closest intersections along active rays
-                aggregate->IntersectClosest(
-                    maxQueueSize, CurrentRayQueue(wavefrontDepth), escapedRayQueue,
-                    hitAreaLightQueue, basicEvalMaterialQueue, universalEvalMaterialQueue,
-                    mediumSampleQueue, NextRayQueue(wavefrontDepth));
-
-                if (wavefrontDepth > 0) {
-                    // As above, with the indexing...
-                    RayQueue *statsQueue = CurrentRayQueue(wavefrontDepth);
-                    Do(
-                        "Update indirect ray stats", PBRT_CPU_GPU_LAMBDA() {
-                            stats->indirectRays[wavefrontDepth] += statsQueue->Size();
-                        });
+        // Render image for samples starting at _sampleIndex_
+        if (!partners.empty()) {
+            // Render each band with its integrator, on its GPU if it has one,
+            // and measure how long it takes
+            auto renderBand = [&](WavefrontPathIntegrator *integrator, int band) {
+                Timer bandTimer;
+#ifdef PBRT_BUILD_GPU_RENDERER
+                if (integrator->useGPU)
+                    CUDA_CHECK(cudaSetDevice(integrator->gpuDevice));
+#endif  // PBRT_BUILD_GPU_RENDERER
+                integrator->RenderSamples(sampleIndex, nSamples, yBands[band],
+                                          yBands[band + 1],
+                                          integrator->useGPU ? displayRGB : nullptr);
+#ifdef PBRT_BUILD_GPU_RENDERER
+                if (integrator->useGPU) {
+                    GPUWait();
+                    CUDA_CHECK(cudaSetDevice(gpuDevice));
                 }
+#endif  // PBRT_BUILD_GPU_RENDERER
+                return bandTimer.ElapsedSeconds();
+            };
+            std::vector<std::shared_ptr<AsyncJob<double>>> jobs;
+            for (size_t i = 0; i < partners.size(); ++i)
+                jobs.push_back(
+                    RunAsync([&, i]() { return renderBand(partners[i], i + 1); }));
+            std::vector<Float> bandSeconds(nBands);
+            bandSeconds[0] = renderBand(this, 0);
+            for (size_t i = 0; i < partners.size(); ++i)
+                bandSeconds[i + 1] = jobs[i]->GetResult();
+
+            // Move each band's share of the rows toward the number that its
+            // integrator can render in the same time, given the measured rates
+            std::vector<Float> rates(nBands);
+            for (int i = 0; i < nBands; ++i) {
+                LOG_VERBOSE("Sample %d: rendered rows [%d, %d) in band %d in %f s",
+                            sampleIndex, yBands[i], yBands[i + 1], i, bandSeconds[i]);
+                rates[i] = (yBands[i + 1] - yBands[i]) /
+                           std::max<Float>(bandSeconds[i], 1e-6f);
+            }
+            Float rateSum = std::accumulate(rates.begin(), rates.end(), 0.f);
+            for (int i = 0; i < nBands; ++i)
+                bandFractions[i] = 0.5f * bandFractions[i] + 0.5f * rates[i] / rateSum;
+            yBands = updateBands();
+        } else
+            RenderSamples(sampleIndex, nSamples, pixelBounds.pMin.y, pixelBounds.pMax.y,
+                          displayRGB);
 
-                SampleMediumInteraction(wavefrontDepth);
-
-                HandleEscapedRays();
-
-                HandleEmissiveIntersection();
+#ifdef PBRT_BUILD_GPU_RENDERER
+        // Stream in the image texture tiles that this batch's lookups requested
+        if (useGPU && Options->gpuTextureMemory)
+            UpdateGPUTextureResidency();
+#endif  // PBRT_BUILD_GPU_RENDERER
 
-                if (wavefrontDepth == maxDepth)
+        progress.Update(nSamples);
+        samplesRendered = sampleIndex + nSamples - firstSampleIndex;
+        // Each pixel sample traces one light path with light tracing
+        if (lightTracing)
+            splatScale = Float(1) / samplesRendered;
+
+        // Stop early for the time limit or target MSE, if specified
+        if (sampleIndex + nSamples < lastSampleIndex &&
+            (Options->timeLimit || referenceImage)) {
+            // Computing the MSE is relatively expensive, so only do so after
+            // power-of-two numbers of samples
+            bool computeMSE = referenceImage && IsPowerOf2(samplesRendered);
+            int samplesFinished = samplesRendered;
+#ifdef PBRT_BUILD_GPU_RENDERER
+            if (pipelineBatches && !computeMSE && batchIndex > 0) {
+                // Wait for the previous batch's kernels to finish so that this
+                // batch keeps the GPU busy while the time limit is checked
+                CUDA_CHECK(cudaEventRecord(batchFinished[batchIndex & 1]));
+                CUDA_CHECK(cudaEventSynchronize(batchFinished[(batchIndex - 1) & 1]));
+                samplesFinished = samplesRenderedBefore;
+            } else if (useGPU) {
+                // Wait for the sample's kernels to finish so that the elapsed
+                // time is accurate and the film can be read
+                GPUWait();
+                if (pipelineBatches)
+                    CUDA_CHECK(cudaEventRecord(batchFinished[batchIndex & 1]));
+            }
+            ++batchIndex;
+            samplesRenderedBefore = samplesRendered;
+#endif  // PBRT_BUILD_GPU_RENDERER
+            Float elapsed = timer.ElapsedSeconds();
+            // Account for the samples still being rendered when predicting the
+            // time at which the next batch would finish
+            int samplesPending = samplesRendered - samplesFinished + samplesPerBatch;
+            if (Options->timeLimit &&
+                elapsed + elapsed / samplesFinished * samplesPending >
+                    *Options->timeLimit) {
+                LOG_VERBOSE("Stopping at %d spp for time limit", samplesRendered);
+                break;
+            }
+            if (computeMSE) {
+                ImageMetadata metadata;
+                Image image = film.GetImage(&metadata, splatScale);
+                Float mse = image.MSE(image.AllChannelsDesc(), *referenceImage).Average();
+                LOG_VERBOSE("MSE %f at %d spp", mse, samplesRendered);
+                if (mse <= *Options->targetMSE)
                     break;
-
-                EvaluateMaterialsAndBSDFs(wavefrontDepth);
-
-                // Do immediately so that we have space for shadow rays for subsurface..
-                TraceShadowRays(wavefrontDepth);
-
-                SampleSubsurface(wavefrontDepth);
             }
-
-            UpdateFilm();
-            // Copy updated film pixels to buffer for display
-#ifdef PBRT_BUILD_GPU_RENDERER
-            if (Options->useGPU && !Options->displayServer.empty())
-                GPUParallelFor(
-                    "Update Display RGB Buffer", maxQueueSize,
-                    PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
-                        Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
-                        if (!InsideExclusive(pPixel, film.PixelBounds()))
-                            return;
-
-                        Point2i p(pPixel - film.PixelBounds().pMin);
-                        displayRGB[p.x + p.y * resolution.x] = film.GetPixelRGB(pPixel);
-                    });
-#endif  //  PBRT_BUILD_GPU_RENDERER
         }
-
-        progress.Update();
     }
     progress.Done();
 
 #ifdef PBRT_BUILD_GPU_RENDERER
-    if (Options->useGPU)
+    if (useGPU)
         GPUWait();
+    if (pipelineBatches)
+        for (cudaEvent_t event : batchFinished)
+            CUDA_CHECK(cudaEventDestroy(event));
 #endif  // PBRT_BUILD_GPU_RENDERER
     Float seconds = timer.ElapsedSeconds();
     // Shut down display server thread, if active
 #ifdef PBRT_BUILD_GPU_RENDERER
-    if (Options->useGPU) {
+    if (useGPU) {
         // Wait until rendering is all done before we start to shut down the
         // display stuff..
         if (!Options->displayServer.empty()) {
@@ -619,38 +1166,331 @@ Float WavefrontPathIntegrator::Render() {
     return seconds;
 }
 
+void WavefrontPathIntegrator::RenderSamples(int sampleIndex, int nSamples, int yStart,
+                                            int yEnd, RGB *displayRGB) {
+    // Render samples $[sampleIndex, sampleIndex + nSamples)$ for the pixels in
+    // rows $[yStart, yEnd)$
+    LOG_VERBOSE("Starting to submit work for samples %d-%d", sampleIndex,
+                sampleIndex + nSamples - 1);
+    for (int y0 = yStart; y0 < yEnd; y0 += scanlinesPerPass) {
+        int y1 = std::min(y0 + scanlinesPerPass, yEnd);
+        if (regeneratePaths)
+            TracePaths(y0, y1, sampleIndex, sampleIndex + nSamples);
+        else
+            // Follow each sample's paths until they have all terminated
+            for (int s = sampleIndex; s < sampleIndex + nSamples; ++s) {
+                TracePaths(y0, y1, s, s + 1);
+                // Light paths' contributions have already been splatted
+                if (!lightTracing)
+                    UpdateFilm();
+            }
+
+        // Copy updated film pixels to buffer for display
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (useGPU && displayRGB) {
+            int xResolution = film.PixelBounds().Diagonal().x;
+            GPUParallelFor(
+                "Update Display RGB Buffer", maxQueueSize,
+                PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+                    Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+                    if (!InsideExclusive(pPixel, film.PixelBounds()))
+                        return;
+
+                    Point2i p(pPixel - film.PixelBounds().pMin);
+                    displayRGB[p.x + p.y * xResolution] =
+                        film.GetPixelRGB(pPixel, splatScale);
+                });
+        }
+#endif  //  PBRT_BUILD_GPU_RENDERER
+    }
+}
+
+void WavefrontPathIntegrator::TracePaths(int y0, int y1, int sampleStart,
+                                         int sampleEnd) {
+    // Generate camera rays for current scanline range
+    RayQueue *cameraRayQueue = CurrentRayQueue(0);
+    Do(
+        "Reset ray queue", PBRT_CPU_GPU_LAMBDA() {
+            PBRT_DBG("Starting scanlines at y0 = %d, sample %d / %d\n", y0, sampleStart,
+                     samplesPerPixel);
+            cameraRayQueue->Reset();
+        });
+    if (lightTracing) {
+        // Splat light emitted toward the camera before tracing the light paths
+        GenerateLightPaths(y0, y1, sampleStart);
+        TraceShadowRays(0);
+        SplatLightPaths();
+    } else
+        GenerateCameraRays(y0, y1, sampleStart);
+    Do(
+        "Update camera ray stats",
+        PBRT_CPU_GPU_LAMBDA() { stats->cameraRays += cameraRayQueue->Size(); });
+
+    // Trace rays and estimate radiance up to maximum ray depth
+    for (int wavefrontDepth = 0; true; ++wavefrontDepth) {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (useGPUGraphs) {
+            // The kernels launched for a depth only depend on it through the
+            // ray queue used and the checks against the maximum depth, so with
+            // path regeneration, later depths share two graphs
+            int graphIndex = wavefrontDepth;
+            if (wavefrontDepth > maxDepth)
+                graphIndex = maxDepth + 1 + (wavefrontDepth & 1);
+            GPULaunchGraph("Trace wavefront depth (CUDA graph)",
+                           &depthGraphs[graphIndex],
+                           [&]() { TraceWavefrontDepth(wavefrontDepth); });
+        } else
+#endif  // PBRT_BUILD_GPU_RENDERER
+            TraceWavefrontDepth(wavefrontDepth);
+
+        if (regeneratePaths ? !RegeneratePaths(wavefrontDepth, sampleEnd)
+                            : wavefrontDepth == maxDepth)
+            break;
+    }
+}
+
+void WavefrontPathIntegrator::TraceWavefrontDepth(int wavefrontDepth) {
+    // Reset queues before tracing rays
+    RayQueue *nextQueue = NextRayQueue(wavefrontDepth);
+    Do(
+        "Reset queues before tracing rays", PBRT_CPU_GPU_LAMBDA() {
+            nextQueue->Reset();
+            // Reset queues before tracing next batch of rays
+            if (mediumSampleQueue)
+                mediumSampleQueue->Reset();
+            if (mediumScatterQueue)
+                mediumScatterQueue->Reset();
+
+            if (escapedRayQueue)
+                escapedRayQueue->Reset();
+            if (hitAreaLightQueue)
+                hitAreaLightQueue->Reset();
+
+            basicEvalMaterialQueue->Reset();
+            universalEvalMaterialQueue->Reset();
+
+            if (bssrdfEvalQueue)
+                bssrdfEvalQueue->Reset();
+            if (subsurfaceScatterQueue)
+                subsurfaceScatterQueue->Reset();
+        });
+
+    // Follow active ray paths and accumulate radiance estimates
+    if (sppmPhotonPass)
+        GeneratePhotonSamples(wavefrontDepth);
+    else
+        GenerateRaySamples(wavefrontDepth);
+
+    // Find closest intersections along active rays
+    if (sortRays && wavefrontDepth > 0)
+        SortRayQueue(wavefrontDepth);
+    // Photons don't gather the emission of the lights they hit
+    aggregate->IntersectClosest(
+        maxQueueSize, CurrentRayQueue(wavefrontDepth),
+        sppmPhotonPass ? nullptr : escapedRayQueue,
+        sppmPhotonPass ? nullptr : hitAreaLightQueue, basicEvalMaterialQueue,
+        universalEvalMaterialQueue, mediumSampleQueue, NextRayQueue(wavefrontDepth));
+
+    if (wavefrontDepth > 0) {
+        // As above, with the indexing...
+        RayQueue *statsQueue = CurrentRayQueue(wavefrontDepth);
+        int statsDepth = std::min(wavefrontDepth, maxDepth);
+        Do(
+            "Update indirect ray stats", PBRT_CPU_GPU_LAMBDA() {
+                stats->indirectRays[statsDepth] += statsQueue->Size();
+            });
+    }
+
+    SampleMediumInteraction(wavefrontDepth);
+
+    if (!sppmPhotonPass) {
+        HandleEscapedRays();
+
+        HandleEmissiveIntersection();
+    }
+
+    // With path regeneration, the queues hold paths of all depths and the
+    // material kernels skip the ones at the maximum depth
+    if (wavefrontDepth == maxDepth && !regeneratePaths)
+        return;
+
+    EvaluateMaterialsAndBSDFs(wavefrontDepth);
+
+    // Do immediately so that we have space for shadow rays for subsurface..
+    TraceShadowRays(wavefrontDepth);
+    if (lightTracing)
+        SplatLightPaths();
+
+    SampleSubsurface(wavefrontDepth);
+}
+
+bool WavefrontPathIntegrator::RegeneratePaths(int wavefrontDepth, int sampleEnd) {
+    // Mark the pixels whose paths continue at the next depth
+    RayQueue *nextQueue = NextRayQueue(wavefrontDepth);
+    ParallelFor(
+        "Mark active paths", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int index) {
+            if (index < nextQueue->Size())
+                pixelSampleState.pathActive[nextQueue->pixelIndex[index]] = 1;
+        });
+
+    // Add the samples of the other pixels to the film and start their next samples
+    UpdateFilmForTerminatedPaths(sampleEnd);
+    Do(
+        "Record ray queue size",
+        PBRT_CPU_GPU_LAMBDA() { stats->queuedRays = nextQueue->Size(); });
+    RegenerateCameraRays(wavefrontDepth, sampleEnd);
+    Do(
+        "Update camera ray stats", PBRT_CPU_GPU_LAMBDA() {
+            stats->cameraRays += nextQueue->Size() - stats->queuedRays;
+        });
+
+    // Check whether any paths remain; on the GPU, this requires waiting for
+    // the kernels to finish, so it is only done every few depths
+    if (useGPU && (wavefrontDepth + 1) % 4 != 0)
+        return true;
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU)
+        GPUWait();
+#endif  // PBRT_BUILD_GPU_RENDERER
+    return nextQueue->Size() > 0;
+}
+
+const int *WavefrontPathIntegrator::SortQueueIndices(int nItems) {
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU) {
+        CUDA_CHECK(cub::DeviceRadixSort::SortPairs(
+            queueSortTemp, queueSortTempBytes, queueSortKeys,
+            queueSortKeys + maxQueueSize, queueSortIndices,
+            queueSortIndices + maxQueueSize, nItems, 0, 64, GPULaunchStream()));
+        return queueSortIndices + maxQueueSize;
+    }
+#endif  // PBRT_BUILD_GPU_RENDERER
+    uint64_t *keys = queueSortKeys;
+    std::sort(queueSortIndices, queueSortIndices + nItems,
+              [keys](int a, int b) { return keys[a] < keys[b]; });
+    return queueSortIndices;
+}
+
+void WavefrontPathIntegrator::SortRayQueue(int wavefrontDepth) {
+    // Compute sort keys from the rays' quantized origins and directions
+    RayQueue *rayQueue = CurrentRayQueue(wavefrontDepth);
+    uint64_t *keys = queueSortKeys;
+    int *indices = queueSortIndices;
+    Bounds3f bounds = sceneBounds;
+    int nItems = useGPU ? maxQueueSize : rayQueue->Size();
+    ParallelFor(
+        "Compute ray sort keys", nItems, PBRT_CPU_GPU_LAMBDA(int index) {
+            indices[index] = index;
+            if (index >= rayQueue->Size()) {
+                keys[index] = ~uint64_t(0);
+                return;
+            }
+            // Order rays by the Morton code of their origins and then, among rays
+            // starting in the same cell, by their octahedral direction
+            auto quantize = [](Float v, int n) { return Clamp(int(v * n), 0, n - 1); };
+            Point3f p = rayQueue->ray.o[index];
+            Vector3f dir = rayQueue->ray.d[index];
+            Vector3f o = bounds.Offset(p);
+            Point2f d = EqualAreaSphereToSquare(Normalize(dir));
+            uint64_t originCode = EncodeMorton3(quantize(o.x, 1024), quantize(o.y, 1024),
+                                                quantize(o.z, 1024));
+            uint64_t directionCode = EncodeMorton2(quantize(d.x, 64), quantize(d.y, 64));
+            keys[index] = (originCode << 12) | directionCode;
+        });
+    const int *order = SortQueueIndices(nItems);
+
+    // Gather the rays in sorted order and copy them back to the ray queue
+    SOA<RayWorkItem> *sorted = &sortedRays;
+    ParallelFor(
+        "Gather sorted rays", nItems, PBRT_CPU_GPU_LAMBDA(int index) {
+            if (index < rayQueue->Size()) {
+                RayWorkItem w = (*rayQueue)[order[index]];
+                (*sorted)[index] = w;
+            }
+        });
+    ParallelFor(
+        "Copy sorted rays", nItems, PBRT_CPU_GPU_LAMBDA(int index) {
+            if (index < rayQueue->Size()) {
+                RayWorkItem w = (*sorted)[index];
+                (*rayQueue)[index] = w;
+            }
+        });
+}
+
+// Returns the radiance that the infinite light _light_ contributes to the path of
+// the escaped ray _w_; _lightHandle_ refers to the same light. With
+// _restirDI_, light sampling alone accounts for direct lighting at camera rays'
+// non-specular hits.
+template <typename ConcreteLight>
+PBRT_CPU_GPU inline SampledSpectrum EscapedRayRadiance(const EscapedRayWorkItem &w,
+                                                       const ConcreteLight &light,
+                                                       Light lightHandle,
+                                                       LightSampler lightSampler,
+                                                       bool restirDI) {
+    if (restirDI && w.depth == 1 && !w.specularBounce)
+        return SampledSpectrum(0.f);
+    SampledSpectrum Le = light.Le(Ray(w.rayo, w.rayd), w.lambda);
+    if (!Le)
+        return SampledSpectrum(0.f);
+    // Compute path radiance contribution from infinite light
+    PBRT_DBG("T_hat %f %f %f %f Le %f %f %f %f", w.T_hat[0], w.T_hat[1], w.T_hat[2],
+             w.T_hat[3], Le[0], Le[1], Le[2], Le[3]);
+    PBRT_DBG("pdf uni %f %f %f %f pdf nee %f %f %f %f", w.uniPathPDF[0], w.uniPathPDF[1],
+             w.uniPathPDF[2], w.uniPathPDF[3], w.lightPathPDF[0], w.lightPathPDF[1],
+             w.lightPathPDF[2], w.lightPathPDF[3]);
+
+    if (w.depth == 0 || w.specularBounce)
+        return w.T_hat * Le / w.uniPathPDF.Average();
+    // Compute MIS-weighted radiance contribution from infinite light
+    LightSampleContext ctx = w.prevIntrCtx;
+    Float lightChoicePDF = lightSampler.PDF(ctx, lightHandle);
+    SampledSpectrum lightPathPDF = w.lightPathPDF * lightChoicePDF *
+                                   light.PDF_Li(ctx, w.rayd, LightSamplingMode::WithMIS);
+    return w.T_hat * Le / (w.uniPathPDF + lightPathPDF).Average();
+}
+
 void WavefrontPathIntegrator::HandleEscapedRays() {
     if (!escapedRayQueue)
         return;
+    if (!useGPU) {
+        // Dispatch on each infinite light's type once for each batch of escaped
+        // rays on the CPU
+        ParallelForLanes(escapedRayQueue->Size(), [&](int start, int end) {
+            EscapedRayWorkItem items[CPULaneCount];
+            SampledSpectrum L[CPULaneCount];
+            int n = end - start;
+            for (int i = 0; i < n; ++i) {
+                items[i] = (*escapedRayQueue)[start + i];
+                L[i] = SampledSpectrum(0.f);
+            }
+
+            for (const auto &light : *infiniteLights) {
+                auto accumulate = [&](auto concreteLight) {
+                    for (int i = 0; i < n; ++i)
+                        L[i] += EscapedRayRadiance(items[i], *concreteLight, light,
+                                                   lightSampler, restirDI);
+                };
+                light.Dispatch(accumulate);
+            }
+
+            // Update pixel radiance for rays with non-zero radiance
+            for (int i = 0; i < n; ++i)
+                if (L[i]) {
+                    int pixelIndex = items[i].pixelIndex;
+                    L[i] += pixelSampleState.L[pixelIndex];
+                    pixelSampleState.L[pixelIndex] = L[i];
+                }
+        });
+        return;
+    }
+
     ForAllQueued(
         "Handle escaped rays", escapedRayQueue, maxQueueSize,
         PBRT_CPU_GPU_LAMBDA(const EscapedRayWorkItem w) {
             // Compute weighted radiance for escaped ray
             SampledSpectrum L(0.f);
-            for (const auto &light : *infiniteLights) {
-                if (SampledSpectrum Le = light.Le(Ray(w.rayo, w.rayd), w.lambda); Le) {
-                    // Compute path radiance contribution from infinite light
-                    PBRT_DBG("L %f %f %f %f T_hat %f %f %f %f Le %f %f %f %f", L[0], L[1],
-                             L[2], L[3], w.T_hat[0], w.T_hat[1], w.T_hat[2], w.T_hat[3],
-                             Le[0], Le[1], Le[2], Le[3]);
-                    PBRT_DBG("pdf uni %f %f %f %f pdf nee %f %f %f %f", w.uniPathPDF[0],
-                             w.uniPathPDF[1], w.uniPathPDF[2], w.uniPathPDF[3],
-                             w.lightPathPDF[0], w.lightPathPDF[1], w.lightPathPDF[2],
-                             w.lightPathPDF[3]);
-
-                    if (w.depth == 0 || w.specularBounce) {
-                        L += w.T_hat * Le / w.uniPathPDF.Average();
-                    } else {
-                        // Compute MIS-weighted radiance contribution from infinite light
-                        LightSampleContext ctx = w.prevIntrCtx;
-                        Float lightChoicePDF = lightSampler.PDF(ctx, light);
-                        SampledSpectrum lightPathPDF =
-                            w.lightPathPDF * lightChoicePDF *
-                            light.PDF_Li(ctx, w.rayd, LightSamplingMode::WithMIS);
-                        L += w.T_hat * Le / (w.uniPathPDF + lightPathPDF).Average();
-                    }
-                }
-            }
+            for (const auto &light : *infiniteLights)
+                L += EscapedRayRadiance(w, light, light, lightSampler, restirDI);
 
             // Update pixel radiance if ray's radiance is non-zero
             if (L) {
@@ -664,9 +1504,14 @@ void WavefrontPathIntegrator::HandleEscapedRays() {
 }
 
 void WavefrontPathIntegrator::HandleEmissiveIntersection() {
+    if (!hitAreaLightQueue)
+        return;
     ForAllQueued(
         "Handle emitters hit by indirect rays", hitAreaLightQueue, maxQueueSize,
         PBRT_CPU_GPU_LAMBDA(const HitAreaLightWorkItem w) {
+            // Skip emission that reservoir light sampling already accounts for
+            if (restirDI && w.depth == 1 && !w.isSpecularBounce)
+                return;
             // Find emitted radiance from surface that ray hit
             SampledSpectrum Le = w.areaLight.L(w.p, w.n, w.uv, w.wo, w.lambda);
             if (!Le)
@@ -701,20 +1546,26 @@ void WavefrontPathIntegrator::HandleEmissiveIntersection() {
 }
 
 void WavefrontPathIntegrator::TraceShadowRays(int wavefrontDepth) {
+    // With path regeneration, rays are counted by wavefront iteration and the
+    // ones traced after _maxDepth_ iterations are counted in the last bucket
+    int statsDepth = std::max(0, std::min(wavefrontDepth, maxDepth - 1));
     if (haveMedia)
-        aggregate->IntersectShadowTr(maxQueueSize, shadowRayQueue, &pixelSampleState);
+        aggregate->IntersectShadowTr(maxQueueSize, shadowRayQueue, &pixelSampleState,
+                                     residualTracking);
     else
         aggregate->IntersectShadow(maxQueueSize, shadowRayQueue, &pixelSampleState);
     // Reset shadow ray queue
     Do(
         "Reset shadowRayQueue", PBRT_CPU_GPU_LAMBDA() {
-            stats->shadowRays[wavefrontDepth] += shadowRayQueue->Size();
+            stats->shadowRays[statsDepth] += shadowRayQueue->Size();
             shadowRayQueue->Reset();
         });
 }
 
-WavefrontPathIntegrator::Stats::Stats(int maxDepth, Allocator alloc)
-    : indirectRays(maxDepth + 1, alloc), shadowRays(maxDepth, alloc) {}
+WavefrontPathIntegrator::Stats::Stats(int maxDepth, bool haveMedia, Allocator alloc)
+    : indirectRays(maxDepth + 1, alloc),
+      shadowRays(std::max(maxDepth, 1), alloc),
+      mediumRays(haveMedia ? maxDepth + 1 : 0, alloc) {}
 
 std::string WavefrontPathIntegrator::Stats::Print() const {
     std::string s;
@@ -726,6 +1577,10 @@ std::string WavefrontPathIntegrator::Stats::Print() const {
     for (int i = 0; i < shadowRays.size(); ++i)
         s += StringPrintf("    %-42s               %12" PRIu64 "\n",
                           StringPrintf("Shadow rays, depth %-3d", i), shadowRays[i]);
+    for (int i = 0; i < mediumRays.size(); ++i)
+        s += StringPrintf("    %-42s               %12" PRIu64 "\n",
+                          StringPrintf("Medium ray segments, depth %-3d", i),
+                          mediumRays[i]);
     return s;
 }
 
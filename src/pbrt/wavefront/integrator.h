@@ -18,8 +18,11 @@
 #include <pbrt/gpu/util.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
 #include <pbrt/options.h>
+#include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/wavefront/workitems.h>
 #include <pbrt/wavefront/workqueue.h>
 
@@ -46,25 +49,114 @@ class WavefrontAggregate {
     virtual void IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue,
                                  SOA<PixelSampleState> *pixelSampleState) const = 0;
     virtual void IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
-                                   SOA<PixelSampleState> *pixelSampleState) const = 0;
+                                   SOA<PixelSampleState> *pixelSampleState,
+                                   bool residualTracking) const = 0;
 
     virtual void IntersectOneRandom(
         int maxRays, SubsurfaceScatterQueue *subsurfaceScatterQueue) const = 0;
 };
 
+// Returns whether the wavefront integrator's material evaluation kernels are
+// compiled for _ConcreteMaterial_; builds configured with PBRT_WAVEFRONT_MATERIALS
+// only include the kernels for the listed materials.
+template <typename ConcreteMaterial>
+constexpr bool WavefrontMaterialCompiled() {
+#ifdef PBRT_WAVEFRONT_SPECIALIZED_MATERIALS
+    return
+#ifdef PBRT_WAVEFRONT_MATERIAL_COATEDDIFFUSE
+        std::is_same_v<ConcreteMaterial, CoatedDiffuseMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_COATEDCONDUCTOR
+        std::is_same_v<ConcreteMaterial, CoatedConductorMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_CONDUCTOR
+        std::is_same_v<ConcreteMaterial, ConductorMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_DIELECTRIC
+        std::is_same_v<ConcreteMaterial, DielectricMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_DIFFUSE
+        std::is_same_v<ConcreteMaterial, DiffuseMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_DIFFUSETRANSMISSION
+        std::is_same_v<ConcreteMaterial, DiffuseTransmissionMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_HAIR
+        std::is_same_v<ConcreteMaterial, HairMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_MEASURED
+        std::is_same_v<ConcreteMaterial, MeasuredMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_SUBSURFACE
+        std::is_same_v<ConcreteMaterial, SubsurfaceMaterial> ||
+#endif
+#ifdef PBRT_WAVEFRONT_MATERIAL_THINDIELECTRIC
+        std::is_same_v<ConcreteMaterial, ThinDielectricMaterial> ||
+#endif
+        false;
+#else
+    return true;
+#endif
+}
+
 // WavefrontPathIntegrator Definition
 class WavefrontPathIntegrator {
   public:
     // WavefrontPathIntegrator Public Methods
     Float Render();
+    void RenderSamples(int sampleIndex, int nSamples, int yStart, int yEnd,
+                       RGB *displayRGB);
+    void TracePaths(int y0, int y1, int sampleStart, int sampleEnd);
+    void TraceWavefrontDepth(int wavefrontDepth);
 
-    void GenerateCameraRays(int y0, int sampleIndex);
+    void GenerateCameraRays(int y0, int y1, int sampleIndex);
     template <typename Sampler>
-    void GenerateCameraRays(int y0, int sampleIndex);
+    void GenerateCameraRays(int y0, int y1, int sampleIndex);
+    template <typename Sampler>
+    PBRT_CPU_GPU bool GenerateCameraRay(int pixelIndex, Point2i pPixel, int sampleIndex,
+                                        Ray *ray, SampledWavelengths *lambda);
+    template <typename F>
+    void PushCameraRays(const char *description, RayQueue *rayQueue, F generate);
 
-    void GenerateRaySamples(int wavefrontDepth, int sampleIndex);
+    // With light tracing, starts a light path for each pixel sample, splatting
+    // the emitted radiance that reaches the camera at its first vertex
+    void GenerateLightPaths(int y0, int y1, int sampleIndex);
     template <typename Sampler>
-    void GenerateRaySamples(int wavefrontDepth, int sampleIndex);
+    void GenerateLightPaths(int y0, int y1, int sampleIndex);
+    void SplatLightPaths();
+
+    // With the "sppm" integrator, each iteration traces camera paths that record
+    // the pixels' visible points and then photons that deposit their flux at the
+    // visible points around their hits
+    Float RenderSPPM();
+    void StartSPPMPass(int iteration, bool photons);
+    void AddSPPMPathRadiance();
+    void BuildSPPMGrid();
+    void TracePhotons(int photonStart);
+    void GeneratePhotons(int photonStart);
+    void GeneratePhotonSamples(int wavefrontDepth);
+    PBRT_CPU_GPU void DepositPhoton(Point3f p, Vector3f wi, SampledSpectrum beta,
+                                    const SampledWavelengths &lambda);
+    void UpdateSPPMPixels();
+    void WriteSPPMImage(ImageMetadata metadata);
+    // Returns the index of _pPixel_ in arrays over the film's pixel bounds
+    PBRT_CPU_GPU int FilmPixelIndex(Point2i pPixel) const {
+        Bounds2i pixelBounds = film.PixelBounds();
+        int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+        return (pPixel.x - pixelBounds.pMin.x) +
+               (pPixel.y - pixelBounds.pMin.y) * xResolution;
+    }
+
+    // With path regeneration, starts the next sample of the pixels whose
+    // paths have terminated and returns false once no paths remain
+    bool RegeneratePaths(int wavefrontDepth, int sampleEnd);
+    void RegenerateCameraRays(int wavefrontDepth, int sampleEnd);
+    template <typename Sampler>
+    void RegenerateCameraRays(int wavefrontDepth, int sampleEnd);
+
+    void GenerateRaySamples(int wavefrontDepth);
+    template <typename Sampler>
+    void GenerateRaySamples(int wavefrontDepth);
 
     void TraceShadowRays(int wavefrontDepth);
     void SampleMediumInteraction(int wavefrontDepth);
@@ -76,39 +168,91 @@ class WavefrontPathIntegrator {
     void HandleEmissiveIntersection();
 
     void EvaluateMaterialsAndBSDFs(int wavefrontDepth);
+    // Resamples light candidates and the previous sample's reservoirs at this
+    // pixel and nearby ones to choose the light sample at a camera ray's hit
+    template <typename ConcreteBxDF>
+    PBRT_CPU_GPU void SampleReservoirDirectLighting(const BSDF &bsdf,
+                                                    const LightSampleContext &ctx,
+                                                    Point3fi pi, Normal3f n, Normal3f ns,
+                                                    Vector3f wo, Float time,
+                                                    SampledSpectrum T_hat,
+                                                    SampledSpectrum uniPathPDF,
+                                                    const SampledWavelengths &lambda,
+                                                    Float uc, Point2f u, int pixelIndex);
     template <typename ConcreteMaterial>
     void EvaluateMaterialAndBSDF(int wavefrontDepth);
     template <typename ConcreteMaterial, typename TextureEvaluator>
     void EvaluateMaterialAndBSDF(MaterialEvalQueue *evalQueue, int wavefrontDepth);
 
     void UpdateFilm();
+    void UpdateFilmForTerminatedPaths(int sampleEnd);
+    template <typename ConcreteFilm>
+    PBRT_CPU_GPU void AddPixelSample(ConcreteFilm *film, int pixelIndex);
+
+    // Sorts the indices of the first _nItems_ queue items by the keys in
+    // _queueSortKeys_ and returns them in sorted order
+    const int *SortQueueIndices(int nItems);
+    void SortRayQueue(int wavefrontDepth);
 
-    WavefrontPathIntegrator(Allocator alloc, ParsedScene &scene);
+    // The integrator renders using the GPU if _useGPU_ is true and otherwise
+    // using the CPU's threads. If a _film_ is provided, the integrator adds its
+    // samples to it rather than creating one from the scene description.
+    WavefrontPathIntegrator(Allocator alloc, ParsedScene &scene, bool useGPU,
+                            Film film = nullptr);
 
     template <typename F>
     void ParallelFor(const char *description, int nItems, F &&func) {
-        if (Options->useGPU)
+        if (useGPU)
 #ifdef PBRT_BUILD_GPU_RENDERER
             GPUParallelFor(description, nItems, func);
 #else
-            LOG_FATAL("Options->useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
+            LOG_FATAL("useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
 #endif
-        else
+        else {
+            // Descriptions may be temporary strings, so they are copied
+            TraceScope trace("Kernel", "kernel");
+            if (TracingEnabled())
+                trace.SetDetail(description);
+            StatsPerfScope perf(description);
             pbrt::ParallelFor(0, nItems, func);
+        }
+    }
+
+    // Calls _func_ on the CPU with ranges of at most _CPULaneCount_ consecutive
+    // items so that kernels can hoist dynamic dispatch and queue allocation out
+    // of their per-item loops
+    template <typename F>
+    void ParallelForLanes(int nItems, F &&func) {
+        pbrt::ParallelFor(0, nItems, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; i += CPULaneCount)
+                func(int(i), int(std::min<int64_t>(end, i + CPULaneCount)));
+        });
     }
+    static constexpr int CPULaneCount = 64;
 
     template <typename F>
     void Do(const char *description, F &&func) {
-        if (Options->useGPU)
+        if (useGPU)
 #ifdef PBRT_BUILD_GPU_RENDERER
             GPUParallelFor(description, 1, [=] PBRT_GPU(int) mutable { func(); });
 #else
-            LOG_FATAL("Options->useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
+            LOG_FATAL("useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
 #endif
         else
             func();
     }
 
+    template <typename F, typename WorkItem>
+    void ForAllQueued(const char *desc, const WorkQueue<WorkItem> *q, int maxQueued,
+                      F &&func) {
+        pbrt::ForAllQueued(useGPU, desc, q, maxQueued, std::forward<F>(func));
+    }
+    template <typename F, typename WorkItem>
+    void ForAllQueued(const char *desc, const WorkQueue<WorkItem> *q, int maxQueued,
+                      const int *order, F &&func) {
+        pbrt::ForAllQueued(useGPU, desc, q, maxQueued, order, std::forward<F>(func));
+    }
+
     RayQueue *CurrentRayQueue(int wavefrontDepth) {
         return rayQueues[wavefrontDepth & 1];
     }
@@ -117,6 +261,15 @@ class WavefrontPathIntegrator {
     }
 
     // WavefrontPathIntegrator Member Variables
+    bool useGPU;
+    // CUDA device that the integrator renders on when _useGPU_ is set
+    int gpuDevice = 0;
+    // Allocator for the integrator's scene objects and queues
+    Allocator alloc;
+    // Integrators that render bands of each sample's rows into this
+    // integrator's film while it renders the first one: one for each
+    // additional GPU with --multi-gpu and one on the CPU with --hybrid
+    std::vector<WavefrontPathIntegrator *> partners;
     bool initializeVisibleSurface;
     bool haveSubsurface;
     bool haveMedia;
@@ -124,13 +277,17 @@ class WavefrontPathIntegrator {
     pstd::array<bool, Material::NumTags()> haveUniversalEvalMaterial;
 
     struct Stats {
-        Stats(int maxDepth, Allocator alloc);
+        Stats(int maxDepth, bool haveMedia, Allocator alloc);
 
         std::string Print() const;
 
         // Note: not atomics: tid 0 always updates them for everyone...
         uint64_t cameraRays = 0;
         pstd::vector<uint64_t> indirectRays, shadowRays;
+        // Ray segments that start inside a medium; empty if there are no media
+        pstd::vector<uint64_t> mediumRays;
+        // Size of the next ray queue before camera rays are regenerated
+        int queuedRays = 0;
     };
     Stats *stats;
 
@@ -142,10 +299,72 @@ class WavefrontPathIntegrator {
     LightSampler lightSampler;
 
     int maxDepth, samplesPerPixel;
+    // Number of samples per pixel that Render() took, which may be fewer than
+    // _samplesPerPixel_ with --time-limit or --target-mse
+    int samplesRendered = 0;
     bool regularize;
+    // Estimate shadow rays' transmittance with residual ratio tracking
+    bool residualTracking;
 
     int scanlinesPerPass, maxQueueSize;
 
+    // With --regenerate-paths, pixels whose paths terminate start their next
+    // sample right away, so that the queues stay full at deep bounces
+    bool regeneratePaths;
+
+    // With the "lightpath" integrator, paths start at the lights and each
+    // vertex's connection to the camera is splatted at _splatRaster_, with
+    // the film's splats scaled by _splatScale_
+    bool lightTracing;
+    Point2f *splatRaster = nullptr;
+    Float splatScale = 1;
+
+    // With the "sppm" integrator, camera paths end at visible points, which are
+    // stored for the pixels over the film's pixel bounds along with their SPPM
+    // estimates. _sppmPhotonPass_ is set while photons are traced and is only
+    // changed while no kernels are running.
+    bool sppm = false, sppmPhotonPass = false;
+    int sppmIteration = 0, photonsPerIteration = 0;
+    LightSampler photonLightSampler;
+    pstd::vector<DigitPermutation> *photonDigitPermutations = nullptr;
+    SPPMPixelState *sppmPixels = nullptr;
+    SPPMBxDFStorage *sppmBxDFs = nullptr;
+    SPPMGrid sppmGrid;
+    void *sppmScanTemp = nullptr;
+    size_t sppmScanTempBytes = 0;
+    const RGBColorSpace *outputColorSpace = nullptr;
+
+    // With the "restirdi" parameter, direct lighting at camera rays' hits is
+    // sampled using reservoirs that the pixels keep from sample to sample. The
+    // two buffers, indexed by pixel in the film's pixel bounds, alternate between
+    // holding the current and previous samples' reservoirs.
+    bool restirDI = false;
+    int restirCandidates, restirNeighbors;
+    Float restirRadius;
+    DirectLightingReservoir *reservoirs[2] = {nullptr, nullptr};
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    // With --gpu-graphs, the kernels for each wavefront depth are captured in
+    // a CUDA graph the first time they run and the graph is launched after
+    bool useGPUGraphs = false;
+    std::vector<cudaGraphExec_t> depthGraphs;
+#endif  // PBRT_BUILD_GPU_RENDERER
+
+    // With --sort-materials, each material evaluation queue is processed in
+    // order of material instance and texture coordinates
+    bool sortMaterials;
+    // Keys and item indices for sorting queues; the second half of each array
+    // holds the output of the radix sort used on the GPU
+    uint64_t *queueSortKeys = nullptr;
+    int *queueSortIndices = nullptr;
+    void *queueSortTemp = nullptr;
+    size_t queueSortTempBytes = 0;
+    // With --sort-rays, rays are reordered by origin and direction before they
+    // are traced, using _sortedRays_ as scratch storage
+    bool sortRays;
+    Bounds3f sceneBounds;
+    SOA<RayWorkItem> sortedRays;
+
     SOA<PixelSampleState> pixelSampleState;
 
     RayQueue *rayQueues[2];
@@ -108,7 +108,7 @@ inline PBRT_CPU_GPU void EnqueueWorkAfterIntersection(
         return;
     }
 
-    if (intr.areaLight) {
+    if (intr.areaLight && hitAreaLightQueue) {
         PBRT_DBG("Ray hit an area light: adding to hitAreaLightQueue pixel index %d\n",
                  r.pixelIndex);
         Ray ray = r.ray;
@@ -185,7 +185,7 @@ inline PBRT_CPU_GPU void rescale(SampledSpectrum &T_hat, SampledSpectrum &lightP
 template <typename T, typename S>
 inline PBRT_CPU_GPU void TraceTransmittance(ShadowRayWorkItem sr,
                                             SOA<PixelSampleState> *pixelSampleState,
-                                            T trace, S spawnTo) {
+                                            bool residualTracking, T trace, S spawnTo) {
     SampledWavelengths lambda = sr.lambda;
 
     SampledSpectrum Ld = sr.Ld;
@@ -218,48 +218,58 @@ inline PBRT_CPU_GPU void TraceTransmittance(ShadowRayWorkItem sr,
             Float tEnd = !result.hit
                              ? tMax
                              : (Distance(ray.o, Point3f(result.pHit)) / Length(ray.d));
-            SampledSpectrum T_maj = ray.medium.SampleT_maj(
-                ray, tEnd, rng.Uniform<Float>(), rng, lambda,
-                [&](const MediumSample &mediumSample) {
-                    const SampledSpectrum &T_maj = mediumSample.T_maj;
-                    const MediumInteraction &intr = mediumSample.intr;
-                    SampledSpectrum sigma_n = intr.sigma_n();
-
-                    // ratio-tracking: only evaluate null scattering
-                    T_ray *= T_maj * sigma_n;
-                    lightPathPDF *= T_maj * intr.sigma_maj;
-                    uniPathPDF *= T_maj * sigma_n;
-
-                    // Possibly terminate transmittance computation using Russian roulette
-                    SampledSpectrum Tr = T_ray / (lightPathPDF + uniPathPDF).Average();
-                    if (Tr.MaxComponentValue() < 0.05f) {
-                        Float q = 0.75f;
-                        if (rng.Uniform<Float>() < q)
-                            T_ray = SampledSpectrum(0.);
-                        else {
-                            lightPathPDF *= 1 - q;
-                            uniPathPDF *= 1 - q;
-                        }
+            auto updateTransmittance = [&](const MediumSample &mediumSample) {
+                const SampledSpectrum &T_maj = mediumSample.T_maj;
+                const MediumInteraction &intr = mediumSample.intr;
+                SampledSpectrum sigma_n = mediumSample.sigma_n();
+
+                // ratio-tracking: only evaluate null scattering
+                T_ray *= T_maj * sigma_n;
+                lightPathPDF *= T_maj * intr.sigma_maj;
+                uniPathPDF *= T_maj * sigma_n;
+
+                // Possibly terminate transmittance computation using Russian roulette
+                SampledSpectrum Tr = T_ray / (lightPathPDF + uniPathPDF).Average();
+                if (Tr.MaxComponentValue() < 0.05f) {
+                    Float q = 0.75f;
+                    if (rng.Uniform<Float>() < q)
+                        T_ray = SampledSpectrum(0.);
+                    else {
+                        lightPathPDF *= 1 - q;
+                        uniPathPDF *= 1 - q;
                     }
-
-                    PBRT_DBG(
-                        "T_maj %f %f %f %f sigma_n %f %f %f %f sigma_maj %f %f %f %f\n",
-                        T_maj[0], T_maj[1], T_maj[2], T_maj[3], sigma_n[0], sigma_n[1],
-                        sigma_n[2], sigma_n[3], intr.sigma_maj[0], intr.sigma_maj[1],
-                        intr.sigma_maj[2], intr.sigma_maj[3]);
-                    PBRT_DBG("T_ray %f %f %f %f lightPathPDF %f %f %f %f uniPathPDF %f "
-                             "%f %f %f\n",
-                             T_ray[0], T_ray[1], T_ray[2], T_ray[3], lightPathPDF[0],
-                             lightPathPDF[1], lightPathPDF[2], lightPathPDF[3],
-                             uniPathPDF[0], uniPathPDF[1], uniPathPDF[2], uniPathPDF[3]);
-
-                    if (!T_ray)
-                        return false;
-
-                    rescale(T_ray, lightPathPDF, uniPathPDF);
-
-                    return true;
-                });
+                }
+
+                PBRT_DBG(
+                    "T_maj %f %f %f %f sigma_n %f %f %f %f sigma_maj %f %f %f %f\n",
+                    T_maj[0], T_maj[1], T_maj[2], T_maj[3], sigma_n[0], sigma_n[1],
+                    sigma_n[2], sigma_n[3], intr.sigma_maj[0], intr.sigma_maj[1],
+                    intr.sigma_maj[2], intr.sigma_maj[3]);
+                PBRT_DBG("T_ray %f %f %f %f lightPathPDF %f %f %f %f uniPathPDF %f "
+                         "%f %f %f\n",
+                         T_ray[0], T_ray[1], T_ray[2], T_ray[3], lightPathPDF[0],
+                         lightPathPDF[1], lightPathPDF[2], lightPathPDF[3],
+                         uniPathPDF[0], uniPathPDF[1], uniPathPDF[2], uniPathPDF[3]);
+
+                if (!T_ray)
+                    return false;
+
+                rescale(T_ray, lightPathPDF, uniPathPDF);
+
+                return true;
+            };
+            SampledSpectrum T_maj;
+            Float u = rng.Uniform<Float>();
+            if (residualTracking) {
+                // Sample residual extinction and apply control transmittance
+                SampledSpectrum T_c;
+                T_maj = ray.medium.SampleT_res(ray, tEnd, u, rng, lambda, &T_c,
+                                               updateTransmittance);
+                T_ray *= T_c;
+                uniPathPDF *= T_c;
+            } else
+                T_maj = ray.medium.SampleT_maj(ray, tEnd, u, rng, lambda,
+                                               updateTransmittance);
             T_ray *= T_maj;
             lightPathPDF *= T_maj;
             uniPathPDF *= T_maj;
@@ -0,0 +1,115 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/film.h>
+#include <pbrt/lights.h>
+#include <pbrt/lightsamplers.h>
+#include <pbrt/options.h>
+#include <pbrt/samplers.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/vecmath.h>
+#include <pbrt/wavefront/integrator.h>
+
+namespace pbrt {
+
+// WavefrontPathIntegrator Light Path Methods
+void WavefrontPathIntegrator::GenerateLightPaths(int y0, int y1, int sampleIndex) {
+    auto generatePaths = [=](auto sampler) {
+        using ConcreteSampler = std::remove_reference_t<decltype(*sampler)>;
+        if constexpr (!std::is_same_v<ConcreteSampler, MLTSampler> &&
+                      !std::is_same_v<ConcreteSampler, DebugMLTSampler>)
+            GenerateLightPaths<ConcreteSampler>(y0, y1, sampleIndex);
+    };
+
+    sampler.DispatchCPU(generatePaths);
+}
+
+template <typename ConcreteSampler>
+void WavefrontPathIntegrator::GenerateLightPaths(int y0, int y1, int sampleIndex) {
+    RayQueue *rayQueue = CurrentRayQueue(0);
+    ParallelFor(
+        "Generate light paths", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            // Compute pixel coordinates for _pixelIndex_
+            Bounds2i pixelBounds = film.PixelBounds();
+            int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+            Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
+                           y0 + pixelIndex / xResolution);
+            if (pPixel.y >= y1)
+                pPixel.y = pixelBounds.pMax.y;
+            pixelSampleState.pPixel[pixelIndex] = pPixel;
+            pixelSampleState.pathActive[pixelIndex] = 0;
+            pixelSampleState.sampleIndex[pixelIndex] = sampleIndex;
+            pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
+            if (!InsideExclusive(pPixel, pixelBounds))
+                return;
+
+            // Draw the light path's samples from its pixel sample's sampler
+            ConcreteSampler pixelSampler = *sampler.Cast<ConcreteSampler>();
+            pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
+            Float lu = pixelSampler.Get1D();
+            if (GetOptions().disableWavelengthJitter)
+                lu = 0.5f;
+            SampledWavelengths lambda = film.SampleWavelengths(lu);
+            Float ul = pixelSampler.Get1D();
+            Float time = camera.SampleTime(pixelSampler.Get1D());
+            Point2f ul0 = pixelSampler.Get2D(), ul1 = pixelSampler.Get2D();
+            Point2f uCamera = pixelSampler.Get2D();
+
+            // Sample light and point on it to start light path
+            pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ul);
+            if (!sampledLight)
+                return;
+            Light light = sampledLight->light;
+            Float lightPDF = sampledLight->pdf;
+            pstd::optional<LightLeSample> les = light.SampleLe(ul0, ul1, lambda, time);
+            pixelSampleState.lambda[pixelIndex] = lambda;
+            if (!les || les->pdfPos == 0 || les->pdfDir == 0 || !les->L)
+                return;
+
+            // Enqueue shadow ray to the camera for the light's emitted radiance
+            if (les->intr) {
+                pstd::optional<CameraWiSample> cs =
+                    camera.SampleWi(*les->intr, uCamera, lambda);
+                if (cs && cs->pdf != 0) {
+                    Float pdf = light.PDF_Li(LightSampleContext(cs->pLens), cs->wi);
+                    SampledSpectrum Le = light.L(les->intr->p(), les->intr->n,
+                                                 les->intr->uv, cs->wi, lambda);
+                    if (pdf > 0 && Le) {
+                        SampledSpectrum Ld = Le * les->AbsCosTheta(cs->wi) * cs->Wi /
+                                             (lightPDF * pdf * cs->pdf);
+                        splatRaster[pixelIndex] = cs->pRaster;
+                        shadowRayQueue->Push(ShadowRayWorkItem{
+                            cs->pRef.SpawnRayTo(cs->pLens), 1 - ShadowEpsilon, lambda,
+                            Ld, SampledSpectrum(1.f), SampledSpectrum(0.f), pixelIndex});
+                    }
+                }
+            }
+
+            // Enqueue light path ray with its weighted throughput
+            Ray ray = les->ray;
+            SampledSpectrum T_hat = les->L * les->AbsCosTheta(ray.d) /
+                                    (lightPDF * les->pdfPos * les->pdfDir);
+            rayQueue->PushIndirectRay(ray, 0, LightSampleContext(), T_hat,
+                                      SampledSpectrum(1.f), SampledSpectrum(1.f), lambda,
+                                      1.f, false, false, pixelIndex);
+        });
+}
+
+void WavefrontPathIntegrator::SplatLightPaths() {
+    ParallelFor(
+        "Splat light paths", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            // Add radiance of light path's unoccluded camera connection to film
+            SampledSpectrum L = pixelSampleState.L[pixelIndex];
+            if (!L)
+                return;
+            SampledWavelengths lambda = pixelSampleState.lambda[pixelIndex];
+            film.AddSplat(splatRaster[pixelIndex], L, lambda);
+            pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
+        });
+}
+
+}  // namespace pbrt
@@ -46,6 +46,12 @@ struct SampleMediumScatteringCallback {
 void WavefrontPathIntegrator::SampleMediumInteraction(int wavefrontDepth) {
     if (!haveMedia)
         return;
+    // Count the ray segments that start inside media
+    int statsDepth = std::min(wavefrontDepth, maxDepth);
+    Do(
+        "Update medium ray stats", PBRT_CPU_GPU_LAMBDA() {
+            stats->mediumRays[statsDepth] += mediumSampleQueue->Size();
+        });
 
     RayQueue *nextRayQueue = NextRayQueue(wavefrontDepth);
     ForAllQueued(
@@ -271,7 +277,9 @@ void WavefrontPathIntegrator::SampleMediumInteraction(int wavefrontDepth) {
             material.Dispatch(enqueue);
         });
 
-    if (wavefrontDepth == maxDepth)
+    // With path regeneration, paths at all depths are in the queues; items at
+    // the maximum depth are skipped in SampleMediumScattering() instead
+    if (wavefrontDepth == maxDepth && !regeneratePaths)
         return;
 
     ForEachType(SampleMediumScatteringCallback{wavefrontDepth, this},
@@ -290,6 +298,8 @@ void WavefrontPathIntegrator::SampleMediumScattering(int wavefrontDepth) {
         mediumScatterQueue->Get<MediumScatterWorkItem<ConcretePhaseFunction>>(),
         maxQueueSize,
         PBRT_CPU_GPU_LAMBDA(const MediumScatterWorkItem<ConcretePhaseFunction> w) {
+            if (w.depth == maxDepth)
+                return;
             RaySamples raySamples = pixelSampleState.samples[w.pixelIndex];
             Vector3f wo = w.wo;
 
@@ -12,18 +12,18 @@
 namespace pbrt {
 
 // WavefrontPathIntegrator Sampler Methods
-void WavefrontPathIntegrator::GenerateRaySamples(int wavefrontDepth, int sampleIndex) {
+void WavefrontPathIntegrator::GenerateRaySamples(int wavefrontDepth) {
     auto generateSamples = [=](auto sampler) {
         using ConcreteSampler = std::remove_reference_t<decltype(*sampler)>;
         if constexpr (!std::is_same_v<ConcreteSampler, MLTSampler> &&
                       !std::is_same_v<ConcreteSampler, DebugMLTSampler>)
-            GenerateRaySamples<ConcreteSampler>(wavefrontDepth, sampleIndex);
+            GenerateRaySamples<ConcreteSampler>(wavefrontDepth);
     };
     sampler.DispatchCPU(generateSamples);
 }
 
 template <typename ConcreteSampler>
-void WavefrontPathIntegrator::GenerateRaySamples(int wavefrontDepth, int sampleIndex) {
+void WavefrontPathIntegrator::GenerateRaySamples(int wavefrontDepth) {
     // Generate description string _desc_ for ray sample generation
     std::string desc = std::string("Generate ray samples - ") + ConcreteSampler::Name();
 
@@ -32,7 +32,8 @@ void WavefrontPathIntegrator::GenerateRaySamples(int wavefrontDepth, int sampleI
         desc.c_str(), rayQueue, maxQueueSize, PBRT_CPU_GPU_LAMBDA(const RayWorkItem w) {
             // Generate samples for ray segment at current sample index
             // Find first sample dimension
-            int dimension = 6 + 7 * w.depth;
+            // Light paths use 9 dimensions to start, camera paths 6
+            int dimension = (lightTracing ? 9 : 6) + 7 * w.depth;
             if (haveSubsurface)
                 dimension += 3 * w.depth;
             if (haveMedia)
@@ -41,25 +42,44 @@ void WavefrontPathIntegrator::GenerateRaySamples(int wavefrontDepth, int sampleI
             // Initialize _Sampler_ for pixel, sample index, and dimension
             ConcreteSampler pixelSampler = *sampler.Cast<ConcreteSampler>();
             Point2i pPixel = pixelSampleState.pPixel[w.pixelIndex];
+            int sampleIndex = pixelSampleState.sampleIndex[w.pixelIndex];
             pixelSampler.StartPixelSample(pPixel, sampleIndex, dimension);
 
             // Initialize _RaySamples_ structure with sample values
+            // Only ray segments that start inside a medium use the medium samples
             RaySamples rs;
-            rs.direct.uc = pixelSampler.Get1D();
-            rs.direct.u = pixelSampler.Get2D();
-            // Initialize indirect and possibly subsurface and medium samples in _rs_
-            rs.indirect.uc = pixelSampler.Get1D();
-            rs.indirect.u = pixelSampler.Get2D();
-            rs.indirect.rr = pixelSampler.Get1D();
             rs.haveSubsurface = haveSubsurface;
-            if (haveSubsurface) {
-                rs.subsurface.uc = pixelSampler.Get1D();
-                rs.subsurface.u = pixelSampler.Get2D();
-            }
-            rs.haveMedia = haveMedia;
-            if (haveMedia) {
-                rs.media.uDist = pixelSampler.Get1D();
-                rs.media.uMode = pixelSampler.Get1D();
+            rs.haveMedia = haveMedia && w.ray.medium;
+            if constexpr (std::is_same_v<ConcreteSampler, ZSobolSampler>) {
+                // Compute all of the ray's samples with a single pass over the
+                // digits of the Morton index
+                int ss = haveSubsurface ? 1 : 0, m = rs.haveMedia ? 1 : 0;
+                pstd::array<Point2f, 9> u = pixelSampler.template GetSamples<9>(
+                    {1, 2, 1, 2, 1, ss, 2 * ss, m, m});
+                rs.direct.uc = u[0].x;
+                rs.direct.u = u[1];
+                rs.indirect.uc = u[2].x;
+                rs.indirect.u = u[3];
+                rs.indirect.rr = u[4].x;
+                rs.subsurface.uc = u[5].x;
+                rs.subsurface.u = u[6];
+                rs.media.uDist = u[7].x;
+                rs.media.uMode = u[8].x;
+            } else {
+                rs.direct.uc = pixelSampler.Get1D();
+                rs.direct.u = pixelSampler.Get2D();
+                // Initialize indirect and possibly subsurface and medium samples in _rs_
+                rs.indirect.uc = pixelSampler.Get1D();
+                rs.indirect.u = pixelSampler.Get2D();
+                rs.indirect.rr = pixelSampler.Get1D();
+                if (haveSubsurface) {
+                    rs.subsurface.uc = pixelSampler.Get1D();
+                    rs.subsurface.u = pixelSampler.Get2D();
+                }
+                if (rs.haveMedia) {
+                    rs.media.uDist = pixelSampler.Get1D();
+                    rs.media.uMode = pixelSampler.Get1D();
+                }
             }
 
             // Store _RaySamples_ in pixel sample state
@@ -0,0 +1,270 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/film.h>
+#include <pbrt/lights.h>
+#include <pbrt/lightsamplers.h>
+#include <pbrt/options.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/wavefront/integrator.h>
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <cub/cub.cuh>
+#endif  // PBRT_BUILD_GPU_RENDERER
+
+namespace pbrt {
+
+// WavefrontPathIntegrator SPPM Methods
+Float WavefrontPathIntegrator::RenderSPPM() {
+    Timer timer;
+    if (!partners.empty())
+        Warning("The wavefront \"sppm\" integrator only renders using a single device.");
+    if (!Options->displayServer.empty())
+        Warning("The wavefront \"sppm\" integrator does not support --display-server.");
+
+    Bounds2i pixelBounds = film.PixelBounds();
+    int nIterations = samplesPerPixel;
+    ProgressReporter progress(nIterations, "Rendering", Options->quiet, useGPU);
+    for (int iter = 0; iter < nIterations; ++iter) {
+        // Trace camera paths to the pixels' visible points
+        StartSPPMPass(iter, false);
+        for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
+             y0 += scanlinesPerPass) {
+            int y1 = std::min(y0 + scanlinesPerPass, pixelBounds.pMax.y);
+            TracePaths(y0, y1, iter, iter + 1);
+            AddSPPMPathRadiance();
+        }
+        BuildSPPMGrid();
+
+        // Trace photons and accumulate contributions at visible points
+        StartSPPMPass(iter, true);
+        for (int photonStart = 0; photonStart < photonsPerIteration;
+             photonStart += maxQueueSize)
+            TracePhotons(photonStart);
+        UpdateSPPMPixels();
+
+        progress.Update(1);
+        samplesRendered = iter + 1;
+        if (Options->timeLimit && timer.ElapsedSeconds() > *Options->timeLimit) {
+            LOG_VERBOSE("Stopping after %d SPPM iterations for time limit",
+                        samplesRendered);
+            break;
+        }
+    }
+    progress.Done();
+
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU)
+        GPUWait();
+#endif  // PBRT_BUILD_GPU_RENDERER
+    return timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::StartSPPMPass(int iteration, bool photons) {
+    // Wait for the previous pass's kernels, which read the pass's state
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU)
+        GPUWait();
+#endif  // PBRT_BUILD_GPU_RENDERER
+    sppmIteration = iteration;
+    sppmPhotonPass = photons;
+}
+
+void WavefrontPathIntegrator::AddSPPMPathRadiance() {
+    ParallelFor(
+        "Add SPPM path radiance", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            // Add radiance that camera path found to pixel's direct lighting estimate
+            Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+            if (!InsideExclusive(pPixel, film.PixelBounds()))
+                return;
+            SampledSpectrum L = pixelSampleState.L[pixelIndex] *
+                                pixelSampleState.cameraRayWeight[pixelIndex];
+            SPPMPixelState &pixel = sppmPixels[FilmPixelIndex(pPixel)];
+            pixel.Ld += film.ToOutputRGB(L, pixelSampleState.lambda[pixelIndex]);
+        });
+}
+
+void WavefrontPathIntegrator::BuildSPPMGrid() {
+    // Count visible points in each hash bucket
+    int nPixels = film.PixelBounds().Area(), hashSize = sppmGrid.hashSize;
+    ParallelFor(
+        "Reset SPPM grid counts", hashSize + 1,
+        PBRT_CPU_GPU_LAMBDA(int h) { sppmGrid.counts[h].Store(0); });
+    ParallelFor(
+        "Count SPPM visible points", nPixels, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            const SPPMPixelState &pixel = sppmPixels[pixelIndex];
+            if (pixel.vp.beta)
+                sppmGrid.ForEachBucket(pixel.vp.p, pixel.radius,
+                                       [&](int h) { sppmGrid.counts[h].Add(1); });
+        });
+
+    // Compute bucket offsets from the counts
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (useGPU) {
+        CUDA_CHECK(cub::DeviceScan::ExclusiveSum(
+            sppmScanTemp, sppmScanTempBytes, reinterpret_cast<int *>(sppmGrid.counts),
+            sppmGrid.offsets, hashSize + 1, GPULaunchStream()));
+    } else
+#endif  // PBRT_BUILD_GPU_RENDERER
+    {
+        sppmGrid.offsets[0] = 0;
+        for (int h = 0; h < hashSize; ++h)
+            sppmGrid.offsets[h + 1] = sppmGrid.offsets[h] + sppmGrid.counts[h].Load();
+    }
+
+    // Store visible points contiguously in their buckets' ranges of entries
+    ParallelFor(
+        "Initialize SPPM grid insertion points", hashSize,
+        PBRT_CPU_GPU_LAMBDA(int h) { sppmGrid.counts[h].Store(sppmGrid.offsets[h]); });
+    ParallelFor(
+        "Add SPPM visible points to grid", nPixels, PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            const SPPMPixelState &pixel = sppmPixels[pixelIndex];
+            if (!pixel.vp.beta)
+                return;
+            Float radius2 = Sqr(pixel.radius);
+            sppmGrid.ForEachBucket(pixel.vp.p, pixel.radius, [&](int h) {
+                int index = sppmGrid.counts[h].Add(1);
+                sppmGrid.entries[index] = SPPMGridEntry{pixel.vp.p, radius2, pixelIndex};
+            });
+        });
+}
+
+void WavefrontPathIntegrator::TracePhotons(int photonStart) {
+    // Generate photon rays from the lights
+    RayQueue *photonRayQueue = CurrentRayQueue(0);
+    Do(
+        "Reset ray queue", PBRT_CPU_GPU_LAMBDA() { photonRayQueue->Reset(); });
+    GeneratePhotons(photonStart);
+
+    // Follow photon paths until their last deposit at depth _maxDepth_ - 1
+    for (int wavefrontDepth = 0; wavefrontDepth < maxDepth; ++wavefrontDepth)
+        TraceWavefrontDepth(wavefrontDepth);
+}
+
+void WavefrontPathIntegrator::GeneratePhotons(int photonStart) {
+    RayQueue *rayQueue = CurrentRayQueue(0);
+    int iteration = sppmIteration;
+    ParallelFor(
+        "Generate photons", maxQueueSize, PBRT_CPU_GPU_LAMBDA(int index) {
+            // Initialize pixel sample state for photon, which has no pixel
+            pixelSampleState.pPixel[index] = film.PixelBounds().pMax;
+            pixelSampleState.L[index] = SampledSpectrum(0.f);
+            int photonIndex = photonStart + index;
+            pixelSampleState.sampleIndex[index] = photonIndex;
+            if (photonIndex >= photonsPerIteration)
+                return;
+
+            // Compute sample values for photon ray leaving light source
+            // Photons use the same Halton sample dimensions as _SPPMIntegrator_'s
+            uint64_t haltonIndex =
+                uint64_t(iteration) * uint64_t(photonsPerIteration) + photonIndex;
+            const pstd::vector<DigitPermutation> &perms = *photonDigitPermutations;
+            auto sample = [&](int dim) {
+                return ScrambledRadicalInverse(dim, haltonIndex, perms[dim]);
+            };
+            Float ul = sample(0);
+            Point2f uLight0(sample(1), sample(2)), uLight1(sample(3), sample(4));
+            Float time = camera.SampleTime(sample(5));
+            Float lu = GetOptions().disableWavelengthJitter
+                           ? 0.5f
+                           : RadicalInverse(1, iteration);
+            SampledWavelengths lambda = film.SampleWavelengths(lu);
+            pixelSampleState.lambda[index] = lambda;
+
+            // Sample light and photon ray leaving it
+            pstd::optional<SampledLight> sampledLight = photonLightSampler.Sample(ul);
+            if (!sampledLight)
+                return;
+            Light light = sampledLight->light;
+            pstd::optional<LightLeSample> les =
+                light.SampleLe(uLight0, uLight1, lambda, time);
+            if (!les || les->pdfPos == 0 || les->pdfDir == 0 || !les->L)
+                return;
+
+            // Enqueue photon ray with its initial throughput
+            Ray ray = les->ray;
+            SampledSpectrum T_hat = les->L * les->AbsCosTheta(ray.d) /
+                                    (sampledLight->pdf * les->pdfPos * les->pdfDir);
+            rayQueue->PushIndirectRay(ray, 0, LightSampleContext(), T_hat,
+                                      SampledSpectrum(1.f), SampledSpectrum(1.f), lambda,
+                                      1.f, false, false, index);
+        });
+}
+
+void WavefrontPathIntegrator::GeneratePhotonSamples(int wavefrontDepth) {
+    RayQueue *rayQueue = CurrentRayQueue(wavefrontDepth);
+    int iteration = sppmIteration;
+    ForAllQueued(
+        "Generate photon samples", rayQueue, maxQueueSize,
+        PBRT_CPU_GPU_LAMBDA(const RayWorkItem w) {
+            // Continue photon's Halton sample after the light's dimensions
+            uint64_t haltonIndex = uint64_t(iteration) * uint64_t(photonsPerIteration) +
+                                   pixelSampleState.sampleIndex[w.pixelIndex];
+            const pstd::vector<DigitPermutation> &perms = *photonDigitPermutations;
+            int dim = 6 + 4 * w.depth;
+            auto sample = [&](int d) {
+                return ScrambledRadicalInverse(d, haltonIndex, perms[d]);
+            };
+
+            // Photons only use the samples for BSDF sampling and Russian roulette
+            RaySamples rs{};
+            rs.indirect.uc = sample(dim);
+            rs.indirect.u = Point2f(sample(dim + 1), sample(dim + 2));
+            rs.indirect.rr = sample(dim + 3);
+            pixelSampleState.samples[w.pixelIndex] = rs;
+        });
+}
+
+void WavefrontPathIntegrator::UpdateSPPMPixels() {
+    ParallelFor(
+        "Update SPPM pixels", film.PixelBounds().Area(),
+        PBRT_CPU_GPU_LAMBDA(int pixelIndex) {
+            SPPMPixelState &p = sppmPixels[pixelIndex];
+            if (int m = p.m.Load(); m > 0) {
+                // Compute new photon count and search radius given photons
+                Float gamma = (Float)2 / (Float)3;
+                Float nNew = p.n + gamma * m;
+                Float rNew = p.radius * std::sqrt(nNew / (p.n + m));
+
+                // Update $\tau$ for pixel
+                RGB Phi_i(p.Phi_i[0], p.Phi_i[1], p.Phi_i[2]);
+                p.tau = (p.tau + Phi_i) * Sqr(rNew) / Sqr(p.radius);
+
+                // Set remaining pixel values for next photon pass
+                p.n = nNew;
+                p.radius = rNew;
+                p.m.Store(0);
+                for (int c = 0; c < 3; ++c)
+                    p.Phi_i[c] = (Float)0;
+            }
+            // Reset visible point for the next iteration
+            p.vp.beta = SampledSpectrum(0.f);
+        });
+}
+
+void WavefrontPathIntegrator::WriteSPPMImage(ImageMetadata metadata) {
+    // Compute radiance estimates of the SPPM pixels
+    Bounds2i pixelBounds = film.PixelBounds();
+    Image image(PixelFormat::Float, Point2i(pixelBounds.Diagonal()), {"R", "G", "B"});
+    int iterations = std::max(samplesRendered, 1);
+    uint64_t np = uint64_t(iterations) * uint64_t(photonsPerIteration);
+    pbrt::ParallelFor2D(pixelBounds, [&](Point2i pPixel) {
+        const SPPMPixelState &pixel = sppmPixels[FilmPixelIndex(pPixel)];
+        RGB L = pixel.Ld / iterations + pixel.tau / (np * Pi * Sqr(pixel.radius));
+        image.SetChannels(Point2i(pPixel - pixelBounds.pMin), {L.r, L.g, L.b});
+    });
+
+    metadata.pixelBounds = pixelBounds;
+    metadata.fullResolution = film.FullResolution();
+    metadata.colorSpace = outputColorSpace;
+    image.Write(film.GetFilename(), metadata);
+}
+
+}  // namespace pbrt
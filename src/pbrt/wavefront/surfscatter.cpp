@@ -13,10 +13,14 @@
 #include <pbrt/textures.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/containers.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 #include <pbrt/wavefront/integrator.h>
 
+#include <new>
 #include <type_traits>
 
 namespace pbrt {
@@ -39,6 +43,131 @@ static inline void rescale(SampledSpectrum &T_hat, SampledSpectrum &lightPathPDF
     }
 }
 
+PBRT_CPU_GPU
+static inline uint32_t QuantizeTextureCoordinate(Float v) {
+    return Clamp(int(1024 * (v - pstd::floor(v))), 0, 1023);
+}
+
+// Returns a key that orders material evaluation work items by material
+// instance and then by the Morton code of their texture coordinates
+PBRT_CPU_GPU
+static inline uint64_t MaterialSortKey(const void *material, Point2f uv) {
+    uint64_t key = (uint64_t(uintptr_t(material)) >> 4) << 20;
+    return key | EncodeMorton2(QuantizeTextureCoordinate(uv[0]),
+                               QuantizeTextureCoordinate(uv[1]));
+}
+
+// WavefrontPathIntegrator Reservoir Direct Lighting Method Definitions
+template <typename ConcreteBxDF>
+PBRT_CPU_GPU void WavefrontPathIntegrator::SampleReservoirDirectLighting(
+    const BSDF &bsdf, const LightSampleContext &ctx, Point3fi pi, Normal3f n, Normal3f ns,
+    Vector3f wo, Float time, SampledSpectrum T_hat, SampledSpectrum uniPathPDF,
+    const SampledWavelengths &lambda, Float uc, Point2f u, int pixelIndex) {
+    // Find the reservoirs for the pixel sample and the previous one
+    Bounds2i pixelBounds = film.PixelBounds();
+    int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+    int sampleIndex = pixelSampleState.sampleIndex[pixelIndex];
+    auto reservoirIndex = [&](Point2i p) {
+        return (p.x - pixelBounds.pMin.x) + (p.y - pixelBounds.pMin.y) * xResolution;
+    };
+    DirectLightingReservoir *current = reservoirs[sampleIndex & 1];
+    const DirectLightingReservoir *previous = reservoirs[(sampleIndex + 1) & 1];
+
+    // Declare state for the light sample that is chosen by resampling; its target
+    // function is the average of its unshadowed contribution _h_
+    Light selectedLight = nullptr;
+    Point2f selectedU;
+    Float selectedTarget = 0, weightSum = 0;
+    int M = 0;
+    pstd::optional<LightLiSample> selectedLs;
+    SampledSpectrum selectedH(0.f);
+    RNG rng(Hash(uc, u), Hash(pixelIndex));
+
+    // Update the chosen sample with the light sample _(light, uLight)_, which
+    // has resampling weight _weight_, as _m_ candidates would
+    auto update = [&](Light light, Point2f uLight, Float weight, int m,
+                      const pstd::optional<LightLiSample> &ls, SampledSpectrum h) {
+        weightSum += weight;
+        M += m;
+        if (weight > 0 && rng.Uniform<Float>() * weightSum < weight) {
+            selectedLight = light;
+            selectedU = uLight;
+            selectedTarget = h.Average();
+            selectedLs = ls;
+            selectedH = h;
+        }
+    };
+    // Sample the light with _uLight_ and return its unshadowed contribution;
+    // the compensated infinite light distributions only suit MIS with the BSDF
+    auto evaluate = [&](Light light, Point2f uLight, pstd::optional<LightLiSample> *ls) {
+        *ls = light.SampleLi(ctx, uLight, lambda, LightSamplingMode::WithoutMIS);
+        if (!*ls || !(*ls)->L || (*ls)->pdf == 0)
+            return SampledSpectrum(0.f);
+        Vector3f wi = (*ls)->wi;
+        return bsdf.f<ConcreteBxDF>(wo, wi) * AbsDot(wi, ns) * (*ls)->L / (*ls)->pdf;
+    };
+
+    // Resample the light sampler's candidates, starting with the sampler's sample
+    for (int i = 0; i < restirCandidates; ++i) {
+        Float ucLight = (i == 0) ? uc : rng.Uniform<Float>();
+        Point2f uLight =
+            (i == 0) ? u : Point2f(rng.Uniform<Float>(), rng.Uniform<Float>());
+        pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, ucLight);
+        if (!sampledLight) {
+            ++M;
+            continue;
+        }
+        pstd::optional<LightLiSample> ls;
+        SampledSpectrum h = evaluate(sampledLight->light, uLight, &ls);
+        update(sampledLight->light, uLight, h.Average() / sampledLight->pdf, 1, ls, h);
+    }
+
+    // Resample the previous sample's reservoirs at this pixel and nearby ones
+    auto reuse = [&](Point2i p) {
+        if (!InsideExclusive(p, pixelBounds))
+            return;
+        const DirectLightingReservoir &r = previous[reservoirIndex(p)];
+        if (r.sampleIndex != sampleIndex - 1 || r.M == 0 || Dot(r.ns, ns) < 0.9f)
+            return;
+        pstd::optional<LightLiSample> ls;
+        SampledSpectrum h(0.f);
+        if (r.light && r.W > 0)
+            h = evaluate(r.light, r.uLight, &ls);
+        update(r.light, r.uLight, h.Average() * r.W * r.M, r.M, ls, h);
+    };
+    reuse(pPixel);
+    for (int i = 0; i < restirNeighbors; ++i) {
+        Point2f uDisk(rng.Uniform<Float>(), rng.Uniform<Float>());
+        Point2f d = restirRadius * SampleUniformDiskConcentric(uDisk);
+        Point2i offset(pstd::round(d.x), pstd::round(d.y));
+        if (offset != Point2i(0, 0))
+            reuse(pPixel + Vector2i(offset));
+    }
+
+    // Store the pixel's reservoir, limiting how much its sample counts for later
+    DirectLightingReservoir &r = current[reservoirIndex(pPixel)];
+    Float W = selectedTarget > 0 ? weightSum / (M * selectedTarget) : 0;
+    r.light = selectedLight;
+    r.uLight = selectedU;
+    r.W = W;
+    r.M = std::min(M, 20 * restirCandidates);
+    r.sampleIndex = sampleIndex;
+    r.ns = ns;
+
+    // Enqueue shadow ray for the chosen light sample
+    if (!selectedLs || W == 0)
+        return;
+    SampledSpectrum Ld = T_hat * selectedH * W;
+    if (!Ld)
+        return;
+    // The light sample has no MIS weight, so the shadow ray's path PDF is just
+    // that of the path up to the intersection
+    Ray ray = SpawnRayTo(pi, n, time, selectedLs->pLight.pi, selectedLs->pLight.n);
+    shadowRayQueue->Push(ShadowRayWorkItem{ray, 1 - ShadowEpsilon, lambda, Ld,
+                                           SampledSpectrum(0.f), uniPathPDF, pixelIndex});
+}
+
 // EvaluateMaterialCallback Definition
 struct EvaluateMaterialCallback {
     int wavefrontDepth;
@@ -46,12 +175,37 @@ struct EvaluateMaterialCallback {
     // EvaluateMaterialCallback Public Methods
     template <typename ConcreteMaterial>
     void operator()() {
-        if constexpr (!std::is_same_v<ConcreteMaterial, MixMaterial>)
+        if constexpr (!std::is_same_v<ConcreteMaterial, MixMaterial> &&
+                      WavefrontMaterialCompiled<ConcreteMaterial>())
             integrator->EvaluateMaterialAndBSDF<ConcreteMaterial>(wavefrontDepth);
     }
 };
 
 // WavefrontPathIntegrator Surface Scattering Methods
+PBRT_CPU_GPU void WavefrontPathIntegrator::DepositPhoton(
+    Point3f p, Vector3f wi, SampledSpectrum beta, const SampledWavelengths &lambda) {
+    // Add photon contribution to visible points in the grid cell of _p_
+    Point3i pi;
+    if (!sppmGrid.ToGrid(p, &pi))
+        return;
+    int h = sppmGrid.Bucket(pi);
+    for (int i = sppmGrid.offsets[h]; i < sppmGrid.offsets[h + 1]; ++i) {
+        const SPPMGridEntry &entry = sppmGrid.entries[i];
+        if (DistanceSquared(entry.p, p) > entry.radius2)
+            continue;
+        // Update _pixel_ $\Phi$ and $m$ for nearby photon
+        SPPMPixelState &pixel = sppmPixels[entry.pixelIndex];
+        SampledSpectrum Phi = beta * pixel.vp.bsdf.f(pixel.vp.wo, wi);
+        SampledWavelengths l = lambda;
+        if (pixel.vp.secondaryLambdaTerminated)
+            l.TerminateSecondary();
+        RGB Phi_i = film.ToOutputRGB(pixel.vp.beta * Phi, l);
+        for (int c = 0; c < 3; ++c)
+            pixel.Phi_i[c].Add(Phi_i[c]);
+        pixel.m.Add(1);
+    }
+}
+
 void WavefrontPathIntegrator::EvaluateMaterialsAndBSDFs(int wavefrontDepth) {
     ForEachType(EvaluateMaterialCallback{wavefrontDepth, this}, Material::Types());
 }
@@ -62,9 +216,11 @@ void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(int wavefrontDepth) {
     if (haveBasicEvalMaterial[index])
         EvaluateMaterialAndBSDF<ConcreteMaterial, BasicTextureEvaluator>(
             basicEvalMaterialQueue, wavefrontDepth);
+#ifndef PBRT_WAVEFRONT_BASIC_TEXTURES_ONLY
     if (haveUniversalEvalMaterial[index])
         EvaluateMaterialAndBSDF<ConcreteMaterial, UniversalTextureEvaluator>(
             universalEvalMaterialQueue, wavefrontDepth);
+#endif
 }
 
 template <typename ConcreteMaterial, typename TextureEvaluator>
@@ -78,9 +234,45 @@ void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(MaterialEvalQueue *evalQue
 
     RayQueue *nextRayQueue = NextRayQueue(wavefrontDepth);
     auto queue = evalQueue->Get<MaterialEvalWorkItem<ConcreteMaterial>>();
+
+    // Sort the queue's items by material instance and texture coordinates, if
+    // requested, so that nearby threads evaluate the same textures and BSDFs
+    const int *order = nullptr;
+    if (sortMaterials) {
+        uint64_t *keys = queueSortKeys;
+        int *indices = queueSortIndices;
+        // On the CPU, the queue's size is known without waiting for the GPU
+        int nItems = useGPU ? maxQueueSize : queue->Size();
+        ParallelFor(
+            "Compute material sort keys", nItems, PBRT_CPU_GPU_LAMBDA(int index) {
+                indices[index] = index;
+                // Unused entries at the end of the queue sort after the others
+                keys[index] = index < queue->Size()
+                                  ? MaterialSortKey(queue->material[index],
+                                                    queue->uv[index])
+                                  : ~uint64_t(0);
+            });
+        order = SortQueueIndices(nItems);
+    }
+
     ForAllQueued(
-        name.c_str(), queue, maxQueueSize,
+        name.c_str(), queue, maxQueueSize, order,
         PBRT_CPU_GPU_LAMBDA(const MaterialEvalWorkItem<ConcreteMaterial> w) {
+            // Paths at the maximum depth are only in the queue with path regeneration
+            if (w.depth == maxDepth)
+                return;
+            if (sppmPhotonPass) {
+                // Deposit photon at visible points unless it comes from the light
+                if (w.depth > 0)
+                    DepositPhoton(Point3f(w.pi), w.wo, w.T_hat / w.uniPathPDF.Average(),
+                                  w.lambda);
+            } else if (sppm) {
+                // SPPM camera paths only continue past their visible point to
+                // find the emission at the next vertex
+                int vpIndex = FilmPixelIndex(pixelSampleState.pPixel[w.pixelIndex]);
+                if (sppmPixels[vpIndex].vp.beta)
+                    return;
+            }
             // Evaluate material and BSDF for ray intersection
             TextureEvaluator texEval;
             // Compute differentials for position and $(u,v)$ at intersection point
@@ -174,11 +366,32 @@ void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(MaterialEvalQueue *evalQue
                     VisibleSurface(isect, camera.GetCameraTransform(), albedo, lambda);
             }
 
+            // Record SPPM visible point at the first diffuse or final glossy vertex
+            if (sppm && !sppmPhotonPass) {
+                BxDFFlags flags = bsdf.Flags();
+                if (IsDiffuse(flags) || (IsGlossy(flags) && w.depth == maxDepth - 1)) {
+                    // Copy BxDF to the pixel's storage for the visible point's BSDF
+                    int vpIndex = FilmPixelIndex(pixelSampleState.pPixel[w.pixelIndex]);
+                    ConcreteBxDF *vpBxDF = new (&sppmBxDFs[vpIndex]) ConcreteBxDF(bxdf);
+                    SPPMPixelState &pixel = sppmPixels[vpIndex];
+                    pixel.vp.p = Point3f(w.pi);
+                    pixel.vp.wo = w.wo;
+                    pixel.vp.bsdf = BSDF(ns, dpdus, vpBxDF);
+                    SampledSpectrum cameraRayWeight =
+                        pixelSampleState.cameraRayWeight[w.pixelIndex];
+                    pixel.vp.beta = w.T_hat * cameraRayWeight / w.uniPathPDF.Average();
+                    pixel.vp.secondaryLambdaTerminated = lambda.SecondaryTerminated();
+                }
+            }
+
             // Sample BSDF and enqueue indirect ray at intersection point
             Vector3f wo = w.wo;
             RaySamples raySamples = pixelSampleState.samples[w.pixelIndex];
+            TransportMode mode = (lightTracing || sppmPhotonPass)
+                                     ? TransportMode::Importance
+                                     : TransportMode::Radiance;
             pstd::optional<BSDFSample> bsdfSample = bsdf.Sample_f<ConcreteBxDF>(
-                wo, raySamples.indirect.uc, raySamples.indirect.u);
+                wo, raySamples.indirect.uc, raySamples.indirect.u, mode);
             if (bsdfSample) {
                 // Compute updated path throughput and PDFs and enqueue indirect ray
                 Vector3f wi = bsdfSample->wi;
@@ -192,7 +405,7 @@ void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(MaterialEvalQueue *evalQue
 
                 // Update _uniPathPDF_ based on BSDF sample PDF
                 if (bsdfSample->pdfIsProportional) {
-                    Float pdf = bsdf.PDF<ConcreteBxDF>(wo, wi);
+                    Float pdf = bsdf.PDF<ConcreteBxDF>(wo, wi, mode);
                     T_hat *= pdf / bsdfSample->pdf;
                     uniPathPDF *= pdf;
                 } else
@@ -259,8 +472,33 @@ void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(MaterialEvalQueue *evalQue
                 }
             }
 
-            // Sample light and enqueue shadow ray at intersection point
+            // Photons only scatter at surfaces
+            if (sppmPhotonPass)
+                return;
+
             BxDFFlags flags = bsdf.Flags();
+            if (lightTracing) {
+                // Enqueue shadow ray to the camera for light path vertex
+                if (!IsNonSpecular(flags))
+                    return;
+                Interaction intr(w.pi, w.n, w.uv, wo, w.time);
+                pstd::optional<CameraWiSample> cs =
+                    camera.SampleWi(intr, raySamples.direct.u, lambda);
+                if (!cs || cs->pdf == 0)
+                    return;
+                SampledSpectrum f =
+                    bsdf.f<ConcreteBxDF>(wo, cs->wi, TransportMode::Importance);
+                SampledSpectrum Ld = w.T_hat * f * AbsDot(cs->wi, ns) * cs->Wi / cs->pdf;
+                if (!Ld)
+                    return;
+                splatRaster[w.pixelIndex] = cs->pRaster;
+                shadowRayQueue->Push(ShadowRayWorkItem{
+                    cs->pRef.SpawnRayTo(cs->pLens), 1 - ShadowEpsilon, lambda, Ld,
+                    w.uniPathPDF, SampledSpectrum(0.f), w.pixelIndex});
+                return;
+            }
+
+            // Sample light and enqueue shadow ray at intersection point
             if (IsNonSpecular(flags)) {
                 // Choose a light source using the _LightSampler_
                 LightSampleContext ctx(w.pi, w.n, ns);
@@ -268,6 +506,13 @@ void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(MaterialEvalQueue *evalQue
                     ctx.pi = OffsetRayOrigin(ctx.pi, w.n, wo);
                 else if (IsTransmissive(flags) && IsReflective(flags))
                     ctx.pi = OffsetRayOrigin(ctx.pi, w.n, -wo);
+                // Resample direct lighting at camera rays' intersections, if enabled
+                if (restirDI && w.depth == 0) {
+                    SampleReservoirDirectLighting<ConcreteBxDF>(
+                        bsdf, ctx, w.pi, w.n, ns, wo, w.time, w.T_hat, w.uniPathPDF,
+                        lambda, raySamples.direct.uc, raySamples.direct.u, w.pixelIndex);
+                    return;
+                }
                 pstd::optional<SampledLight> sampledLight =
                     lightSampler.Sample(ctx, raySamples.direct.uc);
                 if (!sampledLight)
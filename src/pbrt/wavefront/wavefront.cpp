@@ -7,6 +7,8 @@
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <pbrt/gpu/memory.h>
 #endif // PBRT_BUILD_GPU_RENDERER
+#include <pbrt/parser.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/wavefront/integrator.h>
 
 namespace pbrt {
@@ -16,6 +18,24 @@ void RenderWavefront(ParsedScene &scene) {
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     if (Options->useGPU) {
+        // With multiple GPUs, each integrator allocates its objects and queues
+        // from its own memory resource so that they can be prefetched to the
+        // device that renders with them
+        const std::vector<int> &devices = GPUDevices();
+        auto gpuAllocator = [&]() {
+            return devices.size() > 1 ? Allocator(new CUDATrackedMemoryResource)
+                                      : gpuMemoryAllocator;
+        };
+
+        // The data allocated while parsing is only read while rendering, so
+        // each GPU and the CPU can keep their own copies of it
+        int hasConcurrentManagedAccess;
+        CUDA_CHECK(cudaDeviceGetAttribute(&hasConcurrentManagedAccess,
+                                          cudaDevAttrConcurrentManagedAccess,
+                                          devices[0]));
+        if (hasConcurrentManagedAccess)
+            dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource())
+                ->SetReadMostly();
 #ifdef PBRT_IS_WINDOWS
         // NOTE: on Windows, where only basic unified memory is supported, the
         // WavefrontPathIntegrator itself is *not* allocated using the unified
@@ -23,24 +43,69 @@ void RenderWavefront(ParsedScene &scene) {
         // members (e.g. maxDepth) concurrently while the GPU is rendering.  In
         // turn, the lambda capture for GPU kernels has to capture *this by
         // value (see the definition of PBRT_CPU_GPU_LAMBDA in pbrt/pbrt.h.).
-        integrator = new WavefrontPathIntegrator(gpuMemoryAllocator, scene);
+        integrator = new WavefrontPathIntegrator(gpuAllocator(), scene, true);
 #else
         // With more capable unified memory, the WavefrontPathIntegrator can live in
         // unified memory and some cudaMemAdvise calls, to come shortly, let us
         // have fast read-only access to it on the CPU.
-        integrator =
-            gpuMemoryAllocator.new_object<WavefrontPathIntegrator>(gpuMemoryAllocator, scene);
+        Allocator alloc = gpuAllocator();
+        integrator = alloc.new_object<WavefrontPathIntegrator>(alloc, scene, true);
 #endif
+
+        // Each band of rows needs at least one row of the image
+        int nRows = integrator->film.PixelBounds().Diagonal().y;
+        for (size_t i = 1; i < devices.size(); ++i) {
+            if (int(integrator->partners.size()) + 1 >= nRows) {
+                Warning("Not using GPU device %d for an image with %d rows.", devices[i],
+                        nRows);
+                continue;
+            }
+            // The other GPUs render into the primary GPU's film, which is
+            // accessible to them through managed memory
+            StatsPhase phase("CreateMultiGPUIntegrator");
+            CUDA_CHECK(cudaSetDevice(devices[i]));
+            Allocator alloc = gpuAllocator();
+            integrator->partners.push_back(alloc.new_object<WavefrontPathIntegrator>(
+                alloc, scene, true, integrator->film));
+            CUDA_CHECK(cudaSetDevice(devices[0]));
+        }
+
+        if (Options->hybrid) {
+            // The CPU adds samples to the GPU's film while kernels are running,
+            // which requires that both can access managed memory concurrently
+            if (!hasConcurrentManagedAccess)
+                Warning("Ignoring --hybrid since the GPU doesn't support concurrent "
+                        "access to managed memory.");
+            else if (int(integrator->partners.size()) + 1 >= nRows)
+                Warning("Ignoring --hybrid for an image with %d rows.", nRows);
+            else {
+                StatsPhase phase("CreateHybridCPUIntegrator");
+                integrator->partners.push_back(new WavefrontPathIntegrator(
+                    Allocator(), scene, false, integrator->film));
+            }
+        }
     } else
 #endif // PBRT_BUILD_GPU_RENDERER
-        integrator = new WavefrontPathIntegrator(Allocator(), scene);
+        integrator = new WavefrontPathIntegrator(Allocator(), scene, false);
+
+    // All of the scene's objects have been created from its parameters
+    FreeParsedParameters();
 
     ///////////////////////////////////////////////////////////////////////////
     // Render!
-    Float seconds = integrator->Render();
+    Float seconds;
+    {
+        StatsPhase phase("Render");
+        seconds = integrator->Render();
+    }
 
     LOG_VERBOSE("Total rendering time: %.3f s", seconds);
 
+#ifdef PBRT_BUILD_GPU_RENDERER
+    if (Options->useGPU && !Options->gpuKernelProfile.empty())
+        WriteKernelStats(Options->gpuKernelProfile);
+#endif // PBRT_BUILD_GPU_RENDERER
+
     if (Options->printStatistics) {
 #ifdef PBRT_BUILD_GPU_RENDERER
         if (Options->useGPU)
@@ -49,6 +114,14 @@ void RenderWavefront(ParsedScene &scene) {
 
         Printf("Wavefront integrator statistics:\n");
         Printf("%s\n", integrator->stats->Print());
+        for (const WavefrontPathIntegrator *partner : integrator->partners) {
+            if (partner->useGPU)
+                Printf("GPU device %d wavefront integrator statistics:\n",
+                       partner->gpuDevice);
+            else
+                Printf("Hybrid CPU wavefront integrator statistics:\n");
+            Printf("%s\n", partner->stats->Print());
+        }
     }
 
 #ifdef PBRT_BUILD_GPU_RENDERER
@@ -60,11 +133,13 @@ void RenderWavefront(ParsedScene &scene) {
 #endif // PBRT_BUILD_GPU_RENDERER
 
     ImageMetadata metadata;
-    metadata.samplesPerPixel = integrator->sampler.SamplesPerPixel();
     integrator->camera.InitMetadata(&metadata);
     metadata.renderTimeSeconds = seconds;
-    metadata.samplesPerPixel = integrator->sampler.SamplesPerPixel();
-    integrator->film.WriteImage(metadata);
+    metadata.samplesPerPixel = integrator->samplesRendered;
+    if (integrator->sppm)
+        integrator->WriteSPPMImage(metadata);
+    else
+        integrator->film.WriteImage(metadata, integrator->splatScale);
 }
 
 } // namespace pbrt
@@ -13,10 +13,15 @@
 #include <pbrt/materials.h>
 #include <pbrt/ray.h>
 #include <pbrt/util/containers.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/soa.h>
 #include <pbrt/wavefront/workqueue.h>
 
+#include <algorithm>
+#include <atomic>
+
 namespace pbrt {
 
 // RaySamples Definition
@@ -127,6 +132,143 @@ struct PixelSampleState {
     VisibleSurface visibleSurface;
     SampledSpectrum cameraRayWeight;
     RaySamples samples;
+    int sampleIndex;
+    int pathActive;
+};
+
+// DirectLightingReservoir Definition
+// Light sample chosen by resampling light candidates at a camera ray's hit: the
+// light and the sample values to sample it with, the sample's contribution weight
+// _W_, and the number of candidates _M_ that it was chosen from
+struct DirectLightingReservoir {
+    Light light;
+    Point2f uLight;
+    Float W = 0;
+    int M = 0;
+    // Pixel sample and shading normal that the reservoir was computed for
+    int sampleIndex = -1;
+    Normal3f ns;
+};
+
+// SPPMCounter Definition
+// Integer that the SPPM kernels update with atomic operations on the CPU and GPU
+class SPPMCounter {
+  public:
+    // SPPMCounter Public Methods
+    PBRT_CPU_GPU
+    int Add(int v) {
+#ifdef PBRT_IS_GPU_CODE
+        return atomicAdd(&value, v);
+#else
+        return value.fetch_add(v, std::memory_order_relaxed);
+#endif
+    }
+
+    PBRT_CPU_GPU
+    int Load() const {
+#ifdef PBRT_IS_GPU_CODE
+        return value;
+#else
+        return value.load(std::memory_order_relaxed);
+#endif
+    }
+
+    PBRT_CPU_GPU
+    void Store(int v) {
+#ifdef PBRT_IS_GPU_CODE
+        value = v;
+#else
+        value.store(v, std::memory_order_relaxed);
+#endif
+    }
+
+  private:
+    // SPPMCounter Private Members
+#ifdef PBRT_IS_GPU_CODE
+    int value = 0;
+#else
+    std::atomic<int> value{0};
+#endif
+};
+
+// SPPMPixelState Definition
+// Per-pixel state of the wavefront SPPM integrator, as in _SPPMIntegrator_; the
+// BxDF of the visible point's BSDF is stored in the pixel's _SPPMBxDFStorage_
+struct SPPMPixelState {
+    // SPPMPixelState Public Members
+    Float radius = 0;
+    RGB Ld;
+    struct {
+        Point3f p;
+        Vector3f wo;
+        BSDF bsdf;
+        SampledSpectrum beta;
+        bool secondaryLambdaTerminated;
+    } vp;
+    AtomicFloat Phi_i[3];
+    SPPMCounter m;
+    RGB tau;
+    Float n = 0;
+};
+
+// BxDFStorage Definition
+// Memory that can hold a copy of any of the BxDFs that visible points' BSDFs use
+template <typename Types>
+struct BxDFStorage;
+template <typename... Ts>
+struct alignas(std::max({alignof(Ts)...})) BxDFStorage<TypePack<Ts...>> {
+    uint8_t bytes[std::max({sizeof(Ts)...})];
+};
+using SPPMBxDFStorage = BxDFStorage<BxDF::Types>;
+
+// SPPMGridEntry Definition
+struct SPPMGridEntry {
+    Point3f p;
+    Float radius2;
+    int pixelIndex;
+};
+
+// SPPMGrid Definition
+// Hashed uniform grid over the scene bounds that holds the pass's visible points.
+// The entries of hash bucket _h_ are _entries[offsets[h]]_ through
+// _entries[offsets[h + 1] - 1]_; _counts_ are used to build the grid.
+struct SPPMGrid {
+    // SPPMGrid Public Methods
+    PBRT_CPU_GPU
+    bool ToGrid(Point3f p, Point3i *pi) const {
+        bool inBounds = true;
+        Vector3f pg = bounds.Offset(p);
+        for (int i = 0; i < 3; ++i) {
+            (*pi)[i] = (int)(res[i] * pg[i]);
+            inBounds &= (*pi)[i] >= 0 && (*pi)[i] < res[i];
+            (*pi)[i] = Clamp((*pi)[i], 0, res[i] - 1);
+        }
+        return inBounds;
+    }
+
+    PBRT_CPU_GPU
+    int Bucket(Point3i pi) const { return Hash(pi) % hashSize; }
+
+    // Calls _func_ with the hash bucket of each cell that the sphere around _p_
+    // with radius _r_ overlaps
+    template <typename F>
+    PBRT_CPU_GPU void ForEachBucket(Point3f p, Float r, F func) const {
+        Point3i pMin, pMax;
+        ToGrid(p - Vector3f(r, r, r), &pMin);
+        ToGrid(p + Vector3f(r, r, r), &pMax);
+        for (int z = pMin.z; z <= pMax.z; ++z)
+            for (int y = pMin.y; y <= pMax.y; ++y)
+                for (int x = pMin.x; x <= pMax.x; ++x)
+                    func(Bucket(Point3i(x, y, z)));
+    }
+
+    // SPPMGrid Public Members
+    Bounds3f bounds;
+    int res[3];
+    int hashSize = 0;
+    SPPMCounter *counts = nullptr;
+    int *offsets = nullptr;
+    SPPMGridEntry *entries = nullptr;
 };
 
 // RayWorkItem Definition
@@ -347,6 +489,9 @@ class RayQueue : public WorkQueue<RayWorkItem> {
     // RayQueue Public Methods
     PBRT_CPU_GPU
     int PushCameraRay(const Ray &ray, const SampledWavelengths &lambda, int pixelIndex);
+    PBRT_CPU_GPU
+    void SetCameraRay(int index, const Ray &ray, const SampledWavelengths &lambda,
+                      int pixelIndex);
 
     PBRT_CPU_GPU
     int PushIndirectRay(const Ray &ray, int depth, const LightSampleContext &prevIntrCtx,
@@ -361,6 +506,13 @@ class RayQueue : public WorkQueue<RayWorkItem> {
 inline int RayQueue::PushCameraRay(const Ray &ray, const SampledWavelengths &lambda,
                                    int pixelIndex) {
     int index = AllocateEntry();
+    SetCameraRay(index, ray, lambda, pixelIndex);
+    return index;
+}
+
+PBRT_CPU_GPU
+inline void RayQueue::SetCameraRay(int index, const Ray &ray,
+                                   const SampledWavelengths &lambda, int pixelIndex) {
     DCHECK(!ray.HasNaN());
     this->ray[index] = ray;
     this->depth[index] = 0;
@@ -372,7 +524,6 @@ inline int RayQueue::PushCameraRay(const Ray &ray, const SampledWavelengths &lam
     this->uniPathPDF[index] = SampledSpectrum(1.f);
     this->lightPathPDF[index] = SampledSpectrum(1.f);
     this->isSpecularBounce[index] = false;
-    return index;
 }
 
 PBRT_CPU_GPU
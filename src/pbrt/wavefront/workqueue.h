@@ -33,6 +33,12 @@
 #include <cuda/atomic>
 #endif
 
+// Warp-wide intrinsics can't be used in OptiX programs, which define
+// PBRT_NO_WARP_INTRINSICS
+#if (__CUDA_ARCH__ >= 700) && !defined(PBRT_NO_WARP_INTRINSICS)
+#define PBRT_USE_WARP_AGGREGATED_ATOMICS
+#endif
+
 #endif  // __CUDACC__
 
 namespace pbrt {
@@ -86,12 +92,38 @@ class WorkQueue : public SOA<WorkItem> {
         return index;
     }
 
+    // Reserves _n_ consecutive entries in the queue with a single atomic
+    // operation and returns the index of the first of them
+    PBRT_CPU_GPU
+    int AllocateEntries(int n) {
+#ifdef PBRT_IS_GPU_CODE
+#ifdef PBRT_USE_LEGACY_CUDA_ATOMICS
+        return atomicAdd(&size, n);
+#else
+        return size.fetch_add(n, cuda::std::memory_order_relaxed);
+#endif
+#else
+        return size.fetch_add(n, std::memory_order_relaxed);
+#endif
+    }
+
   protected:
     // WorkQueue Protected Methods
     PBRT_CPU_GPU
     int AllocateEntry() {
 #ifdef PBRT_IS_GPU_CODE
-#ifdef PBRT_USE_LEGACY_CUDA_ATOMICS
+#ifdef PBRT_USE_WARP_AGGREGATED_ATOMICS
+        // Allocate entries for all of the threads in the warp that are pushing
+        // to this queue with a single atomic operation by the lowest of them
+        unsigned int mask = __match_any_sync(__activemask(), (unsigned long long)this);
+        int leader = __ffs(mask) - 1, lane;
+        asm("mov.u32 %0, %%laneid;" : "=r"(lane));
+        int base = 0;
+        if (lane == leader)
+            base = size.fetch_add(__popc(mask), cuda::std::memory_order_relaxed);
+        base = __shfl_sync(mask, base, leader);
+        return base + __popc(mask & ((1u << lane) - 1));
+#elif defined(PBRT_USE_LEGACY_CUDA_ATOMICS)
         return atomicAdd(&size, 1);
 #else
         return size.fetch_add(1, cuda::std::memory_order_relaxed);
@@ -103,39 +135,52 @@ class WorkQueue : public SOA<WorkItem> {
 
   private:
     // WorkQueue Private Members
+    // _size_ is on its own cache line so that CPU threads pushing to the queue
+    // don't also invalidate the SOA array pointers that they all read
 #ifdef PBRT_IS_GPU_CODE
 #ifdef PBRT_USE_LEGACY_CUDA_ATOMICS
-    int size = 0;
+    alignas(64) int size = 0;
 #else
-    cuda::atomic<int, cuda::thread_scope_device> size{0};
+    alignas(64) cuda::atomic<int, cuda::thread_scope_device> size{0};
 #endif
 #else
-    std::atomic<int> size{0};
+    alignas(64) std::atomic<int> size{0};
 #endif  // PBRT_IS_GPU_CODE
 };
 
 // WorkQueue Inline Functions
+// Calls _func_ for each of the items in _q_, visiting them in the order of the
+// item indices in _order_ if it isn't null and in the order they were pushed
+// otherwise.
 template <typename F, typename WorkItem>
-void ForAllQueued(const char *desc, const WorkQueue<WorkItem> *q, int maxQueued,
-                  F &&func) {
-    if (Options->useGPU) {
+void ForAllQueued(bool useGPU, const char *desc, const WorkQueue<WorkItem> *q,
+                  int maxQueued, const int *order, F &&func) {
+    if (useGPU) {
         // Launch GPU threads to process _q_ using _func_
 #ifdef PBRT_BUILD_GPU_RENDERER
         GPUParallelFor(desc, maxQueued, [=] PBRT_GPU(int index) mutable {
             if (index >= q->Size())
                 return;
-            func((*q)[index]);
+            func((*q)[order ? order[index] : index]);
         });
 #else
-        LOG_FATAL("Options->useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
+        LOG_FATAL("useGPU was set without PBRT_BUILD_GPU_RENDERER enabled");
 #endif
 
     } else {
         // Process _q_ using _func_ with CPU threads
-        ParallelFor(0, q->Size(), [&](int index) { func((*q)[index]); });
+        ParallelFor(0, q->Size(),
+                    [&](int index) { func((*q)[order ? order[index] : index]); });
     }
 }
 
+template <typename F, typename WorkItem>
+void ForAllQueued(bool useGPU, const char *desc, const WorkQueue<WorkItem> *q,
+                  int maxQueued, F &&func) {
+    ForAllQueued(useGPU, desc, q, maxQueued, (const int *)nullptr,
+                 std::forward<F>(func));
+}
+
 // MultiWorkQueue Definition
 template <typename T>
 class MultiWorkQueue;
@@ -154,6 +199,15 @@ class MultiWorkQueue<TypePack<Ts...>> {
         ((*Get<Ts>() = WorkQueue<Ts>(haveType[index++] ? n : 1, alloc)), ...);
     }
 
+    // Returns the memory used for each entry of the queues that are allocated
+    // for the given _haveType_
+    static size_t BytesPerItem(pstd::span<const bool> haveType) {
+        int index = 0;
+        size_t bytes = 0;
+        ((bytes += haveType[index++] ? sizeof(Ts) : 0), ...);
+        return bytes;
+    }
+
     template <typename T>
     PBRT_CPU_GPU int Size() const {
         return Get<T>()->Size();